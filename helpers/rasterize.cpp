@@ -0,0 +1,79 @@
+#include <cairo.h>
+#include <librsvg/rsvg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+static void Usage()
+{
+    fprintf( stderr, "Usage: rasterize <source> <destination> <size>...\n" );
+    fprintf( stderr, "  renders the SVG at each size, the destination is a sequence of uint32 size and size*size ARGB32\n" );
+    fprintf( stderr, "  premultiplied pixels, as wl_shm ARGB8888 expects\n" );
+}
+
+int main( int argc, char** argv )
+{
+    if( argc < 4 )
+    {
+        Usage();
+        return 1;
+    }
+
+    const char* source = argv[1];
+    const char* destination = argv[2];
+
+    auto handle = rsvg_handle_new_from_file( source, nullptr );
+    if( !handle )
+    {
+        fprintf( stderr, "Failed to load SVG image %s\n", source );
+        return 1;
+    }
+    rsvg_handle_set_dpi( handle, 96 );
+
+    FILE* dst = fopen( destination, "wb" );
+    if( !dst )
+    {
+        fprintf( stderr, "Failed to open destination file %s\n", destination );
+        g_object_unref( handle );
+        return 1;
+    }
+
+    for( int i=3; i<argc; i++ )
+    {
+        const auto size = atoi( argv[i] );
+        if( size <= 0 )
+        {
+            fprintf( stderr, "Invalid size %s\n", argv[i] );
+            fclose( dst );
+            g_object_unref( handle );
+            return 1;
+        }
+
+        auto surface = cairo_image_surface_create( CAIRO_FORMAT_ARGB32, size, size );
+        auto cr = cairo_create( surface );
+        RsvgRectangle viewport = { 0, 0, double( size ), double( size ) };
+        if( !rsvg_handle_render_document( handle, cr, &viewport, nullptr ) )
+        {
+            fprintf( stderr, "Failed to render %s at %d px\n", source, size );
+            cairo_destroy( cr );
+            cairo_surface_destroy( surface );
+            fclose( dst );
+            g_object_unref( handle );
+            return 1;
+        }
+        cairo_surface_flush( surface );
+
+        const uint32_t sz = size;
+        fwrite( &sz, 1, sizeof( sz ), dst );
+        const auto data = cairo_image_surface_get_data( surface );
+        const auto stride = cairo_image_surface_get_stride( surface );
+        for( int y=0; y<size; y++ ) fwrite( data + y * stride, 1, size * 4, dst );
+
+        cairo_destroy( cr );
+        cairo_surface_destroy( surface );
+    }
+
+    fclose( dst );
+    g_object_unref( handle );
+    return 0;
+}
@@ -50,6 +50,7 @@ int main( int argc, char** argv )
         {
         case 'd':
             SetLogLevel( LogLevel::Callstack );
+            WarmCallstacks();
             break;
         case 'e':
             ShowExternalCallstacks( true );
@@ -71,6 +72,9 @@ int main( int argc, char** argv )
         }
     }
 
+    // Logging from the worker threads would serialize them otherwise
+    SetLogAsync( true );
+
     printf( "Starting " ANSI_BOLD ANSI_ITALIC "Modern Core" ANSI_RESET "…\n\n" );
     printf( "Build id: %s\n\n", GitRef );
 
@@ -3,9 +3,11 @@
 #include <memory>
 #include <vector>
 
+#include "DmabufFeedback.hpp"
 #include "util/NoCopy.hpp"
 
 class GpuDevice;
+class TaskDispatch;
 class VlkInstance;
 
 class Backend
@@ -15,11 +17,15 @@ public:
 
     NoCopy( Backend );
 
-    virtual void VulkanInit() = 0;
+    // Independent per GPU and per output setup may be spread over the workers
+    virtual void VulkanInit( TaskDispatch& td ) = 0;
 
     virtual void Run() = 0;
     virtual void Stop() = 0;
 
+    // Must be called after VulkanInit()
+    [[nodiscard]] virtual DmabufFeedback GetDmabufFeedback() const { return {}; }
+
 protected:
     Backend() = default;
 
@@ -0,0 +1,33 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+class GpuDevice;
+
+// Buffer layouts clients should allocate in, as linux-dmabuf feedback. Allocating for the output which shows the
+// surface allows direct scanout, everything else is composited by the GPU.
+struct DmabufFeedback
+{
+    struct Format
+    {
+        uint32_t format;
+        uint64_t modifier;
+
+        bool operator==( const Format& rhs ) const = default;
+    };
+
+    struct Tranche
+    {
+        dev_t device;
+        bool scanout;
+        std::vector<Format> formats;
+    };
+
+    std::shared_ptr<GpuDevice> gpu;     // Client buffers are imported here. Null if dma-bufs are not supported.
+    dev_t mainDevice = 0;
+    Tranche render;                     // Everything the GPU can sample from
+    std::vector<Tranche> outputs;       // For each output, what its primary plane can scan out
+};
@@ -1,5 +1,7 @@
+#include <algorithm>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/sysmacros.h>
 #include <systemd/sd-device.h>
 #include <systemd/sd-login.h>
 #include <tracy/Tracy.hpp>
@@ -7,13 +9,24 @@
 
 #include "BackendDrm.hpp"
 #include "DbusLoginPaths.hpp"
+#include "DrmConnector.hpp"
 #include "DrmDevice.hpp"
+#include "DrmFormat.hpp"
+#include "InputThread.hpp"
 #include "backend/GpuDevice.hpp"
+#include "dbus/DbusMessage.hpp"
 #include "dbus/DbusSession.hpp"
+#include "server/FrameCallbacks.hpp"
+#include "server/Scene.hpp"
 #include "server/Server.hpp"
+#include "util/ConfigRegistry.hpp"
 #include "util/Panic.hpp"
+#include "util/TaskDispatch.hpp"
+#include "vulkan/VlkDevice.hpp"
 #include "vulkan/VlkInstance.hpp"
 
+constexpr uint32_t InputMajor = 13;
+
 #define DbusCallback( func ) [this] ( DbusMessage msg ) { return func( std::move( msg ) ); }
 
 static bool GetCurrentSession( char*& session, char*& seat )
@@ -61,12 +74,13 @@ static bool GetActiveLocalSession( const char* currentSession, char*& session, c
 }
 
 BackendDrm::BackendDrm()
-    : m_session( nullptr )
+    : m_bus( std::make_unique<DbusSession>() )
+    , m_session( nullptr )
     , m_seat( nullptr )
 {
     ZoneScoped;
 
-    DbusSession bus;
+    auto& bus = *m_bus;
     CheckPanic( bus, "Cannot continue without a valid Dbus connection." );
 
     if( !GetCurrentSession( m_session, m_seat ) )
@@ -111,6 +125,16 @@ BackendDrm::BackendDrm()
     CheckPanic( sd_device_enumerator_add_match_subsystem( e, "drm", true ) >= 0, "Failed to mach drm subsystem" );
     CheckPanic( sd_device_enumerator_add_match_sysname( e, "card[0-9]*" ) >= 0, "Failed to match drm device" );
 
+    // All devices are taken at once, so that the logind round-trips overlap
+    struct Candidate
+    {
+        std::string devName;
+        bool isBoot;
+        dev_t dev = 0;
+        DbusMessage reply;
+    };
+    std::vector<std::unique_ptr<Candidate>> candidates;
+
     for( sd_device* dev = sd_device_enumerator_get_device_first( e ); dev; dev = sd_device_enumerator_get_device_next( e ) )
     {
         const char* seat = nullptr;
@@ -147,11 +171,32 @@ BackendDrm::BackendDrm()
             continue;
         }
 
+        auto candidate = std::make_unique<Candidate>( devName, isBoot );
         try
         {
-            auto drmDevice = std::make_unique<DrmDevice>( devName, bus, m_sessionPath.c_str() );
+            DrmDevice::Take( devName, bus, m_sessionPath.c_str(), [c = candidate.get()]( dev_t dev, DbusMessage reply ) {
+                c->dev = dev;
+                c->reply = std::move( reply );
+            } );
+            candidates.emplace_back( std::move( candidate ) );
+        }
+        catch( DrmDevice::DeviceException& e )
+        {
+            mclog( LogLevel::Debug, "Skipping DRM device %s: %s", devName, e.what() );
+        }
+    }
+
+    sd_device_enumerator_unref( e );
 
-            if( isBoot )
+    CheckPanic( bus.WaitReplies(), "Failed to take DRM devices" );
+
+    for( auto& c : candidates )
+    {
+        try
+        {
+            auto drmDevice = std::make_unique<DrmDevice>( c->devName.c_str(), c->dev, std::move( c->reply ), m_sessionPath.c_str() );
+
+            if( c->isBoot )
             {
                 m_drmDevices.insert( m_drmDevices.begin(), std::move( drmDevice ) );
             }
@@ -162,12 +207,10 @@ BackendDrm::BackendDrm()
         }
         catch( DrmDevice::DeviceException& e )
         {
-            mclog( LogLevel::Debug, "Skipping DRM device %s: %s", devName, e.what() );
+            mclog( LogLevel::Debug, "Skipping DRM device %s: %s", c->devName.c_str(), e.what() );
         }
     }
 
-    sd_device_enumerator_unref( e );
-
     CheckPanic( !m_drmDevices.empty(), "No DRM devices found" );
     mclog( LogLevel::Info, "Found %zu DRM device(s)", m_drmDevices.size() );
 }
@@ -178,55 +221,284 @@ BackendDrm::~BackendDrm()
     free( m_seat );
 }
 
-void BackendDrm::VulkanInit()
+void BackendDrm::VulkanInit( TaskDispatch& td )
 {
     ZoneScoped;
 
+    // Creating a Vulkan device takes long, and the GPUs don't depend on each other
+    std::vector<std::shared_ptr<GpuDevice>> gpus( m_drmDevices.size() );
+    {
+        TaskGroup group;
+        for( size_t i=0; i<m_drmDevices.size(); i++ )
+        {
+            td.Queue( group, [this, i, &gpus] {
+                ZoneScopedN( "GPU setup" );
+                auto& drmDev = m_drmDevices[i];
+                ZoneText( drmDev->Name().c_str(), drmDev->Name().size() );
+                auto physDev = drmDev->MatchPhysicalDevice();
+                if( !physDev )
+                {
+                    mclog( LogLevel::Warning, "Failed to resolve Vulkan device for DRM device '%s'", drmDev->Name().c_str() );
+                    return;
+                }
+                try
+                {
+                    gpus[i] = std::make_shared<GpuDevice>( Server::Instance().VkInstance(), physDev );
+                }
+                catch( const std::exception& e )
+                {
+                    mclog( LogLevel::Fatal, "Failed to initialize GPU: %s", e.what() );
+                }
+            } );
+        }
+        group.Wait();
+    }
+
+    // Device order is kept, the boot GPU stays first
+    auto gpu = gpus.begin();
     auto it = m_drmDevices.begin();
     while( it != m_drmDevices.end() )
     {
-        auto& drmDev = *it;
-        auto physDev = drmDev->MatchPhysicalDevice();
-        if( !physDev )
+        if( *gpu )
         {
-            mclog( LogLevel::Warning, "Failed to resolve Vulkan device for DRM device '%s'", drmDev->Name().c_str() );
-            it = m_drmDevices.erase( it );
+            (*it)->SetGpuDevice( *gpu );
+            m_gpus.emplace_back( std::move( *gpu ) );
+            ++it;
         }
         else
         {
-            try
-            {
-                auto gpu = std::make_shared<GpuDevice>( Server::Instance().VkInstance(), physDev );
-                drmDev->SetGpuDevice( gpu );
-                m_gpus.emplace_back( std::move( gpu ) );
-                ++it;
-            }
-            catch( const std::exception& e )
-            {
-                mclog( LogLevel::Fatal, "Failed to initialize GPU: %s", e.what() );
-                it = m_drmDevices.erase( it );
-            }
+            it = m_drmDevices.erase( it );
+        }
+        ++gpu;
+    }
+
+    // Outputs attached to an integrated GPU are rendered on a discrete one, if there is one, and shared over PRIME
+    const auto config = ConfigRegistry::Instance().Get( "backend-drm.ini" );
+    if( config->Get( "Output", "PrimeRender", 1u ) != 0 )
+    {
+        auto gpu = std::ranges::find_if( m_gpus, []( const auto& g ) { return g->Device()->GetPhysicalDevice()->Properties().deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU; } );
+        if( gpu != m_gpus.end() ) m_renderGpu = *gpu;
+    }
+
+    // 10 bit and half float formats are for HDR output
+    const auto formatName = config->Get( "Output", "Format", "xrgb8888" );
+    auto format = ParseDrmFormat( formatName );
+    if( !format )
+    {
+        mclog( LogLevel::Warning, "Unknown output format '%s'", formatName );
+        format = &DrmFormatXrgb8888;
+    }
+
+    // Buffer allocation and the test commits of each output are independent. Vulkan objects and queues are
+    // locked where they are shared, and the kernel serializes commits on the same device.
+    TaskGroup group;
+    for( auto& dev : m_drmDevices )
+    {
+        for( auto& conn : dev->Connectors() )
+        {
+            if( !conn->IsActive() ) continue;
+            conn->SetFormat( *format );
+            td.Queue( group, [this, conn = conn.get()] {
+                ZoneScopedN( "Output setup" );
+                ZoneText( conn->Name().c_str(), conn->Name().size() );
+                if( !conn->SetModeVulkan( m_renderGpu ) ) mclog( LogLevel::Warning, "Failed to set up buffers for connector %s", conn->Name().c_str() );
+            } );
         }
     }
+    group.Wait();
+}
+
+DmabufFeedback BackendDrm::GetDmabufFeedback() const
+{
+    ZoneScoped;
+
+    // Client buffers are composited on the render GPU, or without PRIME on the first display device
+    DmabufFeedback feedback;
+    auto mainDev = m_renderGpu ? std::ranges::find_if( m_drmDevices, [this]( const auto& d ) { return d->Gpu() == m_renderGpu; } ) : m_drmDevices.begin();
+    if( mainDev == m_drmDevices.end() ) return feedback;
+
+    feedback.gpu = (*mainDev)->Gpu();
+    feedback.mainDevice = (*mainDev)->DeviceId();
+    feedback.render = { feedback.mainDevice, false };
+    for( auto& format : DrmFormats() )
+    {
+        for( auto mod : DeviceModifiers( *feedback.gpu, format.vk, VK_IMAGE_USAGE_SAMPLED_BIT ) )
+        {
+            feedback.render.formats.emplace_back( DmabufFeedback::Format { format.drm, mod } );
+        }
+    }
+
+    for( auto& dev : m_drmDevices )
+    {
+        for( auto& conn : dev->Connectors() )
+        {
+            if( !conn->IsActive() ) continue;
+            feedback.outputs.emplace_back( DmabufFeedback::Tranche { dev->DeviceId(), true, conn->ScanoutFormats( *feedback.gpu ) } );
+        }
+    }
+
+    return feedback;
 }
 
 void BackendDrm::Run()
 {
+    m_bus->Attach( m_loop );
+
+    for( auto& dev : m_drmDevices )
+    {
+        m_loop.AddFd( dev->Descriptor(), EPOLLIN, [&dev]( uint32_t ) { dev->DispatchEvents(); } );
+    }
+
+    // Config files changed on disk are reloaded here, and subscribers pick up the new values on the loop thread
+    auto& registry = ConfigRegistry::Instance();
+    if( registry.Descriptor() >= 0 ) m_loop.AddFd( registry.Descriptor(), EPOLLIN, [&registry]( uint32_t ) { registry.Dispatch(); } );
+
+    // Each output is scheduled on its own, at its own refresh rate
+    const auto config = ConfigRegistry::Instance().Get( "backend-drm.ini" );
+    const auto deadline = config->Get( "Output", "RenderDeadline", 4000u );
+    const auto vrr = config->Get( "Output", "VariableRefresh", 1u ) != 0;
+    const auto hdr = config->Get( "Output", "Hdr", 0u ) != 0;
+    const auto hdrWhite = config->Get( "Output", "HdrWhite", 203u );
+
+    // Outputs are placed side by side in the scene layout. Scene damage schedules a frame on the outputs it
+    // touches, and nothing else does. Surfaces get their frame callbacks from the outputs showing them.
+    auto& scene = Server::Instance().GetScene();
+    auto& frameCallbacks = Server::Instance().GetFrameCallbacks();
+    frameCallbacks.AttachLoop( m_loop );
+    std::vector<Scene::Id> outputs;
+    std::vector<std::pair<DrmConnector*, int32_t>> layout;      // Connectors and their scene x offset
+    int32_t x = 0;
+    int32_t height = 0;
+
+    for( auto& dev : m_drmDevices )
+    {
+        for( auto& conn : dev->Connectors() )
+        {
+            if( !conn->IsActive() ) continue;
+            conn->Scheduler().SetDeadline( deadline );
+            if( conn->IsVrrCapable() ) conn->SetVrr( vrr );
+            if( hdr && conn->IsHdrCapable() && !conn->SetHdr( true, float( hdrWhite ) ) ) mclog( LogLevel::Warning, "Connector %s: HDR output not available", conn->Name().c_str() );
+
+            const auto& mode = conn->Mode();
+            const auto output = scene.AddOutput( { x, 0, x + mode.hdisplay, mode.vdisplay }, [c = conn.get()] { c->Damage(); } );
+            outputs.emplace_back( output );
+            layout.emplace_back( conn.get(), x );
+            x += mode.hdisplay;
+            height = std::max<int32_t>( height, mode.vdisplay );
+
+            // Nothing renders into the outputs yet, so no frame is ever committed
+            conn->AttachLoop( m_loop, [] { return false; }, [&frameCallbacks, output]( uint64_t time ) { frameCallbacks.Presented( output, time ); } );
+        }
+    }
+
+    // Input is read on its own thread. The cursor plane follows the newest pointer position as soon as a batch of
+    // events comes in, before the events themselves are looked at.
+    try
+    {
+        m_input = std::make_unique<InputThread>( m_loop, m_sessionPath.c_str(), m_seat, x, height );
+    }
+    catch( InputThread::InputException& e )
+    {
+        mclog( LogLevel::Warning, "No input: %s", e.what() );
+    }
+    if( m_input )
+    {
+        m_loop.AddFd( m_input->Descriptor(), EPOLLIN, [this, &layout]( uint32_t ) {
+            ZoneScopedN( "Input" );
+            m_input->Acknowledge();
+
+            int32_t cx, cy;
+            m_input->CursorPosition( cx, cy );
+            auto it = std::ranges::find_if( layout, [cx]( const auto& l ) { return cx < l.second + l.first->Mode().hdisplay; } );
+            if( it != layout.end() ) it->first->MoveCursor( cx - it->second, cy );
+
+            // There is no seat to deliver the events to yet
+            InputEvent event;
+            while( m_input->Pop( event ) ) {}
+        } );
+    }
+
+    m_loop.Run();
+
+    if( m_input )
+    {
+        m_loop.RemoveFd( m_input->Descriptor() );
+        m_input.reset();
+    }
+    if( registry.Descriptor() >= 0 ) m_loop.RemoveFd( registry.Descriptor() );
+    frameCallbacks.DetachLoop();
+    for( auto output : outputs ) scene.RemoveOutput( output );
+    for( auto& dev : m_drmDevices )
+    {
+        for( auto& conn : dev->Connectors() ) conn->DetachLoop();
+        m_loop.RemoveFd( dev->Descriptor() );
+    }
 }
 
 void BackendDrm::Stop()
 {
+    m_loop.Stop();
+}
+
+DrmDevice* BackendDrm::FindDevice( uint32_t major, uint32_t minor ) const
+{
+    auto it = std::ranges::find_if( m_drmDevices, [dev = makedev( major, minor )]( const auto& d ) { return d->DeviceId() == dev; } );
+    return it == m_drmDevices.end() ? nullptr : it->get();
 }
 
 int BackendDrm::PauseDevice( DbusMessage msg )
 {
-    mclog( LogLevel::Warning, "PauseDevice not implemented" );
+    ZoneScoped;
+
+    uint32_t major, minor;
+    const char* type;
+    if( !msg.Read( "uus", &major, &minor, &type ) ) return 0;
+
+    // Input devices are revoked along with the session. They are all closed, and taken again once the session, and
+    // with it the DRM devices, resumes.
+    if( major == InputMajor )
+    {
+        if( strcmp( type, "gone" ) != 0 && m_input ) m_input->Suspend();
+        if( strcmp( type, "pause" ) == 0 )
+        {
+            m_bus->CallAsync( []( DbusMessage ) {}, LoginService, m_sessionPath.c_str(), LoginSessionIface, "PauseDeviceComplete", "uu", major, minor );
+        }
+        return 0;
+    }
+
+    auto dev = FindDevice( major, minor );
+    if( !dev ) return 0;
+
+    // GPU resources and buffers stay alive, only KMS access is lost until the device is resumed
+    dev->Pause();
+    if( m_input ) m_input->Suspend();
+
+    // A "pause" waits for the acknowledgement, "force" and "gone" have already revoked the device
+    if( strcmp( type, "pause" ) == 0 )
+    {
+        m_bus->CallAsync( []( DbusMessage ) {}, LoginService, m_sessionPath.c_str(), LoginSessionIface, "PauseDeviceComplete", "uu", major, minor );
+    }
+    else if( strcmp( type, "gone" ) == 0 )
+    {
+        mclog( LogLevel::Warning, "DRM device %s is gone", dev->Name().c_str() );
+    }
     return 0;
 }
 
 int BackendDrm::ResumeDevice( DbusMessage msg )
 {
-    mclog( LogLevel::Warning, "ResumeDevice not implemented" );
+    ZoneScoped;
+
+    // The descriptor is a new reference to the already open device, and is owned by the message
+    uint32_t major, minor;
+    int fd;
+    if( !msg.Read( "uuh", &major, &minor, &fd ) ) return 0;
+
+    auto dev = FindDevice( major, minor );
+    if( !dev ) return 0;
+
+    dev->Resume();
+    if( m_input ) m_input->Resume();
     return 0;
 }
 
@@ -5,10 +5,13 @@
 #include <vector>
 
 #include "backend/Backend.hpp"
+#include "util/EventLoop.hpp"
 #include "util/NoCopy.hpp"
 
 class DbusMessage;
+class DbusSession;
 class DrmDevice;
+class InputThread;
 
 class BackendDrm : public Backend
 {
@@ -18,16 +21,23 @@ public:
 
     NoCopy( BackendDrm );
 
-    void VulkanInit() override;
+    void VulkanInit( TaskDispatch& td ) override;
+    [[nodiscard]] DmabufFeedback GetDmabufFeedback() const override;
 
     void Run() override;
     void Stop() override;
 
 private:
+    [[nodiscard]] DrmDevice* FindDevice( uint32_t major, uint32_t minor ) const;
+
     int PauseDevice( DbusMessage msg );
     int ResumeDevice( DbusMessage msg );
     int PropertiesChanged( DbusMessage msg );
 
+    // Kept for the lifetime of the backend, as the signal callbacks are tied to the session
+    std::unique_ptr<DbusSession> m_bus;
+    EventLoop m_loop;
+
     char* m_session;
     char* m_seat;
 
@@ -35,4 +45,7 @@ private:
     std::string m_seatPath;
 
     std::vector<std::unique_ptr<DrmDevice>> m_drmDevices;
+    std::shared_ptr<GpuDevice> m_renderGpu;     // Null if each output renders on its own device
+
+    std::unique_ptr<InputThread> m_input;       // Only while running
 };
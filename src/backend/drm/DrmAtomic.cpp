@@ -0,0 +1,43 @@
+#include <string.h>
+#include <tracy/Tracy.hpp>
+
+#include "DrmAtomic.hpp"
+#include "util/Logs.hpp"
+#include "util/Panic.hpp"
+
+DrmAtomic::DrmAtomic( int fd )
+    : m_fd( fd )
+    , m_req( drmModeAtomicAlloc() )
+{
+    CheckPanic( m_req, "Failed to allocate atomic request" );
+}
+
+DrmAtomic::~DrmAtomic()
+{
+    drmModeAtomicFree( m_req );
+}
+
+bool DrmAtomic::Add( uint32_t object, uint32_t property, uint64_t value )
+{
+    if( property == 0 ) return false;
+    return drmModeAtomicAddProperty( m_req, object, property, value ) >= 0;
+}
+
+bool DrmAtomic::Test( uint32_t flags ) const
+{
+    ZoneScoped;
+    return drmModeAtomicCommit( m_fd, m_req, flags | DRM_MODE_ATOMIC_TEST_ONLY, nullptr ) == 0;
+}
+
+bool DrmAtomic::Commit( uint32_t flags, void* userData ) const
+{
+    ZoneScoped;
+
+    const auto res = drmModeAtomicCommit( m_fd, m_req, flags, userData );
+    if( res != 0 )
+    {
+        mclog( LogLevel::Warning, "Atomic commit failed: %s", strerror( -res ) );
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stdint.h>
+#include <xf86drmMode.h>
+
+#include "util/NoCopy.hpp"
+
+// Collects object properties into a single atomic KMS request. The request is applied as a whole, or not at all.
+class DrmAtomic
+{
+public:
+    explicit DrmAtomic( int fd );
+    ~DrmAtomic();
+
+    NoCopy( DrmAtomic );
+
+    // Returns false if the property id is 0, i.e. the object does not have the property
+    bool Add( uint32_t object, uint32_t property, uint64_t value );
+
+    // Checks if the driver would accept the request, without touching the hardware
+    [[nodiscard]] bool Test( uint32_t flags = 0 ) const;
+
+    // With DRM_MODE_ATOMIC_PAGE_FLIP_EVENT, the user data is passed to the page flip handler of the device
+    bool Commit( uint32_t flags, void* userData = nullptr ) const;
+
+private:
+    int m_fd;
+    drmModeAtomicReqPtr m_req;
+};
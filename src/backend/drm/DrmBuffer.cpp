@@ -1,7 +1,8 @@
 #include <drm_fourcc.h>
 #include <gbm.h>
-#include <sys/stat.h>
+#include <string.h>
 #include <tracy/Tracy.hpp>
+#include <unistd.h>
 #include <xf86drm.h>
 
 #include "DrmBuffer.hpp"
@@ -9,158 +10,282 @@
 #include "backend/GpuDevice.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
+#include "vulkan/VlkCommandBuffer.hpp"
 #include "vulkan/VlkDevice.hpp"
 #include "vulkan/VlkError.hpp"
-#include "vulkan/VlkProxy.hpp"
+#include "vulkan/VlkImage.hpp"
+#include "vulkan/VlkSemaphore.hpp"
 
 namespace
 {
-bool CheckDisjoint( const std::vector<int>& dmaBufFds )
+VkImageMemoryBarrier2 ForeignBarrier( VkImage image, uint32_t queueFamily, bool acquire, VkImageLayout layout, VkAccessFlags2 access )
 {
-    if( dmaBufFds.size() == 1 ) return false;
-
-    struct stat st_ref, st;
-    if( fstat( dmaBufFds[0], &st_ref ) < 0 ) return false;
-
-    for( size_t i=1; i<dmaBufFds.size(); i++ )
-    {
-        if( fstat( dmaBufFds[i], &st ) < 0 ) return false;
-        if( st.st_ino != st_ref.st_ino ) return true;
-    }
-    return false;
+    return {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = acquire ? VK_PIPELINE_STAGE_2_NONE : VK_PIPELINE_STAGE_2_COPY_BIT,
+        .srcAccessMask = acquire ? VK_ACCESS_2_NONE : access,
+        .dstStageMask = acquire ? VK_PIPELINE_STAGE_2_COPY_BIT : VK_PIPELINE_STAGE_2_NONE,
+        .dstAccessMask = acquire ? access : VK_ACCESS_2_NONE,
+        .oldLayout = acquire ? VK_IMAGE_LAYOUT_GENERAL : layout,
+        .newLayout = acquire ? layout : VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = acquire ? VK_QUEUE_FAMILY_FOREIGN_EXT : queueFamily,
+        .dstQueueFamilyIndex = acquire ? queueFamily : VK_QUEUE_FAMILY_FOREIGN_EXT,
+        .image = image,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+    };
 }
 }
 
-DrmBuffer::DrmBuffer( DrmDevice& device, const drmModeModeInfo& mode, const std::vector<uint64_t>& modifiers )
+DrmBuffer::DrmBuffer( DrmDevice& device, const DrmFormat& format, const drmModeModeInfo& mode, const std::vector<uint64_t>& modifiers )
+    : DrmBuffer( device, format, mode.hdisplay, mode.vdisplay, modifiers )
+{
+}
+
+DrmBuffer::DrmBuffer( DrmDevice& device, const DrmFormat& format, uint32_t width, uint32_t height, const std::vector<uint64_t>& modifiers )
     : m_device( device )
+    , m_renderGpu( device.Gpu() )
+    , m_prime( Prime::None )
+    , m_format( format )
+    , m_width( width )
+    , m_height( height )
 {
     ZoneScoped;
 
-    m_bo = gbm_bo_create_with_modifiers( device, mode.hdisplay, mode.vdisplay, DRM_FORMAT_XRGB8888, modifiers.data(), modifiers.size() );
-    CheckPanic( m_bo, "Failed to create gbm buffer" );
+    m_bo = CreateScanoutBo( modifiers );
+    m_scanout = ImportBo( m_bo, *m_renderGpu, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT );
+    m_renderDone = std::make_shared<VlkSemaphore>( *m_renderGpu->Device(), VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT );
+}
 
-    m_modifier = gbm_bo_get_modifier( m_bo );
-    const auto numPlanes = gbm_bo_get_plane_count( m_bo );
+DrmBuffer::DrmBuffer( DrmDevice& device, std::shared_ptr<GpuDevice> renderGpu, Prime prime, const DrmFormat& format, const drmModeModeInfo& mode, const std::vector<uint64_t>& modifiers )
+    : m_device( device )
+    , m_renderGpu( std::move( renderGpu ) )
+    , m_prime( prime )
+    , m_format( format )
+    , m_width( mode.hdisplay )
+    , m_height( mode.vdisplay )
+{
+    ZoneScoped;
+    CheckPanic( m_prime == Prime::None || m_renderGpu != device.Gpu(), "PRIME buffer rendered on the display GPU" );
 
-    if( GetLogLevel() <= LogLevel::Debug )
+    m_bo = CreateScanoutBo( modifiers );
+    m_renderDone = std::make_shared<VlkSemaphore>( *m_renderGpu->Device(), VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT );
+
+    if( m_prime != Prime::Copy )
     {
-        auto modifierName = drmGetFormatModifierName( m_modifier );
-        mclog( LogLevel::Debug, "Buffer modifier: 0x%llx (%s), num planes: %d", m_modifier, modifierName, numPlanes );
-        free( modifierName );
+        m_scanout = ImportBo( m_bo, *m_renderGpu, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT );
+        return;
     }
 
-    std::vector<int> dmaBufFds( numPlanes );
-    std::vector<uint32_t> pitches( numPlanes );
-    std::vector<uint32_t> offsets( numPlanes );
-    std::vector<VkSubresourceLayout> layouts( numPlanes );
-    for( uint32_t i=0; i<numPlanes; i++ )
-    {
-        dmaBufFds[i] = gbm_bo_get_fd_for_plane( m_bo, i );
+    // Linear is the one layout every GPU can share, but it may not be good for scanout, or not supported by the
+    // display engine at all. The display GPU copies it into a buffer with its own modifiers.
+    const uint64_t linear = DRM_FORMAT_MOD_LINEAR;
+    m_linearBo = gbm_bo_create_with_modifiers( device, m_width, m_height, m_format.drm, &linear, 1 );
+    CheckPanic( m_linearBo, "Failed to create linear gbm buffer" );
 
-        layouts[i].offset = offsets[i] = gbm_bo_get_offset( m_bo, i );
-        layouts[i].rowPitch = pitches[i] = gbm_bo_get_stride_for_plane( m_bo, i );
-        layouts[i].arrayPitch = 0;
-        layouts[i].depthPitch = 0;
+    auto& displayGpu = device.Gpu();
+    m_scanout = ImportBo( m_bo, *displayGpu, VK_IMAGE_USAGE_TRANSFER_DST_BIT );
+    m_linear = ImportBo( m_linearBo, *m_renderGpu, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT );
+    m_copySource = ImportBo( m_linearBo, *displayGpu, VK_IMAGE_USAGE_TRANSFER_SRC_BIT );
 
-        mclog( LogLevel::Debug, "  Plane %d: offset %d, pitch %d", i, layouts[i].offset, layouts[i].rowPitch );
-    }
+    m_copyWait = std::make_shared<VlkSemaphore>( *displayGpu->Device() );
+    m_copyDone = std::make_shared<VlkSemaphore>( *displayGpu->Device(), VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT );
+    RecordCopy();
+}
 
-    std::vector<uint64_t> drmModifiers( numPlanes, m_modifier );
-    CheckPanic( drmModeAddFB2WithModifiers( device.Descriptor(), mode.hdisplay, mode.vdisplay, DRM_FORMAT_XRGB8888, (uint32_t*)dmaBufFds.data(), pitches.data(), offsets.data(), drmModifiers.data(), &m_kmsFb, DRM_MODE_FB_MODIFIERS ), "Failed to create KMS framebuffer" );
+DrmBuffer::~DrmBuffer()
+{
+    m_copy.reset();
+    m_copySource.reset();
+    m_linear.reset();
+    m_scanout.reset();
+    drmModeRmFB( m_device.Descriptor(), m_kmsFb );
+    if( m_linearBo ) gbm_bo_destroy( m_linearBo );
+    gbm_bo_destroy( m_bo );
+}
 
-    const bool disjoint = CheckDisjoint( dmaBufFds );
-    CheckPanic( !disjoint, "Disjoint buffers are not supported" );
+int DrmBuffer::ScanoutFence()
+{
+    ZoneScoped;
 
-    VkImageDrmFormatModifierExplicitCreateInfoEXT modInfo = { VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_EXPLICIT_CREATE_INFO_EXT };
-    modInfo.drmFormatModifier = m_modifier;
-    modInfo.drmFormatModifierPlaneCount = numPlanes;
-    modInfo.pPlaneLayouts = layouts.data();
+    const auto renderFence = m_renderDone->ExportSyncFd();
+    if( m_prime != Prime::Copy ) return renderFence;
+
+    // The import takes ownership of the descriptor
+    if( renderFence >= 0 ) m_copyWait->ImportSyncFd( renderFence );
+
+    const VkSemaphore wait = *m_copyWait;
+    const VkSemaphore signal = *m_copyDone;
+    const VkPipelineStageFlags waitStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
+    const VkCommandBuffer cmdbuf = *m_copy;
+    const VkSubmitInfo submitInfo = {
+        .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO,
+        .waitSemaphoreCount = renderFence >= 0 ? 1u : 0u,
+        .pWaitSemaphores = &wait,
+        .pWaitDstStageMask = &waitStage,
+        .commandBufferCount = 1,
+        .pCommandBuffers = &cmdbuf,
+        .signalSemaphoreCount = 1,
+        .pSignalSemaphores = &signal
+    };
+
+    auto& device = *m_device.Gpu()->Device();
+    device.lock( QueueType::Transfer );
+    const auto res = vkQueueSubmit( device.GetQueue( QueueType::Transfer ), 1, &submitInfo, VK_NULL_HANDLE );
+    device.unlock( QueueType::Transfer );
+    VkVerify( res );
+
+    return m_copyDone->ExportSyncFd();
+}
+
+bool DrmBuffer::Write( const uint8_t* data, uint32_t stride, uint32_t width, uint32_t height )
+{
+    ZoneScoped;
+    CheckPanic( width <= m_width && height <= m_height, "Write larger than the buffer" );
 
-    VkExternalMemoryImageCreateInfo extInfo = { VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO };
-    extInfo.pNext = &modInfo;
-    extInfo.handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+    const auto bpp = m_format.vk == VK_FORMAT_R16G16B16A16_SFLOAT ? 8u : 4u;
 
-    VkImageCreateInfo imageInfo = { VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO };
-    imageInfo.pNext = &extInfo;
-    imageInfo.flags = disjoint ? VK_IMAGE_CREATE_DISJOINT_BIT : 0;
-    imageInfo.imageType = VK_IMAGE_TYPE_2D;
-    imageInfo.format = VK_FORMAT_B8G8R8A8_SRGB;
-    imageInfo.extent.width = mode.hdisplay;
-    imageInfo.extent.height = mode.vdisplay;
-    imageInfo.extent.depth = 1;
-    imageInfo.mipLevels = 1;
-    imageInfo.arrayLayers = 1;
-    imageInfo.samples = VK_SAMPLE_COUNT_1_BIT;
-    imageInfo.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
-    imageInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-    imageInfo.sharingMode = VK_SHARING_MODE_EXCLUSIVE;
-    imageInfo.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+    uint32_t dstStride;
+    void* mapData = nullptr;
+    auto dst = (uint8_t*)gbm_bo_map( m_bo, 0, 0, m_width, m_height, GBM_BO_TRANSFER_WRITE, &dstStride, &mapData );
+    if( !dst ) return false;
 
-    auto& dev = *device.Gpu()->Device();
-    VkVerify( vkCreateImage( dev, &imageInfo, nullptr, &m_image ) );
+    for( uint32_t y=0; y<m_height; y++ )
+    {
+        if( y < height )
+        {
+            memcpy( dst, data, width * bpp );
+            memset( dst + width * bpp, 0, ( m_width - width ) * bpp );
+            data += stride;
+        }
+        else
+        {
+            memset( dst, 0, m_width * bpp );
+        }
+        dst += dstStride;
+    }
 
-    VkMemoryFdPropertiesKHR memFdProps = { VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR };
-    VkVerify( GetMemoryFdPropertiesKHR( dev, VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT, dmaBufFds[0], &memFdProps ) );
+    gbm_bo_unmap( m_bo, mapData );
+    return true;
+}
 
-    VkImageMemoryRequirementsInfo2 memReqInfo = { VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2 };
-    memReqInfo.image = m_image;
+VkImage DrmBuffer::RenderTarget() const
+{
+    return m_prime == Prime::Copy ? *m_linear : *m_scanout;
+}
 
-    VkMemoryRequirements2 memReq = { VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+uint64_t DrmBuffer::Modifier() const
+{
+    return gbm_bo_get_modifier( m_bo );
+}
 
-    vkGetImageMemoryRequirements2( dev, &memReqInfo, &memReq );
-    mclog( LogLevel::Debug, "  Memory requirements: size %d, alignment %d", memReq.memoryRequirements.size, memReq.memoryRequirements.alignment );
+gbm_bo* DrmBuffer::CreateScanoutBo( const std::vector<uint64_t>& modifiers )
+{
+    auto bo = gbm_bo_create_with_modifiers( m_device, m_width, m_height, m_format.drm, modifiers.data(), modifiers.size() );
+    CheckPanic( bo, "Failed to create %s gbm buffer", m_format.name );
 
-    auto memIdx = FindMemoryType( memReq.memoryRequirements.memoryTypeBits & memFdProps.memoryTypeBits, 0 );
-    CheckPanic( memIdx >= 0, "Failed to find suitable memory type" );
+    const auto modifier = gbm_bo_get_modifier( bo );
+    const auto numPlanes = gbm_bo_get_plane_count( bo );
 
-    VkMemoryDedicatedAllocateInfo dedInfo = { VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO };
-    dedInfo.image = m_image;
+    if( GetLogLevel() <= LogLevel::Debug )
+    {
+        auto modifierName = drmGetFormatModifierName( modifier );
+        mclog( LogLevel::Debug, "Buffer format %s, modifier: 0x%llx (%s), num planes: %d", m_format.name, modifier, modifierName, numPlanes );
+        free( modifierName );
+    }
 
-    VkImportMemoryFdInfoKHR importInfo = { VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR };
-    importInfo.pNext = &dedInfo;
-    importInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
-    importInfo.fd = dmaBufFds[0];
+    std::vector<uint32_t> handles( numPlanes );
+    std::vector<uint32_t> pitches( numPlanes );
+    std::vector<uint32_t> offsets( numPlanes );
+    for( int i=0; i<numPlanes; i++ )
+    {
+        handles[i] = gbm_bo_get_handle_for_plane( bo, i ).u32;
+        offsets[i] = gbm_bo_get_offset( bo, i );
+        pitches[i] = gbm_bo_get_stride_for_plane( bo, i );
+    }
 
-    dmaBufFds[0] = -1;      // ownership transferred
+    std::vector<uint64_t> drmModifiers( numPlanes, modifier );
+    CheckPanic( drmModeAddFB2WithModifiers( m_device.Descriptor(), m_width, m_height, m_format.drm, handles.data(), pitches.data(), offsets.data(), drmModifiers.data(), &m_kmsFb, DRM_MODE_FB_MODIFIERS ) == 0, "Failed to create KMS framebuffer" );
 
-    VkMemoryAllocateInfo memInfo = { VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO };
-    memInfo.pNext = &importInfo;
-    memInfo.allocationSize = memReq.memoryRequirements.size;
-    memInfo.memoryTypeIndex = memIdx;
+    return bo;
+}
 
-    VkVerify( vkAllocateMemory( dev, &memInfo, nullptr, &m_memory ) );
+std::shared_ptr<VlkImage> DrmBuffer::ImportBo( gbm_bo* bo, const GpuDevice& gpu, VkImageUsageFlags usage ) const
+{
+    ZoneScoped;
 
-    VkBindImageMemoryInfo bindInfo = { VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO };
-    bindInfo.image = m_image;
-    bindInfo.memory = m_memory;
-    bindInfo.memoryOffset = 0;
+    const auto numPlanes = gbm_bo_get_plane_count( bo );
+    CheckPanic( numPlanes > 0 && numPlanes <= int( VlkImage::DmaBuf::MaxPlanes ), "Invalid number of buffer planes: %d", numPlanes );
+
+    VlkImage::DmaBuf dmaBuf = {
+        .width = m_width,
+        .height = m_height,
+        .format = m_format.vk,
+        .modifier = gbm_bo_get_modifier( bo ),
+        .numPlanes = uint32_t( numPlanes )
+    };
+    for( int i=0; i<numPlanes; i++ )
+    {
+        dmaBuf.fd[i] = gbm_bo_get_fd_for_plane( bo, i );
+        dmaBuf.offset[i] = gbm_bo_get_offset( bo, i );
+        dmaBuf.stride[i] = gbm_bo_get_stride_for_plane( bo, i );
 
-    VkVerify( vkBindImageMemory2( dev, 1, &bindInfo ) );
+        mclog( LogLevel::Debug, "  Plane %d: offset %d, pitch %d", i, dmaBuf.offset[i], dmaBuf.stride[i] );
+    }
 
-    for( auto& fd : dmaBufFds )
+    std::shared_ptr<VlkImage> image;
+    try
     {
-        if( fd != -1 ) close( fd );
+        image = std::make_shared<VlkImage>( *gpu.Device(), dmaBuf, usage );
+    }
+    catch( const VlkImage::ImportException& e )
+    {
+        Panic( "Failed to import gbm buffer: %s", e.what() );
     }
-}
 
-DrmBuffer::~DrmBuffer()
-{
-    auto& dev = *m_device.Gpu()->Device();
-    vkFreeMemory( dev, m_memory, nullptr );
-    vkDestroyImage( dev, m_image, nullptr );
-    drmModeRmFB( m_device.Descriptor(), m_kmsFb );
-    gbm_bo_destroy( m_bo );
+    for( int i=0; i<numPlanes; i++ ) close( dmaBuf.fd[i] );
+    return image;
 }
 
-int DrmBuffer::FindMemoryType( uint32_t typeBits, VkMemoryPropertyFlags properties )
+void DrmBuffer::RecordCopy()
 {
-    const auto& memProps = m_device.Gpu()->Device()->GetPhysicalDevice()->MemoryProperties();
-    for( uint32_t i=0; i<memProps.memoryTypeCount; i++ )
-    {
-        if( (typeBits & (1 << i)) && (memProps.memoryTypes[i].propertyFlags & properties) == properties )
-        {
-            return i;
-        }
-    }
-    return -1;
+    ZoneScoped;
+
+    auto& device = *m_device.Gpu()->Device();
+    const auto queueFamily = device.GetQueueInfo( QueueType::Transfer ).idx;
+
+    // Recorded once, and submitted for each frame. The buffer is not presented again before the previous copy
+    // was scanned out.
+    m_copy = std::make_shared<VlkCommandBuffer>( *device.GetCommandPool( QueueType::Transfer ) );
+    m_copy->Begin( VK_COMMAND_BUFFER_USAGE_SIMULTANEOUS_USE_BIT );
+
+    const VkImageMemoryBarrier2 acquire[] = {
+        ForeignBarrier( *m_copySource, queueFamily, true, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_2_TRANSFER_READ_BIT ),
+        ForeignBarrier( *m_scanout, queueFamily, true, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_2_TRANSFER_WRITE_BIT )
+    };
+    const VkDependencyInfo acquireDeps = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 2,
+        .pImageMemoryBarriers = acquire
+    };
+    vkCmdPipelineBarrier2( *m_copy, &acquireDeps );
+
+    const VkImageCopy region = {
+        .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+        .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+        .extent = { m_width, m_height, 1 }
+    };
+    vkCmdCopyImage( *m_copy, *m_copySource, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, *m_scanout, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region );
+
+    const VkImageMemoryBarrier2 release[] = {
+        ForeignBarrier( *m_copySource, queueFamily, false, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, VK_ACCESS_2_TRANSFER_READ_BIT ),
+        ForeignBarrier( *m_scanout, queueFamily, false, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_ACCESS_2_TRANSFER_WRITE_BIT )
+    };
+    const VkDependencyInfo releaseDeps = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 2,
+        .pImageMemoryBarriers = release
+    };
+    vkCmdPipelineBarrier2( *m_copy, &releaseDeps );
+
+    m_copy->End();
 }
@@ -1,28 +1,83 @@
 #pragma once
 
+#include <memory>
 #include <stdint.h>
 #include <vector>
 #include <vulkan/vulkan.h>
 #include <xf86drmMode.h>
 
+#include "DrmFormat.hpp"
+
 class DrmDevice;
+class GpuDevice;
+class VlkCommandBuffer;
+class VlkImage;
+class VlkSemaphore;
 struct gbm_bo;
 
 class DrmBuffer
 {
 public:
-    DrmBuffer( DrmDevice& device, const drmModeModeInfo& mode, const std::vector<uint64_t>& modifiers );
+    // How a buffer rendered on another GPU reaches the display
+    enum class Prime
+    {
+        None,       // Rendered on the GPU of the display device
+        Direct,     // The render GPU writes the scanout buffer, the modifiers must be supported by both devices
+        Copy        // The render GPU writes a linear buffer, which the display GPU copies for scanout
+    };
+
+    DrmBuffer( DrmDevice& device, const DrmFormat& format, const drmModeModeInfo& mode, const std::vector<uint64_t>& modifiers );
+    DrmBuffer( DrmDevice& device, const DrmFormat& format, uint32_t width, uint32_t height, const std::vector<uint64_t>& modifiers );
+    DrmBuffer( DrmDevice& device, std::shared_ptr<GpuDevice> renderGpu, Prime prime, const DrmFormat& format, const drmModeModeInfo& mode, const std::vector<uint64_t>& modifiers );
     ~DrmBuffer();
 
+    [[nodiscard]] uint32_t Framebuffer() const { return m_kmsFb; }
+    [[nodiscard]] uint32_t Width() const { return m_width; }
+    [[nodiscard]] uint32_t Height() const { return m_height; }
+    [[nodiscard]] auto& Format() const { return m_format; }
+    [[nodiscard]] uint64_t Modifier() const;
+
+    // The image to render into, on the render GPU. Between frames it is owned by
+    // VK_QUEUE_FAMILY_FOREIGN_EXT, in the general layout.
+    [[nodiscard]] VkImage RenderTarget() const;
+    [[nodiscard]] auto& RenderGpu() const { return m_renderGpu; }
+
+    // To be signalled by the submission rendering into the buffer, on the render GPU
+    [[nodiscard]] auto& RenderDone() const { return m_renderDone; }
+
+    // Returns the sync_file scanout has to wait for, or -1 if the buffer is ready. With the copy fallback, this
+    // submits the copy to the transfer queue of the display GPU, behind the rendering.
+    [[nodiscard]] int ScanoutFence();
+
+    // CPU upload of small buffers, such as cursors. The pixels are placed in the top left corner, the rest is
+    // cleared. Returns false if the buffer can't be mapped.
+    bool Write( const uint8_t* data, uint32_t stride, uint32_t width, uint32_t height );
+
 private:
-    int FindMemoryType( uint32_t typeBits, VkMemoryPropertyFlags properties );
+    // Also creates the KMS framebuffer
+    [[nodiscard]] gbm_bo* CreateScanoutBo( const std::vector<uint64_t>& modifiers );
+    [[nodiscard]] std::shared_ptr<VlkImage> ImportBo( gbm_bo* bo, const GpuDevice& gpu, VkImageUsageFlags usage ) const;
+    void RecordCopy();
 
     DrmDevice& m_device;
+    std::shared_ptr<GpuDevice> m_renderGpu;
+    Prime m_prime;
+
+    DrmFormat m_format;
+    uint32_t m_width;
+    uint32_t m_height;
 
     gbm_bo* m_bo;
     uint32_t m_kmsFb;
-    uint64_t m_modifier;
+    std::shared_ptr<VlkImage> m_scanout;
+
+    // Copy fallback only: the linear buffer, imported on both GPUs
+    gbm_bo* m_linearBo = nullptr;
+    std::shared_ptr<VlkImage> m_linear;
+    std::shared_ptr<VlkImage> m_copySource;
+    std::shared_ptr<VlkCommandBuffer> m_copy;
+    std::shared_ptr<VlkSemaphore> m_copyWait;
+    std::shared_ptr<VlkSemaphore> m_copyDone;
 
-    VkImage m_image;
-    VkDeviceMemory m_memory;
+    std::shared_ptr<VlkSemaphore> m_renderDone;
 };
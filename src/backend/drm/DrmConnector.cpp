@@ -1,14 +1,19 @@
 #include <algorithm>
 #include <bit>
+#include <drm_fourcc.h>
 #include <format>
 #include <gbm.h>
+#include <math.h>
 #include <ranges>
 #include <tracy/Tracy.hpp>
+#include <unistd.h>
+#include <xf86drm.h>
 
 extern "C" {
 #include <libdisplay-info/info.h>
 }
 
+#include "DrmAtomic.hpp"
 #include "DrmBuffer.hpp"
 #include "DrmDevice.hpp"
 #include "DrmConnector.hpp"
@@ -17,12 +22,26 @@ extern "C" {
 #include "DrmProperties.hpp"
 #include "backend/GpuDevice.hpp"
 #include "util/Ansi.hpp"
+#include "util/Clock.hpp"
+#include "util/ColorMatrix.hpp"
+#include "util/Colorspace.hpp"
+#include "util/EventLoop.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
+#include "util/TransferCurve.hpp"
 #include "vulkan/VlkDevice.hpp"
 #include "vulkan/VlkError.hpp"
+#include "vulkan/VlkFence.hpp"
+#include "vulkan/VlkFencePool.hpp"
+#include "vulkan/VlkGarbage.hpp"
+#include "vulkan/VlkSemaphore.hpp"
 
 constexpr static int BufferNum = 3;
+constexpr static uint64_t DefaultRenderDeadline = 4000;     // Microseconds
+
+// CTA-861 values, which the kernel does not export
+constexpr static uint8_t HdmiEotfSmpteSt2084 = 2;
+constexpr static uint32_t HdmiStaticMetadataType1 = 0;
 
 static uint32_t GetRefreshRate( const drmModeModeInfo& mode )
 {
@@ -35,9 +54,13 @@ static uint32_t GetRefreshRate( const drmModeModeInfo& mode )
 
 DrmConnector::DrmConnector( DrmDevice& device, uint32_t id, const drmModeRes* res )
     : m_id( id )
+    , m_propCrtcId( 0 )
     , m_monitor( "unknown" )
+    , m_damage( {} )
+    , m_capture( {} )
     , m_device( device )
     , m_mode{}
+    , m_scheduler( 0, DefaultRenderDeadline )
 {
     ZoneScoped;
 
@@ -75,6 +98,16 @@ DrmConnector::DrmConnector( DrmDevice& device, uint32_t id, const drmModeRes* re
         DrmProperties props( device.Descriptor(), conn->connector_id, DRM_MODE_OBJECT_CONNECTOR );
         if( props )
         {
+            m_propCrtcId = props.Id( "CRTC_ID" );
+
+            auto vrr = props["vrr_capable"];
+            m_vrrCapable = vrr && vrr.Value() != 0;
+
+            m_propHdrMetadata = props.Id( "HDR_OUTPUT_METADATA" );
+            auto colorspace = props["Colorspace"];
+            if( colorspace && colorspace.EnumValue( "BT2020_RGB", m_colorspaceBt2020 ) ) m_propColorspace = props.Id( "Colorspace" );
+            bool pq = false;
+
             auto prop = props["EDID"];
             if( prop )
             {
@@ -85,13 +118,21 @@ DrmConnector::DrmConnector( DrmDevice& device, uint32_t id, const drmModeRes* re
                     if( info )
                     {
                         m_monitor = di_info_get_model( info );
+                        if( auto hdr = di_info_get_hdr_static_metadata( info ); hdr )
+                        {
+                            pq = hdr->pq;
+                            m_hdrMaxNits = hdr->desired_content_max_luminance;
+                            m_hdrMinNits = hdr->desired_content_min_luminance;
+                        }
                         di_info_destroy( info );
                     }
                 }
             }
+
+            m_hdrCapable = pq && m_propHdrMetadata != 0 && m_propColorspace != 0;
         }
 
-        mclog( LogLevel::Info, "  Connector %s: %s, %dx%d mm", m_name.c_str(), m_monitor.c_str(), conn->mmWidth, conn->mmHeight );
+        mclog( LogLevel::Info, "  Connector %s: %s, %dx%d mm%s", m_name.c_str(), m_monitor.c_str(), conn->mmWidth, conn->mmHeight, m_hdrCapable ? ", HDR" : "" );
 
         for( int j=0; j<conn->count_modes; j++ )
         {
@@ -106,6 +147,9 @@ DrmConnector::DrmConnector( DrmDevice& device, uint32_t id, const drmModeRes* re
 
 DrmConnector::~DrmConnector()
 {
+    DetachLoop();
+    ReleasePlanes();
+    ClearHdr();
 }
 
 bool DrmConnector::SetMode( const drmModeModeInfo& mode )
@@ -114,8 +158,14 @@ bool DrmConnector::SetMode( const drmModeModeInfo& mode )
 
     if( SetModeDrm( mode ) && SetModeVulkan() ) return true;
 
+    m_buffers.clear();
+    if( m_crtc )
+    {
+        m_crtc->ClearMode();
+        m_crtc->ClearColorPipeline();
+    }
     m_crtc.reset();
-    m_plane.reset();
+    ReleasePlanes();
     m_mode = {};
 
     return false;
@@ -125,6 +175,7 @@ bool DrmConnector::SetModeDrm( const drmModeModeInfo& mode )
 {
     ZoneScoped;
     CheckPanic( m_connected, "Connector is not connected" );
+    CheckPanic( m_propCrtcId != 0, "Connector %s does not support atomic mode setting", m_name.c_str() );
 
     mclog( LogLevel::Info, "  Setting connector %s to %dx%d @ %d Hz", m_name.c_str(), mode.hdisplay, mode.vdisplay, mode.vrefresh );
 
@@ -132,18 +183,42 @@ bool DrmConnector::SetModeDrm( const drmModeModeInfo& mode )
     auto it = std::ranges::find_if( crtcs, []( const auto& c ) { return !c->IsUsed(); } );
     if( it == crtcs.end() ) return false;
 
-    m_plane = GetPlaneForCrtc( **it );
-    if( !m_plane ) return false;
+    auto plane = GetPlaneForCrtc( **it, DRM_PLANE_TYPE_PRIMARY );
+    if( !plane ) return false;
+    if( !(*it)->SetMode( mode ) ) return false;
+
+    ReleasePlanes();
+    m_plane = std::move( plane );
+    m_plane->Claim();
+
+    // Without a cursor plane, the cursor is composited on the GPU
+    m_cursorPlane = GetPlaneForCrtc( **it, DRM_PLANE_TYPE_CURSOR );
+    if( m_cursorPlane ) m_cursorPlane->Claim();
 
     m_buffers.clear();
     m_modifiers.clear();
+    m_bufferFrame.clear();
+    m_damage.Reset( { 0, 0, mode.hdisplay, mode.vdisplay } );
+    m_capture.Reset( { 0, 0, mode.hdisplay, mode.vdisplay } );
     m_mode = mode;
     m_crtc = *it;
+    m_modeset = true;
+    m_vrrDirty = m_vrr;
+
+    if( m_hdr && !SetupHdr() )
+    {
+        mclog( LogLevel::Warning, "  Connector %s: HDR output can't be set up, disabled", m_name.c_str() );
+        m_hdr = false;
+        ClearHdr();
+    }
+
+    const auto refresh = GetRefreshRate( mode );
+    m_scheduler.SetRefreshInterval( refresh != 0 ? 1000000000ull / refresh : 0 );
 
     return true;
 }
 
-bool DrmConnector::SetModeVulkan()
+bool DrmConnector::SetModeVulkan( const std::shared_ptr<GpuDevice>& renderGpu )
 {
     ZoneScoped;
 
@@ -152,35 +227,43 @@ bool DrmConnector::SetModeVulkan()
     CheckPanic( m_modifiers.empty(), "m_modifiers is empty" );
     CheckPanic( m_buffers.empty(), "m_buffers is empty" );
 
-    VkPhysicalDeviceImageDrmFormatModifierInfoEXT modInfo = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_DRM_FORMAT_MODIFIER_INFO_EXT };
-
-    VkPhysicalDeviceExternalImageFormatInfo extInfo = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO };
-    extInfo.pNext = &modInfo;
-    extInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
-
-    VkPhysicalDeviceImageFormatInfo2 formatInfo = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2 };
-    formatInfo.pNext = &extInfo;
-    formatInfo.format = VK_FORMAT_B8G8R8A8_SRGB;
-    formatInfo.type = VK_IMAGE_TYPE_2D;
-    formatInfo.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
-    formatInfo.usage = VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT;
-
-    VkExternalImageFormatProperties extProp = { VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES };
+    const auto& displayGpu = m_device.Gpu();
+    auto prime = DrmBuffer::Prime::None;
 
-    VkImageFormatProperties2 prop = { VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2 };
-    prop.pNext = &extProp;
+    auto format = m_format;
+    if( m_plane->Modifiers( format.drm ).empty() )
+    {
+        mclog( LogLevel::Warning, "  Connector %s can't scan out %s, falling back to %s", m_name.c_str(), format.name, DrmFormatXrgb8888.name );
+        format = DrmFormatXrgb8888;
+    }
+    const auto& planeModifiers = m_plane->Modifiers( format.drm );
 
-    auto& modifiers = m_plane->Modifiers();
-    for( auto mod : modifiers )
+    if( !renderGpu || renderGpu == displayGpu )
+    {
+        m_modifiers = ImportableModifiers( planeModifiers, *displayGpu, format.vk, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT );
+    }
+    else
     {
-        modInfo.drmFormatModifier = mod;
-        auto res = vkGetPhysicalDeviceImageFormatProperties2( *m_device.Gpu()->Device(), &formatInfo, &prop );
-        if( res == VK_ERROR_FORMAT_NOT_SUPPORTED ) continue;
-        VkVerify( res );
-        if( extProp.externalMemoryProperties.externalMemoryFeatures & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT )
+        // Only modifiers which both devices understand can be shared. Between vendors that is usually only linear,
+        // if the display engine can scan it out.
+        m_modifiers = ImportableModifiers( planeModifiers, *renderGpu, format.vk, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT );
+        if( !m_modifiers.empty() )
         {
-            m_modifiers.emplace_back( mod );
+            prime = DrmBuffer::Prime::Direct;
         }
+        else
+        {
+            const std::vector<uint64_t> linear = { DRM_FORMAT_MOD_LINEAR };
+            if( ImportableModifiers( linear, *renderGpu, format.vk, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT ).empty() ||
+                ImportableModifiers( linear, *displayGpu, format.vk, VK_IMAGE_USAGE_TRANSFER_SRC_BIT ).empty() )
+            {
+                mclog( LogLevel::Warning, "  No buffer layout can be shared with the render GPU" );
+                return false;
+            }
+            m_modifiers = ImportableModifiers( planeModifiers, *displayGpu, format.vk, VK_IMAGE_USAGE_TRANSFER_DST_BIT );
+            prime = DrmBuffer::Prime::Copy;
+        }
+        mclog( LogLevel::Info, "  Connector %s is rendered by another GPU, %s", m_name.c_str(), prime == DrmBuffer::Prime::Direct ? "scanout buffers are shared" : "frames are copied for scanout" );
     }
 
     if( m_modifiers.empty() )
@@ -189,40 +272,541 @@ bool DrmConnector::SetModeVulkan()
         return false;
     }
 
-    for( int i=0; i<BufferNum; i++ )
+    // Both sides claiming support for a compressed layout doesn't mean the display engine can scan it out at this
+    // mode, which may be limited by bandwidth, or by the number of planes using compression. Each rank is tested
+    // before falling back to the next one.
+    const auto& gpu = prime == DrmBuffer::Prime::None ? displayGpu : renderGpu;
+    for( auto& modifiers : RankModifiers( m_modifiers ) )
+    {
+        for( int i=0; i<BufferNum; i++ )
+        {
+            m_buffers.emplace_back( std::make_shared<DrmBuffer>( m_device, gpu, prime, format, m_mode, modifiers ) );
+        }
+
+        if( Commit( *m_buffers[0], DRM_MODE_ATOMIC_TEST_ONLY ) )
+        {
+            mclog( LogLevel::Info, "  Connector %s scans out %s, modifier 0x%llx", m_name.c_str(), format.name, (unsigned long long)m_buffers[0]->Modifier() );
+            m_modifiers = std::move( modifiers );
+            return true;
+        }
+
+        mclog( LogLevel::Debug, "  Modifier 0x%llx rejected by the driver", (unsigned long long)m_buffers[0]->Modifier() );
+        m_buffers.clear();
+    }
+
+    mclog( LogLevel::Warning, "  Mode rejected by the driver" );
+    m_modifiers.clear();
+    return false;
+}
+
+bool DrmConnector::Commit( const DrmBuffer& buffer, uint32_t flags, int inFence, int32_t* outFence, uint32_t damageBlob )
+{
+    ZoneScoped;
+    CheckPanic( m_crtc && m_plane, "Connector %s has no mode set", m_name.c_str() );
+
+    DrmAtomic req( m_device.Descriptor() );
+    if( m_modeset )
     {
-        m_buffers.emplace_back( std::make_shared<DrmBuffer>( m_device, m_mode, m_modifiers ) );
+        req.Add( m_id, m_propCrtcId, m_crtc->Id() );
+        m_crtc->Enable( req );
+        AddHdr( req );
+        flags |= DRM_MODE_ATOMIC_ALLOW_MODESET;
     }
+    m_plane->Attach( req, m_crtc->Id(), buffer.Framebuffer(), 0, 0, buffer.Width(), buffer.Height(), inFence );
+    if( damageBlob ) m_plane->SetDamage( req, damageBlob );
+    AddPlanes( req );
+    if( m_vrrDirty ) m_crtc->SetVrr( req, m_vrr );
+    if( outFence && !m_crtc->RequestOutFence( req, outFence ) ) outFence = nullptr;
+
+    if( flags & DRM_MODE_ATOMIC_TEST_ONLY ) return req.Test( flags );
+    if( !req.Commit( flags, this ) ) return false;
+
+    m_modeset = false;
+    m_shown = &buffer;
+    Committed();
+    return true;
+}
+
+Region DrmConnector::BeginFrame( const DrmBuffer& buffer, const Region& damage )
+{
+    ZoneScoped;
+
+    const auto frame = ++m_frameCount;
+    auto it = m_bufferFrame.find( &buffer );
+    const auto age = it == m_bufferFrame.end() ? 0 : frame - it->second;
+    m_bufferFrame[&buffer] = frame;
 
-#if 0
-    // todo
-    assert( !m_bo );
+    auto repaint = m_damage.Frame( damage, uint32_t( std::min<uint64_t>( age, UINT32_MAX ) ) );
+    TracyPlot( "Repaint area (%)", float( repaint.Area() * 100.0 / ( uint64_t( m_mode.hdisplay ) * m_mode.vdisplay ) ) );
+    return repaint;
+}
+
+bool DrmConnector::Present( DrmBuffer& buffer, const Region& damage, std::vector<std::shared_ptr<VlkBase>>&& release )
+{
+    ZoneScoped;
 
-    m_bo = gbm_bo_create( m_device, m_mode.hdisplay, m_mode.vdisplay, GBM_FORMAT_XRGB8888, GBM_BO_USE_SCANOUT | GBM_BO_USE_RENDERING );
-    if( !m_bo ) return false;
+    if( m_flipPending || m_paused ) return false;
 
-    if( drmModeAddFB( m_device.Descriptor(), m_mode.hdisplay, m_mode.vdisplay, 24, 32, gbm_bo_get_stride( m_bo ), gbm_bo_get_handle( m_bo ).u32, &m_fbId ) != 0 )
+    // The blob can go right after the commit, the plane state keeps its own reference
+    static_assert( sizeof( Region::Rect ) == sizeof( drm_mode_rect ) );
+    uint32_t damageBlob = 0;
+    if( !damage.IsEmpty() && m_plane->HasDamageClips() )
     {
-        gbm_bo_destroy( m_bo );
-        m_bo = nullptr;
-        return false;
+        auto clipped = damage;
+        clipped.Intersect( { 0, 0, int32_t( buffer.Width() ), int32_t( buffer.Height() ) } );
+        const auto& rects = clipped.Rects();
+        if( drmModeCreatePropertyBlob( m_device.Descriptor(), rects.data(), rects.size() * sizeof( Region::Rect ), &damageBlob ) != 0 ) damageBlob = 0;
     }
 
-    auto _mode = m_mode;
-    if( drmModeSetCrtc( m_device.Descriptor(), m_crtc->GetId(), m_fbId, 0, 0, &m_id, 1, &_mode ) != 0 )
+    // The kernel takes its own reference to the in fence
+    const auto inFence = buffer.ScanoutFence();
+    int32_t outFence = -1;
+    const auto ok = Commit( buffer, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, inFence, release.empty() ? nullptr : &outFence, damageBlob );
+    if( inFence >= 0 ) close( inFence );
+    if( damageBlob ) drmModeDestroyPropertyBlob( m_device.Descriptor(), damageBlob );
+    if( !ok ) return false;
+
+    m_flipPending = true;
+    m_frameFlip = true;
+    if( release.empty() ) return true;
+
+    auto& device = m_device.Gpu()->Device();
+    if( outFence >= 0 )
     {
-        drmModeRmFB( m_device.Descriptor(), m_fbId );
-        gbm_bo_destroy( m_bo );
-        m_bo = nullptr;
+        auto fence = device->GetFencePool()->Acquire();
+        if( fence->ImportSyncFd( outFence ) )
+        {
+            device->GetGarbage()->Recycle( std::move( fence ), std::move( release ) );
+            return true;
+        }
+        close( outFence );
+    }
+
+    // Without an out fence, the page flip event tells when the previous frame is gone
+    m_flipRelease.insert( m_flipRelease.end(), std::make_move_iterator( release.begin() ), std::make_move_iterator( release.end() ) );
+    return true;
+}
+
+void DrmConnector::PageFlip( uint32_t sequence, uint64_t time )
+{
+    ZoneScoped;
+
+    if( m_flipTime != 0 ) TracyPlot( "Page flip interval (ms)", ( time - m_flipTime ) / 1000.f );
+    if( m_flipSequence != 0 && sequence - m_flipSequence > 1 ) mclog( LogLevel::Debug, "Connector %s: missed %u vblanks", m_name.c_str(), sequence - m_flipSequence - 1 );
+
+    if( m_frameFlip )
+    {
+        m_scheduler.Presented( time );
+        m_capture.Presented( time );
+        if( m_presented ) m_presented( time );
+    }
+    else
+    {
+        m_scheduler.Vblank( time );
+    }
+
+    m_flipPending = false;
+    m_frameFlip = false;
+    m_flipRelease.clear();
+    m_flipSequence = sequence;
+    m_flipTime = time;
+
+    // Cursor motion which arrived while the flip was pending
+    if( m_cursorDirty ) CommitCursor();
+    Schedule();
+}
+
+void DrmConnector::AttachLoop( EventLoop& loop, FrameCallback frame, PresentedCallback presented )
+{
+    CheckPanic( !m_loop, "Connector %s is already attached to an event loop", m_name.c_str() );
+
+    m_loop = &loop;
+    m_frame = std::move( frame );
+    m_presented = std::move( presented );
+    m_frameTimer = loop.AddTimer( 0, 0, [this] {
+        ZoneScopedN( "Frame" );
+        m_scheduler.Begin();
+        if( !m_frame() ) m_scheduler.Cancel();
+        Schedule();
+    } );
+    Schedule();
+}
+
+void DrmConnector::DetachLoop()
+{
+    if( !m_loop ) return;
+    m_loop->RemoveTimer( m_frameTimer );
+    m_loop = nullptr;
+    m_frameTimer = -1;
+    m_frame = {};
+    m_presented = {};
+}
+
+void DrmConnector::Damage()
+{
+    m_scheduler.Damage();
+    Schedule();
+}
+
+bool DrmConnector::SetVrr( bool enabled )
+{
+    if( enabled && !m_vrrCapable ) return false;
+    if( enabled == m_vrr ) return true;
+
+    mclog( LogLevel::Info, "  Connector %s: variable refresh %s", m_name.c_str(), enabled ? "enabled" : "disabled" );
+
+    m_vrr = enabled;
+    m_vrrDirty = m_crtc != nullptr;
+    m_scheduler.SetVrr( enabled );
+    return true;
+}
+
+bool DrmConnector::SetHdr( bool enabled, float whiteNits )
+{
+    if( enabled && !m_hdrCapable ) return false;
+    if( enabled == m_hdr && ( !enabled || whiteNits == m_hdrWhite ) ) return true;
+
+    const auto prevWhite = m_hdrWhite;
+    m_hdr = enabled;
+    m_hdrWhite = whiteNits;
+    if( m_crtc )
+    {
+        if( !SetupHdr() )
+        {
+            m_hdr = false;
+            m_hdrWhite = prevWhite;
+            ClearHdr();
+            return false;
+        }
+        // The display may have to retrain the link for the new signal
+        m_modeset = true;
+    }
+
+    if( enabled )
+    {
+        mclog( LogLevel::Info, "  Connector %s: HDR enabled, SDR white at %.0f nits", m_name.c_str(), whiteNits );
+    }
+    else
+    {
+        mclog( LogLevel::Info, "  Connector %s: HDR disabled", m_name.c_str() );
+    }
+    return true;
+}
+
+bool DrmConnector::SetupHdr()
+{
+    ZoneScoped;
+
+    ClearHdr();
+    if( !m_hdr ) return true;
+    if( !m_crtc->HasColorPipeline() ) return false;
+
+    const auto degamma = SrgbDecodeCurve( m_crtc->DegammaSize() );
+    const auto ctm = MakeColorMatrix( primaries709, primaries2020 );
+    const auto gamma = PqEncodeCurve( m_crtc->GammaSize(), m_hdrWhite );
+    if( !m_crtc->SetColorPipeline( degamma, &ctm, gamma ) ) return false;
+
+    // The content never leaves the BT.709 gamut, and peaks at SDR white. Chromaticities are in units of 0.00002,
+    // the minimum luminance in units of 0.0001 nits.
+    auto xy = []( auto& dst, const cmsCIExyY& c ) {
+        dst.x = uint16_t( std::lrint( c.x * 50000 ) );
+        dst.y = uint16_t( std::lrint( c.y * 50000 ) );
+    };
+    const auto white = uint16_t( std::lrint( m_hdrWhite ) );
+
+    hdr_output_metadata metadata = {};
+    metadata.metadata_type = HdmiStaticMetadataType1;
+    auto& info = metadata.hdmi_metadata_type1;
+    info.eotf = HdmiEotfSmpteSt2084;
+    info.metadata_type = HdmiStaticMetadataType1;
+    xy( info.display_primaries[0], primaries709.Red );
+    xy( info.display_primaries[1], primaries709.Green );
+    xy( info.display_primaries[2], primaries709.Blue );
+    xy( info.white_point, white709 );
+    info.max_display_mastering_luminance = m_hdrMaxNits > 0 ? uint16_t( std::lrint( m_hdrMaxNits ) ) : white;
+    info.min_display_mastering_luminance = uint16_t( std::lrint( m_hdrMinNits * 10000 ) );
+    info.max_cll = white;
+    info.max_fall = white;
+
+    if( drmModeCreatePropertyBlob( m_device.Descriptor(), &metadata, sizeof( metadata ), &m_hdrBlob ) != 0 )
+    {
+        mclog( LogLevel::Warning, "  Connector %s: failed to create HDR metadata blob", m_name.c_str() );
+        m_hdrBlob = 0;
+        m_crtc->ClearColorPipeline();
         return false;
     }
+    return true;
+}
+
+void DrmConnector::ClearHdr()
+{
+    if( m_hdrBlob != 0 )
+    {
+        drmModeDestroyPropertyBlob( m_device.Descriptor(), m_hdrBlob );
+        m_hdrBlob = 0;
+    }
+    if( m_crtc ) m_crtc->ClearColorPipeline();
+}
+
+void DrmConnector::AddHdr( DrmAtomic& req ) const
+{
+    // Also without HDR, to reset what the previous user of the connector left. Default colorimetry is 0.
+    req.Add( m_id, m_propColorspace, m_hdr ? m_colorspaceBt2020 : 0 );
+    req.Add( m_id, m_propHdrMetadata, m_hdrBlob );
+}
+
+void DrmConnector::Schedule()
+{
+    if( !m_loop || m_paused ) return;
+
+    // A zero delay would disarm the timer
+    const auto now = GetTimeMicro();
+    const auto next = m_scheduler.NextFrame( now );
+    m_loop->SetTimer( m_frameTimer, next == 0 ? 0 : std::max<uint64_t>( next - now, 1 ) );
+}
+
+size_t DrmConnector::AssignOverlays( const DrmBuffer& primary, const std::vector<Layer>& layers )
+{
+    ZoneScoped;
+    CheckPanic( m_crtc, "Connector %s has no mode set", m_name.c_str() );
+
+    // Planes in use are kept claimed until a commit has taken them off the screen
+    for( auto& overlay : m_overlays ) m_detach.emplace_back( std::move( overlay.plane ) );
+    m_overlays.clear();
+
+    size_t assigned = 0;
+    for( auto& layer : layers )
+    {
+        std::shared_ptr<DrmPlane> plane;
+        auto it = std::ranges::find_if( m_detach, [this]( const auto& p ) { return p->Type() == DRM_PLANE_TYPE_OVERLAY && ( p->Plane()->possible_crtcs & m_crtc->Mask() ); } );
+        if( it != m_detach.end() )
+        {
+            plane = std::move( *it );
+            m_detach.erase( it );
+        }
+        else
+        {
+            plane = GetPlaneForCrtc( *m_crtc, DRM_PLANE_TYPE_OVERLAY );
+            if( !plane ) break;
+            plane->Claim();
+        }
+
+        m_overlays.emplace_back( Overlay { plane, layer } );
+        if( !Commit( primary, DRM_MODE_ATOMIC_TEST_ONLY ) )
+        {
+            // Layers are stacked, so everything above a rejected one must be composited as well
+            m_overlays.pop_back();
+            m_detach.emplace_back( std::move( plane ) );
+            break;
+        }
+        assigned++;
+    }
+
+    TracyPlot( "Overlay planes", int64_t( assigned ) );
+    return assigned;
+}
+
+bool DrmConnector::CanScanout( const DrmBuffer& buffer )
+{
+    ZoneScoped;
+
+    if( buffer.Width() != m_mode.hdisplay || buffer.Height() != m_mode.vdisplay ) return false;
+    return Commit( buffer, DRM_MODE_ATOMIC_TEST_ONLY );
+}
+
+std::shared_ptr<DrmBuffer> DrmConnector::CreateCursorBuffer()
+{
+    ZoneScoped;
+    CheckPanic( m_cursorPlane, "Connector %s has no cursor plane", m_name.c_str() );
+
+    uint64_t width, height;
+    if( drmGetCap( m_device.Descriptor(), DRM_CAP_CURSOR_WIDTH, &width ) != 0 ) width = 64;
+    if( drmGetCap( m_device.Descriptor(), DRM_CAP_CURSOR_HEIGHT, &height ) != 0 ) height = 64;
+
+    // Cursor images are tiny, linear is as good as anything else
+    const auto& format = DrmFormatArgb8888;
+    auto modifiers = ImportableModifiers( m_cursorPlane->Modifiers( format.drm ), *m_device.Gpu(), format.vk, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT );
+    if( modifiers.empty() ) return {};
+
+    return std::make_shared<DrmBuffer>( m_device, format, uint32_t( width ), uint32_t( height ), modifiers );
+}
+
+bool DrmConnector::SetCursor( std::shared_ptr<DrmBuffer> buffer, int32_t x, int32_t y )
+{
+    ZoneScoped;
+
+    if( !m_cursorPlane ) return !buffer;
+
+    m_cursor = std::move( buffer );
+    m_cursorX = x;
+    m_cursorY = y;
+
+    // A rejected cursor buffer leaves the plane empty, and the cursor to GPU composition
+    bool ok = true;
+    if( m_cursor && !m_modeset )
+    {
+        DrmAtomic req( m_device.Descriptor() );
+        AddCursor( req );
+        if( !req.Test() )
+        {
+            m_cursor.reset();
+            ok = false;
+        }
+    }
 
-    m_crtc->Enable();
-#endif
+    m_cursorDirty = true;
+    if( !m_flipPending ) CommitCursor();
+    return ok;
+}
 
+void DrmConnector::MoveCursor( int32_t x, int32_t y )
+{
+    if( x == m_cursorX && y == m_cursorY ) return;
+
+    m_cursorX = x;
+    m_cursorY = y;
+    if( !m_cursor ) return;
+
+    m_cursorDirty = true;
+    if( !m_flipPending ) CommitCursor();
+}
+
+void DrmConnector::CommitCursor()
+{
+    ZoneScoped;
+
+    // Nothing is on screen before the first frame was committed
+    if( m_modeset || m_paused ) return;
+
+    DrmAtomic req( m_device.Descriptor() );
+    AddCursor( req );
+    if( !req.Commit( DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT, this ) ) return;
+
+    m_flipPending = true;
+    m_cursorDirty = false;
+    m_cursorShown = m_cursor != nullptr;
+}
+
+void DrmConnector::AddCursor( DrmAtomic& req ) const
+{
+    if( m_cursor )
+    {
+        m_cursorPlane->Attach( req, m_crtc->Id(), m_cursor->Framebuffer(), m_cursorX, m_cursorY, m_cursor->Width(), m_cursor->Height() );
+    }
+    else if( m_cursorShown )
+    {
+        m_cursorPlane->Detach( req );
+    }
+}
+
+void DrmConnector::AddPlanes( DrmAtomic& req ) const
+{
+    if( m_cursorPlane ) AddCursor( req );
+    for( auto& overlay : m_overlays )
+    {
+        auto& buffer = *overlay.layer.buffer;
+        overlay.plane->Attach( req, m_crtc->Id(), buffer.Framebuffer(), overlay.layer.x, overlay.layer.y, buffer.Width(), buffer.Height() );
+    }
+    for( auto& plane : m_detach ) plane->Detach( req );
+}
+
+void DrmConnector::Pause()
+{
+    if( m_paused ) return;
+    mclog( LogLevel::Debug, "  Connector %s: paused", m_name.c_str() );
+
+    m_paused = true;
+    if( m_loop ) m_loop->SetTimer( m_frameTimer, 0 );
+}
+
+bool DrmConnector::AddRestore( DrmAtomic& req ) const
+{
+    if( !m_crtc || m_buffers.empty() ) return false;
+
+    // A client buffer which was scanned out directly may be gone by now. The connector buffers are not.
+    auto it = std::ranges::find_if( m_buffers, [this]( const auto& b ) { return b.get() == m_shown; } );
+    auto& buffer = it != m_buffers.end() ? **it : *m_buffers.front();
+
+    // The other session may have left anything on the planes
+    req.Add( m_id, m_propCrtcId, m_crtc->Id() );
+    m_crtc->Enable( req );
+    AddHdr( req );
+    m_plane->Attach( req, m_crtc->Id(), buffer.Framebuffer(), 0, 0, buffer.Width(), buffer.Height() );
+    if( m_cursorPlane && !m_cursor ) m_cursorPlane->Detach( req );
+    AddPlanes( req );
+    if( m_vrrCapable ) m_crtc->SetVrr( req, m_vrr );
     return true;
 }
 
+void DrmConnector::Resumed( bool restored )
+{
+    if( !m_paused ) return;
+    mclog( LogLevel::Debug, "  Connector %s: resumed%s", m_name.c_str(), restored ? "" : ", state not restored" );
+
+    // Flips pending at the pause were completed by the restoring commit. Without it, the next frame does a full
+    // mode set.
+    m_paused = false;
+    m_flipPending = false;
+    m_frameFlip = false;
+    m_flipRelease.clear();
+    if( restored )
+    {
+        m_modeset = false;
+        Committed();
+    }
+    else if( m_crtc )
+    {
+        m_modeset = true;
+    }
+
+    // The buffers kept their contents, only what changed in the scene while paused is repainted
+    m_scheduler.Damage();
+    Schedule();
+}
+
+void DrmConnector::Committed()
+{
+    m_vrrDirty = false;
+
+    for( auto& plane : m_detach ) plane->Release();
+    m_detach.clear();
+
+    m_cursorDirty = false;
+    m_cursorShown = m_cursor != nullptr;
+}
+
+void DrmConnector::ReleasePlanes()
+{
+    if( m_plane ) m_plane->Release();
+    if( m_cursorPlane ) m_cursorPlane->Release();
+    for( auto& overlay : m_overlays ) overlay.plane->Release();
+    for( auto& plane : m_detach ) plane->Release();
+
+    m_plane.reset();
+    m_cursorPlane.reset();
+    m_overlays.clear();
+    m_detach.clear();
+    m_cursor.reset();
+    m_cursorShown = false;
+    m_cursorDirty = false;
+}
+
+std::vector<DmabufFeedback::Format> DrmConnector::ScanoutFormats( const GpuDevice& gpu ) const
+{
+    ZoneScoped;
+    CheckPanic( m_plane, "Connector %s has no mode set", m_name.c_str() );
+
+    std::vector<DmabufFeedback::Format> ret;
+    for( auto& format : DrmFormats() )
+    {
+        for( auto mod : ImportableModifiers( m_plane->Modifiers( format.drm ), gpu, format.vk, VK_IMAGE_USAGE_SAMPLED_BIT ) )
+        {
+            ret.emplace_back( DmabufFeedback::Format { format.drm, mod } );
+        }
+    }
+    return ret;
+}
+
 const drmModeModeInfo& DrmConnector::BestDisplayMode() const
 {
     CheckPanic( m_connected, "Connector is not connected");
@@ -251,22 +835,17 @@ const drmModeModeInfo& DrmConnector::BestDisplayMode() const
     return m_modes[best];
 }
 
-const std::shared_ptr<DrmPlane>& DrmConnector::GetPlaneForCrtc( const DrmCrtc& crtc )
+std::shared_ptr<DrmPlane> DrmConnector::GetPlaneForCrtc( const DrmCrtc& crtc, uint64_t type ) const
 {
     auto& planes = m_device.Planes();
     for( auto& plane : planes )
     {
         auto& p = *plane->Plane();
-        if( p.possible_crtcs & crtc.Mask() )
+        if( ( p.possible_crtcs & crtc.Mask() ) && plane->Type() == type && !plane->IsUsed() )
         {
-            if( plane->Type() == DRM_PLANE_TYPE_PRIMARY )
-            {
-                mclog( LogLevel::Debug, "  Using plane %d for connector %s", p.plane_id, m_name.c_str() );
-                return plane;
-            }
+            mclog( LogLevel::Debug, "  Using plane %d for connector %s", p.plane_id, m_name.c_str() );
+            return plane;
         }
     }
-
-    static std::shared_ptr<DrmPlane> empty;
-    return empty;
+    return {};
 }
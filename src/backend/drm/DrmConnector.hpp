@@ -1,25 +1,50 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
 #include <vector>
+#include <vulkan/vulkan.h>
 #include <xf86drmMode.h>
 
+#include "DrmFormat.hpp"
+#include "backend/DmabufFeedback.hpp"
+#include "server/OutputCapture.hpp"
+#include "util/DamageRing.hpp"
+#include "util/FrameScheduler.hpp"
 #include "util/NoCopy.hpp"
+#include "util/Region.hpp"
+#include "util/RobinHood.hpp"
 
 class DrmBuffer;
 class DrmCrtc;
 class DrmDevice;
+class DrmAtomic;
 class DrmPlane;
+class EventLoop;
+class GpuDevice;
+class VlkBase;
 struct gbm_bo;
 
 class DrmConnector
 {
 public:
+    // Records and presents a frame. Returns false if nothing was committed.
+    using FrameCallback = std::function<bool()>;
+    // A committed frame reached the screen, at the page flip time in microseconds
+    using PresentedCallback = std::function<void( uint64_t time )>;
+
     struct ConnectorException : public std::runtime_error { explicit ConnectorException( const std::string& msg ) : std::runtime_error( msg ) {} };
 
+    // A client buffer shown directly on a plane, at a position on the CRTC
+    struct Layer
+    {
+        std::shared_ptr<DrmBuffer> buffer;
+        int32_t x, y;
+    };
+
     DrmConnector( DrmDevice& device, uint32_t id, const drmModeRes* res );
     ~DrmConnector();
 
@@ -28,7 +53,77 @@ public:
     bool SetMode( const drmModeModeInfo& mode );
 
     bool SetModeDrm( const drmModeModeInfo& mode );
-    bool SetModeVulkan();
+    // Without a render GPU, or with the one of the display device, frames are rendered on the display device.
+    // Otherwise they are shared with it over PRIME.
+    // The best ranked modifiers which pass a test commit are used, see RankModifiers().
+    bool SetModeVulkan( const std::shared_ptr<GpuDevice>& renderGpu = {} );
+
+    // Scanout format of the buffers created by the next mode set. If the primary plane doesn't support it,
+    // XRGB8888 is used instead.
+    void SetFormat( const DrmFormat& format ) { m_format = format; }
+
+    // Atomic commit of the connector, CRTC and plane state. The pending mode is included until it was committed
+    // once. With DRM_MODE_ATOMIC_TEST_ONLY nothing is changed.
+    bool Commit( const DrmBuffer& buffer, uint32_t flags, int inFence = -1, int32_t* outFence = nullptr, uint32_t damageBlob = 0 );
+
+    // Frames are rendered on the loop thread, at the times the scheduler picks. Damage() requests a new frame.
+    void AttachLoop( EventLoop& loop, FrameCallback frame, PresentedCallback presented = {} );
+    void DetachLoop();
+    void Damage();
+
+    // Takes effect with the next commit. Returns false if the display has no variable refresh support.
+    bool SetVrr( bool enabled );
+    [[nodiscard]] bool IsVrrCapable() const { return m_vrrCapable; }
+
+    // HDR signalling, with the colour transform left to the display engine. Frames stay sRGB encoded BT.709, which
+    // the CRTC linearizes, maps to BT.2020 and encodes with PQ, with SDR white at whiteNits. Takes effect with a
+    // mode set on the next commit. Returns false if the display or the CRTC can't do it.
+    bool SetHdr( bool enabled, float whiteNits = 203 );
+    [[nodiscard]] bool IsHdrCapable() const { return m_hdrCapable; }
+    [[nodiscard]] bool IsHdr() const { return m_hdr; }
+
+    [[nodiscard]] FrameScheduler& Scheduler() { return m_scheduler; }
+
+    // Screen capture of the frames of the connector. The frame callback records the copies behind its
+    // composition, they are done when the frame is presented.
+    [[nodiscard]] OutputCapture& Capture() { return m_capture; }
+
+    // Records the damage of the frame about to be rendered into one of the connector buffers, and returns the part
+    // of the buffer to repaint. That also covers what changed since the buffer was last shown.
+    [[nodiscard]] Region BeginFrame( const DrmBuffer& buffer, const Region& damage );
+
+    // Non-blocking page flip. Scanout waits for the ScanoutFence() of the buffer, and the objects are
+    // recycled once the flip has replaced the previous frame, so the CPU never waits on either. Returns false if
+    // the previous flip has not completed yet, or the commit failed. The damage of the frame is passed on as
+    // FB_DAMAGE_CLIPS, an empty region means the whole buffer changed.
+    bool Present( DrmBuffer& buffer, const Region& damage = {}, std::vector<std::shared_ptr<VlkBase>>&& release = {} );
+    void PageFlip( uint32_t sequence, uint64_t time );      // Page flip event, time in microseconds
+
+    // Layers are in stacking order above the primary buffer. They are assigned to free overlay planes until one
+    // does not fit, or a TEST_ONLY commit rejects it. That layer and the ones above it are left for GPU
+    // composition. Returns the number of layers assigned, which are shown from the next commit on.
+    size_t AssignOverlays( const DrmBuffer& primary, const std::vector<Layer>& layers );
+
+    // Checks if a fullscreen client buffer can be scanned out on the primary plane, without composition
+    [[nodiscard]] bool CanScanout( const DrmBuffer& buffer );
+
+    // The cursor plane is updated on its own, so cursor motion doesn't need a new frame. Returns false if the
+    // cursor has to be composited instead. A null buffer hides the cursor.
+    [[nodiscard]] bool HasCursorPlane() const { return m_cursorPlane != nullptr; }
+    [[nodiscard]] std::shared_ptr<DrmBuffer> CreateCursorBuffer();
+    bool SetCursor( std::shared_ptr<DrmBuffer> buffer, int32_t x, int32_t y );
+    void MoveCursor( int32_t x, int32_t y );
+
+    // Session switch. While paused nothing is committed or scheduled. Buffers and GPU resources are kept, so that
+    // resuming only restores the KMS state: AddRestore() adds the last committed state to a request covering the
+    // whole device, and Resumed() is called once it was committed, or failed to.
+    void Pause();
+    bool AddRestore( DrmAtomic& req ) const;
+    void Resumed( bool restored );
+    [[nodiscard]] bool IsPaused() const { return m_paused; }
+
+    // Client buffer layouts the primary plane can scan out, and the GPU can sample from when compositing
+    [[nodiscard]] std::vector<DmabufFeedback::Format> ScanoutFormats( const GpuDevice& gpu ) const;
 
     [[nodiscard]] const drmModeModeInfo& BestDisplayMode() const;
 
@@ -37,25 +132,91 @@ public:
     [[nodiscard]] const std::string& Name() const { return m_name; }
     [[nodiscard]] const std::string& Monitor() const { return m_monitor; }
     [[nodiscard]] const std::vector<uint32_t>& Crtcs() const { return m_crtcs; }
+    [[nodiscard]] bool IsFlipPending() const { return m_flipPending; }
+    [[nodiscard]] bool IsActive() const { return m_crtc != nullptr; }
+    [[nodiscard]] auto& Buffers() const { return m_buffers; }
+    [[nodiscard]] auto& Mode() const { return m_mode; }
 
 private:
-    const std::shared_ptr<DrmPlane>& GetPlaneForCrtc( const DrmCrtc& crtc );
+    struct Overlay
+    {
+        std::shared_ptr<DrmPlane> plane;
+        Layer layer;
+    };
+
+    [[nodiscard]] std::shared_ptr<DrmPlane> GetPlaneForCrtc( const DrmCrtc& crtc, uint64_t type ) const;
+
+    void Schedule();
+    void CommitCursor();
+    void AddCursor( DrmAtomic& req ) const;
+    void AddPlanes( DrmAtomic& req ) const;
+    void AddHdr( DrmAtomic& req ) const;
+    bool SetupHdr();
+    void ClearHdr();
+    void Committed();
+    void ReleasePlanes();
 
     uint32_t m_id;
     bool m_connected;
+    uint32_t m_propCrtcId;
 
     std::string m_name;
     std::string m_monitor;
 
     std::shared_ptr<DrmCrtc> m_crtc;
     std::shared_ptr<DrmPlane> m_plane;
+    std::shared_ptr<DrmPlane> m_cursorPlane;
+
+    std::vector<Overlay> m_overlays;
+    std::vector<std::shared_ptr<DrmPlane>> m_detach;        // Taken off the screen by the next commit
+
+    std::shared_ptr<DrmBuffer> m_cursor;
+    int32_t m_cursorX = 0;
+    int32_t m_cursorY = 0;
+    bool m_cursorShown = false;
+    bool m_cursorDirty = false;
 
     std::vector<uint32_t> m_crtcs;
     std::vector<drmModeModeInfo> m_modes;
     std::vector<uint64_t> m_modifiers;
+    DrmFormat m_format = DrmFormatXrgb8888;
 
     std::vector<std::shared_ptr<DrmBuffer>> m_buffers;
 
+    DamageRing m_damage;
+    OutputCapture m_capture;
+    unordered_flat_map<const DrmBuffer*, uint64_t> m_bufferFrame;    // Frame each buffer was last rendered in
+    uint64_t m_frameCount = 0;
+
     DrmDevice& m_device;
     drmModeModeInfo m_mode;
+
+    bool m_modeset = false;
+    bool m_paused = false;
+    const DrmBuffer* m_shown = nullptr;     // Only compared against the connector buffers, may be a client buffer
+    bool m_flipPending = false;
+    bool m_frameFlip = false;       // The pending flip carries a frame, not only cursor motion
+    std::vector<std::shared_ptr<VlkBase>> m_flipRelease;     // Only if an out fence could not be used
+    uint32_t m_flipSequence = 0;
+    uint64_t m_flipTime = 0;
+
+    bool m_vrrCapable = false;
+    bool m_vrr = false;
+    bool m_vrrDirty = false;
+
+    uint32_t m_propColorspace = 0;
+    uint32_t m_propHdrMetadata = 0;
+    uint64_t m_colorspaceBt2020 = 0;
+    float m_hdrMaxNits = 0;         // Of the display, from the EDID, 0 if unknown
+    float m_hdrMinNits = 0;
+    bool m_hdrCapable = false;
+    bool m_hdr = false;
+    float m_hdrWhite = 203;
+    uint32_t m_hdrBlob = 0;
+
+    FrameScheduler m_scheduler;
+    EventLoop* m_loop = nullptr;
+    int m_frameTimer = -1;
+    FrameCallback m_frame;
+    PresentedCallback m_presented;
 };
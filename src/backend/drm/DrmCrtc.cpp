@@ -1,10 +1,55 @@
+#include <algorithm>
+#include <math.h>
 #include <tracy/Tracy.hpp>
 #include <xf86drmMode.h>
 
+#include "DrmAtomic.hpp"
 #include "DrmCrtc.hpp"
+#include "DrmProperties.hpp"
+#include "util/ColorMatrix.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
+static bool CreateBlob( int fd, const void* data, size_t size, uint32_t& blob )
+{
+    if( drmModeCreatePropertyBlob( fd, data, size, &blob ) == 0 ) return true;
+    blob = 0;
+    return false;
+}
+
+static bool CreateLutBlob( int fd, const std::vector<float>& curve, uint32_t size, uint32_t& blob )
+{
+    if( curve.empty() ) return true;
+    CheckPanic( curve.size() == size, "LUT size mismatch" );
+
+    std::vector<drm_color_lut> lut( size );
+    for( uint32_t i=0; i<size; i++ )
+    {
+        const auto v = uint16_t( std::lrint( std::clamp( curve[i], 0.f, 1.f ) * 0xFFFF ) );
+        lut[i] = { .red = v, .green = v, .blue = v };
+    }
+    return CreateBlob( fd, lut.data(), lut.size() * sizeof( drm_color_lut ), blob );
+}
+
+// S31.32 sign-magnitude fixed point, rows of the matrix in order
+static bool CreateCtmBlob( int fd, const ColorMatrix* ctm, uint32_t& blob )
+{
+    if( !ctm ) return true;
+
+    drm_color_ctm data;
+    for( int r=0; r<3; r++ )
+    {
+        for( int c=0; c<3; c++ )
+        {
+            const auto v = double( ctm->col[c][r] );
+            auto& dst = data.matrix[r*3+c];
+            dst = uint64_t( std::llround( std::abs( v ) * ( 1ull << 32 ) ) );
+            if( v < 0 ) dst |= 1ull << 63;
+        }
+    }
+    return CreateBlob( fd, &data, sizeof( data ), blob );
+}
+
 DrmCrtc::DrmCrtc( int fd, uint32_t id, uint32_t mask )
     : m_fd( fd )
     , m_id( id )
@@ -17,22 +62,109 @@ DrmCrtc::DrmCrtc( int fd, uint32_t id, uint32_t mask )
     CheckPanic( id == crtc->crtc_id, "CRTC ID mismatch" );
     m_bufferId = crtc->buffer_id;
     drmModeFreeCrtc( crtc );
+
+    DrmProperties props( fd, id, DRM_MODE_OBJECT_CRTC );
+    if( !props ) throw CrtcException( "Failed to get CRTC properties" );
+    m_propModeId = props.Id( "MODE_ID" );
+    m_propActive = props.Id( "ACTIVE" );
+    m_propOutFence = props.Id( "OUT_FENCE_PTR" );
+    m_propVrr = props.Id( "VRR_ENABLED" );
+    m_propDegamma = props.Id( "DEGAMMA_LUT" );
+    m_propCtm = props.Id( "CTM" );
+    m_propGamma = props.Id( "GAMMA_LUT" );
+    if( auto size = props["DEGAMMA_LUT_SIZE"]; size ) m_degammaSize = uint32_t( size.Value() );
+    if( auto size = props["GAMMA_LUT_SIZE"]; size ) m_gammaSize = uint32_t( size.Value() );
+    if( !m_propModeId || !m_propActive ) throw CrtcException( "CRTC does not support atomic mode setting" );
 }
 
 DrmCrtc::~DrmCrtc()
 {
+    ClearMode();
+    ClearColorPipeline();
 }
 
-void DrmCrtc::Enable()
+bool DrmCrtc::SetMode( const drmModeModeInfo& mode )
 {
+    ZoneScoped;
+
+    ClearMode();
+    if( drmModeCreatePropertyBlob( m_fd, &mode, sizeof( mode ), &m_modeBlob ) != 0 )
+    {
+        mclog( LogLevel::Warning, "CRTC %u: failed to create mode blob", m_id );
+        m_modeBlob = 0;
+        return false;
+    }
+    return true;
 }
 
-void DrmCrtc::Disable()
+void DrmCrtc::ClearMode()
 {
-    ZoneScoped;
-    CheckPanic( m_bufferId != 0, "CRTC %u: already disabled", m_id );
+    // The kernel keeps its own reference to the blob while the mode is in use
+    if( m_modeBlob == 0 ) return;
+    drmModeDestroyPropertyBlob( m_fd, m_modeBlob );
+    m_modeBlob = 0;
+}
+
+void DrmCrtc::Enable( DrmAtomic& req ) const
+{
+    CheckPanic( m_modeBlob != 0, "CRTC %u: no mode set", m_id );
 
+    req.Add( m_id, m_propModeId, m_modeBlob );
+    req.Add( m_id, m_propActive, 1 );
+
+    // Always set, so that nothing is left from whoever used the CRTC before
+    req.Add( m_id, m_propDegamma, m_degammaBlob );
+    req.Add( m_id, m_propCtm, m_ctmBlob );
+    req.Add( m_id, m_propGamma, m_gammaBlob );
+}
+
+void DrmCrtc::Disable( DrmAtomic& req )
+{
     mclog( LogLevel::Debug, "CRTC %u: disabling", m_id );
-    drmModeSetCrtc( m_fd, m_id, 0, 0, 0, nullptr, 0, nullptr );
+
+    req.Add( m_id, m_propModeId, 0 );
+    req.Add( m_id, m_propActive, 0 );
+
+    ClearMode();
+    ClearColorPipeline();
     m_bufferId = 0;
 }
+
+bool DrmCrtc::RequestOutFence( DrmAtomic& req, int32_t* fd ) const
+{
+    *fd = -1;
+    return req.Add( m_id, m_propOutFence, uint64_t( uintptr_t( fd ) ) );
+}
+
+bool DrmCrtc::SetVrr( DrmAtomic& req, bool enabled ) const
+{
+    return req.Add( m_id, m_propVrr, enabled ? 1 : 0 );
+}
+
+bool DrmCrtc::SetColorPipeline( const std::vector<float>& degamma, const ColorMatrix* ctm, const std::vector<float>& gamma )
+{
+    ZoneScoped;
+
+    ClearColorPipeline();
+    if( !HasColorPipeline() ) return false;
+    if( CreateLutBlob( m_fd, degamma, m_degammaSize, m_degammaBlob ) &&
+        CreateCtmBlob( m_fd, ctm, m_ctmBlob ) &&
+        CreateLutBlob( m_fd, gamma, m_gammaSize, m_gammaBlob ) )
+    {
+        return true;
+    }
+
+    mclog( LogLevel::Warning, "CRTC %u: failed to create colour pipeline blobs", m_id );
+    ClearColorPipeline();
+    return false;
+}
+
+void DrmCrtc::ClearColorPipeline()
+{
+    for( auto blob : { &m_degammaBlob, &m_ctmBlob, &m_gammaBlob } )
+    {
+        if( *blob == 0 ) continue;
+        drmModeDestroyPropertyBlob( m_fd, *blob );
+        *blob = 0;
+    }
+}
@@ -3,9 +3,14 @@
 #include <stdexcept>
 #include <stdint.h>
 #include <string>
+#include <vector>
 
 #include "util/NoCopy.hpp"
 
+using drmModeModeInfo = struct _drmModeModeInfo;
+class DrmAtomic;
+struct ColorMatrix;
+
 class DrmCrtc
 {
 public:
@@ -16,11 +21,32 @@ public:
 
     NoCopy( DrmCrtc );
 
-    void Enable();
-    void Disable();
+    // Creates the mode blob. The CRTC is used from then on, until the mode is cleared or the CRTC is disabled.
+    bool SetMode( const drmModeModeInfo& mode );
+    void ClearMode();
+
+    // Add the CRTC state to an atomic request. Enabling requires a mode to be set.
+    void Enable( DrmAtomic& req ) const;
+    void Disable( DrmAtomic& req );
+
+    // The kernel stores a sync_file in the pointed to descriptor, signalled once the committed state is on screen
+    // and the previous framebuffers are no longer scanned out
+    bool RequestOutFence( DrmAtomic& req, int32_t* fd ) const;
+
+    // Returns false if the CRTC has no variable refresh support
+    bool SetVrr( DrmAtomic& req, bool enabled ) const;
+
+    // Colour transform of the display engine, done on the blended planes: the degamma curve, the colour matrix,
+    // then the gamma curve. Curves are sampled evenly over [0, 1], at the sizes below. An empty curve or a null
+    // matrix is bypassed. Takes effect with the next Enable().
+    bool SetColorPipeline( const std::vector<float>& degamma, const ColorMatrix* ctm, const std::vector<float>& gamma );
+    void ClearColorPipeline();
+    [[nodiscard]] bool HasColorPipeline() const { return m_propDegamma && m_propCtm && m_propGamma && m_degammaSize >= 2 && m_gammaSize >= 2; }
+    [[nodiscard]] uint32_t DegammaSize() const { return m_degammaSize; }
+    [[nodiscard]] uint32_t GammaSize() const { return m_gammaSize; }
 
     [[nodiscard]] uint32_t Id() const { return m_id; }
-    [[nodiscard]] bool IsUsed() const { return m_bufferId != 0; }
+    [[nodiscard]] bool IsUsed() const { return m_bufferId != 0 || m_modeBlob != 0; }
     [[nodiscard]] uint32_t Mask() const { return m_mask; }
 
 private:
@@ -28,4 +54,19 @@ private:
     uint32_t m_id;
     uint32_t m_bufferId;
     uint32_t m_mask;
+
+    uint32_t m_modeBlob = 0;
+    uint32_t m_propModeId;
+    uint32_t m_propActive;
+    uint32_t m_propOutFence;
+    uint32_t m_propVrr;
+
+    uint32_t m_degammaBlob = 0;
+    uint32_t m_ctmBlob = 0;
+    uint32_t m_gammaBlob = 0;
+    uint32_t m_propDegamma;
+    uint32_t m_propCtm;
+    uint32_t m_propGamma;
+    uint32_t m_degammaSize = 0;
+    uint32_t m_gammaSize = 0;
 };
@@ -0,0 +1,54 @@
+#include <tracy/Tracy.hpp>
+
+#include "DrmBuffer.hpp"
+#include "DrmConnector.hpp"
+#include "DrmCursorSet.hpp"
+#include "cursor/CursorAtlas.hpp"
+#include "util/Bitmap.hpp"
+#include "util/Logs.hpp"
+#include "util/Panic.hpp"
+
+DrmCursorSet::DrmCursorSet( DrmConnector& connector, const CursorAtlas& atlas )
+    : m_atlas( atlas )
+{
+    ZoneScoped;
+    CheckPanic( connector.HasCursorPlane(), "Connector %s has no cursor plane", connector.Name().c_str() );
+
+    auto& pixels = atlas.Pixels();
+    const auto stride = pixels.Width() * 4;
+
+    size_t missing = 0;
+    m_cursors.reserve( atlas.Entries().size() );
+    for( auto& e : atlas.Entries() )
+    {
+        auto buffer = connector.CreateCursorBuffer();
+        if( buffer && e.width <= buffer->Width() && e.height <= buffer->Height() )
+        {
+            auto src = pixels.Data() + ( size_t( e.y ) * pixels.Width() + e.x ) * 4;
+            if( !buffer->Write( src, stride, e.width, e.height ) ) buffer.reset();
+        }
+        else
+        {
+            buffer.reset();
+        }
+        if( !buffer ) missing++;
+        m_cursors.emplace_back( Cursor { std::move( buffer ), e.xhot, e.yhot } );
+    }
+
+    if( missing != 0 ) mclog( LogLevel::Debug, "  %zu of %zu cursor images can't use the cursor plane of %s", missing, m_cursors.size(), connector.Name().c_str() );
+}
+
+DrmCursorSet::~DrmCursorSet() = default;
+
+const DrmCursorSet::Cursor& DrmCursorSet::Get( CursorType type, uint32_t bitmap ) const
+{
+    auto& entry = m_atlas.Get( type, bitmap );
+    return m_cursors[&entry - m_atlas.Entries().data()];
+}
+
+bool DrmCursorSet::Show( DrmConnector& connector, CursorType type, uint32_t bitmap, int32_t x, int32_t y ) const
+{
+    auto& cursor = Get( type, bitmap );
+    if( !cursor.buffer ) return false;
+    return connector.SetCursor( cursor.buffer, x - int32_t( cursor.xhot ), y - int32_t( cursor.yhot ) );
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "cursor/CursorType.hpp"
+#include "util/NoCopy.hpp"
+
+class CursorAtlas;
+class DrmBuffer;
+class DrmConnector;
+
+// A cursor plane buffer for every image of a cursor atlas, filled once. Changing the shape, or animating it, is
+// then only a framebuffer swap on the plane.
+//
+// Images larger than the cursor plane have no buffer, and must be composited on the GPU instead.
+class DrmCursorSet
+{
+public:
+    struct Cursor
+    {
+        std::shared_ptr<DrmBuffer> buffer;
+        uint32_t xhot, yhot;
+    };
+
+    DrmCursorSet( DrmConnector& connector, const CursorAtlas& atlas );
+    ~DrmCursorSet();
+
+    NoCopy( DrmCursorSet );
+
+    // The buffer is nullptr if the image doesn't fit the plane
+    [[nodiscard]] const Cursor& Get( CursorType type, uint32_t bitmap ) const;
+
+    // Shows the cursor with its hotspot at the position
+    bool Show( DrmConnector& connector, CursorType type, uint32_t bitmap, int32_t x, int32_t y ) const;
+
+private:
+    const CursorAtlas& m_atlas;
+    std::vector<Cursor> m_cursors;      // Same order as the atlas entries
+};
@@ -9,11 +9,13 @@
 #include <xf86drmMode.h>
 
 #include "DbusLoginPaths.hpp"
+#include "DrmAtomic.hpp"
 #include "DrmCrtc.hpp"
 #include "DrmConnector.hpp"
 #include "DrmDevice.hpp"
 #include "DrmPlane.hpp"
 #include "PciBus.hpp"
+#include "dbus/DbusMessage.hpp"
 #include "dbus/DbusSession.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
@@ -21,7 +23,26 @@
 
 constexpr int DriMajor = 226;
 
-DrmDevice::DrmDevice( const char* devName, DbusSession& bus, const char* sessionPath )
+static void PageFlipHandler( int, unsigned int sequence, unsigned int sec, unsigned int usec, unsigned int, void* data )
+{
+    ((DrmConnector*)data)->PageFlip( sequence, uint64_t( sec ) * 1000000 + usec );
+}
+
+void DrmDevice::Take( const char* devName, DbusSession& bus, const char* sessionPath, std::function<void(dev_t, DbusMessage)> callback )
+{
+    struct stat st;
+    if( stat( devName, &st ) != 0 ) throw DeviceException( std::format( "Failed to stat DRM device: {}", strerror( errno ) ) );
+    if( major( st.st_rdev ) != DriMajor ) throw DeviceException( "Not a DRM device" );
+
+    const auto dev = st.st_rdev;
+    if( !bus.CallAsync( [dev, callback = std::move( callback )]( DbusMessage msg ) { callback( dev, std::move( msg ) ); },
+        LoginService, sessionPath, LoginSessionIface, "TakeDevice", "uu", major( dev ), minor( dev ) ) )
+    {
+        throw DeviceException( "Failed to take device" );
+    }
+}
+
+DrmDevice::DrmDevice( const char* devName, dev_t dev, DbusMessage reply, const char* sessionPath )
     : m_sessionPath( sessionPath )
     , m_dev( 0 )
     , m_fd( -1 )
@@ -29,17 +50,12 @@ DrmDevice::DrmDevice( const char* devName, DbusSession& bus, const char* session
 {
     ZoneScoped;
 
-    struct stat st;
-    if( stat( devName, &st ) != 0 ) throw DeviceException( std::format( "Failed to stat DRM device: {}", strerror( errno ) ) );
-    if( major( st.st_rdev ) != DriMajor ) throw DeviceException( "Not a DRM device" );
-
-    auto devMsg = bus.Call( LoginService, sessionPath, LoginSessionIface, "TakeDevice", "uu", major( st.st_rdev ), minor( st.st_rdev ) );
-    if( !devMsg ) throw DeviceException( "Failed to take device" );
-    m_dev = st.st_rdev;
+    if( !reply ) throw DeviceException( "Failed to take device" );
+    m_dev = dev;
 
     int fd;
     int paused;
-    if( !devMsg.Read( "hb", &fd, &paused ) ) throw DeviceException( "Failed to read device file descriptor" );
+    if( !reply.Read( "hb", &fd, &paused ) ) throw DeviceException( "Failed to read device file descriptor" );
 
     if( !drmIsKMS( fd ) ) throw DeviceException( "Not a KMS device" );
 
@@ -147,6 +163,47 @@ DrmDevice::~DrmDevice()
     }
 }
 
+void DrmDevice::DispatchEvents()
+{
+    ZoneScoped;
+
+    drmEventContext ctx = {
+        .version = DRM_EVENT_CONTEXT_VERSION,
+        .page_flip_handler2 = PageFlipHandler
+    };
+    drmHandleEvent( m_fd, &ctx );
+}
+
+void DrmDevice::Pause()
+{
+    if( m_paused ) return;
+    mclog( LogLevel::Info, "DRM device %s: paused", m_name.c_str() );
+
+    m_paused = true;
+    for( auto& conn : m_connectors ) conn->Pause();
+}
+
+bool DrmDevice::Resume()
+{
+    ZoneScoped;
+
+    if( !m_paused ) return true;
+    mclog( LogLevel::Info, "DRM device %s: resumed", m_name.c_str() );
+    m_paused = false;
+
+    // Planes the other session left enabled are turned off in the same commit
+    DrmAtomic req( m_fd );
+    bool any = false;
+    for( auto& conn : m_connectors ) any |= conn->AddRestore( req );
+    for( auto& plane : m_planes ) if( !plane->IsUsed() ) plane->Detach( req );
+
+    const auto restored = any && req.Commit( DRM_MODE_ATOMIC_ALLOW_MODESET );
+    if( any && !restored ) mclog( LogLevel::Warning, "DRM device %s: failed to restore the display state", m_name.c_str() );
+
+    for( auto& conn : m_connectors ) conn->Resumed( restored );
+    return restored || !any;
+}
+
 std::shared_ptr<VlkPhysicalDevice> DrmDevice::MatchPhysicalDevice()
 {
     ZoneScoped;
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <stdexcept>
 #include <string>
@@ -12,6 +13,7 @@
 using drmModeRes = struct _drmModeRes;
 using drmModeModeInfo = struct _drmModeModeInfo;
 struct gbm_device;
+class DbusMessage;
 class DbusSession;
 class DrmConnector;
 class DrmCrtc;
@@ -25,21 +27,36 @@ public:
     struct DeviceException : public std::runtime_error { explicit DeviceException( const std::string& msg ) : std::runtime_error( msg ) {} };
     struct ModesetException : public std::runtime_error { explicit ModesetException( const std::string& msg ) : std::runtime_error( msg ) {} };
 
-    DrmDevice( const char* devName, DbusSession& bus, const char* sessionPath );
+    // Asks logind for the device. All devices can be requested before the first reply is in, which is then
+    // passed to the constructor.
+    static void Take( const char* devName, DbusSession& bus, const char* sessionPath, std::function<void(dev_t, DbusMessage)> callback );
+
+    DrmDevice( const char* devName, dev_t dev, DbusMessage reply, const char* sessionPath );
     ~DrmDevice();
 
     NoCopy( DrmDevice );
 
+    [[nodiscard]] auto& Connectors() const { return m_connectors; }
     [[nodiscard]] auto& Crtcs() const { return m_crtcs; }
     [[nodiscard]] auto& Planes() const { return m_planes; }
 
     [[nodiscard]] auto Descriptor() const { return m_fd; }
+    [[nodiscard]] auto DeviceId() const { return m_dev; }
     [[nodiscard]] auto& Name() const { return m_name; }
 
     [[nodiscard]] auto& Gpu() const { return m_gpu; }
 
     operator gbm_device*() const { return m_gbm; }
 
+    // Session switch. Logind revokes DRM master on pause and grants it again before resume. Resume() restores the
+    // KMS state of all connectors in a single commit, everything else is kept across the pause.
+    void Pause();
+    bool Resume();
+    [[nodiscard]] bool IsPaused() const { return m_paused; }
+
+    // Reads pending DRM events and calls the connectors which scheduled the completed page flips
+    void DispatchEvents();
+
     std::shared_ptr<VlkPhysicalDevice> MatchPhysicalDevice();
     void SetGpuDevice( const std::shared_ptr<GpuDevice>& gpu );
 
@@ -68,4 +85,6 @@ private:
 
     std::string m_name;
     PciBus m_pci;
+
+    bool m_paused = false;
 };
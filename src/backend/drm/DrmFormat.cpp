@@ -0,0 +1,179 @@
+#include <algorithm>
+#include <drm_fourcc.h>
+#include <string.h>
+
+#include "DrmFormat.hpp"
+#include "backend/GpuDevice.hpp"
+#include "vulkan/VlkDevice.hpp"
+#include "vulkan/VlkError.hpp"
+
+const DrmFormat DrmFormatXrgb8888 = { DRM_FORMAT_XRGB8888, VK_FORMAT_B8G8R8A8_SRGB, "xrgb8888" };
+const DrmFormat DrmFormatArgb8888 = { DRM_FORMAT_ARGB8888, VK_FORMAT_B8G8R8A8_SRGB, "argb8888" };
+const DrmFormat DrmFormatXrgb2101010 = { DRM_FORMAT_XRGB2101010, VK_FORMAT_A2R10G10B10_UNORM_PACK32, "xrgb2101010" };
+const DrmFormat DrmFormatXbgr16161616f = { DRM_FORMAT_XBGR16161616F, VK_FORMAT_R16G16B16A16_SFLOAT, "xbgr16161616f" };
+
+namespace
+{
+enum Rank
+{
+    Linear,
+    Tiled,
+    Compressed
+};
+
+bool IsIntelCompressed( uint64_t modifier )
+{
+    static constexpr uint64_t ccs[] = {
+        I915_FORMAT_MOD_Y_TILED_CCS,
+        I915_FORMAT_MOD_Yf_TILED_CCS,
+#ifdef I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS
+        I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS,
+        I915_FORMAT_MOD_Y_TILED_GEN12_MC_CCS,
+        I915_FORMAT_MOD_Y_TILED_GEN12_RC_CCS_CC,
+#endif
+#ifdef I915_FORMAT_MOD_4_TILED_DG2_RC_CCS
+        I915_FORMAT_MOD_4_TILED_DG2_RC_CCS,
+        I915_FORMAT_MOD_4_TILED_DG2_MC_CCS,
+        I915_FORMAT_MOD_4_TILED_DG2_RC_CCS_CC,
+#endif
+#ifdef I915_FORMAT_MOD_4_TILED_MTL_RC_CCS
+        I915_FORMAT_MOD_4_TILED_MTL_RC_CCS,
+        I915_FORMAT_MOD_4_TILED_MTL_MC_CCS,
+        I915_FORMAT_MOD_4_TILED_MTL_RC_CCS_CC,
+#endif
+    };
+    return std::ranges::find( ccs, modifier ) != std::end( ccs );
+}
+
+std::vector<VkDrmFormatModifierPropertiesEXT> GetModifierProperties( const GpuDevice& gpu, VkFormat format )
+{
+    VkDrmFormatModifierPropertiesListEXT modList = { VK_STRUCTURE_TYPE_DRM_FORMAT_MODIFIER_PROPERTIES_LIST_EXT };
+    VkFormatProperties2 formatProps = { VK_STRUCTURE_TYPE_FORMAT_PROPERTIES_2 };
+    formatProps.pNext = &modList;
+    vkGetPhysicalDeviceFormatProperties2( *gpu.Device(), format, &formatProps );
+    if( modList.drmFormatModifierCount == 0 ) return {};
+
+    std::vector<VkDrmFormatModifierPropertiesEXT> props( modList.drmFormatModifierCount );
+    modList.pDrmFormatModifierProperties = props.data();
+    vkGetPhysicalDeviceFormatProperties2( *gpu.Device(), format, &formatProps );
+    props.resize( modList.drmFormatModifierCount );
+    return props;
+}
+}
+
+const std::vector<DrmFormat>& DrmFormats()
+{
+    static const std::vector<DrmFormat> formats = {
+        DrmFormatXrgb8888,
+        DrmFormatArgb8888,
+        { DRM_FORMAT_XBGR8888, VK_FORMAT_R8G8B8A8_SRGB, "xbgr8888" },
+        { DRM_FORMAT_ABGR8888, VK_FORMAT_R8G8B8A8_SRGB, "abgr8888" },
+        DrmFormatXrgb2101010,
+        { DRM_FORMAT_ARGB2101010, VK_FORMAT_A2R10G10B10_UNORM_PACK32, "argb2101010" },
+        { DRM_FORMAT_XBGR2101010, VK_FORMAT_A2B10G10R10_UNORM_PACK32, "xbgr2101010" },
+        { DRM_FORMAT_ABGR2101010, VK_FORMAT_A2B10G10R10_UNORM_PACK32, "abgr2101010" },
+        DrmFormatXbgr16161616f,
+        { DRM_FORMAT_ABGR16161616F, VK_FORMAT_R16G16B16A16_SFLOAT, "abgr16161616f" },
+    };
+    return formats;
+}
+
+const DrmFormat* ParseDrmFormat( const char* name )
+{
+    for( auto format : { &DrmFormatXrgb8888, &DrmFormatXrgb2101010, &DrmFormatXbgr16161616f } )
+    {
+        if( strcmp( format->name, name ) == 0 ) return format;
+    }
+    return nullptr;
+}
+
+const DrmFormat* FindDrmFormat( uint32_t drm )
+{
+    auto& formats = DrmFormats();
+    auto it = std::ranges::find_if( formats, [drm]( const auto& f ) { return f.drm == drm; } );
+    return it == formats.end() ? nullptr : &*it;
+}
+
+std::vector<uint64_t> ImportableModifiers( const std::vector<uint64_t>& modifiers, const GpuDevice& gpu, VkFormat format, VkImageUsageFlags usage )
+{
+    VkPhysicalDeviceImageDrmFormatModifierInfoEXT modInfo = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_DRM_FORMAT_MODIFIER_INFO_EXT };
+
+    VkPhysicalDeviceExternalImageFormatInfo extInfo = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_EXTERNAL_IMAGE_FORMAT_INFO };
+    extInfo.pNext = &modInfo;
+    extInfo.handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT;
+
+    VkPhysicalDeviceImageFormatInfo2 formatInfo = { VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_IMAGE_FORMAT_INFO_2 };
+    formatInfo.pNext = &extInfo;
+    formatInfo.format = format;
+    formatInfo.type = VK_IMAGE_TYPE_2D;
+    formatInfo.tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT;
+    formatInfo.usage = usage;
+
+    VkExternalImageFormatProperties extProp = { VK_STRUCTURE_TYPE_EXTERNAL_IMAGE_FORMAT_PROPERTIES };
+
+    VkImageFormatProperties2 prop = { VK_STRUCTURE_TYPE_IMAGE_FORMAT_PROPERTIES_2 };
+    prop.pNext = &extProp;
+
+    std::vector<uint64_t> ret;
+    for( auto mod : modifiers )
+    {
+        modInfo.drmFormatModifier = mod;
+        auto res = vkGetPhysicalDeviceImageFormatProperties2( *gpu.Device(), &formatInfo, &prop );
+        if( res == VK_ERROR_FORMAT_NOT_SUPPORTED ) continue;
+        VkVerify( res );
+        if( extProp.externalMemoryProperties.externalMemoryFeatures & VK_EXTERNAL_MEMORY_FEATURE_IMPORTABLE_BIT )
+        {
+            ret.emplace_back( mod );
+        }
+    }
+
+    return ret;
+}
+
+uint32_t ModifierPlaneCount( const GpuDevice& gpu, VkFormat format, uint64_t modifier )
+{
+    for( auto& p : GetModifierProperties( gpu, format ) )
+    {
+        if( p.drmFormatModifier == modifier ) return p.drmFormatModifierPlaneCount;
+    }
+    return 0;
+}
+
+std::vector<uint64_t> DeviceModifiers( const GpuDevice& gpu, VkFormat format, VkImageUsageFlags usage )
+{
+    const auto props = GetModifierProperties( gpu, format );
+
+    std::vector<uint64_t> modifiers;
+    modifiers.reserve( props.size() );
+    for( auto& p : props ) modifiers.emplace_back( p.drmFormatModifier );
+    return ImportableModifiers( modifiers, gpu, format, usage );
+}
+
+int ModifierRank( uint64_t modifier )
+{
+    if( modifier == DRM_FORMAT_MOD_LINEAR ) return Linear;
+
+    switch( modifier >> 56 )
+    {
+    case DRM_FORMAT_MOD_VENDOR_INTEL:
+        return IsIntelCompressed( modifier ) ? Compressed : Tiled;
+    case DRM_FORMAT_MOD_VENDOR_AMD:
+        return AMD_FMT_MOD_GET( DCC, modifier ) ? Compressed : Tiled;
+    case DRM_FORMAT_MOD_VENDOR_ARM:
+        // AFBC is type 0, with the block layout in the low bits. A zero value is not a valid AFBC modifier.
+        return ( ( modifier >> 52 ) & 0xf ) == DRM_FORMAT_MOD_ARM_TYPE_AFBC && ( modifier & 0xfffffffffffffull ) != 0 ? Compressed : Tiled;
+    case DRM_FORMAT_MOD_VENDOR_NVIDIA:
+        // Compression type of the block linear layout
+        return ( ( modifier >> 23 ) & 0x7 ) != 0 ? Compressed : Tiled;
+    default:
+        return Tiled;
+    }
+}
+
+std::vector<std::vector<uint64_t>> RankModifiers( const std::vector<uint64_t>& modifiers )
+{
+    std::vector<std::vector<uint64_t>> ret( Compressed + 1 );
+    for( auto mod : modifiers ) ret[Compressed - ModifierRank( mod )].emplace_back( mod );
+    std::erase_if( ret, []( const auto& v ) { return v.empty(); } );
+    return ret;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+class GpuDevice;
+
+// A scanout format, and the Vulkan format with the same memory layout. The 10 bit and half float formats are
+// meant for HDR output, the transfer function is applied when rendering.
+struct DrmFormat
+{
+    uint32_t drm;
+    VkFormat vk;
+    const char* name;
+};
+
+extern const DrmFormat DrmFormatXrgb8888;
+extern const DrmFormat DrmFormatArgb8888;
+extern const DrmFormat DrmFormatXrgb2101010;
+extern const DrmFormat DrmFormatXbgr16161616f;
+
+// Every format with a Vulkan equivalent, e.g. for client buffers
+[[nodiscard]] const std::vector<DrmFormat>& DrmFormats();
+
+// Return nullptr for an unknown format
+[[nodiscard]] const DrmFormat* ParseDrmFormat( const char* name );
+[[nodiscard]] const DrmFormat* FindDrmFormat( uint32_t drm );
+
+// The modifiers of the list which the device can import a dma-buf with, for the given usage
+[[nodiscard]] std::vector<uint64_t> ImportableModifiers( const std::vector<uint64_t>& modifiers, const GpuDevice& gpu, VkFormat format, VkImageUsageFlags usage );
+
+// Number of memory planes of a buffer with the modifier, 0 if the device doesn't support it for the format
+[[nodiscard]] uint32_t ModifierPlaneCount( const GpuDevice& gpu, VkFormat format, uint64_t modifier );
+
+// All modifiers the device supports for the format, which it can also import with the given usage
+[[nodiscard]] std::vector<uint64_t> DeviceModifiers( const GpuDevice& gpu, VkFormat format, VkImageUsageFlags usage );
+
+// Higher is better. Compressed layouts (AFBC, CCS, DCC and the like) save the most memory bandwidth, then tiled
+// ones, then linear.
+[[nodiscard]] int ModifierRank( uint64_t modifier );
+
+// Splits the modifiers into groups of equal rank, the best one first. The buffer allocator is free to choose
+// within a group, but must not fall back to a worse one if a better one works.
+[[nodiscard]] std::vector<std::vector<uint64_t>> RankModifiers( const std::vector<uint64_t>& modifiers );
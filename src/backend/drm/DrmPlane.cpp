@@ -2,10 +2,13 @@
 #include <tracy/Tracy.hpp>
 #include <xf86drmMode.h>
 
+#include "DrmAtomic.hpp"
 #include "DrmPlane.hpp"
 #include "DrmProperties.hpp"
+#include "util/Panic.hpp"
 
 DrmPlane::DrmPlane( int fd, uint32_t id )
+    : m_id( id )
 {
     ZoneScoped;
 
@@ -25,21 +28,36 @@ DrmPlane::DrmPlane( int fd, uint32_t id )
     if( !typeProp ) throw PlaneException( "Failed to get plane type" );
     m_type = typeProp.Value();
 
+    m_props = {
+        .fbId = props.Id( "FB_ID" ),
+        .crtcId = props.Id( "CRTC_ID" ),
+        .srcX = props.Id( "SRC_X" ),
+        .srcY = props.Id( "SRC_Y" ),
+        .srcW = props.Id( "SRC_W" ),
+        .srcH = props.Id( "SRC_H" ),
+        .crtcX = props.Id( "CRTC_X" ),
+        .crtcY = props.Id( "CRTC_Y" ),
+        .crtcW = props.Id( "CRTC_W" ),
+        .crtcH = props.Id( "CRTC_H" ),
+        .inFenceFd = props.Id( "IN_FENCE_FD" ),
+        .fbDamageClips = props.Id( "FB_DAMAGE_CLIPS" )
+    };
+    if( !m_props.fbId || !m_props.crtcId ) throw PlaneException( "Plane does not support atomic mode setting" );
+
     auto data = (drm_format_modifier_blob*)blob->data;
     auto formats = (uint32_t*)( ((char*)data) + data->formats_offset );
     auto modifiers = (drm_format_modifier*)( ((char*)data) + data->modifiers_offset );
 
     for( uint32_t f=0; f<data->count_formats; f++ )
     {
-        if( formats[f] != DRM_FORMAT_XRGB8888 ) continue;
-
+        auto& list = m_modifiers[formats[f]];
         for( uint32_t m=0; m<data->count_modifiers; m++ )
         {
             auto& mod = modifiers[m];
             if( f < mod.offset || f > mod.offset + 63 ) continue;
-            if( !( mod.formats & ( 1 << ( f - mod.offset ) ) ) ) continue;
+            if( !( mod.formats & ( 1ull << ( f - mod.offset ) ) ) ) continue;
 
-            m_modifiers.emplace_back( mod.modifier );
+            list.emplace_back( mod.modifier );
         }
     }
 }
@@ -48,3 +66,39 @@ DrmPlane::~DrmPlane()
 {
     drmModeFreePlane( m_plane );
 }
+
+const std::vector<uint64_t>& DrmPlane::Modifiers( uint32_t format ) const
+{
+    static const std::vector<uint64_t> none;
+    auto it = m_modifiers.find( format );
+    return it == m_modifiers.end() ? none : it->second;
+}
+
+void DrmPlane::Attach( DrmAtomic& req, uint32_t crtc, uint32_t fb, int32_t x, int32_t y, uint32_t width, uint32_t height, int inFence ) const
+{
+    req.Add( m_id, m_props.fbId, fb );
+    req.Add( m_id, m_props.crtcId, crtc );
+
+    // Source coordinates are in 16.16 fixed point
+    req.Add( m_id, m_props.srcX, 0 );
+    req.Add( m_id, m_props.srcY, 0 );
+    req.Add( m_id, m_props.srcW, uint64_t( width ) << 16 );
+    req.Add( m_id, m_props.srcH, uint64_t( height ) << 16 );
+    req.Add( m_id, m_props.crtcX, uint64_t( int64_t( x ) ) );
+    req.Add( m_id, m_props.crtcY, uint64_t( int64_t( y ) ) );
+    req.Add( m_id, m_props.crtcW, width );
+    req.Add( m_id, m_props.crtcH, height );
+
+    if( inFence >= 0 ) CheckPanic( req.Add( m_id, m_props.inFenceFd, inFence ), "Plane %u does not support in fences", m_id );
+}
+
+void DrmPlane::Detach( DrmAtomic& req ) const
+{
+    req.Add( m_id, m_props.fbId, 0 );
+    req.Add( m_id, m_props.crtcId, 0 );
+}
+
+void DrmPlane::SetDamage( DrmAtomic& req, uint32_t blob ) const
+{
+    req.Add( m_id, m_props.fbDamageClips, blob );
+}
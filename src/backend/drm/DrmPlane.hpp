@@ -5,8 +5,10 @@
 #include <vector>
 
 #include "util/NoCopy.hpp"
+#include "util/RobinHood.hpp"
 
 using drmModePlane = struct _drmModePlane;
+class DrmAtomic;
 
 class DrmPlane
 {
@@ -18,12 +20,42 @@ public:
 
     NoCopy( DrmPlane );
 
-    [[nodiscard]] auto& Modifiers() const { return m_modifiers; }
+    // Add the plane state to an atomic request. The whole framebuffer is shown unscaled, at the position on the
+    // CRTC. If the fence descriptor is not -1, scanout waits for it to signal.
+    void Attach( DrmAtomic& req, uint32_t crtc, uint32_t fb, int32_t x, int32_t y, uint32_t width, uint32_t height, int inFence = -1 ) const;
+    void Detach( DrmAtomic& req ) const;
+
+    // The blob holds drm_mode_rect damage in framebuffer coordinates. Drivers which upload or compress the
+    // framebuffer only touch that part.
+    void SetDamage( DrmAtomic& req, uint32_t blob ) const;
+
+    // Planes are shared by all connectors of the device. A claimed plane is not handed out to another CRTC.
+    void Claim() { m_used = true; }
+    void Release() { m_used = false; }
+
+    // Modifiers the plane can scan out in the given format, empty if the format is not supported
+    [[nodiscard]] const std::vector<uint64_t>& Modifiers( uint32_t format ) const;
     [[nodiscard]] auto Plane() const { return m_plane; }
     [[nodiscard]] auto Type() const { return m_type; }
+    [[nodiscard]] bool IsUsed() const { return m_used; }
+    [[nodiscard]] bool HasDamageClips() const { return m_props.fbDamageClips != 0; }
 
 private:
+    struct Properties
+    {
+        uint32_t fbId;
+        uint32_t crtcId;
+        uint32_t srcX, srcY, srcW, srcH;
+        uint32_t crtcX, crtcY, crtcW, crtcH;
+        uint32_t inFenceFd;
+        uint32_t fbDamageClips;
+    };
+
+    uint32_t m_id;
+    Properties m_props;
+
     drmModePlane* m_plane;
-    std::vector<uint64_t> m_modifiers;
+    unordered_flat_map<uint32_t, std::vector<uint64_t>> m_modifiers;
     uint64_t m_type;
+    bool m_used = false;
 };
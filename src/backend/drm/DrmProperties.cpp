@@ -31,6 +31,20 @@ drmModePropertyBlobPtr DrmProperty::Blob()
     return nullptr;
 }
 
+bool DrmProperty::EnumValue( const char* name, uint64_t& value ) const
+{
+    if( !m_prop || !( m_prop->flags & DRM_MODE_PROP_ENUM ) ) return false;
+    for( int i=0; i<m_prop->count_enums; i++ )
+    {
+        if( strcmp( m_prop->enums[i].name, name ) == 0 )
+        {
+            value = m_prop->enums[i].value;
+            return true;
+        }
+    }
+    return false;
+}
+
 /* DrmProperties */
 
 DrmProperties::DrmProperties( int fd, uint32_t id, uint32_t type )
@@ -70,3 +84,19 @@ DrmProperty DrmProperties::operator[]( const char* name ) const
     }
     return {};
 }
+
+uint32_t DrmProperties::Id( const char* name ) const
+{
+    ZoneScoped;
+    ZoneText( name, strlen( name ) );
+
+    for( int i=0; i<m_props->count_props; i++ )
+    {
+        auto prop = drmModeGetProperty( m_fd, m_props->props[i] );
+        if( !prop ) continue;
+        const auto found = strcmp( prop->name, name ) == 0;
+        drmModeFreeProperty( prop );
+        if( found ) return m_props->props[i];
+    }
+    return 0;
+}
@@ -16,6 +16,8 @@ public:
 
     [[nodiscard]] uint64_t Value() const { return m_value; }
     [[nodiscard]] drmModePropertyBlobPtr Blob();
+    // False if the property is not an enum, or has no such entry
+    [[nodiscard]] bool EnumValue( const char* name, uint64_t& value ) const;
 
     operator bool() const { return m_fd != 0; }
 
@@ -38,6 +40,7 @@ public:
     void List() const;
 
     [[nodiscard]] DrmProperty operator[]( const char* name ) const;
+    [[nodiscard]] uint32_t Id( const char* name ) const;       // 0 if the object has no such property
 
     operator bool() const { return m_props; }
 
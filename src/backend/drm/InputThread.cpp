@@ -0,0 +1,358 @@
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <errno.h>
+#include <fcntl.h>
+#include <libinput.h>
+#include <libudev.h>
+#include <memory>
+#include <mutex>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+
+#include "DbusLoginPaths.hpp"
+#include "InputThread.hpp"
+#include "dbus/DbusMessage.hpp"
+#include "dbus/DbusSession.hpp"
+#include "util/Logs.hpp"
+
+namespace
+{
+// Hands a device opened on the bus thread over to the input thread, which may have given up waiting
+struct PendingOpen
+{
+    std::mutex lock;
+    std::condition_variable cv;
+    int fd = -1;
+    bool done = false;
+    bool abandoned = false;
+};
+
+constexpr uint64_t PackPosition( int32_t x, int32_t y )
+{
+    return uint64_t( uint32_t( x ) ) << 32 | uint32_t( y );
+}
+
+// Called on the bus thread. Returns a descriptor owned by the caller, or a negative errno.
+int TakeDevice( const char* sessionPath, dev_t dev )
+{
+    ZoneScoped;
+
+    DbusSession bus;
+    auto reply = bus.Call( LoginService, sessionPath, LoginSessionIface, "TakeDevice", "uu", major( dev ), minor( dev ) );
+    if( !reply ) return -EACCES;
+
+    int fd;
+    int paused;
+    if( !reply.Read( "hb", &fd, &paused ) ) return -EACCES;
+
+    // The descriptor belongs to the message
+    const auto ret = fcntl( fd, F_DUPFD_CLOEXEC, 0 );
+    return ret < 0 ? -errno : ret;
+}
+
+void ReleaseDevice( const char* sessionPath, dev_t dev )
+{
+    DbusSession bus;
+    bus.Call( LoginService, sessionPath, LoginSessionIface, "ReleaseDevice", "uu", major( dev ), minor( dev ) );
+}
+}
+
+InputThread::InputThread( EventLoop& busLoop, const char* sessionPath, const char* seat, int32_t width, int32_t height )
+    : m_busLoop( busLoop )
+    , m_busThread( std::this_thread::get_id() )
+    , m_sessionPath( sessionPath )
+    , m_notify( eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) )
+    , m_width( std::max( width, 1 ) )
+    , m_height( std::max( height, 1 ) )
+    , m_x( m_width / 2 )
+    , m_y( m_height / 2 )
+    , m_cursor( PackPosition( m_width / 2, m_height / 2 ) )
+{
+    ZoneScoped;
+
+    if( m_notify < 0 ) throw InputException( "Failed to create eventfd" );
+
+    m_udev = udev_new();
+    if( !m_udev )
+    {
+        close( m_notify );
+        throw InputException( "Failed to create udev context" );
+    }
+
+    // The devices present now are opened right here, on the bus thread
+    static constexpr libinput_interface Interface = {
+        .open_restricted = OpenRestricted,
+        .close_restricted = CloseRestricted
+    };
+    m_input = libinput_udev_create_context( &Interface, this, m_udev );
+    if( !m_input || libinput_udev_assign_seat( m_input, seat ) != 0 )
+    {
+        if( m_input ) libinput_unref( m_input );
+        udev_unref( m_udev );
+        close( m_notify );
+        throw InputException( "Failed to set up libinput" );
+    }
+
+    m_thread = std::thread( [this] { Thread(); } );
+}
+
+InputThread::~InputThread()
+{
+    ZoneScoped;
+
+    m_loop.Stop();
+    m_thread.join();
+
+    // Back on the bus thread, so the devices are released directly
+    libinput_unref( m_input );
+    udev_unref( m_udev );
+    close( m_notify );
+}
+
+void InputThread::Acknowledge()
+{
+    uint64_t count;
+    (void)read( m_notify, &count, sizeof( count ) );
+}
+
+void InputThread::CursorPosition( int32_t& x, int32_t& y ) const
+{
+    const auto packed = m_cursor.load( std::memory_order_acquire );
+    x = int32_t( uint32_t( packed >> 32 ) );
+    y = int32_t( uint32_t( packed ) );
+}
+
+void InputThread::Suspend()
+{
+    m_loop.Post( [this] { libinput_suspend( m_input ); } );
+}
+
+void InputThread::Resume()
+{
+    m_loop.Post( [this] {
+        if( libinput_resume( m_input ) != 0 ) mclog( LogLevel::Warning, "Failed to resume input devices" );
+    } );
+}
+
+int InputThread::OpenRestricted( const char* path, int, void* user )
+{
+    return ((InputThread*)user)->Open( path );
+}
+
+void InputThread::CloseRestricted( int fd, void* user )
+{
+    ((InputThread*)user)->Close( fd );
+}
+
+int InputThread::Open( const char* path )
+{
+    ZoneScoped;
+
+    struct stat st;
+    if( stat( path, &st ) != 0 ) return -errno;
+    const auto dev = st.st_rdev;
+
+    int fd;
+    if( std::this_thread::get_id() == m_busThread )
+    {
+        fd = TakeDevice( m_sessionPath.c_str(), dev );
+    }
+    else
+    {
+        // Hotplug. The bus loop may be busy with a frame, or already stopped, and then the device is closed
+        // again by whoever gets to it last.
+        auto pending = std::make_shared<PendingOpen>();
+        m_busLoop.Post( [pending, sessionPath = m_sessionPath, dev] {
+            const auto fd = TakeDevice( sessionPath.c_str(), dev );
+            std::lock_guard lock( pending->lock );
+            if( pending->abandoned )
+            {
+                if( fd >= 0 )
+                {
+                    close( fd );
+                    ReleaseDevice( sessionPath.c_str(), dev );
+                }
+                return;
+            }
+            pending->fd = fd;
+            pending->done = true;
+            pending->cv.notify_one();
+        } );
+
+        std::unique_lock lock( pending->lock );
+        while( !pending->cv.wait_for( lock, std::chrono::milliseconds( 100 ), [&pending] { return pending->done; } ) )
+        {
+            if( m_loop.IsStopped() )
+            {
+                pending->abandoned = true;
+                return -ENODEV;
+            }
+        }
+        fd = pending->fd;
+    }
+
+    if( fd < 0 )
+    {
+        mclog( LogLevel::Warning, "Failed to open input device %s: %s", path, strerror( -fd ) );
+        return fd;
+    }
+    m_devices.emplace( fd, dev );
+    return fd;
+}
+
+void InputThread::Close( int fd )
+{
+    close( fd );
+
+    auto it = m_devices.find( fd );
+    if( it == m_devices.end() ) return;
+    const auto dev = it->second;
+    m_devices.erase( it );
+
+    if( std::this_thread::get_id() == m_busThread )
+    {
+        ReleaseDevice( m_sessionPath.c_str(), dev );
+    }
+    else
+    {
+        m_busLoop.Post( [sessionPath = m_sessionPath, dev] { ReleaseDevice( sessionPath.c_str(), dev ); } );
+    }
+}
+
+void InputThread::Thread()
+{
+    tracy::SetThreadName( "Input" );
+
+    const auto fd = libinput_get_fd( m_input );
+    m_loop.AddFd( fd, EPOLLIN, [this]( uint32_t ) { Dispatch(); } );
+
+    // Events of the devices added at setup are already waiting
+    Dispatch();
+    m_loop.Run();
+
+    m_loop.RemoveFd( fd );
+}
+
+void InputThread::Dispatch()
+{
+    ZoneScoped;
+
+    if( const auto res = libinput_dispatch( m_input ); res != 0 )
+    {
+        mclog( LogLevel::Warning, "Failed to dispatch input: %s", strerror( -res ) );
+        return;
+    }
+
+    bool queued = false;
+    while( auto event = libinput_get_event( m_input ) )
+    {
+        queued |= Handle( event );
+        libinput_event_destroy( event );
+    }
+
+    // One wakeup per batch, the consumer drains everything there is
+    if( queued )
+    {
+        const uint64_t one = 1;
+        (void)write( m_notify, &one, sizeof( one ) );
+    }
+}
+
+bool InputThread::Handle( libinput_event* event )
+{
+    switch( libinput_event_get_type( event ) )
+    {
+    case LIBINPUT_EVENT_DEVICE_ADDED:
+        mclog( LogLevel::Info, "Input device added: %s", libinput_device_get_name( libinput_event_get_device( event ) ) );
+        return false;
+    case LIBINPUT_EVENT_DEVICE_REMOVED:
+        mclog( LogLevel::Info, "Input device removed: %s", libinput_device_get_name( libinput_event_get_device( event ) ) );
+        return false;
+    case LIBINPUT_EVENT_POINTER_MOTION:
+    {
+        auto pointer = libinput_event_get_pointer_event( event );
+        const auto x0 = m_x;
+        const auto y0 = m_y;
+        Move( m_x + libinput_event_pointer_get_dx( pointer ), m_y + libinput_event_pointer_get_dy( pointer ) );
+        return Push( { .type = InputEvent::Type::Motion, .dx = float( m_x - x0 ), .dy = float( m_y - y0 ), .time = libinput_event_pointer_get_time_usec( pointer ) } );
+    }
+    case LIBINPUT_EVENT_POINTER_MOTION_ABSOLUTE:
+    {
+        auto pointer = libinput_event_get_pointer_event( event );
+        const auto x0 = m_x;
+        const auto y0 = m_y;
+        Move( libinput_event_pointer_get_absolute_x_transformed( pointer, m_width ), libinput_event_pointer_get_absolute_y_transformed( pointer, m_height ) );
+        return Push( { .type = InputEvent::Type::Motion, .dx = float( m_x - x0 ), .dy = float( m_y - y0 ), .time = libinput_event_pointer_get_time_usec( pointer ) } );
+    }
+    case LIBINPUT_EVENT_POINTER_BUTTON:
+    {
+        auto pointer = libinput_event_get_pointer_event( event );
+        return Push( {
+            .type = InputEvent::Type::Button,
+            .code = libinput_event_pointer_get_button( pointer ),
+            .state = libinput_event_pointer_get_button_state( pointer ) == LIBINPUT_BUTTON_STATE_PRESSED ? 1u : 0u,
+            .time = libinput_event_pointer_get_time_usec( pointer )
+        } );
+    }
+    case LIBINPUT_EVENT_POINTER_SCROLL_WHEEL:
+    case LIBINPUT_EVENT_POINTER_SCROLL_FINGER:
+    case LIBINPUT_EVENT_POINTER_SCROLL_CONTINUOUS:
+    {
+        const auto type = libinput_event_get_type( event );
+        auto pointer = libinput_event_get_pointer_event( event );
+        auto value = [type, pointer]( libinput_pointer_axis axis ) {
+            if( !libinput_event_pointer_has_axis( pointer, axis ) ) return 0.f;
+            if( type == LIBINPUT_EVENT_POINTER_SCROLL_WHEEL ) return float( libinput_event_pointer_get_scroll_value_v120( pointer, axis ) / 120 );
+            return float( libinput_event_pointer_get_scroll_value( pointer, axis ) );
+        };
+        const auto source = type == LIBINPUT_EVENT_POINTER_SCROLL_WHEEL ? LIBINPUT_POINTER_AXIS_SOURCE_WHEEL :
+            type == LIBINPUT_EVENT_POINTER_SCROLL_FINGER ? LIBINPUT_POINTER_AXIS_SOURCE_FINGER : LIBINPUT_POINTER_AXIS_SOURCE_CONTINUOUS;
+        return Push( {
+            .type = InputEvent::Type::Scroll,
+            .code = uint32_t( source ),
+            .dx = value( LIBINPUT_POINTER_AXIS_SCROLL_HORIZONTAL ),
+            .dy = value( LIBINPUT_POINTER_AXIS_SCROLL_VERTICAL ),
+            .time = libinput_event_pointer_get_time_usec( pointer )
+        } );
+    }
+    case LIBINPUT_EVENT_KEYBOARD_KEY:
+    {
+        auto keyboard = libinput_event_get_keyboard_event( event );
+        return Push( {
+            .type = InputEvent::Type::Key,
+            .code = libinput_event_keyboard_get_key( keyboard ),
+            .state = libinput_event_keyboard_get_key_state( keyboard ) == LIBINPUT_KEY_STATE_PRESSED ? 1u : 0u,
+            .time = libinput_event_keyboard_get_time_usec( keyboard )
+        } );
+    }
+    default:
+        return false;
+    }
+}
+
+void InputThread::Move( double x, double y )
+{
+    m_x = std::clamp( x, 0., double( m_width - 1 ) );
+    m_y = std::clamp( y, 0., double( m_height - 1 ) );
+    m_cursor.store( PackPosition( int32_t( m_x ), int32_t( m_y ) ), std::memory_order_release );
+}
+
+bool InputThread::Push( const InputEvent& event )
+{
+    if( !m_queue.Push( event ) )
+    {
+        m_dropped++;
+        return false;
+    }
+    if( m_dropped != 0 )
+    {
+        mclog( LogLevel::Warning, "Input queue was full, %u events dropped", m_dropped );
+        m_dropped = 0;
+    }
+    return true;
+}
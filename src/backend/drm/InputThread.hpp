@@ -0,0 +1,100 @@
+#pragma once
+
+#include <atomic>
+#include <stdexcept>
+#include <stdint.h>
+#include <string>
+#include <sys/types.h>
+#include <thread>
+
+#include "util/EventLoop.hpp"
+#include "util/NoCopy.hpp"
+#include "util/RobinHood.hpp"
+#include "util/SpscQueue.hpp"
+
+struct libinput;
+struct libinput_event;
+struct udev;
+
+struct InputEvent
+{
+    enum class Type : uint8_t
+    {
+        Motion,         // Pointer moved by dx, dy, already applied to the cursor position
+        Button,         // Linux input code, state is 1 if pressed
+        Scroll,         // dx, dy in wheel clicks for wheels, in pixels otherwise, code is the libinput axis source
+        Key             // Linux input code, state is 1 if pressed
+    };
+
+    Type type;
+    uint32_t code;
+    uint32_t state;
+    float dx, dy;
+    uint64_t time;      // Microseconds, CLOCK_MONOTONIC, as reported by the device
+};
+
+// Reads libinput on a thread of its own, so that input is never held back by a frame being built on the loop
+// thread. Events are passed to the loop thread in a lock-free ring, and Descriptor() becomes readable whenever
+// new ones were queued.
+//
+// The pointer position is tracked on the input thread and published with each batch, so that the cursor can be
+// moved to the latest position before the queued events are looked at.
+//
+// Devices are opened through logind. That is done on the thread which created the object, and which owns the
+// session bus, so the input thread hands device hotplug over to the loop running there.
+class InputThread
+{
+public:
+    struct InputException : public std::runtime_error { explicit InputException( const std::string& msg ) : std::runtime_error( msg ) {} };
+
+    using Queue = SpscQueue<InputEvent, 1024>;
+
+    // The pointer is kept within the width and height of the scene layout
+    InputThread( EventLoop& busLoop, const char* sessionPath, const char* seat, int32_t width, int32_t height );
+    ~InputThread();
+
+    NoCopy( InputThread );
+
+    // Consumer side, on the bus loop thread. Acknowledge() clears the readable state of the descriptor, and must
+    // be called before the queue is drained, so that no batch goes unnoticed.
+    [[nodiscard]] int Descriptor() const { return m_notify; }
+    void Acknowledge();
+    bool Pop( InputEvent& event ) { return m_queue.Pop( event ); }
+    void CursorPosition( int32_t& x, int32_t& y ) const;
+
+    // Session switch. Devices are closed while suspended, and opened again on resume.
+    void Suspend();
+    void Resume();
+
+private:
+    static int OpenRestricted( const char* path, int flags, void* user );
+    static void CloseRestricted( int fd, void* user );
+
+    int Open( const char* path );
+    void Close( int fd );
+
+    void Thread();
+    void Dispatch();
+    bool Handle( libinput_event* event );
+    void Move( double x, double y );
+    bool Push( const InputEvent& event );
+
+    EventLoop& m_busLoop;
+    std::thread::id m_busThread;
+    std::string m_sessionPath;
+
+    udev* m_udev = nullptr;
+    libinput* m_input = nullptr;
+    unordered_flat_map<int, dev_t> m_devices;       // By descriptor, only touched by the thread owning m_input
+
+    int m_notify;
+    Queue m_queue;
+    uint32_t m_dropped = 0;
+
+    int32_t m_width, m_height;
+    double m_x, m_y;
+    std::atomic<uint64_t> m_cursor;     // Packed x and y, whole pixels
+
+    EventLoop m_loop;
+    std::thread m_thread;
+};
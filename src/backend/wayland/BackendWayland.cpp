@@ -6,9 +6,10 @@
 #include "BackendWayland.hpp"
 #include "backend/GpuDevice.hpp"
 #include "server/Server.hpp"
-#include "util/Config.hpp"
+#include "util/ConfigRegistry.hpp"
 #include "util/Invoke.hpp"
 #include "util/Panic.hpp"
+#include "util/TaskDispatch.hpp"
 #include "vulkan/VlkCommandBuffer.hpp"
 #include "vulkan/VlkDevice.hpp"
 #include "vulkan/VlkInstance.hpp"
@@ -27,7 +28,7 @@ BackendWayland::~BackendWayland()
     m_windows.clear();
 }
 
-void BackendWayland::VulkanInit()
+void BackendWayland::VulkanInit( TaskDispatch& td )
 {
     ZoneScoped;
 
@@ -41,21 +42,33 @@ void BackendWayland::VulkanInit()
         mclog( LogLevel::Info, "  %d: %s", idx++, dev->Properties().deviceName );
     }
 
+    // Devices are created in parallel, but keep the order of the physical devices
+    std::vector<std::shared_ptr<GpuDevice>> gpus( devices.size() );
+    TaskGroup group;
+    for( size_t i=0; i<devices.size(); i++ )
+    {
+        td.Queue( group, [&vkInstance, &devices, &gpus, i] {
+            ZoneScopedN( "GPU setup" );
+            try
+            {
+                gpus[i] = std::make_shared<GpuDevice>( vkInstance, devices[i] );
+            }
+            catch( const std::exception& e )
+            {
+                mclog( LogLevel::Fatal, "Failed to initialize GPU: %s", e.what() );
+            }
+        } );
+    }
+    group.Wait();
+
     m_gpus.reserve( devices.size() );
-    for( auto& dev : devices )
+    for( auto& gpu : gpus )
     {
-        try
-        {
-            m_gpus.emplace_back( std::make_shared<GpuDevice>( vkInstance, dev ) );
-        }
-        catch( const std::exception& e )
-        {
-            mclog( LogLevel::Fatal, "Failed to initialize GPU: %s", e.what() );
-        }
+        if( gpu ) m_gpus.emplace_back( std::move( gpu ) );
     }
 
-    Config config( "backend-wayland.ini" );
-    if( config )
+    const auto config = ConfigRegistry::Instance().Get( "backend-wayland.ini" );
+    if( *config )
     {
         bool windowAdded = false;
         int idx = 0;
@@ -64,10 +77,14 @@ void BackendWayland::VulkanInit()
             const auto section = std::format( "Window{}", idx );
             int physDev;
             uint32_t width, height;
-            if( !config.GetOpt( section.c_str(), "PhysicalDevice", physDev ) ) break;
-            width = config.Get( section.c_str(), "Width", 1650u );
-            height = config.Get( section.c_str(), "Height", 1050u );
+            if( !config->GetOpt( section.c_str(), "PhysicalDevice", physDev ) ) break;
+            width = config->Get( section.c_str(), "Width", 1650u );
+            height = config->Get( section.c_str(), "Height", 1050u );
             OpenWindow( physDev, width, height, section.c_str() );
+            m_windows.back()->SetPresentMode(
+                VlkSwapchain::ParsePresentMode( config->Get( section.c_str(), "PresentMode", "fifo" ) ),
+                config->Get( section.c_str(), "SwapchainImages", 0u ),
+                config->Get( section.c_str(), "FramesInFlight", 0u ) );
             windowAdded = true;
             idx++;
         }
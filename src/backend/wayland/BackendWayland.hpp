@@ -18,7 +18,7 @@ public:
 
     NoCopy( BackendWayland );
 
-    void VulkanInit() override;
+    void VulkanInit( TaskDispatch& td ) override;
 
     void Run() override;
     void Stop() override;
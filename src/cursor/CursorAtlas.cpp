@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <bit>
+#include <cmath>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+
+#include "CursorAtlas.hpp"
+#include "CursorBase.hpp"
+#include "util/Bitmap.hpp"
+#include "util/Logs.hpp"
+#include "util/Panic.hpp"
+#include "vulkan/ext/Texture.hpp"
+
+namespace
+{
+// Shelf packing, tallest images first. Returns the atlas height, or 0 if the images don't fit in the width.
+uint32_t Pack( std::vector<CursorAtlas::Entry>& entries, const std::vector<uint32_t>& order, uint32_t width )
+{
+    uint32_t x = 0;
+    uint32_t y = 0;
+    uint32_t shelf = 0;
+    for( auto idx : order )
+    {
+        auto& e = entries[idx];
+        if( e.width + CursorAtlas::Padding > width ) return 0;
+        if( x + e.width + CursorAtlas::Padding > width )
+        {
+            x = 0;
+            y += shelf;
+            shelf = 0;
+        }
+        e.x = x;
+        e.y = y;
+        x += e.width + CursorAtlas::Padding;
+        shelf = std::max( shelf, e.height + CursorAtlas::Padding );
+    }
+    return y + shelf;
+}
+}
+
+CursorAtlas::CursorAtlas( const CursorBase& cursor, uint32_t size )
+    : m_size( size )
+{
+    ZoneScoped;
+
+    auto def = cursor.Get( size, CursorType::Default );
+    CheckPanic( def && !def->bitmaps.empty(), "No default cursor at size %u", size );
+
+    // Types falling back to the default cursor share its entries
+    std::vector<const Bitmap*> bitmaps;
+    uint64_t area = 0;
+    for( int i=0; i<(int)CursorType::NUM; i++ )
+    {
+        auto data = cursor.Get( size, (CursorType)i );
+        if( !data || data->bitmaps.empty() ) data = def;
+        m_data[i] = data;
+
+        auto it = std::ranges::find( m_data.begin(), m_data.begin() + i, data );
+        if( it != m_data.begin() + i )
+        {
+            m_first[i] = m_first[it - m_data.begin()];
+            continue;
+        }
+
+        m_first[i] = uint32_t( m_entries.size() );
+        for( auto& bmp : data->bitmaps )
+        {
+            m_entries.emplace_back( Entry { 0, 0, bmp.bitmap->Width(), bmp.bitmap->Height(), bmp.xhot, bmp.yhot } );
+            bitmaps.emplace_back( bmp.bitmap.get() );
+            area += uint64_t( bmp.bitmap->Width() + Padding ) * ( bmp.bitmap->Height() + Padding );
+        }
+    }
+
+    std::vector<uint32_t> order( m_entries.size() );
+    for( uint32_t i=0; i<order.size(); i++ ) order[i] = i;
+    std::ranges::stable_sort( order, [this]( auto a, auto b ) { return m_entries[a].height > m_entries[b].height; } );
+
+    // Square power of two to start with, made wider until the shelves fit
+    auto width = std::bit_ceil( uint32_t( std::ceil( std::sqrt( double( area ) ) ) ) );
+    uint32_t height;
+    while( ( height = Pack( m_entries, order, width ) ) == 0 || height > width ) width *= 2;
+
+    m_pixels = std::make_unique<Bitmap>( width, height );
+    memset( m_pixels->Data(), 0, size_t( width ) * height * 4 );
+    for( size_t i=0; i<m_entries.size(); i++ )
+    {
+        auto& e = m_entries[i];
+        auto src = bitmaps[i]->Data();
+        auto dst = m_pixels->Data() + ( size_t( e.y ) * width + e.x ) * 4;
+        for( uint32_t y=0; y<e.height; y++ )
+        {
+            memcpy( dst, src, e.width * 4 );
+            src += e.width * 4;
+            dst += size_t( width ) * 4;
+        }
+    }
+
+    mclog( LogLevel::Debug, "Cursor atlas at size %u: %zu images in %ux%u", size, m_entries.size(), width, height );
+}
+
+CursorAtlas::~CursorAtlas() = default;
+
+const CursorAtlas::Entry& CursorAtlas::Get( CursorType type, uint32_t bitmap ) const
+{
+    CheckPanic( bitmap < m_data[(int)type]->bitmaps.size(), "Cursor bitmap %u out of range", bitmap );
+    return m_entries[m_first[(int)type] + bitmap];
+}
+
+std::shared_ptr<Texture> CursorAtlas::Upload( VlkDevice& device, std::vector<std::shared_ptr<VlkFence>>& fencesOut ) const
+{
+    ZoneScoped;
+    return std::make_shared<Texture>( device, *m_pixels, Format, Texture::Mips::None, fencesOut );
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "CursorType.hpp"
+#include "util/NoCopy.hpp"
+
+class Bitmap;
+class CursorBase;
+struct CursorData;
+class Texture;
+class VlkDevice;
+class VlkFence;
+
+// Every image of every cursor type at one size, packed into a single bitmap. Uploaded once, so that a shape change
+// or the next frame of an animation only selects a different rectangle.
+//
+// Pixels are kept as the cursor files store them, premultiplied BGRA, which is ARGB8888 in DRM terms.
+class CursorAtlas
+{
+public:
+    struct Entry
+    {
+        uint32_t x, y;
+        uint32_t width, height;
+        uint32_t xhot, yhot;
+    };
+
+    static constexpr uint32_t Padding = 1;      // Between entries, so that filtering doesn't bleed
+    static constexpr VkFormat Format = VK_FORMAT_B8G8R8A8_SRGB;
+
+    CursorAtlas( const CursorBase& cursor, uint32_t size );
+    ~CursorAtlas();
+
+    NoCopy( CursorAtlas );
+
+    // The bitmap index is the one in CursorFrame::frame. Types missing in the theme use the default cursor, as
+    // CursorBase::Get() does.
+    [[nodiscard]] const Entry& Get( CursorType type, uint32_t bitmap ) const;
+    [[nodiscard]] const CursorData& Data( CursorType type ) const { return *m_data[(int)type]; }
+
+    [[nodiscard]] const std::vector<Entry>& Entries() const { return m_entries; }
+    [[nodiscard]] const Bitmap& Pixels() const { return *m_pixels; }
+    [[nodiscard]] uint32_t Size() const { return m_size; }
+
+    [[nodiscard]] std::shared_ptr<Texture> Upload( VlkDevice& device, std::vector<std::shared_ptr<VlkFence>>& fencesOut ) const;
+
+private:
+    uint32_t m_size;
+    std::unique_ptr<Bitmap> m_pixels;
+    std::vector<Entry> m_entries;
+
+    std::array<const CursorData*, (int)CursorType::NUM> m_data;
+    std::array<uint32_t, (int)CursorType::NUM> m_first;     // Index of the first entry of each type
+};
@@ -1,10 +1,25 @@
+#include <tracy/Tracy.hpp>
+
 #include "CursorBase.hpp"
 
 const CursorData* CursorBase::Get( uint32_t size, CursorType type ) const
 {
+    std::lock_guard lock( m_lock );
     auto it = m_cursor.find( size );
     if( it == m_cursor.end() ) return nullptr;
-    auto& t = it->second.type[(int)type];
-    if( t.bitmaps.empty() ) return &it->second.type[(int)CursorType::Default];
+    auto& t = Load( size, it->second, type );
+    if( t.bitmaps.empty() ) return &Load( size, it->second, CursorType::Default );
     return &t;
 }
+
+CursorData& CursorBase::Load( uint32_t size, CursorSize& data, CursorType type ) const
+{
+    auto& t = data.type[(int)type];
+    if( data.pending[(int)type] )
+    {
+        ZoneScopedN( "Cursor decode" );
+        data.pending[(int)type] = false;
+        Decode( size, type, t );
+    }
+    return t;
+}
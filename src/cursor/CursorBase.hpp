@@ -2,6 +2,7 @@
 
 #include <array>
 #include <memory>
+#include <mutex>
 #include <vector>
 
 #include "CursorType.hpp"
@@ -32,6 +33,7 @@ struct CursorData
 struct CursorSize
 {
     std::array<CursorData, (int)CursorType::NUM> type;
+    std::array<bool, (int)CursorType::NUM> pending = {};    // In the theme, but not decoded yet
 };
 
 class CursorBase
@@ -42,11 +44,23 @@ public:
     NoCopy( CursorBase );
 
     [[nodiscard]] virtual uint32_t FitSize( uint32_t size ) const = 0;
+    // The best size to resample from: the smallest one not below the requested size, or the largest one
+    [[nodiscard]] virtual uint32_t SourceSize( uint32_t size ) const = 0;
+    // Decodes pending data on first use. Thread safe.
     [[nodiscard]] const CursorData* Get( uint32_t size, CursorType type ) const;
     [[nodiscard]] bool Valid() const { return !m_cursor.empty(); }
 
 protected:
     CursorBase() = default;
 
-    unordered_flat_map<uint32_t, CursorSize> m_cursor;
+    // Loaders which only read the table of contents up front mark the data pending, and fill it in here
+    virtual void Decode( uint32_t size, CursorType type, CursorData& data ) const {}
+
+    // Sizes must all be known at construction, so that the data doesn't move
+    mutable unordered_flat_map<uint32_t, CursorSize> m_cursor;
+
+private:
+    CursorData& Load( uint32_t size, CursorSize& data, CursorType type ) const;
+
+    mutable std::mutex m_lock;
 };
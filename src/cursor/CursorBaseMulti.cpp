@@ -23,6 +23,14 @@ uint32_t CursorBaseMulti::FitSize( uint32_t size ) const
     return dnext > dprev ? prev : next;
 }
 
+uint32_t CursorBaseMulti::SourceSize( uint32_t size ) const
+{
+    CheckPanic( !m_sizes.empty(), "Sizes are not calculated" );
+
+    const auto it = std::lower_bound( m_sizes.begin(), m_sizes.end(), size );
+    return it == m_sizes.end() ? m_sizes.back() : *it;
+}
+
 void CursorBaseMulti::CalcSizes()
 {
     CheckPanic( !m_cursor.empty(), "Cursor is empty" );
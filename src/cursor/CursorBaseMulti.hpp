@@ -9,6 +9,7 @@ class CursorBaseMulti : public CursorBase
 {
 public:
     [[nodiscard]] uint32_t FitSize( uint32_t size ) const override;
+    [[nodiscard]] uint32_t SourceSize( uint32_t size ) const override;
 
     NoCopy( CursorBaseMulti );
 
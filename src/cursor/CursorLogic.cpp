@@ -47,11 +47,14 @@ void CursorLogic::SetCursor( CursorType type )
 
 [[nodiscard]] const CursorBitmap& CursorLogic::GetCurrentCursorFrame() const
 {
-    CheckPanic( m_cursor, "Cursor is not set" );
-    if( m_cursor->bitmaps.size() == 1 ) return m_cursor->bitmaps.front();
+    return m_cursor->bitmaps[GetCurrentBitmap()];
+}
 
-    const auto animFrame = m_cursor->frames[m_frame];
-    return m_cursor->bitmaps[animFrame.frame];
+uint32_t CursorLogic::GetCurrentBitmap() const
+{
+    CheckPanic( m_cursor, "Cursor is not set" );
+    if( m_cursor->bitmaps.size() == 1 ) return 0;
+    return m_cursor->frames[m_frame].frame;
 }
 
 bool CursorLogic::NeedUpdate()
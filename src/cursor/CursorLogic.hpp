@@ -19,6 +19,10 @@ public:
     void SetCursor( CursorType type );
     [[nodiscard]] const CursorBitmap& GetCurrentCursorFrame() const;
 
+    // Together they select the CursorAtlas entry to show
+    [[nodiscard]] CursorType GetType() const { return m_type; }
+    [[nodiscard]] uint32_t GetCurrentBitmap() const;
+
     bool NeedUpdate();
 
 private:
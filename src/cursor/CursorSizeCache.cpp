@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include "CursorSizeCache.hpp"
+#include "util/Bitmap.hpp"
+#include "util/Logs.hpp"
+#include "util/TaskDispatch.hpp"
+
+CursorSizeCache::CursorSizeCache( const CursorBase& cursor, TaskDispatch& td )
+    : m_cursor( cursor )
+    , m_td( td )
+    , m_jobs( std::make_unique<TaskGroup>() )
+{
+}
+
+CursorSizeCache::~CursorSizeCache()
+{
+    m_jobs->Wait();
+}
+
+void CursorSizeCache::Prepare( uint32_t size )
+{
+    if( size == 0 || m_cursor.FitSize( size ) == size ) return;
+
+    {
+        std::lock_guard lock( m_lock );
+        if( m_sizes.contains( size ) ) return;
+        m_sizes.emplace( size, nullptr );
+    }
+
+    mclog( LogLevel::Debug, "Resampling cursors to size %u from %u", size, m_cursor.SourceSize( size ) );
+    m_td.Queue( *m_jobs, [this, size] {
+        TaskDispatch::ScopedPriority priority( TaskDispatch::Priority::Background );
+        auto data = std::make_unique<CursorSize>();
+        Resample( size, *data );
+
+        std::lock_guard lock( m_lock );
+        m_sizes[size] = std::move( data );
+    } );
+}
+
+const CursorData* CursorSizeCache::Get( uint32_t size, CursorType type ) const
+{
+    {
+        std::lock_guard lock( m_lock );
+        auto it = m_sizes.find( size );
+        if( it != m_sizes.end() && it->second )
+        {
+            auto& data = it->second->type[(int)type];
+            if( !data.bitmaps.empty() ) return &data;
+            return &it->second->type[(int)CursorType::Default];
+        }
+    }
+    return m_cursor.Get( m_cursor.FitSize( size ), type );
+}
+
+bool CursorSizeCache::IsReady( uint32_t size ) const
+{
+    if( m_cursor.FitSize( size ) == size ) return true;
+    std::lock_guard lock( m_lock );
+    auto it = m_sizes.find( size );
+    return it != m_sizes.end() && it->second;
+}
+
+void CursorSizeCache::Resample( uint32_t size, CursorSize& data ) const
+{
+    ZoneScoped;
+    ZoneValue( size );
+
+    // Types missing in the theme get the default cursor from Get(), and are left empty here
+    const auto source = m_cursor.SourceSize( size );
+    const auto def = m_cursor.Get( source, CursorType::Default );
+    for( int i=0; i<(int)CursorType::NUM; i++ )
+    {
+        auto src = m_cursor.Get( source, (CursorType)i );
+        if( !src || ( i != (int)CursorType::Default && src == def ) ) continue;
+
+        auto& dst = data.type[i];
+        dst.frames = src->frames;
+        dst.bitmaps.reserve( src->bitmaps.size() );
+        for( auto& bmp : src->bitmaps )
+        {
+            const auto w = std::max( 1u, uint32_t( uint64_t( bmp.bitmap->Width() ) * size / source ) );
+            const auto h = std::max( 1u, uint32_t( uint64_t( bmp.bitmap->Height() ) * size / source ) );
+            dst.bitmaps.emplace_back( CursorBitmap {
+                .bitmap = bmp.bitmap->ResizeNew( w, h ),
+                .xhot = uint32_t( uint64_t( bmp.xhot ) * size / source ),
+                .yhot = uint32_t( uint64_t( bmp.yhot ) * size / source )
+            } );
+        }
+    }
+}
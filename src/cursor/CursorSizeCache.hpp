@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+#include "CursorBase.hpp"
+#include "CursorType.hpp"
+#include "util/NoCopy.hpp"
+#include "util/RobinHood.hpp"
+
+class TaskDispatch;
+class TaskGroup;
+
+// Cursor images at the exact sizes the outputs need. Sizes missing in the theme are resampled from the nearest
+// larger one, in the background, when an output asks for them with Prepare(). Get() never resamples; until the
+// resampled images are ready it returns the theme's closest size.
+class CursorSizeCache
+{
+public:
+    CursorSizeCache( const CursorBase& cursor, TaskDispatch& td );
+    ~CursorSizeCache();
+
+    NoCopy( CursorSizeCache );
+
+    // Call when an output appears or changes its scale. Thread safe.
+    void Prepare( uint32_t size );
+
+    // The returned data stays valid for the lifetime of the cache. Thread safe.
+    [[nodiscard]] const CursorData* Get( uint32_t size, CursorType type ) const;
+    [[nodiscard]] bool IsReady( uint32_t size ) const;
+
+private:
+    void Resample( uint32_t size, CursorSize& data ) const;
+
+    const CursorBase& m_cursor;
+    TaskDispatch& m_td;
+    std::unique_ptr<TaskGroup> m_jobs;
+
+    mutable std::mutex m_lock;
+    unordered_flat_map<uint32_t, std::unique_ptr<CursorSize>> m_sizes;     // nullptr while resampling
+};
@@ -3,13 +3,13 @@
 #include "CursorTheme.hpp"
 #include "WinCursor.hpp"
 #include "XCursor.hpp"
-#include "util/Config.hpp"
+#include "util/ConfigRegistry.hpp"
 
 CursorTheme::CursorTheme()
 {
-    Config config( "mouse.ini" );
+    const auto config = ConfigRegistry::Instance().Get( "mouse.ini" );
 
-    const auto themeName = config.Get( "Theme", "Name", "default" );
+    const auto themeName = config->Get( "Theme", "Name", "default" );
     m_cursor = std::make_unique<XCursor>( themeName );
     if( !m_cursor->Valid() )
     {
@@ -17,7 +17,7 @@ CursorTheme::CursorTheme()
         if( !m_cursor->Valid() ) throw( CursorException( std::format( "Cannot load mouse cursor theme {}", themeName ) ) );
     }
 
-    m_size = m_cursor->FitSize( config.Get( "Theme", "Size", 24 ) );
+    m_size = m_cursor->FitSize( config->Get( "Theme", "Size", 24 ) );
 }
 
 CursorTheme::~CursorTheme()
@@ -4,7 +4,9 @@
 #include <stdlib.h>
 #include <string>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
+#include <unistd.h>
 #include <ranges>
 #include <vector>
 
@@ -12,7 +14,7 @@
 #include "XCursor.hpp"
 #include "util/Bitmap.hpp"
 #include "util/Config.hpp"
-#include "util/FileWrapper.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/Home.hpp"
 #include "util/Logs.hpp"
 #include "util/RobinHood.hpp"
@@ -180,35 +182,47 @@ struct XcursorImage
     uint32_t delay;
 };
 
-static bool LoadCursor( const std::string& path, int cursorType, unordered_flat_map<uint32_t, CursorSize>& cursor )
+bool XCursor::ReadToc( const std::string& path, int type )
 {
-    FileWrapper f( path.c_str(), "rb" );
-    if( !f ) return false;
+    if( access( path.c_str(), R_OK ) != 0 ) return false;
+
+    std::unique_ptr<FileBuffer> file;
+    try
+    {
+        file = std::make_unique<FileBuffer>( path.c_str() );
+    }
+    catch( const FileBuffer::FileException& )
+    {
+        return false;
+    }
 
     XcursorHdr hdr;
-    if( !f.Read( &hdr, sizeof( hdr ) ) || memcmp( &hdr.magic, "Xcur", 4 ) != 0 ) return false;
+    if( file->size() < sizeof( hdr ) ) return false;
+    memcpy( &hdr, file->data(), sizeof( hdr ) );
+    if( memcmp( &hdr.magic, "Xcur", 4 ) != 0 ) return false;
+    if( hdr.header + uint64_t( hdr.ntoc ) * sizeof( XcursorToc ) > file->size() ) return false;
 
-    std::vector<XcursorToc> toc( hdr.ntoc );
-    if( !f.Read( toc.data(), sizeof( XcursorToc ) * hdr.ntoc ) ) return false;
+    // Only a few images of the one size in use are ever read
+    madvise( (void*)file->data(), file->size(), MADV_RANDOM );
 
-    for( auto& v : toc )
+    bool found = false;
+    auto toc = file->data() + hdr.header;
+    for( uint32_t i=0; i<hdr.ntoc; i++ )
     {
+        XcursorToc v;
+        memcpy( &v, toc + i * sizeof( XcursorToc ), sizeof( v ) );
         if( v.type != XcursorTypeImage ) continue;
-        fseek( f, v.pos + XcursorChunkHdrSize, SEEK_SET );
-        XcursorImage img;
-        if( !f.Read( &img, sizeof( XcursorImage ) ) ) return false;
+        if( v.pos + XcursorChunkHdrSize + sizeof( XcursorImage ) > file->size() ) continue;
 
-        auto bitmap = std::make_shared<Bitmap>( img.width, img.height );
-        if( !f.Read( bitmap->Data(), img.width * img.height * 4 ) ) return false;
-
-        auto it = cursor.find( v.subtype );
-        if( it == cursor.end() ) it = cursor.emplace( v.subtype, CursorSize {} ).first;
-
-        auto& cursorData = it->second.type[cursorType];
-        cursorData.frames.emplace_back( CursorFrame { img.delay * 1000, (uint32_t)cursorData.bitmaps.size() } );
-        cursorData.bitmaps.emplace_back( CursorBitmap { std::move( bitmap ), img.xhot, img.yhot } );
+        auto it = m_cursor.find( v.subtype );
+        if( it == m_cursor.end() ) it = m_cursor.emplace( v.subtype, CursorSize {} ).first;
+        it->second.pending[type] = true;
+        m_images[v.subtype][type].emplace_back( v.pos );
+        found = true;
     }
+    if( !found ) return false;
 
+    m_files[type] = std::move( file );
     return true;
 }
 
@@ -222,10 +236,10 @@ XCursor::XCursor( const char* theme )
     {
         for( int i=0; i<numTypes; i++ )
         {
-            if( std::ranges::any_of( m_cursor, [i]( const auto& v ){ return !v.second.type[i].bitmaps.empty(); } ) ) continue;
+            if( m_files[i] ) continue;
 
             const auto path = td + CursorNames[i];
-            if( LoadCursor( path, i, m_cursor ) ) left--;
+            if( ReadToc( path, i ) ) left--;
             if( left == 0 ) break;
         }
         if( left == 0 ) break;
@@ -234,5 +248,31 @@ XCursor::XCursor( const char* theme )
 
     CalcSizes();
 
-    mclog( LogLevel::Info, "Loaded %i/%i X cursors from theme %s", numTypes - left, numTypes, theme );
+    mclog( LogLevel::Info, "Found %i/%i X cursors in theme %s, in %zu sizes", numTypes - left, numTypes, theme, m_cursor.size() );
+}
+
+XCursor::~XCursor() = default;
+
+void XCursor::Decode( uint32_t size, CursorType type, CursorData& data ) const
+{
+    const auto t = (int)type;
+    auto& file = *m_files[t];
+
+    for( auto pos : m_images.find( size )->second[t] )
+    {
+        XcursorImage img;
+        memcpy( &img, file.data() + pos + XcursorChunkHdrSize, sizeof( img ) );
+        const auto offset = pos + XcursorChunkHdrSize + sizeof( XcursorImage );
+        if( offset + uint64_t( img.width ) * img.height * 4 > file.size() )
+        {
+            mclog( LogLevel::Warning, "Truncated image in cursor %s, size %u", CursorNames[t], size );
+            break;
+        }
+
+        auto bitmap = std::make_shared<Bitmap>( img.width, img.height );
+        memcpy( bitmap->Data(), file.data() + offset, size_t( img.width ) * img.height * 4 );
+
+        data.frames.emplace_back( CursorFrame { img.delay * 1000, (uint32_t)data.bitmaps.size() } );
+        data.bitmaps.emplace_back( CursorBitmap { std::move( bitmap ), img.xhot, img.yhot } );
+    }
 }
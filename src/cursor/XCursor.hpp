@@ -1,11 +1,33 @@
 #pragma once
 
+#include <array>
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 #include "CursorBaseMulti.hpp"
 
+class FileBuffer;
+
+// Only the table of contents of each cursor file is read up front. The files stay mapped, and an image is decoded
+// the first time its type and size are asked for.
 class XCursor : public CursorBaseMulti
 {
 public:
     explicit XCursor( const char* theme );
+    ~XCursor() override;
 
     NoCopy( XCursor );
+
+protected:
+    void Decode( uint32_t size, CursorType type, CursorData& data ) const override;
+
+private:
+    bool ReadToc( const std::string& path, int type );
+
+    std::array<std::unique_ptr<FileBuffer>, (int)CursorType::NUM> m_files;
+
+    // Image chunk offsets of each size and type, in file order
+    unordered_flat_map<uint32_t, std::array<std::vector<uint32_t>, (int)CursorType::NUM>> m_images;
 };
@@ -1,16 +1,77 @@
+#include <algorithm>
 #include <memory>
+#include <string>
 #include <systemd/sd-bus.h>
+#include <time.h>
 #include <tracy/Tracy.hpp>
 #include <unistd.h>
 
 #include "DbusMessage.hpp"
 #include "DbusSession.hpp"
+#include "util/EventLoop.hpp"
 #include "util/Logs.hpp"
+#include "util/Panic.hpp"
 
 thread_local sd_bus* t_bus = nullptr;
 thread_local int t_count = 0;
 thread_local std::vector<std::unique_ptr<std::function<int(DbusMessage)>>> t_callbacks;
 
+struct PendingCall
+{
+    DbusSession::ReplyCallback callback;
+    std::string name;
+};
+
+thread_local std::vector<std::unique_ptr<PendingCall>> t_pending;
+
+thread_local EventLoop* t_loop = nullptr;
+thread_local int t_loopFd = -1;
+thread_local int t_loopPrepare = -1;
+
+static void ProcessBus()
+{
+    ZoneScoped;
+
+    int res;
+    while( ( res = sd_bus_process( t_bus, nullptr ) ) > 0 ) {}
+    if( res < 0 ) mclog( LogLevel::Error, "Failed to process DBus messages: %s", strerror( -res ) );
+}
+
+// Returns the time until the bus has to be processed again, in milliseconds, or -1 if there is no deadline
+static int BusTimeout()
+{
+    uint64_t deadline;
+    if( sd_bus_get_timeout( t_bus, &deadline ) < 0 || deadline == UINT64_MAX ) return -1;
+
+    timespec ts;
+    clock_gettime( CLOCK_MONOTONIC, &ts );
+    const auto now = uint64_t( ts.tv_sec ) * 1000000 + ts.tv_nsec / 1000;
+    return deadline <= now ? 0 : int( ( deadline - now + 999 ) / 1000 );
+}
+
+static int CallReply( sd_bus_message* msg, void* userdata, sd_bus_error* )
+{
+    ZoneScoped;
+
+    auto call = (PendingCall*)userdata;
+    ZoneText( call->name.c_str(), call->name.size() );
+
+    if( auto err = sd_bus_message_get_error( msg ); err )
+    {
+        mclog( LogLevel::Error, "Failed to call method %s: %s", call->name.c_str(), err->message );
+        call->callback( {} );
+    }
+    else
+    {
+        call->callback( DbusMessage( sd_bus_message_ref( msg ) ) );
+    }
+
+    // The callback may have made more calls
+    auto it = std::ranges::find_if( t_pending, [call]( const auto& v ) { return v.get() == call; } );
+    t_pending.erase( it );
+    return 1;
+}
+
 DbusSession::DbusSession()
 {
     ZoneScoped;
@@ -29,11 +90,23 @@ DbusSession::~DbusSession()
 {
     if( --t_count == 0 )
     {
+        if( t_loop )
+        {
+            t_loop->RemoveFd( t_loopFd );
+            t_loop->RemovePrepare( t_loopPrepare );
+            t_loop = nullptr;
+        }
+
         if( !t_callbacks.empty() )
         {
             mclog( LogLevel::Debug, "Thread %i: clearing %zu DBus callbacks", gettid(), t_callbacks.size() );
             t_callbacks.clear();
         }
+        if( !t_pending.empty() )
+        {
+            mclog( LogLevel::Warning, "Thread %i: dropping %zu unanswered DBus calls", gettid(), t_pending.size() );
+            t_pending.clear();
+        }
 
         sd_bus_unref( t_bus );
         t_bus = nullptr;
@@ -64,6 +137,46 @@ DbusMessage DbusSession::Call( const char* dst, const char* path, const char* if
     return DbusMessage( msg );
 }
 
+bool DbusSession::CallAsync( ReplyCallback callback, const char* dst, const char* path, const char* iface, const char* member, const char* sig, ... )
+{
+    ZoneScoped;
+    ZoneTextF( "DBus async call %s.%s", iface, member );
+
+    auto call = std::make_unique<PendingCall>( std::move( callback ), std::string( iface ) + "." + member );
+
+    va_list ap;
+    va_start( ap, sig );
+
+    auto res = sd_bus_call_method_asyncv( t_bus, nullptr, dst, path, iface, member, CallReply, call.get(), sig, ap );
+    va_end( ap );
+
+    if( res < 0 )
+    {
+        mclog( LogLevel::Error, "Failed to call method %s.%s: %s", iface, member, strerror( -res ) );
+        return false;
+    }
+
+    t_pending.emplace_back( std::move( call ) );
+    return true;
+}
+
+bool DbusSession::WaitReplies()
+{
+    ZoneScoped;
+
+    while( !t_pending.empty() )
+    {
+        auto res = sd_bus_process( t_bus, nullptr );
+        if( res == 0 ) res = sd_bus_wait( t_bus, UINT64_MAX );
+        if( res < 0 )
+        {
+            mclog( LogLevel::Error, "Failed to wait for DBus replies: %s", strerror( -res ) );
+            return false;
+        }
+    }
+    return true;
+}
+
 bool DbusSession::MatchSignal( const char* sender, const char* path, const char* iface, const char* member, std::function<int(DbusMessage)> callback )
 {
     ZoneScoped;
@@ -106,6 +219,32 @@ bool DbusSession::GetProperty( const char* dst, const char* path, const char* if
     return true;
 }
 
+void DbusSession::Attach( EventLoop& loop )
+{
+    ZoneScoped;
+
+    if( !t_bus ) return;
+    CheckPanic( !t_loop, "DBus session is already attached to an event loop" );
+
+    t_loopFd = sd_bus_get_fd( t_bus );
+    if( t_loopFd < 0 )
+    {
+        mclog( LogLevel::Error, "Failed to get DBus descriptor: %s", strerror( -t_loopFd ) );
+        return;
+    }
+    t_loop = &loop;
+
+    loop.AddFd( t_loopFd, EPOLLIN, []( uint32_t ) { ProcessBus(); } );
+
+    // Replies to method calls may have queued other messages, without the descriptor becoming readable
+    t_loopPrepare = loop.AddPrepare( [] {
+        ProcessBus();
+        const auto events = sd_bus_get_events( t_bus );
+        t_loop->ModifyFd( t_loopFd, events > 0 ? uint32_t( events ) : EPOLLIN );
+        return BusTimeout();
+    } );
+}
+
 DbusSession::operator bool() const
 {
     return t_bus != nullptr;
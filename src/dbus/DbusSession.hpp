@@ -5,20 +5,34 @@
 #include "DbusMessage.hpp"
 #include "util/NoCopy.hpp"
 
+class EventLoop;
 struct sd_bus;
 
 class DbusSession
 {
 public:
+    using ReplyCallback = std::function<void(DbusMessage)>;     // The message is empty if the call failed
+
     DbusSession();
     ~DbusSession();
 
     NoCopy( DbusSession );
 
     DbusMessage Call( const char* dst, const char* path, const char* iface, const char* member, const char* sig = nullptr, ... );
+
+    // Sends the call without waiting for the reply, so that independent calls overlap their round-trips. The
+    // callback runs on this thread, when the attached event loop or WaitReplies() processes the reply.
+    bool CallAsync( ReplyCallback callback, const char* dst, const char* path, const char* iface, const char* member, const char* sig = nullptr, ... );
+    // Processes the bus until every async call made on this thread was answered. Returns false on bus errors.
+    bool WaitReplies();
+
     bool MatchSignal( const char* sender, const char* path, const char* iface, const char* member, std::function<int(DbusMessage)> callback );
 
     bool GetProperty( const char* dst, const char* path, const char* iface, const char* member, bool& out );
 
+    // Signals and other incoming messages of the thread's bus are dispatched by the event loop, which must run on
+    // this thread. Stays attached until the last session of the thread is destroyed.
+    void Attach( EventLoop& loop );
+
     operator bool() const;
 };
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "util/TaskDispatch.hpp"
+
+// Decodes an image of 4x4 blocks, each taking Words 64-bit words, one row of blocks per step. Rows are split
+// between workers if td is set. The decode function is called as decode( src, dst, width ).
+template<size_t Words, typename F>
+void DecodeBlockRows( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height, TaskDispatch* td, F&& decode )
+{
+    const auto blocksX = width / 4;
+    const auto rows = height / 4;
+
+    auto fn = [&]( size_t begin, size_t end ) {
+        auto s = src + begin * blocksX * Words;
+        for( size_t y=begin; y<end; y++ )
+        {
+            auto d = dst + y * 4 * width;
+            for( uint32_t x=0; x<blocksX; x++ )
+            {
+                decode( s, d, width );
+                s += Words;
+                d += 4;
+            }
+        }
+    };
+
+    if( td && rows > 1 )
+    {
+        td->ParallelFor( 0, rows, TaskDispatch::AdaptiveGrain, fn );
+    }
+    else
+    {
+        fn( 0, rows );
+    }
+}
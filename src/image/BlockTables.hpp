@@ -0,0 +1,126 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <stdint.h>
+
+// Lookup tables of the BC and ETC block decoders, generated at compile time and shared between them
+
+// Channels of 4 to 7 bits widened to 8 bits by bit replication
+template<int Bits>
+inline constexpr auto g_expand = []{
+    static_assert( Bits >= 4 && Bits < 8 );
+    std::array<uint8_t, 1 << Bits> ret = {};
+    for( int i=0; i<( 1 << Bits ); i++ ) ret[i] = ( i << ( 8 - Bits ) ) | ( i >> ( Bits * 2 - 8 ) );
+    return ret;
+}();
+
+// ETC1 intensity modifiers, the second half of each row negates the first
+inline constexpr auto g_etcModifiers = []{
+    constexpr int32_t half[8][2] = { { 2, 8 }, { 5, 17 }, { 9, 29 }, { 13, 42 }, { 18, 60 }, { 24, 80 }, { 33, 106 }, { 47, 183 } };
+    std::array<std::array<int32_t, 4>, 8> ret = {};
+    for( int i=0; i<8; i++ ) ret[i] = { half[i][0], half[i][1], -half[i][0], -half[i][1] };
+    return ret;
+}();
+
+// EAC modifiers. The positive half of each row mirrors the negative one, one step closer to zero.
+inline constexpr auto g_eacModifiers = []{
+    constexpr int32_t half[16][4] = {
+        { -3, -6,  -9, -15 }, { -3, -7, -10, -13 }, { -2, -5,  -8, -13 }, { -2, -4,  -6, -13 },
+        { -3, -6,  -8, -12 }, { -3, -7,  -9, -11 }, { -4, -7,  -8, -11 }, { -3, -5,  -8, -11 },
+        { -2, -6,  -8, -10 }, { -2, -5,  -8, -10 }, { -2, -4,  -8, -10 }, { -2, -5,  -7, -10 },
+        { -3, -4,  -7, -10 }, { -1, -2,  -3, -10 }, { -4, -6,  -8,  -9 }, { -3, -5,  -7,  -9 }
+    };
+    std::array<std::array<int32_t, 8>, 16> ret = {};
+    for( int i=0; i<16; i++ )
+    {
+        for( int j=0; j<4; j++ )
+        {
+            ret[i][j] = half[i][j];
+            ret[i][j+4] = -half[i][j] - 1;
+        }
+    }
+    return ret;
+}();
+
+// EAC 11-bit multipliers, a zero multiplier is read as 1/8
+inline constexpr auto g_eac11Mul = []{
+    std::array<int32_t, 16> ret = {};
+    ret[0] = 1;
+    for( int i=1; i<16; i++ ) ret[i] = i * 8;
+    return ret;
+}();
+
+// Distances of the ETC2 T and H modes
+inline constexpr uint8_t g_etcDistance[8] = { 3, 6, 11, 16, 23, 32, 41, 64 };
+
+// Saturation to 0-255. Block decoders only overshoot by what their modifiers add, which stays within ClampBias.
+inline constexpr int32_t ClampBias = 256;
+inline constexpr auto g_clampU8 = []{
+    std::array<uint8_t, 256 + ClampBias * 2> ret = {};
+    for( int i=0; i<int( ret.size() ); i++ ) ret[i] = std::clamp( i - ClampBias, 0, 255 );
+    return ret;
+}();
+
+inline uint8_t ClampU8( int32_t val )
+{
+    return g_clampU8[val + ClampBias];
+}
+
+// BC3 alpha and BC4/BC5 channel palettes interpolate the two endpoints in sevenths, or in fifths between two
+// extra entries of 0 and 255. Weights are of the first and second endpoint, for palette entries 2 to 7.
+inline constexpr auto g_bcWeights7 = []{
+    std::array<std::array<uint8_t, 2>, 6> ret = {};
+    for( int i=0; i<6; i++ ) ret[i] = { uint8_t( 6 - i ), uint8_t( i + 1 ) };
+    return ret;
+}();
+
+inline constexpr auto g_bcWeights5 = []{
+    std::array<std::array<uint8_t, 2>, 4> ret = {};
+    for( int i=0; i<4; i++ ) ret[i] = { uint8_t( 4 - i ), uint8_t( i + 1 ) };
+    return ret;
+}();
+
+// Builds the eight entry palette of a BC4 block, with each entry shifted up to the channel position
+inline void BcChannelPalette( uint32_t a0, uint32_t a1, uint32_t* dict, int shift )
+{
+    dict[0] = a0 << shift;
+    dict[1] = a1 << shift;
+    if( a0 > a1 )
+    {
+        for( int i=0; i<6; i++ ) dict[i+2] = ( ( g_bcWeights7[i][0] * a0 + g_bcWeights7[i][1] * a1 ) / 7 ) << shift;
+    }
+    else
+    {
+        for( int i=0; i<4; i++ ) dict[i+2] = ( ( g_bcWeights5[i][0] * a0 + g_bcWeights5[i][1] * a1 ) / 5 ) << shift;
+        dict[6] = 0;
+        dict[7] = 0xFFu << shift;
+    }
+}
+
+// Builds the four entry palette of a BC1 color block. Alpha is or'ed into each entry, and the fourth entry of
+// the three color mode is just alpha.
+inline void BcColorPalette( uint16_t c0, uint16_t c1, uint32_t* dict, uint32_t alpha )
+{
+    const uint32_t r0 = g_expand<5>[c0 >> 11];
+    const uint32_t g0 = g_expand<6>[( c0 >> 5 ) & 0x3F];
+    const uint32_t b0 = g_expand<5>[c0 & 0x1F];
+
+    const uint32_t r1 = g_expand<5>[c1 >> 11];
+    const uint32_t g1 = g_expand<6>[( c1 >> 5 ) & 0x3F];
+    const uint32_t b1 = g_expand<5>[c1 & 0x1F];
+
+    dict[0] = alpha | ( b0 << 16 ) | ( g0 << 8 ) | r0;
+    dict[1] = alpha | ( b1 << 16 ) | ( g1 << 8 ) | r1;
+
+    if( c0 > c1 )
+    {
+        dict[2] = alpha | ( ( ( 2*b0 + b1 ) / 3 ) << 16 ) | ( ( ( 2*g0 + g1 ) / 3 ) << 8 ) | ( ( 2*r0 + r1 ) / 3 );
+        dict[3] = alpha | ( ( ( 2*b1 + b0 ) / 3 ) << 16 ) | ( ( ( 2*g1 + g0 ) / 3 ) << 8 ) | ( ( 2*r1 + r0 ) / 3 );
+    }
+    else
+    {
+        dict[2] = alpha | ( ( ( b0 + b1 ) / 2 ) << 16 ) | ( ( ( g0 + g1 ) / 2 ) << 8 ) | ( ( r0 + r1 ) / 2 );
+        dict[3] = alpha;
+    }
+}
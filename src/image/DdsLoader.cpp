@@ -1,12 +1,41 @@
+#include <algorithm>
+#include <bit>
 #include <string.h>
 
 #include "bcdec.h"
+#include "BlockDecode.hpp"
+#include "BlockTables.hpp"
 #include "DdsLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
 
+#ifdef __AVX2__
+#  include <immintrin.h>
+#endif
+
+#ifdef __AVX2__
+// Rows 0-1 of a block are in top, rows 2-3 in bottom.
+static inline void StoreBlock( __m256i top, __m256i bottom, uint32_t* dst, uint32_t w )
+{
+    _mm_storeu_si128( (__m128i*)dst, _mm256_castsi256_si128( top ) );
+    _mm_storeu_si128( (__m128i*)(dst+w), _mm256_extracti128_si256( top, 1 ) );
+    _mm_storeu_si128( (__m128i*)(dst+w*2), _mm256_castsi256_si128( bottom ) );
+    _mm_storeu_si128( (__m128i*)(dst+w*3), _mm256_extracti128_si256( bottom, 1 ) );
+}
+
+// Extracts eight consecutive indices of the given bit width and looks them up in an eight entry dictionary.
+template<int Bits>
+static inline __m256i Lookup( __m256i dict, uint32_t idx )
+{
+    const auto shift = _mm256_setr_epi32( 0, Bits, Bits*2, Bits*3, Bits*4, Bits*5, Bits*6, Bits*7 );
+    const auto mask = _mm256_set1_epi32( ( 1 << Bits ) - 1 );
+    const auto i = _mm256_and_si256( _mm256_srlv_epi32( _mm256_set1_epi32( idx ), shift ), mask );
+    return _mm256_permutevar8x32_epi32( dict, i );
+}
+#endif
+
 static void DecodeBc1Part( uint64_t d, uint32_t* dst, uint32_t w )
 {
     uint8_t* in = (uint8_t*)&d;
@@ -16,40 +45,13 @@ static void DecodeBc1Part( uint64_t d, uint32_t* dst, uint32_t w )
     memcpy( &c1, in+2, 2 );
     memcpy( &idx, in+4, 4 );
 
-    uint8_t r0 = ( ( c0 & 0xF800 ) >> 8 ) | ( ( c0 & 0xF800 ) >> 13 );
-    uint8_t g0 = ( ( c0 & 0x07E0 ) >> 3 ) | ( ( c0 & 0x07E0 ) >> 9 );
-    uint8_t b0 = ( ( c0 & 0x001F ) << 3 ) | ( ( c0 & 0x001F ) >> 2 );
-
-    uint8_t r1 = ( ( c1 & 0xF800 ) >> 8 ) | ( ( c1 & 0xF800 ) >> 13 );
-    uint8_t g1 = ( ( c1 & 0x07E0 ) >> 3 ) | ( ( c1 & 0x07E0 ) >> 9 );
-    uint8_t b1 = ( ( c1 & 0x001F ) << 3 ) | ( ( c1 & 0x001F ) >> 2 );
-
     uint32_t dict[4];
+    BcColorPalette( c0, c1, dict, 0xFF000000 );
 
-    dict[0] = 0xFF000000 | ( b0 << 16 ) | ( g0 << 8 ) | r0;
-    dict[1] = 0xFF000000 | ( b1 << 16 ) | ( g1 << 8 ) | r1;
-
-    uint32_t r, g, b;
-    if( c0 > c1 )
-    {
-        r = (2*r0+r1)/3;
-        g = (2*g0+g1)/3;
-        b = (2*b0+b1)/3;
-        dict[2] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
-        r = (2*r1+r0)/3;
-        g = (2*g1+g0)/3;
-        b = (2*b1+b0)/3;
-        dict[3] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
-    }
-    else
-    {
-        r = (int(r0)+r1)/2;
-        g = (int(g0)+g1)/2;
-        b = (int(b0)+b1)/2;
-        dict[2] = 0xFF000000 | ( b << 16 ) | ( g << 8 ) | r;
-        dict[3] = 0xFF000000;
-    }
-
+#ifdef __AVX2__
+    const auto vdict = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)dict ) );
+    StoreBlock( Lookup<2>( vdict, idx ), Lookup<2>( vdict, idx >> 16 ), dst, w );
+#else
     memcpy( dst+0, dict + (idx & 0x3), 4 );
     idx >>= 2;
     memcpy( dst+1, dict + (idx & 0x3), 4 );
@@ -87,6 +89,7 @@ static void DecodeBc1Part( uint64_t d, uint32_t* dst, uint32_t w )
     memcpy( dst+2, dict + (idx & 0x3), 4 );
     idx >>= 2;
     memcpy( dst+3, dict + (idx & 0x3), 4 );
+#endif
 }
 
 static void DecodeBc3Part( uint64_t a, uint64_t d, uint32_t* dst, uint32_t w )
@@ -106,61 +109,18 @@ static void DecodeBc3Part( uint64_t a, uint64_t d, uint32_t* dst, uint32_t w )
     memcpy( &idx, in+4, 4 );
 
     uint32_t adict[8];
-    adict[0] = a0 << 24;
-    adict[1] = a1 << 24;
-    if( a0 > a1 )
-    {
-        adict[2] = ( (6*a0+1*a1)/7 ) << 24;
-        adict[3] = ( (5*a0+2*a1)/7 ) << 24;
-        adict[4] = ( (4*a0+3*a1)/7 ) << 24;
-        adict[5] = ( (3*a0+4*a1)/7 ) << 24;
-        adict[6] = ( (2*a0+5*a1)/7 ) << 24;
-        adict[7] = ( (1*a0+6*a1)/7 ) << 24;
-    }
-    else
-    {
-        adict[2] = ( (4*a0+1*a1)/5 ) << 24;
-        adict[3] = ( (3*a0+2*a1)/5 ) << 24;
-        adict[4] = ( (2*a0+3*a1)/5 ) << 24;
-        adict[5] = ( (1*a0+4*a1)/5 ) << 24;
-        adict[6] = 0;
-        adict[7] = 0xFF000000;
-    }
-
-    uint8_t r0 = ( ( c0 & 0xF800 ) >> 8 ) | ( ( c0 & 0xF800 ) >> 13 );
-    uint8_t g0 = ( ( c0 & 0x07E0 ) >> 3 ) | ( ( c0 & 0x07E0 ) >> 9 );
-    uint8_t b0 = ( ( c0 & 0x001F ) << 3 ) | ( ( c0 & 0x001F ) >> 2 );
-
-    uint8_t r1 = ( ( c1 & 0xF800 ) >> 8 ) | ( ( c1 & 0xF800 ) >> 13 );
-    uint8_t g1 = ( ( c1 & 0x07E0 ) >> 3 ) | ( ( c1 & 0x07E0 ) >> 9 );
-    uint8_t b1 = ( ( c1 & 0x001F ) << 3 ) | ( ( c1 & 0x001F ) >> 2 );
+    BcChannelPalette( a0, a1, adict, 24 );
 
     uint32_t dict[4];
-
-    dict[0] = ( b0 << 16 ) | ( g0 << 8 ) | r0;
-    dict[1] = ( b1 << 16 ) | ( g1 << 8 ) | r1;
-
-    uint32_t r, g, b;
-    if( c0 > c1 )
-    {
-        r = (2*r0+r1)/3;
-        g = (2*g0+g1)/3;
-        b = (2*b0+b1)/3;
-        dict[2] = ( b << 16 ) | ( g << 8 ) | r;
-        r = (2*r1+r0)/3;
-        g = (2*g1+g0)/3;
-        b = (2*b1+b0)/3;
-        dict[3] = ( b << 16 ) | ( g << 8 ) | r;
-    }
-    else
-    {
-        r = (int(r0)+r1)/2;
-        g = (int(g0)+g1)/2;
-        b = (int(b0)+b1)/2;
-        dict[2] = ( b << 16 ) | ( g << 8 ) | r;
-        dict[3] = 0;
-    }
-
+    BcColorPalette( c0, c1, dict, 0 );
+
+#ifdef __AVX2__
+    const auto vdict = _mm256_broadcastsi128_si256( _mm_loadu_si128( (const __m128i*)dict ) );
+    const auto vadict = _mm256_loadu_si256( (const __m256i*)adict );
+    const auto top = _mm256_or_si256( Lookup<2>( vdict, idx ), Lookup<3>( vadict, aidx & 0xFFFFFF ) );
+    const auto bottom = _mm256_or_si256( Lookup<2>( vdict, idx >> 16 ), Lookup<3>( vadict, aidx >> 24 ) );
+    StoreBlock( top, bottom, dst, w );
+#else
     dst[0] = dict[idx & 0x3] | adict[aidx & 0x7];
     idx >>= 2;
     aidx >>= 3;
@@ -213,6 +173,7 @@ static void DecodeBc3Part( uint64_t a, uint64_t d, uint32_t* dst, uint32_t w )
     idx >>= 2;
     aidx >>= 3;
     dst[3] = dict[idx & 0x3] | adict[aidx & 0x7];
+#endif
 }
 
 static void DecodeBc4Part( uint64_t a, uint32_t* dst, uint32_t w )
@@ -225,26 +186,7 @@ static void DecodeBc4Part( uint64_t a, uint32_t* dst, uint32_t w )
     memcpy( &aidx, ain+2, 6 );
 
     uint32_t adict[8];
-    adict[0] = a0;
-    adict[1] = a1;
-    if(a0 > a1)
-    {
-        adict[2] = ( (6*a0+1*a1)/7 );
-        adict[3] = ( (5*a0+2*a1)/7 );
-        adict[4] = ( (4*a0+3*a1)/7 );
-        adict[5] = ( (3*a0+4*a1)/7 );
-        adict[6] = ( (2*a0+5*a1)/7 );
-        adict[7] = ( (1*a0+6*a1)/7 );
-    }
-    else
-    {
-        adict[2] = ( (4*a0+1*a1)/5 );
-        adict[3] = ( (3*a0+2*a1)/5 );
-        adict[4] = ( (2*a0+3*a1)/5 );
-        adict[5] = ( (1*a0+4*a1)/5 );
-        adict[6] = 0;
-        adict[7] = 0xFF;
-    }
+    BcChannelPalette( a0, a1, adict, 0 );
 
     dst[0] = adict[aidx & 0x7] | 0xFF000000;
     aidx >>= 3;
@@ -302,48 +244,10 @@ static void DecodeBc5Part( uint64_t r, uint64_t g, uint32_t* dst, uint32_t w )
     memcpy( &gidx, gin+2, 6 );
 
     uint32_t rdict[8];
-    rdict[0] = r0;
-    rdict[1] = r1;
-    if(r0 > r1)
-    {
-        rdict[2] = ( (6*r0+1*r1)/7 );
-        rdict[3] = ( (5*r0+2*r1)/7 );
-        rdict[4] = ( (4*r0+3*r1)/7 );
-        rdict[5] = ( (3*r0+4*r1)/7 );
-        rdict[6] = ( (2*r0+5*r1)/7 );
-        rdict[7] = ( (1*r0+6*r1)/7 );
-    }
-    else
-    {
-        rdict[2] = ( (4*r0+1*r1)/5 );
-        rdict[3] = ( (3*r0+2*r1)/5 );
-        rdict[4] = ( (2*r0+3*r1)/5 );
-        rdict[5] = ( (1*r0+4*r1)/5 );
-        rdict[6] = 0;
-        rdict[7] = 0xFF;
-    }
+    BcChannelPalette( r0, r1, rdict, 0 );
 
     uint32_t gdict[8];
-    gdict[0] = g0 << 8;
-    gdict[1] = g1 << 8;
-    if(g0 > g1)
-    {
-        gdict[2] = ( (6*g0+1*g1)/7 ) << 8;
-        gdict[3] = ( (5*g0+2*g1)/7 ) << 8;
-        gdict[4] = ( (4*g0+3*g1)/7 ) << 8;
-        gdict[5] = ( (3*g0+4*g1)/7 ) << 8;
-        gdict[6] = ( (2*g0+5*g1)/7 ) << 8;
-        gdict[7] = ( (1*g0+6*g1)/7 ) << 8;
-    }
-    else
-    {
-        gdict[2] = ( (4*g0+1*g1)/5 ) << 8;
-        gdict[3] = ( (3*g0+2*g1)/5 ) << 8;
-        gdict[4] = ( (2*g0+3*g1)/5 ) << 8;
-        gdict[5] = ( (1*g0+4*g1)/5 ) << 8;
-        gdict[6] = 0;
-        gdict[7] = 0xFF00;
-    }
+    BcChannelPalette( g0, g1, gdict, 8 );
 
     dst[0] = rdict[ridx & 0x7] | gdict[gidx & 0x7] | 0xFF000000;
     ridx >>= 3;
@@ -401,80 +305,44 @@ static void DecodeBc5Part( uint64_t r, uint64_t g, uint32_t* dst, uint32_t w )
     gidx >>= 3;
 }
 
-static void DecodeBc1( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+static void DecodeBc1( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    for( int y=0; y<height/4; y++ )
-    {
-        for( int x=0; x<width/4; x++ )
-        {
-            uint64_t d = *src++;
-            DecodeBc1Part( d, dst, width );
-            dst += 4;
-        }
-        dst += width * 3;
-    }
+    DecodeBlockRows<1>( dst, src, width, height, td, []( const uint64_t* s, uint32_t* d, uint32_t w ) {
+        DecodeBc1Part( s[0], d, w );
+    } );
 }
 
-static void DecodeBc3( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+static void DecodeBc3( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    for( int y=0; y<height/4; y++ )
-    {
-        for( int x=0; x<width/4; x++ )
-        {
-            uint64_t a = *src++;
-            uint64_t d = *src++;
-            DecodeBc3Part( a, d, dst, width );
-            dst += 4;
-        }
-        dst += width * 3;
-    }
+    DecodeBlockRows<2>( dst, src, width, height, td, []( const uint64_t* s, uint32_t* d, uint32_t w ) {
+        DecodeBc3Part( s[0], s[1], d, w );
+    } );
 }
 
-static void DecodeBc4( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+static void DecodeBc4( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    for( int y=0; y<height/4; y++ )
-    {
-        for( int x=0; x<width/4; x++ )
-        {
-            uint64_t r = *src++;
-            DecodeBc4Part( r, dst, width );
-            dst += 4;
-        }
-        dst += width * 3;
-    }
+    DecodeBlockRows<1>( dst, src, width, height, td, []( const uint64_t* s, uint32_t* d, uint32_t w ) {
+        DecodeBc4Part( s[0], d, w );
+    } );
 }
 
-static void DecodeBc5( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+static void DecodeBc5( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    for( int y=0; y<height/4; y++ )
-    {
-        for( int x=0; x<width/4; x++ )
-        {
-            uint64_t r = *src++;
-            uint64_t g = *src++;
-            DecodeBc5Part( r, g, dst, width );
-            dst += 4;
-        }
-        dst += width * 3;
-    }
+    DecodeBlockRows<2>( dst, src, width, height, td, []( const uint64_t* s, uint32_t* d, uint32_t w ) {
+        DecodeBc5Part( s[0], s[1], d, w );
+    } );
 }
 
-static void DecodeBc7( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+static void DecodeBc7( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    for( int y=0; y<height/4; y++ )
-    {
-        for( int x=0; x<width/4; x++ )
-        {
-            bcdec_bc7( src, dst, width * 4 );
-            src += 2;
-            dst += 4;
-        }
-        dst += width * 3;
-    }
+    DecodeBlockRows<2>( dst, src, width, height, td, []( const uint64_t* s, uint32_t* d, uint32_t w ) {
+        bcdec_bc7( s, d, w * 4 );
+    } );
 }
 
-DdsLoader::DdsLoader( std::shared_ptr<FileWrapper> file )
+DdsLoader::DdsLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td )
     : m_file( std::move( file ) )
+    , m_td( td )
 {
     fseek( *m_file, 0, SEEK_SET );
     uint32_t magic;
@@ -507,6 +375,25 @@ DdsLoader::DdsLoader( std::shared_ptr<FileWrapper> file )
         m_valid = false;
         break;
     }
+    if( !m_valid ) return;
+
+    uint32_t hdr[37] = {};
+    fseek( *m_file, 0, SEEK_SET );
+    fread( hdr, 4, m_offset / 4, *m_file );
+
+    m_width = hdr[4];
+    m_height = hdr[3];
+    m_levels = std::min( ( hdr[2] & 0x20000 ) ? std::max( 1u, hdr[7] ) : 1, 32u );     // DDSD_MIPMAPCOUNT
+
+    // Each array layer or cube face is stored with its full mip chain
+    if( m_offset == 148 )
+    {
+        m_layers = std::max( 1u, hdr[35] ) * ( ( hdr[34] & 0x4 ) ? 6 : 1 );           // D3D10_RESOURCE_MISC_TEXTURECUBE
+    }
+    else
+    {
+        m_layers = ( hdr[28] & 0x200 ) ? std::max( 1, std::popcount( hdr[28] & 0xFC00 ) ) : 1;    // DDSCAPS2_CUBEMAP
+    }
 }
 
 bool DdsLoader::IsValidSignature( const uint8_t* buf, size_t size )
@@ -521,38 +408,74 @@ bool DdsLoader::IsValid() const
     return m_valid;
 }
 
+// Only formats with an sRGB variant are passed through, as the decoded data is also displayed as sRGB.
+BitmapCompressed::Format DdsLoader::CompressedFormat()
+{
+    switch( m_format )
+    {
+    case 0x31545844: return BitmapCompressed::Format::Bc1;
+    case 0x35545844: return BitmapCompressed::Format::Bc3;
+    case 98: return BitmapCompressed::Format::Bc7;
+    default: return BitmapCompressed::Format::None;
+    }
+}
+
+bool DdsLoader::HasFastPreview()
+{
+    return m_valid && PreviewLevel() > 0;
+}
+
+uint32_t DdsLoader::Layers()
+{
+    return m_valid ? m_layers : 1;
+}
+
+ImageInfo DdsLoader::Probe()
+{
+    CheckPanic( m_valid, "Invalid DDS file" );
+    return {
+        .width = m_width,
+        .height = m_height
+    };
+}
+
 std::unique_ptr<Bitmap> DdsLoader::Load()
 {
     CheckPanic( m_valid, "Invalid DDS file" );
+    CheckPanic( m_layer < m_layers, "Invalid DDS layer" );
 
     FileBuffer buf( m_file );
-    const auto ptr = (uint32_t*)buf.data();
 
-    uint32_t width = ptr[4];
-    uint32_t height = ptr[3];
+    auto level = PreviewLevel();
+    if( LevelOffset( level ) + LevelSize( level ) > buf.size() ) level = 0;
+    CheckPanic( LevelOffset( level ) + LevelSize( level ) <= buf.size(), "DDS file is truncated" );
+
+    const uint32_t width = std::max( 1u, m_width >> level );
+    const uint32_t height = std::max( 1u, m_height >> level );
+    const auto src = (const uint64_t*)( buf.data() + LevelOffset( level ) );
 
     auto bmp = std::make_unique<Bitmap>( width, height );
 
     switch( m_format )
     {
     case 0x31545844:
-        DecodeBc1( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + m_offset), width, height );
+        DecodeBc1( (uint32_t*)bmp->Data(), src, width, height, m_td );
         break;
     case 0x35545844:
-        DecodeBc3( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + m_offset), width, height );
+        DecodeBc3( (uint32_t*)bmp->Data(), src, width, height, m_td );
         break;
     case 0x31495441:
     case 0x55344342:
     case 80:
-        DecodeBc4( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + m_offset), width, height );
+        DecodeBc4( (uint32_t*)bmp->Data(), src, width, height, m_td );
         break;
     case 0x32495441:
     case 0x55354342:
     case 83:
-        DecodeBc5( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + m_offset), width, height );
+        DecodeBc5( (uint32_t*)bmp->Data(), src, width, height, m_td );
         break;
     case 98:
-        DecodeBc7( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + m_offset), width, height );
+        DecodeBc7( (uint32_t*)bmp->Data(), src, width, height, m_td );
         break;
     default:
         Panic( "Unsupported DDS format" );
@@ -560,3 +483,56 @@ std::unique_ptr<Bitmap> DdsLoader::Load()
 
     return bmp;
 }
+
+std::unique_ptr<BitmapCompressed> DdsLoader::LoadCompressed()
+{
+    CheckPanic( m_valid, "Invalid DDS file" );
+    CheckPanic( m_layer < m_layers, "Invalid DDS layer" );
+    const auto format = CompressedFormat();
+    CheckPanic( format != BitmapCompressed::Format::None, "DDS format can't be loaded compressed" );
+
+    FileBuffer buf( m_file );
+
+    // Files may claim more levels than they contain.
+    uint32_t levels = 0;
+    while( levels < m_levels && LevelOffset( levels ) + LevelSize( levels ) <= buf.size() ) levels++;
+    CheckPanic( levels > 0, "DDS file is truncated" );
+
+    // The mip chain of a layer is contiguous
+    auto bmp = std::make_unique<BitmapCompressed>( format, m_width, m_height, levels );
+    memcpy( bmp->Data(), buf.data() + LevelOffset( 0 ), bmp->Size() );
+
+    return bmp;
+}
+
+size_t DdsLoader::LevelSize( uint32_t level ) const
+{
+    const auto block = ( m_format == 0x31545844 || m_format == 0x31495441 || m_format == 0x55344342 || m_format == 80 ) ? 8 : 16;
+    const auto w = std::max( 1u, m_width >> level );
+    const auto h = std::max( 1u, m_height >> level );
+    return size_t( ( w + 3 ) / 4 ) * ( ( h + 3 ) / 4 ) * block;
+}
+
+size_t DdsLoader::LevelOffset( uint32_t level ) const
+{
+    size_t layer = 0;
+    for( uint32_t i=0; i<m_levels; i++ ) layer += LevelSize( i );
+
+    size_t offset = m_offset + m_layer * layer;
+    for( uint32_t i=0; i<level; i++ ) offset += LevelSize( i );
+    return offset;
+}
+
+uint32_t DdsLoader::PreviewLevel() const
+{
+    auto level = (uint32_t)std::countr_zero( TargetScale( m_width, m_height, 1u << ( m_levels - 1 ) ) );
+
+    // The software decoders only handle whole blocks
+    auto whole = [this]( uint32_t level ) {
+        const auto w = m_width >> level;
+        const auto h = m_height >> level;
+        return w >= 4 && h >= 4 && ( w & 3 ) == 0 && ( h & 3 ) == 0;
+    };
+    while( level > 0 && !whole( level ) ) level--;
+    return level;
+}
@@ -8,22 +8,41 @@
 
 class Bitmap;
 class FileWrapper;
+class TaskDispatch;
 
 class DdsLoader : public ImageLoader
 {
 public:
-    explicit DdsLoader( std::shared_ptr<FileWrapper> file );
+    explicit DdsLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td = nullptr );
     NoCopy( DdsLoader );
 
     static bool IsValidSignature( const uint8_t* buf, size_t size );
 
     [[nodiscard]] bool IsValid() const override;
+    [[nodiscard]] BitmapCompressed::Format CompressedFormat() override;
+    [[nodiscard]] bool HasFastPreview() override;
+    [[nodiscard]] uint32_t Layers() override;
+    [[nodiscard]] ImageInfo Probe() override;
+
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<BitmapCompressed> LoadCompressed() override;
 
 private:
+    [[nodiscard]] size_t LevelSize( uint32_t level ) const;
+    [[nodiscard]] size_t LevelOffset( uint32_t level ) const;     // In the selected layer
+
+    // Smallest stored mip level covering the target size.
+    [[nodiscard]] uint32_t PreviewLevel() const;
+
     bool m_valid;
     std::shared_ptr<FileWrapper> m_file;
+    TaskDispatch* m_td;
 
     uint32_t m_format;
     uint32_t m_offset;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_levels;
+    uint32_t m_layers;
 };
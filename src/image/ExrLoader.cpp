@@ -1,16 +1,24 @@
+#include <algorithm>
+#include <bit>
 #include <vector>
 
+#include <IexBaseExc.h>
+#include <ImfChannelList.h>
 #include <ImfChromaticities.h>
+#include <ImfMultiPartInputFile.h>
 #include <ImfRgbaFile.h>
 #include <ImfStandardAttributes.h>
+#include <ImfTiledRgbaFile.h>
 #include <lcms2.h>
 
 #include "ExrLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/BitmapHdrHalf.hpp"
 #include "util/Colorspace.hpp"
 #include "util/DataBuffer.hpp"
-#include "util/FileWrapper.hpp"
+#include "util/FileBuffer.hpp"
+#include "util/Logs.hpp"
 #include "util/Panic.hpp"
 #include "util/TaskDispatch.hpp"
 #include "util/Tonemapper.hpp"
@@ -26,49 +34,67 @@ static void FixAlpha( float* ptr, size_t sz )
     while( --sz );
 }
 
-class ExrStream : public Imf::IStream
+static void CopyRgb( const Imf::Rgba* src, float* dst, size_t sz )
 {
-public:
-    explicit ExrStream( std::shared_ptr<FileWrapper>&& file )
-        : Imf::IStream( "<unknown>" )
-        , m_file( std::move( file ) )
+    do
     {
-        fseek( *m_file, 0, SEEK_SET );
+        *dst++ = src->r;
+        *dst++ = src->g;
+        *dst++ = src->b;
+        *dst++ = 1;
+        src++;
     }
+    while( --sz );
+}
 
-    bool isMemoryMapped() const override { return false; }
-    bool read( char c[], int n ) override { fread( c, 1, n, *m_file ); return !feof( *m_file ); }
-    uint64_t tellg() override { return ftell( *m_file ); }
-    void seekg( uint64_t pos ) override { fseek( *m_file, pos, SEEK_SET ); }
-
-private:
-    std::shared_ptr<FileWrapper> m_file;
-};
+// Transform from the primaries in the file header to the given colorspace. Null if the header has none.
+static cmsHTRANSFORM CreateChromaTransform( const Imf::Header& header, Colorspace colorspace, cmsUInt32Number outFormat )
+{
+    const auto chroma = header.findTypedAttribute<OPENEXR_IMF_INTERNAL_NAMESPACE::ChromaticitiesAttribute>( "chromaticities" );
+    if( !chroma ) return nullptr;
+
+    const auto neutral = header.findTypedAttribute<IMATH_NAMESPACE::V2f>( "adoptedNeutral" );
+    const auto white = neutral ? cmsCIExyY { neutral->x, neutral->y, 1 } : cmsCIExyY { 0.3127f, 0.329f, 1 };
+
+    const cmsCIExyYTRIPLE primaries = {
+        { chroma->value().red.x, chroma->value().red.y, 1 },
+        { chroma->value().green.x, chroma->value().green.y, 1 },
+        { chroma->value().blue.x, chroma->value().blue.y, 1 }
+    };
+    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
+    cmsToneCurve* linear3[3] = { linear, linear, linear };
+
+    auto profileIn = cmsCreateRGBProfile( &white, &primaries, linear3 );
+    auto profileOut = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT709 ? &primaries709 : &primaries2020, linear3 );
+    auto transform = cmsCreateTransform( profileIn, TYPE_RGBA_HALF_FLT, profileOut, outFormat, INTENT_PERCEPTUAL, 0 );
+
+    cmsCloseProfile( profileIn );
+    cmsCloseProfile( profileOut );
+    cmsFreeToneCurve( linear );
+    return transform;
+}
 
-struct ExrThreadSetter
+// Reads the scanlines in bands, so that a cancelled load stops early. The band height is a multiple of the line
+// count of every compression scheme. Returns false if the load was cancelled.
+static bool ReadPixels( Imf::RgbaInputFile& exr, int y0, int y1 )
 {
-    ExrThreadSetter()
+    constexpr int BandLines = 256;
+    for( int y=y0; y<=y1; y+=BandLines )
     {
-        Imf::setGlobalThreadCount( std::max( 1u, std::thread::hardware_concurrency() ) );
+        if( TaskDispatch::IsCancelled() ) return false;
+        exr.readPixels( y, std::min( y + BandLines - 1, y1 ) );
     }
-};
+    return true;
+}
 
-ExrLoader::ExrLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td )
-    : m_td( td )
-    , m_tonemap( tonemap )
+// OpenEXR decompresses chunks on its global pool, while the calling thread blocks until they are done. That thread
+// is often a worker of the dispatch, so the chunks can't be queued on the dispatch itself, as all its workers might
+// end up waiting. Instead, the pool is sized like the dispatch, so that loads started on every worker do not add
+// up to more busy threads than there are workers. It only ever grows, as resizing restarts its threads.
+static void SizeThreadPool( TaskDispatch* td )
 {
-    static ExrThreadSetter setter;
-
-    try
-    {
-        m_stream = std::make_unique<ExrStream>( std::move( file ) );
-        m_exr = std::make_unique<Imf::RgbaInputFile>( *m_stream );
-        m_valid = true;
-    }
-    catch( const std::exception& )
-    {
-        m_valid = false;
-    }
+    const auto threads = td ? int( td->NumWorkers() ) : int( std::max( 1u, std::thread::hardware_concurrency() ) );
+    if( Imf::globalThreadCount() < threads ) Imf::setGlobalThreadCount( threads );
 }
 
 class ExrBuffer : public Imf::IStream
@@ -81,7 +107,15 @@ public:
     {
     }
 
-    bool isMemoryMapped() const override { return false; }
+    // The buffer is either a mapped file or already resident, so hand out pointers into it instead of copying.
+    bool isMemoryMapped() const override { return true; }
+    char* readMemoryMapped( int n ) override
+    {
+        if( m_pos + n > m_buffer->size() ) throw Iex::InputExc( "Unexpected end of file" );
+        auto ptr = (char*)m_buffer->data() + m_pos;
+        m_pos += n;
+        return ptr;
+    }
     bool read( char c[], int n ) override
     {
         const auto sz = std::min<size_t>( n, m_buffer->size() - m_pos );
@@ -98,15 +132,49 @@ private:
 };
 
 ExrLoader::ExrLoader( std::shared_ptr<DataBuffer> buffer, ToneMap::Operator tonemap, TaskDispatch* td )
-    : m_td( td )
+    : m_part( 0 )
+    , m_td( td )
     , m_tonemap( tonemap )
 {
-    static ExrThreadSetter setter;
+    SizeThreadPool( td );
+
+    m_stream = std::make_unique<ExrBuffer>( std::move( buffer ) );
+    Open();
+}
 
+ExrLoader::ExrLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td )
+    : ExrLoader( std::make_shared<FileBuffer>( file ), tonemap, td )
+{
+}
+
+ExrLoader::~ExrLoader()
+{
+}
+
+void ExrLoader::Open()
+{
     try
     {
-        m_stream = std::make_unique<ExrBuffer>( std::move( buffer ) );
+#if OPENEXR_VERSION_HEX >= 0x03010000
+        // Multi-part files may start with a part holding e.g. depth or object IDs only
+        {
+            Imf::MultiPartInputFile multi( *m_stream );
+            for( int i=0; i<multi.parts(); i++ )
+            {
+                const auto& channels = multi.header( i ).channels();
+                if( channels.findChannel( "R" ) || channels.findChannel( "Y" ) )
+                {
+                    m_part = i;
+                    break;
+                }
+            }
+            if( multi.parts() > 1 ) mclog( LogLevel::Info, "EXR: %i parts, reading part %i", multi.parts(), m_part );
+        }
+        m_stream->seekg( 0 );
+        m_exr = std::make_unique<Imf::RgbaInputFile>( m_part, *m_stream );
+#else
         m_exr = std::make_unique<Imf::RgbaInputFile>( *m_stream );
+#endif
         m_valid = true;
     }
     catch( const std::exception& )
@@ -115,10 +183,6 @@ ExrLoader::ExrLoader( std::shared_ptr<DataBuffer> buffer, ToneMap::Operator tone
     }
 }
 
-ExrLoader::~ExrLoader()
-{
-}
-
 bool ExrLoader::IsValidSignature( const uint8_t* buf, size_t size )
 {
     if( size < 4 ) return false;
@@ -130,32 +194,22 @@ bool ExrLoader::IsValid() const
     return m_valid;
 }
 
+ImageInfo ExrLoader::Probe()
+{
+    CheckPanic( m_valid, "Invalid EXR file" );
+    const auto dw = m_exr->dataWindow();
+    return {
+        .width = uint32_t( dw.max.x - dw.min.x + 1 ),
+        .height = uint32_t( dw.max.y - dw.min.y + 1 ),
+        .hdr = true
+    };
+}
+
 std::unique_ptr<Bitmap> ExrLoader::Load()
 {
     auto hdr = LoadHdr( Colorspace::BT709 );
-    if( m_td )
-    {
-        auto bmp = std::make_unique<Bitmap>( hdr->Width(), hdr->Height() );
-        auto src = hdr->Data();
-        auto dst = bmp->Data();
-        size_t sz = hdr->Width() * hdr->Height();
-        while( sz > 0 )
-        {
-            const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-            m_td->Queue( [src, dst, chunk, tonemap = m_tonemap] {
-                ToneMap::Process( tonemap, (uint32_t*)dst, src, chunk );
-            } );
-            src += chunk * 4;
-            dst += chunk * 4;
-            sz -= chunk;
-        }
-        m_td->Sync();
-        return bmp;
-    }
-    else
-    {
-        return hdr->Tonemap( m_tonemap );
-    }
+    if( !hdr ) return nullptr;
+    return hdr->Tonemap( m_tonemap, m_td );
 }
 
 std::unique_ptr<BitmapHdr> ExrLoader::LoadHdr( Colorspace colorspace )
@@ -168,114 +222,258 @@ std::unique_ptr<BitmapHdr> ExrLoader::LoadHdr( Colorspace colorspace )
     auto height = dw.max.y - dw.min.y + 1;
 
     std::vector<Imf::Rgba> hdr;
-    hdr.resize( width * height );
+    if( !ReadLevel( hdr, width, height ) )
+    {
+        hdr.resize( width * height );
 
-    m_exr->setFrameBuffer( hdr.data() - dw.min.x - dw.min.y * width, 1, width );
-    m_exr->readPixels( dw.min.y, dw.max.y );
+        m_exr->setFrameBuffer( hdr.data() - dw.min.x - dw.min.y * width, 1, width );
+        if( !ReadPixels( *m_exr, dw.min.y, dw.max.y ) ) return nullptr;
+    }
 
-    auto bmp = std::make_unique<BitmapHdr>( width, height, colorspace );
+    return Convert( hdr, width, height, colorspace );
+}
+
+std::unique_ptr<BitmapHdrHalf> ExrLoader::LoadHdrHalf( Colorspace colorspace )
+{
+    CheckPanic( m_exr, "Invalid EXR file" );
+    CheckPanic( colorspace == Colorspace::BT709 || colorspace == Colorspace::BT2020, "Invalid colorspace" );
+
+    auto dw = m_exr->dataWindow();
+    auto width = dw.max.x - dw.min.x + 1;
+    auto height = dw.max.y - dw.min.y + 1;
+
+    auto transform = CreateChromaTransform( m_exr->header(), colorspace, TYPE_RGBA_HALF_FLT );
+    const auto fileColorspace = transform ? colorspace : Colorspace::BT709;
 
-    const auto chroma = m_exr->header().findTypedAttribute<OPENEXR_IMF_INTERNAL_NAMESPACE::ChromaticitiesAttribute>( "chromaticities" );
-    if( chroma )
+    // Imf::Rgba has the same layout as the bitmap pixels, so the full image is read right into it
+    std::vector<Imf::Rgba> level;
+    const auto reduced = ReadLevel( level, width, height );
+    auto bmp = std::make_unique<BitmapHdrHalf>( width, height, fileColorspace );
+    if( reduced )
     {
-        const auto neutral = m_exr->header().findTypedAttribute<IMATH_NAMESPACE::V2f>( "adoptedNeutral" );
-        const auto white = neutral ? cmsCIExyY { neutral->x, neutral->y, 1 } : cmsCIExyY { 0.3127f, 0.329f, 1 };
-
-        const auto& cv = chroma->value();
-        const cmsCIExyYTRIPLE primaries = {
-            { chroma->value().red.x, chroma->value().red.y, 1 },
-            { chroma->value().green.x, chroma->value().green.y, 1 },
-            { chroma->value().blue.x, chroma->value().blue.y, 1 }
-        };
-        cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-        cmsToneCurve* linear3[3] = { linear, linear, linear };
-
-        auto profileIn = cmsCreateRGBProfile( &white, &primaries, linear3 );
-        auto profileOut = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT709 ? &primaries709 : &primaries2020, linear3 );
-        auto transform = cmsCreateTransform( profileIn, TYPE_RGBA_HALF_FLT, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
+        memcpy( bmp->Data(), level.data(), level.size() * sizeof( Imf::Rgba ) );
+    }
+    else
+    {
+        m_exr->setFrameBuffer( (Imf::Rgba*)bmp->Data() - dw.min.x - dw.min.y * width, 1, width );
+        if( !ReadPixels( *m_exr, dw.min.y, dw.max.y ) )
+        {
+            if( transform ) cmsDeleteTransform( transform );
+            return nullptr;
+        }
+    }
 
+    if( transform )
+    {
+        auto ptr = bmp->Data();
         if( m_td )
         {
-            auto src = hdr.data();
-            auto dst = bmp->Data();
-            auto sz = width * height;
-            while( sz > 0 )
-            {
-                auto chunk = std::min<size_t>( sz, 16 * 1024 );
-                m_td->Queue( [src, dst, chunk, transform] {
-                    cmsDoTransform( transform, src, dst, chunk );
-                    FixAlpha( dst, chunk );
-                } );
-                src += chunk;
-                dst += chunk * 4;
-                sz -= chunk;
-            }
-            m_td->Sync();
+            m_td->ParallelFor( 0, width * height, TaskDispatch::AdaptiveGrain, [ptr, transform]( size_t begin, size_t end ) {
+                cmsDoTransform( transform, ptr + begin * 4, ptr + begin * 4, end - begin );
+            } );
         }
         else
         {
-            cmsDoTransform( transform, hdr.data(), bmp->Data(), width * height );
-            FixAlpha( bmp->Data(), width * height );
+            cmsDoTransform( transform, ptr, ptr, width * height );
         }
-
         cmsDeleteTransform( transform );
-        cmsCloseProfile( profileIn );
-        cmsCloseProfile( profileOut );
-        cmsFreeToneCurve( linear );
     }
     else if( colorspace == Colorspace::BT2020 )
     {
-        cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-        cmsToneCurve* linear3[3] = { linear, linear, linear };
+        bmp->SetColorspace( Colorspace::BT2020, m_td );
+    }
+    bmp->SetAlpha( 1, m_td );
+
+    return bmp;
+}
 
-        auto profileIn = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-        auto profileOut = cmsCreateRGBProfile( &white709, &primaries2020, linear3 );
-        auto transform = cmsCreateTransform( profileIn, TYPE_RGBA_HALF_FLT, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
+std::unique_ptr<BitmapHdr> ExrLoader::Convert( const std::vector<Imf::Rgba>& hdr, int width, int height, Colorspace colorspace )
+{
+    // Without primaries in the header the pixels are BT.709, which is converted to BT.2020 with the bitmap matrix
+    auto transform = CreateChromaTransform( m_exr->header(), colorspace, TYPE_RGBA_FLT );
+    auto bmp = std::make_unique<BitmapHdr>( width, height, transform ? colorspace : Colorspace::BT709 );
 
-        if( m_td )
+    auto convert = [src = hdr.data(), dst = bmp->Data(), transform]( size_t begin, size_t end ) {
+        if( transform )
         {
-            auto src = hdr.data();
-            auto dst = bmp->Data();
-            auto sz = width * height;
-            while( sz > 0 )
-            {
-                auto chunk = std::min<size_t>( sz, 16 * 1024 );
-                m_td->Queue( [src, dst, chunk, transform] {
-                    cmsDoTransform( transform, src, dst, chunk );
-                    FixAlpha( dst, chunk );
-                } );
-                src += chunk;
-                dst += chunk * 4;
-                sz -= chunk;
-            }
-            m_td->Sync();
+            cmsDoTransform( transform, src + begin, dst + begin * 4, end - begin );
+            FixAlpha( dst + begin * 4, end - begin );
         }
         else
         {
-            cmsDoTransform( transform, hdr.data(), bmp->Data(), width * height );
-            FixAlpha( bmp->Data(), width * height );
+            CopyRgb( src + begin, dst + begin * 4, end - begin );
         }
+    };
+    if( m_td )
+    {
+        m_td->ParallelFor( 0, size_t( width ) * height, TaskDispatch::AdaptiveGrain, convert );
+    }
+    else
+    {
+        convert( 0, size_t( width ) * height );
+    }
 
+    if( transform )
+    {
         cmsDeleteTransform( transform );
-        cmsCloseProfile( profileIn );
-        cmsCloseProfile( profileOut );
-        cmsFreeToneCurve( linear );
     }
-    else
+    else if( colorspace == Colorspace::BT2020 )
     {
-        auto dst = bmp->Data();
-        auto src = hdr.data();
-        auto sz = width * height;
-        do
+        bmp->SetColorspace( Colorspace::BT2020, m_td );
+    }
+    return bmp;
+}
+
+bool ExrLoader::HasFastPreview()
+{
+    return LevelScale() > 1;
+}
+
+uint32_t ExrLoader::LevelScale() const
+{
+    if( !m_exr || m_part != 0 ) return 1;
+
+    const auto& header = m_exr->header();
+    if( !header.hasTileDescription() || header.tileDescription().mode == Imf::ONE_LEVEL ) return 1;
+
+    const auto dw = m_exr->dataWindow();
+    return TargetScale( dw.max.x - dw.min.x + 1, dw.max.y - dw.min.y + 1, 1u << 30 );
+}
+
+bool ExrLoader::ReadLevel( std::vector<Imf::Rgba>& hdr, int& width, int& height )
+{
+    const auto scale = LevelScale();
+    if( scale == 1 ) return false;
+
+    auto tiled = OpenTiled();
+    if( !tiled ) return false;
+
+    try
+    {
+        // Mip levels have lx == ly, rip levels are picked along the diagonal to keep the aspect ratio
+        const auto level = std::min( { std::countr_zero( scale ), tiled->numXLevels() - 1, tiled->numYLevels() - 1 } );
+        if( level == 0 ) return false;
+
+        const auto dw = tiled->dataWindowForLevel( level, level );
+        width = dw.max.x - dw.min.x + 1;
+        height = dw.max.y - dw.min.y + 1;
+        mclog( LogLevel::Info, "EXR: Reading level %i, %ix%i", level, width, height );
+
+        hdr.resize( width * height );
+        tiled->setFrameBuffer( hdr.data() - dw.min.x - dw.min.y * width, 1, width );
+        tiled->readTiles( 0, tiled->numXTiles( level ) - 1, 0, tiled->numYTiles( level ) - 1, level, level );
+        return true;
+    }
+    catch( const std::exception& e )
+    {
+        mclog( LogLevel::Warning, "EXR: Failed to read reduced level: %s", e.what() );
+
+        const auto dw = m_exr->dataWindow();
+        width = dw.max.x - dw.min.x + 1;
+        height = dw.max.y - dw.min.y + 1;
+        hdr.clear();
+        return false;
+    }
+}
+
+uint32_t ExrLoader::RegionLevels()
+{
+    if( !m_exr ) return 0;
+
+    auto tiled = OpenTiled();
+    if( !tiled ) return 1;
+    return std::min( tiled->numXLevels(), tiled->numYLevels() );
+}
+
+std::unique_ptr<BitmapHdr> ExrLoader::LoadRegionHdr( uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t level, Colorspace colorspace )
+{
+    CheckPanic( m_exr, "Invalid EXR file" );
+    CheckPanic( colorspace == Colorspace::BT709 || colorspace == Colorspace::BT2020, "Invalid colorspace" );
+
+    std::vector<Imf::Rgba> hdr;
+    if( !ReadRegion( hdr, x, y, width, height, level ) ) return nullptr;
+    return Convert( hdr, width, height, colorspace );
+}
+
+Imf::TiledRgbaInputFile* ExrLoader::OpenTiled()
+{
+    if( m_tiled ) return m_tiled.get();
+
+    // The single part tiled interface can only read the first part
+    if( m_part != 0 || !m_exr->header().hasTileDescription() ) return nullptr;
+
+    try
+    {
+        // The stream is shared with the scanline reader, which seeks to each chunk it reads anyway
+        m_stream->seekg( 0 );
+        m_tiled = std::make_unique<Imf::TiledRgbaInputFile>( *m_stream );
+        return m_tiled.get();
+    }
+    catch( const std::exception& e )
+    {
+        mclog( LogLevel::Warning, "EXR: Failed to open tiled reader: %s", e.what() );
+        return nullptr;
+    }
+}
+
+bool ExrLoader::ReadRegion( std::vector<Imf::Rgba>& hdr, uint32_t x, uint32_t y, uint32_t& width, uint32_t& height, uint32_t level )
+{
+    auto tiled = OpenTiled();
+    if( level > 0 && ( !tiled || level >= RegionLevels() ) ) return false;
+
+    try
+    {
+        const auto dw = tiled ? tiled->dataWindowForLevel( level, level ) : m_exr->dataWindow();
+        const uint32_t lw = dw.max.x - dw.min.x + 1;
+        const uint32_t lh = dw.max.y - dw.min.y + 1;
+        if( x >= lw || y >= lh ) return false;
+
+        width = std::min( width, lw - x );
+        height = std::min( height, lh - y );
+        if( width == 0 || height == 0 ) return false;
+
+        // Whole tiles or scanlines are decoded, so the frame buffer has to span them
+        std::vector<Imf::Rgba> buf;
+        uint32_t bw, bx, by;
+        if( tiled )
         {
-            *dst++ = src->r;
-            *dst++ = src->g;
-            *dst++ = src->b;
-            *dst++ = 1;
-            src++;
+            const uint32_t tw = tiled->tileXSize();
+            const uint32_t th = tiled->tileYSize();
+            const auto tx0 = x / tw;
+            const auto ty0 = y / th;
+            const auto tx1 = ( x + width - 1 ) / tw;
+            const auto ty1 = ( y + height - 1 ) / th;
+
+            bx = tx0 * tw;
+            by = ty0 * th;
+            bw = ( tx1 - tx0 + 1 ) * tw;
+            buf.resize( size_t( bw ) * ( ty1 - ty0 + 1 ) * th );
+
+            tiled->setFrameBuffer( buf.data() - ( ptrdiff_t( dw.min.x ) + bx ) - ( ptrdiff_t( dw.min.y ) + by ) * bw, 1, bw );
+            tiled->readTiles( tx0, tx1, ty0, ty1, level, level );
+        }
+        else
+        {
+            bx = 0;
+            by = y;
+            bw = lw;
+            buf.resize( size_t( bw ) * height );
+
+            const auto y0 = dw.min.y + int( y );
+            m_exr->setFrameBuffer( buf.data() - dw.min.x - ptrdiff_t( y0 ) * bw, 1, bw );
+            m_exr->readPixels( y0, y0 + int( height ) - 1 );
         }
-        while( --sz );
-    }
 
-    return bmp;
+        hdr.resize( size_t( width ) * height );
+        for( uint32_t i=0; i<height; i++ )
+        {
+            std::copy_n( buf.data() + size_t( y - by + i ) * bw + ( x - bx ), width, hdr.data() + size_t( i ) * width );
+        }
+        return true;
+    }
+    catch( const std::exception& e )
+    {
+        mclog( LogLevel::Warning, "EXR: Failed to read region: %s", e.what() );
+        return false;
+    }
 }
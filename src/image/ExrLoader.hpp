@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <vector>
 
 #include <OpenEXRConfig.h>
 
@@ -16,6 +17,8 @@ namespace OPENEXR_IMF_INTERNAL_NAMESPACE
 {
     class IStream;
     class RgbaInputFile;
+    class TiledRgbaInputFile;
+    struct Rgba;
 }
 
 class ExrLoader : public ImageLoader
@@ -30,13 +33,34 @@ public:
 
     [[nodiscard]] bool IsValid() const override;
     [[nodiscard]] bool IsHdr() override { return true; }
+    [[nodiscard]] bool HasFastPreview() override;
+    [[nodiscard]] ImageInfo Probe() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
+    [[nodiscard]] std::unique_ptr<BitmapHdrHalf> LoadHdrHalf( Colorspace colorspace ) override;
+
+    [[nodiscard]] uint32_t RegionLevels() override;
+    [[nodiscard]] std::unique_ptr<BitmapHdr> LoadRegionHdr( uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t level, Colorspace colorspace ) override;
 
 private:
+    // Picks the first part with colour channels, if the file has many.
+    void Open();
+    [[nodiscard]] std::unique_ptr<BitmapHdr> Convert( const std::vector<OPENEXR_IMF_INTERNAL_NAMESPACE::Rgba>& hdr, int width, int height, Colorspace colorspace );
+
+    // Reduction of the smallest mip or rip level still covering the target size, 1 if the file has no levels.
+    [[nodiscard]] uint32_t LevelScale() const;
+    [[nodiscard]] bool ReadLevel( std::vector<OPENEXR_IMF_INTERNAL_NAMESPACE::Rgba>& hdr, int& width, int& height );
+
+    // Opened on first use. Null if the file is not tiled, or if the colour part is not the first one.
+    [[nodiscard]] OPENEXR_IMF_INTERNAL_NAMESPACE::TiledRgbaInputFile* OpenTiled();
+    // Width and height are clipped to the level extent.
+    [[nodiscard]] bool ReadRegion( std::vector<OPENEXR_IMF_INTERNAL_NAMESPACE::Rgba>& hdr, uint32_t x, uint32_t y, uint32_t& width, uint32_t& height, uint32_t level );
+
     std::unique_ptr<OPENEXR_IMF_INTERNAL_NAMESPACE::IStream> m_stream;
     std::unique_ptr<OPENEXR_IMF_INTERNAL_NAMESPACE::RgbaInputFile> m_exr;
+    std::unique_ptr<OPENEXR_IMF_INTERNAL_NAMESPACE::TiledRgbaInputFile> m_tiled;
+    int m_part;
 
     TaskDispatch* m_td;
 
@@ -0,0 +1,301 @@
+#include <stdio.h>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+#include <vector>
+
+#include "HdrLoader.hpp"
+#include "util/Bitmap.hpp"
+#include "util/BitmapHdr.hpp"
+#include "util/FileBuffer.hpp"
+#include "util/FileWrapper.hpp"
+#include "util/Logs.hpp"
+#include "util/Panic.hpp"
+#include "util/SimdDispatch.hpp"
+#include "util/TaskDispatch.hpp"
+
+#if defined MCORE_SIMD_X86
+#  include <x86intrin.h>
+#endif
+
+namespace
+{
+// Header lines can be of any length, the rest of a long one is skipped
+bool ReadLine( FILE* file, char* buf, size_t size )
+{
+    if( !fgets( buf, size, file ) ) return false;
+    if( !strchr( buf, '\n' ) )
+    {
+        int c;
+        while( ( c = fgetc( file ) ) != EOF && c != '\n' ) {}
+    }
+    return true;
+}
+
+// A scanline starts with 2, 2 and the width if each channel is run-length encoded on its own. Otherwise it is
+// stored as pixels, where a 1, 1, 1 pixel repeats the previous one, with the count in its exponent byte, shifted
+// up by 8 bits for each run which directly follows.
+//
+// Without Write, the scanline is only checked and skipped. Returns the position after it, or null if the data is
+// damaged.
+template<bool Write>
+const uint8_t* Scanline( const uint8_t* ptr, const uint8_t* end, uint8_t* dst, uint32_t width )
+{
+    if( width >= 8 && width < 32768 && end - ptr >= 4 && ptr[0] == 2 && ptr[1] == 2 && ( ptr[2] & 0x80 ) == 0 )
+    {
+        if( ( uint32_t( ptr[2] ) << 8 | ptr[3] ) != width ) return nullptr;
+        ptr += 4;
+        for( int c=0; c<4; c++ )
+        {
+            uint32_t x = 0;
+            while( x < width )
+            {
+                if( ptr == end ) return nullptr;
+                uint32_t count = *ptr++;
+                if( count > 128 )
+                {
+                    count -= 128;
+                    if( ptr == end || count > width - x ) return nullptr;
+                    if constexpr( Write )
+                    {
+                        const auto v = *ptr;
+                        for( uint32_t i=0; i<count; i++ ) dst[( x + i ) * 4 + c] = v;
+                    }
+                    ptr++;
+                }
+                else
+                {
+                    if( count == 0 || count > width - x || size_t( end - ptr ) < count ) return nullptr;
+                    if constexpr( Write )
+                    {
+                        for( uint32_t i=0; i<count; i++ ) dst[( x + i ) * 4 + c] = ptr[i];
+                    }
+                    ptr += count;
+                }
+                x += count;
+            }
+        }
+        return ptr;
+    }
+
+    uint32_t x = 0;
+    int shift = 0;
+    while( x < width )
+    {
+        if( end - ptr < 4 ) return nullptr;
+        if( ptr[0] == 1 && ptr[1] == 1 && ptr[2] == 1 )
+        {
+            const auto count = uint64_t( ptr[3] ) << shift;
+            if( x == 0 || shift > 24 || count > width - x ) return nullptr;
+            if constexpr( Write )
+            {
+                for( uint64_t i=0; i<count; i++ ) memcpy( dst + ( x + i ) * 4, dst + ( x - 1 ) * 4, 4 );
+            }
+            x += count;
+            shift += 8;
+        }
+        else
+        {
+            if constexpr( Write ) memcpy( dst + x * 4, ptr, 4 );
+            x++;
+            shift = 0;
+        }
+        ptr += 4;
+    }
+    return ptr;
+}
+}
+
+// A pixel is the mantissa of each channel and a shared exponent: c * 2^( e - 136 ). The scale is built directly from
+// its float bits, as 2^( e - 128 ) / 256. Exponents below 2 are denormal scales, which are flushed to black.
+#if defined MCORE_SIMD_X86
+SIMD_SSE41 static void RgbeToFloatSse41( const uint8_t*& src, float*& dst, size_t& sz )
+{
+    const auto one = _mm_set1_epi32( 1 );
+    const auto scale = _mm_set1_ps( 1.f / 256 );
+    while( sz > 0 )
+    {
+        int32_t rgbe;
+        memcpy( &rgbe, src, 4 );
+        const auto px = _mm_cvtepu8_epi32( _mm_cvtsi32_si128( rgbe ) );
+        const auto e = _mm_shuffle_epi32( px, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+        const auto mul = _mm_mul_ps( _mm_castsi128_ps( _mm_slli_epi32( _mm_max_epi32( _mm_sub_epi32( e, one ), _mm_setzero_si128() ), 23 ) ), scale );
+        _mm_storeu_ps( dst, _mm_blend_ps( _mm_mul_ps( _mm_cvtepi32_ps( px ), mul ), _mm_set1_ps( 1 ), 0x8 ) );
+        src += 4;
+        dst += 4;
+        sz--;
+    }
+}
+
+SIMD_AVX2 static void RgbeToFloatAvx2( const uint8_t*& src, float*& dst, size_t& sz )
+{
+    const auto one = _mm256_set1_epi32( 1 );
+    const auto scale = _mm256_set1_ps( 1.f / 256 );
+    while( sz >= 2 )
+    {
+        const auto px = _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)src ) );
+        const auto e = _mm256_shuffle_epi32( px, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+        const auto mul = _mm256_mul_ps( _mm256_castsi256_ps( _mm256_slli_epi32( _mm256_max_epi32( _mm256_sub_epi32( e, one ), _mm256_setzero_si256() ), 23 ) ), scale );
+        _mm256_storeu_ps( dst, _mm256_blend_ps( _mm256_mul_ps( _mm256_cvtepi32_ps( px ), mul ), _mm256_set1_ps( 1 ), 0x88 ) );
+        src += 8;
+        dst += 8;
+        sz -= 2;
+    }
+}
+
+SIMD_AVX512 static void RgbeToFloatAvx512( const uint8_t*& src, float*& dst, size_t& sz )
+{
+    const auto one = _mm512_set1_epi32( 1 );
+    const auto scale = _mm512_set1_ps( 1.f / 256 );
+    while( sz >= 4 )
+    {
+        const auto px = _mm512_cvtepu8_epi32( _mm_loadu_si128( (const __m128i*)src ) );
+        const auto e = _mm512_shuffle_epi32( px, _MM_PERM_DDDD );
+        const auto mul = _mm512_mul_ps( _mm512_castsi512_ps( _mm512_slli_epi32( _mm512_max_epi32( _mm512_sub_epi32( e, one ), _mm512_setzero_si512() ), 23 ) ), scale );
+        _mm512_storeu_ps( dst, _mm512_mask_blend_ps( 0x8888, _mm512_mul_ps( _mm512_cvtepi32_ps( px ), mul ), _mm512_set1_ps( 1 ) ) );
+        src += 16;
+        dst += 16;
+        sz -= 4;
+    }
+    RgbeToFloatAvx2( src, dst, sz );
+}
+#endif
+
+static void RgbeToFloat( const uint8_t* src, float* dst, size_t sz )
+{
+#if defined MCORE_SIMD_X86
+    switch( GetSimdLevel() )
+    {
+    case SimdLevel::Avx512: RgbeToFloatAvx512( src, dst, sz ); break;
+    case SimdLevel::Avx2: RgbeToFloatAvx2( src, dst, sz ); break;
+    case SimdLevel::Sse41: RgbeToFloatSse41( src, dst, sz ); break;
+    default: break;
+    }
+#endif
+
+    while( sz-- > 0 )
+    {
+        const uint32_t bits = src[3] > 1 ? uint32_t( src[3] - 1 ) << 23 : 0;
+        float mul;
+        memcpy( &mul, &bits, sizeof( mul ) );
+        mul *= 1.f / 256;
+        dst[0] = src[0] * mul;
+        dst[1] = src[1] * mul;
+        dst[2] = src[2] * mul;
+        dst[3] = 1;
+        src += 4;
+        dst += 4;
+    }
+}
+
+HdrLoader::HdrLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td )
+    : m_valid( false )
+    , m_width( 0 )
+    , m_height( 0 )
+    , m_offset( 0 )
+    , m_file( std::move( file ) )
+    , m_tonemap( tonemap )
+    , m_td( td )
+{
+    fseek( *m_file, 0, SEEK_SET );
+
+    char line[256];
+    if( !ReadLine( *m_file, line, sizeof( line ) ) ) return;
+    if( strcmp( line, "#?RADIANCE\n" ) != 0 && strcmp( line, "#?RGBE\n" ) != 0 ) return;
+
+    // Variables, up to an empty line. Files in the XYZE format are rare, and not supported.
+    for(;;)
+    {
+        if( !ReadLine( *m_file, line, sizeof( line ) ) ) return;
+        if( line[0] == '\n' ) break;
+        if( strncmp( line, "FORMAT=", 7 ) == 0 && strcmp( line + 7, "32-bit_rle_rgbe\n" ) != 0 ) return;
+    }
+
+    // Only the standard orientation, top to bottom and left to right
+    int w, h;
+    if( !ReadLine( *m_file, line, sizeof( line ) ) || sscanf( line, "-Y %d +X %d", &h, &w ) != 2 || w <= 0 || h <= 0 ) return;
+
+    m_width = w;
+    m_height = h;
+    m_offset = ftell( *m_file );
+    m_valid = m_offset > 0;
+}
+
+bool HdrLoader::IsValidSignature( const uint8_t* buf, size_t size )
+{
+    if( size >= 11 && memcmp( buf, "#?RADIANCE\n", 11 ) == 0 ) return true;
+    if( size >= 7 && memcmp( buf, "#?RGBE\n", 7 ) == 0 ) return true;
+    return false;
+}
+
+bool HdrLoader::IsValid() const
+{
+    return m_valid;
+}
+
+ImageInfo HdrLoader::Probe()
+{
+    CheckPanic( m_valid, "Invalid Radiance HDR file" );
+    return {
+        .width = m_width,
+        .height = m_height,
+        .hdr = true
+    };
+}
+
+std::unique_ptr<Bitmap> HdrLoader::Load()
+{
+    auto hdr = LoadHdr( Colorspace::BT709 );
+    if( !hdr ) return nullptr;
+    return hdr->Tonemap( m_tonemap, m_td );
+}
+
+std::unique_ptr<BitmapHdr> HdrLoader::LoadHdr( Colorspace colorspace )
+{
+    ZoneScoped;
+    CheckPanic( m_valid, "Invalid Radiance HDR file" );
+    CheckPanic( colorspace == Colorspace::BT709 || colorspace == Colorspace::BT2020, "Invalid colorspace" );
+
+    FileBuffer buf( m_file );
+    if( buf.size() < size_t( m_offset ) ) return nullptr;
+    const auto end = (const uint8_t*)buf.data() + buf.size();
+
+    // Scanlines have no stored size, so they are found by skipping over the runs, which is much cheaper than
+    // expanding them
+    std::vector<const uint8_t*> lines( m_height );
+    {
+        ZoneScopedN( "Index" );
+        auto ptr = (const uint8_t*)buf.data() + m_offset;
+        for( uint32_t y=0; y<m_height; y++ )
+        {
+            lines[y] = ptr;
+            ptr = Scanline<false>( ptr, end, nullptr, m_width );
+            if( !ptr )
+            {
+                mclog( LogLevel::Warning, "Radiance HDR scanline %u is damaged", y );
+                return nullptr;
+            }
+        }
+    }
+
+    // The index pass has checked every scanline already
+    auto hdr = std::make_unique<BitmapHdr>( m_width, m_height, Colorspace::BT709 );
+    auto decode = [this, &lines, end, data = hdr->Data()]( size_t begin, size_t last ) {
+        std::vector<uint8_t> rgbe( size_t( m_width ) * 4 );
+        for( size_t y=begin; y<last; y++ )
+        {
+            Scanline<true>( lines[y], end, rgbe.data(), m_width );
+            RgbeToFloat( rgbe.data(), data + y * m_width * 4, m_width );
+        }
+    };
+    if( m_td )
+    {
+        m_td->ParallelFor( 0, m_height, TaskDispatch::AdaptiveGrain, decode );
+    }
+    else
+    {
+        decode( 0, m_height );
+    }
+
+    if( colorspace != Colorspace::BT709 ) hdr->SetColorspace( colorspace, m_td );
+    return hdr;
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+#include "ImageLoader.hpp"
+#include "util/NoCopy.hpp"
+
+class Bitmap;
+class FileWrapper;
+class TaskDispatch;
+
+// Radiance RGBE images. Scanlines are found with a quick pass over the run lengths, and then expanded and
+// converted to float in parallel.
+class HdrLoader : public ImageLoader
+{
+public:
+    explicit HdrLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td );
+    NoCopy( HdrLoader );
+
+    static bool IsValidSignature( const uint8_t* buf, size_t size );
+
+    [[nodiscard]] bool IsValid() const override;
+    [[nodiscard]] bool IsHdr() override { return true; }
+    [[nodiscard]] bool PreferHdr() override { return true; }
+    [[nodiscard]] ImageInfo Probe() override;
+
+    [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
+
+private:
+    bool m_valid;
+    uint32_t m_width;
+    uint32_t m_height;
+    long m_offset;      // Of the pixel data, after the header
+
+    std::shared_ptr<FileWrapper> m_file;
+    ToneMap::Operator m_tonemap;
+    TaskDispatch* m_td;
+};
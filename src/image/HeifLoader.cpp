@@ -1,20 +1,23 @@
 #include <algorithm>
+#include <atomic>
 #include <cmath>
 #include <libheif/heif.h>
 #include <lcms2.h>
 #include <pugixml.hpp>
 #include <stb_image_resize2.h>
+#include <stdlib.h>
 #include <string.h>
+#include <tracy/Tracy.hpp>
 #include <vector>
 
 #include "HeifLoader.hpp"
-#include "util/Alloca.h"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/CmsCache.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
-#include "util/Simd.hpp"
+#include "util/SimdVec.hpp"
 #include "util/TaskDispatch.hpp"
 #include "util/Tonemapper.hpp"
 
@@ -52,105 +55,97 @@ static float Hlg( float E )
     }
 }
 
-#if defined __SSE4_1__ && defined __FMA__
-static void LinearizePq128( float* ptr, int sz, float NominalLuminanceMul )
+template<typename V>
+SIMD_INLINE void LinearizePqLoop( float*& ptr, int& sz, float NominalLuminanceMul )
 {
-    while( sz > 0 )
+    constexpr int px = V::Lanes / 4;
+    while( sz >= px )
     {
-        __m128 px0 = _mm_loadu_ps( ptr );
-        __m128 px1 = _mm_max_ps( px0, _mm_setzero_ps() );
-        __m128 Nm2 = _mm_pow_ps( px1, _mm_set1_ps( 1.f / 78.84375f ) );
+        const auto px0 = V::Load( ptr );
+        const auto px1 = Max( px0, V::Set( 0.f ) );
+        const auto Nm2 = Pow( px1, V::Set( 1.f / 78.84375f ) );
 
-        __m128 px2 = _mm_sub_ps( Nm2, _mm_set1_ps( 0.8359375f ) );
-        __m128 px3 = _mm_max_ps( px2, _mm_setzero_ps() );
+        const auto px2 = Nm2 - V::Set( 0.8359375f );
+        const auto px3 = Max( px2, V::Set( 0.f ) );
 
-        __m128 px4 = _mm_fnmadd_ps( _mm_set1_ps( 18.6875f ), Nm2, _mm_set1_ps( 18.8515625f ) );
-        __m128 px5 = _mm_div_ps( px3, px4 );
+        const auto px4 = NegMulAdd( V::Set( 18.6875f ), Nm2, V::Set( 18.8515625f ) );
+        const auto px5 = px3 / px4;
 
-        __m128 px6 = _mm_pow_ps( px5, _mm_set1_ps( 1.f / 0.1593017578125f ) );
-        __m128 ret = _mm_mul_ps( px6, _mm_set1_ps( 10000.f * NominalLuminanceMul ) );
+        const auto px6 = Pow( px5, V::Set( 1.f / 0.1593017578125f ) );
+        const auto ret = px6 * V::Set( 10000.f * NominalLuminanceMul );
 
-        __m128 b = _mm_blend_ps( ret, px0, 0x8 );
-        _mm_storeu_ps( ptr, b );
+        AlphaFrom( ret, px0 ).Store( ptr );
 
-        ptr += 4;
-        sz--;
+        ptr += V::Lanes;
+        sz -= px;
     }
 }
 
-#  if defined __AVX2__
-static void LinearizePq256( float* ptr, int sz, float NominalLuminanceMul )
+template<typename V>
+SIMD_INLINE void ApplyGainMapLoop( float*& ptr, size_t& sz, const float*& gptr, float hadj )
 {
-    while( sz > 1 )
+    constexpr size_t px = V::Lanes / 4;
+    while( sz >= px )
     {
-        __m256 px0 = _mm256_loadu_ps( ptr );
-        __m256 px1 = _mm256_max_ps( px0, _mm256_setzero_ps() );
-        __m256 Nm2 = _mm256_pow_ps( px1, _mm256_set1_ps( 1.f / 78.84375f ) );
-
-        __m256 px2 = _mm256_sub_ps( Nm2, _mm256_set1_ps( 0.8359375f ) );
-        __m256 px3 = _mm256_max_ps( px2, _mm256_setzero_ps() );
-
-        __m256 px4 = _mm256_fnmadd_ps( _mm256_set1_ps( 18.6875f ), Nm2, _mm256_set1_ps( 18.8515625f ) );
-        __m256 px5 = _mm256_div_ps( px3, px4 );
-
-        __m256 px6 = _mm256_pow_ps( px5, _mm256_set1_ps( 1.f / 0.1593017578125f ) );
-        __m256 ret = _mm256_mul_ps( px6, _mm256_set1_ps( 10000.f * NominalLuminanceMul ) );
-
-        __m256 b = _mm256_blend_ps( ret, px0, 0x88 );
-        _mm256_storeu_ps( ptr, b );
+        const auto mul = MulAdd( V::Set( hadj ), V::LoadPerPixel( gptr ), V::Set( 1.f ) );
+        const auto v = V::Load( ptr ) * AlphaFrom( mul, V::Set( 1.f ) );
+        v.Store( ptr );
 
-        ptr += 8;
-        sz -= 2;
+        sz -= px;
+        ptr += V::Lanes;
+        gptr += px;
     }
 }
-#  endif
 
-#  if defined __AVX512F__
-static void LinearizePq512( float* ptr, int sz, float NominalLuminanceMul )
+#if defined MCORE_SIMD_X86
+SIMD_SSE41 static void LinearizePqSse41( float* ptr, int sz, float NominalLuminanceMul )
 {
-    while( sz > 3 )
-    {
-        __m512 px0 = _mm512_loadu_ps( ptr );
-        __m512 px1 = _mm512_max_ps( px0, _mm512_setzero_ps() );
-        __m512 Nm2 = _mm512_pow_ps( px1, _mm512_set1_ps( 1.f / 78.84375f ) );
-
-        __m512 px2 = _mm512_sub_ps( Nm2, _mm512_set1_ps( 0.8359375f ) );
-        __m512 px3 = _mm512_max_ps( px2, _mm512_setzero_ps() );
+    LinearizePqLoop<Simd::F128>( ptr, sz, NominalLuminanceMul );
+}
 
-        __m512 px4 = _mm512_fnmadd_ps( _mm512_set1_ps( 18.6875f ), Nm2, _mm512_set1_ps( 18.8515625f ) );
-        __m512 px5 = _mm512_div_ps( px3, px4 );
+SIMD_AVX2 static void LinearizePqAvx2( float* ptr, int sz, float NominalLuminanceMul )
+{
+    LinearizePqLoop<Simd::F256>( ptr, sz, NominalLuminanceMul );
+    if( sz > 0 ) LinearizePqSse41( ptr, sz, NominalLuminanceMul );
+}
 
-        __m512 px6 = _mm512_pow_ps( px5, _mm512_set1_ps( 1.f / 0.1593017578125f ) );
-        __m512 ret = _mm512_mul_ps( px6, _mm512_set1_ps( 10000.f * NominalLuminanceMul ) );
+SIMD_AVX512 static void LinearizePqAvx512( float* ptr, int sz, float NominalLuminanceMul )
+{
+    LinearizePqLoop<Simd::F512>( ptr, sz, NominalLuminanceMul );
+    if( sz > 0 ) LinearizePqAvx2( ptr, sz, NominalLuminanceMul );
+}
 
-        __m512 b = _mm512_mask_blend_ps( 0x8888, ret, px0 );
-        _mm512_storeu_ps( ptr, b );
+SIMD_SSE41 static void ApplyGainMapSse41( float* ptr, size_t sz, const float* gptr, float hadj )
+{
+    ApplyGainMapLoop<Simd::F128>( ptr, sz, gptr, hadj );
+}
 
-        ptr += 16;
-        sz -= 4;
-    }
+SIMD_AVX2 static void ApplyGainMapAvx2( float* ptr, size_t sz, const float* gptr, float hadj )
+{
+    ApplyGainMapLoop<Simd::F256>( ptr, sz, gptr, hadj );
+    if( sz > 0 ) ApplyGainMapSse41( ptr, sz, gptr, hadj );
 }
-#  endif
 
-static void LinearizePq( float* ptr, int sz, float NominalLuminanceMul )
+SIMD_AVX512 static void ApplyGainMapAvx512( float* ptr, size_t sz, const float* gptr, float hadj )
 {
-#  ifdef __AVX512F__
-    LinearizePq512( ptr, sz, NominalLuminanceMul );
-    if( (sz & 3) == 0 ) return;
-    ptr += ( sz & ~3 ) * 4;
-    sz &= 3;
-#  endif
-#  ifdef __AVX2__
-    LinearizePq256( ptr, sz, NominalLuminanceMul );
-    if( (sz & 1) == 0 ) return;
-    ptr += ( sz & ~1 ) * 4;
-    sz &= 1;
-#  endif
-    LinearizePq128( ptr, sz, NominalLuminanceMul );
+    ApplyGainMapLoop<Simd::F512>( ptr, sz, gptr, hadj );
+    if( sz > 0 ) ApplyGainMapAvx2( ptr, sz, gptr, hadj );
 }
-#else
+#endif
+
 static void LinearizePq( float* ptr, int sz, float NominalLuminanceMul )
 {
+#if defined MCORE_SIMD_X86
+    switch( GetSimdLevel() )
+    {
+    case SimdLevel::Avx512: LinearizePqAvx512( ptr, sz, NominalLuminanceMul ); return;
+    case SimdLevel::Avx2: LinearizePqAvx2( ptr, sz, NominalLuminanceMul ); return;
+    case SimdLevel::Sse41: LinearizePqSse41( ptr, sz, NominalLuminanceMul ); return;
+    default: break;
+    }
+#elif defined MCORE_SIMD_NEON
+    if( GetSimdLevel() == SimdLevel::Neon ) LinearizePqLoop<Simd::FNeon>( ptr, sz, NominalLuminanceMul );
+#endif
     for( int i=0; i<sz; i++ )
     {
         ptr[0] = Pq( ptr[0], NominalLuminanceMul );
@@ -160,65 +155,21 @@ static void LinearizePq( float* ptr, int sz, float NominalLuminanceMul )
         ptr += 4;
     }
 }
-#endif
 
 static void ApplyGainMap( float* ptr, size_t sz, const float* gptr, float headroom )
 {
     const float hadj = headroom - 1.f;
 
-#if defined __SSE4_1__ && defined __FMA__
-    __m128 hadj4 = _mm_set1_ps( hadj );
-    while( sz >= 4 )
-    {
-        __m128 gain = _mm_loadu_ps( gptr );
-        __m128 mul = _mm_fmadd_ps( hadj4, gain, _mm_set1_ps( 1.f ) );
-
-        __m128 sh0 = _mm_shuffle_ps( mul, mul, _MM_SHUFFLE( 0, 0, 0, 0 ) );
-        __m128 sh1 = _mm_shuffle_ps( mul, mul, _MM_SHUFFLE( 1, 1, 1, 1 ) );
-        __m128 sh2 = _mm_shuffle_ps( mul, mul, _MM_SHUFFLE( 2, 2, 2, 2 ) );
-        __m128 sh3 = _mm_shuffle_ps( mul, mul, _MM_SHUFFLE( 3, 3, 3, 3 ) );
-
-  #ifdef __AVX2__
-        __m256 sh01 = _mm256_insertf128_ps( _mm256_castps128_ps256( sh0 ), sh1, 1 );
-        __m256 sh23 = _mm256_insertf128_ps( _mm256_castps128_ps256( sh2 ), sh3, 1 );
-
-    #ifdef __AVX512F__
-        __m512 sh0123 = _mm512_insertf32x8( _mm512_castps256_ps512( sh01 ), sh23, 1 );
-        __m512 mul0 = _mm512_mask_blend_ps( 0x8888, sh0123, _mm512_set1_ps( 1.f ) );
-
-        __m512 px = _mm512_loadu_ps( ptr );
-        _mm512_storeu_ps( ptr, _mm512_mul_ps( px, mul0 ) );
-    #else
-        __m256 mul0 = _mm256_blend_ps( sh01, _mm256_set1_ps( 1.f ), 0x88 );
-        __m256 mul1 = _mm256_blend_ps( sh23, _mm256_set1_ps( 1.f ), 0x88 );
-
-        __m256 px0 = _mm256_loadu_ps( ptr );
-        __m256 px1 = _mm256_loadu_ps( ptr + 8 );
-
-        _mm256_storeu_ps( ptr, _mm256_mul_ps( px0, mul0 ) );
-        _mm256_storeu_ps( ptr + 8, _mm256_mul_ps( px1, mul1 ) );
-    #endif
-  #else
-        __m128 mul0 = _mm_blend_ps( sh0, _mm_set1_ps( 1.f ), 8 );
-        __m128 mul1 = _mm_blend_ps( sh1, _mm_set1_ps( 1.f ), 8 );
-        __m128 mul2 = _mm_blend_ps( sh2, _mm_set1_ps( 1.f ), 8 );
-        __m128 mul3 = _mm_blend_ps( sh3, _mm_set1_ps( 1.f ), 8 );
-
-        __m128 px0 = _mm_loadu_ps( ptr );
-        __m128 px1 = _mm_loadu_ps( ptr + 4 );
-        __m128 px2 = _mm_loadu_ps( ptr + 8 );
-        __m128 px3 = _mm_loadu_ps( ptr + 12 );
-
-        _mm_storeu_ps( ptr, _mm_mul_ps( px0, mul0 ) );
-        _mm_storeu_ps( ptr + 4, _mm_mul_ps( px1, mul1 ) );
-        _mm_storeu_ps( ptr + 8, _mm_mul_ps( px2, mul2 ) );
-        _mm_storeu_ps( ptr + 12, _mm_mul_ps( px3, mul3 ) );
-  #endif
-
-        sz -= 4;
-        ptr += 16;
-        gptr += 4;
+#if defined MCORE_SIMD_X86
+    switch( GetSimdLevel() )
+    {
+    case SimdLevel::Avx512: ApplyGainMapAvx512( ptr, sz, gptr, hadj ); return;
+    case SimdLevel::Avx2: ApplyGainMapAvx2( ptr, sz, gptr, hadj ); return;
+    case SimdLevel::Sse41: ApplyGainMapSse41( ptr, sz, gptr, hadj ); return;
+    default: break;
     }
+#elif defined MCORE_SIMD_NEON
+    if( GetSimdLevel() == SimdLevel::Neon ) ApplyGainMapLoop<Simd::FNeon>( ptr, sz, gptr, hadj );
 #endif
 
     while( sz-- > 0 )
@@ -232,6 +183,61 @@ static void ApplyGainMap( float* ptr, size_t sz, const float* gptr, float headro
     }
 }
 
+static cmsHPROFILE CreateRgbProfile( const cmsCIExyY& white, const cmsCIExyYTRIPLE& primaries, float gamma )
+{
+    cmsToneCurve* curve = cmsBuildGamma( nullptr, gamma );
+    cmsToneCurve* curve3[3] = { curve, curve, curve };
+    auto profile = cmsCreateRGBProfile( &white, &primaries, curve3 );
+    cmsFreeToneCurve( curve );
+    return profile;
+}
+
+static CmsCache::ProfileId RgbProfileId( const cmsCIExyY& white, const cmsCIExyYTRIPLE& primaries, float gamma )
+{
+    const double params[] = {
+        gamma, white.x, white.y,
+        primaries.Red.x, primaries.Red.y,
+        primaries.Green.x, primaries.Green.y,
+        primaries.Blue.x, primaries.Blue.y
+    };
+    return CmsCache::Id( "RGB", params, sizeof( params ) );
+}
+
+// Decoder plugin to use instead of the one libheif ranks highest. libheif builds its ffmpeg plugin as the
+// hardware accelerated HEVC decoder, and dav1d is the fastest AV1 decoder. MCORE_HEIF_DECODER overrides the
+// choice. Returns nullptr if the plugin is not installed.
+static const char* PreferredDecoder( const char* mimeType )
+{
+#if LIBHEIF_HAVE_VERSION( 1, 15, 0 )
+    heif_compression_format format;
+    const char* preferred;
+    if( strcmp( mimeType, "image/heic" ) == 0 )
+    {
+        format = heif_compression_HEVC;
+        preferred = "ffmpeg";
+    }
+    else if( strcmp( mimeType, "image/avif" ) == 0 )
+    {
+        format = heif_compression_AV1;
+        preferred = "dav1d";
+    }
+    else
+    {
+        return nullptr;
+    }
+    if( auto env = getenv( "MCORE_HEIF_DECODER" ) ) preferred = env;
+
+    constexpr int MaxDecoders = 16;
+    const heif_decoder_descriptor* decoders[MaxDecoders];
+    const auto num = heif_get_decoder_descriptors( format, decoders, MaxDecoders );
+    for( int i=0; i<num; i++ )
+    {
+        const auto id = heif_decoder_descriptor_get_id_name( decoders[i] );
+        if( strcmp( id, preferred ) == 0 ) return id;
+    }
+#endif
+    return nullptr;
+}
 
 HeifLoader::HeifLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator tonemap, TaskDispatch* td )
     : m_valid( false )
@@ -242,11 +248,9 @@ HeifLoader::HeifLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator ton
     , m_handleGainMap( nullptr )
     , m_image( nullptr )
     , m_nclx( nullptr )
+    , m_options( nullptr )
     , m_gainMap( nullptr )
     , m_iccData( nullptr )
-    , m_profileIn( nullptr )
-    , m_profileOut( nullptr )
-    , m_transform( nullptr )
     , m_td( td )
 {
     fseek( *m_file, 0, SEEK_SET );
@@ -260,12 +264,10 @@ HeifLoader::HeifLoader( std::shared_ptr<FileWrapper> file, ToneMap::Operator ton
 
 HeifLoader::~HeifLoader()
 {
-    if( m_transform ) cmsDeleteTransform( m_transform );
-    if( m_profileOut ) cmsCloseProfile( m_profileOut );
-    if( m_profileIn ) cmsCloseProfile( m_profileIn );
     delete[] m_iccData;
     delete[] m_gainMap;
     if( m_nclx ) heif_nclx_color_profile_free( m_nclx );
+    if( m_options ) heif_decoding_options_free( m_options );
     if( m_image ) heif_image_release( m_image );
     if( m_handleGainMap ) heif_image_handle_release( m_handleGainMap );
     if( m_handle ) heif_image_handle_release( m_handle );
@@ -297,81 +299,57 @@ bool HeifLoader::IsHdr()
     return false;
 }
 
+bool HeifLoader::HasFastPreview()
+{
+    if( !m_buf && !Open() ) return false;
+    if( m_handleGainMap ) return false;
+
+    auto thumbnail = GetThumbnail();
+    if( !thumbnail ) return false;
+    heif_image_handle_release( thumbnail );
+    return true;
+}
+
+ImageInfo HeifLoader::Probe()
+{
+    if( !m_buf && !Open() ) return {};
+
+    // The handle size already has the irot and imir transformations applied
+    return {
+        .width = uint32_t( m_width ),
+        .height = uint32_t( m_height ),
+        .hdr = IsHdr()
+    };
+}
+
 std::unique_ptr<Bitmap> HeifLoader::Load()
 {
     if( !m_buf && !Open() ) return nullptr;
 
-    if( !IsHdr() || m_handleGainMap )
-    {
-        if( !SetupDecode( false, Colorspace::BT709 ) ) return nullptr;
+    const auto tonemap = IsHdr() && !m_handleGainMap;
+    if( !SetupDecode( tonemap, Colorspace::BT709 ) ) return nullptr;
 
-        auto bmp = std::make_unique<Bitmap>( m_width, m_height );
-        auto out = (uint32_t*)bmp->Data();
+    auto bmp = std::make_unique<Bitmap>( m_width, m_height );
+    auto out = (uint32_t*)bmp->Data();
 
-        if( m_td )
+    Dispatch( [this, out, tonemap]( size_t begin, size_t end ) {
+        alignas( 64 ) float block[BlockSize * 4];
+        for( size_t i=begin; i<end; i+=BlockSize )
         {
-            size_t offset = 0;
-            size_t sz = m_width * m_height;
-            while( sz > 0 )
+            const auto sz = std::min( end - i, BlockSize );
+            ConvertBlock( block, sz, i, tonemap );
+            if( tonemap )
             {
-                const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                m_td->Queue( [this, out, chunk, offset] {
-                    auto ptr = (float*)alloca( chunk * 4 * sizeof( float ) );
-                    LoadYCbCr( ptr, chunk, offset );
-                    ConvertYCbCrToRGB( ptr, chunk );
-                    cmsDoTransform( m_transform, ptr, out, chunk );
-                } );
-                out += chunk;
-                sz -= chunk;
-                offset += chunk;
+                ToneMap::Process( m_tonemap, out + i, block, sz );
             }
-            m_td->Sync();
-        }
-        else
-        {
-            auto tmp = std::make_unique<BitmapHdr>( m_width, m_height, Colorspace::BT709 );
-            LoadYCbCr( tmp->Data(), m_width * m_height, 0 );
-            ConvertYCbCrToRGB( tmp->Data(), m_width * m_height );
-            cmsDoTransform( m_transform, tmp->Data(), out, m_width * m_height );
-        }
-
-        return bmp;
-    }
-    else
-    {
-        if( m_td )
-        {
-            if( !SetupDecode( true, Colorspace::BT709 ) ) return nullptr;
-
-            auto bmp = std::make_unique<Bitmap>( m_width, m_height );
-            auto out = (uint32_t*)bmp->Data();
-
-            size_t offset = 0;
-            size_t sz = m_width * m_height;
-            while( sz > 0 )
+            else
             {
-                const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                m_td->Queue( [this, out, chunk, offset] {
-                    auto ptr = (float*)alloca( chunk * 4 * sizeof( float ) );
-                    LoadYCbCr( ptr, chunk, offset );
-                    ConvertYCbCrToRGB( ptr, chunk );
-                    if( m_transform ) cmsDoTransform( m_transform, ptr, ptr, chunk );
-                    ApplyTransfer( ptr, chunk, offset );
-                    ToneMap::Process( m_tonemap, out, ptr, chunk );
-                } );
-                out += chunk;
-                sz -= chunk;
-                offset += chunk;
+                cmsDoTransform( m_transform.get(), block, out + i, sz );
             }
-            m_td->Sync();
-            return bmp;
         }
-        else
-        {
-            std::unique_ptr<BitmapHdr> hdr = LoadHdr( Colorspace::BT709 );
-            return hdr->Tonemap( m_tonemap );
-        }
-    }
+    } );
+
+    return bmp;
 }
 
 std::unique_ptr<BitmapHdr> HeifLoader::LoadHdr( Colorspace colorspace )
@@ -380,35 +358,40 @@ std::unique_ptr<BitmapHdr> HeifLoader::LoadHdr( Colorspace colorspace )
     if( !SetupDecode( true, colorspace ) ) return nullptr;
 
     auto bmp = std::make_unique<BitmapHdr>( m_width, m_height, colorspace );
-    if( m_td )
-    {
-        auto ptr = bmp->Data();
-        size_t offset = 0;
-        size_t sz = m_width * m_height;
-        while( sz > 0 )
+    auto data = bmp->Data();
+
+    Dispatch( [this, data]( size_t begin, size_t end ) {
+        for( size_t i=begin; i<end; i+=BlockSize )
         {
-            const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-            m_td->Queue( [this, ptr, chunk, offset] {
-                LoadYCbCr( ptr, chunk, offset );
-                ConvertYCbCrToRGB( ptr, chunk );
-                if( m_transform ) cmsDoTransform( m_transform, ptr, ptr, chunk );
-                ApplyTransfer( ptr, chunk, offset );
-            } );
-            ptr += chunk * 4;
-            sz -= chunk;
-            offset += chunk;
+            ConvertBlock( data + i * 4, std::min( end - i, BlockSize ), i, true );
         }
-        m_td->Sync();
+    } );
+
+    return bmp;
+}
+
+void HeifLoader::Dispatch( const std::function<void(size_t, size_t)>& fn )
+{
+    const size_t sz = m_width * m_height;
+    if( m_td )
+    {
+        m_td->ParallelFor( 0, sz, TaskDispatch::AdaptiveGrain, fn );
     }
     else
     {
-        LoadYCbCr( bmp->Data(), m_width * m_height, 0 );
-        ConvertYCbCrToRGB( bmp->Data(), m_width * m_height );
-        if( m_transform ) cmsDoTransform( m_transform, bmp->Data(), bmp->Data(), m_width * m_height );
-        ApplyTransfer( bmp->Data(), m_width * m_height, 0 );
+        fn( 0, sz );
     }
+}
 
-    return bmp;
+void HeifLoader::ConvertBlock( float* ptr, size_t sz, size_t offset, bool hdr )
+{
+    LoadYCbCr( ptr, sz, offset );
+    ConvertYCbCrToRGB( ptr, sz );
+    if( hdr )
+    {
+        if( m_transform ) cmsDoTransform( m_transform.get(), ptr, ptr, sz );
+        ApplyTransfer( ptr, sz, offset );
+    }
 }
 
 bool HeifLoader::Open()
@@ -422,6 +405,16 @@ bool HeifLoader::Open()
     auto err = heif_context_read_from_memory_without_copy( m_ctx, m_buf->data(), m_buf->size(), nullptr );
     if( err.code != heif_error_Ok ) return false;
 
+    m_options = heif_decoding_options_alloc();
+#if LIBHEIF_HAVE_VERSION( 1, 15, 0 )
+    const auto mimeType = heif_get_file_mime_type( (const uint8_t*)m_buf->data(), (int)std::min<size_t>( m_buf->size(), 64 ) );
+    if( auto decoder = PreferredDecoder( mimeType ) )
+    {
+        mclog( LogLevel::Info, "HEIF: Using %s decoder", decoder );
+        m_options->decoder_id = decoder;
+    }
+#endif
+
     err = heif_context_get_primary_image_handle( m_ctx, &m_handle );
     if( err.code != heif_error_Ok ) return false;
 
@@ -480,7 +473,25 @@ bool HeifLoader::Open()
 
 bool HeifLoader::SetupDecode( bool hdr, Colorspace colorspace )
 {
-    auto err = heif_decode_image( m_handle, &m_image, heif_colorspace_YCbCr, heif_chroma_444, nullptr );
+    // The gain map is sized against the primary image, so thumbnails are only used without one
+    auto thumbnail = m_handleGainMap ? nullptr : GetThumbnail();
+    if( thumbnail )
+    {
+        m_width = heif_image_handle_get_width( thumbnail );
+        m_height = heif_image_handle_get_height( thumbnail );
+        mclog( LogLevel::Info, "HEIF: Decoding %dx%d thumbnail", m_width, m_height );
+    }
+
+    const auto handle = thumbnail ? thumbnail : m_handle;
+    heif_error err = {};
+    m_image = DecodeTiled( handle );
+    if( !m_image && TaskDispatch::IsCancelled() )
+    {
+        if( thumbnail ) heif_image_handle_release( thumbnail );
+        return false;
+    }
+    if( !m_image ) err = heif_decode_image( handle, &m_image, heif_colorspace_YCbCr, heif_chroma_444, m_options );
+    if( thumbnail ) heif_image_handle_release( thumbnail );
     if( err.code != heif_error_Ok ) return false;
 
     m_colorspace = colorspace;
@@ -580,29 +591,32 @@ bool HeifLoader::SetupDecode( bool hdr, Colorspace colorspace )
         }
     }
 
-    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-    cmsToneCurve* linear3[3] = { linear, linear, linear };
-
     // cmsCreate_sRGBProfile() uses 2.2 gamma internally, not the proper 61966-2-1 transfer function
-    cmsToneCurve* gamma = cmsBuildGamma( nullptr, 2.2f );
-    cmsToneCurve* gamma3[3] = { gamma, gamma, gamma };
+    constexpr float gamma = 2.2f;
+
+    CmsCache::Key key = {
+        .in = {},
+        .out = CmsCache::Id( "sRGB" ),
+        .inFormat = TYPE_RGBA_FLT,
+        .outFormat = TYPE_RGBA_8,
+        .intent = INTENT_PERCEPTUAL,
+        .flags = cmsFLAGS_COPY_ALPHA
+    };
+    std::function<cmsHPROFILE()> openIn;
+    std::function<cmsHPROFILE()> openOut = [] { return cmsCreate_sRGBProfile(); };
+    if( hdr )
+    {
+        CheckPanic( colorspace == Colorspace::BT709 || colorspace == Colorspace::BT2020, "Invalid colorspace" );
+        const auto& primariesOut = colorspace == Colorspace::BT709 ? primaries709 : primaries2020;
+        key.out = RgbProfileId( white709, primariesOut, 1 );
+        key.outFormat = TYPE_RGBA_FLT;
+        openOut = [&primariesOut] { return CreateRgbProfile( white709, primariesOut, 1 ); };
+    }
 
     if( m_iccData )
     {
-        m_profileIn = cmsOpenProfileFromMem( m_iccData, m_iccSize );
-        int outType;
-        if( hdr )
-        {
-            CheckPanic( colorspace == Colorspace::BT709 || colorspace == Colorspace::BT2020, "Invalid colorspace" );
-            m_profileOut = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT709 ? &primaries709 : &primaries2020, linear3 );
-            outType = TYPE_RGBA_FLT;
-        }
-        else
-        {
-            m_profileOut = cmsCreate_sRGBProfile();
-            outType = TYPE_RGBA_8;
-        }
-        m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, outType, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        key.in = CmsCache::Id( m_iccData, m_iccSize );
+        openIn = [this] { return cmsOpenProfileFromMem( m_iccData, m_iccSize ); };
     }
     else if( m_nclx )
     {
@@ -613,39 +627,28 @@ bool HeifLoader::SetupDecode( bool hdr, Colorspace colorspace )
             { m_nclx->color_primary_blue_x, m_nclx->color_primary_blue_y, 1 }
         };
 
-        if( hdr )
+        // HDR data in BT.709 primaries is already in the output colorspace
+        if( !hdr || m_nclx->color_primaries != heif_color_primaries_ITU_R_BT_709_5 )
         {
-            m_profileIn = cmsCreateRGBProfile( &white, &primaries, linear3 );
-            if( m_nclx->color_primaries != heif_color_primaries_ITU_R_BT_709_5 )
-            {
-                CheckPanic( colorspace == Colorspace::BT709 || colorspace == Colorspace::BT2020, "Invalid colorspace" );
-                m_profileOut = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT709 ? &primaries709 : &primaries2020, linear3 );
-                m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
-            }
-        }
-        else
-        {
-            m_profileIn = cmsCreateRGBProfile( &white, &primaries, gamma3 );
-            m_profileOut = cmsCreate_sRGBProfile();
-            m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, TYPE_RGBA_8, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+            const auto inGamma = hdr ? 1 : gamma;
+            key.in = RgbProfileId( white, primaries, inGamma );
+            openIn = [white, primaries, inGamma] { return CreateRgbProfile( white, primaries, inGamma ); };
         }
     }
     else
     {
         CheckPanic( !hdr, "Can't be HDR here" );
 
-        m_profileIn = cmsCreateRGBProfile( &white709, &primaries709, gamma3 );
-        m_profileOut = cmsCreate_sRGBProfile();
-        m_transform = cmsCreateTransform( m_profileIn, TYPE_RGBA_FLT, m_profileOut, TYPE_RGBA_8, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        key.in = RgbProfileId( white709, primaries709, gamma );
+        openIn = [] { return CreateRgbProfile( white709, primaries709, gamma ); };
     }
 
-    cmsFreeToneCurve( linear );
-    cmsFreeToneCurve( gamma );
+    m_transform = openIn ? CmsCache::Get( key, openIn, openOut ) : nullptr;
 
     if( hdr && m_handleGainMap )
     {
         heif_image* gainMap;
-        err = heif_decode_image( m_handleGainMap, &gainMap, heif_colorspace_monochrome, heif_chroma_monochrome, nullptr );
+        err = heif_decode_image( m_handleGainMap, &gainMap, heif_colorspace_monochrome, heif_chroma_monochrome, m_options );
         if( err.code != heif_error_Ok ) return false;
 
         int stride;
@@ -687,6 +690,139 @@ bool HeifLoader::SetupDecode( bool hdr, Colorspace colorspace )
     return true;
 }
 
+heif_image* HeifLoader::DecodeTiled( heif_image_handle* handle )
+{
+#if LIBHEIF_HAVE_VERSION( 1, 19, 0 )
+    if( !m_td || m_td->NumWorkers() < 2 ) return nullptr;
+
+    heif_image_tiling tiling;
+    if( heif_image_handle_get_image_tiling( handle, 1, &tiling ).code != heif_error_Ok ) return nullptr;
+    if( tiling.image_width != uint32_t( m_width ) || tiling.image_height != uint32_t( m_height ) ) return nullptr;
+    const auto numTiles = tiling.num_columns * tiling.num_rows;
+    if( numTiles < 2 ) return nullptr;
+
+    ZoneScoped;
+    mclog( LogLevel::Info, "HEIF: Decoding %ux%u grid of %ux%u tiles", tiling.num_columns, tiling.num_rows, tiling.tile_width, tiling.tile_height );
+
+    // The first tile determines the plane layout and color profiles of the assembled image
+    heif_image* first;
+    if( heif_image_handle_decode_image_tile( handle, &first, heif_colorspace_YCbCr, heif_chroma_444, m_options, 0, 0 ).code != heif_error_Ok ) return nullptr;
+
+    std::vector<std::pair<heif_channel, int>> channels;
+    for( auto channel : { heif_channel_Y, heif_channel_Cb, heif_channel_Cr, heif_channel_Alpha } )
+    {
+        if( heif_image_has_channel( first, channel ) ) channels.emplace_back( channel, heif_image_get_bits_per_pixel_range( first, channel ) );
+    }
+
+    heif_image* image;
+    heif_image_create( m_width, m_height, heif_colorspace_YCbCr, heif_chroma_444, &image );
+    for( auto& [channel, bpp] : channels ) heif_image_add_plane( image, channel, m_width, m_height, bpp );
+
+    heif_color_profile_nclx* nclx;
+    if( heif_image_get_nclx_color_profile( first, &nclx ).code == heif_error_Ok )
+    {
+        heif_image_set_nclx_color_profile( image, nclx );
+        heif_nclx_color_profile_free( nclx );
+    }
+    if( const auto iccSize = heif_image_get_raw_color_profile_size( first ); iccSize > 0 )
+    {
+        std::vector<uint8_t> icc( iccSize );
+        heif_image_get_raw_color_profile( first, icc.data() );
+        heif_image_set_raw_color_profile( image, "prof", icc.data(), iccSize );
+    }
+
+    // Edge tiles may extend past the image
+    auto copy = [&]( heif_image* tile, uint32_t tx, uint32_t ty ) {
+        const auto x0 = tx * tiling.tile_width;
+        const auto y0 = ty * tiling.tile_height;
+        const auto w = std::min<uint32_t>( tiling.tile_width, m_width - x0 );
+        const auto h = std::min<uint32_t>( tiling.tile_height, m_height - y0 );
+        for( auto& [channel, bpp] : channels )
+        {
+            int srcStride, dstStride;
+            auto src = heif_image_get_plane_readonly( tile, channel, &srcStride );
+            auto dst = heif_image_get_plane( image, channel, &dstStride );
+            const auto bytes = bpp > 8 ? 2 : 1;
+            dst += y0 * dstStride + x0 * bytes;
+            for( uint32_t y=0; y<h; y++ )
+            {
+                memcpy( dst, src, w * bytes );
+                src += srcStride;
+                dst += dstStride;
+            }
+        }
+    };
+    copy( first, 0, 0 );
+    heif_image_release( first );
+
+    std::atomic<bool> failed = false;
+    m_td->ParallelFor( 1, numTiles, 1, [&]( size_t begin, size_t end ) {
+        for( size_t i=begin; i<end; i++ )
+        {
+            if( TaskDispatch::IsCancelled() ) return;
+            const uint32_t tx = i % tiling.num_columns;
+            const uint32_t ty = i / tiling.num_columns;
+
+            heif_image* tile;
+            if( heif_image_handle_decode_image_tile( handle, &tile, heif_colorspace_YCbCr, heif_chroma_444, m_options, tx, ty ).code != heif_error_Ok )
+            {
+                failed.store( true, std::memory_order_relaxed );
+                return;
+            }
+            copy( tile, tx, ty );
+            heif_image_release( tile );
+        }
+    } );
+
+    if( TaskDispatch::IsCancelled() )
+    {
+        heif_image_release( image );
+        return nullptr;
+    }
+    if( failed.load( std::memory_order_relaxed ) )
+    {
+        mclog( LogLevel::Warning, "HEIF: Tile decode failed, decoding the whole image" );
+        heif_image_release( image );
+        return nullptr;
+    }
+    return image;
+#else
+    return nullptr;
+#endif
+}
+
+heif_image_handle* HeifLoader::GetThumbnail()
+{
+    const auto num = heif_image_handle_get_number_of_thumbnails( m_handle );
+    if( num == 0 ) return nullptr;
+
+    std::vector<heif_item_id> ids( num );
+    heif_image_handle_get_list_of_thumbnail_IDs( m_handle, ids.data(), num );
+
+    // Smallest thumbnail which still covers the target size
+    heif_image_handle* best = nullptr;
+    int bestWidth = 0;
+    for( auto id : ids )
+    {
+        heif_image_handle* thumbnail;
+        if( heif_image_handle_get_thumbnail( m_handle, id, &thumbnail ).code != heif_error_Ok ) continue;
+
+        const auto width = heif_image_handle_get_width( thumbnail );
+        const auto height = heif_image_handle_get_height( thumbnail );
+        if( CoversTarget( width, height ) && ( !best || width < bestWidth ) )
+        {
+            if( best ) heif_image_handle_release( best );
+            best = thumbnail;
+            bestWidth = width;
+        }
+        else
+        {
+            heif_image_handle_release( thumbnail );
+        }
+    }
+    return best;
+}
+
 template<typename T>
 static inline void ProcessYCbCrAlpha( float* ptr, const T* srcY, const T* srcCb, const T* srcCr, const T* srcA, size_t sz, size_t offset, size_t width, size_t stride, float div )
 {
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <stdint.h>
 
@@ -16,6 +17,7 @@ struct heif_context;
 struct heif_image;
 struct heif_image_handle;
 struct heif_color_profile_nclx;
+struct heif_decoding_options;
 
 class HeifLoader : public ImageLoader
 {
@@ -36,6 +38,8 @@ public:
 
     [[nodiscard]] bool IsValid() const override;
     [[nodiscard]] bool IsHdr() override;
+    [[nodiscard]] bool HasFastPreview() override;
+    [[nodiscard]] ImageInfo Probe() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
@@ -44,6 +48,20 @@ private:
     [[nodiscard]] bool Open();
 
     [[nodiscard]] bool SetupDecode( bool hdr, Colorspace colorspace );
+    [[nodiscard]] heif_image_handle* GetThumbnail();
+
+    // Decodes the tiles of grid images in parallel and assembles them. Returns nullptr if the image is not
+    // tiled, or if the tiles can't be decoded separately.
+    [[nodiscard]] heif_image* DecodeTiled( heif_image_handle* handle );
+
+    // Pixels taken through all conversion stages at once. The float RGBA block stays in the L2 cache.
+    static constexpr size_t BlockSize = 4096;
+
+    // Runs fn( begin, end ) over pixel ranges of the image, in parallel when a TaskDispatch is available.
+    void Dispatch( const std::function<void(size_t, size_t)>& fn );
+
+    // YCbCr to RGB conversion of one block. HDR output also gets the color transform and the transfer function.
+    void ConvertBlock( float* ptr, size_t sz, size_t offset, bool hdr );
 
     void LoadYCbCr( float* ptr, size_t sz, size_t offset );
     void ConvertYCbCrToRGB( float* ptr, size_t sz );
@@ -61,6 +79,7 @@ private:
     heif_image_handle* m_handleGainMap;
     heif_image* m_image;
     heif_color_profile_nclx* m_nclx;
+    heif_decoding_options* m_options;
 
     int m_width, m_height;
     int m_stride, m_bpp;
@@ -80,9 +99,7 @@ private:
     const uint8_t* m_planeCr;
     const uint8_t* m_planeA;
 
-    void* m_profileIn;
-    void* m_profileOut;
-    void* m_transform;
+    std::shared_ptr<void> m_transform;
 
     TaskDispatch* m_td;
 };
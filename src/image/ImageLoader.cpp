@@ -1,10 +1,13 @@
 #include <concepts>
+#include <lcms2.h>
 #include <stdint.h>
 #include <sys/stat.h>
+#include <type_traits>
 #include <tracy/Tracy.hpp>
 
 #include "DdsLoader.hpp"
 #include "ExrLoader.hpp"
+#include "HdrLoader.hpp"
 #include "HeifLoader.hpp"
 #include "ImageLoader.hpp"
 #include "JpgLoader.hpp"
@@ -18,10 +21,15 @@
 #include "WebpLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapAnim.hpp"
+#include "util/BitmapAnimStream.hpp"
+#include "util/BitmapDct.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/BitmapHdrHalf.hpp"
+#include "util/BitmapYuv.hpp"
 #include "util/DataBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Logs.hpp"
+#include "util/Panic.hpp"
 #include "vector/PdfImage.hpp"
 #include "vector/SvgImage.hpp"
 
@@ -40,15 +48,46 @@ static inline std::unique_ptr<ImageLoader> CheckImageLoader( const std::shared_p
     return nullptr;
 }
 
-template<ImageLoaderConcept T, typename... Args>
-static inline std::unique_ptr<ImageLoader> CheckImageLoader( const uint8_t* buf, size_t size, const std::shared_ptr<FileWrapper>& file, Args&&... args )
+template<ImageLoaderConcept T>
+static std::unique_ptr<ImageLoader> OpenImageLoader( const std::shared_ptr<FileWrapper>& file, ToneMap::Operator tonemap, TaskDispatch* td )
 {
-    if( !T::IsValidSignature( buf, size ) ) return nullptr;
-    auto loader = std::make_unique<T>( file, std::forward<Args>( args )... );
-    if( loader->IsValid() ) return loader;
-    return nullptr;
+    if constexpr( std::is_constructible_v<T, const std::shared_ptr<FileWrapper>&, ToneMap::Operator, TaskDispatch*> )
+    {
+        return CheckImageLoader<T>( file, tonemap, td );
+    }
+    else if constexpr( std::is_constructible_v<T, const std::shared_ptr<FileWrapper>&, TaskDispatch*> )
+    {
+        return CheckImageLoader<T>( file, td );
+    }
+    else
+    {
+        return CheckImageLoader<T>( file );
+    }
 }
 
+struct ImageSignature
+{
+    bool (*check)( const uint8_t* buf, size_t size );
+    std::unique_ptr<ImageLoader> (*open)( const std::shared_ptr<FileWrapper>& file, ToneMap::Operator tonemap, TaskDispatch* td );
+};
+
+// Only loaders with a matching signature are constructed. Camera raw files are mostly TIFF containers, so TIFF
+// magic goes to libraw first.
+static constexpr ImageSignature Signatures[] = {
+    { PngLoader::IsValidSignature, OpenImageLoader<PngLoader> },
+    { JpgLoader::IsValidSignature, OpenImageLoader<JpgLoader> },
+    { JxlLoader::IsValidSignature, OpenImageLoader<JxlLoader> },
+    { WebpLoader::IsValidSignature, OpenImageLoader<WebpLoader> },
+    { HeifLoader::IsValidSignature, OpenImageLoader<HeifLoader> },
+    { PvrLoader::IsValidSignature, OpenImageLoader<PvrLoader> },
+    { DdsLoader::IsValidSignature, OpenImageLoader<DdsLoader> },
+    { PcxLoader::IsValidSignature, OpenImageLoader<PcxLoader> },
+    { ExrLoader::IsValidSignature, OpenImageLoader<ExrLoader> },
+    { HdrLoader::IsValidSignature, OpenImageLoader<HdrLoader> },
+    { TiffLoader::IsValidSignature, OpenImageLoader<RawLoader> },
+    { TiffLoader::IsValidSignature, OpenImageLoader<TiffLoader> },
+};
+
 template<ImageLoaderConcept T, typename... Args>
 static inline std::unique_ptr<ImageLoader> CheckImageLoader( const std::shared_ptr<DataBuffer>& buffer, Args&&... args )
 {
@@ -57,16 +96,114 @@ static inline std::unique_ptr<ImageLoader> CheckImageLoader( const std::shared_p
     return nullptr;
 }
 
+ImageInfo ImageLoader::Probe()
+{
+    return {
+        .hdr = IsHdr(),
+        .animated = IsAnimated()
+    };
+}
+
+std::unique_ptr<Bitmap> ImageLoader::LoadStreaming( RowSink& sink )
+{
+    return Load();
+}
+
 std::unique_ptr<BitmapAnim> ImageLoader::LoadAnim()
 {
     return nullptr;
 }
 
+std::unique_ptr<BitmapAnimStream> ImageLoader::LoadAnimStream( TaskDispatch* td )
+{
+    return nullptr;
+}
+
 std::unique_ptr<BitmapHdr> ImageLoader::LoadHdr( Colorspace colorspace )
 {
     return nullptr;
 }
 
+std::unique_ptr<BitmapHdrHalf> ImageLoader::LoadHdrHalf( Colorspace colorspace )
+{
+    auto hdr = LoadHdr( colorspace );
+    if( !hdr ) return nullptr;
+    return std::make_unique<BitmapHdrHalf>( *hdr );
+}
+
+std::unique_ptr<BitmapCompressed> ImageLoader::LoadCompressed()
+{
+    return nullptr;
+}
+
+std::unique_ptr<BitmapYuv> ImageLoader::LoadYuv()
+{
+    return nullptr;
+}
+
+std::unique_ptr<BitmapDct> ImageLoader::LoadDct()
+{
+    return nullptr;
+}
+
+std::unique_ptr<BitmapHdr> ImageLoader::LoadRegionHdr( uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t level, Colorspace colorspace )
+{
+    return nullptr;
+}
+
+std::unique_ptr<BitmapHdr> ImageLoader::ConvertSrgb16( const uint16_t* src, uint32_t width, uint32_t height, Colorspace colorspace, int orientation )
+{
+    CheckPanic( colorspace == Colorspace::BT709 || colorspace == Colorspace::BT2020, "Invalid colorspace" );
+
+    // IEC 61966-2-1 transfer function. cmsCreate_sRGBProfile() matches it, but only comes with BT.709 primaries.
+    const cmsFloat64Number srgbParams[5] = { 2.4, 1 / 1.055, 0.055 / 1.055, 1 / 12.92, 0.04045 };
+    cmsToneCurve* srgb = cmsBuildParametricToneCurve( nullptr, 4, srgbParams );
+    cmsToneCurve* srgb3[3] = { srgb, srgb, srgb };
+    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
+    cmsToneCurve* linear3[3] = { linear, linear, linear };
+
+    auto profileIn = cmsCreateRGBProfile( &white709, &primaries709, srgb3 );
+    auto profileOut = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT709 ? &primaries709 : &primaries2020, linear3 );
+    auto transform = cmsCreateTransform( profileIn, TYPE_RGBA_16, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
+
+    auto bmp = std::make_unique<BitmapHdr>( width, height, colorspace, orientation );
+    const auto sz = size_t( width ) * height;
+    cmsDoTransform( transform, src, bmp->Data(), sz );
+
+    // Extra channels are not touched by the transform
+    auto dst = bmp->Data() + 3;
+    src += 3;
+    for( size_t i=0; i<sz; i++ )
+    {
+        *dst = *src / 65535.f;
+        dst += 4;
+        src += 4;
+    }
+
+    cmsDeleteTransform( transform );
+    cmsCloseProfile( profileIn );
+    cmsCloseProfile( profileOut );
+    cmsFreeToneCurve( srgb );
+    cmsFreeToneCurve( linear );
+
+    return bmp;
+}
+
+uint32_t ImageLoader::TargetScale( uint32_t width, uint32_t height, uint32_t maxFactor ) const
+{
+    uint32_t factor = 1;
+    while( factor * 2 <= maxFactor && CoversTarget( width / ( factor * 2 ), height / ( factor * 2 ) ) ) factor *= 2;
+    return factor;
+}
+
+bool ImageLoader::CoversTarget( uint32_t width, uint32_t height ) const
+{
+    if( m_targetWidth == 0 || m_targetHeight == 0 ) return false;
+
+    // Fitting scales by min( tw / w, th / h ), so one dimension reaching the target is enough
+    return width >= m_targetWidth || height >= m_targetHeight;
+}
+
 std::unique_ptr<ImageLoader> GetImageLoader( const char* path, ToneMap::Operator tonemap, TaskDispatch* td, struct timespec* mtime )
 {
     ZoneScoped;
@@ -92,28 +229,72 @@ std::unique_ptr<ImageLoader> GetImageLoader( const char* path, ToneMap::Operator
         if( fstat( fileno( *file ), &st ) == 0 ) *mtime = st.st_mtim;
     }
 
-    if( auto loader = CheckImageLoader<PngLoader>( buf, sz, file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<JpgLoader>( buf, sz, file, td ); loader ) return loader;
-    if( auto loader = CheckImageLoader<JxlLoader>( buf, sz, file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<WebpLoader>( buf, sz, file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<HeifLoader>( buf, sz, file, tonemap, td ); loader ) return loader;
-    if( auto loader = CheckImageLoader<PvrLoader>( buf, sz, file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<DdsLoader>( buf, sz, file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<PcxLoader>( buf, sz, file ); loader ) return loader;
+    bool tried = false;
+    for( auto& sig : Signatures )
+    {
+        if( !sig.check( buf, sz ) ) continue;
+        if( auto loader = sig.open( file, tonemap, td ); loader ) return loader;
+        tried = true;
+    }
+
+    // Formats without a usable signature, e.g. TGA, or the pile of camera raw containers
     if( auto loader = CheckImageLoader<StbImageLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<ExrLoader>( buf, sz, file, tonemap, td ); loader ) return loader;
-    if( auto loader = CheckImageLoader<RawLoader>( file ); loader ) return loader;
-    if( auto loader = CheckImageLoader<TiffLoader>( buf, sz, file ); loader ) return loader;
+    if( !TiffLoader::IsValidSignature( buf, sz ) )
+    {
+        if( auto loader = CheckImageLoader<RawLoader>( file, td ); loader ) return loader;
+    }
+    if( tried ) mclog( LogLevel::Debug, "Image %s has a known signature, but can't be loaded", path );
 
     mclog( LogLevel::Debug, "Raster image loaders can't open %s", path );
     return nullptr;
 }
 
+bool IsLoadableImage( const char* path )
+{
+    ZoneScoped;
+
+    auto file = std::make_shared<FileWrapper>( path, "rb" );
+    if( !*file ) return false;
+
+    struct stat st;
+    if( fstat( fileno( *file ), &st ) != 0 || !S_ISREG( st.st_mode ) ) return false;
+
+    uint8_t buf[12];
+    const size_t sz = fread( buf, 1, sizeof( buf ), *file );
+    if( sz == 0 ) return false;
+
+    // A file with a valid signature may still fail to load, which is reported when it is shown
+    for( auto& sig : Signatures )
+    {
+        if( sig.check( buf, sz ) ) return true;
+    }
+
+    if( CheckImageLoader<StbImageLoader>( file ) ) return true;
+    return !TiffLoader::IsValidSignature( buf, sz ) && CheckImageLoader<RawLoader>( file );
+}
+
+bool IsLoadableImage( const char* path, const uint8_t* header, size_t size )
+{
+    ZoneScoped;
+
+    if( size == 0 ) return false;
+    for( auto& sig : Signatures )
+    {
+        if( sig.check( header, size ) ) return true;
+    }
+
+    auto file = std::make_shared<FileWrapper>( path, "rb" );
+    if( !*file ) return false;
+    if( CheckImageLoader<StbImageLoader>( file ) ) return true;
+    return !TiffLoader::IsValidSignature( header, size ) && CheckImageLoader<RawLoader>( file );
+}
+
 std::unique_ptr<ImageLoader> GetImageLoader( const std::shared_ptr<DataBuffer>& buffer, ToneMap::Operator tonemap, TaskDispatch* td )
 {
     ZoneScoped;
 
     if( auto loader = CheckImageLoader<PngLoader>( buffer ); loader ) return loader;
+    if( auto loader = CheckImageLoader<JpgLoader>( buffer, td ); loader ) return loader;
     if( auto loader = CheckImageLoader<ExrLoader>( buffer, tonemap, td ); loader ) return loader;
 
     return nullptr;
@@ -1,18 +1,50 @@
 #pragma once
 
 #include <memory>
+#include <stdint.h>
 #include <time.h>
 
+#include "util/BitmapCompressed.hpp"
 #include "util/Colorspace.hpp"
 #include "util/Tonemapper.hpp"
 
 class Bitmap;
 class BitmapAnim;
+class BitmapAnimStream;
+class BitmapDct;
 class BitmapHdr;
+class BitmapHdrHalf;
+class BitmapYuv;
 class DataBuffer;
 class TaskDispatch;
 class VectorImage;
 
+// Image properties known from the file header, without decoding any pixel data.
+struct ImageInfo
+{
+    uint32_t width = 0;     // Stored size, before orientation is applied. Zero if not known.
+    uint32_t height = 0;
+    int orientation = 0;    // EXIF orientation, zero if none
+    bool hdr = false;
+    bool animated = false;
+};
+
+// Receives the rows of an image as a loader decodes them, see ImageLoader::LoadStreaming().
+class RowSink
+{
+public:
+    virtual ~RowSink() = default;
+
+    // Called once, with the size of the image, before any rows are given. Returning false declines the image,
+    // which is then loaded without passing any rows.
+    virtual bool Start( uint32_t width, uint32_t height ) = 0;
+
+    // Final RGBA pixels of count rows, starting with row y, packed as in the bitmap Load() returns. Bands come in
+    // any order and from any thread, but never concurrently. A band may be given again if the loader falls back
+    // to another decoder, the last pixels given are the ones returned.
+    virtual void Rows( const uint32_t* data, uint32_t y, uint32_t count ) = 0;
+};
+
 class ImageLoader
 {
 public:
@@ -23,13 +55,93 @@ public:
     [[nodiscard]] virtual bool IsHdr() { return false; }
     [[nodiscard]] virtual bool PreferHdr() { return false; }
 
+    // Block compression format of the file data, if it can be passed to the GPU as is with LoadCompressed().
+    // Load() remains available as a fallback for devices without support for the format.
+    [[nodiscard]] virtual BitmapCompressed::Format CompressedFormat() { return BitmapCompressed::Format::None; }
+
+    // Whether, with a target size set, Load() and LoadHdr() return a reduced image at a fraction of the cost of
+    // the full one. Loaders are single use, so the full image then has to come from a new loader.
+    [[nodiscard]] virtual bool HasFastPreview() { return false; }
+
+    // Whether LoadYuv() can return the subsampled YCbCr planes as stored in the file, to be converted to RGB on
+    // the GPU. Only images which need no other processing, such as color management or orientation, qualify.
+    // Load() remains available as a fallback.
+    [[nodiscard]] virtual bool HasYuv() { return false; }
+
+    // Whether LoadDct() can return the quantized DCT coefficients, leaving the inverse DCT to the GPU. The same
+    // restrictions as for HasYuv() apply.
+    [[nodiscard]] virtual bool HasDct() { return false; }
+
+    // Whether LoadStreaming() passes the image on band by band, as it is decoded, e.g. to upload it while the
+    // rest is still decoding. Only images which need no processing of the full image after decoding, such as
+    // color management or orientation, qualify.
+    [[nodiscard]] virtual bool HasStreaming() { return false; }
+
+    // Reads the image properties from the file header. Can be called before any of the Load functions, and
+    // does not count as the single use of the loader.
+    [[nodiscard]] virtual ImageInfo Probe();
+
     [[nodiscard]] virtual std::unique_ptr<Bitmap> Load() = 0;
+    // Same as Load(), also giving every row of the returned bitmap to the sink. Loaders without streaming return
+    // Load() and never start the sink.
+    [[nodiscard]] virtual std::unique_ptr<Bitmap> LoadStreaming( RowSink& sink );
     [[nodiscard]] virtual std::unique_ptr<BitmapAnim> LoadAnim();
+    // Like LoadAnim(), but frames are decoded as the animation plays, ahead of playback on td if it is set.
+    [[nodiscard]] virtual std::unique_ptr<BitmapAnimStream> LoadAnimStream( TaskDispatch* td = nullptr );
     [[nodiscard]] virtual std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace = Colorspace::BT709 );
+    // Same as LoadHdr(), in half float precision, as used by textures. Loaders of half float formats return
+    // the pixels without a float intermediate, the others convert the LoadHdr() result.
+    [[nodiscard]] virtual std::unique_ptr<BitmapHdrHalf> LoadHdrHalf( Colorspace colorspace = Colorspace::BT709 );
+    [[nodiscard]] virtual std::unique_ptr<BitmapCompressed> LoadCompressed();
+    [[nodiscard]] virtual std::unique_ptr<BitmapYuv> LoadYuv();
+    [[nodiscard]] virtual std::unique_ptr<BitmapDct> LoadDct();
+
+    // Number of resolution levels LoadRegionHdr() can read from, each half the size of the previous one. Zero if
+    // the loader can't read parts of the image without decoding all of it.
+    [[nodiscard]] virtual uint32_t RegionLevels() { return 0; }
+
+    // Reads a rectangle of the given level, in pixels of that level. The rectangle is clipped to the level size.
+    // Unlike the other Load functions, this may be called any number of times. Must be externally synchronized.
+    [[nodiscard]] virtual std::unique_ptr<BitmapHdr> LoadRegionHdr( uint32_t x, uint32_t y, uint32_t width, uint32_t height, uint32_t level, Colorspace colorspace = Colorspace::BT709 );
+
+    // Number of images stored in the file, such as cube map faces or texture array layers. The Load functions
+    // return the one selected with SetLayer().
+    [[nodiscard]] virtual uint32_t Layers() { return 1; }
+    void SetLayer( uint32_t layer ) { m_layer = layer; }
+
+    // Size the image will be shown at, in display orientation. Loaders able to decode at a reduced resolution
+    // may return an image smaller than the original, but still large enough to be fit into the target without
+    // upscaling. Zero disables the hint.
+    void SetTargetSize( uint32_t width, uint32_t height ) { m_targetWidth = width; m_targetHeight = height; }
+
+protected:
+    // Largest power of two reduction factor, up to maxFactor, that keeps an image of the given size (in display
+    // orientation) from dropping below the target size.
+    [[nodiscard]] uint32_t TargetScale( uint32_t width, uint32_t height, uint32_t maxFactor ) const;
+
+    // Converts tightly packed 16-bit sRGB RGBA pixels to linear values in the given colorspace, keeping their
+    // full precision.
+    [[nodiscard]] static std::unique_ptr<BitmapHdr> ConvertSrgb16( const uint16_t* src, uint32_t width, uint32_t height, Colorspace colorspace, int orientation = 0 );
+
+    // Whether an image of the given size can be shown at the target size without upscaling. Always false
+    // when no target is set, as only the full image will do then.
+    [[nodiscard]] bool CoversTarget( uint32_t width, uint32_t height ) const;
+
+    uint32_t m_targetWidth = 0;
+    uint32_t m_targetHeight = 0;
+    uint32_t m_layer = 0;
 };
 
 std::unique_ptr<ImageLoader> GetImageLoader( const char* path, ToneMap::Operator tonemap, TaskDispatch* td = nullptr, struct timespec* mtime = nullptr );
 std::unique_ptr<ImageLoader> GetImageLoader( const std::shared_ptr<DataBuffer>& buffer, ToneMap::Operator tonemap, TaskDispatch* td = nullptr );
 
+// Cheap check whether GetImageLoader() would likely succeed, for scanning directories. Files with a known
+// signature are accepted without constructing a loader. Anything which is not a regular file is rejected.
+[[nodiscard]] bool IsLoadableImage( const char* path );
+
+// Same, for a regular file of which the first size bytes were already read. Only files without a known signature
+// are opened.
+[[nodiscard]] bool IsLoadableImage( const char* path, const uint8_t* header, size_t size );
+
 std::unique_ptr<Bitmap> LoadImage( const char* path );
 std::unique_ptr<VectorImage> LoadVectorImage( const char* path );
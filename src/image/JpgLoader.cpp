@@ -1,24 +1,35 @@
 #include <algorithm>
 #include <arpa/inet.h>
+#include <atomic>
 #include <stdio.h>
 #include <jpeglib.h>
 #include <lcms2.h>
 #include <libexif/exif-data.h>
 #include <math.h>
+#include <mutex>
 #include <setjmp.h>
 #include <stb_image_resize2.h>
 #include <stdint.h>
 #include <string.h>
+#include <string>
+#include <string_view>
+#include <tracy/Tracy.hpp>
+#include <vector>
 
 #include "JpgLoader.hpp"
 #include "util/Colorspace.hpp"
 #include "util/Bitmap.hpp"
+#include "util/BitmapDct.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/BitmapRotate.hpp"
+#include "util/BitmapYuv.hpp"
+#include "util/CmsCache.hpp"
 #include "util/EmbedData.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/Logs.hpp"
 #include "util/Panic.hpp"
-#include "util/Simd.hpp"
+#include "util/SimdVec.hpp"
 #include "util/TaskDispatch.hpp"
 
 #include "data/CmykIcm.hpp"
@@ -34,6 +45,15 @@ JpgLoader::JpgLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td )
     m_valid = fread( hdr, 1, 2, *m_file ) == 2 && hdr[0] == 0xFF && hdr[1] == 0xD8;
 }
 
+JpgLoader::JpgLoader( std::shared_ptr<DataBuffer> buf, TaskDispatch* td )
+    : m_buf( std::move( buf ) )
+    , m_td( td )
+    , m_cinfo( nullptr )
+    , m_iccData( nullptr )
+{
+    m_valid = IsValidSignature( (const uint8_t*)m_buf->data(), m_buf->size() );
+}
+
 JpgLoader::~JpgLoader()
 {
     free( m_iccData );
@@ -55,7 +75,55 @@ bool JpgLoader::IsValid() const
 bool JpgLoader::IsHdr()
 {
     if( !m_cinfo && !Open() ) return false;
-    return !m_grayScale && ( m_iccData || m_gainMapOffset >= 0 );
+    return !m_grayScale && ( m_iccData || GainMapOffset() >= 0 );
+}
+
+bool JpgLoader::HasFastPreview()
+{
+    if( !m_cinfo && !Open() ) return false;
+    return DctScale() >= 4;
+}
+
+// Restart intervals are decoded in parallel by LoadParallel(), which beats a serial decode even without the color
+// conversion and upsampling
+bool JpgLoader::HasYuv()
+{
+    if( !m_cinfo && !Open() ) return false;
+    if( !IsPlainYcbcr() ) return false;
+    return m_cinfo->restart_interval == 0 || m_cinfo->progressive_mode || !m_td || m_td->NumWorkers() < 2;
+}
+
+// Entropy decoding is the only work left on the CPU, and it runs in parallel over restart intervals, when there are
+// any
+bool JpgLoader::HasDct()
+{
+    if( !m_cinfo && !Open() ) return false;
+    return IsPlainYcbcr();
+}
+
+// Color management works on the full image, and rotated rows come out as columns of the bitmap
+bool JpgLoader::HasStreaming()
+{
+    if( !m_cinfo && !Open() ) return false;
+    return !m_cmyk && !m_iccData && m_orientation <= 1;
+}
+
+bool JpgLoader::IsPlainYcbcr()
+{
+    if( m_cmyk || m_grayScale || m_iccData || m_orientation > 1 ) return false;
+    if( m_cinfo->jpeg_color_space != JCS_YCbCr || m_cinfo->num_components != 3 || DctScale() != 1 ) return false;
+
+    const auto comp = m_cinfo->comp_info;
+    if( comp[1].h_samp_factor != 1 || comp[1].v_samp_factor != 1 || comp[2].h_samp_factor != 1 || comp[2].v_samp_factor != 1 ) return false;
+    if( comp[0].h_samp_factor != 2 || ( comp[0].v_samp_factor != 2 && comp[0].v_samp_factor != 1 ) ) return false;
+    return GainMapOffset() < 0;
+}
+
+uint32_t JpgLoader::DctScale() const
+{
+    // Orientations 5 to 8 swap the axes
+    const auto transposed = m_orientation >= 5;
+    return TargetScale( transposed ? m_cinfo->image_height : m_cinfo->image_width, transposed ? m_cinfo->image_width : m_cinfo->image_height, 8 );
 }
 
 struct JpgErrorMgr
@@ -73,20 +141,52 @@ static void CmsTransform( TaskDispatch* td, cmsHTRANSFORM transform, const TInpu
     }
     else
     {
-        while( size > 0 )
-        {
-            auto chunk = std::min<uint32_t>( size, 16 * 1024 );
-            td->Queue( [input, output, chunk, transform] {
-                cmsDoTransform( transform, input, output, chunk );
-            } );
-            input += chunk * 4;
-            output += chunk * 4;
-            size -= chunk;
-        }
-        td->Sync();
+        td->ParallelFor( 0, size, TaskDispatch::AdaptiveGrain, [input, output, transform]( size_t begin, size_t end ) {
+            cmsDoTransform( transform, input + begin * 4, output + begin * 4, end - begin );
+        } );
     }
 }
 
+// The profile images are converted from: the embedded ICC profile, the stock CMYK one, or sRGB
+static CmsCache::ProfileId InputProfileId( const uint8_t* icc, uint32_t iccSz, bool cmyk )
+{
+    if( icc ) return CmsCache::Id( icc, iccSz );
+    return CmsCache::Id( cmyk ? "CMYK" : "sRGB" );
+}
+
+static cmsHPROFILE OpenInputProfile( const uint8_t* icc, uint32_t iccSz, bool cmyk )
+{
+    if( icc ) return cmsOpenProfileFromMem( icc, iccSz );
+    if( cmyk )
+    {
+        Unembed( CmykIcm );
+        return cmsOpenProfileFromMem( CmykIcm->data(), CmykIcm->size() );
+    }
+    return cmsCreate_sRGBProfile();
+}
+
+static cmsHPROFILE CreateLinearProfile( Colorspace colorspace )
+{
+    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
+    cmsToneCurve* linear3[3] = { linear, linear, linear };
+    auto profile = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT2020 ? &primaries2020 : &primaries709, linear3 );
+    cmsFreeToneCurve( linear );
+    return profile;
+}
+
+static CmsCache::Transform SrgbTransform( const uint8_t* icc, uint32_t iccSz, bool cmyk )
+{
+    const CmsCache::Key key = {
+        .in = InputProfileId( icc, iccSz, cmyk ),
+        .out = CmsCache::Id( "sRGB" ),
+        .inFormat = cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8,
+        .outFormat = TYPE_RGBA_8,
+        .intent = INTENT_PERCEPTUAL,
+        .flags = 0
+    };
+    return CmsCache::Get( key, [=] { return OpenInputProfile( icc, iccSz, cmyk ); }, [] { return cmsCreate_sRGBProfile(); } );
+}
+
 namespace
 {
 bool HasColorspaceExtensions()
@@ -115,9 +215,354 @@ bool HasColorspaceExtensions()
     return false;
 #endif
 }
+
+// Passes the rows of a streaming load on to the sink. Strips decoded in parallel share it, so the sink is only
+// called under the lock.
+struct JpgSink
+{
+    RowSink& sink;
+    bool direct;    // RGBX output leaves the padding byte as it is
+    std::mutex lock;
+
+    void Rows( uint8_t* data, uint32_t width, uint32_t y, uint32_t count )
+    {
+        auto px = (uint32_t*)data + size_t( y ) * width;
+        if( direct )
+        {
+            for( size_t i=0; i<size_t( width ) * count; i++ ) px[i] |= 0xFF000000;
+        }
+        std::lock_guard guard( lock );
+        sink.Rows( px, y, count );
+    }
+};
+
+// Decoded image, as laid out in the bitmap. Orientations 5 to 8 swap the axes, and the decoded rows are rotated
+// into place one band at a time, while they are still in cache. Only unrotated rows are streamed.
+struct JpgOutput
+{
+    uint8_t* data;
+    uint32_t width;     // Decoded width
+    uint32_t height;    // Decoded height
+    int orientation;
+    JpgSink* sink = nullptr;
+};
+
+// Decodes one scanline into RGBA pixels at dst. Direct output is 4 bytes per pixel already, otherwise row holds
+// the 3 byte pixels.
+void ReadRow( jpeg_decompress_struct* cinfo, uint8_t* dst, uint8_t* row )
+{
+    if( !row )
+    {
+        jpeg_read_scanlines( cinfo, &dst, 1 );
+        return;
+    }
+
+    jpeg_read_scanlines( cinfo, &row, 1 );
+    for( int i=0; i<cinfo->output_width; i++ )
+    {
+        uint32_t col;
+        memcpy( &col, row + i * 3, 4 );
+        col |= 0xFF000000;
+        memcpy( dst, &col, 4 );
+        dst += 4;
+    }
+}
+
+// Converts the scanlines up to end, which start at row y of the image, into RGBA pixels. Returns false if the
+// load was cancelled before all rows were read.
+bool ReadRows( jpeg_decompress_struct* cinfo, const JpgOutput& out, uint32_t y, uint32_t end, bool direct )
+{
+    constexpr uint32_t BandRows = 16;
+    const auto width = out.width;
+    auto row = direct ? nullptr : new uint8_t[width * 3 + 1];
+    bool cancelled = false;
+
+    if( out.orientation < 5 )
+    {
+        auto dst = out.data + size_t( y ) * width * 4;
+        auto band = y;
+        while( cinfo->output_scanline < end )
+        {
+            if( cinfo->output_scanline % BandRows == 0 )
+            {
+                if( TaskDispatch::IsCancelled() )
+                {
+                    cancelled = true;
+                    break;
+                }
+                if( out.sink && y > band )
+                {
+                    out.sink->Rows( out.data, width, band, y - band );
+                    band = y;
+                }
+            }
+            ReadRow( cinfo, dst, row );
+            dst += width * 4;
+            y++;
+        }
+        if( out.sink && !cancelled && y > band ) out.sink->Rows( out.data, width, band, y - band );
+    }
+    else
+    {
+        auto band = new uint8_t[width * 4 * BandRows];
+        const auto clockwise = out.orientation == 6 || out.orientation == 7;
+        while( cinfo->output_scanline < end )
+        {
+            if( TaskDispatch::IsCancelled() )
+            {
+                cancelled = true;
+                break;
+            }
+            uint32_t rows = 0;
+            while( rows < BandRows && cinfo->output_scanline < end )
+            {
+                ReadRow( cinfo, band + rows * width * 4, row );
+                rows++;
+            }
+            if( clockwise )
+            {
+                RotateRows<true>( (const uint32_t*)band, (uint32_t*)out.data, width, out.height, y, rows );
+            }
+            else
+            {
+                RotateRows<false>( (const uint32_t*)band, (uint32_t*)out.data, width, out.height, y, rows );
+            }
+            y += rows;
+        }
+        delete[] band;
+    }
+
+    delete[] row;
+    return !cancelled;
 }
 
-std::unique_ptr<Bitmap> JpgLoader::LoadNoColorspace()
+// Bitmap for the decoded image. If rotate is set, rotations are done while decoding and only the vertical flip
+// of orientations 5 and 7 is left for later.
+std::unique_ptr<Bitmap> MakeBitmap( uint32_t width, uint32_t height, int orientation, bool rotate )
+{
+    if( !rotate ) return std::make_unique<Bitmap>( width, height, orientation );
+
+    switch( orientation )
+    {
+    case 5:
+    case 7:
+        return std::make_unique<Bitmap>( height, width, 4 );
+    case 6:
+    case 8:
+        return std::make_unique<Bitmap>( height, width );
+    default:
+        return std::make_unique<Bitmap>( width, height, orientation );
+    }
+}
+
+// Layout of a sequential JPEG scan with restart markers. Restart intervals are coded independently, so runs of
+// them can be decoded in parallel, each wrapped in a copy of the headers.
+struct JpgRestartLayout
+{
+    std::vector<uint8_t> header;    // SOI up to and including SOS, without APPn and COM segments
+    size_t heightOffset;            // Frame height within header
+    std::vector<size_t> intervals;  // Start of the entropy coded data of each restart interval
+    size_t scanEnd;
+};
+
+bool ParseRestartLayout( const uint8_t* data, size_t size, JpgRestartLayout& layout )
+{
+    if( size < 4 || data[0] != 0xFF || data[1] != 0xD8 ) return false;
+
+    layout.header.assign( data, data + 2 );
+    bool frame = false;
+    size_t pos = 2;
+    for(;;)
+    {
+        if( pos + 4 > size || data[pos] != 0xFF ) return false;
+        const auto marker = data[pos+1];
+        if( marker == 0xFF )
+        {
+            pos++;
+            continue;
+        }
+        const size_t len = ( data[pos+2] << 8 ) | data[pos+3];
+        if( len < 2 || pos + 2 + len > size ) return false;
+
+        if( marker == 0xC0 || marker == 0xC1 )
+        {
+            if( len < 8 ) return false;
+            layout.heightOffset = layout.header.size() + 5;
+            frame = true;
+        }
+        else if( marker >= 0xC2 && marker <= 0xCF && marker != 0xC4 && marker != 0xC8 && marker != 0xCC )
+        {
+            // Progressive, lossless or arithmetic coded
+            return false;
+        }
+
+        const bool skip = ( marker >= 0xE0 && marker <= 0xEF ) || marker == 0xFE;
+        if( !skip ) layout.header.insert( layout.header.end(), data + pos, data + pos + 2 + len );
+        pos += 2 + len;
+        if( marker == 0xDA ) break;
+    }
+    if( !frame ) return false;
+
+    layout.intervals.clear();
+    layout.intervals.emplace_back( pos );
+    for(;;)
+    {
+        auto ff = (const uint8_t*)memchr( data + pos, 0xFF, size - pos );
+        if( !ff || ff + 1 == data + size ) return false;
+        pos = ff - data;
+
+        const auto next = data[pos+1];
+        if( next == 0x00 )
+        {
+            pos += 2;
+        }
+        else if( next == 0xFF )
+        {
+            pos++;
+        }
+        else if( next >= 0xD0 && next <= 0xD7 )
+        {
+            pos += 2;
+            layout.intervals.emplace_back( pos );
+        }
+        else
+        {
+            break;
+        }
+    }
+    layout.scanEnd = pos;
+    return true;
+}
+
+// Standalone JPEG image made of restart intervals [first, last), which cover the given number of pixel rows.
+std::vector<uint8_t> BuildStrip( const JpgRestartLayout& layout, const uint8_t* data, size_t first, size_t last, uint32_t height )
+{
+    const auto begin = layout.intervals[first];
+    const auto end = last < layout.intervals.size() ? layout.intervals[last] - 2 : layout.scanEnd;
+    const auto hdrSize = layout.header.size();
+
+    std::vector<uint8_t> strip;
+    strip.reserve( hdrSize + end - begin + 2 );
+    strip.insert( strip.end(), layout.header.begin(), layout.header.end() );
+    strip.insert( strip.end(), data + begin, data + end );
+    strip.emplace_back( 0xFF );
+    strip.emplace_back( 0xD9 );
+
+    strip[layout.heightOffset] = height >> 8;
+    strip[layout.heightOffset + 1] = height & 0xFF;
+
+    // The decoder expects the marker sequence to start at RST0
+    for( size_t i=first+1; i<last; i++ )
+    {
+        strip[hdrSize + layout.intervals[i] - 1 - begin] = 0xD0 + ( ( i - first - 1 ) & 7 );
+    }
+
+    return strip;
+}
+
+// Runs of restart intervals which can be decoded independently. Each strip begins an MCU row.
+struct JpgStrips
+{
+    JpgRestartLayout layout;
+    std::vector<size_t> splits;     // First restart interval of each strip, then the number of intervals
+    std::vector<size_t> rows;       // Restart intervals which begin an MCU row, then the number of intervals
+    uint32_t mcusPerRow;
+    uint32_t mcuHeight;
+};
+
+bool SplitStrips( const jpeg_decompress_struct* cinfo, const uint8_t* data, size_t size, size_t maxStrips, JpgStrips& strips )
+{
+    if( cinfo->restart_interval == 0 || cinfo->progressive_mode || cinfo->arith_code ) return false;
+    if( cinfo->comps_in_scan != cinfo->num_components ) return false;
+
+    // Non-interleaved scans have single block MCUs
+    const uint32_t mcuWidth = cinfo->num_components == 1 ? DCTSIZE : cinfo->max_h_samp_factor * DCTSIZE;
+    const uint32_t mcuHeight = cinfo->num_components == 1 ? DCTSIZE : cinfo->max_v_samp_factor * DCTSIZE;
+    const auto mcusPerRow = ( cinfo->image_width + mcuWidth - 1 ) / mcuWidth;
+    const auto mcuRows = ( cinfo->image_height + mcuHeight - 1 ) / mcuHeight;
+    const auto interval = cinfo->restart_interval;
+    if( mcuRows < 4 ) return false;
+
+    auto& layout = strips.layout;
+    if( !ParseRestartLayout( data, size, layout ) ) return false;
+    if( layout.intervals.size() != ( size_t( mcusPerRow ) * mcuRows + interval - 1 ) / interval ) return false;
+
+    // Strips begin at restart intervals which also begin an MCU row
+    const auto numStrips = std::min<size_t>( maxStrips, mcuRows );
+    const auto rowsPerStrip = ( mcuRows + numStrips - 1 ) / numStrips;
+    auto& splits = strips.splits;
+    auto& rows = strips.rows;
+    splits = { 0 };
+    rows = { 0 };
+    for( size_t i=1; i<layout.intervals.size(); i++ )
+    {
+        const auto mcu = i * interval;
+        if( mcu % mcusPerRow != 0 ) continue;
+        rows.push_back( i );
+        if( mcu / mcusPerRow >= splits.size() * rowsPerStrip ) splits.push_back( i );
+    }
+    if( splits.size() < 2 ) return false;
+    splits.push_back( layout.intervals.size() );
+    rows.push_back( layout.intervals.size() );
+
+    strips.mcusPerRow = mcusPerRow;
+    strips.mcuHeight = mcuHeight;
+    return true;
+}
+
+// Restart intervals [first, last) to decode strip s from. Fancy upsampling of subsampled chroma blends in the
+// neighbouring rows, so the strip is decoded with an MCU row above and below it, where there are any, and the
+// rows it covers come out the same as in a serial decode.
+void StripRange( const JpgStrips& strips, size_t s, size_t& first, size_t& last )
+{
+    const auto& rows = strips.rows;
+    first = s == 0 ? 0 : *( std::ranges::lower_bound( rows, strips.splits[s] ) - 1 );
+    last = s + 2 == strips.splits.size() ? rows.back() : *std::ranges::upper_bound( rows, strips.splits[s+1] );
+}
+
+// Strips carry no APPn segments, so the colour space is not guessed again, but taken from the full header, which
+// has the Adobe colour transform
+void ReadStripHeader( jpeg_decompress_struct* cinfo, const jpeg_decompress_struct* image )
+{
+    jpeg_read_header( cinfo, TRUE );
+    cinfo->jpeg_color_space = image->jpeg_color_space;
+    cinfo->saw_JFIF_marker = image->saw_JFIF_marker;
+    cinfo->saw_Adobe_marker = image->saw_Adobe_marker;
+    cinfo->Adobe_transform = image->Adobe_transform;
+}
+
+// Copies the coefficients read by jpeg_read_coefficients() into dct, starting at the given MCU row
+bool CopyCoefficients( jpeg_decompress_struct* cinfo, jvirt_barray_ptr* coefs, BitmapDct& dct, uint32_t mcuRow )
+{
+    static_assert( sizeof( JCOEF ) == sizeof( int16_t ) );
+
+    for( int c=0; c<3; c++ )
+    {
+        const auto& comp = cinfo->comp_info[c];
+        const auto& dst = dct.GetComponent( c );
+        const auto y0 = mcuRow * comp.v_samp_factor;
+        if( comp.width_in_blocks != dst.widthInBlocks || y0 + comp.height_in_blocks > dst.heightInBlocks ) return false;
+
+        for( uint32_t y=0; y<comp.height_in_blocks; y++ )
+        {
+            const auto row = ( *cinfo->mem->access_virt_barray )( (j_common_ptr)cinfo, coefs[c], y, 1, FALSE );
+            memcpy( dct.Block( c, 0, y0 + y ), row[0], dst.widthInBlocks * sizeof( JBLOCK ) );
+        }
+    }
+    return true;
+}
+
+void CopyQuantTables( const jpeg_decompress_struct* cinfo, BitmapDct& dct )
+{
+    for( int c=0; c<3; c++ )
+    {
+        const auto quant = cinfo->comp_info[c].quant_table->quantval;
+        std::copy( quant, quant + DCTSIZE2, dct.Quant( c ) );
+    }
+}
+}
+
+std::unique_ptr<Bitmap> JpgLoader::LoadNoColorspace( bool rotate, RowSink* sink )
 {
     if( !m_cinfo && !Open() ) return nullptr;
 
@@ -131,70 +576,300 @@ std::unique_ptr<Bitmap> JpgLoader::LoadNoColorspace()
 #ifdef JCS_EXTENSIONS
     if( extensions && !m_cmyk ) m_cinfo->out_color_space = JCS_EXT_RGBX;
 #endif
-    jpeg_start_decompress( m_cinfo );
 
-    auto bmp = std::make_unique<Bitmap>( m_cinfo->output_width, m_cinfo->output_height, m_orientation );
-    auto ptr = bmp->Data();
+    const auto scale = DctScale();
+    if( scale > 1 )
+    {
+        mclog( LogLevel::Info, "JPEG DCT scaling 1/%u", scale );
+        m_cinfo->scale_num = 1;
+        m_cinfo->scale_denom = scale;
+    }
 
-    if( m_cmyk || extensions )
+    // Started once for either decoder, the parallel one may fall back to the serial one
+    if( sink )
     {
-        while( m_cinfo->output_scanline < m_cinfo->output_height )
-        {
-            jpeg_read_scanlines( m_cinfo, &ptr, 1 );
-            ptr += m_cinfo->output_width * 4;
-        }
+        jpeg_calc_output_dimensions( m_cinfo );
+        if( !sink->Start( m_cinfo->output_width, m_cinfo->output_height ) ) sink = nullptr;
     }
-    else
+
+    if( auto bmp = LoadParallel( m_cmyk || extensions, rotate, sink ); bmp ) return bmp;
+    if( TaskDispatch::IsCancelled() ) return nullptr;
+
+    jpeg_start_decompress( m_cinfo );
+
+    auto bmp = MakeBitmap( m_cinfo->output_width, m_cinfo->output_height, m_orientation, rotate );
+    std::unique_ptr<JpgSink> bands;
+    if( sink ) bands = std::make_unique<JpgSink>( *sink, m_cmyk || extensions );
+    if( !ReadRows( m_cinfo, { bmp->Data(), m_cinfo->output_width, m_cinfo->output_height, rotate ? m_orientation : 0, bands.get() }, 0, m_cinfo->output_height, m_cmyk || extensions ) )
     {
-        auto row = new uint8_t[m_cinfo->output_width * 3 + 1];
-        while( m_cinfo->output_scanline < m_cinfo->output_height )
+        jpeg_abort_decompress( m_cinfo );
+        return nullptr;
+    }
+
+    jpeg_finish_decompress( m_cinfo );
+    return bmp;
+}
+
+std::unique_ptr<Bitmap> JpgLoader::LoadParallel( bool direct, bool rotate, RowSink* sink )
+{
+    if( !m_td || m_td->NumWorkers() < 2 ) return nullptr;
+
+    ZoneScoped;
+
+    JpgStrips strips;
+    if( !SplitStrips( m_cinfo, (const uint8_t*)m_buf->data(), m_buf->size(), m_td->NumWorkers() * 2, strips ) ) return nullptr;
+    const auto& layout = strips.layout;
+    const auto& splits = strips.splits;
+    const auto mcusPerRow = strips.mcusPerRow;
+    const auto mcuHeight = strips.mcuHeight;
+    const auto interval = m_cinfo->restart_interval;
+
+    const auto scale = m_cinfo->scale_denom;
+    const auto width = ( m_cinfo->image_width + scale - 1 ) / scale;
+    const auto height = ( m_cinfo->image_height + scale - 1 ) / scale;
+    mclog( LogLevel::Info, "JPEG: Decoding %zu strips in parallel", splits.size() - 1 );
+
+    auto bmp = MakeBitmap( width, height, m_orientation, rotate );
+    std::unique_ptr<JpgSink> bands;
+    if( sink ) bands = std::make_unique<JpgSink>( *sink, direct );
+    const JpgOutput out = { bmp->Data(), width, height, rotate ? m_orientation : 0, bands.get() };
+    std::atomic<bool> failed = false;
+    m_td->ParallelFor( 0, splits.size() - 1, 1, [&]( size_t begin, size_t end ) {
+        for( size_t s=begin; s<end; s++ )
         {
-            jpeg_read_scanlines( m_cinfo, &row, 1 );
-            for( int i=0; i<m_cinfo->output_width; i++ )
+            size_t first, last;
+            StripRange( strips, s, first, last );
+            const auto top = first * interval / mcusPerRow * mcuHeight;
+            const auto y0 = splits[s] * interval / mcusPerRow * mcuHeight;
+            const auto y1 = std::min( splits[s+1] * interval / mcusPerRow * mcuHeight, size_t( m_cinfo->image_height ) );
+            const auto bottom = std::min( last * interval / mcusPerRow * mcuHeight, size_t( m_cinfo->image_height ) );
+            const auto strip = BuildStrip( layout, (const uint8_t*)m_buf->data(), first, last, bottom - top );
+
+            jpeg_decompress_struct cinfo;
+            JpgErrorMgr jerr;
+            cinfo.err = jpeg_std_error( &jerr.pub );
+            jerr.pub.error_exit = []( j_common_ptr cinfo ) { longjmp( ((JpgErrorMgr*)cinfo->err)->setjmp_buffer, 1 ); };
+            if( setjmp( jerr.setjmp_buffer ) )
             {
-                uint32_t col;
-                memcpy( &col, row + i * 3, 4 );
-                col |= 0xFF000000;
-                memcpy( ptr, &col, 4 );
-                ptr += 4;
+                jpeg_destroy_decompress( &cinfo );
+                failed.store( true, std::memory_order_relaxed );
+                return;
             }
+
+            jpeg_create_decompress( &cinfo );
+            jpeg_mem_src( &cinfo, strip.data(), strip.size() );
+            ReadStripHeader( &cinfo, m_cinfo );
+            cinfo.out_color_space = m_cinfo->out_color_space;
+            cinfo.scale_num = m_cinfo->scale_num;
+            cinfo.scale_denom = m_cinfo->scale_denom;
+            jpeg_start_decompress( &cinfo );
+            if( cinfo.output_width != width || top / scale + cinfo.output_height > height ) longjmp( jerr.setjmp_buffer, 1 );
+
+            // Rows decoded only for the upsampling are dropped. Interior strip bounds are whole MCU rows, which the
+            // DCT scales divide.
+            const auto skip = uint32_t( ( y0 - top ) / scale );
+            const auto end = y1 == m_cinfo->image_height ? cinfo.output_height : uint32_t( ( y1 - top ) / scale );
+            std::vector<uint8_t> discard( size_t( cinfo.output_width ) * cinfo.output_components );
+            auto ptr = discard.data();
+            while( cinfo.output_scanline < skip ) jpeg_read_scanlines( &cinfo, &ptr, 1 );
+
+            if( ReadRows( &cinfo, out, y0 / scale, end, direct ) && end == cinfo.output_height ) jpeg_finish_decompress( &cinfo );
+            jpeg_destroy_decompress( &cinfo );
         }
-        delete[] row;
-    }
+    } );
 
-    jpeg_finish_decompress( m_cinfo );
+    if( TaskDispatch::IsCancelled() ) return nullptr;
+    if( failed.load( std::memory_order_relaxed ) )
+    {
+        mclog( LogLevel::Warning, "JPEG: Parallel decode failed, falling back to serial decode" );
+        return nullptr;
+    }
     return bmp;
 }
 
+ImageInfo JpgLoader::Probe()
+{
+    if( !m_cinfo && !Open() ) return {};
+    return {
+        .width = m_cinfo->image_width,
+        .height = m_cinfo->image_height,
+        .orientation = m_orientation,
+        .hdr = IsHdr()
+    };
+}
+
 std::unique_ptr<Bitmap> JpgLoader::Load()
 {
-    auto bmp = LoadNoColorspace();
+    auto bmp = LoadNoColorspace( true );
     if( !bmp ) return nullptr;
 
-    cmsHTRANSFORM transform = nullptr;
-    cmsHPROFILE profileIn = nullptr;
-    auto profileOut = cmsCreate_sRGBProfile();
-    if( m_iccData )
+    if( m_iccData || m_cmyk )
+    {
+        if( m_iccData ) mclog( LogLevel::Info, "ICC profile size: %u", m_iccSz );
+        const auto transform = SrgbTransform( m_iccData, m_iccSz, m_cmyk );
+        if( transform ) CmsTransform( m_td, transform.get(), bmp->Data(), bmp->Data(), bmp->Width() * bmp->Height() );
+    }
+
+    bmp->SetAlpha( 0xFF, m_td );
+    return bmp;
+}
+
+// The bands are given the final alpha as they are passed on, so the bitmap needs nothing more
+std::unique_ptr<Bitmap> JpgLoader::LoadStreaming( RowSink& sink )
+{
+    if( !HasStreaming() ) return Load();
+    return LoadNoColorspace( true, &sink );
+}
+
+// Raw data output skips the upsampling and color conversion. Rows come out a whole iMCU row at a time, padded to
+// whole blocks, and are cropped into the planes.
+std::unique_ptr<BitmapYuv> JpgLoader::LoadYuv()
+{
+    if( !HasYuv() ) return nullptr;
+
+    ZoneScoped;
+
+    JpgErrorMgr jerr;
+    m_cinfo->err = jpeg_std_error( &jerr.pub );
+    jerr.pub.error_exit = []( j_common_ptr cinfo ) { longjmp( ((JpgErrorMgr*)cinfo->err)->setjmp_buffer, 1 ); };
+    if( setjmp( jerr.setjmp_buffer ) ) return nullptr;
+
+    m_cinfo->raw_data_out = TRUE;
+    jpeg_start_decompress( m_cinfo );
+
+    const auto subsampling = m_cinfo->comp_info[0].v_samp_factor == 2 ? BitmapYuv::Subsampling::S420 : BitmapYuv::Subsampling::S422;
+    auto yuv = std::make_unique<BitmapYuv>( m_cinfo->image_width, m_cinfo->image_height, subsampling );
+    const uint32_t rows = m_cinfo->max_v_samp_factor * DCTSIZE;
+
+    uint8_t* planes[3] = { yuv->Y(), yuv->Cb(), yuv->Cr() };
+    const uint32_t widths[3] = { yuv->Width(), yuv->ChromaWidth(), yuv->ChromaWidth() };
+    const uint32_t heights[3] = { yuv->Height(), yuv->ChromaHeight(), yuv->ChromaHeight() };
+
+    uint32_t strides[3], compRows[3];
+    size_t bufsize = 0;
+    for( int c=0; c<3; c++ )
     {
-        mclog( LogLevel::Info, "ICC profile size: %u", m_iccSz );
-        profileIn = cmsOpenProfileFromMem( m_iccData, m_iccSz );
+        strides[c] = m_cinfo->comp_info[c].width_in_blocks * DCTSIZE;
+        compRows[c] = m_cinfo->comp_info[c].v_samp_factor * DCTSIZE;
+        bufsize += size_t( strides[c] ) * compRows[c];
     }
-    else if( m_cmyk )
+    std::vector<uint8_t> buf( bufsize );
+    JSAMPROW ptrs[3][2 * DCTSIZE];
+    JSAMPARRAY bands[3];
+    auto ptr = buf.data();
+    for( int c=0; c<3; c++ )
     {
-        Unembed( CmykIcm );
-        profileIn = cmsOpenProfileFromMem( CmykIcm->data(), CmykIcm->size() );
+        for( uint32_t i=0; i<compRows[c]; i++ )
+        {
+            ptrs[c][i] = ptr;
+            ptr += strides[c];
+        }
+        bands[c] = ptrs[c];
     }
-    if( profileIn ) transform = cmsCreateTransform( profileIn, m_cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8, profileOut, TYPE_RGBA_8, INTENT_PERCEPTUAL, 0 );
-    if( transform )
+
+    while( m_cinfo->output_scanline < m_cinfo->output_height )
     {
-        CmsTransform( m_td, transform, bmp->Data(), bmp->Data(), bmp->Width() * bmp->Height() );
-        cmsDeleteTransform( transform );
+        if( TaskDispatch::IsCancelled() || jpeg_read_raw_data( m_cinfo, bands, rows ) == 0 )
+        {
+            jpeg_abort_decompress( m_cinfo );
+            return nullptr;
+        }
+        const auto band = m_cinfo->output_scanline / rows - 1;
+        for( int c=0; c<3; c++ )
+        {
+            const auto y0 = band * compRows[c];
+            const auto n = std::min( compRows[c], heights[c] - y0 );
+            for( uint32_t i=0; i<n; i++ ) memcpy( planes[c] + size_t( y0 + i ) * widths[c], ptrs[c][i], widths[c] );
+        }
     }
-    if( profileIn ) cmsCloseProfile( profileIn );
-    cmsCloseProfile( profileOut );
 
-    bmp->SetAlpha( 0xFF );
-    return bmp;
+    jpeg_finish_decompress( m_cinfo );
+    return yuv;
+}
+
+std::unique_ptr<BitmapDct> JpgLoader::LoadDct()
+{
+    if( !HasDct() ) return nullptr;
+
+    ZoneScoped;
+
+    const auto subsampling = m_cinfo->comp_info[0].v_samp_factor == 2 ? BitmapYuv::Subsampling::S420 : BitmapYuv::Subsampling::S422;
+    auto dct = std::make_unique<BitmapDct>( m_cinfo->image_width, m_cinfo->image_height, subsampling );
+    if( LoadDctParallel( *dct ) ) return dct;
+    if( TaskDispatch::IsCancelled() ) return nullptr;
+
+    JpgErrorMgr jerr;
+    m_cinfo->err = jpeg_std_error( &jerr.pub );
+    jerr.pub.error_exit = []( j_common_ptr cinfo ) { longjmp( ((JpgErrorMgr*)cinfo->err)->setjmp_buffer, 1 ); };
+    if( setjmp( jerr.setjmp_buffer ) ) return nullptr;
+
+    auto coefs = jpeg_read_coefficients( m_cinfo );
+    if( !coefs || TaskDispatch::IsCancelled() || !CopyCoefficients( m_cinfo, coefs, *dct, 0 ) )
+    {
+        jpeg_abort_decompress( m_cinfo );
+        return nullptr;
+    }
+    CopyQuantTables( m_cinfo, *dct );
+
+    jpeg_finish_decompress( m_cinfo );
+    return dct;
+}
+
+// Same strips as LoadParallel(), but each one stops after entropy decoding
+bool JpgLoader::LoadDctParallel( BitmapDct& dct )
+{
+    if( !m_td || m_td->NumWorkers() < 2 ) return false;
+
+    ZoneScoped;
+
+    JpgStrips strips;
+    if( !SplitStrips( m_cinfo, (const uint8_t*)m_buf->data(), m_buf->size(), m_td->NumWorkers() * 2, strips ) ) return false;
+    const auto& splits = strips.splits;
+    const auto interval = m_cinfo->restart_interval;
+    mclog( LogLevel::Info, "JPEG: Entropy decoding %zu strips in parallel", splits.size() - 1 );
+
+    std::atomic<bool> failed = false;
+    m_td->ParallelFor( 0, splits.size() - 1, 1, [&]( size_t begin, size_t end ) {
+        for( size_t s=begin; s<end; s++ )
+        {
+            if( TaskDispatch::IsCancelled() ) return;
+
+            const auto mcuRow = uint32_t( splits[s] * interval / strips.mcusPerRow );
+            const auto y0 = mcuRow * strips.mcuHeight;
+            const auto y1 = std::min( uint32_t( splits[s+1] * interval / strips.mcusPerRow ) * strips.mcuHeight, m_cinfo->image_height );
+            const auto strip = BuildStrip( strips.layout, (const uint8_t*)m_buf->data(), splits[s], splits[s+1], y1 - y0 );
+
+            jpeg_decompress_struct cinfo;
+            JpgErrorMgr jerr;
+            cinfo.err = jpeg_std_error( &jerr.pub );
+            jerr.pub.error_exit = []( j_common_ptr cinfo ) { longjmp( ((JpgErrorMgr*)cinfo->err)->setjmp_buffer, 1 ); };
+            if( setjmp( jerr.setjmp_buffer ) )
+            {
+                jpeg_destroy_decompress( &cinfo );
+                failed.store( true, std::memory_order_relaxed );
+                return;
+            }
+
+            jpeg_create_decompress( &cinfo );
+            jpeg_mem_src( &cinfo, strip.data(), strip.size() );
+            ReadStripHeader( &cinfo, m_cinfo );
+            auto coefs = jpeg_read_coefficients( &cinfo );
+            if( !coefs || !CopyCoefficients( &cinfo, coefs, dct, mcuRow ) ) longjmp( jerr.setjmp_buffer, 1 );
+
+            // All strips carry the same tables
+            if( s == 0 ) CopyQuantTables( &cinfo, dct );
+            jpeg_finish_decompress( &cinfo );
+            jpeg_destroy_decompress( &cinfo );
+        }
+    } );
+
+    if( TaskDispatch::IsCancelled() ) return false;
+    if( failed.load( std::memory_order_relaxed ) )
+    {
+        mclog( LogLevel::Warning, "JPEG: Parallel entropy decode failed, falling back to serial decode" );
+        return false;
+    }
+    return true;
 }
 
 #pragma pack( push, 1 )
@@ -256,95 +931,62 @@ static Channel ReadIsoChannel( uint8_t*& ptr )
     };
 }
 
-static void ApplyGainMap( float* dst, const float* sdr, const float* gm, size_t sz, Channel* ch )
+template<typename V>
+SIMD_INLINE void ApplyGainMapLoop( float*& dst, const float*& sdr, const float*& gm, size_t& sz, const Channel* ch )
 {
-#if defined __SSE4_1__ && defined __FMA__
-    const float gainMapMin[4] = { ch[0].gainMapMin, ch[1].gainMapMin, ch[2].gainMapMin, 0 };
-    const float gainMapMax[4] = { ch[0].gainMapMax, ch[1].gainMapMax, ch[2].gainMapMax, 0 };
-    const float offsetSdr[4] = { ch[0].offsetSdr, ch[1].offsetSdr, ch[2].offsetSdr, 0 };
-    const float offsetHdr[4] = { ch[0].offsetHdr, ch[1].offsetHdr, ch[2].offsetHdr, 0 };
+    const auto vGainMapMin = V::SetPixel( ch[0].gainMapMin, ch[1].gainMapMin, ch[2].gainMapMin, 0 );
+    const auto vGainMapMax = V::SetPixel( ch[0].gainMapMax, ch[1].gainMapMax, ch[2].gainMapMax, 0 );
+    const auto vOffsetSdr = V::SetPixel( ch[0].offsetSdr, ch[1].offsetSdr, ch[2].offsetSdr, 0 );
+    const auto vOffsetHdr = V::SetPixel( ch[0].offsetHdr, ch[1].offsetHdr, ch[2].offsetHdr, 0 );
 
-    __m128 vGainMapMin = _mm_loadu_ps( gainMapMin );
-    __m128 vGainMapMax = _mm_loadu_ps( gainMapMax );
-    __m128 vOffsetSdr = _mm_loadu_ps( offsetSdr );
-    __m128 vOffsetHdr = _mm_loadu_ps( offsetHdr );
-
-#ifdef __AVX512F__
-    __m512 vGainMapMin512 = _mm512_broadcast_f32x4( vGainMapMin );
-    __m512 vGainMapMax512 = _mm512_broadcast_f32x4( vGainMapMax );
-    __m512 vOffsetSdr512 = _mm512_broadcast_f32x4( vOffsetSdr );
-    __m512 vOffsetHdr512 = _mm512_broadcast_f32x4( vOffsetHdr );
-
-    while( sz >= 4 )
+    constexpr size_t px = V::Lanes / 4;
+    while( sz >= px )
     {
-        __m512 vGm = _mm512_loadu_ps( gm );
-        __m512 vGm1 = _mm512_sub_ps( _mm512_set1_ps( 1.f ), vGm );
-        __m512 vGm2 = _mm512_mul_ps( vGm, vGainMapMax512 );
-        __m512 logBoost = _mm512_fmadd_ps( vGm1, vGainMapMin512, vGm2 );
-        __m512 logBoostExp = _mm512_exp_ps( logBoost );
+        const auto vGm = V::Load( gm );
+        const auto logBoost = MulAdd( V::Set( 1.f ) - vGm, vGainMapMin, vGm * vGainMapMax );
+        const auto vHdr = MulSub( V::Load( sdr ) + vOffsetSdr, Exp2( logBoost ), vOffsetHdr );
+        AlphaFrom( vHdr, V::Set( 1.f ) ).Store( dst );
+
+        dst += V::Lanes;
+        gm += V::Lanes;
+        sdr += V::Lanes;
+        sz -= px;
+    }
+}
 
-        __m512 vSdr = _mm512_loadu_ps( sdr );
-        __m512 vSdr1 = _mm512_add_ps( vSdr, vOffsetSdr512 );
-        __m512 vHdr = _mm512_fmsub_ps( vSdr1, logBoostExp, vOffsetHdr512 );
-        __m512 vHdr1 = _mm512_mask_blend_ps( 0x8888, vHdr, _mm512_set1_ps( 1.f ) );
+#if defined MCORE_SIMD_X86
+SIMD_SSE41 static void ApplyGainMapSse41( float* dst, const float* sdr, const float* gm, size_t sz, const Channel* ch )
+{
+    ApplyGainMapLoop<Simd::F128>( dst, sdr, gm, sz, ch );
+}
 
-        _mm512_storeu_ps( dst, vHdr1 );
+SIMD_AVX2 static void ApplyGainMapAvx2( float* dst, const float* sdr, const float* gm, size_t sz, const Channel* ch )
+{
+    ApplyGainMapLoop<Simd::F256>( dst, sdr, gm, sz, ch );
+    if( sz > 0 ) ApplyGainMapSse41( dst, sdr, gm, sz, ch );
+}
 
-        dst += 16;
-        gm += 16;
-        sdr += 16;
-        sz -= 4;
-    }
+SIMD_AVX512 static void ApplyGainMapAvx512( float* dst, const float* sdr, const float* gm, size_t sz, const Channel* ch )
+{
+    ApplyGainMapLoop<Simd::F512>( dst, sdr, gm, sz, ch );
+    if( sz > 0 ) ApplyGainMapAvx2( dst, sdr, gm, sz, ch );
+}
 #endif
 
-#ifdef __AVX2__
-    __m256 vGainMapMin256 = _mm256_set_m128( vGainMapMin, vGainMapMin );
-    __m256 vGainMapMax256 = _mm256_set_m128( vGainMapMax, vGainMapMax );
-    __m256 vOffsetSdr256 = _mm256_set_m128( vOffsetSdr, vOffsetSdr );
-    __m256 vOffsetHdr256 = _mm256_set_m128( vOffsetHdr, vOffsetHdr );
-
-    while( sz >= 2 )
+static void ApplyGainMap( float* dst, const float* sdr, const float* gm, size_t sz, const Channel* ch )
+{
+#if defined MCORE_SIMD_X86
+    switch( GetSimdLevel() )
     {
-        __m256 vGm = _mm256_loadu_ps( gm );
-        __m256 vGm1 = _mm256_sub_ps( _mm256_set1_ps( 1.f ), vGm );
-        __m256 vGm2 = _mm256_mul_ps( vGm, vGainMapMax256 );
-        __m256 logBoost = _mm256_fmadd_ps( vGm1, vGainMapMin256, vGm2 );
-        __m256 logBoostExp = _mm256_exp_ps( logBoost );
-
-        __m256 vSdr = _mm256_loadu_ps( sdr );
-        __m256 vSdr1 = _mm256_add_ps( vSdr, vOffsetSdr256 );
-        __m256 vHdr = _mm256_fmsub_ps( vSdr1, logBoostExp, vOffsetHdr256 );
-        __m256 vHdr1 = _mm256_blend_ps( vHdr, _mm256_set1_ps( 1.f ), 0x88 );
-
-        _mm256_storeu_ps( dst, vHdr1 );
-
-        gm += 8;
-        sdr += 8;
-        dst += 8;
-        sz -= 2;
+    case SimdLevel::Avx512: ApplyGainMapAvx512( dst, sdr, gm, sz, ch ); return;
+    case SimdLevel::Avx2: ApplyGainMapAvx2( dst, sdr, gm, sz, ch ); return;
+    case SimdLevel::Sse41: ApplyGainMapSse41( dst, sdr, gm, sz, ch ); return;
+    default: break;
     }
+#elif defined MCORE_SIMD_NEON
+    if( GetSimdLevel() == SimdLevel::Neon ) ApplyGainMapLoop<Simd::FNeon>( dst, sdr, gm, sz, ch );
 #endif
 
-    while( sz-- > 0 )
-    {
-        __m128 vGm = _mm_loadu_ps( gm );
-        __m128 vGm1 = _mm_sub_ps( _mm_set1_ps( 1.f ), vGm );
-        __m128 vGm2 = _mm_mul_ps( vGm, vGainMapMax );
-        __m128 logBoost = _mm_fmadd_ps( vGm1, vGainMapMin, vGm2 );
-        __m128 logBoostExp = _mm_exp_ps( logBoost );
-
-        __m128 vSdr = _mm_loadu_ps( sdr );
-        __m128 vSdr1 = _mm_add_ps( vSdr, vOffsetSdr );
-        __m128 vHdr = _mm_fmsub_ps( vSdr1, logBoostExp, vOffsetHdr );
-        __m128 vHdr1 = _mm_blend_ps( vHdr, _mm_set1_ps( 1.f ), 0x8 );
-
-        _mm_storeu_ps( dst, vHdr1 );
-
-        gm += 4;
-        sdr += 4;
-        dst += 4;
-    }
-#else
     while( sz-- > 0 )
     {
         const auto gmR = *gm++;
@@ -366,72 +1008,292 @@ static void ApplyGainMap( float* dst, const float* sdr, const float* gm, size_t
         *dst++ = b;
         *dst++ = 1.0f;
     }
-#endif
 }
 
-std::unique_ptr<BitmapHdr> JpgLoader::LoadHdr( Colorspace colorspace )
+// Bilinear sample of the gain map, with pixel centers aligned to the ones of the base image
+struct GainMapTap
 {
-    if( !IsHdr() ) return nullptr;
-
-    auto base = LoadNoColorspace();
-    if( !base ) return nullptr;
+    uint32_t i0, i1;
+    float w;
+};
 
-    auto baseFloat = std::make_unique<BitmapHdr>( base->Width(), base->Height(), colorspace, m_orientation );
+static GainMapTap GainMapSample( uint32_t x, uint32_t size, uint32_t gmSize )
+{
+    const auto pos = std::clamp( ( x + 0.5f ) * gmSize / size - 0.5f, 0.f, float( gmSize - 1 ) );
+    const auto i0 = uint32_t( pos );
+    return { i0, std::min( i0 + 1, gmSize - 1 ), pos - i0 };
+}
 
-    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-    cmsToneCurve* linear3[3] = { linear, linear, linear };
-    cmsHPROFILE profileIn;
-    auto profileOut = cmsCreateRGBProfile( &white709, colorspace == Colorspace::BT2020 ? &primaries2020 : &primaries709, linear3 );
-    if( m_iccData )
+// Converts rows of the base image to linear light and applies the gain map to them. The gain map is kept at its
+// own resolution and upsampled one row at a time.
+static void ApplyGainMapRows( TaskDispatch* td, cmsHTRANSFORM transform, const Bitmap& base, const BitmapHdr& gainMap, BitmapHdr& dst, const Channel* ch )
+{
+    const auto width = base.Width();
+    const auto height = base.Height();
+    const auto gmWidth = gainMap.Width();
+    const auto gmHeight = gainMap.Height();
+    const bool fullSize = gmWidth == width && gmHeight == height;
+
+    std::vector<GainMapTap> taps;
+    if( !fullSize )
     {
-        mclog( LogLevel::Info, "ICC profile size: %u", m_iccSz );
-        profileIn = cmsOpenProfileFromMem( m_iccData, m_iccSz );
+        taps.reserve( width );
+        for( uint32_t x=0; x<width; x++ ) taps.emplace_back( GainMapSample( x, width, gmWidth ) );
     }
-    else if( m_cmyk )
+
+    auto rows = [&]( size_t begin, size_t end ) {
+        std::vector<float> linear( width * 4 );
+        std::vector<float> gmRow, gain;
+        if( !fullSize )
+        {
+            gmRow.resize( gmWidth * 4 );
+            gain.resize( width * 4 );
+        }
+
+        for( size_t y=begin; y<end; y++ )
+        {
+            cmsDoTransform( transform, base.Data() + y * width * 4, linear.data(), width );
+
+            const float* gptr;
+            if( fullSize )
+            {
+                gptr = gainMap.Data() + y * width * 4;
+            }
+            else
+            {
+                const auto ty = GainMapSample( y, height, gmHeight );
+                const auto r0 = gainMap.Data() + size_t( ty.i0 ) * gmWidth * 4;
+                const auto r1 = gainMap.Data() + size_t( ty.i1 ) * gmWidth * 4;
+                for( size_t i=0; i<gmWidth * 4; i++ ) gmRow[i] = r0[i] + ( r1[i] - r0[i] ) * ty.w;
+
+                auto out = gain.data();
+                for( auto& t : taps )
+                {
+                    const auto p0 = gmRow.data() + t.i0 * 4;
+                    const auto p1 = gmRow.data() + t.i1 * 4;
+                    for( int c=0; c<4; c++ ) *out++ = p0[c] + ( p1[c] - p0[c] ) * t.w;
+                }
+                gptr = gain.data();
+            }
+
+            ApplyGainMap( dst.Data() + y * width * 4, linear.data(), gptr, width, ch );
+        }
+    };
+
+    if( td )
     {
-        Unembed( CmykIcm );
-        profileIn = cmsOpenProfileFromMem( CmykIcm->data(), CmykIcm->size() );
+        td->ParallelFor( 0, height, TaskDispatch::AdaptiveGrain, rows );
     }
     else
     {
-        profileIn = cmsCreate_sRGBProfile();
+        rows( 0, height );
     }
-    auto transform = cmsCreateTransform( profileIn, m_cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
-    if( transform )
+}
+
+// Returns the transform from the base image to linear light. Profiles which cannot be converted to float directly
+// are first converted to sRGB, in place. Returns nullptr on failure.
+static CmsCache::Transform LinearTransform( TaskDispatch* td, Bitmap& base, Colorspace colorspace, const uint8_t* icc, uint32_t iccSz, bool cmyk )
+{
+    const auto linearId = CmsCache::Id( colorspace == Colorspace::BT2020 ? "BT.2020 linear" : "BT.709 linear" );
+    auto openLinear = [colorspace] { return CreateLinearProfile( colorspace ); };
+
+    const CmsCache::Key key = {
+        .in = InputProfileId( icc, iccSz, cmyk ),
+        .out = linearId,
+        .inFormat = cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8,
+        .outFormat = TYPE_RGBA_FLT,
+        .intent = INTENT_PERCEPTUAL,
+        .flags = 0
+    };
+    auto transform = CmsCache::Get( key, [=] { return OpenInputProfile( icc, iccSz, cmyk ); }, openLinear );
+    if( transform ) return transform;
+
+    const auto toSrgb = SrgbTransform( icc, iccSz, cmyk );
+    if( !toSrgb )
     {
-        CmsTransform( m_td, transform, base->Data(), baseFloat->Data(), base->Width() * base->Height() );
+        mclog( LogLevel::Error, "JPEG: Failed to create transform to sRGB" );
+        return nullptr;
     }
-    else
+    CmsTransform( td, toSrgb.get(), base.Data(), base.Data(), base.Width() * base.Height() );
+
+    const CmsCache::Key srgbKey = {
+        .in = CmsCache::Id( "sRGB" ),
+        .out = linearId,
+        .inFormat = TYPE_RGBA_8,
+        .outFormat = TYPE_RGBA_FLT,
+        .intent = INTENT_PERCEPTUAL,
+        .flags = 0
+    };
+    transform = CmsCache::Get( srgbKey, [] { return cmsCreate_sRGBProfile(); }, openLinear );
+    CheckPanic( transform, "Failed to create sRGB to HDR transform" );
+    return transform;
+}
+
+namespace
+{
+// Segments in front of the image data. These are read straight from the file data, as the markers saved by
+// libjpeg are gone once the image is decoded. Returns at the first segment the callback accepts.
+template<typename F>
+void ForEachSegment( const uint8_t* data, size_t size, F&& f )
+{
+    size_t pos = 2;     // skip Start-Of-Image
+    while( pos + 4 <= size && data[pos] == 0xFF )
     {
-        auto sz = base->Width() * base->Height();
-        cmsHPROFILE profileSrgb = cmsCreate_sRGBProfile();
-        transform = cmsCreateTransform( profileIn, m_cmyk ? TYPE_CMYK_8_REV : TYPE_RGBA_8, profileSrgb, TYPE_RGBA_8, INTENT_PERCEPTUAL, 0 );
-        if( !transform )
+        const auto marker = data[pos+1];
+        if( marker == 0xFF )
         {
-            cmsCloseProfile( profileIn );
-            cmsCloseProfile( profileOut );
-            cmsFreeToneCurve( linear );
-            mclog( LogLevel::Error, "JPEG: Failed to create transform to sRGB" );
-            return nullptr;
+            pos++;      // fill byte
+            continue;
         }
-        CmsTransform( m_td, transform, base->Data(), base->Data(), sz );
-        cmsDeleteTransform( transform );
-        transform = cmsCreateTransform( profileSrgb, TYPE_RGBA_8, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
-        CheckPanic( transform, "Failed to create sRGB to HDR transform" );
-        CmsTransform( m_td, transform, base->Data(), baseFloat->Data(), sz );
-        cmsCloseProfile( profileSrgb );
+        if( marker == 0xDA || marker == 0xD9 ) return;      // Start-Of-Scan, End-Of-Image
+
+        const size_t len = data[pos+2] << 8 | data[pos+3];
+        if( len < 2 || len > size - pos - 2 ) return;
+        if( f( marker, data + pos + 4, len - 2 ) ) return;
+        pos += len + 2;
     }
-    if( transform ) cmsDeleteTransform( transform );
-    cmsCloseProfile( profileIn );
-    cmsCloseProfile( profileOut );
-    cmsFreeToneCurve( linear );
+}
 
-    base.reset();
+std::string_view FindXmp( const uint8_t* data, size_t size )
+{
+    static constexpr const char XmpSig[] = "http://ns.adobe.com/xap/1.0/";
+    static constexpr size_t XmpSigLen = sizeof( XmpSig );
+
+    std::string_view xmp;
+    ForEachSegment( data, size, [&xmp]( uint8_t marker, const uint8_t* ptr, size_t len ) {
+        if( marker != 0xE1 || len <= XmpSigLen || memcmp( ptr, XmpSig, XmpSigLen ) != 0 ) return false;
+        xmp = std::string_view( (const char*)ptr + XmpSigLen, len - XmpSigLen );
+        return true;
+    } );
+    return xmp;
+}
 
-    if( m_gainMapOffset < 0 )
+// Gain map metadata is written as attributes, so the few values needed are looked up in the packet text, without
+// building a document. Searching starts at pos, which is left past the attribute found.
+bool XmpNextAttribute( std::string_view xmp, std::string_view name, size_t& pos, std::string_view& value )
+{
+    auto isSpace = []( char c ) { return c == ' ' || c == '\t' || c == '\n' || c == '\r'; };
+    while( ( pos = xmp.find( name, pos ) ) != std::string_view::npos )
     {
-        auto sz = baseFloat->Width() * baseFloat->Height();
-        auto ptr = baseFloat->Data();
+        const auto start = pos;
+        pos += name.size();
+        if( start == 0 || !isSpace( xmp[start-1] ) ) continue;
+
+        auto p = pos;
+        while( p < xmp.size() && isSpace( xmp[p] ) ) p++;
+        if( p == xmp.size() || xmp[p] != '=' ) continue;
+        p++;
+        while( p < xmp.size() && isSpace( xmp[p] ) ) p++;
+        if( p == xmp.size() || ( xmp[p] != '"' && xmp[p] != '\'' ) ) continue;
+
+        const auto end = xmp.find( xmp[p], p + 1 );
+        if( end == std::string_view::npos ) return false;
+        value = xmp.substr( p + 1, end - p - 1 );
+        pos = end + 1;
+        return true;
+    }
+    return false;
+}
+
+bool XmpAttribute( std::string_view xmp, std::string_view name, std::string_view& value )
+{
+    size_t pos = 0;
+    return XmpNextAttribute( xmp, name, pos, value );
+}
+
+float XmpFloat( std::string_view xmp, std::string_view name, float fallback )
+{
+    std::string_view value;
+    if( !XmpAttribute( xmp, name, value ) ) return fallback;
+    return strtof( std::string( value ).c_str(), nullptr );
+}
+
+// Ultra HDR lists the gain map as an item of the container directory, in the XMP of the primary image
+bool HasGainMapItem( std::string_view xmp )
+{
+    std::string_view value;
+    if( !XmpAttribute( xmp, "xmlns:hdrgm", value ) || value != "http://ns.adobe.com/hdr-gain-map/1.0/" ) return false;
+    if( !XmpAttribute( xmp, "hdrgm:Version", value ) || value != "1.0" ) return false;
+    if( !XmpAttribute( xmp, "xmlns:Container", value ) || value != "http://ns.google.com/photos/1.0/container/" ) return false;
+
+    size_t pos = 0;
+    while( XmpNextAttribute( xmp, "Item:Semantic", pos, value ) )
+    {
+        if( value == "GainMap" ) return true;
+    }
+    return false;
+}
+
+// Offset of the first undefined or gain map image listed in the MP index IFD, relative to the MPF endian marker,
+// which starts the data
+int64_t MpfGainMapOffset( const uint8_t* ptr, size_t size )
+{
+    if( size < 8 ) return -1;
+    const bool bigEndian = ptr[0] == 0x4D;
+    auto read16 = [ptr, bigEndian]( size_t pos ) {
+        uint16_t v;
+        memcpy( &v, ptr + pos, 2 );
+        return bigEndian ? ntohs( v ) : v;
+    };
+    auto read32 = [ptr, bigEndian]( size_t pos ) {
+        uint32_t v;
+        memcpy( &v, ptr + pos, 4 );
+        return bigEndian ? ntohl( v ) : v;
+    };
+
+    size_t offset = read32( 4 );
+    if( offset + 2 > size ) return -1;
+    auto count = read16( offset );
+    offset += 2;
+
+    // IFD entries are a tag, type, count and value of 12 bytes in total. MP entries are 16 bytes long, with the
+    // image offset after the attributes and size.
+    uint32_t numImages = 0;
+    while( count-- > 0 && offset + 12 <= size )
+    {
+        const auto tag = read16( offset );
+        const auto value = read32( offset + 8 );
+        offset += 12;
+
+        if( tag == 0xB001 )
+        {
+            numImages = value;
+        }
+        else if( tag == 0xB002 )
+        {
+            for( uint32_t i=0; i<numImages; i++ )
+            {
+                const auto entry = size_t( value ) + i * 16;
+                if( entry + 16 > size ) return -1;
+                const auto attr = read32( entry );
+                if( attr == 0 || ( attr & 0xFFFFFF ) == 0x050000 ) return read32( entry + 8 );
+            }
+            return -1;
+        }
+    }
+    return -1;
+}
+}
+
+std::unique_ptr<BitmapHdr> JpgLoader::LoadHdr( Colorspace colorspace )
+{
+    if( !IsHdr() ) return nullptr;
+
+    auto base = LoadNoColorspace();
+    if( !base ) return nullptr;
+    if( m_iccData ) mclog( LogLevel::Info, "ICC profile size: %u", m_iccSz );
+
+    const auto gainMapOffset = GainMapOffset();
+    if( gainMapOffset < 0 )
+    {
+        const auto transform = LinearTransform( m_td, *base, colorspace, m_iccData, m_iccSz, m_cmyk );
+        if( !transform ) return nullptr;
+
+        auto bmp = std::make_unique<BitmapHdr>( base->Width(), base->Height(), colorspace, m_orientation );
+        auto sz = bmp->Width() * bmp->Height();
+        CmsTransform( m_td, transform.get(), base->Data(), bmp->Data(), sz );
+
+        auto ptr = bmp->Data();
         while( sz-- > 0 )
         {
             // ITU-R BT.2408 reference white is 203 nits
@@ -440,10 +1302,14 @@ std::unique_ptr<BitmapHdr> JpgLoader::LoadHdr( Colorspace colorspace )
             *ptr++ *= 2.03f;
             *ptr++ = 1.f;
         }
-        return baseFloat;
+        return bmp;
     }
 
-    fseek( *m_file, m_gainMapOffset, SEEK_SET );
+    if( size_t( gainMapOffset ) >= m_buf->size() )
+    {
+        mclog( LogLevel::Error, "JPEG: Gain map offset is past the end of the file" );
+        return nullptr;
+    }
 
     uint8_t* gainMap = nullptr;
 
@@ -459,8 +1325,7 @@ std::unique_ptr<BitmapHdr> JpgLoader::LoadHdr( Colorspace colorspace )
     }
 
     jpeg_create_decompress( &gcinfo );
-    jpeg_stdio_src( &gcinfo, *m_file );
-    jpeg_save_markers( &gcinfo, JPEG_APP0 + 1, 0xFFFF );
+    jpeg_mem_src( &gcinfo, (const unsigned char*)m_buf->data() + gainMapOffset, m_buf->size() - gainMapOffset );
     jpeg_save_markers( &gcinfo, JPEG_APP0 + 2, 0xFFFF );
     jpeg_read_header( &gcinfo, TRUE );
 
@@ -501,41 +1366,25 @@ std::unique_ptr<BitmapHdr> JpgLoader::LoadHdr( Colorspace colorspace )
     }
     else
     {
-        auto doc = LoadXmp( &gcinfo );
-        if( !doc )
+        const auto xmp = FindXmp( (const uint8_t*)m_buf->data() + gainMapOffset, m_buf->size() - gainMapOffset );
+        if( xmp.empty() )
         {
             mclog( LogLevel::Warning, "JPEG: No XMP metadata found for gain map" );
             jpeg_destroy_decompress( &gcinfo );
             return nullptr;
         }
 
-        auto root = doc->child( "x:xmpmeta" ).child( "rdf:RDF" ).child( "rdf:Description" );
-        if( !root )
-        {
-            mclog( LogLevel::Warning, "JPEG: No gain map metadata found in XMP" );
-            jpeg_destroy_decompress( &gcinfo );
-            return nullptr;
-        }
-
-        const auto attrGamma = root.attribute( "hdrgm:Gamma" );
-        const auto attrHdrCapMin = root.attribute( "hdrgm:HDRCapacityMin" );
-        const auto attrHdrCapMax = root.attribute( "hdrgm:HDRCapacityMax" );
-        const auto attrGainMapMin = root.attribute( "hdrgm:GainMapMin" );
-        const auto attrGainMapMax = root.attribute( "hdrgm:GainMapMax" );
-        const auto attrOffsetSdr = root.attribute( "hdrgm:OffsetSDR" );
-        const auto attrOffsetHdr = root.attribute( "hdrgm:OffsetHDR" );
-
         ch[0] = {
-            .gamma = attrGamma ? attrGamma.as_float() : 1.0f,
-            .gainMapMin = attrGainMapMin ? attrGainMapMin.as_float() : 0.0f,
-            .gainMapMax = attrGainMapMax ? attrGainMapMax.as_float() : 1.0f,  // required value
-            .offsetSdr = attrOffsetSdr ? attrOffsetSdr.as_float() : (1.f/64),
-            .offsetHdr = attrOffsetHdr ? attrOffsetHdr.as_float() : (1.f/64)
+            .gamma = XmpFloat( xmp, "hdrgm:Gamma", 1.0f ),
+            .gainMapMin = XmpFloat( xmp, "hdrgm:GainMapMin", 0.0f ),
+            .gainMapMax = XmpFloat( xmp, "hdrgm:GainMapMax", 1.0f ),    // required value
+            .offsetSdr = XmpFloat( xmp, "hdrgm:OffsetSDR", 1.f/64 ),
+            .offsetHdr = XmpFloat( xmp, "hdrgm:OffsetHDR", 1.f/64 )
         };
         ch[2] = ch[1] = ch[0];
 
-        hdrCapMin = attrHdrCapMin ? attrHdrCapMin.as_float() : 0.0f;
-        hdrCapMax = attrHdrCapMax ? attrHdrCapMax.as_float() : 1.0f;     // required value
+        hdrCapMin = XmpFloat( xmp, "hdrgm:HDRCapacityMin", 0.0f );
+        hdrCapMax = XmpFloat( xmp, "hdrgm:HDRCapacityMax", 1.0f );        // required value
 
         loaded = true;
     }
@@ -553,6 +1402,12 @@ std::unique_ptr<BitmapHdr> JpgLoader::LoadHdr( Colorspace colorspace )
     auto ptr = gainMap;
     while( gcinfo.output_scanline < gcinfo.output_height )
     {
+        if( TaskDispatch::IsCancelled() )
+        {
+            jpeg_destroy_decompress( &gcinfo );
+            delete[] gainMap;
+            return nullptr;
+        }
         jpeg_read_scanlines( &gcinfo, &ptr, 1 );
         ptr += gcinfo.output_width * gmChannels;
     }
@@ -621,52 +1476,22 @@ std::unique_ptr<BitmapHdr> JpgLoader::LoadHdr( Colorspace colorspace )
     }
     delete[] gainMap;
 
-    if( gmFloat->Width() != baseFloat->Width() || gmFloat->Height() != baseFloat->Height() )
-    {
-        gmFloat->Resize( baseFloat->Width(), baseFloat->Height(), m_td );
-    }
-
-    auto bmp = std::make_unique<BitmapHdr>( baseFloat->Width(), baseFloat->Height(), colorspace, m_orientation );
-    sz = baseFloat->Width() * baseFloat->Height();
-
-    dst = bmp->Data();
-    auto sdr = baseFloat->Data();
-    auto gm = gmFloat->Data();
+    const auto transform = LinearTransform( m_td, *base, colorspace, m_iccData, m_iccSz, m_cmyk );
+    if( !transform ) return nullptr;
 
-    ApplyGainMap( dst, sdr, gm, sz, ch );
+    auto bmp = std::make_unique<BitmapHdr>( base->Width(), base->Height(), colorspace, m_orientation );
+    ApplyGainMapRows( m_td, transform.get(), *base, *gmFloat, *bmp, ch );
 
+    if( TaskDispatch::IsCancelled() ) return nullptr;
     return bmp;
 }
 
-struct Ifd
-{
-    uint16_t tag;
-    uint16_t type;
-    uint32_t count;
-    uint32_t value_offset;
-};
-
-struct MpEntry
-{
-    uint32_t attr;
-    uint32_t size;
-    uint32_t offset;
-    uint16_t dep1, dep2;
-};
-
-struct JpgMarker
-{
-    uint16_t marker;
-    uint16_t size;
-    uint32_t data;
-};
-
 bool JpgLoader::Open()
 {
     CheckPanic( m_valid, "Invalid JPEG file" );
     CheckPanic( !m_cinfo, "Already opened" );
 
-    fseek( *m_file, 0, SEEK_SET );
+    if( !m_buf ) m_buf = std::make_shared<FileBuffer>( m_file );
     m_orientation = LoadOrientation();
 
     m_cinfo = new jpeg_decompress_struct();
@@ -677,167 +1502,65 @@ bool JpgLoader::Open()
     if( setjmp( jerr.setjmp_buffer ) ) return false;
 
     jpeg_create_decompress( m_cinfo );
-    jpeg_stdio_src( m_cinfo, *m_file );
-    jpeg_save_markers( m_cinfo, JPEG_APP0 + 1, 0xFFFF );
+    jpeg_mem_src( m_cinfo, (const unsigned char*)m_buf->data(), m_buf->size() );
     jpeg_save_markers( m_cinfo, JPEG_APP0 + 2, 0xFFFF );
     jpeg_read_header( m_cinfo, TRUE );
 
+    // The ICC profile is needed by the SDR path as well. Gain maps are only looked for when asked about.
     jpeg_read_icc_profile( m_cinfo, &m_iccData, &m_iccSz );
     m_cmyk = m_cinfo->jpeg_color_space == JCS_CMYK || m_cinfo->jpeg_color_space == JCS_YCCK;
     m_grayScale = m_cinfo->jpeg_color_space == JCS_GRAYSCALE;
 
+    m_gainMapChecked = false;
     m_gainMapOffset = -1;
     m_isIso = false;
 
-    bool validGainMap = false;
-    auto marker = m_cinfo->marker_list;
-    while( marker )
-    {
-        if( marker->marker == JPEG_APP0 + 2 && marker->data_length > 28 &&
-            memcmp( marker->data, "urn:iso:std:iso:ts:21496:-1\0", 28 ) == 0 )
-        {
-            uint16_t version;
-            memcpy( &version, marker->data + 28, 2 );
-            version = ntohs( version );
-            if( version == 0 )
-            {
-                validGainMap = true;
-                m_isIso = true;
-            }
-            break;
-        }
-        marker = marker->next;
-    }
-    if( !m_isIso )
-    {
-        auto doc = LoadXmp( m_cinfo );
-        if( doc )
-        {
-            if( auto root = doc->child( "x:xmpmeta" ).child( "rdf:RDF" ).child( "rdf:Description" ); root )
-            {
-                const auto hdrgmns = root.attribute( "xmlns:hdrgm" );
-                const auto hdrgm = root.attribute( "hdrgm:Version" );
-                const auto containerns = root.attribute( "xmlns:Container" );
-                if( hdrgmns && strcmp( hdrgmns.as_string(), "http://ns.adobe.com/hdr-gain-map/1.0/" ) == 0 &&
-                    containerns && strcmp( containerns.as_string(), "http://ns.google.com/photos/1.0/container/" ) == 0 &&
-                    hdrgm && strcmp( hdrgm.as_string(), "1.0" ) == 0 )
-                {
-                    const auto container = root.child( "Container:Directory" ).child( "rdf:Seq" ).children( "rdf:li" );
-                    for( auto li : container )
-                    {
-                        if( auto item = li.child( "Container:Item" ); item )
-                        {
-                            if( auto semantic = item.attribute( "Item:Semantic" ); semantic )
-                            {
-                                if( strcmp( semantic.as_string(), "GainMap" ) == 0 )
-                                {
-                                    validGainMap = true;
-                                    break;
-                                }
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
+    return true;
+}
 
-    if( validGainMap )
-    {
-        auto marker = m_cinfo->marker_list;
-        while( marker )
-        {
-            if( marker->marker == JPEG_APP0 + 2 && marker->data_length > 4 && memcmp( marker->data, "MPF\0", 4 ) == 0 )
-            {
-                auto ptr = marker->data + 4;
-                bool bigEndian = ptr[0] == 0x4D;
+int JpgLoader::GainMapOffset()
+{
+    if( m_gainMapChecked ) return m_gainMapOffset;
+    m_gainMapChecked = true;
 
-                uint32_t offset;
-                memcpy( &offset, ptr + 4, 4 );
-                if( bigEndian ) offset = ntohl( offset );
+    ZoneScoped;
 
-                uint16_t count;
-                memcpy( &count, ptr + offset, 2 );
-                if( bigEndian ) count = ntohs( count );
-                offset += 2;
+    const auto data = (const uint8_t*)m_buf->data();
+    const auto size = m_buf->size();
 
-                int numImages = 0;
-                while( count-- > 0 )
-                {
-                    Ifd ifd;
-                    memcpy( &ifd, ptr + offset, sizeof( Ifd ) );
-                    offset += sizeof( Ifd );
-                    if( bigEndian )
-                    {
-                        ifd.tag = ntohs( ifd.tag );
-                        ifd.value_offset = ntohl( ifd.value_offset );
-                    }
-
-                    if( ifd.tag == 0xB001 )
-                    {
-                        numImages = ifd.value_offset;
-                    }
-                    else if( ifd.tag == 0xB002 )
-                    {
-                        auto mpe = ptr + ifd.value_offset;
-                        for( int i=0; i<numImages; i++ )
-                        {
-                            MpEntry entry;
-                            memcpy( &entry, mpe, sizeof( MpEntry ) );
-                            mpe += sizeof( MpEntry );
-                            if( bigEndian ) entry.attr = ntohl( entry.attr );
-
-                            // Undefined or GainMap
-                            if( entry.attr == 0 || ( entry.attr & 0xFFFFFF ) == 0x050000 )
-                            {
-                                m_gainMapOffset = bigEndian ? ntohl( entry.offset ) : entry.offset;
-                                break;
-                            }
-                        }
-                        break;
-                    }
-                }
-                break;
-            }
-            marker = marker->next;
+    bool iso = false;
+    const uint8_t* mpf = nullptr;
+    size_t mpfSize = 0;
+    ForEachSegment( data, size, [&]( uint8_t marker, const uint8_t* ptr, size_t len ) {
+        if( marker != 0xE2 ) return false;
+        if( !iso && len > 30 && memcmp( ptr, "urn:iso:std:iso:ts:21496:-1\0", 28 ) == 0 )
+        {
+            iso = true;
+            m_isIso = ( ptr[28] << 8 | ptr[29] ) == 0;
         }
-    }
-
-    // Gain map offset is relative to MFD Endian marker, the location of which is not provided by the library.
-    // Do the incredibly stupid thing and search for it in raw file data.
-    if( m_gainMapOffset >= 0 )
-    {
-        const auto filePos = ftell( *m_file );
-        fseek( *m_file, 2, SEEK_SET );  // skip Start-Of-Image
-        for(;;)
+        else if( !mpf && len > 4 && memcmp( ptr, "MPF\0", 4 ) == 0 )
         {
-            JpgMarker marker;
-            fread( &marker, sizeof( JpgMarker ), 1, *m_file );
-            marker.size = ntohs( marker.size );
-
-            if( marker.marker == 0xE2FF && marker.size > 6 && memcmp( &marker.data, "MPF\0", 4 ) == 0 )
-            {
-                m_gainMapOffset += ftell( *m_file );
-                mclog( LogLevel::Info, "Gain map offset: %d", m_gainMapOffset );
-                break;
-            }
-            else
-            {
-                fseek( *m_file, marker.size - 6, SEEK_CUR );
-            }
+            mpf = ptr + 4;
+            mpfSize = len - 4;
         }
-        fseek( *m_file, filePos, SEEK_SET );
-    }
+        return false;
+    } );
 
-    return true;
+    if( !mpf || ( !m_isIso && !HasGainMapItem( FindXmp( data, size ) ) ) ) return -1;
+
+    const auto offset = MpfGainMapOffset( mpf, mpfSize );
+    if( offset < 0 || offset >= int64_t( size - ( mpf - data ) ) ) return -1;
+
+    m_gainMapOffset = int( offset + ( mpf - data ) );
+    mclog( LogLevel::Info, "Gain map offset: %d", m_gainMapOffset );
+    return m_gainMapOffset;
 }
 
 int JpgLoader::LoadOrientation()
 {
     int orientation = 0;
 
-    FileBuffer buf( m_file );
-    auto exif = exif_data_new_from_data( (const unsigned char*)buf.data(), buf.size() );
+    auto exif = exif_data_new_from_data( (const unsigned char*)m_buf->data(), m_buf->size() );
 
     if( exif )
     {
@@ -852,26 +1575,3 @@ int JpgLoader::LoadOrientation()
 
     return orientation;
 }
-
-std::unique_ptr<pugi::xml_document> JpgLoader::LoadXmp( jpeg_decompress_struct* cinfo )
-{
-    constexpr const char XmpSig[] = "http://ns.adobe.com/xap/1.0/";
-    constexpr size_t XmpSigLen = sizeof( XmpSig );
-
-    auto marker = cinfo->marker_list;
-    while( marker )
-    {
-        if( marker->marker == JPEG_APP0 + 1 )
-        {
-            if( marker->data_length > XmpSigLen && memcmp( marker->data, XmpSig, XmpSigLen ) == 0 )
-            {
-                auto doc = std::make_unique<pugi::xml_document>();
-                if( doc->load_buffer( marker->data + XmpSigLen, marker->data_length - XmpSigLen ) ) return doc;
-                break;
-            }
-        }
-        marker = marker->next;
-    }
-
-    return nullptr;
-}
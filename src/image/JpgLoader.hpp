@@ -1,13 +1,13 @@
 #pragma once
 
 #include <memory>
-#include <pugixml.hpp>
 #include <stdint.h>
 
 #include "ImageLoader.hpp"
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class DataBuffer;
 class FileWrapper;
 class TaskDispatch;
 struct jpeg_decompress_struct;
@@ -16,6 +16,7 @@ class JpgLoader : public ImageLoader
 {
 public:
     explicit JpgLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td );
+    explicit JpgLoader( std::shared_ptr<DataBuffer> buf, TaskDispatch* td );
     ~JpgLoader() override;
     NoCopy( JpgLoader );
 
@@ -23,19 +24,36 @@ public:
 
     [[nodiscard]] bool IsValid() const override;
     [[nodiscard]] bool IsHdr() override;
+    [[nodiscard]] bool HasFastPreview() override;
+    [[nodiscard]] bool HasYuv() override;
+    [[nodiscard]] bool HasDct() override;
+    [[nodiscard]] bool HasStreaming() override;
+    [[nodiscard]] ImageInfo Probe() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadStreaming( RowSink& sink ) override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
+    [[nodiscard]] std::unique_ptr<BitmapYuv> LoadYuv() override;
+    [[nodiscard]] std::unique_ptr<BitmapDct> LoadDct() override;
 
 private:
     [[nodiscard]] bool Open();
 
     int LoadOrientation();
-    std::unique_ptr<pugi::xml_document> LoadXmp( jpeg_decompress_struct* cinfo );
-    [[nodiscard]] std::unique_ptr<Bitmap> LoadNoColorspace();
+    // Found in the metadata on first use, negative if there is no gain map
+    [[nodiscard]] int GainMapOffset();
+    // With rotate set, orientations 5 to 8 are applied while decoding. The bitmap is left with the flip that remains.
+    // Rows are given to the sink, if there is one, as they are decoded.
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadNoColorspace( bool rotate = false, RowSink* sink = nullptr );
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadParallel( bool direct, bool rotate, RowSink* sink );
+    [[nodiscard]] bool LoadDctParallel( BitmapDct& dct );
+    [[nodiscard]] uint32_t DctScale() const;
+    // Full size 4:2:0 or 4:2:2 YCbCr which needs no processing after decoding
+    [[nodiscard]] bool IsPlainYcbcr();
 
     bool m_valid;
     std::shared_ptr<FileWrapper> m_file;
+    std::shared_ptr<DataBuffer> m_buf;
 
     TaskDispatch* m_td;
 
@@ -45,6 +63,7 @@ private:
     bool m_cmyk;
     bool m_grayScale;
     int m_orientation;
+    bool m_gainMapChecked;
     int m_gainMapOffset;
     bool m_isIso;
 };
@@ -1,15 +1,20 @@
+#include <algorithm>
+#include <atomic>
 #include <jxl/cms_interface.h>
 #include <jxl/color_encoding.h>
 #include <jxl/decode.h>
+#include <jxl/parallel_runner.h>
 #include <jxl/resizable_parallel_runner.h>
 #include <lcms2.h>
 
 #include "JxlLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/CmsCache.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
+#include "util/TaskDispatch.hpp"
 
 namespace
 {
@@ -50,9 +55,17 @@ void* CmsInit( void* data, size_t num_threads, size_t pixels_per_thread, const J
         cms->dstBuf[i] = new float[pixels_per_thread * 3];
     }
 
-    cms->profileIn = cmsOpenProfileFromMem( input_profile->icc.data, input_profile->icc.size );
-    cms->profileOut = cmsOpenProfileFromMem( output_profile->icc.data, output_profile->icc.size );
-    cms->transform = cmsCreateTransform( cms->profileIn, TYPE_RGB_FLT, cms->profileOut, TYPE_RGB_FLT, INTENT_PERCEPTUAL, 0 );
+    const CmsCache::Key key = {
+        .in = CmsCache::Id( input_profile->icc.data, input_profile->icc.size ),
+        .out = CmsCache::Id( output_profile->icc.data, output_profile->icc.size ),
+        .inFormat = TYPE_RGB_FLT,
+        .outFormat = TYPE_RGB_FLT,
+        .intent = INTENT_PERCEPTUAL,
+        .flags = 0
+    };
+    cms->transform = CmsCache::Get( key,
+        [input_profile] { return cmsOpenProfileFromMem( input_profile->icc.data, input_profile->icc.size ); },
+        [output_profile] { return cmsOpenProfileFromMem( output_profile->icc.data, output_profile->icc.size ); } );
 
     return cms;
 }
@@ -72,7 +85,7 @@ float* CmsGetDstBuffer( void* data, size_t thread )
 JXL_BOOL CmsRun( void* data, size_t thread, const float* input, float* output, size_t num_pixels )
 {
     auto cms = (JxlLoader::CmsData*)data;
-    cmsDoTransform( cms->transform, input, output, num_pixels );
+    cmsDoTransform( cms->transform.get(), input, output, num_pixels );
     return true;
 }
 
@@ -80,17 +93,50 @@ void CmsDestroy( void* data )
 {
     auto cms = (JxlLoader::CmsData*)data;
 
-    cmsDeleteTransform( cms->transform );
-    cmsCloseProfile( cms->profileOut );
-    cmsCloseProfile( cms->profileIn );
+    cms->transform.reset();
 
     for( auto& buf : cms->srcBuf ) delete[] buf;
     for( auto& buf : cms->dstBuf ) delete[] buf;
 }
+
+// Runs libjxl work on the shared TaskDispatch. One job per thread id pulls values from a common counter, so
+// that the per-thread state libjxl (and the CMS buffers) allocate in init stays private to one thread. A cancelled
+// load stops pulling values and fails the run, which makes libjxl abort the decode.
+JxlParallelRetCode TaskDispatchRunner( void* runner_opaque, void* jpegxl_opaque, JxlParallelRunInit init, JxlParallelRunFunction func, uint32_t start_range, uint32_t end_range )
+{
+    auto td = (TaskDispatch*)runner_opaque;
+    if( TaskDispatch::IsCancelled() ) return -1;
+
+    const auto range = end_range - start_range;
+    const auto threads = std::min<size_t>( td->NumWorkers() + 1, range );
+    if( threads == 0 ) return init( jpegxl_opaque, 1 );
+    if( init( jpegxl_opaque, threads ) != 0 ) return -1;
+
+    std::atomic<uint32_t> next = start_range;
+    auto run = [&next, end_range, jpegxl_opaque, func]( size_t thread ) {
+        for(;;)
+        {
+            const auto value = next.fetch_add( 1, std::memory_order_relaxed );
+            if( value >= end_range || TaskDispatch::IsCancelled() ) break;
+            func( jpegxl_opaque, value, thread );
+        }
+    };
+
+    TaskGroup group;
+    for( size_t i=1; i<threads; i++ )
+    {
+        td->Queue( group, [&run, i] { run( i ); } );
+    }
+    run( 0 );
+    group.Wait();
+
+    return TaskDispatch::IsCancelled() ? -1 : 0;
+}
 }
 
-JxlLoader::JxlLoader( std::shared_ptr<FileWrapper> file )
+JxlLoader::JxlLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td )
     : m_file( std::move( file ) )
+    , m_td( td )
     , m_runner( nullptr )
     , m_dec( nullptr )
 {
@@ -130,6 +176,28 @@ bool JxlLoader::PreferHdr()
     return true;
 }
 
+bool JxlLoader::HasFastPreview()
+{
+    if( !m_dec && !Open() ) return false;
+
+    // Only VarDCT images are certain to have the 1:8 DC pass. Those are nearly always stored in XYB, while
+    // lossless modular images keep the original profile.
+    if( m_info.have_animation || m_info.uses_original_profile ) return false;
+    return PassScale() >= 8;
+}
+
+ImageInfo JxlLoader::Probe()
+{
+    if( !m_dec && !Open() ) return {};
+    return {
+        .width = m_info.xsize,
+        .height = m_info.ysize,
+        .orientation = m_info.orientation,
+        .hdr = m_info.bits_per_sample > 8,
+        .animated = m_info.have_animation != 0
+    };
+}
+
 std::unique_ptr<Bitmap> JxlLoader::Load()
 {
     if( !m_dec && !Open() ) return nullptr;
@@ -141,6 +209,7 @@ std::unique_ptr<Bitmap> JxlLoader::Load()
 
     for(;;)
     {
+        if( TaskDispatch::IsCancelled() ) return nullptr;
         const auto res = JxlDecoderProcessInput( m_dec );
         if( res == JXL_DEC_ERROR || res == JXL_DEC_NEED_MORE_INPUT || res == JXL_DEC_BASIC_INFO ) return nullptr;
         if( res == JXL_DEC_SUCCESS || res == JXL_DEC_FULL_IMAGE ) break;
@@ -148,6 +217,11 @@ std::unique_ptr<Bitmap> JxlLoader::Load()
         {
             JxlDecoderSetOutputColorProfile( m_dec, &srgb, nullptr, 0 );
         }
+        if( res == JXL_DEC_FRAME_PROGRESSION && ProgressionSufficient() )
+        {
+            if( JxlDecoderFlushImage( m_dec ) != JXL_DEC_SUCCESS ) return nullptr;
+            break;
+        }
     }
 
     return bmp;
@@ -164,6 +238,7 @@ std::unique_ptr<BitmapHdr> JxlLoader::LoadHdr( Colorspace colorspace )
 
     for(;;)
     {
+        if( TaskDispatch::IsCancelled() ) return nullptr;
         const auto res = JxlDecoderProcessInput( m_dec );
         if( res == JXL_DEC_ERROR || res == JXL_DEC_NEED_MORE_INPUT || res == JXL_DEC_BASIC_INFO ) return nullptr;
         if( res == JXL_DEC_SUCCESS || res == JXL_DEC_FULL_IMAGE ) break;
@@ -172,6 +247,11 @@ std::unique_ptr<BitmapHdr> JxlLoader::LoadHdr( Colorspace colorspace )
             CheckPanic( colorspace == Colorspace::BT709 || colorspace == Colorspace::BT2020, "Invalid colorspace" );
             JxlDecoderSetOutputColorProfile( m_dec, colorspace == Colorspace::BT709 ? &bt709 : &bt2020, nullptr, 0 );
         }
+        if( res == JXL_DEC_FRAME_PROGRESSION && ProgressionSufficient() )
+        {
+            if( JxlDecoderFlushImage( m_dec ) != JXL_DEC_SUCCESS ) return nullptr;
+            break;
+        }
     }
 
     return bmp;
@@ -183,11 +263,19 @@ bool JxlLoader::Open()
     CheckPanic( !m_buf && !m_runner && !m_dec, "Already opened" );
 
     m_buf = std::make_unique<FileBuffer>( m_file );
-    m_runner = JxlResizableParallelRunnerCreate( nullptr );
+    if( !m_td ) m_runner = JxlResizableParallelRunnerCreate( nullptr );
 
     m_dec = JxlDecoderCreate( nullptr );
-    JxlDecoderSubscribeEvents( m_dec, JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING | JXL_DEC_FULL_IMAGE );
-    JxlDecoderSetParallelRunner( m_dec, JxlResizableParallelRunner, m_runner );
+    JxlDecoderSubscribeEvents( m_dec, JXL_DEC_BASIC_INFO | JXL_DEC_COLOR_ENCODING | JXL_DEC_FRAME_PROGRESSION | JXL_DEC_FULL_IMAGE );
+    JxlDecoderSetProgressiveDetail( m_dec, kPasses );
+    if( m_td )
+    {
+        JxlDecoderSetParallelRunner( m_dec, TaskDispatchRunner, m_td );
+    }
+    else
+    {
+        JxlDecoderSetParallelRunner( m_dec, JxlResizableParallelRunner, m_runner );
+    }
 
     JxlDecoderSetInput( m_dec, (const uint8_t*)m_buf->data(), m_buf->size() );
     JxlDecoderCloseInput( m_dec );
@@ -199,7 +287,7 @@ bool JxlLoader::Open()
         if( res == JXL_DEC_BASIC_INFO )
         {
             JxlDecoderGetBasicInfo( m_dec, &m_info );
-            JxlResizableParallelRunnerSetThreads( m_runner, JxlResizableParallelRunnerSuggestThreads( m_info.xsize, m_info.ysize ) );
+            if( m_runner ) JxlResizableParallelRunnerSetThreads( m_runner, JxlResizableParallelRunnerSuggestThreads( m_info.xsize, m_info.ysize ) );
 
             const JxlCmsInterface cmsInterface
             {
@@ -216,3 +304,20 @@ bool JxlLoader::Open()
         }
     }
 }
+
+bool JxlLoader::ProgressionSufficient()
+{
+    if( m_info.have_animation ) return false;
+
+    // The intended ratio is that of the passes decoded so far. Flushing renders them upsampled to full size.
+    const auto ratio = JxlDecoderGetIntendedDownsamplingRatio( m_dec );
+    if( ratio <= 1 ) return false;
+
+    return ratio <= PassScale();
+}
+
+uint32_t JxlLoader::PassScale() const
+{
+    const auto transposed = m_info.orientation >= JXL_ORIENT_TRANSPOSE;
+    return TargetScale( transposed ? m_info.ysize : m_info.xsize, transposed ? m_info.xsize : m_info.ysize, 8 );
+}
@@ -12,9 +12,8 @@ class Bitmap;
 class BitmapHdr;
 class FileBuffer;
 class FileWrapper;
+class TaskDispatch;
 typedef struct JxlDecoderStruct JxlDecoder;
-typedef void* cmsHPROFILE;
-typedef void* cmsHTRANSFORM;
 
 class JxlLoader : public ImageLoader
 {
@@ -24,12 +23,10 @@ public:
         std::vector<float*> srcBuf;
         std::vector<float*> dstBuf;
 
-        cmsHPROFILE profileIn;
-        cmsHPROFILE profileOut;
-        cmsHTRANSFORM transform;
+        std::shared_ptr<void> transform;
     };
 
-    explicit JxlLoader( std::shared_ptr<FileWrapper> file );
+    explicit JxlLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td = nullptr );
     ~JxlLoader() override;
     NoCopy( JxlLoader );
 
@@ -38,6 +35,8 @@ public:
     [[nodiscard]] bool IsValid() const override;
     [[nodiscard]] bool IsHdr() override;
     [[nodiscard]] bool PreferHdr() override;
+    [[nodiscard]] bool HasFastPreview() override;
+    [[nodiscard]] ImageInfo Probe() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
@@ -45,10 +44,16 @@ public:
 private:
     bool Open();
 
+    // Whether the passes decoded so far have enough detail for the target size.
+    [[nodiscard]] bool ProgressionSufficient();
+    [[nodiscard]] uint32_t PassScale() const;
+
     bool m_valid;
     std::shared_ptr<FileWrapper> m_file;
     std::unique_ptr<FileBuffer> m_buf;
 
+    // Decoding runs on td if set, otherwise on a private libjxl thread pool.
+    TaskDispatch* m_td;
     void* m_runner;
     JxlDecoder* m_dec;
     JxlBasicInfo m_info;
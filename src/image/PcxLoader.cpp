@@ -6,6 +6,7 @@
 
 #include "PcxLoader.hpp"
 #include "util/Bitmap.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
 
@@ -46,14 +47,27 @@ bool PcxLoader::IsValid() const
     return m_valid;
 }
 
+ImageInfo PcxLoader::Probe()
+{
+    CheckPanic( m_valid, "Invalid PCX file" );
+
+    fseek( *m_file, 4, SEEK_SET );
+    uint16_t window[4];
+    if( fread( window, 2, 4, *m_file ) != 4 ) return {};
+    return {
+        .width = uint32_t( window[2] - window[0] + 1 ),
+        .height = uint32_t( window[3] - window[1] + 1 )
+    };
+}
+
 std::unique_ptr<Bitmap> PcxLoader::Load()
 {
     CheckPanic( m_valid, "Invalid PCX file" );
 
-    fseek( *m_file, 0, SEEK_SET );
+    FileBuffer buf( m_file );
 
     int w, h, comp;
-    auto data = drpcx_load( []( void* f, void* out, size_t sz ) { return fread( out, 1, sz, (FILE*)f ); }, (FILE*)*m_file, false, &w, &h, &comp, 4 );
+    auto data = drpcx_load_memory( buf.data(), buf.size(), false, &w, &h, &comp, 4 );
     if( data == nullptr ) return nullptr;
 
     auto bmp = std::make_unique<Bitmap>( w, h );
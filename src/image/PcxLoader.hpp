@@ -18,6 +18,7 @@ public:
     static bool IsValidSignature( const uint8_t* buf, size_t size );
 
     [[nodiscard]] bool IsValid() const override;
+    [[nodiscard]] ImageInfo Probe() override;
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
 
 private:
@@ -1,12 +1,245 @@
+#include <functional>
+#include <libdeflate.h>
+#include <memory>
 #include <png.h>
 #include <setjmp.h>
+#include <stdlib.h>
 #include <string.h>
+#include <tracy/Tracy.hpp>
+#include <vector>
 
 #include "PngLoader.hpp"
 #include "util/Bitmap.hpp"
+#include "util/BitmapHdr.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
 #include "util/Panic.hpp"
+#include "util/SimdDispatch.hpp"
+#include "util/TaskDispatch.hpp"
+
+#if defined MCORE_SIMD_X86
+#  include <x86intrin.h>
+#elif defined MCORE_SIMD_NEON
+#  include <arm_neon.h>
+#endif
+
+namespace
+{
+enum class Filter : uint8_t
+{
+    None,
+    Sub,
+    Up,
+    Avg,
+    Paeth
+};
+
+uint32_t ReadU32( const uint8_t* ptr )
+{
+    return uint32_t( ptr[0] ) << 24 | uint32_t( ptr[1] ) << 16 | uint32_t( ptr[2] ) << 8 | ptr[3];
+}
+
+// Pixels of 3 bytes are moved through the low bytes of a 32-bit value
+template<size_t Bpp>
+uint32_t LoadPixel( const uint8_t* ptr )
+{
+    uint32_t v = 0;
+    memcpy( &v, ptr, Bpp );
+    return v;
+}
+
+template<size_t Bpp>
+void StorePixel( uint8_t* ptr, uint32_t v )
+{
+    memcpy( ptr, &v, Bpp );
+}
+
+uint8_t PaethPredictor( int a, int b, int c )
+{
+    const auto pa = abs( b - c );
+    const auto pb = abs( a - c );
+    const auto pc = abs( a + b - 2 * c );
+    if( pa <= pb && pa <= pc ) return a;
+    return pb <= pc ? b : c;
+}
+
+// The destination may be the filtered row itself. The previous row is already unfiltered; for the first row of
+// the image it is all zeros.
+template<size_t Bpp>
+void UnfilterScalar( Filter filter, uint8_t* dst, const uint8_t* src, const uint8_t* prev, size_t size )
+{
+    switch( filter )
+    {
+    case Filter::None:
+        if( dst != src ) memcpy( dst, src, size );
+        break;
+    case Filter::Sub:
+        for( size_t i=0; i<Bpp; i++ ) dst[i] = src[i];
+        for( size_t i=Bpp; i<size; i++ ) dst[i] = src[i] + dst[i-Bpp];
+        break;
+    case Filter::Up:
+        for( size_t i=0; i<size; i++ ) dst[i] = src[i] + prev[i];
+        break;
+    case Filter::Avg:
+        for( size_t i=0; i<Bpp; i++ ) dst[i] = src[i] + ( prev[i] >> 1 );
+        for( size_t i=Bpp; i<size; i++ ) dst[i] = src[i] + ( ( dst[i-Bpp] + prev[i] ) >> 1 );
+        break;
+    case Filter::Paeth:
+        for( size_t i=0; i<Bpp; i++ ) dst[i] = src[i] + prev[i];
+        for( size_t i=Bpp; i<size; i++ ) dst[i] = src[i] + PaethPredictor( dst[i-Bpp], prev[i], prev[i-Bpp] );
+        break;
+    }
+}
+}
+
+// Sub, Avg and Paeth depend on the pixel to the left, so these go one pixel at a time, with the channels of a
+// pixel in parallel. Up has no such dependency and is done in full vectors.
+#if defined MCORE_SIMD_X86
+template<size_t Bpp>
+SIMD_SSE41 static void UnfilterSse41( Filter filter, uint8_t* dst, const uint8_t* src, const uint8_t* prev, size_t size )
+{
+    switch( filter )
+    {
+    case Filter::Sub:
+    {
+        auto a = _mm_setzero_si128();
+        for( size_t i=0; i<size; i+=Bpp )
+        {
+            a = _mm_add_epi8( a, _mm_cvtsi32_si128( LoadPixel<Bpp>( src + i ) ) );
+            StorePixel<Bpp>( dst + i, _mm_cvtsi128_si32( a ) );
+        }
+        break;
+    }
+    case Filter::Up:
+    {
+        size_t i = 0;
+        for( ; i+16<=size; i+=16 )
+        {
+            _mm_storeu_si128( (__m128i*)( dst + i ), _mm_add_epi8( _mm_loadu_si128( (const __m128i*)( src + i ) ), _mm_loadu_si128( (const __m128i*)( prev + i ) ) ) );
+        }
+        for( ; i<size; i++ ) dst[i] = src[i] + prev[i];
+        break;
+    }
+    case Filter::Avg:
+    {
+        // The rounding down average is the rounding up one, less the low bit of the sum
+        const auto one = _mm_set1_epi8( 1 );
+        auto a = _mm_setzero_si128();
+        for( size_t i=0; i<size; i+=Bpp )
+        {
+            const auto b = _mm_cvtsi32_si128( LoadPixel<Bpp>( prev + i ) );
+            const auto avg = _mm_sub_epi8( _mm_avg_epu8( a, b ), _mm_and_si128( _mm_xor_si128( a, b ), one ) );
+            a = _mm_add_epi8( _mm_cvtsi32_si128( LoadPixel<Bpp>( src + i ) ), avg );
+            StorePixel<Bpp>( dst + i, _mm_cvtsi128_si32( a ) );
+        }
+        break;
+    }
+    case Filter::Paeth:
+    {
+        // In 16 bits, where the distances fit. Ties go to a, then b, as in the predictor above.
+        auto a = _mm_setzero_si128();
+        auto c = _mm_setzero_si128();
+        for( size_t i=0; i<size; i+=Bpp )
+        {
+            const auto b = _mm_cvtepu8_epi16( _mm_cvtsi32_si128( LoadPixel<Bpp>( prev + i ) ) );
+            const auto p = _mm_sub_epi16( b, c );
+            const auto q = _mm_sub_epi16( a, c );
+            const auto pa = _mm_abs_epi16( p );
+            const auto pb = _mm_abs_epi16( q );
+            const auto pc = _mm_abs_epi16( _mm_add_epi16( p, q ) );
+            const auto smallest = _mm_min_epi16( pc, _mm_min_epi16( pa, pb ) );
+            auto nearest = _mm_blendv_epi8( c, b, _mm_cmpeq_epi16( smallest, pb ) );
+            nearest = _mm_blendv_epi8( nearest, a, _mm_cmpeq_epi16( smallest, pa ) );
+
+            const auto x = _mm_add_epi8( _mm_cvtsi32_si128( LoadPixel<Bpp>( src + i ) ), _mm_packus_epi16( nearest, nearest ) );
+            StorePixel<Bpp>( dst + i, _mm_cvtsi128_si32( x ) );
+            a = _mm_cvtepu8_epi16( x );
+            c = b;
+        }
+        break;
+    }
+    default:
+        UnfilterScalar<Bpp>( filter, dst, src, prev, size );
+        break;
+    }
+}
+#elif defined MCORE_SIMD_NEON
+template<size_t Bpp>
+static void UnfilterNeon( Filter filter, uint8_t* dst, const uint8_t* src, const uint8_t* prev, size_t size )
+{
+    switch( filter )
+    {
+    case Filter::Sub:
+    {
+        auto a = vdup_n_u8( 0 );
+        for( size_t i=0; i<size; i+=Bpp )
+        {
+            a = vadd_u8( a, vreinterpret_u8_u32( vdup_n_u32( LoadPixel<Bpp>( src + i ) ) ) );
+            StorePixel<Bpp>( dst + i, vget_lane_u32( vreinterpret_u32_u8( a ), 0 ) );
+        }
+        break;
+    }
+    case Filter::Up:
+    {
+        size_t i = 0;
+        for( ; i+16<=size; i+=16 )
+        {
+            vst1q_u8( dst + i, vaddq_u8( vld1q_u8( src + i ), vld1q_u8( prev + i ) ) );
+        }
+        for( ; i<size; i++ ) dst[i] = src[i] + prev[i];
+        break;
+    }
+    case Filter::Avg:
+    {
+        auto a = vdup_n_u8( 0 );
+        for( size_t i=0; i<size; i+=Bpp )
+        {
+            const auto b = vreinterpret_u8_u32( vdup_n_u32( LoadPixel<Bpp>( prev + i ) ) );
+            a = vadd_u8( vreinterpret_u8_u32( vdup_n_u32( LoadPixel<Bpp>( src + i ) ) ), vhadd_u8( a, b ) );
+            StorePixel<Bpp>( dst + i, vget_lane_u32( vreinterpret_u32_u8( a ), 0 ) );
+        }
+        break;
+    }
+    case Filter::Paeth:
+    {
+        auto a = vdupq_n_s16( 0 );
+        auto c = vdupq_n_s16( 0 );
+        for( size_t i=0; i<size; i+=Bpp )
+        {
+            const auto b = vreinterpretq_s16_u16( vmovl_u8( vreinterpret_u8_u32( vdup_n_u32( LoadPixel<Bpp>( prev + i ) ) ) ) );
+            const auto p = vsubq_s16( b, c );
+            const auto q = vsubq_s16( a, c );
+            const auto pa = vabsq_s16( p );
+            const auto pb = vabsq_s16( q );
+            const auto pc = vabsq_s16( vaddq_s16( p, q ) );
+            const auto smallest = vminq_s16( pc, vminq_s16( pa, pb ) );
+            auto nearest = vbslq_s16( vceqq_s16( smallest, pb ), b, c );
+            nearest = vbslq_s16( vceqq_s16( smallest, pa ), a, nearest );
+
+            const auto x = vadd_u8( vreinterpret_u8_u32( vdup_n_u32( LoadPixel<Bpp>( src + i ) ) ), vmovn_u16( vreinterpretq_u16_s16( nearest ) ) );
+            StorePixel<Bpp>( dst + i, vget_lane_u32( vreinterpret_u32_u8( x ), 0 ) );
+            a = vreinterpretq_s16_u16( vmovl_u8( x ) );
+            c = b;
+        }
+        break;
+    }
+    default:
+        UnfilterScalar<Bpp>( filter, dst, src, prev, size );
+        break;
+    }
+}
+#endif
+
+template<size_t Bpp>
+static void Unfilter( Filter filter, uint8_t* dst, const uint8_t* src, const uint8_t* prev, size_t size )
+{
+#if defined MCORE_SIMD_X86
+    if( GetSimdLevel() != SimdLevel::Scalar ) return UnfilterSse41<Bpp>( filter, dst, src, prev, size );
+#elif defined MCORE_SIMD_NEON
+    if( GetSimdLevel() == SimdLevel::Neon ) return UnfilterNeon<Bpp>( filter, dst, src, prev, size );
+#endif
+    UnfilterScalar<Bpp>( filter, dst, src, prev, size );
+}
 
 PngLoader::PngLoader( const std::shared_ptr<FileWrapper>& file )
     : PngLoader( std::make_shared<FileBuffer>( file ) )
@@ -33,29 +266,112 @@ bool PngLoader::IsValid() const
     return m_buf != nullptr;
 }
 
+bool PngLoader::IsHdr()
+{
+    // IHDR is always the first chunk, bit depth follows the image size
+    return m_buf && m_buf->size() > 24 && m_buf->data()[24] == 16;
+}
+
+// There is nothing to do after decoding, 16-bit samples are cut to 8 bits as they are read
+bool PngLoader::HasStreaming()
+{
+    return m_buf != nullptr;
+}
+
+ImageInfo PngLoader::Probe()
+{
+    CheckPanic( m_buf, "Invalid PNG file" );
+    if( m_buf->size() < 24 ) return {};
+
+    // IHDR is always the first chunk
+    auto ihdr = (const uint8_t*)m_buf->data() + 16;
+    return {
+        .width = uint32_t( ihdr[0] << 24 | ihdr[1] << 16 | ihdr[2] << 8 | ihdr[3] ),
+        .height = uint32_t( ihdr[4] << 24 | ihdr[5] << 16 | ihdr[6] << 8 | ihdr[7] ),
+        .hdr = IsHdr()
+    };
+}
+
 std::unique_ptr<Bitmap> PngLoader::Load()
 {
     CheckPanic( m_buf, "Invalid PNG file" );
 
+    std::unique_ptr<Bitmap> bmp;
+    if( !Decode( false, [&bmp]( uint32_t width, uint32_t height ) {
+        bmp = std::make_unique<Bitmap>( width, height );
+        return bmp->Data();
+    } ) ) return nullptr;
+    return bmp;
+}
+
+std::unique_ptr<Bitmap> PngLoader::LoadStreaming( RowSink& sink )
+{
+    CheckPanic( m_buf, "Invalid PNG file" );
+
+    std::unique_ptr<Bitmap> bmp;
+    bool stream = false;
+    if( !Decode( false, [&bmp, &sink, &stream]( uint32_t width, uint32_t height ) {
+        bmp = std::make_unique<Bitmap>( width, height );
+        stream = sink.Start( width, height );
+        return bmp->Data();
+    }, [&bmp, &sink, &stream]( uint32_t y, uint32_t count ) {
+        if( stream ) sink.Rows( (const uint32_t*)bmp->Data() + size_t( y ) * bmp->Width(), y, count );
+    } ) ) return nullptr;
+    return bmp;
+}
+
+std::unique_ptr<BitmapHdr> PngLoader::LoadHdr( Colorspace colorspace )
+{
+    CheckPanic( m_buf, "Invalid PNG file" );
+
+    std::unique_ptr<uint16_t[]> data;
+    uint32_t w, h;
+    if( !Decode( true, [&data, &w, &h]( uint32_t width, uint32_t height ) {
+        data = std::make_unique<uint16_t[]>( size_t( width ) * height * 4 );
+        w = width;
+        h = height;
+        return (uint8_t*)data.get();
+    } ) ) return nullptr;
+    return ConvertSrgb16( data.get(), w, h, colorspace );
+}
+
+bool PngLoader::Decode( bool wide, const std::function<uint8_t*( uint32_t, uint32_t )>& alloc, const std::function<void( uint32_t, uint32_t )>& bands )
+{
+    // IHDR: size, bit depth, color type, compression, filter and interlace method
+    auto ihdr = (const uint8_t*)m_buf->data() + 8;
+    if( !wide && m_buf->size() >= 33 && ReadU32( ihdr ) == 13 && memcmp( ihdr + 4, "IHDR", 4 ) == 0 &&
+        ihdr[16] == 8 && ( ihdr[17] == PNG_COLOR_TYPE_RGB || ihdr[17] == PNG_COLOR_TYPE_RGB_ALPHA ) &&
+        ihdr[18] == 0 && ihdr[19] == 0 && ihdr[20] == 0 )
+    {
+        const auto width = ReadU32( ihdr + 8 );
+        const auto height = ReadU32( ihdr + 12 );
+        if( width > 0 && height > 0 && width <= PNG_USER_WIDTH_MAX && height <= PNG_USER_HEIGHT_MAX )
+        {
+            return DecodeDirect( width, height, ihdr[17] == PNG_COLOR_TYPE_RGB ? 3 : 4, alloc, bands );
+        }
+    }
+
+    m_offset = 8;
+
     auto png = png_create_read_struct( PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr );
-    if( !png ) return nullptr;
+    if( !png ) return false;
     auto info = png_create_info_struct( png );
     if( !info )
     {
         png_destroy_read_struct( &png, nullptr, nullptr );
-        return nullptr;
+        return false;
     }
     auto end = png_create_info_struct( png );
     if( !end )
     {
         png_destroy_read_struct( &png, &info, nullptr );
-        return nullptr;
+        return false;
     }
 
     if( setjmp( png_jmpbuf( png ) ) )
     {
         png_destroy_read_struct( &png, &info, &end );
-        return nullptr;
+        return false;
     }
 
     png_set_read_fn( png, this, []( png_structp png, png_bytep data, png_size_t length )
@@ -73,7 +389,18 @@ std::unique_ptr<Bitmap> PngLoader::Load()
     int bitDepth, colorType;
     png_get_IHDR( png, info, &width, &height, &bitDepth, &colorType, nullptr, nullptr, nullptr );
 
-    if( bitDepth == 16 ) png_set_strip_16( png );
+    if( !wide )
+    {
+        if( bitDepth == 16 ) png_set_strip_16( png );
+    }
+    else
+    {
+        if( bitDepth < 16 ) png_set_expand_16( png );
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+        png_set_swap( png );
+#endif
+    }
+    const auto opaque = wide ? 0xFFFF : 0xFF;
 
     switch( colorType )
     {
@@ -85,38 +412,154 @@ std::unique_ptr<Bitmap> PngLoader::Load()
         }
         else
         {
-            png_set_filler( png, 0xFF, PNG_FILLER_AFTER );
+            png_set_filler( png, opaque, PNG_FILLER_AFTER );
         }
         break;
     case PNG_COLOR_TYPE_GRAY:
         if( bitDepth < 8 ) png_set_expand_gray_1_2_4_to_8( png );
         png_set_gray_to_rgb( png );
-        png_set_filler( png, 0xFF, PNG_FILLER_AFTER );
+        png_set_filler( png, opaque, PNG_FILLER_AFTER );
         break;
     case PNG_COLOR_TYPE_GRAY_ALPHA:
         if( bitDepth < 8 ) png_set_expand_gray_1_2_4_to_8( png );
         png_set_gray_to_rgb( png );
         break;
     case PNG_COLOR_TYPE_RGB:
-        png_set_filler( png, 0xFF, PNG_FILLER_AFTER );
+        png_set_filler( png, opaque, PNG_FILLER_AFTER );
         break;
     default:
         break;
     }
 
-    auto bmp = std::make_unique<Bitmap>( width, height );
+    const auto passes = png_set_interlace_handling( png );
+    png_read_update_info( png, info );
 
-    auto rowPtrs = new png_bytep[height];
-    auto ptr = bmp->Data();
-    for( png_uint_32 i=0; i<height; i++ )
+    const auto stride = width * ( wide ? 8 : 4 );
+    auto ptr = alloc( width, height );
+
+    // Read row by row instead of with png_read_image(), so that a cancelled load stops early. Interlaced rows are
+    // final only in the last pass.
+    for( int pass=0; pass<passes; pass++ )
     {
-        rowPtrs[i] = ptr;
-        ptr += width * 4;
+        const auto last = bands && pass == passes - 1;
+        for( png_uint_32 i=0; i<height; i++ )
+        {
+            if( ( i & 31 ) == 0 )
+            {
+                if( TaskDispatch::IsCancelled() )
+                {
+                    png_destroy_read_struct( &png, &info, &end );
+                    return false;
+                }
+                if( last && i > 0 ) bands( i - 32, 32 );
+            }
+            png_read_row( png, ptr + size_t( i ) * stride, nullptr );
+        }
+        if( last ) bands( ( height - 1 ) & ~31u, ( ( height - 1 ) & 31 ) + 1 );
     }
-    png_read_image( png, rowPtrs );
-    delete[] rowPtrs;
 
     png_read_end( png, end );
     png_destroy_read_struct( &png, &info, &end );
-    return bmp;
+    return true;
+}
+
+bool PngLoader::DecodeDirect( uint32_t width, uint32_t height, uint32_t channels, const std::function<uint8_t*( uint32_t, uint32_t )>& alloc, const std::function<void( uint32_t, uint32_t )>& bands )
+{
+    ZoneScoped;
+
+    // The compressed stream may be split over any number of IDAT chunks, which are usually consecutive. If there
+    // is only one, it is inflated in place.
+    const auto data = (const uint8_t*)m_buf->data();
+    const auto size = m_buf->size();
+    std::vector<std::pair<const uint8_t*, size_t>> idat;
+    size_t total = 0;
+    size_t pos = 8;
+    for(;;)
+    {
+        if( size - pos < 12 ) return false;
+        const auto len = ReadU32( data + pos );
+        if( len > size - pos - 12 ) return false;
+        const auto type = data + pos + 4;
+        if( memcmp( type, "IDAT", 4 ) == 0 )
+        {
+            idat.emplace_back( type + 4, len );
+            total += len;
+        }
+        else if( memcmp( type, "IEND", 4 ) == 0 )
+        {
+            break;
+        }
+        pos += len + 12;
+    }
+    if( idat.empty() ) return false;
+
+    std::unique_ptr<uint8_t[]> joined;
+    const uint8_t* stream = idat[0].first;
+    if( idat.size() > 1 )
+    {
+        joined = std::make_unique_for_overwrite<uint8_t[]>( total );
+        auto ptr = joined.get();
+        for( auto& chunk : idat )
+        {
+            memcpy( ptr, chunk.first, chunk.second );
+            ptr += chunk.second;
+        }
+        stream = joined.get();
+    }
+
+    // Each row is preceded by its filter type
+    const auto rowSize = size_t( width ) * channels;
+    const auto rawSize = ( rowSize + 1 ) * height;
+    auto raw = std::make_unique_for_overwrite<uint8_t[]>( rawSize );
+    {
+        ZoneScopedN( "Inflate" );
+        auto inflater = libdeflate_alloc_decompressor();
+        if( !inflater ) return false;
+        const auto res = libdeflate_zlib_decompress( inflater, stream, total, raw.get(), rawSize, nullptr );
+        libdeflate_free_decompressor( inflater );
+        if( res != LIBDEFLATE_SUCCESS ) return false;
+    }
+    joined.reset();
+    if( TaskDispatch::IsCancelled() ) return false;
+
+    const std::vector<uint8_t> zero( rowSize );
+    auto dst = alloc( width, height );
+    const uint8_t* prev = zero.data();
+    for( uint32_t y=0; y<height; y++ )
+    {
+        if( ( y & 31 ) == 0 )
+        {
+            if( TaskDispatch::IsCancelled() ) return false;
+            if( bands && y > 0 ) bands( y - 32, 32 );
+        }
+
+        auto row = raw.get() + y * ( rowSize + 1 );
+        const auto filter = Filter( row[0] );
+        if( filter > Filter::Paeth ) return false;
+        row++;
+
+        auto out = dst + size_t( y ) * width * 4;
+        if( channels == 4 )
+        {
+            // Straight into the bitmap, where the row above already is
+            Unfilter<4>( filter, out, row, prev, rowSize );
+            prev = out;
+        }
+        else
+        {
+            Unfilter<3>( filter, row, row, prev, rowSize );
+            prev = row;
+            for( uint32_t x=0; x<width; x++ )
+            {
+                out[0] = row[0];
+                out[1] = row[1];
+                out[2] = row[2];
+                out[3] = 0xFF;
+                out += 4;
+                row += 3;
+            }
+        }
+    }
+    if( bands ) bands( ( height - 1 ) & ~31u, ( ( height - 1 ) & 31 ) + 1 );
+    return true;
 }
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <stdint.h>
 
@@ -20,9 +21,21 @@ public:
     static bool IsValidSignature( const uint8_t* buf, size_t size );
 
     [[nodiscard]] bool IsValid() const override;
+    [[nodiscard]] bool IsHdr() override;
+    [[nodiscard]] bool HasStreaming() override;
+    [[nodiscard]] ImageInfo Probe() override;
+
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadStreaming( RowSink& sink ) override;
+    [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
 
 private:
+    // Decodes to RGBA, 16 bits per channel if wide. The destination is requested once the image size is known.
+    // Rows which are final are reported to bands, if set, with the first row and their count.
+    bool Decode( bool wide, const std::function<uint8_t*( uint32_t, uint32_t )>& alloc, const std::function<void( uint32_t, uint32_t )>& bands = {} );
+    // Non-interlaced 8-bit RGB and RGBA, inflated in one go and unfiltered without libpng
+    bool DecodeDirect( uint32_t width, uint32_t height, uint32_t channels, const std::function<uint8_t*( uint32_t, uint32_t )>& alloc, const std::function<void( uint32_t, uint32_t )>& bands );
+
     std::shared_ptr<DataBuffer> m_buf;
     size_t m_offset;
 };
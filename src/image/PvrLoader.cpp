@@ -1,5 +1,9 @@
+#include <algorithm>
+#include <bit>
 #include <string.h>
 
+#include "BlockDecode.hpp"
+#include "BlockTables.hpp"
 #include "PvrLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/FileBuffer.hpp"
@@ -19,56 +23,6 @@
 #  define _bswap64(x) __builtin_bswap64(x)
 #endif
 
-constexpr int32_t g_table[8][4] = {
-    {  2,  8,   -2,   -8 },
-    {  5, 17,   -5,  -17 },
-    {  9, 29,   -9,  -29 },
-    { 13, 42,  -13,  -42 },
-    { 18, 60,  -18,  -60 },
-    { 24, 80,  -24,  -80 },
-    { 33, 106, -33, -106 },
-    { 47, 183, -47, -183 }
-};
-
-constexpr int32_t g_alpha[16][8] = {
-    { -3, -6,  -9, -15, 2, 5, 8, 14 },
-    { -3, -7, -10, -13, 2, 6, 9, 12 },
-    { -2, -5,  -8, -13, 1, 4, 7, 12 },
-    { -2, -4,  -6, -13, 1, 3, 5, 12 },
-    { -3, -6,  -8, -12, 2, 5, 7, 11 },
-    { -3, -7,  -9, -11, 2, 6, 8, 10 },
-    { -4, -7,  -8, -11, 3, 6, 7, 10 },
-    { -3, -5,  -8, -11, 2, 4, 7, 10 },
-    { -2, -6,  -8, -10, 1, 5, 7,  9 },
-    { -2, -5,  -8, -10, 1, 4, 7,  9 },
-    { -2, -4,  -8, -10, 1, 3, 7,  9 },
-    { -2, -5,  -7, -10, 1, 4, 6,  9 },
-    { -3, -4,  -7, -10, 2, 3, 6,  9 },
-    { -1, -2,  -3, -10, 0, 1, 2,  9 },
-    { -4, -6,  -8,  -9, 3, 5, 7,  8 },
-    { -3, -5,  -7,  -9, 2, 4, 6,  8 }
-};
-
-constexpr uint8_t table59T58H[8] = { 3,6,11,16,23,32,41,64 };
-
-constexpr int32_t g_alpha11Mul[16] = { 1, 8, 16, 24, 32, 40, 48, 56, 64, 72, 80, 88, 96, 104, 112, 120 };
-
-static uint8_t clampu8( int32_t val )
-{
-    if( ( val & ~0xFF ) == 0 ) return val;
-    return ( ( ~val ) >> 31 ) & 0xFF;
-}
-
-static int32_t expand6(uint32_t value)
-{
-    return (value << 2) | (value >> 4);
-}
-
-static int32_t expand7(uint32_t value)
-{
-    return (value << 1) | (value >> 6);
-}
-
 static uint64_t ConvertByteOrder( uint64_t d )
 {
     uint32_t word[2];
@@ -103,13 +57,13 @@ static void DecodeT( uint64_t block, uint32_t* dst, uint32_t w )
     const auto codeword_lo = block & 0x1;
     const auto codeword = ( codeword_hi << 1 ) | codeword_lo;
 
-    const auto c2r = clampu8( cr1 + table59T58H[codeword] );
-    const auto c2g = clampu8( cg1 + table59T58H[codeword] );
-    const auto c2b = clampu8( cb1 + table59T58H[codeword] );
+    const auto c2r = ClampU8( cr1 + g_etcDistance[codeword] );
+    const auto c2g = ClampU8( cg1 + g_etcDistance[codeword] );
+    const auto c2b = ClampU8( cb1 + g_etcDistance[codeword] );
 
-    const auto c3r = clampu8( cr1 - table59T58H[codeword] );
-    const auto c3g = clampu8( cg1 - table59T58H[codeword] );
-    const auto c3b = clampu8( cb1 - table59T58H[codeword] );
+    const auto c3r = ClampU8( cr1 - g_etcDistance[codeword] );
+    const auto c3g = ClampU8( cg1 - g_etcDistance[codeword] );
+    const auto c3b = ClampU8( cb1 - g_etcDistance[codeword] );
 
     const uint32_t col_tab[4] = {
         uint32_t( cr0 | ( cg0 << 8 ) | ( cb0 << 16 ) | 0xFF000000 ),
@@ -156,15 +110,15 @@ static void DecodeTAlpha( uint64_t block, uint64_t alpha, uint32_t* dst, uint32_
 
     const int32_t base = alpha >> 56;
     const int32_t mul = ( alpha >> 52 ) & 0xF;
-    const auto tbl = g_alpha[( alpha >> 48 ) & 0xF];
+    const auto& tbl = g_eacModifiers[( alpha >> 48 ) & 0xF];
 
-    const auto c2r = clampu8( cr1 + table59T58H[codeword] );
-    const auto c2g = clampu8( cg1 + table59T58H[codeword] );
-    const auto c2b = clampu8( cb1 + table59T58H[codeword] );
+    const auto c2r = ClampU8( cr1 + g_etcDistance[codeword] );
+    const auto c2g = ClampU8( cg1 + g_etcDistance[codeword] );
+    const auto c2b = ClampU8( cb1 + g_etcDistance[codeword] );
 
-    const auto c3r = clampu8( cr1 - table59T58H[codeword] );
-    const auto c3g = clampu8( cg1 - table59T58H[codeword] );
-    const auto c3b = clampu8( cb1 - table59T58H[codeword] );
+    const auto c3r = ClampU8( cr1 - g_etcDistance[codeword] );
+    const auto c3g = ClampU8( cg1 - g_etcDistance[codeword] );
+    const auto c3b = ClampU8( cb1 - g_etcDistance[codeword] );
 
     const uint32_t col_tab[4] = {
         uint32_t( cr0 | ( cg0 << 8 ) | ( cb0 << 16 ) ),
@@ -181,7 +135,7 @@ static void DecodeTAlpha( uint64_t block, uint64_t alpha, uint32_t* dst, uint32_
             //2bit indices distributed on two lane 16bit numbers
             const uint8_t index = ( ( ( indexes >> ( j + i * 4 + 16 ) ) & 0x1 ) << 1 ) | ( ( indexes >> ( j + i * 4 ) ) & 0x1 );
             const auto amod = tbl[( alpha >> ( 45 - j * 3 - i * 12 ) ) & 0x7];
-            const uint32_t a = clampu8( base + amod * mul );
+            const uint32_t a = ClampU8( base + amod * mul );
             dst[j * w + i] = col_tab[index] | ( a << 24 );
         }
     }
@@ -214,10 +168,10 @@ static void DecodeH( uint64_t block, uint32_t* dst, uint32_t w )
     const auto codeword = codeword_hi | codeword_lo;
 
     const uint32_t col_tab[] = {
-        uint32_t( clampu8( r0 + table59T58H[codeword] ) | ( clampu8( g0 + table59T58H[codeword] ) << 8 ) | ( clampu8( b0 + table59T58H[codeword] ) << 16 ) ),
-        uint32_t( clampu8( r0 - table59T58H[codeword] ) | ( clampu8( g0 - table59T58H[codeword] ) << 8 ) | ( clampu8( b0 - table59T58H[codeword] ) << 16 ) ),
-        uint32_t( clampu8( r1 + table59T58H[codeword] ) | ( clampu8( g1 + table59T58H[codeword] ) << 8 ) | ( clampu8( b1 + table59T58H[codeword] ) << 16 ) ),
-        uint32_t( clampu8( r1 - table59T58H[codeword] ) | ( clampu8( g1 - table59T58H[codeword] ) << 8 ) | ( clampu8( b1 - table59T58H[codeword] ) << 16 ) )
+        uint32_t( ClampU8( r0 + g_etcDistance[codeword] ) | ( ClampU8( g0 + g_etcDistance[codeword] ) << 8 ) | ( ClampU8( b0 + g_etcDistance[codeword] ) << 16 ) ),
+        uint32_t( ClampU8( r0 - g_etcDistance[codeword] ) | ( ClampU8( g0 - g_etcDistance[codeword] ) << 8 ) | ( ClampU8( b0 - g_etcDistance[codeword] ) << 16 ) ),
+        uint32_t( ClampU8( r1 + g_etcDistance[codeword] ) | ( ClampU8( g1 + g_etcDistance[codeword] ) << 8 ) | ( ClampU8( b1 + g_etcDistance[codeword] ) << 16 ) ),
+        uint32_t( ClampU8( r1 - g_etcDistance[codeword] ) | ( ClampU8( g1 - g_etcDistance[codeword] ) << 8 ) | ( ClampU8( b1 - g_etcDistance[codeword] ) << 16 ) )
     };
 
     for( uint8_t j = 0; j < 4; j++ )
@@ -258,13 +212,13 @@ static void DecodeHAlpha( uint64_t block, uint64_t alpha, uint32_t* dst, uint32_
 
     const int32_t base = alpha >> 56;
     const int32_t mul = ( alpha >> 52 ) & 0xF;
-    const auto tbl = g_alpha[(alpha >> 48) & 0xF];
+    const auto& tbl = g_eacModifiers[(alpha >> 48) & 0xF];
 
     const uint32_t col_tab[] = {
-        uint32_t( clampu8( r0 + table59T58H[codeword] ) | ( clampu8( g0 + table59T58H[codeword] ) << 8 ) | ( clampu8( b0 + table59T58H[codeword] ) << 16 ) ),
-        uint32_t( clampu8( r0 - table59T58H[codeword] ) | ( clampu8( g0 - table59T58H[codeword] ) << 8 ) | ( clampu8( b0 - table59T58H[codeword] ) << 16 ) ),
-        uint32_t( clampu8( r1 + table59T58H[codeword] ) | ( clampu8( g1 + table59T58H[codeword] ) << 8 ) | ( clampu8( b1 + table59T58H[codeword] ) << 16 ) ),
-        uint32_t( clampu8( r1 - table59T58H[codeword] ) | ( clampu8( g1 - table59T58H[codeword] ) << 8 ) | ( clampu8( b1 - table59T58H[codeword] ) << 16 ) )
+        uint32_t( ClampU8( r0 + g_etcDistance[codeword] ) | ( ClampU8( g0 + g_etcDistance[codeword] ) << 8 ) | ( ClampU8( b0 + g_etcDistance[codeword] ) << 16 ) ),
+        uint32_t( ClampU8( r0 - g_etcDistance[codeword] ) | ( ClampU8( g0 - g_etcDistance[codeword] ) << 8 ) | ( ClampU8( b0 - g_etcDistance[codeword] ) << 16 ) ),
+        uint32_t( ClampU8( r1 + g_etcDistance[codeword] ) | ( ClampU8( g1 + g_etcDistance[codeword] ) << 8 ) | ( ClampU8( b1 + g_etcDistance[codeword] ) << 16 ) ),
+        uint32_t( ClampU8( r1 - g_etcDistance[codeword] ) | ( ClampU8( g1 - g_etcDistance[codeword] ) << 8 ) | ( ClampU8( b1 - g_etcDistance[codeword] ) << 16 ) )
     };
 
     for( uint8_t j = 0; j < 4; j++ )
@@ -273,7 +227,7 @@ static void DecodeHAlpha( uint64_t block, uint64_t alpha, uint32_t* dst, uint32_
         {
             const uint8_t index = ( ( ( indexes >> ( j + i * 4 + 16 ) ) & 0x1 ) << 1 ) | ( ( indexes >> ( j + i * 4 ) ) & 0x1 );
             const auto amod = tbl[( alpha >> ( 45 - j * 3 - i * 12) ) & 0x7];
-            const uint32_t a = clampu8( base + amod * mul );
+            const uint32_t a = ClampU8( base + amod * mul );
             dst[j * w + i] = col_tab[index] | ( a << 24 );
         }
     }
@@ -281,25 +235,25 @@ static void DecodeHAlpha( uint64_t block, uint64_t alpha, uint32_t* dst, uint32_
 
 static void DecodePlanar( uint64_t block, uint32_t* dst, uint32_t w )
 {
-    const auto bv = expand6((block >> ( 0 + 32)) & 0x3F);
-    const auto gv = expand7((block >> ( 6 + 32)) & 0x7F);
-    const auto rv = expand6((block >> (13 + 32)) & 0x3F);
+    const int32_t bv = g_expand<6>[(block >> ( 0 + 32)) & 0x3F];
+    const int32_t gv = g_expand<7>[(block >> ( 6 + 32)) & 0x7F];
+    const int32_t rv = g_expand<6>[(block >> (13 + 32)) & 0x3F];
 
-    const auto bh = expand6((block >> (19 + 32)) & 0x3F);
-    const auto gh = expand7((block >> (25 + 32)) & 0x7F);
+    const int32_t bh = g_expand<6>[(block >> (19 + 32)) & 0x3F];
+    const int32_t gh = g_expand<7>[(block >> (25 + 32)) & 0x7F];
 
     const auto rh0 = (block >> (32 - 32)) & 0x01;
     const auto rh1 = ((block >> (34 - 32)) & 0x1F) << 1;
-    const auto rh = expand6(rh0 | rh1);
+    const int32_t rh = g_expand<6>[rh0 | rh1];
 
     const auto bo0 = (block >> (39 - 32)) & 0x07;
     const auto bo1 = ((block >> (43 - 32)) & 0x3) << 3;
     const auto bo2 = ((block >> (48 - 32)) & 0x1) << 5;
-    const auto bo = expand6(bo0 | bo1 | bo2);
+    const int32_t bo = g_expand<6>[bo0 | bo1 | bo2];
     const auto go0 = (block >> (49 - 32)) & 0x3F;
     const auto go1 = ((block >> (56 - 32)) & 0x01) << 6;
-    const auto go = expand7(go0 | go1);
-    const auto ro = expand6((block >> (57 - 32)) & 0x3F);
+    const int32_t go = g_expand<7>[go0 | go1];
+    const int32_t ro = g_expand<6>[(block >> (57 - 32)) & 0x3F];
 
 #ifdef __ARM_NEON
     uint64_t init = uint64_t(uint16_t(rh-ro)) | ( uint64_t(uint16_t(gh-go)) << 16 ) | ( uint64_t(uint16_t(bh-bo)) << 32 );
@@ -351,9 +305,9 @@ static void DecodePlanar( uint64_t block, uint32_t* dst, uint32_t w )
             }
             else
             {
-                const auto rc = clampu8( r );
-                const auto gc = clampu8( g );
-                const auto bc = clampu8( b );
+                const auto rc = ClampU8( r );
+                const auto gc = ClampU8( g );
+                const auto bc = ClampU8( b );
                 dst[j*w+i] = rc | ( gc << 8 ) | ( bc << 16 ) | 0xFF000000;
             }
         }
@@ -363,29 +317,29 @@ static void DecodePlanar( uint64_t block, uint32_t* dst, uint32_t w )
 
 static void DecodePlanarAlpha( uint64_t block, uint64_t alpha, uint32_t* dst, uint32_t w )
 {
-    const auto bv = expand6((block >> ( 0 + 32)) & 0x3F);
-    const auto gv = expand7((block >> ( 6 + 32)) & 0x7F);
-    const auto rv = expand6((block >> (13 + 32)) & 0x3F);
+    const int32_t bv = g_expand<6>[(block >> ( 0 + 32)) & 0x3F];
+    const int32_t gv = g_expand<7>[(block >> ( 6 + 32)) & 0x7F];
+    const int32_t rv = g_expand<6>[(block >> (13 + 32)) & 0x3F];
 
-    const auto bh = expand6((block >> (19 + 32)) & 0x3F);
-    const auto gh = expand7((block >> (25 + 32)) & 0x7F);
+    const int32_t bh = g_expand<6>[(block >> (19 + 32)) & 0x3F];
+    const int32_t gh = g_expand<7>[(block >> (25 + 32)) & 0x7F];
 
     const auto rh0 = (block >> (32 - 32)) & 0x01;
     const auto rh1 = ((block >> (34 - 32)) & 0x1F) << 1;
-    const auto rh = expand6(rh0 | rh1);
+    const int32_t rh = g_expand<6>[rh0 | rh1];
 
     const auto bo0 = (block >> (39 - 32)) & 0x07;
     const auto bo1 = ((block >> (43 - 32)) & 0x3) << 3;
     const auto bo2 = ((block >> (48 - 32)) & 0x1) << 5;
-    const auto bo = expand6(bo0 | bo1 | bo2);
+    const int32_t bo = g_expand<6>[bo0 | bo1 | bo2];
     const auto go0 = (block >> (49 - 32)) & 0x3F;
     const auto go1 = ((block >> (56 - 32)) & 0x01) << 6;
-    const auto go = expand7(go0 | go1);
-    const auto ro = expand6((block >> (57 - 32)) & 0x3F);
+    const int32_t go = g_expand<7>[go0 | go1];
+    const int32_t ro = g_expand<6>[(block >> (57 - 32)) & 0x3F];
 
     const int32_t base = alpha >> 56;
     const int32_t mul = ( alpha >> 52 ) & 0xF;
-    const auto tbl = g_alpha[( alpha >> 48 ) & 0xF];
+    const auto& tbl = g_eacModifiers[( alpha >> 48 ) & 0xF];
 
 #ifdef __ARM_NEON
     uint64_t init = uint64_t(uint16_t(rh-ro)) | ( uint64_t(uint16_t(gh-go)) << 16 ) | ( uint64_t(uint16_t(bh-bo)) << 32 );
@@ -400,7 +354,7 @@ static void DecodePlanarAlpha( uint64_t block, uint64_t alpha, uint32_t* dst, ui
         for( int i=0; i<4; i++ )
         {
             const auto amod = tbl[(alpha >> ( 45 - j*3 - i*12 )) & 0x7];
-            const uint32_t a = clampu8( base + amod * mul );
+            const uint32_t a = ClampU8( base + amod * mul );
             uint8x8_t c = vqshrun_n_s16( col, 2 );
             dst[j*w+i] = vget_lane_u32( vreinterpret_u32_u8( c ), 0 ) | ( a << 24 );
             col = vaddq_s16( col, chco );
@@ -417,7 +371,7 @@ static void DecodePlanarAlpha( uint64_t block, uint64_t alpha, uint32_t* dst, ui
         for( int i=0; i<4; i++ )
         {
             const auto amod = tbl[(alpha >> ( 45 - j*3 - i*12 )) & 0x7];
-            const uint32_t a = clampu8( base + amod * mul );
+            const uint32_t a = ClampU8( base + amod * mul );
             __m128i c = _mm_srai_epi16( col, 2 );
             __m128i s = _mm_packus_epi16( c, c );
             dst[j*w+i] = _mm_cvtsi128_si32( s ) | ( a << 24 );
@@ -434,16 +388,16 @@ static void DecodePlanarAlpha( uint64_t block, uint64_t alpha, uint32_t* dst, ui
             const uint32_t g = (i * (gh - go) + j * (gv - go) + 4 * go + 2) >> 2;
             const uint32_t b = (i * (bh - bo) + j * (bv - bo) + 4 * bo + 2) >> 2;
             const auto amod = tbl[(alpha >> ( 45 - j*3 - i*12 )) & 0x7];
-            const uint32_t a = clampu8( base + amod * mul );
+            const uint32_t a = ClampU8( base + amod * mul );
             if( ( ( r | g | b ) & ~0xFF ) == 0 )
             {
                 dst[j*w+i] = r | ( g << 8 ) | ( b << 16 ) | ( a << 24 );
             }
             else
             {
-                const auto rc = clampu8( r );
-                const auto gc = clampu8( g );
-                const auto bc = clampu8( b );
+                const auto rc = ClampU8( r );
+                const auto gc = ClampU8( g );
+                const auto bc = ClampU8( b );
                 dst[j*w+i] = rc | ( gc << 8 ) | ( bc << 16 ) | ( a << 24 );
             }
         }
@@ -494,12 +448,12 @@ static void DecodeRGBPart( uint64_t d, uint32_t* dst, uint32_t w )
             return;
         }
 
-        br[0] = ( r0 << 3 ) | ( r0 >> 2 );
-        br[1] = ( r1 << 3 ) | ( r1 >> 2 );
-        bg[0] = ( g0 << 3 ) | ( g0 >> 2 );
-        bg[1] = ( g1 << 3 ) | ( g1 >> 2 );
-        bb[0] = ( b0 << 3 ) | ( b0 >> 2 );
-        bb[1] = ( b1 << 3 ) | ( b1 >> 2 );
+        br[0] = g_expand<5>[r0];
+        br[1] = g_expand<5>[r1];
+        bg[0] = g_expand<5>[g0];
+        bg[1] = g_expand<5>[g1];
+        bb[0] = g_expand<5>[b0];
+        bb[1] = g_expand<5>[b1];
     }
     else
     {
@@ -536,7 +490,7 @@ static void DecodeRGBPart( uint64_t d, uint32_t* dst, uint32_t w )
         {
             for( int j=0; j<4; j++ )
             {
-                const auto mod = g_table[tcw[j/2]][idx & 0x3];
+                const auto& mod = g_etcModifiers[tcw[j/2]][idx & 0x3];
                 const auto r = br[j/2] + mod;
                 const auto g = bg[j/2] + mod;
                 const auto b = bb[j/2] + mod;
@@ -546,9 +500,9 @@ static void DecodeRGBPart( uint64_t d, uint32_t* dst, uint32_t w )
                 }
                 else
                 {
-                    const auto rc = clampu8( r );
-                    const auto gc = clampu8( g );
-                    const auto bc = clampu8( b );
+                    const auto rc = ClampU8( r );
+                    const auto gc = ClampU8( g );
+                    const auto bc = ClampU8( b );
                     dst[j*w+i] = rc | ( gc << 8 ) | ( bc << 16 ) | 0xFF000000;
                 }
                 idx >>= 2;
@@ -559,7 +513,7 @@ static void DecodeRGBPart( uint64_t d, uint32_t* dst, uint32_t w )
     {
         for( int i=0; i<4; i++ )
         {
-            const auto tbl = g_table[tcw[i/2]];
+            const auto& tbl = g_etcModifiers[tcw[i/2]];
             const auto cr = br[i/2];
             const auto cg = bg[i/2];
             const auto cb = bb[i/2];
@@ -576,9 +530,9 @@ static void DecodeRGBPart( uint64_t d, uint32_t* dst, uint32_t w )
                 }
                 else
                 {
-                    const auto rc = clampu8( r );
-                    const auto gc = clampu8( g );
-                    const auto bc = clampu8( b );
+                    const auto rc = ClampU8( r );
+                    const auto gc = ClampU8( g );
+                    const auto bc = ClampU8( b );
                     dst[j*w+i] = rc | ( gc << 8 ) | ( bc << 16 ) | 0xFF000000;
                 }
                 idx >>= 2;
@@ -631,12 +585,12 @@ static void DecodeRGBAPart( uint64_t d, uint64_t alpha, uint32_t* dst, uint32_t
             return;
         }
 
-        br[0] = ( r0 << 3 ) | ( r0 >> 2 );
-        br[1] = ( r1 << 3 ) | ( r1 >> 2 );
-        bg[0] = ( g0 << 3 ) | ( g0 >> 2 );
-        bg[1] = ( g1 << 3 ) | ( g1 >> 2 );
-        bb[0] = ( b0 << 3 ) | ( b0 >> 2 );
-        bb[1] = ( b1 << 3 ) | ( b1 >> 2 );
+        br[0] = g_expand<5>[r0];
+        br[1] = g_expand<5>[r1];
+        bg[0] = g_expand<5>[g0];
+        bg[1] = g_expand<5>[g1];
+        bb[0] = g_expand<5>[b0];
+        bb[1] = g_expand<5>[b1];
     }
     else
     {
@@ -669,7 +623,7 @@ static void DecodeRGBAPart( uint64_t d, uint64_t alpha, uint32_t* dst, uint32_t
 
     const int32_t base = alpha >> 56;
     const int32_t mul = ( alpha >> 52 ) & 0xF;
-    const auto atbl = g_alpha[( alpha >> 48 ) & 0xF];
+    const auto& atbl = g_eacModifiers[( alpha >> 48 ) & 0xF];
 
     if( d & 0x1 )
     {
@@ -677,21 +631,21 @@ static void DecodeRGBAPart( uint64_t d, uint64_t alpha, uint32_t* dst, uint32_t
         {
             for( int j=0; j<4; j++ )
             {
-                const auto mod = g_table[tcw[j/2]][idx & 0x3];
+                const auto& mod = g_etcModifiers[tcw[j/2]][idx & 0x3];
                 const auto r = br[j/2] + mod;
                 const auto g = bg[j/2] + mod;
                 const auto b = bb[j/2] + mod;
                 const auto amod = atbl[(alpha >> ( 45 - j*3 - i*12 )) & 0x7];
-                const uint32_t a = clampu8( base + amod * mul );
+                const uint32_t a = ClampU8( base + amod * mul );
                 if( ( ( r | g | b ) & ~0xFF ) == 0 )
                 {
                     dst[j*w+i] = r | ( g << 8 ) | ( b << 16 ) | ( a << 24 );
                 }
                 else
                 {
-                    const auto rc = clampu8( r );
-                    const auto gc = clampu8( g );
-                    const auto bc = clampu8( b );
+                    const auto rc = ClampU8( r );
+                    const auto gc = ClampU8( g );
+                    const auto bc = ClampU8( b );
                     dst[j*w+i] = rc | ( gc << 8 ) | ( bc << 16 ) | ( a << 24 );
                 }
                 idx >>= 2;
@@ -702,7 +656,7 @@ static void DecodeRGBAPart( uint64_t d, uint64_t alpha, uint32_t* dst, uint32_t
     {
         for( int i=0; i<4; i++ )
         {
-            const auto tbl = g_table[tcw[i/2]];
+            const auto& tbl = g_etcModifiers[tcw[i/2]];
             const auto cr = br[i/2];
             const auto cg = bg[i/2];
             const auto cb = bb[i/2];
@@ -714,16 +668,16 @@ static void DecodeRGBAPart( uint64_t d, uint64_t alpha, uint32_t* dst, uint32_t
                 const auto g = cg + mod;
                 const auto b = cb + mod;
                 const auto amod = atbl[(alpha >> ( 45 - j*3 - i*12 )) & 0x7];
-                const uint32_t a = clampu8( base + amod * mul );
+                const uint32_t a = ClampU8( base + amod * mul );
                 if( ( ( r | g | b ) & ~0xFF ) == 0 )
                 {
                     dst[j*w+i] = r | ( g << 8 ) | ( b << 16 ) | ( a << 24 );
                 }
                 else
                 {
-                    const auto rc = clampu8( r );
-                    const auto gc = clampu8( g );
-                    const auto bc = clampu8( b );
+                    const auto rc = ClampU8( r );
+                    const auto gc = ClampU8( g );
+                    const auto bc = ClampU8( b );
                     dst[j*w+i] = rc | ( gc << 8 ) | ( bc << 16 ) | ( a << 24 );
                 }
                 idx >>= 2;
@@ -738,14 +692,14 @@ static void DecodeRPart( uint64_t r, uint32_t* dst, uint32_t w )
 
     const int32_t base = ( r >> 56 )*8+4;
     const int32_t mul = ( r >> 52 ) & 0xF;
-    const auto atbl = g_alpha[( r >> 48 ) & 0xF];
+    const auto& atbl = g_eacModifiers[( r >> 48 ) & 0xF];
 
     for( int i=0; i<4; i++ )
     {
         for ( int j=0; j<4; j++ )
         {
             const auto amod = atbl[(r >> ( 45 - j*3 - i*12 )) & 0x7];
-            const uint32_t rc = clampu8( ( base + amod * g_alpha11Mul[mul] )/8 );
+            const uint32_t rc = ClampU8( ( base + amod * g_eac11Mul[mul] )/8 );
             dst[j*w+i] = rc | 0xFF000000;
         }
     }
@@ -758,95 +712,68 @@ static void DecodeRGPart( uint64_t r, uint64_t g, uint32_t* dst, uint32_t w )
 
     const int32_t rbase = ( r >> 56 )*8+4;
     const int32_t rmul = ( r >> 52 ) & 0xF;
-    const auto rtbl = g_alpha[( r >> 48 ) & 0xF];
+    const auto& rtbl = g_eacModifiers[( r >> 48 ) & 0xF];
 
     const int32_t gbase = ( g >> 56 )*8+4;
     const int32_t gmul = ( g >> 52 ) & 0xF;
-    const auto gtbl = g_alpha[( g >> 48 ) & 0xF];
+    const auto& gtbl = g_eacModifiers[( g >> 48 ) & 0xF];
 
     for( int i=0; i<4; i++ )
     {
         for( int j=0; j<4; j++ )
         {
             const auto rmod = rtbl[(r >> ( 45 - j*3 - i*12 )) & 0x7];
-            const uint32_t rc = clampu8( ( rbase + rmod * g_alpha11Mul[rmul] )/8 );
+            const uint32_t rc = ClampU8( ( rbase + rmod * g_eac11Mul[rmul] )/8 );
 
             const auto gmod = gtbl[(g >> ( 45 - j*3 - i*12 )) & 0x7];
-            const uint32_t gc = clampu8( ( gbase + gmod * g_alpha11Mul[gmul] )/8 );
+            const uint32_t gc = ClampU8( ( gbase + gmod * g_eac11Mul[gmul] )/8 );
 
             dst[j*w+i] = rc | (gc << 8) | 0xFF000000;
         }
     }
 }
 
-static void DecodeRgb( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+static void DecodeRgb( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    for( int y=0; y<height/4; y++ )
-    {
-        for( int x=0; x<width/4; x++ )
-        {
-            uint64_t d = *src++;
-            DecodeRGBPart( d, dst, width );
-            dst += 4;
-        }
-        dst += width * 3;
-    }
+    DecodeBlockRows<1>( dst, src, width, height, td, []( const uint64_t* s, uint32_t* d, uint32_t w ) {
+        DecodeRGBPart( s[0], d, w );
+    } );
 }
 
-static void DecodeRgba( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+static void DecodeRgba( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    for( int y=0; y<height/4; y++ )
-    {
-        for( int x=0; x<width/4; x++ )
-        {
-            uint64_t a = *src++;
-            uint64_t d = *src++;
-            DecodeRGBAPart( d, a, dst, width );
-            dst += 4;
-        }
-        dst += width * 3;
-    }
+    DecodeBlockRows<2>( dst, src, width, height, td, []( const uint64_t* s, uint32_t* d, uint32_t w ) {
+        DecodeRGBAPart( s[1], s[0], d, w );
+    } );
 }
 
-static void DecodeR( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+static void DecodeR( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    for( int y=0; y<height/4; y++ )
-    {
-        for( int x=0; x<width/4; x++ )
-        {
-            uint64_t d = *src++;
-            DecodeRPart( d, dst, width );
-            dst += 4;
-        }
-        dst += width * 3;
-    }
+    DecodeBlockRows<1>( dst, src, width, height, td, []( const uint64_t* s, uint32_t* d, uint32_t w ) {
+        DecodeRPart( s[0], d, w );
+    } );
 }
 
-static void DecodeRg( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height )
+static void DecodeRg( uint32_t* dst, const uint64_t* src, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    for( int y=0; y<height/4; y++ )
-    {
-        for( int x=0; x<width/4; x++ )
-        {
-            uint64_t r = *src++;
-            uint64_t g = *src++;
-            DecodeRGPart( r, g, dst, width );
-            dst += 4;
-        }
-        dst += width * 3;
-    }
+    DecodeBlockRows<2>( dst, src, width, height, td, []( const uint64_t* s, uint32_t* d, uint32_t w ) {
+        DecodeRGPart( s[0], s[1], d, w );
+    } );
 }
 
-PvrLoader::PvrLoader( std::shared_ptr<FileWrapper> file )
+PvrLoader::PvrLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td )
     : m_file( std::move( file ) )
+    , m_td( td )
 {
     fseek( *m_file, 0, SEEK_SET );
     uint32_t magic;
     m_valid = fread( &magic, 1, 4, *m_file ) == 4 && magic == 0x03525650;
     if( !m_valid ) return;
 
-    fseek( *m_file, 4*2, SEEK_SET );
-    fread( &m_format, 1, 4, *m_file );
+    uint32_t hdr[13] = {};
+    fseek( *m_file, 0, SEEK_SET );
+    fread( hdr, 4, 13, *m_file );
+    m_format = hdr[2];
 
     m_valid =
         m_format == 6  ||       // ETC1
@@ -854,6 +781,14 @@ PvrLoader::PvrLoader( std::shared_ptr<FileWrapper> file )
         m_format == 23 ||       // ETC2 RGBA
         m_format == 25 ||       // ETC2 R11
         m_format == 26;         // ETC2 RG11
+    if( !m_valid ) return;
+
+    m_width = hdr[7];
+    m_height = hdr[6];
+    m_depth = std::max( 1u, hdr[8] );
+    m_layers = std::max( 1u, hdr[9] ) * std::max( 1u, hdr[10] );    // Surfaces and faces
+    m_levels = std::min( std::max( 1u, hdr[11] ), 32u );
+    m_offset = 52 + hdr[12];
 }
 
 bool PvrLoader::IsValid() const
@@ -861,40 +796,73 @@ bool PvrLoader::IsValid() const
     return m_valid;
 }
 
+BitmapCompressed::Format PvrLoader::CompressedFormat()
+{
+    switch( m_format )
+    {
+    case 6:
+    case 22: return BitmapCompressed::Format::Etc2Rgb;
+    case 23: return BitmapCompressed::Format::Etc2Rgba;
+    default: return BitmapCompressed::Format::None;
+    }
+}
+
 bool PvrLoader::IsValidSignature(const uint8_t *buf, size_t size)
 {
     if( size < 4 ) return false;
     return *(uint32_t*)buf == 0x03525650;
 }
 
+bool PvrLoader::HasFastPreview()
+{
+    return m_valid && PreviewLevel() > 0;
+}
+
+uint32_t PvrLoader::Layers()
+{
+    return m_valid ? m_layers : 1;
+}
+
+ImageInfo PvrLoader::Probe()
+{
+    CheckPanic( m_valid, "Invalid PVR file" );
+    return {
+        .width = m_width,
+        .height = m_height
+    };
+}
+
 std::unique_ptr<Bitmap> PvrLoader::Load()
 {
     CheckPanic( m_valid, "Invalid PVR file" );
+    CheckPanic( m_layer < m_layers, "Invalid PVR layer" );
 
     FileBuffer buf( m_file );
-    const auto ptr = (uint32_t*)buf.data();
 
-    uint32_t width = *(ptr+7);
-    uint32_t height = *(ptr+6);
+    auto level = PreviewLevel();
+    if( LevelOffset( level ) + LevelSize( level ) > buf.size() ) level = 0;
+    CheckPanic( LevelOffset( level ) + LevelSize( level ) <= buf.size(), "PVR file is truncated" );
 
-    auto bmp = std::make_unique<Bitmap>( width, height );
+    const uint32_t width = std::max( 1u, m_width >> level );
+    const uint32_t height = std::max( 1u, m_height >> level );
+    const auto src = (const uint64_t*)( buf.data() + LevelOffset( level ) );
 
-    const auto offset = 52 + *(ptr+12);
+    auto bmp = std::make_unique<Bitmap>( width, height );
 
     switch( m_format )
     {
     case 6:
     case 22:
-        DecodeRgb( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + offset), width, height );
+        DecodeRgb( (uint32_t*)bmp->Data(), src, width, height, m_td );
         break;
     case 23:
-        DecodeRgba( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + offset), width, height );
+        DecodeRgba( (uint32_t*)bmp->Data(), src, width, height, m_td );
         break;
     case 25:
-        DecodeR( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + offset), width, height );
+        DecodeR( (uint32_t*)bmp->Data(), src, width, height, m_td );
         break;
     case 26:
-        DecodeRg( (uint32_t*)bmp->Data(), (const uint64_t*)(buf.data() + offset), width, height );
+        DecodeRg( (uint32_t*)bmp->Data(), src, width, height, m_td );
         break;
     default:
         Panic( "Unsupported PVR format" );
@@ -902,3 +870,58 @@ std::unique_ptr<Bitmap> PvrLoader::Load()
 
     return bmp;
 }
+
+std::unique_ptr<BitmapCompressed> PvrLoader::LoadCompressed()
+{
+    CheckPanic( m_valid, "Invalid PVR file" );
+    CheckPanic( m_layer < m_layers, "Invalid PVR layer" );
+    const auto format = CompressedFormat();
+    CheckPanic( format != BitmapCompressed::Format::None, "PVR format can't be loaded compressed" );
+
+    FileBuffer buf( m_file );
+
+    // Files may claim more levels than they contain.
+    uint32_t levels = 0;
+    while( levels < m_levels && LevelOffset( levels ) + LevelSize( levels ) <= buf.size() ) levels++;
+    CheckPanic( levels > 0, "PVR file is truncated" );
+
+    // Mip levels are interleaved with surfaces and faces, so each one is copied separately
+    auto bmp = std::make_unique<BitmapCompressed>( format, m_width, m_height, levels );
+    const auto& lv = bmp->Levels();
+    for( uint32_t i=0; i<lv.size(); i++ )
+    {
+        memcpy( bmp->Data() + lv[i].offset, buf.data() + LevelOffset( i ), lv[i].size );
+    }
+
+    return bmp;
+}
+
+size_t PvrLoader::LevelSize( uint32_t level ) const
+{
+    const auto block = ( m_format == 23 || m_format == 26 ) ? 16 : 8;
+    const auto w = std::max( 1u, m_width >> level );
+    const auto h = std::max( 1u, m_height >> level );
+    return size_t( ( w + 3 ) / 4 ) * ( ( h + 3 ) / 4 ) * block;
+}
+
+size_t PvrLoader::LevelOffset( uint32_t level ) const
+{
+    // For each level, all surfaces, then faces, then depth slices. Only the first slice of 3D textures is read.
+    size_t offset = m_offset;
+    for( uint32_t i=0; i<level; i++ ) offset += LevelSize( i ) * m_depth * m_layers;
+    return offset + LevelSize( level ) * m_depth * m_layer;
+}
+
+uint32_t PvrLoader::PreviewLevel() const
+{
+    auto level = (uint32_t)std::countr_zero( TargetScale( m_width, m_height, 1u << ( m_levels - 1 ) ) );
+
+    // The software decoders only handle whole blocks
+    auto whole = [this]( uint32_t level ) {
+        const auto w = m_width >> level;
+        const auto h = m_height >> level;
+        return w >= 4 && h >= 4 && ( w & 3 ) == 0 && ( h & 3 ) == 0;
+    };
+    while( level > 0 && !whole( level ) ) level--;
+    return level;
+}
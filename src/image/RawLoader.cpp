@@ -1,67 +1,53 @@
 #include <libraw.h>
 #include <stdint.h>
 #include <string.h>
+#include <tracy/Tracy.hpp>
 
+#include "JpgLoader.hpp"
 #include "RawLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapHdr.hpp"
-#include "util/FileWrapper.hpp"
+#include "util/DataBuffer.hpp"
+#include "util/FileBuffer.hpp"
+#include "util/Logs.hpp"
+#include "util/NoCopy.hpp"
 #include "util/Panic.hpp"
 
-class RawLoaderDataStream : public LibRaw_abstract_datastream
+namespace
+{
+// Keeps the embedded JPEG preview alive for as long as the JPEG loader reads from it.
+class RawPreviewBuffer : public DataBuffer
 {
 public:
-    RawLoaderDataStream( std::shared_ptr<FileWrapper> _file ) : file( std::move( _file ) )
+    explicit RawPreviewBuffer( libraw_processed_image_t* img )
+        : DataBuffer( (const char*)img->data, img->data_size )
+        , m_img( img )
     {
-        fseek( *file, 0, SEEK_END );
-        sz = ftell( *file );
-        fseek( *file, 0, SEEK_SET );
     }
 
-    int valid() override { return 1; }
-    int read(void *ptr, size_t size, size_t nmemb) override { return fread( ptr, size, nmemb, *file ); }
-    int eof() override { return feof( *file ); }
-    int seek(INT64 o, int whence) override { return fseek( *file, o, whence ); }
-    INT64 tell() override { return ftell( *file ); }
-    INT64 size() override { return sz; }
-    int get_char() override { return fgetc( *file ); }
-    char *gets(char *str, int sz) override { if( sz < 1 ) return nullptr; return fgets( str, sz, *file ); }
-    int scanf_one(const char *fmt, void *val) override { return fscanf( *file, fmt, val ); }
-    const char *fname() override { return nullptr; }
+    ~RawPreviewBuffer() override { LibRaw::dcraw_clear_mem( m_img ); }
+
+    NoCopy( RawPreviewBuffer );
 
 private:
-    std::shared_ptr<FileWrapper> file;
-    int64_t sz;
+    libraw_processed_image_t* m_img;
 };
 
-RawLoader::RawLoader( const std::shared_ptr<FileWrapper>& file )
-    : m_raw( std::make_unique<LibRaw>() )
-    , m_stream( std::make_unique<RawLoaderDataStream>( file ) )
-{
-    m_valid = m_raw->open_datastream( m_stream.get() ) == 0;
-}
-
-RawLoader::~RawLoader()
-{
-}
-
-bool RawLoader::IsValid() const
+// LibRaw flip values, as EXIF orientation
+int FlipToOrientation( int flip )
 {
-    return m_valid;
+    switch( flip )
+    {
+    case 3: return 3;
+    case 5: return 8;
+    case 6: return 6;
+    default: return 0;
+    }
 }
 
-std::unique_ptr<Bitmap> RawLoader::Load()
+std::unique_ptr<Bitmap> ToBitmap( const libraw_processed_image_t* img, int orientation = 0 )
 {
-    CheckPanic( m_valid, "Invalid RAW file" );
-
-    auto params = m_raw->output_params_ptr();
-    params->use_camera_wb = 1;
-
-    m_raw->unpack();
-    m_raw->dcraw_process();
-    auto img = m_raw->dcraw_make_mem_image();
-
-    auto bmp = std::make_unique<Bitmap>( img->width, img->height );
+    auto bmp = std::make_unique<Bitmap>( img->width, img->height, orientation );
     auto src = img->data;
     auto dst = (uint32_t*)bmp->Data();
     auto sz = img->width * img->height;
@@ -101,6 +87,64 @@ std::unique_ptr<Bitmap> RawLoader::Load()
         break;
     }
 
+    return bmp;
+}
+}
+
+RawLoader::RawLoader( const std::shared_ptr<FileWrapper>& file, TaskDispatch* td )
+    : m_buf( std::make_unique<FileBuffer>( file ) )
+    , m_raw( std::make_unique<LibRaw>() )
+    , m_td( td )
+{
+    m_valid = m_raw->open_buffer( m_buf->data(), m_buf->size() ) == 0;
+}
+
+RawLoader::~RawLoader()
+{
+}
+
+bool RawLoader::IsValid() const
+{
+    return m_valid;
+}
+
+bool RawLoader::HasFastPreview()
+{
+    return m_valid && ( PreviewCovers() || HalfSize() );
+}
+
+ImageInfo RawLoader::Probe()
+{
+    CheckPanic( m_valid, "Invalid RAW file" );
+
+    const auto& sizes = m_raw->imgdata.sizes;
+    return {
+        .width = sizes.width,
+        .height = sizes.height,
+        .orientation = FlipToOrientation( sizes.flip ),
+        .hdr = true
+    };
+}
+
+std::unique_ptr<Bitmap> RawLoader::Load()
+{
+    CheckPanic( m_valid, "Invalid RAW file" );
+
+    auto params = m_raw->output_params_ptr();
+    params->use_camera_wb = 1;
+    SetupScale();
+
+    if( PreviewCovers() )
+    {
+        if( auto bmp = LoadPreview(); bmp ) return bmp;
+        mclog( LogLevel::Info, "RAW: Embedded preview can't be used" );
+    }
+
+    m_raw->unpack();
+    m_raw->dcraw_process();
+    auto img = m_raw->dcraw_make_mem_image();
+    auto bmp = ToBitmap( img );
+
     LibRaw::dcraw_clear_mem( img );
     return bmp;
 }
@@ -116,6 +160,7 @@ std::unique_ptr<BitmapHdr> RawLoader::LoadHdr( Colorspace colorspace )
     params->output_color = colorspace == Colorspace::BT709 ? 1 : 8;
     params->output_bps = 16;
     params->no_auto_bright = 1;
+    SetupScale();
 
     m_raw->unpack();
     m_raw->dcraw_process();
@@ -159,3 +204,76 @@ std::unique_ptr<BitmapHdr> RawLoader::LoadHdr( Colorspace colorspace )
     LibRaw::dcraw_clear_mem( img );
     return bmp;
 }
+
+bool RawLoader::PreviewCovers() const
+{
+    // Previews are stored in sensor orientation, like the raw data. Flip bit 2 swaps the axes.
+    const auto& thumb = m_raw->imgdata.thumbnail;
+    const auto transposed = m_raw->imgdata.sizes.flip & 4;
+    if( thumb.twidth == 0 || thumb.theight == 0 ) return false;
+    return CoversTarget( transposed ? thumb.theight : thumb.twidth, transposed ? thumb.twidth : thumb.theight );
+}
+
+std::unique_ptr<Bitmap> RawLoader::LoadPreview()
+{
+    ZoneScoped;
+
+    if( m_raw->unpack_thumb() != LIBRAW_SUCCESS ) return nullptr;
+
+    int err;
+    auto img = m_raw->dcraw_make_mem_thumb( &err );
+    if( !img ) return nullptr;
+
+    const auto orientation = FlipToOrientation( m_raw->imgdata.sizes.flip );
+    std::unique_ptr<Bitmap> bmp;
+    if( img->type == LIBRAW_IMAGE_JPEG )
+    {
+        JpgLoader jpg( std::make_shared<RawPreviewBuffer>( img ), m_td );
+        if( !jpg.IsValid() ) return nullptr;
+        jpg.SetTargetSize( m_targetWidth, m_targetHeight );
+        bmp = jpg.Load();
+        if( !bmp ) return nullptr;
+
+        // Some cameras tag the preview with its own orientation, otherwise it is in sensor orientation
+        if( bmp->Orientation() <= 1 )
+        {
+            switch( orientation )
+            {
+            case 3: bmp->Rotate180(); break;
+            case 6: bmp->Rotate90( m_td ); break;
+            case 8: bmp->Rotate270( m_td ); break;
+            default: break;
+            }
+        }
+    }
+    else if( img->type == LIBRAW_IMAGE_BITMAP && img->bits == 8 && ( img->colors == 1 || img->colors == 3 ) )
+    {
+        bmp = ToBitmap( img, orientation );
+        LibRaw::dcraw_clear_mem( img );
+    }
+    else
+    {
+        LibRaw::dcraw_clear_mem( img );
+        return nullptr;
+    }
+
+    mclog( LogLevel::Info, "RAW: Using %ux%u embedded preview", bmp->Width(), bmp->Height() );
+    return bmp;
+}
+
+bool RawLoader::HalfSize() const
+{
+    // Half size mode skips demosaicing and takes each 2x2 Bayer quad as one pixel. Flip bit 2 swaps the axes.
+    const auto& sizes = m_raw->imgdata.sizes;
+    const auto transposed = sizes.flip & 4;
+    return TargetScale( transposed ? sizes.height : sizes.width, transposed ? sizes.width : sizes.height, 2 ) > 1;
+}
+
+void RawLoader::SetupScale()
+{
+    if( HalfSize() )
+    {
+        mclog( LogLevel::Info, "RAW: Decoding at half size" );
+        m_raw->output_params_ptr()->half_size = 1;
+    }
+}
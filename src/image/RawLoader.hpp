@@ -6,26 +6,36 @@
 #include "util/NoCopy.hpp"
 
 class Bitmap;
+class FileBuffer;
 class FileWrapper;
 class LibRaw;
-class RawLoaderDataStream;
+class TaskDispatch;
 
 class RawLoader : public ImageLoader
 {
 public:
-    explicit RawLoader( const std::shared_ptr<FileWrapper>& file );
+    explicit RawLoader( const std::shared_ptr<FileWrapper>& file, TaskDispatch* td = nullptr );
     ~RawLoader() override;
     NoCopy( RawLoader );
 
     [[nodiscard]] bool IsValid() const override;
     [[nodiscard]] bool IsHdr() override { return true; }
+    [[nodiscard]] bool HasFastPreview() override;
+    [[nodiscard]] ImageInfo Probe() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
     [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
 
 private:
+    // Whether the embedded preview is large enough for the target size.
+    [[nodiscard]] bool PreviewCovers() const;
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadPreview();
+    [[nodiscard]] bool HalfSize() const;
+    void SetupScale();
+
+    std::unique_ptr<FileBuffer> m_buf;
     std::unique_ptr<LibRaw> m_raw;
-    std::unique_ptr<RawLoaderDataStream> m_stream;
 
+    TaskDispatch* m_td;
     bool m_valid;
 };
@@ -1,24 +1,134 @@
-#include <lcms2.h>
 #include <string.h>
+#include <vector>
 
 #define STB_IMAGE_IMPLEMENTATION
 #define STBI_NO_JPEG
 #define STBI_NO_PNG
+#define STBI_NO_HDR
 #include <stb_image.h>
 
 #include "StbImageLoader.hpp"
 #include "util/Bitmap.hpp"
-#include "util/BitmapHdr.hpp"
+#include "util/BitmapAnimStream.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/NoCopy.hpp"
 #include "util/Panic.hpp"
 
+namespace
+{
+// Counts the images in a GIF file, skipping over the LZW data without decoding it.
+uint32_t CountGifFrames( const uint8_t* data, size_t size )
+{
+    if( size < 13 || memcmp( data, "GIF8", 4 ) != 0 ) return 0;
+
+    size_t pos = 13;
+    if( data[10] & 0x80 ) pos += 3 * ( 2 << ( data[10] & 7 ) );
+
+    auto skipSubBlocks = [data, size, &pos] {
+        while( pos < size && data[pos] != 0 ) pos += data[pos] + 1;
+        pos++;
+    };
+
+    uint32_t frames = 0;
+    while( pos < size )
+    {
+        switch( data[pos] )
+        {
+        case 0x21:  // Extension
+            pos += 2;
+            skipSubBlocks();
+            break;
+        case 0x2C:  // Image descriptor, optional local color table, LZW minimum code size, image data
+        {
+            if( pos + 10 > size ) return frames;
+            const auto flags = data[pos+9];
+            pos += 10;
+            if( flags & 0x80 ) pos += 3 * ( 2 << ( flags & 7 ) );
+            pos++;
+            skipSubBlocks();
+            frames++;
+            break;
+        }
+        default:    // Trailer
+            return frames;
+        }
+    }
+    return frames;
+}
+
+// Uses the stb_image GIF internals directly, as the public API only decodes all frames at once.
+class GifAnimSource : public BitmapAnimStream::Source
+{
+public:
+    explicit GifAnimSource( std::unique_ptr<FileBuffer>&& buf )
+        : m_buf( std::move( buf ) )
+        , m_gif( std::make_unique<stbi__gif>() )
+    {
+        memset( m_gif.get(), 0, sizeof( stbi__gif ) );
+        Rewind();
+    }
+
+    ~GifAnimSource() override
+    {
+        Release();
+    }
+
+    NoCopy( GifAnimSource );
+
+    bool Next( BitmapAnim::Frame& frame ) override
+    {
+        int comp;
+        auto out = stbi__gif_load_next( &m_ctx, m_gif.get(), &comp, 4, m_twoBack.empty() ? nullptr : m_twoBack.data() );
+        if( !out || out == (stbi_uc*)&m_ctx ) return false;
+
+        const auto sz = size_t( m_gif->w ) * m_gif->h * 4;
+        auto bmp = std::make_shared<Bitmap>( m_gif->w, m_gif->h );
+        memcpy( bmp->Data(), out, sz );
+
+        // The restore to previous disposal method needs the frame before the last one
+        m_twoBack.swap( m_prev );
+        m_prev.assign( out, out + sz );
+
+        frame = { std::move( bmp ), uint32_t( m_gif->delay ) * 1000 };
+        return true;
+    }
+
+    void Rewind() override
+    {
+        Release();
+        memset( m_gif.get(), 0, sizeof( stbi__gif ) );
+        stbi__start_mem( &m_ctx, (const stbi_uc*)m_buf->data(), int( m_buf->size() ) );
+        m_prev.clear();
+        m_twoBack.clear();
+    }
+
+private:
+    void Release()
+    {
+        STBI_FREE( m_gif->out );
+        STBI_FREE( m_gif->history );
+        STBI_FREE( m_gif->background );
+    }
+
+    std::unique_ptr<FileBuffer> m_buf;
+    std::unique_ptr<stbi__gif> m_gif;
+    stbi__context m_ctx;
+
+    std::vector<stbi_uc> m_prev;
+    std::vector<stbi_uc> m_twoBack;
+};
+}
+
 StbImageLoader::StbImageLoader( std::shared_ptr<FileWrapper> file )
     : m_file( std::move( file ) )
 {
     fseek( *m_file, 0, SEEK_SET );
     int w, h, comp;
     m_valid = stbi_info_from_file( *m_file, &w, &h, &comp ) == 1;
-    m_hdr = stbi_is_hdr_from_file( *m_file );
+    m_frames = -1;
+    m_width = m_valid ? w : 0;
+    m_height = m_valid ? h : 0;
 }
 
 bool StbImageLoader::IsValid() const
@@ -26,24 +136,44 @@ bool StbImageLoader::IsValid() const
     return m_valid;
 }
 
-bool StbImageLoader::IsHdr()
+bool StbImageLoader::IsAnimated()
 {
-    return m_hdr;
+    if( !m_valid ) return false;
+    if( m_frames < 0 )
+    {
+        uint8_t hdr[4];
+        fseek( *m_file, 0, SEEK_SET );
+        if( fread( hdr, 1, 4, *m_file ) == 4 && memcmp( hdr, "GIF8", 4 ) == 0 )
+        {
+            FileBuffer buf( m_file );
+            m_frames = CountGifFrames( (const uint8_t*)buf.data(), buf.size() );
+        }
+        else
+        {
+            m_frames = 1;
+        }
+    }
+    return m_frames > 1;
 }
 
-bool StbImageLoader::PreferHdr()
+ImageInfo StbImageLoader::Probe()
 {
-    return true;
+    CheckPanic( m_valid, "Invalid stb_image file" );
+    return {
+        .width = m_width,
+        .height = m_height,
+        .animated = IsAnimated()
+    };
 }
 
 std::unique_ptr<Bitmap> StbImageLoader::Load()
 {
     CheckPanic( m_valid, "Invalid stb_image file" );
 
-    fseek( *m_file, 0, SEEK_SET );
+    FileBuffer buf( m_file );
 
     int w, h, comp;
-    auto data = stbi_load_from_file( *m_file, &w, &h, &comp, 4 );
+    auto data = stbi_load_from_memory( (const stbi_uc*)buf.data(), buf.size(), &w, &h, &comp, 4 );
     if( data == nullptr ) return nullptr;
 
     auto bmp = std::make_unique<Bitmap>( w, h );
@@ -53,52 +183,10 @@ std::unique_ptr<Bitmap> StbImageLoader::Load()
     return bmp;
 }
 
-std::unique_ptr<BitmapHdr> StbImageLoader::LoadHdr( Colorspace colorspace )
+std::unique_ptr<BitmapAnimStream> StbImageLoader::LoadAnimStream( TaskDispatch* td )
 {
-    CheckPanic( m_valid, "Invalid stb_image file" );
-    if( !m_hdr ) return nullptr;
-
-    fseek( *m_file, 0, SEEK_SET );
-
-    int w, h, comp;
-    auto data = stbi_loadf_from_file( *m_file, &w, &h, &comp, 4 );
-    if( data == nullptr ) return nullptr;
-
-    auto hdr = std::make_unique<BitmapHdr>( w, h, colorspace );
-    if( colorspace == Colorspace::BT709 )
-    {
-        memcpy( hdr->Data(), data, w * h * 4 * sizeof( float ) );
-    }
-    else if( colorspace == Colorspace::BT2020 )
-    {
-        cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-        cmsToneCurve* linear3[3] = { linear, linear, linear };
-
-        auto profileIn = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-        auto profileOut = cmsCreateRGBProfile( &white709, &primaries2020, linear3 );
-        auto transform = cmsCreateTransform( profileIn, TYPE_RGBA_FLT, profileOut, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, 0 );
-
-        cmsDoTransform( transform, data, hdr->Data(), w * h );
+    if( !IsAnimated() ) return nullptr;
 
-        cmsDeleteTransform( transform );
-        cmsCloseProfile( profileIn );
-        cmsCloseProfile( profileOut );
-        cmsFreeToneCurve( linear );
-
-        auto ptr = hdr->Data() + 3;
-        auto sz = w * h;
-        do
-        {
-            *ptr = 1;
-            ptr += 4;
-        }
-        while( --sz );
-    }
-    else
-    {
-        Panic( "Invalid colorspace" );
-    }
-
-    stbi_image_free( data );
-    return hdr;
+    auto source = std::make_unique<GifAnimSource>( std::make_unique<FileBuffer>( m_file ) );
+    return std::make_unique<BitmapAnimStream>( std::move( source ), m_width, m_height, m_frames, td );
 }
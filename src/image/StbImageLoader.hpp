@@ -1,6 +1,7 @@
 #pragma once
 
 #include <memory>
+#include <stdint.h>
 
 #include "ImageLoader.hpp"
 #include "util/NoCopy.hpp"
@@ -15,15 +16,17 @@ public:
     NoCopy( StbImageLoader );
 
     [[nodiscard]] bool IsValid() const override;
-    [[nodiscard]] bool IsHdr() override;
-    [[nodiscard]] bool PreferHdr() override;
+    [[nodiscard]] bool IsAnimated() override;
+    [[nodiscard]] ImageInfo Probe() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
-    [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
+    [[nodiscard]] std::unique_ptr<BitmapAnimStream> LoadAnimStream( TaskDispatch* td ) override;
 
 private:
     bool m_valid;
-    bool m_hdr;
+    uint32_t m_width;
+    uint32_t m_height;
+    int m_frames;       // Negative until counted
 
     std::shared_ptr<FileWrapper> m_file;
 };
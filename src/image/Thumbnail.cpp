@@ -0,0 +1,239 @@
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <string_view>
+#include <sys/stat.h>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+
+#include "ImageLoader.hpp"
+#include "PngLoader.hpp"
+#include "Thumbnail.hpp"
+#include "util/Bitmap.hpp"
+#include "util/FileBuffer.hpp"
+#include "util/FileWrapper.hpp"
+#include "util/Filesystem.hpp"
+#include "util/Home.hpp"
+#include "util/Logs.hpp"
+#include "util/Md5.hpp"
+#include "util/Url.hpp"
+
+struct ThumbnailCache::Source
+{
+    std::string path;       // Canonical
+    std::string uri;
+    std::string thumbnail;
+    int64_t mtime;
+    uint64_t size;
+    uint32_t pixels;
+};
+
+namespace
+{
+constexpr const char* SizeDirs[] = { "normal/", "large/", "x-large/", "xx-large/" };
+
+struct ThumbnailText
+{
+    std::string_view uri;
+    std::string_view mtime;
+    std::string_view size;
+};
+
+uint32_t ReadBe32( const uint8_t* ptr )
+{
+    return ( uint32_t( ptr[0] ) << 24 ) | ( ptr[1] << 16 ) | ( ptr[2] << 8 ) | ptr[3];
+}
+
+// Walks the chunk headers of a PNG file and collects the thumbnail keys of the tEXt chunks
+bool ReadText( const uint8_t* data, size_t size, ThumbnailText& text )
+{
+    if( size < 8 || !PngLoader::IsValidSignature( data, size ) ) return false;
+
+    size_t pos = 8;
+    while( pos + 8 <= size )
+    {
+        const auto len = ReadBe32( data + pos );
+        const auto type = data + pos + 4;
+        if( len > size - pos - 8 ) return false;
+        if( memcmp( type, "IEND", 4 ) == 0 ) break;
+
+        if( memcmp( type, "tEXt", 4 ) == 0 )
+        {
+            const auto chunk = std::string_view( (const char*)data + pos + 8, len );
+            const auto sep = chunk.find( '\0' );
+            if( sep != std::string_view::npos )
+            {
+                const auto key = chunk.substr( 0, sep );
+                const auto value = chunk.substr( sep + 1 );
+                if( key == "Thumb::URI" ) text.uri = value;
+                else if( key == "Thumb::MTime" ) text.mtime = value;
+                else if( key == "Thumb::Size" ) text.size = value;
+            }
+        }
+        pos += size_t( len ) + 12;
+    }
+    return true;
+}
+
+// Only the integer part is compared, as some writers store the modification time with a fraction
+bool MatchesNumber( std::string_view text, uint64_t value )
+{
+    const auto str = std::string( text );
+    char* end;
+    const auto parsed = strtoull( str.c_str(), &end, 10 );
+    return end != str.c_str() && parsed == value;
+}
+}
+
+ThumbnailCache::ThumbnailCache()
+{
+    const auto xdgCache = getenv( "XDG_CACHE_HOME" );
+    if( xdgCache && *xdgCache == '/' )
+    {
+        m_root = xdgCache;
+        m_root += "/thumbnails/";
+    }
+    else
+    {
+        m_root = GetHome();
+        if( !m_root.empty() ) m_root += "/.cache/thumbnails/";
+    }
+}
+
+std::unique_ptr<Bitmap> ThumbnailCache::Get( const char* path, Size size, TaskDispatch* td ) const
+{
+    ZoneScoped;
+
+    Source source;
+    const auto cached = GetSource( path, size, source );
+    if( cached )
+    {
+        if( auto thumbnail = Find( source ); thumbnail ) return thumbnail;
+    }
+
+    auto loader = GetImageLoader( path, ToneMap::Operator::PbrNeutral, td );
+    if( !loader ) return nullptr;
+
+    // Thumbnails record the size of the full image, in display orientation
+    const auto info = loader->Probe();
+    const auto swap = info.orientation >= 5 && info.orientation <= 8;
+    const auto imageWidth = swap ? info.height : info.width;
+    const auto imageHeight = swap ? info.width : info.height;
+
+    const auto pixels = Pixels( size );
+    loader->SetTargetSize( pixels, pixels );
+    auto bitmap = loader->Load();
+    if( !bitmap ) return nullptr;
+    bitmap->NormalizeOrientation( td );
+
+    const auto width = bitmap->Width();
+    const auto height = bitmap->Height();
+    if( width > pixels || height > pixels )
+    {
+        const auto scale = float( pixels ) / std::max( width, height );
+        const auto w = std::clamp<uint32_t>( uint32_t( width * scale + 0.5f ), 1, pixels );
+        const auto h = std::clamp<uint32_t>( uint32_t( height * scale + 0.5f ), 1, pixels );
+        bitmap = bitmap->ResizeNew( w, h, td );
+    }
+
+    if( cached ) Store( source, *bitmap, imageWidth != 0 ? imageWidth : width, imageHeight != 0 ? imageHeight : height );
+    return bitmap;
+}
+
+std::unique_ptr<Bitmap> ThumbnailCache::Find( const char* path, Size size ) const
+{
+    ZoneScoped;
+
+    Source source;
+    if( !GetSource( path, size, source ) ) return nullptr;
+    return Find( source );
+}
+
+bool ThumbnailCache::GetSource( const char* path, Size size, Source& source ) const
+{
+    if( m_root.empty() ) return false;
+
+    char* real = realpath( path, nullptr );
+    if( !real ) return false;
+    source.path = real;
+    free( real );
+
+    struct stat st;
+    if( stat( source.path.c_str(), &st ) != 0 ) return false;
+
+    source.uri = "file://" + UrlEncodePath( source.path );
+    source.thumbnail = m_root + SizeDirs[(int)size] + Md5Hex( source.uri.data(), source.uri.size() ) + ".png";
+    source.mtime = st.st_mtim.tv_sec;
+    source.size = st.st_size;
+    source.pixels = Pixels( size );
+    return true;
+}
+
+std::unique_ptr<Bitmap> ThumbnailCache::Find( const Source& source ) const
+{
+    auto file = std::make_shared<FileWrapper>( source.thumbnail.c_str(), "rb" );
+    if( !*file ) return nullptr;
+
+    std::shared_ptr<FileBuffer> buffer;
+    try
+    {
+        buffer = std::make_shared<FileBuffer>( file );
+    }
+    catch( FileBuffer::FileException& )
+    {
+        return nullptr;
+    }
+
+    // A thumbnail is valid only for the file it was made of, as last modified. The size is optional.
+    ThumbnailText text;
+    if( !ReadText( (const uint8_t*)buffer->data(), buffer->size(), text ) ||
+        text.uri != source.uri ||
+        !MatchesNumber( text.mtime, source.mtime ) ||
+        ( !text.size.empty() && !MatchesNumber( text.size, source.size ) ) )
+    {
+        return nullptr;
+    }
+
+    PngLoader loader( buffer );
+    if( !loader.IsValid() ) return nullptr;
+    auto bitmap = loader.Load();
+    if( !bitmap || bitmap->Width() > source.pixels || bitmap->Height() > source.pixels ) return nullptr;
+
+    mclog( LogLevel::Debug, "Using thumbnail %s for %s", source.thumbnail.c_str(), source.path.c_str() );
+    return bitmap;
+}
+
+void ThumbnailCache::Store( const Source& source, const Bitmap& thumbnail, uint32_t width, uint32_t height ) const
+{
+    ZoneScoped;
+
+    // Images in the thumbnail cache itself must not be thumbnailed
+    if( source.path.starts_with( m_root ) ) return;
+
+    const auto pos = source.thumbnail.find_last_of( '/' );
+    if( !CreateDirectories( source.thumbnail.substr( 0, pos ) ) ) return;
+
+    // Written to a temporary file in the same directory, so that readers never see a partial thumbnail.
+    // mkstemp() creates it with 0600 permissions, as the specification requires.
+    auto tmp = source.thumbnail + ".XXXXXX";
+    const auto fd = mkstemp( tmp.data() );
+    if( fd < 0 ) return;
+
+    const std::vector<std::pair<std::string, std::string>> text = {
+        { "Thumb::URI", source.uri },
+        { "Thumb::MTime", std::to_string( source.mtime ) },
+        { "Thumb::Size", std::to_string( source.size ) },
+        { "Thumb::Image::Width", std::to_string( width ) },
+        { "Thumb::Image::Height", std::to_string( height ) },
+        { "Software", "ModernCore" }
+    };
+    const auto ok = thumbnail.SavePng( fd, text );
+    if( close( fd ) == 0 && ok && rename( tmp.c_str(), source.thumbnail.c_str() ) == 0 )
+    {
+        mclog( LogLevel::Debug, "Stored thumbnail %s for %s", source.thumbnail.c_str(), source.path.c_str() );
+    }
+    else
+    {
+        unlink( tmp.c_str() );
+    }
+}
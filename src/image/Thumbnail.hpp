@@ -0,0 +1,42 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+
+class Bitmap;
+class TaskDispatch;
+
+// Thumbnails stored in the freedesktop.org thumbnail cache, so that they are shared with file managers and other
+// viewers. Thumbnails made elsewhere are used as long as they are valid for the current file.
+class ThumbnailCache
+{
+public:
+    enum class Size
+    {
+        Normal,     // 128 pixels
+        Large,      // 256 pixels
+        XLarge,     // 512 pixels
+        XXLarge     // 1024 pixels
+    };
+
+    ThumbnailCache();
+
+    // Returns the cached thumbnail if it is up to date. Otherwise the image is decoded, at a reduced resolution
+    // if the loader can do it, and the new thumbnail is stored. Null if the image can't be loaded. Thread safe.
+    [[nodiscard]] std::unique_ptr<Bitmap> Get( const char* path, Size size, TaskDispatch* td = nullptr ) const;
+
+    // Only looks up the cache, without loading the image.
+    [[nodiscard]] std::unique_ptr<Bitmap> Find( const char* path, Size size ) const;
+
+    [[nodiscard]] static constexpr uint32_t Pixels( Size size ) { return 128u << (int)size; }
+
+private:
+    struct Source;
+
+    [[nodiscard]] bool GetSource( const char* path, Size size, Source& source ) const;
+    [[nodiscard]] std::unique_ptr<Bitmap> Find( const Source& source ) const;
+    void Store( const Source& source, const Bitmap& thumbnail, uint32_t width, uint32_t height ) const;
+
+    std::string m_root;
+};
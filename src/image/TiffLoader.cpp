@@ -1,13 +1,116 @@
+#include <algorithm>
+#include <atomic>
+#include <memory>
 #include <string.h>
 #include <tiffio.h>
+#include <tracy/Tracy.hpp>
+#include <vector>
 
 #include "TiffLoader.hpp"
 #include "util/Bitmap.hpp"
+#include "util/BitmapHdr.hpp"
+#include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/TaskDispatch.hpp"
 
-TiffLoader::TiffLoader( std::shared_ptr<FileWrapper> file )
+namespace
+{
+// Read-only libtiff client over a memory buffer. Every worker opens its own handle, as a TIFF* can't be shared
+// between threads, and the file data is then read without any locking.
+struct TiffMemory
+{
+    const char* data;
+    toff_t size;
+    toff_t pos;
+};
+
+tsize_t MemRead( thandle_t handle, tdata_t buf, tsize_t size )
+{
+    auto mem = (TiffMemory*)handle;
+    const auto sz = std::min<toff_t>( size, mem->pos < mem->size ? mem->size - mem->pos : 0 );
+    memcpy( buf, mem->data + mem->pos, sz );
+    mem->pos += sz;
+    return sz;
+}
+
+tsize_t MemWrite( thandle_t, tdata_t, tsize_t )
+{
+    return 0;
+}
+
+toff_t MemSeek( thandle_t handle, toff_t offset, int whence )
+{
+    auto mem = (TiffMemory*)handle;
+    switch( whence )
+    {
+    case SEEK_SET: mem->pos = offset; break;
+    case SEEK_CUR: mem->pos += offset; break;
+    case SEEK_END: mem->pos = mem->size + offset; break;
+    default: return toff_t( -1 );
+    }
+    return mem->pos;
+}
+
+int MemClose( thandle_t )
+{
+    return 0;
+}
+
+toff_t MemSize( thandle_t handle )
+{
+    return ( (TiffMemory*)handle )->size;
+}
+
+// Lets libtiff decode strips straight from the buffer, without copying them first
+int MemMap( thandle_t handle, tdata_t* base, toff_t* size )
+{
+    auto mem = (TiffMemory*)handle;
+    *base = (tdata_t)mem->data;
+    *size = mem->size;
+    return 1;
+}
+
+void MemUnmap( thandle_t, tdata_t, toff_t )
+{
+}
+
+// Expands samples stored as read to RGBA in place, starting from the end
+template<typename T>
+void ExpandToRgba( T* data, size_t sz, uint16_t samples, T opaque )
+{
+    if( samples == 4 ) return;
+
+    auto src = data + sz * samples;
+    auto dst = data + sz * 4;
+    for( size_t i=0; i<sz; i++ )
+    {
+        src -= samples;
+        dst -= 4;
+        switch( samples )
+        {
+        case 1:
+            dst[3] = opaque;
+            dst[0] = dst[1] = dst[2] = src[0];
+            break;
+        case 2:
+            dst[3] = src[1];
+            dst[0] = dst[1] = dst[2] = src[0];
+            break;
+        default:
+            dst[3] = opaque;
+            dst[2] = src[2];
+            dst[1] = src[1];
+            dst[0] = src[0];
+            break;
+        }
+    }
+}
+}
+
+TiffLoader::TiffLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td )
     : m_file( std::move( file ) )
     , m_tiff( nullptr )
+    , m_td( td )
 {
     fseek( *m_file, 0, SEEK_SET );
     uint8_t hdr[4];
@@ -35,12 +138,52 @@ bool TiffLoader::IsValid() const
     return m_tiff != nullptr;
 }
 
+bool TiffLoader::IsHdr()
+{
+    return m_tiff && IsDirect( 16 );
+}
+
+ImageInfo TiffLoader::Probe()
+{
+    CheckPanic( m_tiff, "Invalid TIFF file" );
+
+    uint32_t width, height;
+    uint16_t orientation;
+    TIFFGetField( m_tiff, TIFFTAG_IMAGEWIDTH, &width );
+    TIFFGetField( m_tiff, TIFFTAG_IMAGELENGTH, &height );
+    TIFFGetFieldDefaulted( m_tiff, TIFFTAG_ORIENTATION, &orientation );
+
+    return {
+        .width = width,
+        .height = height,
+        .orientation = orientation,
+        .hdr = IsHdr()
+    };
+}
+
 std::unique_ptr<Bitmap> TiffLoader::Load()
 {
+    ZoneScoped;
+
     uint32_t width, height;
     TIFFGetField( m_tiff, TIFFTAG_IMAGEWIDTH, &width );
     TIFFGetField( m_tiff, TIFFTAG_IMAGELENGTH, &height );
 
+    if( IsDirect( 8 ) )
+    {
+        uint16_t samples, orientation;
+        TIFFGetFieldDefaulted( m_tiff, TIFFTAG_SAMPLESPERPIXEL, &samples );
+        TIFFGetFieldDefaulted( m_tiff, TIFFTAG_ORIENTATION, &orientation );
+
+        auto bmp = std::make_unique<Bitmap>( width, height, orientation );
+        if( ReadSamples( bmp->Data() ) )
+        {
+            ExpandToRgba<uint8_t>( bmp->Data(), size_t( width ) * height, samples, 0xFF );
+            return bmp;
+        }
+        if( TaskDispatch::IsCancelled() ) return nullptr;
+    }
+
     auto bmp = std::make_unique<Bitmap>( width, height );
 
     if( TIFFReadRGBAImageOriented( m_tiff, width, height, (uint32_t*)bmp->Data(), ORIENTATION_TOPLEFT ) == 0 )
@@ -50,3 +193,103 @@ std::unique_ptr<Bitmap> TiffLoader::Load()
 
     return bmp;
 }
+
+std::unique_ptr<BitmapHdr> TiffLoader::LoadHdr( Colorspace colorspace )
+{
+    ZoneScoped;
+    if( !IsHdr() ) return nullptr;
+
+    uint32_t width, height;
+    uint16_t samples, orientation;
+    TIFFGetField( m_tiff, TIFFTAG_IMAGEWIDTH, &width );
+    TIFFGetField( m_tiff, TIFFTAG_IMAGELENGTH, &height );
+    TIFFGetFieldDefaulted( m_tiff, TIFFTAG_SAMPLESPERPIXEL, &samples );
+    TIFFGetFieldDefaulted( m_tiff, TIFFTAG_ORIENTATION, &orientation );
+
+    auto data = std::make_unique<uint16_t[]>( size_t( width ) * height * 4 );
+    if( !ReadSamples( (uint8_t*)data.get() ) ) return nullptr;
+    ExpandToRgba<uint16_t>( data.get(), size_t( width ) * height, samples, 0xFFFF );
+
+    return ConvertSrgb16( data.get(), width, height, colorspace, orientation );
+}
+
+bool TiffLoader::IsDirect( uint16_t bitsPerSample )
+{
+    uint16_t bits = 0, samples = 0, planar = 0, photometric = 0, format = SAMPLEFORMAT_UINT;
+    TIFFGetFieldDefaulted( m_tiff, TIFFTAG_BITSPERSAMPLE, &bits );
+    TIFFGetFieldDefaulted( m_tiff, TIFFTAG_SAMPLESPERPIXEL, &samples );
+    TIFFGetFieldDefaulted( m_tiff, TIFFTAG_PLANARCONFIG, &planar );
+    TIFFGetFieldDefaulted( m_tiff, TIFFTAG_SAMPLEFORMAT, &format );
+    if( !TIFFGetField( m_tiff, TIFFTAG_PHOTOMETRIC, &photometric ) ) return false;
+
+    if( bits != bitsPerSample || format != SAMPLEFORMAT_UINT || planar != PLANARCONFIG_CONTIG ) return false;
+    if( photometric == PHOTOMETRIC_RGB ) return samples == 3 || samples == 4;
+    if( photometric == PHOTOMETRIC_MINISBLACK ) return samples == 1 || samples == 2;
+    return false;
+}
+
+bool TiffLoader::ReadSamples( uint8_t* dst )
+{
+    ZoneScoped;
+
+    const auto chunks = TIFFIsTiled( m_tiff ) ? TIFFNumberOfTiles( m_tiff ) : TIFFNumberOfStrips( m_tiff );
+    if( !m_td || m_td->NumWorkers() < 2 || chunks < 2 ) return ReadChunks( m_tiff, dst, 0, chunks );
+
+    FileBuffer buf( m_file );
+    std::atomic<bool> ok = true;
+    m_td->ParallelFor( 0, chunks, TaskDispatch::AdaptiveGrain, [&buf, &ok, dst]( size_t begin, size_t end ) {
+        TiffMemory mem = { buf.data(), buf.size(), 0 };
+        auto tiff = TIFFClientOpen( "<memory>", "r", &mem, MemRead, MemWrite, MemSeek, MemClose, MemSize, MemMap, MemUnmap );
+        if( !tiff || !ReadChunks( tiff, dst, begin, end ) ) ok.store( false, std::memory_order_relaxed );
+        if( tiff ) TIFFClose( tiff );
+    } );
+    return ok.load( std::memory_order_relaxed );
+}
+
+bool TiffLoader::ReadChunks( struct tiff* tiff, uint8_t* dst, size_t begin, size_t end )
+{
+    uint32_t width, height;
+    TIFFGetField( tiff, TIFFTAG_IMAGEWIDTH, &width );
+    TIFFGetField( tiff, TIFFTAG_IMAGELENGTH, &height );
+    const auto scanline = TIFFScanlineSize64( tiff );
+
+    if( !TIFFIsTiled( tiff ) )
+    {
+        uint32_t rps;
+        TIFFGetFieldDefaulted( tiff, TIFFTAG_ROWSPERSTRIP, &rps );
+        rps = std::min( rps, height );
+
+        // Strips of contiguous samples are decoded in place
+        for( size_t i=begin; i<end; i++ )
+        {
+            if( TaskDispatch::IsCancelled() ) return false;
+            const auto y = uint32_t( i * rps );
+            const auto rows = std::min( rps, height - y );
+            if( TIFFReadEncodedStrip( tiff, i, dst + y * scanline, rows * scanline ) < 0 ) return false;
+        }
+        return true;
+    }
+
+    uint32_t tw, th;
+    TIFFGetField( tiff, TIFFTAG_TILEWIDTH, &tw );
+    TIFFGetField( tiff, TIFFTAG_TILELENGTH, &th );
+    const auto across = ( width + tw - 1 ) / tw;
+    const auto pixel = scanline / width;
+
+    std::vector<uint8_t> tile( TIFFTileSize64( tiff ) );
+    for( size_t i=begin; i<end; i++ )
+    {
+        if( TaskDispatch::IsCancelled() ) return false;
+        if( TIFFReadEncodedTile( tiff, i, tile.data(), tile.size() ) < 0 ) return false;
+
+        const auto x = uint32_t( i % across ) * tw;
+        const auto y = uint32_t( i / across ) * th;
+        const auto cw = std::min( tw, width - x );
+        const auto ch = std::min( th, height - y );
+        for( uint32_t r=0; r<ch; r++ )
+        {
+            memcpy( dst + ( y + r ) * scanline + x * pixel, tile.data() + r * tw * pixel, cw * pixel );
+        }
+    }
+    return true;
+}
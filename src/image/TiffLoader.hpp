@@ -8,21 +8,34 @@
 
 class Bitmap;
 class FileWrapper;
+class TaskDispatch;
 struct tiff;
 
 class TiffLoader : public ImageLoader
 {
 public:
-    explicit TiffLoader( std::shared_ptr<FileWrapper> file );
+    explicit TiffLoader( std::shared_ptr<FileWrapper> file, TaskDispatch* td = nullptr );
     ~TiffLoader() override;
     NoCopy( TiffLoader );
 
     static bool IsValidSignature( const uint8_t* buf, size_t size );
 
     [[nodiscard]] bool IsValid() const override;
+    [[nodiscard]] bool IsHdr() override;
+    [[nodiscard]] ImageInfo Probe() override;
+
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
+    [[nodiscard]] std::unique_ptr<BitmapHdr> LoadHdr( Colorspace colorspace ) override;
 
 private:
+    // Whether the samples can be read as stored, which is the case for contiguous RGB(A) and grey(+alpha) data.
+    [[nodiscard]] bool IsDirect( uint16_t bitsPerSample );
+
+    // Decodes the strips or tiles in parallel, each worker through its own handle on the mapped file.
+    [[nodiscard]] bool ReadSamples( uint8_t* dst );
+    [[nodiscard]] static bool ReadChunks( struct tiff* tiff, uint8_t* dst, size_t begin, size_t end );
+
     std::shared_ptr<FileWrapper> m_file;
     struct tiff* m_tiff;
+    TaskDispatch* m_td;
 };
@@ -1,15 +1,74 @@
+#include <algorithm>
 #include <string.h>
+#include <tracy/Tracy.hpp>
+#include <utility>
+#include <webp/decode.h>
 #include <webp/demux.h>
 
 #include "WebpLoader.hpp"
 #include "util/Bitmap.hpp"
 #include "util/BitmapAnim.hpp"
+#include "util/BitmapAnimStream.hpp"
 #include "util/FileBuffer.hpp"
 #include "util/FileWrapper.hpp"
+#include "util/Logs.hpp"
+#include "util/NoCopy.hpp"
 #include "util/Panic.hpp"
 
+namespace
+{
+class WebpAnimSource : public BitmapAnimStream::Source
+{
+public:
+    WebpAnimSource( std::unique_ptr<FileBuffer>&& buf, WebPAnimDecoder* dec )
+        : m_buf( std::move( buf ) )
+        , m_dec( dec )
+        , m_prevDelay( 0 )
+    {
+        WebPAnimDecoderGetInfo( m_dec, &m_info );
+    }
+
+    ~WebpAnimSource() override
+    {
+        WebPAnimDecoderDelete( m_dec );
+    }
+
+    NoCopy( WebpAnimSource );
+
+    bool Next( BitmapAnim::Frame& frame ) override
+    {
+        int delay;
+        uint8_t* out;
+        if( !WebPAnimDecoderHasMoreFrames( m_dec ) || !WebPAnimDecoderGetNext( m_dec, &out, &delay ) ) return false;
+
+        auto bmp = std::make_shared<Bitmap>( m_info.canvas_width, m_info.canvas_height );
+        memcpy( bmp->Data(), out, m_info.canvas_width * m_info.canvas_height * 4 );
+
+        // Decoder timestamps are the end times of the frames, in ms
+        frame = { std::move( bmp ), uint32_t( delay - m_prevDelay ) * 1000 };
+        m_prevDelay = delay;
+        return true;
+    }
+
+    void Rewind() override
+    {
+        WebPAnimDecoderReset( m_dec );
+        m_prevDelay = 0;
+    }
+
+private:
+    std::unique_ptr<FileBuffer> m_buf;
+    WebPAnimDecoder* m_dec;
+    WebPAnimInfo m_info;
+    int m_prevDelay;
+};
+}
+
 WebpLoader::WebpLoader( std::shared_ptr<FileWrapper> file )
-    : m_file( std::move( file ) )
+    : m_hasAnimation( false )
+    , m_width( 0 )
+    , m_height( 0 )
+    , m_file( std::move( file ) )
     , m_dec( nullptr )
 {
     fseek( *m_file, 0, SEEK_SET );
@@ -34,7 +93,9 @@ bool WebpLoader::IsValid() const
 
 bool WebpLoader::IsAnimated()
 {
-    if( !m_dec && !Open() ) return false;
+    if( !m_buf && !Open() ) return false;
+    if( !m_hasAnimation ) return false;
+    if( !m_dec && !OpenAnim() ) return false;
 
     WebPAnimInfo info;
     WebPAnimDecoderGetInfo( m_dec, &info );
@@ -42,9 +103,22 @@ bool WebpLoader::IsAnimated()
     return info.frame_count > 1;
 }
 
+ImageInfo WebpLoader::Probe()
+{
+    if( !m_buf && !Open() ) return {};
+
+    return {
+        .width = m_width,
+        .height = m_height,
+        .animated = IsAnimated()
+    };
+}
+
 std::unique_ptr<Bitmap> WebpLoader::Load()
 {
-    if( !m_dec && !Open() ) return nullptr;
+    if( !m_buf && !Open() ) return nullptr;
+    if( !m_hasAnimation ) return LoadStill();
+    if( !m_dec && !OpenAnim() ) return nullptr;
 
     WebPAnimInfo info;
     WebPAnimDecoderGetInfo( m_dec, &info );
@@ -61,7 +135,8 @@ std::unique_ptr<Bitmap> WebpLoader::Load()
 
 std::unique_ptr<BitmapAnim> WebpLoader::LoadAnim()
 {
-    if( !m_dec && !Open() ) return nullptr;
+    if( !m_buf && !Open() ) return nullptr;
+    if( !m_dec && !OpenAnim() ) return nullptr;
 
     WebPAnimInfo info;
     WebPAnimDecoderGetInfo( m_dec, &info );
@@ -85,13 +160,39 @@ std::unique_ptr<BitmapAnim> WebpLoader::LoadAnim()
     return anim;
 }
 
+std::unique_ptr<BitmapAnimStream> WebpLoader::LoadAnimStream( TaskDispatch* td )
+{
+    if( !m_buf && !Open() ) return nullptr;
+    if( !m_dec && !OpenAnim() ) return nullptr;
+
+    WebPAnimInfo info;
+    WebPAnimDecoderGetInfo( m_dec, &info );
+
+    // The decoder and the data it reads from are handed over, as the stream may outlive the loader
+    auto source = std::make_unique<WebpAnimSource>( std::move( m_buf ), std::exchange( m_dec, nullptr ) );
+    return std::make_unique<BitmapAnimStream>( std::move( source ), info.canvas_width, info.canvas_height, info.frame_count, td );
+}
+
 bool WebpLoader::Open()
 {
     CheckPanic( m_valid, "Invalid WebP file" );
-    CheckPanic( !m_buf && !m_dec, "Already opened" );
+    CheckPanic( !m_buf, "Already opened" );
 
     m_buf = std::make_unique<FileBuffer>( m_file );
 
+    WebPBitstreamFeatures features;
+    if( WebPGetFeatures( (const uint8_t*)m_buf->data(), m_buf->size(), &features ) != VP8_STATUS_OK ) return false;
+
+    m_hasAnimation = features.has_animation;
+    m_width = features.width;
+    m_height = features.height;
+    return true;
+}
+
+bool WebpLoader::OpenAnim()
+{
+    CheckPanic( m_buf && !m_dec, "Already opened" );
+
     WebPData data = {
         .bytes = (const uint8_t*)m_buf->data(),
         .size = m_buf->size()
@@ -105,3 +206,34 @@ bool WebpLoader::Open()
     m_dec = WebPAnimDecoderNew( &data, &opts );
     return m_dec != nullptr;
 }
+
+std::unique_ptr<Bitmap> WebpLoader::LoadStill()
+{
+    ZoneScoped;
+
+    WebPDecoderConfig config;
+    if( !WebPInitDecoderConfig( &config ) ) return nullptr;
+
+    // The rescaler works while rows are decoded, so a reduced image costs less than a full one plus a resize
+    const auto scale = TargetScale( m_width, m_height, 8 );
+    const auto width = std::max( 1u, m_width / scale );
+    const auto height = std::max( 1u, m_height / scale );
+    if( scale > 1 )
+    {
+        mclog( LogLevel::Info, "WebP scaling 1/%u", scale );
+        config.options.use_scaling = 1;
+        config.options.scaled_width = width;
+        config.options.scaled_height = height;
+    }
+    config.options.use_threads = 1;
+
+    auto bmp = std::make_unique<Bitmap>( width, height );
+    config.output.colorspace = MODE_RGBA;
+    config.output.is_external_memory = 1;
+    config.output.u.RGBA.rgba = bmp->Data();
+    config.output.u.RGBA.stride = width * 4;
+    config.output.u.RGBA.size = size_t( width ) * height * 4;
+
+    if( WebPDecode( (const uint8_t*)m_buf->data(), m_buf->size(), &config ) != VP8_STATUS_OK ) return nullptr;
+    return bmp;
+}
@@ -23,14 +23,24 @@ public:
 
     [[nodiscard]] bool IsValid() const override;
     [[nodiscard]] bool IsAnimated() override;
+    [[nodiscard]] ImageInfo Probe() override;
 
     [[nodiscard]] std::unique_ptr<Bitmap> Load() override;
     [[nodiscard]] std::unique_ptr<BitmapAnim> LoadAnim() override;
+    [[nodiscard]] std::unique_ptr<BitmapAnimStream> LoadAnimStream( TaskDispatch* td ) override;
 
 private:
     bool Open();
+    bool OpenAnim();
+
+    // Stills are decoded straight into the bitmap, without the compositing canvas of the animation decoder
+    [[nodiscard]] std::unique_ptr<Bitmap> LoadStill();
 
     bool m_valid;
+    bool m_hasAnimation;
+
+    uint32_t m_width;
+    uint32_t m_height;
 
     std::shared_ptr<FileWrapper> m_file;
     std::unique_ptr<FileBuffer> m_buf;
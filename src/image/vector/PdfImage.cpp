@@ -1,19 +1,25 @@
+#include <algorithm>
 #include <cairo.h>
 #include <dlfcn.h>
 #include <glib-object.h>
 #include <stdint.h>
 #include <string.h>
+#include <tracy/Tracy.hpp>
 
 #include "PdfImage.hpp"
 #include "util/Bitmap.hpp"
+#include "util/FileBuffer.hpp"
+#include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
-using LoadPdf_t = void*(*)(int, const char*, GError**);
+using LoadPdf_t = void*(*)(GBytes*, const char*, GError**);
+using GetPageCount_t = int(*)(void*);
 using GetPage_t = void*(*)(void*, int);
 using GetPageSize_t = void(*)(void*, double*, double*);
 using RenderPage_t = void(*)(void*, cairo_t*);
 
 static LoadPdf_t LoadPdf = nullptr;
+static GetPageCount_t GetPageCount = nullptr;
 static GetPage_t GetPage = nullptr;
 static GetPageSize_t GetPageSize = nullptr;
 static RenderPage_t RenderPage = nullptr;
@@ -25,14 +31,16 @@ struct PdfLibraryLoader
         auto lib = dlopen( "libpoppler-glib.so", RTLD_LAZY );
         if( lib )
         {
-            auto LoadPdf_f = (LoadPdf_t)dlsym( lib, "poppler_document_new_from_fd" );
+            auto LoadPdf_f = (LoadPdf_t)dlsym( lib, "poppler_document_new_from_bytes" );
+            auto GetPageCount_f = (GetPageCount_t)dlsym( lib, "poppler_document_get_n_pages" );
             auto GetPage_f = (GetPage_t)dlsym( lib, "poppler_document_get_page" );
             auto GetPageSize_f = (GetPageSize_t)dlsym( lib, "poppler_page_get_size" );
             auto RenderPage_f = (RenderPage_t)dlsym( lib, "poppler_page_render_for_printing" );
 
-            if( LoadPdf_f && GetPage_f && GetPageSize_f && RenderPage_f )
+            if( LoadPdf_f && GetPageCount_f && GetPage_f && GetPageSize_f && RenderPage_f )
             {
                 LoadPdf = LoadPdf_f;
+                GetPageCount = GetPageCount_f;
                 GetPage = GetPage_f;
                 GetPageSize = GetPageSize_f;
                 RenderPage = RenderPage_f;
@@ -45,8 +53,35 @@ struct PdfLibraryLoader
     };
 };
 
+static std::unique_ptr<Bitmap> SurfaceToBitmap( const uint8_t* src, int stride, int width, int height )
+{
+    auto img = std::make_unique<Bitmap>( width, height );
+    auto dst = (uint32_t*)img->Data();
+
+    while( height-- )
+    {
+        for( int x = 0; x < width; x++ )
+        {
+            uint32_t px = *(uint32_t*)src;
+            *dst++ = ( px & 0xFF00FF00 ) | ( px & 0x00FF0000 ) >> 16 | ( px & 0x000000FF ) << 16;
+            src += 4;
+        }
+        src += stride - width * 4;
+    }
+
+    return img;
+}
+
+static std::unique_ptr<Bitmap> CopyBitmap( const Bitmap& bmp )
+{
+    auto ret = std::make_unique<Bitmap>( bmp.Width(), bmp.Height() );
+    memcpy( ret->Data(), bmp.Data(), size_t( bmp.Width() ) * bmp.Height() * 4 );
+    return ret;
+}
+
 PdfImage::PdfImage( FileWrapper& file )
-    : m_pdf( nullptr )
+    : m_bytes( nullptr )
+    , m_pdf( nullptr )
     , m_page( nullptr )
 {
     fseek( file, 0, SEEK_SET );
@@ -56,10 +91,13 @@ PdfImage::PdfImage( FileWrapper& file )
         static PdfLibraryLoader loader;
         if( LoadPdf )
         {
-            m_pdf = LoadPdf( fileno( file ), nullptr, nullptr );
+            m_buf = std::make_unique<FileBuffer>( file );
+            m_bytes = g_bytes_new_static( m_buf->data(), m_buf->size() );
+            m_pdf = LoadPdf( m_bytes, nullptr, nullptr );
             if( m_pdf )
             {
-                file.Release();
+                m_pages = GetPageCount( m_pdf );
+                CheckPanic( m_pages > 0, "PDF has no pages" );
 
                 m_page = GetPage( m_pdf, 0 );
                 CheckPanic( m_page, "Failed to load PDF page" );
@@ -76,8 +114,12 @@ PdfImage::PdfImage( FileWrapper& file )
 
 PdfImage::~PdfImage()
 {
+    m_prefetch.Wait();
+
+    for( auto doc : m_pool ) g_object_unref( doc );
     if( m_page ) g_object_unref( m_page );
     if( m_pdf ) g_object_unref( m_pdf );
+    if( m_bytes ) g_bytes_unref( m_bytes );
 }
 
 bool PdfImage::IsValid() const
@@ -85,37 +127,168 @@ bool PdfImage::IsValid() const
     return m_pdf != nullptr;
 }
 
+void PdfImage::SetPage( int page )
+{
+    CheckPanic( m_pdf, "Invalid PDF image" );
+    CheckPanic( page >= 0 && page < m_pages, "Invalid PDF page %d (of %d)", page, m_pages );
+    if( page == m_pageIdx ) return;
+
+    auto pg = GetPage( m_pdf, page );
+    CheckPanic( pg, "Failed to load PDF page" );
+    g_object_unref( m_page );
+    m_page = pg;
+    m_pageIdx = page;
+
+    double w, h;
+    GetPageSize( m_page, &w, &h );
+
+    m_width = w;
+    m_height = h;
+}
+
 std::unique_ptr<Bitmap> PdfImage::Rasterize( int width, int height ) const
 {
     CheckPanic( m_page, "Invalid PDF image" );
 
+    const auto sx = double( width ) / m_width;
+    const auto sy = double( height ) / m_height;
+
+    auto img = FromCache( m_pageIdx, width, height );
+    if( !img )
+    {
+        img = Render( m_pageIdx, 0, 0, width, height, sx, sy );
+        if( img ) Store( m_pageIdx, width, height, CopyBitmap( *img ) );
+    }
+
+    if( m_td )
+    {
+        Prefetch( m_pageIdx + 1, sx, sy );
+        Prefetch( m_pageIdx - 1, sx, sy );
+    }
+
+    return img;
+}
+
+std::unique_ptr<Bitmap> PdfImage::RasterizeRegion( int x, int y, int width, int height, float scale ) const
+{
+    CheckPanic( m_page, "Invalid PDF image" );
+    CheckPanic( width > 0 && height > 0, "Invalid region size (%d×%d)", width, height );
+
+    return Render( m_pageIdx, x, y, width, height, scale, scale );
+}
+
+std::unique_ptr<Bitmap> PdfImage::Render( int page, int x, int y, int width, int height, double sx, double sy ) const
+{
+    ZoneScoped;
+
+    auto doc = AcquireDocument();
+    if( !doc ) return nullptr;
+
+    auto pg = GetPage( doc, page );
+    if( !pg )
+    {
+        ReleaseDocument( doc );
+        return nullptr;
+    }
+
     const auto stride = cairo_format_stride_for_width( CAIRO_FORMAT_ARGB32, width );
     auto data = new uint8_t[height * stride];
     memset( data, 0, height * stride );
     auto surface = cairo_image_surface_create_for_data( data, CAIRO_FORMAT_ARGB32, width, height, stride );
     auto cr = cairo_create( surface );
-    cairo_scale( cr, float( width ) / m_width, float( height ) / m_height );
+    cairo_translate( cr, -x, -y );
+    cairo_scale( cr, sx, sy );
 
-    RenderPage( m_page, cr );
+    RenderPage( pg, cr );
+    g_object_unref( pg );
+    ReleaseDocument( doc );
 
-    auto img = std::make_unique<Bitmap>( width, height );
-    auto dst = (uint32_t*)img->Data();
-    auto src = data;
+    auto img = SurfaceToBitmap( data, stride, width, height );
+
+    cairo_destroy( cr );
+    cairo_surface_destroy( surface );
+    delete[] data;
+
+    return img;
+}
+
+std::unique_ptr<Bitmap> PdfImage::FromCache( int page, int width, int height ) const
+{
+    std::unique_lock lock( m_cacheLock );
+
+    // A background render of this page is already running. It will be done sooner than a new one.
+    m_cacheCv.wait( lock, [&] {
+        return std::none_of( m_pending.begin(), m_pending.end(), [&]( const auto& p ) { return p.page == page && p.width == width && p.height == height; } );
+    } );
+
+    auto it = std::find_if( m_cache.begin(), m_cache.end(), [&]( const auto& c ) { return c.page == page && c.width == width && c.height == height; } );
+    if( it == m_cache.end() ) return nullptr;
+
+    m_cache.splice( m_cache.begin(), m_cache, it );
+    return CopyBitmap( *it->bmp );
+}
+
+void PdfImage::Store( int page, int width, int height, std::unique_ptr<Bitmap>&& bmp ) const
+{
+    std::lock_guard lock( m_cacheLock );
+    m_cache.remove_if( [&]( const auto& c ) { return c.page == page && c.width == width && c.height == height; } );
+    m_cache.emplace_front( CachedPage { page, width, height, std::move( bmp ) } );
+    if( m_cache.size() > CacheSize ) m_cache.pop_back();
+}
+
+void PdfImage::Prefetch( int page, double sx, double sy ) const
+{
+    if( page < 0 || page >= m_pages ) return;
+
+    auto pg = GetPage( m_pdf, page );
+    if( !pg ) return;
+    double pw, ph;
+    GetPageSize( pg, &pw, &ph );
+    g_object_unref( pg );
+
+    const int width = pw * sx;
+    const int height = ph * sy;
+    if( width <= 0 || height <= 0 ) return;
 
-    while( height-- )
     {
-        for( int x = 0; x < width; x++ )
+        std::lock_guard lock( m_cacheLock );
+        const auto match = [&]( const auto& c ) { return c.page == page && c.width == width && c.height == height; };
+        if( std::any_of( m_cache.begin(), m_cache.end(), match ) ) return;
+        if( std::any_of( m_pending.begin(), m_pending.end(), match ) ) return;
+        m_pending.emplace_back( PendingPage { page, width, height } );
+    }
+
+    TaskDispatch::ScopedPriority priority( TaskDispatch::Priority::Background );
+    m_td->Queue( m_prefetch, [this, page, width, height, sx, sy] {
+        auto bmp = Render( page, 0, 0, width, height, sx, sy );
+        if( bmp ) Store( page, width, height, std::move( bmp ) );
         {
-            uint32_t px = *(uint32_t*)src;
-            *dst++ = ( px & 0xFF00FF00 ) | ( px & 0x00FF0000 ) >> 16 | ( px & 0x000000FF ) << 16;
-            src += 4;
+            std::lock_guard lock( m_cacheLock );
+            std::erase_if( m_pending, [&]( const auto& p ) { return p.page == page && p.width == width && p.height == height; } );
+        }
+        m_cacheCv.notify_all();
+    } );
+}
+
+void* PdfImage::AcquireDocument() const
+{
+    {
+        std::lock_guard lock( m_poolLock );
+        if( !m_pool.empty() )
+        {
+            auto doc = m_pool.back();
+            m_pool.pop_back();
+            return doc;
         }
-        src += stride - width * 4;
     }
 
-    cairo_destroy( cr );
-    cairo_surface_destroy( surface );
-    delete[] data;
+    auto doc = LoadPdf( m_bytes, nullptr, nullptr );
+    if( !doc ) mclog( LogLevel::Warning, "PDF: Failed to open document for rendering" );
+    return doc;
+}
 
-    return img;
+void PdfImage::ReleaseDocument( void* doc ) const
+{
+    std::lock_guard lock( m_poolLock );
+    m_pool.emplace_back( doc );
 }
@@ -1,8 +1,19 @@
 #pragma once
 
+#include <condition_variable>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <vector>
+
 #include "util/FileWrapper.hpp"
+#include "util/TaskDispatch.hpp"
 #include "util/VectorImage.hpp"
 
+class FileBuffer;
+
+typedef struct _GBytes GBytes;
+
 class PdfImage : public VectorImage
 {
 public:
@@ -16,12 +27,64 @@ public:
     [[nodiscard]] int Width() const override { return m_width; }
     [[nodiscard]] int Height() const override { return m_height; }
 
+    // Size and rasterization refer to the selected page. Don't change it while other threads are rendering.
+    [[nodiscard]] int Pages() const { return m_pages; }
+    [[nodiscard]] int Page() const { return m_pageIdx; }
+    void SetPage( int page );
+
+    // If set, each Rasterize() call renders the previous and next pages at the same scale in the background.
+    void SetPrefetch( TaskDispatch* td ) { m_td = td; }
+
     [[nodiscard]] std::unique_ptr<Bitmap> Rasterize( int width, int height ) const override;
+    [[nodiscard]] std::unique_ptr<Bitmap> RasterizeRegion( int x, int y, int width, int height, float scale ) const override;
 
 private:
+    // Rendered pages, most recently used first
+    struct CachedPage
+    {
+        int page;
+        int width;
+        int height;
+        std::unique_ptr<Bitmap> bmp;
+    };
+    static constexpr size_t CacheSize = 8;
+
+    [[nodiscard]] std::unique_ptr<Bitmap> Render( int page, int x, int y, int width, int height, double sx, double sy ) const;
+
+    [[nodiscard]] std::unique_ptr<Bitmap> FromCache( int page, int width, int height ) const;
+    void Store( int page, int width, int height, std::unique_ptr<Bitmap>&& bmp ) const;
+    void Prefetch( int page, double sx, double sy ) const;
+
+    // Poppler documents can't render concurrently, so each render takes its own document from the pool
+    void* AcquireDocument() const;
+    void ReleaseDocument( void* doc ) const;
+
+    std::unique_ptr<FileBuffer> m_buf;
+    GBytes* m_bytes;
+
     void* m_pdf;
     void* m_page;
 
+    int m_pages = 0;
+    int m_pageIdx = 0;
     int m_width = -1;
     int m_height = -1;
+
+    mutable std::mutex m_poolLock;
+    mutable std::vector<void*> m_pool;
+
+    TaskDispatch* m_td = nullptr;
+    mutable TaskGroup m_prefetch;
+
+    struct PendingPage
+    {
+        int page;
+        int width;
+        int height;
+    };
+
+    mutable std::mutex m_cacheLock;
+    mutable std::condition_variable m_cacheCv;
+    mutable std::list<CachedPage> m_cache;
+    mutable std::vector<PendingPage> m_pending;
 };
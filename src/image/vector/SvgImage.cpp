@@ -11,6 +11,25 @@
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
+static std::unique_ptr<Bitmap> SurfaceToBitmap( const uint8_t* src, int stride, int width, int height )
+{
+    auto img = std::make_unique<Bitmap>( width, height );
+    auto dst = (uint32_t*)img->Data();
+
+    while( height-- )
+    {
+        for( int x = 0; x < width; x++ )
+        {
+            uint32_t px = *(uint32_t*)src;
+            *dst++ = ( px & 0xFF00FF00 ) | ( px & 0x00FF0000 ) >> 16 | ( px & 0x000000FF ) << 16;
+            src += 4;
+        }
+        src += stride - width * 4;
+    }
+
+    return img;
+}
+
 SvgImage::SvgImage( FileWrapper& file )
     : SvgImage( std::make_shared<FileBuffer>( file ) )
 {
@@ -36,6 +55,7 @@ SvgImage::SvgImage( std::shared_ptr<DataBuffer> buf )
 
 SvgImage::~SvgImage()
 {
+    for( auto handle : m_pool ) g_object_unref( handle );
     if( m_handle ) g_object_unref( m_handle );
     g_object_unref( m_stream );
 }
@@ -67,20 +87,36 @@ std::unique_ptr<Bitmap> SvgImage::Rasterize( int width, int height ) const
         return nullptr;
     }
 
-    auto img = std::make_unique<Bitmap>( width, height );
-    auto dst = (uint32_t*)img->Data();
-    auto src = data;
+    auto img = SurfaceToBitmap( data, stride, width, height );
 
-    while( height-- )
-    {
-        for( int x = 0; x < width; x++ )
-        {
-            uint32_t px = *(uint32_t*)src;
-            *dst++ = ( px & 0xFF00FF00 ) | ( px & 0x00FF0000 ) >> 16 | ( px & 0x000000FF ) << 16;
-            src += 4;
-        }
-        src += stride - width * 4;
-    }
+    cairo_destroy( cr );
+    cairo_surface_destroy( surface );
+    delete[] data;
+
+    return img;
+}
+
+std::unique_ptr<Bitmap> SvgImage::RasterizeRegion( int x, int y, int width, int height, float scale ) const
+{
+    CheckPanic( m_handle, "Invalid SVG image" );
+    CheckPanic( m_width > 0 && m_height > 0, "SVG image has no intrinsic size" );
+    CheckPanic( width > 0 && height > 0, "Invalid region size (%d×%d)", width, height );
+
+    auto handle = AcquireHandle();
+    if( !handle ) return nullptr;
+
+    const auto stride = cairo_format_stride_for_width( CAIRO_FORMAT_ARGB32, width );
+    auto data = new uint8_t[height * stride];
+    memset( data, 0, height * stride );
+    auto surface = cairo_image_surface_create_for_data( data, CAIRO_FORMAT_ARGB32, width, height, stride );
+    auto cr = cairo_create( surface );
+
+    RsvgRectangle viewport = { double( m_border ) - x, double( m_border ) - y, m_width * scale, m_height * scale };
+    const auto ok = rsvg_handle_render_document( handle, cr, &viewport, nullptr );
+    ReleaseHandle( handle );
+
+    std::unique_ptr<Bitmap> img;
+    if( ok ) img = SurfaceToBitmap( data, stride, width, height );
 
     cairo_destroy( cr );
     cairo_surface_destroy( surface );
@@ -88,3 +124,34 @@ std::unique_ptr<Bitmap> SvgImage::Rasterize( int width, int height ) const
 
     return img;
 }
+
+RsvgHandle* SvgImage::AcquireHandle() const
+{
+    {
+        std::lock_guard lock( m_poolLock );
+        if( !m_pool.empty() )
+        {
+            auto handle = m_pool.back();
+            m_pool.pop_back();
+            return handle;
+        }
+    }
+
+    auto stream = g_memory_input_stream_new_from_data( m_buf->data(), m_buf->size(), nullptr );
+    auto handle = rsvg_handle_new_from_stream_sync( stream, nullptr, RSVG_HANDLE_FLAGS_NONE, nullptr, nullptr );
+    g_object_unref( stream );
+    if( !handle )
+    {
+        mclog( LogLevel::Warning, "SVG: Failed to create handle for region rendering" );
+        return nullptr;
+    }
+
+    rsvg_handle_set_dpi( handle, 96 );
+    return handle;
+}
+
+void SvgImage::ReleaseHandle( RsvgHandle* handle ) const
+{
+    std::lock_guard lock( m_poolLock );
+    m_pool.emplace_back( handle );
+}
@@ -1,7 +1,9 @@
 #pragma once
 
 #include <memory>
+#include <mutex>
 #include <stdint.h>
+#include <vector>
 
 #include "util/FileWrapper.hpp"
 #include "util/VectorImage.hpp"
@@ -26,6 +28,7 @@ public:
     [[nodiscard]] int Height() const override { return m_height; }
 
     [[nodiscard]] std::unique_ptr<Bitmap> Rasterize( int width, int height ) const override;
+    [[nodiscard]] std::unique_ptr<Bitmap> RasterizeRegion( int x, int y, int width, int height, float scale ) const override;
 
     void SetBorder( uint32_t border ) { m_border = border; }
 
@@ -39,4 +42,11 @@ private:
     int m_height = -1;
 
     uint32_t m_border = 0;
+
+    // librsvg handles can't render concurrently, so each region render takes its own handle from the pool
+    RsvgHandle* AcquireHandle() const;
+    void ReleaseHandle( RsvgHandle* handle ) const;
+
+    mutable std::mutex m_poolLock;
+    mutable std::vector<RsvgHandle*> m_pool;
 };
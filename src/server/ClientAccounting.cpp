@@ -0,0 +1,146 @@
+#include <tracy/Tracy.hpp>
+#include <wayland-server-core.h>
+
+#include "ClientAccounting.hpp"
+#include "util/Config.hpp"
+#include "util/ConfigRegistry.hpp"
+#include "util/Logs.hpp"
+#include "util/Panic.hpp"
+
+struct ClientAccounting::Client
+{
+    wl_listener destroy;        // Must be first, the listener is cast back to the client
+    ClientAccounting* owner;
+    wl_client* client;
+    Usage usage;
+};
+
+namespace
+{
+constexpr const char* ResourceNames[] = { "GPU memory", "shm memory", "frame callbacks" };
+static_assert( std::size( ResourceNames ) == ClientAccounting::NumResources );
+
+constexpr uint64_t MiB = 1024 * 1024;
+}
+
+ClientAccounting::ClientAccounting()
+{
+    auto& registry = ConfigRegistry::Instance();
+    LoadLimits( *registry.Get( "server.ini" ) );
+    for( auto key : { "GpuMemory", "ShmMemory", "FrameCallbacks" } )
+    {
+        m_subscriptions.emplace_back( registry.Subscribe( "server.ini", "Limits", key, [this]( const Config& config ) { LoadLimits( config ); } ) );
+    }
+}
+
+ClientAccounting::~ClientAccounting()
+{
+    for( auto id : m_subscriptions ) ConfigRegistry::Instance().Unsubscribe( id );
+    for( auto& client : m_clients ) wl_list_remove( &client.second->destroy.link );
+}
+
+bool ClientAccounting::Charge( wl_client* client, Resource resource, uint64_t amount )
+{
+    auto& c = Get( client );
+    const auto idx = (size_t)resource;
+    auto& used = c.usage.used[idx];
+
+    if( m_limit[idx] != 0 && used + amount > m_limit[idx] )
+    {
+        c.usage.rejected++;
+        mclog( LogLevel::Warning, "Client %i is over its %s limit (%llu + %llu > %llu)", c.usage.pid, ResourceNames[idx], (unsigned long long)used, (unsigned long long)amount, (unsigned long long)m_limit[idx] );
+        return false;
+    }
+
+    used += amount;
+    m_total[idx] += amount;
+    Plot();
+    return true;
+}
+
+void ClientAccounting::Release( wl_client* client, Resource resource, uint64_t amount )
+{
+    // Resources are destroyed after the client destroy listener ran, in which case everything was dropped already
+    auto it = m_clients.find( client );
+    if( it == m_clients.end() ) return;
+
+    const auto idx = (size_t)resource;
+    auto& used = it->second->usage.used[idx];
+    CheckPanic( used >= amount, "Released more %s than was charged", ResourceNames[idx] );
+    used -= amount;
+    m_total[idx] -= amount;
+    Plot();
+}
+
+std::vector<ClientAccounting::Usage> ClientAccounting::Query() const
+{
+    std::vector<Usage> ret;
+    ret.reserve( m_clients.size() );
+    for( auto& client : m_clients ) ret.emplace_back( client.second->usage );
+    return ret;
+}
+
+void ClientAccounting::Log() const
+{
+    mclog( LogLevel::Info, "%zu client(s):", m_clients.size() );
+    for( auto& client : m_clients )
+    {
+        auto& usage = client.second->usage;
+        mclog( LogLevel::Info, "  pid %i: GPU %.1f MiB, shm %.1f MiB, %llu frame callbacks, %llu rejected",
+            usage.pid,
+            usage.used[(size_t)Resource::GpuMemory] / double( MiB ),
+            usage.used[(size_t)Resource::ShmMemory] / double( MiB ),
+            (unsigned long long)usage.used[(size_t)Resource::FrameCallbacks],
+            (unsigned long long)usage.rejected );
+    }
+}
+
+ClientAccounting::Client& ClientAccounting::Get( wl_client* client )
+{
+    auto it = m_clients.find( client );
+    if( it != m_clients.end() ) return *it->second;
+
+    auto c = std::make_unique<Client>();
+    c->owner = this;
+    c->client = client;
+    c->usage = {};
+    wl_client_get_credentials( client, &c->usage.pid, nullptr, nullptr );
+
+    c->destroy.notify = []( wl_listener* listener, void* ) {
+        auto c = (Client*)listener;
+        c->owner->Destroy( c->client );
+    };
+    wl_client_add_destroy_listener( client, &c->destroy );
+
+    auto& ret = *c;
+    m_clients.emplace( client, std::move( c ) );
+    return ret;
+}
+
+void ClientAccounting::Destroy( wl_client* client )
+{
+    auto it = m_clients.find( client );
+    CheckPanic( it != m_clients.end(), "Unknown client destroyed" );
+
+    auto& usage = it->second->usage;
+    for( size_t i=0; i<NumResources; i++ ) m_total[i] -= usage.used[i];
+    if( usage.rejected != 0 ) mclog( LogLevel::Debug, "Client %i had %llu requests rejected", usage.pid, (unsigned long long)usage.rejected );
+
+    wl_list_remove( &it->second->destroy.link );
+    m_clients.erase( it );
+    Plot();
+}
+
+void ClientAccounting::Plot() const
+{
+    TracyPlot( "Client GPU memory (MiB)", m_total[(size_t)Resource::GpuMemory] / double( MiB ) );
+    TracyPlot( "Client shm memory (MiB)", m_total[(size_t)Resource::ShmMemory] / double( MiB ) );
+    TracyPlot( "Pending frame callbacks", int64_t( m_total[(size_t)Resource::FrameCallbacks] ) );
+}
+
+void ClientAccounting::LoadLimits( const Config& config )
+{
+    m_limit[(size_t)Resource::GpuMemory] = config.Get( "Limits", "GpuMemory", 1024u ) * MiB;
+    m_limit[(size_t)Resource::ShmMemory] = config.Get( "Limits", "ShmMemory", 512u ) * MiB;
+    m_limit[(size_t)Resource::FrameCallbacks] = config.Get( "Limits", "FrameCallbacks", 256u );
+}
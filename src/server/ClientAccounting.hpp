@@ -0,0 +1,69 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vector>
+
+#include "util/NoCopy.hpp"
+#include "util/RobinHood.hpp"
+
+class Config;
+
+extern "C" {
+    struct wl_client;
+};
+
+// Resources held by each Wayland client. They are charged when created and released when destroyed, and a
+// client going over one of its limits has the request rejected, instead of starving the compositor.
+//
+// Limits are read from the [Limits] section of server.ini, and follow changes to the file. Memory is given in MiB,
+// zero disables a limit. A lowered limit doesn't take back what was already charged.
+class ClientAccounting
+{
+public:
+    enum class Resource
+    {
+        GpuMemory,          // Bytes, imported dma-bufs and textures uploaded for the client
+        ShmMemory,          // Bytes, of shared memory buffers in use
+        FrameCallbacks,     // Pending wl_surface.frame requests
+        Count
+    };
+    static constexpr size_t NumResources = (size_t)Resource::Count;
+
+    struct Usage
+    {
+        pid_t pid;
+        std::array<uint64_t, NumResources> used;
+        uint64_t rejected;      // Requests over the limit
+    };
+
+    ClientAccounting();
+    ~ClientAccounting();
+
+    NoCopy( ClientAccounting );
+
+    // Returns false, and charges nothing, if the client would go over its limit
+    [[nodiscard]] bool Charge( wl_client* client, Resource resource, uint64_t amount );
+    void Release( wl_client* client, Resource resource, uint64_t amount );
+
+    [[nodiscard]] uint64_t Limit( Resource resource ) const { return m_limit[(size_t)resource]; }
+
+    // For debugging, a snapshot of all connected clients
+    [[nodiscard]] std::vector<Usage> Query() const;
+    void Log() const;
+
+private:
+    struct Client;
+
+    Client& Get( wl_client* client );
+    void Destroy( wl_client* client );
+    void Plot() const;
+    void LoadLimits( const Config& config );
+
+    std::array<uint64_t, NumResources> m_limit;
+    std::vector<int> m_subscriptions;
+    std::array<uint64_t, NumResources> m_total = {};
+    unordered_flat_map<wl_client*, std::unique_ptr<Client>> m_clients;
+};
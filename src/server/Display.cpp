@@ -1,23 +1,40 @@
 #include <wayland-server-core.h>
 
+#include "ClientAccounting.hpp"
 #include "Display.hpp"
+#include "LinuxDmabuf.hpp"
+#include "LinuxDrmSyncobj.hpp"
+#include "ShmTexture.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
 
-Display::Display()
+Display::Display( DmabufFeedback dmabuf )
     : m_dpy( wl_display_create() )
     , m_socket( wl_display_add_socket_auto( m_dpy ) )
+    , m_accounting( std::make_unique<ClientAccounting>() )
 {
     CheckPanic( m_dpy, "Failed to create wl_display!" );
     CheckPanic( m_socket, "Failed to initialize a socket!" );
 
     mclog( LogLevel::Info, "Wayland socket: %s", m_socket );
+
+    CheckPanic( wl_display_init_shm( m_dpy ) == 0, "Failed to initialize wl_shm!" );
+    ShmTexture::AddFormats( m_dpy );
+
+    if( dmabuf.gpu )
+    {
+        // Explicit sync only makes sense for buffers the GPU imports
+        if( const auto fd = LinuxDrmSyncobj::OpenDevice( dmabuf.mainDevice ); fd >= 0 ) m_syncobj = std::make_unique<LinuxDrmSyncobj>( m_dpy, fd );
+        m_dmabuf = std::make_unique<LinuxDmabuf>( m_dpy, std::move( dmabuf ), *m_accounting );
+    }
 }
 
 Display::~Display()
 {
     wl_display_destroy_clients( m_dpy );
+    m_syncobj.reset();
+    m_dmabuf.reset();
     wl_display_destroy( m_dpy );
 }
 
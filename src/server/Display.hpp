@@ -1,15 +1,23 @@
 #pragma once
 
+#include <memory>
+
+#include "backend/DmabufFeedback.hpp"
 #include "util/NoCopy.hpp"
 
 extern "C" {
     struct wl_display;
 };
 
+class ClientAccounting;
+class LinuxDmabuf;
+class LinuxDrmSyncobj;
+
 class Display
 {
 public:
-    Display();
+    // The dma-buf global is only created if the feedback names a GPU to import on
+    explicit Display( DmabufFeedback dmabuf = {} );
     ~Display();
 
     NoCopy( Display );
@@ -18,10 +26,15 @@ public:
     void Terminate();
 
     [[nodiscard]] const char* Socket() const { return m_socket; }
+    [[nodiscard]] auto& GetAccounting() const { return *m_accounting; }
 
     [[nodiscard]] operator wl_display* () const { return m_dpy; }
 
 private:
     wl_display* m_dpy;
     const char* m_socket;
+
+    std::unique_ptr<ClientAccounting> m_accounting;
+    std::unique_ptr<LinuxDmabuf> m_dmabuf;
+    std::unique_ptr<LinuxDrmSyncobj> m_syncobj;
 };
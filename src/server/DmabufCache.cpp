@@ -0,0 +1,72 @@
+#include <sys/stat.h>
+#include <tracy/Tracy.hpp>
+
+#include "DmabufCache.hpp"
+#include "backend/GpuDevice.hpp"
+#include "util/Logs.hpp"
+#include "vulkan/VlkDevice.hpp"
+
+namespace
+{
+bool SameLayout( const VlkImage::DmaBuf& a, const VlkImage::DmaBuf& b )
+{
+    if( a.width != b.width || a.height != b.height || a.format != b.format || a.numPlanes != b.numPlanes ) return false;
+    for( uint32_t i=0; i<a.numPlanes; i++ )
+    {
+        if( a.offset[i] != b.offset[i] || a.stride[i] != b.stride[i] ) return false;
+    }
+    return true;
+}
+}
+
+DmabufCache::DmabufCache( std::shared_ptr<GpuDevice> gpu )
+    : m_gpu( std::move( gpu ) )
+{
+}
+
+DmabufCache::~DmabufCache() = default;
+
+std::shared_ptr<VlkImage> DmabufCache::Get( const VlkImage::DmaBuf& dmaBuf )
+{
+    ZoneScoped;
+
+    struct stat st;
+    if( fstat( dmaBuf.fd[0], &st ) < 0 ) throw VlkImage::ImportException( "Invalid dma-buf descriptor" );
+
+    const Key key = { st.st_dev, st.st_ino, dmaBuf.modifier };
+    m_tick++;
+
+    auto it = m_entries.find( key );
+    if( it != m_entries.end() )
+    {
+        // The same memory may be shared with a different layout, which needs an image of its own
+        if( SameLayout( it->second.layout, dmaBuf ) )
+        {
+            it->second.lastUse = m_tick;
+            return it->second.image;
+        }
+        m_entries.erase( it );
+    }
+
+    auto image = std::make_shared<VlkImage>( *m_gpu->Device(), dmaBuf, VK_IMAGE_USAGE_SAMPLED_BIT );
+    m_entries.emplace( key, Entry { image, dmaBuf, m_tick } );
+    Trim();
+
+    TracyPlot( "Imported dma-bufs", int64_t( m_entries.size() ) );
+    return image;
+}
+
+void DmabufCache::Trim()
+{
+    for( auto it = m_entries.begin(); it != m_entries.end(); )
+    {
+        if( it->second.image.use_count() == 1 && m_tick - it->second.lastUse > MaxIdle )
+        {
+            it = m_entries.erase( it );
+        }
+        else
+        {
+            ++it;
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <sys/types.h>
+#include <vulkan/vulkan.h>
+
+#include "util/NoCopy.hpp"
+#include "util/RobinHood.hpp"
+#include "vulkan/VlkImage.hpp"
+
+class GpuDevice;
+
+// Imported client dma-bufs, keyed by the inode of the buffer and its modifier. Clients recreate wl_buffers for
+// the same memory, and a dma-buf keeps its inode for as long as it exists, so reused buffers are imported only
+// once. Images no wl_buffer refers to are kept for a while, then dropped.
+class DmabufCache
+{
+public:
+    static constexpr uint64_t MaxIdle = 64;     // Imports since an unreferenced image was last used
+
+    explicit DmabufCache( std::shared_ptr<GpuDevice> gpu );
+    ~DmabufCache();
+
+    NoCopy( DmabufCache );
+
+    // Throws VlkImage::ImportException if the buffer can't be imported
+    [[nodiscard]] std::shared_ptr<VlkImage> Get( const VlkImage::DmaBuf& dmaBuf );
+
+    [[nodiscard]] auto& Gpu() const { return m_gpu; }
+
+private:
+    struct Key
+    {
+        dev_t dev;
+        ino_t ino;
+        uint64_t modifier;
+
+        bool operator==( const Key& rhs ) const = default;
+    };
+
+    struct KeyHash
+    {
+        size_t operator()( const Key& key ) const { return size_t( key.ino * 0x9e3779b97f4a7c15ull ) ^ size_t( key.modifier ) ^ size_t( key.dev ); }
+    };
+
+    struct Entry
+    {
+        std::shared_ptr<VlkImage> image;
+        VlkImage::DmaBuf layout;        // Descriptors are not valid
+        uint64_t lastUse;
+    };
+
+    void Trim();
+
+    std::shared_ptr<GpuDevice> m_gpu;
+    unordered_flat_map<Key, Entry, KeyHash> m_entries;
+    uint64_t m_tick = 0;
+};
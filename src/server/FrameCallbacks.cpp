@@ -0,0 +1,150 @@
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+
+#include "ClientAccounting.hpp"
+#include "FrameCallbacks.hpp"
+#include "util/Clock.hpp"
+#include "util/Config.hpp"
+#include "util/ConfigRegistry.hpp"
+#include "util/EventLoop.hpp"
+#include "util/Panic.hpp"
+
+FrameCallbacks::FrameCallbacks( Scene& scene, ClientAccounting& accounting )
+    : m_scene( scene )
+    , m_accounting( accounting )
+{
+    auto& registry = ConfigRegistry::Instance();
+    auto LoadInterval = [this]( const Config& config ) { m_interval = std::max( config.Get( "Frame", "HiddenInterval", 1000u ), 1u ) * 1000ull; };
+    LoadInterval( *registry.Get( "server.ini" ) );
+    m_subscription = registry.Subscribe( "server.ini", "Frame", "HiddenInterval", LoadInterval );
+}
+
+FrameCallbacks::~FrameCallbacks()
+{
+    ConfigRegistry::Instance().Unsubscribe( m_subscription );
+    DetachLoop();
+
+    // The resources outlive this when the clients are destroyed later
+    for( auto& [id, pending] : m_pending )
+    {
+        for( auto callback : pending.callbacks )
+        {
+            wl_resource_set_destructor( callback, nullptr );
+            m_accounting.Release( wl_resource_get_client( callback ), ClientAccounting::Resource::FrameCallbacks, 1 );
+        }
+    }
+}
+
+void FrameCallbacks::AttachLoop( EventLoop& loop )
+{
+    CheckPanic( !m_loop, "Frame callbacks are already attached to an event loop" );
+    m_loop = &loop;
+    m_timer = loop.AddTimer( 0, 0, [this] { Throttle(); } );
+    if( !m_pending.empty() ) ArmTimer( GetTimeMicro() );
+}
+
+void FrameCallbacks::DetachLoop()
+{
+    if( !m_loop ) return;
+    m_loop->RemoveTimer( m_timer );
+    m_loop = nullptr;
+    m_timer = -1;
+}
+
+bool FrameCallbacks::Add( Scene::Id surface, wl_resource* callback )
+{
+    if( !m_accounting.Charge( wl_resource_get_client( callback ), ClientAccounting::Resource::FrameCallbacks, 1 ) ) return false;
+    wl_resource_set_implementation( callback, nullptr, this, Destroyed );
+
+    const auto now = GetTimeMicro();
+    auto [it, added] = m_pending.try_emplace( surface, Pending { {}, now } );
+    it->second.callbacks.emplace_back( callback );
+    if( added ) ArmTimer( now );
+    return true;
+}
+
+void FrameCallbacks::RemoveSurface( Scene::Id surface )
+{
+    auto it = m_pending.find( surface );
+    if( it == m_pending.end() ) return;
+
+    // Destroying the resources calls Destroyed(), which must not find them anymore
+    auto callbacks = std::move( it->second.callbacks );
+    m_pending.erase( it );
+    for( auto callback : callbacks ) wl_resource_destroy( callback );
+}
+
+void FrameCallbacks::Presented( Scene::Id output, uint64_t time )
+{
+    ZoneScoped;
+    if( m_pending.empty() ) return;
+
+    for( auto surface : m_scene.VisibleSurfaces( output ) )
+    {
+        auto it = m_pending.find( surface );
+        if( it == m_pending.end() ) continue;
+
+        auto callbacks = std::move( it->second.callbacks );
+        m_pending.erase( it );
+        Done( std::move( callbacks ), time );
+    }
+}
+
+void FrameCallbacks::Destroyed( wl_resource* callback )
+{
+    auto self = (FrameCallbacks*)wl_resource_get_user_data( callback );
+    self->m_accounting.Release( wl_resource_get_client( callback ), ClientAccounting::Resource::FrameCallbacks, 1 );
+
+    // Only found if the client went away, done callbacks were taken out of the list before
+    for( auto it = self->m_pending.begin(); it != self->m_pending.end(); ++it )
+    {
+        auto& callbacks = it->second.callbacks;
+        if( std::erase( callbacks, callback ) == 0 ) continue;
+        if( callbacks.empty() ) self->m_pending.erase( it );
+        return;
+    }
+}
+
+void FrameCallbacks::Done( std::vector<wl_resource*>&& callbacks, uint64_t time )
+{
+    for( auto callback : callbacks )
+    {
+        wl_callback_send_done( callback, uint32_t( time / 1000 ) );
+        wl_resource_destroy( callback );
+    }
+}
+
+// Surfaces which were not shown within the interval are let through anyway. This includes visible ones on an
+// output which has nothing to draw, as a commit without damage does not render a frame.
+void FrameCallbacks::Throttle()
+{
+    ZoneScoped;
+
+    const auto now = GetTimeMicro();
+    std::vector<wl_resource*> due;
+    for( auto it = m_pending.begin(); it != m_pending.end(); )
+    {
+        if( now - it->second.since < m_interval )
+        {
+            ++it;
+            continue;
+        }
+        due.insert( due.end(), it->second.callbacks.begin(), it->second.callbacks.end() );
+        it = m_pending.erase( it );
+    }
+    TracyPlot( "Throttled frame callbacks", int64_t( due.size() ) );
+    Done( std::move( due ), now );
+
+    if( !m_pending.empty() ) ArmTimer( now );
+}
+
+void FrameCallbacks::ArmTimer( uint64_t now )
+{
+    if( !m_loop ) return;
+
+    auto next = UINT64_MAX;
+    for( auto& [id, pending] : m_pending ) next = std::min( next, pending.since + m_interval );
+    m_loop->SetTimer( m_timer, next > now ? next - now : 1 );
+}
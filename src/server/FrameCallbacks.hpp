@@ -0,0 +1,67 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "Scene.hpp"
+#include "util/NoCopy.hpp"
+#include "util/RobinHood.hpp"
+
+extern "C" {
+    struct wl_resource;
+};
+
+class ClientAccounting;
+class EventLoop;
+
+// Pending wl_surface.frame callbacks. A done event tells the client that now is a good time to draw, so the
+// callbacks of a surface which is visible on an output are done when that output presents a frame. Surfaces
+// which are unmapped, fully covered by opaque surfaces or outside of all outputs get theirs only at a throttled
+// rate, so that their clients stay responsive without drawing frames which nobody sees. The throttle timer is
+// armed only while callbacks are waiting.
+//
+// The throttle interval is read from the [Frame] section of server.ini, in milliseconds, and follows changes to the
+// file.
+class FrameCallbacks
+{
+public:
+    FrameCallbacks( Scene& scene, ClientAccounting& accounting );
+    ~FrameCallbacks();
+
+    NoCopy( FrameCallbacks );
+
+    void AttachLoop( EventLoop& loop );
+    void DetachLoop();
+
+    // Takes over the wl_callback resource. Returns false, and does not take it, if the client is over its
+    // frame callback limit.
+    [[nodiscard]] bool Add( Scene::Id surface, wl_resource* callback );
+    // The pending callbacks are destroyed without a done event
+    void RemoveSurface( Scene::Id surface );
+
+    // The output presented a frame. Times are in microseconds, on the monotonic clock.
+    void Presented( Scene::Id output, uint64_t time );
+
+private:
+    struct Pending
+    {
+        std::vector<wl_resource*> callbacks;
+        uint64_t since;         // When the oldest callback was added
+    };
+
+    static void Destroyed( wl_resource* callback );
+
+    void Done( std::vector<wl_resource*>&& callbacks, uint64_t time );
+    void Throttle();
+    void ArmTimer( uint64_t now );
+
+    Scene& m_scene;
+    ClientAccounting& m_accounting;
+    uint64_t m_interval;        // Microseconds
+    int m_subscription;
+
+    unordered_flat_map<Scene::Id, Pending> m_pending;
+
+    EventLoop* m_loop = nullptr;
+    int m_timer = -1;
+};
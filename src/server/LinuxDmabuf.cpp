@@ -0,0 +1,421 @@
+#include <algorithm>
+#include <drm_fourcc.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+
+#include "ClientAccounting.hpp"
+#include "LinuxDmabuf.hpp"
+#include "backend/drm/DrmFormat.hpp"
+#include "util/Logs.hpp"
+#include "util/Panic.hpp"
+#include "vulkan/VlkImage.hpp"
+
+#include "wayland-linux-dmabuf-unstable-v1-server-protocol.h"
+
+struct LinuxDmabuf::Params
+{
+    LinuxDmabuf* owner;
+    VlkImage::DmaBuf dmaBuf;
+    bool planeSet[VlkImage::DmaBuf::MaxPlanes];
+    bool used;
+};
+
+namespace
+{
+struct Buffer
+{
+    std::shared_ptr<VlkImage> image;
+    bool yInvert;
+
+    ClientAccounting& accounting;
+    wl_client* client;
+};
+
+// Entry of the format table, as the protocol defines it
+struct TableEntry
+{
+    uint32_t format;
+    uint32_t pad;
+    uint64_t modifier;
+};
+static_assert( sizeof( TableEntry ) == 16 );
+
+void DestroyResource( wl_client*, wl_resource* resource )
+{
+    wl_resource_destroy( resource );
+}
+
+const struct wl_buffer_interface s_bufferImpl = {
+    .destroy = DestroyResource
+};
+
+const struct zwp_linux_dmabuf_feedback_v1_interface s_feedbackImpl = {
+    .destroy = DestroyResource
+};
+
+void AddDevice( wl_array& array, dev_t dev )
+{
+    auto ptr = (dev_t*)wl_array_add( &array, sizeof( dev_t ) );
+    CheckPanic( ptr, "Out of memory" );
+    *ptr = dev;
+}
+}
+
+LinuxDmabuf::LinuxDmabuf( wl_display* dpy, DmabufFeedback feedback, ClientAccounting& accounting )
+    : m_feedback( std::move( feedback ) )
+    , m_accounting( accounting )
+    , m_cache( m_feedback.gpu )
+{
+    ZoneScoped;
+    CheckPanic( m_feedback.gpu, "No GPU to import client buffers on" );
+
+    CreateFormatTable();
+    m_global = wl_global_create( dpy, &zwp_linux_dmabuf_v1_interface, Version, this, Bind );
+    CheckPanic( m_global, "Failed to create linux-dmabuf global" );
+
+    mclog( LogLevel::Info, "linux-dmabuf: %zu formats, %zu outputs", m_table.size(), m_feedback.outputs.size() );
+}
+
+LinuxDmabuf::~LinuxDmabuf()
+{
+    wl_global_destroy( m_global );
+    if( m_tableFd >= 0 ) close( m_tableFd );
+}
+
+std::shared_ptr<VlkImage> LinuxDmabuf::GetImage( wl_resource* buffer )
+{
+    if( !wl_resource_instance_of( buffer, &wl_buffer_interface, &s_bufferImpl ) ) return {};
+    return ( (Buffer*)wl_resource_get_user_data( buffer ) )->image;
+}
+
+void LinuxDmabuf::Bind( wl_client* client, void* data, uint32_t version, uint32_t id )
+{
+    static const struct zwp_linux_dmabuf_v1_interface impl = {
+        .destroy = DestroyResource,
+        .create_params = CreateParams,
+        .get_default_feedback = GetDefaultFeedback,
+        .get_surface_feedback = GetSurfaceFeedback
+    };
+
+    auto resource = wl_resource_create( client, &zwp_linux_dmabuf_v1_interface, version, id );
+    if( !resource )
+    {
+        wl_client_post_no_memory( client );
+        return;
+    }
+    wl_resource_set_implementation( resource, &impl, data, nullptr );
+
+    // Since version 4 the formats are only sent as feedback
+    auto self = (LinuxDmabuf*)data;
+    if( version < 4 ) self->SendModifiers( resource, version );
+}
+
+void LinuxDmabuf::CreateParams( wl_client* client, wl_resource* resource, uint32_t id )
+{
+    static const struct zwp_linux_buffer_params_v1_interface impl = {
+        .destroy = DestroyResource,
+        .add = ParamsAdd,
+        .create = ParamsCreate,
+        .create_immed = ParamsCreateImmed
+    };
+
+    auto params = wl_resource_create( client, &zwp_linux_buffer_params_v1_interface, wl_resource_get_version( resource ), id );
+    if( !params )
+    {
+        wl_client_post_no_memory( client );
+        return;
+    }
+
+    auto data = new Params {
+        .owner = (LinuxDmabuf*)wl_resource_get_user_data( resource ),
+        .dmaBuf = { .fd = { -1, -1, -1, -1 } },
+        .planeSet = {},
+        .used = false
+    };
+    wl_resource_set_implementation( params, &impl, data, []( wl_resource* r ) {
+        auto params = (Params*)wl_resource_get_user_data( r );
+        for( auto fd : params->dmaBuf.fd )
+        {
+            if( fd >= 0 ) close( fd );
+        }
+        delete params;
+    } );
+}
+
+void LinuxDmabuf::GetDefaultFeedback( wl_client* client, wl_resource* resource, uint32_t id )
+{
+    auto feedback = wl_resource_create( client, &zwp_linux_dmabuf_feedback_v1_interface, wl_resource_get_version( resource ), id );
+    if( !feedback )
+    {
+        wl_client_post_no_memory( client );
+        return;
+    }
+    wl_resource_set_implementation( feedback, &s_feedbackImpl, nullptr, nullptr );
+
+    auto self = (LinuxDmabuf*)wl_resource_get_user_data( resource );
+    self->SendFeedback( feedback, { &self->m_feedback.render } );
+}
+
+void LinuxDmabuf::GetSurfaceFeedback( wl_client* client, wl_resource* resource, uint32_t id, wl_resource* surface )
+{
+    auto feedback = wl_resource_create( client, &zwp_linux_dmabuf_feedback_v1_interface, wl_resource_get_version( resource ), id );
+    if( !feedback )
+    {
+        wl_client_post_no_memory( client );
+        return;
+    }
+    wl_resource_set_implementation( feedback, &s_feedbackImpl, nullptr, nullptr );
+
+    // Surfaces are not placed on outputs yet, so the first output is assumed
+    auto self = (LinuxDmabuf*)wl_resource_get_user_data( resource );
+    std::vector<const DmabufFeedback::Tranche*> tranches;
+    if( !self->m_feedback.outputs.empty() ) tranches.emplace_back( &self->m_feedback.outputs[0] );
+    tranches.emplace_back( &self->m_feedback.render );
+    self->SendFeedback( feedback, tranches );
+}
+
+void LinuxDmabuf::ParamsAdd( wl_client* client, wl_resource* resource, int32_t fd, uint32_t plane, uint32_t offset, uint32_t stride, uint32_t modifierHi, uint32_t modifierLo )
+{
+    auto params = (Params*)wl_resource_get_user_data( resource );
+    if( params->used )
+    {
+        close( fd );
+        wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED, "Params were already used" );
+        return;
+    }
+    if( plane >= VlkImage::DmaBuf::MaxPlanes )
+    {
+        close( fd );
+        wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_IDX, "Plane index %u out of bounds", plane );
+        return;
+    }
+    if( params->planeSet[plane] )
+    {
+        close( fd );
+        wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_PLANE_SET, "Plane %u was already set", plane );
+        return;
+    }
+
+    const auto modifier = ( uint64_t( modifierHi ) << 32 ) | modifierLo;
+    auto& dmaBuf = params->dmaBuf;
+    if( dmaBuf.numPlanes > 0 && dmaBuf.modifier != modifier )
+    {
+        close( fd );
+        wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT, "All planes must have the same modifier" );
+        return;
+    }
+
+    params->planeSet[plane] = true;
+    dmaBuf.fd[plane] = fd;
+    dmaBuf.offset[plane] = offset;
+    dmaBuf.stride[plane] = stride;
+    dmaBuf.modifier = modifier;
+    dmaBuf.numPlanes++;
+}
+
+void LinuxDmabuf::ParamsCreate( wl_client* client, wl_resource* resource, int32_t width, int32_t height, uint32_t format, uint32_t flags )
+{
+    auto params = (Params*)wl_resource_get_user_data( resource );
+    auto buffer = params->owner->CreateBuffer( client, resource, 0, width, height, format, flags );
+    if( buffer )
+    {
+        zwp_linux_buffer_params_v1_send_created( resource, buffer );
+    }
+    else
+    {
+        zwp_linux_buffer_params_v1_send_failed( resource );
+    }
+}
+
+void LinuxDmabuf::ParamsCreateImmed( wl_client* client, wl_resource* resource, uint32_t bufferId, int32_t width, int32_t height, uint32_t format, uint32_t flags )
+{
+    auto params = (Params*)wl_resource_get_user_data( resource );
+    auto buffer = params->owner->CreateBuffer( client, resource, bufferId, width, height, format, flags );
+    if( !buffer )
+    {
+        // The client already uses the buffer id, there is no sane way to continue. If a protocol error was posted
+        // already, this one is ignored.
+        wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_WL_BUFFER, "Failed to import dma-buf" );
+    }
+}
+
+wl_resource* LinuxDmabuf::CreateBuffer( wl_client* client, wl_resource* resource, uint32_t bufferId, int32_t width, int32_t height, uint32_t format, uint32_t flags )
+{
+    ZoneScoped;
+
+    auto params = (Params*)wl_resource_get_user_data( resource );
+    if( params->used )
+    {
+        wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_ALREADY_USED, "Params were already used" );
+        return nullptr;
+    }
+    params->used = true;
+
+    auto& dmaBuf = params->dmaBuf;
+    if( dmaBuf.numPlanes == 0 )
+    {
+        wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE, "No planes were added" );
+        return nullptr;
+    }
+    for( uint32_t i=0; i<dmaBuf.numPlanes; i++ )
+    {
+        if( !params->planeSet[i] )
+        {
+            wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INCOMPLETE, "Plane %u is missing", i );
+            return nullptr;
+        }
+    }
+    if( width <= 0 || height <= 0 )
+    {
+        wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_DIMENSIONS, "Invalid buffer size %ix%i", width, height );
+        return nullptr;
+    }
+
+    auto drmFormat = FindDrmFormat( format );
+    if( !drmFormat )
+    {
+        wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_INVALID_FORMAT, "Unsupported format 0x%x", format );
+        return nullptr;
+    }
+
+    for( uint32_t i=0; i<dmaBuf.numPlanes; i++ )
+    {
+        const auto size = lseek( dmaBuf.fd[i], 0, SEEK_END );
+        if( size < 0 ) continue;        // Not all dma-bufs can tell their size
+        const auto end = uint64_t( dmaBuf.offset[i] ) + ( i == 0 ? uint64_t( dmaBuf.stride[i] ) * height : 0 );
+        if( dmaBuf.offset[i] >= size || end > uint64_t( size ) )
+        {
+            wl_resource_post_error( resource, ZWP_LINUX_BUFFER_PARAMS_V1_ERROR_OUT_OF_BOUNDS, "Plane %u is out of the buffer bounds", i );
+            return nullptr;
+        }
+    }
+
+    // Interlaced buffers would need a deinterlacing pass. Implicit modifiers and mismatched plane counts are not
+    // valid in a Vulkan import, so they fail here instead of later in the driver.
+    if( ( flags & ( ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_INTERLACED | ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_BOTTOM_FIRST ) ) ||
+        dmaBuf.modifier == DRM_FORMAT_MOD_INVALID ||
+        ModifierPlaneCount( *m_feedback.gpu, drmFormat->vk, dmaBuf.modifier ) != dmaBuf.numPlanes )
+    {
+        return nullptr;
+    }
+
+    dmaBuf.width = uint32_t( width );
+    dmaBuf.height = uint32_t( height );
+    dmaBuf.format = drmFormat->vk;
+
+    std::shared_ptr<VlkImage> image;
+    try
+    {
+        image = m_cache.Get( dmaBuf );
+    }
+    catch( const VlkImage::ImportException& e )
+    {
+        mclog( LogLevel::Debug, "Failed to import client dma-buf: %s", e.what() );
+        return nullptr;
+    }
+
+    // Buffers sharing a cached import are each charged in full, as the client could drop the others at any time
+    if( !m_accounting.Charge( client, ClientAccounting::Resource::GpuMemory, image->Size() ) ) return nullptr;
+
+    auto buffer = wl_resource_create( client, &wl_buffer_interface, 1, bufferId );
+    if( !buffer )
+    {
+        m_accounting.Release( client, ClientAccounting::Resource::GpuMemory, image->Size() );
+        wl_client_post_no_memory( client );
+        return nullptr;
+    }
+    wl_resource_set_implementation( buffer, &s_bufferImpl, new Buffer { std::move( image ), ( flags & ZWP_LINUX_BUFFER_PARAMS_V1_FLAGS_Y_INVERT ) != 0, m_accounting, client }, []( wl_resource* r ) {
+        auto buffer = (Buffer*)wl_resource_get_user_data( r );
+        buffer->accounting.Release( buffer->client, ClientAccounting::Resource::GpuMemory, buffer->image->Size() );
+        delete buffer;
+    } );
+    return buffer;
+}
+
+void LinuxDmabuf::CreateFormatTable()
+{
+    ZoneScoped;
+
+    auto addFormats = [this]( const DmabufFeedback::Tranche& tranche ) {
+        for( auto& f : tranche.formats )
+        {
+            if( std::ranges::find( m_table, f ) == m_table.end() ) m_table.emplace_back( f );
+        }
+    };
+    addFormats( m_feedback.render );
+    for( auto& output : m_feedback.outputs ) addFormats( output );
+    CheckPanic( m_table.size() <= UINT16_MAX, "Too many formats for the format table" );
+
+    std::vector<TableEntry> entries;
+    entries.reserve( m_table.size() );
+    for( auto& f : m_table ) entries.emplace_back( TableEntry { f.format, 0, f.modifier } );
+
+    // Clients map the table, it must not change under them
+    m_tableSize = entries.size() * sizeof( TableEntry );
+    m_tableFd = memfd_create( "mcore-dmabuf-formats", MFD_CLOEXEC | MFD_ALLOW_SEALING );
+    CheckPanic( m_tableFd >= 0, "Failed to create format table: %s", strerror( errno ) );
+    CheckPanic( write( m_tableFd, entries.data(), m_tableSize ) == ssize_t( m_tableSize ), "Failed to write format table" );
+    fcntl( m_tableFd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL );
+}
+
+void LinuxDmabuf::SendFeedback( wl_resource* resource, const std::vector<const DmabufFeedback::Tranche*>& tranches ) const
+{
+    ZoneScoped;
+
+    zwp_linux_dmabuf_feedback_v1_send_format_table( resource, m_tableFd, m_tableSize );
+
+    wl_array dev;
+    wl_array_init( &dev );
+    AddDevice( dev, m_feedback.mainDevice );
+    zwp_linux_dmabuf_feedback_v1_send_main_device( resource, &dev );
+    wl_array_release( &dev );
+
+    for( auto tranche : tranches )
+    {
+        if( tranche->formats.empty() ) continue;
+
+        wl_array_init( &dev );
+        AddDevice( dev, tranche->device );
+        zwp_linux_dmabuf_feedback_v1_send_tranche_target_device( resource, &dev );
+        wl_array_release( &dev );
+
+        wl_array indices;
+        wl_array_init( &indices );
+        for( auto& f : tranche->formats )
+        {
+            auto idx = (uint16_t*)wl_array_add( &indices, sizeof( uint16_t ) );
+            CheckPanic( idx, "Out of memory" );
+            *idx = uint16_t( std::ranges::find( m_table, f ) - m_table.begin() );
+        }
+        zwp_linux_dmabuf_feedback_v1_send_tranche_formats( resource, &indices );
+        wl_array_release( &indices );
+
+        zwp_linux_dmabuf_feedback_v1_send_tranche_flags( resource, tranche->scanout ? ZWP_LINUX_DMABUF_FEEDBACK_V1_TRANCHE_FLAGS_SCANOUT : 0 );
+        zwp_linux_dmabuf_feedback_v1_send_tranche_done( resource );
+    }
+
+    zwp_linux_dmabuf_feedback_v1_send_done( resource );
+}
+
+void LinuxDmabuf::SendModifiers( wl_resource* resource, uint32_t version ) const
+{
+    uint32_t last = 0;
+    for( auto& f : m_feedback.render.formats )
+    {
+        if( version >= ZWP_LINUX_DMABUF_V1_MODIFIER_SINCE_VERSION )
+        {
+            zwp_linux_dmabuf_v1_send_modifier( resource, f.format, uint32_t( f.modifier >> 32 ), uint32_t( f.modifier & 0xffffffff ) );
+        }
+        else if( f.format != last )
+        {
+            zwp_linux_dmabuf_v1_send_format( resource, f.format );
+        }
+        last = f.format;
+    }
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include "DmabufCache.hpp"
+#include "backend/DmabufFeedback.hpp"
+#include "util/NoCopy.hpp"
+
+extern "C" {
+    struct wl_client;
+    struct wl_display;
+    struct wl_global;
+    struct wl_resource;
+};
+
+class ClientAccounting;
+class VlkImage;
+
+// The zwp_linux_dmabuf_v1 global. Client buffers are imported on the GPU in the feedback, so GPU clients never
+// have to go through shared memory.
+//
+// Surface feedback lists the scanout formats first, so that a fullscreen client can allocate buffers the primary
+// plane can show directly. Imported buffers are charged to the client's GPU memory.
+class LinuxDmabuf
+{
+public:
+    static constexpr uint32_t Version = 4;
+
+    LinuxDmabuf( wl_display* dpy, DmabufFeedback feedback, ClientAccounting& accounting );
+    ~LinuxDmabuf();
+
+    NoCopy( LinuxDmabuf );
+
+    // The imported image of a wl_buffer, or nullptr if it is not a dma-buf buffer
+    [[nodiscard]] static std::shared_ptr<VlkImage> GetImage( wl_resource* buffer );
+
+private:
+    struct Params;
+
+    static void Bind( wl_client* client, void* data, uint32_t version, uint32_t id );
+
+    static void CreateParams( wl_client* client, wl_resource* resource, uint32_t id );
+    static void GetDefaultFeedback( wl_client* client, wl_resource* resource, uint32_t id );
+    static void GetSurfaceFeedback( wl_client* client, wl_resource* resource, uint32_t id, wl_resource* surface );
+
+    static void ParamsAdd( wl_client* client, wl_resource* resource, int32_t fd, uint32_t plane, uint32_t offset, uint32_t stride, uint32_t modifierHi, uint32_t modifierLo );
+    static void ParamsCreate( wl_client* client, wl_resource* resource, int32_t width, int32_t height, uint32_t format, uint32_t flags );
+    static void ParamsCreateImmed( wl_client* client, wl_resource* resource, uint32_t bufferId, int32_t width, int32_t height, uint32_t format, uint32_t flags );
+
+    // Returns the new wl_buffer, or nullptr if the import failed
+    wl_resource* CreateBuffer( wl_client* client, wl_resource* params, uint32_t bufferId, int32_t width, int32_t height, uint32_t format, uint32_t flags );
+
+    void CreateFormatTable();
+    void SendFeedback( wl_resource* resource, const std::vector<const DmabufFeedback::Tranche*>& tranches ) const;
+    void SendModifiers( wl_resource* resource, uint32_t version ) const;
+
+    DmabufFeedback m_feedback;
+    ClientAccounting& m_accounting;
+    DmabufCache m_cache;
+
+    std::vector<DmabufFeedback::Format> m_table;
+    int m_tableFd = -1;
+    size_t m_tableSize = 0;
+
+    wl_global* m_global;
+};
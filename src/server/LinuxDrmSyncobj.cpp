@@ -0,0 +1,319 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+#include <utility>
+#include <wayland-server-core.h>
+#include <xf86drm.h>
+
+#include "LinuxDrmSyncobj.hpp"
+#include "util/Logs.hpp"
+#include "util/Panic.hpp"
+
+#include "wayland-linux-drm-syncobj-v1-server-protocol.h"
+
+struct LinuxDrmSyncobj::Surface
+{
+    wl_listener destroy;        // Of the wl_surface. Must be first, the listener is cast back to the surface.
+    LinuxDrmSyncobj* owner;
+    wl_resource* resource;
+    wl_resource* surface;       // Null once the wl_surface was destroyed
+    Points pending;
+};
+
+namespace
+{
+void DestroyResource( wl_client*, wl_resource* resource )
+{
+    wl_resource_destroy( resource );
+}
+
+const struct wp_linux_drm_syncobj_timeline_v1_interface s_timelineImpl = {
+    .destroy = DestroyResource
+};
+
+std::shared_ptr<SyncobjTimeline> GetTimeline( wl_resource* timeline )
+{
+    return *(std::shared_ptr<SyncobjTimeline>*)wl_resource_get_user_data( timeline );
+}
+
+// Points of a timeline can't be exported or set directly, only through a binary syncobj
+class TempSyncobj
+{
+public:
+    explicit TempSyncobj( int fd )
+        : m_fd( fd )
+    {
+        if( drmSyncobjCreate( fd, 0, &m_handle ) != 0 ) m_handle = 0;
+    }
+
+    ~TempSyncobj() { if( m_handle ) drmSyncobjDestroy( m_fd, m_handle ); }
+
+    NoCopy( TempSyncobj );
+
+    [[nodiscard]] explicit operator bool() const { return m_handle != 0; }
+    [[nodiscard]] operator uint32_t() const { return m_handle; }
+
+private:
+    int m_fd;
+    uint32_t m_handle;
+};
+}
+
+SyncobjTimeline::SyncobjTimeline( int drmFd, uint32_t handle )
+    : m_fd( drmFd )
+    , m_handle( handle )
+{
+}
+
+SyncobjTimeline::~SyncobjTimeline()
+{
+    drmSyncobjDestroy( m_fd, m_handle );
+    close( m_fd );
+}
+
+int SyncobjTimeline::ExportSyncFd( uint64_t point ) const
+{
+    TempSyncobj tmp( m_fd );
+    if( !tmp || drmSyncobjTransfer( m_fd, tmp, 0, m_handle, point, 0 ) != 0 ) return -1;
+
+    int fd;
+    if( drmSyncobjExportSyncFile( m_fd, tmp, &fd ) != 0 ) return -1;
+    return fd;
+}
+
+int SyncobjTimeline::AvailableFd( uint64_t point ) const
+{
+    const auto fd = eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK );
+    if( fd < 0 ) return -1;
+    if( drmSyncobjEventfd( m_fd, m_handle, point, fd, DRM_SYNCOBJ_WAIT_FLAGS_WAIT_AVAILABLE ) != 0 )
+    {
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+bool SyncobjTimeline::ImportSyncFd( uint64_t point, int fd ) const
+{
+    TempSyncobj tmp( m_fd );
+    const auto ok = tmp && drmSyncobjImportSyncFile( m_fd, tmp, fd ) == 0 && drmSyncobjTransfer( m_fd, m_handle, point, tmp, 0, 0 ) == 0;
+    close( fd );
+    return ok;
+}
+
+void SyncobjTimeline::Signal( uint64_t point ) const
+{
+    if( drmSyncobjTimelineSignal( m_fd, &m_handle, &point, 1 ) != 0 )
+    {
+        mclog( LogLevel::Warning, "Failed to signal syncobj release point: %s", strerror( errno ) );
+    }
+}
+
+SyncobjRelease::SyncobjRelease( std::shared_ptr<SyncobjTimeline> timeline, uint64_t point )
+    : m_timeline( std::move( timeline ) )
+    , m_point( point )
+{
+}
+
+SyncobjRelease::~SyncobjRelease()
+{
+    m_timeline->Signal( m_point );
+}
+
+int LinuxDrmSyncobj::OpenDevice( dev_t device )
+{
+    drmDevicePtr dev;
+    if( drmGetDeviceFromDevId( device, 0, &dev ) != 0 ) return -1;
+
+    // Syncobjs work on either node, the render node does not need DRM master
+    const auto node = ( dev->available_nodes & ( 1 << DRM_NODE_RENDER ) ) ? DRM_NODE_RENDER : DRM_NODE_PRIMARY;
+    const auto fd = ( dev->available_nodes & ( 1 << node ) ) ? open( dev->nodes[node], O_RDWR | O_CLOEXEC ) : -1;
+    drmFreeDevice( &dev );
+    if( fd < 0 ) return -1;
+
+    uint64_t cap = 0;
+    if( drmGetCap( fd, DRM_CAP_SYNCOBJ_TIMELINE, &cap ) != 0 || !cap )
+    {
+        mclog( LogLevel::Info, "No timeline syncobj support, explicit sync is not available" );
+        close( fd );
+        return -1;
+    }
+    return fd;
+}
+
+LinuxDrmSyncobj::LinuxDrmSyncobj( wl_display* dpy, int drmFd )
+    : m_fd( drmFd )
+{
+    m_global = wl_global_create( dpy, &wp_linux_drm_syncobj_manager_v1_interface, Version, this, Bind );
+    CheckPanic( m_global, "Failed to create linux-drm-syncobj global" );
+}
+
+LinuxDrmSyncobj::~LinuxDrmSyncobj()
+{
+    wl_global_destroy( m_global );
+    for( auto& [surface, s] : m_surfaces )
+    {
+        wl_list_remove( &s->destroy.link );
+        wl_list_init( &s->destroy.link );
+        s->owner = nullptr;
+        s->surface = nullptr;
+    }
+    close( m_fd );
+}
+
+bool LinuxDrmSyncobj::TakePoints( wl_resource* surface, bool hasBuffer, Points& points )
+{
+    points = {};
+    auto it = m_surfaces.find( surface );
+    if( it == m_surfaces.end() ) return true;
+
+    auto s = it->second;
+    points = std::exchange( s->pending, {} );
+    if( !hasBuffer )
+    {
+        if( !points.acquire && !points.release ) return true;
+        wl_resource_post_error( s->resource, WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_BUFFER, "Points set without a buffer" );
+        return false;
+    }
+    if( !points.acquire )
+    {
+        wl_resource_post_error( s->resource, WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_ACQUIRE_POINT, "No acquire point" );
+        return false;
+    }
+    if( !points.release )
+    {
+        wl_resource_post_error( s->resource, WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_RELEASE_POINT, "No release point" );
+        return false;
+    }
+    if( points.acquire == points.release && points.acquirePoint >= points.releasePoint )
+    {
+        wl_resource_post_error( s->resource, WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_CONFLICTING_POINTS, "Release point must be after the acquire point" );
+        return false;
+    }
+    return true;
+}
+
+void LinuxDrmSyncobj::Bind( wl_client* client, void* data, uint32_t version, uint32_t id )
+{
+    static const struct wp_linux_drm_syncobj_manager_v1_interface impl = {
+        .destroy = DestroyResource,
+        .get_surface = GetSurface,
+        .import_timeline = ImportTimeline
+    };
+
+    auto resource = wl_resource_create( client, &wp_linux_drm_syncobj_manager_v1_interface, version, id );
+    if( !resource )
+    {
+        wl_client_post_no_memory( client );
+        return;
+    }
+    wl_resource_set_implementation( resource, &impl, data, nullptr );
+}
+
+void LinuxDrmSyncobj::GetSurface( wl_client* client, wl_resource* resource, uint32_t id, wl_resource* surface )
+{
+    static const struct wp_linux_drm_syncobj_surface_v1_interface impl = {
+        .destroy = DestroyResource,
+        .set_acquire_point = SetAcquirePoint,
+        .set_release_point = SetReleasePoint
+    };
+
+    auto self = (LinuxDrmSyncobj*)wl_resource_get_user_data( resource );
+    if( self->m_surfaces.contains( surface ) )
+    {
+        wl_resource_post_error( resource, WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_SURFACE_EXISTS, "Surface already has a syncobj surface" );
+        return;
+    }
+
+    auto syncSurface = wl_resource_create( client, &wp_linux_drm_syncobj_surface_v1_interface, wl_resource_get_version( resource ), id );
+    if( !syncSurface )
+    {
+        wl_client_post_no_memory( client );
+        return;
+    }
+
+    auto data = new Surface {
+        .destroy = {},
+        .owner = self,
+        .resource = syncSurface,
+        .surface = surface,
+        .pending = {}
+    };
+    data->destroy.notify = []( wl_listener* listener, void* ) {
+        auto s = (Surface*)listener;
+        if( s->owner ) s->owner->m_surfaces.erase( s->surface );
+        s->surface = nullptr;
+        wl_list_remove( &s->destroy.link );
+        wl_list_init( &s->destroy.link );
+    };
+    wl_resource_add_destroy_listener( surface, &data->destroy );
+    self->m_surfaces.emplace( surface, data );
+
+    wl_resource_set_implementation( syncSurface, &impl, data, []( wl_resource* r ) {
+        auto s = (Surface*)wl_resource_get_user_data( r );
+        if( s->owner && s->surface ) s->owner->m_surfaces.erase( s->surface );
+        wl_list_remove( &s->destroy.link );
+        delete s;
+    } );
+}
+
+void LinuxDrmSyncobj::ImportTimeline( wl_client* client, wl_resource* resource, uint32_t id, int32_t fd )
+{
+    auto self = (LinuxDrmSyncobj*)wl_resource_get_user_data( resource );
+
+    uint32_t handle;
+    const auto ret = drmSyncobjFDToHandle( self->m_fd, fd, &handle );
+    close( fd );
+    if( ret != 0 )
+    {
+        wl_resource_post_error( resource, WP_LINUX_DRM_SYNCOBJ_MANAGER_V1_ERROR_INVALID_TIMELINE, "Failed to import timeline: %s", strerror( errno ) );
+        return;
+    }
+
+    // Each timeline has its own descriptor of the same file, so that it can outlive the global in garbage
+    const auto timelineFd = fcntl( self->m_fd, F_DUPFD_CLOEXEC, 0 );
+    if( timelineFd < 0 )
+    {
+        drmSyncobjDestroy( self->m_fd, handle );
+        wl_client_post_no_memory( client );
+        return;
+    }
+    auto timeline = std::make_shared<SyncobjTimeline>( timelineFd, handle );
+
+    auto timelineResource = wl_resource_create( client, &wp_linux_drm_syncobj_timeline_v1_interface, wl_resource_get_version( resource ), id );
+    if( !timelineResource )
+    {
+        wl_client_post_no_memory( client );
+        return;
+    }
+    wl_resource_set_implementation( timelineResource, &s_timelineImpl, new std::shared_ptr<SyncobjTimeline>( std::move( timeline ) ), []( wl_resource* r ) {
+        delete (std::shared_ptr<SyncobjTimeline>*)wl_resource_get_user_data( r );
+    } );
+}
+
+void LinuxDrmSyncobj::SetAcquirePoint( wl_client*, wl_resource* resource, wl_resource* timeline, uint32_t pointHi, uint32_t pointLo )
+{
+    auto s = (Surface*)wl_resource_get_user_data( resource );
+    if( !s->surface )
+    {
+        wl_resource_post_error( resource, WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_SURFACE, "The surface was destroyed" );
+        return;
+    }
+    s->pending.acquire = GetTimeline( timeline );
+    s->pending.acquirePoint = ( uint64_t( pointHi ) << 32 ) | pointLo;
+}
+
+void LinuxDrmSyncobj::SetReleasePoint( wl_client*, wl_resource* resource, wl_resource* timeline, uint32_t pointHi, uint32_t pointLo )
+{
+    auto s = (Surface*)wl_resource_get_user_data( resource );
+    if( !s->surface )
+    {
+        wl_resource_post_error( resource, WP_LINUX_DRM_SYNCOBJ_SURFACE_V1_ERROR_NO_SURFACE, "The surface was destroyed" );
+        return;
+    }
+    s->pending.release = GetTimeline( timeline );
+    s->pending.releasePoint = ( uint64_t( pointHi ) << 32 ) | pointLo;
+}
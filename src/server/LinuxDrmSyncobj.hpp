@@ -0,0 +1,105 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <sys/types.h>
+
+#include "util/NoCopy.hpp"
+#include "util/RobinHood.hpp"
+#include "vulkan/VlkBase.hpp"
+
+extern "C" {
+    struct wl_client;
+    struct wl_display;
+    struct wl_global;
+    struct wl_resource;
+};
+
+// A client's timeline drm syncobj, imported on the DRM device of the GPU
+class SyncobjTimeline
+{
+public:
+    SyncobjTimeline( int drmFd, uint32_t handle );
+    ~SyncobjTimeline();
+
+    NoCopy( SyncobjTimeline );
+
+    // The fence of the point as a sync_file, for a temporary import into a binary semaphore, which composition
+    // waits on. Returns -1 if the client has not submitted the work to signal the point yet.
+    [[nodiscard]] int ExportSyncFd( uint64_t point ) const;
+
+    // An eventfd which becomes readable once the point has a fence, so that a commit can wait for the client's
+    // submission on the event loop, instead of blocking. Returns -1 on failure.
+    [[nodiscard]] int AvailableFd( uint64_t point ) const;
+
+    // Signals the point once the sync_file does, which takes ownership of the descriptor
+    bool ImportSyncFd( uint64_t point, int fd ) const;
+    void Signal( uint64_t point ) const;
+
+private:
+    int m_fd;
+    uint32_t m_handle;
+};
+
+// Signals a release point when destroyed. Given to VlkGarbage with the other objects of a frame, the client gets
+// its buffer back as soon as the frame which used it has retired, without the compositor waiting on anything.
+class SyncobjRelease : public VlkBase
+{
+public:
+    SyncobjRelease( std::shared_ptr<SyncobjTimeline> timeline, uint64_t point );
+    ~SyncobjRelease() override;
+
+    NoCopy( SyncobjRelease );
+
+private:
+    std::shared_ptr<SyncobjTimeline> m_timeline;
+    uint64_t m_point;
+};
+
+// The wp_linux_drm_syncobj_manager_v1 global, for explicit synchronization of client buffers. Surfaces with a
+// syncobj surface attached come with an acquire point to wait on before their buffer is read, and a release
+// point to signal once it is not used anymore. Implicit sync of the dma-buf is then not needed at all.
+class LinuxDrmSyncobj
+{
+public:
+    static constexpr uint32_t Version = 1;
+
+    // Points set for the next commit of a surface
+    struct Points
+    {
+        std::shared_ptr<SyncobjTimeline> acquire;
+        uint64_t acquirePoint = 0;
+        std::shared_ptr<SyncobjTimeline> release;
+        uint64_t releasePoint = 0;
+    };
+
+    // Returns a descriptor of the render node of the device, or -1 if it can't be opened or has no timeline
+    // syncobj support
+    [[nodiscard]] static int OpenDevice( dev_t device );
+
+    // Takes ownership of the descriptor
+    LinuxDrmSyncobj( wl_display* dpy, int drmFd );
+    ~LinuxDrmSyncobj();
+
+    NoCopy( LinuxDrmSyncobj );
+
+    // Takes the points of the wl_surface, which its commit applies to the buffer. Both are null if the surface
+    // has no syncobj surface, and implicit sync is used. Returns false, with a protocol error posted, if the
+    // points don't fit the commit.
+    [[nodiscard]] bool TakePoints( wl_resource* surface, bool hasBuffer, Points& points );
+
+private:
+    struct Surface;
+
+    static void Bind( wl_client* client, void* data, uint32_t version, uint32_t id );
+    static void GetSurface( wl_client* client, wl_resource* resource, uint32_t id, wl_resource* surface );
+    static void ImportTimeline( wl_client* client, wl_resource* resource, uint32_t id, int32_t fd );
+
+    static void SetAcquirePoint( wl_client* client, wl_resource* resource, wl_resource* timeline, uint32_t pointHi, uint32_t pointLo );
+    static void SetReleasePoint( wl_client* client, wl_resource* resource, wl_resource* timeline, uint32_t pointHi, uint32_t pointLo );
+
+    int m_fd;
+    unordered_flat_map<wl_resource*, Surface*> m_surfaces;     // By wl_surface
+
+    wl_global* m_global;
+};
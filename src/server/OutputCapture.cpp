@@ -0,0 +1,145 @@
+#include <tracy/Tracy.hpp>
+
+#include "OutputCapture.hpp"
+#include "vulkan/VlkCommandBuffer.hpp"
+#include "vulkan/VlkDevice.hpp"
+#include "vulkan/VlkImage.hpp"
+
+namespace
+{
+// Client buffers are passed between the compositor and the client through the foreign queue family
+VkImageMemoryBarrier2 TargetBarrier( VkImage image, uint32_t queueFamily, bool acquire )
+{
+    return {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = acquire ? VK_PIPELINE_STAGE_2_NONE : VK_PIPELINE_STAGE_2_BLIT_BIT,
+        .srcAccessMask = acquire ? VK_ACCESS_2_NONE : VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = acquire ? VK_PIPELINE_STAGE_2_BLIT_BIT : VK_PIPELINE_STAGE_2_NONE,
+        .dstAccessMask = acquire ? VK_ACCESS_2_TRANSFER_WRITE_BIT : VK_ACCESS_2_NONE,
+        .oldLayout = acquire ? VK_IMAGE_LAYOUT_GENERAL : VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = acquire ? VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL : VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = acquire ? VK_QUEUE_FAMILY_FOREIGN_EXT : queueFamily,
+        .dstQueueFamilyIndex = acquire ? queueFamily : VK_QUEUE_FAMILY_FOREIGN_EXT,
+        .image = image,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+    };
+}
+}
+
+OutputCapture::OutputCapture( const Region::Rect& bounds )
+    : m_damage( bounds, 16 )
+{
+}
+
+void OutputCapture::Reset( const Region::Rect& bounds )
+{
+    m_damage.Reset( bounds );
+    m_filled.clear();
+}
+
+void OutputCapture::Queue( std::shared_ptr<VlkImage> target, uint32_t width, uint32_t height, const Region& clientDamage, DoneCallback done )
+{
+    m_queued.emplace_back( Request { std::move( target ), width, height, clientDamage, std::move( done ) } );
+}
+
+void OutputCapture::Record( VlkDevice& device, VlkCommandBuffer& cmdbuf, VkImage source, const Region& damage, std::vector<std::shared_ptr<VlkBase>>& release )
+{
+    ZoneScoped;
+
+    const auto frame = ++m_frame;
+    m_damage.Add( damage );
+    if( m_queued.empty() ) return;
+
+    std::erase_if( m_filled, []( const auto& it ) { return it.second.target.expired(); } );
+
+    const auto& bounds = m_damage.Bounds();
+    const auto queueFamily = uint32_t( device.GetQueueInfo( cmdbuf ).idx );
+
+    std::vector<VkImageMemoryBarrier2> acquire;
+    std::vector<std::pair<const Request*, Region>> copies;
+    for( auto& req : m_queued )
+    {
+        if( int32_t( req.width ) != bounds.Width() || int32_t( req.height ) != bounds.Height() )
+        {
+            req.done( false, {}, 0 );
+            continue;
+        }
+
+        auto it = m_filled.find( req.target.get() );
+        const auto age = it != m_filled.end() && it->second.target.lock() == req.target ? frame - it->second.frame : 0;
+        auto region = m_damage.Since( uint32_t( std::min<uint64_t>( age, UINT32_MAX ) ) );
+        if( !req.clientDamage.IsEmpty() )
+        {
+            auto client = req.clientDamage;
+            client.Translate( bounds.x0, bounds.y0 );
+            client.Intersect( bounds );
+            region.Add( client );
+        }
+
+        m_filled[req.target.get()] = Filled { req.target, frame };
+        acquire.emplace_back( TargetBarrier( *req.target, queueFamily, true ) );
+        copies.emplace_back( &req, std::move( region ) );
+    }
+
+    if( !copies.empty() )
+    {
+        // The composition wrote the source as a color attachment
+        const VkMemoryBarrier2 sourceBarrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
+            .srcAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_BLIT_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT
+        };
+        const VkDependencyInfo acquireDeps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .memoryBarrierCount = 1,
+            .pMemoryBarriers = &sourceBarrier,
+            .imageMemoryBarrierCount = uint32_t( acquire.size() ),
+            .pImageMemoryBarriers = acquire.data()
+        };
+        vkCmdPipelineBarrier2( cmdbuf, &acquireDeps );
+
+        // Blits rather than copies, as the client may have picked a different format of the same size
+        std::vector<VkImageBlit> blits;
+        std::vector<VkImageMemoryBarrier2> releaseBarriers;
+        for( auto& [req, region] : copies )
+        {
+            blits.clear();
+            for( auto& r : region.Rects() )
+            {
+                const VkOffset3D o0 = { r.x0 - bounds.x0, r.y0 - bounds.y0, 0 };
+                const VkOffset3D o1 = { r.x1 - bounds.x0, r.y1 - bounds.y0, 1 };
+                blits.emplace_back( VkImageBlit {
+                    .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+                    .srcOffsets = { o0, o1 },
+                    .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+                    .dstOffsets = { o0, o1 }
+                } );
+            }
+            if( !blits.empty() ) vkCmdBlitImage( cmdbuf, source, VK_IMAGE_LAYOUT_GENERAL, *req->target, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t( blits.size() ), blits.data(), VK_FILTER_NEAREST );
+            releaseBarriers.emplace_back( TargetBarrier( *req->target, queueFamily, false ) );
+        }
+
+        const VkDependencyInfo releaseDeps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = uint32_t( releaseBarriers.size() ),
+            .pImageMemoryBarriers = releaseBarriers.data()
+        };
+        vkCmdPipelineBarrier2( cmdbuf, &releaseDeps );
+
+        for( auto& [req, region] : copies )
+        {
+            release.emplace_back( req->target );
+            m_copied.emplace_back( Copied { std::move( region ), std::move( req->done ) } );
+        }
+        TracyPlot( "Capture copies", int64_t( copies.size() ) );
+    }
+    m_queued.clear();
+}
+
+void OutputCapture::Presented( uint64_t time )
+{
+    for( auto& copy : m_copied ) copy.done( true, copy.damage, time );
+    m_copied.clear();
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <stdint.h>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "util/DamageRing.hpp"
+#include "util/NoCopy.hpp"
+#include "util/Region.hpp"
+#include "util/RobinHood.hpp"
+
+class VlkBase;
+class VlkCommandBuffer;
+class VlkDevice;
+class VlkImage;
+
+// Screen capture of an output into client dma-bufs. The copies are recorded into the command buffer of the
+// output's frame, right behind the composition, so that capture never reads pixels back on the CPU and never
+// holds up the frame. Each client buffer remembers the frame it was last filled with, and only what was damaged
+// since then is copied again, the same way the output itself repaints by buffer age.
+//
+// Must be externally synchronized.
+class OutputCapture
+{
+public:
+    // The damage which was copied into the buffer, in output coordinates, and the presentation time in
+    // microseconds. Called with ok set to false if the buffer does not fit the output.
+    using DoneCallback = std::function<void( bool ok, const Region& damage, uint64_t time )>;
+
+    explicit OutputCapture( const Region::Rect& bounds );
+
+    NoCopy( OutputCapture );
+
+    // The output has a new size, all buffers are filled completely again
+    void Reset( const Region::Rect& bounds );
+
+    // The buffer is filled from the next frame of the output. Client damage is what the client changed in the
+    // buffer since it was last filled, and is copied again as well.
+    void Queue( std::shared_ptr<VlkImage> target, uint32_t width, uint32_t height, const Region& clientDamage, DoneCallback done );
+    [[nodiscard]] bool HasQueued() const { return !m_queued.empty(); }
+
+    // Records the copies of the frame into the queued buffers. The source must be in the general layout, owned by
+    // the queue family of the command buffer, and written by color attachment output before. The targets are
+    // added to release, to be kept until the GPU is done with the frame.
+    void Record( VlkDevice& device, VlkCommandBuffer& cmdbuf, VkImage source, const Region& damage, std::vector<std::shared_ptr<VlkBase>>& release );
+
+    // The frame of the last recording reached the screen
+    void Presented( uint64_t time );
+
+private:
+    struct Request
+    {
+        std::shared_ptr<VlkImage> target;
+        uint32_t width;
+        uint32_t height;
+        Region clientDamage;
+        DoneCallback done;
+    };
+
+    struct Filled
+    {
+        std::weak_ptr<VlkImage> target;     // The address alone may be reused by a later import
+        uint64_t frame;
+    };
+
+    struct Copied
+    {
+        Region damage;
+        DoneCallback done;
+    };
+
+    DamageRing m_damage;
+    uint64_t m_frame = 0;
+
+    std::vector<Request> m_queued;
+    std::vector<Copied> m_copied;
+    unordered_flat_map<const VlkImage*, Filled> m_filled;
+};
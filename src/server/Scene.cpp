@@ -0,0 +1,218 @@
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include "Scene.hpp"
+#include "util/Panic.hpp"
+
+Scene::Id Scene::AddOutput( const Region::Rect& rect, DamageCallback damaged )
+{
+    const auto id = m_nextId++;
+    m_outputs.emplace( id, Output { rect, Region( { 0, 0, rect.Width(), rect.Height() } ), std::move( damaged ) } );
+    return id;
+}
+
+void Scene::RemoveOutput( Id output )
+{
+    m_outputs.erase( output );
+}
+
+void Scene::SetOutputRect( Id output, const Region::Rect& rect )
+{
+    GetOutput( output ).rect = rect;
+    DamageOutput( output );
+}
+
+Scene::Id Scene::AddSurface()
+{
+    const auto id = m_nextId++;
+    m_surfaces.emplace( id, Surface {} );
+    m_stack.emplace_back( id );
+    return id;
+}
+
+void Scene::RemoveSurface( Id surface )
+{
+    DamageSurfaceRect( GetSurface( surface ) );
+    m_surfaces.erase( surface );
+    std::erase( m_stack, surface );
+}
+
+void Scene::MapSurface( Id surface, bool mapped )
+{
+    auto& s = GetSurface( surface );
+    if( s.mapped == mapped ) return;
+
+    // Either shown or uncovered, both damage the area
+    s.mapped = true;
+    DamageSurfaceRect( s );
+    s.mapped = mapped;
+}
+
+void Scene::SetPosition( Id surface, int32_t x, int32_t y )
+{
+    auto& s = GetSurface( surface );
+    if( s.rect.x0 == x && s.rect.y0 == y ) return;
+
+    // Both the area the surface left and the one it moved to
+    DamageSurfaceRect( s );
+    s.rect = { x, y, x + s.rect.Width(), y + s.rect.Height() };
+    DamageSurfaceRect( s );
+}
+
+void Scene::SetSize( Id surface, uint32_t width, uint32_t height )
+{
+    auto& s = GetSurface( surface );
+    if( s.rect.Width() == int32_t( width ) && s.rect.Height() == int32_t( height ) ) return;
+
+    DamageSurfaceRect( s );
+    s.rect.x1 = s.rect.x0 + int32_t( width );
+    s.rect.y1 = s.rect.y0 + int32_t( height );
+    DamageSurfaceRect( s );
+}
+
+void Scene::Raise( Id surface )
+{
+    auto it = std::ranges::find( m_stack, surface );
+    CheckPanic( it != m_stack.end(), "Unknown surface %u", surface );
+    if( it == m_stack.end() - 1 ) return;
+
+    m_stack.erase( it );
+    m_stack.emplace_back( surface );
+    DamageSurfaceRect( GetSurface( surface ) );
+}
+
+void Scene::SetOpaque( Id surface, const Region& opaque )
+{
+    auto& s = GetSurface( surface );
+    s.opaque = opaque.IsExact() ? opaque : Region();
+
+    // What is below the surface may have to be drawn again
+    DamageSurfaceRect( s );
+}
+
+void Scene::DamageSurface( Id surface, const Region& damage )
+{
+    auto& s = GetSurface( surface );
+    if( !s.mapped ) return;
+
+    auto region = damage;
+    region.Intersect( { 0, 0, s.rect.Width(), s.rect.Height() } );
+    region.Translate( s.rect.x0, s.rect.y0 );
+    DamageLayout( region );
+}
+
+void Scene::DamageOutput( Id output )
+{
+    auto& o = GetOutput( output );
+    o.damage = Region( { 0, 0, o.rect.Width(), o.rect.Height() } );
+    if( o.damaged ) o.damaged();
+}
+
+Scene::Pass Scene::BuildPass( Id output )
+{
+    ZoneScoped;
+
+    auto& o = GetOutput( output );
+    Pass pass;
+    pass.damage = std::move( o.damage );
+    o.damage.Clear();
+    if( pass.damage.IsEmpty() ) return pass;
+
+    // Front to back, so that what opaque surfaces cover can be dropped from the ones below
+    auto uncovered = pass.damage;
+    for( auto it = m_stack.rbegin(); it != m_stack.rend() && !uncovered.IsEmpty(); ++it )
+    {
+        const auto& s = m_surfaces.find( *it )->second;
+        if( !s.mapped || s.rect.IsEmpty() ) continue;
+
+        const Region::Rect rect = { s.rect.x0 - o.rect.x0, s.rect.y0 - o.rect.y0, s.rect.x1 - o.rect.x0, s.rect.y1 - o.rect.y0 };
+        if( !uncovered.Intersects( rect ) ) continue;
+
+        auto clip = uncovered;
+        clip.Intersect( rect );
+        pass.draws.emplace_back( Draw { *it, rect, std::move( clip ) } );
+
+        if( !s.opaque.IsEmpty() )
+        {
+            auto opaque = s.opaque;
+            opaque.Intersect( { 0, 0, rect.Width(), rect.Height() } );
+            opaque.Translate( rect.x0, rect.y0 );
+            uncovered.Subtract( opaque );
+        }
+    }
+    std::ranges::reverse( pass.draws );
+    pass.background = std::move( uncovered );
+
+    TracyPlot( "Scene draws", int64_t( pass.draws.size() ) );
+    return pass;
+}
+
+bool Scene::HasDamage( Id output ) const
+{
+    auto it = m_outputs.find( output );
+    return it != m_outputs.end() && !it->second.damage.IsEmpty();
+}
+
+std::vector<Scene::Id> Scene::VisibleSurfaces( Id output ) const
+{
+    auto oit = m_outputs.find( output );
+    CheckPanic( oit != m_outputs.end(), "Unknown output %u", output );
+    const auto& o = oit->second;
+
+    std::vector<Id> ret;
+    Region uncovered( { 0, 0, o.rect.Width(), o.rect.Height() } );
+    for( auto it = m_stack.rbegin(); it != m_stack.rend() && !uncovered.IsEmpty(); ++it )
+    {
+        const auto& s = m_surfaces.find( *it )->second;
+        if( !s.mapped || s.rect.IsEmpty() ) continue;
+
+        const Region::Rect rect = { s.rect.x0 - o.rect.x0, s.rect.y0 - o.rect.y0, s.rect.x1 - o.rect.x0, s.rect.y1 - o.rect.y0 };
+        if( !uncovered.Intersects( rect ) ) continue;
+        ret.emplace_back( *it );
+
+        if( !s.opaque.IsEmpty() )
+        {
+            auto opaque = s.opaque;
+            opaque.Intersect( { 0, 0, rect.Width(), rect.Height() } );
+            opaque.Translate( rect.x0, rect.y0 );
+            uncovered.Subtract( opaque );
+        }
+    }
+    return ret;
+}
+
+Scene::Surface& Scene::GetSurface( Id surface )
+{
+    auto it = m_surfaces.find( surface );
+    CheckPanic( it != m_surfaces.end(), "Unknown surface %u", surface );
+    return it->second;
+}
+
+Scene::Output& Scene::GetOutput( Id output )
+{
+    auto it = m_outputs.find( output );
+    CheckPanic( it != m_outputs.end(), "Unknown output %u", output );
+    return it->second;
+}
+
+void Scene::DamageLayout( const Region& region )
+{
+    if( region.IsEmpty() ) return;
+    for( auto& [id, o] : m_outputs )
+    {
+        if( !region.Intersects( o.rect ) ) continue;
+
+        auto local = region;
+        local.Intersect( o.rect );
+        local.Translate( -o.rect.x0, -o.rect.y0 );
+
+        const auto wasIdle = o.damage.IsEmpty();
+        o.damage.Add( local );
+        if( wasIdle && o.damaged ) o.damaged();
+    }
+}
+
+void Scene::DamageSurfaceRect( const Surface& surface )
+{
+    if( surface.mapped ) DamageLayout( Region( surface.rect ) );
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <functional>
+#include <stdint.h>
+#include <vector>
+
+#include "util/NoCopy.hpp"
+#include "util/Region.hpp"
+#include "util/RobinHood.hpp"
+
+// Surfaces placed in the global layout, and the outputs showing parts of it. Every change to a surface is turned
+// into damage of the outputs it touches, in output coordinates, so that an output only redraws what changed
+// since its last frame. Nothing is damaged on an output which doesn't show the change.
+//
+// Must be externally synchronized.
+class Scene
+{
+public:
+    using Id = uint32_t;
+
+    // Called when an output gets new damage, and should schedule a frame
+    using DamageCallback = std::function<void()>;
+
+    struct Draw
+    {
+        Id surface;
+        Region::Rect rect;      // Whole surface, in output coordinates
+        Region clip;            // Part of the surface to draw
+    };
+
+    // What an output has to draw for a frame, back to front. Parts of surfaces covered by opaque surfaces above
+    // them are not drawn, and the background only needs to be cleared where nothing opaque is drawn.
+    struct Pass
+    {
+        Region damage;
+        Region background;
+        std::vector<Draw> draws;
+    };
+
+    Scene() = default;
+    NoCopy( Scene );
+
+    Id AddOutput( const Region::Rect& rect, DamageCallback damaged = {} );
+    void RemoveOutput( Id output );
+    void SetOutputRect( Id output, const Region::Rect& rect );      // Fully damaged
+
+    // New surfaces are unmapped, on top of the stack
+    Id AddSurface();
+    void RemoveSurface( Id surface );
+    void MapSurface( Id surface, bool mapped );
+    void SetPosition( Id surface, int32_t x, int32_t y );
+    void SetSize( Id surface, uint32_t width, uint32_t height );
+    void Raise( Id surface );
+
+    // Regions are in surface coordinates. An opaque region which is not exact is ignored.
+    void SetOpaque( Id surface, const Region& opaque );
+    void DamageSurface( Id surface, const Region& damage );
+    void DamageOutput( Id output );
+
+    // Takes the damage the output accumulated since the last pass
+    [[nodiscard]] Pass BuildPass( Id output );
+    [[nodiscard]] bool HasDamage( Id output ) const;
+
+    // Surfaces of which any part is shown on the output, i.e. mapped, inside of it and not covered by opaque
+    // surfaces above them
+    [[nodiscard]] std::vector<Id> VisibleSurfaces( Id output ) const;
+
+private:
+    struct Surface
+    {
+        Region::Rect rect = {};
+        Region opaque;
+        bool mapped = false;
+    };
+
+    struct Output
+    {
+        Region::Rect rect;
+        Region damage;
+        DamageCallback damaged;
+    };
+
+    [[nodiscard]] Surface& GetSurface( Id surface );
+    [[nodiscard]] Output& GetOutput( Id output );
+
+    void DamageLayout( const Region& region );      // In layout coordinates
+    void DamageSurfaceRect( const Surface& surface );
+
+    unordered_flat_map<Id, Surface> m_surfaces;
+    std::vector<Id> m_stack;        // Bottom to top
+
+    unordered_flat_map<Id, Output> m_outputs;
+
+    Id m_nextId = 1;
+};
@@ -3,12 +3,15 @@
 #include <thread>
 
 #include "Display.hpp"
+#include "FrameCallbacks.hpp"
+#include "Scene.hpp"
 #include "Server.hpp"
 #include "backend/drm/BackendDrm.hpp"
 #include "backend/wayland/BackendWayland.hpp"
 #include "dbus/DbusSession.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
+#include "util/TaskDispatch.hpp"
 #include "vulkan/VlkInstance.hpp"
 
 
@@ -26,31 +29,45 @@ Server::Server( bool enableValidation )
 
     mclog( LogLevel::Debug, "Main thread: %i", gettid() );
 
-    std::thread vulkanThread;
+    m_dispatch = std::make_unique<TaskDispatch>( std::thread::hardware_concurrency() - 1, "Worker" );
+    m_scene = std::make_unique<Scene>();
+
+    // Startup is a small dependency graph. The Vulkan instance is created on a worker, while the backend takes
+    // control of the session here, as D-Bus connections belong to the thread which opened them. Per GPU and per
+    // output setup needs both, and is spread over the workers again.
     const auto waylandDpy = getenv( "WAYLAND_DISPLAY" );
-    if( waylandDpy )
+    const auto instanceType = waylandDpy ? VlkInstanceType::Wayland : VlkInstanceType::Drm;
+
+    TaskGroup vulkan;
+    m_dispatch->Queue( vulkan, [this, instanceType, enableValidation] {
+        ZoneScopedN( "Vulkan instance" );
+        m_vkInstance = std::make_unique<VlkInstance>( instanceType, enableValidation );
+    } );
+
     {
-        mclog( LogLevel::Info, "Running on Wayland display: %s", waylandDpy );
-        vulkanThread = std::thread( [this, enableValidation] {
-            m_vkInstance = std::make_unique<VlkInstance>( VlkInstanceType::Wayland, enableValidation );
-        } );
-        m_backend = std::make_unique<BackendWayland>();
+        ZoneScopedN( "Backend" );
+        if( waylandDpy )
+        {
+            mclog( LogLevel::Info, "Running on Wayland display: %s", waylandDpy );
+            m_backend = std::make_unique<BackendWayland>();
+        }
+        else
+        {
+            m_backend = std::make_unique<BackendDrm>();
+        }
     }
-    else
+
     {
-        vulkanThread = std::thread( [this, enableValidation] {
-            m_vkInstance = std::make_unique<VlkInstance>( VlkInstanceType::Drm, enableValidation );
-        } );
-        m_backend = std::make_unique<BackendDrm>();
+        ZoneScopedN( "D-Bus session" );
+        m_dbusSession = std::make_unique<DbusSession>();
     }
 
-    m_dbusSession = std::make_unique<DbusSession>();
-    vulkanThread.join();
-
-    m_backend->VulkanInit();
+    vulkan.Wait();
+    m_backend->VulkanInit( *m_dispatch );
 
-    m_dpy = std::make_unique<Display>();
+    m_dpy = std::make_unique<Display>( m_backend->GetDmabufFeedback() );
     setenv( "WAYLAND_DISPLAY", m_dpy->Socket(), 1 );
+    m_frameCallbacks = std::make_unique<FrameCallbacks>( *m_scene, m_dpy->GetAccounting() );
 }
 
 Server::~Server()
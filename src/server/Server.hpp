@@ -7,7 +7,10 @@
 class Backend;
 class DbusSession;
 class Display;
+class FrameCallbacks;
 class GpuDevice;
+class Scene;
+class TaskDispatch;
 class VlkInstance;
 
 class Server
@@ -23,13 +26,19 @@ public:
     void Run();
 
     [[nodiscard]] auto& VkInstance() const { return *m_vkInstance; }
+    [[nodiscard]] auto& GetScene() const { return *m_scene; }
+    [[nodiscard]] auto& GetFrameCallbacks() const { return *m_frameCallbacks; }
+    [[nodiscard]] auto& GetDispatch() const { return *m_dispatch; }
 
 private:
     void SetupGpus( bool skipSoftware );
 
+    std::unique_ptr<TaskDispatch> m_dispatch;
     std::unique_ptr<DbusSession> m_dbusSession;
     std::unique_ptr<VlkInstance> m_vkInstance;
+    std::unique_ptr<Scene> m_scene;
 
     std::unique_ptr<Backend> m_backend;
     std::unique_ptr<Display> m_dpy;
+    std::unique_ptr<FrameCallbacks> m_frameCallbacks;
 };
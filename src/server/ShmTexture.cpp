@@ -0,0 +1,307 @@
+#include <drm_fourcc.h>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+#include <wayland-server-core.h>
+#include <wayland-server-protocol.h>
+
+#include "ClientAccounting.hpp"
+#include "ShmTexture.hpp"
+#include "backend/drm/DrmFormat.hpp"
+#include "util/Panic.hpp"
+#include "vulkan/VlkCommandBuffer.hpp"
+#include "vulkan/VlkDevice.hpp"
+#include "vulkan/VlkGarbage.hpp"
+#include "vulkan/VlkImage.hpp"
+#include "vulkan/VlkImageView.hpp"
+#include "vulkan/VlkStagingRing.hpp"
+#include "vulkan/VlkTimelineSemaphore.hpp"
+#include "vulkan/ext/Tracy.hpp"
+
+namespace
+{
+// The two original wl_shm formats have their own codes, all others use the DRM fourcc
+uint32_t ShmToDrm( uint32_t format )
+{
+    switch( format )
+    {
+    case WL_SHM_FORMAT_ARGB8888: return DRM_FORMAT_ARGB8888;
+    case WL_SHM_FORMAT_XRGB8888: return DRM_FORMAT_XRGB8888;
+    default: return format;
+    }
+}
+
+uint32_t FormatBpp( const DrmFormat& format )
+{
+    return format.vk == VK_FORMAT_R16G16B16A16_SFLOAT ? 8 : 4;
+}
+
+bool HasAlpha( const DrmFormat& format )
+{
+    return format.name[0] != 'x';
+}
+}
+
+ShmTexture::ShmTexture( std::shared_ptr<VlkDevice> device, ClientAccounting* accounting )
+    : m_device( std::move( device ) )
+    , m_accounting( accounting )
+{
+}
+
+ShmTexture::~ShmTexture()
+{
+    Drop();
+}
+
+void ShmTexture::AddFormats( wl_display* dpy )
+{
+    for( auto& format : DrmFormats() )
+    {
+        if( format.drm != DRM_FORMAT_ARGB8888 && format.drm != DRM_FORMAT_XRGB8888 ) wl_display_add_shm_format( dpy, format.drm );
+    }
+}
+
+bool ShmTexture::Update( wl_resource* buffer, const Region& damage )
+{
+    ZoneScoped;
+
+    auto shm = wl_shm_buffer_get( buffer );
+    if( !shm ) return false;
+
+    const auto format = FindDrmFormat( ShmToDrm( wl_shm_buffer_get_format( shm ) ) );
+    if( !format ) return false;
+
+    const auto width = uint32_t( wl_shm_buffer_get_width( shm ) );
+    const auto height = uint32_t( wl_shm_buffer_get_height( shm ) );
+    const auto stride = uint32_t( wl_shm_buffer_get_stride( shm ) );
+
+    const bool initial = !m_image || width != m_width || height != m_height || format->drm != m_format;
+    if( initial && !Create( wl_resource_get_client( buffer ), width, height, stride, *format ) ) return false;
+
+    Region copy;
+    if( initial )
+    {
+        copy = Region( { 0, 0, int32_t( width ), int32_t( height ) } );
+    }
+    else
+    {
+        copy = damage;
+        copy.Intersect( { 0, 0, int32_t( width ), int32_t( height ) } );
+        if( copy.IsEmpty() ) return true;
+    }
+    ZoneTextF( "%ux%u, %.1f%% damaged", width, height, 100.f * copy.Area() / ( uint64_t( width ) * height ) );
+
+    // The client can shrink the pool under us. libwayland catches the resulting SIGBUS and then reports an error.
+    wl_shm_buffer_begin_access( shm );
+    auto data = (const uint8_t*)wl_shm_buffer_get_data( shm );
+
+    // Host copies write the image right away, which is only safe if no submitted frame still uses it. Row
+    // lengths are given in texels there, so the stride must be a whole number of them.
+    const bool host = m_hostCopy && stride % m_bpp == 0 && m_device->GetTimeline( QueueType::Graphic )->Value() >= m_useValue;
+    if( host )
+    {
+        UploadHost( data, stride, copy.Rects(), initial );
+    }
+    else
+    {
+        UploadStaging( data, stride, copy.Rects(), initial );
+    }
+
+    wl_shm_buffer_end_access( shm );
+    return true;
+}
+
+bool ShmTexture::Create( wl_client* client, uint32_t width, uint32_t height, uint32_t stride, const DrmFormat& format )
+{
+    ZoneScoped;
+
+    Drop();
+
+    m_client = client;
+    const auto shmSize = uint64_t( stride ) * height;
+    if( m_accounting && !m_accounting->Charge( client, ClientAccounting::Resource::ShmMemory, shmSize ) ) return false;
+    m_shmCharge = shmSize;
+
+    m_width = width;
+    m_height = height;
+    m_format = format.drm;
+    m_bpp = FormatBpp( format );
+    m_hostCopy = m_device->UseHostImageCopy();
+
+    // Both kinds of copy must be possible, as host copies are skipped while the texture is in use
+    const VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = format.vk,
+        .extent = { width, height, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VkImageUsageFlags( VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | ( m_hostCopy ? VK_IMAGE_USAGE_HOST_TRANSFER_BIT : 0 ) ),
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    m_image = std::make_shared<VlkImage>( *m_device, imageInfo );
+
+    const auto alpha = HasAlpha( format ) ? VK_COMPONENT_SWIZZLE_IDENTITY : VK_COMPONENT_SWIZZLE_ONE;
+    const VkImageViewCreateInfo viewInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = *m_image,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = format.vk,
+        .components = { VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, VK_COMPONENT_SWIZZLE_IDENTITY, alpha },
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+    };
+    m_view = std::make_shared<VlkImageView>( *m_device, viewInfo );
+
+    if( m_accounting && !m_accounting->Charge( client, ClientAccounting::Resource::GpuMemory, m_image->Size() ) )
+    {
+        Drop();
+        return false;
+    }
+    m_gpuCharge = m_image->Size();
+    return true;
+}
+
+void ShmTexture::Drop()
+{
+    if( m_image ) m_device->GetGarbage()->Recycle( m_device->GetTimeline( QueueType::Graphic ), m_useValue, { std::move( m_image ), std::move( m_view ) } );
+    m_image.reset();
+    m_view.reset();
+    m_useValue = 0;
+
+    if( m_accounting && m_client )
+    {
+        if( m_gpuCharge ) m_accounting->Release( m_client, ClientAccounting::Resource::GpuMemory, m_gpuCharge );
+        if( m_shmCharge ) m_accounting->Release( m_client, ClientAccounting::Resource::ShmMemory, m_shmCharge );
+    }
+    m_gpuCharge = 0;
+    m_shmCharge = 0;
+}
+
+void ShmTexture::UploadStaging( const uint8_t* data, uint32_t stride, const std::vector<Region::Rect>& rects, bool initial )
+{
+    ZoneScoped;
+
+    VkDeviceSize size = 0;
+    for( auto& r : rects ) size += VkDeviceSize( r.Width() ) * r.Height() * m_bpp;
+
+    // The damaged rectangles are packed tightly, one after another
+    auto staging = m_device->GetStagingRing()->Acquire( size );
+    std::vector<VkBufferImageCopy> regions;
+    regions.reserve( rects.size() );
+    VkDeviceSize offset = 0;
+    for( auto& r : rects )
+    {
+        const auto rowSize = size_t( r.Width() ) * m_bpp;
+        auto src = data + size_t( r.y0 ) * stride + size_t( r.x0 ) * m_bpp;
+        auto dst = (uint8_t*)staging.ptr + offset;
+        for( int32_t y=0; y<r.Height(); y++ )
+        {
+            memcpy( dst, src, rowSize );
+            src += stride;
+            dst += rowSize;
+        }
+        regions.emplace_back( VkBufferImageCopy {
+            .bufferOffset = staging.offset + offset,
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .imageOffset = { r.x0, r.y0, 0 },
+            .imageExtent = { uint32_t( r.Width() ), uint32_t( r.Height() ), 1 }
+        } );
+        offset += rowSize * r.Height();
+    }
+    staging.Flush();
+
+    // The graphics queue is used, so that frames submitted later see the copy without a queue ownership transfer
+    auto cmd = std::make_unique<VlkCommandBuffer>( m_device->GetThreadCommandPool( QueueType::Graphic ) );
+    cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+    {
+        ZoneVk( *m_device, *cmd, "Shm upload", true );
+
+        // Earlier frames may still be sampling the parts which are not overwritten
+        VkImageMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = initial ? VK_PIPELINE_STAGE_2_NONE : VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+            .srcAccessMask = VK_ACCESS_2_NONE,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .oldLayout = initial ? VK_IMAGE_LAYOUT_UNDEFINED : Layout,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = *m_image,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+        };
+        VkDependencyInfo deps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &barrier
+        };
+        vkCmdPipelineBarrier2( *cmd, &deps );
+
+        vkCmdCopyBufferToImage( *cmd, staging, *m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, uint32_t( regions.size() ), regions.data() );
+
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = Layout;
+        vkCmdPipelineBarrier2( *cmd, &deps );
+    }
+    cmd->End();
+
+    const auto value = m_device->Submit( *cmd, VK_NULL_HANDLE );
+    auto& timeline = m_device->GetTimeline( QueueType::Graphic );
+    m_device->GetStagingRing()->Release( staging, timeline, value );
+    m_device->GetGarbage()->Recycle( timeline, value, {
+        std::move( cmd ),
+        m_image
+    } );
+    Use( value );
+}
+
+void ShmTexture::UploadHost( const uint8_t* data, uint32_t stride, const std::vector<Region::Rect>& rects, bool initial )
+{
+    ZoneScoped;
+
+    const VkHostImageLayoutTransitionInfo toGeneral = {
+        .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO,
+        .image = *m_image,
+        .oldLayout = initial ? VK_IMAGE_LAYOUT_UNDEFINED : Layout,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+    };
+    vkTransitionImageLayout( *m_device, 1, &toGeneral );
+
+    std::vector<VkMemoryToImageCopy> regions;
+    regions.reserve( rects.size() );
+    for( auto& r : rects )
+    {
+        regions.emplace_back( VkMemoryToImageCopy {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY,
+            .pHostPointer = data + size_t( r.y0 ) * stride + size_t( r.x0 ) * m_bpp,
+            .memoryRowLength = stride / m_bpp,
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .imageOffset = { r.x0, r.y0, 0 },
+            .imageExtent = { uint32_t( r.Width() ), uint32_t( r.Height() ), 1 }
+        } );
+    }
+    const VkCopyMemoryToImageInfo copy = {
+        .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO,
+        .dstImage = *m_image,
+        .dstImageLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .regionCount = uint32_t( regions.size() ),
+        .pRegions = regions.data()
+    };
+    vkCopyMemoryToImage( *m_device, &copy );
+
+    const VkHostImageLayoutTransitionInfo toRead = {
+        .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO,
+        .image = *m_image,
+        .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .newLayout = Layout,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+    };
+    vkTransitionImageLayout( *m_device, 1, &toRead );
+}
@@ -0,0 +1,79 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "util/NoCopy.hpp"
+#include "util/Region.hpp"
+
+extern "C" {
+    struct wl_client;
+    struct wl_display;
+    struct wl_resource;
+};
+
+class ClientAccounting;
+struct DrmFormat;
+class VlkDevice;
+class VlkImage;
+class VlkImageView;
+
+// Long lived texture of a surface which attaches wl_shm buffers. Only the damaged part of each commit is copied,
+// so a blinking cursor in a terminal uploads a few hundred bytes instead of the whole window.
+//
+// Copies go through the device staging ring, or are done by the CPU directly into the image if the device has host
+// image copies and no frame still samples the texture. The texture and the shared memory it is read from are
+// charged to the client owning the buffer.
+class ShmTexture
+{
+public:
+    explicit ShmTexture( std::shared_ptr<VlkDevice> device, ClientAccounting* accounting = nullptr );
+    ~ShmTexture();
+
+    NoCopy( ShmTexture );
+
+    // Adds the wl_shm formats which can be uploaded to the ones libwayland always advertises
+    static void AddFormats( wl_display* dpy );
+
+    // The damage is in buffer pixels. Everything is copied if the buffer size or format has changed. Returns
+    // false if the buffer is not a wl_shm buffer of a supported format, or if the client is over its limits.
+    bool Update( wl_resource* buffer, const Region& damage );
+
+    // Frames which sample the texture must report their graphics queue submission
+    void Use( uint64_t value ) { if( value > m_useValue ) m_useValue = value; }
+
+    [[nodiscard]] auto& Image() const { return m_image; }
+    [[nodiscard]] auto& View() const { return m_view; }
+    [[nodiscard]] uint32_t Width() const { return m_width; }
+    [[nodiscard]] uint32_t Height() const { return m_height; }
+
+    // Layout of the image outside of Update()
+    static constexpr VkImageLayout Layout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+
+private:
+    [[nodiscard]] bool Create( wl_client* client, uint32_t width, uint32_t height, uint32_t stride, const DrmFormat& format );
+    void Drop();
+
+    void UploadStaging( const uint8_t* data, uint32_t stride, const std::vector<Region::Rect>& rects, bool initial );
+    void UploadHost( const uint8_t* data, uint32_t stride, const std::vector<Region::Rect>& rects, bool initial );
+
+    std::shared_ptr<VlkDevice> m_device;
+    ClientAccounting* m_accounting;
+    std::shared_ptr<VlkImage> m_image;
+    std::shared_ptr<VlkImageView> m_view;
+
+    uint32_t m_width = 0;
+    uint32_t m_height = 0;
+    uint32_t m_format = 0;
+    uint32_t m_bpp = 0;
+    bool m_hostCopy = false;
+
+    wl_client* m_client = nullptr;
+    uint64_t m_gpuCharge = 0;
+    uint64_t m_shmCharge = 0;
+
+    // Last graphics queue submission which reads or writes the image
+    uint64_t m_useValue = 0;
+};
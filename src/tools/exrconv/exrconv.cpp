@@ -1,13 +1,24 @@
 #include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <dirent.h>
+#include <getopt.h>
+#include <mutex>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string>
+#include <sys/stat.h>
 #include <thread>
+#include <unistd.h>
+#include <vector>
 
 #include "image/ImageLoader.hpp"
 #include "util/Ansi.hpp"
 #include "util/BitmapHdr.hpp"
-#include "util/BitmapHdrHalf.hpp"
+#include "util/ExrWriter.hpp"
 #include "util/Home.hpp"
 #include "util/Logs.hpp"
+#include "util/NoCopy.hpp"
 #include "util/Panic.hpp"
 #include "util/TaskDispatch.hpp"
 #include "util/Tonemapper.hpp"
@@ -17,6 +28,147 @@ static void PrintHelp()
 {
     printf( ANSI_BOLD ANSI_GREEN "exrconv" ANSI_RESET " — convert HDR image to EXR format, build %s\n\n", GitRef );
     printf( "Usage: exrconv <input> <output>\n" );
+    printf( "       exrconv [options] <inputs or directories...> <output>\n\n" );
+    printf( "In batch mode the output is a directory, or a pattern in which {} is replaced by the input file name\n" );
+    printf( "without extension.\n\n" );
+    printf( "Options:\n" );
+    printf( "  -c, --compression [type]     Compression: none, zip (default), piz, dwaa, htj2k\n" );
+    printf( "  -j, --jobs [count]           Number of files converted at the same time\n" );
+    printf( "  -m, --memory [MiB]           Memory budget of the images being converted\n" );
+    printf( "  --help                       Print this help\n" );
+}
+
+namespace
+{
+// Bytes per pixel while converting: the float image, and the decoder intermediates. The half float rows
+// are converted and written in bands.
+constexpr size_t BytesPerPixel = 16 + 8;
+
+// Files only start loading when their estimated size fits into what is left of the budget. A file larger than
+// the whole budget waits until nothing else is being converted.
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget( size_t size ) : m_free( size ), m_size( size ) {}
+
+    NoCopy( MemoryBudget );
+
+    size_t Acquire( size_t size )
+    {
+        size = std::min( size, m_size );
+        std::unique_lock lock( m_lock );
+        m_cv.wait( lock, [&]{ return m_free >= size; } );
+        m_free -= size;
+        return size;
+    }
+
+    void Release( size_t size )
+    {
+        {
+            std::lock_guard lock( m_lock );
+            m_free += size;
+        }
+        m_cv.notify_all();
+    }
+
+private:
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    size_t m_free;
+    size_t m_size;
+};
+
+enum class Result
+{
+    Ok,
+    Skipped,
+    Failed
+};
+}
+
+// Entries of the directory which can be loaded, sorted by name
+static std::vector<std::string> ListImages( const std::string& path )
+{
+    std::vector<std::string> ret;
+    DIR* dir = opendir( path.c_str() );
+    if( !dir ) return ret;
+
+    struct dirent* entry;
+    while( ( entry = readdir( dir ) ) )
+    {
+        if( entry->d_type == DT_REG || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN )
+        {
+            auto file = path + "/" + entry->d_name;
+            if( IsLoadableImage( file.c_str() ) ) ret.emplace_back( std::move( file ) );
+        }
+    }
+    closedir( dir );
+    std::ranges::sort( ret );
+    return ret;
+}
+
+static bool IsDirectory( const std::string& path )
+{
+    struct stat st;
+    return stat( path.c_str(), &st ) == 0 && S_ISDIR( st.st_mode );
+}
+
+static std::string OutputName( const std::string& input, const std::string& output )
+{
+    auto name = input.substr( input.find_last_of( '/' ) + 1 );
+    const auto ext = name.find_last_of( '.' );
+    if( ext != std::string::npos && ext != 0 ) name.resize( ext );
+
+    const auto pos = output.find( "{}" );
+    if( pos != std::string::npos ) return output.substr( 0, pos ) + name + output.substr( pos + 2 );
+    return output + "/" + name + ".exr";
+}
+
+// In batch mode files which are not HDR are skipped, as directories may hold anything
+static Result Convert( const char* inFile, const char* outFile, bool batch, ExrWriter::Compression compression, MemoryBudget& budget, TaskDispatch& td )
+{
+    mclog( LogLevel::Info, "Converting %s to %s", inFile, outFile );
+
+    auto loader = GetImageLoader( inFile, ToneMap::Operator::PbrNeutral, &td );
+    if( !loader )
+    {
+        mclog( LogLevel::Error, "Failed to load image %s", inFile );
+        return Result::Failed;
+    }
+    if( !loader->IsHdr() )
+    {
+        if( batch )
+        {
+            mclog( LogLevel::Warning, "Image %s is not HDR, skipping", inFile );
+            return Result::Skipped;
+        }
+        mclog( LogLevel::Error, "Image %s is not HDR", inFile );
+        return Result::Failed;
+    }
+
+    const auto info = loader->Probe();
+    const auto estimate = info.width != 0 ? size_t( info.width ) * info.height * BytesPerPixel : SIZE_MAX;
+    const auto reserved = budget.Acquire( estimate );
+
+    auto hdr = loader->LoadHdr();
+    loader.reset();
+    if( !hdr )
+    {
+        budget.Release( reserved );
+        mclog( LogLevel::Error, "Failed to load image %s", inFile );
+        return Result::Failed;
+    }
+
+    bool ok;
+    {
+        ExrWriter writer( outFile, hdr->Width(), hdr->Height(), compression, &td );
+        writer.Write( hdr->Data(), hdr->Height() );
+        ok = writer.IsValid();
+    }
+    hdr.reset();
+
+    budget.Release( reserved );
+    return ok ? Result::Ok : Result::Failed;
 }
 
 int main( int argc, char** argv )
@@ -25,40 +177,115 @@ int main( int argc, char** argv )
     SetLogLevel( LogLevel::Error );
 #endif
 
-    if( argc != 3 )
+    enum { OptHelp };
+
+    struct option longOptions[] = {
+        { "compression", required_argument, nullptr, 'c' },
+        { "jobs", required_argument, nullptr, 'j' },
+        { "memory", required_argument, nullptr, 'm' },
+        { "help", no_argument, nullptr, OptHelp },
+        {}
+    };
+
+    ExrWriter::Compression compression = ExrWriter::Compression::Zip;
+    size_t jobs = std::max( 1u, std::thread::hardware_concurrency() );
+    size_t memory = size_t( sysconf( _SC_PHYS_PAGES ) ) * sysconf( _SC_PAGE_SIZE ) / 2;
+
+    int opt;
+    while( ( opt = getopt_long( argc, argv, "c:j:m:", longOptions, nullptr ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'c':
+            if( !ExrWriter::ParseCompression( optarg, compression ) )
+            {
+                mclog( LogLevel::Error, "Unknown compression %s", optarg );
+                return 1;
+            }
+            break;
+        case 'j':
+            jobs = std::max( 1l, strtol( optarg, nullptr, 10 ) );
+            break;
+        case 'm':
+            memory = std::max( 1l, strtol( optarg, nullptr, 10 ) ) * 1024 * 1024;
+            break;
+        case OptHelp:
+            PrintHelp();
+            return 0;
+        default:
+            break;
+        }
+    }
+    if( argc - optind < 2 )
     {
         PrintHelp();
         return 1;
     }
 
     const auto workerThreads = std::max( 1u, std::thread::hardware_concurrency() - 1 );
-    TaskDispatch td( workerThreads, "Worker" );
+    TaskDispatch td( workerThreads, "Worker", TaskDispatch::LoadPlacement( "exrconv.ini" ) );
 
-    const auto inFileStr = ExpandHome( argv[1] );
-    const auto inFile = inFileStr.c_str();
+    const auto output = ExpandHome( argv[argc-1] );
+    std::vector<std::string> inputs;
+    bool batch = argc - optind > 2;
+    for( int i=optind; i<argc-1; i++ )
+    {
+        auto path = ExpandHome( argv[i] );
+        if( IsDirectory( path ) )
+        {
+            auto list = ListImages( path );
+            inputs.insert( inputs.end(), std::make_move_iterator( list.begin() ), std::make_move_iterator( list.end() ) );
+            batch = true;
+        }
+        else
+        {
+            inputs.emplace_back( std::move( path ) );
+        }
+    }
 
-    const auto outFileStr = ExpandHome( argv[2] );
-    const auto outFile = outFileStr.c_str();
+    if( inputs.empty() )
+    {
+        mclog( LogLevel::Error, "No images found" );
+        return 1;
+    }
 
-    mclog( LogLevel::Info, "Converting %s to %s", inFile, outFile );
+    MemoryBudget budget( memory );
 
-    auto loader = GetImageLoader( inFile, ToneMap::Operator::PbrNeutral, &td );
-    if( !loader )
+    if( !batch )
     {
-        mclog( LogLevel::Error, "Failed to load image %s", inFile );
-        return 1;
+        return Convert( inputs[0].c_str(), output.c_str(), false, compression, budget, td ) == Result::Ok ? 0 : 1;
     }
-    if( !loader->IsHdr() )
+
+    if( output.find( "{}" ) == std::string::npos && !IsDirectory( output ) )
     {
-        mclog( LogLevel::Error, "Image %s is not HDR", inFile );
+        mclog( LogLevel::Error, "Output %s must be a directory, or a pattern containing {}", output.c_str() );
         return 1;
     }
 
-    auto hdr = loader->LoadHdr();
-    CheckPanic( hdr, "Failed to load image %s", inFile );
+    // Each job thread converts one file at a time. The decoders run on the job threads, and spread the parallel
+    // parts of their work over the shared worker pool.
+    std::atomic<size_t> next = 0;
+    std::atomic<size_t> failed = 0;
+    auto worker = [&] {
+        for(;;)
+        {
+            const auto idx = next.fetch_add( 1, std::memory_order_relaxed );
+            if( idx >= inputs.size() ) break;
+            const auto outFile = OutputName( inputs[idx], output );
+            if( Convert( inputs[idx].c_str(), outFile.c_str(), true, compression, budget, td ) == Result::Failed ) failed.fetch_add( 1, std::memory_order_relaxed );
+        }
+    };
 
-    auto half = std::make_unique<BitmapHdrHalf>( *hdr );
-    half->SaveExr( outFile );
+    jobs = std::min( jobs, inputs.size() );
+    std::vector<std::thread> threads;
+    for( size_t i=1; i<jobs; i++ ) threads.emplace_back( worker );
+    worker();
+    for( auto& t : threads ) t.join();
 
+    if( failed != 0 )
+    {
+        mclog( LogLevel::Error, "Failed to convert %zu of %zu files", failed.load(), inputs.size() );
+        return 1;
+    }
     return 0;
 }
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+
+#include "AnimationRing.hpp"
+#include "TextureFormats.hpp"
+#include "util/Bitmap.hpp"
+#include "util/BitmapAnimStream.hpp"
+#include "util/Panic.hpp"
+#include "vulkan/VlkBuffer.hpp"
+#include "vulkan/VlkCommandBuffer.hpp"
+#include "vulkan/VlkDevice.hpp"
+#include "vulkan/VlkFence.hpp"
+#include "vulkan/VlkFencePool.hpp"
+#include "vulkan/VlkGarbage.hpp"
+#include "vulkan/VlkImage.hpp"
+#include "vulkan/VlkImageView.hpp"
+#include "vulkan/VlkTimelineSemaphore.hpp"
+#include "vulkan/ext/Tracy.hpp"
+
+AnimationRing::AnimationRing( VlkDevice& device, std::shared_ptr<BitmapAnimStream> stream, uint32_t firstDelay )
+    : m_device( device )
+    , m_stream( std::move( stream ) )
+    , m_width( m_stream->Width() )
+    , m_height( m_stream->Height() )
+    , m_layers {}
+    , m_firstDelay( std::max( firstDelay, MinDelay ) )
+{
+    ZoneScoped;
+    CheckPanic( m_width > 0 && m_height > 0, "Invalid animation size" );
+
+    const VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = SdrFormat,
+        .extent = { m_width, m_height, 1 },
+        .mipLevels = 1,
+        .arrayLayers = Layers,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    m_image = std::make_shared<VlkImage>( device, imageInfo );
+
+    for( uint32_t i=0; i<Layers; i++ )
+    {
+        const VkImageViewCreateInfo viewInfo = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+            .image = *m_image,
+            .viewType = VK_IMAGE_VIEW_TYPE_2D,
+            .format = SdrFormat,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, i, 1 }
+        };
+        m_layers[i].view = std::make_unique<VlkImageView>( device, viewInfo );
+    }
+
+    const VkBufferCreateInfo bufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = VkDeviceSize( m_width ) * m_height * 4 * Layers,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    m_staging = std::make_shared<VlkBuffer>( device, bufferInfo, VlkBuffer::PreferHost | VlkBuffer::WillWrite );
+}
+
+AnimationRing::~AnimationRing() = default;
+
+bool AnimationRing::Update( uint64_t now )
+{
+    if( m_deadline == 0 ) m_deadline = now + m_firstDelay;
+
+    bool changed = false;
+    if( m_queued > 0 && now >= m_deadline && m_device.GetTimeline( QueueType::Graphic )->Value() >= m_layers[m_head].ready )
+    {
+        m_shown = int( m_head );
+        m_head = ( m_head + 1 ) % Layers;
+        m_queued--;
+
+        // A late frame starts the schedule over, instead of the following ones being rushed to catch up
+        const auto delay = m_layers[m_shown].delay;
+        m_deadline = m_deadline + delay < now ? now + delay : m_deadline + delay;
+        changed = true;
+    }
+
+    const uint32_t used = m_shown < 0 ? 0 : 1;
+    while( m_queued + used < Layers && Upload( ( m_head + m_queued ) % Layers ) ) m_queued++;
+
+    return changed;
+}
+
+VkImageView AnimationRing::View() const
+{
+    if( m_shown < 0 ) return VK_NULL_HANDLE;
+    return *m_layers[m_shown].view;
+}
+
+// The uploads are made on the graphics queue, where the barrier orders the write after the frames which still
+// sample the previous contents of the layer. Queue ownership never changes.
+bool AnimationRing::Upload( uint32_t layer )
+{
+    BitmapAnim::Frame frame;
+    if( !m_stream->TryNext( frame ) ) return false;
+    if( !frame.bmp || frame.bmp->Width() != m_width || frame.bmp->Height() != m_height ) return false;
+
+    ZoneScoped;
+    const auto size = VkDeviceSize( m_width ) * m_height * 4;
+    const auto offset = size * layer;
+    memcpy( (char*)m_staging->Ptr() + offset, frame.bmp->Data(), size );
+    m_staging->Flush( offset, size );
+
+    auto cmd = std::make_unique<VlkCommandBuffer>( m_device.GetThreadCommandPool( QueueType::Graphic ) );
+    cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+    {
+        ZoneVk( m_device, *cmd, "Animation frame", true );
+
+        VkImageMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = *m_image,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, layer, 1 }
+        };
+        const VkDependencyInfo deps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &barrier
+        };
+        vkCmdPipelineBarrier2( *cmd, &deps );
+
+        const VkBufferImageCopy region = {
+            .bufferOffset = offset,
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, layer, 1 },
+            .imageExtent = { m_width, m_height, 1 }
+        };
+        vkCmdCopyBufferToImage( *cmd, *m_staging, *m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region );
+
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_SAMPLED_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier2( *cmd, &deps );
+    }
+    cmd->End();
+
+    auto fence = m_device.GetFencePool()->Acquire();
+    m_layers[layer].ready = m_device.Submit( *cmd, *fence );
+    m_layers[layer].delay = std::max( frame.delay_us, MinDelay );
+    m_device.GetGarbage()->Recycle( fence, {
+        std::move( cmd ),
+        m_image,
+        m_staging
+    } );
+    return true;
+}
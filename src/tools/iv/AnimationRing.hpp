@@ -0,0 +1,70 @@
+#pragma once
+
+#include <array>
+#include <memory>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include "util/NoCopy.hpp"
+#include "vulkan/VlkBase.hpp"
+
+class BitmapAnimStream;
+class VlkBuffer;
+class VlkDevice;
+class VlkImage;
+class VlkImageView;
+
+// Plays an animation from the layers of a single array image. Frames are uploaded to the free layers ahead of
+// their deadlines, and each layer has its own view, so advancing to the next frame only switches the view which
+// is drawn. Nothing is allocated while the animation plays. Must be externally synchronized.
+class AnimationRing : public VlkBase
+{
+    struct Layer
+    {
+        std::unique_ptr<VlkImageView> view;
+        uint64_t ready;         // Graphics timeline value of the upload
+        uint32_t delay;
+    };
+
+public:
+    static constexpr uint32_t Layers = 3;
+
+    // Shorter frame delays, mostly zero ones in GIF files, are stretched to this, in microseconds
+    static constexpr uint32_t MinDelay = 20000;
+
+    // The first frame is drawn from the texture it was loaded into, the ring takes over with the second one.
+    // The delay is that of the first frame.
+    AnimationRing( VlkDevice& device, std::shared_ptr<BitmapAnimStream> stream, uint32_t firstDelay );
+    ~AnimationRing() override;
+
+    NoCopy( AnimationRing );
+
+    // Shows the next frame if its deadline has passed and its upload has finished, and uploads decoded frames
+    // to the free layers. The first call starts the playback. Returns true if the shown frame changed.
+    bool Update( uint64_t now );
+
+    // GetTimeMicro() time at which the shown frame is due to be replaced
+    [[nodiscard]] uint64_t Deadline() const { return m_deadline; }
+
+    // VK_NULL_HANDLE until the ring shows its first frame
+    [[nodiscard]] VkImageView View() const;
+
+private:
+    [[nodiscard]] bool Upload( uint32_t layer );
+
+    VlkDevice& m_device;
+    std::shared_ptr<BitmapAnimStream> m_stream;
+    uint32_t m_width;
+    uint32_t m_height;
+
+    std::shared_ptr<VlkImage> m_image;
+    std::shared_ptr<VlkBuffer> m_staging;       // A slot per layer, each is only written while its layer is free
+    std::array<Layer, Layers> m_layers;
+
+    int m_shown = -1;
+    uint32_t m_head = 0;        // Next layer to show
+    uint32_t m_queued = 0;      // Layers from the head on which have a frame
+
+    uint32_t m_firstDelay;
+    uint64_t m_deadline = 0;
+};
@@ -2,6 +2,7 @@
 #include <string.h>
 
 #include "Background.hpp"
+#include "OutputTransfer.hpp"
 #include "util/EmbedData.hpp"
 #include "vulkan/VlkBuffer.hpp"
 #include "vulkan/VlkCommandBuffer.hpp"
@@ -14,7 +15,6 @@
 #include "vulkan/ext/Tracy.hpp"
 
 #include "shader/BackgroundFrag.hpp"
-#include "shader/BackgroundPqFrag.hpp"
 #include "shader/BackgroundVert.hpp"
 
 
@@ -26,10 +26,10 @@ struct Vertex
 Background::Background( GarbageChute& garbage, std::shared_ptr<VlkDevice> device, VkFormat format )
     : m_garbage( garbage )
     , m_device( std::move( device ) )
+    , m_pipeline( garbage )
 {
     Unembed( BackgroundVert );
     Unembed( BackgroundFrag );
-    Unembed( BackgroundPqFrag );
 
     const std::array stages = {
         VlkShader::Stage { std::make_shared<VlkShaderModule>( *m_device, *BackgroundVert ), VK_SHADER_STAGE_VERTEX_BIT },
@@ -38,18 +38,12 @@ Background::Background( GarbageChute& garbage, std::shared_ptr<VlkDevice> device
     m_shader = std::make_shared<VlkShader>( stages );
 
 
-    const std::array stagesPq = {
-        stages[0],
-        VlkShader::Stage { std::make_shared<VlkShaderModule>( *m_device, *BackgroundPqFrag ), VK_SHADER_STAGE_FRAGMENT_BIT }
-    };
-    m_shaderPq = std::make_shared<VlkShader>( stagesPq );
-
 
     constexpr VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
         .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
     };
     m_pipelineLayout = std::make_shared<VlkPipelineLayout>( *m_device, pipelineLayoutInfo );
-    CreatePipeline( format );
+    m_pipeline.Init( CreatePipeline( format ), format );
 
 
     constexpr Vertex vdata[] = {
@@ -70,11 +64,10 @@ Background::Background( GarbageChute& garbage, std::shared_ptr<VlkDevice> device
 
 Background::~Background()
 {
+    m_pipeline.Release();
     m_garbage.Recycle( {
-        std::move( m_pipeline ),
         std::move( m_pipelineLayout ),
         std::move( m_shader ),
-        std::move( m_shaderPq ),
         std::move( m_vertexBuffer )
     } );
 }
@@ -85,28 +78,28 @@ void Background::Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent )
         .width = float( extent.width ),
         .height = float( extent.height )
     };
-    VkRect2D scissor = {
-        .extent = extent
-    };
 
     std::array<VkBuffer, 1> vertexBuffers = { *m_vertexBuffer };
     constexpr std::array<VkDeviceSize, 1> offsets = { 0 };
 
     ZoneVk( *m_device, cmdbuf, "Background", true );
-    vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipeline );
+    vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipeline.Get() );
     vkCmdSetViewport( cmdbuf, 0, 1, &viewport );
-    vkCmdSetScissor( cmdbuf, 0, 1, &scissor );
     vkCmdBindVertexBuffers( cmdbuf, 0, 1, vertexBuffers.data(), offsets.data() );
     vkCmdDraw( cmdbuf, 3, 1, 0, 0 );
 }
 
 void Background::FormatChange( VkFormat format )
 {
-    m_garbage.Recycle( std::move( m_pipeline ) );
-    CreatePipeline( format );
+    m_pipeline.Change( format, [this, format] { return CreatePipeline( format ); } );
+}
+
+void Background::PrepareFormat( VkFormat format )
+{
+    m_pipeline.Prepare( format, [this, format] { return CreatePipeline( format ); } );
 }
 
-void Background::CreatePipeline( VkFormat format )
+std::shared_ptr<VlkPipeline> Background::CreatePipeline( VkFormat format )
 {
     static constexpr VkVertexInputBindingDescription vertexBindingDescription = {
         .binding = 0,
@@ -166,12 +159,12 @@ void Background::CreatePipeline( VkFormat format )
         .dynamicStateCount = dynamicStateList.size(),
         .pDynamicStates = dynamicStateList.data()
     };
-    const bool pq = format == VK_FORMAT_A2B10G10R10_UNORM_PACK32 || format == VK_FORMAT_A2R10G10B10_UNORM_PACK32;
+    const VlkShader shader( *m_shader, { uint32_t( GetOutputTransfer( format ) ) } );
     const VkGraphicsPipelineCreateInfo pipelineInfo = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
         .pNext = &rendering,
-        .stageCount = pq ? m_shaderPq->GetStageCount() : m_shader->GetStageCount(),
-        .pStages = pq ? m_shaderPq->GetStages() : m_shader->GetStages(),
+        .stageCount = shader.GetStageCount(),
+        .pStages = shader.GetStages(),
         .pVertexInputState = &vertexInputInfo,
         .pInputAssemblyState = &inputAssembly,
         .pViewportState = &viewportState,
@@ -181,5 +174,5 @@ void Background::CreatePipeline( VkFormat format )
         .pDynamicState = &dynamicState,
         .layout = *m_pipelineLayout,
     };
-    m_pipeline = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+    return std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
 }
@@ -3,6 +3,8 @@
 #include <memory>
 #include <vulkan/vulkan.h>
 
+#include "PreparedPipeline.hpp"
+
 class GarbageChute;
 class VlkBuffer;
 class VlkCommandBuffer;
@@ -19,16 +21,16 @@ public:
 
     void Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent );
     void FormatChange( VkFormat format );
+    void PrepareFormat( VkFormat format );      // Thread safe, makes a later FormatChange() to this format cheap
 
 private:
-    void CreatePipeline( VkFormat format );
+    [[nodiscard]] std::shared_ptr<VlkPipeline> CreatePipeline( VkFormat format );
 
     GarbageChute& m_garbage;
     std::shared_ptr<VlkDevice> m_device;
 
     std::shared_ptr<VlkShader> m_shader;
-    std::shared_ptr<VlkShader> m_shaderPq;
     std::shared_ptr<VlkPipelineLayout> m_pipelineLayout;
-    std::shared_ptr<VlkPipeline> m_pipeline;
+    PreparedPipeline<std::shared_ptr<VlkPipeline>> m_pipeline;
     std::shared_ptr<VlkBuffer> m_vertexBuffer;
 };
@@ -5,6 +5,7 @@
 #include <vector>
 
 #include "BusyIndicator.hpp"
+#include "OutputTransfer.hpp"
 #include "image/vector/SvgImage.hpp"
 #include "util/Bitmap.hpp"
 #include "util/DataBuffer.hpp"
@@ -27,7 +28,6 @@
 #include "data/HourglassSvg.hpp"
 #include "shader/BusyIndicatorVert.hpp"
 #include "shader/TexturingFrag.hpp"
-#include "shader/TexturingPqFrag.hpp"
 
 static float SmootherStep( float edge0, float edge1, float x )
 {
@@ -51,13 +51,14 @@ constexpr size_t HourglassSize = 128;
 BusyIndicator::BusyIndicator( GarbageChute& garbage, std::shared_ptr<VlkDevice> device, VkFormat format, float scale )
     : m_garbage( garbage )
     , m_device( std::move( device ) )
+    , m_pipeline( garbage )
     , m_scale( scale )
 {
     Unembed( HourglassSvg );
     m_hourglass = std::make_unique<SvgImage>( HourglassSvg );
     m_hourglass->SetBorder( 1 );
     std::vector<std::shared_ptr<VlkFence>> texFences;
-    m_texture = std::make_shared<Texture>( *m_device, *m_hourglass->Rasterize( HourglassSize * scale, HourglassSize * scale ), VK_FORMAT_R8G8B8A8_SRGB, false, texFences );
+    m_texture = std::make_shared<Texture>( *m_device, *m_hourglass->Rasterize( HourglassSize * scale, HourglassSize * scale ), VK_FORMAT_R8G8B8A8_SRGB, Texture::Mips::None, texFences );
 
     VkSamplerCreateInfo samplerInfo = {
         .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
@@ -83,7 +84,6 @@ BusyIndicator::BusyIndicator( GarbageChute& garbage, std::shared_ptr<VlkDevice>
 
     Unembed( BusyIndicatorVert );
     Unembed( TexturingFrag );
-    Unembed( TexturingPqFrag );
 
     const std::array stages = {
         VlkShader::Stage { std::make_shared<VlkShaderModule>( *m_device, *BusyIndicatorVert ), VK_SHADER_STAGE_VERTEX_BIT },
@@ -92,12 +92,6 @@ BusyIndicator::BusyIndicator( GarbageChute& garbage, std::shared_ptr<VlkDevice>
     m_shader = std::make_shared<VlkShader>( stages );
 
 
-    const std::array stagesPq = {
-        stages[0],
-        VlkShader::Stage { std::make_shared<VlkShaderModule>( *m_device, *TexturingPqFrag ), VK_SHADER_STAGE_FRAGMENT_BIT }
-    };
-    m_shaderPq = std::make_shared<VlkShader>( stagesPq );
-
 
     static constexpr std::array bindings = {
         VkDescriptorSetLayoutBinding { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT }
@@ -125,7 +119,7 @@ BusyIndicator::BusyIndicator( GarbageChute& garbage, std::shared_ptr<VlkDevice>
         .pPushConstantRanges = &pushConstantRange
     };
     m_pipelineLayout = std::make_shared<VlkPipelineLayout>( *m_device, pipelineLayoutInfo );
-    CreatePipeline( format );
+    m_pipeline.Init( CreatePipeline( format ), format );
 
 
     constexpr Vertex vdata[] = {
@@ -160,12 +154,11 @@ BusyIndicator::BusyIndicator( GarbageChute& garbage, std::shared_ptr<VlkDevice>
 
 BusyIndicator::~BusyIndicator()
 {
+    m_pipeline.Release();
     m_garbage.Recycle( {
-        std::move( m_pipeline ),
         std::move( m_pipelineLayout ),
         std::move( m_setLayout ),
         std::move( m_shader ),
-        std::move( m_shaderPq ),
         std::move( m_vertexBuffer ),
         std::move( m_indexBuffer ),
         std::move( m_texture ),
@@ -198,9 +191,6 @@ void BusyIndicator::Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent )
         .width = float( extent.width ),
         .height = float( extent.height )
     };
-    VkRect2D scissor = {
-        .extent = extent
-    };
 
     PushConstant pushConstant = {
         m_scale * HourglassSize / extent.width,
@@ -212,33 +202,48 @@ void BusyIndicator::Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent )
     constexpr std::array<VkDeviceSize, 1> offsets = { 0 };
 
     ZoneVk( *m_device, cmdbuf, "BusyIndicator", true );
-    vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipeline );
+    vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipeline.Get() );
     vkCmdPushConstants( cmdbuf, *m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof( PushConstant ), &pushConstant );
     vkCmdSetViewport( cmdbuf, 0, 1, &viewport );
-    vkCmdSetScissor( cmdbuf, 0, 1, &scissor );
     vkCmdBindVertexBuffers( cmdbuf, 0, 1, vertexBuffers.data(), offsets.data() );
     vkCmdBindIndexBuffer( cmdbuf, *m_indexBuffer, 0, VK_INDEX_TYPE_UINT16 );
     vkCmdPushDescriptorSet( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipelineLayout, 0, 1, &m_descWrite );
     vkCmdDrawIndexed( cmdbuf, 6, 1, 0, 0, 0 );
 }
 
+VkRect2D BusyIndicator::GetRect( const VkExtent2D& extent ) const
+{
+    // The hourglass is centered, and its diagonal is the largest extent a rotation can reach
+    const auto half = int32_t( ceil( m_scale * HourglassSize * float( M_SQRT1_2 ) ) ) + 1;
+    const auto cx = int32_t( extent.width / 2 );
+    const auto cy = int32_t( extent.height / 2 );
+    return VkRect2D {
+        .offset = { cx - half, cy - half },
+        .extent = { uint32_t( half * 2 ), uint32_t( half * 2 ) }
+    };
+}
+
 void BusyIndicator::SetScale( float scale )
 {
     m_scale = scale;
     m_garbage.Recycle( std::move( m_texture ) );
     std::vector<std::shared_ptr<VlkFence>> texFences;
-    m_texture = std::make_shared<Texture>( *m_device, *m_hourglass->Rasterize( HourglassSize * scale, HourglassSize * scale ), VK_FORMAT_R8G8B8A8_SRGB, false, texFences );
+    m_texture = std::make_shared<Texture>( *m_device, *m_hourglass->Rasterize( HourglassSize * scale, HourglassSize * scale ), VK_FORMAT_R8G8B8A8_SRGB, Texture::Mips::None, texFences );
     m_imageInfo.imageView = *m_texture;
     for( auto& fence : texFences ) fence->Wait();
 }
 
 void BusyIndicator::FormatChange( VkFormat format )
 {
-    m_garbage.Recycle( std::move( m_pipeline ) );
-    CreatePipeline( format );
+    m_pipeline.Change( format, [this, format] { return CreatePipeline( format ); } );
+}
+
+void BusyIndicator::PrepareFormat( VkFormat format )
+{
+    m_pipeline.Prepare( format, [this, format] { return CreatePipeline( format ); } );
 }
 
-void BusyIndicator::CreatePipeline( VkFormat format )
+std::shared_ptr<VlkPipeline> BusyIndicator::CreatePipeline( VkFormat format )
 {
     static constexpr VkVertexInputBindingDescription vertexBindingDescription = {
         .binding = 0,
@@ -305,12 +310,12 @@ void BusyIndicator::CreatePipeline( VkFormat format )
         .dynamicStateCount = dynamicStateList.size(),
         .pDynamicStates = dynamicStateList.data()
     };
-    const bool pq = format == VK_FORMAT_A2B10G10R10_UNORM_PACK32 || format == VK_FORMAT_A2R10G10B10_UNORM_PACK32;
+    const VlkShader shader( *m_shader, { uint32_t( GetOutputTransfer( format ) ) } );
     const VkGraphicsPipelineCreateInfo pipelineInfo = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
         .pNext = &rendering,
-        .stageCount = pq ? m_shaderPq->GetStageCount() : m_shader->GetStageCount(),
-        .pStages = pq ? m_shaderPq->GetStages() : m_shader->GetStages(),
+        .stageCount = shader.GetStageCount(),
+        .pStages = shader.GetStages(),
         .pVertexInputState = &vertexInputInfo,
         .pInputAssemblyState = &inputAssembly,
         .pViewportState = &viewportState,
@@ -320,5 +325,5 @@ void BusyIndicator::CreatePipeline( VkFormat format )
         .pDynamicState = &dynamicState,
         .layout = *m_pipelineLayout,
     };
-    m_pipeline = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+    return std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
 }
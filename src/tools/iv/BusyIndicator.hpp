@@ -3,6 +3,8 @@
 #include <memory>
 #include <vulkan/vulkan.h>
 
+#include "PreparedPipeline.hpp"
+
 class GarbageChute;
 class SvgImage;
 class Texture;
@@ -24,20 +26,21 @@ public:
     void Update( float delta );
     void ResetTime();
     void Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent );
+    [[nodiscard]] VkRect2D GetRect( const VkExtent2D& extent ) const;     // Covers any rotation of the hourglass
     void SetScale( float scale );
     void FormatChange( VkFormat format );
+    void PrepareFormat( VkFormat format );      // Thread safe, makes a later FormatChange() to this format cheap
 
 private:
-    void CreatePipeline( VkFormat format );
+    [[nodiscard]] std::shared_ptr<VlkPipeline> CreatePipeline( VkFormat format );
 
     GarbageChute& m_garbage;
     std::shared_ptr<VlkDevice> m_device;
 
     std::shared_ptr<VlkShader> m_shader;
-    std::shared_ptr<VlkShader> m_shaderPq;
     std::shared_ptr<VlkDescriptorSetLayout> m_setLayout;
     std::shared_ptr<VlkPipelineLayout> m_pipelineLayout;
-    std::shared_ptr<VlkPipeline> m_pipeline;
+    PreparedPipeline<std::shared_ptr<VlkPipeline>> m_pipeline;
     std::shared_ptr<VlkBuffer> m_vertexBuffer;
     std::shared_ptr<VlkBuffer> m_indexBuffer;
     std::shared_ptr<Texture> m_texture;
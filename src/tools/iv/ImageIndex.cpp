@@ -0,0 +1,204 @@
+#include <algorithm>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string_view>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+
+#include "ImageIndex.hpp"
+#include "util/Config.hpp"
+#include "util/FileBuffer.hpp"
+#include "util/FileWrapper.hpp"
+#include "util/Filesystem.hpp"
+#include "util/Logs.hpp"
+
+struct ImageIndex::Header
+{
+    uint32_t magic;
+    uint32_t count;
+    uint32_t namesSize;
+    uint32_t padding;
+};
+
+// Records are sorted by name. Names follow the records, without terminators.
+struct ImageIndex::Record
+{
+    uint32_t nameOffset;
+    uint32_t nameSize;
+    int64_t mtimeSec;
+    uint64_t size;
+    uint32_t mtimeNsec;
+    uint32_t width;
+    uint32_t height;
+    uint32_t flags;
+};
+
+namespace
+{
+constexpr uint32_t IndexMagic = 0x3149564d;     // MVI1
+
+enum RecordFlags : uint32_t
+{
+    Loadable    = 1 << 0,
+    Hdr         = 1 << 1
+};
+
+// FNV-1a of the canonical directory path names the index file
+std::string IndexPath( const std::string& dir )
+{
+    char* real = realpath( dir.c_str(), nullptr );
+    if( !real ) return {};
+
+    uint64_t hash = 0xcbf29ce484222325;
+    for( auto p = real; *p; p++ )
+    {
+        hash ^= uint8_t( *p );
+        hash *= 0x100000001b3;
+    }
+    free( real );
+
+    char name[32];
+    snprintf( name, sizeof( name ), "%016llx.idx", (unsigned long long)hash );
+    return Config::GetPath( "iv-index/" ) + name;
+}
+}
+
+ImageIndex::ImageIndex( const std::string& dir )
+    : m_path( IndexPath( dir ) )
+{
+    ZoneScoped;
+    if( m_path.empty() ) return;
+
+    auto file = std::make_shared<FileWrapper>( m_path.c_str(), "rb" );
+    if( !*file ) return;
+
+    try
+    {
+        m_buffer = std::make_unique<FileBuffer>( file );
+    }
+    catch( FileBuffer::FileException& )
+    {
+        return;
+    }
+
+    bool valid = m_buffer->size() >= sizeof( Header );
+    if( valid )
+    {
+        auto header = GetHeader();
+        const auto recordsEnd = sizeof( Header ) + size_t( header->count ) * sizeof( Record );
+        valid = header->magic == IndexMagic && m_buffer->size() >= recordsEnd + header->namesSize;
+        if( valid )
+        {
+            auto records = GetRecords();
+            for( uint32_t i=0; i<header->count && valid; i++ )
+            {
+                valid = uint64_t( records[i].nameOffset ) + records[i].nameSize <= header->namesSize;
+            }
+        }
+    }
+    if( !valid )
+    {
+        mclog( LogLevel::Warning, "Ignoring invalid image index %s", m_path.c_str() );
+        m_buffer.reset();
+    }
+}
+
+ImageIndex::~ImageIndex() = default;
+
+bool ImageIndex::Find( std::string_view name, const struct timespec& mtime, uint64_t size, Entry& entry ) const
+{
+    if( !m_buffer ) return false;
+
+    auto records = GetRecords();
+    auto names = GetNames();
+    const auto end = records + GetHeader()->count;
+    auto nameOf = [names]( const Record& record ) { return std::string_view( names + record.nameOffset, record.nameSize ); };
+
+    auto it = std::lower_bound( records, end, name, [&]( const Record& record, std::string_view key ) { return nameOf( record ) < key; } );
+    if( it == end || nameOf( *it ) != name ) return false;
+    if( it->mtimeSec != mtime.tv_sec || it->mtimeNsec != mtime.tv_nsec || it->size != size ) return false;
+
+    entry = {
+        .mtime = mtime,
+        .size = size,
+        .width = it->width,
+        .height = it->height,
+        .loadable = ( it->flags & Loadable ) != 0,
+        .hdr = ( it->flags & Hdr ) != 0
+    };
+    return true;
+}
+
+uint32_t ImageIndex::Size() const
+{
+    return m_buffer ? GetHeader()->count : 0;
+}
+
+bool ImageIndex::Save( const std::vector<std::string_view>& names, const std::vector<Entry>& entries ) const
+{
+    ZoneScoped;
+    if( m_path.empty() || !CreateDirectories( Config::GetPath( "iv-index" ) ) ) return false;
+
+    // Find does a binary search in byte order, which need not be the order of the file list
+    std::vector<uint32_t> order( names.size() );
+    for( uint32_t i=0; i<order.size(); i++ ) order[i] = i;
+    std::ranges::sort( order, [&names]( uint32_t a, uint32_t b ) { return names[a] < names[b]; } );
+
+    std::vector<Record> records;
+    records.reserve( entries.size() );
+    uint32_t offset = 0;
+    for( auto i : order )
+    {
+        auto& e = entries[i];
+        records.emplace_back( Record {
+            .nameOffset = offset,
+            .nameSize = uint32_t( names[i].size() ),
+            .mtimeSec = e.mtime.tv_sec,
+            .size = e.size,
+            .mtimeNsec = uint32_t( e.mtime.tv_nsec ),
+            .width = e.width,
+            .height = e.height,
+            .flags = ( e.loadable ? Loadable : 0u ) | ( e.hdr ? Hdr : 0u )
+        } );
+        offset += names[i].size();
+    }
+    const Header header = {
+        .magic = IndexMagic,
+        .count = uint32_t( records.size() ),
+        .namesSize = offset
+    };
+
+    // Write to a temporary file first, as the index may be mapped by another instance
+    const auto tmp = m_path + ".tmp";
+    FILE* f = fopen( tmp.c_str(), "wb" );
+    if( !f ) return false;
+    bool ok = fwrite( &header, 1, sizeof( header ), f ) == sizeof( header ) &&
+              fwrite( records.data(), sizeof( Record ), records.size(), f ) == records.size();
+    for( size_t i=0; i<order.size() && ok; i++ )
+    {
+        const auto& name = names[order[i]];
+        ok = fwrite( name.data(), 1, name.size(), f ) == name.size();
+    }
+    if( fclose( f ) == 0 && ok && rename( tmp.c_str(), m_path.c_str() ) == 0 )
+    {
+        mclog( LogLevel::Debug, "Saved image index %s, %zu entries", m_path.c_str(), records.size() );
+        return true;
+    }
+    unlink( tmp.c_str() );
+    return false;
+}
+
+const ImageIndex::Header* ImageIndex::GetHeader() const
+{
+    return (const Header*)m_buffer->data();
+}
+
+const ImageIndex::Record* ImageIndex::GetRecords() const
+{
+    return (const Record*)( m_buffer->data() + sizeof( Header ) );
+}
+
+const char* ImageIndex::GetNames() const
+{
+    return m_buffer->data() + sizeof( Header ) + size_t( GetHeader()->count ) * sizeof( Record );
+}
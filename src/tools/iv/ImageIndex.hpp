@@ -0,0 +1,51 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <time.h>
+#include <vector>
+
+#include "util/NoCopy.hpp"
+
+class FileBuffer;
+
+// Results of probing the files of one directory, kept between runs, so that a directory which was seen before
+// does not have to be probed again. The index file is mapped, and replaced as a whole when saved.
+class ImageIndex
+{
+public:
+    struct Entry
+    {
+        struct timespec mtime;
+        uint64_t size;
+        uint32_t width;     // Zero if not known
+        uint32_t height;
+        bool loadable;
+        bool hdr;
+    };
+
+    explicit ImageIndex( const std::string& dir );
+    ~ImageIndex();
+
+    NoCopy( ImageIndex );
+
+    // Succeeds only if the entry matches the given file modification time and size. Thread safe.
+    [[nodiscard]] bool Find( std::string_view name, const struct timespec& mtime, uint64_t size, Entry& entry ) const;
+    [[nodiscard]] uint32_t Size() const;
+
+    // Names are relative to the directory, in any order.
+    bool Save( const std::vector<std::string_view>& names, const std::vector<Entry>& entries ) const;
+
+private:
+    struct Header;
+    struct Record;
+
+    [[nodiscard]] const Header* GetHeader() const;
+    [[nodiscard]] const Record* GetRecords() const;
+    [[nodiscard]] const char* GetNames() const;
+
+    std::string m_path;
+    std::unique_ptr<FileBuffer> m_buffer;
+};
@@ -6,19 +6,100 @@
 #include "image/ImageLoader.hpp"
 #include "image/PngLoader.hpp"
 #include "util/Bitmap.hpp"
+#include "util/BitmapAnimStream.hpp"
+#include "util/BitmapCompressed.hpp"
+#include "util/BitmapDct.hpp"
 #include "util/BitmapHdr.hpp"
+#include "util/BitmapHdrHalf.hpp"
+#include "util/BitmapYuv.hpp"
+#include "util/Clock.hpp"
 #include "util/DataBuffer.hpp"
 #include "util/Logs.hpp"
 #include "util/MemoryBuffer.hpp"
+#include "util/MemoryStats.hpp"
 #include "util/TaskDispatch.hpp"
+#include "util/TilePyramid.hpp"
 
-ImageProvider::ImageProvider( TaskDispatch& td )
-    : m_shutdown( false )
-    , m_currentJob( -1 )
-    , m_nextId( 0 )
-    , m_thread( [this] { Worker(); } )
+namespace
+{
+// Adds the time until the end of the scope to a timeline step
+class StepTimer
+{
+public:
+    explicit StepTimer( uint32_t& step ) : m_step( step ), m_start( GetTimeMicro() ) {}
+    ~StepTimer() { m_step += uint32_t( GetTimeMicro() - m_start ); }
+
+private:
+    uint32_t& m_step;
+    uint64_t m_start;
+};
+
+// Rough peak memory of decoding an image, including the float intermediate of HDR images
+uint64_t DecodeSize( const ImageInfo& info )
+{
+    return uint64_t( info.width ) * info.height * ( info.hdr ? 16 : 4 );
+}
+
+// Whether a load with the given flags gives an image large enough for the request
+bool Covers( const ImageProvider::Flags& load, const ImageProvider::Flags& request )
+{
+    if( load.targetWidth == 0 || load.targetHeight == 0 ) return true;
+    return request.targetWidth != 0 && request.targetHeight != 0 && request.targetWidth <= load.targetWidth && request.targetHeight <= load.targetHeight;
+}
+}
+
+bool ImageProvider::Job::IsBackground() const
+{
+    return std::ranges::all_of( requests, []( const auto& request ) { return request.flags.background; } );
+}
+
+ImageProvider::Flags ImageProvider::Job::LoadFlags() const
+{
+    Flags ret = { .background = IsBackground() };
+    bool full = false;
+    for( auto& request : requests )
+    {
+        full |= request.flags.targetWidth == 0 || request.flags.targetHeight == 0;
+        ret.targetWidth = std::max( ret.targetWidth, request.flags.targetWidth );
+        ret.targetHeight = std::max( ret.targetHeight, request.flags.targetHeight );
+        ret.preview |= request.flags.preview;
+    }
+    if( full )
+    {
+        ret.targetWidth = 0;
+        ret.targetHeight = 0;
+    }
+    return ret;
+}
+
+ImageProvider::ImageProvider( TaskDispatch& td, size_t workers )
+    : m_nextId( 0 )
+    , m_busy( 0 )
+    , m_reserved( 0 )
+    , m_reservedForeground( 0 )
+    , m_shutdown( false )
+    , m_compressedFormats( 0 )
+    , m_compressAbove( 0 )
+    , m_compressMaxSize( 0 )
+    , m_gpuTonemapMaxSize( 0 )
+    , m_gpuYuvMaxSize( 0 )
+    , m_gpuIdctMaxBuffer( 0 )
+    , m_tonemap( ToneMap::Operator::PbrNeutral )
+    , m_tileCacheMaxSize( 0 )
+    , m_tileSize( 0 )
+    , m_overviewSize( 0 )
+    , m_tileCacheBytes( 0 )
+    , m_deliveryExit( false )
     , m_td( td )
 {
+    // Decoders are parallel on their own, more threads mostly help with many small images
+    if( workers == 0 ) workers = std::clamp<size_t>( td.NumWorkers() / 4, 2, 4 );
+    mclog( LogLevel::Info, "%zu image provider threads", workers );
+
+    m_workers.reserve( workers );
+    for( size_t i=0; i<workers; i++ ) m_workers.emplace_back( std::make_unique<Worker>() );
+    for( auto& worker : m_workers ) worker->thread = std::thread( [this, w = worker.get()] { Run( *w ); } );
+    m_deliveryThread = std::thread( [this] { RunDelivery(); } );
 }
 
 ImageProvider::~ImageProvider()
@@ -28,62 +109,122 @@ ImageProvider::~ImageProvider()
         m_shutdown.store( true, std::memory_order_release );
         m_cv.notify_all();
     }
-    m_thread.join();
+    for( auto& worker : m_workers ) worker->thread.join();
+
+    // Loads finished by now are still delivered
+    {
+        std::lock_guard lock( m_deliveryLock );
+        m_deliveryExit = true;
+        m_deliveryReady.notify_one();
+    }
+    m_deliveryThread.join();
 }
 
 int64_t ImageProvider::LoadImage( const char* path, bool hdr, Callback callback, void* userData, Flags flags )
 {
     ZoneScoped;
-    const auto id = m_nextId++;
-    std::lock_guard lock( m_lock );
-    m_jobs.emplace_back( Job {
-        .id = id,
+    return Queue( Job {
         .path = path,
         .fd = -1,
         .hdr = hdr,
-        .callback = callback,
-        .userData = userData,
-        .flags = flags
+        .requests = { Request { .callback = callback, .userData = userData, .flags = flags } }
     } );
-    m_cv.notify_one();
-    return id;
 }
 
 int64_t ImageProvider::LoadImage( int fd, bool hdr, Callback callback, void* userData, const char* origin, Flags flags )
 {
     ZoneScoped;
-    const auto id = m_nextId++;
-    std::lock_guard lock( m_lock );
-    m_jobs.emplace_back( Job {
-        .id = id,
+    return Queue( Job {
         .path = origin,
         .fd = fd,
         .hdr = hdr,
-        .callback = callback,
-        .userData = userData,
-        .flags = flags
+        .requests = { Request { .callback = callback, .userData = userData, .flags = flags } }
     } );
+}
+
+int64_t ImageProvider::Queue( Job&& job )
+{
+    std::lock_guard lock( m_lock );
+    const auto id = m_nextId++;
+    auto& request = job.requests[0];
+    request.id = id;
+    request.cancelled = false;
+    job.queued = GetTimeMicro();
+
+    // File descriptors are read once, so only loads of paths can be shared
+    if( job.fd < 0 )
+    {
+        auto it = std::ranges::find_if( m_jobs, [&job]( const Job& queued ) { return queued.fd < 0 && queued.hdr == job.hdr && queued.path == job.path; } );
+        if( it != m_jobs.end() )
+        {
+            mclog( LogLevel::Debug, "Image %s is already queued", job.path.c_str() );
+            const auto background = request.flags.background;
+            it->requests.emplace_back( std::move( request ) );
+            if( !background ) std::rotate( it, it + 1, m_jobs.end() );
+            return id;
+        }
+
+        for( auto& worker : m_workers )
+        {
+            if( !worker->busy || worker->cancelled.load( std::memory_order_relaxed ) ) continue;
+            auto& running = worker->job;
+            if( running.fd >= 0 || running.hdr != job.hdr || running.path != job.path || !Covers( worker->flags, request.flags ) ) continue;
+            mclog( LogLevel::Debug, "Image %s is already loading", job.path.c_str() );
+            running.requests.emplace_back( std::move( request ) );
+            return id;
+        }
+    }
+
+    m_jobs.emplace_back( std::move( job ) );
     m_cv.notify_one();
     return id;
 }
 
+void ImageProvider::SetStreaming( std::function<std::shared_ptr<RowSink>()> factory )
+{
+    std::lock_guard lock( m_lock );
+    m_streamFactory = std::move( factory );
+}
+
 void ImageProvider::Cancel( int64_t id )
 {
     ZoneScoped;
     std::unique_lock lock( m_lock );
-    if( m_currentJob == id )
+    for( auto& worker : m_workers )
     {
-        m_currentJob = -1;
+        if( !worker->busy ) continue;
+        auto it = std::ranges::find_if( worker->job.requests, [id]( const auto& request ) { return request.id == id; } );
+        if( it != worker->job.requests.end() )
+        {
+            if( !it->cancelled ) CancelRequest( *worker, *it );
+            return;
+        }
     }
-    else
+
+    for( auto job = m_jobs.begin(); job != m_jobs.end(); ++job )
     {
-        auto it = std::ranges::find_if( m_jobs, [id]( const auto& job ) { return job.id == id; } );
-        if( it != m_jobs.end() )
+        auto it = std::ranges::find_if( job->requests, [id]( const auto& request ) { return request.id == id; } );
+        if( it != job->requests.end() )
         {
-            auto job = std::move( *it );
-            m_jobs.erase( it );
+            std::vector<Request> requests = { std::move( *it ) };
+            job->requests.erase( it );
+            if( job->requests.empty() ) m_jobs.erase( job );
             lock.unlock();
-            job.callback( job.userData, job.id, Result::Cancelled, { .flags = job.flags } );
+            DeliverCancelled( std::move( requests ) );
+            return;
+        }
+    }
+    lock.unlock();
+
+    // A finished load waiting for delivery gets a cancelled result instead
+    std::lock_guard deliveryLock( m_deliveryLock );
+    for( auto& delivery : m_deliveries )
+    {
+        auto it = std::ranges::find_if( delivery.requests, [id]( const auto& request ) { return request.id == id; } );
+        if( it != delivery.requests.end() )
+        {
+            it->cancelled = true;
+            return;
         }
     }
 }
@@ -95,106 +236,589 @@ void ImageProvider::CancelAll()
 
     m_lock.lock();
     std::swap( tmp, m_jobs );
-    m_currentJob = -1;
+    for( auto& worker : m_workers )
+    {
+        if( !worker->busy ) continue;
+        for( auto& request : worker->job.requests )
+        {
+            if( !request.cancelled ) CancelRequest( *worker, request );
+        }
+    }
     m_lock.unlock();
 
+    std::vector<Request> requests;
     for( auto& job : tmp )
     {
-        job.callback( job.userData, job.id, Result::Cancelled, { .flags = job.flags } );
+        for( auto& request : job.requests ) requests.emplace_back( std::move( request ) );
+    }
+
+    std::lock_guard lock( m_deliveryLock );
+    for( auto& delivery : m_deliveries )
+    {
+        for( auto& request : delivery.requests ) request.cancelled = true;
+    }
+    if( !requests.empty() ) DeliverCancelledLocked( std::move( requests ) );
+}
+
+void ImageProvider::DeliverCancelled( std::vector<Request>&& requests )
+{
+    std::lock_guard lock( m_deliveryLock );
+    DeliverCancelledLocked( std::move( requests ) );
+}
+
+// Queued behind what is already waiting, so that each callback still has its result in order. The delivery
+// space is not waited for, as the callbacks themselves may cancel.
+void ImageProvider::DeliverCancelledLocked( std::vector<Request>&& requests )
+{
+    for( auto& request : requests ) request.cancelled = true;
+    m_deliveries.emplace_back( Delivery { std::move( requests ), Result::Cancelled, {} } );
+    m_deliveryReady.notify_one();
+}
+
+// Requests of a running job get their callback when the job is done. The decode is stopped once nobody wants
+// the image anymore.
+void ImageProvider::CancelRequest( Worker& worker, Request& request )
+{
+    request.cancelled = true;
+    if( std::ranges::all_of( worker.job.requests, []( const auto& other ) { return other.cancelled; } ) )
+    {
+        worker.cancelled.store( true, std::memory_order_relaxed );
+        m_cv.notify_all();
     }
 }
 
-void ImageProvider::Worker()
+void ImageProvider::Promote( int64_t id )
+{
+    ZoneScoped;
+    std::lock_guard lock( m_lock );
+    for( auto job = m_jobs.begin(); job != m_jobs.end(); ++job )
+    {
+        auto it = std::ranges::find_if( job->requests, [id]( const auto& request ) { return request.id == id; } );
+        if( it != job->requests.end() )
+        {
+            it->flags.background = false;
+            std::rotate( job, job + 1, m_jobs.end() );
+            m_cv.notify_one();
+            return;
+        }
+    }
+}
+
+// Newest foreground job first. Background jobs leave one thread free, so that a foreground request can always
+// start right away.
+std::vector<ImageProvider::Job>::iterator ImageProvider::NextJob()
+{
+    for( auto it = m_jobs.end(); it != m_jobs.begin(); )
+    {
+        --it;
+        if( !it->IsBackground() ) return it;
+    }
+    if( m_jobs.empty() || ( m_workers.size() > 1 && m_busy + 1 >= m_workers.size() ) ) return m_jobs.end();
+    return m_jobs.end() - 1;
+}
+
+void ImageProvider::Run( Worker& worker )
 {
     ZoneScoped;
     std::unique_lock lock( m_lock );
-    while( !m_shutdown.load( std::memory_order_acquire ) )
+    for(;;)
     {
-        m_currentJob = -1;
-        m_cv.wait( lock, [this] { return !m_jobs.empty() || m_shutdown.load( std::memory_order_acquire ); } );
+        auto it = m_jobs.end();
+        m_cv.wait( lock, [this, &it] { return m_shutdown.load( std::memory_order_acquire ) || ( it = NextJob() ) != m_jobs.end(); } );
         if( m_shutdown.load( std::memory_order_acquire ) ) return;
 
-        auto job = std::move( m_jobs.back() );
-        m_jobs.pop_back();
-        m_currentJob = job.id;
+        worker.job = std::move( *it );
+        m_jobs.erase( it );
+        worker.flags = worker.job.LoadFlags();
+        worker.busy = true;
+        worker.cancelled.store( false, std::memory_order_relaxed );
+        m_busy++;
+        lock.unlock();
+
+        Process( worker );
+
+        lock.lock();
+    }
+}
+
+void ImageProvider::Process( Worker& worker )
+{
+    ZoneScopedN( "Image load" );
+
+    // Only the requests change while the job runs, under the lock
+    const auto& job = worker.job;
+    const auto& flags = worker.flags;
+
+    TaskDispatch::ScopedPriority priority( flags.background ? TaskDispatch::Priority::Background : TaskDispatch::Priority::Interactive );
+    std::unique_ptr<Bitmap> bitmap;
+    std::unique_ptr<BitmapHdrHalf> bitmapHdr;
+    std::unique_ptr<BitmapCompressed> bitmapCompressed;
+    std::unique_ptr<BitmapYuv> bitmapYuv;
+    std::unique_ptr<BitmapDct> bitmapDct;
+    std::shared_ptr<BitmapAnimStream> anim;
+    std::shared_ptr<RowSink> stream;
+    BitmapAnim::Frame firstFrame = {};
+    struct timespec mtime = {};
+    Timeline timeline = { .start = job.queued, .queue = uint32_t( GetTimeMicro() - job.queued ) };
+    MemoryStats::Watermark watermark;
+
+    std::shared_ptr<DataBuffer> buffer;
+    if( job.fd >= 0 )
+    {
+        mclog( LogLevel::Info, "Loading image from file descriptor" );
+        buffer = std::make_shared<MemoryBuffer>( job.fd );
+    }
+    else
+    {
+        mclog( LogLevel::Info, "Loading image %s", job.path.c_str() );
+    }
+    auto open = [&] {
+        StepTimer timer( timeline.open );
+        return buffer ? GetImageLoader( buffer, ToneMap::Operator::PbrNeutral, &m_td ) : GetImageLoader( job.path.c_str(), ToneMap::Operator::PbrNeutral, &m_td, &mtime );
+    };
+
+    // Huge images opened before are read from their tile pyramid, without decoding anything
+    std::shared_ptr<TilePyramid> pyramid;
+    const auto tileCacheMaxSize = m_tileCacheMaxSize.load( std::memory_order_relaxed );
+    if( tileCacheMaxSize != 0 && job.fd < 0 )
+    {
+        StepTimer timer( timeline.open );
+        TilePyramid::Source source;
+        if( TilePyramid::GetSource( job.path.c_str(), source ) )
+        {
+            const auto file = TilePyramid::CachePath( source );
+            if( !file.empty() ) pyramid = TilePyramid::Open( file.c_str(), source, m_tileSize.load( std::memory_order_relaxed ) );
+        }
+    }
+
+    auto loader = pyramid ? nullptr : open();
+    ImageInfo info = {};
+    if( loader )
+    {
+        info = Reserve( worker, *loader, timeline );
+        loader->SetTargetSize( flags.targetWidth, flags.targetHeight );
+        if( flags.preview && loader->HasFastPreview() && !loader->IsAnimated() && !worker.cancelled.load( std::memory_order_relaxed ) )
+        {
+            ZoneScopedN( "Preview" );
+            {
+                TaskDispatch::ScopedCancel cancel( &worker.cancelled );
+                Load( *loader, job.hdr, bitmap, bitmapHdr, bitmapCompressed, bitmapYuv, bitmapDct, stream, timeline );
+                StepTimer timer( timeline.orientation );
+                if( bitmap ) bitmap->NormalizeOrientation( &m_td );
+                if( bitmapHdr ) bitmapHdr->NormalizeOrientation( &m_td );
+            }
+
+            const bool cancelled = worker.cancelled.load( std::memory_order_relaxed );
+            if( !cancelled && ( bitmap || bitmapHdr ) )
+            {
+                mclog( LogLevel::Info, "Preview loaded: %ux%u", bitmap ? bitmap->Width() : bitmapHdr->Width(), bitmap ? bitmap->Height() : bitmapHdr->Height() );
+                timeline.preview = uint32_t( GetTimeMicro() - timeline.start );
+                Deliver( worker, Result::Preview, {
+                    .bitmap = std::move( bitmap ),
+                    .bitmapHdr = std::move( bitmapHdr ),
+                    .origin = job.path,
+                    .mtime = mtime,
+                    .timeline = timeline
+                } );
+            }
+            bitmap.reset();
+            bitmapHdr.reset();
+            bitmapCompressed.reset();
+            bitmapYuv.reset();
+            bitmapDct.reset();
+
+            // Loaders are single use, the full image needs a new one
+            loader = cancelled ? nullptr : open();
+        }
+    }
+
+    // Animations are decoded as they play. The first frame is shown like a still image, the view takes the rest
+    // from the stream. Its decode jobs keep going after the load, so they must not inherit the cancellation flag
+    // of the worker, which is reused by the next job.
+    if( loader && loader->IsAnimated() && !worker.cancelled.load( std::memory_order_relaxed ) )
+    {
+        StepTimer timer( timeline.decode );
+        anim = loader->LoadAnimStream( &m_td );
+        if( anim ) firstFrame = anim->Next();
+        if( !firstFrame.bmp ) anim.reset();
+        if( !anim ) loader = open();
+    }
+
+    // Streamed bitmaps are shown as they are, so images which would be block compressed are not streamed
+    if( loader && !anim && !flags.background && loader->HasStreaming() && !MayCompress( info.width, info.height ) )
+    {
+        std::unique_lock lock( m_lock );
+        auto factory = m_streamFactory;
         lock.unlock();
+        if( factory ) stream = factory();
+    }
+    {
+        // Only the decoding is cancellable. The callbacks run outside of the scope, so that work they queue
+        // is never cut short.
+        TaskDispatch::ScopedCancel cancel( &worker.cancelled );
+        if( loader && !anim ) Load( *loader, job.hdr, bitmap, bitmapHdr, bitmapCompressed, bitmapYuv, bitmapDct, stream, timeline );
 
-        ZoneScopedN( "Image load" );
-        std::unique_ptr<Bitmap> bitmap;
-        std::unique_ptr<BitmapHdr> bitmapHdr;
-        struct timespec mtime = {};
+        if( bitmap )
+        {
+            {
+                StepTimer timer( timeline.orientation );
+                bitmap->NormalizeOrientation( &m_td );
+            }
+            StepTimer timer( timeline.compress );
+            bitmapCompressed = Compress( *bitmap );
+            if( bitmapCompressed )
+            {
+                bitmap.reset();
+                bitmapHdr.reset();
+            }
+        }
+        if( bitmapHdr )
+        {
+            StepTimer timer( timeline.orientation );
+            bitmapHdr->NormalizeOrientation( &m_td );
+        }
 
-        std::unique_ptr<ImageLoader> loader;
-        if( job.fd >= 0 )
+        // Whatever a cancelled load left behind is incomplete, and is freed right away
+        if( TaskDispatch::IsCancelled() )
         {
-            mclog( LogLevel::Info, "Loading image from file descriptor" );
-            auto buffer = std::make_shared<MemoryBuffer>( job.fd );
-            loader = GetImageLoader( buffer, ToneMap::Operator::PbrNeutral, &m_td );
+            anim.reset();
+            stream.reset();
+            firstFrame = {};
+            bitmap.reset();
+            bitmapHdr.reset();
+            bitmapCompressed.reset();
+            bitmapYuv.reset();
+            bitmapDct.reset();
         }
-        else
+    }
+
+    // Jobs on other workers count towards the peak too, as it is the process total which has to fit
+    const auto peak = watermark.Peak();
+    timeline.peakMemory = peak.total;
+    mclog( LogLevel::Info, "Peak memory while loading %s: %s", job.fd >= 0 ? "from file descriptor" : job.path.c_str(), peak.Format().c_str() );
+
+    // Requests cancelled after this point are told so by Deliver()
+    if( worker.cancelled.load( std::memory_order_relaxed ) )
+    {
+        Deliver( worker, Result::Cancelled, {} );
+    }
+    else if( pyramid )
+    {
+        mclog( LogLevel::Info, "Image loaded: %ux%u, from the tile cache", pyramid->Width( 0 ), pyramid->Height( 0 ) );
+        mtime = pyramid->Mtime();
+        Deliver( worker, Result::Success, {
+            .pyramid = std::move( pyramid ),
+            .origin = job.path,
+            .mtime = mtime,
+            .timeline = timeline
+        } );
+    }
+    else if( anim )
+    {
+        mclog( LogLevel::Info, "Image loaded: %ux%u, animation with %zu frames", anim->Width(), anim->Height(), anim->FrameCount() );
+        Deliver( worker, Result::Success, {
+            .bitmap = std::move( firstFrame.bmp ),
+            .anim = std::move( anim ),
+            .frameDelay = firstFrame.delay_us,
+            .origin = job.path,
+            .mtime = mtime,
+            .timeline = timeline
+        } );
+    }
+    else if( bitmapCompressed )
+    {
+        mclog( LogLevel::Info, "Image loaded: %ux%u, block compressed", bitmapCompressed->Width(), bitmapCompressed->Height() );
+        Deliver( worker, Result::Success, {
+            .bitmapCompressed = std::move( bitmapCompressed ),
+            .origin = job.path,
+            .mtime = mtime,
+            .timeline = timeline
+        } );
+    }
+    else if( bitmapYuv )
+    {
+        mclog( LogLevel::Info, "Image loaded: %ux%u, YCbCr", bitmapYuv->Width(), bitmapYuv->Height() );
+        Deliver( worker, Result::Success, {
+            .bitmapYuv = std::move( bitmapYuv ),
+            .origin = job.path,
+            .mtime = mtime,
+            .timeline = timeline
+        } );
+    }
+    else if( bitmapDct )
+    {
+        mclog( LogLevel::Info, "Image loaded: %ux%u, DCT coefficients", bitmapDct->Width(), bitmapDct->Height() );
+        Deliver( worker, Result::Success, {
+            .bitmapDct = std::move( bitmapDct ),
+            .origin = job.path,
+            .mtime = mtime,
+            .timeline = timeline
+        } );
+    }
+    else if( bitmap || bitmapHdr )
+    {
+        mclog( LogLevel::Info, "Image loaded: %ux%u", bitmap ? bitmap->Width() : bitmapHdr->Width(), bitmap ? bitmap->Height() : bitmapHdr->Height() );
+
+        // Only full resolution loads of SDR images are cached, the tone mapping of HDR ones depends on the settings
+        std::shared_ptr<Bitmap> shared = std::move( bitmap );
+        if( shared && tileCacheMaxSize != 0 && job.fd < 0 && !info.hdr && std::max( shared->Width(), shared->Height() ) > tileCacheMaxSize )
         {
-            mclog( LogLevel::Info, "Loading image %s", job.path.c_str() );
-            loader = GetImageLoader( job.path.c_str(), ToneMap::Operator::PbrNeutral, &m_td, &mtime );
+            const auto swap = info.orientation >= 5 && info.orientation <= 8;
+            if( shared->Width() == ( swap ? info.height : info.width ) && shared->Height() == ( swap ? info.width : info.height ) ) StoreTiles( shared, job.path, mtime );
         }
+        Deliver( worker, Result::Success, {
+            .bitmap = std::move( shared ),
+            .bitmapHdr = std::move( bitmapHdr ),
+            .stream = std::move( stream ),
+            .origin = job.path,
+            .mtime = mtime,
+            .timeline = timeline
+        } );
+    }
+    else
+    {
+        mclog( LogLevel::Error, "Failed to load image %s", job.path.c_str() );
+        Deliver( worker, Result::Error, {} );
+    }
+}
+
+// Waits until the estimated decode memory fits the limit. Foreground loads only wait for other foreground ones,
+// so that prefetching never holds up the image the user asked for. Returns what the probe found.
+ImageInfo ImageProvider::Reserve( Worker& worker, ImageLoader& loader, Timeline& timeline )
+{
+    ImageInfo info;
+    {
+        StepTimer timer( timeline.probe );
+        info = loader.Probe();
+    }
+    const auto size = DecodeSize( info );
+    const auto background = worker.flags.background;
+
+    StepTimer timer( timeline.wait );
+    std::unique_lock lock( m_lock );
+    auto& reserved = background ? m_reserved : m_reservedForeground;
+    m_cv.wait( lock, [&] { return reserved == 0 || reserved + size <= DecodeMemoryLimit || worker.cancelled.load( std::memory_order_relaxed ) || m_shutdown.load( std::memory_order_acquire ); } );
+    worker.reserved = size;
+    m_reserved += size;
+    if( !background ) m_reservedForeground += size;
+    return info;
+}
 
-        if( loader )
+// Hands the result over to the delivery thread. Anything but a preview also ends the job, and the worker is free
+// to load the next one.
+void ImageProvider::Deliver( Worker& worker, Result result, ReturnData data )
+{
+    std::vector<Request> requests;
+    m_lock.lock();
+    if( result == Result::Preview )
+    {
+        for( auto& request : worker.job.requests )
         {
-            if( loader->IsHdr() && ( job.hdr || loader->PreferHdr() ) )
+            if( !request.cancelled && request.flags.preview ) requests.emplace_back( request );
+        }
+    }
+    else
+    {
+        requests = std::move( worker.job.requests );
+        worker.job = {};
+        worker.busy = false;
+        m_busy--;
+        m_reserved -= worker.reserved;
+        if( !worker.flags.background ) m_reservedForeground -= worker.reserved;
+        worker.reserved = 0;
+        m_cv.notify_all();
+    }
+    m_lock.unlock();
+    if( requests.empty() ) return;
+
+    ZoneScopedN( "Wait for delivery" );
+    std::unique_lock lock( m_deliveryLock );
+    m_deliverySpace.wait( lock, [this] { return m_deliveries.size() < MaxPendingDeliveries; } );
+    m_deliveries.emplace_back( Delivery { std::move( requests ), result, std::move( data ) } );
+    m_deliveryReady.notify_one();
+}
+
+// Calls the callbacks of delivered loads, in the order they were finished in
+void ImageProvider::RunDelivery()
+{
+    std::unique_lock lock( m_deliveryLock );
+    for(;;)
+    {
+        m_deliveryReady.wait( lock, [this] { return m_deliveryExit || !m_deliveries.empty(); } );
+        if( m_deliveries.empty() ) return;
+
+        auto delivery = std::move( m_deliveries.front() );
+        m_deliveries.pop_front();
+        m_deliverySpace.notify_one();
+        lock.unlock();
+
+        ZoneScopedN( "Image delivery" );
+        for( auto& request : delivery.requests )
+        {
+            if( request.cancelled )
             {
-                bitmapHdr = loader->LoadHdr( job.hdr ? Colorspace::BT2020 : Colorspace::BT709 );
-                if( !job.hdr )
-                {
-                    bitmap = std::make_unique<Bitmap>( bitmapHdr->Width(), bitmapHdr->Height() );
-                    auto src = bitmapHdr->Data();
-                    auto dst = bitmap->Data();
-                    size_t sz = bitmapHdr->Width() * bitmapHdr->Height();
-                    while( sz > 0 )
-                    {
-                        const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                        m_td.Queue( [src, dst, chunk] {
-                            ToneMap::Process( ToneMap::Operator::PbrNeutral, (uint32_t*)dst, src, chunk );
-                        } );
-                        src += chunk * 4;
-                        dst += chunk * 4;
-                        sz -= chunk;
-                    }
-                    m_td.Sync();
-                }
+                request.callback( request.userData, request.id, Result::Cancelled, { .flags = request.flags } );
             }
             else
             {
-                bitmap = loader->Load();
+                auto ret = delivery.data;
+                ret.flags = request.flags;
+                request.callback( request.userData, request.id, delivery.result, std::move( ret ) );
             }
         }
+        delivery = {};
 
         lock.lock();
-        const bool cancelled = m_currentJob == -1;
-        lock.unlock();
+    }
+}
+
+// The stream is kept only if the bitmap was passed to it
+void ImageProvider::Load( ImageLoader& loader, bool hdr, std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<BitmapHdrHalf>& bitmapHdr, std::unique_ptr<BitmapCompressed>& bitmapCompressed, std::unique_ptr<BitmapYuv>& bitmapYuv, std::unique_ptr<BitmapDct>& bitmapDct, std::shared_ptr<RowSink>& stream, Timeline& timeline )
+{
+    ZoneScoped;
 
-        if( cancelled )
+    auto sink = std::move( stream );
+
+    const auto compressed = loader.CompressedFormat();
+    if( compressed != BitmapCompressed::Format::None && ( m_compressedFormats.load( std::memory_order_relaxed ) & ( 1u << (int)compressed ) ) )
+    {
+        StepTimer timer( timeline.decode );
+        bitmapCompressed = loader.LoadCompressed();
+    }
+    else if( UseYuv( loader, true ) )
+    {
+        StepTimer timer( timeline.decode );
+        bitmapDct = loader.LoadDct();
+    }
+    else if( UseYuv( loader, false ) )
+    {
+        StepTimer timer( timeline.decode );
+        bitmapYuv = loader.LoadYuv();
+    }
+    else if( loader.IsHdr() && ( hdr || loader.PreferHdr() ) )
+    {
+        // Textures are half float, so the image is loaded in half precision unless it has to be tone mapped here
+        const auto gpuMaxSize = m_gpuTonemapMaxSize.load( std::memory_order_relaxed );
+        if( hdr || gpuMaxSize != 0 )
         {
-            job.callback( job.userData, job.id, Result::Cancelled, { .flags = job.flags } );
+            StepTimer timer( timeline.decode );
+            bitmapHdr = loader.LoadHdrHalf( Colorspace::BT2020 );
         }
-        else if( bitmap || bitmapHdr )
+        if( !hdr && ( gpuMaxSize == 0 || ( bitmapHdr && std::max( bitmapHdr->Width(), bitmapHdr->Height() ) > gpuMaxSize ) ) )
         {
-            uint32_t width, height;
-            if( bitmap ) bitmap->NormalizeOrientation();
-            if( bitmapHdr ) bitmapHdr->NormalizeOrientation();
-            mclog( LogLevel::Info, "Image loaded: %ux%u", bitmap ? bitmap->Width() : bitmapHdr->Width(), bitmap ? bitmap->Height() : bitmapHdr->Height() );
-            job.callback( job.userData, job.id, Result::Success, {
-                .bitmap = std::move( bitmap ),
-                .bitmapHdr = std::move( bitmapHdr ),
-                .origin = job.path,
-                .flags = job.flags,
-                .mtime = mtime
+            std::unique_ptr<BitmapHdr> full;
+            if( bitmapHdr )
+            {
+                StepTimer timer( timeline.convert );
+                full = std::make_unique<BitmapHdr>( *bitmapHdr );
+                bitmapHdr.reset();
+                full->SetColorspace( Colorspace::BT709, &m_td );
+            }
+            else
+            {
+                StepTimer timer( timeline.decode );
+                full = loader.LoadHdr( Colorspace::BT709 );
+            }
+            if( !full ) return;
+            StepTimer timer( timeline.convert );
+            bitmap = std::make_unique<Bitmap>( full->Width(), full->Height(), full->Orientation() );
+            auto src = full->Data();
+            auto dst = (uint32_t*)bitmap->Data();
+            const auto op = m_tonemap.load( std::memory_order_relaxed );
+            m_td.ParallelFor( 0, full->Width() * full->Height(), TaskDispatch::AdaptiveGrain, [src, dst, op]( size_t begin, size_t end ) {
+                ToneMap::Process( op, dst + begin, src + begin * 4, end - begin );
             } );
         }
-        else
+    }
+    else if( sink )
+    {
+        StepTimer timer( timeline.decode );
+        bitmap = loader.LoadStreaming( *sink );
+        stream = std::move( sink );
+    }
+    else
+    {
+        StepTimer timer( timeline.decode );
+        bitmap = loader.Load();
+    }
+}
+
+// Images which Compress() would take are left to it, block compression saves more memory
+bool ImageProvider::UseYuv( ImageLoader& loader, bool dct )
+{
+    const auto maxSize = m_gpuYuvMaxSize.load( std::memory_order_relaxed );
+    const auto maxBuffer = m_gpuIdctMaxBuffer.load( std::memory_order_relaxed );
+    if( maxSize == 0 || ( dct && maxBuffer == 0 ) ) return false;
+    if( dct ? !loader.HasDct() : !loader.HasYuv() ) return false;
+
+    const auto info = loader.Probe();
+    if( std::max( info.width, info.height ) > maxSize ) return false;
+
+    // Two bytes per coefficient, and 4:2:2 chroma has as many coefficients as luma. Padded to whole MCUs.
+    if( dct && uint64_t( ( info.width + 15 ) & ~15u ) * ( ( info.height + 15 ) & ~15u ) * 4 > maxBuffer ) return false;
+    const auto budget = m_compressAbove.load( std::memory_order_relaxed );
+    return budget == 0 || uint64_t( info.width ) * info.height * 4 * 4 / 3 <= budget;
+}
+
+// Whether Compress() may take an SDR image of the given size. Whether it needs alpha decides the rest.
+bool ImageProvider::MayCompress( uint32_t width, uint32_t height )
+{
+    const auto budget = m_compressAbove.load( std::memory_order_relaxed );
+    if( budget == 0 ) return false;
+
+    // With the mip chain, the texture takes a third more than the base level
+    const auto size = uint64_t( width ) * height * 4 * 4 / 3;
+    if( size <= budget ) return false;
+    if( std::max( width, height ) > m_compressMaxSize.load( std::memory_order_relaxed ) ) return false;
+
+    const auto formats = m_compressedFormats.load( std::memory_order_relaxed );
+    return formats & ( 1u << (int)BitmapCompressed::Format::Bc1 | 1u << (int)BitmapCompressed::Format::Bc3 );
+}
+
+std::unique_ptr<BitmapCompressed> ImageProvider::Compress( const Bitmap& bitmap )
+{
+    if( !MayCompress( bitmap.Width(), bitmap.Height() ) ) return nullptr;
+
+    const auto formats = m_compressedFormats.load( std::memory_order_relaxed );
+    const bool bc1 = formats & ( 1u << (int)BitmapCompressed::Format::Bc1 );
+    const bool bc3 = formats & ( 1u << (int)BitmapCompressed::Format::Bc3 );
+    if( !bc1 && !bc3 ) return nullptr;
+
+    ZoneScoped;
+    auto ptr = bitmap.Data() + 3;
+    auto end = ptr + size_t( bitmap.Width() ) * bitmap.Height() * 4;
+    bool opaque = true;
+    while( ptr < end )
+    {
+        if( *ptr != 255 )
         {
-            mclog( LogLevel::Error, "Failed to load image %s", job.path.c_str() );
-            job.callback( job.userData, job.id, Result::Error, { .flags = job.flags } );
+            opaque = false;
+            break;
         }
-
-        lock.lock();
+        ptr += 4;
     }
+
+    if( !opaque && !bc3 ) return nullptr;
+    return BitmapCompressed::Encode( bitmap, opaque && bc1 ? BitmapCompressed::Format::Bc1 : BitmapCompressed::Format::Bc3, true, &m_td );
+}
+
+// Runs in the background after the image was delivered, so that the first open is not held up by it. Nothing is
+// stored if the file was modified since it was loaded.
+void ImageProvider::StoreTiles( std::shared_ptr<Bitmap> bitmap, std::string path, struct timespec mtime )
+{
+    const auto tileSize = m_tileSize.load( std::memory_order_relaxed );
+    const auto overviewSize = m_overviewSize.load( std::memory_order_relaxed );
+    const auto maxBytes = m_tileCacheBytes.load( std::memory_order_relaxed );
+
+    TaskDispatch::ScopedPriority priority( TaskDispatch::Priority::Background );
+    TaskDispatch::ScopedCancel cancel( nullptr );
+    m_td.Queue( [bitmap = std::move( bitmap ), path = std::move( path ), mtime, tileSize, overviewSize, maxBytes, td = &m_td] {
+        ZoneScopedN( "Store tiles" );
+        TilePyramid::Source source;
+        if( !TilePyramid::GetSource( path.c_str(), source ) ) return;
+        if( source.mtime.tv_sec != mtime.tv_sec || source.mtime.tv_nsec != mtime.tv_nsec ) return;
+        const auto file = TilePyramid::CachePath( source );
+        if( file.empty() ) return;
+        if( TilePyramid::Write( file.c_str(), source, *bitmap, tileSize, overviewSize, td ) ) TilePyramid::Trim( maxBytes );
+    } );
 }
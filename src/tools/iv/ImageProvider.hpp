@@ -2,6 +2,8 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
+#include <functional>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
@@ -10,10 +12,20 @@
 #include <time.h>
 #include <vector>
 
+#include "util/Tonemapper.hpp"
+
 class Bitmap;
-class BitmapHdr;
+class BitmapAnimStream;
+class BitmapCompressed;
+class BitmapDct;
+class BitmapYuv;
+class BitmapHdrHalf;
 class DataBuffer;
+class ImageLoader;
+class RowSink;
+class TilePyramid;
 class TaskDispatch;
+struct ImageInfo;
 
 class ImageProvider
 {
@@ -22,56 +34,218 @@ public:
     {
         Success,
         Error,
-        Cancelled
+        Cancelled,
+        Preview     // Reduced image, the job continues with the full one
     };
 
     struct Flags
     {
         int dndFd;
+        bool background;    // e.g. prefetch, loaded only when no foreground request is waiting
+
+        // Size the image will be shown at, so that loaders may decode at a reduced resolution. Zero loads the full image.
+        uint32_t targetWidth;
+        uint32_t targetHeight;
+
+        // The target size image is delivered as a preview, if the loader can make it quickly, and is followed by the
+        // full image.
+        bool preview;
+    };
+
+    // Time spent in each step of a load, in microseconds. The steps which the view takes after the callback are
+    // timed by the view.
+    struct Timeline
+    {
+        uint64_t start;         // GetTimeMicro() when the job was queued
+        uint32_t queue;         // Waiting for a provider thread
+        uint32_t open;          // Reading the file header and picking a loader
+        uint32_t probe;
+        uint32_t wait;          // For decode memory
+        uint32_t decode;
+        uint32_t convert;       // Colorspace conversion and tone mapping
+        uint32_t orientation;
+        uint32_t compress;
+        uint32_t preview;       // Since start, until the preview was delivered, zero without one
+        uint64_t peakMemory;    // Bytes, highest total of MemoryStats while the job ran
     };
 
     struct ReturnData
     {
         std::shared_ptr<Bitmap> bitmap;
-        std::shared_ptr<BitmapHdr> bitmapHdr;
+        std::shared_ptr<BitmapHdrHalf> bitmapHdr;
+        std::shared_ptr<BitmapCompressed> bitmapCompressed;
+        std::shared_ptr<BitmapYuv> bitmapYuv;
+        std::shared_ptr<BitmapDct> bitmapDct;
+        std::shared_ptr<BitmapAnimStream> anim;     // Of animations, the frames after the first one, which is the bitmap
+        uint32_t frameDelay;                        // Of the first frame, in microseconds
+        std::shared_ptr<RowSink> stream;            // Was given all rows of the bitmap, see SetStreaming()
+        std::shared_ptr<TilePyramid> pyramid;       // Huge images cached on disk, read tile by tile instead of a bitmap
         std::string origin;
         Flags flags;
         struct timespec mtime;
+        Timeline timeline;
     };
 
     using Callback = void (*)(void *, int64_t, Result, ReturnData);
 
-    ImageProvider( TaskDispatch& td );
+    // Decodes so much memory at most at once, unless a single image needs more
+    static constexpr uint64_t DecodeMemoryLimit = 1ull << 30;
+
+    // Images are loaded by a number of provider threads, zero picks one based on the TaskDispatch size. Result
+    // callbacks are called in order by a separate delivery thread, never concurrently, so that a provider thread
+    // can decode the next image while the callback uploads the previous one.
+    ImageProvider( TaskDispatch& td, size_t workers = 0 );
     ~ImageProvider();
 
+    // Requests for a file which is already waiting to be loaded, or being loaded at a suitable size, share the
+    // load. Each request gets its own id and callback.
     int64_t LoadImage( const char* path, bool hdr, Callback callback, void* userData, Flags flags = {} );
     int64_t LoadImage( int fd, bool hdr, Callback callback, void* userData, const char* origin, Flags flags = {} );
 
+    // Bit mask of BitmapCompressed::Format values which are returned without decoding.
+    void SetCompressedFormats( uint32_t formats ) { m_compressedFormats.store( formats, std::memory_order_relaxed ); }
+
+    // SDR images which would take more than the given amount of GPU memory are block compressed after loading,
+    // if one of the compressed formats allows it. Zero disables compression. Images larger than maxSize in
+    // either dimension can't be a single texture and are left for the view to tile.
+    void SetCompressAbove( uint64_t bytes, uint32_t maxSize )
+    {
+        m_compressAbove.store( bytes, std::memory_order_relaxed );
+        m_compressMaxSize.store( maxSize, std::memory_order_relaxed );
+    }
+
+    // SDR loads of HDR images return the BT.2020 half float bitmap as is, to be tone mapped by the view shader.
+    // Images larger than maxSize in either dimension can't be a single texture, so they are still tone mapped
+    // here, with the operator set by SetTonemap(). Zero disables GPU tone mapping.
+    void SetGpuTonemap( uint32_t maxSize ) { m_gpuTonemapMaxSize.store( maxSize, std::memory_order_relaxed ); }
+    void SetTonemap( ToneMap::Operator op ) { m_tonemap.store( op, std::memory_order_relaxed ); }
+
+    // Foreground SDR loads which need no processing after decoding are given to a sink made by the factory, row by
+    // row as they are decoded, e.g. to upload them while the rest is still decoding. The sink is returned with the
+    // bitmap, even if it declined the image. Images which would be block compressed are not streamed. Null disables
+    // it.
+    void SetStreaming( std::function<std::shared_ptr<RowSink>()> factory );
+
+    // Images the loader can return as subsampled YCbCr planes are passed on as such, to be converted to RGB by the
+    // view, unless they are larger than maxSize in either dimension, or would be block compressed. Zero disables it.
+    void SetGpuYuv( uint32_t maxSize ) { m_gpuYuvMaxSize.store( maxSize, std::memory_order_relaxed ); }
+    // With GPU YUV enabled, these images may instead be passed on as DCT coefficients, for the view to run the
+    // inverse DCT too, if the coefficients take at most maxBufferSize bytes. Zero disables it.
+    void SetGpuIdct( uint32_t maxBufferSize ) { m_gpuIdctMaxBuffer.store( maxBufferSize, std::memory_order_relaxed ); }
+
+    // Images larger than maxSize in either dimension are stored as a tile pyramid in the disk cache, with the tile
+    // and overview sizes of the view, and are read from it when they are opened again, unless the file has changed
+    // since. The cache is trimmed to maxBytes. A zero maxSize disables it.
+    void SetTileCache( uint32_t maxSize, uint32_t tileSize, uint32_t overviewSize, uint64_t maxBytes )
+    {
+        m_tileCacheMaxSize.store( maxSize, std::memory_order_relaxed );
+        m_tileSize.store( tileSize, std::memory_order_relaxed );
+        m_overviewSize.store( overviewSize, std::memory_order_relaxed );
+        m_tileCacheBytes.store( maxBytes, std::memory_order_relaxed );
+    }
+
+    // The cancelled result goes through the delivery thread too, after any result already waiting there.
+    // Cancelling the job which is being loaded stops the decode at the next point the loader checks for it, which
+    // is usually within a few rows or tiles.
     void Cancel( int64_t id );
     void CancelAll();
 
+    // Turns a queued background request into the newest foreground one, e.g. when a prefetched image is requested
+    // before it was loaded. A job which is already loading is left as it is.
+    void Promote( int64_t id );
+
 private:
-    struct Job
+    struct Request
     {
         int64_t id;
-        std::string path;
-        int fd;
-        bool hdr;
         Callback callback;
         void* userData;
         Flags flags;
+        bool cancelled;
     };
 
-    void Worker();
+    struct Job
+    {
+        std::string path;
+        int fd;
+        bool hdr;
+        uint64_t queued;
+        std::vector<Request> requests;
+
+        [[nodiscard]] bool IsBackground() const;
+        [[nodiscard]] Flags LoadFlags() const;      // Merged from all requests
+    };
+
+    struct Worker
+    {
+        std::thread thread;
+        bool busy = false;
+        Job job;                                // Guarded by m_lock
+        Flags flags = {};                       // The job is loaded with
+        uint64_t reserved = 0;                  // Estimated decode memory
+        std::atomic<bool> cancelled = false;    // All requests of the job were cancelled
+    };
+
+    // A finished load waiting for the delivery thread. Requests are taken from the job when it is delivered.
+    struct Delivery
+    {
+        std::vector<Request> requests;
+        Result result;
+        ReturnData data;
+    };
+
+    // Loads which may wait for delivery at once. Workers with a finished image block beyond that, which bounds
+    // the memory held by decoded images.
+    static constexpr size_t MaxPendingDeliveries = 2;
+
+    int64_t Queue( Job&& job );
+    [[nodiscard]] std::vector<Job>::iterator NextJob();
+    void CancelRequest( Worker& worker, Request& request );
+
+    void Run( Worker& worker );
+    void Process( Worker& worker );
+    ImageInfo Reserve( Worker& worker, ImageLoader& loader, Timeline& timeline );
+    void Deliver( Worker& worker, Result result, ReturnData data );
+    void DeliverCancelled( std::vector<Request>&& requests );
+    void DeliverCancelledLocked( std::vector<Request>&& requests );
+    void RunDelivery();
+    void Load( ImageLoader& loader, bool hdr, std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<BitmapHdrHalf>& bitmapHdr, std::unique_ptr<BitmapCompressed>& bitmapCompressed, std::unique_ptr<BitmapYuv>& bitmapYuv, std::unique_ptr<BitmapDct>& bitmapDct, std::shared_ptr<RowSink>& stream, Timeline& timeline );
+    [[nodiscard]] bool UseYuv( ImageLoader& loader, bool dct );
+    [[nodiscard]] bool MayCompress( uint32_t width, uint32_t height );
+    [[nodiscard]] std::unique_ptr<BitmapCompressed> Compress( const Bitmap& bitmap );
+    void StoreTiles( std::shared_ptr<Bitmap> bitmap, std::string path, struct timespec mtime );
 
-    int64_t m_currentJob;
     int64_t m_nextId;
     std::vector<Job> m_jobs;
 
+    // Cancellation flags of the workers are seen by the loaders and their TaskDispatch jobs through ScopedCancel
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    size_t m_busy;
+    uint64_t m_reserved;
+    uint64_t m_reservedForeground;
+
     std::atomic<bool> m_shutdown;
+    std::atomic<uint32_t> m_compressedFormats;
+    std::atomic<uint64_t> m_compressAbove;
+    std::atomic<uint32_t> m_compressMaxSize;
+    std::atomic<uint32_t> m_gpuTonemapMaxSize;
+    std::atomic<uint32_t> m_gpuYuvMaxSize;
+    std::atomic<uint32_t> m_gpuIdctMaxBuffer;
+    std::atomic<ToneMap::Operator> m_tonemap;
+    std::atomic<uint32_t> m_tileCacheMaxSize;
+    std::atomic<uint32_t> m_tileSize;
+    std::atomic<uint32_t> m_overviewSize;
+    std::atomic<uint64_t> m_tileCacheBytes;
+    std::function<std::shared_ptr<RowSink>()> m_streamFactory;    // Guarded by m_lock
     std::mutex m_lock;
     std::condition_variable m_cv;
-    std::thread m_thread;
+
+    std::deque<Delivery> m_deliveries;
+    bool m_deliveryExit;
+    std::mutex m_deliveryLock;
+    std::condition_variable m_deliveryReady;
+    std::condition_variable m_deliverySpace;
+    std::thread m_deliveryThread;
 
     TaskDispatch& m_td;
 };
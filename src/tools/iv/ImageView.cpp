@@ -1,50 +1,171 @@
 #include <algorithm>
 #include <cmath>
 #include <string.h>
+#include <tracy/Tracy.hpp>
 #include <vector>
 
+#include "AnimationRing.hpp"
 #include "ImageView.hpp"
+#include "OutputTransfer.hpp"
 #include "TextureFormats.hpp"
 #include "Selection.hpp"
+#include "image/ImageLoader.hpp"
 #include "util/Bitmap.hpp"
-#include "util/BitmapHdr.hpp"
+#include "util/BitmapAnimStream.hpp"
+#include "util/BitmapCompressed.hpp"
+#include "util/BitmapHdrHalf.hpp"
+#include "util/BitmapDct.hpp"
+#include "util/BitmapYuv.hpp"
+#include "util/Clock.hpp"
 #include "util/EmbedData.hpp"
+#include "util/Logs.hpp"
+#include "util/TilePyramid.hpp"
 #include "vulkan/VlkBuffer.hpp"
 #include "vulkan/VlkCommandBuffer.hpp"
 #include "vulkan/VlkDescriptorSetLayout.hpp"
 #include "vulkan/VlkDevice.hpp"
 #include "vulkan/VlkFence.hpp"
+#include "vulkan/VlkGarbage.hpp"
+#include "vulkan/VlkImage.hpp"
+#include "vulkan/VlkImageView.hpp"
 #include "vulkan/VlkPipeline.hpp"
+#include "vulkan/VlkPhysicalDevice.hpp"
 #include "vulkan/VlkPipelineLayout.hpp"
 #include "vulkan/VlkProxy.hpp"
 #include "vulkan/VlkSampler.hpp"
 #include "vulkan/VlkShader.hpp"
 #include "vulkan/VlkShaderModule.hpp"
+#include "vulkan/VlkStagingRing.hpp"
 #include "vulkan/ext/GarbageChute.hpp"
 #include "vulkan/ext/Texture.hpp"
 #include "vulkan/ext/Tracy.hpp"
 
+#include "shader/DownsampleComp.hpp"
+#include "shader/IdctComp.hpp"
 #include "shader/NearestFrag.hpp"
-#include "shader/NearestPqFrag.hpp"
 #include "shader/SupersampleFrag.hpp"
-#include "shader/SupersamplePqFrag.hpp"
 #include "shader/TexturingAlphaFrag.hpp"
-#include "shader/TexturingAlphaPqFrag.hpp"
 #include "shader/TexturingVert.hpp"
+#include "shader/YuvToRgbComp.hpp"
 
 struct PushConstant
 {
     float screenSize[2];
+    float origin[2];
+    float size[2];
     float div;
+    int32_t tonemap;
+    float exposure;
 };
 
+struct YuvPushConstant
+{
+    uint32_t chromaWidth;
+    uint32_t chromaHeight;
+    uint32_t cbOffset;
+    uint32_t crOffset;
+    uint32_t vertical;
+    uint32_t lumaStride;
+    uint32_t chromaStride;
+};
+
+struct IdctPushConstant
+{
+    uint32_t quantOffset;
+    uint32_t coefOffset;
+    uint32_t blocksPerRow;
+    uint32_t planeOffset;
+    uint32_t stride;
+};
+
+static Texture::Mips SdrMips( bool cpu )
+{
+    return cpu ? Texture::Mips::Cpu : Texture::Mips::Gpu;
+}
+
+// Uploads the rows of an image as the loader decodes them. Cpu mips would need the full image, so images shown
+// with them are declined, as are the ones which need tiling.
+class TextureStream : public RowSink
+{
+public:
+    TextureStream( std::shared_ptr<VlkDevice> device, uint32_t maxSize, bool cpuMips )
+        : m_device( std::move( device ) )
+        , m_maxSize( maxSize )
+        , m_cpuMips( cpuMips )
+    {
+    }
+
+    bool Start( uint32_t width, uint32_t height ) override
+    {
+        if( m_cpuMips || std::max( width, height ) > m_maxSize ) return false;
+        m_texture = std::make_shared<Texture>( *m_device, width, height, SdrFormat, Texture::Mips::Gpu );
+        m_written.assign( height, false );
+        m_missing = height;
+        return true;
+    }
+
+    // Rows given again are written again, but counted once
+    void Rows( const uint32_t* data, uint32_t y, uint32_t count ) override
+    {
+        m_texture->WriteRows( *m_device, data, y, count );
+        for( uint32_t i=y; i<y+count; i++ )
+        {
+            if( m_written[i] ) continue;
+            m_written[i] = true;
+            m_missing--;
+        }
+    }
+
+    // Null if the image was declined, or not all of it was written
+    [[nodiscard]] std::shared_ptr<Texture> Finish()
+    {
+        if( !m_texture || m_missing != 0 ) return {};
+        std::vector<std::shared_ptr<VlkFence>> texFences;
+        m_texture->Finish( *m_device, texFences );
+        return std::move( m_texture );
+    }
+
+private:
+    std::shared_ptr<VlkDevice> m_device;
+    uint32_t m_maxSize;
+    bool m_cpuMips;
+
+    std::shared_ptr<Texture> m_texture;
+    std::vector<bool> m_written;
+    uint32_t m_missing = 0;
+};
+
+// Makes the given writes visible to the compute shaders which read storage buffers next
+static void ComputeBarrier( VkCommandBuffer cmdbuf, VkPipelineStageFlags2 srcStage, VkAccessFlags2 srcAccess )
+{
+    const VkMemoryBarrier2 barrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = srcStage,
+        .srcAccessMask = srcAccess,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT
+    };
+    const VkDependencyInfo deps = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &barrier
+    };
+    vkCmdPipelineBarrier2( cmdbuf, &deps );
+}
+
 ImageView::ImageView( GarbageChute& garbage, std::shared_ptr<VlkDevice> device, VkFormat format, const VkExtent2D& extent, float scale, Selection& selection )
     : m_garbage( garbage )
     , m_device( std::move( device ) )
+    , m_pipelines( garbage )
+    , m_tileTd( nullptr )
+    , m_maxTextureSize( std::min( m_device->GetPhysicalDevice()->Properties().limits.maxImageDimension2D, MaxTextureSize ) )
+    , m_tileFrame( 0 )
+    , m_residentTiles( 0 )
     , m_extent( extent )
     , m_filteredNearest( false )
     , m_selection( selection )
     , m_scale( scale )
+    , m_tonemap( ToneMap::Operator::PbrNeutral )
     , m_fitMode( FitMode::TooSmall )
 {
     SetScale( scale, extent );
@@ -79,48 +200,34 @@ ImageView::ImageView( GarbageChute& garbage, std::shared_ptr<VlkDevice> device,
     };
 
 
+    Unembed( DownsampleComp );
+    Unembed( IdctComp );
     Unembed( NearestFrag );
-    Unembed( NearestPqFrag );
     Unembed( SupersampleFrag );
-    Unembed( SupersamplePqFrag );
     Unembed( TexturingAlphaFrag );
-    Unembed( TexturingAlphaPqFrag );
     Unembed( TexturingVert );
+    Unembed( YuvToRgbComp );
 
+    auto DownsampleCompModule = std::make_shared<VlkShaderModule>( *m_device, *DownsampleComp );
+    auto IdctCompModule = std::make_shared<VlkShaderModule>( *m_device, *IdctComp );
     auto NearestFragModule = std::make_shared<VlkShaderModule>( *m_device, *NearestFrag );
-    auto NearestPqFragModule = std::make_shared<VlkShaderModule>( *m_device, *NearestPqFrag );
     auto SupersampleFragModule = std::make_shared<VlkShaderModule>( *m_device, *SupersampleFrag );
-    auto SupersamplePqFragModule = std::make_shared<VlkShaderModule>( *m_device, *SupersamplePqFrag );
     auto TexturingAlphaFragModule = std::make_shared<VlkShaderModule>( *m_device, *TexturingAlphaFrag );
-    auto TexturingAlphaPqFragModule = std::make_shared<VlkShaderModule>( *m_device, *TexturingAlphaPqFrag );
     auto TexturingVertModule = std::make_shared<VlkShaderModule>( *m_device, *TexturingVert );
+    auto YuvToRgbCompModule = std::make_shared<VlkShaderModule>( *m_device, *YuvToRgbComp );
 
-    m_shaderMin[0] = std::make_shared<VlkShader>( std::array {
+    m_shaderMin = std::make_shared<VlkShader>( std::array {
         VlkShader::Stage { TexturingVertModule, VK_SHADER_STAGE_VERTEX_BIT },
         VlkShader::Stage { SupersampleFragModule, VK_SHADER_STAGE_FRAGMENT_BIT }
     } );
-    m_shaderMin[1] = std::make_shared<VlkShader>( std::array {
-        VlkShader::Stage { TexturingVertModule, VK_SHADER_STAGE_VERTEX_BIT },
-        VlkShader::Stage { SupersamplePqFragModule, VK_SHADER_STAGE_FRAGMENT_BIT }
-    } );
-
-    m_shaderExact[0] = std::make_shared<VlkShader>( std::array {
+    m_shaderExact = std::make_shared<VlkShader>( std::array {
         VlkShader::Stage { TexturingVertModule, VK_SHADER_STAGE_VERTEX_BIT },
         VlkShader::Stage { TexturingAlphaFragModule, VK_SHADER_STAGE_FRAGMENT_BIT }
     } );
-    m_shaderExact[1] = std::make_shared<VlkShader>( std::array {
-        VlkShader::Stage { TexturingVertModule, VK_SHADER_STAGE_VERTEX_BIT },
-        VlkShader::Stage { TexturingAlphaPqFragModule, VK_SHADER_STAGE_FRAGMENT_BIT }
-    } );
-
-    m_shaderNearest[0] = std::make_shared<VlkShader>( std::array {
+    m_shaderNearest = std::make_shared<VlkShader>( std::array {
         VlkShader::Stage { TexturingVertModule, VK_SHADER_STAGE_VERTEX_BIT },
         VlkShader::Stage { NearestFragModule, VK_SHADER_STAGE_FRAGMENT_BIT }
     } );
-    m_shaderNearest[1] = std::make_shared<VlkShader>( std::array {
-        VlkShader::Stage { TexturingVertModule, VK_SHADER_STAGE_VERTEX_BIT },
-        VlkShader::Stage { NearestPqFragModule, VK_SHADER_STAGE_FRAGMENT_BIT }
-    } );
 
     static constexpr std::array bindings = {
         VkDescriptorSetLayoutBinding { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT }
@@ -139,12 +246,12 @@ ImageView::ImageView( GarbageChute& garbage, std::shared_ptr<VlkDevice> device,
         VkPushConstantRange {
             .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
             .offset = offsetof( PushConstant, screenSize ),
-            .size = sizeof( float ) * 2
+            .size = offsetof( PushConstant, div )
         },
         VkPushConstantRange {
             .stageFlags = VK_SHADER_STAGE_FRAGMENT_BIT,
             .offset = offsetof( PushConstant, div ),
-            .size = sizeof( float )
+            .size = sizeof( PushConstant ) - offsetof( PushConstant, div )
         }
     };
     const VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
@@ -155,7 +262,117 @@ ImageView::ImageView( GarbageChute& garbage, std::shared_ptr<VlkDevice> device,
         .pPushConstantRanges = pushConstantRange.data()
     };
     m_pipelineLayout = std::make_shared<VlkPipelineLayout>( *m_device, pipelineLayoutInfo );
-    CreatePipeline( format );
+    m_pipelines.Init( CreatePipeline( format ), format );
+
+
+    m_shaderDownsample = std::make_shared<VlkShader>( std::array {
+        VlkShader::Stage { DownsampleCompModule, VK_SHADER_STAGE_COMPUTE_BIT }
+    } );
+
+    static constexpr std::array downsampleBindings = {
+        VkDescriptorSetLayoutBinding { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+        VkDescriptorSetLayoutBinding { 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT }
+    };
+    constexpr VkDescriptorSetLayoutCreateInfo downsampleSetLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR,
+        .bindingCount = downsampleBindings.size(),
+        .pBindings = downsampleBindings.data()
+    };
+    m_downsampleSetLayout = std::make_shared<VlkDescriptorSetLayout>( *m_device, downsampleSetLayoutInfo );
+
+    const std::array<VkDescriptorSetLayout, 1> downsampleSets = { *m_downsampleSetLayout };
+    const VkPipelineLayoutCreateInfo downsamplePipelineLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = downsampleSets.size(),
+        .pSetLayouts = downsampleSets.data()
+    };
+    m_downsamplePipelineLayout = std::make_shared<VlkPipelineLayout>( *m_device, downsamplePipelineLayoutInfo );
+
+    const VkComputePipelineCreateInfo downsamplePipelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = *m_shaderDownsample->GetStages(),
+        .layout = *m_downsamplePipelineLayout
+    };
+    m_downsamplePipeline = std::make_shared<VlkPipeline>( *m_device, downsamplePipelineInfo );
+
+
+    m_shaderYuv = std::make_shared<VlkShader>( std::array {
+        VlkShader::Stage { YuvToRgbCompModule, VK_SHADER_STAGE_COMPUTE_BIT }
+    } );
+
+    static constexpr std::array yuvBindings = {
+        VkDescriptorSetLayoutBinding { 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+        VkDescriptorSetLayoutBinding { 1, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1, VK_SHADER_STAGE_COMPUTE_BIT }
+    };
+    constexpr VkDescriptorSetLayoutCreateInfo yuvSetLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR,
+        .bindingCount = yuvBindings.size(),
+        .pBindings = yuvBindings.data()
+    };
+    m_yuvSetLayout = std::make_shared<VlkDescriptorSetLayout>( *m_device, yuvSetLayoutInfo );
+
+    const std::array<VkDescriptorSetLayout, 1> yuvSets = { *m_yuvSetLayout };
+    constexpr VkPushConstantRange yuvPushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .size = sizeof( YuvPushConstant )
+    };
+    const VkPipelineLayoutCreateInfo yuvPipelineLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = yuvSets.size(),
+        .pSetLayouts = yuvSets.data(),
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &yuvPushConstantRange
+    };
+    m_yuvPipelineLayout = std::make_shared<VlkPipelineLayout>( *m_device, yuvPipelineLayoutInfo );
+
+    const VkComputePipelineCreateInfo yuvPipelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = *m_shaderYuv->GetStages(),
+        .layout = *m_yuvPipelineLayout
+    };
+    m_yuvPipeline = std::make_shared<VlkPipeline>( *m_device, yuvPipelineInfo );
+
+
+    m_shaderIdct = std::make_shared<VlkShader>( std::array {
+        VlkShader::Stage { IdctCompModule, VK_SHADER_STAGE_COMPUTE_BIT }
+    } );
+
+    static constexpr std::array idctBindings = {
+        VkDescriptorSetLayoutBinding { 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+        VkDescriptorSetLayoutBinding { 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT }
+    };
+    constexpr VkDescriptorSetLayoutCreateInfo idctSetLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR,
+        .bindingCount = idctBindings.size(),
+        .pBindings = idctBindings.data()
+    };
+    m_idctSetLayout = std::make_shared<VlkDescriptorSetLayout>( *m_device, idctSetLayoutInfo );
+
+    const std::array<VkDescriptorSetLayout, 1> idctSets = { *m_idctSetLayout };
+    constexpr VkPushConstantRange idctPushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .size = sizeof( IdctPushConstant )
+    };
+    const VkPipelineLayoutCreateInfo idctPipelineLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = idctSets.size(),
+        .pSetLayouts = idctSets.data(),
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &idctPushConstantRange
+    };
+    m_idctPipelineLayout = std::make_shared<VlkPipelineLayout>( *m_device, idctPipelineLayoutInfo );
+
+    const VkComputePipelineCreateInfo idctPipelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = *m_shaderIdct->GetStages(),
+        .layout = *m_idctPipelineLayout
+    };
+    m_idctPipeline = std::make_shared<VlkPipeline>( *m_device, idctPipelineInfo );
+
+    m_stats = std::make_shared<LuminanceStats>( *m_device );
 
 
     constexpr uint16_t idata[] = { 0, 1, 2, 2, 3, 0 };
@@ -169,83 +386,324 @@ ImageView::ImageView( GarbageChute& garbage, std::shared_ptr<VlkDevice> device,
     memcpy( m_indexBuffer->Ptr(), idata, sizeof( idata ) );
     m_indexBuffer->Flush();
 
+    constexpr Vertex vdata[] = {
+        { 0, 0, 0, 0 },
+        { 1, 0, 1, 0 },
+        { 1, 1, 1, 1 },
+        { 0, 1, 0, 1 }
+    };
+    constexpr VkBufferCreateInfo vinfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = sizeof( vdata ),
+        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    m_vertexBuffer = std::make_shared<VlkBuffer>( *m_device, vinfo, VlkBuffer::PreferDevice | VlkBuffer::WillWrite );
+    memcpy( m_vertexBuffer->Ptr(), vdata, sizeof( vdata ) );
+    m_vertexBuffer->Flush();
+
     m_selection.SetImageView( this );
 }
 
 ImageView::~ImageView()
 {
+    if( m_anim ) m_garbage.Recycle( std::move( m_anim ) );
+    ReleaseTiles();
+    ReleaseDownsample();
+    m_pipelines.Release();
     m_garbage.Recycle( {
-        std::move( m_pipelineMin ),
-        std::move( m_pipelineExact ),
-        std::move( m_pipelineNearest ),
+        std::move( m_stats ),
+        std::move( m_idctPipeline ),
+        std::move( m_idctPipelineLayout ),
+        std::move( m_idctSetLayout ),
+        std::move( m_shaderIdct ),
+        std::move( m_yuvPipeline ),
+        std::move( m_yuvPipelineLayout ),
+        std::move( m_yuvSetLayout ),
+        std::move( m_shaderYuv ),
+        std::move( m_downsamplePipeline ),
+        std::move( m_downsamplePipelineLayout ),
+        std::move( m_downsampleSetLayout ),
+        std::move( m_shaderDownsample ),
         std::move( m_pipelineLayout ),
         std::move( m_setLayout ),
-        std::move( m_shaderMin[0] ),
-        std::move( m_shaderMin[1] ),
-        std::move( m_shaderExact[0] ),
-        std::move( m_shaderExact[1] ),
-        std::move( m_shaderNearest[0] ),
-        std::move( m_shaderNearest[1] ),
+        std::move( m_shaderMin ),
+        std::move( m_shaderExact ),
+        std::move( m_shaderNearest ),
         std::move( m_vertexBuffer ),
         std::move( m_indexBuffer ),
         std::move( m_texture ),
+        std::move( m_previous ),
+        std::move( m_compare ),
         std::move( m_samplerLinear ),
         std::move( m_samplerNearest ),
     } );
+    for( auto& sampler : m_samplerResident ) if( sampler ) m_garbage.Recycle( std::move( sampler ) );
 }
 
-void ImageView::Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent )
+// The downsampled copy has the size of the image quad, and is drawn 1:1 with the point sampler. Panning keeps
+// using it, only a zoom change makes a new one.
+void ImageView::Prepare( VlkCommandBuffer& cmdbuf )
 {
     CheckPanic( m_texture, "No texture" );
+    if( m_previous || m_texture->ResidentLevel() > 0 ) return;
+
+    // Animation frames would change under the copy
+    if( m_imgScale >= 1 || !m_tileLevels.empty() || m_anim )
+    {
+        if( m_downsampled ) ReleaseDownsample();
+        return;
+    }
+    if( IsDownsampled() ) return;
+    if( m_downsampled ) ReleaseDownsample();
+
+    const auto quad = GetQuad();
+    const auto width = uint32_t( quad.x1 - quad.x0 );
+    const auto height = uint32_t( quad.y1 - quad.y0 );
+    const auto view = ViewExtent( m_extent );
+    if( width == 0 || height == 0 || float( width ) * height > MaxDownsampleArea * view.width * view.height ) return;
+
+    ZoneScoped;
+    ZoneTextF( "%u×%u", width, height );
+
+    const VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = VK_FORMAT_R16G16B16A16_SFLOAT,
+        .extent = { width, height, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_STORAGE_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    m_downsampled = std::make_shared<VlkImage>( *m_device, imageInfo, VlkImage::HighPriority );
+
+    const VkImageViewCreateInfo viewInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = *m_downsampled,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D,
+        .format = VK_FORMAT_R16G16B16A16_SFLOAT,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+    };
+    m_downsampledView = std::make_shared<VlkImageView>( *m_device, viewInfo );
+    m_downsampledScale = m_imgScale;
 
-    const VkViewport viewport = {
-        .width = float( extent.width ),
-        .height = float( extent.height )
+    ZoneVk( *m_device, cmdbuf, "Downsample", true );
+
+    // The texture upload only made the source visible to the fragment shaders
+    const VkMemoryBarrier2 sourceBarrier = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT
+    };
+    VkImageMemoryBarrier2 barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = *m_downsampled,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
     };
-    const VkRect2D scissor = {
-        .extent = extent
+    VkDependencyInfo deps = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .memoryBarrierCount = 1,
+        .pMemoryBarriers = &sourceBarrier,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &barrier
     };
+    vkCmdPipelineBarrier2( cmdbuf, &deps );
 
-    const PushConstant pushConstant = {
-        float( extent.width ),
-        float( extent.height ),
-        m_div
+    const VkDescriptorImageInfo sourceInfo = {
+        .sampler = *m_samplerNearest,
+        .imageView = *m_texture,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+    const VkDescriptorImageInfo targetInfo = {
+        .imageView = *m_downsampledView,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL
+    };
+    const std::array writes = {
+        VkWriteDescriptorSet {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+            .pImageInfo = &sourceInfo
+        },
+        VkWriteDescriptorSet {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstBinding = 1,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .pImageInfo = &targetInfo
+        }
     };
 
-    const std::array<VkBuffer, 1> vertexBuffers = { *m_vertexBuffer };
+    vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, *m_downsamplePipeline );
+    vkCmdPushDescriptorSet( cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, *m_downsamplePipelineLayout, 0, writes.size(), writes.data() );
+    vkCmdDispatch( cmdbuf, ( width + 7 ) / 8, ( height + 7 ) / 8, 1 );
+
+    barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+    barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+    barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+    barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+    barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    deps.memoryBarrierCount = 0;
+    vkCmdPipelineBarrier2( cmdbuf, &deps );
+}
+
+void ImageView::Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent )
+{
+    CheckPanic( m_texture, "No texture" );
+
+    if( m_viewDirty ) ApplyView();
+    if( m_tileDrawDirty ) UpdateTileDraw();
+
+    // Side by side, each half of the window is a view of its own, which clips the image drawn in it
+    const auto view = ViewExtent( extent );
+    VkViewport viewport = {
+        .width = float( view.width ),
+        .height = float( view.height )
+    };
+    VkRect2D scissor = { {}, view };
+
+    PushConstant pushConstant = {
+        .screenSize = { float( view.width ), float( view.height ) },
+        .div = m_div,
+        .tonemap = int32_t( m_tonemap ),
+        .exposure = m_autoExposure ? m_exposure : 1.f
+    };
+    auto Draw = [&]( const Quad& rect ) {
+        pushConstant.origin[0] = rect.x0;
+        pushConstant.origin[1] = rect.y0;
+        pushConstant.size[0] = rect.x1 - rect.x0;
+        pushConstant.size[1] = rect.y1 - rect.y0;
+        vkCmdPushConstants( cmdbuf, *m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, offsetof( PushConstant, screenSize ), offsetof( PushConstant, div ), &pushConstant );
+        vkCmdPushDescriptorSet( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipelineLayout, 0, 1, &m_descWrite );
+        vkCmdDrawIndexed( cmdbuf, 6, 1, 0, 0, 0 );
+    };
+
+    // Until the upload of a new texture is done, the image it replaces stays on screen, as it was drawn last
+    const auto quad = m_previous ? m_previousQuad : GetQuad();
     constexpr std::array<VkDeviceSize, 1> offsets = { 0 };
+    const std::array<VkBuffer, 1> vertexBuffers = { *m_vertexBuffer };
+
+    // The compare texture has no downsampled copy, it's always drawn straight from its mip levels
+    const bool compare = m_compare && !IsTiled() && m_compare->IsDrawable( *m_device );
+    const auto filter = m_imgScale < 1 ? Filter::Min : m_filteredNearest ? Filter::Nearest : Filter::Exact;
+    auto DrawCompare = [&] {
+        const auto sampler = m_imageInfo.sampler;
+        const auto resident = m_compare->ResidentLevel();
+        if( resident > 0 ) m_imageInfo.sampler = GetResidentSampler( resident );
+        m_imageInfo.imageView = *m_compare;
+        vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, SelectPipeline( m_compare->Format(), filter ) );
+        Draw( quad );
+        m_imageInfo.sampler = sampler;
+        m_imageInfo.imageView = *m_texture;
+    };
 
     ZoneVk( *m_device, cmdbuf, "ImageView", true );
-    if( m_imgScale >= 1 )
+    vkCmdPushConstants( cmdbuf, *m_pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, offsetof( PushConstant, div ), sizeof( PushConstant ) - offsetof( PushConstant, div ), &pushConstant.div );
+    vkCmdSetViewport( cmdbuf, 0, 1, &viewport );
+    vkCmdSetScissor( cmdbuf, 0, 1, &scissor );
+    vkCmdBindVertexBuffers( cmdbuf, 0, 1, vertexBuffers.data(), offsets.data() );
+    vkCmdBindIndexBuffer( cmdbuf, *m_indexBuffer, 0, VK_INDEX_TYPE_UINT16 );
+
+    if( compare && m_compareMode == CompareMode::Flicker && m_compareShown )
     {
-        if( m_filteredNearest )
+        DrawCompare();
+    }
+    else
+    {
+        const auto textureFormat = ( m_previous ? m_previous : m_texture )->Format();
+        const bool downsampled = !m_previous && m_imgScale < 1 && IsDownsampled();
+        const auto resident = m_previous ? 0 : m_texture->ResidentLevel();
+        if( resident > 0 ) m_imageInfo.sampler = GetResidentSampler( resident );
+        const auto frame = m_anim && !m_previous ? m_anim->View() : VK_NULL_HANDLE;
+        if( frame != VK_NULL_HANDLE ) m_imageInfo.imageView = frame;
+
+        if( m_previous )
+        {
+            vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, SelectPipeline( textureFormat, Filter::Exact ) );
+            m_imageInfo.imageView = *m_previous;
+        }
+        else if( downsampled )
+        {
+            vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, SelectPipeline( textureFormat, Filter::Exact ) );
+            m_imageInfo.sampler = *m_samplerNearest;
+            m_imageInfo.imageView = *m_downsampledView;
+        }
+        else
+        {
+            vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, SelectPipeline( textureFormat, filter ) );
+        }
+        Draw( quad );
+        if( resident > 0 ) m_imageInfo.sampler = *m_samplerLinear;
+        if( frame != VK_NULL_HANDLE ) m_imageInfo.imageView = *m_texture;
+
+        if( m_previous )
         {
-            vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipelineNearest );
+            m_imageInfo.imageView = *m_texture;
         }
         else
         {
-            vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipelineExact );
+            if( downsampled )
+            {
+                m_imageInfo.sampler = *m_samplerLinear;
+                m_imageInfo.imageView = *m_texture;
+            }
+
+            // Tiles are opaque after blending with the checkerboard, so they fully cover the overview below
+            for( auto& tile : m_tileDraw )
+            {
+                m_imageInfo.imageView = tile.view;
+                Draw( tile.quad );
+            }
+            m_imageInfo.imageView = *m_texture;
         }
     }
-    else
+
+    if( compare && m_compareMode == CompareMode::SideBySide )
     {
-        vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipelineMin );
+        viewport.x = float( view.width );
+        scissor.offset.x = int32_t( view.width );
+        vkCmdSetViewport( cmdbuf, 0, 1, &viewport );
+        vkCmdSetScissor( cmdbuf, 0, 1, &scissor );
+        DrawCompare();
+
+        // The selection is drawn next, over the left view
+        viewport.x = 0;
+        viewport.width = float( extent.width );
+        scissor = { {}, extent };
+        vkCmdSetViewport( cmdbuf, 0, 1, &viewport );
+        vkCmdSetScissor( cmdbuf, 0, 1, &scissor );
     }
-    vkCmdPushConstants( cmdbuf, *m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, offsetof( PushConstant, screenSize ), sizeof( float ) * 2, &pushConstant );
-    vkCmdPushConstants( cmdbuf, *m_pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, offsetof( PushConstant, div ), sizeof( float ), &pushConstant.div );
-    vkCmdSetViewport( cmdbuf, 0, 1, &viewport );
-    vkCmdSetScissor( cmdbuf, 0, 1, &scissor );
-    vkCmdBindVertexBuffers( cmdbuf, 0, 1, vertexBuffers.data(), offsets.data() );
-    vkCmdBindIndexBuffer( cmdbuf, *m_indexBuffer, 0, VK_INDEX_TYPE_UINT16 );
-    vkCmdPushDescriptorSet( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipelineLayout, 0, 1, &m_descWrite );
-    vkCmdDrawIndexed( cmdbuf, 6, 1, 0, 0, 0 );
 }
 
 void ImageView::Resize( const VkExtent2D& extent )
 {
-    const auto dx = int32_t( extent.width - m_extent.width );
-    const auto dy = int32_t( extent.height - m_extent.height );
-    if( dx == 0 && dy == 0 ) return;
+    Refit( extent, ViewExtent( m_extent ) );
+}
+
+// Fits the image again after the size of its view has changed
+void ImageView::Refit( const VkExtent2D& extent, const VkExtent2D& oldView )
+{
+    const auto view = ViewExtent( extent );
+    const auto dx = int32_t( view.width - oldView.width );
+    const auto dy = int32_t( view.height - oldView.height );
+    if( dx == 0 && dy == 0 )
+    {
+        m_extent = extent;
+        return;
+    }
 
     if( m_fitMode == FitMode::TooSmall )
     {
@@ -262,7 +720,7 @@ void ImageView::Resize( const VkExtent2D& extent )
         m_imgOrigin.y += dy / 2.f;
     }
 
-    UpdateVertexBuffer();
+    UpdateView();
 }
 
 std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<Bitmap>& bitmap, TaskDispatch& td, bool newBitmap )
@@ -276,15 +734,14 @@ std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<Bitmap>& bi
         return {};
     }
 
-    std::vector<std::shared_ptr<VlkFence>> texFences;
-    auto texture = std::make_shared<Texture>( *m_device, *bitmap, SdrFormat, true, texFences, &td );
-    for( auto& fence : texFences ) fence->Wait();
+    if( NeedsTiling( bitmap->Width(), bitmap->Height() ) ) return SetTiled( bitmap, td, newBitmap );
 
+    auto texture = CreateTexture( *bitmap, td );
     SetTexture( texture, bitmap->Width(), bitmap->Height(), newBitmap );
     return texture;
 }
 
-std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<BitmapHdr>& bitmap, TaskDispatch& td, bool newBitmap )
+std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<BitmapHdrHalf>& bitmap, TaskDispatch& td, bool newBitmap )
 {
     if( newBitmap ) m_selection.AbortDrag();
 
@@ -295,21 +752,348 @@ std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<BitmapHdr>&
         return {};
     }
 
+    auto texture = CreateTexture( *bitmap, td );
+    SetTexture( texture, bitmap->Width(), bitmap->Height(), newBitmap );
+    return texture;
+}
+
+std::shared_ptr<Texture> ImageView::SetTiled( const std::shared_ptr<Bitmap>& bitmap, TaskDispatch& td, bool newBitmap )
+{
+    ZoneScoped;
+
+    std::vector<TileLevel> levels;
+    levels.emplace_back( TileLevel { .bitmap = bitmap } );
+    while( std::max( levels.back().bitmap->Width(), levels.back().bitmap->Height() ) > OverviewSize )
+    {
+        const auto& prev = *levels.back().bitmap;
+        std::shared_ptr<Bitmap> next = prev.ResizeNew( std::max( 1u, prev.Width() / 2 ), std::max( 1u, prev.Height() / 2 ), &td );
+        levels.emplace_back( TileLevel { .bitmap = std::move( next ) } );
+    }
+
+    // The last level fits in a single texture and becomes the overview
     std::vector<std::shared_ptr<VlkFence>> texFences;
-    auto texture = std::make_shared<Texture>( *m_device, *bitmap, HdrFormat, true, texFences, &td );
-    for( auto& fence : texFences ) fence->Wait();
+    auto texture = std::make_shared<Texture>( *m_device, *levels.back().bitmap, SdrFormat, SdrMips( m_cpuMips ), texFences, &td );
+    levels.pop_back();
+
+    for( auto& level : levels )
+    {
+        level.width = level.bitmap->Width();
+        level.height = level.bitmap->Height();
+        level.tilesX = ( level.width + TileSize - 1 ) / TileSize;
+        level.tilesY = ( level.height + TileSize - 1 ) / TileSize;
+        level.tiles.resize( level.tilesX * level.tilesY );
+    }
+    mclog( LogLevel::Info, "Tiled image, %zu levels, %u×%u tiles at full resolution", levels.size(), levels[0].tilesX, levels[0].tilesY );
 
     SetTexture( texture, bitmap->Width(), bitmap->Height(), newBitmap );
+
+    std::lock_guard lock( m_lock );
+    m_tileLevels = std::move( levels );
+    m_tileTd = &td;
+    return texture;
+}
+
+std::shared_ptr<Texture> ImageView::SetPyramid( const std::shared_ptr<TilePyramid>& pyramid, TaskDispatch& td )
+{
+    ZoneScoped;
+    m_selection.AbortDrag();
+
+    // The last level is the overview, as in SetTiled()
+    const auto numLevels = pyramid->Levels();
+    auto overview = pyramid->Level( numLevels - 1, &td );
+    if( !overview || numLevels < 2 || pyramid->TileSize() != TileSize )
+    {
+        mclog( LogLevel::Error, "Tile pyramid is damaged" );
+        std::lock_guard lock( m_lock );
+        Cleanup();
+        return {};
+    }
+    std::vector<std::shared_ptr<VlkFence>> texFences;
+    auto texture = std::make_shared<Texture>( *m_device, *overview, SdrFormat, SdrMips( m_cpuMips ), texFences, &td );
+
+    std::vector<TileLevel> levels( numLevels - 1 );
+    for( size_t i=0; i<levels.size(); i++ )
+    {
+        auto& level = levels[i];
+        level.width = pyramid->Width( i );
+        level.height = pyramid->Height( i );
+        level.tilesX = pyramid->TilesX( i );
+        level.tilesY = pyramid->TilesY( i );
+        level.tiles.resize( level.tilesX * level.tilesY );
+    }
+    mclog( LogLevel::Info, "Tiled image from the disk cache, %zu levels, %u×%u tiles at full resolution", levels.size(), levels[0].tilesX, levels[0].tilesY );
+
+    SetTexture( texture, levels[0].width, levels[0].height, true );
+
+    std::lock_guard lock( m_lock );
+    m_tileLevels = std::move( levels );
+    m_tilePyramid = pyramid;
+    m_tileTd = &td;
+    return texture;
+}
+
+// Shown right away, so the finer mips are streamed in after the first frames instead of uploaded up front
+std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<BitmapCompressed>& bitmap )
+{
+    m_selection.AbortDrag();
+
+    std::vector<std::shared_ptr<VlkFence>> texFences;
+    auto texture = std::make_shared<Texture>( *m_device, *bitmap, texFences, true );
+    SetTexture( texture, bitmap->Width(), bitmap->Height(), true );
+    return texture;
+}
+
+std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<BitmapYuv>& bitmap )
+{
+    m_selection.AbortDrag();
+
+    auto texture = CreateTexture( *bitmap );
+    SetTexture( texture, bitmap->Width(), bitmap->Height(), true );
+    return texture;
+}
+
+std::shared_ptr<Texture> ImageView::SetBitmap( const std::shared_ptr<BitmapDct>& bitmap )
+{
+    m_selection.AbortDrag();
+
+    auto texture = CreateTexture( *bitmap );
+    SetTexture( texture, bitmap->Width(), bitmap->Height(), true );
+    return texture;
+}
+
+std::shared_ptr<Texture> ImageView::SetStreamed( const std::shared_ptr<Bitmap>& bitmap, RowSink& stream )
+{
+    auto textureStream = dynamic_cast<TextureStream*>( &stream );
+    if( !textureStream ) return {};
+    auto texture = textureStream->Finish();
+    if( !texture ) return {};
+
+    m_selection.AbortDrag();
+    SetTexture( texture, bitmap->Width(), bitmap->Height(), true );
+    return texture;
+}
+
+std::shared_ptr<RowSink> ImageView::CreateStream()
+{
+    return std::make_shared<TextureStream>( m_device, m_maxTextureSize, m_cpuMips );
+}
+
+// Rendering is ordered after the upload on the GPU, there is no need to wait for it here.
+std::shared_ptr<Texture> ImageView::CreateTexture( const Bitmap& bitmap, TaskDispatch& td )
+{
+    if( NeedsTiling( bitmap.Width(), bitmap.Height() ) ) return {};
+
+    std::vector<std::shared_ptr<VlkFence>> texFences;
+    return std::make_shared<Texture>( *m_device, bitmap, SdrFormat, SdrMips( m_cpuMips ), texFences, &td );
+}
+
+std::shared_ptr<Texture> ImageView::CreateTexture( const BitmapHdrHalf& bitmap, TaskDispatch& td )
+{
+    // Two bits of alpha would band any transparency
+    const auto format = m_packedHdr && bitmap.IsOpaque() ? HdrPackedFormat : HdrFormat;
+    std::vector<std::shared_ptr<VlkFence>> texFences;
+    return std::make_shared<Texture>( *m_device, bitmap, format, Texture::Mips::Gpu, texFences, &td );
+}
+
+std::shared_ptr<Texture> ImageView::CreateTexture( const BitmapCompressed& bitmap )
+{
+    std::vector<std::shared_ptr<VlkFence>> texFences;
+    return std::make_shared<Texture>( *m_device, bitmap, texFences );
+}
+
+// Staging memory is host visible and slow to read from a shader, so the planes are copied to the device first
+std::shared_ptr<Texture> ImageView::CreateTexture( const BitmapYuv& bitmap )
+{
+    ZoneScoped;
+    CheckPanic( !NeedsTiling( bitmap.Width(), bitmap.Height() ), "YUV bitmap needs tiling" );
+
+    const auto size = ( bitmap.Size() + 3 ) & ~size_t( 3 );
+    auto staging = m_device->GetStagingRing()->Acquire( size );
+    memcpy( staging.ptr, bitmap.Data(), bitmap.Size() );
+    staging.Flush();
+
+    const VkBufferCreateInfo bufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    auto planes = std::make_shared<VlkBuffer>( *m_device, bufferInfo, VlkBuffer::PreferDevice );
+
+    const YuvPushConstant pushConstant = {
+        .chromaWidth = bitmap.ChromaWidth(),
+        .chromaHeight = bitmap.ChromaHeight(),
+        .cbOffset = uint32_t( bitmap.CbOffset() ),
+        .crOffset = uint32_t( bitmap.CrOffset() ),
+        .vertical = bitmap.GetSubsampling() == BitmapYuv::Subsampling::S420,
+        .lumaStride = bitmap.Width(),
+        .chromaStride = bitmap.ChromaWidth()
+    };
+
+    std::vector<std::shared_ptr<VlkFence>> texFences;
+    auto texture = std::make_shared<Texture>( *m_device, bitmap.Width(), bitmap.Height(), SdrFormat, Texture::Mips::Gpu, [&]( VkCommandBuffer cmdbuf, VkImageView target ) {
+        const VkBufferCopy copy = {
+            .srcOffset = staging.offset,
+            .size = size
+        };
+        vkCmdCopyBuffer( cmdbuf, staging, *planes, 1, &copy );
+        ComputeBarrier( cmdbuf, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT );
+        RecordYuvToRgb( cmdbuf, *planes, size, target, pushConstant, bitmap.Width(), bitmap.Height() );
+    }, texFences );
+
+    m_device->GetStagingRing()->Release( staging, texFences.back() );
+    m_device->GetGarbage()->Recycle( texFences.back(), std::move( planes ) );
+    return texture;
+}
+
+// Both steps run on the device. The blocks are decoded into planes padded to whole blocks, which the YUV
+// conversion then reads with the padded strides.
+std::shared_ptr<Texture> ImageView::CreateTexture( const BitmapDct& bitmap )
+{
+    ZoneScoped;
+    CheckPanic( !NeedsTiling( bitmap.Width(), bitmap.Height() ), "DCT bitmap needs tiling" );
+
+    const auto size = bitmap.Size();
+    auto staging = m_device->GetStagingRing()->Acquire( size );
+    memcpy( staging.ptr, bitmap.Data(), size );
+    staging.Flush();
+
+    const VkBufferCreateInfo coefsInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    auto coefs = std::make_shared<VlkBuffer>( *m_device, coefsInfo, VlkBuffer::PreferDevice );
+
+    std::array<IdctPushConstant, 3> idct;
+    uint32_t planeOffset = 0;
+    for( int c=0; c<3; c++ )
+    {
+        const auto& comp = bitmap.GetComponent( c );
+        idct[c] = {
+            .quantOffset = uint32_t( c * BitmapDct::BlockSize ),
+            .coefOffset = uint32_t( comp.offset ),
+            .blocksPerRow = comp.widthInBlocks,
+            .planeOffset = planeOffset,
+            .stride = comp.widthInBlocks * 8
+        };
+        planeOffset += comp.widthInBlocks * comp.heightInBlocks * 64;
+    }
+    const VkDeviceSize planesSize = planeOffset;
+
+    const VkBufferCreateInfo planesInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = planesSize,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    auto planes = std::make_shared<VlkBuffer>( *m_device, planesInfo, VlkBuffer::PreferDevice );
+
+    const bool vertical = bitmap.GetSubsampling() == BitmapYuv::Subsampling::S420;
+    const YuvPushConstant pushConstant = {
+        .chromaWidth = ( bitmap.Width() + 1 ) / 2,
+        .chromaHeight = vertical ? ( bitmap.Height() + 1 ) / 2 : bitmap.Height(),
+        .cbOffset = idct[1].planeOffset,
+        .crOffset = idct[2].planeOffset,
+        .vertical = vertical,
+        .lumaStride = idct[0].stride,
+        .chromaStride = idct[1].stride
+    };
+
+    std::vector<std::shared_ptr<VlkFence>> texFences;
+    auto texture = std::make_shared<Texture>( *m_device, bitmap.Width(), bitmap.Height(), SdrFormat, Texture::Mips::Gpu, [&]( VkCommandBuffer cmdbuf, VkImageView target ) {
+        const VkBufferCopy copy = {
+            .srcOffset = staging.offset,
+            .size = size
+        };
+        vkCmdCopyBuffer( cmdbuf, staging, *coefs, 1, &copy );
+        ComputeBarrier( cmdbuf, VK_PIPELINE_STAGE_2_TRANSFER_BIT, VK_ACCESS_2_TRANSFER_WRITE_BIT );
+
+        const VkDescriptorBufferInfo coefsDesc = {
+            .buffer = *coefs,
+            .range = size
+        };
+        const VkDescriptorBufferInfo planesDesc = {
+            .buffer = *planes,
+            .range = planesSize
+        };
+        const std::array writes = {
+            VkWriteDescriptorSet {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstBinding = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &coefsDesc
+            },
+            VkWriteDescriptorSet {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstBinding = 1,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &planesDesc
+            }
+        };
+
+        vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, *m_idctPipeline );
+        vkCmdPushDescriptorSet( cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, *m_idctPipelineLayout, 0, writes.size(), writes.data() );
+        for( int c=0; c<3; c++ )
+        {
+            const auto& comp = bitmap.GetComponent( c );
+            vkCmdPushConstants( cmdbuf, *m_idctPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof( IdctPushConstant ), &idct[c] );
+            vkCmdDispatch( cmdbuf, comp.widthInBlocks, comp.heightInBlocks, 1 );
+        }
+        ComputeBarrier( cmdbuf, VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT, VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT );
+
+        RecordYuvToRgb( cmdbuf, *planes, planesSize, target, pushConstant, bitmap.Width(), bitmap.Height() );
+    }, texFences );
+
+    m_device->GetStagingRing()->Release( staging, texFences.back() );
+    m_device->GetGarbage()->Recycle( texFences.back(), { std::move( coefs ), std::move( planes ) } );
     return texture;
 }
 
+void ImageView::RecordYuvToRgb( VkCommandBuffer cmdbuf, VkBuffer planes, VkDeviceSize size, VkImageView target, const YuvPushConstant& pushConstant, uint32_t width, uint32_t height )
+{
+    const VkDescriptorBufferInfo planesInfo = {
+        .buffer = planes,
+        .range = size
+    };
+    const VkDescriptorImageInfo targetInfo = {
+        .imageView = target,
+        .imageLayout = VK_IMAGE_LAYOUT_GENERAL
+    };
+    const std::array writes = {
+        VkWriteDescriptorSet {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstBinding = 0,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+            .pBufferInfo = &planesInfo
+        },
+        VkWriteDescriptorSet {
+            .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+            .dstBinding = 1,
+            .descriptorCount = 1,
+            .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_IMAGE,
+            .pImageInfo = &targetInfo
+        }
+    };
+
+    vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, *m_yuvPipeline );
+    vkCmdPushDescriptorSet( cmdbuf, VK_PIPELINE_BIND_POINT_COMPUTE, *m_yuvPipelineLayout, 0, writes.size(), writes.data() );
+    vkCmdPushConstants( cmdbuf, *m_yuvPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof( pushConstant ), &pushConstant );
+    vkCmdDispatch( cmdbuf, ( width + 7 ) / 8, ( height + 7 ) / 8, 1 );
+}
+
 void ImageView::SetTexture( std::shared_ptr<Texture> texture, uint32_t width, uint32_t height, bool newBitmap )
 {
     std::lock_guard lock( m_lock );
-    Cleanup();
+    Cleanup( true );
 
     std::swap( m_texture, texture );
     m_imageInfo.imageView = *m_texture;
+    MeasureLuminance();
 
     if( newBitmap )
     {
@@ -319,16 +1103,132 @@ void ImageView::SetTexture( std::shared_ptr<Texture> texture, uint32_t width, ui
     else
     {
         CheckPanic( m_bitmapExtent.width == width && m_bitmapExtent.height == height, "Bitmap size changed, but newBitmap is false" );
-        UpdateVertexBuffer();
+        UpdateView();
     }
 }
 
+void ImageView::SetAnimation( std::shared_ptr<BitmapAnimStream> stream, uint32_t firstDelay )
+{
+    std::lock_guard lock( m_lock );
+    if( !m_texture || IsTiled() ) return;
+    if( stream->Width() != m_bitmapExtent.width || stream->Height() != m_bitmapExtent.height ) return;
+    ReleaseDownsample();
+    m_anim = std::make_shared<AnimationRing>( *m_device, std::move( stream ), firstDelay );
+}
+
+uint64_t ImageView::AnimationDeadline() const
+{
+    return m_anim ? m_anim->Deadline() : 0;
+}
+
 std::shared_ptr<Texture> ImageView::GetTexture()
 {
     std::lock_guard lock( m_lock );
     return m_texture;
 }
 
+void ImageView::TextureEdited()
+{
+    std::lock_guard lock( m_lock );
+    ReleaseDownsample();
+    MeasureLuminance();
+}
+
+const LuminanceStats::Result* ImageView::GetLuminance()
+{
+    if( !m_texture || m_measure ) return nullptr;
+    return m_stats->Get();
+}
+
+bool ImageView::UpdateTiles()
+{
+    if( m_tileLevels.empty() ) return false;
+
+    ZoneScoped;
+    m_tileFrame++;
+
+    const auto levelIdx = GetTileLevel();
+    if( levelIdx == m_tileLevels.size() ) return false;
+
+    auto& level = m_tileLevels[levelIdx];
+    const auto rect = GetVisibleTiles( levelIdx );
+
+    bool changed = false;
+    bool pending = false;
+    uint32_t uploads = 0;
+    for( uint32_t y=rect.y0; y<rect.y1; y++ )
+    {
+        for( uint32_t x=rect.x0; x<rect.x1; x++ )
+        {
+            auto& tile = level.tiles[y * level.tilesX + x];
+            if( !tile.texture )
+            {
+                if( uploads == MaxTileUploads )
+                {
+                    pending = true;
+                    continue;
+                }
+                tile.texture = CreateTile( levelIdx, x, y );
+                m_residentTiles++;
+                uploads++;
+                changed = true;
+            }
+            tile.lastUsed = m_tileFrame;
+        }
+    }
+
+    if( m_residentTiles > MaxResidentTiles ) EvictTiles();
+    if( changed ) m_tileDrawDirty = true;
+    return changed || pending;
+}
+
+// With auto exposure, the previous image stays on screen until the exposure of the new one is known, instead of
+// it being shown at the wrong one first
+bool ImageView::UpdateUpload()
+{
+    if( !m_texture ) return false;
+    const auto drawable = m_texture->IsDrawable( *m_device );
+    if( m_measure && drawable )
+    {
+        m_stats->Measure( m_texture, m_texture->ResidentLevel() );
+        m_measure = false;
+    }
+    const auto pending = m_measure || m_stats->IsPending();
+    if( !pending )
+    {
+        const auto stats = m_stats->Get();
+        m_exposure = stats ? stats->exposure : 1.f;
+    }
+    if( m_previous && drawable && !( pending && m_autoExposure ) ) ReleasePrevious();
+    if( m_previous ) return true;
+    const auto streaming = m_texture->Stream( *m_device );
+    const auto comparing = m_compare && m_compare->Stream( *m_device );
+    const auto advanced = m_anim && m_anim->Update( GetTimeMicro() );
+    return streaming || comparing || advanced || pending;
+}
+
+VkSampler ImageView::GetResidentSampler( uint32_t level )
+{
+    if( m_samplerResident.size() <= level ) m_samplerResident.resize( level + 1 );
+    auto& sampler = m_samplerResident[level];
+    if( !sampler )
+    {
+        const VkSamplerCreateInfo samplerInfo = {
+            .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+            .magFilter = VK_FILTER_LINEAR,
+            .minFilter = VK_FILTER_LINEAR,
+            .mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR,
+            .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+            .mipLodBias = -1.f,
+            .minLod = float( level ),
+            .maxLod = VK_LOD_CLAMP_NONE
+        };
+        sampler = std::make_shared<VlkSampler>( *m_device, samplerInfo );
+    }
+    return *sampler;
+}
+
 void ImageView::SetScale( float scale, const VkExtent2D& extent )
 {
     const auto ratio = scale / m_scale;
@@ -340,62 +1240,64 @@ void ImageView::SetScale( float scale, const VkExtent2D& extent )
     m_imgOrigin.x *= ratio;
     m_imgOrigin.y *= ratio;
     SetImgScale( m_imgScale * ratio );
-    UpdateVertexBuffer();
+    UpdateView();
 }
 
 void ImageView::FormatChange( VkFormat format )
 {
-    m_garbage.Recycle( {
-        std::move( m_pipelineMin ),
-        std::move( m_pipelineExact ),
-        std::move( m_pipelineNearest )
-    } );
-    CreatePipeline( format );
+    m_pipelines.Change( format, [this, format] { return CreatePipeline( format ); } );
+}
+
+void ImageView::PrepareFormat( VkFormat format )
+{
+    m_pipelines.Prepare( format, [this, format] { return CreatePipeline( format ); } );
 }
 
 void ImageView::FitToExtent( const VkExtent2D& extent )
 {
     m_fitMode = FitMode::TooSmall;
     m_extent = extent;
+    const auto view = ViewExtent( extent );
 
-    if( m_bitmapExtent.width <= extent.width &&
-        m_bitmapExtent.height <= extent.height )
+    if( m_bitmapExtent.width <= view.width &&
+        m_bitmapExtent.height <= view.height )
     {
         m_imgOrigin = {
-            float( extent.width - m_bitmapExtent.width ) / 2,
-            float( extent.height - m_bitmapExtent.height ) / 2
+            float( view.width - m_bitmapExtent.width ) / 2,
+            float( view.height - m_bitmapExtent.height ) / 2
         };
         SetImgScale( 1 );
     }
     else
     {
-        const auto ratioWidth = float( extent.width ) / m_bitmapExtent.width;
-        const auto ratioHeight = float( extent.height ) / m_bitmapExtent.height;
+        const auto ratioWidth = float( view.width ) / m_bitmapExtent.width;
+        const auto ratioHeight = float( view.height ) / m_bitmapExtent.height;
         const auto scale = std::min( ratioWidth, ratioHeight );
         m_imgOrigin = {
-            float( extent.width - m_bitmapExtent.width * scale ) / 2,
-            float( extent.height - m_bitmapExtent.height * scale ) / 2
+            float( view.width - m_bitmapExtent.width * scale ) / 2,
+            float( view.height - m_bitmapExtent.height * scale ) / 2
         };
         SetImgScale( scale );
     }
-    UpdateVertexBuffer();
+    UpdateView();
 }
 
 void ImageView::FitToWindow( const VkExtent2D& extent )
 {
     m_fitMode = FitMode::Always;
     m_extent = extent;
+    const auto view = ViewExtent( extent );
 
-    const auto ratioWidth = float( extent.width ) / m_bitmapExtent.width;
-    const auto ratioHeight = float( extent.height ) / m_bitmapExtent.height;
+    const auto ratioWidth = float( view.width ) / m_bitmapExtent.width;
+    const auto ratioHeight = float( view.height ) / m_bitmapExtent.height;
     const auto scale = std::min( ratioWidth, ratioHeight );
     m_imgOrigin = {
-        float( extent.width - m_bitmapExtent.width * scale ) / 2,
-        float( extent.height - m_bitmapExtent.height * scale ) / 2
+        float( view.width - m_bitmapExtent.width * scale ) / 2,
+        float( view.height - m_bitmapExtent.height * scale ) / 2
     };
     SetImgScale( scale );
 
-    UpdateVertexBuffer();
+    UpdateView();
 }
 
 void ImageView::FitPixelPerfect( const VkExtent2D& extent, uint32_t zoom, const Vector2<float>* focus )
@@ -404,17 +1306,19 @@ void ImageView::FitPixelPerfect( const VkExtent2D& extent, uint32_t zoom, const
     m_extent = extent;
     if( focus )
     {
-        m_imgOrigin.x = focus->x + ( m_imgOrigin.x - focus->x ) * zoom / m_imgScale;
-        m_imgOrigin.y = focus->y + ( m_imgOrigin.y - focus->y ) * zoom / m_imgScale;
+        const auto point = ViewPoint( *focus );
+        m_imgOrigin.x = point.x + ( m_imgOrigin.x - point.x ) * zoom / m_imgScale;
+        m_imgOrigin.y = point.y + ( m_imgOrigin.y - point.y ) * zoom / m_imgScale;
     }
     else
     {
-        m_imgOrigin.x = ( (float)extent.width - m_bitmapExtent.width * zoom ) / 2;
-        m_imgOrigin.y = ( (float)extent.height - m_bitmapExtent.height * zoom ) / 2;
+        const auto view = ViewExtent( extent );
+        m_imgOrigin.x = ( (float)view.width - m_bitmapExtent.width * zoom ) / 2;
+        m_imgOrigin.y = ( (float)view.height - m_bitmapExtent.height * zoom ) / 2;
     }
     SetImgScale( zoom );
     if( focus ) ClampImagePosition();
-    UpdateVertexBuffer();
+    UpdateView();
 }
 
 void ImageView::Pan( const Vector2<float>& delta )
@@ -422,24 +1326,36 @@ void ImageView::Pan( const Vector2<float>& delta )
     m_fitMode = FitMode::None;
     m_imgOrigin += delta;
     ClampImagePosition();
-    UpdateVertexBuffer();
+    UpdateView();
 }
 
 void ImageView::Zoom( const Vector2<float>& focus, float factor )
 {
     m_fitMode = FitMode::None;
     const auto oldScale = m_imgScale;
+    const auto point = ViewPoint( focus );
     SetImgScale( std::clamp( m_imgScale * factor, 1.f / 128.f, 128.f ) );
-    m_imgOrigin.x = focus.x + ( m_imgOrigin.x - focus.x ) * m_imgScale / oldScale;
-    m_imgOrigin.y = focus.y + ( m_imgOrigin.y - focus.y ) * m_imgScale / oldScale;
+    m_imgOrigin.x = point.x + ( m_imgOrigin.x - point.x ) * m_imgScale / oldScale;
+    m_imgOrigin.y = point.y + ( m_imgOrigin.y - point.y ) * m_imgScale / oldScale;
     ClampImagePosition();
-    UpdateVertexBuffer();
+    UpdateView();
+}
+
+void ImageView::SetCompare( std::shared_ptr<Texture> texture, CompareMode mode, const VkExtent2D& extent )
+{
+    const auto oldView = ViewExtent( m_extent );
+    if( m_compare ) m_garbage.Recycle( std::move( m_compare ) );
+    m_compare = std::move( texture );
+    m_compareMode = mode;
+    m_compareShown = false;
+    Refit( extent, oldView );
 }
 
 void ImageView::ClampImagePosition()
 {
-    m_imgOrigin.x = std::clamp( m_imgOrigin.x, m_extent.width / 2.f - m_bitmapExtent.width * m_imgScale, m_extent.width / 2.f );
-    m_imgOrigin.y = std::clamp( m_imgOrigin.y, m_extent.height / 2.f - m_bitmapExtent.height * m_imgScale, m_extent.height / 2.f );
+    const auto view = ViewExtent( m_extent );
+    m_imgOrigin.x = std::clamp( m_imgOrigin.x, view.width / 2.f - m_bitmapExtent.width * m_imgScale, view.width / 2.f );
+    m_imgOrigin.y = std::clamp( m_imgOrigin.y, view.height / 2.f - m_bitmapExtent.height * m_imgScale, view.height / 2.f );
 }
 
 void ImageView::SetImgScale( float scale )
@@ -459,7 +1375,7 @@ void ImageView::SetImgScale( float scale )
     m_imgScale = scale;
 }
 
-void ImageView::CreatePipeline( VkFormat format )
+ImageView::Pipelines ImageView::CreatePipeline( VkFormat format )
 {
     static constexpr VkVertexInputBindingDescription vertexBindingDescription = {
         .binding = 0,
@@ -527,12 +1443,16 @@ void ImageView::CreatePipeline( VkFormat format )
         .dynamicStateCount = dynamicStateList.size(),
         .pDynamicStates = dynamicStateList.data()
     };
-    const bool pq = format == VK_FORMAT_A2B10G10R10_UNORM_PACK32 || format == VK_FORMAT_A2R10G10B10_UNORM_PACK32;
+    const auto transfer = GetOutputTransfer( format );
+    const bool pq = transfer == OutputTransfer::Pq;
+    const VlkShader shaderMin( *m_shaderMin, { uint32_t( transfer ), 0, 0 } );
+    const VlkShader shaderExact( *m_shaderExact, { uint32_t( transfer ), 0, 0 } );
+    const VlkShader shaderNearest( *m_shaderNearest, { uint32_t( transfer ), 0, 0 } );
     VkGraphicsPipelineCreateInfo pipelineInfo = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
         .pNext = &rendering,
-        .stageCount = pq ? m_shaderMin[1]->GetStageCount() : m_shaderMin[0]->GetStageCount(),
-        .pStages = pq ? m_shaderMin[1]->GetStages() : m_shaderMin[0]->GetStages(),
+        .stageCount = shaderMin.GetStageCount(),
+        .pStages = shaderMin.GetStages(),
         .pVertexInputState = &vertexInputInfo,
         .pInputAssemblyState = &inputAssembly,
         .pViewportState = &viewportState,
@@ -542,59 +1462,331 @@ void ImageView::CreatePipeline( VkFormat format )
         .pDynamicState = &dynamicState,
         .layout = *m_pipelineLayout,
     };
-    m_pipelineMin = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+    Pipelines ret;
+    ret.min = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+
+    pipelineInfo.stageCount = shaderExact.GetStageCount();
+    pipelineInfo.pStages = shaderExact.GetStages();
+    ret.exact = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+
+    pipelineInfo.stageCount = shaderNearest.GetStageCount();
+    pipelineInfo.pStages = shaderNearest.GetStages();
+    ret.nearest = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+
+    if( !pq )
+    {
+        const VlkShader tonemapMin( *m_shaderMin, { uint32_t( transfer ), 1, 0 } );
+        const VlkShader tonemapExact( *m_shaderExact, { uint32_t( transfer ), 1, 0 } );
+        const VlkShader tonemapNearest( *m_shaderNearest, { uint32_t( transfer ), 1, 0 } );
+
+        pipelineInfo.stageCount = tonemapMin.GetStageCount();
+        pipelineInfo.pStages = tonemapMin.GetStages();
+        ret.minTonemap = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+
+        pipelineInfo.stageCount = tonemapExact.GetStageCount();
+        pipelineInfo.pStages = tonemapExact.GetStages();
+        ret.exactTonemap = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+
+        pipelineInfo.stageCount = tonemapNearest.GetStageCount();
+        pipelineInfo.pStages = tonemapNearest.GetStages();
+        ret.nearestTonemap = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+    }
+    else
+    {
+        const VlkShader sdrMin( *m_shaderMin, { uint32_t( transfer ), 0, 1 } );
+        const VlkShader sdrExact( *m_shaderExact, { uint32_t( transfer ), 0, 1 } );
+        const VlkShader sdrNearest( *m_shaderNearest, { uint32_t( transfer ), 0, 1 } );
+
+        pipelineInfo.stageCount = sdrMin.GetStageCount();
+        pipelineInfo.pStages = sdrMin.GetStages();
+        ret.minSdr = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+
+        pipelineInfo.stageCount = sdrExact.GetStageCount();
+        pipelineInfo.pStages = sdrExact.GetStages();
+        ret.exactSdr = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+
+        pipelineInfo.stageCount = sdrNearest.GetStageCount();
+        pipelineInfo.pStages = sdrNearest.GetStages();
+        ret.nearestSdr = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+    }
+
+    const VlkShader packedMin( *m_shaderMin, { uint32_t( transfer ), uint32_t( !pq ), 0, 1 } );
+    const VlkShader packedExact( *m_shaderExact, { uint32_t( transfer ), uint32_t( !pq ), 0, 1 } );
+    const VlkShader packedNearest( *m_shaderNearest, { uint32_t( transfer ), uint32_t( !pq ), 0, 1 } );
+
+    pipelineInfo.stageCount = packedMin.GetStageCount();
+    pipelineInfo.pStages = packedMin.GetStages();
+    ret.minPacked = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
 
-    pipelineInfo.stageCount = pq ? m_shaderExact[1]->GetStageCount() : m_shaderExact[0]->GetStageCount();
-    pipelineInfo.pStages = pq ? m_shaderExact[1]->GetStages() : m_shaderExact[0]->GetStages();
-    m_pipelineExact = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+    pipelineInfo.stageCount = packedExact.GetStageCount();
+    pipelineInfo.pStages = packedExact.GetStages();
+    ret.exactPacked = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+
+    pipelineInfo.stageCount = packedNearest.GetStageCount();
+    pipelineInfo.pStages = packedNearest.GetStages();
+    ret.nearestPacked = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+    return ret;
+}
+
+void ImageView::Pipelines::Recycle( GarbageChute& garbage )
+{
+    garbage.Recycle( {
+        std::move( min ),
+        std::move( exact ),
+        std::move( nearest ),
+        std::move( minTonemap ),
+        std::move( exactTonemap ),
+        std::move( nearestTonemap ),
+        std::move( minSdr ),
+        std::move( exactSdr ),
+        std::move( nearestSdr ),
+        std::move( minPacked ),
+        std::move( exactPacked ),
+        std::move( nearestPacked )
+    } );
+}
 
-    pipelineInfo.stageCount = pq ? m_shaderNearest[1]->GetStageCount() : m_shaderNearest[0]->GetStageCount();
-    pipelineInfo.pStages = pq ? m_shaderNearest[1]->GetStages() : m_shaderNearest[0]->GetStages();
-    m_pipelineNearest = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+// HDR textures are only uploaded for SDR output when they are to be tone mapped here. SDR textures end up on PQ
+// output when the HDR swapchain is kept between images.
+VkPipeline ImageView::SelectPipeline( VkFormat format, Filter filter ) const
+{
+    auto Pick = [filter]( const std::shared_ptr<VlkPipeline>& min, const std::shared_ptr<VlkPipeline>& exact, const std::shared_ptr<VlkPipeline>& nearest ) -> VkPipeline {
+        return filter == Filter::Min ? *min : filter == Filter::Exact ? *exact : *nearest;
+    };
+    const bool hdr = IsHdrFormat( format );
+    const auto& pipelines = m_pipelines.Get();
+    if( format == HdrPackedFormat ) return Pick( pipelines.minPacked, pipelines.exactPacked, pipelines.nearestPacked );
+    if( hdr && pipelines.minTonemap ) return Pick( pipelines.minTonemap, pipelines.exactTonemap, pipelines.nearestTonemap );
+    if( !hdr && pipelines.minSdr ) return Pick( pipelines.minSdr, pipelines.exactSdr, pipelines.nearestSdr );
+    return Pick( pipelines.min, pipelines.exact, pipelines.nearest );
 }
 
-void ImageView::Cleanup()
+// The replaced texture is kept on screen while the new one uploads, unless it wasn't ready to be shown itself
+void ImageView::Cleanup( bool keepShown )
 {
     if( m_texture )
     {
-        m_garbage.Recycle( {
-            std::move( m_texture ),
-            std::move( m_vertexBuffer ),
-        } );
+        if( keepShown && m_texture->IsReady( *m_device ) )
+        {
+            ReleasePrevious();
+            m_previous = std::move( m_texture );
+            m_previousQuad = GetQuad();
+        }
+        else
+        {
+            m_garbage.Recycle( std::move( m_texture ) );
+        }
     }
+    if( !keepShown ) ReleasePrevious();
+    if( m_anim ) m_garbage.Recycle( std::move( m_anim ) );
+    ReleaseTiles();
+    ReleaseDownsample();
 }
 
-std::array<ImageView::Vertex, 4> ImageView::SetupVertexBuffer() const
+// Only HDR textures are measured, others keep the neutral exposure
+void ImageView::MeasureLuminance()
 {
-    float x0 = std::floor( m_imgOrigin.x );
-    float y0 = std::floor( m_imgOrigin.y );
-    float x1 = std::round( x0 + m_bitmapExtent.width * m_imgScale );
-    float y1 = std::round( y0 + m_bitmapExtent.height * m_imgScale );
+    m_stats->Reset();
+    m_measure = IsHdrFormat( m_texture->Format() );
+}
 
-    return { {
-        { x0, y0, 0, 0 },
-        { x1, y0, 1, 0 },
-        { x1, y1, 1, 1 },
-        { x0, y1, 0, 1 }
-    } };
+void ImageView::ReleasePrevious()
+{
+    if( !m_previous ) return;
+    m_garbage.Recycle( std::move( m_previous ) );
 }
 
-void ImageView::UpdateVertexBuffer()
+void ImageView::ReleaseTiles()
 {
-    constexpr VkBufferCreateInfo vinfo = {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = sizeof( Vertex ) * 4,
-        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    for( auto& level : m_tileLevels )
+    {
+        for( auto& tile : level.tiles )
+        {
+            if( tile.texture ) m_garbage.Recycle( std::move( tile.texture ) );
+        }
+    }
+    m_tileLevels.clear();
+    m_tilePyramid.reset();
+    m_tileDraw.clear();
+    m_tileDrawDirty = false;
+    m_tileTd = nullptr;
+    m_residentTiles = 0;
+}
+
+void ImageView::ReleaseDownsample()
+{
+    if( m_downsampled ) m_garbage.Recycle( { std::move( m_downsampledView ), std::move( m_downsampled ) } );
+    m_downsampledScale = 0;
+}
+
+// Picks the coarsest level which still has at least one pixel per screen pixel. Returns the number of tiled
+// levels if the overview is good enough.
+size_t ImageView::GetTileLevel() const
+{
+    // The overview is half the size of the last tiled level
+    const auto overview = float( m_tileLevels.back().width / 2 ) / m_bitmapExtent.width;
+    if( overview >= m_imgScale ) return m_tileLevels.size();
+
+    for( size_t i=m_tileLevels.size()-1; i>0; i-- )
+    {
+        const auto scale = float( m_tileLevels[i].width ) / m_bitmapExtent.width;
+        if( scale >= m_imgScale ) return i;
+    }
+    return 0;
+}
+
+ImageView::TileRect ImageView::GetVisibleTiles( size_t level ) const
+{
+    const auto& tl = m_tileLevels[level];
+    const auto sx = float( tl.width ) / m_bitmapExtent.width / m_imgScale;
+    const auto sy = float( tl.height ) / m_bitmapExtent.height / m_imgScale;
+
+    const auto x0 = std::max( 0.f, -m_imgOrigin.x * sx );
+    const auto y0 = std::max( 0.f, -m_imgOrigin.y * sy );
+    const auto x1 = std::min( float( tl.width ), ( ViewExtent( m_extent ).width - m_imgOrigin.x ) * sx );
+    const auto y1 = std::min( float( tl.height ), ( m_extent.height - m_imgOrigin.y ) * sy );
+    if( x0 >= x1 || y0 >= y1 ) return {};
+
+    return {
+        uint32_t( x0 ) / TileSize,
+        uint32_t( y0 ) / TileSize,
+        std::min( tl.tilesX, uint32_t( std::ceil( x1 ) + TileSize - 1 ) / TileSize ),
+        std::min( tl.tilesY, uint32_t( std::ceil( y1 ) + TileSize - 1 ) / TileSize )
     };
-    auto vb = std::make_shared<VlkBuffer>( *m_device, vinfo, VlkBuffer::PreferDevice | VlkBuffer::WillWrite );
+}
+
+std::shared_ptr<Texture> ImageView::CreateTile( size_t levelIdx, uint32_t x, uint32_t y )
+{
+    ZoneScoped;
+    ZoneTextF( "%u, %u", x, y );
+
+    std::vector<std::shared_ptr<VlkFence>> texFences;
+    const auto& level = m_tileLevels[levelIdx];
+    if( m_tilePyramid )
+    {
+        // A damaged tile stays transparent, rather than being read again every frame
+        auto tile = m_tilePyramid->Tile( levelIdx, x, y );
+        if( !tile )
+        {
+            mclog( LogLevel::Error, "Tile %u, %u of level %zu is damaged", x, y, levelIdx );
+            tile = std::make_unique<Bitmap>( std::min( TileSize, level.width - x * TileSize ), std::min( TileSize, level.height - y * TileSize ) );
+            memset( tile->Data(), 0, size_t( tile->Width() ) * tile->Height() * 4 );
+        }
+        return std::make_shared<Texture>( *m_device, *tile, SdrFormat, SdrMips( m_cpuMips ), texFences, m_tileTd );
+    }
+
+    const auto& src = *level.bitmap;
+    const auto x0 = x * TileSize;
+    const auto y0 = y * TileSize;
+    const auto w = std::min( TileSize, src.Width() - x0 );
+    const auto h = std::min( TileSize, src.Height() - y0 );
 
-    const auto vdata = SetupVertexBuffer();
-    memcpy( vb->Ptr(), vdata.data(), sizeof( Vertex ) * 4 );
-    vb->Flush();
+    Bitmap tile( w, h );
+    auto sptr = src.Data() + ( size_t( y0 ) * src.Width() + x0 ) * 4;
+    auto dptr = tile.Data();
+    for( uint32_t i=0; i<h; i++ )
+    {
+        memcpy( dptr, sptr, w * 4 );
+        sptr += src.Width() * 4;
+        dptr += w * 4;
+    }
+
+    return std::make_shared<Texture>( *m_device, tile, SdrFormat, SdrMips( m_cpuMips ), texFences, m_tileTd );
+}
 
-    if( m_vertexBuffer ) m_garbage.Recycle( std::move( m_vertexBuffer ) );
-    std::swap( m_vertexBuffer, vb );
+void ImageView::EvictTiles()
+{
+    std::vector<Tile*> unused;
+    for( auto& level : m_tileLevels )
+    {
+        for( auto& tile : level.tiles )
+        {
+            if( tile.texture && tile.lastUsed != m_tileFrame ) unused.emplace_back( &tile );
+        }
+    }
+    std::ranges::sort( unused, []( const Tile* a, const Tile* b ) { return a->lastUsed < b->lastUsed; } );
+
+    for( auto tile : unused )
+    {
+        if( m_residentTiles <= MaxResidentTiles ) break;
+        m_garbage.Recycle( std::move( tile->texture ) );
+        m_residentTiles--;
+    }
+}
 
+// Only the resident tiles of the wanted level are drawn. The overview shows through where they are missing.
+void ImageView::UpdateTileDraw()
+{
+    m_tileDrawDirty = false;
+    m_tileDraw.clear();
+
+    const auto levelIdx = GetTileLevel();
+    if( levelIdx == m_tileLevels.size() ) return;
+
+    const auto& level = m_tileLevels[levelIdx];
+    const auto rect = GetVisibleTiles( levelIdx );
+
+    // Edges are computed the same way for neighboring tiles, so that there are no gaps between them
+    const auto ox = std::floor( m_imgOrigin.x );
+    const auto oy = std::floor( m_imgOrigin.y );
+    const auto sx = float( m_bitmapExtent.width ) / level.width * m_imgScale;
+    const auto sy = float( m_bitmapExtent.height ) / level.height * m_imgScale;
+    auto EdgeX = [&]( uint32_t px ) { return std::round( ox + px * sx ); };
+    auto EdgeY = [&]( uint32_t px ) { return std::round( oy + px * sy ); };
+
+    for( uint32_t y=rect.y0; y<rect.y1; y++ )
+    {
+        for( uint32_t x=rect.x0; x<rect.x1; x++ )
+        {
+            const auto& tile = level.tiles[y * level.tilesX + x];
+            if( !tile.texture ) continue;
+
+            m_tileDraw.push_back( { *tile.texture, {
+                EdgeX( x * TileSize ),
+                EdgeY( y * TileSize ),
+                EdgeX( std::min( ( x + 1 ) * TileSize, level.width ) ),
+                EdgeY( std::min( ( y + 1 ) * TileSize, level.height ) )
+            } } );
+        }
+    }
+}
+
+ImageView::Quad ImageView::GetQuad() const
+{
+    const auto x0 = std::floor( m_imgOrigin.x );
+    const auto y0 = std::floor( m_imgOrigin.y );
+    return {
+        x0,
+        y0,
+        std::round( x0 + m_bitmapExtent.width * m_imgScale ),
+        std::round( y0 + m_bitmapExtent.height * m_imgScale )
+    };
+}
+
+// Views change on every input event, but only the last state before a frame is drawn matters
+void ImageView::UpdateView()
+{
+    m_viewDirty = true;
+}
+
+void ImageView::ApplyView()
+{
+    m_viewDirty = false;
+    if( !m_tileLevels.empty() ) m_tileDrawDirty = true;
     if( m_selection.IsActive() ) m_selection.UpdateVertexBuffer();
 }
+
+VkExtent2D ImageView::ViewExtent( const VkExtent2D& extent ) const
+{
+    if( !m_compare || m_compareMode != CompareMode::SideBySide ) return extent;
+    return { std::max( extent.width / 2, 1u ), extent.height };
+}
+
+// Points in the right view of a side by side comparison are moved to the same place in the left one
+Vector2<float> ImageView::ViewPoint( const Vector2<float>& point ) const
+{
+    if( !m_compare || m_compareMode != CompareMode::SideBySide ) return point;
+    const auto width = float( ViewExtent( m_extent ).width );
+    if( point.x < width ) return point;
+    return { point.x - width, point.y };
+}
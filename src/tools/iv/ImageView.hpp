@@ -1,26 +1,41 @@
 #pragma once
 
-#include <array>
+#include <algorithm>
 #include <memory>
 #include <mutex>
+#include <stdint.h>
+#include <vector>
 #include <vulkan/vulkan.h>
 
+#include "LuminanceStats.hpp"
+#include "PreparedPipeline.hpp"
+#include "util/Tonemapper.hpp"
 #include "util/Vector2.hpp"
 
+class AnimationRing;
 class Bitmap;
-class BitmapHdr;
+class BitmapAnimStream;
+class BitmapCompressed;
+class BitmapDct;
+class BitmapHdrHalf;
+class BitmapYuv;
 class GarbageChute;
+class RowSink;
 class Selection;
 class TaskDispatch;
 class Texture;
+class TilePyramid;
 class VlkBuffer;
 class VlkCommandBuffer;
 class VlkDescriptorSetLayout;
 class VlkDevice;
+class VlkImage;
+class VlkImageView;
 class VlkPipeline;
 class VlkPipelineLayout;
 class VlkSampler;
 class VlkShader;
+struct YuvPushConstant;
 
 // Must be externally synchronized.
 class ImageView
@@ -31,6 +46,12 @@ class ImageView
         float u, v;
     };
 
+    // Screen rectangle of an image, in pixels. Drawn with the unit quad in the vertex buffer.
+    struct Quad
+    {
+        float x0, y0, x1, y1;
+    };
+
     enum class FitMode
     {
         None,
@@ -38,20 +59,156 @@ class ImageView
         Always
     };
 
+    struct Tile
+    {
+        std::shared_ptr<Texture> texture;
+        uint64_t lastUsed;
+    };
+
+    // One level of the tile pyramid. Level 0 is the full resolution bitmap, each next one is half the size. There
+    // are no bitmaps if the tiles are read from m_tilePyramid.
+    struct TileLevel
+    {
+        std::shared_ptr<Bitmap> bitmap;
+        uint32_t width;
+        uint32_t height;
+        uint32_t tilesX;
+        uint32_t tilesY;
+        std::vector<Tile> tiles;
+    };
+
+    struct Pipelines
+    {
+        std::shared_ptr<VlkPipeline> min;
+        std::shared_ptr<VlkPipeline> exact;
+        std::shared_ptr<VlkPipeline> nearest;
+
+        // Tone map HDR textures for an SDR framebuffer. Not created for PQ output, where they are shown as is.
+        std::shared_ptr<VlkPipeline> minTonemap;
+        std::shared_ptr<VlkPipeline> exactTonemap;
+        std::shared_ptr<VlkPipeline> nearestTonemap;
+
+        // Map SDR textures to SDR white on a PQ framebuffer. Only created for PQ output.
+        std::shared_ptr<VlkPipeline> minSdr;
+        std::shared_ptr<VlkPipeline> exactSdr;
+        std::shared_ptr<VlkPipeline> nearestSdr;
+
+        // Decode packed PQ textures, and tone map them on an SDR framebuffer
+        std::shared_ptr<VlkPipeline> minPacked;
+        std::shared_ptr<VlkPipeline> exactPacked;
+        std::shared_ptr<VlkPipeline> nearestPacked;
+
+        void Recycle( GarbageChute& garbage );
+    };
+
+    struct TileDraw
+    {
+        VkImageView view;
+        Quad quad;
+    };
+
+    enum class Filter
+    {
+        Min,
+        Exact,
+        Nearest
+    };
+
+    struct TileRect
+    {
+        uint32_t x0, y0, x1, y1;    // Exclusive end
+
+        bool operator==( const TileRect& ) const = default;
+    };
+
 public:
+    enum class CompareMode
+    {
+        SideBySide,     // Each image in its half of the window
+        Flicker         // One image at a time, in the same place
+    };
+
+    // Bitmaps larger than this (or the device limit) are shown tiled. Only the tiles visible at the current zoom
+    // level are kept on the GPU, and a downscaled overview covers the ones which are not loaded yet.
+    static constexpr uint32_t MaxTextureSize = 16384;
+    static constexpr uint32_t TileSize = 2048;
+    static constexpr uint32_t OverviewSize = 4096;
+    static constexpr size_t MaxResidentTiles = 48;
+    static constexpr uint32_t MaxTileUploads = 2;   // Per frame
+
+    // Minified images are drawn from a copy made at the displayed size, unless it is larger than this many
+    // windows. The copy is only made again when the zoom changes.
+    static constexpr float MaxDownsampleArea = 2;
+
     ImageView( GarbageChute& garbage, std::shared_ptr<VlkDevice> device, VkFormat format, const VkExtent2D& extent, float scale, Selection& selection );
     ~ImageView();
 
+    // Records the work that has to be done before the render pass begins. Must be called before Render().
+    void Prepare( VlkCommandBuffer& cmdbuf );
     void Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent );
     void Resize( const VkExtent2D& extent );
 
     std::shared_ptr<Texture> SetBitmap( const std::shared_ptr<Bitmap>& bitmap, TaskDispatch& td, bool newBitmap );      // call with no lock
-    std::shared_ptr<Texture> SetBitmap( const std::shared_ptr<BitmapHdr>& bitmap, TaskDispatch& td, bool newBitmap );   // call with no lock
+    std::shared_ptr<Texture> SetBitmap( const std::shared_ptr<BitmapHdrHalf>& bitmap, TaskDispatch& td, bool newBitmap );   // call with no lock
+    std::shared_ptr<Texture> SetBitmap( const std::shared_ptr<BitmapCompressed>& bitmap );                             // call with no lock
+    std::shared_ptr<Texture> SetBitmap( const std::shared_ptr<BitmapYuv>& bitmap );                                    // call with no lock
+    std::shared_ptr<Texture> SetBitmap( const std::shared_ptr<BitmapDct>& bitmap );                                    // call with no lock
+    // Shown tiled, from a pyramid in the disk cache, so the image is never decoded as a whole
+    std::shared_ptr<Texture> SetPyramid( const std::shared_ptr<TilePyramid>& pyramid, TaskDispatch& td );             // call with no lock
     void SetTexture( std::shared_ptr<Texture> texture, uint32_t width, uint32_t height, bool newBitmap );               // call with no lock
+    // Shows a bitmap which was uploaded as it was decoded, by a sink from CreateStream(). Returns null if the sink
+    // declined the image or missed some of its rows, the bitmap then has to go through SetBitmap().
+    std::shared_ptr<Texture> SetStreamed( const std::shared_ptr<Bitmap>& bitmap, RowSink& stream );                  // call with no lock
+
+    // Plays the animation whose first frame was just shown with SetBitmap() or SetTexture(). The delay is that of
+    // the first frame. Frames are taken from the stream as they are due, so it may continue where it was left.
+    void SetAnimation( std::shared_ptr<BitmapAnimStream> stream, uint32_t firstDelay );                             // call with no lock
+    // GetTimeMicro() time at which the animation shows its next frame, zero if none is playing
+    [[nodiscard]] uint64_t AnimationDeadline() const;
+
+    // Uploads a bitmap to be shown later with SetTexture(), e.g. when it is prefetched. Bitmaps which need tiling
+    // can't be a single texture, these return null and have to go through SetBitmap().
+    [[nodiscard]] std::shared_ptr<Texture> CreateTexture( const Bitmap& bitmap, TaskDispatch& td );                     // thread safe
+    [[nodiscard]] std::shared_ptr<Texture> CreateTexture( const BitmapHdrHalf& bitmap, TaskDispatch& td );              // thread safe
+    [[nodiscard]] std::shared_ptr<Texture> CreateTexture( const BitmapCompressed& bitmap );                             // thread safe
+    // The planes are uploaded as they are and converted to RGB by a compute shader. Must not need tiling.
+    [[nodiscard]] std::shared_ptr<Texture> CreateTexture( const BitmapYuv& bitmap );                                    // thread safe
+    // The inverse DCT runs in a compute shader too, before the conversion. Must not need tiling.
+    [[nodiscard]] std::shared_ptr<Texture> CreateTexture( const BitmapDct& bitmap );                                    // thread safe
+    // Sink for ImageProvider::SetStreaming(), which uploads SDR images row by row, as they are decoded
+    [[nodiscard]] std::shared_ptr<RowSink> CreateStream();                                                            // thread safe
+    [[nodiscard]] bool NeedsTiling( uint32_t width, uint32_t height ) const { return std::max( width, height ) > m_maxTextureSize; }
     std::shared_ptr<Texture> GetTexture();
+    void TextureEdited();       // The shown texture was changed in place, copies made from it are dropped
+
+    // Uploads missing visible tiles, a few per frame, and evicts unused ones. Returns true if the view needs
+    // to be rendered again.
+    bool UpdateTiles();
+
+    // A new texture is shown once its upload has finished on the GPU, the previous one is drawn until then, so
+    // that frames don't wait for the upload. Progressive textures are shown with their coarse levels, and the
+    // finer ones are then streamed in. Animations advance to their next frame here. Returns true if the view needs
+    // to be rendered again.
+    bool UpdateUpload();
+
+    // Operator used for HDR textures on SDR output. Takes effect on the next frame, without reloading the image.
+    void SetTonemap( ToneMap::Operator op ) { m_tonemap = op; }
+    [[nodiscard]] ToneMap::Operator GetTonemap() const { return m_tonemap; }
+
+    // Scales HDR textures which are tone mapped to the exposure measured on the GPU. Takes effect on the next frame.
+    void SetAutoExposure( bool enable ) { m_autoExposure = enable; }
+    [[nodiscard]] bool GetAutoExposure() const { return m_autoExposure; }
+    // Statistics of the shown texture, null if it's not HDR or they are not known yet
+    [[nodiscard]] const LuminanceStats::Result* GetLuminance();
+
+    // Opaque HDR bitmaps are uploaded as HdrPackedFormat from then on, instead of half floats
+    void SetPackedHdr( bool packed ) { m_packedHdr = packed; }
+    // SDR bitmaps get their mips filtered on the CPU from then on, instead of blitted on the GPU
+    void SetCpuMips( bool cpu ) { m_cpuMips = cpu; }
 
     void SetScale( float scale, const VkExtent2D& extent );
     void FormatChange( VkFormat format );
+    void PrepareFormat( VkFormat format );      // Thread safe, makes a later FormatChange() to this format cheap
 
     void FitToExtent( const VkExtent2D& extent );
     void FitToWindow( const VkExtent2D& extent );
@@ -60,7 +217,16 @@ public:
     void Pan( const Vector2<float>& delta );
     void Zoom( const Vector2<float>& focus, float factor );
 
+    // Draws another texture, such as an earlier image, in the same rectangle as the shown one, so that both follow
+    // the same pan and zoom. It's ignored while the view is tiled. Null ends the comparison.
+    void SetCompare( std::shared_ptr<Texture> texture, CompareMode mode, const VkExtent2D& extent );
+    void FlipCompare() { m_compareShown = !m_compareShown; }     // Flicker mode, switches the image on screen
+    [[nodiscard]] bool IsComparing() const { return m_compare != nullptr; }
+    [[nodiscard]] const std::shared_ptr<Texture>& GetCompare() const { return m_compare; }
+    [[nodiscard]] CompareMode GetCompareMode() const { return m_compareMode; }
+
     [[nodiscard]] bool HasBitmap() const { return m_texture != nullptr; };
+    [[nodiscard]] bool IsTiled() const { return !m_tileLevels.empty(); }     // GetTexture() returns the overview
     [[nodiscard]] const VkExtent2D& GetBitmapExtent() const { return m_bitmapExtent; }
     [[nodiscard]] float GetImgScale() const { return m_imgScale; }
     [[nodiscard]] const Vector2<float>& GetImgOrigin() const { return m_imgOrigin; }
@@ -69,11 +235,30 @@ public:
     void unlock() { m_lock.unlock(); }
 
 private:
-    void CreatePipeline( VkFormat format );
+    [[nodiscard]] Pipelines CreatePipeline( VkFormat format );
+    [[nodiscard]] VkPipeline SelectPipeline( VkFormat format, Filter filter ) const;
+
+    std::shared_ptr<Texture> SetTiled( const std::shared_ptr<Bitmap>& bitmap, TaskDispatch& td, bool newBitmap );
+    void RecordYuvToRgb( VkCommandBuffer cmdbuf, VkBuffer planes, VkDeviceSize size, VkImageView target, const YuvPushConstant& pushConstant, uint32_t width, uint32_t height );
 
-    void Cleanup();
-    [[nodiscard]] std::array<Vertex, 4> SetupVertexBuffer() const;
-    void UpdateVertexBuffer();
+    void Refit( const VkExtent2D& extent, const VkExtent2D& oldView );
+    void Cleanup( bool keepShown = false );
+    void MeasureLuminance();
+    void ReleasePrevious();
+    void ReleaseTiles();
+    void ReleaseDownsample();
+    [[nodiscard]] bool IsDownsampled() const { return m_downsampledView && m_downsampledScale == m_imgScale; }
+    [[nodiscard]] size_t GetTileLevel() const;
+    [[nodiscard]] TileRect GetVisibleTiles( size_t level ) const;
+    [[nodiscard]] std::shared_ptr<Texture> CreateTile( size_t levelIdx, uint32_t x, uint32_t y );
+    [[nodiscard]] VkSampler GetResidentSampler( uint32_t level );
+    void EvictTiles();
+    void UpdateTileDraw();
+    [[nodiscard]] Quad GetQuad() const;
+    void UpdateView();     // Deferred to the next Render()
+    void ApplyView();
+    [[nodiscard]] VkExtent2D ViewExtent( const VkExtent2D& extent ) const;
+    [[nodiscard]] Vector2<float> ViewPoint( const Vector2<float>& point ) const;
 
     void ClampImagePosition();
     void SetImgScale( float scale );
@@ -81,19 +266,58 @@ private:
     GarbageChute& m_garbage;
     std::shared_ptr<VlkDevice> m_device;
 
-    std::shared_ptr<VlkShader> m_shaderMin[2];
-    std::shared_ptr<VlkShader> m_shaderExact[2];
-    std::shared_ptr<VlkShader> m_shaderNearest[2];
+    // Specialized for the output transfer and tone mapping when pipelines are created
+    std::shared_ptr<VlkShader> m_shaderMin;
+    std::shared_ptr<VlkShader> m_shaderExact;
+    std::shared_ptr<VlkShader> m_shaderNearest;
     std::shared_ptr<VlkDescriptorSetLayout> m_setLayout;
     std::shared_ptr<VlkPipelineLayout> m_pipelineLayout;
-    std::shared_ptr<VlkPipeline> m_pipelineMin;
-    std::shared_ptr<VlkPipeline> m_pipelineExact;
-    std::shared_ptr<VlkPipeline> m_pipelineNearest;
-    std::shared_ptr<VlkBuffer> m_vertexBuffer;
+    PreparedPipeline<Pipelines> m_pipelines;
+    std::shared_ptr<VlkBuffer> m_vertexBuffer;      // Unit quad, the view transform is in the push constants
+    bool m_viewDirty = false;
     std::shared_ptr<VlkBuffer> m_indexBuffer;
     std::shared_ptr<Texture> m_texture;
+    std::shared_ptr<Texture> m_previous;        // Shown while m_texture uploads
+    std::shared_ptr<AnimationRing> m_anim;      // Frames after the first, which is m_texture
+    Quad m_previousQuad;
+    std::shared_ptr<Texture> m_compare;
+    CompareMode m_compareMode = CompareMode::SideBySide;
+    bool m_compareShown = false;
     std::shared_ptr<VlkSampler> m_samplerLinear;
     std::shared_ptr<VlkSampler> m_samplerNearest;
+    std::vector<std::shared_ptr<VlkSampler>> m_samplerResident;     // Linear, with minLod clamped to the level
+
+    std::shared_ptr<VlkShader> m_shaderDownsample;
+    std::shared_ptr<VlkDescriptorSetLayout> m_downsampleSetLayout;
+    std::shared_ptr<VlkPipelineLayout> m_downsamplePipelineLayout;
+    std::shared_ptr<VlkPipeline> m_downsamplePipeline;
+    std::shared_ptr<VlkImage> m_downsampled;
+    std::shared_ptr<VlkImageView> m_downsampledView;
+    float m_downsampledScale = 0;
+
+    std::shared_ptr<VlkShader> m_shaderYuv;
+    std::shared_ptr<VlkDescriptorSetLayout> m_yuvSetLayout;
+    std::shared_ptr<VlkPipelineLayout> m_yuvPipelineLayout;
+    std::shared_ptr<VlkPipeline> m_yuvPipeline;
+
+    std::shared_ptr<VlkShader> m_shaderIdct;
+    std::shared_ptr<VlkDescriptorSetLayout> m_idctSetLayout;
+    std::shared_ptr<VlkPipelineLayout> m_idctPipelineLayout;
+    std::shared_ptr<VlkPipeline> m_idctPipeline;
+
+    std::shared_ptr<LuminanceStats> m_stats;
+    bool m_measure = false;     // Waits for the texture to become drawable
+    float m_exposure = 1;
+    bool m_autoExposure = false;
+
+    std::vector<TileLevel> m_tileLevels;
+    std::shared_ptr<TilePyramid> m_tilePyramid;
+    std::vector<TileDraw> m_tileDraw;
+    bool m_tileDrawDirty = false;
+    TaskDispatch* m_tileTd;
+    uint32_t m_maxTextureSize;
+    uint64_t m_tileFrame;
+    size_t m_residentTiles;
 
     VkExtent2D m_extent;
     VkExtent2D m_bitmapExtent;
@@ -109,6 +333,9 @@ private:
 
     float m_div;
     float m_scale;
+    ToneMap::Operator m_tonemap;
+    bool m_packedHdr = false;
+    bool m_cpuMips = false;
     FitMode m_fitMode;
 
     std::mutex m_lock;
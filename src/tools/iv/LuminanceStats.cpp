@@ -0,0 +1,284 @@
+#include <array>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+
+#include "LuminanceStats.hpp"
+#include "TextureFormats.hpp"
+#include "util/EmbedData.hpp"
+#include "util/Panic.hpp"
+#include "vulkan/VlkBuffer.hpp"
+#include "vulkan/VlkCommandBuffer.hpp"
+#include "vulkan/VlkDescriptorSetLayout.hpp"
+#include "vulkan/VlkDevice.hpp"
+#include "vulkan/VlkFence.hpp"
+#include "vulkan/VlkFencePool.hpp"
+#include "vulkan/VlkGarbage.hpp"
+#include "vulkan/VlkPipeline.hpp"
+#include "vulkan/VlkPipelineLayout.hpp"
+#include "vulkan/VlkSampler.hpp"
+#include "vulkan/VlkShader.hpp"
+#include "vulkan/VlkShaderModule.hpp"
+#include "vulkan/VlkTimelineSemaphore.hpp"
+#include "vulkan/ext/Texture.hpp"
+#include "vulkan/ext/Tracy.hpp"
+
+#include "shader/LuminanceComp.hpp"
+#include "shader/LuminanceReduceComp.hpp"
+
+// Must match LuminanceBins.comp
+constexpr uint32_t Bins = 64;
+constexpr uint32_t Grid = 256;
+constexpr uint32_t GroupSize = 16;
+
+constexpr VkDeviceSize HistogramSize = ( Bins + 1 ) * sizeof( uint32_t );
+
+LuminanceStats::LuminanceStats( VlkDevice& device )
+    : m_device( device )
+{
+    ZoneScoped;
+
+    Unembed( LuminanceComp );
+    Unembed( LuminanceReduceComp );
+
+    auto LuminanceCompModule = std::make_shared<VlkShaderModule>( m_device, *LuminanceComp );
+    auto LuminanceReduceCompModule = std::make_shared<VlkShaderModule>( m_device, *LuminanceReduceComp );
+
+    m_shaderHistogram = std::make_shared<VlkShader>( std::array {
+        VlkShader::Stage { LuminanceCompModule, VK_SHADER_STAGE_COMPUTE_BIT }
+    } );
+    m_shaderHistogramPq = std::make_shared<VlkShader>( *m_shaderHistogram, std::vector<uint32_t> { 1 } );
+    m_shaderReduce = std::make_shared<VlkShader>( std::array {
+        VlkShader::Stage { LuminanceReduceCompModule, VK_SHADER_STAGE_COMPUTE_BIT }
+    } );
+
+    static constexpr std::array histogramBindings = {
+        VkDescriptorSetLayoutBinding { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+        VkDescriptorSetLayoutBinding { 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT }
+    };
+    constexpr VkDescriptorSetLayoutCreateInfo histogramSetLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR,
+        .bindingCount = histogramBindings.size(),
+        .pBindings = histogramBindings.data()
+    };
+    m_histogramSetLayout = std::make_shared<VlkDescriptorSetLayout>( m_device, histogramSetLayoutInfo );
+
+    const std::array<VkDescriptorSetLayout, 1> histogramSets = { *m_histogramSetLayout };
+    constexpr VkPushConstantRange histogramPushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_COMPUTE_BIT,
+        .size = sizeof( int32_t )
+    };
+    const VkPipelineLayoutCreateInfo histogramPipelineLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = histogramSets.size(),
+        .pSetLayouts = histogramSets.data(),
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &histogramPushConstantRange
+    };
+    m_histogramPipelineLayout = std::make_shared<VlkPipelineLayout>( m_device, histogramPipelineLayoutInfo );
+
+    VkComputePipelineCreateInfo histogramPipelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = *m_shaderHistogram->GetStages(),
+        .layout = *m_histogramPipelineLayout
+    };
+    m_histogramPipeline = std::make_shared<VlkPipeline>( m_device, histogramPipelineInfo );
+    histogramPipelineInfo.stage = *m_shaderHistogramPq->GetStages();
+    m_histogramPqPipeline = std::make_shared<VlkPipeline>( m_device, histogramPipelineInfo );
+
+    static constexpr std::array reduceBindings = {
+        VkDescriptorSetLayoutBinding { 0, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT },
+        VkDescriptorSetLayoutBinding { 1, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1, VK_SHADER_STAGE_COMPUTE_BIT }
+    };
+    constexpr VkDescriptorSetLayoutCreateInfo reduceSetLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR,
+        .bindingCount = reduceBindings.size(),
+        .pBindings = reduceBindings.data()
+    };
+    m_reduceSetLayout = std::make_shared<VlkDescriptorSetLayout>( m_device, reduceSetLayoutInfo );
+
+    const std::array<VkDescriptorSetLayout, 1> reduceSets = { *m_reduceSetLayout };
+    const VkPipelineLayoutCreateInfo reducePipelineLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = reduceSets.size(),
+        .pSetLayouts = reduceSets.data()
+    };
+    m_reducePipelineLayout = std::make_shared<VlkPipelineLayout>( m_device, reducePipelineLayoutInfo );
+
+    const VkComputePipelineCreateInfo reducePipelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO,
+        .stage = *m_shaderReduce->GetStages(),
+        .layout = *m_reducePipelineLayout
+    };
+    m_reducePipeline = std::make_shared<VlkPipeline>( m_device, reducePipelineInfo );
+
+    constexpr VkSamplerCreateInfo samplerInfo = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_NEAREST,
+        .minFilter = VK_FILTER_NEAREST,
+        .mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .maxLod = VK_LOD_CLAMP_NONE
+    };
+    m_sampler = std::make_shared<VlkSampler>( m_device, samplerInfo );
+
+    constexpr VkBufferCreateInfo histogramInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = HistogramSize,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    m_histogram = std::make_shared<VlkBuffer>( m_device, histogramInfo, VlkBuffer::PreferDevice );
+
+    constexpr VkBufferCreateInfo resultInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = sizeof( Result ),
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    m_result = std::make_shared<VlkBuffer>( m_device, resultInfo, VlkBuffer::PreferHost | VlkBuffer::WillRead );
+}
+
+LuminanceStats::~LuminanceStats() = default;
+
+// Both passes are submitted on the graphics queue, where the draws sampling the texture are. Measurements which
+// follow each other reuse the buffers, the first barrier orders them after the previous one.
+void LuminanceStats::Measure( std::shared_ptr<Texture> texture, uint32_t minLevel )
+{
+    ZoneScoped;
+    CheckPanic( IsHdrFormat( texture->Format() ), "Luminance statistics need a HDR texture" );
+
+    auto cmd = std::make_unique<VlkCommandBuffer>( m_device.GetThreadCommandPool( QueueType::Graphic ) );
+    cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+    {
+        ZoneVk( m_device, *cmd, "Luminance statistics", true );
+
+        VkMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            .srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT
+        };
+        const VkDependencyInfo deps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .memoryBarrierCount = 1,
+            .pMemoryBarriers = &barrier
+        };
+        vkCmdPipelineBarrier2( *cmd, &deps );
+        vkCmdFillBuffer( *cmd, *m_histogram, 0, HistogramSize, 0 );
+
+        // The texture upload only made it visible to the fragment shaders
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_CLEAR_BIT | VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT | VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+        vkCmdPipelineBarrier2( *cmd, &deps );
+
+        const VkDescriptorImageInfo textureInfo = {
+            .sampler = *m_sampler,
+            .imageView = *texture,
+            .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+        };
+        const VkDescriptorBufferInfo histogramInfo = {
+            .buffer = *m_histogram,
+            .range = HistogramSize
+        };
+        const VkDescriptorBufferInfo resultInfo = {
+            .buffer = *m_result,
+            .range = sizeof( Result )
+        };
+        const std::array histogramWrites = {
+            VkWriteDescriptorSet {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstBinding = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+                .pImageInfo = &textureInfo
+            },
+            VkWriteDescriptorSet {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstBinding = 1,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &histogramInfo
+            }
+        };
+        const std::array reduceWrites = {
+            VkWriteDescriptorSet {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstBinding = 0,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &histogramInfo
+            },
+            VkWriteDescriptorSet {
+                .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+                .dstBinding = 1,
+                .descriptorCount = 1,
+                .descriptorType = VK_DESCRIPTOR_TYPE_STORAGE_BUFFER,
+                .pBufferInfo = &resultInfo
+            }
+        };
+
+        const auto level = int32_t( minLevel );
+        vkCmdBindPipeline( *cmd, VK_PIPELINE_BIND_POINT_COMPUTE, texture->Format() == HdrPackedFormat ? *m_histogramPqPipeline : *m_histogramPipeline );
+        vkCmdPushDescriptorSet( *cmd, VK_PIPELINE_BIND_POINT_COMPUTE, *m_histogramPipelineLayout, 0, histogramWrites.size(), histogramWrites.data() );
+        vkCmdPushConstants( *cmd, *m_histogramPipelineLayout, VK_SHADER_STAGE_COMPUTE_BIT, 0, sizeof( level ), &level );
+        vkCmdDispatch( *cmd, Grid / GroupSize, Grid / GroupSize, 1 );
+
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_READ_BIT;
+        vkCmdPipelineBarrier2( *cmd, &deps );
+
+        vkCmdBindPipeline( *cmd, VK_PIPELINE_BIND_POINT_COMPUTE, *m_reducePipeline );
+        vkCmdPushDescriptorSet( *cmd, VK_PIPELINE_BIND_POINT_COMPUTE, *m_reducePipelineLayout, 0, reduceWrites.size(), reduceWrites.data() );
+        vkCmdDispatch( *cmd, 1, 1, 1 );
+
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_HOST_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_HOST_READ_BIT;
+        vkCmdPipelineBarrier2( *cmd, &deps );
+    }
+    cmd->End();
+
+    auto fence = m_device.GetFencePool()->Acquire();
+    m_ready = m_device.Submit( *cmd, *fence );
+    m_valid = false;
+    m_device.GetGarbage()->Recycle( fence, {
+        std::move( cmd ),
+        std::move( texture ),
+        m_histogram,
+        m_result,
+        m_histogramPipeline,
+        m_histogramPqPipeline,
+        m_reducePipeline,
+        m_sampler
+    } );
+}
+
+void LuminanceStats::Reset()
+{
+    m_ready = 0;
+    m_valid = false;
+}
+
+bool LuminanceStats::IsPending() const
+{
+    return m_ready != 0 && !m_valid && m_device.GetTimeline( QueueType::Graphic )->Value() < m_ready;
+}
+
+const LuminanceStats::Result* LuminanceStats::Get()
+{
+    if( m_ready == 0 ) return nullptr;
+    if( !m_valid )
+    {
+        if( m_device.GetTimeline( QueueType::Graphic )->Value() < m_ready ) return nullptr;
+        m_result->Invalidate();
+        memcpy( &m_value, m_result->Ptr(), sizeof( Result ) );
+        m_valid = true;
+    }
+    return &m_value;
+}
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+
+#include "util/NoCopy.hpp"
+#include "vulkan/VlkBase.hpp"
+
+class Texture;
+class VlkBuffer;
+class VlkDescriptorSetLayout;
+class VlkDevice;
+class VlkPipeline;
+class VlkPipelineLayout;
+class VlkSampler;
+class VlkShader;
+
+// Luminance statistics of HDR textures, measured on the GPU, so that the image is never read on the CPU. A log2
+// luminance histogram is built from a fixed number of samples, and a second pass reduces it to an exposure and
+// light levels. These are read back once the graphics timeline has passed the submission. Must be externally
+// synchronized.
+class LuminanceStats : public VlkBase
+{
+public:
+    // Light levels are in the units of HDR textures, where 1.0 is 100 nits
+    struct Result
+    {
+        float exposure;     // Scale which brings the image average to middle grey
+        float peak;         // Where the brightest 0.1% of the image begin
+        float average;
+    };
+
+    explicit LuminanceStats( VlkDevice& device );
+    ~LuminanceStats() override;
+
+    NoCopy( LuminanceStats );
+
+    // Submits the passes on the texture, which must be drawable. Levels finer than minLevel are not read. The
+    // result of an earlier measurement is dropped.
+    void Measure( std::shared_ptr<Texture> texture, uint32_t minLevel );
+    void Reset();
+
+    [[nodiscard]] bool IsPending() const;
+    // Null while pending, or without a measurement
+    [[nodiscard]] const Result* Get();
+
+private:
+    VlkDevice& m_device;
+
+    std::shared_ptr<VlkShader> m_shaderHistogram;
+    std::shared_ptr<VlkShader> m_shaderHistogramPq;
+    std::shared_ptr<VlkShader> m_shaderReduce;
+    std::shared_ptr<VlkDescriptorSetLayout> m_histogramSetLayout;
+    std::shared_ptr<VlkDescriptorSetLayout> m_reduceSetLayout;
+    std::shared_ptr<VlkPipelineLayout> m_histogramPipelineLayout;
+    std::shared_ptr<VlkPipelineLayout> m_reducePipelineLayout;
+    std::shared_ptr<VlkPipeline> m_histogramPipeline;
+    std::shared_ptr<VlkPipeline> m_histogramPqPipeline;
+    std::shared_ptr<VlkPipeline> m_reducePipeline;
+    std::shared_ptr<VlkSampler> m_sampler;
+
+    std::shared_ptr<VlkBuffer> m_histogram;
+    std::shared_ptr<VlkBuffer> m_result;        // Host visible
+
+    uint64_t m_ready = 0;       // Graphics timeline value of the last measurement, zero if there is none
+    bool m_valid = false;
+    Result m_value;
+};
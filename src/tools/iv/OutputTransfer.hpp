@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+// Transfer function the shaders encode their output with, given to them as specialization constant 0. sRGB is
+// left to the framebuffer format. Values match shader/Transfer.frag.
+enum class OutputTransfer : uint32_t
+{
+    Srgb,
+    Pq
+};
+
+constexpr OutputTransfer GetOutputTransfer( VkFormat format )
+{
+    return format == VK_FORMAT_A2B10G10R10_UNORM_PACK32 || format == VK_FORMAT_A2R10G10B10_UNORM_PACK32 ? OutputTransfer::Pq : OutputTransfer::Srgb;
+}
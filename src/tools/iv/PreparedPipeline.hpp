@@ -0,0 +1,95 @@
+#pragma once
+
+#include <mutex>
+#include <utility>
+#include <vulkan/vulkan.h>
+
+#include "util/NoCopy.hpp"
+#include "vulkan/ext/GarbageChute.hpp"
+
+// The pipeline of a renderer for the swapchain format, and one for another format, which is built in the
+// background before a format change, e.g. when a window moves to a HDR output. Changing to the prepared format
+// swaps the two, and the previous pipeline is kept prepared, so that switching back is just as cheap.
+//
+// T is a pipeline pointer, or a struct of them which recycles itself with a Recycle( GarbageChute& ) method.
+template<typename T>
+class PreparedPipeline
+{
+public:
+    explicit PreparedPipeline( GarbageChute& garbage ) : m_garbage( garbage ) {}
+
+    NoCopy( PreparedPipeline );
+
+    void Init( T&& pipeline, VkFormat format )
+    {
+        m_pipeline = std::move( pipeline );
+        m_format = format;
+    }
+
+    // Both pipelines are recycled
+    void Release()
+    {
+        Recycle( m_pipeline );
+        if( m_preparedFormat != VK_FORMAT_UNDEFINED ) Recycle( m_prepared );
+        m_preparedFormat = VK_FORMAT_UNDEFINED;
+    }
+
+    // Create builds the pipeline for the format, if it was not prepared
+    template<typename F>
+    void Change( VkFormat format, F&& create )
+    {
+        std::lock_guard lock( m_lock );
+        if( m_preparedFormat == format )
+        {
+            std::swap( m_pipeline, m_prepared );
+            m_preparedFormat = m_format;
+        }
+        else
+        {
+            Recycle( m_pipeline );
+            m_pipeline = create();
+        }
+        m_format = format;
+    }
+
+    // Thread safe, makes a later Change() to this format cheap
+    template<typename F>
+    void Prepare( VkFormat format, F&& create )
+    {
+        auto pipeline = create();
+
+        std::lock_guard lock( m_lock );
+        if( format == m_format )
+        {
+            Recycle( pipeline );
+            return;
+        }
+        if( m_preparedFormat != VK_FORMAT_UNDEFINED ) Recycle( m_prepared );
+        m_prepared = std::move( pipeline );
+        m_preparedFormat = format;
+    }
+
+    [[nodiscard]] const T& Get() const { return m_pipeline; }
+
+private:
+    void Recycle( T& pipeline )
+    {
+        if constexpr( requires { pipeline.Recycle( m_garbage ); } )
+        {
+            pipeline.Recycle( m_garbage );
+        }
+        else
+        {
+            m_garbage.Recycle( std::move( pipeline ) );
+        }
+    }
+
+    GarbageChute& m_garbage;
+
+    T m_pipeline;
+    VkFormat m_format = VK_FORMAT_UNDEFINED;
+
+    std::mutex m_lock;
+    T m_prepared;
+    VkFormat m_preparedFormat = VK_FORMAT_UNDEFINED;
+};
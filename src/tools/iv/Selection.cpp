@@ -5,6 +5,7 @@
 
 #include "ImageView.hpp"
 #include "Selection.hpp"
+#include "OutputTransfer.hpp"
 #include "util/EmbedData.hpp"
 #include "util/Panic.hpp"
 #include "vulkan/VlkBuffer.hpp"
@@ -19,7 +20,6 @@
 #include "wayland/WaylandWindow.hpp"
 
 #include "shader/SelectionFrag.hpp"
-#include "shader/SelectionPqFrag.hpp"
 #include "shader/SelectionVert.hpp"
 
 
@@ -39,12 +39,12 @@ Selection::Selection( std::shared_ptr<WaylandWindow> window, std::shared_ptr<Vlk
     : m_garbage( *window )
     , m_window( std::move( window ) )
     , m_device( std::move( device ) )
+    , m_pipeline( m_garbage )
 {
     SetScale( scale );
 
     Unembed( SelectionVert );
     Unembed( SelectionFrag );
-    Unembed( SelectionPqFrag );
 
     const std::array stages = {
         VlkShader::Stage { std::make_shared<VlkShaderModule>( *m_device, *SelectionVert ), VK_SHADER_STAGE_VERTEX_BIT },
@@ -53,12 +53,6 @@ Selection::Selection( std::shared_ptr<WaylandWindow> window, std::shared_ptr<Vlk
     m_shader = std::make_shared<VlkShader>( stages );
 
 
-    const std::array stagesPq = {
-        stages[0],
-        VlkShader::Stage { std::make_shared<VlkShaderModule>( *m_device, *SelectionPqFrag ), VK_SHADER_STAGE_FRAGMENT_BIT }
-    };
-    m_shaderPq = std::make_shared<VlkShader>( stagesPq );
-
 
     static constexpr std::array pushConstantRange = {
         VkPushConstantRange {
@@ -78,16 +72,15 @@ Selection::Selection( std::shared_ptr<WaylandWindow> window, std::shared_ptr<Vlk
         .pPushConstantRanges = pushConstantRange.data()
     };
     m_pipelineLayout = std::make_shared<VlkPipelineLayout>( *m_device, pipelineLayoutInfo );
-    CreatePipeline( format );
+    m_pipeline.Init( CreatePipeline( format ), format );
 }
 
 Selection::~Selection()
 {
+    m_pipeline.Release();
     m_garbage.Recycle( {
-        std::move( m_pipeline ),
         std::move( m_pipelineLayout ),
         std::move( m_shader ),
-        std::move( m_shaderPq ),
         std::move( m_vertexBuffer ),
     } );
 }
@@ -100,13 +93,15 @@ void Selection::Update( float delta )
 
 void Selection::Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent )
 {
+    {
+        std::lock_guard lock( m_lock );
+        if( m_vertexDirty || !m_vertexBuffer ) BuildVertexBuffer();
+    }
+
     VkViewport viewport = {
         .width = float( extent.width ),
         .height = float( extent.height )
     };
-    VkRect2D scissor = {
-        .extent = extent
-    };
 
     const PushConstant pushConstant = {
         float( extent.width ),
@@ -119,11 +114,10 @@ void Selection::Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent )
     constexpr std::array<VkDeviceSize, 1> offsets = { 0 };
 
     ZoneVk( *m_device, cmdbuf, "Selection", true );
-    vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipeline );
+    vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipeline.Get() );
     vkCmdPushConstants( cmdbuf, *m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, offsetof( PushConstant, screenSize ), sizeof( float ) * 2, &pushConstant );
     vkCmdPushConstants( cmdbuf, *m_pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, offsetof( PushConstant, div ), sizeof( float ) * 2, &pushConstant.div );
     vkCmdSetViewport( cmdbuf, 0, 1, &viewport );
-    vkCmdSetScissor( cmdbuf, 0, 1, &scissor );
     vkCmdBindVertexBuffers( cmdbuf, 0, 1, vertexBuffers.data(), offsets.data() );
     vkCmdDraw( cmdbuf, 5, 1, 0, 0 );
 }
@@ -137,8 +131,12 @@ void Selection::SetScale( float scale )
 
 void Selection::FormatChange( VkFormat format )
 {
-    m_garbage.Recycle( std::move( m_pipeline ) );
-    CreatePipeline( format );
+    m_pipeline.Change( format, [this, format] { return CreatePipeline( format ); } );
+}
+
+void Selection::PrepareFormat( VkFormat format )
+{
+    m_pipeline.Prepare( format, [this, format] { return CreatePipeline( format ); } );
 }
 
 void Selection::AbortDrag()
@@ -308,6 +306,23 @@ bool Selection::IsActive() const
     return m_posMin.x != m_posMax.x && m_posMin.y != m_posMax.y;
 }
 
+VkRect2D Selection::GetScreenRect() const
+{
+    std::lock_guard lock( m_lock );
+    const auto fMin = ImageToScreenPos( m_posMin );
+    const auto fMax = ImageToScreenPos( m_posMax );
+
+    // The outline is drawn just inside the rounded corners, with a margin for line rasterization
+    const auto x0 = int32_t( round( fMin.x ) ) - 1;
+    const auto y0 = int32_t( round( fMin.y ) ) - 1;
+    const auto x1 = int32_t( round( fMax.x ) ) + 2;
+    const auto y1 = int32_t( round( fMax.y ) ) + 2;
+    return VkRect2D {
+        .offset = { x0, y0 },
+        .extent = { uint32_t( std::max( x1 - x0, 0 ) ), uint32_t( std::max( y1 - y0, 0 ) ) }
+    };
+}
+
 VkRect2D Selection::GetSelection() const
 {
     std::lock_guard lock( m_lock );
@@ -332,7 +347,7 @@ void Selection::SetImageView( ImageView* imageView )
     m_imageView = imageView;
 }
 
-void Selection::CreatePipeline( VkFormat format )
+std::shared_ptr<VlkPipeline> Selection::CreatePipeline( VkFormat format )
 {
     static constexpr VkVertexInputBindingDescription vertexBindingDescription = {
         .binding = 0,
@@ -392,12 +407,12 @@ void Selection::CreatePipeline( VkFormat format )
         .dynamicStateCount = dynamicStateList.size(),
         .pDynamicStates = dynamicStateList.data()
     };
-    const bool pq = format == VK_FORMAT_A2B10G10R10_UNORM_PACK32 || format == VK_FORMAT_A2R10G10B10_UNORM_PACK32;
+    const VlkShader shader( *m_shader, { uint32_t( GetOutputTransfer( format ) ) } );
     const VkGraphicsPipelineCreateInfo pipelineInfo = {
         .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
         .pNext = &rendering,
-        .stageCount = pq ? m_shaderPq->GetStageCount() : m_shader->GetStageCount(),
-        .pStages = pq ? m_shaderPq->GetStages() : m_shader->GetStages(),
+        .stageCount = shader.GetStageCount(),
+        .pStages = shader.GetStages(),
         .pVertexInputState = &vertexInputInfo,
         .pInputAssemblyState = &inputAssembly,
         .pViewportState = &viewportState,
@@ -407,12 +422,19 @@ void Selection::CreatePipeline( VkFormat format )
         .pDynamicState = &dynamicState,
         .layout = *m_pipelineLayout,
     };
-    m_pipeline = std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+    return std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
 }
 
 void Selection::UpdateVertexBuffer()
 {
     std::lock_guard lock( m_lock );
+    m_vertexDirty = true;
+}
+
+void Selection::BuildVertexBuffer()
+{
+    m_vertexDirty = false;
+
     const auto fMin = ImageToScreenPos( m_posMin );
     const auto fMax = ImageToScreenPos( m_posMax );
 
@@ -4,6 +4,7 @@
 #include <mutex>
 #include <vulkan/vulkan.h>
 
+#include "PreparedPipeline.hpp"
 #include "util/Vector2.hpp"
 
 class ImageView;
@@ -39,6 +40,7 @@ public:
     void Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent );
     void SetScale( float scale );
     void FormatChange( VkFormat format );
+    void PrepareFormat( VkFormat format );      // Thread safe, makes a later FormatChange() to this format cheap
 
     void AbortDrag();
 
@@ -50,12 +52,14 @@ public:
 
     [[nodiscard]] bool IsActive() const;
     [[nodiscard]] VkRect2D GetSelection() const;
+    [[nodiscard]] VkRect2D GetScreenRect() const;     // Covers the outline, in screen pixels
 
     void SetImageView( ImageView* imageView );
-    void UpdateVertexBuffer();
+    void UpdateVertexBuffer();     // Deferred to the next Render()
 
 private:
-    void CreatePipeline( VkFormat format );
+    [[nodiscard]] std::shared_ptr<VlkPipeline> CreatePipeline( VkFormat format );
+    void BuildVertexBuffer();
 
     [[nodiscard]] Vector2<uint32_t> ScreenToImagePos( const Vector2<float>& pos ) const;
     [[nodiscard]] Vector2<uint32_t> ScreenToImagePosWithOrigin( const Vector2<float>& pos ) const;
@@ -68,10 +72,10 @@ private:
     ImageView* m_imageView;
 
     std::shared_ptr<VlkShader> m_shader;
-    std::shared_ptr<VlkShader> m_shaderPq;
     std::shared_ptr<VlkPipelineLayout> m_pipelineLayout;
-    std::shared_ptr<VlkPipeline> m_pipeline;
+    PreparedPipeline<std::shared_ptr<VlkPipeline>> m_pipeline;
     std::shared_ptr<VlkBuffer> m_vertexBuffer;
+    bool m_vertexDirty = false;
 
     float m_div;
     float m_offset = 0;
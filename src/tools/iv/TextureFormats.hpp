@@ -4,3 +4,10 @@
 
 constexpr auto SdrFormat = VK_FORMAT_R8G8B8A8_SRGB;
 constexpr auto HdrFormat = VK_FORMAT_R16G16B16A16_SFLOAT;
+// Opaque HDR images at half the memory of HdrFormat, PQ encoded and decoded in the shaders
+constexpr auto HdrPackedFormat = VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+
+constexpr bool IsHdrFormat( VkFormat format )
+{
+    return format == HdrFormat || format == HdrPackedFormat;
+}
@@ -0,0 +1,828 @@
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+
+#include "TextureFormats.hpp"
+#include "ThumbnailGrid.hpp"
+#include "OutputTransfer.hpp"
+#include "util/Bitmap.hpp"
+#include "util/EmbedData.hpp"
+#include "util/Logs.hpp"
+#include "util/Panic.hpp"
+#include "util/TaskDispatch.hpp"
+#include "vulkan/VlkBuffer.hpp"
+#include "vulkan/VlkCommandBuffer.hpp"
+#include "vulkan/VlkDescriptorSetLayout.hpp"
+#include "vulkan/VlkDevice.hpp"
+#include "vulkan/VlkGarbage.hpp"
+#include "vulkan/VlkImage.hpp"
+#include "vulkan/VlkImageView.hpp"
+#include "vulkan/VlkPhysicalDevice.hpp"
+#include "vulkan/VlkPipeline.hpp"
+#include "vulkan/VlkPipelineLayout.hpp"
+#include "vulkan/VlkProxy.hpp"
+#include "vulkan/VlkSampler.hpp"
+#include "vulkan/VlkShader.hpp"
+#include "vulkan/VlkShaderModule.hpp"
+#include "vulkan/VlkStagingRing.hpp"
+#include "vulkan/ext/GarbageChute.hpp"
+#include "vulkan/ext/Tracy.hpp"
+
+#include "shader/GridFrag.hpp"
+#include "shader/GridVert.hpp"
+
+struct Vertex
+{
+    float x, y;
+};
+
+struct PushConstant
+{
+    float screenSize[2];
+    float offset[2];
+};
+
+namespace
+{
+constexpr uint32_t SlotPixels = ThumbnailCache::Pixels( ThumbnailGrid::SlotSize );
+constexpr uint32_t SlotsPerRow = ThumbnailGrid::AtlasSize / SlotPixels;
+constexpr uint32_t SlotsPerLayer = SlotsPerRow * SlotsPerRow;
+
+// Linear R8G8B8A8
+constexpr uint32_t PlaceholderColor = 0xFF050505;
+constexpr uint32_t FailedColor = 0xFF03030A;
+constexpr uint32_t SelectedColor = 0xFF4A3A30;
+}
+
+ThumbnailGrid::ThumbnailGrid( GarbageChute& garbage, std::shared_ptr<VlkDevice> device, TaskDispatch& td, VkFormat format, const VkExtent2D& extent, float scale, Callback ready, void* userData )
+    : m_garbage( garbage )
+    , m_device( std::move( device ) )
+    , m_td( td )
+    , m_jobs( std::make_unique<TaskGroup>() )
+    , m_ready( ready )
+    , m_userData( userData )
+    , m_pipeline( garbage )
+    , m_maxLayers( std::min( m_device->GetPhysicalDevice()->Properties().limits.maxImageArrayLayers, 64u ) )
+    , m_maxInFlight( std::max<size_t>( 4, td.NumWorkers() * 2 ) )
+    , m_extent( extent )
+    , m_scale( scale )
+{
+    VkSamplerCreateInfo samplerInfo = {
+        .sType = VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO,
+        .magFilter = VK_FILTER_LINEAR,
+        .minFilter = VK_FILTER_LINEAR,
+        .addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE,
+        .addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE
+    };
+    m_sampler = std::make_unique<VlkSampler>( *m_device, samplerInfo );
+
+    m_imageInfo = {
+        .sampler = *m_sampler,
+        .imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL
+    };
+
+    m_descWrite = {
+        .sType = VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET,
+        .dstBinding = 0,
+        .descriptorCount = 1,
+        .descriptorType = VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER,
+        .pImageInfo = &m_imageInfo
+    };
+
+
+    Unembed( GridVert );
+    Unembed( GridFrag );
+
+    const std::array stages = {
+        VlkShader::Stage { std::make_shared<VlkShaderModule>( *m_device, *GridVert ), VK_SHADER_STAGE_VERTEX_BIT },
+        VlkShader::Stage { std::make_shared<VlkShaderModule>( *m_device, *GridFrag ), VK_SHADER_STAGE_FRAGMENT_BIT }
+    };
+    m_shader = std::make_shared<VlkShader>( stages );
+
+
+
+    static constexpr std::array bindings = {
+        VkDescriptorSetLayoutBinding { 0, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1, VK_SHADER_STAGE_FRAGMENT_BIT }
+    };
+    constexpr VkDescriptorSetLayoutCreateInfo setLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO,
+        .flags = VK_DESCRIPTOR_SET_LAYOUT_CREATE_PUSH_DESCRIPTOR_BIT_KHR,
+        .bindingCount = bindings.size(),
+        .pBindings = bindings.data()
+    };
+    m_setLayout = std::make_shared<VlkDescriptorSetLayout>( *m_device, setLayoutInfo );
+
+
+    const std::array<VkDescriptorSetLayout, 1> sets = { *m_setLayout };
+    static constexpr VkPushConstantRange pushConstantRange = {
+        .stageFlags = VK_SHADER_STAGE_VERTEX_BIT,
+        .offset = 0,
+        .size = sizeof( PushConstant )
+    };
+    const VkPipelineLayoutCreateInfo pipelineLayoutInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO,
+        .setLayoutCount = sets.size(),
+        .pSetLayouts = sets.data(),
+        .pushConstantRangeCount = 1,
+        .pPushConstantRanges = &pushConstantRange
+    };
+    m_pipelineLayout = std::make_shared<VlkPipelineLayout>( *m_device, pipelineLayoutInfo );
+    m_pipeline.Init( CreatePipeline( format ), format );
+
+
+    constexpr Vertex vdata[] = {
+        { 0, 0 },
+        { 1, 0 },
+        { 1, 1 },
+        { 0, 1 }
+    };
+    constexpr VkBufferCreateInfo vinfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = sizeof( vdata ),
+        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    m_vertexBuffer = std::make_shared<VlkBuffer>( *m_device, vinfo, VlkBuffer::PreferDevice | VlkBuffer::WillWrite );
+    memcpy( m_vertexBuffer->Ptr(), vdata, sizeof( vdata ) );
+    m_vertexBuffer->Flush();
+
+    constexpr uint16_t idata[] = { 0, 1, 2, 2, 3, 0 };
+    constexpr VkBufferCreateInfo iinfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = sizeof( idata ),
+        .usage = VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    m_indexBuffer = std::make_shared<VlkBuffer>( *m_device, iinfo, VlkBuffer::PreferDevice | VlkBuffer::WillWrite );
+    memcpy( m_indexBuffer->Ptr(), idata, sizeof( idata ) );
+    m_indexBuffer->Flush();
+
+    UpdateLayout();
+}
+
+ThumbnailGrid::~ThumbnailGrid()
+{
+    m_generation++;
+    m_jobs->Wait();
+
+    m_pipeline.Release();
+    m_garbage.Recycle( {
+        std::move( m_pipelineLayout ),
+        std::move( m_setLayout ),
+        std::move( m_shader ),
+        std::move( m_vertexBuffer ),
+        std::move( m_indexBuffer ),
+        std::move( m_instanceBuffer ),
+        std::move( m_atlasView ),
+        std::move( m_atlas ),
+        std::move( m_sampler )
+    } );
+}
+
+void ThumbnailGrid::SetFiles( const PathList& files, size_t selected )
+{
+    std::string current;
+    if( !m_files.Empty() ) current = m_files.Path( m_selected );
+
+    Reset();
+    if( files.Empty() ) return;
+
+    m_files = files;
+    m_items.resize( m_files.Size() );
+    m_selected = std::min( selected, m_files.Size() - 1 );
+    if( !current.empty() )
+    {
+        if( const auto idx = m_files.Find( current ); idx != PathList::npos ) m_selected = idx;
+    }
+    UpdateLayout();
+    EnsureVisible();
+}
+
+// The atlas is released too, it is only needed while the grid is shown
+void ThumbnailGrid::Clear()
+{
+    Reset();
+    m_garbage.Recycle( {
+        std::move( m_atlasView ),
+        std::move( m_atlas )
+    } );
+    m_layers = 0;
+    m_slots.clear();
+}
+
+// Jobs of the previous file list may still be running. They see the generation change and their results are
+// dropped, so that they don't count as in flight anymore.
+void ThumbnailGrid::Reset()
+{
+    m_generation++;
+    std::unique_lock lock( m_pendingLock );
+    m_pending.clear();
+    lock.unlock();
+
+    m_files.Clear();
+    m_items.clear();
+    for( auto& slot : m_slots ) slot.item = -1;
+    m_selected = 0;
+    m_inFlight = 0;
+    m_scroll = 0;
+    m_residentBegin = 0;
+    m_residentEnd = 0;
+    m_wantBegin.store( 0, std::memory_order_relaxed );
+    m_wantEnd.store( 0, std::memory_order_relaxed );
+
+    if( m_instanceBuffer ) m_garbage.Recycle( std::move( m_instanceBuffer ) );
+    m_instanceCount = 0;
+    m_dirty = true;
+}
+
+bool ThumbnailGrid::Update()
+{
+    if( m_files.Empty() ) return false;
+    ZoneScoped;
+
+    size_t begin, end;
+    ResidentRange( begin, end );
+    if( begin != m_residentBegin || end != m_residentEnd )
+    {
+        m_residentBegin = begin;
+        m_residentEnd = end;
+        m_wantBegin.store( begin, std::memory_order_relaxed );
+        m_wantEnd.store( end, std::memory_order_relaxed );
+        m_dirty = true;
+    }
+
+    std::vector<Loaded> loaded;
+    std::unique_lock lock( m_pendingLock );
+    std::swap( loaded, m_pending );
+    lock.unlock();
+
+    const auto generation = m_generation.load( std::memory_order_relaxed );
+    std::vector<Loaded> uploads;
+    for( auto& v : loaded )
+    {
+        if( v.generation != generation ) continue;
+        m_inFlight--;
+
+        // The atlas was recreated while the item was loading, and it was queued again
+        auto& item = m_items[v.item];
+        if( item.state == State::Ready ) continue;
+        if( v.skipped || v.item < begin || v.item >= end )
+        {
+            item.state = State::None;
+        }
+        else if( !v.bitmap )
+        {
+            item.state = State::Failed;
+            m_dirty = true;
+        }
+        else
+        {
+            uploads.emplace_back( std::move( v ) );
+        }
+    }
+    if( !uploads.empty() ) Upload( uploads );
+
+    QueueLoads( begin, end );
+
+    if( !m_dirty ) return false;
+    UpdateInstanceBuffer();
+    return true;
+}
+
+void ThumbnailGrid::Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent )
+{
+    if( m_instanceCount == 0 ) return;
+
+    const VkViewport viewport = {
+        .width = float( extent.width ),
+        .height = float( extent.height )
+    };
+
+    const PushConstant pushConstant = {
+        { float( extent.width ), float( extent.height ) },
+        { 0, std::round( m_scroll ) }
+    };
+
+    const std::array<VkBuffer, 2> vertexBuffers = { *m_vertexBuffer, *m_instanceBuffer };
+    constexpr std::array<VkDeviceSize, 2> offsets = { 0, 0 };
+
+    ZoneVk( *m_device, cmdbuf, "ThumbnailGrid", true );
+    vkCmdBindPipeline( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipeline.Get() );
+    vkCmdPushConstants( cmdbuf, *m_pipelineLayout, VK_SHADER_STAGE_VERTEX_BIT, 0, sizeof( PushConstant ), &pushConstant );
+    vkCmdSetViewport( cmdbuf, 0, 1, &viewport );
+    vkCmdBindVertexBuffers( cmdbuf, 0, vertexBuffers.size(), vertexBuffers.data(), offsets.data() );
+    vkCmdBindIndexBuffer( cmdbuf, *m_indexBuffer, 0, VK_INDEX_TYPE_UINT16 );
+    vkCmdPushDescriptorSet( cmdbuf, VK_PIPELINE_BIND_POINT_GRAPHICS, *m_pipelineLayout, 0, 1, &m_descWrite );
+    vkCmdDrawIndexed( cmdbuf, 6, m_instanceCount, 0, 0, 0 );
+}
+
+void ThumbnailGrid::Resize( const VkExtent2D& extent )
+{
+    if( extent.width == m_extent.width && extent.height == m_extent.height ) return;
+    m_extent = extent;
+    UpdateLayout();
+    EnsureVisible();
+}
+
+void ThumbnailGrid::SetScale( float scale, const VkExtent2D& extent )
+{
+    m_scale = scale;
+    m_extent = extent;
+    UpdateLayout();
+    EnsureVisible();
+}
+
+void ThumbnailGrid::FormatChange( VkFormat format )
+{
+    m_pipeline.Change( format, [this, format] { return CreatePipeline( format ); } );
+}
+
+void ThumbnailGrid::PrepareFormat( VkFormat format )
+{
+    m_pipeline.Prepare( format, [this, format] { return CreatePipeline( format ); } );
+}
+
+bool ThumbnailGrid::Move( int64_t items )
+{
+    if( m_files.Empty() ) return false;
+    const auto last = int64_t( m_files.Size() - 1 );
+    return Select( size_t( std::clamp<int64_t>( int64_t( m_selected ) + items, 0, last ) ) );
+}
+
+bool ThumbnailGrid::MoveRows( int64_t rows )
+{
+    return Move( rows * m_columns );
+}
+
+bool ThumbnailGrid::MovePages( int64_t pages )
+{
+    return MoveRows( pages * std::max( 1u, m_extent.height / m_cell ) );
+}
+
+bool ThumbnailGrid::Select( size_t index )
+{
+    if( index == m_selected || index >= m_files.Size() ) return false;
+    m_selected = index;
+    EnsureVisible();
+    m_dirty = true;
+    return true;
+}
+
+void ThumbnailGrid::Scroll( float delta )
+{
+    m_scroll += delta * m_scale;
+    ClampScroll();
+}
+
+int64_t ThumbnailGrid::ItemAt( float x, float y ) const
+{
+    y += m_scroll;
+    if( x < m_left || y < 0 ) return -1;
+    const auto col = uint32_t( ( x - m_left ) / m_cell );
+    if( col >= m_columns ) return -1;
+    const auto idx = size_t( y / m_cell ) * m_columns + col;
+    return idx < m_files.Size() ? int64_t( idx ) : -1;
+}
+
+std::shared_ptr<VlkPipeline> ThumbnailGrid::CreatePipeline( VkFormat format )
+{
+    static constexpr std::array vertexBindingDescription = {
+        VkVertexInputBindingDescription {
+            .binding = 0,
+            .stride = sizeof( Vertex ),
+            .inputRate = VK_VERTEX_INPUT_RATE_VERTEX
+        },
+        VkVertexInputBindingDescription {
+            .binding = 1,
+            .stride = sizeof( Instance ),
+            .inputRate = VK_VERTEX_INPUT_RATE_INSTANCE
+        }
+    };
+    static constexpr std::array vertexAttributeDescription = {
+        VkVertexInputAttributeDescription { 0, 0, VK_FORMAT_R32G32_SFLOAT, offsetof( Vertex, x ) },
+        VkVertexInputAttributeDescription { 1, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof( Instance, x ) },
+        VkVertexInputAttributeDescription { 2, 1, VK_FORMAT_R32G32B32A32_SFLOAT, offsetof( Instance, u ) },
+        VkVertexInputAttributeDescription { 3, 1, VK_FORMAT_R32_SFLOAT, offsetof( Instance, layer ) },
+        VkVertexInputAttributeDescription { 4, 1, VK_FORMAT_R8G8B8A8_UNORM, offsetof( Instance, color ) }
+    };
+    constexpr VkPipelineVertexInputStateCreateInfo vertexInputInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO,
+        .vertexBindingDescriptionCount = vertexBindingDescription.size(),
+        .pVertexBindingDescriptions = vertexBindingDescription.data(),
+        .vertexAttributeDescriptionCount = vertexAttributeDescription.size(),
+        .pVertexAttributeDescriptions = vertexAttributeDescription.data()
+    };
+    constexpr VkPipelineInputAssemblyStateCreateInfo inputAssembly = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_INPUT_ASSEMBLY_STATE_CREATE_INFO,
+        .topology = VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST
+    };
+    constexpr VkPipelineViewportStateCreateInfo viewportState = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_VIEWPORT_STATE_CREATE_INFO,
+        .viewportCount = 1,
+        .scissorCount = 1
+    };
+    constexpr VkPipelineRasterizationStateCreateInfo rasterizer = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RASTERIZATION_STATE_CREATE_INFO,
+        .polygonMode = VK_POLYGON_MODE_FILL,
+        .lineWidth = 1.0f
+    };
+    constexpr VkPipelineMultisampleStateCreateInfo multisampling = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_MULTISAMPLE_STATE_CREATE_INFO,
+        .rasterizationSamples = VK_SAMPLE_COUNT_1_BIT
+    };
+    static constexpr VkPipelineColorBlendAttachmentState colorBlendAttachment = {
+        .blendEnable = VK_TRUE,
+        .srcColorBlendFactor = VK_BLEND_FACTOR_SRC_ALPHA,
+        .dstColorBlendFactor = VK_BLEND_FACTOR_ONE_MINUS_SRC_ALPHA,
+        .colorBlendOp = VK_BLEND_OP_ADD,
+        .srcAlphaBlendFactor = VK_BLEND_FACTOR_ONE,
+        .dstAlphaBlendFactor = VK_BLEND_FACTOR_ZERO,
+        .alphaBlendOp = VK_BLEND_OP_ADD,
+        .colorWriteMask = VK_COLOR_COMPONENT_R_BIT | VK_COLOR_COMPONENT_G_BIT | VK_COLOR_COMPONENT_B_BIT | VK_COLOR_COMPONENT_A_BIT
+    };
+    constexpr VkPipelineColorBlendStateCreateInfo colorBlending = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_COLOR_BLEND_STATE_CREATE_INFO,
+        .attachmentCount = 1,
+        .pAttachments = &colorBlendAttachment
+    };
+    const std::array colorAttachmentFormats = {
+        format
+    };
+    const VkPipelineRenderingCreateInfo rendering = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_RENDERING_CREATE_INFO,
+        .colorAttachmentCount = colorAttachmentFormats.size(),
+        .pColorAttachmentFormats = colorAttachmentFormats.data()
+    };
+    static constexpr std::array dynamicStateList = {
+        VK_DYNAMIC_STATE_VIEWPORT,
+        VK_DYNAMIC_STATE_SCISSOR
+    };
+    constexpr VkPipelineDynamicStateCreateInfo dynamicState = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_DYNAMIC_STATE_CREATE_INFO,
+        .dynamicStateCount = dynamicStateList.size(),
+        .pDynamicStates = dynamicStateList.data()
+    };
+    const VlkShader shader( *m_shader, { uint32_t( GetOutputTransfer( format ) ) } );
+    const VkGraphicsPipelineCreateInfo pipelineInfo = {
+        .sType = VK_STRUCTURE_TYPE_GRAPHICS_PIPELINE_CREATE_INFO,
+        .pNext = &rendering,
+        .stageCount = shader.GetStageCount(),
+        .pStages = shader.GetStages(),
+        .pVertexInputState = &vertexInputInfo,
+        .pInputAssemblyState = &inputAssembly,
+        .pViewportState = &viewportState,
+        .pRasterizationState = &rasterizer,
+        .pMultisampleState = &multisampling,
+        .pColorBlendState = &colorBlending,
+        .pDynamicState = &dynamicState,
+        .layout = *m_pipelineLayout,
+    };
+    return std::make_shared<VlkPipeline>( *m_device, pipelineInfo );
+}
+
+// The atlas has to hold every item of the resident rows. It only grows, which drops the loaded thumbnails.
+void ThumbnailGrid::UpdateLayout()
+{
+    m_cell = std::max( 1u, uint32_t( CellSize * m_scale ) );
+    m_columns = std::max( 1u, m_extent.width / m_cell );
+    m_left = std::floor( ( float( m_extent.width ) - m_columns * m_cell ) / 2 );
+    ClampScroll();
+    m_dirty = true;
+
+    if( m_files.Empty() ) return;
+    const auto needed = ( VisibleRows() + MarginRows * 2 ) * m_columns;
+    const auto layers = std::min<uint32_t>( ( needed + SlotsPerLayer - 1 ) / SlotsPerLayer, m_maxLayers );
+    if( layers > m_layers ) CreateAtlas( layers );
+}
+
+void ThumbnailGrid::ClampScroll()
+{
+    const auto rows = ( m_files.Size() + m_columns - 1 ) / m_columns;
+    const auto maxScroll = std::max( 0.f, float( rows * m_cell ) - m_extent.height );
+    m_scroll = std::clamp( m_scroll, 0.f, maxScroll );
+}
+
+void ThumbnailGrid::EnsureVisible()
+{
+    if( m_files.Empty() ) return;
+    const auto top = float( m_selected / m_columns * m_cell );
+    if( top < m_scroll ) m_scroll = top;
+    else if( top + m_cell > m_scroll + m_extent.height ) m_scroll = top + m_cell - float( m_extent.height );
+    ClampScroll();
+}
+
+// Partially visible rows on both edges included
+size_t ThumbnailGrid::VisibleRows() const
+{
+    return m_extent.height / m_cell + 2;
+}
+
+void ThumbnailGrid::ResidentRange( size_t& begin, size_t& end ) const
+{
+    const auto first = size_t( m_scroll / m_cell );
+    const auto row0 = first > MarginRows ? first - MarginRows : 0;
+    const auto row1 = first + VisibleRows() + MarginRows;
+    begin = std::min( row0 * m_columns, m_files.Size() );
+    end = std::min( { row1 * m_columns, m_files.Size(), begin + m_slots.size() } );
+}
+
+void ThumbnailGrid::CreateAtlas( uint32_t layers )
+{
+    ZoneScoped;
+    ZoneTextF( "%u layers", layers );
+    mclog( LogLevel::Debug, "Thumbnail atlas: %u layers of %u×%u", layers, AtlasSize, AtlasSize );
+
+    if( m_atlas ) m_garbage.Recycle( { std::move( m_atlasView ), std::move( m_atlas ) } );
+    for( auto& item : m_items ) item = {};
+    m_slots.assign( layers * SlotsPerLayer, Slot { .item = -1 } );
+    m_layers = layers;
+
+    const VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = SdrFormat,
+        .extent = { AtlasSize, AtlasSize, 1 },
+        .mipLevels = 1,
+        .arrayLayers = layers,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_OPTIMAL,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+    m_atlas = std::make_shared<VlkImage>( *m_device, imageInfo );
+
+    const VkImageViewCreateInfo viewInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO,
+        .image = *m_atlas,
+        .viewType = VK_IMAGE_VIEW_TYPE_2D_ARRAY,
+        .format = SdrFormat,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, layers }
+    };
+    m_atlasView = std::make_shared<VlkImageView>( *m_device, viewInfo );
+    m_imageInfo.imageView = *m_atlasView;
+
+    // The descriptor is bound even if no thumbnail was uploaded yet, so the atlas has to be in the right layout
+    auto cmd = std::make_unique<VlkCommandBuffer>( m_device->GetThreadCommandPool( QueueType::Graphic ) );
+    cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+    const VkImageMemoryBarrier2 barrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = *m_atlas,
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, layers }
+    };
+    const VkDependencyInfo deps = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &barrier
+    };
+    vkCmdPipelineBarrier2( *cmd, &deps );
+    cmd->End();
+
+    const auto value = m_device->Submit( *cmd, VK_NULL_HANDLE );
+    m_device->GetGarbage()->Recycle( m_device->GetTimeline( QueueType::Graphic ), value, {
+        std::move( cmd ),
+        m_atlas
+    } );
+}
+
+// Slots of items outside of the resident range are reused, least recently shown first. There is always one,
+// as the range never has more items than there are slots.
+int32_t ThumbnailGrid::AllocateSlot( size_t begin, size_t end )
+{
+    int32_t best = -1;
+    for( size_t i=0; i<m_slots.size(); i++ )
+    {
+        const auto& slot = m_slots[i];
+        if( slot.item < 0 ) return int32_t( i );
+        if( size_t( slot.item ) >= begin && size_t( slot.item ) < end ) continue;
+        if( best < 0 || slot.lastUse < m_slots[best].lastUse ) best = int32_t( i );
+    }
+    CheckPanic( best >= 0, "No free thumbnail slot" );
+    auto& item = m_items[m_slots[best].item];
+    if( item.slot == best ) item = {};
+    return best;
+}
+
+// Visible rows are queued before the margins. Only a limited number of jobs is in flight, so that scrolling
+// quickly through a large list does not queue work for every item passed on the way.
+void ThumbnailGrid::QueueLoads( size_t begin, size_t end )
+{
+    if( m_inFlight >= m_maxInFlight ) return;
+
+    const auto first = std::min( std::max( begin, size_t( m_scroll / m_cell ) * m_columns ), end );
+    const auto visible = std::min( first + ( m_extent.height / m_cell + 1 ) * m_columns, end );
+    const std::array<std::pair<size_t, size_t>, 3> ranges = { {
+        { first, visible },
+        { visible, end },
+        { begin, first }
+    } };
+
+    const auto generation = m_generation.load( std::memory_order_relaxed );
+    TaskDispatch::ScopedPriority priority( TaskDispatch::Priority::Background );
+    for( auto& [b, e] : ranges )
+    {
+        for( size_t i=b; i<e && m_inFlight < m_maxInFlight; i++ )
+        {
+            auto& item = m_items[i];
+            if( item.state != State::None ) continue;
+            item.state = State::Loading;
+            m_inFlight++;
+
+            m_td.Queue( *m_jobs, [this, i, path = m_files.Path( i ), generation] {
+                if( m_generation.load( std::memory_order_acquire ) != generation ) return;
+
+                Loaded result = { .generation = generation, .item = i };
+                if( i < m_wantBegin.load( std::memory_order_relaxed ) || i >= m_wantEnd.load( std::memory_order_relaxed ) )
+                {
+                    result.skipped = true;
+                }
+                else
+                {
+                    ZoneScopedN( "Thumbnail" );
+                    ZoneText( path.c_str(), path.size() );
+                    result.bitmap = m_cache.Get( path.c_str(), SlotSize );
+                    if( !result.bitmap ) mclog( LogLevel::Warning, "No thumbnail for %s", path.c_str() );
+                }
+
+                std::unique_lock lock( m_pendingLock );
+                m_pending.emplace_back( std::move( result ) );
+                lock.unlock();
+                m_ready( m_userData );
+            } );
+        }
+    }
+}
+
+// All thumbnails are copied with a single submission on the graphics queue, where the frame using them is
+// submitted later. The barriers order the copies after the frames still sampling the atlas.
+void ThumbnailGrid::Upload( std::vector<Loaded>& uploads )
+{
+    ZoneScoped;
+    ZoneValue( uploads.size() );
+
+    VkDeviceSize total = 0;
+    for( auto& v : uploads ) total += VkDeviceSize( v.bitmap->Width() ) * v.bitmap->Height() * 4;
+    auto staging = m_device->GetStagingRing()->Acquire( total );
+
+    std::vector<VkBufferImageCopy> regions;
+    regions.reserve( uploads.size() );
+    VkDeviceSize offset = 0;
+    for( auto& v : uploads )
+    {
+        const auto& bmp = *v.bitmap;
+        const auto idx = AllocateSlot( m_residentBegin, m_residentEnd );
+        m_slots[idx] = {
+            .item = int64_t( v.item ),
+            .lastUse = m_slotTick,
+            .width = uint16_t( bmp.Width() ),
+            .height = uint16_t( bmp.Height() )
+        };
+        m_items[v.item] = { .slot = idx, .state = State::Ready };
+
+        const auto size = VkDeviceSize( bmp.Width() ) * bmp.Height() * 4;
+        memcpy( (char*)staging.ptr + offset, bmp.Data(), size );
+
+        const auto layerSlot = uint32_t( idx ) % SlotsPerLayer;
+        regions.emplace_back( VkBufferImageCopy {
+            .bufferOffset = staging.offset + offset,
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, uint32_t( idx ) / SlotsPerLayer, 1 },
+            .imageOffset = { int32_t( layerSlot % SlotsPerRow * SlotPixels ), int32_t( layerSlot / SlotsPerRow * SlotPixels ), 0 },
+            .imageExtent = { bmp.Width(), bmp.Height(), 1 }
+        } );
+        offset += size;
+    }
+    staging.Flush();
+
+    const VkImageSubresourceRange range = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, m_layers };
+    const VkImageMemoryBarrier2 writeBarrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = *m_atlas,
+        .subresourceRange = range
+    };
+    const VkImageMemoryBarrier2 readBarrier = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+        .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+        .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+        .dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+        .dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT,
+        .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+        .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+        .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+        .image = *m_atlas,
+        .subresourceRange = range
+    };
+    const VkDependencyInfo writeDeps = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &writeBarrier
+    };
+    const VkDependencyInfo readDeps = {
+        .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+        .imageMemoryBarrierCount = 1,
+        .pImageMemoryBarriers = &readBarrier
+    };
+
+    auto cmd = std::make_unique<VlkCommandBuffer>( m_device->GetThreadCommandPool( QueueType::Graphic ) );
+    cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+    {
+        ZoneVk( *m_device, *cmd, "Thumbnail upload", true );
+        vkCmdPipelineBarrier2( *cmd, &writeDeps );
+        vkCmdCopyBufferToImage( *cmd, staging, *m_atlas, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, regions.size(), regions.data() );
+        vkCmdPipelineBarrier2( *cmd, &readDeps );
+    }
+    cmd->End();
+
+    const auto value = m_device->Submit( *cmd, VK_NULL_HANDLE );
+    auto& timeline = m_device->GetTimeline( QueueType::Graphic );
+    m_device->GetStagingRing()->Release( staging, timeline, value );
+    m_device->GetGarbage()->Recycle( timeline, value, {
+        std::move( cmd ),
+        m_atlas
+    } );
+    m_dirty = true;
+}
+
+// Thumbnails are fitted into the cells, but not enlarged beyond their size in logical pixels. Atlas coordinates
+// are inset by half a texel, so that filtering does not pick up the neighbouring slots.
+void ThumbnailGrid::UpdateInstanceBuffer()
+{
+    ZoneScoped;
+    m_dirty = false;
+
+    if( m_instanceBuffer ) m_garbage.Recycle( std::move( m_instanceBuffer ) );
+    m_instanceCount = 0;
+    if( m_residentBegin == m_residentEnd ) return;
+
+    const auto pad = std::round( 8 * m_scale );
+    const auto inner = m_cell - pad * 2;
+    constexpr auto texel = 1.f / AtlasSize;
+
+    m_slotTick++;
+    std::vector<Instance> instances;
+    instances.reserve( m_residentEnd - m_residentBegin + 1 );
+    for( size_t i=m_residentBegin; i<m_residentEnd; i++ )
+    {
+        const auto x = m_left + float( i % m_columns * m_cell );
+        const auto y = float( i / m_columns * m_cell );
+        if( i == m_selected )
+        {
+            instances.emplace_back( Instance { x + pad / 2, y + pad / 2, m_cell - pad, m_cell - pad, 0, 0, 0, 0, -1, SelectedColor } );
+        }
+
+        const auto& item = m_items[i];
+        if( item.slot < 0 )
+        {
+            instances.emplace_back( Instance { x + pad, y + pad, inner, inner, 0, 0, 0, 0, -1, item.state == State::Failed ? FailedColor : PlaceholderColor } );
+            continue;
+        }
+
+        auto& slot = m_slots[item.slot];
+        slot.lastUse = m_slotTick;
+
+        const auto fit = std::min( { inner / slot.width, inner / slot.height, m_scale } );
+        const auto w = std::max( 1.f, std::round( slot.width * fit ) );
+        const auto h = std::max( 1.f, std::round( slot.height * fit ) );
+        const auto layerSlot = uint32_t( item.slot ) % SlotsPerLayer;
+        const auto sx = float( layerSlot % SlotsPerRow * SlotPixels );
+        const auto sy = float( layerSlot / SlotsPerRow * SlotPixels );
+        instances.emplace_back( Instance {
+            x + std::floor( ( m_cell - w ) / 2 ),
+            y + std::floor( ( m_cell - h ) / 2 ),
+            w, h,
+            ( sx + 0.5f ) * texel,
+            ( sy + 0.5f ) * texel,
+            ( slot.width - 1 ) * texel,
+            ( slot.height - 1 ) * texel,
+            float( uint32_t( item.slot ) / SlotsPerLayer ),
+            0
+        } );
+    }
+
+    const VkBufferCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = sizeof( Instance ) * instances.size(),
+        .usage = VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    m_instanceBuffer = std::make_shared<VlkBuffer>( *m_device, info, VlkBuffer::PreferDevice | VlkBuffer::WillWrite );
+    memcpy( m_instanceBuffer->Ptr(), instances.data(), sizeof( Instance ) * instances.size() );
+    m_instanceBuffer->Flush();
+    m_instanceCount = uint32_t( instances.size() );
+}
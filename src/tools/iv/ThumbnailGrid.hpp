@@ -0,0 +1,182 @@
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "PreparedPipeline.hpp"
+#include "image/Thumbnail.hpp"
+#include "util/PathList.hpp"
+
+class Bitmap;
+class GarbageChute;
+class TaskDispatch;
+class TaskGroup;
+class VlkBuffer;
+class VlkCommandBuffer;
+class VlkDescriptorSetLayout;
+class VlkDevice;
+class VlkImage;
+class VlkImageView;
+class VlkPipeline;
+class VlkPipelineLayout;
+class VlkSampler;
+class VlkShader;
+
+// Thumbnails of the file list, laid out in rows. The thumbnails are packed into the slots of a single texture array
+// and drawn with one instanced draw call, so that there are no per file Vulkan objects. Only the rows around the
+// visible ones are loaded, older slots are reused as the view scrolls.
+//
+// Must be externally synchronized. Thumbnail loading jobs only touch the pending list, and call the ready callback
+// when something can be uploaded.
+class ThumbnailGrid
+{
+    enum class State : uint8_t
+    {
+        None,
+        Loading,
+        Ready,
+        Failed
+    };
+
+    struct Item
+    {
+        int32_t slot = -1;
+        State state = State::None;
+    };
+
+    struct Slot
+    {
+        int64_t item;       // -1 if free
+        uint64_t lastUse;
+        uint16_t width;
+        uint16_t height;
+    };
+
+    struct Loaded
+    {
+        uint32_t generation;
+        size_t item;
+        std::unique_ptr<Bitmap> bitmap;
+        bool skipped;       // No longer wanted when the job started
+    };
+
+    struct Instance
+    {
+        float x, y, w, h;       // Relative to the top left corner of the grid
+        float u, v, tw, th;     // Normalized atlas coordinates
+        float layer;            // Negative for a flat colour
+        uint32_t color;
+    };
+
+public:
+    using Callback = void (*)(void*);
+
+    static constexpr uint32_t CellSize = 192;       // Logical pixels
+    static constexpr uint32_t AtlasSize = 2048;
+    static constexpr ThumbnailCache::Size SlotSize = ThumbnailCache::Size::Large;
+    static constexpr uint32_t MarginRows = 1;       // Loaded beyond the visible rows, in both directions
+
+    ThumbnailGrid( GarbageChute& garbage, std::shared_ptr<VlkDevice> device, TaskDispatch& td, VkFormat format, const VkExtent2D& extent, float scale, Callback ready, void* userData );
+    ~ThumbnailGrid();
+
+    // If the selected file is in the new list, the selection stays on it
+    void SetFiles( const PathList& files, size_t selected );
+    void Clear();
+
+    // Uploads the loaded thumbnails and queues loading of the ones that became visible. Must be called before
+    // the frame is recorded. Returns true if the grid needs to be rendered again.
+    bool Update();
+    void Render( VlkCommandBuffer& cmdbuf, const VkExtent2D& extent );
+
+    void Resize( const VkExtent2D& extent );
+    void SetScale( float scale, const VkExtent2D& extent );
+    void FormatChange( VkFormat format );
+    void PrepareFormat( VkFormat format );      // Thread safe, makes a later FormatChange() to this format cheap
+
+    // Moves the selection by a number of items, or rows, clamped to the file list. Returns true if it changed.
+    bool Move( int64_t items );
+    bool MoveRows( int64_t rows );
+    bool MovePages( int64_t pages );
+    bool Select( size_t index );
+    void Scroll( float delta );
+
+    [[nodiscard]] int64_t ItemAt( float x, float y ) const;     // -1 if there is no item at the position
+    [[nodiscard]] size_t GetSelected() const { return m_selected; }
+    [[nodiscard]] bool IsEmpty() const { return m_files.Empty(); }
+
+private:
+    [[nodiscard]] std::shared_ptr<VlkPipeline> CreatePipeline( VkFormat format );
+
+    void Reset();
+
+    void UpdateLayout();
+    void ClampScroll();
+    void EnsureVisible();
+    [[nodiscard]] size_t VisibleRows() const;
+    void ResidentRange( size_t& begin, size_t& end ) const;
+
+    void CreateAtlas( uint32_t layers );
+    [[nodiscard]] int32_t AllocateSlot( size_t begin, size_t end );
+    void QueueLoads( size_t begin, size_t end );
+    void Upload( std::vector<Loaded>& uploads );
+    void UpdateInstanceBuffer();
+
+    GarbageChute& m_garbage;
+    std::shared_ptr<VlkDevice> m_device;
+    TaskDispatch& m_td;
+    std::unique_ptr<TaskGroup> m_jobs;
+    ThumbnailCache m_cache;
+
+    Callback m_ready;
+    void* m_userData;
+
+    std::shared_ptr<VlkShader> m_shader;
+    std::shared_ptr<VlkDescriptorSetLayout> m_setLayout;
+    std::shared_ptr<VlkPipelineLayout> m_pipelineLayout;
+    PreparedPipeline<std::shared_ptr<VlkPipeline>> m_pipeline;
+
+    std::shared_ptr<VlkBuffer> m_vertexBuffer;
+    std::shared_ptr<VlkBuffer> m_indexBuffer;
+    std::shared_ptr<VlkBuffer> m_instanceBuffer;
+    uint32_t m_instanceCount = 0;
+    std::shared_ptr<VlkSampler> m_sampler;
+
+    std::shared_ptr<VlkImage> m_atlas;
+    std::shared_ptr<VlkImageView> m_atlasView;
+    uint32_t m_layers = 0;
+    uint32_t m_maxLayers;
+    std::vector<Slot> m_slots;
+    uint64_t m_slotTick = 0;
+
+    VkDescriptorImageInfo m_imageInfo;
+    VkWriteDescriptorSet m_descWrite;
+
+    PathList m_files;
+    std::vector<Item> m_items;
+    size_t m_selected = 0;
+    size_t m_inFlight = 0;
+    size_t m_maxInFlight;
+
+    // Checked by the loading jobs, to skip work that is no longer needed
+    std::atomic<uint32_t> m_generation = 0;
+    std::atomic<size_t> m_wantBegin = 0;
+    std::atomic<size_t> m_wantEnd = 0;
+
+    std::mutex m_pendingLock;
+    std::vector<Loaded> m_pending;
+
+    VkExtent2D m_extent;
+    float m_scale;
+    uint32_t m_cell;
+    uint32_t m_columns;
+    float m_left;
+    float m_scroll = 0;
+    size_t m_residentBegin = 0;
+    size_t m_residentEnd = 0;
+    bool m_dirty = true;
+};
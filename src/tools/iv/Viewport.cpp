@@ -1,39 +1,58 @@
 #include <algorithm>
 #include <array>
+#include <chrono>
+#include <condition_variable>
 #include <dirent.h>
+#include <errno.h>
 #include <format>
 #include <linux/input-event-codes.h>
 #include <nfd.h>
 #include <numbers>
 #include <signal.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string_view>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/stat.h>
+#include <thread>
 #include <time.h>
 #include <tracy/Tracy.hpp>
+#include <unistd.h>
 #include <vulkan/vulkan.h>
 #include <vulkan/vk_enum_string_helper.h>
 
 #include "Background.hpp"
 #include "BusyIndicator.hpp"
+#include "ImageIndex.hpp"
 #include "ImageView.hpp"
 #include "Selection.hpp"
 #include "TextureFormats.hpp"
+#include "ThumbnailGrid.hpp"
 #include "Viewport.hpp"
 #include "image/ImageLoader.hpp"
 #include "image/vector/SvgImage.hpp"
 #include "util/Bitmap.hpp"
+#include "util/BitmapCompressed.hpp"
+#include "util/BitmapDct.hpp"
+#include "util/BitmapYuv.hpp"
 #include "util/BitmapHdr.hpp"
 #include "util/BitmapHdrHalf.hpp"
-#include "util/Config.hpp"
+#include "util/BitmapLz4.hpp"
+#include "util/Clock.hpp"
+#include "util/ConfigRegistry.hpp"
 #include "util/DataBuffer.hpp"
 #include "util/EmbedData.hpp"
+#include "util/FileBatch.hpp"
+#include "util/FileWrapper.hpp"
 #include "util/Filesystem.hpp"
 #include "util/Home.hpp"
 #include "util/Invoke.hpp"
 #include "util/MemoryBuffer.hpp"
+#include "util/MemoryStats.hpp"
 #include "util/Panic.hpp"
 #include "util/TaskDispatch.hpp"
+#include "util/TilePyramid.hpp"
 #include "util/Url.hpp"
 #include "vulkan/VlkCommandBuffer.hpp"
 #include "vulkan/VlkDevice.hpp"
@@ -43,12 +62,14 @@
 #include "vulkan/ext/PhysDevSel.hpp"
 #include "vulkan/ext/Texture.hpp"
 #include "vulkan/ext/Tracy.hpp"
+#include "vulkan/ext/UploadPolicy.hpp"
 #include "wayland/WaylandCursor.hpp"
 #include "wayland/WaylandDisplay.hpp"
 #include "wayland/WaylandKeys.hpp"
 #include "wayland/WaylandScroll.hpp"
 #include "wayland/WaylandWindow.hpp"
 
+#include "data/IconRaster.hpp"
 #include "data/IconSvg.hpp"
 
 enum class ImageType
@@ -64,10 +85,42 @@ static uint64_t Now()
     return uint64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec;
 }
 
-Viewport::Viewport( WaylandDisplay& display, VlkInstance& vkInstance, int gpu, bool hdr )
+static std::string JsonEscape( std::string_view str )
+{
+    std::string ret;
+    ret.reserve( str.size() );
+    for( auto c : str )
+    {
+        if( c == '"' || c == '\\' )
+        {
+            ret += '\\';
+            ret += c;
+        }
+        else if( (unsigned char)c < 0x20 )
+        {
+            ret += std::format( "\\u{:04x}", int( c ) );
+        }
+        else
+        {
+            ret += c;
+        }
+    }
+    return ret;
+}
+
+static bool IsModified( const char* path, const struct timespec& mtime )
+{
+    struct stat st;
+    if( stat( path, &st ) != 0 ) return true;
+    return st.st_mtim.tv_sec != mtime.tv_sec || st.st_mtim.tv_nsec != mtime.tv_nsec;
+}
+
+Viewport::Viewport( WaylandDisplay& display, VlkInstance& vkInstance, int gpu, bool hdr, const char* preload )
     : m_display( display )
     , m_vkInstance( vkInstance )
-    , m_td( std::make_unique<TaskDispatch>( std::thread::hardware_concurrency() - 1, "Worker" ) )
+    , m_td( std::make_unique<TaskDispatch>( std::thread::hardware_concurrency() - 1, "Worker", TaskDispatch::LoadPlacement( "iv.ini" ) ) )
+    , m_prepareJobs( std::make_unique<TaskGroup>() )
+    , m_scanJobs( std::make_unique<TaskGroup>() )
     , m_window( std::make_shared<WaylandWindow>( display, vkInstance ) )
     , m_provider( std::make_shared<ImageProvider>( *m_td ) )
     , m_hdr( hdr )
@@ -93,14 +146,12 @@ Viewport::Viewport( WaylandDisplay& display, VlkInstance& vkInstance, int gpu, b
         .OnScroll = Method( Scroll )
     };
 
+    Unembed( IconRaster );
     Unembed( IconSvg );
 
     m_window->SetListener( &listener, this );
     m_window->SetAppId( "iv" );
     m_window->SetTitle( "IV" );
-    m_window->SetIcon( SvgImage { IconSvg } );
-    m_window->Commit();
-    m_display.Roundtrip();
 
     const auto& devices = m_vkInstance.QueryPhysicalDevices();
     CheckPanic( !devices.empty(), "No Vulkan physical devices found" );
@@ -119,14 +170,129 @@ Viewport::Viewport( WaylandDisplay& display, VlkInstance& vkInstance, int gpu, b
     }
     mclog( LogLevel::Info, "Selected GPU: %s", physDevice->Properties().deviceName );
 
-    Config cfg( "iv.ini" );
-    const auto width = cfg.Get( "Window", "Width", 1280 );
-    const auto height = cfg.Get( "Window", "Height", 720 );
-    const auto maximized = cfg.Get( "Window", "Maximized", 0 );
+    const auto cfg = ConfigRegistry::Instance().Get( "iv.ini" );
+    const auto width = cfg->Get( "Window", "Width", 1280 );
+    const auto height = cfg->Get( "Window", "Height", 720 );
+    const auto maximized = cfg->Get( "Window", "Maximized", 0 );
+    m_compressAbove = cfg->Get( "Texture", "CompressAbove", 0 );
+    m_prefetchCount = std::max( 0, cfg->Get( "Browse", "Prefetch", 2 ) );
+    m_cacheVram = std::max( 0, cfg->Get( "Cache", "Vram", 1024 ) );
+    m_cacheRam = std::max( 0, cfg->Get( "Cache", "Ram", 512 ) );
+    m_cacheLz4 = std::max( 0, cfg->Get( "Cache", "Compressed", 1024 ) );
+    m_cacheTiles = std::max( 0, cfg->Get( "Cache", "Tiles", 8192 ) );
+    // Negative values leave the choice to the measured upload policy of the machine
+    const auto gpuTonemap = cfg->Get( "Texture", "GpuTonemap", -1 );
+    const auto gpuYuv = cfg->Get( "Texture", "GpuYuv", -1 );
+    const auto gpuMips = cfg->Get( "Texture", "GpuMips", -1 );
+    const auto hostImageCopy = cfg->Get( "Texture", "HostImageCopy", -1 );
+    const auto gpuIdct = cfg->Get( "Texture", "GpuIdct", 0 );
+    const auto packedHdr = cfg->Get( "Texture", "PackedHdr", 0 );
+    m_stickyHdr = cfg->Get( "Window", "StickyHdr", 0 );
+
+    // Mailbox with a single frame in flight gives the lowest latency when panning, at the cost of drawing frames
+    // which are never shown
+    const auto presentMode = VlkSwapchain::ParsePresentMode( cfg->Get( "Window", "PresentMode", "fifo" ) );
+    const auto swapchainImages = std::max( 0, cfg->Get( "Window", "SwapchainImages", 0 ) );
+    const auto framesInFlight = std::max( 0, cfg->Get( "Window", "FramesInFlight", 0 ) );
+
+    uint32_t compressedFormats = 0;
+    for( auto format : { BitmapCompressed::Format::Bc1, BitmapCompressed::Format::Bc3, BitmapCompressed::Format::Bc7, BitmapCompressed::Format::Etc2Rgb, BitmapCompressed::Format::Etc2Rgba } )
+    {
+        if( Texture::CanUpload( *physDevice, format ) ) compressedFormats |= 1u << (int)format;
+    }
+    m_provider->SetCompressedFormats( compressedFormats );
+
+    // Until a machine was calibrated, which its first run does once the device exists, the GPU paths are taken
+    UploadPolicy policy;
+    const auto calibrate = !UploadPolicy::Load( *physDevice, policy ) && ( gpuTonemap < 0 || gpuYuv < 0 || gpuMips < 0 || hostImageCopy < 0 );
+    if( gpuTonemap >= 0 ) policy.gpuTonemap = gpuTonemap != 0;
+    if( gpuYuv >= 0 ) policy.gpuYuv = gpuYuv != 0;
+    if( gpuMips >= 0 ) policy.gpuMips = gpuMips != 0;
+    if( hostImageCopy >= 0 ) policy.hostImageCopy = hostImageCopy != 0;
+
+    // HDR images shown on SDR output are uploaded as is and tone mapped when rendering, so that the operator
+    // can be changed without reloading.
+    //
+    // JPEG chroma is uploaded subsampled and converted to RGB by a compute shader, which takes less than half of
+    // the upload bandwidth, and none of the CPU time of the conversion.
+    //
+    // Both may still be slower than doing the work on a fast CPU, if the GPU is far behind it.
+    const auto maxTextureSize = std::min( physDevice->Properties().limits.maxImageDimension2D, ImageView::MaxTextureSize );
+    auto applyPolicy = [this, maxTextureSize]( const UploadPolicy& upload ) {
+        m_provider->SetGpuTonemap( upload.gpuTonemap ? maxTextureSize : 0 );
+        m_provider->SetGpuYuv( upload.gpuYuv ? maxTextureSize : 0 );
+    };
+    applyPolicy( policy );
+
+    // Optionally the inverse DCT goes there too, leaving only the entropy decoding to the CPU
+    if( gpuIdct ) m_provider->SetGpuIdct( physDevice->Properties().limits.maxStorageBufferRange );
+
+    // Images larger than the budget are block compressed on load, instead of failing to allocate or pushing
+    // everything else out of GPU memory.
+    if( m_compressAbove >= 0 )
+    {
+        uint64_t budget = uint64_t( m_compressAbove ) << 20;
+        if( budget == 0 )
+        {
+            const auto& memProps = physDevice->MemoryProperties();
+            for( uint32_t i=0; i<memProps.memoryHeapCount; i++ )
+            {
+                if( memProps.memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ) budget = std::max( budget, memProps.memoryHeaps[i].size / 4 );
+            }
+        }
+        mclog( LogLevel::Info, "Compressing images larger than %lu MiB", budget >> 20 );
+        m_provider->SetCompressAbove( budget, std::min( physDevice->Properties().limits.maxImageDimension2D, ImageView::MaxTextureSize ) );
+    }
+
+    // Images which have to be tiled are kept on disk as tile pyramids, so that opening them again only reads the
+    // visible tiles
+    if( m_cacheTiles > 0 ) m_provider->SetTileCache( std::min( physDevice->Properties().limits.maxImageDimension2D, ImageView::MaxTextureSize ), ImageView::TileSize, ImageView::OverviewSize, uint64_t( m_cacheTiles ) << 20 );
+
+    // The provider only needs to know what the physical device supports, so the image given on the command line
+    // is decoded while the device, swapchain and pipelines are created. ImageHandler() blocks on the lock until
+    // the view exists. LoadImage() picks the job up.
+    //
+    // Calibration measures the CPU, so on the first run the preload waits until it is done.
+    std::unique_lock lock( m_lock );
+    auto startPreload = [&] {
+        if( !preload ) return;
+        m_window->QuerySurfaceFormats( *physDevice );
+        m_preloadPath = preload;
+        m_currentJob = m_provider->LoadImage( preload, m_hdr && m_window->HdrCapable(), Method( ImageHandler ), this, {
+            .targetWidth = uint32_t( width ),
+            .targetHeight = uint32_t( height ),
+            .preview = true
+        } );
+    };
+    if( !calibrate ) startPreload();
+
+    m_window->SetIcon( *IconRaster, IconSvg );
+    m_window->Commit();
+    m_display.Roundtrip();
 
     m_device = std::make_shared<VlkDevice>( m_vkInstance, physDevice, VlkDevice::RequireGraphic | VlkDevice::RequirePresent, m_window->VkSurface() );
     PrintQueueConfig( *m_device );
+    m_device->LoadPipelineCache( Config::GetPath( "iv-pipelines.cache" ).c_str() );
+
+    if( calibrate )
+    {
+        const auto measured = UploadPolicy::Calibrate( *m_device, *m_td );
+        if( gpuTonemap < 0 ) policy.gpuTonemap = measured.gpuTonemap;
+        if( gpuYuv < 0 ) policy.gpuYuv = measured.gpuYuv;
+        if( gpuMips < 0 ) policy.gpuMips = measured.gpuMips;
+        if( hostImageCopy < 0 ) policy.hostImageCopy = measured.hostImageCopy;
+        applyPolicy( policy );
+        startPreload();
+    }
+    policy.Apply( *m_device );
+    m_pressureHandler = m_device->AddPressureHandler( 0, [this]( VkDeviceSize bytes ) { return EvictTextures( bytes ); } );
+    m_animTimer = m_display.Loop().AddTimer( 0, 0, [this] {
+        std::lock_guard lock( m_lock );
+        WantRender();
+    } );
+    m_window->SetPresentMode( presentMode, swapchainImages, framesInFlight );
     m_window->SetDevice( m_device );
+
     m_window->ResizeNoScale( width, height );
     m_window->Maximize( maximized );
 
@@ -138,6 +304,30 @@ Viewport::Viewport( WaylandDisplay& display, VlkInstance& vkInstance, int gpu, b
     m_busyIndicator = std::make_shared<BusyIndicator>( *m_window, m_device, format, scale );
     m_selection = std::make_shared<Selection>( m_window, m_device, format, scale );
     m_view = std::make_shared<ImageView>( *m_window, m_device, format, m_window->GetSize(), scale, *m_selection );
+    m_view->SetPackedHdr( packedHdr != 0 );
+    m_view->SetCpuMips( !policy.gpuMips );
+    m_provider->SetStreaming( [view = std::weak_ptr( m_view )]() -> std::shared_ptr<RowSink> {
+        auto ptr = view.lock();
+        return ptr ? ptr->CreateStream() : nullptr;
+    } );
+    m_grid = std::make_shared<ThumbnailGrid>( *m_window, m_device, *m_td, format, m_window->GetSize(), scale, Method( ThumbnailReady ), this );
+
+    // The compositor may switch between SDR and HDR at any time. Pipelines for the other format are built in
+    // the background, so that the switch is only a pointer swap. If it happens before they are ready, they are
+    // built on the spot as before.
+    const auto other = m_window->GetSwapchainFormat( format != m_window->GetSwapchainFormat( true ) );
+    if( other != VK_FORMAT_UNDEFINED && other != format )
+    {
+        TaskDispatch::ScopedPriority priority( TaskDispatch::Priority::Background );
+        m_td->Queue( *m_prepareJobs, [this, other] {
+            ZoneScopedN( "Prepare pipelines" );
+            m_background->PrepareFormat( other );
+            m_busyIndicator->PrepareFormat( other );
+            m_selection->PrepareFormat( other );
+            m_view->PrepareFormat( other );
+            m_grid->PrepareFormat( other );
+        } );
+    }
 
     const char* token = getenv( "XDG_ACTIVATION_TOKEN" );
     if( token )
@@ -155,6 +345,12 @@ Viewport::~Viewport()
     const auto winSize = m_window->GetSizeFloating();
     const auto maximized = m_window->IsMaximized();
 
+    m_device->RemovePressureHandler( m_pressureHandler );
+    m_display.Loop().RemoveTimer( m_animTimer );
+    m_scanGeneration++;
+    m_scanJobs->Wait();
+    m_prepareJobs->Wait();
+    m_grid.reset();
     m_window->Close();
     m_provider->CancelAll();
     m_provider.reset();
@@ -169,8 +365,18 @@ Viewport::~Viewport()
             fprintf( f, "Width = %u\n", winSize.width );
             fprintf( f, "Height = %u\n", winSize.height );
             fprintf( f, "Maximized = %d\n", maximized );
+            fprintf( f, "\n[Texture]\n" );
+            fprintf( f, "CompressAbove = %d\n", m_compressAbove );
+            fprintf( f, "\n[Browse]\n" );
+            fprintf( f, "Prefetch = %d\n", m_prefetchCount );
+            fprintf( f, "\n[Cache]\n" );
+            fprintf( f, "Vram = %d\n", m_cacheVram );
+            fprintf( f, "Ram = %d\n", m_cacheRam );
+            fprintf( f, "Compressed = %d\n", m_cacheLz4 );
+            fprintf( f, "Tiles = %d\n", m_cacheTiles );
             fclose( f );
         }
+        m_device->SavePipelineCache( ( configPath + "iv-pipelines.cache" ).c_str() );
     }
 
     NFD_Quit();
@@ -179,14 +385,59 @@ Viewport::~Viewport()
 void Viewport::LoadImage( const char* path, bool scanDirectory )
 {
     ZoneScoped;
-    std::lock_guard lock( m_lock );
-    const auto id = m_provider->LoadImage( path, m_hdr && m_window->HdrCapable(), Method( ImageHandler ), this );
-    ZoneTextF( "id %ld", id );
+    std::unique_lock lock( m_lock );
 
-    if( m_currentJob != -1 ) m_provider->Cancel( m_currentJob );
-    m_currentJob = id;
+    // The image passed to the constructor is already loading, or may even be shown by now
+    const auto preloaded = !m_preloadPath.empty() && m_preloadPath == path;
+    m_preloadPath.clear();
 
-    SetBusy();
+    // A prefetch job which became the current one is left to finish, UpdatePrefetch() cancels it if it is no
+    // longer a neighbour.
+    if( !preloaded )
+    {
+        if( m_currentJob != -1 && FindCached( m_currentJob ) == m_cache.end() ) m_provider->Cancel( m_currentJob );
+        m_currentJob = -1;
+    }
+
+    auto it = preloaded ? m_cache.end() : FindCached( std::string( path ) );
+    if( it != m_cache.end() && it->id == -1 && IsModified( path, it->mtime ) )
+    {
+        m_cache.erase( it );
+        it = m_cache.end();
+    }
+    if( preloaded )
+    {
+        ZoneTextF( "id %ld, preloaded", m_currentJob );
+        if( m_currentJob != -1 ) SetBusy();
+    }
+    else if( it != m_cache.end() && it->id == -1 )
+    {
+        mclog( LogLevel::Info, "Showing cached image %s", path );
+        it->lastUse = ++m_cacheTick;
+        const auto image = *it;
+        lock.unlock();
+        ShowImage( image );
+        lock.lock();
+        if( m_isBusy && m_currentJob == -1 )
+        {
+            m_isBusy = false;
+            m_window->SetCursor( WaylandCursor::Default );
+        }
+    }
+    else if( it != m_cache.end() )
+    {
+        ZoneTextF( "id %ld, prefetched", it->id );
+        m_currentJob = it->id;
+        m_provider->Promote( it->id );
+        SetBusy();
+    }
+    else
+    {
+        const auto id = m_provider->LoadImage( path, m_hdr && m_window->HdrCapable(), Method( ImageHandler ), this, PreviewFlags() );
+        ZoneTextF( "id %ld", id );
+        m_currentJob = id;
+        SetBusy();
+    }
 
     if( scanDirectory )
     {
@@ -204,24 +455,35 @@ void Viewport::LoadImage( const char* path, bool scanDirectory )
             origin = path;
         }
 
-        mclog( LogLevel::Info, "Scanning directory %s", dir.c_str() );
-        auto files = FindLoadableImages( ListDirectory( dir ) );
-        if( files.empty() ) return;
-        mclog( LogLevel::Info, "Found %zu files", files.size() );
-        SetFileList( std::move( files ), origin );
+        ScanDirectory( dir, origin );
     }
+
+    UpdatePrefetch();
 }
 
 void Viewport::LoadImage( int fd, const char* origin, int dndFd )
 {
     ZoneScoped;
     std::lock_guard lock( m_lock );
+    ClearCache();
     m_provider->CancelAll();
-    m_currentJob = m_provider->LoadImage( fd, m_hdr && m_window->HdrCapable(), Method( ImageHandler ), this, origin, { .dndFd = dndFd } );
+    auto flags = PreviewFlags();
+    flags.dndFd = dndFd;
+    m_currentJob = m_provider->LoadImage( fd, m_hdr && m_window->HdrCapable(), Method( ImageHandler ), this, origin, flags );
     ZoneTextF( "id %ld", m_currentJob );
     SetBusy();
 }
 
+ImageProvider::Flags Viewport::PreviewFlags()
+{
+    const auto size = m_window->GetSize();
+    return {
+        .targetWidth = size.width,
+        .targetHeight = size.height,
+        .preview = true
+    };
+}
+
 void Viewport::LoadImage( const std::vector<std::string>& paths )
 {
     ZoneScoped;
@@ -240,10 +502,29 @@ void Viewport::LoadImage( const std::vector<std::string>& paths )
     }
     else
     {
-        m_fileList = std::move( files );
+        m_scanGeneration++;
+        std::lock_guard lock( m_lock );
+        m_fileList = PathList( files );
         m_fileIndex = 0;
-        m_origin = m_fileList[0];
-        LoadImage( m_fileList[0].c_str(), false );
+        m_origin = files[0];
+        FileListChanged();
+        LoadImage( files[0].c_str(), false );
+    }
+}
+
+void Viewport::SetLoadStats( bool print, const char* jsonPath )
+{
+    std::lock_guard lock( m_lock );
+    m_printLoadStats = print;
+    m_loadStatsJson.reset();
+    if( jsonPath )
+    {
+        m_loadStatsJson = std::make_unique<FileWrapper>( jsonPath, "a" );
+        if( !*m_loadStatsJson )
+        {
+            mclog( LogLevel::Error, "Failed to open %s for writing: %s", jsonPath, strerror( errno ) );
+            m_loadStatsJson.reset();
+        }
     }
 }
 
@@ -258,13 +539,15 @@ void Viewport::SetBusy()
     }
 }
 
+// Only the animations which are on screen keep the frame loop running. Everything else asks for a single frame
+// with WantRender(), and the loop stops once a frame has nothing to draw. Animations only redraw their own area.
 void Viewport::Update( float delta )
 {
     std::lock_guard lock( m_lock );
     if( m_isBusy )
     {
         m_busyIndicator->Update( delta );
-        m_render = true;
+        AddDamage( m_busyIndicator->GetRect( m_window->GetSize() ) );
     }
 
     if( m_view->HasBitmap() )
@@ -276,28 +559,64 @@ void Viewport::Update( float delta )
             m_updateTitle = true;
         }
 
-        if( m_selection->IsActive() )
+        if( !m_gridMode && m_selection->IsActive() )
         {
             m_selection->Update( delta );
-            WantRender();
+            AddDamage( m_selection->GetScreenRect() );
         }
     }
+    if( m_showPresentStats && m_lastTime - m_presentStatsTime >= 1000000000 )
+    {
+        m_presentStatsTime = m_lastTime;
+        m_updateTitle = true;
+    }
     if( m_updateTitle )
     {
         m_updateTitle = false;
         bool hdr = m_hdr && m_window->HdrCapable();
         auto& extent = m_view->GetBitmapExtent();
-        if( m_fileList.size() > 1 )
+
+        // Presentation feedback of the last frame, to check the refresh rate and direct scanout
+        std::string stats;
+        if( m_showPresentStats )
+        {
+            const auto& ps = m_window->GetPresentStats();
+            stats = std::format( " - {:.1f} Hz, {:.1f} ms{}{}, {} dropped", ps.refresh > 0 ? 1000 / ps.refresh : 0.f, ps.latency, ps.vsync ? ", vsync" : "", ps.zeroCopy ? ", zero-copy" : "", ps.discarded );
+        }
+        if( m_showLoadStats && m_loadStats.state == LoadStats::State::Done )
+        {
+            const auto& ls = m_loadStats;
+            stats += std::format( " - loaded in {:.1f} ms: decode {:.1f}, texture {:.1f}, upload {:.1f}", ls.total / 1000.f, ls.timeline.decode / 1000.f, ls.build / 1000.f, ls.upload / 1000.f );
+        }
+
+        if( m_fileList.Size() > 1 )
         {
-            m_window->SetTitle( std::format( "{} [{}/{}] - {}×{} - {:.2f}% <{}> — IV", m_origin, m_fileIndex + 1, m_fileList.size(), extent.width, extent.height, m_viewScale * 100, hdr ? "h" : "s"  ).c_str() );
+            m_window->SetTitle( std::format( "{} [{}/{}] - {}×{} - {:.2f}% <{}>{} — IV", m_origin, m_fileIndex + 1, m_fileList.Size(), extent.width, extent.height, m_viewScale * 100, hdr ? "h" : "s", stats ).c_str() );
         }
         else
         {
-            m_window->SetTitle( std::format( "{} - {}×{} - {:.2f}% <{}> — IV", m_origin, extent.width, extent.height, m_viewScale * 100, hdr ? "h" : "s"  ).c_str() );
+            m_window->SetTitle( std::format( "{} - {}×{} - {:.2f}% <{}>{} — IV", m_origin, extent.width, extent.height, m_viewScale * 100, hdr ? "h" : "s", stats ).c_str() );
         }
     }
 }
 
+void Viewport::AddDamage( const VkRect2D& rect )
+{
+    if( rect.extent.width == 0 || rect.extent.height == 0 ) return;
+    if( m_damage.extent.width == 0 )
+    {
+        m_damage = rect;
+    }
+    else
+    {
+        const auto x0 = std::min( m_damage.offset.x, rect.offset.x );
+        const auto y0 = std::min( m_damage.offset.y, rect.offset.y );
+        const auto x1 = std::max( m_damage.offset.x + int32_t( m_damage.extent.width ), rect.offset.x + int32_t( rect.extent.width ) );
+        const auto y1 = std::max( m_damage.offset.y + int32_t( m_damage.extent.height ), rect.offset.y + int32_t( rect.extent.height ) );
+        m_damage = { { x0, y0 }, { uint32_t( x1 - x0 ), uint32_t( y1 - y0 ) } };
+    }
+}
+
 void Viewport::WantRender()
 {
     if( m_render ) return;
@@ -325,13 +644,37 @@ bool Viewport::Render()
 
     std::lock_guard lock( *m_view );
     Update( delta );
+    if( m_view->UpdateUpload() ) m_render = true;
+    if( m_view->UpdateTiles() ) m_render = true;
 
-    if( !m_render ) return false;
+    // HDR output is mapped to the display by the compositor, which these light levels help with
+    const auto luminance = m_view->GetLuminance();
+    m_window->SetContentLight( luminance ? luminance->peak * 100 : 0, luminance ? luminance->average * 100 : 0 );
+    {
+        std::lock_guard lock( m_lock );
+        if( m_gridMode && m_grid->Update() ) m_render = true;
+        UpdateLoadStats();
+
+        // The window idles between animation frames, the timer brings it back for the next one
+        const auto deadline = m_gridMode ? 0 : m_view->AnimationDeadline();
+        m_display.Loop().SetTimer( m_animTimer, deadline == 0 ? 0 : std::max<int64_t>( int64_t( deadline - GetTimeMicro() ), 1000 ) );
+    }
+
+    if( !m_render && m_damage.extent.width == 0 ) return false;
+    const auto damage = m_damage;
+    const auto full = m_render;
     m_render = false;
+    m_damage = {};
 
     FrameMark;
-    auto& cmdbuf = m_window->BeginFrame();
+    auto& cmdbuf = m_window->BeginFrame( full ? nullptr : &damage );
+    const auto& area = m_window->GetRenderArea();
+    {
+        std::lock_guard lock( m_lock );
+        if( !m_gridMode && m_view->HasBitmap() ) m_view->Prepare( cmdbuf );
+    }
 
+    // Outside of the render area the image keeps what was drawn before. All pipelines use the scissor set here.
     const VkRenderingAttachmentInfo attachmentInfo = {
         .sType = VK_STRUCTURE_TYPE_RENDERING_ATTACHMENT_INFO,
         .imageView = m_window->GetImageView(),
@@ -341,18 +684,23 @@ bool Viewport::Render()
     };
     const VkRenderingInfo renderingInfo = {
         .sType = VK_STRUCTURE_TYPE_RENDERING_INFO,
-        .renderArea = { { 0, 0 }, m_window->GetSize() },
+        .renderArea = area,
         .layerCount = 1,
         .colorAttachmentCount = 1,
         .pColorAttachments = &attachmentInfo
     };
 
     vkCmdBeginRendering( cmdbuf, &renderingInfo );
+    vkCmdSetScissor( cmdbuf, 0, 1, &area );
     {
         std::lock_guard lock( m_lock );
         ZoneVk( *m_device, cmdbuf, "Viewport", true );
         m_background->Render( cmdbuf, m_window->GetSize() );
-        if( m_view->HasBitmap() )
+        if( m_gridMode )
+        {
+            m_grid->Render( cmdbuf, m_window->GetSize() );
+        }
+        else if( m_view->HasBitmap() )
         {
             m_view->Render( cmdbuf, m_window->GetSize() );
             if( m_selection->IsActive() )
@@ -368,6 +716,11 @@ bool Viewport::Render()
     vkCmdEndRendering( cmdbuf );
     m_window->EndFrame();
 
+    {
+        std::lock_guard lock( m_lock );
+        if( m_loadStats.state == LoadStats::State::Present ) FinishLoadStats();
+    }
+
     return true;
 }
 
@@ -387,6 +740,7 @@ void Viewport::Scale( uint32_t width, uint32_t height, uint32_t scale )
     m_view->unlock();
 
     std::lock_guard lock( m_lock );
+    m_grid->SetScale( normScale, m_window->GetSize() );
     m_render = true;
 }
 
@@ -400,6 +754,7 @@ void Viewport::Resize( uint32_t width, uint32_t height )
     m_view->unlock();
 
     std::lock_guard lock( m_lock );
+    m_grid->Resize( m_window->GetSize() );
     m_render = true;
 }
 
@@ -417,6 +772,7 @@ void Viewport::FormatChange( VkFormat format )
     m_view->unlock();
 
     std::lock_guard lock( m_lock );
+    m_grid->FormatChange( format );
     m_render = true;
 }
 
@@ -471,14 +827,18 @@ void Viewport::Drop( int fd, const char* mime )
             }
             else
             {
-                SetFileList( std::move( files ), files[0] );
+                std::lock_guard lock( m_lock );
+                SetFileList( PathList( files ), files[0] );
                 LoadImage( files[0].c_str(), false );
             }
         }
     }
     else if( strcmp( mime, "image/png" ) == 0 )
     {
-        m_fileList.clear();
+        std::lock_guard lock( m_lock );
+        m_scanGeneration++;
+        m_fileList.Clear();
+        FileListChanged();
         LoadImage( fd, m_loadOrigin.c_str(), fd + 1 );
     }
     else
@@ -489,13 +849,13 @@ void Viewport::Drop( int fd, const char* mime )
     m_loadOrigin.clear();
 }
 
-static void SaveImage( const char* path, ImageType type, const std::shared_ptr<Texture>& tex, VlkDevice& device, TaskDispatch* td )
+static void SaveImage( const char* path, ImageType type, const std::shared_ptr<Texture>& tex, VlkDevice& device, TaskDispatch* td, ToneMap::Operator op )
 {
     const auto format = tex->Format();
 
     if( type == ImageType::Exr )
     {
-        CheckPanic( format == HdrFormat, "Saving EXR, but texture is not HDR!" );
+        CheckPanic( IsHdrFormat( format ), "Saving EXR, but texture is not HDR!" );
         auto bmp = tex->ReadbackHdr( device );
         bmp->SetColorspace( Colorspace::BT709, td );
         bmp->SaveExr( path );
@@ -512,10 +872,10 @@ static void SaveImage( const char* path, ImageType type, const std::shared_ptr<T
         auto half = tex->ReadbackHdr( device );
         half->SetColorspace( Colorspace::BT709, td );
         auto hdr = std::make_shared<BitmapHdr>( *half );
-        bmp = hdr->Tonemap( ToneMap::Operator::PbrNeutral );
+        bmp = hdr->Tonemap( op, td );
     }
 
-    bmp->SavePng( path );
+    bmp->SavePng( path, td );
 }
 
 void Viewport::KeyEvent( uint32_t key, int mods, bool pressed )
@@ -525,6 +885,8 @@ void Viewport::KeyEvent( uint32_t key, int mods, bool pressed )
     ZoneScoped;
     ZoneValue( key );
 
+    if( GridKeyEvent( key, mods ) ) return;
+
     if( mods & CtrlBit && key == KEY_V )
     {
         PasteClipboard();
@@ -541,11 +903,29 @@ void Viewport::KeyEvent( uint32_t key, int mods, bool pressed )
     {
         auto tex = m_view->GetTexture();
         if( !tex ) return;
+        if( tex->IsCompressed() )
+        {
+            mclog( LogLevel::Error, "Block compressed images can't be saved" );
+            return;
+        }
+        m_view->lock();
+        const auto tiled = m_view->IsTiled();
+        m_view->unlock();
+        if( tiled )
+        {
+            mclog( LogLevel::Error, "Tiled images can't be saved" );
+            return;
+        }
+        if( IsPreview() )
+        {
+            mclog( LogLevel::Error, "Image is still loading" );
+            return;
+        }
 
         std::vector<nfdu8filteritem_t> filters = {
             nfdu8filteritem_t { "PNG image", "*.png" },
         };
-        const auto isHdr = tex->Format() == HdrFormat;
+        const auto isHdr = IsHdrFormat( tex->Format() );
         if( isHdr ) filters.emplace_back( nfdu8filteritem_t { "EXR image", "*.exr" } );
         nfdsavedialogu8args_t args = {
             .filterList = filters.data(),
@@ -573,7 +953,7 @@ void Viewport::KeyEvent( uint32_t key, int mods, bool pressed )
                 type = ImageType::Png;
             }
 
-            SaveImage( str.c_str(), type, tex, *m_device, m_td.get() );
+            SaveImage( str.c_str(), type, tex, *m_device, m_td.get(), m_tonemap );
         }
     }
     else if( key == KEY_F )
@@ -658,32 +1038,125 @@ void Viewport::KeyEvent( uint32_t key, int mods, bool pressed )
     {
         Close();
     }
+    else if( mods == 0 && key == KEY_P )
+    {
+        std::lock_guard lock( m_lock );
+        m_showPresentStats = !m_showPresentStats;
+        m_updateTitle = true;
+        WantRender();
+    }
+    else if( mods == 0 && key == KEY_I )
+    {
+        std::lock_guard lock( m_lock );
+        m_showLoadStats = !m_showLoadStats;
+        m_updateTitle = true;
+        WantRender();
+    }
     else if( mods == 0 && key == KEY_RIGHT )
     {
-        if( m_fileList.size() > 1 )
+        std::lock_guard lock( m_lock );
+        if( m_fileList.Size() > 1 )
         {
-            m_fileIndex = ( m_fileIndex + 1 ) % m_fileList.size();
-            LoadImage( m_fileList[m_fileIndex].c_str(), false );
+            m_fileIndex = ( m_fileIndex + 1 ) % m_fileList.Size();
+            LoadImage( m_fileList.Path( m_fileIndex ).c_str(), false );
         }
     }
     else if( mods == 0 && key == KEY_LEFT )
     {
-        if( m_fileList.size() > 1 )
+        std::lock_guard lock( m_lock );
+        if( m_fileList.Size() > 1 )
         {
-            m_fileIndex = ( m_fileIndex + m_fileList.size() - 1 ) % m_fileList.size();
-            LoadImage( m_fileList[m_fileIndex].c_str(), false );
+            m_fileIndex = ( m_fileIndex + m_fileList.Size() - 1 ) % m_fileList.Size();
+            LoadImage( m_fileList.Path( m_fileIndex ).c_str(), false );
         }
     }
     else if( mods == 0 && key == KEY_H )
     {
         if( m_window->HdrCapable() )
         {
+            std::lock_guard lock( m_lock );
             m_hdr = !m_hdr;
-            if( !m_fileList.empty() ) LoadImage( m_fileList[m_fileIndex].c_str(), false );
+            ClearCache();
+            if( !m_fileList.Empty() ) LoadImage( m_fileList.Path( m_fileIndex ).c_str(), false );
             m_updateTitle = true;
             WantRender();
         }
     }
+    else if( mods == 0 && key == KEY_E )
+    {
+        std::unique_lock viewLock( *m_view );
+        const auto enable = !m_view->GetAutoExposure();
+        m_view->SetAutoExposure( enable );
+        viewLock.unlock();
+        mclog( LogLevel::Info, "Auto exposure: %s", enable ? "on" : "off" );
+
+        std::lock_guard lock( m_lock );
+        WantRender();
+    }
+    else if( ( mods == 0 || mods == ShiftBit ) && key == KEY_C )
+    {
+        // The shown image becomes the reference which the next ones are compared against. Switching between the
+        // modes keeps it.
+        const auto mode = mods == ShiftBit ? ImageView::CompareMode::Flicker : ImageView::CompareMode::SideBySide;
+        auto tex = m_view->GetTexture();
+        std::unique_lock viewLock( *m_view );
+        if( m_view->IsComparing() && m_view->GetCompareMode() == mode )
+        {
+            m_view->SetCompare( nullptr, mode, m_window->GetSize() );
+            viewLock.unlock();
+            mclog( LogLevel::Info, "Compare: off" );
+        }
+        else
+        {
+            if( m_view->IsComparing() )
+            {
+                tex = m_view->GetCompare();
+            }
+            else if( !tex || m_view->IsTiled() )
+            {
+                viewLock.unlock();
+                if( tex ) mclog( LogLevel::Error, "Tiled images can't be compared" );
+                return;
+            }
+            m_view->SetCompare( std::move( tex ), mode, m_window->GetSize() );
+            viewLock.unlock();
+            mclog( LogLevel::Info, "Compare: %s", mode == ImageView::CompareMode::Flicker ? "flicker" : "side by side" );
+        }
+
+        std::lock_guard lock( m_lock );
+        WantRender();
+    }
+    else if( mods == 0 && key == KEY_SPACE )
+    {
+        std::unique_lock viewLock( *m_view );
+        if( !m_view->IsComparing() || m_view->GetCompareMode() != ImageView::CompareMode::Flicker ) return;
+        m_view->FlipCompare();
+        viewLock.unlock();
+
+        std::lock_guard lock( m_lock );
+        WantRender();
+    }
+    else if( mods == 0 && key == KEY_T )
+    {
+        switch( m_tonemap )
+        {
+        case ToneMap::Operator::PbrNeutral: m_tonemap = ToneMap::Operator::AgX; break;
+        case ToneMap::Operator::AgX: m_tonemap = ToneMap::Operator::AgXGolden; break;
+        case ToneMap::Operator::AgXGolden: m_tonemap = ToneMap::Operator::AgXPunchy; break;
+        default: m_tonemap = ToneMap::Operator::PbrNeutral; break;
+        }
+        constexpr const char* names[] = { "AgX", "AgX Golden", "AgX Punchy", "PBR Neutral" };
+        mclog( LogLevel::Info, "Tone mapping operator: %s", names[(int)m_tonemap] );
+
+        // Images too large to be tone mapped on the GPU keep the operator they were loaded with
+        m_provider->SetTonemap( m_tonemap );
+        std::unique_lock viewLock( *m_view );
+        m_view->SetTonemap( m_tonemap );
+        viewLock.unlock();
+
+        std::lock_guard lock( m_lock );
+        WantRender();
+    }
 }
 
 void Viewport::MouseEnter( float x, float y )
@@ -729,6 +1202,23 @@ void Viewport::MouseMove( float x, float y )
 
 void Viewport::MouseButton( uint32_t button, bool pressed )
 {
+    {
+        std::lock_guard lock( m_lock );
+        if( m_gridMode )
+        {
+            if( button == BTN_LEFT && pressed )
+            {
+                const auto item = m_grid->ItemAt( m_mousePos.x, m_mousePos.y );
+                if( item >= 0 )
+                {
+                    m_grid->Select( item );
+                    OpenGridSelection();
+                }
+            }
+            return;
+        }
+    }
+
     if( button == BTN_LEFT && ( !m_imageDrag || ( m_selectionDrag && !pressed ) ) )
     {
         std::lock_guard lock( *m_view );
@@ -754,6 +1244,17 @@ void Viewport::MouseButton( uint32_t button, bool pressed )
 
 void Viewport::Scroll( const WaylandScroll& scroll )
 {
+    {
+        std::lock_guard lock( m_lock );
+        if( m_gridMode )
+        {
+            // A wheel step is 15 units
+            m_grid->Scroll( scroll.source == WaylandScroll::Source::Wheel ? scroll.delta.y * 4 : scroll.delta.y );
+            WantRender();
+            return;
+        }
+    }
+
     if( scroll.delta.y != 0 )
     {
         std::unique_lock viewLock( *m_view );
@@ -825,84 +1326,199 @@ void Viewport::SetMousePointer()
     }
 }
 
-bool Viewport::SendClipboard( const char* mimeType, int32_t fd )
+// Encoded clipboard data, kept in a memfd for the lifetime of the offer. If the encoder only appends to the file,
+// receivers are sent what has been written so far while it is still running.
+struct Viewport::ClipboardPayload
+{
+    ClipboardPayload( int fd, bool stream ) : fd( fd ), stream( stream ) {}
+    ~ClipboardPayload() { close( fd ); }
+
+    void Finish( bool success )
+    {
+        std::lock_guard lock( this->lock );
+        done = true;
+        ok = success;
+        cv.notify_all();
+    }
+
+    [[nodiscard]] bool Failed()
+    {
+        std::lock_guard lock( this->lock );
+        return done && !ok;
+    }
+
+    // Copies the encoded data to the target, waiting for the encoder if it has not finished yet
+    void Send( int target )
+    {
+        ZoneScoped;
+        off_t offset = 0;
+        for(;;)
+        {
+            bool finished;
+            {
+                std::unique_lock lock( this->lock );
+                if( !stream ) cv.wait( lock, [this] { return done; } );
+                finished = done;
+                if( done && !ok ) return;
+            }
+
+            struct stat st;
+            if( fstat( fd, &st ) != 0 ) return;
+            while( offset < st.st_size )
+            {
+                const auto sent = sendfile( target, fd, &offset, st.st_size - offset );
+                if( sent < 0 && errno == EINTR ) continue;
+                if( sent <= 0 ) return;
+            }
+            if( finished ) return;
+
+            std::unique_lock lock( this->lock );
+            cv.wait_for( lock, std::chrono::milliseconds( 5 ), [this] { return done; } );
+        }
+    }
+
+    int fd;
+    bool stream;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool done = false;
+    bool ok = false;
+};
+
+std::shared_ptr<Viewport::ClipboardPayload> Viewport::EncodeClipboard( const char* mimeType )
 {
-    if( !m_clipboard ) return false;
     ZoneScoped;
 
-    if( strcmp( mimeType, "image/png" ) == 0 )
+    const auto png = strcmp( mimeType, "image/png" ) == 0;
+    if( !png && strcmp( mimeType, "image/x-exr" ) != 0 )
+    {
+        mclog( LogLevel::Error, "Unsupported clipboard format: %s", mimeType );
+        return nullptr;
+    }
+    if( !png && !IsHdrFormat( m_clipboard->Format() ) )
+    {
+        mclog( LogLevel::Error, "Format %s requested but clipboard contains SDR image.", mimeType );
+        return nullptr;
+    }
+
+    const auto fd = memfd_create( "iv-clipboard", MFD_CLOEXEC );
+    if( fd < 0 )
+    {
+        mclog( LogLevel::Error, "Failed to create clipboard buffer: %s", strerror( errno ) );
+        return nullptr;
+    }
+    // OpenEXR seeks back to write the offset tables, so that file can only be sent once it is complete
+    auto payload = std::make_shared<ClipboardPayload>( fd, png );
+
+    // The encoding threads don't use the worker pool, as they may outlive the viewport while the receiver is slow
+    // to read. PNG strips are written as they are compressed, so the receiver gets data right away.
+    if( png )
     {
+        // Only the selection is read back, so the colour conversion is done on that part alone
         std::shared_ptr<Bitmap> bmp;
         if( m_clipboard->Format() == SdrFormat )
         {
-            bmp = m_clipboard->ReadbackSdr( *m_device );
+            bmp = m_clipboard->ReadbackSdr( *m_device, m_clipboardClip );
         }
         else
         {
-            auto half = m_clipboard->ReadbackHdr( *m_device );
+            auto half = m_clipboard->ReadbackHdr( *m_device, m_clipboardClip );
             half->SetColorspace( Colorspace::BT709, m_td.get() );
             auto hdr = std::make_shared<BitmapHdr>( *half );
-            bmp = hdr->Tonemap( ToneMap::Operator::PbrNeutral );
+            bmp = hdr->Tonemap( m_tonemap, m_td.get() );
         }
 
-        if( m_clipboardClip.offset.x != 0 || m_clipboardClip.offset.y != 0 ||
-            m_clipboardClip.extent.width != bmp->Width() || m_clipboardClip.extent.height != bmp->Height() )
-        {
-            bmp->Crop( m_clipboardClip.offset.x, m_clipboardClip.offset.y, m_clipboardClip.extent.width, m_clipboardClip.extent.height );
-        }
-
-        std::thread thread( [bmp = std::move( bmp ), fd]() {
+        std::thread thread( [bmp = std::move( bmp ), payload]() {
             ZoneScoped;
-            signal( SIGPIPE, SIG_IGN );
-            bmp->SavePng( fd );
-            close( fd );
+            payload->Finish( bmp->SavePng( payload->fd, {}, nullptr, Bitmap::PngCompression::Fast ) );
         } );
         thread.detach();
     }
-    else if( strcmp( mimeType, "image/x-exr" ) == 0 )
+    else
     {
-        if( m_clipboard->Format() != HdrFormat )
-        {
-            mclog( LogLevel::Error, "Format %s requested but clipboard contains SDR image.", mimeType );
-            return false;
-        }
-
-        auto bmp = m_clipboard->ReadbackHdr( *m_device );
+        auto bmp = m_clipboard->ReadbackHdr( *m_device, m_clipboardClip );
         bmp->SetColorspace( Colorspace::BT709, m_td.get() );
 
-        if( m_clipboardClip.offset.x != 0 || m_clipboardClip.offset.y != 0 ||
-            m_clipboardClip.extent.width != bmp->Width() || m_clipboardClip.extent.height != bmp->Height() )
-        {
-            bmp->Crop( m_clipboardClip.offset.x, m_clipboardClip.offset.y, m_clipboardClip.extent.width, m_clipboardClip.extent.height );
-        }
-
-        std::thread thread( [bmp = std::move( bmp ), fd]() {
+        std::thread thread( [bmp = std::move( bmp ), payload]() {
             ZoneScoped;
-            signal( SIGPIPE, SIG_IGN );
-            bmp->SaveExr( fd );
-            close( fd );
+            payload->Finish( bmp->SaveExr( payload->fd ) );
         } );
         thread.detach();
     }
-    else
-    {
-        mclog( LogLevel::Error, "Unsupported clipboard format: %s", mimeType );
-        return false;
-    }
-
-    return true;
-}
 
-void Viewport::CancelClipboard()
-{
-    m_clipboard.reset();
+    return payload;
 }
 
-bool Viewport::CopyToClipboard()
+bool Viewport::SendClipboard( const char* mimeType, int32_t fd )
 {
-    m_clipboard = m_view->GetTexture();
     if( !m_clipboard ) return false;
+    ZoneScoped;
+
+    // Some receivers ask for the same type several times, these are served from the already encoded data
+    auto it = m_clipboardPayloads.find( mimeType );
+    if( it != m_clipboardPayloads.end() && it->second->Failed() )
+    {
+        m_clipboardPayloads.erase( it );
+        it = m_clipboardPayloads.end();
+    }
+    if( it == m_clipboardPayloads.end() )
+    {
+        auto payload = EncodeClipboard( mimeType );
+        if( !payload ) return false;
+        it = m_clipboardPayloads.emplace( mimeType, std::move( payload ) ).first;
+    }
+    else
+    {
+        mclog( LogLevel::Debug, "Sending cached clipboard data for %s", mimeType );
+    }
+
+    std::thread thread( [payload = it->second, fd]() {
+        signal( SIGPIPE, SIG_IGN );
+        payload->Send( fd );
+        close( fd );
+    } );
+    thread.detach();
+
+    return true;
+}
+
+bool Viewport::IsPreview()
+{
+    std::lock_guard lock( m_lock );
+    return m_preview;
+}
+
+void Viewport::CancelClipboard()
+{
+    m_clipboard.reset();
+    m_clipboardPayloads.clear();
+}
+
+bool Viewport::CopyToClipboard()
+{
+    if( IsPreview() )
+    {
+        mclog( LogLevel::Error, "Image is still loading" );
+        return false;
+    }
+
+    m_clipboardPayloads.clear();
+    m_clipboard = m_view->GetTexture();
+    if( !m_clipboard ) return false;
+    if( m_clipboard->IsCompressed() )
+    {
+        mclog( LogLevel::Error, "Block compressed images can't be copied" );
+        m_clipboard.reset();
+        return false;
+    }
     m_view->lock();
+    if( m_view->IsTiled() )
+    {
+        m_view->unlock();
+        mclog( LogLevel::Error, "Tiled images can't be copied" );
+        m_clipboard.reset();
+        return false;
+    }
     m_clipboardClip = m_selection->GetSelection();
     m_view->unlock();
 
@@ -934,52 +1550,119 @@ void Viewport::CutSelection()
 
     const auto sel = m_clipboardClip;
 
-    if( m_clipboard->Format() == SdrFormat )
+    // The clipboard gets a copy of the selection, the shown texture is then filled in place
+    if( m_clipboard->CanEdit( *m_device ) )
+    {
+        auto texture = m_clipboard;
+        std::vector<std::shared_ptr<VlkFence>> fences;
+        m_clipboard = std::make_shared<Texture>( *m_device, *texture, sel, fences );
+        m_clipboardClip = { {}, sel.extent };
+        texture->FillBlack( *m_device, sel, fences );
+        m_view->TextureEdited();
+    }
+    else if( m_clipboard->Format() == SdrFormat )
     {
         auto bmp = m_clipboard->ReadbackSdr( *m_device );
-        bmp->FillBlack( sel.offset.x, sel.offset.y, sel.extent.width, sel.extent.height );
+        bmp->FillBlack( sel.offset.x, sel.offset.y, sel.extent.width, sel.extent.height, m_td.get() );
         m_view->SetBitmap( bmp, *m_td, false );
     }
     else
     {
         auto half = m_clipboard->ReadbackHdr( *m_device );
-        half->FillBlack( sel.offset.x, sel.offset.y, sel.extent.width, sel.extent.height );
-        auto hdr = std::make_shared<BitmapHdr>( *half );
-        m_view->SetBitmap( hdr, *m_td, false );
+        half->FillBlack( sel.offset.x, sel.offset.y, sel.extent.width, sel.extent.height, m_td.get() );
+        m_view->SetBitmap( half, *m_td, false );
     }
 
     std::lock_guard lock( m_lock );
     WantRender();
 }
 
+void Viewport::EnableHdr( bool hdrImage )
+{
+    // Switching the swapchain format rebuilds every pipeline. In sticky mode SDR images are mapped to SDR white
+    // on the PQ output instead, so that browsing a mix of SDR and HDR images keeps a single swapchain.
+    const bool capable = m_hdr && m_window->HdrCapable();
+    const bool hdr = capable && ( hdrImage || ( m_stickyHdr && m_hdrOutput ) );
+    m_hdrOutput = hdr;
+    m_window->EnableHdr( hdr );
+}
+
 void Viewport::ImageHandler( int64_t id, ImageProvider::Result result, const ImageProvider::ReturnData& data )
 {
     ZoneScoped;
     ZoneTextF( "id %ld, result %d", id, result );
 
-    if( data.flags.dndFd != 0 ) m_window->FinishDnd( data.flags.dndFd - 1 );
+    m_lock.lock();
+    const auto prefetch = FindCached( id ) != m_cache.end();
+    m_lock.unlock();
+    if( prefetch )
+    {
+        PrefetchHandler( id, result, data );
+        return;
+    }
 
-    if( result == ImageProvider::Result::Success )
+    const auto preview = result == ImageProvider::Result::Preview;
+    if( data.flags.dndFd != 0 && !preview ) m_window->FinishDnd( data.flags.dndFd - 1 );
+
+    if( result == ImageProvider::Result::Success || preview )
     {
         uint32_t width, height;
-        if( data.bitmap )
+        std::shared_ptr<Texture> texture;
+        const auto buildStart = GetTimeMicro();
+        if( data.bitmapCompressed )
+        {
+            // must not lock m_view here
+            texture = m_view->SetBitmap( data.bitmapCompressed );
+            width = data.bitmapCompressed->Width();
+            height = data.bitmapCompressed->Height();
+            EnableHdr( false );
+        }
+        else if( data.bitmapYuv )
         {
             // must not lock m_view here
-            m_view->SetBitmap( data.bitmap, *m_td, true );
+            texture = m_view->SetBitmap( data.bitmapYuv );
+            width = data.bitmapYuv->Width();
+            height = data.bitmapYuv->Height();
+            EnableHdr( false );
+        }
+        else if( data.bitmapDct )
+        {
+            // must not lock m_view here
+            texture = m_view->SetBitmap( data.bitmapDct );
+            width = data.bitmapDct->Width();
+            height = data.bitmapDct->Height();
+            EnableHdr( false );
+        }
+        else if( data.pyramid )
+        {
+            // must not lock m_view here
+            texture = m_view->SetPyramid( data.pyramid, *m_td );
+            width = data.pyramid->Width( 0 );
+            height = data.pyramid->Height( 0 );
+            EnableHdr( false );
+        }
+        else if( data.bitmap )
+        {
+            // must not lock m_view here
+            if( data.stream ) texture = m_view->SetStreamed( data.bitmap, *data.stream );
+            if( !texture ) texture = m_view->SetBitmap( data.bitmap, *m_td, true );
+            if( data.anim ) m_view->SetAnimation( data.anim, data.frameDelay );
             width = data.bitmap->Width();
             height = data.bitmap->Height();
-            m_window->EnableHdr( false );
+            EnableHdr( false );
         }
         else
         {
             // must not lock m_view here
-            m_view->SetBitmap( data.bitmapHdr, *m_td, true );
+            texture = m_view->SetBitmap( data.bitmapHdr, *m_td, true );
             width = data.bitmapHdr->Width();
             height = data.bitmapHdr->Height();
-            m_window->EnableHdr( true );
+            EnableHdr( true );
         }
+        const auto buildEnd = GetTimeMicro();
 
         m_lock.lock();
+        m_preview = preview;
         if( data.origin.empty() )
         {
             m_origin = "Untitled";
@@ -989,6 +1672,20 @@ void Viewport::ImageHandler( int64_t id, ImageProvider::Result result, const Ima
             m_origin = data.origin.substr( data.origin.find_last_of( '/' ) + 1 );
             if( m_origin.empty() ) m_origin = "Untitled";
         }
+        if( !preview && m_currentJob == id )
+        {
+            KeepShown( data, texture );
+            m_loadStats = {
+                .timeline = data.timeline,
+                .origin = data.origin,
+                .texture = texture,
+                .width = width,
+                .height = height,
+                .uploadStart = buildEnd,
+                .build = uint32_t( buildEnd - buildStart ),
+                .state = LoadStats::State::Upload
+            };
+        }
         m_updateTitle = true;
         WantRender();
     }
@@ -997,7 +1694,7 @@ void Viewport::ImageHandler( int64_t id, ImageProvider::Result result, const Ima
         m_lock.lock();
     }
 
-    if( m_currentJob == id )
+    if( m_currentJob == id && !preview )
     {
         m_currentJob = -1;
         m_isBusy = false;
@@ -1005,6 +1702,558 @@ void Viewport::ImageHandler( int64_t id, ImageProvider::Result result, const Ima
         WantRender();
     }
     m_lock.unlock();
+
+    if( result == ImageProvider::Result::Success && !preview )
+    {
+        const auto vma = m_device->GetMemoryStatistics();
+        mclog( LogLevel::Debug, "VMA: %u allocations, %.1f MiB in %u blocks, %.1f MiB; %s", vma.allocations, vma.allocationBytes / ( 1024.f * 1024.f ), vma.blocks, vma.blockBytes / ( 1024.f * 1024.f ), MemoryStats::Current().Format().c_str() );
+    }
+    if( result == ImageProvider::Result::Success ) CompressCached( data );
+}
+
+void Viewport::PrefetchHandler( int64_t id, ImageProvider::Result result, const ImageProvider::ReturnData& data )
+{
+    ZoneScoped;
+
+    // The upload runs at the priority of the load, and without the lock, so that browsing is not held up by it
+    CachedImage image = { .id = -1, .hdr = false, .lastUse = 0 };
+    if( result == ImageProvider::Result::Success )
+    {
+        if( data.bitmapCompressed )
+        {
+            image.texture = m_view->CreateTexture( *data.bitmapCompressed );
+            image.width = data.bitmapCompressed->Width();
+            image.height = data.bitmapCompressed->Height();
+        }
+        else if( data.bitmapYuv )
+        {
+            image.texture = m_view->CreateTexture( *data.bitmapYuv );
+            image.width = data.bitmapYuv->Width();
+            image.height = data.bitmapYuv->Height();
+        }
+        else if( data.bitmapDct )
+        {
+            image.texture = m_view->CreateTexture( *data.bitmapDct );
+            image.width = data.bitmapDct->Width();
+            image.height = data.bitmapDct->Height();
+        }
+        else if( data.pyramid )
+        {
+            image.pyramid = data.pyramid;
+            image.width = data.pyramid->Width( 0 );
+            image.height = data.pyramid->Height( 0 );
+        }
+        else if( data.bitmap )
+        {
+            image.texture = m_view->CreateTexture( *data.bitmap, *m_td );
+            if( !image.texture ) image.bitmap = data.bitmap;
+            image.anim = data.anim;
+            image.frameDelay = data.frameDelay;
+            image.width = data.bitmap->Width();
+            image.height = data.bitmap->Height();
+        }
+        else
+        {
+            image.texture = m_view->CreateTexture( *data.bitmapHdr, *m_td );
+            image.width = data.bitmapHdr->Width();
+            image.height = data.bitmapHdr->Height();
+            image.hdr = true;
+        }
+    }
+
+    std::unique_lock lock( m_lock );
+    auto it = FindCached( id );
+    if( it == m_cache.end() ) return;
+
+    const auto current = m_currentJob == id;
+    if( result == ImageProvider::Result::Success )
+    {
+        image.path = std::move( it->path );
+        image.mtime = data.mtime;
+        if( current ) image.lastUse = ++m_cacheTick;
+        *it = image;
+        if( current )
+        {
+            lock.unlock();
+            ShowImage( image );
+            lock.lock();
+        }
+    }
+    else
+    {
+        m_cache.erase( it );
+    }
+
+    if( current && m_currentJob == id )
+    {
+        m_currentJob = -1;
+        m_isBusy = false;
+        m_window->SetCursor( WaylandCursor::Default );
+        WantRender();
+    }
+
+    lock.unlock();
+    if( result == ImageProvider::Result::Success ) CompressCached( data );
+}
+
+// The grid shares the file list with the image view. Leaving it shows the selected image.
+void Viewport::ShowGrid( bool show )
+{
+    std::lock_guard lock( m_lock );
+    if( show == m_gridMode ) return;
+    if( show && m_fileList.Size() < 2 ) return;
+
+    m_gridMode = show;
+    if( show )
+    {
+        m_grid->SetFiles( m_fileList, m_fileIndex );
+    }
+    else
+    {
+        m_grid->Clear();
+    }
+    WantRender();
+}
+
+// Keys which are not handled here keep their image view meaning, e.g. fullscreen or saving the current image
+bool Viewport::GridKeyEvent( uint32_t key, int mods )
+{
+    std::lock_guard lock( m_lock );
+    if( !m_gridMode )
+    {
+        if( mods != 0 || key != KEY_G ) return false;
+        ShowGrid( true );
+        return true;
+    }
+    if( mods != 0 ) return false;
+
+    bool changed;
+    switch( key )
+    {
+    case KEY_LEFT: changed = m_grid->Move( -1 ); break;
+    case KEY_RIGHT: changed = m_grid->Move( 1 ); break;
+    case KEY_UP: changed = m_grid->MoveRows( -1 ); break;
+    case KEY_DOWN: changed = m_grid->MoveRows( 1 ); break;
+    case KEY_PAGEUP: changed = m_grid->MovePages( -1 ); break;
+    case KEY_PAGEDOWN: changed = m_grid->MovePages( 1 ); break;
+    case KEY_HOME: changed = m_grid->Select( 0 ); break;
+    case KEY_END: changed = m_grid->Select( m_fileList.Size() - 1 ); break;
+    case KEY_ENTER:
+    case KEY_KPENTER:
+        OpenGridSelection();
+        return true;
+    case KEY_G:
+    case KEY_ESC:
+        ShowGrid( false );
+        return true;
+    default:
+        return false;
+    }
+    if( changed ) WantRender();
+    return true;
+}
+
+void Viewport::OpenGridSelection()
+{
+    std::lock_guard lock( m_lock );
+    const auto selected = m_grid->GetSelected();
+    ShowGrid( false );
+    if( selected != m_fileIndex && selected < m_fileList.Size() )
+    {
+        m_fileIndex = selected;
+        LoadImage( m_fileList.Path( m_fileIndex ).c_str(), false );
+    }
+    m_updateTitle = true;
+}
+
+// Called from the thumbnail loading jobs
+void Viewport::ThumbnailReady()
+{
+    std::lock_guard lock( m_lock );
+    if( m_gridMode ) WantRender();
+}
+
+// The grid follows the file list, e.g. when a directory scan completes. Without a list there is nothing to show.
+void Viewport::FileListChanged()
+{
+    if( !m_gridMode ) return;
+    if( m_fileList.Size() < 2 )
+    {
+        ShowGrid( false );
+        return;
+    }
+    m_grid->SetFiles( m_fileList, m_fileIndex );
+    WantRender();
+}
+
+void Viewport::ShowImage( const CachedImage& image )
+{
+    ZoneScoped;
+
+    // must not lock m_view here
+    std::shared_ptr<Texture> restored;
+    if( image.texture )
+    {
+        m_selection->AbortDrag();
+        m_view->SetTexture( image.texture, image.width, image.height, true );
+    }
+    else if( image.pyramid )
+    {
+        m_view->SetPyramid( image.pyramid, *m_td );
+    }
+    else if( image.bitmap )
+    {
+        m_view->SetBitmap( image.bitmap, *m_td, true );
+    }
+    else if( image.hdr )
+    {
+        restored = m_view->SetBitmap( std::shared_ptr<BitmapHdrHalf>( image.lz4->ToBitmapHdrHalf( m_td.get() ) ), *m_td, true );
+    }
+    else
+    {
+        restored = m_view->SetBitmap( std::shared_ptr<Bitmap>( image.lz4->ToBitmap( m_td.get() ) ), *m_td, true );
+    }
+    if( image.anim ) m_view->SetAnimation( image.anim, image.frameDelay );
+    EnableHdr( image.hdr );
+
+    std::lock_guard lock( m_lock );
+    if( restored )
+    {
+        // Back from the compressed tier, the image is cached with a texture again
+        auto it = FindCached( image.path );
+        if( it != m_cache.end() && it->lz4 == image.lz4 ) it->texture = std::move( restored );
+        TrimCache();
+    }
+    m_preview = false;
+    m_origin = image.path.substr( image.path.find_last_of( '/' ) + 1 );
+    if( m_origin.empty() ) m_origin = "Untitled";
+    m_updateTitle = true;
+    WantRender();
+}
+
+// Runs without the lock, once the image is cached, so that neither showing it nor browsing waits for it. Only
+// images with a texture get a copy. Tiled ones keep their bitmap, and images uploaded in the Gpu formats are
+// cheaper to load again than to read back.
+void Viewport::CompressCached( const ImageProvider::ReturnData& data )
+{
+    if( m_cacheLz4 == 0 || ( !data.bitmap && !data.bitmapHdr ) ) return;
+
+    const auto wanted = [this, &data] {
+        auto it = FindCached( data.origin );
+        return it != m_cache.end() && it->id == -1 && it->texture && !it->lz4 ? it : m_cache.end();
+    };
+    {
+        std::lock_guard lock( m_lock );
+        if( wanted() == m_cache.end() ) return;
+    }
+
+    std::shared_ptr<BitmapLz4> lz4;
+    if( data.bitmap )
+    {
+        lz4 = std::make_shared<BitmapLz4>( *data.bitmap, m_td.get() );
+    }
+    else
+    {
+        lz4 = std::make_shared<BitmapLz4>( *data.bitmapHdr, m_td.get() );
+    }
+
+    std::lock_guard lock( m_lock );
+    auto it = wanted();
+    if( it == m_cache.end() ) return;
+    it->lz4 = std::move( lz4 );
+    TrimCache();
+}
+
+// Tiled images have no texture to wait for. Without anyone asking for the statistics, the upload is only checked
+// on frames which are drawn anyway.
+void Viewport::UpdateLoadStats()
+{
+    if( m_loadStats.state != LoadStats::State::Upload ) return;
+    const auto texture = m_loadStats.texture.lock();
+    if( !texture || texture->IsReady( *m_device ) )
+    {
+        m_loadStats.upload = uint32_t( GetTimeMicro() - m_loadStats.uploadStart );
+        m_loadStats.state = LoadStats::State::Present;
+        m_render = true;
+    }
+    else if( m_showLoadStats || m_printLoadStats || m_loadStatsJson )
+    {
+        m_render = true;
+    }
+}
+
+void Viewport::FinishLoadStats()
+{
+    auto& ls = m_loadStats;
+    const auto now = GetTimeMicro();
+    ls.present = uint32_t( now - ls.uploadStart - ls.upload );
+    ls.total = uint32_t( now - ls.timeline.start );
+    ls.state = LoadStats::State::Done;
+
+    if( m_printLoadStats )
+    {
+        printf( "%s\n", FormatLoadStats().c_str() );
+        fflush( stdout );
+    }
+    if( m_loadStatsJson )
+    {
+        const auto& t = ls.timeline;
+        fprintf( *m_loadStatsJson, "%s\n", std::format( R"({{"origin":"{}","width":{},"height":{},"queue":{},"open":{},"probe":{},"wait":{},"decode":{},"convert":{},"orientation":{},"compress":{},"preview":{},"texture":{},"upload":{},"present":{},"total":{},"peakMemory":{}}})",
+            JsonEscape( ls.origin ), ls.width, ls.height, t.queue, t.open, t.probe, t.wait, t.decode, t.convert, t.orientation, t.compress, t.preview, ls.build, ls.upload, ls.present, ls.total, t.peakMemory ).c_str() );
+        fflush( *m_loadStatsJson );
+    }
+    if( m_showLoadStats )
+    {
+        m_updateTitle = true;
+        WantRender();
+    }
+}
+
+std::string Viewport::FormatLoadStats() const
+{
+    const auto& ls = m_loadStats;
+    const auto& t = ls.timeline;
+    return std::format( "{} ({}×{}): {:.2f} ms - queue {:.2f}, open {:.2f}, probe {:.2f}, wait {:.2f}, decode {:.2f}, convert {:.2f}, orientation {:.2f}, compress {:.2f}, texture {:.2f}, upload {:.2f}, present {:.2f}",
+        ls.origin.empty() ? "Untitled" : ls.origin, ls.width, ls.height, ls.total / 1000.f, t.queue / 1000.f, t.open / 1000.f, t.probe / 1000.f, t.wait / 1000.f, t.decode / 1000.f, t.convert / 1000.f, t.orientation / 1000.f, t.compress / 1000.f, ls.build / 1000.f, ls.upload / 1000.f, ls.present / 1000.f );
+}
+
+// The shown image is kept like a prefetched one, so that going back to it does not load it again.
+void Viewport::KeepShown( const ImageProvider::ReturnData& data, const std::shared_ptr<Texture>& texture )
+{
+    if( m_fileList.Size() < 2 || !m_fileList.Is( m_fileIndex, data.origin ) ) return;
+
+    auto it = FindCached( data.origin );
+    if( it != m_cache.end() ) m_cache.erase( it );
+
+    CachedImage image = { .path = data.origin, .mtime = data.mtime, .id = -1, .hdr = data.bitmapHdr != nullptr, .lastUse = ++m_cacheTick };
+    if( data.bitmapCompressed )
+    {
+        image.width = data.bitmapCompressed->Width();
+        image.height = data.bitmapCompressed->Height();
+    }
+    else if( data.bitmapYuv )
+    {
+        image.width = data.bitmapYuv->Width();
+        image.height = data.bitmapYuv->Height();
+    }
+    else if( data.bitmapDct )
+    {
+        image.width = data.bitmapDct->Width();
+        image.height = data.bitmapDct->Height();
+    }
+    else if( data.pyramid )
+    {
+        image.width = data.pyramid->Width( 0 );
+        image.height = data.pyramid->Height( 0 );
+    }
+    else
+    {
+        image.width = data.bitmap ? data.bitmap->Width() : data.bitmapHdr->Width();
+        image.height = data.bitmap ? data.bitmap->Height() : data.bitmapHdr->Height();
+    }
+
+    // Tiled images are shown from the bitmap or the pyramid, the texture is only their overview
+    if( data.pyramid )
+    {
+        image.pyramid = data.pyramid;
+    }
+    else if( data.bitmap && m_view->NeedsTiling( image.width, image.height ) )
+    {
+        image.bitmap = data.bitmap;
+    }
+    else
+    {
+        if( !texture ) return;
+        image.texture = texture;
+        image.anim = data.anim;
+        image.frameDelay = data.frameDelay;
+    }
+    m_cache.emplace_back( std::move( image ) );
+    TrimCache();
+}
+
+// Indices of the current image and of its neighbours, nearest first.
+std::vector<size_t> Viewport::Neighbours() const
+{
+    std::vector<size_t> ret;
+    const auto size = m_fileList.Size();
+    if( size < 2 ) return ret;
+
+    ret.emplace_back( m_fileIndex );
+    for( int i=1; i<=m_prefetchCount; i++ )
+    {
+        for( auto idx : { ( m_fileIndex + i ) % size, ( m_fileIndex + size - i % size ) % size } )
+        {
+            if( std::ranges::find( ret, idx ) == ret.end() ) ret.emplace_back( idx );
+        }
+    }
+    return ret;
+}
+
+// Cancels the loads of images which are no longer neighbours of the current one and queues the missing ones.
+// Jobs are queued farthest first, as the provider loads the newest background job first.
+void Viewport::UpdatePrefetch()
+{
+    ZoneScoped;
+    std::lock_guard lock( m_lock );
+
+    const auto wanted = Neighbours();
+
+    // Cancelling a queued job calls the handler right away, so the entries are removed first
+    std::vector<int64_t> cancel;
+    std::erase_if( m_cache, [&]( const CachedImage& image ) {
+        if( image.id == -1 || image.id == m_currentJob ) return false;
+        if( std::ranges::any_of( wanted, [&]( size_t idx ) { return m_fileList.Is( idx, image.path ); } ) ) return false;
+        cancel.emplace_back( image.id );
+        return true;
+    } );
+    for( auto id : cancel ) m_provider->Cancel( id );
+
+    const auto hdr = m_hdr && m_window->HdrCapable();
+    PathList queued( m_fileList.Prefix() );
+    for( auto it = wanted.rbegin(); it != wanted.rend(); ++it )
+    {
+        const auto path = m_fileList.Path( *it );
+        if( *it == m_fileIndex || FindCached( path ) != m_cache.end() ) continue;
+
+        const auto id = m_provider->LoadImage( path.c_str(), hdr, Method( ImageHandler ), this, { .background = true } );
+        m_cache.emplace_back( CachedImage { .path = path, .id = id } );
+        queued.Add( m_fileList.NameView( *it ) );
+    }
+
+    // The provider works on a few images at a time, the files of the others are read ahead while they wait
+    if( queued.Size() > 1 )
+    {
+        TaskDispatch::ScopedPriority priority( TaskDispatch::Priority::Background );
+        m_td->Queue( *m_scanJobs, [queued = std::move( queued )] { FileBatch::Prefetch( queued ); } );
+    }
+
+    TrimCache();
+}
+
+// Evicts the least recently shown images until the cache fits the memory limits. Pending loads and the
+// neighbours of the current image are kept regardless.
+void Viewport::TrimCache()
+{
+    ZoneScoped;
+    std::lock_guard lock( m_lock );
+
+    const auto keep = Neighbours();
+    const auto pinned = [&]( const CachedImage& image ) {
+        return image.id != -1 || std::ranges::any_of( keep, [&]( size_t idx ) { return m_fileList.Is( idx, image.path ); } );
+    };
+    const auto vramSize = []( const CachedImage& image ) { return image.texture ? uint64_t( image.texture->MemorySize() ) : 0; };
+    const auto ramSize = []( const CachedImage& image ) { return image.bitmap ? uint64_t( image.width ) * image.height * 4 : 0; };
+    const auto lz4Size = []( const CachedImage& image ) { return image.lz4 ? uint64_t( image.lz4->Size() ) : 0; };
+
+    uint64_t vram = 0, ram = 0, lz4 = 0;
+    for( auto& image : m_cache )
+    {
+        vram += vramSize( image );
+        ram += ramSize( image );
+        lz4 += lz4Size( image );
+    }
+
+    // Textures may also take at most half of the device memory left free by everything else
+    const auto budget = m_device->GetMemoryBudget();
+    const auto free = budget.budget > budget.usage ? budget.budget - budget.usage : 0;
+    const auto vramLimit = std::min( uint64_t( m_cacheVram ) << 20, vram + free / 2 );
+    const auto ramLimit = uint64_t( m_cacheRam ) << 20;
+    const auto lz4Limit = uint64_t( m_cacheLz4 ) << 20;
+
+    const auto oldest = [&]( auto&& holds ) {
+        auto victim = m_cache.end();
+        for( auto it = m_cache.begin(); it != m_cache.end(); ++it )
+        {
+            if( holds( *it ) && !pinned( *it ) && ( victim == m_cache.end() || it->lastUse < victim->lastUse ) ) victim = it;
+        }
+        return victim;
+    };
+
+    // An image which loses its texture stays in the compressed tier, if it has a copy there
+    while( vram > vramLimit )
+    {
+        auto victim = oldest( []( const CachedImage& image ) { return image.texture != nullptr; } );
+        if( victim == m_cache.end() ) break;
+
+        vram -= vramSize( *victim );
+        victim->texture.reset();
+        if( !victim->lz4 ) m_cache.erase( victim );
+    }
+    while( ram > ramLimit )
+    {
+        auto victim = oldest( []( const CachedImage& image ) { return image.bitmap != nullptr; } );
+        if( victim == m_cache.end() ) break;
+
+        ram -= ramSize( *victim );
+        m_cache.erase( victim );
+    }
+    while( lz4 > lz4Limit )
+    {
+        auto victim = oldest( []( const CachedImage& image ) { return image.lz4 != nullptr; } );
+        if( victim == m_cache.end() ) break;
+
+        lz4 -= lz4Size( *victim );
+        victim->lz4.reset();
+        if( !victim->texture ) m_cache.erase( victim );
+    }
+}
+
+// Called by the device when memory runs short. Textures of images which are not neighbours of the current one go
+// first, then those of the neighbours, least recently shown first. Skipped if another thread holds the cache, as
+// it may be waiting for the allocation which asked for memory.
+VkDeviceSize Viewport::EvictTextures( VkDeviceSize bytes )
+{
+    ZoneScoped;
+    std::unique_lock lock( m_lock, std::try_to_lock );
+    if( !lock || m_fileList.Empty() ) return 0;
+
+    const auto keep = Neighbours();
+    const auto shown = m_fileList.Path( m_fileIndex );
+    const auto rank = [&]( const CachedImage& image ) {
+        const auto neighbour = std::ranges::any_of( keep, [&]( size_t idx ) { return m_fileList.Is( idx, image.path ); } );
+        return std::make_pair( neighbour, image.lastUse );
+    };
+
+    VkDeviceSize freed = 0;
+    while( freed < bytes )
+    {
+        auto victim = m_cache.end();
+        for( auto it = m_cache.begin(); it != m_cache.end(); ++it )
+        {
+            if( !it->texture || it->id != -1 || it->path == shown ) continue;
+            if( victim == m_cache.end() || rank( *it ) < rank( *victim ) ) victim = it;
+        }
+        if( victim == m_cache.end() ) break;
+
+        freed += victim->texture->MemorySize();
+        victim->texture.reset();
+        if( !victim->lz4 ) m_cache.erase( victim );
+    }
+    return freed;
+}
+
+void Viewport::ClearCache()
+{
+    std::lock_guard lock( m_lock );
+
+    std::vector<int64_t> cancel;
+    for( auto& image : m_cache )
+    {
+        if( image.id != -1 ) cancel.emplace_back( image.id );
+    }
+    m_cache.clear();
+    for( auto id : cancel ) m_provider->Cancel( id );
+}
+
+std::vector<Viewport::CachedImage>::iterator Viewport::FindCached( int64_t id )
+{
+    return std::ranges::find_if( m_cache, [id]( const CachedImage& image ) { return image.id == id; } );
+}
+
+std::vector<Viewport::CachedImage>::iterator Viewport::FindCached( const std::string& path )
+{
+    return std::ranges::find_if( m_cache, [&path]( const CachedImage& image ) { return image.path == path; } );
 }
 
 void Viewport::PasteClipboard()
@@ -1025,7 +2274,8 @@ void Viewport::PasteClipboard()
             }
             else
             {
-                SetFileList( std::move( files ), files[0] );
+                std::lock_guard lock( m_lock );
+                SetFileList( PathList( files ), files[0] );
                 LoadImage( files[0].c_str(), false );
             }
             return;
@@ -1045,7 +2295,10 @@ void Viewport::PasteClipboard()
     {
         if( m_clipboardOffer.contains( mimeType ) )
         {
-            m_fileList.clear();
+            std::lock_guard lock( m_lock );
+            m_scanGeneration++;
+            m_fileList.Clear();
+            FileListChanged();
             LoadImage( m_window->GetClipboard( mimeType ), loadOrigin.c_str() );
             return;
         }
@@ -1099,73 +2352,165 @@ std::vector<std::string> Viewport::FindValidFiles( const std::vector<std::string
 
 std::vector<std::string> Viewport::FindLoadableImages( const std::vector<std::string>& fileList )
 {
-    const auto cpus = std::thread::hardware_concurrency();
-    std::vector<std::vector<std::string>> tmp( cpus );
-    const auto batchSize = ( fileList.size() + cpus - 1 ) / cpus;
-    size_t start = 0;
-    int n;
-    for( n=0; n<cpus; n++ )
-    {
-        if( start >= fileList.size() ) break;
-        tmp[n].reserve( batchSize );
-        m_td->Queue( [&fileList, &tmp, n, batchSize, start]() {
-            const auto end = std::min( start + batchSize, fileList.size() );
-            for( size_t i = start; i < end; i++ )
-            {
-                auto loader = GetImageLoader( fileList[i].c_str(), ToneMap::Operator::PbrNeutral );
-                if( loader ) tmp[n].emplace_back( fileList[i] );
-            }
-        } );
-        start += batchSize;
-    }
-    m_td->Sync();
+    ZoneScoped;
+    if( fileList.empty() ) return {};
+
+    // Only files without a known signature are opened again
+    const auto headers = FileBatch::ReadHeaders( fileList, 12, m_td );
+    std::vector<uint8_t> loadable( fileList.size() );
+    m_td->ParallelFor( 0, fileList.size(), TaskDispatch::AdaptiveGrain, [&]( size_t begin, size_t end ) {
+        for( size_t i=begin; i<end; i++ )
+        {
+            const auto& header = headers[i];
+            loadable[i] = header.regular && IsLoadableImage( fileList[i].c_str(), header.data, header.length );
+        }
+    } );
 
     std::vector<std::string> ret;
-    for( int i=0; i<n; i++ )
+    for( size_t i=0; i<fileList.size(); i++ )
     {
-        auto& v = tmp[i];
-        ret.insert( ret.end(), v.begin(), v.end() );
+        if( loadable[i] ) ret.emplace_back( fileList[i] );
     }
     return ret;
 }
 
-void Viewport::SetFileList( std::vector<std::string>&& fileList, const std::string& origin )
+void Viewport::SetFileList( PathList&& fileList, const std::string& origin )
 {
-    m_fileList = fileList;
-    auto it = std::ranges::find( m_fileList, origin );
-    CheckPanic( it != m_fileList.end(), "Origin not found in file list" );
-    m_fileIndex = std::distance( m_fileList.begin(), it );
-    mclog( LogLevel::Info, "File list: %zu files, current: %zu", m_fileList.size(), m_fileIndex );
+    m_scanGeneration++;
+    m_fileList = std::move( fileList );
+    m_fileIndex = m_fileList.Find( origin );
+    CheckPanic( m_fileIndex != PathList::npos, "Origin not found in file list" );
+    mclog( LogLevel::Info, "File list: %zu files, current: %zu", m_fileList.Size(), m_fileIndex );
+    FileListChanged();
 }
 
-std::vector<std::string> Viewport::ListDirectory( const std::string& path )
+// Returns the entries which may be image files, in natural order. Symlinks and entries of unknown type are
+// resolved by IsLoadableImage(), so that the listing itself does not touch every file.
+PathList Viewport::ListDirectory( const std::string& path )
 {
-    std::vector<std::string> ret;
+    ZoneScoped;
+
+    PathList ret( path );
     DIR* dir = opendir( path.c_str() );
     if( !dir ) return ret;
 
     struct dirent* entry;
     while( ( entry = readdir( dir ) ) )
     {
-        if( entry->d_type == DT_REG )
+        if( entry->d_type == DT_REG || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN )
         {
-            ret.emplace_back( path + "/" + entry->d_name );
+            ret.Add( entry->d_name );
         }
-        else if( entry->d_type == DT_LNK )
+    }
+    closedir( dir );
+    ret.Sort();
+    return ret;
+}
+
+// The images around origin are found first and published right away, so that browsing can start. The rest of
+// the directory is checked in the background, and replaces the file list once done, unless it was replaced in
+// the meantime. Files which are in the directory index with the same modification time and size are not
+// probed again.
+void Viewport::ScanDirectory( const std::string& dir, const std::string& origin )
+{
+    ZoneScoped;
+    mclog( LogLevel::Info, "Scanning directory %s", dir.c_str() );
+
+    auto files = ListDirectory( dir );
+    const auto pos = files.LowerBound( origin );
+    if( pos == files.Size() || !files.Is( pos, origin ) ) return;
+
+    auto index = std::make_shared<ImageIndex>( dir );
+    auto isImage = [&]( size_t idx ) {
+        const auto path = files.Path( idx );
+        struct stat st;
+        ImageIndex::Entry entry;
+        if( stat( path.c_str(), &st ) == 0 && index->Find( files.NameView( idx ), st.st_mtim, st.st_size, entry ) ) return entry.loadable;
+        return IsLoadableImage( path.c_str() );
+    };
+
+    std::vector<size_t> nearIdx = { pos };
+    const auto count = std::max( m_prefetchCount, 1 );
+    for( size_t i=pos, found=0; i-- > 0 && found < count; )
+    {
+        if( isImage( i ) )
         {
-            auto srcPath = path + "/" + entry->d_name;
-            char link[PATH_MAX];
-            if( readlink( srcPath.c_str(), link, sizeof( link ) ) != -1 )
+            nearIdx.insert( nearIdx.begin(), i );
+            found++;
+        }
+    }
+    for( size_t i=pos+1, found=0; i<files.Size() && found < count; i++ )
+    {
+        if( isImage( i ) )
+        {
+            nearIdx.emplace_back( i );
+            found++;
+        }
+    }
+    PathList near( files.Prefix() );
+    for( auto idx : nearIdx ) near.Add( files.NameView( idx ) );
+
+    std::lock_guard lock( m_lock );
+    SetFileList( std::move( near ), origin );
+    const auto generation = m_scanGeneration.load();
+
+    TaskDispatch::ScopedPriority priority( TaskDispatch::Priority::Background );
+    m_td->Queue( *m_scanJobs, [this, files = std::move( files ), index, generation] {
+        ZoneScopedN( "Directory scan" );
+
+        // Entries which are not regular files are not indexed. All files are stat'ed in one batch, which on
+        // network file systems costs far less than a round-trip per file.
+        const auto stats = FileBatch::ReadHeaders( files, 0, m_td );
+        if( m_scanGeneration != generation ) return;
+
+        std::vector<ImageIndex::Entry> entries( files.Size() );
+        std::atomic<size_t> probed = 0;
+        m_td->ParallelFor( 0, files.Size(), TaskDispatch::AdaptiveGrain, [&]( size_t begin, size_t end ) {
+            for( size_t i=begin; i<end; i++ )
             {
-                struct stat st;
-                if( stat( link, &st ) == 0 && S_ISREG( st.st_mode ) )
+                if( m_scanGeneration.load( std::memory_order_relaxed ) != generation ) return;
+
+                const auto& st = stats[i];
+                if( !st.regular ) continue;
+
+                auto& entry = entries[i];
+                if( index->Find( files.NameView( i ), st.mtime, st.size, entry ) ) continue;
+
+                entry = { .mtime = st.mtime, .size = st.size };
+                if( auto loader = GetImageLoader( files.Path( i ).c_str(), ToneMap::Operator::PbrNeutral ); loader )
                 {
-                    ret.emplace_back( std::move( srcPath ) );
+                    const auto info = loader->Probe();
+                    entry.width = info.width;
+                    entry.height = info.height;
+                    entry.loadable = true;
+                    entry.hdr = info.hdr;
                 }
+                probed.fetch_add( 1, std::memory_order_relaxed );
             }
+        } );
+        if( m_scanGeneration != generation ) return;
+
+        std::vector<std::string_view> names;
+        std::vector<ImageIndex::Entry> indexed;
+        PathList list( files.Prefix() );
+        for( size_t i=0; i<files.Size(); i++ )
+        {
+            if( !stats[i].regular ) continue;
+            names.emplace_back( files.NameView( i ) );
+            indexed.emplace_back( entries[i] );
+            if( entries[i].loadable ) list.Add( files.NameView( i ) );
         }
-    }
-    closedir( dir );
-    std::ranges::sort( ret );
-    return ret;
+        mclog( LogLevel::Info, "Found %zu files, %zu probed", list.Size(), probed.load() );
+        if( probed != 0 || names.size() != index->Size() ) index->Save( names, indexed );
+
+        std::lock_guard lock( m_lock );
+        if( m_scanGeneration != generation ) return;
+
+        const auto current = m_fileList.Path( m_fileIndex );
+        if( list.Find( current ) == PathList::npos ) return;
+        SetFileList( std::move( list ), current );
+        UpdatePrefetch();
+        m_updateTitle = true;
+        WantRender();
+    } );
 }
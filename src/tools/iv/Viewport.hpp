@@ -1,5 +1,6 @@
 #pragma once
 
+#include <atomic>
 #include <memory>
 #include <mutex>
 #include <stdint.h>
@@ -8,16 +9,24 @@
 #include <vulkan/vulkan.h>
 
 #include "ImageProvider.hpp"
+#include "util/PathList.hpp"
 #include "util/RobinHood.hpp"
 #include "util/Vector2.hpp"
 
 class Background;
+class Bitmap;
+class BitmapAnimStream;
+class BitmapLz4;
 class BusyIndicator;
 class DataBuffer;
+class FileWrapper;
 class ImageView;
 class Selection;
 class TaskDispatch;
+class TaskGroup;
 class Texture;
+class TilePyramid;
+class ThumbnailGrid;
 class VlkDevice;
 class VlkInstance;
 class WaylandDisplay;
@@ -26,8 +35,55 @@ class WaylandWindow;
 
 class Viewport
 {
+    // An image of the file list which is decoded, and unless it needs tiling uploaded, ahead of being shown or
+    // kept after it was. Entries are valid while the file has the same modification time.
+    struct CachedImage
+    {
+        std::string path;
+        struct timespec mtime;
+        int64_t id;                         // Pending load, -1 once done
+        std::shared_ptr<Texture> texture;
+        std::shared_ptr<Bitmap> bitmap;     // Only kept if there is no texture
+        std::shared_ptr<BitmapLz4> lz4;     // Compressed pixels, which are kept when the texture is evicted
+        std::shared_ptr<BitmapAnimStream> anim; // Frames after the first, shared with the view
+        std::shared_ptr<TilePyramid> pyramid;   // Tiled images read from the disk cache, instead of the bitmap
+        uint32_t frameDelay;
+        uint32_t width;
+        uint32_t height;
+        bool hdr;
+        uint64_t lastUse;
+    };
+
+    struct ClipboardPayload;
+
+    // Timeline of the last image loaded for display, which the view completes with the steps after the load.
+    // Times are in microseconds.
+    struct LoadStats
+    {
+        enum class State
+        {
+            None,
+            Upload,     // Waiting for the texture to be ready
+            Present,    // Waiting for the first frame which shows it
+            Done
+        };
+
+        ImageProvider::Timeline timeline;
+        std::string origin;
+        std::weak_ptr<Texture> texture;
+        uint32_t width;
+        uint32_t height;
+        uint64_t uploadStart;
+        uint32_t build;     // Creating the texture and queueing the upload
+        uint32_t upload;
+        uint32_t present;
+        uint32_t total;     // Since the load was queued
+        State state;
+    };
+
 public:
-    Viewport( WaylandDisplay& display, VlkInstance& vkInstance, int gpu, bool hdr );
+    // The preload image starts decoding while the device is created. It must then be passed to LoadImage().
+    Viewport( WaylandDisplay& display, VlkInstance& vkInstance, int gpu, bool hdr, const char* preload = nullptr );
     ~Viewport();
 
     void LoadImage( const char* path, bool scanDirectory );
@@ -35,11 +91,16 @@ public:
 
     void LoadImage( const std::vector<std::string>& paths );
 
+    // Prints the load timeline of each shown image, and appends it as a line of JSON to the given file
+    void SetLoadStats( bool print, const char* jsonPath );
+
 private:
     void SetBusy();
+    [[nodiscard]] ImageProvider::Flags PreviewFlags();
     void Update( float delta );
 
     void WantRender();
+    void AddDamage( const VkRect2D& rect );
 
     void Close();
     bool Render();
@@ -47,6 +108,7 @@ private:
     void Resize( uint32_t width, uint32_t height );
     void FormatChange( VkFormat format );
     void Clipboard( const unordered_flat_set<std::string>& mimeTypes );
+    [[nodiscard]] std::shared_ptr<ClipboardPayload> EncodeClipboard( const char* mimeType );
     void Drag( const unordered_flat_set<std::string>& mimeTypes );
     void Drop( int fd, const char* mime );
     void KeyEvent( uint32_t key, int mods, bool pressed );
@@ -63,21 +125,48 @@ private:
 
     bool CopyToClipboard();
     void CutSelection();
+    [[nodiscard]] bool IsPreview();
 
     void ImageHandler( int64_t id, ImageProvider::Result result, const ImageProvider::ReturnData& data );
+    void PrefetchHandler( int64_t id, ImageProvider::Result result, const ImageProvider::ReturnData& data );
+    void EnableHdr( bool hdrImage );
+
+    void ShowGrid( bool show );
+    bool GridKeyEvent( uint32_t key, int mods );
+    void OpenGridSelection();
+    void ThumbnailReady();
+    void FileListChanged();
+
+    void UpdateLoadStats();
+    void FinishLoadStats();
+    [[nodiscard]] std::string FormatLoadStats() const;
+
+    void ShowImage( const CachedImage& image );
+    void CompressCached( const ImageProvider::ReturnData& data );
+    void KeepShown( const ImageProvider::ReturnData& data, const std::shared_ptr<Texture>& texture );
+    [[nodiscard]] std::vector<size_t> Neighbours() const;
+    void UpdatePrefetch();
+    void TrimCache();
+    VkDeviceSize EvictTextures( VkDeviceSize bytes );
+    void ClearCache();
+    [[nodiscard]] std::vector<CachedImage>::iterator FindCached( int64_t id );
+    [[nodiscard]] std::vector<CachedImage>::iterator FindCached( const std::string& path );
 
     void PasteClipboard();
     [[nodiscard]] std::vector<std::string> ProcessUriList( std::string uriList );
     [[nodiscard]] std::vector<std::string> FindValidFiles( const std::vector<std::string>& uriList );
     [[nodiscard]] std::vector<std::string> FindLoadableImages( const std::vector<std::string>& fileList );
-    [[nodiscard]] std::vector<std::string> ListDirectory( const std::string& path );
+    [[nodiscard]] PathList ListDirectory( const std::string& path );
+    void ScanDirectory( const std::string& dir, const std::string& origin );
 
-    void SetFileList( std::vector<std::string>&& fileList, const std::string& origin );
+    void SetFileList( PathList&& fileList, const std::string& origin );
 
     WaylandDisplay& m_display;
     VlkInstance& m_vkInstance;
 
     std::unique_ptr<TaskDispatch> m_td;
+    std::unique_ptr<TaskGroup> m_prepareJobs;
+    std::unique_ptr<TaskGroup> m_scanJobs;
 
     std::shared_ptr<WaylandWindow> m_window;
     std::shared_ptr<VlkDevice> m_device;
@@ -88,21 +177,39 @@ private:
 
     std::shared_ptr<ImageProvider> m_provider;
     std::shared_ptr<ImageView> m_view;
+    std::shared_ptr<ThumbnailGrid> m_grid;
+    bool m_gridMode = false;    // Guarded by m_lock
 
     std::shared_ptr<Texture> m_clipboard;
     VkRect2D m_clipboardClip;
+    unordered_flat_map<std::string, std::shared_ptr<ClipboardPayload>> m_clipboardPayloads;     // Per MIME type, for the current offer
 
     uint64_t m_lastTime = 0;
     bool m_render = true;
+    VkRect2D m_damage = {};     // Redrawn when m_render is not set, in swapchain pixels
 
     unordered_flat_set<std::string> m_clipboardOffer;
 
-    std::vector<std::string> m_fileList;
+    PathList m_fileList;
     size_t m_fileIndex = 0;
+    std::atomic<uint32_t> m_scanGeneration = 0;     // Changes whenever m_fileList is replaced, which stops a running scan
+
+    // Neighbours of m_fileIndex, and recently shown images within the memory limits. Guarded by m_lock.
+    std::vector<CachedImage> m_cache;
+    uint64_t m_cacheTick = 0;
+    uint64_t m_pressureHandler;
+    int m_animTimer;        // Wakes the render loop at the next animation frame
+    int m_prefetchCount;    // Images before and after the current one, zero disables prefetch
+    int m_cacheVram;        // MiB of textures, further limited by the device memory budget
+    int m_cacheRam;         // MiB of bitmaps kept for tiled images
+    int m_cacheLz4;         // MiB of compressed pixels, the tier below textures
+    int m_cacheTiles;       // MiB of tile pyramids of huge images on disk, zero disables them
 
     std::recursive_mutex m_lock;
     bool m_isBusy = false;
+    bool m_preview = false;     // A reduced image is shown until the full one is loaded
     int m_currentJob = -1;
+    std::string m_preloadPath;
 
     Vector2<float> m_mousePos;
     bool m_mouseFocus = false;
@@ -110,9 +217,20 @@ private:
     bool m_selectionDrag = false;
 
     bool m_updateTitle = false;
+    bool m_showPresentStats = false;
+    uint64_t m_presentStatsTime = 0;
+
+    LoadStats m_loadStats = {};     // Guarded by m_lock
+    bool m_showLoadStats = false;
+    bool m_printLoadStats = false;
+    std::unique_ptr<FileWrapper> m_loadStatsJson;
     std::string m_origin;
     std::string m_loadOrigin;
     float m_viewScale;
 
     bool m_hdr;
+    bool m_stickyHdr;                       // Keep the HDR swapchain for SDR images once it is enabled
+    std::atomic<bool> m_hdrOutput = false;
+    ToneMap::Operator m_tonemap = ToneMap::Operator::PbrNeutral;
+    int m_compressAbove;    // MiB, zero picks a fraction of the GPU memory, negative disables compression
 };
@@ -2,6 +2,7 @@
 #include <memory>
 #include <signal.h>
 #include <stdlib.h>
+#include <string>
 #include <vector>
 
 #include "GitRef.hpp"
@@ -24,6 +25,8 @@ static void PrintHelp()
     printf( "  -V, --validation [on|off]    Enable or disable Vulkan validation layers\n" );
     printf( "  -g, --gpu [id]               Select GPU by id\n" );
     printf( "  -H, --hdr [on|off]           Enable or disable HDR processing\n" );
+    printf( "  --stats                      Print the load timeline of each image\n" );
+    printf( "  --stats-json [file]          Append the load timelines to a JSON lines file\n" );
     printf( "  --help                       Print this help\n" );
 }
 
@@ -40,8 +43,10 @@ int main( int argc, char** argv )
 
     int gpu = -1;
     bool hdr = true;
+    bool stats = false;
+    const char* statsJson = nullptr;
 
-    enum { OptHelp };
+    enum { OptHelp, OptStats, OptStatsJson };
 
     struct option longOptions[] = {
         { "debug", no_argument, nullptr, 'd' },
@@ -49,6 +54,8 @@ int main( int argc, char** argv )
         { "validation", required_argument, nullptr, 'V' },
         { "gpu", required_argument, nullptr, 'g' },
         { "hdr", required_argument, nullptr, 'H' },
+        { "stats", no_argument, nullptr, OptStats },
+        { "stats-json", required_argument, nullptr, OptStatsJson },
         { "help", no_argument, nullptr, OptHelp },
         {}
     };
@@ -60,6 +67,7 @@ int main( int argc, char** argv )
         {
         case 'd':
             SetLogLevel( LogLevel::Callstack );
+            WarmCallstacks();
             break;
         case 'e':
             ShowExternalCallstacks( true );
@@ -73,6 +81,12 @@ int main( int argc, char** argv )
         case 'H':
             hdr = ParseBoolean( optarg );
             break;
+        case OptStats:
+            stats = true;
+            break;
+        case OptStatsJson:
+            statsJson = optarg;
+            break;
         case OptHelp:
             PrintHelp();
             return 0;
@@ -85,28 +99,21 @@ int main( int argc, char** argv )
     auto vkInstance = std::make_unique<VlkInstance>( VlkInstanceType::Wayland, enableValidation );
     auto waylandDisplay = std::make_unique<WaylandDisplay>();
 
-    auto viewport = std::make_unique<Viewport>( *waylandDisplay, *vkInstance, gpu, hdr );
-    if( optind != argc )
+    // A single image is decoded while the viewport is being set up
+    std::string single;
+    if( argc - optind == 1 ) single = argv[optind][0] == '~' ? ExpandHome( argv[optind] ) : argv[optind];
+
+    auto viewport = std::make_unique<Viewport>( *waylandDisplay, *vkInstance, gpu, hdr, single.empty() ? nullptr : single.c_str() );
+    if( stats || statsJson ) viewport->SetLoadStats( stats, statsJson );
+    if( !single.empty() )
     {
-        const auto sz = argc - optind;
-        if( sz == 1 )
-        {
-            const auto path = argv[optind];
-            if( path[0] == '~' )
-            {
-                viewport->LoadImage( ExpandHome( path ).c_str(), true );
-            }
-            else
-            {
-                viewport->LoadImage( argv[optind], true );
-            }
-        }
-        else
-        {
-            std::vector<std::string> files;
-            for( int i = optind; i < argc; ++i ) files.emplace_back( ExpandHome( argv[i] ) );
-            viewport->LoadImage( files );
-        }
+        viewport->LoadImage( single.c_str(), true );
+    }
+    else if( optind != argc )
+    {
+        std::vector<std::string> files;
+        for( int i = optind; i < argc; ++i ) files.emplace_back( ExpandHome( argv[i] ) );
+        viewport->LoadImage( files );
     }
 
     waylandDisplay->Run();
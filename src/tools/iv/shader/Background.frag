@@ -1,4 +1,5 @@
 #version 450
+#include "Transfer.frag"
 
 in vec4 gl_FragCoord;
 
@@ -8,6 +9,6 @@ void main() {
     float dt = dot( gl_FragCoord.xy * 0.001, vec2( 12.9898, 78.233 ) );
     float noise = fract( sin( dt ) * 43758.5453 );
 
-    const float c = pow( 0.1125, 2.2 ) + noise / 255.0;
-    outColor = vec4( c, c, c, 1.0 );
+    const float c = pow( 0.1125, 2.2 ) + noise / 255.0 * SdrWhite();
+    outColor = vec4( EncodeOutput( vec3( c, c, c ) ), 1.0 );
 }
@@ -0,0 +1,12 @@
+// Blends transparent pixels over a checkerboard of squares 1/div pixels wide
+vec4 Checkerboard( vec4 color, float div )
+{
+    if( color.a >= 1.0 ) return color;
+
+    const float lo = pow( 0.2, 2.2 );
+    const float hi = pow( 0.3, 2.2 );
+    const vec4 darkColor = vec4( lo, lo, lo, 1.0 );
+    const vec4 lightColor = vec4( hi, hi, hi, 1.0 );
+    vec4 checkerboard = ( ( int( gl_FragCoord.x * div ) + int( gl_FragCoord.y * div ) ) & 1 ) == 0 ? darkColor : lightColor;
+    return vec4( mix( color, checkerboard, 1.0 - color.a ).rgb, 1.0 );
+}
@@ -0,0 +1,12 @@
+#version 450
+#include "Transfer.frag"
+
+layout(location = 0) in vec3 outTexCoord;
+layout(location = 1) in vec4 inColor;
+layout(location = 0) out vec4 outColor;
+layout(binding = 0) uniform sampler2DArray atlas;
+
+void main() {
+    vec4 color = outTexCoord.z < 0.0 ? inColor : texture( atlas, outTexCoord );
+    outColor = vec4( EncodeOutput( color.rgb * SdrWhite() ), color.a );
+}
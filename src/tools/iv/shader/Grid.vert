@@ -0,0 +1,22 @@
+#version 450
+
+layout(location = 0) in vec2 inCorner;
+layout(location = 1) in vec4 inRect;
+layout(location = 2) in vec4 inTexRect;
+layout(location = 3) in float inLayer;
+layout(location = 4) in vec4 inColor;
+
+layout(location = 0) out vec3 outTexCoord;
+layout(location = 1) out vec4 outColor;
+
+layout(push_constant) uniform PushConstants {
+    vec2 screenSize;
+    vec2 offset;
+};
+
+void main() {
+    vec2 pos = inRect.xy + inCorner * inRect.zw - offset;
+    gl_Position = vec4( pos.x / screenSize.x * 2.0 - 1.0, pos.y / screenSize.y * 2.0 - 1.0, 0.0, 1.0 );
+    outTexCoord = vec3( inTexRect.xy + inCorner * inTexRect.zw, inLayer );
+    outColor = inColor;
+}
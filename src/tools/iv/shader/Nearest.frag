@@ -1,11 +1,23 @@
 #version 450
+#include "Checkerboard.frag"
+#include "Tonemap.frag"
+#include "Transfer.frag"
 
 layout(location = 0) in vec2 outTexCoord;
 layout(location = 0) out vec4 outColor;
 layout(binding = 0) uniform sampler2D tex;
 
+// HDR texture shown on an SDR framebuffer
+layout(constant_id = 1) const bool Tonemapped = false;
+// SDR texture shown on a PQ framebuffer
+layout(constant_id = 2) const bool SdrContent = false;
+// HDR texture stored PQ encoded, see HdrPackedFormat
+layout(constant_id = 3) const bool PqTexture = false;
+
 layout(push_constant) uniform PushConstants {
-    layout(offset = 8) float div;
+    layout(offset = 24) float div;
+    layout(offset = 28) int tonemap;
+    layout(offset = 32) float exposure;     // Applied before tone mapping
 };
 
 vec4 filteredNearest(sampler2D tex, vec2 coord)
@@ -26,13 +38,9 @@ vec4 filteredNearest(sampler2D tex, vec2 coord)
 void main() {
     outColor = filteredNearest(tex, outTexCoord);
 
-    if( outColor.a < 1.0 )
-    {
-        const float lo = pow( 0.2, 2.2 );
-        const float hi = pow( 0.3, 2.2 );
-        const vec4 darkColor = vec4( lo, lo, lo, 1.0 );
-        const vec4 lightColor = vec4( hi, hi, hi, 1.0 );
-        vec4 checkerboard = ( ( int( gl_FragCoord.x * div ) + int( gl_FragCoord.y * div ) ) & 1 ) == 0 ? darkColor : lightColor;
-        outColor = vec4( mix( outColor, checkerboard, 1.0 - outColor.a ).rgb, 1.0 );
-    }
+    if( PqTexture ) outColor.rgb = PqToLinear( outColor.rgb );
+    if( Tonemapped ) outColor.rgb = Tonemap( outColor.rgb * exposure, tonemap );
+    if( SdrContent ) outColor.rgb = SdrToOutput( outColor.rgb );
+    outColor = Checkerboard( outColor, div );
+    outColor.rgb = EncodeOutput( outColor.rgb );
 }
@@ -13,3 +13,20 @@ vec3 Pq( vec3 color )
 
     return pow( ( c1 + c2 * Ym1 ) / ( 1.0 + c3 * Ym1 ), vec3( m2 ) );
 }
+
+// Inverse of Pq(), for textures stored PQ encoded
+vec3 PqToLinear( vec3 color )
+{
+    const float NominalLuminance = 100.0;
+
+    const float m1 = 1305.0 / 8192.0;
+    const float m2 = 2523.0 / 32.0;
+    const float c1 = 107.0 / 128.0;
+    const float c2 = 2413.0 / 128.0;
+    const float c3 = 2392.0 / 128.0;
+
+    const vec3 Em2 = pow( color, vec3( 1.0 / m2 ) );
+    const vec3 Y = pow( max( Em2 - c1, 0.0 ) / ( c2 - c3 * Em2 ), vec3( 1.0 / m1 ) );
+
+    return Y * ( 10000.0 / NominalLuminance );
+}
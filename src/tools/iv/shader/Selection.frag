@@ -1,4 +1,5 @@
 #version 450
+#include "Transfer.frag"
 
 layout(location = 0) out vec4 outColor;
 
@@ -11,6 +12,6 @@ void main() {
     float wave = sin( ( gl_FragCoord.x + gl_FragCoord.y - offset ) * div );
     float k = 0.5;
     float ss = smoothstep( -k, k, wave );
-    float color = pow( ss, 2.2 );
-    outColor = vec4( vec3( color ), 1.0 );
+    vec3 color = EncodeOutput( vec3( pow( ss, 2.2 ) * SdrWhite() ) );
+    outColor = vec4( color, 1.0 );
 }
@@ -1,9 +1,11 @@
 #version 450
+#include "Transfer.frag"
 
 layout(location = 0) in vec2 outTexCoord;
 layout(location = 0) out vec4 outColor;
 layout(binding = 0) uniform sampler2D tex;
 
 void main() {
-    outColor = texture(tex, outTexCoord);
+    vec4 color = texture(tex, outTexCoord);
+    outColor = vec4( EncodeOutput( color.rgb * SdrWhite() ), color.a );
 }
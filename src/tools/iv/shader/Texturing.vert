@@ -5,11 +5,15 @@ layout(location = 1) in vec2 inTexCoord;
 
 layout(location = 0) out vec2 outTexCoord;
 
+// The vertex buffer is a unit quad, placed on the screen by origin and size, in pixels
 layout(push_constant) uniform PushConstants {
     vec2 screenSize;
+    vec2 origin;
+    vec2 size;
 };
 
 void main() {
-    gl_Position = vec4( inPosition.x / screenSize.x * 2.0 - 1.0, inPosition.y / screenSize.y * 2.0 - 1.0, 0.0, 1.0 );
+    vec2 pos = origin + inPosition * size;
+    gl_Position = vec4( pos.x / screenSize.x * 2.0 - 1.0, pos.y / screenSize.y * 2.0 - 1.0, 0.0, 1.0 );
     outTexCoord = inTexCoord;
 }
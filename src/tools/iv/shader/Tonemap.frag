@@ -0,0 +1,97 @@
+// GPU versions of the util/Tonemapper operators. The input is linear BT.2020, as in HDR textures, and the
+// output is linear BT.709, to be encoded by the sRGB framebuffer. Operator values match ToneMap::Operator.
+const int TonemapAgX = 0;
+const int TonemapAgXGolden = 1;
+const int TonemapAgXPunchy = 2;
+const int TonemapPbrNeutral = 3;
+
+const mat3 Bt2020To709 = mat3(
+     1.6604910, -0.5876411, -0.0728499,
+    -0.1245505,  1.1328999, -0.0083494,
+    -0.0181508, -0.1005789,  1.1187297
+);
+
+vec3 PbrNeutral( vec3 color )
+{
+    const float startCompression = 0.8 - 0.04;
+    const float desaturation = 0.15;
+    const float d = 1.0 - startCompression;
+
+    const float x = min( color.r, min( color.g, color.b ) );
+    const float offset = x < 0.08 ? x - 6.25 * x * x : 0.04;
+    color -= offset;
+
+    const float peak = max( color.r, max( color.g, color.b ) );
+    if( peak < startCompression ) return color;
+
+    const float newPeak = 1.0 - d * d / ( peak + d - startCompression );
+    color *= newPeak / peak;
+
+    const float g = 1.0 - 1.0 / ( desaturation * ( peak - newPeak ) + 1.0 );
+    return mix( color, vec3( newPeak ), g );
+}
+
+vec3 AgxCurve( vec3 x )
+{
+    const float threshold = 0.6060606060606061;
+    const float a_up = 69.86278913545539;
+    const float a_down = 59.507875;
+    const float b_up = 13.0 / 4.0;
+    const float b_down = 3.0;
+    const float c_up = -4.0 / 13.0;
+    const float c_down = -1.0 / 3.0;
+
+    const vec3 mask = step( threshold, x );
+    const vec3 a = mix( vec3( a_up ), vec3( a_down ), mask );
+    const vec3 b = mix( vec3( b_up ), vec3( b_down ), mask );
+    const vec3 c = mix( vec3( c_up ), vec3( c_down ), mask );
+
+    return 0.5 + ( -2.0 * threshold + 2.0 * x ) * pow( 1.0 + a * pow( abs( x - threshold ), b ), c );
+}
+
+vec3 AgxTransform( vec3 color )
+{
+    const float min_ev = -12.473931188332413;
+    const float max_ev = 4.026068811667588;
+    const float invrange = 1.0 / ( max_ev - min_ev );
+
+    const mat3 agx_mat = mat3(
+        0.8424010709504686, 0.04240107095046854, 0.04240107095046854,
+        0.07843650156180276, 0.8784365015618028, 0.07843650156180276,
+        0.0791624274877287, 0.0791624274877287, 0.8791624274877287
+    );
+
+    const vec3 c1 = color * agx_mat;
+    const vec3 c2 = clamp( log2( max( c1, vec3( 1e-10 ) ) ) * invrange - min_ev * invrange, 0.0, 1.0 );
+    return AgxCurve( c2 );
+}
+
+vec3 AgxLook( vec3 color, vec3 scale, float saturation, float power )
+{
+    const float luma = dot( color, vec3( 0.2126, 0.7152, 0.0722 ) );
+    const vec3 v = pow( max( vec3( 0.0 ), color * scale ), vec3( power ) );
+    return luma + saturation * ( v - luma );
+}
+
+vec3 AgxEotf( vec3 color )
+{
+    const mat3 agx_mat_inv = mat3(
+        1.1969986613119143, -0.053001338688085674, -0.053001338688085674,
+        -0.09804562695225345, 1.1519543730477466, -0.09804562695225345,
+        -0.09895303435966087, -0.09895303435966087, 1.151046965640339
+    );
+
+    return pow( max( vec3( 0.0 ), color * agx_mat_inv ), vec3( 2.2 ) );
+}
+
+vec3 Tonemap( vec3 color, int op )
+{
+    color = color * Bt2020To709;
+
+    if( op == TonemapPbrNeutral ) return clamp( PbrNeutral( color ), 0.0, 1.0 );
+
+    color = AgxTransform( color );
+    if( op == TonemapAgXGolden ) color = AgxLook( color, vec3( 1.0, 0.9, 0.5 ), 0.8, 0.8 );
+    else if( op == TonemapAgXPunchy ) color = AgxLook( color, vec3( 1.0 ), 1.4, 1.35 );
+    return clamp( AgxEotf( color ), 0.0, 1.0 );
+}
@@ -0,0 +1,30 @@
+#include "Pq.frag"
+
+// Output transfer function, set per pipeline. Values match OutputTransfer. sRGB is encoded by the framebuffer.
+layout(constant_id = 0) const int Transfer = 0;
+
+const int TransferSrgb = 0;
+const int TransferPq = 1;
+
+// Scale of SDR white, 203 nits in PQ
+float SdrWhite()
+{
+    return Transfer == TransferPq ? 2.03 : 1.0;
+}
+
+// SDR content in BT.709, shown on the output without changing its appearance
+vec3 SdrToOutput( vec3 color )
+{
+    if( Transfer != TransferPq ) return color;
+    const mat3 Bt709ToBt2020 = mat3(
+        0.6274040, 0.0690970, 0.0163916,
+        0.3292820, 0.9195400, 0.0880132,
+        0.0433136, 0.0113612, 0.8955950 );
+    return Bt709ToBt2020 * color * SdrWhite();
+}
+
+vec3 EncodeOutput( vec3 color )
+{
+    if( Transfer == TransferPq ) return Pq( color );
+    return color;
+}
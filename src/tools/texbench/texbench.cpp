@@ -0,0 +1,297 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <getopt.h>
+#include <memory>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "GitRef.hpp"
+#include "util/Ansi.hpp"
+#include "util/ArgParser.hpp"
+#include "util/Bitmap.hpp"
+#include "util/BitmapHdr.hpp"
+#include "util/BitmapHdrHalf.hpp"
+#include "util/Clock.hpp"
+#include "util/Logs.hpp"
+#include "util/TaskDispatch.hpp"
+#include "vulkan/VlkBase.hpp"
+#include "vulkan/VlkDevice.hpp"
+#include "vulkan/VlkFence.hpp"
+#include "vulkan/VlkGarbage.hpp"
+#include "vulkan/VlkInstance.hpp"
+#include "vulkan/VlkPhysicalDevice.hpp"
+#include "vulkan/VlkTimelineSemaphore.hpp"
+#include "vulkan/ext/PhysDevSel.hpp"
+#include "vulkan/ext/Texture.hpp"
+
+static void PrintHelp()
+{
+    printf( ANSI_BOLD "texbench — Vulkan texture upload and readback benchmark, build %s" ANSI_RESET "\n\n", GitRef );
+    printf( "Usage: texbench [options]\n" );
+    printf( "Options:\n" );
+    printf( "  -V, --validation [on|off]    Enable or disable Vulkan validation layers\n" );
+    printf( "  -g, --gpu [id]               Select GPU by id, or all\n" );
+    printf( "  -s, --size [pixels]          Width and height of the test images (default 4096)\n" );
+    printf( "  -r, --repeats [count]        Measurements per case, the median is reported (default 10)\n" );
+    printf( "  --help                       Print this help\n" );
+}
+
+namespace
+{
+using Clock = std::chrono::steady_clock;
+
+double Ms( Clock::time_point t0, Clock::time_point t1 )
+{
+    return std::chrono::duration<double, std::milli>( t1 - t0 ).count();
+}
+
+void Report( const char* name, double ms, size_t pixels, size_t bytes )
+{
+    printf( "  %-36s %9.3f ms %9.1f MP/s %8.2f GB/s\n", name, ms, pixels / ms / 1000., bytes / ms / 1e6 );
+}
+
+// Marks the moment the garbage collector releases it
+class Probe : public VlkBase
+{
+public:
+    explicit Probe( std::atomic<Clock::rep>& released ) : m_released( released ) {}
+    ~Probe() override { m_released.store( Clock::now().time_since_epoch().count(), std::memory_order_release ); }
+
+private:
+    std::atomic<Clock::rep>& m_released;
+};
+
+struct Images
+{
+    std::unique_ptr<Bitmap> sdr;
+    std::unique_ptr<BitmapHdrHalf> half;
+    std::unique_ptr<BitmapHdr> hdr;
+};
+
+Images MakeImages( uint32_t size )
+{
+    Images ret;
+    ret.sdr = std::make_unique<Bitmap>( size, size );
+    ret.hdr = std::make_unique<BitmapHdr>( size, size, Colorspace::BT709 );
+
+    auto sdr = ret.sdr->Data();
+    auto hdr = ret.hdr->Data();
+    for( uint32_t y=0; y<size; y++ )
+    {
+        for( uint32_t x=0; x<size; x++ )
+        {
+            *sdr++ = x & 0xFF;
+            *sdr++ = y & 0xFF;
+            *sdr++ = ( x ^ y ) & 0xFF;
+            *sdr++ = 0xFF;
+            *hdr++ = float( x ) / size * 4;
+            *hdr++ = float( y ) / size * 4;
+            *hdr++ = float( ( x ^ y ) & 0xFF ) / 255;
+            *hdr++ = 1;
+        }
+    }
+    ret.half = std::make_unique<BitmapHdrHalf>( *ret.hdr );
+    return ret;
+}
+
+template<typename T>
+double MeasureUpload( VlkDevice& device, const T& bmp, VkFormat format, Texture::Mips mips, int repeats, TaskDispatch& td )
+{
+    return MeasureMedian( repeats, [&] {
+        std::vector<std::shared_ptr<VlkFence>> fences;
+        const auto t0 = Clock::now();
+        auto texture = std::make_unique<Texture>( device, bmp, format, mips, fences, &td );
+        for( auto& fence : fences ) fence->Wait();
+        return Ms( t0, Clock::now() );
+    } );
+}
+
+void RunUploads( VlkDevice& device, const Images& images, int repeats, TaskDispatch& td )
+{
+    const size_t pixels = size_t( images.sdr->Width() ) * images.sdr->Height();
+
+    struct Mode
+    {
+        Texture::Mips mips;
+        const char* name;
+    };
+    constexpr Mode modes[] = {
+        { Texture::Mips::None, "no mips" },
+        { Texture::Mips::Cpu, "CPU mips" },
+        { Texture::Mips::Gpu, "GPU mips" }
+    };
+
+    char name[64];
+    for( auto& mode : modes )
+    {
+        snprintf( name, sizeof( name ), "Upload SDR, %s", mode.name );
+        Report( name, MeasureUpload( device, *images.sdr, VK_FORMAT_R8G8B8A8_SRGB, mode.mips, repeats, td ), pixels, pixels * 4 );
+        snprintf( name, sizeof( name ), "Upload half, %s", mode.name );
+        Report( name, MeasureUpload( device, *images.half, VK_FORMAT_R16G16B16A16_SFLOAT, mode.mips, repeats, td ), pixels, pixels * 8 );
+        snprintf( name, sizeof( name ), "Upload float to half, %s", mode.name );
+        Report( name, MeasureUpload( device, *images.hdr, VK_FORMAT_R16G16B16A16_SFLOAT, mode.mips, repeats, td ), pixels, pixels * 16 );
+        snprintf( name, sizeof( name ), "Upload float, %s", mode.name );
+        Report( name, MeasureUpload( device, *images.hdr, VK_FORMAT_R32G32B32A32_SFLOAT, mode.mips, repeats, td ), pixels, pixels * 16 );
+    }
+}
+
+void RunReadbacks( VlkDevice& device, const Images& images, int repeats, TaskDispatch& td )
+{
+    const size_t pixels = size_t( images.sdr->Width() ) * images.sdr->Height();
+
+    std::vector<std::shared_ptr<VlkFence>> fences;
+    Texture sdr( device, *images.sdr, VK_FORMAT_R8G8B8A8_SRGB, Texture::Mips::None, fences, &td );
+    Texture half( device, *images.half, VK_FORMAT_R16G16B16A16_SFLOAT, Texture::Mips::None, fences, &td );
+    for( auto& fence : fences ) fence->Wait();
+
+    Report( "Readback SDR", MeasureMedian( repeats, [&] {
+        const auto t0 = Clock::now();
+        auto bmp = sdr.ReadbackSdr( device );
+        return Ms( t0, Clock::now() );
+    } ), pixels, pixels * 4 );
+
+    Report( "Readback half", MeasureMedian( repeats, [&] {
+        const auto t0 = Clock::now();
+        auto bmp = half.ReadbackHdr( device );
+        return Ms( t0, Clock::now() );
+    } ), pixels, pixels * 8 );
+
+    const VkRect2D region = { {}, { 256, 256 } };
+    Report( "Readback SDR, 256x256 region", MeasureMedian( repeats, [&] {
+        const auto t0 = Clock::now();
+        auto bmp = sdr.ReadbackSdr( device, region );
+        return Ms( t0, Clock::now() );
+    } ), 256 * 256, 256 * 256 * 4 );
+}
+
+// Time from the timeline reaching the value of a retired object, signalled from the host, to its release
+void RunGarbage( VlkDevice& device, int repeats )
+{
+    auto timeline = std::make_shared<VlkTimelineSemaphore>( device );
+    uint64_t value = 0;
+    std::atomic<Clock::rep> released;
+
+    const auto ms = MeasureMedian( repeats * 10, [&] {
+        released.store( 0, std::memory_order_relaxed );
+        device.GetGarbage()->Recycle( timeline, ++value, std::make_shared<Probe>( released ) );
+
+        const VkSemaphoreSignalInfo info = {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SIGNAL_INFO,
+            .semaphore = *timeline,
+            .value = value
+        };
+        const auto t0 = Clock::now();
+        vkSignalSemaphore( device, &info );
+        while( released.load( std::memory_order_acquire ) == 0 ) std::this_thread::yield();
+        return Ms( t0, Clock::time_point( Clock::duration( released.load( std::memory_order_relaxed ) ) ) );
+    } );
+    printf( "  %-36s %9.3f ms\n", "Garbage reclamation latency", ms );
+}
+
+void RunDevice( VlkInstance& instance, const std::shared_ptr<VlkPhysicalDevice>& physDev, const Images& images, int repeats, TaskDispatch& td )
+{
+    auto& props = physDev->Properties();
+    printf( ANSI_BOLD "%s" ANSI_RESET ", driver %u.%u.%u, Vulkan %u.%u\n", props.deviceName,
+        VK_API_VERSION_MAJOR( props.driverVersion ), VK_API_VERSION_MINOR( props.driverVersion ), VK_API_VERSION_PATCH( props.driverVersion ),
+        VK_API_VERSION_MAJOR( props.apiVersion ), VK_API_VERSION_MINOR( props.apiVersion ) );
+
+    // Staging first, then host image copies, on separate devices
+    for( auto host : { false, true } )
+    {
+        auto device = std::make_unique<VlkDevice>( instance, physDev, VlkDevice::RequireGraphic | ( host ? 0 : VlkDevice::NoHostImageCopy ) );
+        if( host && !device->UseHostImageCopy() )
+        {
+            printf( " Host image copy not available\n" );
+            break;
+        }
+        printf( " %s\n", host ? "Host image copy" : "Staging buffer" );
+        RunUploads( *device, images, repeats, td );
+        RunReadbacks( *device, images, repeats, td );
+        if( !host ) RunGarbage( *device, repeats );
+    }
+}
+}
+
+int main( int argc, char** argv )
+{
+    SetLogLevel( LogLevel::Warning );
+    bool enableValidation = false;
+    const char* gpu = nullptr;
+    uint32_t size = 4096;
+    int repeats = 10;
+
+    enum { OptHelp };
+
+    struct option longOptions[] = {
+        { "validation", required_argument, nullptr, 'V' },
+        { "gpu", required_argument, nullptr, 'g' },
+        { "size", required_argument, nullptr, 's' },
+        { "repeats", required_argument, nullptr, 'r' },
+        { "help", no_argument, nullptr, OptHelp },
+        {}
+    };
+
+    int opt;
+    while( ( opt = getopt_long( argc, argv, "V:g:s:r:", longOptions, nullptr ) ) != -1 )
+    {
+        switch( opt )
+        {
+        case 'V':
+            enableValidation = ParseBoolean( optarg );
+            break;
+        case 'g':
+            gpu = optarg;
+            break;
+        case 's':
+            size = std::clamp( atoi( optarg ), 256, 16384 );
+            break;
+        case 'r':
+            repeats = std::max( 1, atoi( optarg ) );
+            break;
+        case OptHelp:
+            PrintHelp();
+            return 0;
+        default:
+            PrintHelp();
+            return 1;
+        }
+    }
+
+    VlkInstance instance( VlkInstanceType::Headless, enableValidation );
+    const auto& devices = instance.QueryPhysicalDevices();
+    CheckPanic( !devices.empty(), "No Vulkan physical devices found" );
+    for( size_t i=0; i<devices.size(); i++ ) printf( "GPU %zu: %s\n", i, devices[i]->Properties().deviceName );
+
+    std::vector<std::shared_ptr<VlkPhysicalDevice>> selected;
+    if( !gpu )
+    {
+        auto best = PhysDevSel::PickBest( devices, VK_NULL_HANDLE, PhysDevSel::RequireGraphic );
+        CheckPanic( best, "Failed to find suitable Vulkan physical device" );
+        selected.emplace_back( std::move( best ) );
+    }
+    else if( strcmp( gpu, "all" ) == 0 )
+    {
+        selected = devices;
+    }
+    else
+    {
+        const auto id = atoi( gpu );
+        CheckPanic( id >= 0 && id < (int)devices.size(), "Invalid GPU id, must be in range 0 - %zu", devices.size() - 1 );
+        selected.emplace_back( devices[id] );
+    }
+
+    TaskDispatch td( std::max( 1u, std::thread::hardware_concurrency() - 1 ), "Worker" );
+    printf( "Preparing %ux%u images, median of %d runs\n\n", size, size, repeats );
+    const auto images = MakeImages( size );
+
+    for( auto& dev : selected )
+    {
+        RunDevice( instance, dev, images, repeats, td );
+        printf( "\n" );
+    }
+    return 0;
+}
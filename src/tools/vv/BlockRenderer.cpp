@@ -0,0 +1,242 @@
+#include <array>
+#include <stdint.h>
+#include <string.h>
+
+#include "BlockRenderer.hpp"
+#include "util/Bitmap.hpp"
+
+namespace
+{
+struct Number
+{
+    char str[4];
+    uint8_t len;
+};
+
+constexpr std::array<Number, 256> MakeNumbers()
+{
+    std::array<Number, 256> ret = {};
+    for( int i=0; i<256; i++ )
+    {
+        auto& n = ret[i];
+        if( i >= 100 )
+        {
+            n.str[0] = '0' + i / 100;
+            n.str[1] = '0' + i / 10 % 10;
+            n.str[2] = '0' + i % 10;
+            n.len = 3;
+        }
+        else if( i >= 10 )
+        {
+            n.str[0] = '0' + i / 10;
+            n.str[1] = '0' + i % 10;
+            n.len = 2;
+        }
+        else
+        {
+            n.str[0] = '0' + i;
+            n.len = 1;
+        }
+    }
+    return ret;
+}
+
+constexpr auto Numbers = MakeNumbers();
+
+// Quadrant glyphs, indexed by a mask of the foreground pixels: top left, top right, bottom left, bottom right
+constexpr const char* Quadrants[16] = {
+    " ", "▘", "▝", "▀", "▖", "▌", "▞", "▛", "▗", "▚", "▐", "▜", "▄", "▙", "▟", "█"
+};
+
+constexpr uint32_t NoColor = 0xFFFFFFFF;
+
+class Writer
+{
+public:
+    explicit Writer( size_t reserve ) { m_buf.resize( reserve ); }
+
+    void Cell( uint32_t fg, uint32_t bg, const char* glyph )
+    {
+        // Spaces don't show the foreground, so it doesn't need to be set
+        const bool setFg = fg != m_fg && glyph[0] != ' ';
+        const bool setBg = bg != m_bg;
+        if( setFg || setBg )
+        {
+            Put( "\033[", 2 );
+            if( setFg )
+            {
+                Put( "38;2", 4 );
+                Color( fg );
+                m_fg = fg;
+            }
+            if( setBg )
+            {
+                if( setFg ) Put( ";", 1 );
+                Put( "48;2", 4 );
+                Color( bg );
+                m_bg = bg;
+            }
+            Put( "m", 1 );
+        }
+        Put( glyph, strlen( glyph ) );
+    }
+
+    // Cell of the last, odd row, which has no background pixel
+    void Top( uint32_t fg )
+    {
+        if( fg != m_fg )
+        {
+            Put( "\033[38;2", 6 );
+            Color( fg );
+            Put( "m", 1 );
+            m_fg = fg;
+        }
+        Put( "▀", 3 );
+    }
+
+    void EndLine()
+    {
+        Put( "\033[0m\n", 5 );
+        m_fg = m_bg = NoColor;
+    }
+
+    std::string Finish()
+    {
+        m_buf.resize( m_size );
+        return std::move( m_buf );
+    }
+
+private:
+    void Color( uint32_t c )
+    {
+        for( int i=0; i<3; i++ )
+        {
+            auto& n = Numbers[( c >> ( i * 8 ) ) & 0xFF];
+            Put( ";", 1 );
+            Put( n.str, n.len );
+        }
+    }
+
+    void Put( const char* str, size_t len )
+    {
+        if( m_size + len > m_buf.size() ) m_buf.resize( m_buf.size() * 2 + len );
+        memcpy( m_buf.data() + m_size, str, len );
+        m_size += len;
+    }
+
+    std::string m_buf;
+    size_t m_size = 0;
+    uint32_t m_fg = NoColor;
+    uint32_t m_bg = NoColor;
+};
+
+inline int Channel( uint32_t v, int c ) { return ( v >> ( c * 8 ) ) & 0xFF; }
+
+// Average of the pixels selected by the mask, and the squared error to it
+uint32_t Average( const uint32_t* px, uint32_t mask, uint32_t& error )
+{
+    int sum[3] = {};
+    int n = 0;
+    for( int i=0; i<4; i++ )
+    {
+        if( ( mask & ( 1 << i ) ) == 0 ) continue;
+        for( int c=0; c<3; c++ ) sum[c] += Channel( px[i], c );
+        n++;
+    }
+    uint32_t avg = 0;
+    for( int c=0; c<3; c++ ) avg |= uint32_t( ( sum[c] + n / 2 ) / n ) << ( c * 8 );
+
+    for( int i=0; i<4; i++ )
+    {
+        if( ( mask & ( 1 << i ) ) == 0 ) continue;
+        for( int c=0; c<3; c++ )
+        {
+            const auto d = Channel( px[i], c ) - Channel( avg, c );
+            error += d * d;
+        }
+    }
+    return avg;
+}
+
+void RenderHalf( const Bitmap& bitmap, Writer& out )
+{
+    const auto w = bitmap.Width();
+    const auto h = bitmap.Height();
+    auto px = (const uint32_t*)bitmap.Data();
+
+    for( uint32_t y=0; y+1<h; y+=2 )
+    {
+        auto row0 = px + size_t( y ) * w;
+        auto row1 = row0 + w;
+        for( uint32_t x=0; x<w; x++ )
+        {
+            const auto c0 = row0[x] & 0xFFFFFF;
+            const auto c1 = row1[x] & 0xFFFFFF;
+            if( c0 == c1 ) out.Cell( c0, c1, " " );
+            else out.Cell( c0, c1, "▀" );
+        }
+        out.EndLine();
+    }
+    if( ( h & 1 ) != 0 )
+    {
+        auto row = px + size_t( h - 1 ) * w;
+        for( uint32_t x=0; x<w; x++ ) out.Top( row[x] & 0xFFFFFF );
+        out.EndLine();
+    }
+}
+
+// Each cell picks the split of its four pixels into two colours with the smallest error
+void RenderQuadrant( const Bitmap& bitmap, Writer& out )
+{
+    const auto w = bitmap.Width();
+    const auto h = bitmap.Height();
+    auto src = (const uint32_t*)bitmap.Data();
+
+    for( uint32_t y=0; y<h; y+=2 )
+    {
+        const auto y1 = std::min( y + 1, h - 1 );
+        for( uint32_t x=0; x<w; x+=2 )
+        {
+            const auto x1 = std::min( x + 1, w - 1 );
+            const uint32_t px[4] = {
+                src[size_t( y ) * w + x],
+                src[size_t( y ) * w + x1],
+                src[size_t( y1 ) * w + x],
+                src[size_t( y1 ) * w + x1]
+            };
+
+            uint32_t bestError = UINT32_MAX;
+            uint32_t bestMask = 0;
+            uint32_t fg = 0, bg = 0;
+
+            // The bottom right pixel is always background, the complementary masks are equivalent
+            for( uint32_t mask=0; mask<8; mask++ )
+            {
+                uint32_t error = 0;
+                const auto b = Average( px, ~mask & 0xF, error );
+                const auto f = mask ? Average( px, mask, error ) : b;
+                if( error < bestError )
+                {
+                    bestError = error;
+                    bestMask = mask;
+                    fg = f;
+                    bg = b;
+                }
+            }
+            out.Cell( fg, bg, Quadrants[bestMask] );
+        }
+        out.EndLine();
+    }
+}
+}
+
+std::string RenderBlocks( const Bitmap& bitmap, BlockMode mode )
+{
+    const auto cells = size_t( bitmap.Width() ) * ( bitmap.Height() + 1 ) / ( mode == BlockMode::Half ? 2 : 4 );
+    Writer out( cells * 16 + bitmap.Height() * 5 );
+
+    if( mode == BlockMode::Half ) RenderHalf( bitmap, out );
+    else RenderQuadrant( bitmap, out );
+
+    return out.Finish();
+}
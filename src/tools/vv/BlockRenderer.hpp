@@ -0,0 +1,15 @@
+#pragma once
+
+#include <string>
+
+class Bitmap;
+
+enum class BlockMode
+{
+    Half,           // Two pixels per cell, stacked
+    Quadrant        // Four pixels per cell, approximated with two colours
+};
+
+// Text output with 24-bit colour escapes. Colours are only set when they differ from the ones of the previous cell,
+// and the whole image is returned as one string, to be written at once.
+std::string RenderBlocks( const Bitmap& bitmap, BlockMode mode );
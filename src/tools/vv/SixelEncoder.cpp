@@ -0,0 +1,327 @@
+#include <algorithm>
+#include <charconv>
+#include <format>
+#include <tracy/Tracy.hpp>
+
+#ifdef __AVX2__
+#  include <x86intrin.h>
+#endif
+
+#include "SixelEncoder.hpp"
+#include "util/Bitmap.hpp"
+#include "util/TaskDispatch.hpp"
+
+namespace
+{
+constexpr size_t MaxSamples = 32 * 1024;
+constexpr int32_t PadColor = 1000;
+
+constexpr int Bayer4[4][4] = {
+    {  0,  8,  2, 10 },
+    { 12,  4, 14,  6 },
+    {  3, 11,  1,  9 },
+    { 15,  7, 13,  5 }
+};
+
+inline uint32_t Channel( uint32_t v, int c ) { return ( v >> ( c * 8 ) ) & 0xFF; }
+
+struct Box
+{
+    uint32_t begin, end;
+    uint32_t min[3], max[3];
+
+    void Bounds( const std::vector<uint32_t>& samples )
+    {
+        for( int c=0; c<3; c++ )
+        {
+            min[c] = 255;
+            max[c] = 0;
+        }
+        for( uint32_t i=begin; i<end; i++ )
+        {
+            for( int c=0; c<3; c++ )
+            {
+                const auto v = Channel( samples[i], c );
+                min[c] = std::min( min[c], v );
+                max[c] = std::max( max[c], v );
+            }
+        }
+    }
+
+    [[nodiscard]] int Axis() const
+    {
+        int axis = 0;
+        for( int c=1; c<3; c++ ) if( max[c] - min[c] > max[axis] - min[axis] ) axis = c;
+        return axis;
+    }
+
+    [[nodiscard]] uint32_t Range() const { return end - begin > 1 ? max[Axis()] - min[Axis()] : 0; }
+};
+
+void EmitNumber( std::string& out, char prefix, uint32_t value )
+{
+    char buf[16];
+    buf[0] = prefix;
+    const auto res = std::to_chars( buf + 1, buf + sizeof( buf ), value );
+    out.append( buf, res.ptr );
+}
+
+void EmitRun( std::string& out, char ch, uint32_t count )
+{
+    if( count > 3 )
+    {
+        EmitNumber( out, '!', count );
+        out.push_back( ch );
+    }
+    else
+    {
+        out.append( count, ch );
+    }
+}
+}
+
+SixelEncoder::SixelEncoder( TaskDispatch& td, bool dither )
+    : m_td( td )
+    , m_dither( dither )
+{
+}
+
+std::string SixelEncoder::Encode( const Bitmap& bitmap )
+{
+    ZoneScoped;
+
+    const auto w = bitmap.Width();
+    const auto h = bitmap.Height();
+
+    BuildPalette( bitmap );
+    BuildLut();
+
+    std::vector<uint8_t> indices( size_t( w ) * h );
+    m_td.ParallelFor( 0, h, 64, [&]( size_t begin, size_t end ) {
+        Map( bitmap, begin, end, indices );
+    } );
+
+    const auto numBands = ( h + 5 ) / 6;
+    std::vector<std::string> bands( numBands );
+    m_td.ParallelFor( 0, numBands, 1, [&]( size_t begin, size_t end ) {
+        for( size_t i=begin; i<end; i++ )
+        {
+            EncodeBand( indices.data() + i * 6 * w, w, std::min<uint32_t>( 6, h - i * 6 ), bands[i] );
+        }
+    } );
+
+    std::string out = std::format( "\033Pq\"1;1;{};{}", w, h );
+    for( size_t i=0; i<m_palette.size(); i++ )
+    {
+        const auto c = m_palette[i];
+        out.append( std::format( "#{};2;{};{};{}", i, ( Channel( c, 0 ) * 100 + 127 ) / 255, ( Channel( c, 1 ) * 100 + 127 ) / 255, ( Channel( c, 2 ) * 100 + 127 ) / 255 ) );
+    }
+    for( size_t i=0; i<numBands; i++ )
+    {
+        out.append( bands[i] );
+        if( i != numBands - 1 ) out.push_back( '-' );
+    }
+    out.append( "\033\\" );
+    return out;
+}
+
+void SixelEncoder::BuildPalette( const Bitmap& bitmap )
+{
+    ZoneScoped;
+
+    const auto px = (const uint32_t*)bitmap.Data();
+    const auto size = size_t( bitmap.Width() ) * bitmap.Height();
+    const auto step = std::max<size_t>( 1, size / MaxSamples );
+
+    std::vector<uint32_t> samples;
+    samples.reserve( size / step + 1 );
+    for( size_t i=0; i<size; i+=step ) samples.emplace_back( px[i] & 0xFFFFFF );
+
+    // Median cut: the box with the widest channel range is split at its median, until there are enough colours
+    std::vector<Box> boxes;
+    boxes.emplace_back( Box { 0, uint32_t( samples.size() ) } );
+    boxes.back().Bounds( samples );
+    while( boxes.size() < MaxColors )
+    {
+        auto it = std::ranges::max_element( boxes, []( const auto& a, const auto& b ) { return a.Range() < b.Range(); } );
+        if( it->Range() == 0 ) break;
+
+        const auto axis = it->Axis();
+        const auto mid = it->begin + ( it->end - it->begin ) / 2;
+        std::nth_element( samples.begin() + it->begin, samples.begin() + mid, samples.begin() + it->end, [axis]( auto a, auto b ) {
+            return Channel( a, axis ) < Channel( b, axis );
+        } );
+
+        Box upper = { mid, it->end };
+        it->end = mid;
+        it->Bounds( samples );
+        upper.Bounds( samples );
+        boxes.emplace_back( upper );
+    }
+
+    m_palette.clear();
+    for( auto& box : boxes )
+    {
+        uint64_t sum[3] = {};
+        for( uint32_t i=box.begin; i<box.end; i++ )
+        {
+            for( int c=0; c<3; c++ ) sum[c] += Channel( samples[i], c );
+        }
+        const auto n = std::max<uint64_t>( 1, box.end - box.begin );
+        m_palette.emplace_back( uint32_t( sum[0] / n ) | uint32_t( sum[1] / n ) << 8 | uint32_t( sum[2] / n ) << 16 );
+    }
+}
+
+void SixelEncoder::BuildLut()
+{
+    ZoneScoped;
+
+    const auto num = uint32_t( m_palette.size() );
+    const auto num8 = ( num + 7 ) & ~7u;
+    for( uint32_t i=0; i<num8; i++ )
+    {
+        m_red[i] = i < num ? Channel( m_palette[i], 0 ) : PadColor;
+        m_green[i] = i < num ? Channel( m_palette[i], 1 ) : PadColor;
+        m_blue[i] = i < num ? Channel( m_palette[i], 2 ) : PadColor;
+    }
+
+    // Nearest palette entry for the centre of each cell, so that mapping a pixel is a single lookup
+    m_td.ParallelFor( 0, 32, 1, [this, num8]( size_t begin, size_t end ) {
+        for( size_t r=begin; r<end; r++ )
+        {
+            for( int g=0; g<32; g++ )
+            {
+                for( int b=0; b<32; b++ )
+                {
+                    const int cr = r * 8 + 4;
+                    const int cg = g * 8 + 4;
+                    const int cb = b * 8 + 4;
+
+#ifdef __AVX2__
+                    const auto vr = _mm256_set1_epi32( cr );
+                    const auto vg = _mm256_set1_epi32( cg );
+                    const auto vb = _mm256_set1_epi32( cb );
+                    const auto step = _mm256_set1_epi32( 8 );
+                    auto idx = _mm256_setr_epi32( 0, 1, 2, 3, 4, 5, 6, 7 );
+                    auto bestDist = _mm256_set1_epi32( INT32_MAX );
+                    auto bestIdx = _mm256_setzero_si256();
+                    for( uint32_t i=0; i<num8; i+=8 )
+                    {
+                        const auto dr = _mm256_sub_epi32( _mm256_load_si256( (const __m256i*)( m_red.data() + i ) ), vr );
+                        const auto dg = _mm256_sub_epi32( _mm256_load_si256( (const __m256i*)( m_green.data() + i ) ), vg );
+                        const auto db = _mm256_sub_epi32( _mm256_load_si256( (const __m256i*)( m_blue.data() + i ) ), vb );
+                        const auto dist = _mm256_add_epi32( _mm256_add_epi32( _mm256_mullo_epi32( dr, dr ), _mm256_mullo_epi32( dg, dg ) ), _mm256_mullo_epi32( db, db ) );
+                        const auto closer = _mm256_cmpgt_epi32( bestDist, dist );
+                        bestDist = _mm256_min_epi32( bestDist, dist );
+                        bestIdx = _mm256_blendv_epi8( bestIdx, idx, closer );
+                        idx = _mm256_add_epi32( idx, step );
+                    }
+
+                    alignas( 32 ) int32_t dists[8];
+                    alignas( 32 ) int32_t idxs[8];
+                    _mm256_store_si256( (__m256i*)dists, bestDist );
+                    _mm256_store_si256( (__m256i*)idxs, bestIdx );
+                    int best = 0;
+                    for( int i=1; i<8; i++ )
+                    {
+                        if( dists[i] < dists[best] || ( dists[i] == dists[best] && idxs[i] < idxs[best] ) ) best = i;
+                    }
+                    m_lut[r << 10 | g << 5 | b] = uint8_t( idxs[best] );
+#else
+                    uint32_t best = 0;
+                    int bestDist = INT32_MAX;
+                    for( uint32_t i=0; i<num8; i++ )
+                    {
+                        const int dr = m_red[i] - cr;
+                        const int dg = m_green[i] - cg;
+                        const int db = m_blue[i] - cb;
+                        const auto dist = dr * dr + dg * dg + db * db;
+                        if( dist < bestDist )
+                        {
+                            bestDist = dist;
+                            best = i;
+                        }
+                    }
+                    m_lut[r << 10 | g << 5 | b] = uint8_t( best );
+#endif
+                }
+            }
+        }
+    } );
+}
+
+void SixelEncoder::Map( const Bitmap& bitmap, uint32_t y0, uint32_t y1, std::vector<uint8_t>& indices ) const
+{
+    const auto w = bitmap.Width();
+    for( uint32_t y=y0; y<y1; y++ )
+    {
+        auto src = (const uint32_t*)bitmap.Data() + size_t( y ) * w;
+        auto dst = indices.data() + size_t( y ) * w;
+        if( m_dither )
+        {
+            // Offsets span one LUT cell, -4 to 3
+            for( uint32_t x=0; x<w; x++ )
+            {
+                const auto d = ( Bayer4[y & 3][x & 3] - 8 ) / 2;
+                const auto r = std::clamp<int>( Channel( src[x], 0 ) + d, 0, 255 );
+                const auto g = std::clamp<int>( Channel( src[x], 1 ) + d, 0, 255 );
+                const auto b = std::clamp<int>( Channel( src[x], 2 ) + d, 0, 255 );
+                dst[x] = m_lut[( r >> 3 ) << 10 | ( g >> 3 ) << 5 | ( b >> 3 )];
+            }
+        }
+        else
+        {
+            for( uint32_t x=0; x<w; x++ )
+            {
+                const auto v = src[x];
+                dst[x] = m_lut[( v & 0xF8 ) << 7 | ( v & 0xF800 ) >> 6 | ( v & 0xF80000 ) >> 19];
+            }
+        }
+    }
+}
+
+void SixelEncoder::EncodeBand( const uint8_t* indices, uint32_t width, uint32_t rows, std::string& out ) const
+{
+    // Sixel bits of each colour, kept zeroed between bands. Only the used range of each colour is touched.
+    thread_local std::vector<uint8_t> bits;
+    bits.resize( size_t( MaxColors ) * width );
+
+    std::array<uint32_t, MaxColors> lo;
+    std::array<uint32_t, MaxColors> hi = {};
+    lo.fill( width );
+
+    for( uint32_t k=0; k<rows; k++ )
+    {
+        auto row = indices + size_t( k ) * width;
+        for( uint32_t x=0; x<width; x++ )
+        {
+            const auto c = row[x];
+            bits[size_t( c ) * width + x] |= 1 << k;
+            lo[c] = std::min( lo[c], x );
+            hi[c] = std::max( hi[c], x + 1 );
+        }
+    }
+
+    bool first = true;
+    for( uint32_t c=0; c<m_palette.size(); c++ )
+    {
+        if( hi[c] == 0 ) continue;
+        if( !first ) out.push_back( '$' );
+        first = false;
+        EmitNumber( out, '#', c );
+
+        auto line = bits.data() + size_t( c ) * width;
+        if( lo[c] > 0 ) EmitRun( out, '?', lo[c] );
+
+        uint32_t x = lo[c];
+        while( x < hi[c] )
+        {
+            const auto v = line[x];
+            uint32_t n = 1;
+            while( x + n < hi[c] && line[x + n] == v ) n++;
+            EmitRun( out, char( 63 + v ), n );
+            x += n;
+        }
+        std::fill( line + lo[c], line + hi[c], 0 );
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <array>
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+class Bitmap;
+class TaskDispatch;
+
+// Sixel output for opaque RGBA bitmaps. The palette is built by median cut on a subsample of the pixels, and
+// pixels are mapped to it through a lookup table of 5 bits per channel, with optional 4x4 ordered dithering.
+// Mapping and encoding of the six row bands run in parallel.
+class SixelEncoder
+{
+public:
+    static constexpr uint32_t MaxColors = 256;
+
+    SixelEncoder( TaskDispatch& td, bool dither );
+
+    [[nodiscard]] std::string Encode( const Bitmap& bitmap );
+
+private:
+    void BuildPalette( const Bitmap& bitmap );
+    void BuildLut();
+    void Map( const Bitmap& bitmap, uint32_t y0, uint32_t y1, std::vector<uint8_t>& indices ) const;
+    void EncodeBand( const uint8_t* indices, uint32_t width, uint32_t rows, std::string& out ) const;
+
+    TaskDispatch& m_td;
+    bool m_dither;
+
+    std::vector<uint32_t> m_palette;        // 0xBBGGRR
+
+    // The palette split into channels, padded to a multiple of 8 entries which are never the closest
+    alignas( 32 ) std::array<int32_t, MaxColors> m_red;
+    alignas( 32 ) std::array<int32_t, MaxColors> m_green;
+    alignas( 32 ) std::array<int32_t, MaxColors> m_blue;
+    std::array<uint8_t, 32 * 32 * 32> m_lut;
+};
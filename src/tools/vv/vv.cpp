@@ -1,24 +1,33 @@
 #include <algorithm>
+#include <chrono>
+#include <dirent.h>
 #include <libbase64.h>
 #include <format>
+#include <future>
+#include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <memory>
 #include <thread>
-#include <sixel.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <string_view>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 #include <vector>
 #include <zlib.h>
 
+#include "BlockRenderer.hpp"
 #include "GitRef.hpp"
+#include "SixelEncoder.hpp"
 #include "Terminal.hpp"
 #include "image/ImageLoader.hpp"
 #include "util/Ansi.hpp"
 #include "util/Bitmap.hpp"
-#include "util/BitmapAnim.hpp"
+#include "util/BitmapAnimStream.hpp"
 #include "util/BitmapHdr.hpp"
 #include "util/Callstack.hpp"
 #include "util/Home.hpp"
@@ -26,15 +35,18 @@
 #include "util/Panic.hpp"
 #include "util/TaskDispatch.hpp"
 #include "util/Tonemapper.hpp"
+#include "util/TonemapperLut.hpp"
 #include "util/VectorImage.hpp"
 
 static void PrintHelp()
 {
     printf( ANSI_BOLD "vv — terminal image viewer, build %s" ANSI_RESET "\n\n", GitRef );
-    printf( "Usage: vv [options] <image>\n" );
+    printf( "Usage: vv [options] <image> [more images or directories]\n" );
     printf( "Options:\n" );
     printf( "  -b, --block                  Use text-only block mode\n" );
+    printf( "  -Q, --quadrant               Use quadrant glyphs in block mode\n" );
     printf( "  -6, --sixel                  Use sixel graphics mode\n" );
+    printf( "  -D, --dither                 Use ordered dithering in sixel mode\n" );
     printf( "  -s, --scale                  Try to scale up image to 2x\n" );
     printf( "  -f, --fit                    Fit image to terminal size\n" );
     printf( "  -G, --background [color]     Set background color to RRGGBB in hex\n" );
@@ -42,12 +54,15 @@ static void PrintHelp()
     printf( "  -A, --noanim                 Disable animation\n" );
     printf( "  -w, --write [file.png]       Write output to file\n" );
     printf( "  -t, --tonemap [operator]     Choose HDR tone mapping operator\n" );
+    printf( "  -L, --lut                    Tone map through baked LUTs\n" );
     printf( "  --help                       Print this help\n" );
     printf( "\nTone mapping operators:\n" );
     printf( "  pbr (default)\n" );
     printf( "  agx\n" );
     printf( "  agx-golden\n" );
     printf( "  agx-punchy\n" );
+    printf( "  file.cube (custom look)\n" );
+    printf( "\nMultiple files, or a directory, are shown as a contact sheet.\n" );
 }
 
 enum class ScaleMode
@@ -57,47 +72,80 @@ enum class ScaleMode
     Scale2x,
 };
 
-static void AdjustBitmap( std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<BitmapAnim>& anim, const std::unique_ptr<VectorImage>& vector, TaskDispatch& td, uint32_t col, uint32_t row, ScaleMode scale )
+// Returns the size a w x h image is shown at in a col x row area.
+static std::pair<uint32_t, uint32_t> FitSize( uint32_t w, uint32_t h, uint32_t col, uint32_t row, ScaleMode scale )
 {
-    if( anim )
+    if( scale == ScaleMode::Fit || w > col || h > row )
     {
-        const auto& bmp = anim->GetFrame( 0 ).bmp;
-        const auto w = bmp->Width();
-        const auto h = bmp->Height();
-
-        if( scale == ScaleMode::Fit || w > col || h > row )
-        {
-            const auto ratio = std::min( float( col ) / w, float( row ) / h );
-            const auto rw = uint32_t( w * ratio );
-            const auto rh = uint32_t( h * ratio );
-            anim->Resize( rw, rh );
-            mclog( LogLevel::Info, "Animation resized: %ux%u", rw, rh );
-        }
-        else if( scale == ScaleMode::Scale2x && w * 2 <= col && h * 2 <= row )
-        {
-            anim->Resize( w * 2, h * 2 );
-            mclog( LogLevel::Info, "Animation upscaled: %ux%u", w * 2, h * 2 );
-        }
+        const auto ratio = std::min( float( col ) / w, float( row ) / h );
+        return { uint32_t( w * ratio ), uint32_t( h * ratio ) };
     }
-    else if( bitmap )
+    else if( scale == ScaleMode::Scale2x && w * 2 <= col && h * 2 <= row )
     {
-        bitmap->NormalizeOrientation();
+        return { w * 2, h * 2 };
+    }
+    return { w, h };
+}
 
-        const auto w = bitmap->Width();
-        const auto h = bitmap->Height();
+// Resized in stored orientation, so that only the output sized image is rotated.
+static void FitBitmap( Bitmap& bitmap, uint32_t col, uint32_t row, ScaleMode scale, TaskDispatch& td )
+{
+    const bool transposed = bitmap.Orientation() >= 5;
+    const auto w = transposed ? bitmap.Height() : bitmap.Width();
+    const auto h = transposed ? bitmap.Width() : bitmap.Height();
+    const auto [nw, nh] = FitSize( w, h, col, row, scale );
 
-        if( scale == ScaleMode::Fit || w > col || h > row )
+    // HDR images may already be downscaled to the output size before tone mapping
+    if( nw != w || nh != h )
+    {
+        if( transposed ) bitmap.Resize( nh, nw, &td );
+        else bitmap.Resize( nw, nh, &td );
+        mclog( LogLevel::Info, "Image %s: %ux%u", nw > w ? "upscaled" : "resized", nw, nh );
+    }
+    bitmap.NormalizeOrientation( &td );
+}
+
+// Downscales in linear light first, so that only the output sized image is tone mapped.
+static std::unique_ptr<Bitmap> ToneMapHdr( BitmapHdr& hdr, ToneMap::Operator tonemap, uint32_t tw, uint32_t th, ScaleMode scale, TaskDispatch& td )
+{
+    if( tw != 0 && th != 0 )
+    {
+        const bool transposed = hdr.Orientation() >= 5;
+        const auto w = transposed ? hdr.Height() : hdr.Width();
+        const auto h = transposed ? hdr.Width() : hdr.Height();
+        const auto [nw, nh] = FitSize( w, h, tw, th, scale );
+        if( nw < w && nh < h )
         {
-            const auto ratio = std::min( float( col ) / w, float( row ) / h );
-            bitmap->Resize( w * ratio, h * ratio, &td );
-            mclog( LogLevel::Info, "Image resized: %ux%u", bitmap->Width(), bitmap->Height() );
+            if( transposed ) hdr.Resize( nh, nw, &td );
+            else hdr.Resize( nw, nh, &td );
+            mclog( LogLevel::Info, "HDR image resized: %ux%u", nw, nh );
         }
-        else if( scale == ScaleMode::Scale2x && w * 2 <= col && h * 2 <= row )
+    }
+    hdr.NormalizeOrientation( &td );
+    return hdr.Tonemap( tonemap, &td );
+}
+
+// Animation frames are decoded while playing, so only the output size is determined here. NextFrame() then
+// scales each frame to it.
+static void AdjustBitmap( std::unique_ptr<Bitmap>& bitmap, const std::unique_ptr<BitmapAnimStream>& anim, uint32_t& animWidth, uint32_t& animHeight, const std::unique_ptr<VectorImage>& vector, TaskDispatch& td, uint32_t col, uint32_t row, ScaleMode scale )
+{
+    if( anim )
+    {
+        const auto w = anim->Width();
+        const auto h = anim->Height();
+        const auto [aw, ah] = FitSize( w, h, col, row, scale );
+        animWidth = aw;
+        animHeight = ah;
+
+        if( animWidth != w || animHeight != h )
         {
-            bitmap->Resize( w * 2, h * 2, &td );
-            mclog( LogLevel::Info, "Image upscaled: %ux%u", bitmap->Width(), bitmap->Height() );
+            mclog( LogLevel::Info, "Animation %s: %ux%u", animWidth > w ? "upscaled" : "resized", animWidth, animHeight );
         }
     }
+    else if( bitmap )
+    {
+        FitBitmap( *bitmap, col, row, scale, td );
+    }
     else
     {
         CheckPanic( vector, "No image data" );
@@ -114,230 +162,517 @@ static void AdjustBitmap( std::unique_ptr<Bitmap>& bitmap, std::unique_ptr<Bitma
         if( scale == ScaleMode::Fit || w > col || h > row )
         {
             const auto ratio = std::min( float( col ) / w, float( row ) / h );
-            bitmap = vector->Rasterize( w * ratio, h * ratio );
+            bitmap = vector->RasterizeTiled( w * ratio, h * ratio, &td );
         }
         else if( scale == ScaleMode::Scale2x && w * 2 <= col && h * 2 <= row )
         {
-            bitmap = vector->Rasterize( w * 2, h * 2 );
+            bitmap = vector->RasterizeTiled( w * 2, h * 2, &td );
         }
         else
         {
-            bitmap = vector->Rasterize( w, h );
+            bitmap = vector->RasterizeTiled( w, h, &td );
         }
 
         mclog( LogLevel::Info, "Image rasterized: %ux%u", bitmap->Width(), bitmap->Height() );
     }
 }
 
-static void FillBackground( Bitmap& bitmap, uint32_t bg )
+static void FillBackground( Bitmap& bitmap, uint32_t bg, TaskDispatch& td )
 {
     const auto bgc = bg | 0xFF000000;
     const auto bgr = ( bg       ) & 0xFF;
     const auto bgg = ( bg >> 8  ) & 0xFF;
     const auto bgb = ( bg >> 16 ) & 0xFF;
 
-    auto px = (uint32_t*)bitmap.Data();
-    auto sz = bitmap.Width() * bitmap.Height();
-    while( sz-- )
-    {
-        const auto a = *px >> 24;
-        if( a == 0 )
-        {
-            *px = bgc;
-        }
-        else if( a != 255 )
+    auto data = (uint32_t*)bitmap.Data();
+    td.ParallelFor( 0, size_t( bitmap.Width() ) * bitmap.Height(), TaskDispatch::AdaptiveGrain, [=]( size_t begin, size_t end ) {
+        auto px = data + begin;
+        auto sz = end - begin;
+        while( sz-- )
         {
-            const auto r = ( *px       ) & 0xFF;
-            const auto g = ( *px >> 8  ) & 0xFF;
-            const auto b = ( *px >> 16 ) & 0xFF;
+            const auto a = *px >> 24;
+            if( a == 0 )
+            {
+                *px = bgc;
+            }
+            else if( a != 255 )
+            {
+                const auto r = ( *px       ) & 0xFF;
+                const auto g = ( *px >> 8  ) & 0xFF;
+                const auto b = ( *px >> 16 ) & 0xFF;
 
-            const auto ro = bgr + a * ( r - bgr ) / 255;
-            const auto go = bgg + a * ( g - bgg ) / 255;
-            const auto bo = bgb + a * ( b - bgb ) / 255;
+                const auto ro = bgr + a * ( r - bgr ) / 255;
+                const auto go = bgg + a * ( g - bgg ) / 255;
+                const auto bo = bgb + a * ( b - bgb ) / 255;
 
-            *px = ( bo << 16 ) | ( go << 8 ) | ro | 0xFF000000;
+                *px = ( bo << 16 ) | ( go << 8 ) | ro | 0xFF000000;
+            }
+            px++;
         }
-        px++;
-    }
+    } );
 }
 
-static void FillCheckerboard( Bitmap& bitmap, uint32_t shift = 3 )
+static void FillCheckerboard( Bitmap& bitmap, TaskDispatch& td, uint32_t shift = 3 )
 {
     constexpr auto dist = 32;
     constexpr auto bg0 = 128 + dist;
     constexpr auto bg1 = 128 - dist;
 
-    auto px = (uint32_t*)bitmap.Data();
+    auto data = (uint32_t*)bitmap.Data();
     const auto bw = bitmap.Width();
     const auto bh = bitmap.Height();
 
-    for( uint32_t h = 0; h<bh; h++ )
-    {
-        for( uint32_t w = 0; w<bw; w++ )
+    td.ParallelFor( 0, bh, TaskDispatch::AdaptiveGrain, [=]( size_t begin, size_t end ) {
+        auto px = data + begin * bw;
+        for( uint32_t h = begin; h<end; h++ )
         {
-            const auto a = *px >> 24;
-
-            if( a != 255 )
+            for( uint32_t w = 0; w<bw; w++ )
             {
-                const auto sel = ( (w >> shift) + (h >> shift) ) & 1;
-                const auto bg = sel ? bg0 : bg1;
+                const auto a = *px >> 24;
 
-                if( a == 0 )
-                {
-                    *px = bg | (bg << 8 ) | (bg << 16) | 0xFF000000;
-                }
-                else
+                if( a != 255 )
                 {
-                    const auto r = ( *px       ) & 0xFF;
-                    const auto g = ( *px >> 8  ) & 0xFF;
-                    const auto b = ( *px >> 16 ) & 0xFF;
+                    const auto sel = ( (w >> shift) + (h >> shift) ) & 1;
+                    const auto bg = sel ? bg0 : bg1;
+
+                    if( a == 0 )
+                    {
+                        *px = bg | (bg << 8 ) | (bg << 16) | 0xFF000000;
+                    }
+                    else
+                    {
+                        const auto r = ( *px       ) & 0xFF;
+                        const auto g = ( *px >> 8  ) & 0xFF;
+                        const auto b = ( *px >> 16 ) & 0xFF;
 
-                    const auto ro = bg + a * ( r - bg ) / 255;
-                    const auto go = bg + a * ( g - bg ) / 255;
-                    const auto bo = bg + a * ( b - bg ) / 255;
+                        const auto ro = bg + a * ( r - bg ) / 255;
+                        const auto go = bg + a * ( g - bg ) / 255;
+                        const auto bo = bg + a * ( b - bg ) / 255;
 
-                    *px = ( bo << 16 ) | ( go << 8 ) | ro | 0xFF000000;
+                        *px = ( bo << 16 ) | ( go << 8 ) | ro | 0xFF000000;
+                    }
                 }
-            }
 
-            px++;
+                px++;
+            }
         }
-    }
+    } );
+}
+
+static BitmapAnim::Frame NextFrame( BitmapAnimStream& anim, uint32_t width, uint32_t height, int bg, uint32_t shift, TaskDispatch& td )
+{
+    auto frame = anim.Next();
+    if( !frame.bmp ) return frame;
+
+    if( frame.bmp->Width() != width || frame.bmp->Height() != height ) frame.bmp->Resize( width, height, &td );
+    if( bg >= 0 ) FillBackground( *frame.bmp, bg, td );
+    else if( bg == -1 ) FillCheckerboard( *frame.bmp, td, shift );
+    return frame;
 }
 
-static void FillBackground( BitmapAnim& anim, uint32_t bg )
+// Bounding box of the pixels which differ between two frames of the same size. Returns false if they are equal.
+static bool FrameDelta( const Bitmap& prev, const Bitmap& next, uint32_t& x0, uint32_t& y0, uint32_t& x1, uint32_t& y1 )
 {
-    for( size_t i=0; i<anim.FrameCount(); i++ )
+    const auto w = next.Width();
+    const auto h = next.Height();
+    auto pa = (const uint32_t*)prev.Data();
+    auto pb = (const uint32_t*)next.Data();
+
+    x0 = w;
+    y0 = h;
+    x1 = 0;
+    y1 = 0;
+    for( uint32_t y=0; y<h; y++ )
     {
-        FillBackground( *anim.GetFrame( i ).bmp, bg );
+        auto ra = pa + size_t( y ) * w;
+        auto rb = pb + size_t( y ) * w;
+        if( memcmp( ra, rb, w * 4 ) == 0 ) continue;
+
+        uint32_t l = 0;
+        while( ra[l] == rb[l] ) l++;
+        uint32_t r = w;
+        while( ra[r-1] == rb[r-1] ) r--;
+
+        x0 = std::min( x0, l );
+        x1 = std::max( x1, r );
+        if( y0 == h ) y0 = y;
+        y1 = y + 1;
     }
+    return y0 != h;
 }
 
-static void FillCheckerboard( BitmapAnim& anim, uint32_t shift = 3 )
+static std::unique_ptr<Bitmap> CopyRect( const Bitmap& bitmap, uint32_t x, uint32_t y, uint32_t w, uint32_t h )
 {
-    for( size_t i=0; i<anim.FrameCount(); i++ )
+    auto ret = std::make_unique<Bitmap>( w, h );
+    for( uint32_t i=0; i<h; i++ )
     {
-        FillCheckerboard( *anim.GetFrame( i ).bmp, shift );
+        memcpy( ret->Data() + size_t( i ) * w * 4, bitmap.Data() + ( size_t( y + i ) * bitmap.Width() + x ) * 4, w * 4 );
     }
+    return ret;
 }
 
-static void PrintBitmapBlock( Bitmap& bitmap )
+// Entries of the directory which can be loaded, sorted by name.
+static std::vector<std::string> ListImages( const std::string& path, TaskDispatch& td )
 {
-    auto px0 = (uint32_t*)bitmap.Data();
-    auto px1 = px0 + bitmap.Width();
+    std::vector<std::string> files;
+    DIR* dir = opendir( path.c_str() );
+    if( !dir ) return files;
 
-    for( int y=0; y<bitmap.Height() / 2; y++ )
+    struct dirent* entry;
+    while( ( entry = readdir( dir ) ) )
     {
-        for( int x=0; x<bitmap.Width(); x++ )
+        if( entry->d_type == DT_REG || entry->d_type == DT_LNK || entry->d_type == DT_UNKNOWN )
         {
-            auto c0 = *px0++;
-            auto c1 = *px1++;
-            auto r0 = ( c0       ) & 0xFF;
-            auto g0 = ( c0 >> 8  ) & 0xFF;
-            auto b0 = ( c0 >> 16 ) & 0xFF;
-            auto r1 = ( c1       ) & 0xFF;
-            auto g1 = ( c1 >> 8  ) & 0xFF;
-            auto b1 = ( c1 >> 16 ) & 0xFF;
-            printf( "\033[38;2;%d;%d;%dm\033[48;2;%d;%d;%dm▀", r0, g0, b0, r1, g1, b1 );
+            files.emplace_back( path + "/" + entry->d_name );
         }
-        printf( "\033[0m\n" );
-        px0 += bitmap.Width();
-        px1 += bitmap.Width();
     }
-    if( ( bitmap.Height() & 1 ) != 0 )
+    closedir( dir );
+    std::ranges::sort( files );
+
+    std::vector<uint8_t> loadable( files.size() );
+    td.ParallelFor( 0, files.size(), TaskDispatch::AdaptiveGrain, [&]( size_t begin, size_t end ) {
+        for( size_t i=begin; i<end; i++ ) loadable[i] = IsLoadableImage( files[i].c_str() );
+    } );
+
+    std::vector<std::string> ret;
+    for( size_t i=0; i<files.size(); i++ )
+    {
+        if( loadable[i] ) ret.emplace_back( std::move( files[i] ) );
+    }
+    return ret;
+}
+
+// Decodes a contact sheet tile, reduced to fit into a square of the given size. Files without a loader may
+// still be vector images.
+static std::unique_ptr<Bitmap> LoadTile( ImageLoader* loader, const char* path, ToneMap::Operator tonemap, uint32_t size, TaskDispatch& td )
+{
+    std::unique_ptr<Bitmap> bmp;
+    if( loader )
     {
-        for( int x=0; x<bitmap.Width(); x++ )
+        loader->SetTargetSize( size, size );
+        if( loader->IsHdr() && loader->PreferHdr() )
         {
-            auto c0 = *px0++;
-            auto r0 = ( c0       ) & 0xFF;
-            auto g0 = ( c0 >> 8  ) & 0xFF;
-            auto b0 = ( c0 >> 16 ) & 0xFF;
-            printf( "\033[38;2;%d;%d;%dm▀", r0, g0, b0 );
+            auto hdr = loader->LoadHdr();
+            if( hdr ) bmp = ToneMapHdr( *hdr, tonemap, size, size, ScaleMode::None, td );
         }
-        printf( "\033[0m\n" );
+        else
+        {
+            bmp = loader->Load();
+        }
+    }
+    else if( auto vector = LoadVectorImage( path ) )
+    {
+        const auto w = vector->Width() > 0 ? vector->Width() : int( size );
+        const auto h = vector->Height() > 0 ? vector->Height() : int( size );
+        const auto ratio = std::min( 1.f, float( size ) / std::max( w, h ) );
+        bmp = vector->RasterizeTiled( std::max( 1, int( w * ratio ) ), std::max( 1, int( h * ratio ) ), &td );
     }
+    if( bmp ) FitBitmap( *bmp, size, size, ScaleMode::None, td );
+    return bmp;
 }
 
-static bool UploadKittyImage( Bitmap& bitmap, const char* queryPart, bool anim = false )
+// Lays out square tiles, as large as possible with all of them fitting into the area, and decodes the files
+// into them in parallel. Without an area, the tiles have a fixed size and form a roughly square grid.
+static std::unique_ptr<Bitmap> LoadGallery( const std::vector<std::string>& files, std::vector<std::unique_ptr<ImageLoader>>& loaders, ToneMap::Operator tonemap, uint32_t width, uint32_t height, TaskDispatch& td )
 {
-    const auto bmpSize = bitmap.Width() * bitmap.Height() * 4;
-
-    z_stream strm = {};
-    deflateInit( &strm, Z_BEST_SPEED );
-    strm.avail_in = bmpSize;
-    strm.next_in = bitmap.Data();
-
-    std::vector<uint8_t> zdata;
-    zdata.resize( deflateBound( &strm, bmpSize ) );
-    strm.avail_out = zdata.size();
-    strm.next_out = zdata.data();
-
-    auto res = deflate( &strm, Z_FINISH );
-    CheckPanic( res == Z_STREAM_END, "Deflate failed" );
-    const auto zsize = zdata.size() - strm.avail_out;
-    deflateEnd( &strm );
-    mclog( LogLevel::Info, "Compression %zu -> %zu", bmpSize, zsize );
-
-    size_t b64Size = ( ( 4 * zsize / 3 ) + 3 ) & ~3;
-    char* b64Data = new char[b64Size+1];
-    b64Data[b64Size] = 0;
-    size_t outSize;
-    base64_encode( (const char*)zdata.data(), zsize, b64Data, &outSize, 0 );
-    CheckPanic( outSize == b64Size, "Base64 encoding failed" );
-    mclog( LogLevel::Info, "Base64 size: %zu", b64Size );
+    constexpr uint32_t DefaultTile = 256;
 
-    std::string payload;
-    if( b64Size <= 4096 )
+    const auto count = uint32_t( files.size() );
+    uint32_t tile = 0;
+    uint32_t columns = 1;
+    uint32_t gap;
+    if( width == 0 || height == 0 )
     {
-        payload = std::format( "\033_Gf=32,s={},v={},{},o=z;{}\033\\", bitmap.Width(), bitmap.Height(), queryPart, b64Data );
+        tile = DefaultTile;
+        gap = 4;
+        while( columns * columns < count ) columns++;
     }
     else
     {
-        auto ptr = b64Data;
-        while( b64Size > 0 )
+        gap = std::max( 1u, width / 256 );
+        for( uint32_t c=1; c<=count; c++ )
         {
-            size_t chunkSize = std::min<size_t>( 4096, b64Size );
-            b64Size -= chunkSize;
-
-            if( ptr == b64Data )
+            const auto rows = ( count + c - 1 ) / c;
+            const auto size = std::min( ( width + gap ) / c, ( height + gap ) / rows );
+            if( size > gap && size - gap > tile )
             {
-                payload.append( std::format( "\033_Gf=32,s={},v={},{},o=z,m=1;", bitmap.Width(), bitmap.Height(), queryPart ) );
-            }
-            else
-            {
-                int m = b64Size > 0 ? 1 : 0;
-                if( anim )
-                {
-                    payload.append( std::format( "\033_Gm={},a=f;", m ) );
-                }
-                else
-                {
-                    payload.append( std::format( "\033_Gm={};", m ) );
-                }
+                tile = size - gap;
+                columns = c;
             }
+        }
+        if( tile == 0 ) return nullptr;
+    }
+    const auto rows = ( count + columns - 1 ) / columns;
+    mclog( LogLevel::Info, "Contact sheet: %ux%u tiles of %u pixels", columns, rows, tile );
 
-            payload.append( ptr, chunkSize );
-            payload.append( "\033\\" );
+    std::vector<std::unique_ptr<Bitmap>> tiles( count );
+    TaskGroup group;
+    for( uint32_t i=0; i<count; i++ )
+    {
+        td.Queue( group, [&, i] { tiles[i] = LoadTile( loaders[i].get(), files[i].c_str(), tonemap, tile, td ); } );
+    }
+    group.Wait();
 
-            ptr += chunkSize;
+    // The gaps stay transparent, and are filled with the background like the images are
+    const auto sw = columns * ( tile + gap ) - gap;
+    const auto sh = rows * ( tile + gap ) - gap;
+    auto sheet = std::make_unique<Bitmap>( sw, sh );
+    memset( sheet->Data(), 0, size_t( sw ) * sh * 4 );
+
+    size_t loaded = 0;
+    for( uint32_t i=0; i<count; i++ )
+    {
+        if( !tiles[i] )
+        {
+            mclog( LogLevel::Warning, "Failed to load image %s", files[i].c_str() );
+            continue;
+        }
+        loaded++;
+
+        auto& t = *tiles[i];
+        const auto x = ( i % columns ) * ( tile + gap ) + ( tile - t.Width() ) / 2;
+        const auto y = ( i / columns ) * ( tile + gap ) + ( tile - t.Height() ) / 2;
+        for( uint32_t j=0; j<t.Height(); j++ )
+        {
+            memcpy( sheet->Data() + ( size_t( y + j ) * sw + x ) * 4, t.Data() + size_t( j ) * t.Width() * 4, t.Width() * 4 );
         }
     }
-    delete[] b64Data;
+    if( loaded == 0 ) return nullptr;
+    return sheet;
+}
+
+// Local terminals can read the pixels from a shared memory object or a temp file, which skips compression and
+// the tty bandwidth. Over SSH the terminal can't see either, and the data is sent inline.
+enum class KittyMedium
+{
+    Direct,
+    SharedMemory,
+    TempFile
+};
 
-    auto sz = payload.size();
-    auto ptr = payload.c_str();
+static KittyMedium s_kittyMedium = KittyMedium::Direct;
+
+static bool WriteAll( int fd, const char* ptr, size_t sz )
+{
     while( sz > 0 )
     {
-        auto wr = write( STDOUT_FILENO, ptr, sz );
+        auto wr = write( fd, ptr, sz );
         if( wr < 0 )
         {
-            mclog( LogLevel::Error, "Failed to write to terminal" );
+            if( errno == EINTR ) continue;
             return false;
         }
         sz -= wr;
         ptr += wr;
     }
+    return true;
+}
+
+static void PrintBitmapBlock( const Bitmap& bitmap, BlockMode mode )
+{
+    const auto str = RenderBlocks( bitmap, mode );
+    // Anything already printed must go out first
+    fflush( stdout );
+    WriteAll( STDOUT_FILENO, str.data(), str.size() );
+}
+
+static std::string Base64( const char* data, size_t size )
+{
+    std::string ret( ( ( 4 * size / 3 ) + 3 ) & ~3, 0 );
+    size_t outSize;
+    base64_encode( data, size, ret.data(), &outSize, 0 );
+    ret.resize( outSize );
+    return ret;
+}
+
+// Returns the shared memory object name or file path, or an empty string on failure. The terminal removes it after
+// reading. Temp files are only removed if the name contains "tty-graphics-protocol".
+static std::string WriteKittyMedium( KittyMedium medium, const void* data, size_t size )
+{
+    static int counter = 0;
+
+    std::string name;
+    int fd;
+    if( medium == KittyMedium::SharedMemory )
+    {
+        name = std::format( "/vv-{}-{}", getpid(), counter++ );
+        fd = shm_open( name.c_str(), O_CREAT | O_EXCL | O_RDWR, 0600 );
+    }
+    else
+    {
+        name = "/tmp/tty-graphics-protocol-vv-XXXXXX";
+        fd = mkstemp( name.data() );
+    }
+    if( fd < 0 ) return {};
+
+    const auto ok = WriteAll( fd, (const char*)data, size );
+    close( fd );
+    if( !ok )
+    {
+        if( medium == KittyMedium::SharedMemory ) shm_unlink( name.c_str() );
+        else unlink( name.c_str() );
+        return {};
+    }
+    return name;
+}
+
+// Asks the terminal to read a pixel through each medium. Must be called after kitty graphics support was confirmed.
+static KittyMedium ProbeKittyMedium()
+{
+    const uint8_t px[3] = {};
+    const auto shm = WriteKittyMedium( KittyMedium::SharedMemory, px, sizeof( px ) );
+    const auto tmp = WriteKittyMedium( KittyMedium::TempFile, px, sizeof( px ) );
+
+    std::string query;
+    if( !shm.empty() ) query.append( std::format( "\033_Gi=2,s=1,v=1,a=q,t=s,f=24,S=3;{}\033\\", Base64( shm.c_str(), shm.size() ) ) );
+    if( !tmp.empty() ) query.append( std::format( "\033_Gi=3,s=1,v=1,a=q,t=t,f=24;{}\033\\", Base64( tmp.c_str(), tmp.size() ) ) );
+    if( query.empty() ) return KittyMedium::Direct;
+    query.append( "\033[c" );
+
+    const auto res = QueryTerminal( query.c_str() );
+
+    // Left behind if the terminal could not read them
+    if( !shm.empty() ) shm_unlink( shm.c_str() );
+    if( !tmp.empty() ) unlink( tmp.c_str() );
+
+    if( res.find( "\033_Gi=2;OK\033\\" ) != std::string::npos ) return KittyMedium::SharedMemory;
+    if( res.find( "\033_Gi=3;OK\033\\" ) != std::string::npos ) return KittyMedium::TempFile;
+    return KittyMedium::Direct;
+}
+
+struct KittyBand
+{
+    std::unique_ptr<TaskGroup> group;
+    std::vector<uint8_t> data;
+    uint32_t adler;
+};
+
+constexpr size_t KittyBandSize = 256 * 1024;
+
+// Raw deflate. All but the last band end with a sync flush, so that the bands can be concatenated.
+static void DeflateBand( KittyBand& band, const uint8_t* data, size_t size, bool last )
+{
+    z_stream strm = {};
+    deflateInit2( &strm, Z_BEST_SPEED, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY );
+    strm.avail_in = size;
+    strm.next_in = (Bytef*)data;
+
+    band.data.resize( deflateBound( &strm, size ) + 16 );
+    strm.avail_out = band.data.size();
+    strm.next_out = band.data.data();
+
+    [[maybe_unused]] const auto res = deflate( &strm, last ? Z_FINISH : Z_SYNC_FLUSH );
+    CheckPanic( last ? res == Z_STREAM_END : ( res == Z_OK && strm.avail_in == 0 ), "Deflate failed" );
+    band.data.resize( band.data.size() - strm.avail_out );
+    deflateEnd( &strm );
+
+    band.adler = adler32( 1, data, size );
+}
+
+static bool UploadKittyImage( Bitmap& bitmap, const char* queryPart, TaskDispatch& td, bool anim = false )
+{
+    const auto bmpSize = bitmap.Width() * bitmap.Height() * 4;
+
+    if( s_kittyMedium != KittyMedium::Direct )
+    {
+        const auto name = WriteKittyMedium( s_kittyMedium, bitmap.Data(), bmpSize );
+        if( !name.empty() )
+        {
+            const auto payload = std::format( "\033_Gf=32,s={},v={},{},t={},S={};{}\033\\", bitmap.Width(), bitmap.Height(), queryPart, s_kittyMedium == KittyMedium::SharedMemory ? 's' : 't', bmpSize, Base64( name.c_str(), name.size() ) );
+            if( WriteAll( STDOUT_FILENO, payload.c_str(), payload.size() ) ) return true;
+            mclog( LogLevel::Error, "Failed to write to terminal" );
+            return false;
+        }
+        mclog( LogLevel::Warning, "Failed to write image for the terminal to read, sending it inline" );
+    }
 
+    // Bands are deflated in parallel as raw blocks, each ending on a byte boundary, and joined into one zlib
+    // stream. Chunks are written as soon as the bands in order are done.
+    const auto stride = size_t( bitmap.Width() ) * 4;
+    const auto bandRows = std::max<size_t>( 1, KittyBandSize / stride );
+    const auto numBands = ( bitmap.Height() + bandRows - 1 ) / bandRows;
+
+    std::vector<KittyBand> bands( numBands );
+    for( size_t i=0; i<numBands; i++ )
+    {
+        bands[i].group = std::make_unique<TaskGroup>();
+        td.Queue( *bands[i].group, [&bitmap, &band = bands[i], stride, bandRows, numBands, i] {
+            const auto rows = std::min<size_t>( bandRows, bitmap.Height() - i * bandRows );
+            DeflateBand( band, bitmap.Data() + i * bandRows * stride, rows * stride, i == numBands - 1 );
+        } );
+    }
+
+    // Kitty takes at most 4096 base64 characters per chunk, which is 3072 bytes of data
+    constexpr size_t ChunkData = 3072;
+    const uint8_t header[2] = { 0x78, 0x01 };
+    std::vector<uint8_t> pending( header, header + sizeof( header ) );
+    std::string b64( 4096, 0 );
+    uint32_t adler = 1;
+    bool first = true;
+    size_t zsize = 0;
+
+    auto flush = [&]( const uint8_t* data, size_t size, bool last ) {
+        size_t outSize;
+        base64_encode( (const char*)data, size, b64.data(), &outSize, 0 );
+
+        std::string chunk;
+        if( first && last )
+        {
+            chunk = std::format( "\033_Gf=32,s={},v={},{},o=z;", bitmap.Width(), bitmap.Height(), queryPart );
+        }
+        else if( first )
+        {
+            chunk = std::format( "\033_Gf=32,s={},v={},{},o=z,m=1;", bitmap.Width(), bitmap.Height(), queryPart );
+        }
+        else if( anim )
+        {
+            chunk = std::format( "\033_Gm={},a=f;", last ? 0 : 1 );
+        }
+        else
+        {
+            chunk = std::format( "\033_Gm={};", last ? 0 : 1 );
+        }
+        chunk.append( b64.data(), outSize );
+        chunk.append( "\033\\" );
+        first = false;
+        zsize += size;
+        return WriteAll( STDOUT_FILENO, chunk.c_str(), chunk.size() );
+    };
+
+    bool ok = true;
+    for( size_t i=0; i<numBands; i++ )
+    {
+        auto& band = bands[i];
+        band.group->Wait();
+        if( !ok ) continue;
+
+        const auto rows = std::min<size_t>( bandRows, bitmap.Height() - i * bandRows );
+        adler = adler32_combine( adler, band.adler, rows * stride );
+        pending.insert( pending.end(), band.data.begin(), band.data.end() );
+        if( i == numBands - 1 )
+        {
+            const uint8_t trailer[4] = { uint8_t( adler >> 24 ), uint8_t( adler >> 16 ), uint8_t( adler >> 8 ), uint8_t( adler ) };
+            pending.insert( pending.end(), trailer, trailer + sizeof( trailer ) );
+        }
+
+        // The last chunk must carry m=0, so enough is always kept back for it
+        size_t offset = 0;
+        while( ok && pending.size() - offset > ChunkData )
+        {
+            ok = flush( pending.data() + offset, ChunkData, false );
+            offset += ChunkData;
+        }
+        pending.erase( pending.begin(), pending.begin() + offset );
+    }
+    if( ok ) ok = flush( pending.data(), pending.size(), true );
+
+    if( !ok )
+    {
+        mclog( LogLevel::Error, "Failed to write to terminal" );
+        return false;
+    }
+
+    mclog( LogLevel::Info, "Compression %zu -> %zu in %zu bands", bmpSize, zsize, numBands );
     return true;
 }
 
@@ -353,14 +688,17 @@ int main( int argc, char** argv )
         { "debug", no_argument, nullptr, 'd' },
         { "external", no_argument, nullptr, 'e' },
         { "block", no_argument, nullptr, 'b' },
+        { "quadrant", no_argument, nullptr, 'Q' },
         { "scale", no_argument, nullptr, 's' },
         { "fit", no_argument, nullptr, 'f' },
         { "sixel", no_argument, nullptr, '6' },
+        { "dither", no_argument, nullptr, 'D' },
         { "background", required_argument, nullptr, 'G' },
         { "checkerboard", no_argument, nullptr, 'g' },
         { "noanim", no_argument, nullptr, 'A' },
         { "write", required_argument, nullptr, 'w' },
         { "tonemap", required_argument, nullptr, 't' },
+        { "lut", no_argument, nullptr, 'L' },
         { "help", no_argument, nullptr, OptHelp },
         {}
     };
@@ -377,11 +715,13 @@ int main( int argc, char** argv )
     ScaleMode scale = ScaleMode::None;
     int bg = -2;
     bool disableAnimation = false;
+    bool dither = false;
+    BlockMode blockMode = BlockMode::Half;
     const char* writeFn = nullptr;
     ToneMap::Operator tonemap = ToneMap::Operator::PbrNeutral;
 
     int opt;
-    while( ( opt = getopt_long( argc, argv, "debsf6G:gAw:t:", longOptions, nullptr ) ) != -1 )
+    while( ( opt = getopt_long( argc, argv, "debQsf6DG:gAw:t:L", longOptions, nullptr ) ) != -1 )
     {
         switch (opt)
         {
@@ -394,6 +734,10 @@ int main( int argc, char** argv )
         case 'b':
             gfxMode = GfxMode::Block;
             break;
+        case 'Q':
+            gfxMode = GfxMode::Block;
+            blockMode = BlockMode::Quadrant;
+            break;
         case 's':
             scale = ScaleMode::Scale2x;
             break;
@@ -403,6 +747,9 @@ int main( int argc, char** argv )
         case '6':
             gfxMode = GfxMode::Sixel;
             break;
+        case 'D':
+            dither = true;
+            break;
         case 'G':
             bg = strtol( optarg, nullptr, 16 );
             bg = ( bg & 0xFF ) << 16 | ( bg & 0xFF00 ) | ( bg >> 16 );
@@ -434,12 +781,22 @@ int main( int argc, char** argv )
             {
                 tonemap = ToneMap::Operator::AgXPunchy;
             }
+            else if( std::string_view( optarg ).ends_with( ".cube" ) )
+            {
+                auto lut = Lut::LoadCube( ExpandHome( optarg ).c_str() );
+                if( !lut ) return 1;
+                ToneMap::SetCustomLut( std::move( lut ) );
+                tonemap = ToneMap::Operator::Custom;
+            }
             else
             {
                 mclog( LogLevel::Error, "Unknown tone mapping operator" );
                 return 1;
             }
             break;
+        case 'L':
+            ToneMap::SetLutMode( true );
+            break;
         default:
             printf( "\n" );
             [[fallthrough]];
@@ -457,42 +814,68 @@ int main( int argc, char** argv )
     }
 
     const auto workerThreads = std::max( 1u, std::thread::hardware_concurrency() - 1 );
-    TaskDispatch td( workerThreads, "Worker" );
+    TaskDispatch td( workerThreads, "Worker", TaskDispatch::LoadPlacement( "vv.ini" ) );
 
-    const auto imageFileStr = ExpandHome( argv[optind] );
-    const auto imageFile = imageFileStr.c_str();
+    // More than one file, or a directory, makes a contact sheet
+    std::vector<std::string> files;
+    bool gallery = argc - optind > 1;
+    for( int i=optind; i<argc; i++ )
+    {
+        auto path = ExpandHome( argv[i] );
+        struct stat st;
+        if( stat( path.c_str(), &st ) == 0 && S_ISDIR( st.st_mode ) )
+        {
+            auto list = ListImages( path, td );
+            files.insert( files.end(), std::make_move_iterator( list.begin() ), std::make_move_iterator( list.end() ) );
+            gallery = true;
+        }
+        else
+        {
+            files.emplace_back( std::move( path ) );
+        }
+    }
+    if( files.empty() )
+    {
+        mclog( LogLevel::Error, "No images found" );
+        return 1;
+    }
+
+    const auto imageFile = files[0].c_str();
     std::unique_ptr<Bitmap> bitmap;
-    std::unique_ptr<BitmapAnim> anim;
+    std::unique_ptr<BitmapAnimStream> anim;
+    uint32_t animWidth = 0, animHeight = 0;
     std::unique_ptr<VectorImage> vectorImage;
 
-    auto imageThread = std::thread( [&bitmap, &anim, &vectorImage, imageFile, disableAnimation, &td, tonemap] {
+    // The terminal is queried while the image file is opened. The output size is passed to the loader once known.
+    std::promise<std::pair<uint32_t, uint32_t>> targetSize;
+    auto imageThread = std::thread( [&bitmap, &anim, &vectorImage, &files, gallery, imageFile, disableAnimation, &td, tonemap, scale, target = targetSize.get_future()]() mutable {
+        if( gallery )
+        {
+            mclog( LogLevel::Info, "Loading %zu images", files.size() );
+            std::vector<std::unique_ptr<ImageLoader>> loaders( files.size() );
+            td.ParallelFor( 0, files.size(), 1, [&]( size_t begin, size_t end ) {
+                for( size_t i=begin; i<end; i++ ) loaders[i] = GetImageLoader( files[i].c_str(), tonemap, &td );
+            } );
+            const auto [tw, th] = target.get();
+            bitmap = LoadGallery( files, loaders, tonemap, tw, th, td );
+            return;
+        }
+
         mclog( LogLevel::Info, "Loading image %s", imageFile );
         auto loader = GetImageLoader( imageFile, tonemap, &td );
         if( loader )
         {
+            const auto [tw, th] = target.get();
+            loader->SetTargetSize( tw, th );
+
             if( !disableAnimation && loader->IsAnimated() )
             {
-                anim = loader->LoadAnim();
+                anim = loader->LoadAnimStream( &td );
             }
             else if( loader->IsHdr() && loader->PreferHdr() )
             {
                 auto hdr = loader->LoadHdr();
-                bitmap = std::make_unique<Bitmap>( hdr->Width(), hdr->Height() );
-
-                auto src = hdr->Data();
-                auto dst = bitmap->Data();
-                size_t sz = hdr->Width() * hdr->Height();
-                while( sz > 0 )
-                {
-                    const auto chunk = std::min( sz, size_t( 16 * 1024 ) );
-                    td.Queue( [src, dst, chunk, tonemap] {
-                        ToneMap::Process( tonemap, (uint32_t*)dst, src, chunk );
-                    } );
-                    src += chunk * 4;
-                    dst += chunk * 4;
-                    sz -= chunk;
-                }
-                td.Sync();
+                bitmap = ToneMapHdr( *hdr, tonemap, tw, th, scale, td );
             }
             else
             {
@@ -501,8 +884,7 @@ int main( int argc, char** argv )
         }
         if( anim )
         {
-            mclog( LogLevel::Info, "Animated image with %zu frames", anim->FrameCount() );
-            anim->NormalizeSize();
+            mclog( LogLevel::Info, "Animated image with %zu frames, %ux%u", anim->FrameCount(), anim->Width(), anim->Height() );
         }
         else if( bitmap )
         {
@@ -576,14 +958,35 @@ int main( int argc, char** argv )
                         gfxMode = GfxMode::Block;
                     }
                 }
+                else
+                {
+                    s_kittyMedium = ProbeKittyMedium();
+                    constexpr const char* MediumNames[] = { "inline", "shared memory", "temp file" };
+                    mclog( LogLevel::Info, "Kitty image transmission: %s", MediumNames[(int)s_kittyMedium] );
+                }
             }
         }
     }
 
+    switch( gfxMode )
+    {
+    case GfxMode::Block:
+        targetSize.set_value( { ws.ws_col * ( blockMode == BlockMode::Quadrant ? 2 : 1 ), std::max<uint16_t>( 1, ws.ws_row - 1 ) * 2 } );
+        break;
+    case GfxMode::Sixel:
+    case GfxMode::Kitty:
+        targetSize.set_value( { ws.ws_col * cw, std::max<uint16_t>( 1, ws.ws_row - 1 ) * ch } );
+        break;
+    default:
+        targetSize.set_value( { 0, 0 } );
+        break;
+    }
+
     imageThread.join();
     if( !bitmap && !anim && !vectorImage )
     {
-        mclog( LogLevel::Error, "Failed to load image %s", imageFile );
+        if( gallery ) mclog( LogLevel::Error, "Failed to load images" );
+        else mclog( LogLevel::Error, "Failed to load image %s", imageFile );
         return 1;
     }
 
@@ -591,75 +994,89 @@ int main( int argc, char** argv )
     {
         if( bg == -2 ) bg = -1;
 
-        uint32_t col = ws.ws_col;
+        // Quadrant cells are two virtual pixels wide
+        uint32_t col = ws.ws_col * ( blockMode == BlockMode::Quadrant ? 2 : 1 );
         uint32_t row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * 2;
 
         mclog( LogLevel::Info, "Virtual pixels: %ux%u", col, row );
-        AdjustBitmap( bitmap, anim, vectorImage, td, col, row, scale );
-
-        if( anim )
-        {
-            if( bg >= 0 ) FillBackground( *anim, bg );
-            else if( bg == -1 ) FillCheckerboard( *anim, 1 );
-        }
-        else
-        {
-            if( bg >= 0 ) FillBackground( *bitmap, bg );
-            else if( bg == -1 ) FillCheckerboard( *bitmap, 1 );
-        }
+        AdjustBitmap( bitmap, anim, animWidth, animHeight, vectorImage, td, col, row, scale );
 
         if( anim )
         {
             printf( "\033c" );
             for(;;)
             {
-                for( size_t i=0; i<anim->FrameCount(); i++ )
-                {
-                    printf( "\033[s" );
-                    const auto& frame = anim->GetFrame( i );
-                    PrintBitmapBlock( *frame.bmp );
-                    usleep( frame.delay_us );
-                    printf( "\033[u" );
-                }
+                const auto frame = NextFrame( *anim, animWidth, animHeight, bg, 1, td );
+                if( !frame.bmp ) return 1;
+                printf( "\033[s" );
+                PrintBitmapBlock( *frame.bmp, blockMode );
+                usleep( frame.delay_us );
+                printf( "\033[u" );
             }
         }
         else
         {
-            PrintBitmapBlock( *bitmap );
+            if( bg >= 0 ) FillBackground( *bitmap, bg, td );
+            else if( bg == -1 ) FillCheckerboard( *bitmap, td, 1 );
+            PrintBitmapBlock( *bitmap, blockMode );
         }
     }
     else if( gfxMode == GfxMode::Sixel )
     {
-        if( anim )
-        {
-            mclog( LogLevel::Error, "Animation is not supported in sixel graphics mode" );
-            return 1;
-        }
-
         if( bg == -2 ) bg = -1;
 
         uint32_t col = ws.ws_col * cw;
         uint32_t row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * ch;
 
         mclog( LogLevel::Info, "Pixels available: %ux%u", col, row );
-        AdjustBitmap( bitmap, anim, vectorImage, td, col, row, scale );
+        AdjustBitmap( bitmap, anim, animWidth, animHeight, vectorImage, td, col, row, scale );
 
-        if( bg >= 0 ) FillBackground( *bitmap, bg );
-        else if( bg == -1 ) FillCheckerboard( *bitmap );
+        if( anim )
+        {
+            // Played once, each frame drawn over the previous one. The next frame is decoded and encoded while the
+            // current one is shown. The rows are reserved first, so that the terminal doesn't scroll between frames.
+            const auto rows = ( animHeight + ch - 1 ) / ch;
+            const auto reserve = std::string( rows, '\n' ) + std::format( "\033[{}A\0337", rows );
+            if( !WriteAll( STDOUT_FILENO, reserve.c_str(), reserve.size() ) ) return 1;
+
+            SixelEncoder encoder( td, dither );
+            auto encode = [&] {
+                const auto frame = NextFrame( *anim, animWidth, animHeight, bg, 3, td );
+                if( !frame.bmp ) return std::make_pair( std::string(), 0u );
+                return std::make_pair( "\0338" + encoder.Encode( *frame.bmp ), frame.delay_us );
+            };
+
+            auto next = std::async( std::launch::async, encode );
+            for( size_t i=0; i<anim->FrameCount(); i++ )
+            {
+                const auto [sixel, delay] = next.get();
+                if( sixel.empty() ) return 1;
+                if( i + 1 < anim->FrameCount() ) next = std::async( std::launch::async, encode );
 
-        sixel_dither_t* dither;
-        sixel_dither_new( &dither, -1, nullptr );
-        sixel_dither_initialize( dither, bitmap->Data(), bitmap->Width(), bitmap->Height(), SIXEL_PIXELFORMAT_RGBA8888, SIXEL_LARGE_AUTO, SIXEL_REP_AUTO, SIXEL_QUALITY_FULL );
+                const auto start = std::chrono::steady_clock::now();
+                if( !WriteAll( STDOUT_FILENO, sixel.c_str(), sixel.size() ) )
+                {
+                    mclog( LogLevel::Error, "Failed to write to terminal" );
+                    return 1;
+                }
+                if( i + 1 < anim->FrameCount() ) std::this_thread::sleep_until( start + std::chrono::microseconds( delay ) );
+            }
 
-        sixel_output_t* output;
-        sixel_output_new( &output, []( char* data, int size, void* ) -> int {
-            return write( STDOUT_FILENO, data, size );
-        }, nullptr, nullptr );
+            const auto done = std::format( "\0338\033[{}B", rows );
+            WriteAll( STDOUT_FILENO, done.c_str(), done.size() );
+            return 0;
+        }
 
-        sixel_encode( bitmap->Data(), bitmap->Width(), bitmap->Height(), -1, dither, output );
+        if( bg >= 0 ) FillBackground( *bitmap, bg, td );
+        else if( bg == -1 ) FillCheckerboard( *bitmap, td );
 
-        sixel_output_destroy( output );
-        sixel_dither_destroy( dither );
+        SixelEncoder encoder( td, dither );
+        const auto sixel = encoder.Encode( *bitmap );
+        if( !WriteAll( STDOUT_FILENO, sixel.c_str(), sixel.size() ) )
+        {
+            mclog( LogLevel::Error, "Failed to write to terminal" );
+            return 1;
+        }
     }
     else if( gfxMode == GfxMode::Kitty )
     {
@@ -667,31 +1084,24 @@ int main( int argc, char** argv )
         uint32_t row = std::max<uint16_t>( 1, ws.ws_row - 1 ) * ch;
 
         mclog( LogLevel::Info, "Pixels available: %ux%u", col, row );
-        AdjustBitmap( bitmap, anim, vectorImage, td, col, row, scale );
-
-        if( anim )
-        {
-            if( bg >= 0 ) FillBackground( *anim, bg );
-            else if( bg == -1 ) FillCheckerboard( *anim );
-        }
-        else
-        {
-            if( bg >= 0 ) FillBackground( *bitmap, bg );
-            else if( bg == -1 ) FillCheckerboard( *bitmap );
-        }
+        AdjustBitmap( bitmap, anim, animWidth, animHeight, vectorImage, td, col, row, scale );
 
         if( anim )
         {
+            // Frames are uploaded as they are decoded, the terminal then plays the animation on its own. Only the
+            // part which changed since the previous frame is sent, and replaces the pixels of a copy of it.
             int id = -1;
+            std::shared_ptr<Bitmap> prev;
             for( size_t i=0; i<anim->FrameCount(); i++ )
             {
-                const auto& frame = anim->GetFrame( i );
+                const auto frame = NextFrame( *anim, animWidth, animHeight, bg, 3, td );
+                if( !frame.bmp ) return 1;
                 const auto delay_ms = std::max<uint32_t>( frame.delay_us / 1000, 1 );
                 std::string query;
                 if( i == 0 )
                 {
                     query = std::format( "I=1,z={}", delay_ms );
-                    if( !UploadKittyImage( *anim->GetFrame( i ).bmp, query.c_str() ) ) return 1;
+                    if( !UploadKittyImage( *frame.bmp, query.c_str(), td ) ) return 1;
 
                     auto res = QueryTerminal();
                     if( !res.ends_with( ";OK\033\\" ) )
@@ -702,22 +1112,41 @@ int main( int argc, char** argv )
 
                     sscanf( res.c_str(), "\033_Gi=%i;OK\033\\", &id );
                     mclog( LogLevel::Info, "Image ID: %i", id );
+
+                    // Shown right away. In loading mode the terminal plays the frames it has, and waits for more.
+                    auto show = std::format( "\033_Ga=p,i={},q=1\033\\\033_Ga=a,i={},s=2,v=1,q=1\033\\", id, id );
+                    if( !WriteAll( STDOUT_FILENO, show.c_str(), show.size() ) ) return 1;
                 }
                 else
                 {
-                    query = std::format( "a=f,i={},z={}", id, delay_ms );
-                    if( !UploadKittyImage( *anim->GetFrame( i ).bmp, query.c_str(), true ) ) return 1;
+                    // The protocol has no empty frames, an unchanged one repeats a single pixel
+                    uint32_t x0, y0, x1, y1;
+                    if( !FrameDelta( *prev, *frame.bmp, x0, y0, x1, y1 ) )
+                    {
+                        x0 = y0 = 0;
+                        x1 = y1 = 1;
+                    }
+                    auto delta = CopyRect( *frame.bmp, x0, y0, x1 - x0, y1 - y0 );
+
+                    // Kitty frame numbers start at 1, so the previous frame is number i
+                    query = std::format( "a=f,i={},z={},x={},y={},c={},X=1", id, delay_ms, x0, y0, i );
+                    if( !UploadKittyImage( *delta, query.c_str(), td, true ) ) return 1;
                 }
+                prev = frame.bmp;
             }
 
-            auto query = std::format( "\033_Ga=p,i={},q=1\033\\\033_Ga=a,i={},s=3,v=1,q=1\033\\", id, id );
+            // All frames are in, loop them
+            auto query = std::format( "\033_Ga=a,i={},s=3,v=1,q=1\033\\", id );
             write( STDOUT_FILENO, query.c_str(), query.size() );
 
-            if( anim->GetFrame( 0 ).bmp->Width() < col ) printf( "\n" );
+            if( animWidth < col ) printf( "\n" );
         }
         else
         {
-            if( !UploadKittyImage( *bitmap, "a=T" ) ) return 1;
+            if( bg >= 0 ) FillBackground( *bitmap, bg, td );
+            else if( bg == -1 ) FillCheckerboard( *bitmap, td );
+
+            if( !UploadKittyImage( *bitmap, "a=T", td ) ) return 1;
             if( bitmap->Width() < col ) printf( "\n" );
         }
     }
@@ -726,7 +1155,8 @@ int main( int argc, char** argv )
         std::shared_ptr<Bitmap> img;
         if( anim )
         {
-            img = anim->GetFrame( 0 ).bmp;
+            img = anim->Next().bmp;
+            if( !img ) return 1;
         }
         else if( bitmap )
         {
@@ -735,13 +1165,13 @@ int main( int argc, char** argv )
         else
         {
             CheckPanic( vectorImage, "No image data" );
-            img = vectorImage->Rasterize( vectorImage->Width(), vectorImage->Height() );
+            img = vectorImage->RasterizeTiled( vectorImage->Width(), vectorImage->Height(), &td );
         }
 
-        if( bg >= 0 ) FillBackground( *img, bg );
-        else if( bg == -1 ) FillCheckerboard( *img );
+        if( bg >= 0 ) FillBackground( *img, bg, td );
+        else if( bg == -1 ) FillCheckerboard( *img, td );
 
-        img->SavePng( writeFn );
+        img->SavePng( writeFn, &td );
     }
     else
     {
@@ -1,30 +1,183 @@
+#include <algorithm>
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
 #include <stb_image_resize2.h>
-#include <png.h>
 #include <string.h>
 #include <tracy/Tracy.hpp>
 #include <unistd.h>
 #include <utility>
+#include <zlib.h>
 
-#include "Alloca.h"
 #include "Bitmap.hpp"
+#include "BitmapHalve.hpp"
+#include "BitmapOps.hpp"
+#include "BitmapRotate.hpp"
 #include "Panic.hpp"
+#include "PixelPool.hpp"
+#include "SimdDispatch.hpp"
 #include "TaskDispatch.hpp"
 
-#if defined __SSE2__
+#if defined __SSE2__ || defined MCORE_SIMD_X86
 #  include <x86intrin.h>
+#elif defined __ARM_NEON
+#  include <arm_neon.h>
 #endif
 
+namespace
+{
+constexpr size_t PngStripSize = 512 * 1024;     // Filtered bytes per independently deflated strip
+
+struct PngStrip
+{
+    std::vector<uint8_t> data;
+    uint32_t adler;
+    size_t size;
+};
+
+void PutBe32( uint8_t* ptr, uint32_t value )
+{
+    ptr[0] = value >> 24;
+    ptr[1] = value >> 16;
+    ptr[2] = value >> 8;
+    ptr[3] = value;
+}
+
+bool WriteAll( int fd, const void* data, size_t size )
+{
+    auto ptr = (const uint8_t*)data;
+    while( size > 0 )
+    {
+        const auto cnt = write( fd, ptr, size );
+        if( cnt < 0 && errno == EINTR ) continue;
+        if( cnt <= 0 ) return false;
+        ptr += cnt;
+        size -= cnt;
+    }
+    return true;
+}
+
+bool WriteChunk( int fd, const char* type, const void* data, size_t size )
+{
+    uint8_t header[8];
+    PutBe32( header, uint32_t( size ) );
+    memcpy( header + 4, type, 4 );
+
+    auto crc = crc32( 0, header + 4, 4 );
+    if( size > 0 ) crc = crc32( crc, (const Bytef*)data, uInt( size ) );
+    uint8_t footer[4];
+    PutBe32( footer, uint32_t( crc ) );
+
+    return WriteAll( fd, header, sizeof( header ) ) && WriteAll( fd, data, size ) && WriteAll( fd, footer, sizeof( footer ) );
+}
+
+uint8_t Paeth( uint8_t a, uint8_t b, uint8_t c )
+{
+    const auto p = int( a ) + b - c;
+    const auto pa = abs( p - a );
+    const auto pb = abs( p - b );
+    const auto pc = abs( p - c );
+    if( pa <= pb && pa <= pc ) return a;
+    return pb <= pc ? b : c;
+}
+
+// Writes the filter type byte followed by the filtered row. Adaptive filtering picks the filter with the smallest
+// sum of absolute values, like libpng does. Otherwise the Sub filter is used, which is cheap and still helps.
+void FilterRow( const uint8_t* row, const uint8_t* prev, size_t size, uint8_t* out, bool adaptive, uint8_t* scratch )
+{
+    auto filter = [row, prev, size]( int type, uint8_t* dst ) {
+        uint64_t sum = 0;
+        for( size_t i=0; i<size; i++ )
+        {
+            const uint8_t a = i >= 4 ? row[i-4] : 0;
+            const uint8_t b = prev[i];
+            const uint8_t c = i >= 4 ? prev[i-4] : 0;
+            uint8_t v;
+            switch( type )
+            {
+            case 0: v = row[i]; break;
+            case 1: v = row[i] - a; break;
+            case 2: v = row[i] - b; break;
+            case 3: v = row[i] - uint8_t( ( a + b ) / 2 ); break;
+            default: v = row[i] - Paeth( a, b, c ); break;
+            }
+            dst[i] = v;
+            sum += v < 128 ? v : 256 - v;
+        }
+        return sum;
+    };
+
+    if( !adaptive )
+    {
+        out[0] = 1;
+        filter( 1, out + 1 );
+        return;
+    }
+
+    out[0] = 0;
+    auto best = filter( 0, out + 1 );
+    for( int type=1; type<5; type++ )
+    {
+        const auto sum = filter( type, scratch );
+        if( sum < best )
+        {
+            best = sum;
+            out[0] = type;
+            memcpy( out + 1, scratch, size );
+        }
+    }
+}
+
+void EncodePngStrip( const BitmapView& view, uint32_t y0, uint32_t y1, bool last, int level, bool adaptive, PngStrip& strip )
+{
+    ZoneScoped;
+
+    const auto stride = size_t( view.width ) * 4;
+    std::vector<uint8_t> filtered( ( stride + 1 ) * ( y1 - y0 ) );
+    std::vector<uint8_t> scratch( adaptive ? stride : 0 );
+    std::vector<uint8_t> zero( y0 == 0 ? stride : 0 );
+    for( uint32_t y=y0; y<y1; y++ )
+    {
+        const auto row = view.Row( y );
+        const auto prev = y == 0 ? zero.data() : view.Row( y - 1 );
+        FilterRow( row, prev, stride, filtered.data() + ( y - y0 ) * ( stride + 1 ), adaptive, scratch.data() );
+    }
+
+    strip.size = filtered.size();
+    strip.adler = adler32( adler32( 0, nullptr, 0 ), filtered.data(), uInt( filtered.size() ) );
+
+    // Raw deflate, the zlib header and checksum are added around the joined strips
+    z_stream zs = {};
+    CheckPanic( deflateInit2( &zs, level, Z_DEFLATED, -MAX_WBITS, 8, Z_DEFAULT_STRATEGY ) == Z_OK, "Failed to initialize deflate" );
+    strip.data.resize( deflateBound( &zs, filtered.size() ) + 64 );
+    zs.next_in = filtered.data();
+    zs.avail_in = uInt( filtered.size() );
+    zs.next_out = strip.data.data();
+    zs.avail_out = uInt( strip.data.size() );
+    const auto res = deflate( &zs, last ? Z_FINISH : Z_SYNC_FLUSH );
+    CheckPanic( res == ( last ? Z_STREAM_END : Z_OK ) && zs.avail_in == 0, "Deflate failed" );
+    strip.data.resize( zs.total_out );
+    deflateEnd( &zs );
+}
+}
+
 Bitmap::Bitmap( uint32_t width, uint32_t height, int orientation )
     : m_width( width )
     , m_height( height )
-    , m_data( new uint8_t[width*height*4] )
+    , m_data( PixelAlloc<uint8_t>( size_t( width ) * height * 4, MemoryStats::Pool::Bitmap ) )
     , m_orientation( orientation )
 {
 }
 
+Bitmap::Bitmap( const BitmapView& view, TaskDispatch* td )
+    : Bitmap( view.width, view.height )
+{
+    BitmapOps::CopyRows( (const uint32_t*)view.data, view.stride, (uint32_t*)m_data, view.width, view.height, td );
+}
+
 Bitmap::~Bitmap()
 {
-    delete[] m_data;
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::Bitmap );
 }
 
 Bitmap::Bitmap( Bitmap&& other ) noexcept
@@ -43,58 +196,255 @@ Bitmap& Bitmap::operator=( Bitmap&& other ) noexcept
     return *this;
 }
 
-void Bitmap::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
+namespace
 {
-    auto newData = new uint8_t[width*height*4];
-    STBIR_RESIZE resize;
-    stbir_resize_init( &resize, m_data, m_width, m_height, 0, newData, width, height, 0, STBIR_RGBA, STBIR_TYPE_UINT8_SRGB );
-    stbir_set_non_pm_alpha_speed_over_quality( &resize, 1 );
-    if( td )
+
+constexpr int EncodeSize = 4096;
+
+struct ResizeLut
+{
+    // sRGB colour values to linear light, followed by alpha values scaled to [0, 1], so that a single gather
+    // covers a whole pixel.
+    alignas( 64 ) float decode[512];
+    // Linear light in [0, 1], quantized to EncodeSize steps, to sRGB. The steps are fine enough to stay within
+    // one code of the exact result near black, where the curve is steepest.
+    alignas( 64 ) uint8_t encode[EncodeSize];
+};
+
+ResizeLut MakeResizeLut()
+{
+    ResizeLut lut;
+    for( int i=0; i<256; i++ )
     {
-        auto threads = td->NumWorkers() + 1;
-        threads = stbir_build_samplers_with_splits( &resize, threads );
-        for( size_t i=0; i<threads; i++ )
-        {
-            td->Queue( [i, &resize, threads] {
-                stbir_resize_extended_split( &resize, i, 1 );
-            } );
-        }
-        td->Sync();
-        stbir_free_samplers( &resize );
+        const auto v = i / 255.f;
+        lut.decode[i] = v <= 0.04045f ? v / 12.92f : powf( ( v + 0.055f ) / 1.055f, 2.4f );
+        lut.decode[i+256] = v;
     }
-    else
+    for( int i=0; i<EncodeSize; i++ )
     {
-        stbir_resize_extended( &resize );
+        const auto v = i / float( EncodeSize - 1 );
+        const auto s = v <= 0.0031308f ? v * 12.92f : 1.055f * powf( v, 1.f / 2.4f ) - 0.055f;
+        lut.encode[i] = uint8_t( std::clamp( s * 255.f + 0.5f, 0.f, 255.f ) );
     }
-    delete[] m_data;
-    m_data = newData;
-    m_width = width;
-    m_height = height;
+    return lut;
 }
 
-std::unique_ptr<Bitmap> Bitmap::ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td ) const
+const ResizeLut& GetResizeLut()
+{
+    static const ResizeLut lut = MakeResizeLut();
+    return lut;
+}
+
+struct ResizeContext
+{
+    const uint8_t* src;
+    uint32_t srcStride;     // In pixels
+    uint8_t* dst;
+    uint32_t width;
+    const ResizeLut* lut;
+};
+
+#ifdef __AVX2__
+// Two adjacent pixels with one gather. The alpha lanes index the second half of the table.
+inline __m256 DecodePair( const uint8_t* src, const float* lut )
+{
+    const auto idx = _mm256_add_epi32( _mm256_cvtepu8_epi32( _mm_loadl_epi64( (const __m128i*)src ) ), _mm256_setr_epi32( 0, 0, 0, 256, 0, 0, 0, 256 ) );
+    const auto v = _mm256_i32gather_ps( lut, idx, 4 );
+    const auto a = _mm256_permute_ps( v, _MM_SHUFFLE( 3, 3, 3, 3 ) );
+    return _mm256_blend_ps( _mm256_mul_ps( v, a ), a, 0x88 );
+}
+#endif
+
+#ifdef __SSE2__
+inline __m128 DecodePixel( const uint8_t* src, const float* lut )
+{
+    return _mm_mul_ps( _mm_setr_ps( lut[src[0]], lut[src[1]], lut[src[2]], 1.f ), _mm_set1_ps( lut[256 + src[3]] ) );
+}
+
+// Filter ringing may push values outside of [0, 1], and colour is dropped where alpha is not positive.
+inline void EncodePixel( __m128 v, uint8_t* dst, const uint8_t* lut )
+{
+    const auto zero = _mm_setzero_ps();
+    const auto one = _mm_set1_ps( 1.f );
+    const auto a = _mm_min_ps( _mm_max_ps( _mm_shuffle_ps( v, v, _MM_SHUFFLE( 3, 3, 3, 3 ) ), zero ), one );
+    const auto c = _mm_and_ps( _mm_div_ps( v, a ), _mm_cmpgt_ps( a, zero ) );
+
+    alignas( 16 ) int32_t idx[4];
+    _mm_store_si128( (__m128i*)idx, _mm_cvtps_epi32( _mm_mul_ps( _mm_min_ps( _mm_max_ps( c, zero ), one ), _mm_set1_ps( EncodeSize - 1 ) ) ) );
+    dst[0] = lut[idx[0]];
+    dst[1] = lut[idx[1]];
+    dst[2] = lut[idx[2]];
+    dst[3] = uint8_t( _mm_cvtss_si32( _mm_mul_ss( a, _mm_set_ss( 255.f ) ) ) );
+}
+#else
+inline void DecodePixel( const uint8_t* src, float* dst, const float* lut )
+{
+    const auto a = lut[256 + src[3]];
+    dst[0] = lut[src[0]] * a;
+    dst[1] = lut[src[1]] * a;
+    dst[2] = lut[src[2]] * a;
+    dst[3] = a;
+}
+
+inline void EncodePixel( const float* src, uint8_t* dst, const uint8_t* lut )
+{
+    const auto a = std::clamp( src[3], 0.f, 1.f );
+    for( int j=0; j<3; j++ )
+    {
+        const auto c = a > 0 ? std::clamp( src[j] / a, 0.f, 1.f ) : 0.f;
+        dst[j] = lut[int( c * ( EncodeSize - 1 ) + 0.5f )];
+    }
+    dst[3] = uint8_t( a * 255.f + 0.5f );
+}
+#endif
+
+// Input callback, converts a span of source pixels to premultiplied linear light floats. The pixel address is
+// taken from the context, as stbir computes input_ptr for the float type it is told about.
+const void* DecodePremultiplied( void* out, const void*, int num, int x, int y, void* context )
+{
+    auto ctx = (const ResizeContext*)context;
+    auto src = ctx->src + ( size_t( y ) * ctx->srcStride + x ) * 4;
+    auto dst = (float*)out;
+    auto lut = ctx->lut->decode;
+
+    int i = 0;
+#ifdef __AVX2__
+    for( ; i + 2 <= num; i += 2 )
+    {
+        _mm256_storeu_ps( dst, DecodePair( src, lut ) );
+        src += 8;
+        dst += 8;
+    }
+#endif
+    for( ; i < num; i++ )
+    {
+#ifdef __SSE2__
+        _mm_storeu_ps( dst, DecodePixel( src, lut ) );
+#else
+        DecodePixel( src, dst, lut );
+#endif
+        src += 4;
+        dst += 4;
+    }
+    return out;
+}
+
+// Output callback, unpremultiplies a row of resized pixels and encodes it back to sRGB.
+void EncodePremultiplied( const void* out, int num, int y, void* context )
+{
+    auto ctx = (const ResizeContext*)context;
+    auto src = (const float*)out;
+    auto dst = ctx->dst + size_t( y ) * ctx->width * 4;
+    auto lut = ctx->lut->encode;
+
+    for( int i=0; i<num; i++ )
+    {
+#ifdef __SSE2__
+        EncodePixel( _mm_loadu_ps( src ), dst, lut );
+#else
+        EncodePixel( src, dst, lut );
+#endif
+        src += 4;
+        dst += 4;
+    }
+}
+
+// Averages 2x2 blocks of premultiplied linear light, as Resample would do in Premultiplied mode.
+void HalveRow( const uint8_t* src0, const uint8_t* src1, uint8_t* dst, uint32_t width, const ResizeLut& lut )
+{
+    for( uint32_t x=0; x<width; x++ )
+    {
+#ifdef __AVX2__
+        const auto v = _mm256_add_ps( DecodePair( src0, lut.decode ), DecodePair( src1, lut.decode ) );
+        const auto sum = _mm_add_ps( _mm256_castps256_ps128( v ), _mm256_extractf128_ps( v, 1 ) );
+        EncodePixel( _mm_mul_ps( sum, _mm_set1_ps( 0.25f ) ), dst, lut.encode );
+#elif defined __SSE2__
+        const auto v0 = _mm_add_ps( DecodePixel( src0, lut.decode ), DecodePixel( src0 + 4, lut.decode ) );
+        const auto v1 = _mm_add_ps( DecodePixel( src1, lut.decode ), DecodePixel( src1 + 4, lut.decode ) );
+        EncodePixel( _mm_mul_ps( _mm_add_ps( v0, v1 ), _mm_set1_ps( 0.25f ) ), dst, lut.encode );
+#else
+        float p[4][4];
+        DecodePixel( src0, p[0], lut.decode );
+        DecodePixel( src0 + 4, p[1], lut.decode );
+        DecodePixel( src1, p[2], lut.decode );
+        DecodePixel( src1 + 4, p[3], lut.decode );
+        for( int i=0; i<4; i++ ) p[0][i] = ( p[0][i] + p[1][i] + p[2][i] + p[3][i] ) * 0.25f;
+        EncodePixel( p[0], dst, lut.encode );
+#endif
+        src0 += 8;
+        src1 += 8;
+        dst += 4;
+    }
+}
+
+}
+
+void Bitmap::Resample( const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight, uint8_t* dst, uint32_t width, uint32_t height, TaskDispatch* td, ResizeMode mode )
+{
+    Resample( BitmapView { src, srcWidth, srcHeight, srcWidth }, dst, width, height, td, mode );
+}
+
+void Bitmap::Resample( const BitmapView& src, uint8_t* dst, uint32_t width, uint32_t height, TaskDispatch* td, ResizeMode mode )
 {
-    auto ret = std::make_unique<Bitmap>( width, height );
     STBIR_RESIZE resize;
-    stbir_resize_init( &resize, m_data, m_width, m_height, 0, ret->m_data, width, height, 0, STBIR_RGBA, STBIR_TYPE_UINT8_SRGB );
-    stbir_set_non_pm_alpha_speed_over_quality( &resize, 1 );
+    ResizeContext ctx;
+    if( mode == ResizeMode::Premultiplied )
+    {
+        // The pixels are converted once on the way in and once on the way out, and stbir filters the floats
+        // without any colour or alpha handling of its own.
+        ctx = { src.data, src.stride, dst, width, &GetResizeLut() };
+        stbir_resize_init( &resize, src.data, src.width, src.height, 0, dst, width, height, 0, STBIR_RGBA_PM, STBIR_TYPE_FLOAT );
+        stbir_set_pixel_callbacks( &resize, DecodePremultiplied, EncodePremultiplied );
+        stbir_set_user_data( &resize, &ctx );
+    }
+    else
+    {
+        stbir_resize_init( &resize, src.data, src.width, src.height, int( src.stride * 4 ), dst, width, height, 0, STBIR_RGBA, STBIR_TYPE_UINT8_SRGB );
+        stbir_set_non_pm_alpha_speed_over_quality( &resize, 1 );
+    }
     if( td )
     {
-        auto threads = td->NumWorkers() + 1;
-        threads = stbir_build_samplers_with_splits( &resize, threads );
-        for( size_t i=0; i<threads; i++ )
-        {
-            td->Queue( [i, &resize, threads] {
-                stbir_resize_extended_split( &resize, i, 1 );
-            } );
-        }
-        td->Sync();
+        const auto splits = stbir_build_samplers_with_splits( &resize, td->NumWorkers() + 1 );
+        td->ParallelFor( 0, splits, 1, [&resize]( size_t begin, size_t end ) {
+            stbir_resize_extended_split( &resize, begin, end - begin );
+        } );
         stbir_free_samplers( &resize );
     }
     else
     {
         stbir_resize_extended( &resize );
     }
+}
+
+void Bitmap::Halve( const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight, uint8_t* dst, TaskDispatch* td )
+{
+    const auto& lut = GetResizeLut();
+    HalveImage( src, srcWidth, srcHeight, dst, td, [&lut]( const uint8_t* src0, const uint8_t* src1, uint8_t* dst, uint32_t width ) {
+        HalveRow( src0, src1, dst, width, lut );
+    } );
+}
+
+void Bitmap::Resize( uint32_t width, uint32_t height, TaskDispatch* td, ResizeMode mode )
+{
+    auto newData = PixelAlloc<uint8_t>( size_t( width ) * height * 4, MemoryStats::Pool::Bitmap );
+    Resample( m_data, m_width, m_height, newData, width, height, td, mode );
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::Bitmap );
+    m_data = newData;
+    m_width = width;
+    m_height = height;
+}
+
+std::unique_ptr<Bitmap> Bitmap::ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td, ResizeMode mode ) const
+{
+    auto ret = std::make_unique<Bitmap>( width, height );
+    Resample( m_data, m_width, m_height, ret->m_data, width, height, td, mode );
+    return ret;
+}
+
+std::unique_ptr<Bitmap> Bitmap::ResizeNew( const BitmapView& src, uint32_t width, uint32_t height, TaskDispatch* td, ResizeMode mode )
+{
+    auto ret = std::make_unique<Bitmap>( width, height );
+    Resample( src, ret->m_data, width, height, td, mode );
     return ret;
 }
 
@@ -102,7 +452,7 @@ void Bitmap::Extend( uint32_t width, uint32_t height )
 {
     CheckPanic( width >= m_width && height >= m_height, "Invalid extension" );
 
-    auto data = new uint8_t[width*height*4];
+    auto data = PixelAlloc<uint8_t>( size_t( width ) * height * 4, MemoryStats::Pool::Bitmap );
     auto stride = width - m_width;
 
     auto src = m_data;
@@ -112,225 +462,142 @@ void Bitmap::Extend( uint32_t width, uint32_t height )
     {
         memcpy( dst, src, m_width * 4 );
         src += m_width * 4;
-        dst += width * 4;
+        dst += m_width * 4;
         memset( dst, 0, stride * 4 );
         dst += stride * 4;
     }
     memset( dst, 0, ( height - m_height ) * width * 4 );
 
-    delete[] m_data;
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::Bitmap );
     m_data = data;
     m_width = width;
     m_height = height;
 }
 
-void Bitmap::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
+void Bitmap::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height, TaskDispatch* td )
 {
     CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid crop" );
 
-    auto data = new uint8_t[width*height*4];
-    auto dst = data;
-    auto src = m_data + ( y * m_width + x ) * 4;
-
-    for( uint32_t i=0; i<height; i++ )
-    {
-        memcpy( dst, src, width * 4 );
-        src += m_width * 4;
-        dst += width * 4;
-    }
-
-    delete[] m_data;
-    m_data = data;
-    m_width = width;
-    m_height = height;
+    Bitmap cropped( View( x, y, width, height ), td );
+    std::swap( m_data, cropped.m_data );
+    std::swap( m_width, cropped.m_width );
+    std::swap( m_height, cropped.m_height );
 }
 
-void Bitmap::FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
+void Bitmap::FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height, TaskDispatch* td )
 {
     CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid fill" );
-
-    constexpr uint32_t black = 0xff000000;
-    auto row = m_data + ( y * m_width + x ) * 4;
-    for( uint32_t i=0; i<height; i++ )
-    {
-        auto ptr = row;
-        for( uint32_t j=0; j<width; j++ )
-        {
-            memcpy( ptr, &black, 4 );
-            ptr += 4;
-        }
-        row += m_width * 4;
-    }
+    BitmapOps::Fill( (uint32_t*)m_data, m_width, x, y, width, height, 0xff000000u, td );
 }
 
-void Bitmap::FlipVertical()
+void Bitmap::FlipVertical( TaskDispatch* td )
 {
-    auto ptr1 = m_data;
-    auto ptr2 = m_data + ( m_height - 1 ) * m_width * 4;
-    auto tmp = alloca( m_width * 4 );
+    BitmapOps::FlipVertical( (uint32_t*)m_data, m_width, m_height, td );
+}
 
-    for( uint32_t y=0; y<m_height/2; y++ )
-    {
-        memcpy( tmp, ptr1, m_width * 4 );
-        memcpy( ptr1, ptr2, m_width * 4 );
-        memcpy( ptr2, tmp, m_width * 4 );
-        ptr1 += m_width * 4;
-        ptr2 -= m_width * 4;
-    }
+void Bitmap::FlipHorizontal( TaskDispatch* td )
+{
+    BitmapOps::FlipHorizontal( (uint32_t*)m_data, m_width, m_height, td );
 }
 
-void Bitmap::FlipHorizontal()
+void Bitmap::Rotate90( TaskDispatch* td )
 {
-    auto ptr = (uint32_t*)m_data;
+    ZoneScoped;
 
-    for( uint32_t y=0; y<m_height; y++ )
-    {
-        auto ptr1 = ptr;
-        auto ptr2 = ptr + m_width - 1;
+    auto tmp = PixelAlloc<uint8_t>( size_t( m_width ) * m_height * 4, MemoryStats::Pool::Bitmap );
+    RotateImage<true>( (const uint32_t*)m_data, (uint32_t*)tmp, m_width, m_height, td );
 
-        for( uint32_t x=0; x<m_width/2; x++ )
-        {
-            std::swap( *ptr1++, *ptr2-- );
-        }
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::Bitmap );
+    m_data = tmp;
+    std::swap( m_width, m_height );
+}
 
-        ptr += m_width;
-    }
+void Bitmap::Rotate180( TaskDispatch* td )
+{
+    BitmapOps::Rotate180( (uint32_t*)m_data, m_width, m_height, td );
 }
 
-void Bitmap::Rotate90()
+void Bitmap::Rotate270( TaskDispatch* td )
 {
-    auto tmp = new uint8_t[m_width * m_height * 4];
+    ZoneScoped;
 
-    auto src = (uint32_t*)m_data;
-    auto dst = (uint32_t*)tmp;
+    auto tmp = PixelAlloc<uint8_t>( size_t( m_width ) * m_height * 4, MemoryStats::Pool::Bitmap );
+    RotateImage<false>( (const uint32_t*)m_data, (uint32_t*)tmp, m_width, m_height, td );
 
-    for( uint32_t y=0; y<m_height; y++ )
-    {
-        for( uint32_t x=0; x<m_width; x++ )
-        {
-            dst[x * m_height + m_height - y - 1] = src[y * m_width + x];
-        }
-    }
-
-    delete[] m_data;
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::Bitmap );
     m_data = tmp;
     std::swap( m_width, m_height );
 }
 
-void Bitmap::Rotate180()
+#if defined MCORE_SIMD_X86
+SIMD_AVX2 static void SetAlphaAvx2( uint8_t*& ptr, size_t& sz, uint32_t alpha )
 {
-    auto ptr1 = (uint32_t*)m_data;
-    auto ptr2 = (uint32_t*)m_data + m_width * m_height - 1;
-
-    for( uint32_t i=0; i<m_width * m_height / 2; i++ )
+    const auto alpha8 = _mm256_set1_epi32( alpha );
+    const auto mask8 = _mm256_set1_epi32( 0x00FFFFFF );
+    while( sz >= 8 )
     {
-        std::swap( *ptr1++, *ptr2-- );
+        auto v = _mm256_loadu_si256( (const __m256i*)ptr );
+        v = _mm256_and_si256( v, mask8 );
+        v = _mm256_or_si256( v, alpha8 );
+        _mm256_storeu_si256( (__m256i*)ptr, v );
+        ptr += 8 * 4;
+        sz -= 8;
     }
 }
 
-void Bitmap::Rotate270()
+SIMD_AVX512 static void SetAlphaAvx512( uint8_t*& ptr, size_t& sz, uint32_t alpha )
 {
-    auto tmp = new uint8_t[m_width * m_height * 4];
-
-    auto src = (uint32_t*)m_data;
-    auto dst = (uint32_t*)tmp;
-
-    for( uint32_t y=0; y<m_height; y++ )
+    const auto alpha16 = _mm512_set1_epi32( alpha );
+    const auto mask16 = _mm512_set1_epi32( 0x00FFFFFF );
+    while( sz >= 16 )
     {
-        for( uint32_t x=0; x<m_width; x++ )
-        {
-            dst[( m_width - x - 1 ) * m_height + y] = src[y * m_width + x];
-        }
+        auto v = _mm512_loadu_si512( ptr );
+        v = _mm512_and_si512( v, mask16 );
+        v = _mm512_or_si512( v, alpha16 );
+        _mm512_storeu_si512( ptr, v );
+        ptr += 16 * 4;
+        sz -= 16;
     }
-
-    delete[] m_data;
-    m_data = tmp;
-    std::swap( m_width, m_height );
+    SetAlphaAvx2( ptr, sz, alpha );
 }
+#endif
 
-void Bitmap::SetAlpha( uint8_t alpha )
+static void SetAlphaPixels( uint8_t* ptr, size_t sz, uint8_t alpha )
 {
-    auto ptr = m_data;
-    size_t sz = m_width * m_height;
+    const auto alpha32 = uint32_t( alpha ) << 24;
 
-    if( alpha == 0xFF )
+#if defined MCORE_SIMD_X86
+    switch( GetSimdLevel() )
     {
-#ifdef __AVX512F__
-        const auto alpha16 = _mm512_set1_epi32( alpha << 24 );
-        while( sz >= 16 )
-        {
-            auto v = _mm512_loadu_si512( ptr );
-            v = _mm512_or_si512( v, alpha16 );
-            _mm512_storeu_si512( ptr, v );
-            ptr += 16 * 4;
-            sz -= 16;
-        }
-#endif
-#ifdef __AVX2__
-        const auto alpha8 = _mm256_set1_epi32( alpha << 24 );
-        while( sz >= 8 )
-        {
-            auto v = _mm256_loadu_si256( (const __m256i*)ptr );
-            v = _mm256_or_si256( v, alpha8 );
-            _mm256_storeu_si256( (__m256i*)ptr, v );
-            ptr += 8 * 4;
-            sz -= 8;
-        }
-#endif
-#ifdef __SSE2__
-        const auto alpha4 = _mm_set1_epi32( alpha << 24 );
-        while( sz >= 4 )
-        {
-            auto v = _mm_loadu_si128( (const __m128i*)ptr );
-            v = _mm_or_si128( v, alpha4 );
-            _mm_storeu_si128( (__m128i*)ptr, v );
-            ptr += 4 * 4;
-            sz -= 4;
-        }
+    case SimdLevel::Avx512: SetAlphaAvx512( ptr, sz, alpha32 ); break;
+    case SimdLevel::Avx2: SetAlphaAvx2( ptr, sz, alpha32 ); break;
+    default: break;
+    }
 #endif
+#if defined __SSE2__
+    const auto alpha4 = _mm_set1_epi32( alpha32 );
+    const auto mask4 = _mm_set1_epi32( 0x00FFFFFF );
+    while( sz >= 4 )
+    {
+        auto v = _mm_loadu_si128( (const __m128i*)ptr );
+        v = _mm_and_si128( v, mask4 );
+        v = _mm_or_si128( v, alpha4 );
+        _mm_storeu_si128( (__m128i*)ptr, v );
+        ptr += 4 * 4;
+        sz -= 4;
     }
-    else
+#elif defined __ARM_NEON
+    const auto alpha4 = vdupq_n_u32( alpha32 );
+    const auto mask4 = vdupq_n_u32( 0x00FFFFFF );
+    while( sz >= 4 )
     {
-#ifdef __AVX512F__
-        const auto alpha16 = _mm512_set1_epi32( alpha << 24 );
-        const auto mask16 = _mm512_set1_epi32( 0x00FFFFFF );
-        while( sz >= 16 )
-        {
-            auto v = _mm512_loadu_si512( ptr );
-            v = _mm512_and_si512( v, mask16 );
-            v = _mm512_or_si512( v, alpha16 );
-            _mm512_storeu_si512( ptr, v );
-            ptr += 16 * 4;
-            sz -= 16;
-        }
-#endif
-#ifdef __AVX2__
-        const auto alpha8 = _mm256_set1_epi32( alpha << 24 );
-        const auto mask8 = _mm256_set1_epi32( 0x00FFFFFF );
-        while( sz >= 8 )
-        {
-            auto v = _mm256_loadu_si256( (const __m256i*)ptr );
-            v = _mm256_and_si256( v, mask8 );
-            v = _mm256_or_si256( v, alpha8 );
-            _mm256_storeu_si256( (__m256i*)ptr, v );
-            ptr += 8 * 4;
-            sz -= 8;
-        }
-#endif
-#ifdef __SSE2__
-        const auto alpha4 = _mm_set1_epi32( alpha << 24 );
-        const auto mask4 = _mm_set1_epi32( 0x00FFFFFF );
-        while( sz >= 4 )
-        {
-            auto v = _mm_loadu_si128( (const __m128i*)ptr );
-            v = _mm_and_si128( v, mask4 );
-            v = _mm_or_si128( v, alpha4 );
-            _mm_storeu_si128( (__m128i*)ptr, v );
-            ptr += 4 * 4;
-            sz -= 4;
-        }
-#endif
+        auto v = vld1q_u32( (const uint32_t*)ptr );
+        v = vorrq_u32( vandq_u32( v, mask4 ), alpha4 );
+        vst1q_u32( (uint32_t*)ptr, v );
+        ptr += 4 * 4;
+        sz -= 4;
     }
+#endif
 
     ptr += 3;
     while( sz-- )
@@ -340,34 +607,41 @@ void Bitmap::SetAlpha( uint8_t alpha )
     }
 }
 
-void Bitmap::NormalizeOrientation()
+void Bitmap::SetAlpha( uint8_t alpha, TaskDispatch* td )
+{
+    BitmapOps::ForRange( td, size_t( m_width ) * m_height, [this, alpha]( size_t begin, size_t end ) {
+        SetAlphaPixels( m_data + begin * 4, end - begin, alpha );
+    } );
+}
+
+void Bitmap::NormalizeOrientation( TaskDispatch* td )
 {
     if( m_orientation <= 1 ) return;
 
     switch( m_orientation )
     {
     case 2:
-        FlipHorizontal();
+        FlipHorizontal( td );
         break;
     case 3:
-        Rotate180();
+        Rotate180( td );
         break;
     case 4:
-        FlipVertical();
+        FlipVertical( td );
         break;
     case 5:
-        Rotate270();
-        FlipVertical();
+        Rotate270( td );
+        FlipVertical( td );
         break;
     case 6:
-        Rotate90();
+        Rotate90( td );
         break;
     case 7:
-        Rotate90();
-        FlipVertical();
+        Rotate90( td );
+        FlipVertical( td );
         break;
     case 8:
-        Rotate270();
+        Rotate270( td );
         break;
     default:
         Panic( "Invalid orientation value!" );
@@ -376,47 +650,98 @@ void Bitmap::NormalizeOrientation()
     m_orientation = 1;
 }
 
-bool Bitmap::SavePng( const char* path ) const
+bool Bitmap::SavePng( const char* path, TaskDispatch* td ) const
 {
     FILE* f = fopen( path, "wb" );
     CheckPanic( f, "Failed to open %s for writing", path );
 
     mclog( LogLevel::Info, "Saving PNG: %s", path );
-    auto res = SavePng( fileno( f ) );
+    auto res = SavePng( fileno( f ), {}, td );
     fclose( f );
 
     return res;
 }
 
-bool Bitmap::SavePng( int fd ) const
+bool Bitmap::SavePng( int fd, const std::vector<std::pair<std::string, std::string>>& text, TaskDispatch* td, PngCompression compression ) const
 {
-    ZoneScoped;
-
-    png_structp png_ptr = png_create_write_struct( PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr );
-    png_infop info_ptr = png_create_info_struct( png_ptr );
-    if( setjmp( png_jmpbuf( png_ptr ) ) )
-    {
-        png_destroy_write_struct( &png_ptr, &info_ptr );
-        return false;
-    }
+    return SavePng( View(), fd, text, td, compression );
+}
 
-    png_set_write_fn( png_ptr, (png_voidp)(ptrdiff_t)fd, []( png_structp png, png_bytep data, size_t length ) {
-        if( write( (int)(ptrdiff_t)png_get_io_ptr( png ), data, length ) < 0 ) png_error( png, "Write error" );
-    }, nullptr );
+bool Bitmap::SavePng( const BitmapView& view, int fd, const std::vector<std::pair<std::string, std::string>>& text, TaskDispatch* td, PngCompression compression )
+{
+    ZoneScoped;
 
-    png_set_IHDR( png_ptr, info_ptr, m_width, m_height, 8, PNG_COLOR_TYPE_RGB_ALPHA, PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_BASE, PNG_FILTER_TYPE_BASE );
+    static constexpr uint8_t Signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n' };
+    if( !WriteAll( fd, Signature, sizeof( Signature ) ) ) return false;
 
-    png_write_info( png_ptr, info_ptr );
+    uint8_t ihdr[13];
+    PutBe32( ihdr, view.width );
+    PutBe32( ihdr + 4, view.height );
+    ihdr[8] = 8;        // Bit depth
+    ihdr[9] = 6;        // RGBA
+    ihdr[10] = 0;       // Deflate
+    ihdr[11] = 0;       // Adaptive filtering
+    ihdr[12] = 0;       // No interlace
+    if( !WriteChunk( fd, "IHDR", ihdr, sizeof( ihdr ) ) ) return false;
 
-    auto ptr = (uint32_t*)m_data;
-    for( int i=0; i<m_height; i++ )
+    for( auto& [key, value] : text )
     {
-        png_write_rows( png_ptr, (png_bytepp)(&ptr), 1 );
-        ptr += m_width;
+        std::string chunk = key;
+        chunk.push_back( '\0' );
+        chunk += value;
+        if( !WriteChunk( fd, "tEXt", chunk.data(), chunk.size() ) ) return false;
     }
 
-    png_write_end( png_ptr, info_ptr );
-    png_destroy_write_struct( &png_ptr, &info_ptr );
+    // Strips are deflated independently and joined with sync flushes into a single zlib stream, as pigz does.
+    // A batch of strips is compressed in parallel, then written out before the next one starts.
+    const auto fast = compression == PngCompression::Fast;
+    const auto level = fast ? 1 : Z_DEFAULT_COMPRESSION;
+    const auto stride = size_t( view.width ) * 4;
+    const auto stripRows = uint32_t( std::clamp<size_t>( PngStripSize / ( stride + 1 ), 1, std::max( view.height, 1u ) ) );
+    const auto numStrips = ( view.height + stripRows - 1 ) / stripRows;
+    const auto batch = td ? std::max<size_t>( td->NumWorkers() * 2, 1 ) : 1;
+
+    std::vector<PngStrip> strips( std::min<size_t>( batch, numStrips ) );
+    uint32_t adler = adler32( 0, nullptr, 0 );
+    for( uint32_t first=0; first<numStrips; first+=batch )
+    {
+        const auto count = std::min<size_t>( batch, numStrips - first );
+        auto encode = [&]( size_t begin, size_t end ) {
+            for( size_t i=begin; i<end; i++ )
+            {
+                const auto strip = uint32_t( first + i );
+                const auto y0 = strip * stripRows;
+                const auto y1 = std::min( y0 + stripRows, view.height );
+                EncodePngStrip( view, y0, y1, strip == numStrips - 1, level, !fast, strips[i] );
+            }
+        };
+        if( td && count > 1 )
+        {
+            td->ParallelFor( 0, count, 1, encode );
+        }
+        else
+        {
+            encode( 0, count );
+        }
+
+        for( size_t i=0; i<count; i++ )
+        {
+            auto& strip = strips[i];
+            adler = adler32_combine( adler, strip.adler, strip.size );
+            if( first + i == 0 )
+            {
+                const uint8_t header[2] = { 0x78, uint8_t( fast ? 0x01 : 0x9c ) };
+                strip.data.insert( strip.data.begin(), header, header + 2 );
+            }
+            if( first + i == numStrips - 1 )
+            {
+                strip.data.resize( strip.data.size() + 4 );
+                PutBe32( strip.data.data() + strip.data.size() - 4, adler );
+            }
+            if( !WriteChunk( fd, "IDAT", strip.data.data(), strip.data.size() ) ) return false;
+            strip.data = {};
+        }
+    }
 
-    return true;
+    return WriteChunk( fd, "IEND", nullptr, 0 );
 }
@@ -2,6 +2,11 @@
 
 #include <memory>
 #include <stdint.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "BitmapView.hpp"
 
 class TaskDispatch;
 
@@ -9,6 +14,8 @@ class Bitmap
 {
 public:
     Bitmap( uint32_t width, uint32_t height, int orientation = 0 );
+    // Copy of the viewed pixels
+    explicit Bitmap( const BitmapView& view, TaskDispatch* td = nullptr );
     ~Bitmap();
 
     Bitmap( const Bitmap& ) = delete;
@@ -16,19 +23,34 @@ public:
     Bitmap& operator=( const Bitmap& ) = delete;
     Bitmap& operator=( Bitmap&& other ) noexcept;
 
-    void Resize( uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
-    [[nodiscard]] std::unique_ptr<Bitmap> ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td = nullptr ) const;
+    // Both modes filter in linear light. Premultiplied weights colour by alpha, so that transparent pixels do not
+    // bleed into their neighbours. Fast ignores alpha, which is only correct for opaque images.
+    enum class ResizeMode
+    {
+        Premultiplied,
+        Fast
+    };
+
+    void Resize( uint32_t width, uint32_t height, TaskDispatch* td = nullptr, ResizeMode mode = ResizeMode::Premultiplied );
+    [[nodiscard]] std::unique_ptr<Bitmap> ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td = nullptr, ResizeMode mode = ResizeMode::Premultiplied ) const;
+    [[nodiscard]] static std::unique_ptr<Bitmap> ResizeNew( const BitmapView& src, uint32_t width, uint32_t height, TaskDispatch* td = nullptr, ResizeMode mode = ResizeMode::Premultiplied );
+    // Resizes tightly packed RGBA pixel data, e.g. from one mip level to the next one in place of a larger buffer.
+    static void Resample( const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight, uint8_t* dst, uint32_t width, uint32_t height, TaskDispatch* td = nullptr, ResizeMode mode = ResizeMode::Premultiplied );
+    static void Resample( const BitmapView& src, uint8_t* dst, uint32_t width, uint32_t height, TaskDispatch* td = nullptr, ResizeMode mode = ResizeMode::Premultiplied );
+    // Halves tightly packed RGBA pixel data with a 2x2 box filter, in the same space as Premultiplied resampling.
+    // The source must be an exact halving, see IsHalving().
+    static void Halve( const uint8_t* src, uint32_t srcWidth, uint32_t srcHeight, uint8_t* dst, TaskDispatch* td = nullptr );
     void Extend( uint32_t width, uint32_t height );
-    void Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height );
-    void FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height );
-    void SetAlpha( uint8_t alpha );
-    void NormalizeOrientation();
+    void Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
+    void FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
+    void SetAlpha( uint8_t alpha, TaskDispatch* td = nullptr );
+    void NormalizeOrientation( TaskDispatch* td = nullptr );
 
-    void FlipVertical();
-    void FlipHorizontal();
-    void Rotate90();
-    void Rotate180();
-    void Rotate270();
+    void FlipVertical( TaskDispatch* td = nullptr );
+    void FlipHorizontal( TaskDispatch* td = nullptr );
+    void Rotate90( TaskDispatch* td = nullptr );
+    void Rotate180( TaskDispatch* td = nullptr );
+    void Rotate270( TaskDispatch* td = nullptr );
 
     [[nodiscard]] uint32_t Width() const { return m_width; }
     [[nodiscard]] uint32_t Height() const { return m_height; }
@@ -36,8 +58,20 @@ public:
     [[nodiscard]] const uint8_t* Data() const { return m_data; }
     [[nodiscard]] int Orientation() const { return m_orientation; }
 
-    bool SavePng( const char* path ) const;
-    bool SavePng( int fd ) const;
+    [[nodiscard]] BitmapView View() const { return { m_data, m_width, m_height, m_width }; }
+    [[nodiscard]] BitmapView View( uint32_t x, uint32_t y, uint32_t width, uint32_t height ) const { return View().Sub( x, y, width, height ); }
+
+    enum class PngCompression
+    {
+        Default,
+        Fast        // For transfers like the clipboard, where the file is not kept
+    };
+
+    bool SavePng( const char* path, TaskDispatch* td = nullptr ) const;
+    // Text is stored as tEXt chunks of key and value pairs. Rows are compressed in strips, in parallel if td is
+    // set, and written out as they are done.
+    bool SavePng( int fd, const std::vector<std::pair<std::string, std::string>>& text = {}, TaskDispatch* td = nullptr, PngCompression compression = PngCompression::Default ) const;
+    static bool SavePng( const BitmapView& view, int fd, const std::vector<std::pair<std::string, std::string>>& text = {}, TaskDispatch* td = nullptr, PngCompression compression = PngCompression::Default );
 
 private:
     uint32_t m_width;
@@ -1,34 +1,103 @@
+#include <algorithm>
+#include <string.h>
+
 #include "BitmapAnim.hpp"
 #include "Logs.hpp"
+#include "Panic.hpp"
+
+// Bounds the number of changes applied when a frame is requested out of order.
+constexpr size_t KeyInterval = 32;
+
+constexpr size_t NoFrame = ~size_t( 0 );
+
+static std::shared_ptr<Bitmap> Copy( const Bitmap& bmp )
+{
+    auto ret = std::make_shared<Bitmap>( bmp.Width(), bmp.Height(), bmp.Orientation() );
+    memcpy( ret->Data(), bmp.Data(), size_t( bmp.Width() ) * bmp.Height() * 4 );
+    return ret;
+}
 
 BitmapAnim::BitmapAnim( uint32_t frameCount )
+    : m_canvasIdx( NoFrame )
 {
     m_frames.reserve( frameCount );
 }
 
 void BitmapAnim::AddFrame( std::shared_ptr<Bitmap> bmp, uint32_t delay_us )
 {
-    m_frames.push_back( { std::move( bmp ), delay_us } );
+    const auto w = bmp->Width();
+    const auto h = bmp->Height();
+    const auto src = (const uint32_t*)bmp->Data();
+
+    Delta delta = {
+        .delay_us = delay_us,
+        .orientation = bmp->Orientation(),
+        .key = !m_last || m_frames.size() % KeyInterval == 0 || m_last->Width() != w || m_last->Height() != h || m_last->Orientation() != bmp->Orientation()
+    };
+
+    if( delta.key )
+    {
+        delta.width = w;
+        delta.height = h;
+        delta.pixels.assign( src, src + size_t( w ) * h );
+    }
+    else
+    {
+        auto prev = (const uint32_t*)m_last->Data();
+        uint32_t x0 = w, x1 = 0, y0 = h, y1 = 0;
+        for( uint32_t y=0; y<h; y++ )
+        {
+            auto a = src + size_t( y ) * w;
+            auto b = prev + size_t( y ) * w;
+            if( memcmp( a, b, w * 4 ) == 0 ) continue;
+
+            uint32_t l = 0;
+            while( a[l] == b[l] ) l++;
+            uint32_t r = w;
+            while( a[r-1] == b[r-1] ) r--;
+
+            x0 = std::min( x0, l );
+            x1 = std::max( x1, r );
+            y0 = std::min( y0, y );
+            y1 = y + 1;
+        }
+
+        if( y1 > y0 )
+        {
+            delta.x = x0;
+            delta.y = y0;
+            delta.width = x1 - x0;
+            delta.height = y1 - y0;
+            delta.pixels.resize( size_t( delta.width ) * delta.height );
+            for( uint32_t y=0; y<delta.height; y++ )
+            {
+                memcpy( delta.pixels.data() + size_t( y ) * delta.width, src + size_t( y0 + y ) * w + x0, delta.width * 4 );
+            }
+        }
+    }
+
+    m_frames.emplace_back( std::move( delta ) );
+    m_last = std::move( bmp );
 }
 
 void BitmapAnim::Resize( uint32_t width, uint32_t height )
 {
-    for( auto& frame : m_frames )
-    {
-        frame.bmp->Resize( width, height );
-    }
+    Rebuild( [width, height]( Bitmap& bmp, size_t ) { bmp.Resize( width, height ); } );
 }
 
 void BitmapAnim::NormalizeSize()
 {
     bool normalize = false;
-    uint32_t mw = m_frames[0].bmp->Width();
-    uint32_t mh = m_frames[0].bmp->Height();
+    uint32_t mw = m_frames[0].width;
+    uint32_t mh = m_frames[0].height;
 
+    // Only key frames can change the size
     for( size_t i=1; i<m_frames.size(); i++ )
     {
-        const auto fw = m_frames[i].bmp->Width();
-        const auto fh = m_frames[i].bmp->Height();
+        if( !m_frames[i].key ) continue;
+
+        const auto fw = m_frames[i].width;
+        const auto fh = m_frames[i].height;
         if( fw != mw || fh != mh )
         {
             normalize = true;
@@ -41,15 +110,75 @@ void BitmapAnim::NormalizeSize()
 
     if( normalize )
     {
-        for( size_t i=0; i<m_frames.size(); i++ )
-        {
-            const auto fw = m_frames[i].bmp->Width();
-            const auto fh = m_frames[i].bmp->Height();
-            if( fw != mw || fh != mh )
+        Rebuild( [mw, mh]( Bitmap& bmp, size_t idx ) {
+            if( bmp.Width() != mw || bmp.Height() != mh )
             {
-                mclog( LogLevel::Info, "Extending frame %zu (size %ux%u)", i, fw, fh );
-                m_frames[i].bmp->Extend( mw, mh );
+                mclog( LogLevel::Info, "Extending frame %zu (size %ux%u)", idx, bmp.Width(), bmp.Height() );
+                bmp.Extend( mw, mh );
             }
-        }
+        } );
+    }
+}
+
+BitmapAnim::Frame BitmapAnim::GetFrame( size_t idx )
+{
+    CheckPanic( idx < m_frames.size(), "Frame index out of range" );
+
+    auto key = idx;
+    while( !m_frames[key].key ) key--;
+
+    if( m_canvasIdx == NoFrame || m_canvasIdx < key || m_canvasIdx > idx )
+    {
+        m_canvasIdx = key;
+        Apply( m_frames[key] );
+    }
+    while( m_canvasIdx < idx ) Apply( m_frames[++m_canvasIdx] );
+
+    return { m_canvas, m_frames[idx].delay_us };
+}
+
+size_t BitmapAnim::DataSize() const
+{
+    size_t size = 0;
+    for( auto& frame : m_frames ) size += frame.pixels.size() * 4;
+    return size;
+}
+
+// The canvas is written in place, unless the frame it holds was handed out and is still in use.
+void BitmapAnim::Apply( const Delta& delta )
+{
+    if( delta.key )
+    {
+        const bool reuse = m_canvas && m_canvas.use_count() == 1 && m_canvas->Width() == delta.width && m_canvas->Height() == delta.height && m_canvas->Orientation() == delta.orientation;
+        if( !reuse ) m_canvas = std::make_shared<Bitmap>( delta.width, delta.height, delta.orientation );
+        memcpy( m_canvas->Data(), delta.pixels.data(), delta.pixels.size() * 4 );
+        return;
+    }
+    if( delta.width == 0 ) return;
+
+    if( m_canvas.use_count() > 1 ) m_canvas = Copy( *m_canvas );
+    const auto canvasWidth = m_canvas->Width();
+    auto dst = (uint32_t*)m_canvas->Data();
+    for( uint32_t y=0; y<delta.height; y++ )
+    {
+        memcpy( dst + size_t( delta.y + y ) * canvasWidth + delta.x, delta.pixels.data() + size_t( y ) * delta.width, delta.width * 4 );
     }
 }
+
+// Re-encodes all frames after passing copies of the full images through fn, one frame at a time.
+void BitmapAnim::Rebuild( const std::function<void( Bitmap&, size_t )>& fn )
+{
+    BitmapAnim tmp( m_frames.size() );
+    for( size_t i=0; i<m_frames.size(); i++ )
+    {
+        auto frame = GetFrame( i );
+        auto bmp = Copy( *frame.bmp );
+        fn( *bmp, i );
+        tmp.AddFrame( std::move( bmp ), frame.delay_us );
+    }
+
+    m_frames = std::move( tmp.m_frames );
+    m_last = std::move( tmp.m_last );
+    m_canvasIdx = NoFrame;
+    m_canvas.reset();
+}
@@ -1,12 +1,15 @@
 #pragma once
 
 #include <stdint.h>
+#include <functional>
 #include <memory>
 #include <vector>
 
 #include "Bitmap.hpp"
 #include "NoCopy.hpp"
 
+// Frames are stored as the rectangle changed since the previous frame, with a full key frame at regular
+// intervals. Full bitmaps are rebuilt when a frame is requested.
 class BitmapAnim
 {
 public:
@@ -19,15 +22,41 @@ public:
     BitmapAnim( uint32_t frameCount );
     NoCopy( BitmapAnim );
 
+    // Frames are the fully composited images, the differences are found here.
     void AddFrame( std::shared_ptr<Bitmap> bmp, uint32_t delay_us );
     void Resize( uint32_t width, uint32_t height );
     void NormalizeSize();
 
     [[nodiscard]] size_t FrameCount() const { return m_frames.size(); }
 
-    [[nodiscard]] Frame& GetFrame( size_t idx ) { return m_frames[idx]; }
-    [[nodiscard]] const Frame& GetFrame( size_t idx ) const { return m_frames[idx]; }
+    // Requesting frames in playback order only applies a single change per frame. The bitmap is the one frames
+    // are rebuilt in, and must not be modified. It is only copied if it is still held when the next frame is
+    // requested.
+    [[nodiscard]] Frame GetFrame( size_t idx );
+
+    // Bytes of pixel data held by the stored frames.
+    [[nodiscard]] size_t DataSize() const;
 
 private:
-    std::vector<Frame> m_frames;
+    struct Delta
+    {
+        uint32_t x = 0;
+        uint32_t y = 0;
+        uint32_t width = 0;         // Empty if nothing changed. Key frames hold the whole image.
+        uint32_t height = 0;
+        std::vector<uint32_t> pixels;
+        uint32_t delay_us;
+        int orientation;            // Of key frames, the frames after them share it
+        bool key;
+    };
+
+    void Apply( const Delta& delta );
+    void Rebuild( const std::function<void( Bitmap&, size_t )>& fn );
+
+    std::vector<Delta> m_frames;
+    std::shared_ptr<Bitmap> m_last;
+
+    // Frame last rebuilt by GetFrame()
+    size_t m_canvasIdx;
+    std::shared_ptr<Bitmap> m_canvas;
 };
@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include "BitmapAnimStream.hpp"
+#include "Logs.hpp"
+
+BitmapAnimStream::BitmapAnimStream( std::unique_ptr<Source> source, uint32_t width, uint32_t height, size_t frameCount, TaskDispatch* td, size_t window )
+    : m_source( std::move( source ) )
+    , m_width( width )
+    , m_height( height )
+    , m_frameCount( frameCount )
+    , m_td( td )
+    , m_window( std::max<size_t>( window, 1 ) )
+    , m_busy( false )
+    , m_exit( false )
+{
+    std::lock_guard lock( m_lock );
+    Prefetch();
+}
+
+BitmapAnimStream::~BitmapAnimStream()
+{
+    {
+        std::lock_guard lock( m_lock );
+        m_exit = true;
+    }
+    m_group.Wait();
+}
+
+BitmapAnim::Frame BitmapAnimStream::Next()
+{
+    ZoneScoped;
+
+    BitmapAnim::Frame frame = {};
+    if( !m_td )
+    {
+        Decode( frame );
+        return frame;
+    }
+
+    std::unique_lock lock( m_lock );
+    m_cv.wait( lock, [this]{ return !m_frames.empty(); } );
+    frame = std::move( m_frames.front() );
+    m_frames.pop_front();
+    Prefetch();
+    return frame;
+}
+
+bool BitmapAnimStream::TryNext( BitmapAnim::Frame& frame )
+{
+    if( !m_td )
+    {
+        frame = Next();
+        return true;
+    }
+
+    std::lock_guard lock( m_lock );
+    if( m_frames.empty() ) return false;
+    frame = std::move( m_frames.front() );
+    m_frames.pop_front();
+    Prefetch();
+    return true;
+}
+
+void BitmapAnimStream::Decode( BitmapAnim::Frame& frame )
+{
+    ZoneScoped;
+
+    if( m_source->Next( frame ) ) return;
+    m_source->Rewind();
+    if( m_source->Next( frame ) ) return;
+
+    mclog( LogLevel::Error, "Failed to decode animation frame" );
+    frame = {};
+}
+
+// Must be called with m_lock held.
+void BitmapAnimStream::Prefetch()
+{
+    if( !m_td || m_busy || m_exit || m_frames.size() >= m_window ) return;
+
+    m_busy = true;
+    m_td->Queue( m_group, [this] {
+        BitmapAnim::Frame frame = {};
+        Decode( frame );
+
+        std::lock_guard lock( m_lock );
+        m_frames.emplace_back( std::move( frame ) );
+        m_busy = false;
+        m_cv.notify_one();
+        Prefetch();
+    } );
+}
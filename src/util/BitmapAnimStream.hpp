@@ -0,0 +1,65 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+
+#include "BitmapAnim.hpp"
+#include "NoCopy.hpp"
+#include "TaskDispatch.hpp"
+
+// Animation decoded while it plays, a few frames ahead of the consumer, instead of all frames up front. Frames
+// are released as soon as the consumer drops them.
+class BitmapAnimStream
+{
+public:
+    // Decodes frames in file order. Calls are never concurrent, but may come from any thread.
+    class Source
+    {
+    public:
+        virtual ~Source() = default;
+
+        // Returns false past the last frame. Decoding then restarts at the first frame after Rewind().
+        [[nodiscard]] virtual bool Next( BitmapAnim::Frame& frame ) = 0;
+        virtual void Rewind() = 0;
+    };
+
+    // Frames are decoded on td, if set, keeping up to window of them ready. Otherwise they are decoded in Next().
+    BitmapAnimStream( std::unique_ptr<Source> source, uint32_t width, uint32_t height, size_t frameCount, TaskDispatch* td = nullptr, size_t window = 4 );
+    ~BitmapAnimStream();
+
+    NoCopy( BitmapAnimStream );
+
+    [[nodiscard]] uint32_t Width() const { return m_width; }
+    [[nodiscard]] uint32_t Height() const { return m_height; }
+    [[nodiscard]] size_t FrameCount() const { return m_frameCount; }
+
+    // Returns the next frame in playback order, starting over after the last one. The bitmap is null if the
+    // frame can't be decoded.
+    [[nodiscard]] BitmapAnim::Frame Next();
+    // Same, but returns false instead of waiting while the frame is still being decoded on td
+    [[nodiscard]] bool TryNext( BitmapAnim::Frame& frame );
+
+private:
+    void Decode( BitmapAnim::Frame& frame );
+    void Prefetch();
+
+    std::unique_ptr<Source> m_source;
+    uint32_t m_width;
+    uint32_t m_height;
+    size_t m_frameCount;
+
+    TaskDispatch* m_td;
+    size_t m_window;
+
+    // Guarded by m_lock. At most one decode job is in flight, which keeps the source calls serialized.
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+    std::deque<BitmapAnim::Frame> m_frames;
+    bool m_busy;
+    bool m_exit;
+
+    TaskGroup m_group;
+};
@@ -0,0 +1,254 @@
+#include <algorithm>
+#include <limits>
+#include <stdlib.h>
+#include <string.h>
+
+#include "Bitmap.hpp"
+#include "BitmapCompressed.hpp"
+#include "Panic.hpp"
+#include "PixelPool.hpp"
+#include "TaskDispatch.hpp"
+
+static inline uint16_t To565( const uint8_t* c )
+{
+    return ( ( c[0] >> 3 ) << 11 ) | ( ( c[1] >> 2 ) << 5 ) | ( c[2] >> 3 );
+}
+
+static inline void From565( uint16_t v, int* c )
+{
+    const int r = v >> 11;
+    const int g = ( v >> 5 ) & 0x3F;
+    const int b = v & 0x1F;
+    c[0] = ( r << 3 ) | ( r >> 2 );
+    c[1] = ( g << 2 ) | ( g >> 4 );
+    c[2] = ( b << 3 ) | ( b >> 2 );
+}
+
+// Input is 16 RGBA pixels. Always produces a four color block.
+static void EncodeColor( const uint8_t* px, uint8_t* dst )
+{
+    uint8_t mn[3] = { 255, 255, 255 };
+    uint8_t mx[3] = { 0, 0, 0 };
+    for( int i=0; i<16; i++ )
+    {
+        for( int c=0; c<3; c++ )
+        {
+            mn[c] = std::min( mn[c], px[i*4+c] );
+            mx[c] = std::max( mx[c], px[i*4+c] );
+        }
+    }
+
+    // Pull the endpoints in a bit, so that the interpolated colors cover the range better
+    for( int c=0; c<3; c++ )
+    {
+        const uint8_t inset = ( mx[c] - mn[c] ) >> 4;
+        mn[c] += inset;
+        mx[c] -= inset;
+    }
+
+    // Componentwise max >= min, so c0 >= c1. Equal endpoints leave all indices at zero.
+    const uint16_t c0 = To565( mx );
+    const uint16_t c1 = To565( mn );
+    uint32_t indices = 0;
+    if( c0 != c1 )
+    {
+        int palette[4][3];
+        From565( c0, palette[0] );
+        From565( c1, palette[1] );
+        for( int c=0; c<3; c++ )
+        {
+            palette[2][c] = ( 2 * palette[0][c] + palette[1][c] ) / 3;
+            palette[3][c] = ( palette[0][c] + 2 * palette[1][c] ) / 3;
+        }
+
+        for( int i=0; i<16; i++ )
+        {
+            uint32_t best = 0;
+            int bestDist = std::numeric_limits<int>::max();
+            for( uint32_t j=0; j<4; j++ )
+            {
+                int dist = 0;
+                for( int c=0; c<3; c++ )
+                {
+                    const int d = px[i*4+c] - palette[j][c];
+                    dist += d * d;
+                }
+                if( dist < bestDist )
+                {
+                    bestDist = dist;
+                    best = j;
+                }
+            }
+            indices |= best << ( i * 2 );
+        }
+    }
+
+    dst[0] = c0 & 0xFF;
+    dst[1] = c0 >> 8;
+    dst[2] = c1 & 0xFF;
+    dst[3] = c1 >> 8;
+    memcpy( dst + 4, &indices, 4 );
+}
+
+// Input is 16 RGBA pixels. Produces an eight value block.
+static void EncodeAlpha( const uint8_t* px, uint8_t* dst )
+{
+    uint8_t mn = 255;
+    uint8_t mx = 0;
+    for( int i=0; i<16; i++ )
+    {
+        mn = std::min( mn, px[i*4+3] );
+        mx = std::max( mx, px[i*4+3] );
+    }
+
+    uint64_t indices = 0;
+    if( mx != mn )
+    {
+        int palette[8] = { mx, mn };
+        for( int j=2; j<8; j++ ) palette[j] = ( ( 8 - j ) * mx + ( j - 1 ) * mn ) / 7;
+
+        for( int i=0; i<16; i++ )
+        {
+            uint64_t best = 0;
+            int bestDist = std::numeric_limits<int>::max();
+            for( uint64_t j=0; j<8; j++ )
+            {
+                const int dist = std::abs( px[i*4+3] - palette[j] );
+                if( dist < bestDist )
+                {
+                    bestDist = dist;
+                    best = j;
+                }
+            }
+            indices |= best << ( i * 3 );
+        }
+    }
+
+    dst[0] = mx;
+    dst[1] = mn;
+    for( int i=0; i<6; i++ ) dst[2+i] = ( indices >> ( i * 8 ) ) & 0xFF;
+}
+
+static void EncodeLevel( const uint8_t* src, uint32_t width, uint32_t height, uint8_t* dst, BitmapCompressed::Format format, TaskDispatch* td )
+{
+    const auto bw = ( width + 3 ) / 4;
+    const auto bh = ( height + 3 ) / 4;
+    const auto blockSize = BitmapCompressed::BlockSize( format );
+
+    auto rows = [=]( size_t begin, size_t end ) {
+        uint8_t px[16*4];
+        for( size_t by=begin; by<end; by++ )
+        {
+            auto out = dst + by * bw * blockSize;
+            for( uint32_t bx=0; bx<bw; bx++ )
+            {
+                // Blocks over the edge repeat the last row and column
+                for( uint32_t y=0; y<4; y++ )
+                {
+                    const auto sy = std::min<uint32_t>( by * 4 + y, height - 1 );
+                    for( uint32_t x=0; x<4; x++ )
+                    {
+                        const auto sx = std::min<uint32_t>( bx * 4 + x, width - 1 );
+                        memcpy( px + ( y * 4 + x ) * 4, src + ( size_t( sy ) * width + sx ) * 4, 4 );
+                    }
+                }
+                if( format == BitmapCompressed::Format::Bc3 )
+                {
+                    EncodeAlpha( px, out );
+                    EncodeColor( px, out + 8 );
+                }
+                else
+                {
+                    EncodeColor( px, out );
+                }
+                out += blockSize;
+            }
+        }
+    };
+
+    if( td )
+    {
+        td->ParallelFor( 0, bh, TaskDispatch::AdaptiveGrain, rows );
+    }
+    else
+    {
+        rows( 0, bh );
+    }
+}
+
+BitmapCompressed::BitmapCompressed( Format format, uint32_t width, uint32_t height, uint32_t levels )
+    : m_format( format )
+    , m_width( width )
+    , m_height( height )
+    , m_size( 0 )
+{
+    CheckPanic( levels > 0, "No mip levels" );
+    const auto blockSize = BlockSize( format );
+
+    m_levels.reserve( std::min( levels, 32u ) );
+    for( uint32_t i=0; i<levels; i++ )
+    {
+        const auto size = size_t( ( width + 3 ) / 4 ) * ( ( height + 3 ) / 4 ) * blockSize;
+        m_levels.emplace_back( width, height, m_size, size );
+        m_size += size;
+        if( width == 1 && height == 1 ) break;
+        width = std::max( 1u, width / 2 );
+        height = std::max( 1u, height / 2 );
+    }
+
+    m_data = PixelAlloc<uint8_t>( m_size );
+}
+
+BitmapCompressed::~BitmapCompressed()
+{
+    PixelFree( m_data, m_size );
+}
+
+std::unique_ptr<BitmapCompressed> BitmapCompressed::Encode( const Bitmap& bitmap, Format format, bool mips, TaskDispatch* td )
+{
+    CheckPanic( format == Format::Bc1 || format == Format::Bc3, "Unsupported encode format" );
+
+    auto ret = std::make_unique<BitmapCompressed>( format, bitmap.Width(), bitmap.Height(), mips ? std::numeric_limits<uint32_t>::max() : 1 );
+    const auto& levels = ret->Levels();
+    EncodeLevel( bitmap.Data(), bitmap.Width(), bitmap.Height(), ret->Data(), format, td );
+    if( levels.size() == 1 ) return ret;
+
+    // Each level is resampled from the previous one. Two buffers are enough, sized for the first downscaled level.
+    const auto tmpSize = size_t( levels[1].width ) * levels[1].height * 4;
+    auto tmp0 = PixelAlloc<uint8_t>( tmpSize );
+    auto tmp1 = PixelAlloc<uint8_t>( tmpSize );
+
+    const uint8_t* src = bitmap.Data();
+    uint32_t srcWidth = bitmap.Width();
+    uint32_t srcHeight = bitmap.Height();
+    for( size_t i=1; i<levels.size(); i++ )
+    {
+        const auto& level = levels[i];
+        Bitmap::Resample( src, srcWidth, srcHeight, tmp0, level.width, level.height, td );
+        EncodeLevel( tmp0, level.width, level.height, ret->Data() + level.offset, format, td );
+        src = tmp0;
+        srcWidth = level.width;
+        srcHeight = level.height;
+        std::swap( tmp0, tmp1 );
+    }
+
+    PixelFree( tmp0, tmpSize );
+    PixelFree( tmp1, tmpSize );
+    return ret;
+}
+
+size_t BitmapCompressed::BlockSize( Format format )
+{
+    switch( format )
+    {
+    case Format::Bc1:
+    case Format::Etc2Rgb:
+        return 8;
+    case Format::Bc3:
+    case Format::Bc7:
+    case Format::Etc2Rgba:
+        return 16;
+    default:
+        Panic( "Invalid compressed format" );
+    }
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "NoCopy.hpp"
+
+class Bitmap;
+class TaskDispatch;
+
+// Block compressed image data, kept as stored in the file, so that it can be uploaded to the GPU without
+// decoding. Mip levels are stored consecutively, largest first.
+class BitmapCompressed
+{
+public:
+    enum class Format
+    {
+        None,
+        Bc1,        // sRGB
+        Bc3,        // sRGB
+        Bc7,        // sRGB
+        Etc2Rgb,    // sRGB, also covers ETC1
+        Etc2Rgba,   // sRGB
+    };
+
+    struct Level
+    {
+        uint32_t width;
+        uint32_t height;
+        size_t offset;
+        size_t size;
+    };
+
+    BitmapCompressed( Format format, uint32_t width, uint32_t height, uint32_t levels );
+    ~BitmapCompressed();
+
+    NoCopy( BitmapCompressed );
+
+    // Compresses the bitmap, trading quality for a quarter (Bc3) or an eighth (Bc1) of the memory. Endpoints are
+    // taken from the bounding box of each block, which is fast, but visibly worse than what an offline encoder does.
+    // Only Bc1 and Bc3 can be encoded. Bc1 has no alpha.
+    [[nodiscard]] static std::unique_ptr<BitmapCompressed> Encode( const Bitmap& bitmap, Format format, bool mips, TaskDispatch* td = nullptr );
+
+    [[nodiscard]] static size_t BlockSize( Format format );
+
+    [[nodiscard]] Format GetFormat() const { return m_format; }
+    [[nodiscard]] uint32_t Width() const { return m_width; }
+    [[nodiscard]] uint32_t Height() const { return m_height; }
+    [[nodiscard]] const std::vector<Level>& Levels() const { return m_levels; }
+    [[nodiscard]] size_t Size() const { return m_size; }
+    [[nodiscard]] uint8_t* Data() { return m_data; }
+    [[nodiscard]] const uint8_t* Data() const { return m_data; }
+
+private:
+    Format m_format;
+    uint32_t m_width;
+    uint32_t m_height;
+    std::vector<Level> m_levels;
+    size_t m_size;
+    uint8_t* m_data;
+};
@@ -0,0 +1,118 @@
+#include <algorithm>
+#include <math.h>
+#include <numbers>
+#include <tracy/Tracy.hpp>
+
+#include "BitmapDct.hpp"
+#include "PixelPool.hpp"
+#include "TaskDispatch.hpp"
+
+namespace
+{
+// Basis of the 8 point inverse DCT, with the 1/2 C(u) normalization folded in
+struct IdctBasis
+{
+    IdctBasis()
+    {
+        for( int x=0; x<8; x++ )
+        {
+            for( int u=0; u<8; u++ )
+            {
+                const auto cu = u == 0 ? std::numbers::sqrt2_v<float> / 2 : 1.f;
+                c[x][u] = cu / 2 * cosf( ( 2 * x + 1 ) * u * std::numbers::pi_v<float> / 16 );
+            }
+        }
+    }
+
+    float c[8][8];
+};
+
+void Idct( const int16_t* coef, const uint16_t* quant, uint8_t* dst, size_t stride, uint32_t w, uint32_t h )
+{
+    static const IdctBasis basis;
+
+    float tmp[64];
+    for( int v=0; v<8; v++ )
+    {
+        for( int x=0; x<8; x++ )
+        {
+            float sum = 0;
+            for( int u=0; u<8; u++ ) sum += basis.c[x][u] * coef[v*8+u] * quant[v*8+u];
+            tmp[v*8+x] = sum;
+        }
+    }
+    for( uint32_t y=0; y<h; y++ )
+    {
+        for( uint32_t x=0; x<w; x++ )
+        {
+            float sum = 128.5f;
+            for( int v=0; v<8; v++ ) sum += basis.c[y][v] * tmp[v*8+x];
+            dst[y*stride+x] = uint8_t( std::clamp( sum, 0.f, 255.f ) );
+        }
+    }
+}
+}
+
+BitmapDct::BitmapDct( uint32_t width, uint32_t height, BitmapYuv::Subsampling subsampling )
+    : m_width( width )
+    , m_height( height )
+    , m_subsampling( subsampling )
+{
+    const uint32_t cw = ( width + 1 ) / 2;
+    const uint32_t ch = subsampling == BitmapYuv::Subsampling::S420 ? ( height + 1 ) / 2 : height;
+
+    size_t offset = QuantSize;
+    for( int c=0; c<3; c++ )
+    {
+        auto& comp = m_components[c];
+        comp.widthInBlocks = ( ( c == 0 ? width : cw ) + 7 ) / 8;
+        comp.heightInBlocks = ( ( c == 0 ? height : ch ) + 7 ) / 8;
+        comp.offset = offset;
+        offset += size_t( comp.widthInBlocks ) * comp.heightInBlocks * BlockSize;
+    }
+
+    m_size = offset * sizeof( int16_t );
+    m_data = (int16_t*)PixelAlloc( m_size );
+}
+
+BitmapDct::~BitmapDct()
+{
+    PixelFree( (void*)m_data, m_size );
+}
+
+std::unique_ptr<BitmapYuv> BitmapDct::ToYuv( TaskDispatch* td ) const
+{
+    ZoneScoped;
+
+    auto yuv = std::make_unique<BitmapYuv>( m_width, m_height, m_subsampling );
+    uint8_t* planes[3] = { yuv->Y(), yuv->Cb(), yuv->Cr() };
+    const uint32_t widths[3] = { yuv->Width(), yuv->ChromaWidth(), yuv->ChromaWidth() };
+    const uint32_t heights[3] = { yuv->Height(), yuv->ChromaHeight(), yuv->ChromaHeight() };
+
+    for( int c=0; c<3; c++ )
+    {
+        const auto& comp = m_components[c];
+        auto rows = [&, c]( size_t begin, size_t end ) {
+            for( size_t by=begin; by<end; by++ )
+            {
+                const auto y = uint32_t( by * 8 );
+                const auto h = std::min( 8u, heights[c] - y );
+                for( uint32_t bx=0; bx<comp.widthInBlocks; bx++ )
+                {
+                    const auto x = bx * 8;
+                    Idct( Block( c, bx, uint32_t( by ) ), Quant( c ), planes[c] + size_t( y ) * widths[c] + x, widths[c], std::min( 8u, widths[c] - x ), h );
+                }
+            }
+        };
+
+        if( td )
+        {
+            td->ParallelFor( 0, comp.heightInBlocks, TaskDispatch::AdaptiveGrain, rows );
+        }
+        else
+        {
+            rows( 0, comp.heightInBlocks );
+        }
+    }
+    return yuv;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "BitmapYuv.hpp"
+#include "NoCopy.hpp"
+
+class TaskDispatch;
+
+// Quantized DCT coefficients of a YCbCr JPEG image, as left by entropy decoding. The three quantization tables
+// come first, followed by the 8x8 blocks of each component, in row major order. Tables and blocks are in natural
+// order, not zigzag. Blocks cover the planes of a BitmapYuv of the same size, padded to whole blocks.
+class BitmapDct
+{
+public:
+    struct Component
+    {
+        uint32_t widthInBlocks;
+        uint32_t heightInBlocks;
+        size_t offset;      // Of the first block, in coefficients from the start of the data
+    };
+
+    static constexpr size_t BlockSize = 64;
+    static constexpr size_t QuantSize = 3 * BlockSize;
+
+    BitmapDct( uint32_t width, uint32_t height, BitmapYuv::Subsampling subsampling );
+    ~BitmapDct();
+
+    NoCopy( BitmapDct );
+
+    // Dequantizes, runs the inverse DCT and crops the result to the plane sizes
+    [[nodiscard]] std::unique_ptr<BitmapYuv> ToYuv( TaskDispatch* td = nullptr ) const;
+
+    [[nodiscard]] uint32_t Width() const { return m_width; }
+    [[nodiscard]] uint32_t Height() const { return m_height; }
+    [[nodiscard]] BitmapYuv::Subsampling GetSubsampling() const { return m_subsampling; }
+    [[nodiscard]] const Component& GetComponent( int c ) const { return m_components[c]; }
+
+    [[nodiscard]] uint16_t* Quant( int c ) { return (uint16_t*)m_data + c * BlockSize; }
+    [[nodiscard]] const uint16_t* Quant( int c ) const { return (const uint16_t*)m_data + c * BlockSize; }
+    [[nodiscard]] int16_t* Block( int c, uint32_t x, uint32_t y ) { return m_data + BlockOffset( c, x, y ); }
+    [[nodiscard]] const int16_t* Block( int c, uint32_t x, uint32_t y ) const { return m_data + BlockOffset( c, x, y ); }
+
+    [[nodiscard]] size_t Size() const { return m_size; }   // In bytes
+    [[nodiscard]] const void* Data() const { return m_data; }
+
+private:
+    [[nodiscard]] size_t BlockOffset( int c, uint32_t x, uint32_t y ) const { return m_components[c].offset + ( size_t( y ) * m_components[c].widthInBlocks + x ) * BlockSize; }
+
+    uint32_t m_width;
+    uint32_t m_height;
+    BitmapYuv::Subsampling m_subsampling;
+    Component m_components[3];
+    size_t m_size;
+    int16_t* m_data;
+};
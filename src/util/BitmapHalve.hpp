@@ -0,0 +1,45 @@
+#pragma once
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Panic.hpp"
+#include "TaskDispatch.hpp"
+
+// True if width x height is what a 2x2 box filter makes of srcWidth x srcHeight. The source width must be even,
+// and the height even or 1, which the filter then keeps. Odd dimensions would drop the last source column or row.
+inline bool IsHalving( uint32_t srcWidth, uint32_t srcHeight, uint32_t width, uint32_t height )
+{
+    return width * 2 == srcWidth && ( height * 2 == srcHeight || ( srcHeight == 1 && height == 1 ) );
+}
+
+// Reduces pairs of source rows of RGBA pixels, with four T values each, to destination rows half as wide. The
+// reduce function is called as reduce( row0, row1, dst, width ). Rows are split between workers if td is set.
+template<typename T, typename F>
+void HalveImage( const T* src, uint32_t srcWidth, uint32_t srcHeight, T* dst, TaskDispatch* td, F&& reduce )
+{
+    CheckPanic( IsHalving( srcWidth, srcHeight, srcWidth / 2, std::max( 1u, srcHeight / 2 ) ), "Image size %ux%u can't be halved", srcWidth, srcHeight );
+
+    const auto width = srcWidth / 2;
+    const auto height = std::max( 1u, srcHeight / 2 );
+    const auto stride = size_t( srcWidth ) * 4;
+
+    auto fn = [&]( size_t begin, size_t end ) {
+        for( size_t y=begin; y<end; y++ )
+        {
+            auto row0 = src + y * 2 * stride;
+            auto row1 = srcHeight == 1 ? row0 : row0 + stride;
+            reduce( row0, row1, dst + y * width * 4, width );
+        }
+    };
+
+    if( td && height > 1 )
+    {
+        td->ParallelFor( 0, height, TaskDispatch::AdaptiveGrain, fn );
+    }
+    else
+    {
+        fn( 0, height );
+    }
+}
@@ -3,27 +3,55 @@
 #include <stb_image_resize2.h>
 #include <string.h>
 #include <tracy/Tracy.hpp>
+#include <utility>
 
-#if defined __F16C__
+#if defined __SSE2__
 #  include <x86intrin.h>
+#elif defined __ARM_NEON
+#  include <arm_neon.h>
 #endif
 
 #include "contrib/half.hpp"
 
 #include "Bitmap.hpp"
+#include "BitmapHalve.hpp"
 #include "BitmapHdr.hpp"
 #include "BitmapHdrHalf.hpp"
+#include "BitmapOps.hpp"
+#include "BitmapRotate.hpp"
+#include "ColorMatrix.hpp"
 #include "Logs.hpp"
 #include "Panic.hpp"
+#include "PixelPool.hpp"
 #include "Simd.hpp"
+#include "SimdDispatch.hpp"
 #include "TaskDispatch.hpp"
 
-static void HalfToFloat( const half_float::half* src, float* dst, size_t sz )
+namespace
 {
-    ZoneScoped;
+// Rotations move whole RGBA pixels
+struct Pixel
+{
+    float v[4];
+};
+}
 
-#ifdef __F16C__
-  #ifdef __AVX512F__
+#if defined MCORE_SIMD_X86
+SIMD_AVX2 static void HalfToFloatAvx2( const half_float::half*& src, float*& dst, size_t& sz )
+{
+    while( sz >= 8 )
+    {
+        __m128i h = _mm_loadu_si128( (__m128i*)src );
+        __m256 f = _mm256_cvtph_ps( h );
+        _mm256_storeu_ps( dst, f );
+        src += 8;
+        dst += 8;
+        sz -= 8;
+    }
+}
+
+SIMD_AVX512 static void HalfToFloatAvx512( const half_float::half*& src, float*& dst, size_t& sz )
+{
     while( sz >= 16 )
     {
         __m256i h = _mm256_loadu_si256( (__m256i*)src );
@@ -33,18 +61,32 @@ static void HalfToFloat( const half_float::half* src, float* dst, size_t sz )
         dst += 16;
         sz -= 16;
     }
-  #endif
-  #ifdef __AVX2__
-    while( sz >= 8 )
+    HalfToFloatAvx2( src, dst, sz );
+}
+#endif
+
+static void HalfToFloat( const half_float::half* src, float* dst, size_t sz )
+{
+    ZoneScoped;
+
+#if defined MCORE_SIMD_X86
+    switch( GetSimdLevel() )
     {
-        __m128i h = _mm_loadu_si128( (__m128i*)src );
-        __m256 f = _mm256_cvtph_ps( h );
-        _mm256_storeu_ps( dst, f );
-        src += 8;
-        dst += 8;
-        sz -= 8;
+    case SimdLevel::Avx512: HalfToFloatAvx512( src, dst, sz ); break;
+    case SimdLevel::Avx2: HalfToFloatAvx2( src, dst, sz ); break;
+    default: break;
+    }
+#elif defined __ARM_NEON
+    if( GetSimdLevel() == SimdLevel::Neon )
+    {
+        while( sz >= 4 )
+        {
+            vst1q_f32( dst, vcvt_f32_f16( vreinterpret_f16_u16( vld1_u16( (const uint16_t*)src ) ) ) );
+            src += 4;
+            dst += 4;
+            sz -= 4;
+        }
     }
-  #endif
 #endif
 
     while( sz-- > 0 )
@@ -56,8 +98,9 @@ static void HalfToFloat( const half_float::half* src, float* dst, size_t sz )
 BitmapHdr::BitmapHdr( const BitmapHdrHalf& bmp )
     : m_width( bmp.Width() )
     , m_height( bmp.Height() )
-    , m_data( new float[m_width*m_height*4] )
+    , m_data( PixelAlloc<float>( size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdr ) )
     , m_colorspace( bmp.GetColorspace() )
+    , m_orientation( bmp.Orientation() )
 {
     auto src = bmp.Data();
     auto dst = m_data;
@@ -69,41 +112,88 @@ BitmapHdr::BitmapHdr( const BitmapHdrHalf& bmp )
 BitmapHdr::BitmapHdr( uint32_t width, uint32_t height, Colorspace colorspace, int orientation )
     : m_width( width )
     , m_height( height )
-    , m_data( new float[width*height*4] )
+    , m_data( PixelAlloc<float>( size_t( width ) * height * 4, MemoryStats::Pool::BitmapHdr ) )
     , m_colorspace( colorspace )
     , m_orientation( orientation )
 {
 }
 
+BitmapHdr::BitmapHdr( const BitmapHdrView& view, Colorspace colorspace, TaskDispatch* td )
+    : BitmapHdr( view.width, view.height, colorspace )
+{
+    BitmapOps::CopyRows( (const Pixel*)view.data, view.stride, (Pixel*)m_data, view.width, view.height, td );
+}
+
 BitmapHdr::~BitmapHdr()
 {
-    delete[] m_data;
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdr );
 }
 
-void BitmapHdr::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
+void BitmapHdr::Resample( const float* src, uint32_t srcWidth, uint32_t srcHeight, float* dst, uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    Resample( BitmapHdrView { src, srcWidth, srcHeight, srcWidth }, dst, width, height, td );
+}
+
+void BitmapHdr::Resample( const BitmapHdrView& src, float* dst, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    auto newData = new float[width*height*4];
     STBIR_RESIZE resize;
-    stbir_resize_init( &resize, m_data, m_width, m_height, 0, newData, width, height, 0, STBIR_RGBA, STBIR_TYPE_FLOAT );
+    stbir_resize_init( &resize, src.data, src.width, src.height, int( src.stride * 4 * sizeof( float ) ), dst, width, height, 0, STBIR_RGBA, STBIR_TYPE_FLOAT );
     stbir_set_non_pm_alpha_speed_over_quality( &resize, 1 );
     if( td )
     {
-        auto threads = td->NumWorkers() + 1;
-        threads = stbir_build_samplers_with_splits( &resize, threads );
-        for( size_t i=0; i<threads; i++ )
-        {
-            td->Queue( [i, &resize, threads] {
-                stbir_resize_extended_split( &resize, i, 1 );
-            } );
-        }
-        td->Sync();
+        const auto splits = stbir_build_samplers_with_splits( &resize, td->NumWorkers() + 1 );
+        td->ParallelFor( 0, splits, 1, [&resize]( size_t begin, size_t end ) {
+            stbir_resize_extended_split( &resize, begin, end - begin );
+        } );
         stbir_free_samplers( &resize );
     }
     else
     {
         stbir_resize_extended( &resize );
     }
-    delete[] m_data;
+}
+
+void BitmapHdr::Halve( const float* src, uint32_t srcWidth, uint32_t srcHeight, float* dst, TaskDispatch* td )
+{
+    HalveImage( src, srcWidth, srcHeight, dst, td, []( const float* src0, const float* src1, float* dst, uint32_t width ) {
+        uint32_t x = 0;
+#ifdef __AVX512F__
+        for( ; x + 2 <= width; x += 2 )
+        {
+            const auto v = _mm512_add_ps( _mm512_loadu_ps( src0 ), _mm512_loadu_ps( src1 ) );
+            const auto even = _mm512_shuffle_f32x4( v, v, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+            const auto odd = _mm512_shuffle_f32x4( v, v, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+            _mm256_storeu_ps( dst, _mm512_castps512_ps256( _mm512_mul_ps( _mm512_add_ps( even, odd ), _mm512_set1_ps( 0.25f ) ) ) );
+            src0 += 16;
+            src1 += 16;
+            dst += 8;
+        }
+#endif
+        for( ; x < width; x++ )
+        {
+#ifdef __AVX__
+            const auto v = _mm256_add_ps( _mm256_loadu_ps( src0 ), _mm256_loadu_ps( src1 ) );
+            const auto sum = _mm_add_ps( _mm256_castps256_ps128( v ), _mm256_extractf128_ps( v, 1 ) );
+            _mm_storeu_ps( dst, _mm_mul_ps( sum, _mm_set1_ps( 0.25f ) ) );
+#elif defined __SSE2__
+            const auto v0 = _mm_add_ps( _mm_loadu_ps( src0 ), _mm_loadu_ps( src0 + 4 ) );
+            const auto v1 = _mm_add_ps( _mm_loadu_ps( src1 ), _mm_loadu_ps( src1 + 4 ) );
+            _mm_storeu_ps( dst, _mm_mul_ps( _mm_add_ps( v0, v1 ), _mm_set1_ps( 0.25f ) ) );
+#else
+            for( int i=0; i<4; i++ ) dst[i] = ( src0[i] + src0[i+4] + src1[i] + src1[i+4] ) * 0.25f;
+#endif
+            src0 += 8;
+            src1 += 8;
+            dst += 4;
+        }
+    } );
+}
+
+void BitmapHdr::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    auto newData = PixelAlloc<float>( size_t( width ) * height * 4, MemoryStats::Pool::BitmapHdr );
+    Resample( m_data, m_width, m_height, newData, width, height, td );
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdr );
     m_data = newData;
     m_width = width;
     m_height = height;
@@ -112,54 +202,29 @@ void BitmapHdr::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
 std::unique_ptr<BitmapHdr> BitmapHdr::ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td ) const
 {
     auto ret = std::make_unique<BitmapHdr>( width, height, m_colorspace );
-    STBIR_RESIZE resize;
-    stbir_resize_init( &resize, m_data, m_width, m_height, 0, ret->m_data, width, height, 0, STBIR_RGBA, STBIR_TYPE_FLOAT );
-    stbir_set_non_pm_alpha_speed_over_quality( &resize, 1 );
-    if( td )
-    {
-        auto threads = td->NumWorkers() + 1;
-        threads = stbir_build_samplers_with_splits( &resize, threads );
-        for( size_t i=0; i<threads; i++ )
-        {
-            td->Queue( [i, &resize, threads] {
-                stbir_resize_extended_split( &resize, i, 1 );
-            } );
-        }
-        td->Sync();
-        stbir_free_samplers( &resize );
-    }
-    else
-    {
-        stbir_resize_extended( &resize );
-    }
+    Resample( m_data, m_width, m_height, ret->m_data, width, height, td );
     return ret;
 }
 
-void BitmapHdr::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
+std::unique_ptr<BitmapHdr> BitmapHdr::ResizeNew( const BitmapHdrView& src, Colorspace colorspace, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid crop" );
-
-    auto data = new float[width*height*4];
-    auto dst = data;
-    auto src = m_data + ( y * m_width + x ) * 4;
+    auto ret = std::make_unique<BitmapHdr>( width, height, colorspace );
+    Resample( src, ret->m_data, width, height, td );
+    return ret;
+}
 
-    for( uint32_t i=0; i<height; i++ )
-    {
-        memcpy( dst, src, width * 4 * sizeof( float ) );
-        src += m_width * 4;
-        dst += width * 4;
-    }
+void BitmapHdr::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid crop" );
 
-    delete[] m_data;
-    m_data = data;
-    m_width = width;
-    m_height = height;
+    BitmapHdr cropped( View( x, y, width, height ), m_colorspace, td );
+    std::swap( m_data, cropped.m_data );
+    std::swap( m_width, cropped.m_width );
+    std::swap( m_height, cropped.m_height );
 }
 
-void BitmapHdr::SetAlpha( float alpha )
+static void SetAlphaPixels( float* ptr, size_t sz, float alpha )
 {
-    auto ptr = m_data;
-    size_t sz = m_width * m_height;
 
 #ifdef __AVX512F__
     while( sz >= 4 )
@@ -191,34 +256,41 @@ void BitmapHdr::SetAlpha( float alpha )
     }
 }
 
-void BitmapHdr::NormalizeOrientation()
+void BitmapHdr::SetAlpha( float alpha, TaskDispatch* td )
+{
+    BitmapOps::ForRange( td, size_t( m_width ) * m_height, [this, alpha]( size_t begin, size_t end ) {
+        SetAlphaPixels( m_data + begin * 4, end - begin, alpha );
+    } );
+}
+
+void BitmapHdr::NormalizeOrientation( TaskDispatch* td )
 {
     if( m_orientation <= 1 ) return;
 
     switch( m_orientation )
     {
     case 2:
-        FlipHorizontal();
+        FlipHorizontal( td );
         break;
     case 3:
-        Rotate180();
+        Rotate180( td );
         break;
     case 4:
-        FlipVertical();
+        FlipVertical( td );
         break;
     case 5:
-        Rotate270();
-        FlipVertical();
+        Rotate270( td );
+        FlipVertical( td );
         break;
     case 6:
-        Rotate90();
+        Rotate90( td );
         break;
     case 7:
-        Rotate90();
-        FlipVertical();
+        Rotate90( td );
+        FlipVertical( td );
         break;
     case 8:
-        Rotate270();
+        Rotate270( td );
         break;
     default:
         Panic( "Invalid orientation value!" );
@@ -235,20 +307,19 @@ void BitmapHdr::SetColorspace( Colorspace colorspace, TaskDispatch* td )
         return;
     }
 
-    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-    cmsToneCurve* linear3[3] = { linear, linear, linear };
-
-    auto profile709 = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-    auto profile2020 = cmsCreateRGBProfile( &white709, &primaries2020, linear3 );
+    ZoneScoped;
 
-    cmsHTRANSFORM transform;
+    // Both colorspaces are linear and share the white point, so the conversion is just a change of primaries
+    ColorMatrix matrix;
     if( m_colorspace == Colorspace::BT2020 && colorspace == Colorspace::BT709 )
     {
-        transform = cmsCreateTransform( profile2020, TYPE_RGBA_FLT, profile709, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        static const auto m = MakeColorMatrix( primaries2020, primaries709 );
+        matrix = m;
     }
     else if( m_colorspace == Colorspace::BT709 && colorspace == Colorspace::BT2020 )
     {
-        transform = cmsCreateTransform( profile709, TYPE_RGBA_FLT, profile2020, TYPE_RGBA_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        static const auto m = MakeColorMatrix( primaries709, primaries2020 );
+        matrix = m;
     }
     else
     {
@@ -257,132 +328,65 @@ void BitmapHdr::SetColorspace( Colorspace colorspace, TaskDispatch* td )
 
     if( td )
     {
-        auto ptr = m_data;
-        auto sz = m_width * m_height;
-        while( sz > 0 )
-        {
-            auto chunk = std::min<uint32_t>( sz, 16 * 1024 );
-            td->Queue( [ptr, chunk, transform] {
-                cmsDoTransform( transform, ptr, ptr, chunk );
-            } );
-            ptr += chunk * 4;
-            sz -= chunk;
-        }
-        td->Sync();
+        td->ParallelFor( 0, m_width * m_height, TaskDispatch::AdaptiveGrain, [this, &matrix]( size_t begin, size_t end ) {
+            ApplyColorMatrix( matrix, m_data + begin * 4, end - begin );
+        } );
     }
     else
     {
-        cmsDoTransform( transform, m_data, m_data, m_width * m_height );
+        ApplyColorMatrix( matrix, m_data, m_width * m_height );
     }
 
-    cmsDeleteTransform( transform );
-    cmsCloseProfile( profile709 );
-    cmsCloseProfile( profile2020 );
-    cmsFreeToneCurve( linear );
-
     m_colorspace = colorspace;
 }
 
-void BitmapHdr::FlipVertical()
+void BitmapHdr::FlipVertical( TaskDispatch* td )
 {
-    auto ptr1 = m_data;
-    auto ptr2 = m_data + ( m_height - 1 ) * m_width * 4;
-    auto tmp = alloca( m_width * 4 * 4 );
-
-    for( uint32_t y=0; y<m_height/2; y++ )
-    {
-        memcpy( tmp, ptr1, m_width * 4 * 4 );
-        memcpy( ptr1, ptr2, m_width * 4 * 4 );
-        memcpy( ptr2, tmp, m_width * 4 * 4 );
-        ptr1 += m_width * 4;
-        ptr2 -= m_width * 4;
-    }
+    BitmapOps::FlipVertical( (Pixel*)m_data, m_width, m_height, td );
 }
 
-void BitmapHdr::FlipHorizontal()
+void BitmapHdr::FlipHorizontal( TaskDispatch* td )
 {
-    auto ptr = m_data;
-
-    for( uint32_t y=0; y<m_height; y++ )
-    {
-        auto ptr1 = ptr;
-        auto ptr2 = ptr + ( m_width - 1 ) * 4;
-
-        for( uint32_t x=0; x<m_width/2; x++ )
-        {
-            uint32_t tmp[4];
-            memcpy( tmp, ptr1, 4 * 4 );
-            memcpy( ptr1, ptr2, 4 * 4 );
-            memcpy( ptr2, tmp, 4 * 4 );
-            ptr1 += 4;
-            ptr2 -= 4;
-        }
-
-        ptr += m_width * 4;
-    }
+    BitmapOps::FlipHorizontal( (Pixel*)m_data, m_width, m_height, td );
 }
 
-void BitmapHdr::Rotate90()
+void BitmapHdr::Rotate90( TaskDispatch* td )
 {
-    auto tmp = new float[m_width * m_height * 4];
-
-    auto src = m_data;
-    auto dst = tmp;
+    ZoneScoped;
 
-    for( uint32_t y=0; y<m_height; y++ )
-    {
-        for( uint32_t x=0; x<m_width; x++ )
-        {
-            memcpy( dst + ( x * m_height + m_height - y - 1 ) * 4, src + ( y * m_width + x ) * 4, 4 * 4 );
-        }
-    }
+    auto tmp = PixelAlloc<float>( size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdr );
+    RotateImage<true>( (const Pixel*)m_data, (Pixel*)tmp, m_width, m_height, td );
 
-    delete[] m_data;
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdr );
     m_data = tmp;
     std::swap( m_width, m_height );
 }
 
-void BitmapHdr::Rotate180()
+void BitmapHdr::Rotate180( TaskDispatch* td )
 {
-    auto ptr1 = m_data;
-    auto ptr2 = m_data + ( m_width * m_height - 1 ) * 4;
-
-    for( uint32_t i=0; i<m_width * m_height / 2; i++ )
-    {
-        uint32_t tmp[4];
-        memcpy( tmp, ptr1, 4 * 4 );
-        memcpy( ptr1, ptr2, 4 * 4 );
-        memcpy( ptr2, tmp, 4 * 4 );
-        ptr1 += 4;
-        ptr2 -= 4;
-    }
+    BitmapOps::Rotate180( (Pixel*)m_data, m_width, m_height, td );
 }
 
-void BitmapHdr::Rotate270()
+void BitmapHdr::Rotate270( TaskDispatch* td )
 {
-    auto tmp = new float[m_width * m_height * 4];
-
-    auto src = m_data;
-    auto dst = tmp;
+    ZoneScoped;
 
-    for( uint32_t y=0; y<m_height; y++ )
-    {
-        for( uint32_t x=0; x<m_width; x++ )
-        {
-            memcpy( dst + ( ( m_width - x - 1 ) * m_height + y ) * 4, src + ( y * m_width + x ) * 4, 4 * 4 );
-        }
-    }
+    auto tmp = PixelAlloc<float>( size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdr );
+    RotateImage<false>( (const Pixel*)m_data, (Pixel*)tmp, m_width, m_height, td );
 
-    delete[] m_data;
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdr );
     m_data = tmp;
     std::swap( m_width, m_height );
 }
 
-std::unique_ptr<Bitmap> BitmapHdr::Tonemap( ToneMap::Operator op )
+std::unique_ptr<Bitmap> BitmapHdr::Tonemap( ToneMap::Operator op, TaskDispatch* td )
 {
     ZoneScoped;
     CheckPanic( m_colorspace == Colorspace::BT709, "Tone mapping requires BT.709 colorspace" );
     auto bmp = std::make_unique<Bitmap>( m_width, m_height );
-    ToneMap::Process( op, (uint32_t*)bmp->Data(), m_data, m_width * m_height );
+    auto dst = (uint32_t*)bmp->Data();
+    BitmapOps::ForRange( td, size_t( m_width ) * m_height, [this, op, dst]( size_t begin, size_t end ) {
+        ToneMap::Process( op, dst + begin, m_data + begin * 4, end - begin );
+    } );
     return bmp;
 }
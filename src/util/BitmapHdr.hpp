@@ -3,6 +3,7 @@
 #include <memory>
 #include <stdint.h>
 
+#include "BitmapView.hpp"
 #include "Colorspace.hpp"
 #include "NoCopy.hpp"
 #include "Tonemapper.hpp"
@@ -16,21 +17,29 @@ class BitmapHdr
 public:
     explicit BitmapHdr( const BitmapHdrHalf& bmp );
     BitmapHdr( uint32_t width, uint32_t height, Colorspace colorspace, int orientation = 0 );
+    // Copy of the viewed pixels
+    BitmapHdr( const BitmapHdrView& view, Colorspace colorspace, TaskDispatch* td = nullptr );
     ~BitmapHdr();
     NoCopy( BitmapHdr );
 
     void Resize( uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
     [[nodiscard]] std::unique_ptr<BitmapHdr> ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td = nullptr ) const;
-    void SetAlpha( float alpha );
-    void Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height );
-    void NormalizeOrientation();
+    [[nodiscard]] static std::unique_ptr<BitmapHdr> ResizeNew( const BitmapHdrView& src, Colorspace colorspace, uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
+    // Resizes tightly packed RGBA pixel data, e.g. from one mip level to the next one in place of a larger buffer.
+    static void Resample( const float* src, uint32_t srcWidth, uint32_t srcHeight, float* dst, uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
+    static void Resample( const BitmapHdrView& src, float* dst, uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
+    // Halves tightly packed RGBA pixel data with a 2x2 box filter. The source must be an exact halving, see IsHalving().
+    static void Halve( const float* src, uint32_t srcWidth, uint32_t srcHeight, float* dst, TaskDispatch* td = nullptr );
+    void SetAlpha( float alpha, TaskDispatch* td = nullptr );
+    void Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
+    void NormalizeOrientation( TaskDispatch* td = nullptr );
     void SetColorspace( Colorspace colorspace, TaskDispatch* td = nullptr );
 
-    void FlipVertical();
-    void FlipHorizontal();
-    void Rotate90();
-    void Rotate180();
-    void Rotate270();
+    void FlipVertical( TaskDispatch* td = nullptr );
+    void FlipHorizontal( TaskDispatch* td = nullptr );
+    void Rotate90( TaskDispatch* td = nullptr );
+    void Rotate180( TaskDispatch* td = nullptr );
+    void Rotate270( TaskDispatch* td = nullptr );
 
     [[nodiscard]] uint32_t Width() const { return m_width; }
     [[nodiscard]] uint32_t Height() const { return m_height; }
@@ -39,7 +48,10 @@ public:
     [[nodiscard]] int Orientation() const { return m_orientation; }
     [[nodiscard]] Colorspace GetColorspace() const { return m_colorspace; }
 
-    [[nodiscard]] std::unique_ptr<Bitmap> Tonemap( ToneMap::Operator op );
+    [[nodiscard]] BitmapHdrView View() const { return { m_data, m_width, m_height, m_width }; }
+    [[nodiscard]] BitmapHdrView View( uint32_t x, uint32_t y, uint32_t width, uint32_t height ) const { return View().Sub( x, y, width, height ); }
+
+    [[nodiscard]] std::unique_ptr<Bitmap> Tonemap( ToneMap::Operator op, TaskDispatch* td = nullptr );
 
 private:
     uint32_t m_width;
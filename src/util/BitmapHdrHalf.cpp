@@ -1,28 +1,58 @@
+#include <algorithm>
 #include <cmath>
 #include <ImfStdIO.h>
 #include <ImfRgbaFile.h>
-#include <lcms2.h>
 #include <stb_image_resize2.h>
+#include <string.h>
 #include <tracy/Tracy.hpp>
 
-#if defined __F16C__
+#include "SimdDispatch.hpp"
+
+#if defined MCORE_SIMD_X86
 #  include <x86intrin.h>
+#elif defined __ARM_NEON
+#  include <arm_neon.h>
 #endif
 
 #include "contrib/half.hpp"
 
+#include "BitmapHalve.hpp"
 #include "BitmapHdr.hpp"
 #include "BitmapHdrHalf.hpp"
+#include "BitmapOps.hpp"
+#include "BitmapRotate.hpp"
+#include "ColorMatrix.hpp"
+#include "ExrWriter.hpp"
 #include "Logs.hpp"
 #include "Panic.hpp"
+#include "PixelPool.hpp"
 #include "TaskDispatch.hpp"
 
-static void FloatToHalf( const float* src, half_float::half* dst, size_t sz )
+namespace
 {
-    ZoneScoped;
+// Rotations move whole RGBA pixels
+struct Pixel
+{
+    uint16_t v[4];
+};
+}
 
-#ifdef __F16C__
-  #ifdef __AVX512F__
+#if defined MCORE_SIMD_X86
+SIMD_AVX2 static void FloatToHalfAvx2( const float*& src, half_float::half*& dst, size_t& sz )
+{
+    while( sz >= 8 )
+    {
+        __m256 f = _mm256_loadu_ps( src );
+        __m128i h = _mm256_cvtps_ph( f, _MM_FROUND_TO_NEAREST_INT );
+        _mm_storeu_si128( (__m128i*)dst, h );
+        src += 8;
+        dst += 8;
+        sz -= 8;
+    }
+}
+
+SIMD_AVX512 static void FloatToHalfAvx512( const float*& src, half_float::half*& dst, size_t& sz )
+{
     while( sz >= 16 )
     {
         __m512 f = _mm512_loadu_ps( src );
@@ -32,18 +62,32 @@ static void FloatToHalf( const float* src, half_float::half* dst, size_t sz )
         dst += 16;
         sz -= 16;
     }
-  #endif
-  #ifdef __AVX2__
-    while( sz >= 8 )
+    FloatToHalfAvx2( src, dst, sz );
+}
+#endif
+
+static void FloatToHalf( const float* src, half_float::half* dst, size_t sz )
+{
+    ZoneScoped;
+
+#if defined MCORE_SIMD_X86
+    switch( GetSimdLevel() )
     {
-        __m256 f = _mm256_loadu_ps( src );
-        __m128i h = _mm256_cvtps_ph( f, _MM_FROUND_TO_NEAREST_INT );
-        _mm_storeu_si128( (__m128i*)dst, h );
-        src += 8;
-        dst += 8;
-        sz -= 8;
+    case SimdLevel::Avx512: FloatToHalfAvx512( src, dst, sz ); break;
+    case SimdLevel::Avx2: FloatToHalfAvx2( src, dst, sz ); break;
+    default: break;
+    }
+#elif defined __ARM_NEON
+    if( GetSimdLevel() == SimdLevel::Neon )
+    {
+        while( sz >= 4 )
+        {
+            vst1_u16( (uint16_t*)dst, vreinterpret_u16_f16( vcvt_f16_f32( vld1q_f32( src ) ) ) );
+            src += 4;
+            dst += 4;
+            sz -= 4;
+        }
     }
-  #endif
 #endif
 
     while( sz-- > 0 )
@@ -52,11 +96,66 @@ static void FloatToHalf( const float* src, half_float::half* dst, size_t sz )
     }
 }
 
+namespace
+{
+// SMPTE ST 2084 constants. Linear values are scaled so that 1.0 is 100 nits, as in HDR textures.
+constexpr float PqNominal = 100.f / 10000.f;
+constexpr float PqM1 = 1305.f / 8192.f;
+constexpr float PqM2 = 2523.f / 32.f;
+constexpr float PqC1 = 107.f / 128.f;
+constexpr float PqC2 = 2413.f / 128.f;
+constexpr float PqC3 = 2392.f / 128.f;
+
+// A half precision value has only 64K bit patterns, so each of them gets its PQ code, and the transfer function
+// is never evaluated per pixel.
+struct PqTables
+{
+    PqTables()
+    {
+        for( uint32_t i=0; i<65536; i++ )
+        {
+            half_float::half h;
+            const auto bits = uint16_t( i );
+            memcpy( &h, &bits, sizeof( bits ) );
+            const auto v = float( h );
+
+            // Negative values and NaN are black, everything past 10000 nits is clamped
+            if( !( v > 0 ) )
+            {
+                encode[i] = 0;
+            }
+            else
+            {
+                const auto ym1 = std::pow( std::min( v * PqNominal, 1.f ), PqM1 );
+                const auto e = std::pow( ( PqC1 + PqC2 * ym1 ) / ( 1 + PqC3 * ym1 ), PqM2 );
+                encode[i] = uint16_t( std::lrint( e * 1023 ) );
+            }
+        }
+        for( uint32_t i=0; i<1024; i++ )
+        {
+            const auto ep = std::pow( i / 1023.f, 1 / PqM2 );
+            const auto y = std::pow( std::max( ep - PqC1, 0.f ) / ( PqC2 - PqC3 * ep ), 1 / PqM1 );
+            decode[i] = half_float::half( y / PqNominal );
+        }
+    }
+
+    uint16_t encode[65536];
+    half_float::half decode[1024];
+};
+
+const PqTables& GetPqTables()
+{
+    static const PqTables tables;
+    return tables;
+}
+}
+
 BitmapHdrHalf::BitmapHdrHalf( const BitmapHdr& bmp )
     : m_width( bmp.Width() )
     , m_height( bmp.Height() )
-    , m_data( new half_float::half[m_width*m_height*4] )
+    , m_data( PixelAlloc<half_float::half>( size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdrHalf ) )
     , m_colorspace( bmp.GetColorspace() )
+    , m_orientation( bmp.Orientation() )
 {
     auto src = bmp.Data();
     auto dst = m_data;
@@ -65,43 +164,123 @@ BitmapHdrHalf::BitmapHdrHalf( const BitmapHdr& bmp )
     FloatToHalf( src, dst, sz );
 }
 
-BitmapHdrHalf::BitmapHdrHalf( uint32_t width, uint32_t height, Colorspace colorspace )
+void BitmapHdrHalf::ConvertFloat( const float* src, half_float::half* dst, size_t count )
+{
+    FloatToHalf( src, dst, count );
+}
+
+void BitmapHdrHalf::EncodePq( const half_float::half* src, uint32_t* dst, size_t count, TaskDispatch* td )
+{
+    ZoneScoped;
+
+    const auto& lut = GetPqTables().encode;
+    BitmapOps::ForRange( td, count, [src, dst, &lut]( size_t begin, size_t end ) {
+        auto ptr = (const uint16_t*)src + begin * 4;
+        for( size_t i=begin; i<end; i++ )
+        {
+            const auto a = std::clamp( float( src[i*4+3] ), 0.f, 1.f );
+            dst[i] = lut[ptr[0]] | ( lut[ptr[1]] << 10 ) | ( uint32_t( lut[ptr[2]] ) << 20 ) | ( uint32_t( std::lrint( a * 3 ) ) << 30 );
+            ptr += 4;
+        }
+    } );
+}
+
+void BitmapHdrHalf::DecodePq( const uint32_t* src, half_float::half* dst, size_t count, TaskDispatch* td )
+{
+    ZoneScoped;
+
+    static const half_float::half alpha[4] = { half_float::half( 0.f ), half_float::half( 1 / 3.f ), half_float::half( 2 / 3.f ), half_float::half( 1.f ) };
+    const auto& lut = GetPqTables().decode;
+    BitmapOps::ForRange( td, count, [src, dst, &lut]( size_t begin, size_t end ) {
+        auto ptr = dst + begin * 4;
+        for( size_t i=begin; i<end; i++ )
+        {
+            const auto v = src[i];
+            *ptr++ = lut[v & 0x3FF];
+            *ptr++ = lut[( v >> 10 ) & 0x3FF];
+            *ptr++ = lut[( v >> 20 ) & 0x3FF];
+            *ptr++ = alpha[v >> 30];
+        }
+    } );
+}
+
+BitmapHdrHalf::BitmapHdrHalf( uint32_t width, uint32_t height, Colorspace colorspace, int orientation )
     : m_width( width )
     , m_height( height )
-    , m_data( new half_float::half[width*height*4] )
+    , m_data( PixelAlloc<half_float::half>( size_t( width ) * height * 4, MemoryStats::Pool::BitmapHdrHalf ) )
     , m_colorspace( colorspace )
+    , m_orientation( orientation )
 {
 }
 
 BitmapHdrHalf::~BitmapHdrHalf()
 {
-    delete[] m_data;
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdrHalf );
 }
 
-void BitmapHdrHalf::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
+void BitmapHdrHalf::Resample( const half_float::half* src, uint32_t srcWidth, uint32_t srcHeight, half_float::half* dst, uint32_t width, uint32_t height, TaskDispatch* td )
 {
-    auto newData = new half_float::half[width*height*4];
     STBIR_RESIZE resize;
-    stbir_resize_init( &resize, m_data, m_width, m_height, 0, newData, width, height, 0, STBIR_RGBA, STBIR_TYPE_HALF_FLOAT );
+    stbir_resize_init( &resize, src, srcWidth, srcHeight, 0, dst, width, height, 0, STBIR_RGBA, STBIR_TYPE_HALF_FLOAT );
     stbir_set_non_pm_alpha_speed_over_quality( &resize, 1 );
     if( td )
     {
-        auto threads = td->NumWorkers() + 1;
-        threads = stbir_build_samplers_with_splits( &resize, threads );
-        for( size_t i=0; i<threads; i++ )
-        {
-            td->Queue( [i, &resize, threads] {
-                stbir_resize_extended_split( &resize, i, 1 );
-            } );
-        }
-        td->Sync();
+        const auto splits = stbir_build_samplers_with_splits( &resize, td->NumWorkers() + 1 );
+        td->ParallelFor( 0, splits, 1, [&resize]( size_t begin, size_t end ) {
+            stbir_resize_extended_split( &resize, begin, end - begin );
+        } );
         stbir_free_samplers( &resize );
     }
     else
     {
         stbir_resize_extended( &resize );
     }
-    delete[] m_data;
+}
+
+void BitmapHdrHalf::Halve( const half_float::half* src, uint32_t srcWidth, uint32_t srcHeight, half_float::half* dst, TaskDispatch* td )
+{
+    HalveImage( src, srcWidth, srcHeight, dst, td, []( const half_float::half* src0, const half_float::half* src1, half_float::half* dst, uint32_t width ) {
+        uint32_t x = 0;
+#ifdef __F16C__
+  #ifdef __AVX512F__
+        for( ; x + 2 <= width; x += 2 )
+        {
+            const auto v = _mm512_add_ps( _mm512_cvtph_ps( _mm256_loadu_si256( (const __m256i*)src0 ) ), _mm512_cvtph_ps( _mm256_loadu_si256( (const __m256i*)src1 ) ) );
+            const auto even = _mm512_shuffle_f32x4( v, v, _MM_SHUFFLE( 2, 0, 2, 0 ) );
+            const auto odd = _mm512_shuffle_f32x4( v, v, _MM_SHUFFLE( 3, 1, 3, 1 ) );
+            const auto h = _mm512_cvtps_ph( _mm512_mul_ps( _mm512_add_ps( even, odd ), _mm512_set1_ps( 0.25f ) ), _MM_FROUND_TO_NEAREST_INT );
+            _mm_storeu_si128( (__m128i*)dst, _mm256_castsi256_si128( h ) );
+            src0 += 16;
+            src1 += 16;
+            dst += 8;
+        }
+  #endif
+        for( ; x < width; x++ )
+        {
+            const auto v = _mm256_add_ps( _mm256_cvtph_ps( _mm_loadu_si128( (const __m128i*)src0 ) ), _mm256_cvtph_ps( _mm_loadu_si128( (const __m128i*)src1 ) ) );
+            const auto sum = _mm_add_ps( _mm256_castps256_ps128( v ), _mm256_extractf128_ps( v, 1 ) );
+            _mm_storel_epi64( (__m128i*)dst, _mm_cvtps_ph( _mm_mul_ps( sum, _mm_set1_ps( 0.25f ) ), _MM_FROUND_TO_NEAREST_INT ) );
+            src0 += 8;
+            src1 += 8;
+            dst += 4;
+        }
+#else
+        for( ; x < width; x++ )
+        {
+            for( int i=0; i<4; i++ ) dst[i] = half_float::half( ( float( src0[i] ) + float( src0[i+4] ) + float( src1[i] ) + float( src1[i+4] ) ) * 0.25f );
+            src0 += 8;
+            src1 += 8;
+            dst += 4;
+        }
+#endif
+    } );
+}
+
+void BitmapHdrHalf::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    auto newData = PixelAlloc<half_float::half>( size_t( width ) * height * 4, MemoryStats::Pool::BitmapHdrHalf );
+    Resample( m_data, m_width, m_height, newData, width, height, td );
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdrHalf );
     m_data = newData;
     m_width = width;
     m_height = height;
@@ -110,67 +289,29 @@ void BitmapHdrHalf::Resize( uint32_t width, uint32_t height, TaskDispatch* td )
 std::unique_ptr<BitmapHdrHalf> BitmapHdrHalf::ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td ) const
 {
     auto ret = std::make_unique<BitmapHdrHalf>( width, height, m_colorspace );
-    STBIR_RESIZE resize;
-    stbir_resize_init( &resize, m_data, m_width, m_height, 0, ret->m_data, width, height, 0, STBIR_RGBA, STBIR_TYPE_HALF_FLOAT );
-    stbir_set_non_pm_alpha_speed_over_quality( &resize, 1 );
-    if( td )
-    {
-        auto threads = td->NumWorkers() + 1;
-        threads = stbir_build_samplers_with_splits( &resize, threads );
-        for( size_t i=0; i<threads; i++ )
-        {
-            td->Queue( [i, &resize, threads] {
-                stbir_resize_extended_split( &resize, i, 1 );
-            } );
-        }
-        td->Sync();
-        stbir_free_samplers( &resize );
-    }
-    else
-    {
-        stbir_resize_extended( &resize );
-    }
+    Resample( m_data, m_width, m_height, ret->m_data, width, height, td );
     return ret;
 }
 
-void BitmapHdrHalf::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
+void BitmapHdrHalf::Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height, TaskDispatch* td )
 {
     CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid crop" );
 
-    auto data = new half_float::half[width*height*4];
-    auto dst = data;
-    auto src = m_data + ( y * m_width + x ) * 4;
+    auto data = PixelAlloc<half_float::half>( size_t( width ) * height * 4, MemoryStats::Pool::BitmapHdrHalf );
+    BitmapOps::CopyRows( (const Pixel*)m_data + size_t( y ) * m_width + x, m_width, (Pixel*)data, width, height, td );
 
-    for( uint32_t i=0; i<height; i++ )
-    {
-        memcpy( dst, src, width * 4 * sizeof( half_float::half ) );
-        src += m_width * 4;
-        dst += width * 4;
-    }
-
-    delete[] m_data;
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdrHalf );
     m_data = data;
     m_width = width;
     m_height = height;
 }
 
-void BitmapHdrHalf::FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height )
+void BitmapHdrHalf::FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height, TaskDispatch* td )
 {
     CheckPanic( x + width <= m_width && y + height <= m_height, "Invalid fill" );
 
-    auto row = m_data + ( y * m_width + x ) * 4;
-    for( uint32_t i=0; i<height; i++ )
-    {
-        auto ptr = row;
-        for( uint32_t j=0; j<width; j++ )
-        {
-            *ptr++ = 0;
-            *ptr++ = 0;
-            *ptr++ = 0;
-            *ptr++ = 1;
-        }
-        row += m_width * 4;
-    }
+    constexpr Pixel black = { { 0, 0, 0, 0x3C00 } };     // Alpha is 1.0 in half precision
+    BitmapOps::Fill( (Pixel*)m_data, m_width, x, y, width, height, black, td );
 }
 
 void BitmapHdrHalf::SetColorspace( Colorspace colorspace, TaskDispatch* td )
@@ -183,20 +324,17 @@ void BitmapHdrHalf::SetColorspace( Colorspace colorspace, TaskDispatch* td )
 
     ZoneScoped;
 
-    cmsToneCurve* linear = cmsBuildGamma( nullptr, 1 );
-    cmsToneCurve* linear3[3] = { linear, linear, linear };
-
-    auto profile709 = cmsCreateRGBProfile( &white709, &primaries709, linear3 );
-    auto profile2020 = cmsCreateRGBProfile( &white709, &primaries2020, linear3 );
-
-    cmsHTRANSFORM transform;
+    // Pixels are converted in registers, without going through a float copy of the image
+    ColorMatrix matrix;
     if( m_colorspace == Colorspace::BT2020 && colorspace == Colorspace::BT709 )
     {
-        transform = cmsCreateTransform( profile2020, TYPE_RGBA_HALF_FLT, profile709, TYPE_RGBA_HALF_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        static const auto m = MakeColorMatrix( primaries2020, primaries709 );
+        matrix = m;
     }
     else if( m_colorspace == Colorspace::BT709 && colorspace == Colorspace::BT2020 )
     {
-        transform = cmsCreateTransform( profile709, TYPE_RGBA_HALF_FLT, profile2020, TYPE_RGBA_HALF_FLT, INTENT_PERCEPTUAL, cmsFLAGS_COPY_ALPHA );
+        static const auto m = MakeColorMatrix( primaries709, primaries2020 );
+        matrix = m;
     }
     else
     {
@@ -205,40 +343,125 @@ void BitmapHdrHalf::SetColorspace( Colorspace colorspace, TaskDispatch* td )
 
     if( td )
     {
-        auto ptr = m_data;
-        auto sz = m_width * m_height;
-        while( sz > 0 )
-        {
-            auto chunk = std::min<uint32_t>( sz, 16 * 1024 );
-            td->Queue( [ptr, chunk, transform] {
-                cmsDoTransform( transform, ptr, ptr, chunk );
-            } );
-            ptr += chunk * 4;
-            sz -= chunk;
-        }
-        td->Sync();
+        td->ParallelFor( 0, m_width * m_height, TaskDispatch::AdaptiveGrain, [this, &matrix]( size_t begin, size_t end ) {
+            ApplyColorMatrix( matrix, m_data + begin * 4, end - begin );
+        } );
     }
     else
     {
-        cmsDoTransform( transform, m_data, m_data, m_width * m_height );
+        ApplyColorMatrix( matrix, m_data, m_width * m_height );
     }
 
-    cmsDeleteTransform( transform );
-    cmsCloseProfile( profile709 );
-    cmsCloseProfile( profile2020 );
-    cmsFreeToneCurve( linear );
-
     m_colorspace = colorspace;
 }
 
-bool BitmapHdrHalf::SaveExr( const char* path ) const
+bool BitmapHdrHalf::IsOpaque() const
 {
-    Imf::RgbaOutputFile output( path, m_width, m_height, Imf::WRITE_RGBA );
-    output.setFrameBuffer( (const Imf::Rgba*)m_data, 1, m_width );
-    output.writePixels( m_height );
+    auto ptr = (const uint16_t*)m_data + 3;
+    const auto sz = size_t( m_width ) * m_height;
+    for( size_t i=0; i<sz; i++ )
+    {
+        if( *ptr != 0x3C00 ) return false;
+        ptr += 4;
+    }
     return true;
 }
 
+void BitmapHdrHalf::SetAlpha( float alpha, TaskDispatch* td )
+{
+    const half_float::half value( alpha );
+    BitmapOps::ForRange( td, size_t( m_width ) * m_height, [this, value]( size_t begin, size_t end ) {
+        auto ptr = m_data + begin * 4 + 3;
+        for( size_t i=begin; i<end; i++ )
+        {
+            *ptr = value;
+            ptr += 4;
+        }
+    } );
+}
+
+void BitmapHdrHalf::NormalizeOrientation( TaskDispatch* td )
+{
+    if( m_orientation <= 1 ) return;
+
+    switch( m_orientation )
+    {
+    case 2:
+        FlipHorizontal( td );
+        break;
+    case 3:
+        Rotate180( td );
+        break;
+    case 4:
+        FlipVertical( td );
+        break;
+    case 5:
+        Rotate270( td );
+        FlipVertical( td );
+        break;
+    case 6:
+        Rotate90( td );
+        break;
+    case 7:
+        Rotate90( td );
+        FlipVertical( td );
+        break;
+    case 8:
+        Rotate270( td );
+        break;
+    default:
+        Panic( "Invalid orientation value!" );
+    }
+
+    m_orientation = 1;
+}
+
+void BitmapHdrHalf::FlipVertical( TaskDispatch* td )
+{
+    BitmapOps::FlipVertical( (Pixel*)m_data, m_width, m_height, td );
+}
+
+void BitmapHdrHalf::FlipHorizontal( TaskDispatch* td )
+{
+    BitmapOps::FlipHorizontal( (Pixel*)m_data, m_width, m_height, td );
+}
+
+void BitmapHdrHalf::Rotate90( TaskDispatch* td )
+{
+    ZoneScoped;
+
+    auto tmp = PixelAlloc<half_float::half>( size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdrHalf );
+    RotateImage<true>( (const Pixel*)m_data, (Pixel*)tmp, m_width, m_height, td );
+
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdrHalf );
+    m_data = tmp;
+    std::swap( m_width, m_height );
+}
+
+void BitmapHdrHalf::Rotate180( TaskDispatch* td )
+{
+    BitmapOps::Rotate180( (Pixel*)m_data, m_width, m_height, td );
+}
+
+void BitmapHdrHalf::Rotate270( TaskDispatch* td )
+{
+    ZoneScoped;
+
+    auto tmp = PixelAlloc<half_float::half>( size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdrHalf );
+    RotateImage<false>( (const Pixel*)m_data, (Pixel*)tmp, m_width, m_height, td );
+
+    PixelFree( m_data, size_t( m_width ) * m_height * 4, MemoryStats::Pool::BitmapHdrHalf );
+    m_data = tmp;
+    std::swap( m_width, m_height );
+}
+
+bool BitmapHdrHalf::SaveExr( const char* path ) const
+{
+    ExrWriter writer( path, m_width, m_height );
+    writer.Write( m_data, m_height );
+    return writer.IsValid();
+}
+
 bool BitmapHdrHalf::SaveExr( int fd ) const
 {
     Imf::StdOSStream buf;
@@ -16,20 +16,40 @@ class BitmapHdrHalf
 {
 public:
     explicit BitmapHdrHalf( const BitmapHdr& bmp );
-    BitmapHdrHalf( uint32_t width, uint32_t height, Colorspace colorspace );
+    BitmapHdrHalf( uint32_t width, uint32_t height, Colorspace colorspace, int orientation = 0 );
     ~BitmapHdrHalf();
     NoCopy( BitmapHdrHalf );
 
     void Resize( uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
     [[nodiscard]] std::unique_ptr<BitmapHdrHalf> ResizeNew( uint32_t width, uint32_t height, TaskDispatch* td = nullptr ) const;
-    void Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height );
-    void FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height );
+    // Resizes tightly packed RGBA pixel data, e.g. from one mip level to the next one in place of a larger buffer.
+    static void Resample( const half_float::half* src, uint32_t srcWidth, uint32_t srcHeight, half_float::half* dst, uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
+    // Halves tightly packed RGBA pixel data with a 2x2 box filter. The source must be an exact halving, see IsHalving().
+    static void Halve( const half_float::half* src, uint32_t srcWidth, uint32_t srcHeight, half_float::half* dst, TaskDispatch* td = nullptr );
+    // Converts float values to half precision, e.g. to write a float image out in parts.
+    static void ConvertFloat( const float* src, half_float::half* dst, size_t count );
+    // Encodes linear values, with 1.0 being 100 nits, with the PQ transfer function into A2B10G10R10 pixels, as
+    // in VK_FORMAT_A2B10G10R10_UNORM_PACK32. Alpha is rounded to 2 bits, so this only suits opaque images.
+    static void EncodePq( const half_float::half* src, uint32_t* dst, size_t count, TaskDispatch* td = nullptr );
+    static void DecodePq( const uint32_t* src, half_float::half* dst, size_t count, TaskDispatch* td = nullptr );
+    void Crop( uint32_t x, uint32_t y, uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
+    void FillBlack( uint32_t x, uint32_t y, uint32_t width, uint32_t height, TaskDispatch* td = nullptr );
+    void SetAlpha( float alpha, TaskDispatch* td = nullptr );
+    void NormalizeOrientation( TaskDispatch* td = nullptr );
     void SetColorspace( Colorspace colorspace, TaskDispatch* td = nullptr );
+    [[nodiscard]] bool IsOpaque() const;
+
+    void FlipVertical( TaskDispatch* td = nullptr );
+    void FlipHorizontal( TaskDispatch* td = nullptr );
+    void Rotate90( TaskDispatch* td = nullptr );
+    void Rotate180( TaskDispatch* td = nullptr );
+    void Rotate270( TaskDispatch* td = nullptr );
 
     [[nodiscard]] uint32_t Width() const { return m_width; }
     [[nodiscard]] uint32_t Height() const { return m_height; }
     [[nodiscard]] half_float::half* Data() { return m_data; }
     [[nodiscard]] const half_float::half* Data() const { return m_data; }
+    [[nodiscard]] int Orientation() const { return m_orientation; }
     [[nodiscard]] Colorspace GetColorspace() const { return m_colorspace; }
 
     bool SaveExr( const char* path ) const;
@@ -40,4 +60,6 @@ private:
     uint32_t m_height;
     half_float::half* m_data;
     Colorspace m_colorspace;
+
+    int m_orientation;
 };
@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <lz4.h>
+#include <memory>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+
+#include "Bitmap.hpp"
+#include "BitmapHdrHalf.hpp"
+#include "BitmapLz4.hpp"
+#include "BitmapOps.hpp"
+#include "Panic.hpp"
+#include "TaskDispatch.hpp"
+
+namespace
+{
+// Large enough for LZ4 to find matches, small enough to spread an image over all workers
+constexpr size_t ChunkSize = 256 * 1024;
+
+// Byte b of pixel i goes to plane b, as the difference to the same byte of the previous pixel
+template<size_t Bpp>
+void Split( const uint8_t* src, uint8_t* dst, size_t count )
+{
+    uint8_t prev[Bpp] = {};
+    for( size_t i=0; i<count; i++ )
+    {
+        for( size_t b=0; b<Bpp; b++ )
+        {
+            dst[b * count + i] = uint8_t( src[b] - prev[b] );
+            prev[b] = src[b];
+        }
+        src += Bpp;
+    }
+}
+
+template<size_t Bpp>
+void Merge( const uint8_t* src, uint8_t* dst, size_t count )
+{
+    uint8_t prev[Bpp] = {};
+    for( size_t i=0; i<count; i++ )
+    {
+        for( size_t b=0; b<Bpp; b++ )
+        {
+            prev[b] += src[b * count + i];
+            dst[b] = prev[b];
+        }
+        dst += Bpp;
+    }
+}
+}
+
+BitmapLz4::BitmapLz4( const Bitmap& bmp, TaskDispatch* td )
+    : m_width( bmp.Width() )
+    , m_height( bmp.Height() )
+    , m_bpp( 4 )
+    , m_orientation( bmp.Orientation() )
+    , m_colorspace( Colorspace::BT709 )
+{
+    Compress( bmp.Data(), td );
+}
+
+BitmapLz4::BitmapLz4( const BitmapHdrHalf& bmp, TaskDispatch* td )
+    : m_width( bmp.Width() )
+    , m_height( bmp.Height() )
+    , m_bpp( 8 )
+    , m_orientation( bmp.Orientation() )
+    , m_colorspace( bmp.GetColorspace() )
+{
+    Compress( (const uint8_t*)bmp.Data(), td );
+}
+
+BitmapLz4::~BitmapLz4() = default;
+
+std::unique_ptr<Bitmap> BitmapLz4::ToBitmap( TaskDispatch* td ) const
+{
+    CheckPanic( !IsHdr(), "Bitmap is HDR" );
+
+    auto ret = std::make_unique<Bitmap>( m_width, m_height, m_orientation );
+    Decompress( ret->Data(), td );
+    return ret;
+}
+
+std::unique_ptr<BitmapHdrHalf> BitmapLz4::ToBitmapHdrHalf( TaskDispatch* td ) const
+{
+    CheckPanic( IsHdr(), "Bitmap is not HDR" );
+
+    auto ret = std::make_unique<BitmapHdrHalf>( m_width, m_height, m_colorspace, m_orientation );
+    Decompress( (uint8_t*)ret->Data(), td );
+    return ret;
+}
+
+size_t BitmapLz4::ChunkPixels( size_t chunk ) const
+{
+    const auto pixels = size_t( m_width ) * m_height;
+    const auto perChunk = ChunkSize / m_bpp;
+    return std::min( perChunk, pixels - chunk * perChunk );
+}
+
+void BitmapLz4::Compress( const uint8_t* src, TaskDispatch* td )
+{
+    ZoneScoped;
+
+    const auto bytes = size_t( m_width ) * m_height * m_bpp;
+    m_chunks.resize( ( bytes + ChunkSize - 1 ) / ChunkSize );
+
+    BitmapOps::ForRange( td, m_chunks.size(), [this, src]( size_t begin, size_t end ) {
+        auto planes = std::make_unique_for_overwrite<uint8_t[]>( ChunkSize );
+        auto packed = std::make_unique_for_overwrite<char[]>( LZ4_compressBound( ChunkSize ) );
+        for( size_t i=begin; i<end; i++ )
+        {
+            const auto count = ChunkPixels( i );
+            const auto size = int( count * m_bpp );
+            const auto ptr = src + i * ChunkSize;
+            if( m_bpp == 4 ) Split<4>( ptr, planes.get(), count );
+            else Split<8>( ptr, planes.get(), count );
+
+            auto& chunk = m_chunks[i];
+            chunk.size = LZ4_compress_default( (const char*)planes.get(), packed.get(), size, LZ4_compressBound( size ) );
+            CheckPanic( chunk.size > 0, "LZ4 compression failed" );
+            chunk.data = std::make_unique_for_overwrite<char[]>( chunk.size );
+            memcpy( chunk.data.get(), packed.get(), chunk.size );
+        }
+    } );
+
+    m_size = sizeof( *this ) + m_chunks.size() * sizeof( Chunk );
+    for( auto& chunk : m_chunks ) m_size += chunk.size;
+
+    ZoneTextF( "%zu -> %zu bytes", bytes, m_size );
+}
+
+void BitmapLz4::Decompress( uint8_t* dst, TaskDispatch* td ) const
+{
+    ZoneScoped;
+
+    BitmapOps::ForRange( td, m_chunks.size(), [this, dst]( size_t begin, size_t end ) {
+        auto planes = std::make_unique_for_overwrite<uint8_t[]>( ChunkSize );
+        for( size_t i=begin; i<end; i++ )
+        {
+            const auto count = ChunkPixels( i );
+            const auto size = int( count * m_bpp );
+            const auto& chunk = m_chunks[i];
+            const auto ret = LZ4_decompress_safe( chunk.data.get(), (char*)planes.get(), chunk.size, size );
+            CheckPanic( ret == size, "LZ4 decompression failed" );
+
+            const auto ptr = dst + i * ChunkSize;
+            if( m_bpp == 4 ) Merge<4>( planes.get(), ptr, count );
+            else Merge<8>( planes.get(), ptr, count );
+        }
+    } );
+}
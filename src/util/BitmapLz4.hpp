@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+#include "Colorspace.hpp"
+#include "NoCopy.hpp"
+
+class Bitmap;
+class BitmapHdrHalf;
+class TaskDispatch;
+
+// Lossless copy of a bitmap kept compressed in memory, cheaper to restore than decoding the image file again.
+// Pixels are split into byte planes and delta coded, which helps LZ4 with flat areas and with the slowly changing
+// high bytes of half floats. Chunks of rows are compressed independently, so that work in both directions is
+// split between workers if td is set.
+class BitmapLz4
+{
+public:
+    explicit BitmapLz4( const Bitmap& bmp, TaskDispatch* td = nullptr );
+    explicit BitmapLz4( const BitmapHdrHalf& bmp, TaskDispatch* td = nullptr );
+    ~BitmapLz4();
+
+    NoCopy( BitmapLz4 );
+
+    [[nodiscard]] std::unique_ptr<Bitmap> ToBitmap( TaskDispatch* td = nullptr ) const;                 // Not for HDR
+    [[nodiscard]] std::unique_ptr<BitmapHdrHalf> ToBitmapHdrHalf( TaskDispatch* td = nullptr ) const;   // HDR only
+
+    [[nodiscard]] uint32_t Width() const { return m_width; }
+    [[nodiscard]] uint32_t Height() const { return m_height; }
+    [[nodiscard]] bool IsHdr() const { return m_bpp == 8; }
+    [[nodiscard]] size_t Size() const { return m_size; }     // Compressed, in bytes
+
+private:
+    struct Chunk
+    {
+        std::unique_ptr<char[]> data;
+        int size;
+    };
+
+    void Compress( const uint8_t* src, TaskDispatch* td );
+    void Decompress( uint8_t* dst, TaskDispatch* td ) const;
+
+    [[nodiscard]] size_t ChunkPixels( size_t chunk ) const;
+
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_bpp;
+    int m_orientation;
+    Colorspace m_colorspace;
+
+    std::vector<Chunk> m_chunks;
+    size_t m_size;
+};
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <utility>
+
+#if defined __SSE2__
+#  include <x86intrin.h>
+#elif defined __ARM_NEON
+#  include <arm_neon.h>
+#endif
+
+#include "TaskDispatch.hpp"
+
+// In-place operations on RGBA images, with each pixel handled as a single Pixel value. Work is split into bands
+// of rows, or runs of pixels, between workers if td is set.
+namespace BitmapOps
+{
+
+// Calls fn( begin, end ) for chunks covering [0, count)
+template<typename F>
+void ForRange( TaskDispatch* td, size_t count, F&& fn )
+{
+    if( td && count > 1 )
+    {
+        td->ParallelFor( 0, count, TaskDispatch::AdaptiveGrain, fn );
+    }
+    else if( count > 0 )
+    {
+        fn( 0, count );
+    }
+}
+
+// Swaps ptr[i] with end[-1-i] for i in [0, count). The two ranges must not overlap.
+template<typename Pixel>
+inline void SwapReversed( Pixel* ptr, Pixel* end, size_t count )
+{
+    if constexpr( sizeof( Pixel ) == 4 )
+    {
+#if defined __SSE2__
+        while( count >= 4 )
+        {
+            end -= 4;
+            const auto a = _mm_loadu_si128( (const __m128i*)ptr );
+            const auto b = _mm_loadu_si128( (const __m128i*)end );
+            _mm_storeu_si128( (__m128i*)ptr, _mm_shuffle_epi32( b, _MM_SHUFFLE( 0, 1, 2, 3 ) ) );
+            _mm_storeu_si128( (__m128i*)end, _mm_shuffle_epi32( a, _MM_SHUFFLE( 0, 1, 2, 3 ) ) );
+            ptr += 4;
+            count -= 4;
+        }
+#elif defined __ARM_NEON
+        while( count >= 4 )
+        {
+            end -= 4;
+            auto a = vrev64q_u32( vld1q_u32( (const uint32_t*)ptr ) );
+            auto b = vrev64q_u32( vld1q_u32( (const uint32_t*)end ) );
+            vst1q_u32( (uint32_t*)ptr, vcombine_u32( vget_high_u32( b ), vget_low_u32( b ) ) );
+            vst1q_u32( (uint32_t*)end, vcombine_u32( vget_high_u32( a ), vget_low_u32( a ) ) );
+            ptr += 4;
+            count -= 4;
+        }
+#endif
+    }
+    while( count-- ) std::swap( *ptr++, *--end );
+}
+
+template<typename Pixel>
+void FlipVertical( Pixel* data, uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    ForRange( td, height / 2, [=]( size_t begin, size_t end ) {
+        for( size_t y=begin; y<end; y++ )
+        {
+            auto top = data + y * width;
+            std::swap_ranges( top, top + width, data + ( height - y - 1 ) * size_t( width ) );
+        }
+    } );
+}
+
+template<typename Pixel>
+void FlipHorizontal( Pixel* data, uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    ForRange( td, height, [=]( size_t begin, size_t end ) {
+        for( size_t y=begin; y<end; y++ )
+        {
+            auto row = data + y * width;
+            SwapReversed( row, row + width, width / 2 );
+        }
+    } );
+}
+
+template<typename Pixel>
+void Rotate180( Pixel* data, uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    const auto count = size_t( width ) * height;
+    ForRange( td, count / 2, [=]( size_t begin, size_t end ) {
+        SwapReversed( data + begin, data + count - begin, end - begin );
+    } );
+}
+
+// Fills a rectangle of an image with width pixels per row
+template<typename Pixel>
+void Fill( Pixel* data, uint32_t width, uint32_t x, uint32_t y, uint32_t w, uint32_t h, Pixel value, TaskDispatch* td )
+{
+    auto origin = data + size_t( y ) * width + x;
+    ForRange( td, h, [=]( size_t begin, size_t end ) {
+        for( size_t i=begin; i<end; i++ ) std::fill_n( origin + i * width, w, value );
+    } );
+}
+
+// Copies width x height pixels from src, with rows stride pixels apart, to tightly packed dst
+template<typename Pixel>
+void CopyRows( const Pixel* src, size_t stride, Pixel* dst, uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    ForRange( td, height, [=]( size_t begin, size_t end ) {
+        for( size_t y=begin; y<end; y++ ) memcpy( dst + y * width, src + y * stride, width * sizeof( Pixel ) );
+    } );
+}
+
+}
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined __SSE2__
+#  include <x86intrin.h>
+#endif
+
+#include "TaskDispatch.hpp"
+
+namespace BitmapRotate
+{
+
+// Square blocks of this many pixels are rotated at a time, so that both the source and destination lines of
+// a block stay in L1 cache and TLB.
+template<typename Pixel>
+constexpr uint32_t BlockSize = sizeof( Pixel ) >= 16 ? 16 : 32;
+
+// Destination rows are stride pixels apart, which is the source height unless the source is a band of rows.
+template<bool Clockwise, typename Pixel>
+inline void RotatePixel( const Pixel* src, Pixel* dst, uint32_t width, uint32_t height, size_t stride, uint32_t x, uint32_t y )
+{
+    if constexpr( Clockwise )
+    {
+        dst[x * stride + height - y - 1] = src[size_t( y ) * width + x];
+    }
+    else
+    {
+        dst[( width - x - 1 ) * stride + y] = src[size_t( y ) * width + x];
+    }
+}
+
+#if defined __AVX2__
+constexpr uint32_t TileSize = 8;
+
+// Transposes an 8x8 tile of 32-bit pixels in registers and writes each source column as a destination row.
+template<bool Clockwise>
+inline void RotateTile( const uint32_t* src, uint32_t* dst, uint32_t width, uint32_t height, size_t stride, uint32_t x, uint32_t y )
+{
+    auto s = src + size_t( y ) * width + x;
+    __m256i r[8];
+    for( int i=0; i<8; i++ ) r[i] = _mm256_loadu_si256( (const __m256i*)( s + size_t( i ) * width ) );
+
+    const auto t0 = _mm256_unpacklo_epi32( r[0], r[1] );
+    const auto t1 = _mm256_unpackhi_epi32( r[0], r[1] );
+    const auto t2 = _mm256_unpacklo_epi32( r[2], r[3] );
+    const auto t3 = _mm256_unpackhi_epi32( r[2], r[3] );
+    const auto t4 = _mm256_unpacklo_epi32( r[4], r[5] );
+    const auto t5 = _mm256_unpackhi_epi32( r[4], r[5] );
+    const auto t6 = _mm256_unpacklo_epi32( r[6], r[7] );
+    const auto t7 = _mm256_unpackhi_epi32( r[6], r[7] );
+
+    const auto u0 = _mm256_unpacklo_epi64( t0, t2 );
+    const auto u1 = _mm256_unpackhi_epi64( t0, t2 );
+    const auto u2 = _mm256_unpacklo_epi64( t1, t3 );
+    const auto u3 = _mm256_unpackhi_epi64( t1, t3 );
+    const auto u4 = _mm256_unpacklo_epi64( t4, t6 );
+    const auto u5 = _mm256_unpackhi_epi64( t4, t6 );
+    const auto u6 = _mm256_unpacklo_epi64( t5, t7 );
+    const auto u7 = _mm256_unpackhi_epi64( t5, t7 );
+
+    __m256i c[8];
+    c[0] = _mm256_permute2x128_si256( u0, u4, 0x20 );
+    c[1] = _mm256_permute2x128_si256( u1, u5, 0x20 );
+    c[2] = _mm256_permute2x128_si256( u2, u6, 0x20 );
+    c[3] = _mm256_permute2x128_si256( u3, u7, 0x20 );
+    c[4] = _mm256_permute2x128_si256( u0, u4, 0x31 );
+    c[5] = _mm256_permute2x128_si256( u1, u5, 0x31 );
+    c[6] = _mm256_permute2x128_si256( u2, u6, 0x31 );
+    c[7] = _mm256_permute2x128_si256( u3, u7, 0x31 );
+
+    if constexpr( Clockwise )
+    {
+        const auto reverse = _mm256_setr_epi32( 7, 6, 5, 4, 3, 2, 1, 0 );
+        auto d = dst + x * stride + height - y - 8;
+        for( int i=0; i<8; i++ ) _mm256_storeu_si256( (__m256i*)( d + i * stride ), _mm256_permutevar8x32_epi32( c[i], reverse ) );
+    }
+    else
+    {
+        auto d = dst + ( width - x - 1 ) * stride + y;
+        for( int i=0; i<8; i++ ) _mm256_storeu_si256( (__m256i*)( d - i * stride ), c[i] );
+    }
+}
+#elif defined __SSE2__
+constexpr uint32_t TileSize = 4;
+
+// Transposes a 4x4 tile of 32-bit pixels in registers and writes each source column as a destination row.
+template<bool Clockwise>
+inline void RotateTile( const uint32_t* src, uint32_t* dst, uint32_t width, uint32_t height, size_t stride, uint32_t x, uint32_t y )
+{
+    auto s = src + size_t( y ) * width + x;
+    const auto r0 = _mm_loadu_si128( (const __m128i*)s );
+    const auto r1 = _mm_loadu_si128( (const __m128i*)( s + width ) );
+    const auto r2 = _mm_loadu_si128( (const __m128i*)( s + size_t( width ) * 2 ) );
+    const auto r3 = _mm_loadu_si128( (const __m128i*)( s + size_t( width ) * 3 ) );
+
+    const auto t0 = _mm_unpacklo_epi32( r0, r1 );
+    const auto t1 = _mm_unpacklo_epi32( r2, r3 );
+    const auto t2 = _mm_unpackhi_epi32( r0, r1 );
+    const auto t3 = _mm_unpackhi_epi32( r2, r3 );
+
+    __m128i c[4];
+    c[0] = _mm_unpacklo_epi64( t0, t1 );
+    c[1] = _mm_unpackhi_epi64( t0, t1 );
+    c[2] = _mm_unpacklo_epi64( t2, t3 );
+    c[3] = _mm_unpackhi_epi64( t2, t3 );
+
+    if constexpr( Clockwise )
+    {
+        auto d = dst + x * stride + height - y - 4;
+        for( int i=0; i<4; i++ ) _mm_storeu_si128( (__m128i*)( d + i * stride ), _mm_shuffle_epi32( c[i], _MM_SHUFFLE( 0, 1, 2, 3 ) ) );
+    }
+    else
+    {
+        auto d = dst + ( width - x - 1 ) * stride + y;
+        for( int i=0; i<4; i++ ) _mm_storeu_si128( (__m128i*)( d - i * stride ), c[i] );
+    }
+}
+#else
+constexpr uint32_t TileSize = 0;
+#endif
+
+// Rotates source columns [x0, x1), which become whole destination rows.
+template<bool Clockwise, typename Pixel>
+void RotateColumns( const Pixel* src, Pixel* dst, uint32_t width, uint32_t height, size_t stride, uint32_t x0, uint32_t x1 )
+{
+    constexpr auto Block = BlockSize<Pixel>;
+#if defined __SSE2__
+    constexpr auto Tile = sizeof( Pixel ) == 4 ? TileSize : 0;
+#endif
+
+    for( uint32_t y0=0; y0<height; y0+=Block )
+    {
+        const auto y1 = std::min( y0 + Block, height );
+        uint32_t y = y0;
+#if defined __SSE2__
+        if constexpr( Tile != 0 )
+        {
+            for( ; y + Tile <= y1; y += Tile )
+            {
+                uint32_t x = x0;
+                for( ; x + Tile <= x1; x += Tile ) RotateTile<Clockwise>( (const uint32_t*)src, (uint32_t*)dst, width, height, stride, x, y );
+                for( ; x < x1; x++ )
+                {
+                    for( uint32_t i=0; i<Tile; i++ ) RotatePixel<Clockwise>( src, dst, width, height, stride, x, y + i );
+                }
+            }
+        }
+#endif
+        for( ; y < y1; y++ )
+        {
+            for( uint32_t x=x0; x<x1; x++ ) RotatePixel<Clockwise>( src, dst, width, height, stride, x, y );
+        }
+    }
+}
+
+}
+
+// Rotates a width x height image by 90 degrees into dst, which becomes height x width. Clockwise rotation
+// matches EXIF orientation 6. Column blocks are split between workers if td is set.
+template<bool Clockwise, typename Pixel>
+void RotateImage( const Pixel* src, Pixel* dst, uint32_t width, uint32_t height, TaskDispatch* td )
+{
+    constexpr auto Block = BitmapRotate::BlockSize<Pixel>;
+    const auto blocks = ( width + Block - 1 ) / Block;
+
+    auto fn = [&]( size_t begin, size_t end ) {
+        BitmapRotate::RotateColumns<Clockwise>( src, dst, width, height, height, uint32_t( begin * Block ), uint32_t( std::min<size_t>( end * Block, width ) ) );
+    };
+
+    if( td && blocks > 1 )
+    {
+        td->ParallelFor( 0, blocks, TaskDispatch::AdaptiveGrain, fn );
+    }
+    else
+    {
+        fn( 0, blocks );
+    }
+}
+
+// Rotates rows [y, y + rows) of a width x height image, given at src, into their place in dst. Used to rotate
+// an image while it is decoded, one band of rows at a time.
+template<bool Clockwise, typename Pixel>
+void RotateRows( const Pixel* src, Pixel* dst, uint32_t width, uint32_t height, uint32_t y, uint32_t rows )
+{
+    auto band = Clockwise ? dst + ( height - y - rows ) : dst + y;
+    BitmapRotate::RotateColumns<Clockwise>( src, band, width, rows, height, 0, width );
+}
@@ -0,0 +1,29 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "Panic.hpp"
+
+// Non-owning window into RGBA pixels, with rows stride pixels apart. A view of a bitmap stays valid as long as
+// the bitmap is neither destroyed nor resized, so crops and tiles can be passed around without copying.
+template<typename T>
+struct PixelView
+{
+    [[nodiscard]] const T* Row( uint32_t y ) const { return data + size_t( y ) * stride * 4; }
+    [[nodiscard]] bool IsPacked() const { return stride == width; }
+
+    [[nodiscard]] PixelView Sub( uint32_t x, uint32_t y, uint32_t w, uint32_t h ) const
+    {
+        CheckPanic( x + w <= width && y + h <= height, "Invalid view" );
+        return { Row( y ) + size_t( x ) * 4, w, h, stride };
+    }
+
+    const T* data;
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride;
+};
+
+using BitmapView = PixelView<uint8_t>;
+using BitmapHdrView = PixelView<float>;
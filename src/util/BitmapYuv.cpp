@@ -0,0 +1,93 @@
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include "Bitmap.hpp"
+#include "BitmapYuv.hpp"
+#include "PixelPool.hpp"
+#include "TaskDispatch.hpp"
+
+namespace
+{
+// Chroma samples on both sides of a pixel and the weight of the second one. Each chroma sample covers two pixels,
+// its center lying between them, so that the nearer sample gets 3/4 of the weight.
+struct ChromaTap
+{
+    uint32_t i0, i1;
+    float w;
+};
+
+ChromaTap GetTap( uint32_t pos, uint32_t size )
+{
+    const auto k = pos / 2;
+    if( pos & 1 ) return { k, std::min( k + 1, size - 1 ), 0.25f };
+    return { k == 0 ? 0 : k - 1, k, 0.75f };
+}
+
+uint8_t ToByte( float v )
+{
+    return uint8_t( std::clamp( v + 0.5f, 0.f, 255.f ) );
+}
+}
+
+BitmapYuv::BitmapYuv( uint32_t width, uint32_t height, Subsampling subsampling )
+    : m_width( width )
+    , m_height( height )
+    , m_subsampling( subsampling )
+{
+    m_size = CrOffset() + size_t( ChromaWidth() ) * ChromaHeight();
+    m_data = PixelAlloc<uint8_t>( m_size );
+}
+
+BitmapYuv::~BitmapYuv()
+{
+    PixelFree( m_data, m_size );
+}
+
+std::unique_ptr<Bitmap> BitmapYuv::ToBitmap( TaskDispatch* td ) const
+{
+    ZoneScoped;
+
+    auto bmp = std::make_unique<Bitmap>( m_width, m_height );
+    const auto cw = ChromaWidth();
+    const auto ch = ChromaHeight();
+    const auto vertical = m_subsampling == Subsampling::S420;
+
+    auto convert = [this, &bmp, cw, ch, vertical]( size_t begin, size_t end ) {
+        for( size_t y=begin; y<end; y++ )
+        {
+            const auto ty = vertical ? GetTap( uint32_t( y ), ch ) : ChromaTap { uint32_t( y ), uint32_t( y ), 0.f };
+            const auto cb0 = Cb() + size_t( ty.i0 ) * cw;
+            const auto cb1 = Cb() + size_t( ty.i1 ) * cw;
+            const auto cr0 = Cr() + size_t( ty.i0 ) * cw;
+            const auto cr1 = Cr() + size_t( ty.i1 ) * cw;
+            auto src = Y() + y * m_width;
+            auto dst = bmp->Data() + y * m_width * 4;
+            for( uint32_t x=0; x<m_width; x++ )
+            {
+                const auto tx = GetTap( x, cw );
+                const auto cbl = cb0[tx.i0] + ( cb1[tx.i0] - cb0[tx.i0] ) * ty.w;
+                const auto cbr = cb0[tx.i1] + ( cb1[tx.i1] - cb0[tx.i1] ) * ty.w;
+                const auto crl = cr0[tx.i0] + ( cr1[tx.i0] - cr0[tx.i0] ) * ty.w;
+                const auto crr = cr0[tx.i1] + ( cr1[tx.i1] - cr0[tx.i1] ) * ty.w;
+                const auto cb = cbl + ( cbr - cbl ) * tx.w - 128.f;
+                const auto cr = crl + ( crr - crl ) * tx.w - 128.f;
+                const float luma = *src++;
+
+                *dst++ = ToByte( luma + 1.402f * cr );
+                *dst++ = ToByte( luma - 0.344136f * cb - 0.714136f * cr );
+                *dst++ = ToByte( luma + 1.772f * cb );
+                *dst++ = 0xFF;
+            }
+        }
+    };
+
+    if( td )
+    {
+        td->ParallelFor( 0, m_height, TaskDispatch::AdaptiveGrain, convert );
+    }
+    else
+    {
+        convert( 0, m_height );
+    }
+    return bmp;
+}
@@ -0,0 +1,56 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "NoCopy.hpp"
+
+class Bitmap;
+class TaskDispatch;
+
+// 8-bit planar YCbCr with subsampled chroma, as stored in JPEG files: full range BT.601, chroma sited between
+// the luma samples. The planes are tightly packed and stored consecutively, Y first, which takes 1.5 (4:2:0) or
+// 2 (4:2:2) bytes per pixel, instead of the 4 of an RGBA bitmap.
+class BitmapYuv
+{
+public:
+    enum class Subsampling
+    {
+        S420,   // Half width and half height chroma
+        S422    // Half width chroma
+    };
+
+    BitmapYuv( uint32_t width, uint32_t height, Subsampling subsampling );
+    ~BitmapYuv();
+
+    NoCopy( BitmapYuv );
+
+    // Upsamples the chroma with the same triangle filter the GPU conversion and libjpeg use, and converts to RGBA
+    [[nodiscard]] std::unique_ptr<Bitmap> ToBitmap( TaskDispatch* td = nullptr ) const;
+
+    [[nodiscard]] uint32_t Width() const { return m_width; }
+    [[nodiscard]] uint32_t Height() const { return m_height; }
+    [[nodiscard]] uint32_t ChromaWidth() const { return ( m_width + 1 ) / 2; }
+    [[nodiscard]] uint32_t ChromaHeight() const { return m_subsampling == Subsampling::S420 ? ( m_height + 1 ) / 2 : m_height; }
+    [[nodiscard]] Subsampling GetSubsampling() const { return m_subsampling; }
+
+    [[nodiscard]] uint8_t* Y() { return m_data; }
+    [[nodiscard]] uint8_t* Cb() { return m_data + CbOffset(); }
+    [[nodiscard]] uint8_t* Cr() { return m_data + CrOffset(); }
+    [[nodiscard]] const uint8_t* Y() const { return m_data; }
+    [[nodiscard]] const uint8_t* Cb() const { return m_data + CbOffset(); }
+    [[nodiscard]] const uint8_t* Cr() const { return m_data + CrOffset(); }
+
+    [[nodiscard]] size_t CbOffset() const { return size_t( m_width ) * m_height; }
+    [[nodiscard]] size_t CrOffset() const { return CbOffset() + size_t( ChromaWidth() ) * ChromaHeight(); }
+    [[nodiscard]] size_t Size() const { return m_size; }
+    [[nodiscard]] const uint8_t* Data() const { return m_data; }
+
+private:
+    uint32_t m_width;
+    uint32_t m_height;
+    Subsampling m_subsampling;
+    size_t m_size;
+    uint8_t* m_data;
+};
@@ -1,14 +1,18 @@
+#include <condition_variable>
 #include <cxxabi.h>
 #include <format>
+#include <mutex>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string>
 #include <string.h>
+#include <thread>
+#include <vector>
 
 #include "Callstack.hpp"
 #include "Logs.hpp"
+#include "RobinHood.hpp"
 
-static int callstackIdx;
-static bool callstackExternal;
 static bool callstackShowExternal = false;
 
 #ifndef DISABLE_CALLSTACK
@@ -83,8 +87,39 @@ static bool IsPathExternal( const char* path )
     return strncmp( path, "/usr/", 5 ) == 0 || strncmp( path, "/lib/", 5 ) == 0;
 }
 
-static int CallstackCallback( void*, uintptr_t pc, const char* filename, int lineno, const char* function )
+namespace
 {
+struct Frame
+{
+    std::string text;       // Without the frame number
+    bool external;
+};
+
+struct Job
+{
+    CallstackData data;
+    int skip;
+    bool print;     // Otherwise the frames are only resolved, to fill the cache
+};
+
+// An address can resolve to several frames, if functions were inlined into it. Addresses which were seen once are
+// likely to show up again, in the next stack of an error storm.
+constexpr size_t MaxCachedAddresses = 16384;
+
+std::mutex s_symbolLock;        // libbacktrace state is not thread safe, guards the cache too
+unordered_flat_map<uintptr_t, std::vector<Frame>> s_cache;
+
+std::mutex s_queueLock;
+std::condition_variable s_queueCv;
+std::vector<Job> s_queue;
+bool s_busy = false;
+bool s_stop = false;
+std::thread s_symbolizer;
+}
+
+static int CallstackCallback( void* ptr, uintptr_t pc, const char* filename, int lineno, const char* function )
+{
+    auto& frames = *(std::vector<Frame>*)ptr;
     bool isExternal = false;
     std::string msg;
 
@@ -185,21 +220,20 @@ static int CallstackCallback( void*, uintptr_t pc, const char* filename, int lin
             if( path && IsPathExternal( path ) )
             {
                 isExternal = true;
-                callstackExternal = true;
             }
             if( lineno )
             {
-                msg = std::format( "{}. {} [{}:{}]", callstackIdx++, func, path ? path : filename, lineno );
+                msg = std::format( "{} [{}:{}]", func, path ? path : filename, lineno );
             }
             else
             {
-                msg = std::format( "{}. {} [{}]", callstackIdx++, func, path ? path : filename );
+                msg = std::format( "{} [{}]", func, path ? path : filename );
             }
             free( path );
         }
         else
         {
-            msg = std::format( "{}. {}", callstackIdx++, func );
+            msg = std::string( func );
         }
 
         free( demangled );
@@ -211,59 +245,152 @@ static int CallstackCallback( void*, uintptr_t pc, const char* filename, int lin
         if( path && IsPathExternal( path ) )
         {
             isExternal = true;
-            callstackExternal = true;
         }
         if( lineno )
         {
-            msg = std::format( "{}. <unknown> [{}:{}]", callstackIdx++, path ? path : filename, lineno );
+            msg = std::format( "<unknown> [{}:{}]", path ? path : filename, lineno );
         }
         else
         {
-            msg = std::format( "{}. <unknown> [{}]", callstackIdx++, path ? path : filename );
+            msg = std::format( "<unknown> [{}]", path ? path : filename );
         }
         free( path );
     }
     else
     {
         isExternal = true;
-        callstackExternal = true;
-        msg = std::format( "{}. <unknown> (0x{:x})", callstackIdx++, pc );
+        msg = std::format( "<unknown> (0x{:x})", pc );
     }
 
-    if( callstackShowExternal )
+    frames.emplace_back( Frame { std::move( msg ), isExternal } );
+    return 0;
+}
+
+static void CallstackError( void* ptr, const char* msg, int errnum )
+{
+    auto& frames = *(std::vector<Frame>*)ptr;
+    frames.emplace_back( Frame { std::format( "Callstack error {}: {}", errnum, msg ), false } );
+}
+
+// Must be called with s_symbolLock held
+static const std::vector<Frame>& Resolve( uintptr_t pc )
+{
+    static auto state = backtrace_create_state( nullptr, 0, nullptr, nullptr );
+
+    auto it = s_cache.find( pc );
+    if( it != s_cache.end() ) return it->second;
+
+    std::vector<Frame> frames;
+    backtrace_pcinfo( state, pc, CallstackCallback, CallstackError, &frames );
+    if( s_cache.size() >= MaxCachedAddresses ) s_cache.clear();
+    return s_cache.emplace( pc, std::move( frames ) ).first->second;
+}
+
+// Runs of external frames are shown as an ellipsis, unless they are to be shown
+static std::vector<std::string> Symbolize( const CallstackData& data, int skip )
+{
+    std::vector<std::string> lines;
+    lines.emplace_back( "Callstack:" );
+
+    std::lock_guard lock( s_symbolLock );
+    int idx = 0;
+    bool external = false;
+    for( int i = skip; i < data.count; i++ )
     {
-        mclog( LogLevel::Callstack, "%s", msg.c_str() );
+        for( auto& frame : Resolve( (uintptr_t)data.addr[i] ) )
+        {
+            if( frame.external ) external = true;
+            if( callstackShowExternal )
+            {
+                lines.emplace_back( std::format( "{}. {}", idx, frame.text ) );
+            }
+            else if( !frame.external )
+            {
+                if( external )
+                {
+                    lines.emplace_back( "…" );
+                    external = false;
+                }
+                lines.emplace_back( std::format( "{}. {}", idx, frame.text ) );
+            }
+            idx++;
+        }
     }
-    else if( !isExternal )
+    return lines;
+}
+
+static void Print( const std::vector<std::string>& lines )
+{
+    for( auto& line : lines ) mclog( LogLevel::Callstack, "%s", line.c_str() );
+}
+
+static void SymbolizerThread()
+{
+    std::unique_lock lock( s_queueLock );
+    for(;;)
     {
-        if( callstackExternal )
+        s_queueCv.wait( lock, [] { return s_stop || !s_queue.empty(); } );
+        if( s_queue.empty() ) break;
+
+        auto jobs = std::move( s_queue );
+        s_queue.clear();
+        s_busy = true;
+        lock.unlock();
+        for( auto& job : jobs )
         {
-            mclog( LogLevel::Callstack, "…" );
-            callstackExternal = false;
+            auto lines = Symbolize( job.data, job.skip );
+            if( job.print ) Print( lines );
         }
-        mclog( LogLevel::Callstack, "%s", msg.c_str() );
+        lock.lock();
+        s_busy = false;
+        s_queueCv.notify_all();
     }
+}
 
-    return 0;
+// Pending callstacks are still printed
+static void StopSymbolizer()
+{
+    {
+        std::lock_guard lock( s_queueLock );
+        s_stop = true;
+    }
+    s_queueCv.notify_all();
+    s_symbolizer.join();
 }
 
-static void CallstackError( void*, const char* msg, int errnum )
+static void Queue( const CallstackData& data, int skip, bool print )
 {
-    mclog( LogLevel::Callstack, "Callstack error %i: %s", errnum, msg );
+    std::lock_guard lock( s_queueLock );
+    if( !s_symbolizer.joinable() )
+    {
+        // Runs before the destructor of the thread object, which was constructed earlier
+        atexit( StopSymbolizer );
+        s_symbolizer = std::thread( SymbolizerThread );
+    }
+    s_queue.emplace_back( Job { data, skip, print } );
+    s_queueCv.notify_one();
 }
 
 void PrintCallstack( const CallstackData& data, int skip )
 {
-    mclog( LogLevel::Callstack, "Callstack:" );
+    Print( Symbolize( data, skip ) );
+}
 
-    static auto state = backtrace_create_state( nullptr, 0, nullptr, nullptr );
-    callstackIdx = 0;
-    callstackExternal = false;
+void PrintCallstackDeferred( const CallstackData& data, int skip )
+{
+    Queue( data, skip, true );
+}
 
-    for( int i = skip; i < data.count; i++ )
-    {
-        backtrace_pcinfo( state, (uintptr_t)data.addr[i], CallstackCallback, CallstackError, nullptr );
-    }
+void WarmCallstacks()
+{
+    GetCallstack( stack );
+    Queue( stack, 0, false );
+}
+
+void FlushCallstacks()
+{
+    std::unique_lock lock( s_queueLock );
+    s_queueCv.wait( lock, [] { return s_queue.empty() && !s_busy; } );
 }
 
 #else
@@ -272,6 +399,18 @@ void PrintCallstack( const CallstackData& data, int skip )
 {
 }
 
+void PrintCallstackDeferred( const CallstackData& data, int skip )
+{
+}
+
+void WarmCallstacks()
+{
+}
+
+void FlushCallstacks()
+{
+}
+
 #endif
 
 void ShowExternalCallstacks( bool show )
@@ -12,5 +12,12 @@ struct CallstackData
     CallstackData name; \
     name.count = backtrace( name.addr, 64 );
 
+// Symbols are cached by address, as reading the debug info for an address the first time is slow
 [[maybe_unused]] void PrintCallstack( const CallstackData& data, int skip = 0 );
+// Symbolized and printed later on a thread of its own, so that the caller doesn't wait for it
+void PrintCallstackDeferred( const CallstackData& data, int skip = 0 );
+// Loads the debug info in the background, so that the first callstack is not slow to print
+void WarmCallstacks();
+// Waits until the deferred callstacks were printed
+void FlushCallstacks();
 void ShowExternalCallstacks( bool show );
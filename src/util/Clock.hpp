@@ -1,8 +1,22 @@
 #pragma once
 
+#include <algorithm>
 #include <chrono>
+#include <vector>
 
 [[maybe_unused]] static inline uint64_t GetTimeMicro()
 {
     return std::chrono::duration_cast<std::chrono::microseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
 }
+
+// Runs f once to warm up, then returns the median of what it returns over the measured runs, which would be the
+// time each run took
+template<typename F>
+[[nodiscard]] double MeasureMedian( int repeats, F&& f )
+{
+    f();
+    std::vector<double> times;
+    for( int i=0; i<repeats; i++ ) times.emplace_back( f() );
+    std::ranges::sort( times );
+    return times[times.size() / 2];
+}
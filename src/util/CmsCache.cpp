@@ -0,0 +1,96 @@
+#include <algorithm>
+#include <mutex>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+#include <vector>
+
+#include "CmsCache.hpp"
+#include "Md5.hpp"
+
+namespace
+{
+struct Entry
+{
+    CmsCache::Key key;
+    CmsCache::Transform transform;
+};
+
+// A handful of profiles covers what is being viewed at any one time
+constexpr size_t MaxEntries = 32;
+
+std::mutex s_lock;
+std::vector<Entry> s_cache;     // Most recently used last
+
+CmsCache::Transform Find( const CmsCache::Key& key )
+{
+    auto it = std::find_if( s_cache.begin(), s_cache.end(), [&key]( const auto& e ) { return e.key == key; } );
+    if( it == s_cache.end() ) return nullptr;
+    std::rotate( it, it + 1, s_cache.end() );
+    return s_cache.back().transform;
+}
+}
+
+namespace CmsCache
+{
+
+ProfileId Id( const void* data, size_t size )
+{
+    return Md5( data, size );
+}
+
+ProfileId Id( const char* name, const void* params, size_t size )
+{
+    const auto len = strlen( name );
+    std::vector<uint8_t> buf( len + 1 + size );
+    memcpy( buf.data(), name, len + 1 );
+    if( size > 0 ) memcpy( buf.data() + len + 1, params, size );
+    return Md5( buf.data(), buf.size() );
+}
+
+Transform Get( const Key& key, const std::function<cmsHTRANSFORM()>& create )
+{
+    ZoneScoped;
+
+    {
+        std::lock_guard lock( s_lock );
+        if( auto transform = Find( key ) ) return transform;
+    }
+
+    // Built outside of the lock, so that cache hits on other threads do not wait for it
+    auto raw = create();
+    if( !raw ) return nullptr;
+    Transform transform( raw, cmsDeleteTransform );
+
+    std::lock_guard lock( s_lock );
+    if( auto cached = Find( key ) ) return cached;
+    if( s_cache.size() >= MaxEntries ) s_cache.erase( s_cache.begin() );
+    s_cache.emplace_back( Entry { key, transform } );
+    return transform;
+}
+
+Transform Get( const Key& key, const std::function<cmsHPROFILE()>& openIn, const std::function<cmsHPROFILE()>& openOut )
+{
+    return Get( key, [&] {
+        cmsHTRANSFORM transform = nullptr;
+        auto profileIn = openIn();
+        auto profileOut = openOut();
+        if( profileIn && profileOut ) transform = cmsCreateTransform( profileIn, key.inFormat, profileOut, key.outFormat, key.intent, key.flags );
+        if( profileOut ) cmsCloseProfile( profileOut );
+        if( profileIn ) cmsCloseProfile( profileIn );
+        return transform;
+    } );
+}
+
+void Clear()
+{
+    std::lock_guard lock( s_lock );
+    s_cache.clear();
+}
+
+size_t Size()
+{
+    std::lock_guard lock( s_lock );
+    return s_cache.size();
+}
+
+}
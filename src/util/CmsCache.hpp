@@ -0,0 +1,48 @@
+#pragma once
+
+#include <array>
+#include <functional>
+#include <lcms2.h>
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+
+// Process-wide cache of lcms2 transforms. Building the profiles and a transform takes milliseconds, which
+// adds up when consecutive images share a profile, e.g. photos from one camera. Cached transforms are used
+// from many threads at once. This is safe, as cmsDoTransform() works on a copy of the transform's pixel cache.
+namespace CmsCache
+{
+
+// Identifies a profile by the ICC data, or for built-in profiles, by what they are made from
+using ProfileId = std::array<uint8_t, 16>;
+
+[[nodiscard]] ProfileId Id( const void* data, size_t size );
+[[nodiscard]] ProfileId Id( const char* name, const void* params = nullptr, size_t size = 0 );
+
+struct Key
+{
+    ProfileId in;
+    ProfileId out;
+    cmsUInt32Number inFormat;
+    cmsUInt32Number outFormat;
+    cmsUInt32Number intent;
+    cmsUInt32Number flags;
+
+    bool operator==( const Key& ) const = default;
+};
+
+using Transform = std::shared_ptr<void>;
+
+// Returns the cached transform, or one made with create on a miss. Create may return nullptr, which is
+// passed on and not cached. Least recently used transforms are dropped once the cache is full; transforms are
+// freed when the last user lets go of them.
+[[nodiscard]] Transform Get( const Key& key, const std::function<cmsHTRANSFORM()>& create );
+
+// As above, with the transform made from the key's formats, intent and flags. The profiles are only opened
+// on a miss, and closed once the transform is made.
+[[nodiscard]] Transform Get( const Key& key, const std::function<cmsHPROFILE()>& openIn, const std::function<cmsHPROFILE()>& openOut );
+
+void Clear();
+[[nodiscard]] size_t Size();
+
+}
@@ -0,0 +1,210 @@
+#if defined __SSE2__
+#  include <x86intrin.h>
+#elif defined __ARM_NEON
+#  include <arm_neon.h>
+#endif
+
+#include "contrib/half.hpp"
+
+#include "ColorMatrix.hpp"
+#include "Colorspace.hpp"
+
+namespace
+{
+void Invert3x3( const double m[3][3], double inv[3][3] )
+{
+    const auto det =
+        m[0][0] * ( m[1][1] * m[2][2] - m[1][2] * m[2][1] ) -
+        m[0][1] * ( m[1][0] * m[2][2] - m[1][2] * m[2][0] ) +
+        m[0][2] * ( m[1][0] * m[2][1] - m[1][1] * m[2][0] );
+    const auto id = 1 / det;
+
+    inv[0][0] = ( m[1][1] * m[2][2] - m[1][2] * m[2][1] ) * id;
+    inv[0][1] = ( m[0][2] * m[2][1] - m[0][1] * m[2][2] ) * id;
+    inv[0][2] = ( m[0][1] * m[1][2] - m[0][2] * m[1][1] ) * id;
+    inv[1][0] = ( m[1][2] * m[2][0] - m[1][0] * m[2][2] ) * id;
+    inv[1][1] = ( m[0][0] * m[2][2] - m[0][2] * m[2][0] ) * id;
+    inv[1][2] = ( m[0][2] * m[1][0] - m[0][0] * m[1][2] ) * id;
+    inv[2][0] = ( m[1][0] * m[2][1] - m[1][1] * m[2][0] ) * id;
+    inv[2][1] = ( m[0][1] * m[2][0] - m[0][0] * m[2][1] ) * id;
+    inv[2][2] = ( m[0][0] * m[1][1] - m[0][1] * m[1][0] ) * id;
+}
+
+// Linear RGB to XYZ, for the given primaries and white point
+void RgbToXyz( const cmsCIExyYTRIPLE& primaries, const cmsCIExyY& white, double m[3][3] )
+{
+    const cmsCIExyY* p[3] = { &primaries.Red, &primaries.Green, &primaries.Blue };
+
+    double pm[3][3];
+    for( int i=0; i<3; i++ )
+    {
+        pm[0][i] = p[i]->x / p[i]->y;
+        pm[1][i] = 1;
+        pm[2][i] = ( 1 - p[i]->x - p[i]->y ) / p[i]->y;
+    }
+
+    // Scale the primaries so that they add up to the white point
+    double inv[3][3];
+    Invert3x3( pm, inv );
+    const double w[3] = { white.x / white.y, 1, ( 1 - white.x - white.y ) / white.y };
+    for( int i=0; i<3; i++ )
+    {
+        const auto s = inv[i][0] * w[0] + inv[i][1] * w[1] + inv[i][2] * w[2];
+        for( int j=0; j<3; j++ ) m[j][i] = pm[j][i] * s;
+    }
+}
+}
+
+ColorMatrix MakeColorMatrix( const cmsCIExyYTRIPLE& from, const cmsCIExyYTRIPLE& to )
+{
+    double a[3][3], b[3][3], binv[3][3];
+    RgbToXyz( from, white709, a );
+    RgbToXyz( to, white709, b );
+    Invert3x3( b, binv );
+
+    ColorMatrix ret = {};
+    for( int i=0; i<3; i++ )
+    {
+        for( int j=0; j<3; j++ )
+        {
+            ret.col[j][i] = binv[i][0] * a[0][j] + binv[i][1] * a[1][j] + binv[i][2] * a[2][j];
+        }
+    }
+    ret.col[3][3] = 1;
+    return ret;
+}
+
+void ApplyColorMatrix( const ColorMatrix& m, float* ptr, size_t sz )
+{
+#ifdef __AVX512F__
+    {
+        const auto c0 = _mm512_broadcast_f32x4( _mm_load_ps( m.col[0] ) );
+        const auto c1 = _mm512_broadcast_f32x4( _mm_load_ps( m.col[1] ) );
+        const auto c2 = _mm512_broadcast_f32x4( _mm_load_ps( m.col[2] ) );
+        const auto c3 = _mm512_broadcast_f32x4( _mm_load_ps( m.col[3] ) );
+        while( sz >= 4 )
+        {
+            const auto v = _mm512_loadu_ps( ptr );
+            auto r = _mm512_mul_ps( _mm512_permute_ps( v, 0x00 ), c0 );
+            r = _mm512_fmadd_ps( _mm512_permute_ps( v, 0x55 ), c1, r );
+            r = _mm512_fmadd_ps( _mm512_permute_ps( v, 0xAA ), c2, r );
+            r = _mm512_fmadd_ps( _mm512_permute_ps( v, 0xFF ), c3, r );
+            _mm512_storeu_ps( ptr, r );
+            ptr += 16;
+            sz -= 4;
+        }
+    }
+#endif
+#if defined __AVX2__ && defined __FMA__
+    {
+        const auto c0 = _mm256_broadcast_ps( (const __m128*)m.col[0] );
+        const auto c1 = _mm256_broadcast_ps( (const __m128*)m.col[1] );
+        const auto c2 = _mm256_broadcast_ps( (const __m128*)m.col[2] );
+        const auto c3 = _mm256_broadcast_ps( (const __m128*)m.col[3] );
+        while( sz >= 2 )
+        {
+            const auto v = _mm256_loadu_ps( ptr );
+            auto r = _mm256_mul_ps( _mm256_permute_ps( v, 0x00 ), c0 );
+            r = _mm256_fmadd_ps( _mm256_permute_ps( v, 0x55 ), c1, r );
+            r = _mm256_fmadd_ps( _mm256_permute_ps( v, 0xAA ), c2, r );
+            r = _mm256_fmadd_ps( _mm256_permute_ps( v, 0xFF ), c3, r );
+            _mm256_storeu_ps( ptr, r );
+            ptr += 8;
+            sz -= 2;
+        }
+    }
+#endif
+#if defined __SSE2__
+    const auto c0 = _mm_load_ps( m.col[0] );
+    const auto c1 = _mm_load_ps( m.col[1] );
+    const auto c2 = _mm_load_ps( m.col[2] );
+    const auto c3 = _mm_load_ps( m.col[3] );
+    while( sz > 0 )
+    {
+        const auto v = _mm_loadu_ps( ptr );
+        auto r = _mm_mul_ps( _mm_shuffle_ps( v, v, 0x00 ), c0 );
+        r = _mm_add_ps( r, _mm_mul_ps( _mm_shuffle_ps( v, v, 0x55 ), c1 ) );
+        r = _mm_add_ps( r, _mm_mul_ps( _mm_shuffle_ps( v, v, 0xAA ), c2 ) );
+        r = _mm_add_ps( r, _mm_mul_ps( _mm_shuffle_ps( v, v, 0xFF ), c3 ) );
+        _mm_storeu_ps( ptr, r );
+        ptr += 4;
+        sz--;
+    }
+#elif defined __ARM_NEON
+    const auto c0 = vld1q_f32( m.col[0] );
+    const auto c1 = vld1q_f32( m.col[1] );
+    const auto c2 = vld1q_f32( m.col[2] );
+    const auto c3 = vld1q_f32( m.col[3] );
+    while( sz > 0 )
+    {
+        const auto v = vld1q_f32( ptr );
+        auto r = vmulq_laneq_f32( c0, v, 0 );
+        r = vfmaq_laneq_f32( r, c1, v, 1 );
+        r = vfmaq_laneq_f32( r, c2, v, 2 );
+        r = vfmaq_laneq_f32( r, c3, v, 3 );
+        vst1q_f32( ptr, r );
+        ptr += 4;
+        sz--;
+    }
+#else
+    while( sz > 0 )
+    {
+        const float r = ptr[0];
+        const float g = ptr[1];
+        const float b = ptr[2];
+        for( int i=0; i<3; i++ ) ptr[i] = r * m.col[0][i] + g * m.col[1][i] + b * m.col[2][i];
+        ptr += 4;
+        sz--;
+    }
+#endif
+}
+
+void ApplyColorMatrix( const ColorMatrix& m, half_float::half* ptr, size_t sz )
+{
+#if defined __F16C__ && defined __AVX512F__
+    {
+        const auto c0 = _mm512_broadcast_f32x4( _mm_load_ps( m.col[0] ) );
+        const auto c1 = _mm512_broadcast_f32x4( _mm_load_ps( m.col[1] ) );
+        const auto c2 = _mm512_broadcast_f32x4( _mm_load_ps( m.col[2] ) );
+        const auto c3 = _mm512_broadcast_f32x4( _mm_load_ps( m.col[3] ) );
+        while( sz >= 4 )
+        {
+            const auto v = _mm512_cvtph_ps( _mm256_loadu_si256( (const __m256i*)ptr ) );
+            auto r = _mm512_mul_ps( _mm512_permute_ps( v, 0x00 ), c0 );
+            r = _mm512_fmadd_ps( _mm512_permute_ps( v, 0x55 ), c1, r );
+            r = _mm512_fmadd_ps( _mm512_permute_ps( v, 0xAA ), c2, r );
+            r = _mm512_fmadd_ps( _mm512_permute_ps( v, 0xFF ), c3, r );
+            _mm256_storeu_si256( (__m256i*)ptr, _mm512_cvtps_ph( r, _MM_FROUND_TO_NEAREST_INT ) );
+            ptr += 16;
+            sz -= 4;
+        }
+    }
+#endif
+#if defined __F16C__ && defined __AVX2__ && defined __FMA__
+    {
+        const auto c0 = _mm256_broadcast_ps( (const __m128*)m.col[0] );
+        const auto c1 = _mm256_broadcast_ps( (const __m128*)m.col[1] );
+        const auto c2 = _mm256_broadcast_ps( (const __m128*)m.col[2] );
+        const auto c3 = _mm256_broadcast_ps( (const __m128*)m.col[3] );
+        while( sz >= 2 )
+        {
+            const auto v = _mm256_cvtph_ps( _mm_loadu_si128( (const __m128i*)ptr ) );
+            auto r = _mm256_mul_ps( _mm256_permute_ps( v, 0x00 ), c0 );
+            r = _mm256_fmadd_ps( _mm256_permute_ps( v, 0x55 ), c1, r );
+            r = _mm256_fmadd_ps( _mm256_permute_ps( v, 0xAA ), c2, r );
+            r = _mm256_fmadd_ps( _mm256_permute_ps( v, 0xFF ), c3, r );
+            _mm_storeu_si128( (__m128i*)ptr, _mm256_cvtps_ph( r, _MM_FROUND_TO_NEAREST_INT ) );
+            ptr += 8;
+            sz -= 2;
+        }
+    }
+#endif
+    while( sz > 0 )
+    {
+        float px[4] = { float( ptr[0] ), float( ptr[1] ), float( ptr[2] ), float( ptr[3] ) };
+        ApplyColorMatrix( m, px, 1 );
+        for( int i=0; i<3; i++ ) ptr[i] = half_float::half( px[i] );
+        ptr += 4;
+        sz--;
+    }
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <lcms2.h>
+#include <stddef.h>
+
+namespace half_float { class half; }
+
+// Change of primaries between linear RGB colorspaces sharing the D65 white point. Column c holds the
+// contribution of input channel c to each output channel. Alpha passes through.
+struct ColorMatrix
+{
+    alignas( 16 ) float col[4][4];
+};
+
+[[nodiscard]] ColorMatrix MakeColorMatrix( const cmsCIExyYTRIPLE& from, const cmsCIExyYTRIPLE& to );
+
+// Converts sz RGBA pixels in place. Half float pixels are widened to float for the math, a few at a time.
+void ApplyColorMatrix( const ColorMatrix& m, float* ptr, size_t sz );
+void ApplyColorMatrix( const ColorMatrix& m, half_float::half* ptr, size_t sz );
@@ -38,14 +38,14 @@ std::string Config::GetPath( const char* name )
     return path;
 }
 
-const char* Config::GetString( const char* section, const char* key, const char* def )
+const char* Config::GetString( const char* section, const char* key, const char* def ) const
 {
     if( !m_config ) return def;
     auto val = ini_get( m_config, section, key );
     return val ? val : def;
 }
 
-int Config::GetInt( const char* section, const char* key, int def )
+int Config::GetInt( const char* section, const char* key, int def ) const
 {
     if( !m_config ) return def;
     auto val = ini_get( m_config, section, key );
@@ -55,7 +55,7 @@ int Config::GetInt( const char* section, const char* key, int def )
     return (end == val) ? def : num;
 }
 
-uint32_t Config::GetUInt( const char* section, const char* key, uint32_t def )
+uint32_t Config::GetUInt( const char* section, const char* key, uint32_t def ) const
 {
     if( !m_config ) return def;
     auto val = ini_get( m_config, section, key );
@@ -65,14 +65,14 @@ uint32_t Config::GetUInt( const char* section, const char* key, uint32_t def )
     return (end == val) ? def : num;
 }
 
-bool Config::GetOptString( const char* section, const char* key, const char*& output )
+bool Config::GetOptString( const char* section, const char* key, const char*& output ) const
 {
     if( !m_config ) return false;
     output = ini_get( m_config, section, key );
     return output != nullptr;
 }
 
-bool Config::GetOptInt( const char* section, const char* key, int& output )
+bool Config::GetOptInt( const char* section, const char* key, int& output ) const
 {
     if( !m_config ) return false;
     auto val = ini_get( m_config, section, key );
@@ -82,7 +82,7 @@ bool Config::GetOptInt( const char* section, const char* key, int& output )
     return (end != val);
 }
 
-bool Config::GetOptUInt( const char* section, const char* key, uint32_t& output )
+bool Config::GetOptUInt( const char* section, const char* key, uint32_t& output ) const
 {
     if( !m_config ) return false;
     auto val = ini_get( m_config, section, key );
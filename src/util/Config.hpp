@@ -21,40 +21,40 @@ public:
     explicit operator bool() const { return m_config; }
 
     template<typename T>
-    T Get( const char* section, const char* key, T defaultVal );
+    T Get( const char* section, const char* key, T defaultVal ) const;
 
     // "Optional"
     template<typename T>
-    bool GetOpt( const char* section, const char* key, T& output );
+    bool GetOpt( const char* section, const char* key, T& output ) const;
 
     static std::string GetPath( const char* name = "" );
 
 private:
-    const char* GetString( const char* section, const char* key, const char* def );
-    int GetInt( const char* section, const char* key, int def );
-    uint32_t GetUInt( const char* section, const char* key, uint32_t def );
+    const char* GetString( const char* section, const char* key, const char* def ) const;
+    int GetInt( const char* section, const char* key, int def ) const;
+    uint32_t GetUInt( const char* section, const char* key, uint32_t def ) const;
 
-    bool GetOptString( const char* section, const char* key, const char*& output );
-    bool GetOptInt( const char* section, const char* key, int& output );
-    bool GetOptUInt( const char* section, const char* key, uint32_t& output );
+    bool GetOptString( const char* section, const char* key, const char*& output ) const;
+    bool GetOptInt( const char* section, const char* key, int& output ) const;
+    bool GetOptUInt( const char* section, const char* key, uint32_t& output ) const;
 
     ini_t* m_config;
 };
 
 template<>
-inline const char* Config::Get( const char* s, const char* k, const char* v ) { return GetString( s, k, v ); }
+inline const char* Config::Get( const char* s, const char* k, const char* v ) const { return GetString( s, k, v ); }
 
 template<>
-inline int Config::Get( const char* s, const char* k, int v ) { return GetInt( s, k, v ); }
+inline int Config::Get( const char* s, const char* k, int v ) const { return GetInt( s, k, v ); }
 
 template<>
-inline uint32_t Config::Get( const char* s, const char* k, uint32_t v ) { return GetUInt( s, k, v ); }
+inline uint32_t Config::Get( const char* s, const char* k, uint32_t v ) const { return GetUInt( s, k, v ); }
 
 template<>
-inline bool Config::GetOpt( const char* s, const char* k, const char*& v ) { return GetOptString( s, k, v ); }
+inline bool Config::GetOpt( const char* s, const char* k, const char*& v ) const { return GetOptString( s, k, v ); }
 
 template<>
-inline bool Config::GetOpt( const char* s, const char* k, int& v ) { return GetOptInt( s, k, v ); }
+inline bool Config::GetOpt( const char* s, const char* k, int& v ) const { return GetOptInt( s, k, v ); }
 
 template<>
-inline bool Config::GetOpt( const char* s, const char* k, uint32_t& v ) { return GetOptUInt( s, k, v ); }
+inline bool Config::GetOpt( const char* s, const char* k, uint32_t& v ) const { return GetOptUInt( s, k, v ); }
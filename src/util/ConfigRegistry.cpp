@@ -0,0 +1,149 @@
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/inotify.h>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+
+#include "ConfigRegistry.hpp"
+#include "util/Logs.hpp"
+
+namespace
+{
+// Editors either write the file in place, or write a new one and rename it over the old one
+constexpr uint32_t WatchMask = IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE;
+
+// Null if the key is missing, or the file could not be read
+const char* Value( const Config& config, const std::string& section, const std::string& key )
+{
+    const char* value;
+    return config.GetOpt( section.c_str(), key.c_str(), value ) ? value : nullptr;
+}
+
+bool Changed( const char* a, const char* b )
+{
+    if( !a || !b ) return a != b;
+    return strcmp( a, b ) != 0;
+}
+}
+
+ConfigRegistry::ConfigRegistry()
+    : m_inotify( inotify_init1( IN_NONBLOCK | IN_CLOEXEC ) )
+{
+    if( m_inotify < 0 ) mclog( LogLevel::Warning, "Config files won't be reloaded, inotify is not available: %s", strerror( errno ) );
+}
+
+ConfigRegistry::~ConfigRegistry()
+{
+    if( m_inotify >= 0 ) close( m_inotify );
+}
+
+ConfigRegistry& ConfigRegistry::Instance()
+{
+    static ConfigRegistry registry;
+    return registry;
+}
+
+std::shared_ptr<const Config> ConfigRegistry::Get( const char* name )
+{
+    std::lock_guard lock( m_lock );
+    return Load( name ).config;
+}
+
+int ConfigRegistry::Subscribe( const char* name, const char* section, const char* key, Callback callback )
+{
+    std::lock_guard lock( m_lock );
+    Load( name );
+    const auto id = m_subscriberId++;
+    m_subscribers.emplace_back( Subscriber { id, name, section, key, std::make_shared<Callback>( std::move( callback ) ) } );
+    return id;
+}
+
+void ConfigRegistry::Unsubscribe( int id )
+{
+    std::lock_guard lock( m_lock );
+    std::erase_if( m_subscribers, [id]( const auto& s ) { return s.id == id; } );
+}
+
+void ConfigRegistry::Dispatch()
+{
+    ZoneScoped;
+
+    // Several events for a file usually come together, it's only read once for all of them
+    std::vector<std::string> changed;
+    alignas( inotify_event ) char buf[4096];
+    for(;;)
+    {
+        const auto size = read( m_inotify, buf, sizeof( buf ) );
+        if( size <= 0 ) break;
+
+        std::lock_guard lock( m_lock );
+        for( ssize_t pos = 0; pos < size; )
+        {
+            const auto event = (const inotify_event*)( buf + pos );
+            pos += sizeof( inotify_event ) + event->len;
+            if( event->len == 0 ) continue;
+
+            auto dir = m_dirs.find( event->wd );
+            if( dir == m_dirs.end() ) continue;
+            const auto path = dir->second + "/" + event->name;
+            for( auto& [name, file] : m_files )
+            {
+                if( file.path == path && std::ranges::find( changed, name ) == changed.end() ) changed.emplace_back( name );
+            }
+        }
+    }
+
+    for( auto& name : changed ) Reload( name );
+}
+
+ConfigRegistry::File& ConfigRegistry::Load( const std::string& name )
+{
+    auto it = m_files.find( name );
+    if( it != m_files.end() ) return it->second;
+
+    auto path = Config::GetPath( name.c_str() );
+    if( m_inotify >= 0 )
+    {
+        const auto slash = path.rfind( '/' );
+        const auto dir = slash == std::string::npos ? std::string( "." ) : path.substr( 0, slash );
+
+        // The same directory gets the same watch descriptor
+        const auto wd = inotify_add_watch( m_inotify, dir.c_str(), WatchMask );
+        if( wd >= 0 )
+        {
+            m_dirs.emplace( wd, dir );
+        }
+        else
+        {
+            mclog( LogLevel::Debug, "Not watching %s for config changes: %s", dir.c_str(), strerror( errno ) );
+        }
+    }
+
+    auto config = std::make_shared<const Config>( name );
+    return m_files.emplace( name, File { std::move( path ), std::move( config ) } ).first->second;
+}
+
+// Parsing is done without the lock held, and the callbacks are called without it
+void ConfigRegistry::Reload( const std::string& name )
+{
+    mclog( LogLevel::Info, "Reloading config file %s", name.c_str() );
+    auto config = std::make_shared<const Config>( name );
+
+    std::vector<std::shared_ptr<Callback>> notify;
+    {
+        std::lock_guard lock( m_lock );
+        auto it = m_files.find( name );
+        if( it == m_files.end() ) return;
+        auto old = std::move( it->second.config );
+        it->second.config = config;
+
+        for( auto& s : m_subscribers )
+        {
+            if( s.name != name ) continue;
+            if( Changed( Value( *old, s.section, s.key ), Value( *config, s.section, s.key ) ) ) notify.emplace_back( s.callback );
+        }
+    }
+
+    for( auto& callback : notify ) ( *callback )( *config );
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include "Config.hpp"
+#include "NoCopy.hpp"
+#include "RobinHood.hpp"
+
+// Parsed config files, shared by the whole process, so that each file is read only once. Files are watched with
+// inotify on the directory they are in, and read again when they are written, replaced or removed.
+//
+// Reloads are done by Dispatch(), once Descriptor() becomes readable, e.g. in an EventLoop. Subscribers are then
+// called on that thread, if the value of the key they subscribed to has changed. Everything else is thread safe.
+class ConfigRegistry
+{
+public:
+    using Callback = std::function<void( const Config& config )>;
+
+    ConfigRegistry();
+    ~ConfigRegistry();
+
+    NoCopy( ConfigRegistry );
+
+    static ConfigRegistry& Instance();
+
+    // Name as given to Config. The returned config is not changed by reloads, it just stops being the current one.
+    [[nodiscard]] std::shared_ptr<const Config> Get( const char* name );
+
+    // Returns an id for Unsubscribe(). The callback is not called for the current contents of the file.
+    [[nodiscard]] int Subscribe( const char* name, const char* section, const char* key, Callback callback );
+    void Unsubscribe( int id );
+
+    // Negative if inotify is not available, in which case files are never reloaded
+    [[nodiscard]] int Descriptor() const { return m_inotify; }
+    void Dispatch();
+
+private:
+    struct File
+    {
+        std::string path;
+        std::shared_ptr<const Config> config;
+    };
+
+    struct Subscriber
+    {
+        int id;
+        std::string name;
+        std::string section;
+        std::string key;
+        std::shared_ptr<Callback> callback;
+    };
+
+    File& Load( const std::string& name );
+    void Reload( const std::string& name );
+
+    int m_inotify;
+
+    std::mutex m_lock;
+    unordered_flat_map<std::string, File> m_files;      // By name
+    unordered_flat_map<int, std::string> m_dirs;        // By watch descriptor
+    std::vector<Subscriber> m_subscribers;
+    int m_subscriberId = 0;
+};
@@ -0,0 +1,105 @@
+#include <algorithm>
+#include <ctype.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "CpuTopology.hpp"
+
+static bool ReadSysfsValue( uint32_t cpu, const char* file, uint64_t& value )
+{
+    char path[128];
+    snprintf( path, sizeof( path ), "/sys/devices/system/cpu/cpu%u/%s", cpu, file );
+    auto f = fopen( path, "r" );
+    if( !f ) return false;
+    unsigned long long tmp;
+    const auto ok = fscanf( f, "%llu", &tmp ) == 1;
+    fclose( f );
+    if( ok ) value = tmp;
+    return ok;
+}
+
+std::vector<uint32_t> ParseCpuList( const char* str )
+{
+    std::vector<uint32_t> ret;
+    if( !str ) return ret;
+
+    auto ptr = str;
+    for(;;)
+    {
+        while( isspace( *ptr ) ) ptr++;
+        if( !isdigit( *ptr ) ) return {};
+
+        char* end;
+        const auto first = strtoul( ptr, &end, 10 );
+        auto last = first;
+        ptr = end;
+        if( *ptr == '-' )
+        {
+            ptr++;
+            if( !isdigit( *ptr ) ) return {};
+            last = strtoul( ptr, &end, 10 );
+            ptr = end;
+            if( last < first ) return {};
+        }
+        for( auto i=first; i<=last; i++ ) ret.emplace_back( i );
+
+        while( isspace( *ptr ) ) ptr++;
+        if( *ptr == '\0' ) break;
+        if( *ptr != ',' ) return {};
+        ptr++;
+    }
+
+    std::ranges::sort( ret );
+    const auto dup = std::ranges::unique( ret );
+    ret.erase( dup.begin(), dup.end() );
+    return ret;
+}
+
+std::vector<std::vector<uint32_t>> GetCpuClasses()
+{
+    cpu_set_t set;
+    if( sched_getaffinity( 0, sizeof( set ), &set ) != 0 ) return {};
+
+    struct Cpu
+    {
+        uint32_t id;
+        uint64_t capacity;
+    };
+    std::vector<Cpu> cpus;
+    for( uint32_t i=0; i<CPU_SETSIZE; i++ )
+    {
+        if( CPU_ISSET( i, &set ) ) cpus.emplace_back( Cpu { i, 0 } );
+    }
+    if( cpus.empty() ) return {};
+
+    // cpu_capacity is provided on ARM big.LITTLE systems. Intel hybrid cores are told apart by their maximum
+    // frequency. If neither is available, all cores are treated as equal.
+    for( const char* file : { "cpu_capacity", "cpufreq/cpuinfo_max_freq" } )
+    {
+        bool valid = true;
+        for( auto& cpu : cpus )
+        {
+            if( !ReadSysfsValue( cpu.id, file, cpu.capacity ) ) { valid = false; break; }
+        }
+        if( valid ) break;
+        for( auto& cpu : cpus ) cpu.capacity = 0;
+    }
+
+    std::ranges::stable_sort( cpus, []( const auto& a, const auto& b ) { return a.capacity > b.capacity; } );
+
+    // Boost clocks vary slightly between cores of the same kind, only big differences start a new class.
+    std::vector<std::vector<uint32_t>> ret;
+    uint64_t capacity = 0;
+    for( auto& cpu : cpus )
+    {
+        if( ret.empty() || cpu.capacity * 100 < capacity * 85 )
+        {
+            ret.emplace_back();
+            capacity = cpu.capacity;
+        }
+        ret.back().emplace_back( cpu.id );
+    }
+    for( auto& cls : ret ) std::ranges::sort( cls );
+    return ret;
+}
@@ -0,0 +1,11 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+// Parses a Linux style CPU list, e.g. "0-3,8,10-11". Invalid input gives an empty list.
+std::vector<uint32_t> ParseCpuList( const char* str );
+
+// CPUs available to the process, grouped by performance class, fastest class first. Machines without
+// heterogeneous cores have a single class.
+std::vector<std::vector<uint32_t>> GetCpuClasses();
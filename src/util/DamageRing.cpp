@@ -0,0 +1,47 @@
+#include "DamageRing.hpp"
+#include "util/Panic.hpp"
+
+DamageRing::DamageRing( const Region::Rect& bounds, uint32_t depth )
+    : m_bounds( bounds )
+    , m_history( depth )
+{
+    CheckPanic( depth > 0, "Damage history must not be empty" );
+}
+
+void DamageRing::Reset( const Region::Rect& bounds )
+{
+    m_bounds = bounds;
+    for( auto& r : m_history ) r.Clear();
+    m_next = 0;
+    m_frames = 0;
+}
+
+Region DamageRing::Frame( const Region& damage, uint32_t age )
+{
+    Add( damage );
+    return Since( age );
+}
+
+void DamageRing::Add( const Region& damage )
+{
+    const auto depth = uint32_t( m_history.size() );
+
+    auto& slot = m_history[m_next];
+    slot = damage;
+    slot.Intersect( m_bounds );
+    m_next = ( m_next + 1 ) % depth;
+    if( m_frames <= depth ) m_frames++;
+}
+
+Region DamageRing::Since( uint32_t age ) const
+{
+    const auto depth = uint32_t( m_history.size() );
+
+    // The new frame is in the history too, so a buffer of age n needs the last n entries. The frame the buffer was
+    // drawn in must have been recorded as well, or it holds contents from before the last reset.
+    if( age == 0 || age >= m_frames ) return Region( m_bounds );
+
+    Region ret;
+    for( uint32_t i=1; i<=age; i++ ) ret.Add( m_history[( m_next + depth - i ) % depth] );
+    return ret;
+}
@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "Region.hpp"
+
+// Damage of the last few frames of an output. A buffer which was last drawn some frames ago is missing the changes
+// of all frames since then, so that is what has to be repainted in it, and not only the damage of the new frame.
+class DamageRing
+{
+public:
+    explicit DamageRing( const Region::Rect& bounds, uint32_t depth = 4 );
+
+    // Everything is damaged, e.g. after a mode change
+    void Reset( const Region::Rect& bounds );
+
+    // Records the damage of a new frame, and returns the part of a buffer which must be repainted. The age is the
+    // number of frames since the buffer was last drawn, 1 for the previous frame. An age of 0, or one older than
+    // the history, means that the contents of the buffer are unknown.
+    [[nodiscard]] Region Frame( const Region& damage, uint32_t age );
+
+    // The two halves of Frame(), for when buffers of different ages are filled from the same frame
+    void Add( const Region& damage );
+    [[nodiscard]] Region Since( uint32_t age ) const;
+
+    [[nodiscard]] auto& Bounds() const { return m_bounds; }
+
+private:
+    Region::Rect m_bounds;
+    std::vector<Region> m_history;      // Ring of the most recent frames
+    uint32_t m_next = 0;
+    uint32_t m_frames = 0;              // Frames recorded since the last reset, up to one more than the depth
+};
@@ -0,0 +1,191 @@
+#include <algorithm>
+#include <errno.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+
+#include "EventLoop.hpp"
+#include "util/Panic.hpp"
+
+namespace
+{
+constexpr size_t MaxEvents = 16;
+
+itimerspec TimerSpec( uint64_t delay, uint64_t interval )
+{
+    return {
+        .it_interval = { time_t( interval / 1000000 ), long( interval % 1000000 ) * 1000 },
+        .it_value = { time_t( delay / 1000000 ), long( delay % 1000000 ) * 1000 }
+    };
+}
+}
+
+EventLoop::EventLoop()
+    : m_epoll( epoll_create1( EPOLL_CLOEXEC ) )
+    , m_wakeup( eventfd( 0, EFD_CLOEXEC | EFD_NONBLOCK ) )
+{
+    CheckPanic( m_epoll >= 0, "Failed to create epoll instance: %s", strerror( errno ) );
+    CheckPanic( m_wakeup >= 0, "Failed to create eventfd: %s", strerror( errno ) );
+
+    AddFd( m_wakeup, EPOLLIN, [this]( uint32_t ) { DrainWakeup(); } );
+}
+
+EventLoop::~EventLoop()
+{
+    close( m_wakeup );
+    close( m_epoll );
+}
+
+void EventLoop::AddFd( int fd, uint32_t events, FdCallback callback )
+{
+    CheckPanic( !m_sources.contains( fd ), "Descriptor %i is already in the event loop", fd );
+
+    epoll_event ev = {
+        .events = events,
+        .data = { .fd = fd }
+    };
+    CheckPanic( epoll_ctl( m_epoll, EPOLL_CTL_ADD, fd, &ev ) == 0, "Failed to add descriptor %i to event loop: %s", fd, strerror( errno ) );
+    m_sources.emplace( fd, std::make_shared<FdCallback>( std::move( callback ) ) );
+}
+
+void EventLoop::ModifyFd( int fd, uint32_t events )
+{
+    epoll_event ev = {
+        .events = events,
+        .data = { .fd = fd }
+    };
+    CheckPanic( epoll_ctl( m_epoll, EPOLL_CTL_MOD, fd, &ev ) == 0, "Failed to modify descriptor %i in event loop: %s", fd, strerror( errno ) );
+}
+
+void EventLoop::RemoveFd( int fd )
+{
+    auto it = m_sources.find( fd );
+    if( it == m_sources.end() ) return;
+    m_sources.erase( it );
+    epoll_ctl( m_epoll, EPOLL_CTL_DEL, fd, nullptr );
+}
+
+int EventLoop::AddTimer( uint64_t delay, uint64_t interval, Callback callback )
+{
+    const auto fd = timerfd_create( CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK );
+    CheckPanic( fd >= 0, "Failed to create timerfd: %s", strerror( errno ) );
+
+    AddFd( fd, EPOLLIN, [fd, callback = std::move( callback )]( uint32_t ) {
+        uint64_t expirations;
+        if( read( fd, &expirations, sizeof( expirations ) ) == sizeof( expirations ) ) callback();
+    } );
+    SetTimer( fd, delay, interval );
+    return fd;
+}
+
+void EventLoop::SetTimer( int timer, uint64_t delay, uint64_t interval )
+{
+    const auto spec = TimerSpec( delay, interval );
+    timerfd_settime( timer, 0, &spec, nullptr );
+}
+
+void EventLoop::RemoveTimer( int timer )
+{
+    RemoveFd( timer );
+    close( timer );
+}
+
+int EventLoop::AddPrepare( PrepareCallback prepare, Callback finish )
+{
+    const auto id = m_prepareId++;
+    m_prepare.emplace_back( Prepare { id, std::move( prepare ), std::move( finish ) } );
+    return id;
+}
+
+void EventLoop::RemovePrepare( int id )
+{
+    // Only marked here, as the callback may be running. Removed at the start of the next dispatch.
+    auto it = std::ranges::find_if( m_prepare, [id]( const auto& v ) { return v.id == id; } );
+    if( it != m_prepare.end() ) it->id = -1;
+}
+
+void EventLoop::Post( Callback callback )
+{
+    {
+        std::lock_guard lock( m_postLock );
+        m_posted.emplace_back( std::move( callback ) );
+    }
+    Wakeup();
+}
+
+void EventLoop::Wakeup()
+{
+    const uint64_t value = 1;
+    [[maybe_unused]] const auto res = write( m_wakeup, &value, sizeof( value ) );
+}
+
+bool EventLoop::Dispatch( int timeout )
+{
+    if( IsStopped() ) return false;
+
+    std::erase_if( m_prepare, []( const auto& v ) { return v.id < 0; } );
+    const auto numPrepare = m_prepare.size();
+
+    for( size_t i=0; i<numPrepare; i++ )
+    {
+        if( m_prepare[i].id < 0 || !m_prepare[i].prepare ) continue;
+        const auto limit = m_prepare[i].prepare();
+        if( limit >= 0 && ( timeout < 0 || limit < timeout ) ) timeout = limit;
+    }
+    if( IsStopped() ) timeout = 0;
+
+    epoll_event events[MaxEvents];
+    int num;
+    do
+    {
+        num = epoll_wait( m_epoll, events, MaxEvents, timeout );
+    }
+    while( num < 0 && errno == EINTR );
+    CheckPanic( num >= 0, "Failed to wait for events: %s", strerror( errno ) );
+
+    {
+        ZoneScopedN( "Event dispatch" );
+        for( int i=0; i<num; i++ )
+        {
+            // The source may have been removed by an earlier callback. The callback is kept alive while it runs,
+            // even if it removes itself.
+            auto it = m_sources.find( events[i].data.fd );
+            if( it == m_sources.end() ) continue;
+            auto callback = it->second;
+            (*callback)( events[i].events );
+        }
+    }
+
+    for( size_t i=0; i<numPrepare; i++ )
+    {
+        if( m_prepare[i].id >= 0 && m_prepare[i].finish ) m_prepare[i].finish();
+    }
+
+    return !IsStopped();
+}
+
+void EventLoop::Run()
+{
+    while( Dispatch() ) {}
+}
+
+void EventLoop::Stop()
+{
+    m_stop.store( true, std::memory_order_release );
+    Wakeup();
+}
+
+void EventLoop::DrainWakeup()
+{
+    uint64_t value;
+    [[maybe_unused]] const auto res = read( m_wakeup, &value, sizeof( value ) );
+
+    std::vector<Callback> posted;
+    {
+        std::lock_guard lock( m_postLock );
+        std::swap( posted, m_posted );
+    }
+    for( auto& cb : posted ) cb();
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <atomic>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <sys/epoll.h>
+#include <utility>
+#include <vector>
+
+#include "util/NoCopy.hpp"
+#include "util/RobinHood.hpp"
+
+// Waits on file descriptors, timers and cross thread wakeups with a single epoll set, so that one thread can serve
+// the Wayland display, D-Bus, DRM devices and anything else which provides a pollable descriptor.
+//
+// Callbacks run on the thread which calls Run() or Dispatch(). Sources may be added or removed from within the
+// callbacks, but otherwise only from that thread. Post(), Wakeup() and Stop() are thread safe.
+class EventLoop
+{
+public:
+    using FdCallback = std::function<void(uint32_t events)>;       // Ready epoll events
+    using Callback = std::function<void()>;
+
+    // Called before the loop blocks. Returns the longest time to block, in milliseconds, or -1 for no limit.
+    using PrepareCallback = std::function<int()>;
+
+    EventLoop();
+    ~EventLoop();
+
+    NoCopy( EventLoop );
+
+    // The descriptor is not owned by the loop and must be removed before it is closed
+    void AddFd( int fd, uint32_t events, FdCallback callback );
+    void ModifyFd( int fd, uint32_t events );
+    void RemoveFd( int fd );
+
+    // Times in microseconds. The timer fires once after the delay, and then every interval, if it is not zero.
+    // A zero delay disarms the timer.
+    [[nodiscard]] int AddTimer( uint64_t delay, uint64_t interval, Callback callback );
+    void SetTimer( int timer, uint64_t delay, uint64_t interval = 0 );
+    void RemoveTimer( int timer );
+
+    // Prepare is called before each wait, finish after the ready sources were dispatched. Either may be empty.
+    // Must not be added from within another prepare or finish callback.
+    [[nodiscard]] int AddPrepare( PrepareCallback prepare, Callback finish = {} );
+    void RemovePrepare( int id );
+
+    // The callback runs on the loop thread, during the next dispatch
+    void Post( Callback callback );
+    void Wakeup();
+
+    // Blocks for at most the timeout, in milliseconds, or until something is ready, and dispatches it.
+    // Returns false once the loop was stopped.
+    bool Dispatch( int timeout = -1 );
+    void Run();
+    void Stop();
+
+    [[nodiscard]] bool IsStopped() const { return m_stop.load( std::memory_order_acquire ); }
+
+private:
+    struct Prepare
+    {
+        int id;
+        PrepareCallback prepare;
+        Callback finish;
+    };
+
+    void DrainWakeup();
+
+    int m_epoll;
+    int m_wakeup;
+
+    unordered_flat_map<int, std::shared_ptr<FdCallback>> m_sources;
+    std::vector<Prepare> m_prepare;
+    int m_prepareId = 0;
+
+    std::mutex m_postLock;
+    std::vector<Callback> m_posted;
+
+    std::atomic<bool> m_stop = false;
+};
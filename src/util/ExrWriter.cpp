@@ -0,0 +1,142 @@
+#include <algorithm>
+#include <exception>
+#include <ImfHeader.h>
+#include <ImfRgbaFile.h>
+#include <ImfThreading.h>
+#include <string.h>
+#include <thread>
+#include <tracy/Tracy.hpp>
+
+#include "contrib/half.hpp"
+
+#include "BitmapHdrHalf.hpp"
+#include "ExrWriter.hpp"
+#include "Logs.hpp"
+#include "TaskDispatch.hpp"
+
+namespace
+{
+// Compressed blocks per band and thread. Bands are large enough to keep all threads busy, with some slack for
+// blocks which compress slower than others.
+constexpr uint32_t BlocksPerThread = 4;
+
+uint32_t LinesPerBlock( ExrWriter::Compression compression )
+{
+    switch( compression )
+    {
+    case ExrWriter::Compression::None: return 1;
+    case ExrWriter::Compression::Zip: return 16;
+    case ExrWriter::Compression::Htj2k: return 256;
+    default: return 32;
+    }
+}
+
+Imf::Compression ToImf( ExrWriter::Compression compression )
+{
+    switch( compression )
+    {
+    case ExrWriter::Compression::None: return Imf::NO_COMPRESSION;
+    case ExrWriter::Compression::Piz: return Imf::PIZ_COMPRESSION;
+    case ExrWriter::Compression::Dwaa: return Imf::DWAA_COMPRESSION;
+#if OPENEXR_VERSION_HEX >= 0x03040000
+    case ExrWriter::Compression::Htj2k: return Imf::HTJ2K256_COMPRESSION;
+#else
+    case ExrWriter::Compression::Htj2k:
+        mclog( LogLevel::Warning, "HTJ2K compression needs OpenEXR 3.4, using ZIP" );
+        return Imf::ZIP_COMPRESSION;
+#endif
+    default: return Imf::ZIP_COMPRESSION;
+    }
+}
+}
+
+ExrWriter::ExrWriter( const char* path, uint32_t width, uint32_t height, Compression compression, TaskDispatch* td )
+    : m_width( width )
+    , m_height( height )
+{
+    ZoneScoped;
+
+    const auto threads = td ? uint32_t( td->NumWorkers() ) + 1 : std::max( 1u, std::thread::hardware_concurrency() );
+    if( Imf::globalThreadCount() < int( threads ) ) Imf::setGlobalThreadCount( threads );
+
+    Imf::Header header( width, height );
+    header.compression() = ToImf( compression );
+
+    m_bandRows = std::max( 1u, std::min( height, LinesPerBlock( compression ) * BlocksPerThread * threads ) );
+
+    try
+    {
+        m_file = std::make_unique<Imf::RgbaOutputFile>( path, header, Imf::WRITE_RGBA, threads );
+    }
+    catch( const std::exception& e )
+    {
+        mclog( LogLevel::Error, "Failed to create EXR file %s: %s", path, e.what() );
+    }
+}
+
+ExrWriter::~ExrWriter()
+{
+    if( m_file && m_row != m_height ) mclog( LogLevel::Warning, "EXR file closed after %u of %u rows", m_row, m_height );
+}
+
+void ExrWriter::Write( const half_float::half* data, uint32_t rows )
+{
+    ZoneScoped;
+    if( !m_file ) return;
+    rows = std::min( rows, m_height - m_row );
+
+    // The frame buffer is addressed with absolute row numbers
+    try
+    {
+        m_file->setFrameBuffer( (const Imf::Rgba*)data - size_t( m_row ) * m_width, 1, m_width );
+        m_file->writePixels( rows );
+        m_row += rows;
+    }
+    catch( const std::exception& e )
+    {
+        Fail( e.what() );
+    }
+}
+
+void ExrWriter::Write( const float* data, uint32_t rows )
+{
+    ZoneScoped;
+    m_band.resize( size_t( m_bandRows ) * m_width * 4 );
+    while( rows > 0 && m_file )
+    {
+        const auto band = std::min( rows, m_bandRows );
+        const auto count = size_t( band ) * m_width * 4;
+        BitmapHdrHalf::ConvertFloat( data, m_band.data(), count );
+        Write( m_band.data(), band );
+        data += count;
+        rows -= band;
+    }
+}
+
+bool ExrWriter::ParseCompression( const char* name, Compression& compression )
+{
+    struct Entry { const char* name; Compression compression; };
+    constexpr Entry Names[] = {
+        { "none", Compression::None },
+        { "zip", Compression::Zip },
+        { "piz", Compression::Piz },
+        { "dwaa", Compression::Dwaa },
+        { "htj2k", Compression::Htj2k }
+    };
+
+    for( auto& v : Names )
+    {
+        if( strcmp( v.name, name ) == 0 )
+        {
+            compression = v.compression;
+            return true;
+        }
+    }
+    return false;
+}
+
+void ExrWriter::Fail( const char* what )
+{
+    mclog( LogLevel::Error, "Failed to write EXR file: %s", what );
+    m_file.reset();
+}
@@ -0,0 +1,54 @@
+#pragma once
+
+#include <memory>
+#include <stdint.h>
+#include <vector>
+
+#include <OpenEXRConfig.h>
+
+#include "NoCopy.hpp"
+
+namespace half_float { class half; }
+namespace OPENEXR_IMF_INTERNAL_NAMESPACE { class RgbaOutputFile; }
+
+class TaskDispatch;
+
+// Writes a scanline RGBA EXR file as the rows come in, top to bottom. Float rows are converted to half precision
+// one band at a time, so that a half float copy of the whole image is never needed. The line blocks of each band
+// are compressed in parallel, on OpenEXR's thread pool, which is sized to the worker count of the dispatch.
+class ExrWriter
+{
+public:
+    enum class Compression
+    {
+        None,
+        Zip,
+        Piz,
+        Dwaa,
+        Htj2k       // Needs OpenEXR 3.4, falls back to Zip otherwise
+    };
+
+    ExrWriter( const char* path, uint32_t width, uint32_t height, Compression compression = Compression::Zip, TaskDispatch* td = nullptr );
+    ~ExrWriter();
+    NoCopy( ExrWriter );
+
+    // Tightly packed RGBA pixels. Nothing more is written once an error occurred.
+    void Write( const half_float::half* data, uint32_t rows );
+    void Write( const float* data, uint32_t rows );
+
+    [[nodiscard]] bool IsValid() const { return m_file != nullptr; }
+    [[nodiscard]] uint32_t Row() const { return m_row; }
+
+    // Accepts none, zip, piz, dwaa and htj2k
+    [[nodiscard]] static bool ParseCompression( const char* name, Compression& compression );
+
+private:
+    void Fail( const char* what );
+
+    std::unique_ptr<OPENEXR_IMF_INTERNAL_NAMESPACE::RgbaOutputFile> m_file;
+    uint32_t m_width;
+    uint32_t m_height;
+    uint32_t m_row = 0;
+    uint32_t m_bandRows;
+    std::vector<half_float::half> m_band;
+};
@@ -0,0 +1,386 @@
+#include <algorithm>
+#include <atomic>
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+
+#include "FileBatch.hpp"
+#include "Logs.hpp"
+#include "NoCopy.hpp"
+#include "PathList.hpp"
+#include "TaskDispatch.hpp"
+
+namespace
+{
+// Files in flight at once. Each has at most one request queued, so this is also the submission queue size.
+constexpr uint32_t Depth = 128;
+
+// Minimal io_uring instance, set up with the raw system calls
+class Ring
+{
+public:
+    explicit Ring( uint32_t entries )
+    {
+        io_uring_params params = {};
+        m_fd = (int)syscall( __NR_io_uring_setup, entries, &params );
+        if( m_fd < 0 ) return;
+
+        // Opening, stat and advice calls are all there since the same kernel version
+        if( !( params.features & IORING_FEAT_SINGLE_MMAP ) || !( params.features & IORING_FEAT_RW_CUR_POS ) )
+        {
+            Close();
+            return;
+        }
+
+        m_ringSize = std::max( params.sq_off.array + params.sq_entries * sizeof( uint32_t ), params.cq_off.cqes + params.cq_entries * sizeof( io_uring_cqe ) );
+        m_ring = mmap( nullptr, m_ringSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQ_RING );
+        m_sqeSize = params.sq_entries * sizeof( io_uring_sqe );
+        m_sqes = (io_uring_sqe*)mmap( nullptr, m_sqeSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, m_fd, IORING_OFF_SQES );
+        if( m_ring == MAP_FAILED || m_sqes == MAP_FAILED )
+        {
+            Close();
+            return;
+        }
+
+        auto base = (uint8_t*)m_ring;
+        m_sqTail = (uint32_t*)( base + params.sq_off.tail );
+        m_sqMask = *(uint32_t*)( base + params.sq_off.ring_mask );
+        m_cqHead = (uint32_t*)( base + params.cq_off.head );
+        m_cqTail = (uint32_t*)( base + params.cq_off.tail );
+        m_cqMask = *(uint32_t*)( base + params.cq_off.ring_mask );
+        m_cqes = (io_uring_cqe*)( base + params.cq_off.cqes );
+
+        // Submission slots are used in order, so the indirection array never changes
+        auto array = (uint32_t*)( base + params.sq_off.array );
+        for( uint32_t i=0; i<params.sq_entries; i++ ) array[i] = i;
+        m_tail = *m_sqTail;
+    }
+
+    ~Ring() { Close(); }
+
+    NoCopy( Ring );
+
+    [[nodiscard]] explicit operator bool() const { return m_fd >= 0; }
+
+    [[nodiscard]] io_uring_sqe& Next( uint8_t opcode, uint64_t userData )
+    {
+        auto& sqe = m_sqes[m_tail++ & m_sqMask];
+        memset( &sqe, 0, sizeof( sqe ) );
+        sqe.opcode = opcode;
+        sqe.user_data = userData;
+        m_pending++;
+        return sqe;
+    }
+
+    // Submits the queued requests and waits for at least one completion
+    void Submit()
+    {
+        ZoneScoped;
+        std::atomic_ref( *m_sqTail ).store( m_tail, std::memory_order_release );
+        while( syscall( __NR_io_uring_enter, m_fd, m_pending, 1, IORING_ENTER_GETEVENTS, nullptr, 0 ) < 0 && errno == EINTR ) {}
+        m_pending = 0;
+    }
+
+    template<typename F>
+    void Reap( F&& fn )
+    {
+        auto head = *m_cqHead;
+        const auto tail = std::atomic_ref( *m_cqTail ).load( std::memory_order_acquire );
+        while( head != tail )
+        {
+            const auto& cqe = m_cqes[head++ & m_cqMask];
+            fn( cqe.user_data, cqe.res );
+        }
+        std::atomic_ref( *m_cqHead ).store( head, std::memory_order_release );
+    }
+
+private:
+    void Close()
+    {
+        if( m_sqes && m_sqes != MAP_FAILED ) munmap( m_sqes, m_sqeSize );
+        if( m_ring && m_ring != MAP_FAILED ) munmap( m_ring, m_ringSize );
+        if( m_fd >= 0 ) close( m_fd );
+        m_fd = -1;
+    }
+
+    int m_fd;
+    void* m_ring = nullptr;
+    size_t m_ringSize = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqeSize = 0;
+
+    uint32_t* m_sqTail;
+    uint32_t m_sqMask;
+    uint32_t* m_cqHead;
+    uint32_t* m_cqTail;
+    uint32_t m_cqMask;
+    io_uring_cqe* m_cqes;
+
+    uint32_t m_tail;
+    uint32_t m_pending = 0;
+};
+
+// Steps of a file, stored in the low bits of the request user data. The rest is the slot of the file.
+enum Step : uint64_t
+{
+    Statx,
+    Open,
+    Read,
+    Advise,
+    Finish
+};
+
+struct Slot
+{
+    size_t index;
+    int fd;
+    struct statx stx;
+};
+
+// Keeps up to a slot per file in flight and calls step( ring, slot, step, res ) for each completion. The step
+// either queues the next request of the file and returns true, or returns false when the file is done.
+template<typename S, typename F>
+void Drive( Ring& ring, size_t count, S&& start, F&& step )
+{
+    std::vector<Slot> slots( std::min<size_t>( count, Depth ) );
+    std::vector<uint32_t> free( slots.size() );
+    for( uint32_t i=0; i<free.size(); i++ ) free[i] = uint32_t( free.size() - 1 - i );
+
+    size_t next = 0;
+    while( next < count || free.size() != slots.size() )
+    {
+        while( next < count && !free.empty() )
+        {
+            const auto id = free.back();
+            free.pop_back();
+            slots[id].index = next++;
+            slots[id].fd = -1;
+            start( ring, slots[id], (uint64_t)id << 3 );
+        }
+        ring.Submit();
+        ring.Reap( [&]( uint64_t data, int32_t res ) {
+            const auto id = uint32_t( data >> 3 );
+            if( !step( ring, slots[id], (uint64_t)id << 3, Step( data & 7 ), res ) ) free.emplace_back( id );
+        } );
+    }
+}
+
+void StartStatx( Ring& ring, Slot& slot, uint64_t tag, int dirfd, const char* path )
+{
+    auto& sqe = ring.Next( IORING_OP_STATX, tag | Statx );
+    sqe.fd = dirfd;
+    sqe.addr = (uint64_t)path;
+    sqe.len = STATX_TYPE | STATX_SIZE | STATX_MTIME;
+    sqe.off = (uint64_t)&slot.stx;
+}
+
+void StartOpen( Ring& ring, uint64_t tag, int dirfd, const char* path )
+{
+    auto& sqe = ring.Next( IORING_OP_OPENAT, tag | Open );
+    sqe.fd = dirfd;
+    sqe.addr = (uint64_t)path;
+    sqe.open_flags = O_RDONLY | O_CLOEXEC;
+}
+
+void StartClose( Ring& ring, uint64_t tag, int fd )
+{
+    auto& sqe = ring.Next( IORING_OP_CLOSE, tag | Finish );
+    sqe.fd = fd;
+}
+
+template<typename N>
+void ReadHeadersUring( Ring& ring, int dirfd, N&& name, size_t length, std::vector<FileBatch::Header>& ret )
+{
+    Drive( ring, ret.size(), [&]( Ring& ring, Slot& slot, uint64_t tag ) {
+        StartStatx( ring, slot, tag, dirfd, name( slot.index ) );
+    }, [&]( Ring& ring, Slot& slot, uint64_t tag, Step step, int32_t res ) {
+        auto& header = ret[slot.index];
+        switch( step )
+        {
+        case Statx:
+            if( res < 0 || !S_ISREG( slot.stx.stx_mode ) ) return false;
+            header.regular = true;
+            header.size = slot.stx.stx_size;
+            header.mtime = { .tv_sec = slot.stx.stx_mtime.tv_sec, .tv_nsec = slot.stx.stx_mtime.tv_nsec };
+            if( length == 0 || header.size == 0 ) return false;
+            StartOpen( ring, tag, dirfd, name( slot.index ) );
+            return true;
+        case Open:
+        {
+            if( res < 0 ) return false;
+            slot.fd = res;
+            auto& sqe = ring.Next( IORING_OP_READ, tag | Read );
+            sqe.fd = slot.fd;
+            sqe.addr = (uint64_t)header.data;
+            sqe.len = uint32_t( length );
+            return true;
+        }
+        case Read:
+            if( res > 0 ) header.length = uint32_t( res );
+            StartClose( ring, tag, slot.fd );
+            return true;
+        default:
+            return false;
+        }
+    } );
+}
+
+template<typename N>
+void PrefetchUring( Ring& ring, int dirfd, size_t count, N&& name )
+{
+    Drive( ring, count, [&]( Ring& ring, Slot& slot, uint64_t tag ) {
+        StartOpen( ring, tag, dirfd, name( slot.index ) );
+    }, [&]( Ring& ring, Slot& slot, uint64_t tag, Step step, int32_t res ) {
+        switch( step )
+        {
+        case Open:
+        {
+            if( res < 0 ) return false;
+            slot.fd = res;
+            auto& sqe = ring.Next( IORING_OP_FADVISE, tag | Advise );
+            sqe.fd = slot.fd;
+            sqe.fadvise_advice = POSIX_FADV_WILLNEED;
+            return true;
+        }
+        case Advise:
+            StartClose( ring, tag, slot.fd );
+            return true;
+        default:
+            return false;
+        }
+    } );
+}
+
+template<typename F>
+void ForEach( TaskDispatch* td, size_t count, F&& fn )
+{
+    const auto run = [&]( size_t begin, size_t end ) { for( size_t i=begin; i<end; i++ ) fn( i ); };
+    if( td && count > 1 ) td->ParallelFor( 0, count, 1, run );
+    else run( 0, count );
+}
+// Names are relative to dirfd, which may be AT_FDCWD
+template<typename N>
+std::vector<FileBatch::Header> ReadHeaders( int dirfd, size_t count, N&& name, size_t length, TaskDispatch* td )
+{
+    length = std::min( length, FileBatch::MaxHeader );
+    std::vector<FileBatch::Header> ret( count );
+    if( count == 0 ) return ret;
+
+    if( Ring ring( Depth ); ring )
+    {
+        ReadHeadersUring( ring, dirfd, name, length, ret );
+        return ret;
+    }
+
+    ForEach( td, count, [&]( size_t i ) {
+        struct stat st;
+        if( fstatat( dirfd, name( i ), &st, 0 ) != 0 || !S_ISREG( st.st_mode ) ) return;
+
+        auto& header = ret[i];
+        header.regular = true;
+        header.size = st.st_size;
+        header.mtime = st.st_mtim;
+        if( length == 0 || header.size == 0 ) return;
+
+        const auto fd = openat( dirfd, name( i ), O_RDONLY | O_CLOEXEC );
+        if( fd < 0 ) return;
+        const auto len = pread( fd, header.data, length, 0 );
+        if( len > 0 ) header.length = uint32_t( len );
+        close( fd );
+    } );
+    return ret;
+}
+
+template<typename N>
+void Prefetch( int dirfd, size_t count, N&& name, TaskDispatch* td )
+{
+    if( count == 0 ) return;
+    if( Ring ring( Depth ); ring )
+    {
+        PrefetchUring( ring, dirfd, count, name );
+        return;
+    }
+
+    ForEach( td, count, [&]( size_t i ) {
+        const auto fd = openat( dirfd, name( i ), O_RDONLY | O_CLOEXEC );
+        if( fd < 0 ) return;
+        posix_fadvise( fd, 0, 0, POSIX_FADV_WILLNEED );
+        close( fd );
+    } );
+}
+
+// The directory of the list, opened once, so that each file lookup only resolves its own name
+class ListDir
+{
+public:
+    explicit ListDir( const PathList& list )
+        : m_fd( list.Prefix().empty() ? AT_FDCWD : open( list.Prefix().c_str(), O_PATH | O_DIRECTORY | O_CLOEXEC ) )
+    {
+    }
+
+    ~ListDir() { if( m_fd >= 0 ) close( m_fd ); }
+
+    NoCopy( ListDir );
+
+    [[nodiscard]] int Fd() const { return m_fd; }
+
+private:
+    int m_fd;
+};
+}
+
+namespace FileBatch
+{
+
+std::vector<Header> ReadHeaders( const std::vector<std::string>& paths, size_t length, TaskDispatch* td )
+{
+    ZoneScoped;
+    ZoneValue( paths.size() );
+    return ::ReadHeaders( AT_FDCWD, paths.size(), [&]( size_t i ) { return paths[i].c_str(); }, length, td );
+}
+
+std::vector<Header> ReadHeaders( const PathList& list, size_t length, TaskDispatch* td )
+{
+    ZoneScoped;
+    ZoneValue( list.Size() );
+
+    // Without the directory nothing in it can be opened, which leaves all headers not regular
+    ListDir dir( list );
+    if( dir.Fd() == -1 ) return std::vector<Header>( list.Size() );
+    return ::ReadHeaders( dir.Fd(), list.Size(), [&]( size_t i ) { return list.Name( i ); }, length, td );
+}
+
+void Prefetch( const std::vector<std::string>& paths, TaskDispatch* td )
+{
+    ZoneScoped;
+    ZoneValue( paths.size() );
+    ::Prefetch( AT_FDCWD, paths.size(), [&]( size_t i ) { return paths[i].c_str(); }, td );
+}
+
+void Prefetch( const PathList& list, TaskDispatch* td )
+{
+    ZoneScoped;
+    ZoneValue( list.Size() );
+
+    ListDir dir( list );
+    if( dir.Fd() == -1 ) return;
+    ::Prefetch( dir.Fd(), list.Size(), [&]( size_t i ) { return list.Name( i ); }, td );
+}
+
+bool HasUring()
+{
+    static const bool available = [] {
+        const bool ret = bool( Ring( 1 ) );
+        mclog( LogLevel::Debug, "io_uring is %savailable for file batches", ret ? "" : "not " );
+        return ret;
+    }();
+    return available;
+}
+
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+class PathList;
+class TaskDispatch;
+
+// File system access for many files at once. Requests go to io_uring in batches, with many files in flight, so
+// that on network file systems the cost is bandwidth rather than one round-trip after another. Without io_uring
+// the same is done with blocking calls, spread over the workers of td if it is set.
+namespace FileBatch
+{
+
+constexpr size_t MaxHeader = 16;
+
+struct Header
+{
+    bool regular = false;       // Anything else is not opened, and has no other fields set
+    uint64_t size = 0;
+    struct timespec mtime = {};
+    uint32_t length = 0;        // Bytes read into data, less than requested only for short files
+    uint8_t data[MaxHeader];
+};
+
+// Stats the files and reads the first length bytes of each, at most MaxHeader. Nothing is read if length is zero.
+[[nodiscard]] std::vector<Header> ReadHeaders( const std::vector<std::string>& paths, size_t length, TaskDispatch* td = nullptr );
+// Same, with the names looked up relative to the list directory, which is resolved only once
+[[nodiscard]] std::vector<Header> ReadHeaders( const PathList& list, size_t length, TaskDispatch* td = nullptr );
+
+// Starts read-ahead of the whole files into the page cache, so that later loads do not wait for the storage.
+// Returns once the reads are queued, not when the data has arrived.
+void Prefetch( const std::vector<std::string>& paths, TaskDispatch* td = nullptr );
+void Prefetch( const PathList& list, TaskDispatch* td = nullptr );
+
+[[nodiscard]] bool HasUring();
+
+}
@@ -28,6 +28,10 @@ FileBuffer::FileBuffer( const char* fn )
         throw FileException( std::format( "Failed to map file: {}", fn ) );
     }
     m_data = (const char*)map;
+
+    // Loaders read the whole file front to back, so ask for early and aggressive read-ahead.
+    madvise( map, m_size, MADV_WILLNEED );
+    madvise( map, m_size, MADV_SEQUENTIAL );
 }
 
 FileBuffer::FileBuffer( FILE* file )
@@ -45,6 +49,8 @@ FileBuffer::FileBuffer( FILE* file )
         throw FileException( "Failed to map file" );
     }
     m_data = (const char*)map;
+    madvise( map, m_size, MADV_WILLNEED );
+    madvise( map, m_size, MADV_SEQUENTIAL );
 }
 
 FileBuffer::FileBuffer( const std::shared_ptr<FileWrapper>& file )
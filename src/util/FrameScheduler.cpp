@@ -0,0 +1,47 @@
+#include "FrameScheduler.hpp"
+
+FrameScheduler::FrameScheduler( uint64_t refreshInterval, uint64_t deadline )
+    : m_interval( refreshInterval )
+    , m_deadline( deadline )
+{
+}
+
+void FrameScheduler::Begin()
+{
+    m_damaged = false;
+    m_inFlight = true;
+}
+
+void FrameScheduler::Cancel()
+{
+    m_inFlight = false;
+}
+
+void FrameScheduler::Presented( uint64_t time )
+{
+    m_inFlight = false;
+    Vblank( time );
+}
+
+void FrameScheduler::Vblank( uint64_t time )
+{
+    if( time > m_lastVblank ) m_lastVblank = time;
+}
+
+uint64_t FrameScheduler::NextFrame( uint64_t now ) const
+{
+    if( !m_damaged || m_inFlight ) return 0;
+    if( m_lastVblank == 0 || m_interval == 0 ) return now;
+
+    // With variable refresh the interval is the shortest one the display supports
+    uint64_t vblank = m_lastVblank + m_interval;
+    if( !m_vrr && vblank < now + m_deadline )
+    {
+        // Too late for that one, aim at the first vblank which still leaves the full deadline
+        const auto missed = ( now + m_deadline - vblank + m_interval - 1 ) / m_interval;
+        vblank += missed * m_interval;
+    }
+
+    const auto start = vblank > m_deadline ? vblank - m_deadline : 0;
+    return start > now ? start : now;
+}
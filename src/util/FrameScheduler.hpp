@@ -0,0 +1,45 @@
+#pragma once
+
+#include <stdint.h>
+
+// Decides when an output should start rendering its next frame. The schedule is derived from the times at which
+// previous frames reached the screen, so each output keeps its own phase and refresh rate.
+//
+// Rendering starts one deadline before the vblank the frame is meant for. With variable refresh, the display
+// waits for the frame instead, and the next one may start as soon as the maximum refresh rate allows. Without
+// damage nothing is scheduled, so idle outputs don't render at all.
+//
+// All times are in microseconds, on the clock of the page flip timestamps.
+class FrameScheduler
+{
+public:
+    FrameScheduler( uint64_t refreshInterval, uint64_t deadline );
+
+    void SetRefreshInterval( uint64_t interval ) { m_interval = interval; }
+    void SetDeadline( uint64_t deadline ) { m_deadline = deadline; }
+    void SetVrr( bool enabled ) { m_vrr = enabled; }
+
+    // Something on the output changed
+    void Damage() { m_damaged = true; }
+
+    void Begin();                       // Rendering of a frame started, the damage is now handled
+    void Cancel();                      // The frame was not committed. Damage again to retry.
+    void Presented( uint64_t time );    // The frame reached the screen
+    void Vblank( uint64_t time );       // A flip without a new frame, e.g. cursor motion, only updates the phase
+
+    // Returns the time to start rendering, not earlier than now, or 0 if no frame should be rendered, either
+    // because there is no damage, or because a frame is still waiting to be shown.
+    [[nodiscard]] uint64_t NextFrame( uint64_t now ) const;
+
+    [[nodiscard]] bool IsIdle() const { return !m_damaged && !m_inFlight; }
+    [[nodiscard]] bool IsVrr() const { return m_vrr; }
+
+private:
+    uint64_t m_interval;
+    uint64_t m_deadline;
+
+    uint64_t m_lastVblank = 0;
+    bool m_damaged = false;
+    bool m_inFlight = false;
+    bool m_vrr = false;
+};
@@ -0,0 +1,90 @@
+#pragma once
+
+#include <concepts>
+#include <new>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+
+#include "util/NoCopy.hpp"
+
+// Type-erased void() callable with a fixed inline capture buffer. Never allocates.
+class InlineTask
+{
+public:
+    static constexpr size_t Capacity = 48;
+
+    template<typename F>
+    static constexpr bool Fits =
+        sizeof( std::decay_t<F> ) <= Capacity &&
+        alignof( std::decay_t<F> ) <= alignof( std::max_align_t ) &&
+        std::is_nothrow_move_constructible_v<std::decay_t<F>>;
+
+    InlineTask() = default;
+
+    template<typename F>
+    requires( !std::same_as<std::decay_t<F>, InlineTask> && std::invocable<std::decay_t<F>&> )
+    InlineTask( F&& f )
+    {
+        using T = std::decay_t<F>;
+        static_assert( Fits<T>, "Callable does not fit in the inline buffer" );
+        new( m_storage ) T( std::forward<F>( f ) );
+        m_ops = &OpsFor<T>;
+    }
+
+    ~InlineTask() { Reset(); }
+
+    NoCopy( InlineTask );
+
+    InlineTask( InlineTask&& other ) noexcept
+    {
+        MoveFrom( other );
+    }
+
+    InlineTask& operator=( InlineTask&& other ) noexcept
+    {
+        if( this != &other )
+        {
+            Reset();
+            MoveFrom( other );
+        }
+        return *this;
+    }
+
+    void operator()() { m_ops->call( m_storage ); }
+
+    void Reset()
+    {
+        if( !m_ops ) return;
+        m_ops->destroy( m_storage );
+        m_ops = nullptr;
+    }
+
+    explicit operator bool() const { return m_ops != nullptr; }
+
+private:
+    struct Ops
+    {
+        void (*call)( void* );
+        void (*move)( void* dst, void* src );
+        void (*destroy)( void* );
+    };
+
+    template<typename T>
+    static constexpr Ops OpsFor = {
+        []( void* ptr ) { ( *(T*)ptr )(); },
+        []( void* dst, void* src ) { new( dst ) T( std::move( *(T*)src ) ); ( (T*)src )->~T(); },
+        []( void* ptr ) { ( (T*)ptr )->~T(); }
+    };
+
+    void MoveFrom( InlineTask& other )
+    {
+        m_ops = other.m_ops;
+        if( !m_ops ) return;
+        m_ops->move( m_storage, other.m_storage );
+        other.m_ops = nullptr;
+    }
+
+    alignas( std::max_align_t ) unsigned char m_storage[Capacity];
+    const Ops* m_ops = nullptr;
+};
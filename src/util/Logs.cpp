@@ -1,9 +1,19 @@
+#include <algorithm>
 #include <assert.h>
+#include <atomic>
+#include <errno.h>
+#include <limits.h>
+#include <memory>
 #include <mutex>
 #include <stdarg.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/uio.h>
+#include <thread>
 #include <tracy/Tracy.hpp>
+#include <unistd.h>
+#include <vector>
 
 #include "Ansi.hpp"
 #include "Callstack.hpp"
@@ -11,15 +21,72 @@
 
 namespace
 {
-LogLevel s_logLevel = LogLevel::Info;
+constexpr size_t RingSize = 64 * 1024;
+constexpr uint32_t WrapMarker = 0xFFFFFFFF;
+constexpr uint32_t DeferredBit = 0x80000000;
+constexpr size_t MaxQueued = RingSize / 4;
+constexpr int FnLen = 20;
+
+// Messages of one thread, waiting for the writer. The owning thread is the only producer. Consumers hold
+// s_drainLock, so there is only one of them at a time. Positions increase monotonically, and are taken
+// modulo the ring size. Each entry is a 32-bit length followed by the text, or by a deferred message if the
+// top bit of the length is set, padded to 4 bytes. An entry which doesn't fit before the end of the ring is
+// preceded by a wrap marker.
+struct LogRing
+{
+    alignas( 64 ) std::atomic<size_t> head = 0;
+    alignas( 64 ) std::atomic<size_t> tail = 0;
+    std::atomic<size_t> dropped = 0;
+    std::atomic<bool> closed = false;
+    char data[RingSize];
+};
+
+// The ring is kept in the registry after the thread exits, until it is drained
+struct RingOwner
+{
+    ~RingOwner() { if( ring ) ring->closed.store( true, std::memory_order_release ); }
+    std::shared_ptr<LogRing> ring;
+};
+
 bool s_logSynchronized = false;
 FILE* s_logFile = nullptr;
 TracyLockableN( std::recursive_mutex, s_logLock, "Logger" );
+
+std::atomic<bool> s_async = false;
+std::thread s_writer;
+std::atomic<bool> s_writerRun = false;
+std::atomic<uint32_t> s_pending = 0;
+
+TracyLockableN( std::mutex, s_drainLock, "Log drain" );
+std::mutex s_ringLock;
+std::vector<std::shared_ptr<LogRing>> s_rings;
+
+thread_local RingOwner t_ring;
+}
+
+LogLevel g_logLevel = LogLevel::Info;
+
+static void Drain();
+
+static void WriterThread()
+{
+    tracy::SetThreadName( "Log writer" );
+    while( s_writerRun.load( std::memory_order_acquire ) )
+    {
+        s_pending.wait( 0, std::memory_order_acquire );
+        s_pending.store( 0, std::memory_order_relaxed );
+        Drain();
+    }
+}
+
+static void StopWriter()
+{
+    SetLogAsync( false );
 }
 
 void SetLogLevel( LogLevel level )
 {
-    s_logLevel = level;
+    g_logLevel = level;
 }
 
 void SetLogSynchronized( bool sync )
@@ -27,9 +94,42 @@ void SetLogSynchronized( bool sync )
     s_logSynchronized = sync;
 }
 
+void SetLogAsync( bool async )
+{
+    std::lock_guard lock( s_logLock );
+    if( async == s_writer.joinable() ) return;
+
+    if( async )
+    {
+        // Runs before the destructor of the thread object, which was constructed earlier
+        static bool once = false;
+        if( !once )
+        {
+            atexit( StopWriter );
+            once = true;
+        }
+
+        s_writerRun.store( true, std::memory_order_release );
+        s_writer = std::thread( WriterThread );
+        s_async.store( true, std::memory_order_release );
+    }
+    else
+    {
+        s_async.store( false, std::memory_order_release );
+        s_writerRun.store( false, std::memory_order_release );
+        s_pending.store( 1, std::memory_order_release );
+        s_pending.notify_one();
+        s_writer.join();
+        Drain();
+    }
+}
+
 void SetLogToFile( bool enabled )
 {
     std::lock_guard lock( s_logLock );
+    Drain();
+
+    std::lock_guard drainLock( s_drainLock );
     if( enabled )
     {
         assert( !s_logFile );
@@ -45,7 +145,7 @@ void SetLogToFile( bool enabled )
 
 LogLevel GetLogLevel()
 {
-    return s_logLevel;
+    return g_logLevel;
 }
 
 void LogBlockBegin()
@@ -58,97 +158,376 @@ void LogBlockEnd()
     if( s_logSynchronized ) s_logLock.unlock();
 }
 
+void LogFlush()
+{
+    Drain();
+}
+
 namespace
 {
-void PrintLevel( LogLevel level )
+const char* LevelString( LogLevel level )
 {
-    const char* str = nullptr;
-
     switch( level )
     {
-    case LogLevel::Callstack: str = ANSI_CYAN "[STACK] "; break;
-    case LogLevel::Debug: str = ANSI_BOLD ANSI_BLACK "[DEBUG] "; break;
-    case LogLevel::Info: str = " [INFO] "; break;
-    case LogLevel::Warning: str = ANSI_BOLD ANSI_YELLOW " [WARN] "; break;
+    case LogLevel::Callstack: return ANSI_CYAN "[STACK] ";
+    case LogLevel::Debug: return ANSI_BOLD ANSI_BLACK "[DEBUG] ";
+    case LogLevel::Info: return " [INFO] ";
+    case LogLevel::Warning: return ANSI_BOLD ANSI_YELLOW " [WARN] ";
     case LogLevel::Error:
-    case LogLevel::ErrorTrace: str = ANSI_BOLD ANSI_RED "[ERROR] "; break;
-    case LogLevel::Fatal: str = ANSI_BOLD ANSI_MAGENTA "[FATAL] "; break;
-    default: assert( false ); break;
+    case LogLevel::ErrorTrace: return ANSI_BOLD ANSI_RED "[ERROR] ";
+    case LogLevel::Fatal: return ANSI_BOLD ANSI_MAGENTA "[FATAL] ";
+    default: assert( false ); return "";
+    }
+}
+
+// Writes everything, continuing after partial writes
+void WriteVec( int fd, iovec* iov, int count )
+{
+    while( count > 0 )
+    {
+        auto wr = writev( fd, iov, count );
+        if( wr < 0 )
+        {
+            if( errno == EINTR ) continue;
+            return;
+        }
+        while( count > 0 && size_t( wr ) >= iov->iov_len )
+        {
+            wr -= iov->iov_len;
+            iov++;
+            count--;
+        }
+        if( count > 0 )
+        {
+            iov->iov_base = (char*)iov->iov_base + wr;
+            iov->iov_len -= wr;
+        }
     }
+}
 
-    printf( "%s", str );
-    if( s_logFile ) fprintf( s_logFile, "%s", str );
+void Output( iovec* iov, int count )
+{
+    if( count == 0 ) return;
+    std::vector<iovec> copy;
+    if( s_logFile ) copy.assign( iov, iov + count );
+    WriteVec( STDOUT_FILENO, iov, count );
+    if( s_logFile ) WriteVec( fileno( s_logFile ), copy.data(), count );
 }
 
-void PrintSourceLocation( FILE* f, const char* fileName, size_t len, size_t line )
+// Complete lines, as they appear in the output
+class LineBuffer
 {
-    constexpr int FnLen = 20;
-    if( len > FnLen )
+public:
+    void Clear() { m_size = 0; }
+
+    // Returns the offset of the message text
+    size_t Begin( LogLevel level, const char* fileName, size_t line )
     {
-        fprintf( f, "…%s:%-4zu│ ", fileName + len - FnLen - 1, line );
+        Append( "%s", LevelString( level ) );
+
+        const auto len = strlen( fileName );
+        if( len > FnLen ) Append( "…%s:%-4zu│ ", fileName + len - FnLen - 1, line );
+        else Append( "%*s:%-4zu%*s│ ", FnLen, fileName, line, int( FnLen - len + 2 ), "" );
+
+        return m_size;
     }
-    else
+
+    void End()
+    {
+        Append( "%s", ANSI_RESET "\n" );
+    }
+
+    void AppendV( const char* fmt, va_list args )
+    {
+        va_list copy;
+        va_copy( copy, args );
+        const auto res = vsnprintf( m_buf.data() + m_size, m_buf.size() - m_size, fmt, args );
+        if( res > 0 && m_size + res >= m_buf.size() )
+        {
+            m_buf.resize( std::max( m_buf.size() * 2, m_size + res + 1 ) );
+            vsnprintf( m_buf.data() + m_size, m_buf.size() - m_size, fmt, copy );
+        }
+        va_end( copy );
+        if( res > 0 ) m_size += res;
+    }
+
+    void AppendDeferred( const LogDetail::Deferred& msg, const char* args )
+    {
+        const auto res = msg.format( m_buf.data() + m_size, m_buf.size() - m_size, msg.fmt, args );
+        if( res > 0 && m_size + res >= m_buf.size() )
+        {
+            m_buf.resize( std::max( m_buf.size() * 2, m_size + res + 1 ) );
+            msg.format( m_buf.data() + m_size, m_buf.size() - m_size, msg.fmt, args );
+        }
+        if( res > 0 ) m_size += res;
+    }
+
+    [[nodiscard]] const char* Data() const { return m_buf.data(); }
+    [[nodiscard]] size_t Size() const { return m_size; }
+
+private:
+    void Append( const char* fmt, ... )
+    {
+        va_list args;
+        va_start( args, fmt );
+        AppendV( fmt, args );
+        va_end( args );
+    }
+
+    std::vector<char> m_buf = std::vector<char>( 1024 );
+    size_t m_size = 0;
+};
+
+thread_local LineBuffer t_line;
+
+LogRing& ThreadRing()
+{
+    if( !t_ring.ring )
+    {
+        t_ring.ring = std::make_shared<LogRing>();
+        std::lock_guard lock( s_ringLock );
+        s_rings.emplace_back( t_ring.ring );
+    }
+    return *t_ring.ring;
+}
+
+// Returns the payload of a new entry, or nullptr if the ring is full. Published with Publish().
+char* Allocate( LogRing& ring, size_t size, size_t& pos )
+{
+    const size_t need = ( 4 + size + 3 ) & ~size_t( 3 );
+
+    auto head = ring.head.load( std::memory_order_relaxed );
+    const auto tail = ring.tail.load( std::memory_order_acquire );
+    auto offset = head % RingSize;
+    const auto pad = offset + need > RingSize ? RingSize - offset : 0;
+    if( head + pad + need - tail > RingSize ) return nullptr;
+
+    if( pad != 0 )
     {
-        fprintf( f, "%*s:%-4zu%*s│ ", FnLen, fileName, line, int( FnLen - len + 2 ), "" );
+        memcpy( ring.data + offset, &WrapMarker, 4 );
+        head += pad;
+        offset = 0;
     }
+    pos = head;
+    return ring.data + offset + 4;
 }
+
+void Publish( LogRing& ring, size_t pos, uint32_t len )
+{
+    memcpy( ring.data + pos % RingSize, &len, 4 );
+    ring.head.store( pos + ( ( 4 + ( len & ~DeferredBit ) + 3 ) & ~size_t( 3 ) ), std::memory_order_release );
+    if( s_pending.exchange( 1, std::memory_order_release ) == 0 ) s_pending.notify_one();
 }
 
-void MCoreLogMessage( LogLevel level, const char* fileName, size_t line, const char *fmt, ... )
+bool CanQueue( LogLevel level )
 {
-    if( level != LogLevel::Callstack && level < s_logLevel ) return;
+    return s_async.load( std::memory_order_acquire ) && !s_logSynchronized && level < LogLevel::Error && level != LogLevel::Callstack;
+}
+
+thread_local size_t t_reserved;
+
+// Deferred messages are formatted here, on the writer thread
+LineBuffer s_deferred;
+
+void DrainRing( LogRing& ring )
+{
+    const auto dropped = ring.dropped.exchange( 0, std::memory_order_relaxed );
+
+    auto tail = ring.tail.load( std::memory_order_relaxed );
+    const auto head = ring.head.load( std::memory_order_acquire );
+
+    // Formatted text is referenced by offset, as the buffer may grow while the batch is collected
+    iovec iov[IOV_MAX];
+    bool local[IOV_MAX];
+    int count = 0;
+    s_deferred.Clear();
 
+    auto flush = [&] {
+        for( int i=0; i<count; i++ )
+        {
+            if( local[i] ) iov[i].iov_base = (char*)s_deferred.Data() + (size_t)iov[i].iov_base;
+        }
+        Output( iov, count );
+        ring.tail.store( tail, std::memory_order_release );
+        count = 0;
+        s_deferred.Clear();
+    };
+
+    while( tail != head )
+    {
+        const auto offset = tail % RingSize;
+        uint32_t len;
+        memcpy( &len, ring.data + offset, 4 );
+        if( len == WrapMarker )
+        {
+            tail += RingSize - offset;
+            continue;
+        }
+
+        const auto payload = ring.data + offset + 4;
+        if( len & DeferredBit )
+        {
+            LogDetail::Deferred msg;
+            memcpy( &msg, payload, sizeof( msg ) );
+            const auto start = s_deferred.Size();
+            s_deferred.Begin( msg.level, msg.fileName, msg.line );
+            s_deferred.AppendDeferred( msg, payload + sizeof( msg ) );
+            s_deferred.End();
+            iov[count] = { (void*)start, s_deferred.Size() - start };
+            local[count++] = true;
+            len &= ~DeferredBit;
+        }
+        else
+        {
+            iov[count] = { payload, len };
+            local[count++] = false;
+        }
+        tail += ( 4 + len + 3 ) & ~size_t( 3 );
+
+        if( count == IOV_MAX ) flush();
+    }
+    flush();
+
+    if( dropped != 0 )
+    {
+        char tmp[128];
+        const auto len = snprintf( tmp, sizeof( tmp ), "%s%zu log messages dropped" ANSI_RESET "\n", LevelString( LogLevel::Warning ), dropped );
+        iovec notice = { tmp, size_t( len ) };
+        Output( &notice, 1 );
+    }
+}
+}
+
+char* LogDetail::Reserve( LogLevel level, size_t size, bool& dropped )
+{
+    dropped = false;
+    if( !CanQueue( level ) || size > MaxQueued ) return nullptr;
+
+    auto& ring = ThreadRing();
+    auto ptr = Allocate( ring, size, t_reserved );
+    if( !ptr )
+    {
+        ring.dropped.fetch_add( 1, std::memory_order_relaxed );
+        dropped = true;
+    }
+    return ptr;
+}
+
+void LogDetail::Commit( size_t size )
+{
+    Publish( *t_ring.ring, t_reserved, uint32_t( size ) | DeferredBit );
+}
+
+int LogDetail::Print( char* out, size_t size, const char* fmt, ... )
+{
     va_list args;
     va_start( args, fmt );
-    const auto len = strlen( fileName );
+    const auto res = vsnprintf( out, size, fmt, args );
+    va_end( args );
+    return res;
+}
 
-#ifndef DISABLE_CALLSTACK
-    // Get callstack outside of lock
-    const bool printCallstack = level >= LogLevel::ErrorTrace || ( level >= LogLevel::Error && s_logLevel <= LogLevel::Callstack );
-    CallstackData stack;
-    if( printCallstack ) stack.count = backtrace( stack.addr, 64 );
-#endif
+// Writes out the messages of all threads. Rings of threads which have exited are removed once empty.
+static void Drain()
+{
+    ZoneScoped;
+    std::lock_guard lock( s_drainLock );
 
-    s_logLock.lock();
-    PrintLevel( level );
-    PrintSourceLocation( stdout, fileName, len, line );
-    vprintf( fmt, args );
-    printf( ANSI_RESET "\n" );
-    fflush( stdout );
-    if( s_logFile )
+    std::vector<std::shared_ptr<LogRing>> rings;
     {
-        va_end( args );
-        va_start( args, fmt );
-        PrintSourceLocation( s_logFile, fileName, len, line );
-        vfprintf( s_logFile, fmt, args );
-        fprintf( s_logFile, ANSI_RESET "\n" );
-        fflush( s_logFile );
+        std::lock_guard ringLock( s_ringLock );
+        rings = s_rings;
     }
-#ifndef DISABLE_CALLSTACK
-    if( printCallstack ) PrintCallstack( stack, 1 );
-#endif
-    s_logLock.unlock();
+    for( auto& ring : rings ) DrainRing( *ring );
+
+    std::lock_guard ringLock( s_ringLock );
+    std::erase_if( s_rings, []( const auto& ring ) {
+        return ring->closed.load( std::memory_order_acquire ) && ring->head.load( std::memory_order_relaxed ) == ring->tail.load( std::memory_order_relaxed );
+    } );
+}
+
+void MCoreLogMessage( LogLevel level, const char* fileName, size_t line, const char *fmt, ... )
+{
+    if( level != LogLevel::Callstack && level < g_logLevel ) return;
+
+    va_list args;
+    va_start( args, fmt );
+    auto& buf = t_line;
+    buf.Clear();
+    const auto msg = buf.Begin( level, fileName, line );
+    buf.AppendV( fmt, args );
+    buf.End();
     va_end( args );
 
 #ifdef TRACY_ENABLE
     if( level != LogLevel::Callstack )
     {
-        va_start( args, fmt );
-        char tmp[8*1024];
-        const auto res = vsnprintf( tmp, sizeof( tmp ), fmt, args );
-        if( res > 0 )
+        // Without the trailing reset sequence and newline. Sent first, as printing a callstack reuses the buffer.
+        const auto data = buf.Data() + msg;
+        const auto size = buf.Size() - msg - strlen( ANSI_RESET "\n" );
+        switch( level )
         {
-            switch( level )
+        case LogLevel::Debug: TracyMessageC( data, size, 0x888888 ); break;
+        case LogLevel::Info: TracyMessage( data, size ); break;
+        case LogLevel::Warning: TracyMessageC( data, size, 0xFFFF00 ); break;
+        case LogLevel::Error: TracyMessageCS( data, size, 0xFF0000, 64 ); break;
+        case LogLevel::Fatal: TracyMessageCS( data, size, 0xFF00FF, 64 ); break;
+        default: assert( false ); break;
+        }
+    }
+#else
+    (void)msg;
+#endif
+
+    // Errors, messages too long for the ring, and everything in synchronized mode are written out right away,
+    // after the queued messages
+    if( CanQueue( level ) && buf.Size() <= MaxQueued )
+    {
+        auto& ring = ThreadRing();
+        size_t pos;
+        if( auto ptr = Allocate( ring, buf.Size(), pos ) )
+        {
+            memcpy( ptr, buf.Data(), buf.Size() );
+            Publish( ring, pos, uint32_t( buf.Size() ) );
+        }
+        else
+        {
+            ring.dropped.fetch_add( 1, std::memory_order_relaxed );
+        }
+    }
+    else
+    {
+#ifndef DISABLE_CALLSTACK
+        // Get callstack outside of lock
+        const bool printCallstack = level >= LogLevel::ErrorTrace || ( level >= LogLevel::Error && g_logLevel <= LogLevel::Callstack );
+        CallstackData stack;
+        if( printCallstack ) stack.count = backtrace( stack.addr, 64 );
+#endif
+
+        s_logLock.lock();
+        if( s_async.load( std::memory_order_relaxed ) ) Drain();
+        fwrite( buf.Data(), 1, buf.Size(), stdout );
+        fflush( stdout );
+        if( s_logFile )
+        {
+            fwrite( buf.Data(), 1, buf.Size(), s_logFile );
+            fflush( s_logFile );
+        }
+#ifndef DISABLE_CALLSTACK
+        // Plain errors may come in storms, their callstacks are symbolized in the background instead of under the
+        // lock. The process may not survive the worse ones long enough for that.
+        if( printCallstack )
+        {
+            if( level == LogLevel::Error && !s_logSynchronized )
             {
-            case LogLevel::Debug: TracyMessageC( tmp, res, 0x888888 ); break;
-            case LogLevel::Info: TracyMessage( tmp, res ); break;
-            case LogLevel::Warning: TracyMessageC( tmp, res, 0xFFFF00 ); break;
-            case LogLevel::Error: TracyMessageCS( tmp, res, 0xFF0000, 64 ); break;
-            case LogLevel::Fatal: TracyMessageCS( tmp, res, 0xFF00FF, 64 ); break;
-            default: assert( false ); break;
+                PrintCallstackDeferred( stack, 1 );
+            }
+            else
+            {
+                PrintCallstack( stack, 1 );
             }
         }
-        va_end( args );
-    }
 #endif
+        s_logLock.unlock();
+    }
 }
@@ -1,6 +1,10 @@
 #pragma once
 
 #include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <tuple>
+#include <type_traits>
 
 enum class LogLevel
 {
@@ -13,8 +17,26 @@ enum class LogLevel
     Fatal
 };
 
+// Messages below this level are compiled out, along with the evaluation of their arguments. Release builds
+// drop debug messages. Callstack messages are always kept.
+#ifndef MCORE_LOG_MIN_LEVEL
+#  ifdef NDEBUG
+#    define MCORE_LOG_MIN_LEVEL Info
+#  else
+#    define MCORE_LOG_MIN_LEVEL Callstack
+#  endif
+#endif
+
+constexpr LogLevel LogMinLevel = LogLevel::MCORE_LOG_MIN_LEVEL;
+
+extern LogLevel g_logLevel;
+
 void SetLogLevel( LogLevel level );
 void SetLogSynchronized( bool sync );
+// Queues messages below the error level in per thread buffers, which a background thread writes out. Messages
+// are dropped if a buffer is full. Errors, and all messages in synchronized mode, are still written right away.
+// Messages with only numbers, pointers and strings as arguments are formatted by the background thread.
+void SetLogAsync( bool async );
 void SetLogToFile( bool enabled );
 
 LogLevel GetLogLevel();
@@ -22,6 +44,122 @@ LogLevel GetLogLevel();
 void LogBlockBegin();
 void LogBlockEnd();
 
+// Writes out the queued messages of all threads
+void LogFlush();
+
 void MCoreLogMessage( LogLevel level, const char* fileName, size_t line, const char* fmt, ... );
 
-#define mclog(level, fmt, ...) MCoreLogMessage( level, __FILE__, __LINE__, fmt, ##__VA_ARGS__ )
+namespace LogDetail
+{
+using FormatFn = int(*)( char* out, size_t size, const char* fmt, const char* args );
+
+// Queued in place of the text of a message. The format string and the file name must outlive the writer,
+// which string literals do. Char pointers are copied as strings, anything else by value.
+struct Deferred
+{
+    FormatFn format;
+    const char* fmt;
+    const char* fileName;
+    uint32_t line;
+    LogLevel level;
+};
+
+// Space for a deferred message in the ring of the calling thread. Returns nullptr if the message has to be
+// formatted right away, or if it was dropped because the ring is full, in which case dropped is set.
+char* Reserve( LogLevel level, size_t size, bool& dropped );
+void Commit( size_t size );
+
+int Print( char* out, size_t size, const char* fmt, ... );
+
+template<typename T>
+constexpr bool IsString = std::is_pointer_v<T> && std::is_same_v<std::remove_cv_t<std::remove_pointer_t<T>>, char>;
+
+template<typename T>
+constexpr bool IsDeferrable = std::is_arithmetic_v<T> || std::is_enum_v<T> || std::is_pointer_v<T> || std::is_null_pointer_v<T>;
+
+template<typename T>
+size_t PackedSize( T v )
+{
+    if constexpr( IsString<T> ) return sizeof( uint32_t ) + ( v ? strlen( v ) + 1 : 0 );
+    else return sizeof( T );
+}
+
+template<typename T>
+void Pack( char*& ptr, T v )
+{
+    if constexpr( IsString<T> )
+    {
+        const uint32_t len = v ? uint32_t( strlen( v ) ) : UINT32_MAX;
+        memcpy( ptr, &len, sizeof( len ) );
+        ptr += sizeof( len );
+        if( v )
+        {
+            memcpy( ptr, v, len + 1 );
+            ptr += len + 1;
+        }
+    }
+    else
+    {
+        memcpy( ptr, &v, sizeof( T ) );
+        ptr += sizeof( T );
+    }
+}
+
+template<typename T>
+auto Unpack( const char*& ptr )
+{
+    if constexpr( IsString<T> )
+    {
+        uint32_t len;
+        memcpy( &len, ptr, sizeof( len ) );
+        ptr += sizeof( len );
+        if( len == UINT32_MAX ) return (const char*)nullptr;
+        const auto str = ptr;
+        ptr += len + 1;
+        return str;
+    }
+    else
+    {
+        T v;
+        memcpy( &v, ptr, sizeof( T ) );
+        ptr += sizeof( T );
+        return v;
+    }
+}
+
+template<typename... Args>
+int Format( char* out, size_t size, const char* fmt, const char* args )
+{
+    // Braced initialization unpacks the arguments in order
+    std::tuple<decltype( Unpack<Args>( args ) )...> values { Unpack<Args>( args )... };
+    return std::apply( [&]( auto... v ) { return Print( out, size, fmt, v... ); }, values );
+}
+
+template<typename... Args>
+void Log( LogLevel level, const char* fileName, size_t line, const char* fmt, Args... args )
+{
+#ifndef TRACY_ENABLE
+    if constexpr( ( IsDeferrable<Args> && ... ) )
+    {
+        const auto size = sizeof( Deferred ) + ( PackedSize( args ) + ... + 0 );
+        bool dropped;
+        if( auto ptr = Reserve( level, size, dropped ) )
+        {
+            const Deferred hdr = { Format<Args...>, fmt, fileName, uint32_t( line ), level };
+            memcpy( ptr, &hdr, sizeof( hdr ) );
+            ptr += sizeof( hdr );
+            ( Pack( ptr, args ), ... );
+            Commit( size );
+            return;
+        }
+        if( dropped ) return;
+    }
+#endif
+    MCoreLogMessage( level, fileName, line, fmt, args... );
+}
+
+constexpr bool IsCompiled( LogLevel level ) { return level == LogLevel::Callstack || level >= LogMinLevel; }
+inline bool IsEnabled( LogLevel level ) { return IsCompiled( level ) && ( level == LogLevel::Callstack || level >= g_logLevel ); }
+}
+
+#define mclog(level, fmt, ...) do { if( LogDetail::IsEnabled( level ) ) LogDetail::Log( level, __FILE__, __LINE__, fmt, ##__VA_ARGS__ ); } while( 0 )
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <array>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+// RFC 1321 digest. Only for identifying data, e.g. thumbnail file names, not for security.
+[[nodiscard]] std::array<uint8_t, 16> Md5( const void* data, size_t size );
+[[nodiscard]] std::string Md5Hex( const void* data, size_t size );
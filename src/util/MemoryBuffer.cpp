@@ -1,3 +1,9 @@
+#include <algorithm>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <unistd.h>
 
 #include "MemoryBuffer.hpp"
@@ -13,20 +19,88 @@ MemoryBuffer::MemoryBuffer( int fd )
 {
     if( fd < 0 ) return;
 
-    char buf[64*1024];
-    while( true )
+    struct stat st;
+    const auto valid = fstat( fd, &st ) == 0;
+    if( valid && S_ISREG( st.st_mode ) && lseek( fd, 0, SEEK_CUR ) == 0 )
     {
-        auto len = read( fd, buf, sizeof( buf ) );
-        if( len <= 0 ) break;
-        m_buf.insert( m_buf.end(), buf, buf + len );
+        if( st.st_size == 0 || Map( fd, st.st_size ) )
+        {
+            close( fd );
+            return;
+        }
     }
+    if( !valid || !S_ISFIFO( st.st_mode ) || !Splice( fd ) ) Read( fd );
     close( fd );
+}
 
-    m_data = m_buf.data();
-    m_size = m_buf.size();
+MemoryBuffer::~MemoryBuffer()
+{
+    if( m_map ) munmap( m_map, m_size );
 }
 
 std::string MemoryBuffer::AsString() const
 {
-    return { m_buf.data(), m_buf.size() };
+    if( !m_data ) return {};
+    return { m_data, m_size };
+}
+
+bool MemoryBuffer::Map( int fd, size_t size )
+{
+    auto map = mmap( nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    if( map == MAP_FAILED ) return false;
+
+    madvise( map, size, MADV_SEQUENTIAL );
+    m_map = map;
+    m_data = (const char*)map;
+    m_size = size;
+    return true;
+}
+
+bool MemoryBuffer::Splice( int fd )
+{
+    const auto mem = memfd_create( "MemoryBuffer", MFD_CLOEXEC );
+    if( mem < 0 ) return false;
+
+    int available = 0;
+    if( ioctl( fd, FIONREAD, &available ) != 0 || available <= 0 ) available = 64*1024;
+
+    size_t size = 0;
+    while( true )
+    {
+        // The pages of the pipe are moved into the file, if the writer allows it
+        const auto len = splice( fd, nullptr, mem, nullptr, std::max<size_t>( available, 1024*1024 ), SPLICE_F_MOVE | SPLICE_F_MORE );
+        if( len < 0 && errno == EINTR ) continue;
+        if( len < 0 && size == 0 )
+        {
+            // Nothing was taken from the pipe yet, so it can still be read normally
+            close( mem );
+            return false;
+        }
+        if( len <= 0 ) break;
+        size += len;
+    }
+
+    const auto ok = size == 0 || Map( mem, size );
+    close( mem );
+    return ok;
+}
+
+void MemoryBuffer::Read( int fd )
+{
+    int available = 0;
+    if( ioctl( fd, FIONREAD, &available ) == 0 && available > 0 ) m_buf.reserve( available );
+
+    size_t size = 0;
+    while( true )
+    {
+        if( m_buf.size() - size < 64*1024 ) m_buf.resize( std::max<size_t>( m_buf.size() * 2, size + 64*1024 ) );
+        const auto len = read( fd, m_buf.data() + size, m_buf.size() - size );
+        if( len < 0 && errno == EINTR ) continue;
+        if( len <= 0 ) break;
+        size += len;
+    }
+    m_buf.resize( size );
+
+    m_data = m_buf.empty() ? nullptr : m_buf.data();
+    m_size = m_buf.size();
 }
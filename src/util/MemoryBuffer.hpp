@@ -11,12 +11,21 @@ class MemoryBuffer : public DataBuffer
 public:
     MemoryBuffer() = default;
     explicit MemoryBuffer( std::vector<char>&& buf );
+
+    // Takes ownership of the descriptor and reads it to the end. Regular files are mapped, pipes are spliced into
+    // an anonymous memory file, which is then mapped, so that the data is not copied around as it grows.
     explicit MemoryBuffer( int fd );
+    ~MemoryBuffer() override;
 
     [[nodiscard]] std::string AsString() const;
 
     NoCopy( MemoryBuffer );
 
 private:
+    [[nodiscard]] bool Map( int fd, size_t size );
+    [[nodiscard]] bool Splice( int fd );
+    void Read( int fd );
+
     std::vector<char> m_buf;
+    void* m_map = nullptr;
 };
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <atomic>
+#include <format>
+#include <mutex>
+#include <tracy/Tracy.hpp>
+#include <vector>
+
+#include "MemoryStats.hpp"
+
+namespace
+{
+// Tracy tells pools apart by the name pointer, so the names must stay the same
+constexpr const char* Names[] = {
+    "Bitmap",
+    "BitmapHdr",
+    "BitmapHdrHalf",
+    "Pixels",
+    "Texture scratch",
+    "Pixel cache",
+    "Staging",
+    "Vulkan buffers",
+    "Textures"
+};
+static_assert( std::size( Names ) == MemoryStats::NumPools );
+
+std::atomic<uint64_t> s_current[MemoryStats::NumPools];
+
+// Watermarks are only updated while any exist, so that allocations are plain counter updates otherwise
+std::atomic<uint32_t> s_numMarks;
+std::mutex s_lock;
+std::vector<MemoryStats::Usage*> s_marks;
+}
+
+namespace MemoryStats
+{
+
+uint64_t Usage::Total() const
+{
+    uint64_t ret = 0;
+    for( auto v : bytes ) ret += v;
+    return ret;
+}
+
+std::string Usage::Format() const
+{
+    auto ret = std::format( "{:.1f} MiB", total / ( 1024.f * 1024.f ) );
+    const char* sep = " (";
+    for( size_t i=0; i<NumPools; i++ )
+    {
+        if( bytes[i] == 0 ) continue;
+        ret += std::format( "{}{} {:.1f}", sep, Names[i], bytes[i] / ( 1024.f * 1024.f ) );
+        sep = ", ";
+    }
+    if( *sep == ',' ) ret += ')';
+    return ret;
+}
+
+void Alloc( Pool pool, const void* ptr, size_t size )
+{
+    TracyAllocN( ptr, size, Names[(size_t)pool] );
+    s_current[(size_t)pool].fetch_add( size, std::memory_order_relaxed );
+    if( s_numMarks.load( std::memory_order_relaxed ) == 0 ) return;
+
+    const auto current = Current();
+    std::lock_guard lock( s_lock );
+    for( auto peak : s_marks )
+    {
+        for( size_t i=0; i<NumPools; i++ ) peak->bytes[i] = std::max( peak->bytes[i], current.bytes[i] );
+        peak->total = std::max( peak->total, current.total );
+    }
+}
+
+void Free( Pool pool, const void* ptr, size_t size )
+{
+    TracyFreeN( ptr, Names[(size_t)pool] );
+    s_current[(size_t)pool].fetch_sub( size, std::memory_order_relaxed );
+}
+
+const char* Name( Pool pool )
+{
+    return Names[(size_t)pool];
+}
+
+Usage Current()
+{
+    Usage ret;
+    for( size_t i=0; i<NumPools; i++ ) ret.bytes[i] = s_current[i].load( std::memory_order_relaxed );
+    ret.total = ret.Total();
+    return ret;
+}
+
+Watermark::Watermark()
+    : m_peak( Current() )
+{
+    std::lock_guard lock( s_lock );
+    s_marks.emplace_back( &m_peak );
+    s_numMarks.fetch_add( 1, std::memory_order_relaxed );
+}
+
+Watermark::~Watermark()
+{
+    std::lock_guard lock( s_lock );
+    std::erase( s_marks, &m_peak );
+    s_numMarks.fetch_sub( 1, std::memory_order_relaxed );
+}
+
+Usage Watermark::Peak() const
+{
+    std::lock_guard lock( s_lock );
+    return m_peak;
+}
+
+}
@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+
+#include "NoCopy.hpp"
+
+// Accounting of the large allocations by what they are for, to tell where peak memory goes. Each pool shows up
+// as a named memory pool in Tracy, and current and peak usage can be queried for logs.
+namespace MemoryStats
+{
+
+enum class Pool
+{
+    Bitmap,
+    BitmapHdr,
+    BitmapHdrHalf,
+    Pixels,         // Other pixel data, such as YCbCr planes, DCT coefficients or block compressed images
+    Scratch,        // Mip chains and conversion temporaries made while building textures
+    PixelCache,     // Freed pixel buffers kept for reuse
+    Staging,        // Host visible Vulkan buffers
+    Buffers,        // Other Vulkan buffers
+    Textures,       // Vulkan images made through VMA
+    NumPools
+};
+
+constexpr size_t NumPools = (size_t)Pool::NumPools;
+
+struct Usage
+{
+    [[nodiscard]] uint64_t Total() const;
+
+    // Total and the non-empty pools in MiB, e.g. "120.5 MiB (Bitmap 96.0, Textures 24.5)"
+    [[nodiscard]] std::string Format() const;
+
+    uint64_t bytes[NumPools] = {};
+    uint64_t total = 0;     // For peaks, the highest sum seen, which may be less than the sum of pool peaks
+};
+
+// The pool passed to Free() must be the one the memory was allocated from.
+void Alloc( Pool pool, const void* ptr, size_t size );
+void Free( Pool pool, const void* ptr, size_t size );
+
+[[nodiscard]] const char* Name( Pool pool );
+[[nodiscard]] Usage Current();
+
+// High-water marks of all pools while the object exists. Allocations anywhere in the process are counted, so
+// the peaks of jobs which overlap include each other.
+class Watermark
+{
+public:
+    Watermark();
+    ~Watermark();
+
+    NoCopy( Watermark );
+
+    [[nodiscard]] Usage Peak() const;
+
+private:
+    Usage m_peak;
+};
+
+}
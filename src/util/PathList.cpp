@@ -0,0 +1,136 @@
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include "PathList.hpp"
+#include "Panic.hpp"
+
+namespace
+{
+bool IsDigit( char c ) { return c >= '0' && c <= '9'; }
+}
+
+bool NaturalLess( std::string_view a, std::string_view b )
+{
+    size_t i = 0, j = 0;
+    while( i < a.size() && j < b.size() )
+    {
+        if( IsDigit( a[i] ) && IsDigit( b[j] ) )
+        {
+            // Leading zeros only break ties between equal values
+            auto za = i, zb = j;
+            while( za < a.size() && a[za] == '0' ) za++;
+            while( zb < b.size() && b[zb] == '0' ) zb++;
+            auto ea = za, eb = zb;
+            while( ea < a.size() && IsDigit( a[ea] ) ) ea++;
+            while( eb < b.size() && IsDigit( b[eb] ) ) eb++;
+
+            if( ea - za != eb - zb ) return ea - za < eb - zb;
+            if( const auto cmp = a.substr( za, ea - za ).compare( b.substr( zb, eb - zb ) ); cmp != 0 ) return cmp < 0;
+            if( za - i != zb - j ) return za - i < zb - j;
+            i = ea;
+            j = eb;
+        }
+        else
+        {
+            if( a[i] != b[j] ) return (unsigned char)a[i] < (unsigned char)b[j];
+            i++;
+            j++;
+        }
+    }
+    return i == a.size() && j < b.size();
+}
+
+PathList::PathList( std::string_view dir )
+    : m_prefix( dir )
+{
+    if( !m_prefix.empty() && m_prefix.back() != '/' ) m_prefix += '/';
+}
+
+PathList::PathList( const std::vector<std::string>& paths )
+{
+    if( paths.empty() ) return;
+
+    std::string_view prefix = paths[0];
+    prefix = prefix.substr( 0, prefix.find_last_of( '/' ) + 1 );
+    for( auto& path : paths )
+    {
+        while( !prefix.empty() && !std::string_view( path ).starts_with( prefix ) )
+        {
+            prefix.remove_suffix( 1 );
+            prefix = prefix.substr( 0, prefix.find_last_of( '/' ) + 1 );
+        }
+    }
+    m_prefix = prefix;
+
+    size_t bytes = 0;
+    for( auto& path : paths ) bytes += path.size() - m_prefix.size() + 1;
+    Reserve( paths.size(), bytes );
+    for( auto& path : paths ) Add( std::string_view( path ).substr( m_prefix.size() ) );
+}
+
+void PathList::Add( std::string_view name )
+{
+    CheckPanic( m_names.size() + name.size() + 1 <= UINT32_MAX, "Path list too large" );
+    m_entries.emplace_back( Entry { uint32_t( m_names.size() ), uint32_t( name.size() ) } );
+    m_names.insert( m_names.end(), name.begin(), name.end() );
+    m_names.emplace_back( '\0' );
+}
+
+void PathList::Reserve( size_t count, size_t bytes )
+{
+    m_entries.reserve( count );
+    m_names.reserve( bytes );
+}
+
+void PathList::Sort()
+{
+    ZoneScoped;
+    ZoneValue( m_entries.size() );
+
+    const auto names = m_names.data();
+    std::ranges::sort( m_entries, [names]( const Entry& a, const Entry& b ) {
+        return NaturalLess( std::string_view( names + a.offset, a.size ), std::string_view( names + b.offset, b.size ) );
+    } );
+}
+
+void PathList::Clear()
+{
+    m_prefix.clear();
+    m_names.clear();
+    m_entries.clear();
+}
+
+std::string PathList::Path( size_t idx ) const
+{
+    std::string ret;
+    ret.reserve( m_prefix.size() + m_entries[idx].size );
+    ret += m_prefix;
+    ret += NameView( idx );
+    return ret;
+}
+
+bool PathList::Is( size_t idx, std::string_view path ) const
+{
+    return path.size() == m_prefix.size() + m_entries[idx].size && path.starts_with( m_prefix ) && path.substr( m_prefix.size() ) == NameView( idx );
+}
+
+size_t PathList::Find( std::string_view path ) const
+{
+    if( !path.starts_with( m_prefix ) ) return npos;
+    const auto name = path.substr( m_prefix.size() );
+    for( size_t i=0; i<m_entries.size(); i++ )
+    {
+        if( NameView( i ) == name ) return i;
+    }
+    return npos;
+}
+
+size_t PathList::LowerBound( std::string_view path ) const
+{
+    if( !path.starts_with( m_prefix ) ) return m_entries.size();
+    const auto name = path.substr( m_prefix.size() );
+    const auto it = std::ranges::partition_point( m_entries, [this, name]( const Entry& e ) {
+        return NaturalLess( std::string_view( m_names.data() + e.offset, e.size ), name );
+    } );
+    return size_t( std::distance( m_entries.begin(), it ) );
+}
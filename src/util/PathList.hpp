@@ -0,0 +1,54 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Natural order, in which runs of digits compare by their value, so that "img2" comes before "img10"
+[[nodiscard]] bool NaturalLess( std::string_view a, std::string_view b );
+
+// File paths sharing a directory prefix, which is stored once. The names are kept NUL terminated in a single
+// buffer, so that a list of any length takes a few allocations, and a name can be passed to the *at() calls
+// relative to the opened directory as it is.
+class PathList
+{
+public:
+    static constexpr size_t npos = size_t( -1 );
+
+    PathList() = default;
+    // Names are added relative to the directory. An empty directory makes them full paths.
+    explicit PathList( std::string_view dir );
+    // Any paths, e.g. from an URI list. Their common directory, if there is one, becomes the prefix.
+    explicit PathList( const std::vector<std::string>& paths );
+
+    void Add( std::string_view name );
+    void Reserve( size_t count, size_t bytes );
+    void Sort();        // Natural order
+    void Clear();
+
+    [[nodiscard]] size_t Size() const { return m_entries.size(); }
+    [[nodiscard]] bool Empty() const { return m_entries.empty(); }
+
+    [[nodiscard]] const std::string& Prefix() const { return m_prefix; }        // Ends with a slash, if not empty
+    [[nodiscard]] const char* Name( size_t idx ) const { return m_names.data() + m_entries[idx].offset; }
+    [[nodiscard]] std::string_view NameView( size_t idx ) const { return std::string_view( Name( idx ), m_entries[idx].size ); }
+    [[nodiscard]] std::string Path( size_t idx ) const;
+
+    [[nodiscard]] bool Is( size_t idx, std::string_view path ) const;
+    [[nodiscard]] size_t Find( std::string_view path ) const;           // npos if not in the list
+    // First entry not before the path, for sorted lists. Size() if the path is outside of the prefix.
+    [[nodiscard]] size_t LowerBound( std::string_view path ) const;
+
+private:
+    struct Entry
+    {
+        uint32_t offset;
+        uint32_t size;
+    };
+
+    std::string m_prefix;
+    std::vector<char> m_names;
+    std::vector<Entry> m_entries;      // In list order, sorting only moves these
+};
@@ -0,0 +1,140 @@
+#include <atomic>
+#include <mutex>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <tracy/Tracy.hpp>
+#include <vector>
+
+#include "PixelPool.hpp"
+#include "Panic.hpp"
+
+namespace
+{
+constexpr size_t Alignment = 64;
+
+// Smaller buffers are not worth pooling and go straight to the allocator.
+constexpr size_t MinPooledSize = 256 * 1024;
+constexpr size_t HugePageSize = 2 * 1024 * 1024;
+
+struct CachedBuffer
+{
+    void* ptr;
+    size_t size;
+};
+
+std::mutex s_lock;
+std::vector<CachedBuffer> s_cache;      // Oldest first
+size_t s_cachedSize = 0;
+size_t s_limit = 256 * 1024 * 1024;
+std::atomic<bool> s_hugePages = true;
+
+// Size classes are spaced at quarter powers of two, which wastes at most 25% of the requested size.
+size_t SizeClass( size_t size )
+{
+    if( size < MinPooledSize ) return size;
+
+    const auto bits = 63 - __builtin_clzll( size );
+    const auto step = size_t( 1 ) << ( bits - 2 );
+    return ( size + step - 1 ) & ~( step - 1 );
+}
+
+void* MapBuffer( size_t size )
+{
+    auto ptr = mmap( nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0 );
+    CheckPanic( ptr != MAP_FAILED, "Failed to allocate %zu bytes of pixel data", size );
+    if( s_hugePages.load( std::memory_order_relaxed ) && size >= HugePageSize ) madvise( ptr, size, MADV_HUGEPAGE );
+    return ptr;
+}
+
+void ReleaseLocked( size_t limit )
+{
+    size_t num = 0;
+    while( s_cachedSize > limit )
+    {
+        auto& buf = s_cache[num++];
+        MemoryStats::Free( MemoryStats::Pool::PixelCache, buf.ptr, buf.size );
+        munmap( buf.ptr, buf.size );
+        s_cachedSize -= buf.size;
+    }
+    s_cache.erase( s_cache.begin(), s_cache.begin() + num );
+}
+}
+
+void* PixelAlloc( size_t size, MemoryStats::Pool pool )
+{
+    ZoneScoped;
+    if( size == 0 ) size = 1;
+
+    const auto cls = SizeClass( size );
+    if( cls < MinPooledSize )
+    {
+        auto ptr = aligned_alloc( Alignment, ( size + Alignment - 1 ) & ~( Alignment - 1 ) );
+        CheckPanic( ptr, "Failed to allocate %zu bytes of pixel data", size );
+        MemoryStats::Alloc( pool, ptr, cls );
+        return ptr;
+    }
+
+    void* ptr = nullptr;
+    {
+        std::lock_guard lock( s_lock );
+        for( size_t i=s_cache.size(); i>0; i-- )
+        {
+            if( s_cache[i-1].size == cls )
+            {
+                ptr = s_cache[i-1].ptr;
+                s_cache.erase( s_cache.begin() + i - 1 );
+                s_cachedSize -= cls;
+                MemoryStats::Free( MemoryStats::Pool::PixelCache, ptr, cls );
+                break;
+            }
+        }
+    }
+
+    if( !ptr ) ptr = MapBuffer( cls );
+    MemoryStats::Alloc( pool, ptr, cls );
+    return ptr;
+}
+
+void PixelFree( void* ptr, size_t size, MemoryStats::Pool pool )
+{
+    if( !ptr ) return;
+    if( size == 0 ) size = 1;
+
+    const auto cls = SizeClass( size );
+    MemoryStats::Free( pool, ptr, cls );
+    if( cls < MinPooledSize )
+    {
+        free( ptr );
+        return;
+    }
+
+    std::lock_guard lock( s_lock );
+    if( cls > s_limit )
+    {
+        munmap( ptr, cls );
+        return;
+    }
+    s_cache.emplace_back( CachedBuffer { ptr, cls } );
+    s_cachedSize += cls;
+    MemoryStats::Alloc( MemoryStats::Pool::PixelCache, ptr, cls );
+    ReleaseLocked( s_limit );
+}
+
+void PixelPoolTrim()
+{
+    std::lock_guard lock( s_lock );
+    ReleaseLocked( 0 );
+}
+
+void PixelPoolSetLimit( size_t bytes )
+{
+    std::lock_guard lock( s_lock );
+    s_limit = bytes;
+    ReleaseLocked( s_limit );
+}
+
+void PixelPoolSetHugePages( bool enable )
+{
+    s_hugePages.store( enable, std::memory_order_relaxed );
+}
@@ -0,0 +1,26 @@
+#pragma once
+
+#include <stddef.h>
+
+#include "MemoryStats.hpp"
+
+// Storage for bitmap pixel data. All buffers are 64 byte aligned. Large buffers are rounded up to a size class
+// and kept for reuse when freed, so that repeatedly loading images of similar size doesn't fault in fresh
+// memory every time. The size and pool passed to PixelFree() must match the ones given to PixelAlloc().
+[[nodiscard]] void* PixelAlloc( size_t size, MemoryStats::Pool pool = MemoryStats::Pool::Pixels );
+void PixelFree( void* ptr, size_t size, MemoryStats::Pool pool = MemoryStats::Pool::Pixels );
+
+template<typename T>
+[[nodiscard]] T* PixelAlloc( size_t count, MemoryStats::Pool pool = MemoryStats::Pool::Pixels ) { return (T*)PixelAlloc( count * sizeof( T ), pool ); }
+
+template<typename T>
+void PixelFree( T* ptr, size_t count, MemoryStats::Pool pool = MemoryStats::Pool::Pixels ) { PixelFree( (void*)ptr, count * sizeof( T ), pool ); }
+
+// Releases all cached buffers.
+void PixelPoolTrim();
+
+// Upper limit of memory kept for reuse. Setting it to zero disables caching.
+void PixelPoolSetLimit( size_t bytes );
+
+// Large buffers are backed by transparent huge pages, if enabled. This is on by default.
+void PixelPoolSetHugePages( bool enable );
@@ -0,0 +1,135 @@
+#include <algorithm>
+
+#include "Region.hpp"
+
+namespace
+{
+// Appends the parts of a which are not covered by b, at most four bands
+void SubtractRect( const Region::Rect& a, const Region::Rect& b, std::vector<Region::Rect>& out )
+{
+    const auto i = Intersection( a, b );
+    if( i.IsEmpty() )
+    {
+        out.emplace_back( a );
+        return;
+    }
+
+    if( a.y0 < i.y0 ) out.emplace_back( Region::Rect { a.x0, a.y0, a.x1, i.y0 } );
+    if( i.y1 < a.y1 ) out.emplace_back( Region::Rect { a.x0, i.y1, a.x1, a.y1 } );
+    if( a.x0 < i.x0 ) out.emplace_back( Region::Rect { a.x0, i.y0, i.x0, i.y1 } );
+    if( i.x1 < a.x1 ) out.emplace_back( Region::Rect { i.x1, i.y0, a.x1, i.y1 } );
+}
+}
+
+Region::Rect Intersection( const Region::Rect& a, const Region::Rect& b )
+{
+    return {
+        std::max( a.x0, b.x0 ),
+        std::max( a.y0, b.y0 ),
+        std::min( a.x1, b.x1 ),
+        std::min( a.y1, b.y1 )
+    };
+}
+
+Region::Region( const Rect& rect )
+{
+    if( !rect.IsEmpty() ) m_rects.emplace_back( rect );
+}
+
+void Region::Add( const Rect& rect )
+{
+    if( rect.IsEmpty() ) return;
+
+    // Only the parts not yet in the region are added, so that the rectangles stay disjoint
+    std::vector<Rect> pieces = { rect };
+    std::vector<Rect> tmp;
+    for( auto& r : m_rects )
+    {
+        tmp.clear();
+        for( auto& p : pieces ) SubtractRect( p, r, tmp );
+        std::swap( pieces, tmp );
+        if( pieces.empty() ) return;
+    }
+    m_rects.insert( m_rects.end(), pieces.begin(), pieces.end() );
+    if( m_rects.size() > MaxRects ) Collapse();
+}
+
+void Region::Add( const Region& region )
+{
+    for( auto& r : region.m_rects ) Add( r );
+    if( !region.m_exact ) m_exact = false;
+}
+
+void Region::Subtract( const Rect& rect )
+{
+    if( rect.IsEmpty() || m_rects.empty() ) return;
+
+    std::vector<Rect> out;
+    out.reserve( m_rects.size() + 4 );
+    for( auto& r : m_rects ) SubtractRect( r, rect, out );
+    m_rects = std::move( out );
+    if( m_rects.size() > MaxRects ) Collapse();
+}
+
+void Region::Subtract( const Region& region )
+{
+    for( auto& r : region.m_rects ) Subtract( r );
+}
+
+void Region::Intersect( const Rect& rect )
+{
+    for( auto& r : m_rects ) r = Intersection( r, rect );
+    std::erase_if( m_rects, []( const auto& r ) { return r.IsEmpty(); } );
+}
+
+void Region::Translate( int32_t dx, int32_t dy )
+{
+    for( auto& r : m_rects )
+    {
+        r.x0 += dx;
+        r.x1 += dx;
+        r.y0 += dy;
+        r.y1 += dy;
+    }
+}
+
+bool Region::Intersects( const Rect& rect ) const
+{
+    return std::ranges::any_of( m_rects, [&rect]( const auto& r ) { return !Intersection( r, rect ).IsEmpty(); } );
+}
+
+bool Region::Contains( const Rect& rect ) const
+{
+    if( rect.IsEmpty() ) return true;
+    Region rest( rect );
+    rest.Subtract( *this );
+    return rest.IsEmpty();
+}
+
+Region::Rect Region::Bounds() const
+{
+    if( m_rects.empty() ) return {};
+    auto ret = m_rects[0];
+    for( size_t i=1; i<m_rects.size(); i++ )
+    {
+        ret.x0 = std::min( ret.x0, m_rects[i].x0 );
+        ret.y0 = std::min( ret.y0, m_rects[i].y0 );
+        ret.x1 = std::max( ret.x1, m_rects[i].x1 );
+        ret.y1 = std::max( ret.y1, m_rects[i].y1 );
+    }
+    return ret;
+}
+
+uint64_t Region::Area() const
+{
+    uint64_t ret = 0;
+    for( auto& r : m_rects ) ret += uint64_t( r.Width() ) * r.Height();
+    return ret;
+}
+
+void Region::Collapse()
+{
+    const auto bounds = Bounds();
+    m_rects.assign( 1, bounds );
+    m_exact = false;
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// A set of pixels, stored as non-overlapping rectangles. Used for damage and for surface opacity.
+//
+// The number of rectangles is capped. A region which grows beyond that is replaced by its bounding box, which
+// only ever makes it cover more pixels: repainting a bit more is cheaper than tracking every fragment of a busy
+// frame. It does make the region useless where covering too much is wrong, such as for opacity, which IsExact()
+// tells.
+class Region
+{
+public:
+    // Half open, x1 and y1 are not part of the rectangle. Same layout as drm_mode_rect.
+    struct Rect
+    {
+        int32_t x0, y0, x1, y1;
+
+        [[nodiscard]] bool IsEmpty() const { return x0 >= x1 || y0 >= y1; }
+        [[nodiscard]] int32_t Width() const { return x1 - x0; }
+        [[nodiscard]] int32_t Height() const { return y1 - y0; }
+
+        bool operator==( const Rect& rhs ) const = default;
+    };
+
+    static constexpr size_t MaxRects = 16;
+
+    Region() = default;
+    explicit Region( const Rect& rect );
+
+    void Add( const Rect& rect );
+    void Add( const Region& region );
+    void Subtract( const Rect& rect );
+    void Subtract( const Region& region );
+    void Intersect( const Rect& rect );
+    void Translate( int32_t dx, int32_t dy );
+    void Clear() { m_rects.clear(); m_exact = true; }
+
+    [[nodiscard]] bool Intersects( const Rect& rect ) const;
+    [[nodiscard]] bool Contains( const Rect& rect ) const;
+    [[nodiscard]] Rect Bounds() const;
+    [[nodiscard]] uint64_t Area() const;
+
+    [[nodiscard]] bool IsEmpty() const { return m_rects.empty(); }
+    [[nodiscard]] bool IsExact() const { return m_exact; }
+    [[nodiscard]] auto& Rects() const { return m_rects; }
+
+private:
+    void Collapse();
+
+    std::vector<Rect> m_rects;
+    bool m_exact = true;
+};
+
+[[nodiscard]] Region::Rect Intersection( const Region::Rect& a, const Region::Rect& b );
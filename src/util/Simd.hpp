@@ -2,13 +2,14 @@
 
 // Based on https://github.com/AcademySoftwareFoundation/OpenImageIO/blob/main/src/include/OpenImageIO/fmath.h
 
-#if defined __SSE4_1__
-#  include <x86intrin.h>
-#endif
+#include "SimdDispatch.hpp"
 
-#if defined __SSE4_1__ && defined __FMA__
+#if defined MCORE_SIMD_X86
+#  include <x86intrin.h>
 
-static inline __m128 _mm_log_ps( __m128 x )
+// The target attributes allow calling these from the dispatched kernels, as well as from code built with the
+// matching compiler flags.
+SIMD_SSE41 static inline __m128 _mm_log_ps( __m128 x )
 {
     __m128i e0 = _mm_castps_si128( x );
     __m128i e1 = _mm_srai_epi32( e0, 23 );
@@ -31,7 +32,7 @@ static inline __m128 _mm_log_ps( __m128 x )
     return r2;
 }
 
-static inline __m128 _mm_exp_ps( __m128 x )
+SIMD_SSE41 static inline __m128 _mm_exp_ps( __m128 x )
 {
     __m128i mi = _mm_cvtps_epi32( x );
     __m128  mf = _mm_round_ps( x, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC) );
@@ -49,15 +50,12 @@ static inline __m128 _mm_exp_ps( __m128 x )
     return sf;
 }
 
-static inline __m128 _mm_pow_ps( __m128 x, __m128 y )
+SIMD_SSE41 static inline __m128 _mm_pow_ps( __m128 x, __m128 y )
 {
     return _mm_exp_ps( _mm_mul_ps( y, _mm_log_ps( x ) ) );
 }
 
-#endif
-
-#ifdef __AVX2__
-static inline __m256 _mm256_log_ps( __m256 x )
+SIMD_AVX2 static inline __m256 _mm256_log_ps( __m256 x )
 {
     __m256i e0 = _mm256_castps_si256( x );
     __m256i e1 = _mm256_srai_epi32( e0, 23 );
@@ -80,7 +78,7 @@ static inline __m256 _mm256_log_ps( __m256 x )
     return r2;
 }
 
-static inline __m256 _mm256_exp_ps( __m256 x )
+SIMD_AVX2 static inline __m256 _mm256_exp_ps( __m256 x )
 {
     __m256i mi = _mm256_cvtps_epi32( x );
     __m256  mf = _mm256_round_ps( x, (_MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC) );
@@ -98,14 +96,12 @@ static inline __m256 _mm256_exp_ps( __m256 x )
     return sf;
 }
 
-static inline __m256 _mm256_pow_ps( __m256 x, __m256 y )
+SIMD_AVX2 static inline __m256 _mm256_pow_ps( __m256 x, __m256 y )
 {
     return _mm256_exp_ps( _mm256_mul_ps( y, _mm256_log_ps( x ) ) );
 }
-#endif
 
-#ifdef __AVX512F__
-static inline __m512 _mm512_log_ps( __m512 x )
+SIMD_AVX512 static inline __m512 _mm512_log_ps( __m512 x )
 {
     __m512i e0 = _mm512_castps_si512( x );
     __m512i e1 = _mm512_srai_epi32( e0, 23 );
@@ -128,7 +124,7 @@ static inline __m512 _mm512_log_ps( __m512 x )
     return r2;
 }
 
-static inline __m512 _mm512_exp_ps( __m512 x )
+SIMD_AVX512 static inline __m512 _mm512_exp_ps( __m512 x )
 {
     __m512i mi = _mm512_cvtps_epi32( x );
     __m512  mf = _mm512_roundscale_ps( x, _MM_FROUND_TO_NEAREST_INT );
@@ -146,7 +142,7 @@ static inline __m512 _mm512_exp_ps( __m512 x )
     return sf;
 }
 
-static inline __m512 _mm512_pow_ps( __m512 x, __m512 y )
+SIMD_AVX512 static inline __m512 _mm512_pow_ps( __m512 x, __m512 y )
 {
     return _mm512_exp_ps( _mm512_mul_ps( y, _mm512_log_ps( x ) ) );
 }
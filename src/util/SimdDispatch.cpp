@@ -0,0 +1,72 @@
+#include <atomic>
+#include <stdlib.h>
+#include <string.h>
+
+#include "SimdDispatch.hpp"
+
+namespace
+{
+SimdLevel DetectSimdLevel()
+{
+#if defined MCORE_SIMD_X86
+    __builtin_cpu_init();
+    if( __builtin_cpu_supports( "avx512f" ) && __builtin_cpu_supports( "avx512bw" ) ) return SimdLevel::Avx512;
+    if( __builtin_cpu_supports( "avx2" ) && __builtin_cpu_supports( "fma" ) && __builtin_cpu_supports( "f16c" ) ) return SimdLevel::Avx2;
+    if( __builtin_cpu_supports( "sse4.1" ) && __builtin_cpu_supports( "fma" ) ) return SimdLevel::Sse41;
+#elif defined __ARM_NEON
+    return SimdLevel::Neon;
+#endif
+    return SimdLevel::Scalar;
+}
+
+SimdLevel Clamp( SimdLevel level, SimdLevel cpu )
+{
+    if( cpu == SimdLevel::Neon ) return level == SimdLevel::Scalar ? SimdLevel::Scalar : SimdLevel::Neon;
+    if( level == SimdLevel::Neon ) return cpu;
+    return level < cpu ? level : cpu;
+}
+
+SimdLevel InitSimdLevel()
+{
+    const auto cpu = GetCpuSimdLevel();
+    const auto env = getenv( "MCORE_SIMD" );
+    if( !env ) return cpu;
+
+    for( auto level : { SimdLevel::Scalar, SimdLevel::Sse41, SimdLevel::Avx2, SimdLevel::Avx512, SimdLevel::Neon } )
+    {
+        if( strcasecmp( env, SimdLevelName( level ) ) == 0 ) return Clamp( level, cpu );
+    }
+    return cpu;
+}
+
+std::atomic<SimdLevel> s_level = InitSimdLevel();
+}
+
+SimdLevel GetSimdLevel()
+{
+    return s_level.load( std::memory_order_relaxed );
+}
+
+SimdLevel GetCpuSimdLevel()
+{
+    static const auto level = DetectSimdLevel();
+    return level;
+}
+
+void SetSimdLevel( SimdLevel level )
+{
+    s_level.store( Clamp( level, GetCpuSimdLevel() ), std::memory_order_relaxed );
+}
+
+const char* SimdLevelName( SimdLevel level )
+{
+    switch( level )
+    {
+    case SimdLevel::Scalar: return "scalar";
+    case SimdLevel::Sse41: return "sse4.1";
+    case SimdLevel::Avx2: return "avx2";
+    case SimdLevel::Avx512: return "avx512";
+    case SimdLevel::Neon: return "neon";
+    default: return "unknown";
+    }
+}
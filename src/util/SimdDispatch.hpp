@@ -0,0 +1,34 @@
+#pragma once
+
+#include <stdint.h>
+
+// Kernels with wide x86 variants build each of them with a target attribute, whatever the compiler flags, and
+// pick one at run time. This way generic x86-64 binaries still use AVX2 and AVX-512 where the CPU has them.
+// NEON is part of the AArch64 baseline, so it needs no dispatch.
+#if defined __x86_64__ && ( defined __GNUC__ || defined __clang__ )
+#  define MCORE_SIMD_X86
+#  define SIMD_SSE41 __attribute__(( target( "sse4.1,fma" ) ))
+#  define SIMD_AVX2 __attribute__(( target( "avx2,fma,f16c" ) ))
+#  define SIMD_AVX512 __attribute__(( target( "avx512f,avx512bw,avx2,fma,f16c" ) ))
+#elif defined __aarch64__ && defined __ARM_NEON
+#  define MCORE_SIMD_NEON
+#endif
+
+enum class SimdLevel : uint8_t
+{
+    Scalar,
+    Sse41,      // With FMA
+    Avx2,       // With FMA and F16C
+    Avx512,     // F and BW
+    Neon
+};
+
+// Widest level the CPU supports, detected on first use. It can be lowered with the MCORE_SIMD environment
+// variable (scalar, sse4.1, avx2, avx512), or with SetSimdLevel(), to compare the kernel variants.
+[[nodiscard]] SimdLevel GetSimdLevel();
+[[nodiscard]] SimdLevel GetCpuSimdLevel();
+
+// Levels the CPU does not support are lowered to what it does
+void SetSimdLevel( SimdLevel level );
+
+[[nodiscard]] const char* SimdLevelName( SimdLevel level );
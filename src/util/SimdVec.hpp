@@ -0,0 +1,427 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "SimdDispatch.hpp"
+
+#if defined MCORE_SIMD_X86
+#  include <x86intrin.h>
+#elif defined MCORE_SIMD_NEON
+#  include <arm_neon.h>
+#endif
+
+// Width agnostic wrappers over the vector registers, so that a kernel can be written once, as a SIMD_INLINE
+// template over the vector type, and instantiated in a function with the matching target attribute:
+//
+//   template<typename V> SIMD_INLINE void Kernel( float* ptr ) { ... }
+//   SIMD_AVX2 static void KernelAvx2( float* ptr ) { Kernel<Simd::F256>( ptr ); }
+//
+// The operations have the target attribute of their vector type and are inlined into the instantiation. The
+// vectors hold RGBA pixels, four lanes each. Pixel operations (Splat, HMin, AlphaFrom, ...) work on each pixel
+// separately.
+//
+// Kernels which mix channels can instead work on Planar groups, with one vector per channel and one pixel per
+// lane. LoadPlanar() deinterleaves V::Lanes pixels in registers and StorePixels() puts packed results back in
+// place, so the images themselves stay interleaved.
+#define SIMD_INLINE inline __attribute__(( always_inline ))
+
+// The templates have no target attribute of their own, so GCC warns about the ABI of wide vectors passed to
+// and from them, even though they are always inlined. Templates take vectors by reference, which silences
+// most of it.
+#pragma GCC diagnostic ignored "-Wpsabi"
+
+namespace Simd
+{
+
+// Pixels may be in any order within the channel vectors, as long as all four agree
+template<typename V>
+struct Planar
+{
+    V r, g, b, a;
+};
+
+#if defined MCORE_SIMD_X86
+struct I128
+{
+    SIMD_SSE41 static I128 Set( int32_t x ) { return { _mm_set1_epi32( x ) }; }
+
+    __m128i v;
+};
+
+struct F128
+{
+    using Int = I128;
+    using Mask = __m128;
+    static constexpr size_t Lanes = 4;
+
+    SIMD_SSE41 static F128 Set( float x ) { return { _mm_set1_ps( x ) }; }
+    SIMD_SSE41 static F128 SetPixel( float r, float g, float b, float a ) { return { _mm_setr_ps( r, g, b, a ) }; }
+    SIMD_SSE41 static F128 Load( const float* ptr ) { return { _mm_loadu_ps( ptr ) }; }
+    // Loads one value for each pixel and repeats it over the four lanes
+    SIMD_SSE41 static F128 LoadPerPixel( const float* ptr ) { return { _mm_set1_ps( *ptr ) }; }
+    SIMD_SSE41 void Store( float* ptr ) const { _mm_storeu_ps( ptr, v ); }
+
+    __m128 v;
+};
+
+SIMD_SSE41 inline F128 operator+( F128 a, F128 b ) { return { _mm_add_ps( a.v, b.v ) }; }
+SIMD_SSE41 inline F128 operator-( F128 a, F128 b ) { return { _mm_sub_ps( a.v, b.v ) }; }
+SIMD_SSE41 inline F128 operator*( F128 a, F128 b ) { return { _mm_mul_ps( a.v, b.v ) }; }
+SIMD_SSE41 inline F128 operator/( F128 a, F128 b ) { return { _mm_div_ps( a.v, b.v ) }; }
+SIMD_SSE41 inline F128 Min( F128 a, F128 b ) { return { _mm_min_ps( a.v, b.v ) }; }
+SIMD_SSE41 inline F128 Max( F128 a, F128 b ) { return { _mm_max_ps( a.v, b.v ) }; }
+SIMD_SSE41 inline F128 Abs( F128 a ) { return { _mm_andnot_ps( _mm_set1_ps( -0.f ), a.v ) }; }
+SIMD_SSE41 inline F128 MulAdd( F128 a, F128 b, F128 c ) { return { _mm_fmadd_ps( a.v, b.v, c.v ) }; }
+SIMD_SSE41 inline F128 NegMulAdd( F128 a, F128 b, F128 c ) { return { _mm_fnmadd_ps( a.v, b.v, c.v ) }; }
+SIMD_SSE41 inline F128 MulSub( F128 a, F128 b, F128 c ) { return { _mm_fmsub_ps( a.v, b.v, c.v ) }; }
+SIMD_SSE41 inline F128 Rcp( F128 a ) { return { _mm_rcp_ps( a.v ) }; }
+SIMD_SSE41 inline F128 Round( F128 a ) { return { _mm_round_ps( a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ) }; }
+SIMD_SSE41 inline F128::Mask Lt( F128 a, F128 b ) { return _mm_cmplt_ps( a.v, b.v ); }
+SIMD_SSE41 inline F128::Mask Le( F128 a, F128 b ) { return _mm_cmple_ps( a.v, b.v ); }
+SIMD_SSE41 inline F128 Select( F128::Mask m, F128 a, F128 b ) { return { _mm_blendv_ps( b.v, a.v, m ) }; }
+SIMD_SSE41 inline F128 AlphaFrom( F128 a, F128 b ) { return { _mm_blend_ps( a.v, b.v, 0x8 ) }; }
+template<int I> SIMD_SSE41 inline F128 Splat( F128 a ) { return { _mm_shuffle_ps( a.v, a.v, _MM_SHUFFLE( I, I, I, I ) ) }; }
+SIMD_SSE41 inline F128 SwapHalves( F128 a ) { return { _mm_shuffle_ps( a.v, a.v, _MM_SHUFFLE( 1, 0, 3, 2 ) ) }; }
+SIMD_SSE41 inline F128 SwapPairs( F128 a ) { return { _mm_shuffle_ps( a.v, a.v, _MM_SHUFFLE( 2, 3, 0, 1 ) ) }; }
+SIMD_SSE41 inline I128 ToInt( F128 a ) { return { _mm_cvtps_epi32( a.v ) }; }
+SIMD_SSE41 inline I128 AsInt( F128 a ) { return { _mm_castps_si128( a.v ) }; }
+
+SIMD_SSE41 inline I128 operator+( I128 a, I128 b ) { return { _mm_add_epi32( a.v, b.v ) }; }
+SIMD_SSE41 inline I128 operator-( I128 a, I128 b ) { return { _mm_sub_epi32( a.v, b.v ) }; }
+SIMD_SSE41 inline I128 operator&( I128 a, I128 b ) { return { _mm_and_si128( a.v, b.v ) }; }
+SIMD_SSE41 inline I128 operator|( I128 a, I128 b ) { return { _mm_or_si128( a.v, b.v ) }; }
+template<int N> SIMD_SSE41 inline I128 ShiftLeft( I128 a ) { return { _mm_slli_epi32( a.v, N ) }; }
+template<int N> SIMD_SSE41 inline I128 ShiftRight( I128 a ) { return { _mm_srai_epi32( a.v, N ) }; }
+SIMD_SSE41 inline F128 ToFloat( I128 a ) { return { _mm_cvtepi32_ps( a.v ) }; }
+SIMD_SSE41 inline F128 AsFloat( I128 a ) { return { _mm_castsi128_ps( a.v ) }; }
+
+// Rounds to integers and stores each pixel as RGBA8, saturated
+SIMD_SSE41 inline void StoreRgba8( uint32_t* dst, F128 a )
+{
+    __m128i v0 = _mm_cvtps_epi32( a.v );
+    __m128i v1 = _mm_packus_epi32( v0, v0 );
+    __m128i v2 = _mm_packus_epi16( v1, v1 );
+    *dst = _mm_cvtsi128_si32( v2 );
+}
+
+SIMD_SSE41 inline void LoadPlanar( const float* ptr, Planar<F128>& p )
+{
+    auto r = _mm_loadu_ps( ptr );
+    auto g = _mm_loadu_ps( ptr + 4 );
+    auto b = _mm_loadu_ps( ptr + 8 );
+    auto a = _mm_loadu_ps( ptr + 12 );
+    _MM_TRANSPOSE4_PS( r, g, b, a );
+    p = { { r }, { g }, { b }, { a } };
+}
+
+// Stores one 32-bit value per pixel of a group loaded with LoadPlanar()
+SIMD_SSE41 inline void StorePixels( uint32_t* dst, I128 px ) { _mm_storeu_si128( (__m128i*)dst, px.v ); }
+
+
+struct I256
+{
+    SIMD_AVX2 static I256 Set( int32_t x ) { return { _mm256_set1_epi32( x ) }; }
+
+    __m256i v;
+};
+
+struct F256
+{
+    using Int = I256;
+    using Mask = __m256;
+    static constexpr size_t Lanes = 8;
+
+    SIMD_AVX2 static F256 Set( float x ) { return { _mm256_set1_ps( x ) }; }
+    SIMD_AVX2 static F256 SetPixel( float r, float g, float b, float a ) { return { _mm256_setr_ps( r, g, b, a, r, g, b, a ) }; }
+    SIMD_AVX2 static F256 Load( const float* ptr ) { return { _mm256_loadu_ps( ptr ) }; }
+    SIMD_AVX2 static F256 LoadPerPixel( const float* ptr ) { return { _mm256_set_m128( _mm_set1_ps( ptr[1] ), _mm_set1_ps( ptr[0] ) ) }; }
+    SIMD_AVX2 void Store( float* ptr ) const { _mm256_storeu_ps( ptr, v ); }
+
+    __m256 v;
+};
+
+SIMD_AVX2 inline F256 operator+( F256 a, F256 b ) { return { _mm256_add_ps( a.v, b.v ) }; }
+SIMD_AVX2 inline F256 operator-( F256 a, F256 b ) { return { _mm256_sub_ps( a.v, b.v ) }; }
+SIMD_AVX2 inline F256 operator*( F256 a, F256 b ) { return { _mm256_mul_ps( a.v, b.v ) }; }
+SIMD_AVX2 inline F256 operator/( F256 a, F256 b ) { return { _mm256_div_ps( a.v, b.v ) }; }
+SIMD_AVX2 inline F256 Min( F256 a, F256 b ) { return { _mm256_min_ps( a.v, b.v ) }; }
+SIMD_AVX2 inline F256 Max( F256 a, F256 b ) { return { _mm256_max_ps( a.v, b.v ) }; }
+SIMD_AVX2 inline F256 Abs( F256 a ) { return { _mm256_andnot_ps( _mm256_set1_ps( -0.f ), a.v ) }; }
+SIMD_AVX2 inline F256 MulAdd( F256 a, F256 b, F256 c ) { return { _mm256_fmadd_ps( a.v, b.v, c.v ) }; }
+SIMD_AVX2 inline F256 NegMulAdd( F256 a, F256 b, F256 c ) { return { _mm256_fnmadd_ps( a.v, b.v, c.v ) }; }
+SIMD_AVX2 inline F256 MulSub( F256 a, F256 b, F256 c ) { return { _mm256_fmsub_ps( a.v, b.v, c.v ) }; }
+SIMD_AVX2 inline F256 Rcp( F256 a ) { return { _mm256_rcp_ps( a.v ) }; }
+SIMD_AVX2 inline F256 Round( F256 a ) { return { _mm256_round_ps( a.v, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC ) }; }
+SIMD_AVX2 inline F256::Mask Lt( F256 a, F256 b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_LT_OQ ); }
+SIMD_AVX2 inline F256::Mask Le( F256 a, F256 b ) { return _mm256_cmp_ps( a.v, b.v, _CMP_LE_OQ ); }
+SIMD_AVX2 inline F256 Select( F256::Mask m, F256 a, F256 b ) { return { _mm256_blendv_ps( b.v, a.v, m ) }; }
+SIMD_AVX2 inline F256 AlphaFrom( F256 a, F256 b ) { return { _mm256_blend_ps( a.v, b.v, 0x88 ) }; }
+template<int I> SIMD_AVX2 inline F256 Splat( F256 a ) { return { _mm256_permute_ps( a.v, _MM_SHUFFLE( I, I, I, I ) ) }; }
+SIMD_AVX2 inline F256 SwapHalves( F256 a ) { return { _mm256_permute_ps( a.v, _MM_SHUFFLE( 1, 0, 3, 2 ) ) }; }
+SIMD_AVX2 inline F256 SwapPairs( F256 a ) { return { _mm256_permute_ps( a.v, _MM_SHUFFLE( 2, 3, 0, 1 ) ) }; }
+SIMD_AVX2 inline I256 ToInt( F256 a ) { return { _mm256_cvtps_epi32( a.v ) }; }
+SIMD_AVX2 inline I256 AsInt( F256 a ) { return { _mm256_castps_si256( a.v ) }; }
+
+SIMD_AVX2 inline I256 operator+( I256 a, I256 b ) { return { _mm256_add_epi32( a.v, b.v ) }; }
+SIMD_AVX2 inline I256 operator-( I256 a, I256 b ) { return { _mm256_sub_epi32( a.v, b.v ) }; }
+SIMD_AVX2 inline I256 operator&( I256 a, I256 b ) { return { _mm256_and_si256( a.v, b.v ) }; }
+SIMD_AVX2 inline I256 operator|( I256 a, I256 b ) { return { _mm256_or_si256( a.v, b.v ) }; }
+template<int N> SIMD_AVX2 inline I256 ShiftLeft( I256 a ) { return { _mm256_slli_epi32( a.v, N ) }; }
+template<int N> SIMD_AVX2 inline I256 ShiftRight( I256 a ) { return { _mm256_srai_epi32( a.v, N ) }; }
+SIMD_AVX2 inline F256 ToFloat( I256 a ) { return { _mm256_cvtepi32_ps( a.v ) }; }
+SIMD_AVX2 inline F256 AsFloat( I256 a ) { return { _mm256_castsi256_ps( a.v ) }; }
+
+SIMD_AVX2 inline void StoreRgba8( uint32_t* dst, F256 a )
+{
+    __m256i v0 = _mm256_cvtps_epi32( a.v );
+    __m256i v1 = _mm256_packus_epi32( v0, v0 );
+    __m256i v2 = _mm256_packus_epi16( v1, v1 );
+    dst[0] = _mm_cvtsi128_si32( _mm256_castsi256_si128( v2 ) );
+    dst[1] = _mm_cvtsi128_si32( _mm256_extracti128_si256( v2, 1 ) );
+}
+
+// Transposes within each 128-bit lane, which leaves pixels out of order. StorePixels() reverses that.
+SIMD_AVX2 inline void LoadPlanar( const float* ptr, Planar<F256>& p )
+{
+    const auto v0 = _mm256_loadu_ps( ptr );
+    const auto v1 = _mm256_loadu_ps( ptr + 8 );
+    const auto v2 = _mm256_loadu_ps( ptr + 16 );
+    const auto v3 = _mm256_loadu_ps( ptr + 24 );
+    const auto t0 = _mm256_unpacklo_ps( v0, v1 );
+    const auto t1 = _mm256_unpacklo_ps( v2, v3 );
+    const auto t2 = _mm256_unpackhi_ps( v0, v1 );
+    const auto t3 = _mm256_unpackhi_ps( v2, v3 );
+    p.r = { _mm256_shuffle_ps( t0, t1, _MM_SHUFFLE( 1, 0, 1, 0 ) ) };
+    p.g = { _mm256_shuffle_ps( t0, t1, _MM_SHUFFLE( 3, 2, 3, 2 ) ) };
+    p.b = { _mm256_shuffle_ps( t2, t3, _MM_SHUFFLE( 1, 0, 1, 0 ) ) };
+    p.a = { _mm256_shuffle_ps( t2, t3, _MM_SHUFFLE( 3, 2, 3, 2 ) ) };
+}
+
+SIMD_AVX2 inline void StorePixels( uint32_t* dst, I256 px )
+{
+    const auto order = _mm256_setr_epi32( 0, 4, 1, 5, 2, 6, 3, 7 );
+    _mm256_storeu_si256( (__m256i*)dst, _mm256_permutevar8x32_epi32( px.v, order ) );
+}
+
+
+struct I512
+{
+    SIMD_AVX512 static I512 Set( int32_t x ) { return { _mm512_set1_epi32( x ) }; }
+
+    __m512i v;
+};
+
+struct F512
+{
+    using Int = I512;
+    using Mask = __mmask16;
+    static constexpr size_t Lanes = 16;
+
+    SIMD_AVX512 static F512 Set( float x ) { return { _mm512_set1_ps( x ) }; }
+    SIMD_AVX512 static F512 SetPixel( float r, float g, float b, float a ) { return { _mm512_broadcast_f32x4( _mm_setr_ps( r, g, b, a ) ) }; }
+    SIMD_AVX512 static F512 Load( const float* ptr ) { return { _mm512_loadu_ps( ptr ) }; }
+    SIMD_AVX512 static F512 LoadPerPixel( const float* ptr )
+    {
+        const auto idx = _mm512_setr_epi32( 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3 );
+        return { _mm512_permutexvar_ps( idx, _mm512_castps128_ps512( _mm_loadu_ps( ptr ) ) ) };
+    }
+    SIMD_AVX512 void Store( float* ptr ) const { _mm512_storeu_ps( ptr, v ); }
+
+    __m512 v;
+};
+
+SIMD_AVX512 inline F512 operator+( F512 a, F512 b ) { return { _mm512_add_ps( a.v, b.v ) }; }
+SIMD_AVX512 inline F512 operator-( F512 a, F512 b ) { return { _mm512_sub_ps( a.v, b.v ) }; }
+SIMD_AVX512 inline F512 operator*( F512 a, F512 b ) { return { _mm512_mul_ps( a.v, b.v ) }; }
+SIMD_AVX512 inline F512 operator/( F512 a, F512 b ) { return { _mm512_div_ps( a.v, b.v ) }; }
+SIMD_AVX512 inline F512 Min( F512 a, F512 b ) { return { _mm512_min_ps( a.v, b.v ) }; }
+SIMD_AVX512 inline F512 Max( F512 a, F512 b ) { return { _mm512_max_ps( a.v, b.v ) }; }
+SIMD_AVX512 inline F512 Abs( F512 a ) { return { _mm512_abs_ps( a.v ) }; }
+SIMD_AVX512 inline F512 MulAdd( F512 a, F512 b, F512 c ) { return { _mm512_fmadd_ps( a.v, b.v, c.v ) }; }
+SIMD_AVX512 inline F512 NegMulAdd( F512 a, F512 b, F512 c ) { return { _mm512_fnmadd_ps( a.v, b.v, c.v ) }; }
+SIMD_AVX512 inline F512 MulSub( F512 a, F512 b, F512 c ) { return { _mm512_fmsub_ps( a.v, b.v, c.v ) }; }
+SIMD_AVX512 inline F512 Rcp( F512 a ) { return { _mm512_rcp14_ps( a.v ) }; }
+SIMD_AVX512 inline F512 Round( F512 a ) { return { _mm512_roundscale_ps( a.v, _MM_FROUND_TO_NEAREST_INT ) }; }
+SIMD_AVX512 inline F512::Mask Lt( F512 a, F512 b ) { return _mm512_cmp_ps_mask( a.v, b.v, _CMP_LT_OQ ); }
+SIMD_AVX512 inline F512::Mask Le( F512 a, F512 b ) { return _mm512_cmp_ps_mask( a.v, b.v, _CMP_LE_OQ ); }
+SIMD_AVX512 inline F512 Select( F512::Mask m, F512 a, F512 b ) { return { _mm512_mask_blend_ps( m, b.v, a.v ) }; }
+SIMD_AVX512 inline F512 AlphaFrom( F512 a, F512 b ) { return { _mm512_mask_blend_ps( 0x8888, a.v, b.v ) }; }
+template<int I> SIMD_AVX512 inline F512 Splat( F512 a ) { return { _mm512_permute_ps( a.v, _MM_SHUFFLE( I, I, I, I ) ) }; }
+SIMD_AVX512 inline F512 SwapHalves( F512 a ) { return { _mm512_permute_ps( a.v, _MM_SHUFFLE( 1, 0, 3, 2 ) ) }; }
+SIMD_AVX512 inline F512 SwapPairs( F512 a ) { return { _mm512_permute_ps( a.v, _MM_SHUFFLE( 2, 3, 0, 1 ) ) }; }
+SIMD_AVX512 inline I512 ToInt( F512 a ) { return { _mm512_cvtps_epi32( a.v ) }; }
+SIMD_AVX512 inline I512 AsInt( F512 a ) { return { _mm512_castps_si512( a.v ) }; }
+
+SIMD_AVX512 inline I512 operator+( I512 a, I512 b ) { return { _mm512_add_epi32( a.v, b.v ) }; }
+SIMD_AVX512 inline I512 operator-( I512 a, I512 b ) { return { _mm512_sub_epi32( a.v, b.v ) }; }
+SIMD_AVX512 inline I512 operator&( I512 a, I512 b ) { return { _mm512_and_epi32( a.v, b.v ) }; }
+SIMD_AVX512 inline I512 operator|( I512 a, I512 b ) { return { _mm512_or_epi32( a.v, b.v ) }; }
+template<int N> SIMD_AVX512 inline I512 ShiftLeft( I512 a ) { return { _mm512_slli_epi32( a.v, N ) }; }
+template<int N> SIMD_AVX512 inline I512 ShiftRight( I512 a ) { return { _mm512_srai_epi32( a.v, N ) }; }
+SIMD_AVX512 inline F512 ToFloat( I512 a ) { return { _mm512_cvtepi32_ps( a.v ) }; }
+SIMD_AVX512 inline F512 AsFloat( I512 a ) { return { _mm512_castsi512_ps( a.v ) }; }
+
+SIMD_AVX512 inline void StoreRgba8( uint32_t* dst, F512 a )
+{
+    __m512i v0 = _mm512_cvtps_epi32( a.v );
+    __m512i v1 = _mm512_packus_epi32( v0, v0 );
+    __m512i v2 = _mm512_packus_epi16( v1, v1 );
+    dst[0] = _mm_cvtsi128_si32( _mm512_castsi512_si128( v2 ) );
+    dst[1] = _mm_cvtsi128_si32( _mm512_extracti32x4_epi32( v2, 1 ) );
+    dst[2] = _mm_cvtsi128_si32( _mm512_extracti32x4_epi32( v2, 2 ) );
+    dst[3] = _mm_cvtsi128_si32( _mm512_extracti32x4_epi32( v2, 3 ) );
+}
+
+SIMD_AVX512 inline void LoadPlanar( const float* ptr, Planar<F512>& p )
+{
+    const auto v0 = _mm512_loadu_ps( ptr );
+    const auto v1 = _mm512_loadu_ps( ptr + 16 );
+    const auto v2 = _mm512_loadu_ps( ptr + 32 );
+    const auto v3 = _mm512_loadu_ps( ptr + 48 );
+    const auto t0 = _mm512_unpacklo_ps( v0, v1 );
+    const auto t1 = _mm512_unpacklo_ps( v2, v3 );
+    const auto t2 = _mm512_unpackhi_ps( v0, v1 );
+    const auto t3 = _mm512_unpackhi_ps( v2, v3 );
+    p.r = { _mm512_shuffle_ps( t0, t1, _MM_SHUFFLE( 1, 0, 1, 0 ) ) };
+    p.g = { _mm512_shuffle_ps( t0, t1, _MM_SHUFFLE( 3, 2, 3, 2 ) ) };
+    p.b = { _mm512_shuffle_ps( t2, t3, _MM_SHUFFLE( 1, 0, 1, 0 ) ) };
+    p.a = { _mm512_shuffle_ps( t2, t3, _MM_SHUFFLE( 3, 2, 3, 2 ) ) };
+}
+
+SIMD_AVX512 inline void StorePixels( uint32_t* dst, I512 px )
+{
+    const auto order = _mm512_setr_epi32( 0, 4, 8, 12, 1, 5, 9, 13, 2, 6, 10, 14, 3, 7, 11, 15 );
+    _mm512_storeu_si512( dst, _mm512_permutexvar_epi32( order, px.v ) );
+}
+#endif
+
+#if defined MCORE_SIMD_NEON
+struct INeon
+{
+    static INeon Set( int32_t x ) { return { vdupq_n_s32( x ) }; }
+
+    int32x4_t v;
+};
+
+struct FNeon
+{
+    using Int = INeon;
+    using Mask = uint32x4_t;
+    static constexpr size_t Lanes = 4;
+
+    static FNeon Set( float x ) { return { vdupq_n_f32( x ) }; }
+    static FNeon SetPixel( float r, float g, float b, float a ) { const float v[4] = { r, g, b, a }; return { vld1q_f32( v ) }; }
+    static FNeon Load( const float* ptr ) { return { vld1q_f32( ptr ) }; }
+    static FNeon LoadPerPixel( const float* ptr ) { return { vld1q_dup_f32( ptr ) }; }
+    void Store( float* ptr ) const { vst1q_f32( ptr, v ); }
+
+    float32x4_t v;
+};
+
+inline FNeon operator+( FNeon a, FNeon b ) { return { vaddq_f32( a.v, b.v ) }; }
+inline FNeon operator-( FNeon a, FNeon b ) { return { vsubq_f32( a.v, b.v ) }; }
+inline FNeon operator*( FNeon a, FNeon b ) { return { vmulq_f32( a.v, b.v ) }; }
+inline FNeon operator/( FNeon a, FNeon b ) { return { vdivq_f32( a.v, b.v ) }; }
+inline FNeon Min( FNeon a, FNeon b ) { return { vminq_f32( a.v, b.v ) }; }
+inline FNeon Max( FNeon a, FNeon b ) { return { vmaxq_f32( a.v, b.v ) }; }
+inline FNeon Abs( FNeon a ) { return { vabsq_f32( a.v ) }; }
+inline FNeon MulAdd( FNeon a, FNeon b, FNeon c ) { return { vfmaq_f32( c.v, a.v, b.v ) }; }
+inline FNeon NegMulAdd( FNeon a, FNeon b, FNeon c ) { return { vfmsq_f32( c.v, a.v, b.v ) }; }
+inline FNeon MulSub( FNeon a, FNeon b, FNeon c ) { return { vnegq_f32( vfmsq_f32( c.v, a.v, b.v ) ) }; }
+// The estimate alone has 8 bits of precision, one Newton-Raphson step brings it close to the x86 one
+inline FNeon Rcp( FNeon a ) { const auto e = vrecpeq_f32( a.v ); return { vmulq_f32( vrecpsq_f32( a.v, e ), e ) }; }
+inline FNeon Round( FNeon a ) { return { vrndnq_f32( a.v ) }; }
+inline FNeon::Mask Lt( FNeon a, FNeon b ) { return vcltq_f32( a.v, b.v ); }
+inline FNeon::Mask Le( FNeon a, FNeon b ) { return vcleq_f32( a.v, b.v ); }
+inline FNeon Select( FNeon::Mask m, FNeon a, FNeon b ) { return { vbslq_f32( m, a.v, b.v ) }; }
+inline FNeon AlphaFrom( FNeon a, FNeon b ) { return { vcopyq_laneq_f32( a.v, 3, b.v, 3 ) }; }
+template<int I> inline FNeon Splat( FNeon a ) { return { vdupq_laneq_f32( a.v, I ) }; }
+inline FNeon SwapHalves( FNeon a ) { return { vextq_f32( a.v, a.v, 2 ) }; }
+inline FNeon SwapPairs( FNeon a ) { return { vrev64q_f32( a.v ) }; }
+inline INeon ToInt( FNeon a ) { return { vcvtnq_s32_f32( a.v ) }; }
+inline INeon AsInt( FNeon a ) { return { vreinterpretq_s32_f32( a.v ) }; }
+
+inline INeon operator+( INeon a, INeon b ) { return { vaddq_s32( a.v, b.v ) }; }
+inline INeon operator-( INeon a, INeon b ) { return { vsubq_s32( a.v, b.v ) }; }
+inline INeon operator&( INeon a, INeon b ) { return { vandq_s32( a.v, b.v ) }; }
+inline INeon operator|( INeon a, INeon b ) { return { vorrq_s32( a.v, b.v ) }; }
+template<int N> inline INeon ShiftLeft( INeon a ) { return { vshlq_n_s32( a.v, N ) }; }
+template<int N> inline INeon ShiftRight( INeon a ) { return { vshrq_n_s32( a.v, N ) }; }
+inline FNeon ToFloat( INeon a ) { return { vcvtq_f32_s32( a.v ) }; }
+inline FNeon AsFloat( INeon a ) { return { vreinterpretq_f32_s32( a.v ) }; }
+
+inline void StoreRgba8( uint32_t* dst, FNeon a )
+{
+    const auto v0 = vqmovn_u32( vcvtnq_u32_f32( a.v ) );
+    const auto v1 = vqmovn_u16( vcombine_u16( v0, v0 ) );
+    vst1_lane_u32( dst, vreinterpret_u32_u8( v1 ), 0 );
+}
+
+inline void LoadPlanar( const float* ptr, Planar<FNeon>& p )
+{
+    const auto v = vld4q_f32( ptr );
+    p = { { v.val[0] }, { v.val[1] }, { v.val[2] }, { v.val[3] } };
+}
+
+inline void StorePixels( uint32_t* dst, INeon px ) { vst1q_u32( dst, vreinterpretq_u32_s32( px.v ) ); }
+#endif
+
+
+// Smallest and largest of the four lanes of each pixel, in all of them
+template<typename V>
+SIMD_INLINE V HMin( const V& a )
+{
+    const auto t = Min( a, SwapHalves( a ) );
+    return Min( t, SwapPairs( t ) );
+}
+
+template<typename V>
+SIMD_INLINE V HMax( const V& a )
+{
+    const auto t = Max( a, SwapHalves( a ) );
+    return Max( t, SwapPairs( t ) );
+}
+
+// Approximations good to about 1e-5 relative error. Log2 expects positive normal numbers.
+template<typename V>
+SIMD_INLINE V Log2( const V& x )
+{
+    using I = typename V::Int;
+
+    const auto e0 = AsInt( x );
+    const auto e1 = ShiftRight<23>( e0 ) - I::Set( 127 );
+    const auto e2 = ( e0 & I::Set( 0x007fffff ) ) | I::Set( 0x3f800000 );
+    const auto f = AsFloat( e2 ) - V::Set( 1.f );
+    const auto f2 = f * f;
+    const auto f4 = f2 * f2;
+    auto hi = MulAdd( f, V::Set( -0.00931049621349f ), V::Set(  0.05206469089414f ) );
+    auto lo = MulAdd( f, V::Set(  0.47868480909345f ), V::Set( -0.72116591947498f ) );
+    hi = MulAdd( f, hi, V::Set( -0.13753123777116f ) );
+    hi = MulAdd( f, hi, V::Set(  0.24187369696082f ) );
+    hi = MulAdd( f, hi, V::Set( -0.34730547155299f ) );
+    lo = MulAdd( f, lo, V::Set(  1.442689881667200f ) );
+    return MulAdd( f4, hi, f * lo ) + ToFloat( e1 );
+}
+
+template<typename V>
+SIMD_INLINE V Exp2( const V& x )
+{
+    const auto mi = ToInt( x );
+    const auto f = x - Round( x );
+    auto r = V::Set( 1.33336498402e-3f );
+    r = MulAdd( f, r, V::Set( 9.810352697968e-3f ) );
+    r = MulAdd( f, r, V::Set( 5.551834031939e-2f ) );
+    r = MulAdd( f, r, V::Set( 0.2401793301105f ) );
+    r = MulAdd( f, r, V::Set( 0.693144857883f ) );
+    r = MulAdd( f, r, V::Set( 1.0f ) );
+    return AsFloat( ShiftLeft<23>( mi ) + AsInt( r ) );
+}
+
+template<typename V>
+SIMD_INLINE V Pow( const V& x, const V& y )
+{
+    return Exp2( y * Log2( x ) );
+}
+
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+#include <type_traits>
+
+#include "NoCopy.hpp"
+
+// Lock-free ring passing values from one producer thread to one consumer thread. Each side keeps a cached copy of
+// the other side's index, so that the shared cache lines are only touched when the ring looks full or empty.
+template<typename T, size_t Size>
+class SpscQueue
+{
+    static_assert( Size != 0 && ( Size & ( Size - 1 ) ) == 0, "Size must be a power of two" );
+    static_assert( std::is_trivially_copyable_v<T> );
+
+public:
+    SpscQueue() = default;
+
+    NoCopy( SpscQueue );
+
+    // Producer side. Returns false if the ring is full.
+    bool Push( const T& value )
+    {
+        const auto head = m_head.load( std::memory_order_relaxed );
+        if( head - m_tailCache == Size )
+        {
+            m_tailCache = m_tail.load( std::memory_order_acquire );
+            if( head - m_tailCache == Size ) return false;
+        }
+        m_data[head & ( Size - 1 )] = value;
+        m_head.store( head + 1, std::memory_order_release );
+        return true;
+    }
+
+    // Consumer side. Returns false if the ring is empty.
+    bool Pop( T& value )
+    {
+        const auto tail = m_tail.load( std::memory_order_relaxed );
+        if( tail == m_headCache )
+        {
+            m_headCache = m_head.load( std::memory_order_acquire );
+            if( tail == m_headCache ) return false;
+        }
+        value = m_data[tail & ( Size - 1 )];
+        m_tail.store( tail + 1, std::memory_order_release );
+        return true;
+    }
+
+    // Only a snapshot, if the other side is running
+    [[nodiscard]] bool Empty() const { return m_head.load( std::memory_order_acquire ) == m_tail.load( std::memory_order_acquire ); }
+    [[nodiscard]] static constexpr size_t Capacity() { return Size; }
+
+private:
+    alignas( 64 ) std::atomic<size_t> m_head = 0;
+    size_t m_tailCache = 0;
+
+    alignas( 64 ) std::atomic<size_t> m_tail = 0;
+    size_t m_headCache = 0;
+
+    alignas( 64 ) T m_data[Size];
+};
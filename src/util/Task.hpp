@@ -0,0 +1,272 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <coroutine>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <stddef.h>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "util/NoCopy.hpp"
+
+// Lazily started coroutine returning T. Nothing runs until the task is awaited, and then it runs on the awaiting
+// thread up to its first suspension, e.g. co_await td.Schedule(), which moves it to a TaskDispatch worker. When
+// the task completes, the awaiting coroutine is resumed on the thread the task finished on. No thread is blocked
+// while waiting, except in SyncWait().
+//
+//   Task<int> Decode( TaskDispatch& td ) { co_await td.Schedule(); co_return 42; }
+//   Task<> Load( TaskDispatch& td ) { auto v = co_await WhenAll( DecodeTasks( td ) ); ... }
+template<typename T = void> class Task;
+
+namespace TaskDetail
+{
+
+struct PromiseBase
+{
+    // Symmetric transfer to the awaiting coroutine, so that long chains of tasks don't grow the stack
+    struct FinalAwaiter
+    {
+        [[nodiscard]] bool await_ready() const noexcept { return false; }
+        template<typename P>
+        std::coroutine_handle<> await_suspend( std::coroutine_handle<P> h ) const noexcept { return h.promise().continuation; }
+        void await_resume() const noexcept {}
+    };
+
+    std::suspend_always initial_suspend() const noexcept { return {}; }
+    FinalAwaiter final_suspend() const noexcept { return {}; }
+    void unhandled_exception() noexcept { exception = std::current_exception(); }
+
+    std::coroutine_handle<> continuation = std::noop_coroutine();
+    std::exception_ptr exception;
+};
+
+template<typename T>
+struct Promise : PromiseBase
+{
+    Task<T> get_return_object() noexcept;
+
+    template<typename U>
+    void return_value( U&& v ) { value.emplace( std::forward<U>( v ) ); }
+
+    T Result()
+    {
+        if( exception ) std::rethrow_exception( exception );
+        return std::move( *value );
+    }
+
+    std::optional<T> value;
+};
+
+template<>
+struct Promise<void> : PromiseBase
+{
+    Task<void> get_return_object() noexcept;
+
+    void return_void() const noexcept {}
+
+    void Result() const
+    {
+        if( exception ) std::rethrow_exception( exception );
+    }
+};
+
+// Outcome of a task awaited by WhenAll() or SyncWait()
+template<typename T>
+struct Result
+{
+    T Get()
+    {
+        if( exception ) std::rethrow_exception( exception );
+        return std::move( *value );
+    }
+
+    std::optional<T> value;
+    std::exception_ptr exception;
+};
+
+template<>
+struct Result<void>
+{
+    void Get() const
+    {
+        if( exception ) std::rethrow_exception( exception );
+    }
+
+    bool value = false;
+    std::exception_ptr exception;
+};
+
+// Coroutine which starts right away and frees itself when done. Used to await tasks from plain code.
+struct Detached
+{
+    struct promise_type
+    {
+        Detached get_return_object() const noexcept { return {}; }
+        std::suspend_never initial_suspend() const noexcept { return {}; }
+        std::suspend_never final_suspend() const noexcept { return {}; }
+        void return_void() const noexcept {}
+        void unhandled_exception() const noexcept { std::terminate(); }
+    };
+};
+
+// The count starts one above the number of tasks, and the extra one is dropped when all of them have been
+// started. Whoever arrives last resumes the waiting coroutine, so tasks finishing before the others are even
+// started can't resume it early.
+struct Latch
+{
+    explicit Latch( size_t tasks ) : count( tasks + 1 ) {}
+
+    [[nodiscard]] bool Arrive() { return count.fetch_sub( 1, std::memory_order_acq_rel ) == 1; }
+
+    std::atomic<size_t> count;
+    std::coroutine_handle<> continuation;
+};
+
+// Awaits the task, stores its outcome and calls done(), which is kept in the coroutine frame
+template<typename T, typename F>
+Detached Run( Task<T>& task, Result<T>& result, F done );
+
+}
+
+template<typename T>
+class [[nodiscard]] Task
+{
+public:
+    using promise_type = TaskDetail::Promise<T>;
+    using Handle = std::coroutine_handle<promise_type>;
+
+    explicit Task( Handle handle ) : m_handle( handle ) {}
+    Task( Task&& other ) noexcept : m_handle( std::exchange( other.m_handle, {} ) ) {}
+    ~Task() { if( m_handle ) m_handle.destroy(); }
+
+    Task& operator=( Task&& other ) noexcept
+    {
+        if( this != &other )
+        {
+            if( m_handle ) m_handle.destroy();
+            m_handle = std::exchange( other.m_handle, {} );
+        }
+        return *this;
+    }
+
+    NoCopy( Task );
+
+    // Starts the task. A task can be awaited only once.
+    auto operator co_await() noexcept
+    {
+        struct Awaiter
+        {
+            Handle handle;
+
+            [[nodiscard]] bool await_ready() const noexcept { return handle.done(); }
+            std::coroutine_handle<> await_suspend( std::coroutine_handle<> h ) const noexcept
+            {
+                handle.promise().continuation = h;
+                return handle;
+            }
+            T await_resume() const { return handle.promise().Result(); }
+        };
+        return Awaiter { m_handle };
+    }
+
+private:
+    Handle m_handle;
+};
+
+template<typename T>
+Task<T> TaskDetail::Promise<T>::get_return_object() noexcept
+{
+    return Task<T>( std::coroutine_handle<Promise<T>>::from_promise( *this ) );
+}
+
+inline Task<void> TaskDetail::Promise<void>::get_return_object() noexcept
+{
+    return Task<void>( std::coroutine_handle<Promise<void>>::from_promise( *this ) );
+}
+
+template<typename T, typename F>
+TaskDetail::Detached TaskDetail::Run( Task<T>& task, Result<T>& result, F done )
+{
+    try
+    {
+        if constexpr( std::is_void_v<T> )
+        {
+            co_await task;
+            result.value = true;
+        }
+        else
+        {
+            result.value.emplace( co_await task );
+        }
+    }
+    catch( ... )
+    {
+        result.exception = std::current_exception();
+    }
+    done();
+}
+
+// Starts all tasks and completes when every one of them has. The results are in the order of the tasks. If any
+// task failed, the first exception in that order is rethrown, after all tasks are done.
+template<typename T>
+Task<std::conditional_t<std::is_void_v<T>, void, std::vector<T>>> WhenAll( std::vector<Task<T>> tasks )
+{
+    struct Awaiter
+    {
+        std::vector<Task<T>>& tasks;
+        std::vector<TaskDetail::Result<T>>& results;
+        TaskDetail::Latch& latch;
+
+        [[nodiscard]] bool await_ready() const noexcept { return tasks.empty(); }
+        bool await_suspend( std::coroutine_handle<> h ) const
+        {
+            latch.continuation = h;
+            auto arrive = [&latch = latch] { if( latch.Arrive() ) latch.continuation.resume(); };
+            for( size_t i=0; i<tasks.size(); i++ ) TaskDetail::Run( tasks[i], results[i], arrive );
+            return !latch.Arrive();
+        }
+        void await_resume() const noexcept {}
+    };
+
+    std::vector<TaskDetail::Result<T>> results( tasks.size() );
+    TaskDetail::Latch latch( tasks.size() );
+    co_await Awaiter { tasks, results, latch };
+
+    if constexpr( std::is_void_v<T> )
+    {
+        for( auto& r : results ) r.Get();
+    }
+    else
+    {
+        std::vector<T> ret;
+        ret.reserve( results.size() );
+        for( auto& r : results ) ret.emplace_back( r.Get() );
+        co_return ret;
+    }
+}
+
+// Runs the task to completion, blocking the calling thread. Meant for the boundary with code that is not a
+// coroutine; a worker waiting here is parked just as in TaskDispatch::Sync().
+template<typename T>
+T SyncWait( Task<T> task )
+{
+    TaskDetail::Result<T> result;
+    std::mutex lock;
+    std::condition_variable cv;
+    bool done = false;
+
+    TaskDetail::Run( task, result, [&] {
+        std::lock_guard guard( lock );
+        done = true;
+        cv.notify_one();
+    } );
+
+    std::unique_lock guard( lock );
+    cv.wait( guard, [&done] { return done; } );
+    guard.unlock();
+    return result.Get();
+}
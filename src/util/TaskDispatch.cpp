@@ -1,98 +1,592 @@
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <errno.h>
+#include <sched.h>
+#include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <tracy/Tracy.hpp>
 
 #include "TaskDispatch.hpp"
+#include "util/Config.hpp"
+#include "util/CpuTopology.hpp"
 #include "util/Logs.hpp"
+#include "util/Panic.hpp"
 
-TaskDispatch::TaskDispatch( size_t workers, const char* name )
-    : m_exit( false )
-    , m_jobs( 0 )
-    , m_initDone( false )
+namespace
 {
-    ZoneScoped;
+// Identifies the queue owned by the current thread, if it is a worker.
+thread_local TaskDispatch* s_owner = nullptr;
+thread_local size_t s_ownerIdx = 0;
+
+thread_local TaskDispatch::Priority s_priority = TaskDispatch::Priority::Interactive;
+thread_local const std::atomic<bool>* s_cancel = nullptr;
+
+// Adaptive ParallelFor chunks should take about this long, so that the queueing overhead is negligible.
+constexpr uint64_t TargetChunkTimeNs = 200 * 1000;
+
+// Workers which have nothing to do for this long are shut down.
+constexpr auto WorkerIdleTimeout = std::chrono::seconds( 2 );
+
+// Returns the set of CPUs each worker may run on. An empty result means no pinning.
+std::vector<std::vector<uint32_t>> AssignCpus( size_t workers, const WorkerPlacement& placement )
+{
+    if( placement.policy == WorkerPlacement::Policy::Any && placement.cpus.empty() ) return {};
+
+    auto classes = GetCpuClasses();
+    if( !placement.cpus.empty() )
+    {
+        for( auto& cls : classes )
+        {
+            std::erase_if( cls, [&placement]( uint32_t cpu ) { return !std::ranges::binary_search( placement.cpus, cpu ); } );
+        }
+        std::erase_if( classes, []( const auto& cls ) { return cls.empty(); } );
+    }
+    if( classes.empty() )
+    {
+        mclog( LogLevel::Warning, "No usable CPUs for worker placement, ignoring" );
+        return {};
+    }
 
-    m_init = std::thread( [this, workers, name] {
-        mclog( LogLevel::Info, "Creating %zu worker threads named '%s'", workers, name );
+    std::vector<uint32_t> all;
+    for( auto& cls : classes ) all.insert( all.end(), cls.begin(), cls.end() );
+    std::ranges::sort( all );
 
-        m_workers.reserve( workers );
-        for( size_t i=0; i<workers; i++ )
+    std::vector<std::vector<uint32_t>> ret( workers );
+    size_t idx = 0;
+    if( placement.policy == WorkerPlacement::Policy::PerformanceFirst )
+    {
+        mclog( LogLevel::Info, "Placing workers on %zu CPU classes, %zu fastest CPUs", classes.size(), classes[0].size() );
+        for( auto& cls : classes )
         {
-            m_workers.emplace_back( [this, name, i]{ SetName( name, i ); Worker(); } );
+            for( size_t i=0; i<cls.size() && idx<workers; i++ ) ret[idx++] = cls;
         }
-    } );
+    }
+    // Workers not placed on a specific class may use any allowed CPU.
+    while( idx < workers ) ret[idx++] = all;
+    return ret;
 }
 
-TaskDispatch::~TaskDispatch()
+#ifdef TRACY_ENABLE
+uint64_t NowNs()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>( std::chrono::steady_clock::now().time_since_epoch() ).count();
+}
+
+// Tracy identifies plots by the name pointer, which must stay valid until the end of the program.
+const char* PlotName( const char* name, const char* metric )
+{
+    char tmp[128];
+    snprintf( tmp, sizeof( tmp ), "%s: %s", name, metric );
+    return strdup( tmp );
+}
+#endif
+
+void SetAffinity( const std::vector<uint32_t>& cpus )
+{
+    if( cpus.empty() ) return;
+
+    cpu_set_t set;
+    CPU_ZERO( &set );
+    for( auto cpu : cpus )
+    {
+        if( cpu < CPU_SETSIZE ) CPU_SET( cpu, &set );
+    }
+    if( sched_setaffinity( 0, sizeof( set ), &set ) != 0 )
+    {
+        mclog( LogLevel::Warning, "Failed to set worker thread affinity: %s", strerror( errno ) );
+    }
+}
+}
+
+TaskGroup::TaskGroup()
+    : m_td( nullptr )
+    , m_count( 0 )
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    // Jobs still referencing the group must not outlive it.
+    Wait();
+}
+
+void TaskGroup::Wait()
+{
+    if( !m_td ) return;
+
+    // Don't pick up jobs less urgent than the ones the caller is waiting for.
+    const auto priority = TaskDispatch::CurrentPriority();
+    while( !IsDone() )
+    {
+        if( m_td->RunPending( priority ) ) continue;
+
+        // Nothing left to help with, the remaining jobs are already running elsewhere.
+        std::unique_lock lock( m_lock );
+        m_cv.wait( lock, [this]{ return m_count.load( std::memory_order_acquire ) == 0; } );
+    }
+
+    // Done() may still be holding the lock, and the group can be destroyed once Wait() returns.
+    std::lock_guard lock( m_lock );
+}
+
+void TaskGroup::Add( TaskDispatch* td, size_t count )
+{
+    CheckPanic( !m_td || m_td == td, "Task group used with multiple dispatchers" );
+    m_td = td;
+    m_count.fetch_add( count, std::memory_order_relaxed );
+}
+
+void TaskGroup::Done()
+{
+    std::lock_guard lock( m_lock );
+    if( m_count.fetch_sub( 1, std::memory_order_acq_rel ) == 1 ) m_cv.notify_all();
+}
+
+TaskDispatch::ScopedPriority::ScopedPriority( Priority priority )
+    : m_prev( s_priority )
+{
+    s_priority = priority;
+}
+
+TaskDispatch::ScopedPriority::~ScopedPriority()
+{
+    s_priority = m_prev;
+}
+
+TaskDispatch::Priority TaskDispatch::CurrentPriority()
+{
+    return s_priority;
+}
+
+TaskDispatch::ScopedCancel::ScopedCancel( const std::atomic<bool>* flag )
+    : m_prev( s_cancel )
+{
+    s_cancel = flag;
+}
+
+TaskDispatch::ScopedCancel::~ScopedCancel()
+{
+    s_cancel = m_prev;
+}
+
+bool TaskDispatch::IsCancelled()
+{
+    return s_cancel && s_cancel->load( std::memory_order_relaxed );
+}
+
+const std::atomic<bool>* TaskDispatch::CurrentCancel()
 {
-    WaitInit();
+    return s_cancel;
+}
 
+TaskDispatch::TaskDispatch( size_t workers, const char* name, WorkerPlacement placement )
+    : m_nextQueue( 0 )
+    , m_queued { 0, 0 }
+    , m_pending( 0 )
+    , m_sleeping( 0 )
+    , m_running( 0 )
+    , m_exit( false )
+    , m_numWorkers( workers )
+    , m_name( name )
+    , m_placement( std::move( placement ) )
+    , m_placed( false )
+    , m_workers( workers )
+    , m_alive( workers, false )
+#ifdef TRACY_ENABLE
+    , m_steals( 0 )
+    , m_plotQueued( PlotName( name, "queued jobs" ) )
+    , m_plotBusy( PlotName( name, "busy workers" ) )
+    , m_plotLatency( PlotName( name, "job start latency (us)" ) )
+    , m_plotSteals( PlotName( name, "steals" ) )
+#endif
+{
+    ZoneScoped;
+
+#ifdef TRACY_ENABLE
+    TracyPlotConfig( m_plotQueued, tracy::PlotFormatType::Number, true, true, 0 );
+    TracyPlotConfig( m_plotBusy, tracy::PlotFormatType::Number, true, true, 0 );
+    TracyPlotConfig( m_plotLatency, tracy::PlotFormatType::Number, false, false, 0 );
+    TracyPlotConfig( m_plotSteals, tracy::PlotFormatType::Number, true, false, 0 );
+#endif
+
+    // Workers are only started once there is work for them, but each has its queue ready from the start.
+    // With no workers there is still one queue, which is drained by Sync().
+    const auto numQueues = std::max<size_t>( workers, 1 );
+    m_queues.reserve( numQueues );
+    for( size_t i=0; i<numQueues; i++ ) m_queues.emplace_back( std::make_unique<WorkQueue>() );
+
+    mclog( LogLevel::Info, "Up to %zu worker threads named '%s'", workers, name );
+}
+
+WorkerPlacement TaskDispatch::LoadPlacement( const char* config )
+{
+    WorkerPlacement ret;
+    Config cfg( config );
+
+    const auto policy = cfg.Get( "TaskDispatch", "Placement", "any" );
+    if( strcmp( policy, "performance" ) == 0 )
+    {
+        ret.policy = WorkerPlacement::Policy::PerformanceFirst;
+    }
+    else if( strcmp( policy, "any" ) != 0 )
+    {
+        mclog( LogLevel::Warning, "Unknown worker placement policy '%s' in %s", policy, config );
+    }
+
+    const char* affinity;
+    if( cfg.GetOpt( "TaskDispatch", "Affinity", affinity ) )
+    {
+        ret.cpus = ParseCpuList( affinity );
+        if( ret.cpus.empty() ) mclog( LogLevel::Warning, "Invalid worker affinity '%s' in %s", affinity, config );
+    }
+
+    return ret;
+}
+
+TaskDispatch::~TaskDispatch()
+{
+    // No new workers can be started once the threads are taken out.
+    m_spawnLock.lock();
     m_exit.store( true, std::memory_order_release );
-    m_queueLock.lock();
+    auto workers = std::move( m_workers );
+    m_spawnLock.unlock();
+
+    m_sleepLock.lock();
     m_cvWork.notify_all();
-    m_queueLock.unlock();
+    m_sleepLock.unlock();
 
-    for( auto& worker : m_workers )
+    for( auto& worker : workers )
     {
-        worker.join();
+        if( worker.joinable() ) worker.join();
     }
 }
 
-void TaskDispatch::WaitInit()
+void TaskDispatch::QueueBulk( std::span<InlineTask> tasks )
 {
-    if( m_initDone.load( std::memory_order_relaxed ) ) return;
+    PushBulk( nullptr, tasks );
+}
 
-    std::lock_guard lock( m_initLock );
-    if( !m_initDone.load( std::memory_order_acquire ) )
+void TaskDispatch::QueueBulk( TaskGroup& group, std::span<InlineTask> tasks )
+{
+    if( tasks.empty() ) return;
+    group.Add( this, tasks.size() );
+    PushBulk( &group, tasks );
+}
+
+void TaskDispatch::Sync()
+{
+    for(;;)
     {
-        m_init.join();
-        m_initDone.store( true, std::memory_order_release );
+        while( RunPending() ) {}
+
+        // Whatever is left is in flight on the workers. Any jobs they spawn will be picked up by them.
+        std::unique_lock lock( m_syncLock );
+        if( m_pending.load( std::memory_order_acquire ) == 0 ) return;
+        if( HasQueued() ) continue;
+        m_cvJobs.wait( lock, [this]{ return m_pending.load( std::memory_order_acquire ) == 0; } );
+        return;
     }
 }
 
-void TaskDispatch::Queue( const std::function<void(void)>& f )
+void TaskDispatch::ParallelFor( size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn )
 {
-    std::lock_guard lock( m_queueLock );
-    m_queue.emplace_back( f );
-    m_cvWork.notify_one();
+    if( begin >= end || IsCancelled() ) return;
+
+    const auto threads = m_numWorkers + 1;
+    if( threads == 1 )
+    {
+        fn( begin, end );
+        return;
+    }
+
+    if( grain == AdaptiveGrain )
+    {
+        const auto probe = std::clamp<size_t>( ( end - begin ) / ( threads * 16 ), 1, 1024 );
+        const auto t0 = std::chrono::steady_clock::now();
+        fn( begin, begin + probe );
+        const auto t1 = std::chrono::steady_clock::now();
+        begin += probe;
+        if( begin == end || IsCancelled() ) return;
+
+        const auto left = end - begin;
+        const auto timeNs = std::max<uint64_t>( std::chrono::duration_cast<std::chrono::nanoseconds>( t1 - t0 ).count(), 1 );
+        const auto itemNs = double( timeNs ) / probe;
+        if( left * itemNs < TargetChunkTimeNs )
+        {
+            fn( begin, end );
+            return;
+        }
+
+        // Never make less chunks than there are threads to run them.
+        const auto maxGrain = ( left + threads - 1 ) / threads;
+        grain = std::clamp<size_t>( size_t( TargetChunkTimeNs / itemNs ), 1, maxGrain );
+    }
+    else if( end - begin <= grain )
+    {
+        fn( begin, end );
+        return;
+    }
+
+    TaskGroup group;
+    std::array<InlineTask, 64> batch;
+    size_t num = 0;
+    while( end - begin > grain )
+    {
+        batch[num++] = InlineTask( [&fn, begin, grain] { if( !IsCancelled() ) fn( begin, begin + grain ); } );
+        begin += grain;
+        if( num == batch.size() )
+        {
+            QueueBulk( group, batch );
+            num = 0;
+        }
+    }
+    QueueBulk( group, std::span( batch.data(), num ) );
+    if( !IsCancelled() ) fn( begin, end );
+    group.Wait();
 }
 
-void TaskDispatch::Queue( std::function<void(void)>&& f )
+void TaskDispatch::Push( Job&& job )
 {
-    std::lock_guard lock( m_queueLock );
-    m_queue.emplace_back( std::move( f ) );
-    m_cvWork.notify_one();
+    // Workers keep the jobs they spawn local, everybody else spreads jobs across all queues.
+    const auto idx = s_owner == this ? s_ownerIdx : m_nextQueue.fetch_add( 1, std::memory_order_relaxed ) % m_queues.size();
+    auto& queue = *m_queues[idx];
+
+    const auto priority = size_t( job.priority );
+#ifdef TRACY_ENABLE
+    job.queueTime = NowNs();
+#endif
+    m_pending.fetch_add( 1, std::memory_order_relaxed );
+    queue.lock.lock();
+    queue.jobs[priority].emplace_back( std::move( job ) );
+    m_queued[priority].fetch_add( 1, std::memory_order_seq_cst );
+    queue.lock.unlock();
+#ifdef TRACY_ENABLE
+    PlotQueued();
+#endif
+
+    Wake( false );
 }
 
-void TaskDispatch::Sync()
+void TaskDispatch::PushBulk( TaskGroup* group, std::span<InlineTask> tasks )
 {
-    std::unique_lock lock( m_queueLock );
-    while( !m_queue.empty() )
+    if( tasks.empty() ) return;
+
+    const auto priority = size_t( s_priority );
+    const auto cancel = s_cancel;
+#ifdef TRACY_ENABLE
+    const auto queueTime = NowNs();
+#endif
+    m_pending.fetch_add( tasks.size(), std::memory_order_relaxed );
+
+    // A worker keeps everything in its own queue, to be stolen as needed. Other threads split the tasks evenly.
+    const auto numQueues = s_owner == this ? 1 : std::min( m_queues.size(), tasks.size() );
+    const auto first = s_owner == this ? s_ownerIdx : m_nextQueue.fetch_add( numQueues, std::memory_order_relaxed );
+    size_t offset = 0;
+    for( size_t i=0; i<numQueues; i++ )
     {
-        auto f = m_queue.back();
-        m_queue.pop_back();
-        lock.unlock();
-        f();
-        lock.lock();
+        const auto count = ( tasks.size() - offset ) / ( numQueues - i );
+        auto& queue = *m_queues[( first + i ) % m_queues.size()];
+        auto& jobs = queue.jobs[priority];
+        queue.lock.lock();
+        for( size_t j=0; j<count; j++ )
+        {
+#ifdef TRACY_ENABLE
+            jobs.emplace_back( Job { std::move( tasks[offset + j] ), group, Priority( priority ), cancel, queueTime } );
+#else
+            jobs.emplace_back( Job { std::move( tasks[offset + j] ), group, Priority( priority ), cancel } );
+#endif
+        }
+        m_queued[priority].fetch_add( count, std::memory_order_seq_cst );
+        queue.lock.unlock();
+        offset += count;
     }
-    m_cvJobs.wait( lock, [this]{ return m_jobs == 0; } );
+#ifdef TRACY_ENABLE
+    PlotQueued();
+#endif
+
+    Wake( tasks.size() > 1 );
 }
 
-void TaskDispatch::Worker()
+void TaskDispatch::Wake( bool all )
 {
+    // Pairs with the increment of m_sleeping in Worker(). Either the worker sees the queued job before going to
+    // sleep, or it is seen as sleeping here and gets woken up. Retiring workers leave the sleeping count under
+    // the lock, so if none is left a new worker may be needed.
+    if( m_sleeping.load( std::memory_order_seq_cst ) != 0 )
+    {
+        std::lock_guard lock( m_sleepLock );
+        if( m_sleeping.load( std::memory_order_relaxed ) != 0 )
+        {
+            if( all ) m_cvWork.notify_all(); else m_cvWork.notify_one();
+            if( !all ) return;
+        }
+    }
+
+    // Grow when the queue backs up, i.e. there are more jobs waiting than workers that could pick them up. Running
+    // workers may all be busy with long jobs, so only the sleeping ones and those started here count.
+    size_t spawned = 0;
+    for(;;)
+    {
+        auto running = m_running.load( std::memory_order_seq_cst );
+        if( running >= m_numWorkers ) return;
+        size_t queued = 0;
+        for( auto& v : m_queued ) queued += v.load( std::memory_order_seq_cst );
+        if( queued <= m_sleeping.load( std::memory_order_seq_cst ) + spawned ) return;
+        if( m_running.compare_exchange_weak( running, running + 1, std::memory_order_seq_cst ) )
+        {
+            Spawn();
+            spawned++;
+        }
+    }
+}
+
+void TaskDispatch::Spawn()
+{
+    ZoneScoped;
+    std::lock_guard lock( m_spawnLock );
+    if( m_exit.load( std::memory_order_relaxed ) )
+    {
+        m_running.fetch_sub( 1, std::memory_order_relaxed );
+        return;
+    }
+
+    if( !m_placed )
+    {
+        m_cpus = AssignCpus( m_numWorkers, m_placement );
+        m_cpus.resize( m_numWorkers );
+        m_placed = true;
+    }
+
+    // The slot is freed by a retiring worker before it stops counting as running, so one must be available.
+    const auto it = std::ranges::find( m_alive, false );
+    CheckPanic( it != m_alive.end(), "No free worker slot" );
+    const auto idx = size_t( it - m_alive.begin() );
+    *it = true;
+
+    // A worker previously using the slot has already left Worker() and only needs to be joined.
+    auto& worker = m_workers[idx];
+    if( worker.joinable() ) worker.join();
+    worker = std::thread( [this, idx] { SetName( m_name.c_str(), idx ); SetAffinity( m_cpus[idx] ); Worker( idx ); } );
+}
+
+bool TaskDispatch::Pop( size_t idx, size_t priority, Job& job )
+{
+    if( m_queued[priority].load( std::memory_order_relaxed ) == 0 ) return false;
+
+    auto& queue = *m_queues[idx];
+    auto& jobs = queue.jobs[priority];
+    std::lock_guard lock( queue.lock );
+    if( jobs.empty() ) return false;
+    job = std::move( jobs.back() );
+    jobs.pop_back();
+    m_queued[priority].fetch_sub( 1, std::memory_order_relaxed );
+    return true;
+}
+
+bool TaskDispatch::Steal( size_t idx, size_t priority, Job& job )
+{
+    const auto num = m_queues.size();
+    for( size_t i=0; i<num; i++ )
+    {
+        if( m_queued[priority].load( std::memory_order_relaxed ) == 0 ) return false;
+
+        auto& queue = *m_queues[( idx + i ) % num];
+        auto& jobs = queue.jobs[priority];
+        std::lock_guard lock( queue.lock );
+        if( jobs.empty() ) continue;
+        job = std::move( jobs.front() );
+        jobs.pop_front();
+        m_queued[priority].fetch_sub( 1, std::memory_order_relaxed );
+#ifdef TRACY_ENABLE
+        if( s_owner == this && ( idx + i ) % num != s_ownerIdx ) TracyPlot( m_plotSteals, int64_t( m_steals.fetch_add( 1, std::memory_order_relaxed ) + 1 ) );
+#endif
+        return true;
+    }
+    return false;
+}
+
+bool TaskDispatch::RunPending( Priority lowest )
+{
+    Job job;
+    for( size_t priority=0; priority<=size_t( lowest ); priority++ )
+    {
+        const bool found = s_owner == this ?
+            Pop( s_ownerIdx, priority, job ) || Steal( s_ownerIdx + 1, priority, job ) :
+            Steal( 0, priority, job );
+        if( found )
+        {
+            Run( job );
+            return true;
+        }
+    }
+    return false;
+}
+
+bool TaskDispatch::HasQueued() const
+{
+    for( auto& queued : m_queued )
+    {
+        if( queued.load( std::memory_order_seq_cst ) != 0 ) return true;
+    }
+    return false;
+}
+
+void TaskDispatch::Run( Job& job )
+{
+#ifdef TRACY_ENABLE
+    PlotQueued();
+    TracyPlot( m_plotLatency, ( NowNs() - job.queueTime ) / 1000.f );
+#endif
+    const auto prev = s_priority;
+    const auto prevCancel = s_cancel;
+    s_priority = job.priority;
+    s_cancel = job.cancel;
+    job.f();
+    job.f.Reset();
+    s_priority = prev;
+    s_cancel = prevCancel;
+    if( job.group ) job.group->Done();
+    if( m_pending.fetch_sub( 1, std::memory_order_acq_rel ) == 1 )
+    {
+        m_syncLock.lock();
+        m_cvJobs.notify_all();
+        m_syncLock.unlock();
+    }
+}
+
+void TaskDispatch::Worker( size_t idx )
+{
+    s_owner = this;
+    s_ownerIdx = idx;
+
     for(;;)
     {
-        std::unique_lock lock( m_queueLock );
-        m_cvWork.wait( lock, [this]{ return !m_queue.empty() || m_exit.load( std::memory_order_acquire ); } );
         if( m_exit.load( std::memory_order_acquire ) ) return;
-        auto f = m_queue.back();
-        m_queue.pop_back();
-        m_jobs++;
-        lock.unlock();
-        f();
-        lock.lock();
-        m_jobs--;
-        if( m_jobs == 0 && m_queue.empty() ) m_cvJobs.notify_all();
-        lock.unlock();
+        if( RunPending() ) continue;
+
+        std::unique_lock lock( m_sleepLock );
+        m_sleeping.fetch_add( 1, std::memory_order_seq_cst );
+#ifdef TRACY_ENABLE
+        PlotBusy();
+#endif
+        if( !m_cvWork.wait_for( lock, WorkerIdleTimeout, [this]{ return HasQueued() || m_exit.load( std::memory_order_acquire ); } ) )
+        {
+            // The slot must be free before the worker stops counting as running, see Spawn().
+            std::lock_guard spawnLock( m_spawnLock );
+            m_alive[idx] = false;
+            m_running.fetch_sub( 1, std::memory_order_seq_cst );
+            m_sleeping.fetch_sub( 1, std::memory_order_seq_cst );
+#ifdef TRACY_ENABLE
+            PlotBusy();
+#endif
+            return;
+        }
+        m_sleeping.fetch_sub( 1, std::memory_order_relaxed );
+#ifdef TRACY_ENABLE
+        PlotBusy();
+#endif
     }
 }
 
@@ -102,3 +596,17 @@ void TaskDispatch::SetName( const char* name, size_t num )
     snprintf( tmp, sizeof( tmp ), "%s #%zu", name, num );
     tracy::SetThreadName( tmp );
 }
+
+#ifdef TRACY_ENABLE
+void TaskDispatch::PlotQueued() const
+{
+    size_t queued = 0;
+    for( auto& v : m_queued ) queued += v.load( std::memory_order_relaxed );
+    TracyPlot( m_plotQueued, int64_t( queued ) );
+}
+
+void TaskDispatch::PlotBusy() const
+{
+    TracyPlot( m_plotBusy, int64_t( m_running.load( std::memory_order_relaxed ) - m_sleeping.load( std::memory_order_relaxed ) ) );
+}
+#endif
@@ -2,43 +2,242 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <coroutine>
+#include <deque>
 #include <functional>
+#include <memory>
 #include <mutex>
+#include <span>
+#include <stdint.h>
+#include <string>
 #include <thread>
 #include <vector>
 
+#include "util/InlineTask.hpp"
 #include "util/NoCopy.hpp"
 
+class TaskDispatch;
+
+struct WorkerPlacement
+{
+    enum class Policy
+    {
+        Any,                // Let the OS schedule the workers
+        PerformanceFirst    // Pin workers to the fastest cores first, then to the slower ones
+    };
+
+    Policy policy = Policy::Any;
+    std::vector<uint32_t> cpus;     // If not empty, workers only run on these CPUs
+};
+
+// Tracks a subset of jobs queued on a TaskDispatch, so that they can be waited for without stalling on
+// unrelated work. The waiting thread runs pending jobs itself, instead of blocking.
+class TaskGroup
+{
+    friend class TaskDispatch;
+
+public:
+    TaskGroup();
+    ~TaskGroup();
+
+    NoCopy( TaskGroup );
+
+    void Wait();
+
+    [[nodiscard]] bool IsDone() const { return m_count.load( std::memory_order_acquire ) == 0; }
+
+private:
+    void Add( TaskDispatch* td, size_t count = 1 );
+    void Done();
+
+    TaskDispatch* m_td;
+    std::atomic<size_t> m_count;
+
+    std::mutex m_lock;
+    std::condition_variable m_cv;
+};
+
 class TaskDispatch
 {
+    friend class TaskGroup;
+
 public:
-    TaskDispatch( size_t workers, const char* name );
+    // Workers always pick up interactive jobs first. Background work is thus preempted at job (chunk) boundaries.
+    enum class Priority
+    {
+        Interactive,
+        Background
+    };
+    static constexpr size_t NumPriorities = 2;
+
+    // Sets the priority of jobs queued from the current thread, for the lifetime of the object. Jobs queued from
+    // within a running job inherit its priority.
+    class ScopedPriority
+    {
+    public:
+        explicit ScopedPriority( Priority priority );
+        ~ScopedPriority();
+        NoCopy( ScopedPriority );
+
+    private:
+        Priority m_prev;
+    };
+
+    [[nodiscard]] static Priority CurrentPriority();
+
+    // Sets the cancellation flag checked by work done on the current thread, for the lifetime of the object. Like
+    // the priority, it is inherited by jobs queued from the thread. Long running work, such as image decoding,
+    // should poll IsCancelled() at convenient points and bail out. ParallelFor() skips the chunks which have not
+    // started yet once the flag is set. The flag must outlive the jobs queued under it.
+    class ScopedCancel
+    {
+    public:
+        explicit ScopedCancel( const std::atomic<bool>* flag );
+        ~ScopedCancel();
+        NoCopy( ScopedCancel );
+
+    private:
+        const std::atomic<bool>* m_prev;
+    };
+
+    [[nodiscard]] static bool IsCancelled();
+
+    TaskDispatch( size_t workers, const char* name, WorkerPlacement placement = {} );
+
+    // Reads the [TaskDispatch] section of the named ini file. Keys are Placement (any, performance) and
+    // Affinity (CPU list, e.g. 0-3,8).
+    [[nodiscard]] static WorkerPlacement LoadPlacement( const char* config );
     ~TaskDispatch();
 
     NoCopy( TaskDispatch );
 
-    void WaitInit();
+    // Workers are started on demand, so there is nothing to wait for. Kept for callers written against eager startup.
+    void WaitInit() {}
+
+    // Callables fitting in InlineTask are stored without allocating, larger ones are wrapped in std::function.
+    template<typename F> requires std::invocable<std::decay_t<F>&>
+    void Queue( F&& f ) { Push( { MakeTask( std::forward<F>( f ) ), nullptr, CurrentPriority(), CurrentCancel() } ); }
+
+    template<typename F> requires std::invocable<std::decay_t<F>&>
+    void Queue( TaskGroup& group, F&& f )
+    {
+        group.Add( this );
+        Push( { MakeTask( std::forward<F>( f ) ), &group, CurrentPriority(), CurrentCancel() } );
+    }
 
-    void Queue( const std::function<void(void)>& f );
-    void Queue( std::function<void(void)>&& f );
+    // co_await td.Schedule() suspends the coroutine and resumes it on a worker, with the priority and cancellation
+    // flag of the awaiting thread. See util/Task.hpp.
+    struct ScheduleAwaiter
+    {
+        TaskDispatch* td;
 
+        [[nodiscard]] bool await_ready() const noexcept { return false; }
+        void await_suspend( std::coroutine_handle<> h ) const { td->Queue( [h] { h.resume(); } ); }
+        void await_resume() const noexcept {}
+    };
+    [[nodiscard]] ScheduleAwaiter Schedule() { return { this }; }
+
+    // Queues all tasks at once, taking each worker queue lock only once. The tasks are moved from.
+    void QueueBulk( std::span<InlineTask> tasks );
+    void QueueBulk( TaskGroup& group, std::span<InlineTask> tasks );
+
+    // Waits for all queued jobs, including the ones belonging to groups.
     void Sync();
 
-    [[nodiscard]] size_t NumWorkers() const { return m_workers.size(); }
+    // Calls fn( chunkBegin, chunkEnd ) for consecutive chunks covering [begin, end) and waits for completion.
+    // With grain set to AdaptiveGrain, the chunk size is derived from the worker count and the measured cost
+    // of a probe chunk, which is run on the calling thread.
+    static constexpr size_t AdaptiveGrain = 0;
+    void ParallelFor( size_t begin, size_t end, size_t grain, const std::function<void(size_t, size_t)>& fn );
+
+    [[nodiscard]] size_t NumWorkers() const { return m_numWorkers; }
+    [[nodiscard]] size_t NumRunningWorkers() const { return m_running.load( std::memory_order_relaxed ); }
 
 private:
-    void Worker();
+    struct Job
+    {
+        InlineTask f;
+        TaskGroup* group;
+        Priority priority;
+        const std::atomic<bool>* cancel;
+#ifdef TRACY_ENABLE
+        uint64_t queueTime = 0;
+#endif
+    };
+
+    // Each worker owns a deque per priority. The owner pushes and pops at the back, other threads steal from the front.
+    struct WorkQueue
+    {
+        std::mutex lock;
+        std::deque<Job> jobs[NumPriorities];
+    };
+
+    [[nodiscard]] static const std::atomic<bool>* CurrentCancel();
+
+    template<typename F>
+    static InlineTask MakeTask( F&& f )
+    {
+        if constexpr( InlineTask::Fits<F> )
+        {
+            return InlineTask( std::forward<F>( f ) );
+        }
+        else
+        {
+            return InlineTask( std::function<void(void)>( std::forward<F>( f ) ) );
+        }
+    }
+
+    void Push( Job&& job );
+    void PushBulk( TaskGroup* group, std::span<InlineTask> tasks );
+    bool Pop( size_t idx, size_t priority, Job& job );
+    bool Steal( size_t idx, size_t priority, Job& job );
+    bool RunPending( Priority lowest = Priority::Background );
+    void Run( Job& job );
+    [[nodiscard]] bool HasQueued() const;
+
+    void Wake( bool all );
+    void Spawn();
+    void Worker( size_t idx );
     void SetName( const char* name, size_t num );
 
-    std::vector<std::function<void(void)>> m_queue;
-    std::mutex m_queueLock;
-    std::condition_variable m_cvWork, m_cvJobs;
+#ifdef TRACY_ENABLE
+    void PlotQueued() const;
+    void PlotBusy() const;
+#endif
+
+    std::vector<std::unique_ptr<WorkQueue>> m_queues;
+    std::atomic<size_t> m_nextQueue;
+
+    std::atomic<size_t> m_queued[NumPriorities];
+    std::atomic<size_t> m_pending;
+    std::atomic<size_t> m_sleeping;
+    std::atomic<size_t> m_running;
+
+    std::mutex m_sleepLock;
+    std::condition_variable m_cvWork;
+
+    std::mutex m_syncLock;
+    std::condition_variable m_cvJobs;
+
     std::atomic<bool> m_exit;
-    size_t m_jobs;
 
+    size_t m_numWorkers;
+    std::string m_name;
+
+    // Worker slots are guarded by m_spawnLock. Lock order is m_sleepLock, then m_spawnLock.
+    std::mutex m_spawnLock;
+    WorkerPlacement m_placement;
+    bool m_placed;
+    std::vector<std::vector<uint32_t>> m_cpus;
     std::vector<std::thread> m_workers;
+    std::vector<bool> m_alive;
+
+#ifdef TRACY_ENABLE
+    std::atomic<uint64_t> m_steals;
 
-    std::thread m_init;
-    std::mutex m_initLock;
-    std::atomic<bool> m_initDone;
+    const char* m_plotQueued;
+    const char* m_plotBusy;
+    const char* m_plotLatency;
+    const char* m_plotSteals;
+#endif
 };
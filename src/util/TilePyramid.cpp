@@ -0,0 +1,376 @@
+#include <algorithm>
+#include <atomic>
+#include <dirent.h>
+#include <fcntl.h>
+#include <lz4.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <tracy/Tracy.hpp>
+#include <unistd.h>
+
+#include "Bitmap.hpp"
+#include "BitmapOps.hpp"
+#include "Filesystem.hpp"
+#include "Home.hpp"
+#include "Logs.hpp"
+#include "Md5.hpp"
+#include "TilePyramid.hpp"
+
+namespace
+{
+constexpr char Magic[8] = { 'M', 'C', 'T', 'I', 'L', 'E', 'S', '\0' };
+constexpr uint32_t Version = 1;
+constexpr uint32_t MaxLevels = 32;
+
+// Followed by the source path, padded to 8 bytes, the level table, the tile table, and the tile data
+struct FileHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t tileSize;
+    uint32_t levels;
+    uint32_t pathSize;
+    int64_t mtimeSec;
+    int64_t mtimeNsec;
+    uint64_t fileSize;
+};
+static_assert( sizeof( FileHeader ) == 48 );
+
+constexpr size_t Align8( size_t v ) { return ( v + 7 ) & ~size_t( 7 ); }
+
+bool WriteAll( FILE* f, const void* data, size_t size )
+{
+    return fwrite( data, 1, size, f ) == size;
+}
+}
+
+TilePyramid::TilePyramid( const char* data, size_t size, uint32_t tileSize, std::vector<LevelInfo>&& levels, const TileInfo* tiles, const struct timespec& mtime )
+    : m_data( data )
+    , m_size( size )
+    , m_tileSize( tileSize )
+    , m_levels( std::move( levels ) )
+    , m_tiles( tiles )
+    , m_mtime( mtime )
+{
+}
+
+TilePyramid::~TilePyramid()
+{
+    munmap( (void*)m_data, m_size );
+}
+
+bool TilePyramid::GetSource( const char* path, Source& source )
+{
+    char* real = realpath( path, nullptr );
+    if( !real ) return false;
+    source.path = real;
+    free( real );
+
+    struct stat st;
+    if( stat( source.path.c_str(), &st ) != 0 || !S_ISREG( st.st_mode ) ) return false;
+    source.mtime = st.st_mtim;
+    source.size = st.st_size;
+    return true;
+}
+
+std::string TilePyramid::CacheDir()
+{
+    const auto xdgCache = getenv( "XDG_CACHE_HOME" );
+    if( xdgCache && *xdgCache == '/' ) return std::string( xdgCache ) + "/iv/tiles/";
+    auto home = GetHome();
+    if( home.empty() ) return {};
+    return home + "/.cache/iv/tiles/";
+}
+
+std::string TilePyramid::CachePath( const Source& source )
+{
+    auto dir = CacheDir();
+    if( dir.empty() ) return {};
+    return dir + Md5Hex( source.path.data(), source.path.size() ) + ".tiles";
+}
+
+std::shared_ptr<TilePyramid> TilePyramid::Open( const char* file, const Source& source, uint32_t tileSize )
+{
+    ZoneScoped;
+
+    const auto fd = open( file, O_RDONLY | O_CLOEXEC );
+    if( fd < 0 ) return nullptr;
+
+    struct stat st;
+    if( fstat( fd, &st ) != 0 || size_t( st.st_size ) < sizeof( FileHeader ) )
+    {
+        close( fd );
+        return nullptr;
+    }
+    const size_t size = st.st_size;
+    auto map = mmap( nullptr, size, PROT_READ, MAP_SHARED, fd, 0 );
+    if( map == MAP_FAILED )
+    {
+        close( fd );
+        return nullptr;
+    }
+
+    // The file modification time records the last use, for Trim()
+    futimens( fd, nullptr );
+    close( fd );
+
+    const auto data = (const char*)map;
+    auto fail = [&]( const char* reason ) {
+        mclog( LogLevel::Debug, "Tile pyramid %s not used: %s", file, reason );
+        munmap( map, size );
+        return nullptr;
+    };
+
+    FileHeader hdr;
+    memcpy( &hdr, data, sizeof( hdr ) );
+    if( memcmp( hdr.magic, Magic, sizeof( Magic ) ) != 0 || hdr.version != Version ) return fail( "not a tile pyramid" );
+    if( hdr.tileSize != tileSize ) return fail( "tile size differs" );
+    if( hdr.levels == 0 || hdr.levels > MaxLevels ) return fail( "invalid level count" );
+    if( hdr.pathSize != source.path.size() || sizeof( hdr ) + hdr.pathSize > size ) return fail( "made of another file" );
+    if( memcmp( data + sizeof( hdr ), source.path.data(), hdr.pathSize ) != 0 ) return fail( "made of another file" );
+    if( hdr.mtimeSec != source.mtime.tv_sec || hdr.mtimeNsec != source.mtime.tv_nsec || hdr.fileSize != source.size ) return fail( "image was modified" );
+
+    const auto levelOffset = Align8( sizeof( hdr ) + hdr.pathSize );
+    const auto tileOffset = levelOffset + hdr.levels * sizeof( LevelInfo );
+    if( tileOffset > size ) return fail( "truncated" );
+
+    std::vector<LevelInfo> levels( hdr.levels );
+    memcpy( levels.data(), data + levelOffset, hdr.levels * sizeof( LevelInfo ) );
+    uint64_t tiles = 0;
+    for( auto& level : levels )
+    {
+        if( level.width == 0 || level.height == 0 || level.firstTile != tiles ) return fail( "invalid level table" );
+        tiles += uint64_t( ( level.width + tileSize - 1 ) / tileSize ) * ( ( level.height + tileSize - 1 ) / tileSize );
+    }
+
+    const auto dataOffset = tileOffset + tiles * sizeof( TileInfo );
+    if( dataOffset > size ) return fail( "truncated" );
+    auto tileTable = (const TileInfo*)( data + tileOffset );
+    for( uint64_t i=0; i<tiles; i++ )
+    {
+        const auto& tile = tileTable[i];
+        if( tile.size == 0 || tile.offset < dataOffset || tile.size > size || tile.offset > size - tile.size ) return fail( "invalid tile table" );
+    }
+
+    mclog( LogLevel::Info, "Using tile pyramid %s for %s", file, source.path.c_str() );
+    return std::shared_ptr<TilePyramid>( new TilePyramid( data, size, tileSize, std::move( levels ), tileTable, source.mtime ) );
+}
+
+bool TilePyramid::Write( const char* file, const Source& source, const Bitmap& bitmap, uint32_t tileSize, uint32_t overviewSize, TaskDispatch* td )
+{
+    ZoneScoped;
+
+    if( tileSize == 0 || uint64_t( tileSize ) * tileSize * 4 > LZ4_MAX_INPUT_SIZE ) return false;
+
+    // The same levels as the view makes of the bitmap
+    std::vector<std::unique_ptr<Bitmap>> owned;
+    std::vector<const Bitmap*> levels = { &bitmap };
+    while( std::max( levels.back()->Width(), levels.back()->Height() ) > overviewSize && levels.size() < MaxLevels )
+    {
+        const auto& prev = *levels.back();
+        owned.emplace_back( prev.ResizeNew( std::max( 1u, prev.Width() / 2 ), std::max( 1u, prev.Height() / 2 ), td ) );
+        levels.emplace_back( owned.back().get() );
+    }
+
+    std::vector<LevelInfo> levelTable;
+    uint64_t tiles = 0;
+    for( auto& level : levels )
+    {
+        levelTable.emplace_back( LevelInfo { level->Width(), level->Height(), tiles } );
+        tiles += uint64_t( ( level->Width() + tileSize - 1 ) / tileSize ) * ( ( level->Height() + tileSize - 1 ) / tileSize );
+    }
+    std::vector<TileInfo> tileTable( tiles );
+
+    const auto pos = std::string_view( file ).find_last_of( '/' );
+    if( pos != std::string_view::npos && !CreateDirectories( std::string( file, pos ) ) ) return false;
+
+    auto tmp = std::string( file ) + ".XXXXXX";
+    const auto fd = mkstemp( tmp.data() );
+    if( fd < 0 ) return false;
+    auto f = fdopen( fd, "wb" );
+    if( !f )
+    {
+        close( fd );
+        unlink( tmp.c_str() );
+        return false;
+    }
+
+    FileHeader hdr = {
+        .version = Version,
+        .tileSize = tileSize,
+        .levels = uint32_t( levels.size() ),
+        .pathSize = uint32_t( source.path.size() ),
+        .mtimeSec = source.mtime.tv_sec,
+        .mtimeNsec = source.mtime.tv_nsec,
+        .fileSize = source.size
+    };
+    memcpy( hdr.magic, Magic, sizeof( Magic ) );
+    const auto levelOffset = Align8( sizeof( hdr ) + hdr.pathSize );
+    const auto tileOffset = levelOffset + levels.size() * sizeof( LevelInfo );
+    auto offset = tileOffset + tiles * sizeof( TileInfo );
+
+    // A row of tiles is compressed at a time, so that only so much compressed data is held before it is written
+    bool ok = fseek( f, long( offset ), SEEK_SET ) == 0;
+    struct Packed
+    {
+        std::unique_ptr<char[]> data;
+        int size;
+    };
+    for( size_t l=0; l<levels.size() && ok; l++ )
+    {
+        const auto& level = *levels[l];
+        const auto tilesX = ( level.Width() + tileSize - 1 ) / tileSize;
+        const auto tilesY = ( level.Height() + tileSize - 1 ) / tileSize;
+        std::vector<Packed> row( tilesX );
+        for( uint32_t y=0; y<tilesY && ok; y++ )
+        {
+            BitmapOps::ForRange( td, tilesX, [&, y]( size_t begin, size_t end ) {
+                auto raw = std::make_unique_for_overwrite<char[]>( size_t( tileSize ) * tileSize * 4 );
+                for( size_t x=begin; x<end; x++ )
+                {
+                    const auto x0 = uint32_t( x ) * tileSize;
+                    const auto y0 = y * tileSize;
+                    const auto w = std::min( tileSize, level.Width() - x0 );
+                    const auto h = std::min( tileSize, level.Height() - y0 );
+                    auto src = level.Data() + ( size_t( y0 ) * level.Width() + x0 ) * 4;
+                    for( uint32_t i=0; i<h; i++ ) memcpy( raw.get() + size_t( i ) * w * 4, src + size_t( i ) * level.Width() * 4, w * 4 );
+
+                    // Tiles which do not compress are stored as they are, which is also faster to read
+                    const auto rawSize = int( w * h * 4 );
+                    auto& packed = row[x];
+                    packed.data = std::make_unique_for_overwrite<char[]>( LZ4_compressBound( rawSize ) );
+                    packed.size = LZ4_compress_default( raw.get(), packed.data.get(), rawSize, LZ4_compressBound( rawSize ) );
+                    if( packed.size <= 0 || packed.size >= rawSize )
+                    {
+                        memcpy( packed.data.get(), raw.get(), rawSize );
+                        packed.size = rawSize;
+                    }
+                }
+            } );
+            for( uint32_t x=0; x<tilesX && ok; x++ )
+            {
+                auto& packed = row[x];
+                tileTable[levelTable[l].firstTile + y * tilesX + x] = { offset, uint64_t( packed.size ) };
+                ok = WriteAll( f, packed.data.get(), packed.size );
+                offset += packed.size;
+                packed.data.reset();
+            }
+        }
+    }
+
+    const uint64_t zero = 0;
+    ok = ok && fseek( f, 0, SEEK_SET ) == 0 &&
+        WriteAll( f, &hdr, sizeof( hdr ) ) &&
+        WriteAll( f, source.path.data(), source.path.size() ) &&
+        WriteAll( f, &zero, levelOffset - sizeof( hdr ) - source.path.size() ) &&
+        WriteAll( f, levelTable.data(), levelTable.size() * sizeof( LevelInfo ) ) &&
+        WriteAll( f, tileTable.data(), tileTable.size() * sizeof( TileInfo ) );
+    ok = fclose( f ) == 0 && ok;
+
+    if( !ok || rename( tmp.c_str(), file ) != 0 )
+    {
+        mclog( LogLevel::Warning, "Failed to write tile pyramid %s", file );
+        unlink( tmp.c_str() );
+        return false;
+    }
+    mclog( LogLevel::Info, "Stored tile pyramid %s for %s, %zu levels, %.1f MiB", file, source.path.c_str(), levels.size(), offset / ( 1024.f * 1024.f ) );
+    return true;
+}
+
+void TilePyramid::Trim( uint64_t maxBytes )
+{
+    ZoneScoped;
+
+    const auto root = CacheDir();
+    if( root.empty() ) return;
+    auto dir = opendir( root.c_str() );
+    if( !dir ) return;
+
+    struct Entry
+    {
+        std::string path;
+        struct timespec mtime;
+        uint64_t size;
+    };
+    std::vector<Entry> entries;
+    while( auto ent = readdir( dir ) )
+    {
+        struct stat st;
+        auto path = root + ent->d_name;
+        if( stat( path.c_str(), &st ) == 0 && S_ISREG( st.st_mode ) ) entries.emplace_back( Entry { std::move( path ), st.st_mtim, uint64_t( st.st_size ) } );
+    }
+    closedir( dir );
+
+    std::ranges::sort( entries, []( const auto& a, const auto& b ) {
+        return a.mtime.tv_sec != b.mtime.tv_sec ? a.mtime.tv_sec > b.mtime.tv_sec : a.mtime.tv_nsec > b.mtime.tv_nsec;
+    } );
+    uint64_t total = 0;
+    for( auto& entry : entries )
+    {
+        total += entry.size;
+        if( total > maxBytes )
+        {
+            mclog( LogLevel::Debug, "Removing tile pyramid %s", entry.path.c_str() );
+            unlink( entry.path.c_str() );
+        }
+    }
+}
+
+bool TilePyramid::Decode( size_t level, uint32_t x, uint32_t y, uint8_t* dst ) const
+{
+    const auto& info = m_levels[level];
+    const auto w = std::min( m_tileSize, info.width - x * m_tileSize );
+    const auto h = std::min( m_tileSize, info.height - y * m_tileSize );
+    const auto rawSize = int( w * h * 4 );
+
+    const auto& tile = m_tiles[info.firstTile + y * TilesX( level ) + x];
+    if( tile.size == uint64_t( rawSize ) )
+    {
+        memcpy( dst, m_data + tile.offset, rawSize );
+        return true;
+    }
+    return LZ4_decompress_safe( m_data + tile.offset, (char*)dst, int( tile.size ), rawSize ) == rawSize;
+}
+
+std::unique_ptr<Bitmap> TilePyramid::Tile( size_t level, uint32_t x, uint32_t y ) const
+{
+    ZoneScoped;
+
+    const auto& info = m_levels[level];
+    auto ret = std::make_unique<Bitmap>( std::min( m_tileSize, info.width - x * m_tileSize ), std::min( m_tileSize, info.height - y * m_tileSize ) );
+    if( !Decode( level, x, y, ret->Data() ) ) return nullptr;
+    return ret;
+}
+
+std::unique_ptr<Bitmap> TilePyramid::Level( size_t level, TaskDispatch* td ) const
+{
+    ZoneScoped;
+
+    const auto& info = m_levels[level];
+    const auto tilesX = TilesX( level );
+    auto ret = std::make_unique<Bitmap>( info.width, info.height );
+    std::atomic<bool> ok = true;
+    BitmapOps::ForRange( td, size_t( tilesX ) * TilesY( level ), [&]( size_t begin, size_t end ) {
+        auto raw = std::make_unique_for_overwrite<uint8_t[]>( size_t( m_tileSize ) * m_tileSize * 4 );
+        for( size_t i=begin; i<end; i++ )
+        {
+            const auto x = uint32_t( i % tilesX );
+            const auto y = uint32_t( i / tilesX );
+            if( !Decode( level, x, y, raw.get() ) )
+            {
+                ok.store( false, std::memory_order_relaxed );
+                return;
+            }
+            const auto w = std::min( m_tileSize, info.width - x * m_tileSize );
+            const auto h = std::min( m_tileSize, info.height - y * m_tileSize );
+            auto dst = ret->Data() + ( size_t( y ) * m_tileSize * info.width + size_t( x ) * m_tileSize ) * 4;
+            for( uint32_t r=0; r<h; r++ ) memcpy( dst + size_t( r ) * info.width * 4, raw.get() + size_t( r ) * w * 4, w * 4 );
+        }
+    } );
+    if( !ok.load( std::memory_order_relaxed ) ) return nullptr;
+    return ret;
+}
@@ -0,0 +1,88 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <time.h>
+#include <vector>
+
+#include "NoCopy.hpp"
+
+class Bitmap;
+class TaskDispatch;
+
+// Tiled mip pyramid of a decoded image, kept on disk in a single file, so that opening a huge image again reads
+// only the tiles which are shown instead of decoding all of it. The file is memory mapped, tiles are LZ4
+// compressed separately, or stored as is where that does not help. Level 0 is the full image, each next one is
+// half the size, down to the first one which fits the overview size.
+class TilePyramid
+{
+public:
+    // Identifies the image file a pyramid was made of. It must be rebuilt when any of this changes.
+    struct Source
+    {
+        std::string path;       // Canonical
+        struct timespec mtime;
+        uint64_t size;
+    };
+
+    ~TilePyramid();
+
+    NoCopy( TilePyramid );
+
+    // False if the file does not exist
+    [[nodiscard]] static bool GetSource( const char* path, Source& source );
+
+    // Where the pyramid of the source is cached, empty if there is no cache directory
+    [[nodiscard]] static std::string CacheDir();
+    [[nodiscard]] static std::string CachePath( const Source& source );
+
+    // Null if the file is missing, damaged, or was made of another version of the image or with another tile size
+    [[nodiscard]] static std::shared_ptr<TilePyramid> Open( const char* file, const Source& source, uint32_t tileSize );
+
+    // Builds the smaller levels from the bitmap and writes the file, through a temporary one which replaces it
+    // when complete, so that a pyramid is never seen half written.
+    static bool Write( const char* file, const Source& source, const Bitmap& bitmap, uint32_t tileSize, uint32_t overviewSize, TaskDispatch* td = nullptr );
+
+    // Deletes the least recently opened pyramids in the cache directory, until they take at most maxBytes
+    static void Trim( uint64_t maxBytes );
+
+    [[nodiscard]] size_t Levels() const { return m_levels.size(); }
+    [[nodiscard]] uint32_t Width( size_t level ) const { return m_levels[level].width; }
+    [[nodiscard]] uint32_t Height( size_t level ) const { return m_levels[level].height; }
+    [[nodiscard]] uint32_t TileSize() const { return m_tileSize; }
+    [[nodiscard]] uint32_t TilesX( size_t level ) const { return ( m_levels[level].width + m_tileSize - 1 ) / m_tileSize; }
+    [[nodiscard]] uint32_t TilesY( size_t level ) const { return ( m_levels[level].height + m_tileSize - 1 ) / m_tileSize; }
+    [[nodiscard]] const struct timespec& Mtime() const { return m_mtime; }
+
+    // Null if the tile data is damaged
+    [[nodiscard]] std::unique_ptr<Bitmap> Tile( size_t level, uint32_t x, uint32_t y ) const;
+    // Whole level, from all of its tiles
+    [[nodiscard]] std::unique_ptr<Bitmap> Level( size_t level, TaskDispatch* td = nullptr ) const;
+
+private:
+    struct LevelInfo
+    {
+        uint32_t width;
+        uint32_t height;
+        uint64_t firstTile;
+    };
+
+    struct TileInfo
+    {
+        uint64_t offset;
+        uint64_t size;          // Equal to the raw size if the pixels are not compressed
+    };
+
+    TilePyramid( const char* data, size_t size, uint32_t tileSize, std::vector<LevelInfo>&& levels, const TileInfo* tiles, const struct timespec& mtime );
+
+    [[nodiscard]] bool Decode( size_t level, uint32_t x, uint32_t y, uint8_t* dst ) const;
+
+    const char* m_data;
+    size_t m_size;
+    uint32_t m_tileSize;
+    std::vector<LevelInfo> m_levels;
+    const TileInfo* m_tiles;
+    struct timespec m_mtime;
+};
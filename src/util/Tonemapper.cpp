@@ -1,13 +1,73 @@
 #include <assert.h>
+#include <atomic>
 #include <cmath>
+#include <mutex>
 
+#include "Panic.hpp"
 #include "Tonemapper.hpp"
+#include "TonemapperLut.hpp"
 
 namespace ToneMap
 {
 
+namespace
+{
+std::atomic<bool> s_lutMode = false;
+
+constexpr size_t NumOperators = size_t( Operator::Custom );
+std::once_flag s_lutOnce[NumOperators];
+std::unique_ptr<Lut> s_luts[NumOperators];
+std::unique_ptr<Lut> s_custom;
+
+Lut::Operator GetFunction( Operator op )
+{
+    switch( op )
+    {
+    case Operator::AgX: return AgX;
+    case Operator::AgXGolden: return AgXGolden;
+    case Operator::AgXPunchy: return AgXPunchy;
+    case Operator::PbrNeutral: return PbrNeutral;
+    default: Panic( "Invalid tone mapping operator" );
+    }
+}
+}
+
+void SetLutMode( bool enable )
+{
+    s_lutMode.store( enable, std::memory_order_relaxed );
+}
+
+bool LutMode()
+{
+    return s_lutMode.load( std::memory_order_relaxed );
+}
+
+const Lut& GetLut( Operator op )
+{
+    if( op == Operator::Custom )
+    {
+        CheckPanic( s_custom, "Custom tone mapping LUT is not set" );
+        return *s_custom;
+    }
+
+    const auto idx = size_t( op );
+    std::call_once( s_lutOnce[idx], [idx, op] { s_luts[idx] = std::make_unique<Lut>( GetFunction( op ) ); } );
+    return *s_luts[idx];
+}
+
+void SetCustomLut( std::unique_ptr<Lut> lut )
+{
+    s_custom = std::move( lut );
+}
+
 void Process( Operator op, uint32_t* dst, float* src, size_t sz )
 {
+    if( op == Operator::Custom || LutMode() )
+    {
+        GetLut( op ).Apply( dst, src, sz );
+        return;
+    }
+
     switch( op )
     {
     case Operator::AgX:
@@ -1,8 +1,11 @@
 #pragma once
 
+#include <memory>
 #include <stddef.h>
 #include <stdint.h>
 
+class Lut;
+
 namespace ToneMap
 {
 
@@ -11,11 +14,21 @@ enum class Operator
     AgX,
     AgXGolden,
     AgXPunchy,
-    PbrNeutral
+    PbrNeutral,
+    Custom          // Look set with SetCustomLut()
 };
 
 void Process( Operator op, uint32_t* dst, float* src, size_t sz );
 
+// With LUT mode enabled, Process() samples a LUT baked from the operator on first use, instead of
+// evaluating the curve for each pixel. Custom looks are always applied as LUTs.
+void SetLutMode( bool enable );
+[[nodiscard]] bool LutMode();
+[[nodiscard]] const Lut& GetLut( Operator op );
+
+// Must be called before any image using Operator::Custom is processed.
+void SetCustomLut( std::unique_ptr<Lut> lut );
+
 
 struct HdrColor
 {
@@ -2,23 +2,42 @@
 
 #include <algorithm>
 #include <array>
+#include <cfloat>
 #include <cmath>
 
 #include "Tonemapper.hpp"
+#include "TonemapperSimd.hpp"
 
 namespace ToneMap
 {
 
+constexpr auto threshold = 0.6060606060606061f;
+constexpr auto a_up = 69.86278913545539f;
+constexpr auto a_down = 59.507875f;
+constexpr auto b_up = 13.0f / 4.0f;
+constexpr auto b_down = 3.0f;
+constexpr auto c_up = -4.0f / 13.0f;
+constexpr auto c_down = -1.0f / 3.0f;
+
+constexpr auto min_ev = -12.473931188332413f;
+constexpr auto max_ev = 4.026068811667588f;
+constexpr auto range = max_ev - min_ev;
+constexpr auto invrange = 1.f / range;
+
+constexpr std::array agx_mat = {
+    0.8424010709504686f, 0.04240107095046854f, 0.04240107095046854f,
+    0.07843650156180276f, 0.8784365015618028f, 0.07843650156180276f,
+    0.0791624274877287f, 0.0791624274877287f, 0.8791624274877287f
+};
+
+constexpr std::array agx_mat_inv = {
+    1.1969986613119143f, -0.053001338688085674f, -0.053001338688085674f,
+    -0.09804562695225345f, 1.1519543730477466f, -0.09804562695225345f,
+    -0.09895303435966087f, -0.09895303435966087f, 1.151046965640339f
+};
+
 static float AgxCurve( float x )
 {
-    constexpr auto threshold = 0.6060606060606061f;
-    constexpr auto a_up = 69.86278913545539f;
-    constexpr auto a_down = 59.507875f;
-    constexpr auto b_up = 13.0f / 4.0f;
-    constexpr auto b_down = 3.0f;
-    constexpr auto c_up = -4.0f / 13.0f;
-    constexpr auto c_down = -1.0f / 3.0f;
-
     const float mask = x < threshold ? 0.f : 1.f;
     const float a = a_up + (a_down - a_up) * mask;
     const float b = b_up + (b_down - b_up) * mask;
@@ -29,17 +48,6 @@ static float AgxCurve( float x )
 
 static HdrColor AgxTransform( const HdrColor& hdr )
 {
-    constexpr auto min_ev = -12.473931188332413f;
-    constexpr auto max_ev = 4.026068811667588f;
-    constexpr auto range = max_ev - min_ev;
-    constexpr auto invrange = 1.f / range;
-
-    constexpr std::array agx_mat = {
-        0.8424010709504686f, 0.04240107095046854f, 0.04240107095046854f,
-        0.07843650156180276f, 0.8784365015618028f, 0.07843650156180276f,
-        0.0791624274877287f, 0.0791624274877287f, 0.8791624274877287f
-    };
-
     const HdrColor c1 = {
         agx_mat[0] * hdr.r + agx_mat[1] * hdr.g + agx_mat[2] * hdr.b,
         agx_mat[3] * hdr.r + agx_mat[4] * hdr.g + agx_mat[5] * hdr.b,
@@ -94,12 +102,6 @@ static HdrColor AgxLookPunchy( const HdrColor& color )
 
 static HdrColor AgxEotf( const HdrColor& color )
 {
-    constexpr std::array agx_mat_inv = {
-        1.1969986613119143f, -0.053001338688085674f, -0.053001338688085674f,
-        -0.09804562695225345f, 1.1519543730477466f, -0.09804562695225345f,
-        -0.09895303435966087f, -0.09895303435966087f, 1.151046965640339f
-    };
-
     const HdrColor out = {
         agx_mat_inv[0] * color.r + agx_mat_inv[1] * color.g + agx_mat_inv[2] * color.b,
         agx_mat_inv[3] * color.r + agx_mat_inv[4] * color.g + agx_mat_inv[5] * color.b,
@@ -115,8 +117,140 @@ static HdrColor AgxEotf( const HdrColor& color )
     };
 }
 
+// The vector kernels work on planar groups of pixels, one channel per vector
+enum class Look
+{
+    None,
+    Golden,
+    Punchy
+};
+
+// Inputs below this are raised to it before pow, which keeps the exp argument in range of the
+// approximation. The error is far below 8-bit output precision.
+constexpr auto powFloor = 1e-9f;
+
+template<typename V>
+SIMD_INLINE V PowFloor( const V& x, const V& y )
+{
+    return Pow( Max( x, V::Set( powFloor ) ), y );
+}
+
+template<typename V>
+SIMD_INLINE void MulMat( Simd::Planar<V>& c, const std::array<float, 9>& m )
+{
+    const auto r = MulAdd( c.b, V::Set( m[2] ), MulAdd( c.g, V::Set( m[1] ), c.r * V::Set( m[0] ) ) );
+    const auto g = MulAdd( c.b, V::Set( m[5] ), MulAdd( c.g, V::Set( m[4] ), c.r * V::Set( m[3] ) ) );
+    const auto b = MulAdd( c.b, V::Set( m[8] ), MulAdd( c.g, V::Set( m[7] ), c.r * V::Set( m[6] ) ) );
+    c.r = r;
+    c.g = g;
+    c.b = b;
+}
+
+template<typename V>
+SIMD_INLINE V AgxCurveVec( const V& x0 )
+{
+    const auto vl0 = Log2( Max( x0, V::Set( FLT_MIN ) ) );
+    const auto vl1 = MulAdd( vl0, V::Set( invrange ), V::Set( -min_ev * invrange ) );
+    const auto vx = Min( Max( vl1, V::Set( 0.f ) ), V::Set( 1.0f ) );
+
+    const auto vm = Lt( vx, V::Set( threshold ) );
+    const auto va = Select( vm, V::Set( a_up ), V::Set( a_down ) );
+    const auto vb = Select( vm, V::Set( b_up ), V::Set( b_down ) );
+    const auto vc = Select( vm, V::Set( c_up ), V::Set( c_down ) );
+
+    const auto vd0 = vx - V::Set( threshold );
+    const auto vp0 = PowFloor( Abs( vd0 ), vb );
+    const auto vp1 = MulAdd( va, vp0, V::Set( 1.0f ) );
+    const auto vp2 = PowFloor( vp1, vc );
+
+    return MulAdd( vd0 + vd0, vp2, V::Set( 0.5f ) );
+}
+
+template<typename V>
+SIMD_INLINE void AgxLookVec( Simd::Planar<V>& c, const HdrColor& scale, float saturation, float power )
+{
+    const auto vl = MulAdd( c.b, V::Set( 0.0722f ), MulAdd( c.g, V::Set( 0.7152f ), c.r * V::Set( 0.2126f ) ) );
+    const auto vs = V::Set( saturation );
+    const auto vp = V::Set( power );
+
+    c.r = MulAdd( vs, PowFloor( c.r * V::Set( scale.r ), vp ) - vl, vl );
+    c.g = MulAdd( vs, PowFloor( c.g * V::Set( scale.g ), vp ) - vl, vl );
+    c.b = MulAdd( vs, PowFloor( c.b * V::Set( scale.b ), vp ) - vl, vl );
+}
+
+template<Look L>
+struct AgxKernel
+{
+    template<typename V>
+    SIMD_INLINE void operator()( Simd::Planar<V>& c ) const
+    {
+        MulMat( c, agx_mat );
+        c.r = AgxCurveVec( c.r );
+        c.g = AgxCurveVec( c.g );
+        c.b = AgxCurveVec( c.b );
+
+        if constexpr( L == Look::Golden ) AgxLookVec( c, { 1.0f, 0.9f, 0.5f }, 0.8f, 0.8f );
+        if constexpr( L == Look::Punchy ) AgxLookVec( c, { 1.0f, 1.0f, 1.0f }, 1.4f, 1.35f );
+
+        MulMat( c, agx_mat_inv );
+        c.r = PowFloor( c.r, V::Set( 2.2f ) );
+        c.g = PowFloor( c.g, V::Set( 2.2f ) );
+        c.b = PowFloor( c.b, V::Set( 2.2f ) );
+    }
+};
+
+#if defined MCORE_SIMD_X86
+template<Look L>
+SIMD_SSE41 static void AgxSse41( uint32_t* dst, float* src, size_t sz )
+{
+    TonemapPlanar<Simd::F128>( dst, src, sz, AgxKernel<L>() );
+}
+
+template<Look L>
+SIMD_AVX2 static void AgxAvx2( uint32_t* dst, float* src, size_t sz )
+{
+    TonemapPlanar<Simd::F256>( dst, src, sz, AgxKernel<L>() );
+}
+
+template<Look L>
+SIMD_AVX512 static void AgxAvx512( uint32_t* dst, float* src, size_t sz )
+{
+    TonemapPlanar<Simd::F512>( dst, src, sz, AgxKernel<L>() );
+}
+#elif defined MCORE_SIMD_NEON
+template<Look L>
+static void AgxNeon( uint32_t* dst, float* src, size_t sz )
+{
+    TonemapPlanar<Simd::FNeon>( dst, src, sz, AgxKernel<L>() );
+}
+#endif
+
+// Returns false if there is no vector kernel for the current SIMD level
+template<Look L>
+static bool AgxSimd( uint32_t* dst, float* src, size_t sz )
+{
+#if defined MCORE_SIMD_X86
+    switch( GetSimdLevel() )
+    {
+    case SimdLevel::Avx512: AgxAvx512<L>( dst, src, sz ); return true;
+    case SimdLevel::Avx2: AgxAvx2<L>( dst, src, sz ); return true;
+    case SimdLevel::Sse41: AgxSse41<L>( dst, src, sz ); return true;
+    default: break;
+    }
+#elif defined MCORE_SIMD_NEON
+    if( GetSimdLevel() == SimdLevel::Neon )
+    {
+        AgxNeon<L>( dst, src, sz );
+        return true;
+    }
+#endif
+    return false;
+}
+
 void AgX( uint32_t* dst, float* src, size_t sz )
 {
+    if( AgxSimd<Look::None>( dst, src, sz ) ) return;
+
     do
     {
         auto color = AgxTransform( { src[0], src[1], src[2] } );
@@ -139,6 +273,8 @@ void AgX( uint32_t* dst, float* src, size_t sz )
 
 void AgXGolden( uint32_t* dst, float* src, size_t sz )
 {
+    if( AgxSimd<Look::Golden>( dst, src, sz ) ) return;
+
     do
     {
         auto color = AgxTransform( { src[0], src[1], src[2] } );
@@ -162,6 +298,8 @@ void AgXGolden( uint32_t* dst, float* src, size_t sz )
 
 void AgXPunchy( uint32_t* dst, float* src, size_t sz )
 {
+    if( AgxSimd<Look::Punchy>( dst, src, sz ) ) return;
+
     do
     {
         auto color = AgxTransform( { src[0], src[1], src[2] } );
@@ -0,0 +1,273 @@
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+#include <string.h>
+#include <string>
+
+#include "FileBuffer.hpp"
+#include "Logs.hpp"
+#include "Simd.hpp"
+#include "TonemapperLut.hpp"
+
+namespace
+{
+// Exposure range covered by baked LUTs. The operators mix channels before compressing them, so the range
+// has to extend well past the point where each of them saturates. Values outside are clamped.
+constexpr float MinEv = -14.f;
+constexpr float MaxEv = 12.f;
+
+constexpr int MaxCubeSize = 256;
+
+bool ParseFloats( const char* str, float* out, int count )
+{
+    for( int i=0; i<count; i++ )
+    {
+        char* end;
+        out[i] = strtof( str, &end );
+        if( end == str ) return false;
+        str = end;
+    }
+    return true;
+}
+
+bool IsKeyword( const std::string& line, const char* keyword )
+{
+    const auto len = strlen( keyword );
+    return line.compare( 0, len, keyword ) == 0 && ( line.size() == len || line[len] == ' ' || line[len] == '\t' );
+}
+}
+
+Lut::Lut( Operator op, int size )
+    : m_size( size )
+    , m_log( true )
+    , m_data( size_t( size ) * size * size * 4 )
+{
+    const auto scale = ( size - 1 ) / ( MaxEv - MinEv );
+    for( int i=0; i<3; i++ )
+    {
+        m_min[i] = MinEv;
+        m_scale[i] = scale;
+    }
+    m_min[3] = 0;
+    m_scale[3] = 0;
+
+    // Node 0 stands for everything below the range, so evaluate it at black
+    std::vector<float> axis( size );
+    axis[0] = 0;
+    for( int i=1; i<size; i++ ) axis[i] = std::exp2( MinEv + i / scale );
+
+    const auto count = size_t( size ) * size * size;
+    std::vector<float> src( count * 4 );
+    auto ptr = src.data();
+    for( int b=0; b<size; b++ )
+    {
+        for( int g=0; g<size; g++ )
+        {
+            for( int r=0; r<size; r++ )
+            {
+                *ptr++ = axis[r];
+                *ptr++ = axis[g];
+                *ptr++ = axis[b];
+                *ptr++ = 1;
+            }
+        }
+    }
+
+    std::vector<uint32_t> dst( count );
+    op( dst.data(), src.data(), count );
+
+    auto out = m_data.data();
+    for( auto v : dst )
+    {
+        *out++ = ( v & 0xFF ) / 255.f;
+        *out++ = ( ( v >> 8 ) & 0xFF ) / 255.f;
+        *out++ = ( ( v >> 16 ) & 0xFF ) / 255.f;
+        *out++ = 0;
+    }
+}
+
+Lut::Lut( int size, const float* domainMin, const float* domainMax, std::vector<float>&& data )
+    : m_size( size )
+    , m_log( false )
+    , m_data( std::move( data ) )
+{
+    for( int i=0; i<3; i++ )
+    {
+        m_min[i] = domainMin[i];
+        m_scale[i] = ( size - 1 ) / ( domainMax[i] - domainMin[i] );
+    }
+    m_min[3] = 0;
+    m_scale[3] = 0;
+}
+
+std::unique_ptr<Lut> Lut::LoadCube( const char* path )
+{
+    try
+    {
+        FileBuffer buf( path );
+        auto lut = ParseCube( buf.data(), buf.size() );
+        if( !lut ) mclog( LogLevel::Error, "Invalid .cube file: %s", path );
+        return lut;
+    }
+    catch( FileBuffer::FileException& )
+    {
+        return nullptr;
+    }
+}
+
+std::unique_ptr<Lut> Lut::ParseCube( const char* data, size_t size )
+{
+    int lutSize = 0;
+    float domainMin[3] = { 0, 0, 0 };
+    float domainMax[3] = { 1, 1, 1 };
+    std::vector<float> nodes;
+    size_t count = 0;
+
+    const auto end = data + size;
+    std::string line;
+    while( data < end )
+    {
+        auto eol = (const char*)memchr( data, '\n', end - data );
+        if( !eol ) eol = end;
+        line.assign( data, eol );
+        data = eol + 1;
+
+        const auto first = line.find_first_not_of( " \t\r" );
+        if( first == std::string::npos || line[first] == '#' ) continue;
+        line.erase( 0, first );
+
+        if( IsKeyword( line, "TITLE" ) ) continue;
+        if( IsKeyword( line, "LUT_3D_SIZE" ) )
+        {
+            lutSize = atoi( line.c_str() + 11 );
+            if( lutSize < 2 || lutSize > MaxCubeSize || !nodes.empty() ) return nullptr;
+            nodes.resize( size_t( lutSize ) * lutSize * lutSize * 4 );
+        }
+        else if( IsKeyword( line, "DOMAIN_MIN" ) )
+        {
+            if( !ParseFloats( line.c_str() + 10, domainMin, 3 ) ) return nullptr;
+        }
+        else if( IsKeyword( line, "DOMAIN_MAX" ) )
+        {
+            if( !ParseFloats( line.c_str() + 10, domainMax, 3 ) ) return nullptr;
+        }
+        else if( IsKeyword( line, "LUT_3D_INPUT_RANGE" ) )
+        {
+            float range[2];
+            if( !ParseFloats( line.c_str() + 18, range, 2 ) ) return nullptr;
+            std::fill_n( domainMin, 3, range[0] );
+            std::fill_n( domainMax, 3, range[1] );
+        }
+        else if( IsKeyword( line, "LUT_1D_SIZE" ) )
+        {
+            mclog( LogLevel::Error, "1D .cube LUTs are not supported" );
+            return nullptr;
+        }
+        else
+        {
+            if( nodes.empty() || count == nodes.size() / 4 ) return nullptr;
+            auto ptr = nodes.data() + count * 4;
+            if( !ParseFloats( line.c_str(), ptr, 3 ) ) return nullptr;
+            ptr[3] = 0;
+            count++;
+        }
+    }
+
+    if( nodes.empty() || count != nodes.size() / 4 ) return nullptr;
+    for( int i=0; i<3; i++ ) if( !( domainMax[i] > domainMin[i] ) ) return nullptr;
+
+    return std::unique_ptr<Lut>( new Lut( lutSize, domainMin, domainMax, std::move( nodes ) ) );
+}
+
+void Lut::Apply( uint32_t* dst, const float* src, size_t sz ) const
+{
+    const auto n = m_size;
+    const size_t dg = size_t( n ) * 4;
+    const size_t db = size_t( n ) * n * 4;
+    const auto data = m_data.data();
+
+#if defined __SSE4_1__ && defined __FMA__
+    const auto vmin = _mm_loadu_ps( m_min );
+    const auto vscale = _mm_loadu_ps( m_scale );
+    const auto vmax = _mm_set1_ps( float( n - 1 ) );
+    const auto vlast = _mm_set1_epi32( n - 2 );
+
+    while( sz > 0 )
+    {
+        __m128 s0 = _mm_loadu_ps( src );
+        __m128 v0 = m_log ? _mm_log_ps( _mm_max_ps( s0, _mm_set1_ps( FLT_MIN ) ) ) : s0;
+        __m128 v1 = _mm_mul_ps( _mm_sub_ps( v0, vmin ), vscale );
+        __m128 v2 = _mm_min_ps( _mm_max_ps( v1, _mm_setzero_ps() ), vmax );
+        __m128i vi = _mm_min_epi32( _mm_cvttps_epi32( v2 ), vlast );
+        __m128 vf = _mm_sub_ps( v2, _mm_cvtepi32_ps( vi ) );
+
+        const auto base = data + size_t( _mm_extract_epi32( vi, 2 ) ) * db + size_t( _mm_extract_epi32( vi, 1 ) ) * dg + size_t( _mm_extract_epi32( vi, 0 ) ) * 4;
+
+        __m128 fr = _mm_shuffle_ps( vf, vf, 0x00 );
+        __m128 fg = _mm_shuffle_ps( vf, vf, 0x55 );
+        __m128 fb = _mm_shuffle_ps( vf, vf, 0xAA );
+
+        __m128 p000 = _mm_loadu_ps( base );
+        __m128 p100 = _mm_loadu_ps( base + 4 );
+        __m128 p010 = _mm_loadu_ps( base + dg );
+        __m128 p110 = _mm_loadu_ps( base + dg + 4 );
+        __m128 p001 = _mm_loadu_ps( base + db );
+        __m128 p101 = _mm_loadu_ps( base + db + 4 );
+        __m128 p011 = _mm_loadu_ps( base + db + dg );
+        __m128 p111 = _mm_loadu_ps( base + db + dg + 4 );
+
+        __m128 c00 = _mm_fmadd_ps( fr, _mm_sub_ps( p100, p000 ), p000 );
+        __m128 c10 = _mm_fmadd_ps( fr, _mm_sub_ps( p110, p010 ), p010 );
+        __m128 c01 = _mm_fmadd_ps( fr, _mm_sub_ps( p101, p001 ), p001 );
+        __m128 c11 = _mm_fmadd_ps( fr, _mm_sub_ps( p111, p011 ), p011 );
+        __m128 c0 = _mm_fmadd_ps( fg, _mm_sub_ps( c10, c00 ), c00 );
+        __m128 c1 = _mm_fmadd_ps( fg, _mm_sub_ps( c11, c01 ), c01 );
+        __m128 c = _mm_fmadd_ps( fb, _mm_sub_ps( c1, c0 ), c0 );
+
+        __m128 v7 = _mm_blend_ps( c, s0, 0x8 );
+        __m128 v8 = _mm_min_ps( v7, _mm_set1_ps( 1.0f ) );
+        __m128 v9 = _mm_max_ps( v8, _mm_setzero_ps() );
+        __m128 v10 = _mm_mul_ps( v9, _mm_set1_ps( 255.0f ) );
+        __m128i v11 = _mm_cvtps_epi32( v10 );
+        __m128i v12 = _mm_packus_epi32( v11, v11 );
+        __m128i v13 = _mm_packus_epi16( v12, v12 );
+        *dst++ = _mm_cvtsi128_si32( v13 );
+
+        src += 4;
+        sz--;
+    }
+#else
+    while( sz > 0 )
+    {
+        int idx[3];
+        float frac[3];
+        for( int i=0; i<3; i++ )
+        {
+            const auto x = m_log ? std::log2( std::max( src[i], FLT_MIN ) ) : src[i];
+            const auto v = ( x - m_min[i] ) * m_scale[i];
+            const auto c = v > 0 ? std::min( v, float( n - 1 ) ) : 0.f;
+            idx[i] = std::min( int( c ), n - 2 );
+            frac[i] = c - idx[i];
+        }
+
+        const auto base = data + idx[2] * db + idx[1] * dg + idx[0] * 4;
+        float out[3];
+        for( int i=0; i<3; i++ )
+        {
+            const auto c00 = std::lerp( base[i], base[4+i], frac[0] );
+            const auto c10 = std::lerp( base[dg+i], base[dg+4+i], frac[0] );
+            const auto c01 = std::lerp( base[db+i], base[db+4+i], frac[0] );
+            const auto c11 = std::lerp( base[db+dg+i], base[db+dg+4+i], frac[0] );
+            out[i] = std::lerp( std::lerp( c00, c10, frac[1] ), std::lerp( c01, c11, frac[1] ), frac[2] );
+        }
+
+        *dst++ = (uint32_t( std::clamp( src[3], 0.0f, 1.0f ) * 255.0f ) << 24) |
+                 (uint32_t( std::clamp( out[2], 0.0f, 1.0f ) * 255.0f ) << 16) |
+                 (uint32_t( std::clamp( out[1], 0.0f, 1.0f ) * 255.0f ) << 8) |
+                  uint32_t( std::clamp( out[0], 0.0f, 1.0f ) * 255.0f );
+
+        src += 4;
+        sz--;
+    }
+#endif
+}
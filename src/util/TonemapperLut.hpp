@@ -0,0 +1,40 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+
+// A tone mapping operator sampled on a 3D grid of display-encoded colors, applied with trilinear
+// interpolation. Baked operators index the grid through a log2 shaper, so that the nodes are spread
+// evenly over the exposure range. Looks loaded from .cube files use the linear domain given in the file.
+class Lut
+{
+public:
+    using Operator = void(*)( uint32_t* dst, float* src, size_t sz );
+
+    static constexpr int BakeSize = 65;
+
+    explicit Lut( Operator op, int size = BakeSize );
+
+    // Returns nullptr if the file can't be read or isn't a valid 3D .cube LUT.
+    [[nodiscard]] static std::unique_ptr<Lut> LoadCube( const char* path );
+    [[nodiscard]] static std::unique_ptr<Lut> ParseCube( const char* data, size_t size );
+
+    void Apply( uint32_t* dst, const float* src, size_t sz ) const;
+
+    [[nodiscard]] int Size() const { return m_size; }
+
+private:
+    Lut( int size, const float* domainMin, const float* domainMax, std::vector<float>&& data );
+
+    int m_size;
+    bool m_log;
+
+    // Grid coordinate is ( shaper( x ) - m_min ) * m_scale.
+    float m_min[4];
+    float m_scale[4];
+
+    // RGBA nodes, red index changing fastest, as in .cube files. Alpha is unused padding.
+    std::vector<float> m_data;
+};
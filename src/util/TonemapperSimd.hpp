@@ -0,0 +1,64 @@
+#pragma once
+
+#include <string.h>
+
+#include "SimdVec.hpp"
+
+namespace ToneMap
+{
+
+template<typename V>
+SIMD_INLINE V EncodeSrgb( const V& color )
+{
+    const auto lin = color * V::Set( 12.92f );
+    const auto gam = Pow( color, V::Set( 1.0f / 2.4f ) ) * V::Set( 1.055f ) - V::Set( 0.055f );
+    return Select( Le( color, V::Set( 0.0031308f ) ), lin, gam );
+}
+
+template<typename V>
+SIMD_INLINE typename V::Int Quantize( const V& x )
+{
+    return ToInt( Max( Min( x, V::Set( 1.0f ) ), V::Set( 0.f ) ) * V::Set( 255.0f ) );
+}
+
+// Encodes linear color with the sRGB transfer function and stores it as RGBA8, with alpha as is
+template<typename V>
+SIMD_INLINE void StoreSrgb( uint32_t* dst, const Simd::Planar<V>& color )
+{
+    const auto r = Quantize( EncodeSrgb( color.r ) );
+    const auto g = Quantize( EncodeSrgb( color.g ) );
+    const auto b = Quantize( EncodeSrgb( color.b ) );
+    const auto a = Quantize( color.a );
+    StorePixels( dst, r | ShiftLeft<8>( g ) | ShiftLeft<16>( b ) | ShiftLeft<24>( a ) );
+}
+
+// Tone maps sz pixels in planar groups. The kernel is called as kernel( group ) and turns linear HDR color into
+// linear display color, leaving alpha alone. The last, partial group goes through a zero padded copy.
+template<typename V, typename K>
+SIMD_INLINE void TonemapPlanar( uint32_t* dst, const float* src, size_t sz, const K& kernel )
+{
+    Simd::Planar<V> group;
+    while( sz >= V::Lanes )
+    {
+        LoadPlanar( src, group );
+        kernel( group );
+        StoreSrgb( dst, group );
+
+        dst += V::Lanes;
+        src += V::Lanes * 4;
+        sz -= V::Lanes;
+    }
+
+    if( sz > 0 )
+    {
+        float tmp[V::Lanes * 4] = {};
+        uint32_t out[V::Lanes];
+        memcpy( tmp, src, sz * 4 * sizeof( float ) );
+        LoadPlanar( tmp, group );
+        kernel( group );
+        StoreSrgb( out, group );
+        memcpy( dst, out, sz * sizeof( uint32_t ) );
+    }
+}
+
+}
@@ -0,0 +1,43 @@
+#include <algorithm>
+#include <math.h>
+
+#include "Panic.hpp"
+#include "TransferCurve.hpp"
+
+namespace
+{
+// SMPTE ST 2084 constants
+constexpr double PqM1 = 1305. / 8192.;
+constexpr double PqM2 = 2523. / 32.;
+constexpr double PqC1 = 107. / 128.;
+constexpr double PqC2 = 2413. / 128.;
+constexpr double PqC3 = 2392. / 128.;
+constexpr double PqMaxNits = 10000;
+}
+
+std::vector<float> SrgbDecodeCurve( size_t size )
+{
+    CheckPanic( size >= 2, "Curve size must be at least 2" );
+
+    std::vector<float> curve( size );
+    for( size_t i=0; i<size; i++ )
+    {
+        const auto v = double( i ) / ( size - 1 );
+        curve[i] = float( v <= 0.04045 ? v / 12.92 : pow( ( v + 0.055 ) / 1.055, 2.4 ) );
+    }
+    return curve;
+}
+
+std::vector<float> PqEncodeCurve( size_t size, float whiteNits )
+{
+    CheckPanic( size >= 2, "Curve size must be at least 2" );
+
+    const auto scale = std::clamp( double( whiteNits ), 0., PqMaxNits ) / PqMaxNits;
+    std::vector<float> curve( size );
+    for( size_t i=0; i<size; i++ )
+    {
+        const auto ym1 = pow( double( i ) / ( size - 1 ) * scale, PqM1 );
+        curve[i] = float( pow( ( PqC1 + PqC2 * ym1 ) / ( 1 + PqC3 * ym1 ), PqM2 ) );
+    }
+    return curve;
+}
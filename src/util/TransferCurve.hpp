@@ -0,0 +1,13 @@
+#pragma once
+
+#include <stddef.h>
+#include <vector>
+
+// Transfer functions sampled for lookup tables applied outside of the shaders, e.g. by the display engine. Entry
+// i is the output for the input i / ( size - 1 ), both in [0, 1]. The size must be at least 2.
+
+// sRGB encoded to linear
+[[nodiscard]] std::vector<float> SrgbDecodeCurve( size_t size );
+
+// Linear to SMPTE ST 2084. Input 1.0 is SDR white, shown at whiteNits.
+[[nodiscard]] std::vector<float> PqEncodeCurve( size_t size, float whiteNits );
@@ -1,3 +1,5 @@
+#include <string.h>
+
 #include "Url.hpp"
 
 void UrlDecode( std::string& url )
@@ -15,3 +17,26 @@ void UrlDecode( std::string& url )
         pos += 1;
     }
 }
+
+std::string UrlEncodePath( const std::string& path )
+{
+    constexpr char Hex[] = "0123456789ABCDEF";
+
+    std::string ret;
+    ret.reserve( path.size() );
+    for( const unsigned char c : path )
+    {
+        const bool safe = ( c >= 'a' && c <= 'z' ) || ( c >= 'A' && c <= 'Z' ) || ( c >= '0' && c <= '9' ) || ( c != 0 && strchr( "!$&'()*+,-./:=@_~", c ) );
+        if( safe )
+        {
+            ret += c;
+        }
+        else
+        {
+            ret += '%';
+            ret += Hex[c >> 4];
+            ret += Hex[c & 0xF];
+        }
+    }
+    return ret;
+}
@@ -3,3 +3,7 @@
 #include <string>
 
 void UrlDecode( std::string& url );
+
+// Escapes a file path for use in a file:// URI. The set of characters left as is matches GLib, so that the URI
+// is the same as the one other applications make, e.g. for thumbnail lookup.
+[[nodiscard]] std::string UrlEncodePath( const std::string& path );
@@ -0,0 +1,54 @@
+#include <algorithm>
+#include <atomic>
+#include <string.h>
+#include <tracy/Tracy.hpp>
+
+#include "Bitmap.hpp"
+#include "TaskDispatch.hpp"
+#include "VectorImage.hpp"
+
+std::unique_ptr<Bitmap> VectorImage::RasterizeTiled( int width, int height, TaskDispatch* td ) const
+{
+    const auto w = Width();
+    const auto h = Height();
+    if( !td || w <= 0 || h <= 0 || ( width <= TileSize && height <= TileSize ) ) return Rasterize( width, height );
+
+    ZoneScoped;
+
+    const auto scale = std::min( float( width ) / w, float( height ) / h );
+    const auto tilesX = ( width + TileSize - 1 ) / TileSize;
+    const auto tilesY = ( height + TileSize - 1 ) / TileSize;
+    const auto numTiles = size_t( tilesX ) * tilesY;
+
+    auto bmp = std::make_unique<Bitmap>( width, height );
+    std::atomic<bool> failed = false;
+
+    td->ParallelFor( 0, numTiles, 1, [&]( size_t begin, size_t end ) {
+        for( size_t i=begin; i<end; i++ )
+        {
+            const auto x = int( i % tilesX ) * TileSize;
+            const auto y = int( i / tilesX ) * TileSize;
+            const auto tw = std::min( TileSize, width - x );
+            const auto th = std::min( TileSize, height - y );
+
+            auto tile = RasterizeRegion( x, y, tw, th, scale );
+            if( !tile )
+            {
+                failed.store( true, std::memory_order_relaxed );
+                continue;
+            }
+
+            auto src = tile->Data();
+            auto dst = bmp->Data() + ( size_t( y ) * width + x ) * 4;
+            for( int line=0; line<th; line++ )
+            {
+                memcpy( dst, src, tw * 4 );
+                src += tw * 4;
+                dst += width * 4;
+            }
+        }
+    } );
+
+    if( failed.load( std::memory_order_relaxed ) ) return nullptr;
+    return bmp;
+}
@@ -5,6 +5,7 @@
 #include "NoCopy.hpp"
 
 class Bitmap;
+class TaskDispatch;
 
 class VectorImage
 {
@@ -19,4 +20,13 @@ public:
     [[nodiscard]] virtual int Height() const { return -1; }
 
     [[nodiscard]] virtual std::unique_ptr<Bitmap> Rasterize( int width, int height ) const = 0;
+
+    // Renders the width x height rectangle at x, y of the image rasterized at scale times its intrinsic size.
+    // Requires the intrinsic size to be known. Safe to call from multiple threads at once.
+    [[nodiscard]] virtual std::unique_ptr<Bitmap> RasterizeRegion( int x, int y, int width, int height, float scale ) const = 0;
+
+    // Renders the image in TileSize tiles on the worker threads. Falls back to a single Rasterize() call if
+    // the intrinsic size is not known or the image fits in one tile.
+    static constexpr int TileSize = 512;
+    [[nodiscard]] std::unique_ptr<Bitmap> RasterizeTiled( int width, int height, TaskDispatch* td ) const;
 };
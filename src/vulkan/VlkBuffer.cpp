@@ -6,6 +6,7 @@
 VlkBuffer::VlkBuffer( VmaAllocator allocator, const VkBufferCreateInfo& createInfo, int flags )
     : m_allocator( allocator )
     , m_size( createInfo.size )
+    , m_pool( ( flags & PreferHost ) ? MemoryStats::Pool::Staging : MemoryStats::Pool::Buffers )
 {
     ZoneScoped;
 
@@ -23,11 +24,15 @@ VlkBuffer::VlkBuffer( VmaAllocator allocator, const VkBufferCreateInfo& createIn
     VkVerify( vmaCreateBuffer( allocator, &createInfo, &allocInfo, &m_buffer, &m_alloc, &info ) );
 
     m_map = info.pMappedData;
+    vmaGetAllocationMemoryProperties( allocator, m_alloc, &m_memoryFlags );
+    m_allocSize = info.size;
+    MemoryStats::Alloc( m_pool, m_alloc, m_allocSize );
 }
 
 VlkBuffer::~VlkBuffer()
 {
     ZoneScoped;
+    MemoryStats::Free( m_pool, m_alloc, m_allocSize );
     vmaDestroyBuffer( m_allocator, m_buffer, m_alloc );
 }
 
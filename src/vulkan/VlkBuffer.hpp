@@ -4,6 +4,7 @@
 #include <vk_mem_alloc.h>
 
 #include "VlkBase.hpp"
+#include "util/MemoryStats.hpp"
 #include "util/NoCopy.hpp"
 
 class VlkBuffer : public VlkBase
@@ -29,6 +30,7 @@ public:
     void Invalidate() { Invalidate( 0, m_size ); }
 
     [[nodiscard]] void* Ptr() const { return m_map; }
+    [[nodiscard]] bool IsHostCached() const { return m_memoryFlags & VK_MEMORY_PROPERTY_HOST_CACHED_BIT; }
 
     operator VkBuffer() const { return m_buffer; }
 
@@ -39,4 +41,7 @@ private:
 
     void* m_map;
     VkDeviceSize m_size;
+    VkDeviceSize m_allocSize;
+    VkMemoryPropertyFlags m_memoryFlags;
+    MemoryStats::Pool m_pool;
 };
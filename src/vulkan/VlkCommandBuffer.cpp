@@ -3,24 +3,15 @@
 #include "VlkError.hpp"
 
 VlkCommandBuffer::VlkCommandBuffer( const VlkCommandPool& pool, bool primary )
-    : m_commandPool( pool )
-    , m_device( pool )
+    : m_commandBuffer( pool.Allocate( primary ) )
+    , m_commandPool( pool )
+    , m_primary( primary )
 {
-    const VkCommandBufferAllocateInfo info  = {
-        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
-        .commandPool = pool,
-        .level = primary ? VK_COMMAND_BUFFER_LEVEL_PRIMARY : VK_COMMAND_BUFFER_LEVEL_SECONDARY,
-        .commandBufferCount = 1
-    };
-
-    std::lock_guard lock( pool );
-    VkVerify( vkAllocateCommandBuffers( pool, &info, &m_commandBuffer ) );
 }
 
 VlkCommandBuffer::~VlkCommandBuffer()
 {
-    std::lock_guard lock( m_commandPool );
-    vkFreeCommandBuffers( m_device, m_commandPool, 1, &m_commandBuffer );
+    m_commandPool.Free( m_commandBuffer, m_primary );
 }
 
 void VlkCommandBuffer::Begin( VkCommandBufferUsageFlags flags, bool _lock )
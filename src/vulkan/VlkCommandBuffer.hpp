@@ -28,5 +28,5 @@ public:
 private:
     VkCommandBuffer m_commandBuffer;
     const VlkCommandPool& m_commandPool;
-    VkDevice m_device;
+    bool m_primary;
 };
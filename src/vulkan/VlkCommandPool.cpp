@@ -1,13 +1,15 @@
 #include "VlkCommandPool.hpp"
 #include "VlkError.hpp"
 
-VlkCommandPool::VlkCommandPool( VkDevice device, uint32_t queueIndex, QueueType queueType )
+constexpr size_t MaxFree = 32;
+
+VlkCommandPool::VlkCommandPool( VkDevice device, uint32_t queueIndex, QueueType queueType, bool transient )
     : m_device( device )
     , m_queueType( queueType )
 {
     const VkCommandPoolCreateInfo info = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO,
-        .flags = VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT,
+        .flags = VkCommandPoolCreateFlags( VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT | ( transient ? VK_COMMAND_POOL_CREATE_TRANSIENT_BIT : 0 ) ),
         .queueFamilyIndex = queueIndex
     };
     VkVerify( vkCreateCommandPool( device, &info, nullptr, &m_pool ) );
@@ -17,3 +19,39 @@ VlkCommandPool::~VlkCommandPool()
 {
     vkDestroyCommandPool( m_device, m_pool, nullptr );
 }
+
+VkCommandBuffer VlkCommandPool::Allocate( bool primary ) const
+{
+    std::lock_guard lock( m_lock );
+    auto& free = m_free[primary];
+    if( !free.empty() )
+    {
+        auto cmdbuf = free.back();
+        free.pop_back();
+        return cmdbuf;
+    }
+
+    const VkCommandBufferAllocateInfo info  = {
+        .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO,
+        .commandPool = m_pool,
+        .level = primary ? VK_COMMAND_BUFFER_LEVEL_PRIMARY : VK_COMMAND_BUFFER_LEVEL_SECONDARY,
+        .commandBufferCount = 1
+    };
+    VkCommandBuffer cmdbuf;
+    VkVerify( vkAllocateCommandBuffers( m_device, &info, &cmdbuf ) );
+    return cmdbuf;
+}
+
+void VlkCommandPool::Free( VkCommandBuffer cmdbuf, bool primary ) const
+{
+    std::lock_guard lock( m_lock );
+    auto& free = m_free[primary];
+    if( free.size() < MaxFree )
+    {
+        free.emplace_back( cmdbuf );
+    }
+    else
+    {
+        vkFreeCommandBuffers( m_device, m_pool, 1, &cmdbuf );
+    }
+}
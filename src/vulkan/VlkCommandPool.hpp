@@ -1,6 +1,7 @@
 #pragma once
 
 #include <mutex>
+#include <vector>
 #include <vulkan/vulkan.h>
 
 #include "VlkQueueType.hpp"
@@ -9,11 +10,15 @@
 class VlkCommandPool
 {
 public:
-    VlkCommandPool( VkDevice device, uint32_t queueIndex, QueueType queueType );
+    VlkCommandPool( VkDevice device, uint32_t queueIndex, QueueType queueType, bool transient = false );
     ~VlkCommandPool();
 
     NoCopy( VlkCommandPool );
 
+    // Freed command buffers are kept for reuse. Beginning a buffer resets it, so they are handed out as they are.
+    [[nodiscard]] VkCommandBuffer Allocate( bool primary ) const;
+    void Free( VkCommandBuffer cmdbuf, bool primary ) const;
+
     operator VkCommandPool() const { return m_pool; }
     operator VkDevice() const { return m_device; }
     operator QueueType() const { return m_queueType; }
@@ -28,4 +33,5 @@ private:
     const QueueType m_queueType;
 
     mutable std::mutex m_lock;
+    mutable std::vector<VkCommandBuffer> m_free[2];     // Secondary, primary
 };
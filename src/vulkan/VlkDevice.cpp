@@ -1,19 +1,39 @@
 #include <array>
 #include <format>
 #include <ranges>
+#include <stdio.h>
 #include <string.h>
+#include <string>
 #include <tracy/Tracy.hpp>
+#include <unistd.h>
 #include <vector>
 
 #include "VlkCommandBuffer.hpp"
 #include "VlkCommandPool.hpp"
 #include "VlkDevice.hpp"
 #include "VlkError.hpp"
+#include "VlkFencePool.hpp"
 #include "VlkGarbage.hpp"
 #include "VlkInstance.hpp"
 #include "VlkPhysicalDevice.hpp"
+#include "VlkStagingRing.hpp"
+#include "VlkTimelineSemaphore.hpp"
 #include "vulkan/ext/Tracy.hpp"
 
+constexpr VkDeviceSize StagingRingSize = 128 * 1024 * 1024;
+
+// Written in front of the driver provided cache data. The data has its own header, but it doesn't cover the
+// driver version, and drivers are known to return garbage on mismatched data instead of ignoring it.
+struct PipelineCacheHeader
+{
+    uint32_t magic;
+    uint32_t driverVersion;
+    uint8_t deviceUUID[VK_UUID_SIZE];
+    uint64_t size;
+};
+
+constexpr uint32_t PipelineCacheMagic = 0x4350434d;     // MCPC
+
 VlkDevice::VlkDevice( VlkInstance& instance, std::shared_ptr<VlkPhysicalDevice> physDev, int flags, VkSurfaceKHR presentSurface )
     : m_physDev( std::move( physDev ) )
     , m_garbage( std::make_shared<VlkGarbage>() )
@@ -284,31 +304,69 @@ VlkDevice::VlkDevice( VlkInstance& instance, std::shared_ptr<VlkPhysicalDevice>
 
     std::vector<const char*> deviceExtensions = {};
 
+    m_incrementalPresent = false;
+    m_presentWait = false;
+    m_hdrMetadata = false;
     if( instance.Type() == VlkInstanceType::Wayland )
     {
         deviceExtensions.emplace_back( VK_KHR_SWAPCHAIN_EXTENSION_NAME );
         deviceExtensions.emplace_back( VK_EXT_SWAPCHAIN_MAINTENANCE_1_EXTENSION_NAME );
+
+        m_incrementalPresent = m_physDev->HasIncrementalPresent();
+        if( m_incrementalPresent ) deviceExtensions.emplace_back( VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME );
+
+        m_presentWait = m_physDev->HasPresentWait();
+        if( m_presentWait )
+        {
+            deviceExtensions.emplace_back( VK_KHR_PRESENT_ID_EXTENSION_NAME );
+            deviceExtensions.emplace_back( VK_KHR_PRESENT_WAIT_EXTENSION_NAME );
+        }
+
+        m_hdrMetadata = m_physDev->HasHdrMetadata();
+        if( m_hdrMetadata ) deviceExtensions.emplace_back( VK_EXT_HDR_METADATA_EXTENSION_NAME );
     }
-    else
+    else if( instance.Type() == VlkInstanceType::Drm )
     {
         deviceExtensions.emplace_back( VK_KHR_EXTERNAL_MEMORY_FD_EXTENSION_NAME );
         deviceExtensions.emplace_back( VK_EXT_EXTERNAL_MEMORY_DMA_BUF_EXTENSION_NAME );
         deviceExtensions.emplace_back( VK_EXT_IMAGE_DRM_FORMAT_MODIFIER_EXTENSION_NAME );
         deviceExtensions.emplace_back( VK_EXT_QUEUE_FAMILY_FOREIGN_EXTENSION_NAME );
         deviceExtensions.emplace_back( VK_KHR_EXTERNAL_SEMAPHORE_FD_EXTENSION_NAME );
+        deviceExtensions.emplace_back( VK_KHR_EXTERNAL_FENCE_FD_EXTENSION_NAME );
     }
 
+    const auto memoryBudget = m_physDev->HasMemoryBudget();
+    if( memoryBudget ) deviceExtensions.emplace_back( VK_EXT_MEMORY_BUDGET_EXTENSION_NAME );
+    m_memoryPriority = m_physDev->HasMemoryPriority();
+    if( m_memoryPriority ) deviceExtensions.emplace_back( VK_EXT_MEMORY_PRIORITY_EXTENSION_NAME );
+
     const auto& txInfo = m_queueInfo[(int)QueueType::Transfer];
-    m_hostImageCopy = m_physDev->HasHostImageCopy() && ( txInfo.shareCompute || txInfo.shareGraphic );
+    m_hostImageCopySupported = !( flags & NoHostImageCopy ) && m_physDev->HasHostImageCopy() && ( txInfo.shareCompute || txInfo.shareGraphic );
+    m_hostImageCopy = m_hostImageCopySupported;
 
+    VkPhysicalDevicePresentWaitFeaturesKHR featuresPresentWait = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR,
+        .presentWait = VK_TRUE
+    };
+    VkPhysicalDevicePresentIdFeaturesKHR featuresPresentId = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+        .pNext = &featuresPresentWait,
+        .presentId = VK_TRUE
+    };
+    VkPhysicalDeviceMemoryPriorityFeaturesEXT featuresMemoryPriority = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PRIORITY_FEATURES_EXT,
+        .pNext = m_presentWait ? &featuresPresentId : nullptr,
+        .memoryPriority = VK_TRUE
+    };
     VkPhysicalDeviceSwapchainMaintenance1FeaturesEXT featuresSwapchainMaintenance1 = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_SWAPCHAIN_MAINTENANCE_1_FEATURES_EXT,
+        .pNext = m_memoryPriority ? (void*)&featuresMemoryPriority : m_presentWait ? (void*)&featuresPresentId : nullptr,
         .swapchainMaintenance1 = VK_TRUE
     };
     VkPhysicalDeviceVulkan14Features features14 = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_4_FEATURES,
         .pNext = &featuresSwapchainMaintenance1,
-        .hostImageCopy = m_hostImageCopy,
+        .hostImageCopy = m_hostImageCopySupported,
         .pushDescriptor = VK_TRUE
     };
     VkPhysicalDeviceVulkan13Features features13 = {
@@ -319,7 +377,8 @@ VlkDevice::VlkDevice( VlkInstance& instance, std::shared_ptr<VlkPhysicalDevice>
     };
     VkPhysicalDeviceVulkan12Features features12 = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_2_FEATURES,
-        .pNext = &features13
+        .pNext = &features13,
+        .timelineSemaphore = VK_TRUE
     };
     VkPhysicalDeviceVulkan11Features features11 = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_1_FEATURES,
@@ -382,12 +441,20 @@ VlkDevice::VlkDevice( VlkInstance& instance, std::shared_ptr<VlkPhysicalDevice>
     }
 
     const VmaAllocatorCreateInfo allocInfo = {
+        .flags = ( memoryBudget ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_BUDGET_BIT : 0u ) | ( m_memoryPriority ? VMA_ALLOCATOR_CREATE_EXT_MEMORY_PRIORITY_BIT : 0u ),
         .physicalDevice = *m_physDev,
         .device = m_device,
         .instance = instance,
         .vulkanApiVersion = instance.ApiVersion()
     };
     VkVerify( vmaCreateAllocator( &allocInfo, &m_allocator ) );
+    m_stagingRing = std::make_shared<VlkStagingRing>( m_allocator, m_garbage, StagingRingSize );
+    m_fencePool = std::make_shared<VlkFencePool>( m_device );
+
+    constexpr VkPipelineCacheCreateInfo cacheInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO
+    };
+    VkVerify( vkCreatePipelineCache( m_device, &cacheInfo, nullptr, &m_pipelineCache ) );
 
     if( m_queueInfo[(int)QueueType::Graphic].idx >= 0 )
     {
@@ -448,6 +515,20 @@ VlkDevice::VlkDevice( VlkInstance& instance, std::shared_ptr<VlkPhysicalDevice>
         }
     }
 
+    for( size_t i=0; i<m_queueLock.size(); i++ )
+    {
+        if( !m_queueLock[i] ) continue;
+        for( size_t j=0; j<i; j++ )
+        {
+            if( m_queueLock[j] == m_queueLock[i] )
+            {
+                m_timeline[i] = m_timeline[j];
+                break;
+            }
+        }
+        if( !m_timeline[i] ) m_timeline[i] = std::make_shared<Timeline>( std::make_shared<VlkTimelineSemaphore>( m_device ), 0 );
+    }
+
 #ifdef TRACY_ENABLE
     auto gpdctd = (PFN_vkGetPhysicalDeviceCalibrateableTimeDomainsEXT)vkGetInstanceProcAddr( instance, "vkGetPhysicalDeviceCalibrateableTimeDomainsEXT" );
     auto gct = (PFN_vkGetCalibratedTimestampsEXT)vkGetInstanceProcAddr( instance, "vkGetCalibratedTimestampsEXT" );
@@ -472,26 +553,282 @@ VlkDevice::~VlkDevice()
     TracyVkDestroy( m_tracyCtx );
 #endif
 
+    m_stagingRing.reset();
     m_garbage.reset();
+    m_fencePool.reset();
+    for( auto& timeline : m_timeline ) timeline.reset();
 
+    m_threadPools.clear();
     for( auto& pool : m_commandPool ) pool.reset();
+    vkDestroyPipelineCache( m_device, m_pipelineCache, nullptr );
     vmaDestroyAllocator( m_allocator );
     vkDestroyDevice( m_device, nullptr );
 }
 
-void VlkDevice::Submit( const VlkCommandBuffer& cmdbuf, VkFence fence )
+const VlkCommandPool& VlkDevice::GetThreadCommandPool( QueueType type )
+{
+    CheckPanic( m_commandPool[(int)type], "Command pool does not exist" );
+
+    std::lock_guard lock( m_threadPoolLock );
+    auto it = m_threadPools.find( std::this_thread::get_id() );
+    if( it == m_threadPools.end() )
+    {
+        ZoneScopedN( "Thread command pools" );
+
+        // Same sharing of pools between queue types as in the device wide ones
+        std::array<std::shared_ptr<VlkCommandPool>, 4> pools;
+        for( size_t i=0; i<m_commandPool.size(); i++ )
+        {
+            if( !m_commandPool[i] ) continue;
+            for( size_t j=0; j<i; j++ )
+            {
+                if( m_commandPool[j] == m_commandPool[i] )
+                {
+                    pools[i] = pools[j];
+                    break;
+                }
+            }
+            if( !pools[i] ) pools[i] = std::make_shared<VlkCommandPool>( m_device, m_queueInfo[i].idx, (QueueType)i, true );
+        }
+        it = m_threadPools.emplace( std::this_thread::get_id(), std::move( pools ) ).first;
+    }
+    return *it->second[(int)type];
+}
+
+uint64_t VlkDevice::Submit( const VlkCommandBuffer& cmdbuf, VkFence fence, std::span<const TimelinePoint> wait )
 {
     const VkCommandBufferSubmitInfo cmdbufInfo = {
         .sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_SUBMIT_INFO,
         .commandBuffer = cmdbuf
     };
+
+    std::vector<VkSemaphoreSubmitInfo> waitInfo;
+    waitInfo.reserve( wait.size() );
+    for( auto& point : wait )
+    {
+        waitInfo.emplace_back( VkSemaphoreSubmitInfo {
+            .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+            .semaphore = *GetTimeline( point.queue ),
+            .value = point.value,
+            .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+        } );
+    }
+
+    const QueueType type = cmdbuf;
+    auto& timeline = *m_timeline[(int)type];
+
+    lock( type );
+    const auto value = ++timeline.value;
+    const VkSemaphoreSubmitInfo signalInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_SUBMIT_INFO,
+        .semaphore = *timeline.semaphore,
+        .value = value,
+        .stageMask = VK_PIPELINE_STAGE_2_ALL_COMMANDS_BIT
+    };
     const VkSubmitInfo2 submitInfo = {
         .sType = VK_STRUCTURE_TYPE_SUBMIT_INFO_2,
+        .waitSemaphoreInfoCount = (uint32_t)waitInfo.size(),
+        .pWaitSemaphoreInfos = waitInfo.data(),
         .commandBufferInfoCount = 1,
-        .pCommandBufferInfos = &cmdbufInfo
+        .pCommandBufferInfos = &cmdbufInfo,
+        .signalSemaphoreInfoCount = 1,
+        .pSignalSemaphoreInfos = &signalInfo
+    };
+    VkVerify( vkQueueSubmit2( GetQueue( type ), 1, &submitInfo, fence ) );
+    unlock( type );
+
+    return value;
+}
+
+bool VlkDevice::LoadPipelineCache( const char* path )
+{
+    ZoneScoped;
+
+    FILE* f = fopen( path, "rb" );
+    if( !f ) return false;
+
+    PipelineCacheHeader header;
+    std::vector<uint8_t> data;
+    if( fread( &header, 1, sizeof( header ), f ) == sizeof( header ) && header.magic == PipelineCacheMagic && header.size < 256 * 1024 * 1024 )
+    {
+        data.resize( header.size );
+        if( fread( data.data(), 1, header.size, f ) != header.size ) data.clear();
+    }
+    fclose( f );
+
+    const auto& properties = m_physDev->Properties();
+    const auto& id = m_physDev->IdProperties();
+    if( data.size() < sizeof( VkPipelineCacheHeaderVersionOne ) ||
+        header.driverVersion != properties.driverVersion ||
+        memcmp( header.deviceUUID, id.deviceUUID, VK_UUID_SIZE ) != 0 )
+    {
+        mclog( LogLevel::Info, "Ignoring pipeline cache %s, written for a different device or driver", path );
+        return false;
+    }
+
+    VkPipelineCacheHeaderVersionOne vkHeader;
+    memcpy( &vkHeader, data.data(), sizeof( vkHeader ) );
+    if( vkHeader.headerVersion != VK_PIPELINE_CACHE_HEADER_VERSION_ONE ||
+        vkHeader.vendorID != properties.vendorID ||
+        vkHeader.deviceID != properties.deviceID ||
+        memcmp( vkHeader.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE ) != 0 )
+    {
+        mclog( LogLevel::Info, "Ignoring pipeline cache %s, written for a different device or driver", path );
+        return false;
+    }
+
+    const VkPipelineCacheCreateInfo cacheInfo = {
+        .sType = VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO,
+        .initialDataSize = data.size(),
+        .pInitialData = data.data()
+    };
+    VkPipelineCache cache;
+    if( vkCreatePipelineCache( m_device, &cacheInfo, nullptr, &cache ) != VK_SUCCESS ) return false;
+    const auto res = vkMergePipelineCaches( m_device, m_pipelineCache, 1, &cache );
+    vkDestroyPipelineCache( m_device, cache, nullptr );
+    if( res != VK_SUCCESS ) return false;
+
+    mclog( LogLevel::Debug, "Loaded pipeline cache %s, %zu bytes", path, data.size() );
+    return true;
+}
+
+void VlkDevice::SavePipelineCache( const char* path ) const
+{
+    ZoneScoped;
+
+    size_t size;
+    if( vkGetPipelineCacheData( m_device, m_pipelineCache, &size, nullptr ) != VK_SUCCESS || size == 0 ) return;
+    std::vector<uint8_t> data( size );
+    if( vkGetPipelineCacheData( m_device, m_pipelineCache, &size, data.data() ) != VK_SUCCESS ) return;
+
+    PipelineCacheHeader header = {
+        .magic = PipelineCacheMagic,
+        .driverVersion = m_physDev->Properties().driverVersion,
+        .size = size
     };
+    memcpy( header.deviceUUID, m_physDev->IdProperties().deviceUUID, VK_UUID_SIZE );
+
+    // Write to a temporary file first, so that a crash doesn't leave a truncated cache behind
+    const auto tmp = std::string( path ) + ".tmp";
+    FILE* f = fopen( tmp.c_str(), "wb" );
+    if( !f ) return;
+    const bool ok = fwrite( &header, 1, sizeof( header ), f ) == sizeof( header ) && fwrite( data.data(), 1, size, f ) == size;
+    if( fclose( f ) == 0 && ok )
+    {
+        rename( tmp.c_str(), path );
+    }
+    else
+    {
+        unlink( tmp.c_str() );
+    }
+}
+
+VlkDevice::MemoryBudget VlkDevice::GetMemoryBudget() const
+{
+    ZoneScoped;
+
+    const VkPhysicalDeviceMemoryProperties* props;
+    vmaGetMemoryProperties( m_allocator, &props );
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets( m_allocator, budgets );
+
+    MemoryBudget ret = {};
+    for( uint32_t i=0; i<props->memoryHeapCount; i++ )
+    {
+        if( props->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT )
+        {
+            ret.usage += budgets[i].usage;
+            ret.budget += budgets[i].budget;
+        }
+    }
+    return ret;
+}
+
+std::vector<VlkDevice::HeapBudget> VlkDevice::GetHeapBudgets() const
+{
+    ZoneScoped;
+
+    const VkPhysicalDeviceMemoryProperties* props;
+    vmaGetMemoryProperties( m_allocator, &props );
+
+    VmaBudget budgets[VK_MAX_MEMORY_HEAPS];
+    vmaGetHeapBudgets( m_allocator, budgets );
 
-    lock( cmdbuf );
-    VkVerify( vkQueueSubmit2( GetQueue( cmdbuf ), 1, &submitInfo, fence ) );
-    unlock( cmdbuf );
+    std::vector<HeapBudget> ret( props->memoryHeapCount );
+    for( uint32_t i=0; i<props->memoryHeapCount; i++ )
+    {
+        ret[i] = {
+            .usage = budgets[i].usage,
+            .budget = budgets[i].budget,
+            .deviceLocal = ( props->memoryHeaps[i].flags & VK_MEMORY_HEAP_DEVICE_LOCAL_BIT ) != 0
+        };
+    }
+    return ret;
+}
+
+uint64_t VlkDevice::AddPressureHandler( int priority, PressureHandler handler )
+{
+    std::lock_guard lock( m_pressureLock );
+    const auto id = ++m_pressureId;
+    auto it = std::ranges::upper_bound( m_pressure, priority, {}, &Pressure::priority );
+    m_pressure.insert( it, Pressure { id, priority, std::move( handler ) } );
+    return id;
+}
+
+void VlkDevice::RemovePressureHandler( uint64_t id )
+{
+    std::lock_guard lock( m_pressureLock );
+    std::erase_if( m_pressure, [id]( const Pressure& p ) { return p.id == id; } );
+}
+
+bool VlkDevice::ReserveMemory( VkDeviceSize size )
+{
+    const auto budget = GetMemoryBudget();
+    if( budget.usage + size <= budget.budget ) return true;
+
+    const auto wanted = budget.usage + size - budget.budget;
+    return RelievePressure( wanted ) >= wanted;
+}
+
+VkDeviceSize VlkDevice::RelievePressure( VkDeviceSize bytes )
+{
+    ZoneScoped;
+
+    // Handlers may create images themselves, which must not call them again
+    std::unique_lock lock( m_pressureLock, std::try_to_lock );
+    if( !lock ) return 0;
+    static thread_local bool s_inside = false;
+    if( s_inside ) return 0;
+    s_inside = true;
+
+    VkDeviceSize freed = 0;
+    for( size_t i=0; i<m_pressure.size() && freed < bytes; i++ )
+    {
+        freed += m_pressure[i].handler( bytes - freed );
+    }
+    s_inside = false;
+    if( freed > 0 ) m_garbage->Collect();
+
+    mclog( LogLevel::Warning, "Device memory pressure: %.1f MiB wanted, %.1f MiB freed", bytes / ( 1024.f * 1024.f ), freed / ( 1024.f * 1024.f ) );
+    return freed;
+}
+
+VlkDevice::MemoryStatistics VlkDevice::GetMemoryStatistics() const
+{
+    ZoneScoped;
+
+    VmaTotalStatistics stats;
+    vmaCalculateStatistics( m_allocator, &stats );
+
+    const auto& total = stats.total.statistics;
+    TracyPlot( "VMA blocks (MiB)", total.blockBytes / ( 1024. * 1024. ) );
+    TracyPlot( "VMA allocations (MiB)", total.allocationBytes / ( 1024. * 1024. ) );
+
+    return {
+        .blocks = total.blockCount,
+        .allocations = total.allocationCount,
+        .blockBytes = total.blockBytes,
+        .allocationBytes = total.allocationBytes
+    };
 }
@@ -1,9 +1,13 @@
 #pragma once
 
 #include <array>
+#include <functional>
 #include <memory>
 #include <mutex>
+#include <span>
 #include <stdexcept>
+#include <thread>
+#include <vector>
 #include <vulkan/vulkan.h>
 #include <tracy/TracyVulkan.hpp>
 #include <vk_mem_alloc.h>
@@ -12,11 +16,15 @@
 #include "VlkQueueType.hpp"
 #include "util/NoCopy.hpp"
 #include "util/Panic.hpp"
+#include "util/RobinHood.hpp"
 
 class VlkCommandBuffer;
 class VlkCommandPool;
+class VlkFencePool;
 class VlkGarbage;
 class VlkInstance;
+class VlkStagingRing;
+class VlkTimelineSemaphore;
 
 class VlkDevice
 {
@@ -26,6 +34,7 @@ public:
         RequireGraphic  = 1 << 0,
         RequireCompute  = 1 << 1,
         RequirePresent  = 1 << 2,
+        NoHostImageCopy = 1 << 3,   // Transfer through staging buffers even if host image copies are available
     };
 
     struct QueueInfo
@@ -37,6 +46,41 @@ public:
         bool sharePresent;
     };
 
+    // Point on the timeline of a queue, which is advanced by each Submit() call.
+    struct TimelinePoint
+    {
+        QueueType queue;
+        uint64_t value;
+    };
+
+    // Summed over the device local heaps. Without VK_EXT_memory_budget the budget is an estimate made by VMA.
+    struct MemoryBudget
+    {
+        VkDeviceSize usage;
+        VkDeviceSize budget;
+    };
+
+    struct HeapBudget
+    {
+        VkDeviceSize usage;
+        VkDeviceSize budget;
+        bool deviceLocal;
+    };
+
+    // Asked to free up to the given number of bytes of device memory when it runs short, returns how much was
+    // freed. Handlers are called from whichever thread allocates, and must not wait for locks which may be held
+    // while images are created.
+    using PressureHandler = std::function<VkDeviceSize( VkDeviceSize bytes )>;
+
+    // Everything allocated through VMA, in all heaps
+    struct MemoryStatistics
+    {
+        uint32_t blocks;        // Device memory objects
+        uint32_t allocations;
+        VkDeviceSize blockBytes;
+        VkDeviceSize allocationBytes;
+    };
+
     struct DeviceException : public std::runtime_error { explicit DeviceException( const std::string& msg ) : std::runtime_error( msg ) {} };
 
     VlkDevice( VlkInstance& instance, std::shared_ptr<VlkPhysicalDevice> physDev, int flags, VkSurfaceKHR presentSurface = VK_NULL_HANDLE );
@@ -44,15 +88,54 @@ public:
 
     NoCopy( VlkDevice );
 
-    void Submit( const VlkCommandBuffer& cmdbuf, VkFence fence );
+    // Returns the value the queue timeline reaches when the submission completes. The wait points are waited for
+    // on the GPU, before any command in the submission is executed.
+    uint64_t Submit( const VlkCommandBuffer& cmdbuf, VkFence fence, std::span<const TimelinePoint> wait = {} );
+
+    // The cache file is ignored if it was written for a different device or driver version. Loading merges the
+    // file contents into the cache, so it can be done after pipelines were created.
+    bool LoadPipelineCache( const char* path );
+    void SavePipelineCache( const char* path ) const;
 
     [[nodiscard]] auto& GetQueueInfo( QueueType type ) const { return m_queueInfo[(int)type]; }
     [[nodiscard]] auto GetQueue( QueueType type ) const { CheckPanic( m_queue[(int)type] != VK_NULL_HANDLE, "Queue does not exist" ); return m_queue[(int)type]; }
     [[nodiscard]] auto& GetCommandPool( QueueType type ) const { CheckPanic( m_commandPool[(int)type], "Command pool does not exist" ); return m_commandPool[(int)type]; }
+    [[nodiscard]] auto& GetFencePool() const { return m_fencePool; }
     [[nodiscard]] auto& GetPhysicalDevice() const { return m_physDev; }
     [[nodiscard]] auto& GetGarbage() const { return m_garbage; }
+    [[nodiscard]] auto& GetStagingRing() const { return m_stagingRing; }
+    [[nodiscard]] auto& GetTimeline( QueueType type ) const { CheckPanic( m_timeline[(int)type], "Timeline does not exist" ); return m_timeline[(int)type]->semaphore; }
+    [[nodiscard]] VkPipelineCache GetPipelineCache() const { return m_pipelineCache; }
+
+    // Transient pool of the calling thread, for one-shot command buffers. Recording from different threads then
+    // doesn't serialize on the pool lock. The pools live as long as the device, as buffers may be freed on other
+    // threads after the one recording them has exited.
+    [[nodiscard]] const VlkCommandPool& GetThreadCommandPool( QueueType type );
 
     [[nodiscard]] bool UseHostImageCopy() const { return m_hostImageCopy; }
+    // Host image copies can be turned off later, if staging buffers were measured to be faster. Textures made
+    // before keep the path they were uploaded with.
+    void SetHostImageCopy( bool enable ) { m_hostImageCopy = enable && m_hostImageCopySupported; }
+    [[nodiscard]] bool UseIncrementalPresent() const { return m_incrementalPresent; }
+    [[nodiscard]] bool UsePresentWait() const { return m_presentWait; }
+    [[nodiscard]] bool UseHdrMetadata() const { return m_hdrMetadata; }
+    [[nodiscard]] MemoryBudget GetMemoryBudget() const;
+    [[nodiscard]] std::vector<HeapBudget> GetHeapBudgets() const;
+    [[nodiscard]] MemoryStatistics GetMemoryStatistics() const;     // Walks all allocations, not for every frame
+
+    // Handlers with a lower priority are asked first. Removing a handler waits for calls to it to return.
+    [[nodiscard]] uint64_t AddPressureHandler( int priority, PressureHandler handler );
+    void RemovePressureHandler( uint64_t id );
+
+    // Asks the pressure handlers for memory until size more bytes fit in the budget of the device local heaps.
+    // Returns whether they fit. Anything freed may still be in use by the GPU and is only returned to the heap
+    // once the garbage is collected, so this works ahead of the budget rather than on the spot.
+    bool ReserveMemory( VkDeviceSize size );
+
+    // Calls the pressure handlers in order until bytes were freed, returns the amount
+    VkDeviceSize RelievePressure( VkDeviceSize bytes );
+
+    [[nodiscard]] bool UseMemoryPriority() const { return m_memoryPriority; }
 
     operator VkDevice() const { return m_device; }
     operator VkPhysicalDevice() const { return *m_physDev; }
@@ -66,6 +149,13 @@ public:
     void unlock( QueueType type ) { CheckPanic( m_queueLock[(int)type], "Queue lock does not exist" ); m_queueLock[(int)type]->unlock(); }
 
 private:
+    // Queues sharing a VkQueue share the timeline. The value is guarded by the queue lock.
+    struct Timeline
+    {
+        std::shared_ptr<VlkTimelineSemaphore> semaphore;
+        uint64_t value;
+    };
+
     VkDevice m_device;
     std::shared_ptr<VlkPhysicalDevice> m_physDev;
 
@@ -75,12 +165,36 @@ private:
     std::array<VkQueue, 4> m_queue;
     std::array<std::shared_ptr<VlkCommandPool>, 4> m_commandPool;
     std::array<std::shared_ptr<std::mutex>, 4> m_queueLock;
+    std::array<std::shared_ptr<Timeline>, 4> m_timeline;
+
+    std::mutex m_threadPoolLock;
+    unordered_flat_map<std::thread::id, std::array<std::shared_ptr<VlkCommandPool>, 4>> m_threadPools;
 
     bool m_hostImageCopy;
+    bool m_hostImageCopySupported;
+    bool m_incrementalPresent;
+    bool m_presentWait;
+    bool m_hdrMetadata;
+    bool m_memoryPriority;
+
+    struct Pressure
+    {
+        uint64_t id;
+        int priority;
+        PressureHandler handler;
+    };
+
+    std::recursive_mutex m_pressureLock;
+    std::vector<Pressure> m_pressure;       // By priority
+    uint64_t m_pressureId = 0;
+
+    VkPipelineCache m_pipelineCache;
 
 #ifdef TRACY_ENABLE
     TracyVkCtx m_tracyCtx = nullptr;
 #endif
 
     std::shared_ptr<VlkGarbage> m_garbage;
+    std::shared_ptr<VlkStagingRing> m_stagingRing;
+    std::shared_ptr<VlkFencePool> m_fencePool;
 };
@@ -1,5 +1,6 @@
 #include "VlkError.hpp"
 #include "VlkFence.hpp"
+#include "VlkProxy.hpp"
 
 VlkFence::VlkFence( VkDevice device, VkFenceCreateFlags flags )
     : m_device( device )
@@ -25,3 +26,15 @@ void VlkFence::Reset()
 {
     VkVerify( vkResetFences( m_device, 1, &m_fence ) );
 }
+
+bool VlkFence::ImportSyncFd( int fd )
+{
+    const VkImportFenceFdInfoKHR info = {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_FENCE_FD_INFO_KHR,
+        .fence = m_fence,
+        .flags = VK_FENCE_IMPORT_TEMPORARY_BIT,
+        .handleType = VK_EXTERNAL_FENCE_HANDLE_TYPE_SYNC_FD_BIT,
+        .fd = fd
+    };
+    return ImportFenceFdKHR( m_device, &info ) == VK_SUCCESS;
+}
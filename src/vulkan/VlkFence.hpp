@@ -16,6 +16,10 @@ public:
     VkResult Wait( uint64_t timeout = UINT64_MAX );
     void Reset();
 
+    // Temporarily replaces the payload with a sync_file, until the fence is reset. Takes ownership of the
+    // descriptor on success.
+    [[nodiscard]] bool ImportSyncFd( int fd );
+
     operator VkFence&() { return m_fence; }
 
 private:
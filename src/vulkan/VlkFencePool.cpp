@@ -0,0 +1,52 @@
+#include <tracy/Tracy.hpp>
+
+#include "VlkFence.hpp"
+#include "VlkFencePool.hpp"
+
+// Enough for the uploads of a burst of thumbnails to be in flight at once
+constexpr size_t MaxFree = 64;
+
+VlkFencePool::VlkFencePool( VkDevice device )
+    : m_device( device )
+{
+}
+
+VlkFencePool::~VlkFencePool()
+{
+    for( auto fence : m_free ) delete fence;
+}
+
+std::shared_ptr<VlkFence> VlkFencePool::Acquire()
+{
+    VlkFence* fence = nullptr;
+    {
+        std::lock_guard lock( m_lock );
+        if( !m_free.empty() )
+        {
+            fence = m_free.back();
+            m_free.pop_back();
+        }
+    }
+    if( !fence )
+    {
+        ZoneScopedN( "New fence" );
+        fence = new VlkFence( m_device );
+    }
+    return std::shared_ptr<VlkFence>( fence, [pool = weak_from_this()]( VlkFence* ptr ) { Release( pool, ptr ); } );
+}
+
+void VlkFencePool::Release( const std::weak_ptr<VlkFencePool>& pool, VlkFence* fence )
+{
+    auto self = pool.lock();
+    if( self && fence->Wait( 0 ) == VK_SUCCESS )
+    {
+        fence->Reset();
+        std::lock_guard lock( self->m_lock );
+        if( self->m_free.size() < MaxFree )
+        {
+            self->m_free.emplace_back( fence );
+            return;
+        }
+    }
+    delete fence;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <vulkan/vulkan.h>
+
+#include "util/NoCopy.hpp"
+
+class VlkFence;
+
+// Unsignaled fences for one-shot submissions. A fence goes back to the pool when the last reference to it is
+// dropped, which for submissions recycled through VlkGarbage is when the garbage is collected. Fences released
+// unsignaled may never have been submitted, or may still be pending, and are destroyed instead.
+class VlkFencePool : public std::enable_shared_from_this<VlkFencePool>
+{
+public:
+    explicit VlkFencePool( VkDevice device );
+    ~VlkFencePool();
+
+    NoCopy( VlkFencePool );
+
+    [[nodiscard]] std::shared_ptr<VlkFence> Acquire();
+
+private:
+    static void Release( const std::weak_ptr<VlkFencePool>& pool, VlkFence* fence );
+
+    VkDevice m_device;
+
+    std::mutex m_lock;
+    std::vector<VlkFence*> m_free;
+};
@@ -1,9 +1,11 @@
+#include <algorithm>
 #include <common/TracySystem.hpp>
 #include <tracy/Tracy.hpp>
 
 #include "VlkBase.hpp"
 #include "VlkFence.hpp"
 #include "VlkGarbage.hpp"
+#include "VlkTimelineSemaphore.hpp"
 #include "util/Logs.hpp"
 #include "util/Panic.hpp"
 
@@ -19,9 +21,10 @@ VlkGarbage::~VlkGarbage()
     m_cv.notify_all();
     m_reaper.join();
 
-    if( m_garbage.empty() ) return;
-    mclog( LogLevel::Debug, "Waiting for %zu garbage sets", m_garbage.size() );
+    if( m_garbage.empty() && m_timelineGarbage.empty() ) return;
+    mclog( LogLevel::Debug, "Waiting for %zu garbage sets, %zu timelines", m_garbage.size(), m_timelineGarbage.size() );
     for( auto& g : m_garbage ) g.first->Wait();
+    for( auto& g : m_timelineGarbage ) g.first->Wait( g.second.back().value );
 }
 
 void VlkGarbage::Recycle( std::shared_ptr<VlkFence> fence, std::shared_ptr<VlkBase>&& object )
@@ -56,6 +59,41 @@ void VlkGarbage::Recycle( std::shared_ptr<VlkFence> fence, std::vector<std::shar
     m_cv.notify_one();
 }
 
+void VlkGarbage::Recycle( std::shared_ptr<VlkTimelineSemaphore> timeline, uint64_t value, std::shared_ptr<VlkBase>&& object )
+{
+    Recycle( std::move( timeline ), value, std::vector<std::shared_ptr<VlkBase>> { std::move( object ) } );
+}
+
+void VlkGarbage::Recycle( std::shared_ptr<VlkTimelineSemaphore> timeline, uint64_t value, std::vector<std::shared_ptr<VlkBase>>&& objects )
+{
+    CheckPanic( timeline, "Timeline is null" );
+    std::lock_guard lock( m_lock );
+    auto& sets = m_timelineGarbage[std::move( timeline )];
+
+    // Values mostly arrive in order, but submissions from different threads may race to get here.
+    if( !sets.empty() && sets.back().value == value )
+    {
+        sets.back().objects.insert( sets.back().objects.end(), std::make_move_iterator( objects.begin() ), std::make_move_iterator( objects.end() ) );
+    }
+    else if( sets.empty() || sets.back().value < value )
+    {
+        sets.emplace_back( value, std::move( objects ) );
+    }
+    else
+    {
+        auto it = std::lower_bound( sets.begin(), sets.end(), value, []( const auto& set, uint64_t v ) { return set.value < v; } );
+        if( it->value == value )
+        {
+            it->objects.insert( it->objects.end(), std::make_move_iterator( objects.begin() ), std::make_move_iterator( objects.end() ) );
+        }
+        else
+        {
+            sets.emplace( it, value, std::move( objects ) );
+        }
+    }
+    m_cv.notify_one();
+}
+
 void VlkGarbage::Collect()
 {
     std::unique_lock lock( m_lock );
@@ -69,7 +107,7 @@ void VlkGarbage::Reaper()
     while( !m_shutdown.load( std::memory_order_acquire ) )
     {
         std::unique_lock lock( m_lock );
-        m_cv.wait( lock, [this] { return m_shutdown.load( std::memory_order_acquire ) || !m_garbage.empty(); } );
+        m_cv.wait( lock, [this] { return m_shutdown.load( std::memory_order_acquire ) || !m_garbage.empty() || !m_timelineGarbage.empty(); } );
         if( m_shutdown.load( std::memory_order_acquire ) ) return;
 
         ReapGarbage( lock );
@@ -79,9 +117,33 @@ void VlkGarbage::Reaper()
             mclog( LogLevel::Debug, "Garbage is still present, sleeping for 100 ms" );
             m_cv.wait_for( lock, std::chrono::milliseconds( 100 ) );
         }
+        else if( !m_timelineGarbage.empty() )
+        {
+            WaitTimelines( lock );
+        }
     }
 }
 
+void VlkGarbage::WaitTimelines( std::unique_lock<std::mutex>& lock )
+{
+    ZoneScoped;
+
+    std::vector<std::shared_ptr<VlkTimelineSemaphore>> timelines;
+    std::vector<VkSemaphore> semaphores;
+    std::vector<uint64_t> values;
+    for( auto& g : m_timelineGarbage )
+    {
+        timelines.emplace_back( g.first );
+        semaphores.emplace_back( *g.first );
+        values.emplace_back( g.second.front().value );
+    }
+
+    // Fence garbage recycled in the meantime is picked up after the timeout, at the latest.
+    lock.unlock();
+    VlkTimelineSemaphore::WaitAny( timelines[0]->Device(), semaphores, values, 100 * 1000 * 1000 );
+    lock.lock();
+}
+
 void VlkGarbage::ReapGarbage( std::unique_lock<std::mutex>& lock )
 {
     ZoneScoped;
@@ -107,6 +169,29 @@ void VlkGarbage::ReapGarbage( std::unique_lock<std::mutex>& lock )
         }
     }
 
+    auto tit = m_timelineGarbage.begin();
+    while( tit != m_timelineGarbage.end() )
+    {
+        const auto current = tit->first->Value();
+        auto& timelineSets = tit->second;
+        while( !timelineSets.empty() && timelineSets.front().value <= current )
+        {
+            auto& objects = timelineSets.front().objects;
+            count += objects.size();
+            sets++;
+            tmp.insert( tmp.end(), std::make_move_iterator( objects.begin() ), std::make_move_iterator( objects.end() ) );
+            timelineSets.pop_front();
+        }
+        if( timelineSets.empty() )
+        {
+            tit = m_timelineGarbage.erase( tit );
+        }
+        else
+        {
+            ++tit;
+        }
+    }
+
     if( !tmp.empty() )
     {
         ZoneScopedN( "Garbage collection" );
@@ -2,6 +2,7 @@
 
 #include <atomic>
 #include <condition_variable>
+#include <deque>
 #include <memory>
 #include <mutex>
 #include <thread>
@@ -11,6 +12,7 @@
 
 class VlkBase;
 class VlkFence;
+class VlkTimelineSemaphore;
 
 class VlkGarbage
 {
@@ -21,14 +23,27 @@ public:
     void Recycle( std::shared_ptr<VlkFence> fence, std::shared_ptr<VlkBase>&& object );
     void Recycle( std::shared_ptr<VlkFence> fence, std::vector<std::shared_ptr<VlkBase>>&& objects );
 
+    // Objects are released once the timeline reaches the value. Sets retired on the same timeline are reclaimed
+    // together, with a single counter query, and the reaper blocks on the semaphores instead of polling.
+    void Recycle( std::shared_ptr<VlkTimelineSemaphore> timeline, uint64_t value, std::shared_ptr<VlkBase>&& object );
+    void Recycle( std::shared_ptr<VlkTimelineSemaphore> timeline, uint64_t value, std::vector<std::shared_ptr<VlkBase>>&& objects );
+
     void Collect();
 
 private:
+    struct TimelineSet
+    {
+        uint64_t value;
+        std::vector<std::shared_ptr<VlkBase>> objects;
+    };
+
     void Reaper();
+    void WaitTimelines( std::unique_lock<std::mutex>& lock );
     void ReapGarbage( std::unique_lock<std::mutex>& lock );
 
     std::mutex m_lock;
     unordered_flat_map<std::shared_ptr<VlkFence>, std::vector<std::shared_ptr<VlkBase>>> m_garbage;
+    unordered_flat_map<std::shared_ptr<VlkTimelineSemaphore>, std::deque<TimelineSet>> m_timelineGarbage;    // Sorted by value
 
     std::atomic<bool> m_shutdown;
     std::thread m_reaper;
@@ -1,7 +1,42 @@
+#include <sys/stat.h>
 #include <tracy/Tracy.hpp>
+#include <unistd.h>
+#include <vulkan/vk_enum_string_helper.h>
 
+#include "VlkDevice.hpp"
 #include "VlkError.hpp"
 #include "VlkImage.hpp"
+#include "VlkPhysicalDevice.hpp"
+#include "VlkProxy.hpp"
+#include "util/MemoryStats.hpp"
+
+namespace
+{
+bool IsDisjoint( const VlkImage::DmaBuf& dmaBuf )
+{
+    if( dmaBuf.numPlanes == 1 ) return false;
+
+    struct stat ref, st;
+    if( fstat( dmaBuf.fd[0], &ref ) < 0 ) return false;
+
+    for( uint32_t i=1; i<dmaBuf.numPlanes; i++ )
+    {
+        if( fstat( dmaBuf.fd[i], &st ) < 0 ) return false;
+        if( st.st_ino != ref.st_ino ) return true;
+    }
+    return false;
+}
+
+int FindMemoryType( const VlkPhysicalDevice& physDev, uint32_t typeBits )
+{
+    const auto& memProps = physDev.MemoryProperties();
+    for( uint32_t i=0; i<memProps.memoryTypeCount; i++ )
+    {
+        if( typeBits & ( 1 << i ) ) return i;
+    }
+    return -1;
+}
+}
 
 VlkImage::VlkImage( VmaAllocator allocator, const VkImageCreateInfo& createInfo )
     : m_allocator( allocator )
@@ -11,11 +46,163 @@ VlkImage::VlkImage( VmaAllocator allocator, const VkImageCreateInfo& createInfo
     VmaAllocationCreateInfo allocInfo = {};
     allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
 
-    VkVerify( vmaCreateImage( m_allocator, &createInfo, &allocInfo, &m_image, &m_allocation, nullptr ) );
+    VmaAllocationInfo info;
+    VkVerify( vmaCreateImage( m_allocator, &createInfo, &allocInfo, &m_image, &m_allocation, &info ) );
+    m_size = info.size;
+    MemoryStats::Alloc( MemoryStats::Pool::Textures, m_allocation, m_size );
+}
+
+VlkImage::VlkImage( VlkDevice& device, const VkImageCreateInfo& createInfo, float priority )
+    : m_allocator( device )
+{
+    ZoneScoped;
+
+    const VkDeviceImageMemoryRequirements reqInfo = {
+        .sType = VK_STRUCTURE_TYPE_DEVICE_IMAGE_MEMORY_REQUIREMENTS,
+        .pCreateInfo = &createInfo
+    };
+    VkMemoryRequirements2 req = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2
+    };
+    vkGetDeviceImageMemoryRequirements( device, &reqInfo, &req );
+    const auto size = req.memoryRequirements.size;
+    device.ReserveMemory( size );
+
+    VmaAllocationCreateInfo allocInfo = {};
+    allocInfo.usage = VMA_MEMORY_USAGE_AUTO;
+    allocInfo.priority = priority;
+
+    VmaAllocationInfo info;
+    auto res = vmaCreateImage( m_allocator, &createInfo, &allocInfo, &m_image, &m_allocation, &info );
+    if( res == VK_ERROR_OUT_OF_DEVICE_MEMORY && device.RelievePressure( size ) > 0 )
+    {
+        res = vmaCreateImage( m_allocator, &createInfo, &allocInfo, &m_image, &m_allocation, &info );
+    }
+    VkVerify( res );
+    m_size = info.size;
+    MemoryStats::Alloc( MemoryStats::Pool::Textures, m_allocation, m_size );
+}
+
+VlkImage::VlkImage( VlkDevice& device, const DmaBuf& dmaBuf, VkImageUsageFlags usage )
+    : m_device( device )
+{
+    ZoneScoped;
+
+    if( dmaBuf.numPlanes == 0 || dmaBuf.numPlanes > DmaBuf::MaxPlanes ) throw ImportException( "Invalid number of planes" );
+    if( IsDisjoint( dmaBuf ) ) throw ImportException( "Disjoint buffers are not supported" );
+
+    VkSubresourceLayout layouts[DmaBuf::MaxPlanes] = {};
+    for( uint32_t i=0; i<dmaBuf.numPlanes; i++ )
+    {
+        layouts[i].offset = dmaBuf.offset[i];
+        layouts[i].rowPitch = dmaBuf.stride[i];
+    }
+
+    const VkImageDrmFormatModifierExplicitCreateInfoEXT modInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_DRM_FORMAT_MODIFIER_EXPLICIT_CREATE_INFO_EXT,
+        .drmFormatModifier = dmaBuf.modifier,
+        .drmFormatModifierPlaneCount = dmaBuf.numPlanes,
+        .pPlaneLayouts = layouts
+    };
+    const VkExternalMemoryImageCreateInfo extInfo = {
+        .sType = VK_STRUCTURE_TYPE_EXTERNAL_MEMORY_IMAGE_CREATE_INFO,
+        .pNext = &modInfo,
+        .handleTypes = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT
+    };
+    const VkImageCreateInfo imageInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO,
+        .pNext = &extInfo,
+        .imageType = VK_IMAGE_TYPE_2D,
+        .format = dmaBuf.format,
+        .extent = { dmaBuf.width, dmaBuf.height, 1 },
+        .mipLevels = 1,
+        .arrayLayers = 1,
+        .samples = VK_SAMPLE_COUNT_1_BIT,
+        .tiling = VK_IMAGE_TILING_DRM_FORMAT_MODIFIER_EXT,
+        .usage = usage,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE,
+        .initialLayout = VK_IMAGE_LAYOUT_UNDEFINED
+    };
+
+    auto res = vkCreateImage( m_device, &imageInfo, nullptr, &m_image );
+    if( res != VK_SUCCESS ) throw ImportException( std::string( "Failed to create image: " ) + string_VkResult( res ) );
+
+    VkMemoryFdPropertiesKHR memFdProps = { VK_STRUCTURE_TYPE_MEMORY_FD_PROPERTIES_KHR };
+    res = GetMemoryFdPropertiesKHR( m_device, VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT, dmaBuf.fd[0], &memFdProps );
+    if( res != VK_SUCCESS )
+    {
+        vkDestroyImage( m_device, m_image, nullptr );
+        throw ImportException( std::string( "Failed to get dma-buf properties: " ) + string_VkResult( res ) );
+    }
+
+    const VkImageMemoryRequirementsInfo2 memReqInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_REQUIREMENTS_INFO_2,
+        .image = m_image
+    };
+    VkMemoryRequirements2 memReq = { VK_STRUCTURE_TYPE_MEMORY_REQUIREMENTS_2 };
+    vkGetImageMemoryRequirements2( m_device, &memReqInfo, &memReq );
+    m_size = memReq.memoryRequirements.size;
+
+    const auto memIdx = FindMemoryType( *device.GetPhysicalDevice(), memReq.memoryRequirements.memoryTypeBits & memFdProps.memoryTypeBits );
+    if( memIdx < 0 )
+    {
+        vkDestroyImage( m_device, m_image, nullptr );
+        throw ImportException( "No memory type can hold the dma-buf" );
+    }
+
+    // A successful import takes ownership of the descriptor, so it gets its own
+    const auto fd = dup( dmaBuf.fd[0] );
+    if( fd < 0 )
+    {
+        vkDestroyImage( m_device, m_image, nullptr );
+        throw ImportException( "Failed to duplicate dma-buf descriptor" );
+    }
+
+    const VkMemoryDedicatedAllocateInfo dedInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_DEDICATED_ALLOCATE_INFO,
+        .image = m_image
+    };
+    const VkImportMemoryFdInfoKHR importInfo = {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_MEMORY_FD_INFO_KHR,
+        .pNext = &dedInfo,
+        .handleType = VK_EXTERNAL_MEMORY_HANDLE_TYPE_DMA_BUF_BIT_EXT,
+        .fd = fd
+    };
+    const VkMemoryAllocateInfo memInfo = {
+        .sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO,
+        .pNext = &importInfo,
+        .allocationSize = memReq.memoryRequirements.size,
+        .memoryTypeIndex = uint32_t( memIdx )
+    };
+
+    res = vkAllocateMemory( m_device, &memInfo, nullptr, &m_memory );
+    if( res != VK_SUCCESS )
+    {
+        close( fd );
+        vkDestroyImage( m_device, m_image, nullptr );
+        throw ImportException( std::string( "Failed to import dma-buf memory: " ) + string_VkResult( res ) );
+    }
+
+    const VkBindImageMemoryInfo bindInfo = {
+        .sType = VK_STRUCTURE_TYPE_BIND_IMAGE_MEMORY_INFO,
+        .image = m_image,
+        .memory = m_memory
+    };
+    VkVerify( vkBindImageMemory2( m_device, 1, &bindInfo ) );
 }
 
 VlkImage::~VlkImage()
 {
     ZoneScoped;
-    vmaDestroyImage( m_allocator, m_image, m_allocation );
+
+    if( m_allocation )
+    {
+        MemoryStats::Free( MemoryStats::Pool::Textures, m_allocation, m_size );
+        vmaDestroyImage( m_allocator, m_image, m_allocation );
+    }
+    else
+    {
+        vkDestroyImage( m_device, m_image, nullptr );
+        vkFreeMemory( m_device, m_memory, nullptr );
+    }
 }
@@ -1,23 +1,67 @@
 #pragma once
 
+#include <stdexcept>
+#include <stdint.h>
 #include <vulkan/vulkan.h>
 #include <vk_mem_alloc.h>
 
 #include "VlkBase.hpp"
 #include "util/NoCopy.hpp"
 
+class VlkDevice;
+
 class VlkImage : public VlkBase
 {
 public:
+    struct ImportException : public std::runtime_error { explicit ImportException( const std::string& msg ) : std::runtime_error( msg ) {} };
+
+    // Layout of a dma-buf, as described by GBM or by a linux-dmabuf client. The descriptors stay owned by the
+    // caller.
+    struct DmaBuf
+    {
+        static constexpr uint32_t MaxPlanes = 4;
+
+        uint32_t width;
+        uint32_t height;
+        VkFormat format;
+        uint64_t modifier;
+        uint32_t numPlanes;
+        int fd[MaxPlanes];
+        uint32_t offset[MaxPlanes];
+        uint32_t stride[MaxPlanes];
+    };
+
+    // Weights of the memory of an image in the device local heaps, if VK_EXT_memory_priority is supported. The
+    // driver moves memory of low priority out first when it runs out of space.
+    static constexpr float LowPriority = 0.25f;
+    static constexpr float DefaultPriority = 0.5f;
+    static constexpr float HighPriority = 1.f;
+
     VlkImage( VmaAllocator allocator, const VkImageCreateInfo& createInfo );
+
+    // Makes room with the pressure handlers of the device when the image would exceed the memory budget, and
+    // retries once if the allocation still fails for lack of device memory.
+    VlkImage( VlkDevice& device, const VkImageCreateInfo& createInfo, float priority = DefaultPriority );
+
+    // Imports the memory of a dma-buf, without a copy. Throws if the device can't use the buffer, which is
+    // expected for client provided ones.
+    VlkImage( VlkDevice& device, const DmaBuf& dmaBuf, VkImageUsageFlags usage );
+
     ~VlkImage();
 
     NoCopy( VlkImage );
 
+    [[nodiscard]] VkDeviceSize Size() const { return m_size; }
+
     operator VkImage() const { return m_image; }
 
 private:
     VkImage m_image;
-    VmaAllocation m_allocation;
-    VmaAllocator m_allocator;
+    VmaAllocation m_allocation = VK_NULL_HANDLE;
+    VkDeviceSize m_size;
+    VmaAllocator m_allocator = VK_NULL_HANDLE;
+
+    // Imported images only
+    VkDevice m_device = VK_NULL_HANDLE;
+    VkDeviceMemory m_memory = VK_NULL_HANDLE;
 };
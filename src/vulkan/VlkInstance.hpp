@@ -11,7 +11,8 @@ class VlkPhysicalDevice;
 enum class VlkInstanceType
 {
     Wayland,
-    Drm
+    Drm,
+    Headless    // No presentation, for offscreen work such as benchmarks
 };
 
 class VlkInstance
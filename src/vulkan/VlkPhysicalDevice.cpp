@@ -24,6 +24,15 @@ VlkPhysicalDevice::VlkPhysicalDevice( VkPhysicalDevice physDev )
     vkGetPhysicalDeviceProperties( physDev, &m_properties );
     vkGetPhysicalDeviceMemoryProperties( physDev, &m_memoryProperties );
 
+    m_idProperties = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_ID_PROPERTIES
+    };
+    VkPhysicalDeviceProperties2 properties2 = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2,
+        .pNext = &m_idProperties
+    };
+    vkGetPhysicalDeviceProperties2( physDev, &properties2 );
+
     m_features14 = {
         .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_VULKAN_1_4_FEATURES
     };
@@ -84,6 +93,55 @@ bool VlkPhysicalDevice::HasHostImageCopy() const
     return m_features14.hostImageCopy == VK_TRUE;
 }
 
+bool VlkPhysicalDevice::HasMemoryBudget() const
+{
+    return IsExtensionAvailable( VK_EXT_MEMORY_BUDGET_EXTENSION_NAME );
+}
+
+bool VlkPhysicalDevice::HasMemoryPriority() const
+{
+    if( !IsExtensionAvailable( VK_EXT_MEMORY_PRIORITY_EXTENSION_NAME ) ) return false;
+
+    VkPhysicalDeviceMemoryPriorityFeaturesEXT memoryPriority = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_MEMORY_PRIORITY_FEATURES_EXT
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &memoryPriority
+    };
+    vkGetPhysicalDeviceFeatures2( m_physDev, &features );
+    return memoryPriority.memoryPriority == VK_TRUE;
+}
+
+bool VlkPhysicalDevice::HasIncrementalPresent() const
+{
+    return IsExtensionAvailable( VK_KHR_INCREMENTAL_PRESENT_EXTENSION_NAME );
+}
+
+bool VlkPhysicalDevice::HasPresentWait() const
+{
+    if( !IsExtensionAvailable( VK_KHR_PRESENT_ID_EXTENSION_NAME ) || !IsExtensionAvailable( VK_KHR_PRESENT_WAIT_EXTENSION_NAME ) ) return false;
+
+    VkPhysicalDevicePresentWaitFeaturesKHR presentWait = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_WAIT_FEATURES_KHR
+    };
+    VkPhysicalDevicePresentIdFeaturesKHR presentId = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PRESENT_ID_FEATURES_KHR,
+        .pNext = &presentWait
+    };
+    VkPhysicalDeviceFeatures2 features = {
+        .sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2,
+        .pNext = &presentId
+    };
+    vkGetPhysicalDeviceFeatures2( m_physDev, &features );
+    return presentId.presentId == VK_TRUE && presentWait.presentWait == VK_TRUE;
+}
+
+bool VlkPhysicalDevice::HasHdrMetadata() const
+{
+    return IsExtensionAvailable( VK_EXT_HDR_METADATA_EXTENSION_NAME );
+}
+
 bool VlkPhysicalDevice::IsDeviceHardware() const
 {
     return m_properties.deviceType == VK_PHYSICAL_DEVICE_TYPE_DISCRETE_GPU ||
@@ -16,6 +16,7 @@ public:
     [[nodiscard]] auto& QueueFamilyProperties() const { return m_queueFamilyProperties; }
     [[nodiscard]] auto& ExtensionProperties() const { return m_extensionProperties; }
     [[nodiscard]] auto& MemoryProperties() const { return m_memoryProperties; }
+    [[nodiscard]] auto& IdProperties() const { return m_idProperties; }
 
     [[nodiscard]] bool IsGraphicCapable() const;
     [[nodiscard]] bool IsComputeCapable() const;
@@ -24,6 +25,11 @@ public:
     [[nodiscard]] bool HasCalibratedTimestamps() const;
     [[nodiscard]] bool HasPciBusInfo() const;
     [[nodiscard]] bool HasHostImageCopy() const;
+    [[nodiscard]] bool HasMemoryBudget() const;
+    [[nodiscard]] bool HasMemoryPriority() const;
+    [[nodiscard]] bool HasIncrementalPresent() const;
+    [[nodiscard]] bool HasPresentWait() const;
+    [[nodiscard]] bool HasHdrMetadata() const;
 
     [[nodiscard]] bool IsDeviceHardware() const;
 
@@ -35,6 +41,7 @@ private:
     VkPhysicalDevice m_physDev;
     VkPhysicalDeviceProperties m_properties;
     VkPhysicalDeviceMemoryProperties m_memoryProperties;
+    VkPhysicalDeviceIDProperties m_idProperties;
 
     VkPhysicalDeviceFeatures2 m_features;
     VkPhysicalDeviceVulkan11Features m_features11;
@@ -1,10 +1,27 @@
+#include "VlkDevice.hpp"
 #include "VlkError.hpp"
 #include "VlkPipeline.hpp"
 
-VlkPipeline::VlkPipeline( VkDevice device, const VkGraphicsPipelineCreateInfo& createInfo )
+VlkPipeline::VlkPipeline( VkDevice device, const VkGraphicsPipelineCreateInfo& createInfo, VkPipelineCache cache )
     : m_device( device )
 {
-    VkVerify( vkCreateGraphicsPipelines( device, VK_NULL_HANDLE, 1, &createInfo, nullptr, &m_pipeline ) );
+    VkVerify( vkCreateGraphicsPipelines( device, cache, 1, &createInfo, nullptr, &m_pipeline ) );
+}
+
+VlkPipeline::VlkPipeline( VlkDevice& device, const VkGraphicsPipelineCreateInfo& createInfo )
+    : VlkPipeline( (VkDevice)device, createInfo, device.GetPipelineCache() )
+{
+}
+
+VlkPipeline::VlkPipeline( VkDevice device, const VkComputePipelineCreateInfo& createInfo, VkPipelineCache cache )
+    : m_device( device )
+{
+    VkVerify( vkCreateComputePipelines( device, cache, 1, &createInfo, nullptr, &m_pipeline ) );
+}
+
+VlkPipeline::VlkPipeline( VlkDevice& device, const VkComputePipelineCreateInfo& createInfo )
+    : VlkPipeline( (VkDevice)device, createInfo, device.GetPipelineCache() )
+{
 }
 
 VlkPipeline::~VlkPipeline()
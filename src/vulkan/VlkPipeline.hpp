@@ -5,10 +5,15 @@
 #include "VlkBase.hpp"
 #include "util/NoCopy.hpp"
 
+class VlkDevice;
+
 class VlkPipeline : public VlkBase
 {
 public:
-    VlkPipeline( VkDevice device, const VkGraphicsPipelineCreateInfo& createInfo );
+    VlkPipeline( VkDevice device, const VkGraphicsPipelineCreateInfo& createInfo, VkPipelineCache cache = VK_NULL_HANDLE );
+    VlkPipeline( VlkDevice& device, const VkGraphicsPipelineCreateInfo& createInfo );     // Uses the device pipeline cache
+    VlkPipeline( VkDevice device, const VkComputePipelineCreateInfo& createInfo, VkPipelineCache cache = VK_NULL_HANDLE );
+    VlkPipeline( VlkDevice& device, const VkComputePipelineCreateInfo& createInfo );
     ~VlkPipeline();
 
     NoCopy( VlkPipeline );
@@ -3,6 +3,7 @@
 
 PFN_vkGetSemaphoreFdKHR GetSemaphoreFdKHR;
 PFN_vkImportSemaphoreFdKHR ImportSemaphoreFdKHR;
+PFN_vkImportFenceFdKHR ImportFenceFdKHR;
 PFN_vkGetMemoryFdPropertiesKHR GetMemoryFdPropertiesKHR;
 
 VkResult LoadVulkanExtensions( VlkInstance& instance )
@@ -15,6 +16,9 @@ VkResult LoadVulkanExtensions( VlkInstance& instance )
         ImportSemaphoreFdKHR = (PFN_vkImportSemaphoreFdKHR)vkGetInstanceProcAddr( instance, "vkImportSemaphoreFdKHR" );
         if( !ImportSemaphoreFdKHR ) return VK_ERROR_EXTENSION_NOT_PRESENT;
 
+        ImportFenceFdKHR = (PFN_vkImportFenceFdKHR)vkGetInstanceProcAddr( instance, "vkImportFenceFdKHR" );
+        if( !ImportFenceFdKHR ) return VK_ERROR_EXTENSION_NOT_PRESENT;
+
         GetMemoryFdPropertiesKHR = (PFN_vkGetMemoryFdPropertiesKHR)vkGetInstanceProcAddr( instance, "vkGetMemoryFdPropertiesKHR" );
         if( !GetMemoryFdPropertiesKHR ) return VK_ERROR_EXTENSION_NOT_PRESENT;
     }
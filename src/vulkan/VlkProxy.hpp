@@ -11,4 +11,5 @@ void DestroyDebugUtilsMessengerEXT( VkInstance instance, VkDebugUtilsMessengerEX
 
 extern PFN_vkGetSemaphoreFdKHR GetSemaphoreFdKHR;
 extern PFN_vkImportSemaphoreFdKHR ImportSemaphoreFdKHR;
+extern PFN_vkImportFenceFdKHR ImportFenceFdKHR;
 extern PFN_vkGetMemoryFdPropertiesKHR GetMemoryFdPropertiesKHR;
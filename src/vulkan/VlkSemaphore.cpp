@@ -1,10 +1,18 @@
 #include "VlkError.hpp"
+#include "VlkProxy.hpp"
 #include "VlkSemaphore.hpp"
 
-VlkSemaphore::VlkSemaphore( VkDevice device )
+VlkSemaphore::VlkSemaphore( VkDevice device, VkExternalSemaphoreHandleTypeFlags exportTypes )
     : m_device( device )
 {
-    constexpr VkSemaphoreCreateInfo info = { .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO };
+    const VkExportSemaphoreCreateInfo exportInfo = {
+        .sType = VK_STRUCTURE_TYPE_EXPORT_SEMAPHORE_CREATE_INFO,
+        .handleTypes = exportTypes
+    };
+    const VkSemaphoreCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = exportTypes != 0 ? &exportInfo : nullptr
+    };
     VkVerify( vkCreateSemaphore( device, &info, nullptr, &m_semaphore ) );
 }
 
@@ -12,3 +20,27 @@ VlkSemaphore::~VlkSemaphore()
 {
     vkDestroySemaphore( m_device, m_semaphore, nullptr );
 }
+
+int VlkSemaphore::ExportSyncFd() const
+{
+    const VkSemaphoreGetFdInfoKHR info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_GET_FD_INFO_KHR,
+        .semaphore = m_semaphore,
+        .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT
+    };
+    int fd;
+    VkVerify( GetSemaphoreFdKHR( m_device, &info, &fd ) );
+    return fd;
+}
+
+void VlkSemaphore::ImportSyncFd( int fd )
+{
+    const VkImportSemaphoreFdInfoKHR info = {
+        .sType = VK_STRUCTURE_TYPE_IMPORT_SEMAPHORE_FD_INFO_KHR,
+        .semaphore = m_semaphore,
+        .flags = VK_SEMAPHORE_IMPORT_TEMPORARY_BIT,
+        .handleType = VK_EXTERNAL_SEMAPHORE_HANDLE_TYPE_SYNC_FD_BIT,
+        .fd = fd
+    };
+    VkVerify( ImportSemaphoreFdKHR( m_device, &info ) );
+}
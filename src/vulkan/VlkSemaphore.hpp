@@ -8,11 +8,19 @@
 class VlkSemaphore : public VlkBase
 {
 public:
-    explicit VlkSemaphore( VkDevice device );
+    // The handle types are the ones the semaphore payload can be exported as
+    explicit VlkSemaphore( VkDevice device, VkExternalSemaphoreHandleTypeFlags exportTypes = 0 );
     ~VlkSemaphore();
 
     NoCopy( VlkSemaphore );
 
+    // Must be called after a signal operation was submitted. Exporting consumes the payload, as a wait would.
+    // Returns -1 if the semaphore is already signalled.
+    [[nodiscard]] int ExportSyncFd() const;
+
+    // Temporary import of a sync_file, which the next wait consumes. Takes ownership of the descriptor.
+    void ImportSyncFd( int fd );
+
     operator VkSemaphore() const { return m_semaphore; }
 
 private:
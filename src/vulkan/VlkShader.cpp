@@ -16,3 +16,28 @@ VlkShader::VlkShader( const Stage* stages, size_t count )
         m_modules[i] = stages[i].module;
     }
 }
+
+VlkShader::VlkShader( const VlkShader& shader, std::vector<uint32_t> constants )
+    : m_stages( shader.m_stages )
+    , m_modules( shader.m_modules )
+    , m_constants( std::move( constants ) )
+    , m_entries( m_constants.size() )
+{
+    for( size_t i=0; i<m_constants.size(); i++ )
+    {
+        m_entries[i] = {
+            .constantID = uint32_t( i ),
+            .offset = uint32_t( i * sizeof( uint32_t ) ),
+            .size = sizeof( uint32_t )
+        };
+    }
+    m_specialization = {
+        .mapEntryCount = uint32_t( m_entries.size() ),
+        .pMapEntries = m_entries.data(),
+        .dataSize = m_constants.size() * sizeof( uint32_t ),
+        .pData = m_constants.data()
+    };
+
+    // Stages which don't declare some of the constants ignore them
+    for( auto& stage : m_stages ) stage.pSpecializationInfo = &m_specialization;
+}
@@ -24,6 +24,10 @@ public:
 
     VlkShader( const Stage* stages, size_t count );
 
+    // Same stages, specialized with the given constant values. Each value sets the constant with its index as
+    // constant_id, 32 bits wide, for bool, int and uint constants alike.
+    VlkShader( const VlkShader& shader, std::vector<uint32_t> constants );
+
     NoCopy( VlkShader );
 
     [[nodiscard]] uint32_t GetStageCount() const { return m_stages.size(); }
@@ -32,4 +36,8 @@ public:
 private:
     std::vector<VkPipelineShaderStageCreateInfo> m_stages;
     std::vector<std::shared_ptr<VlkShaderModule>> m_modules;
+
+    std::vector<uint32_t> m_constants;
+    std::vector<VkSpecializationMapEntry> m_entries;
+    VkSpecializationInfo m_specialization = {};
 };
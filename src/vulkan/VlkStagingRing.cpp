@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <tracy/Tracy.hpp>
+
+#include "VlkBuffer.hpp"
+#include "VlkFence.hpp"
+#include "VlkGarbage.hpp"
+#include "VlkStagingRing.hpp"
+#include "VlkTimelineSemaphore.hpp"
+#include "util/Logs.hpp"
+#include "util/Panic.hpp"
+
+static VkBufferCreateInfo GetBufferInfo( VkDeviceSize size )
+{
+    return {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+}
+
+// Staging memory is also read by the CPU, for readbacks and mip generation, so it should be cached.
+static constexpr int BufferFlags = VlkBuffer::PreferHost | VlkBuffer::WillRead;
+
+void VlkStagingRing::Allocation::Flush() const
+{
+    buffer->Flush( offset, size );
+}
+
+void VlkStagingRing::Allocation::Invalidate() const
+{
+    buffer->Invalidate( offset, size );
+}
+
+bool VlkStagingRing::Allocation::IsHostCached() const
+{
+    return buffer->IsHostCached();
+}
+
+VlkStagingRing::Allocation::operator VkBuffer() const
+{
+    return *buffer;
+}
+
+VlkStagingRing::VlkStagingRing( VmaAllocator allocator, std::shared_ptr<VlkGarbage> garbage, VkDeviceSize size )
+    : m_allocator( allocator )
+    , m_garbage( std::move( garbage ) )
+    , m_size( size )
+    , m_nextId( 1 )
+{
+}
+
+VlkStagingRing::~VlkStagingRing()
+{
+    for( auto& segment : m_segments )
+    {
+        if( segment.fence ) segment.fence->Wait();
+        else if( segment.timeline ) segment.timeline->Wait( segment.value );
+    }
+}
+
+VlkStagingRing::Allocation VlkStagingRing::Acquire( VkDeviceSize size, VkDeviceSize alignment )
+{
+    ZoneScoped;
+
+    if( size <= m_size )
+    {
+        std::lock_guard lock( m_lock );
+        if( !m_buffer )
+        {
+            mclog( LogLevel::Info, "Creating %zu MB staging ring", size_t( m_size / ( 1024 * 1024 ) ) );
+            m_buffer = std::make_shared<VlkBuffer>( m_allocator, GetBufferInfo( m_size ), BufferFlags );
+        }
+
+        VkDeviceSize offset;
+        if( Allocate( size, alignment, offset ) || ( Reclaim(), Allocate( size, alignment, offset ) ) )
+        {
+            const auto id = m_nextId++;
+            m_segments.emplace_back( Segment { id, offset, offset + size, false, nullptr, nullptr, 0 } );
+            return { m_buffer, offset, size, (uint8_t*)m_buffer->Ptr() + offset, id };
+        }
+    }
+
+    // Too large for the ring, or the ring is full of in-flight uploads.
+    ZoneText( "Dedicated", 9 );
+    auto buffer = std::make_shared<VlkBuffer>( m_allocator, GetBufferInfo( size ), BufferFlags );
+    auto ptr = buffer->Ptr();
+    return { std::move( buffer ), 0, size, ptr, 0 };
+}
+
+void VlkStagingRing::Release( Allocation& alloc, std::shared_ptr<VlkFence> fence )
+{
+    CheckPanic( fence, "Fence is null" );
+
+    if( alloc.id == 0 )
+    {
+        m_garbage->Recycle( std::move( fence ), std::move( alloc.buffer ) );
+        return;
+    }
+
+    std::lock_guard lock( m_lock );
+    auto& segment = Find( alloc.id );
+    segment.released = true;
+    segment.fence = std::move( fence );
+    alloc.buffer.reset();
+    Reclaim();
+}
+
+void VlkStagingRing::Release( Allocation& alloc, std::shared_ptr<VlkTimelineSemaphore> timeline, uint64_t value )
+{
+    CheckPanic( timeline, "Timeline is null" );
+
+    if( alloc.id == 0 )
+    {
+        m_garbage->Recycle( std::move( timeline ), value, std::move( alloc.buffer ) );
+        return;
+    }
+
+    std::lock_guard lock( m_lock );
+    auto& segment = Find( alloc.id );
+    segment.released = true;
+    segment.timeline = std::move( timeline );
+    segment.value = value;
+    alloc.buffer.reset();
+    Reclaim();
+}
+
+VlkStagingRing::Segment& VlkStagingRing::Find( uint64_t id )
+{
+    auto it = std::find_if( m_segments.begin(), m_segments.end(), [id]( const auto& s ) { return s.id == id; } );
+    CheckPanic( it != m_segments.end(), "Invalid staging allocation" );
+    return *it;
+}
+
+bool VlkStagingRing::Allocate( VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset )
+{
+    if( m_segments.empty() )
+    {
+        offset = 0;
+        return size <= m_size;
+    }
+
+    const auto tail = m_segments.front().begin;
+    const auto head = m_segments.back().end;
+    const auto start = ( head + alignment - 1 ) / alignment * alignment;
+
+    if( head > tail )
+    {
+        // Free space is at the end, and before the tail after wrapping around.
+        if( start + size <= m_size ) { offset = start; return true; }
+        if( size <= tail ) { offset = 0; return true; }
+        return false;
+    }
+
+    // Wrapped, free space is between head and tail.
+    if( start + size <= tail ) { offset = start; return true; }
+    return false;
+}
+
+void VlkStagingRing::Reclaim()
+{
+    while( !m_segments.empty() )
+    {
+        auto& front = m_segments.front();
+        if( !front.released ) break;
+        if( front.fence ? front.fence->Wait( 0 ) != VK_SUCCESS : front.timeline->Value() < front.value ) break;
+        m_segments.pop_front();
+    }
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+#include <vk_mem_alloc.h>
+
+#include "util/NoCopy.hpp"
+
+class VlkBuffer;
+class VlkFence;
+class VlkGarbage;
+class VlkTimelineSemaphore;
+
+// Persistently mapped host buffer, from which short lived staging regions are suballocated. Regions are handed
+// back together with the fence of the submission using them, and are reused once it is signaled. Requests that
+// don't fit get a dedicated buffer instead.
+class VlkStagingRing
+{
+public:
+    struct Allocation
+    {
+        std::shared_ptr<VlkBuffer> buffer;
+        VkDeviceSize offset;
+        VkDeviceSize size;
+        void* ptr;
+        uint64_t id;    // Zero for dedicated buffers
+
+        void Flush() const;
+        void Invalidate() const;
+        [[nodiscard]] bool IsHostCached() const;
+
+        operator VkBuffer() const;
+    };
+
+    VlkStagingRing( VmaAllocator allocator, std::shared_ptr<VlkGarbage> garbage, VkDeviceSize size );
+    ~VlkStagingRing();
+
+    NoCopy( VlkStagingRing );
+
+    [[nodiscard]] Allocation Acquire( VkDeviceSize size, VkDeviceSize alignment = 256 );
+    void Release( Allocation& alloc, std::shared_ptr<VlkFence> fence );
+    void Release( Allocation& alloc, std::shared_ptr<VlkTimelineSemaphore> timeline, uint64_t value );
+
+private:
+    struct Segment
+    {
+        uint64_t id;
+        VkDeviceSize begin;
+        VkDeviceSize end;
+        bool released;
+        std::shared_ptr<VlkFence> fence;                // Either fence or timeline is set on release
+        std::shared_ptr<VlkTimelineSemaphore> timeline;
+        uint64_t value;
+    };
+
+    Segment& Find( uint64_t id );
+    bool Allocate( VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset );
+    void Reclaim();
+
+    VmaAllocator m_allocator;
+    std::shared_ptr<VlkGarbage> m_garbage;
+    VkDeviceSize m_size;
+
+    std::mutex m_lock;
+    std::shared_ptr<VlkBuffer> m_buffer;
+    std::deque<Segment> m_segments;     // In allocation order
+    uint64_t m_nextId;
+};
@@ -1,6 +1,8 @@
 #include <algorithm>
 #include <array>
 #include <stdint.h>
+#include <string.h>
+#include <tracy/Tracy.hpp>
 #include <vector>
 #include <vulkan/vk_enum_string_helper.h>
 
@@ -27,7 +29,7 @@ static void PrintSwapchainProperties( const VlkSwapchainProperties &properties )
     }
 }
 
-VlkSwapchain::VlkSwapchain( const VlkDevice& device, VkSurfaceKHR surface, const VkExtent2D& extent, bool hdr, VkSwapchainKHR oldSwapchain )
+VlkSwapchain::VlkSwapchain( const VlkDevice& device, VkSurfaceKHR surface, const VkExtent2D& extent, bool hdr, VkPresentModeKHR presentMode, uint32_t imageCount, VkSwapchainKHR oldSwapchain )
     : m_properties( *device.GetPhysicalDevice(), surface )
     , m_presentMode( VK_PRESENT_MODE_FIFO_KHR )
     , m_device( device )
@@ -54,7 +56,20 @@ VlkSwapchain::VlkSwapchain( const VlkDevice& device, VkSurfaceKHR surface, const
 
     mclog( LogLevel::Info, "Swapchain extent: %ux%u", m_extent.width, m_extent.height );
 
-    auto imageCount = std::max( 2u, caps.minImageCount );
+    const auto& modes = m_properties.GetPresentModes();
+    if( std::ranges::find( modes, presentMode ) != modes.end() )
+    {
+        m_presentMode = presentMode;
+    }
+    else
+    {
+        mclog( LogLevel::Warning, "Present mode %s is not supported, using FIFO", string_VkPresentModeKHR( presentMode ) );
+    }
+    mclog( LogLevel::Info, "Swapchain present mode: %s", string_VkPresentModeKHR( m_presentMode ) );
+
+    // Mailbox needs a spare image to replace the queued one without blocking
+    if( imageCount == 0 ) imageCount = m_presentMode == VK_PRESENT_MODE_MAILBOX_KHR ? 3 : 2;
+    imageCount = std::max( imageCount, caps.minImageCount );
     if( caps.maxImageCount > 0 && imageCount > caps.maxImageCount ) imageCount = caps.maxImageCount;
 
     mclog( LogLevel::Info, "Swapchain image count: %u", imageCount );
@@ -113,6 +128,18 @@ VlkSwapchain::VlkSwapchain( const VlkDevice& device, VkSurfaceKHR surface, const
         viewCreateInfo.image = m_images[i];
         VkVerify( vkCreateImageView( device, &viewCreateInfo, nullptr, &m_imageViews[i] ) );
     }
+
+    if( device.UsePresentWait() )
+    {
+        m_waitForPresent = (PFN_vkWaitForPresentKHR)vkGetDeviceProcAddr( device, "vkWaitForPresentKHR" );
+        if( !m_waitForPresent ) mclog( LogLevel::Warning, "vkWaitForPresentKHR not available" );
+    }
+
+    if( device.UseHdrMetadata() && m_format.colorSpace == VK_COLOR_SPACE_HDR10_ST2084_EXT )
+    {
+        m_setHdrMetadata = (PFN_vkSetHdrMetadataEXT)vkGetDeviceProcAddr( device, "vkSetHdrMetadataEXT" );
+        if( !m_setHdrMetadata ) mclog( LogLevel::Warning, "vkSetHdrMetadataEXT not available" );
+    }
 }
 
 VlkSwapchain::~VlkSwapchain()
@@ -121,6 +148,46 @@ VlkSwapchain::~VlkSwapchain()
     for( auto& view : m_imageViews ) vkDestroyImageView( m_device, view, nullptr );
 }
 
+VkPresentModeKHR VlkSwapchain::ParsePresentMode( const char* mode )
+{
+    if( strcmp( mode, "mailbox" ) == 0 ) return VK_PRESENT_MODE_MAILBOX_KHR;
+    if( strcmp( mode, "relaxed" ) == 0 ) return VK_PRESENT_MODE_FIFO_RELAXED_KHR;
+    if( strcmp( mode, "immediate" ) == 0 ) return VK_PRESENT_MODE_IMMEDIATE_KHR;
+    if( strcmp( mode, "fifo" ) != 0 ) mclog( LogLevel::Warning, "Unknown present mode: %s", mode );
+    return VK_PRESENT_MODE_FIFO_KHR;
+}
+
+void VlkSwapchain::SetContentLight( float maxCll, float maxFall )
+{
+    if( !m_setHdrMetadata ) return;
+
+    const VkHdrMetadataEXT metadata = {
+        .sType = VK_STRUCTURE_TYPE_HDR_METADATA_EXT,
+        .displayPrimaryRed = { 0.708f, 0.292f },
+        .displayPrimaryGreen = { 0.170f, 0.797f },
+        .displayPrimaryBlue = { 0.131f, 0.046f },
+        .whitePoint = { 0.3127f, 0.3290f },
+        .maxLuminance = maxCll,
+        .minLuminance = 0.0001f,
+        .maxContentLightLevel = maxCll,
+        .maxFrameAverageLightLevel = maxFall
+    };
+    m_setHdrMetadata( m_device, 1, &m_swapchain, &metadata );
+}
+
+uint64_t VlkSwapchain::NextPresentId()
+{
+    return m_waitForPresent ? ++m_presentId : 0;
+}
+
+bool VlkSwapchain::WaitForPresent( uint64_t presentId, uint64_t timeout ) const
+{
+    ZoneScoped;
+    if( !m_waitForPresent || presentId == 0 ) return false;
+    const auto res = m_waitForPresent( m_device, m_swapchain, presentId, timeout );
+    return res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR;
+}
+
 void VlkSwapchain::PresentBarrier( VkCommandBuffer cmd, uint32_t imageIndex )
 {
     VkImageMemoryBarrier2 barrier = {
@@ -140,14 +207,14 @@ void VlkSwapchain::PresentBarrier( VkCommandBuffer cmd, uint32_t imageIndex )
     vkCmdPipelineBarrier2( cmd, &deps );
 }
 
-void VlkSwapchain::RenderBarrier( VkCommandBuffer cmd, uint32_t imageIndex )
+void VlkSwapchain::RenderBarrier( VkCommandBuffer cmd, uint32_t imageIndex, bool preserve )
 {
     VkImageMemoryBarrier2 barrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
         .srcStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
         .dstStageMask = VK_PIPELINE_STAGE_2_COLOR_ATTACHMENT_OUTPUT_BIT,
         .dstAccessMask = VK_ACCESS_2_COLOR_ATTACHMENT_WRITE_BIT,
-        .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+        .oldLayout = preserve ? VK_IMAGE_LAYOUT_PRESENT_SRC_KHR : VK_IMAGE_LAYOUT_UNDEFINED,
         .newLayout = VK_IMAGE_LAYOUT_ATTACHMENT_OPTIMAL,
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
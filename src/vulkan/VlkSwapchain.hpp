@@ -13,15 +13,34 @@ class VlkDevice;
 class VlkSwapchain : public VlkBase
 {
 public:
-    VlkSwapchain( const VlkDevice& device, VkSurfaceKHR surface, const VkExtent2D& extent, bool hdr, VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE );
+    // Falls back to FIFO if the present mode is not supported. An image count of zero picks the smallest one
+    // which works well with the present mode.
+    VlkSwapchain( const VlkDevice& device, VkSurfaceKHR surface, const VkExtent2D& extent, bool hdr, VkPresentModeKHR presentMode = VK_PRESENT_MODE_FIFO_KHR, uint32_t imageCount = 0, VkSwapchainKHR oldSwapchain = VK_NULL_HANDLE );
     ~VlkSwapchain();
 
     NoCopy( VlkSwapchain );
 
     void PresentBarrier( VkCommandBuffer cmd, uint32_t imageIndex );
-    void RenderBarrier( VkCommandBuffer cmd, uint32_t imageIndex );
+    void RenderBarrier( VkCommandBuffer cmd, uint32_t imageIndex, bool preserve = false );     // Keeps the contents of the last present
+
+    // Present ids are numbered from one with each swapchain. Zero if the device does not use present wait.
+    [[nodiscard]] uint64_t NextPresentId();
+
+    // Blocks until the present with the given id is visible, or the timeout (in nanoseconds) expires. Returns
+    // false on timeout, or if it can't be known, e.g. because the swapchain is out of date.
+    bool WaitForPresent( uint64_t presentId, uint64_t timeout ) const;
+
+    // Describes the content to the compositor, in nits, for it to map HDR output to the display. The mastering
+    // display is assumed to cover BT.2020 and the same peak. Ignored for SDR swapchains, or if the device can't
+    // pass metadata on.
+    void SetContentLight( float maxCll, float maxFall );
+
+    // Accepts "fifo", "relaxed", "mailbox" and "immediate". Anything else is FIFO. Immediate allows tearing, which
+    // the WSI tells the compositor with the tearing control protocol, where available.
+    [[nodiscard]] static VkPresentModeKHR ParsePresentMode( const char* mode );
 
     [[nodiscard]] VkFormat GetFormat() const { return m_format.format; }
+    [[nodiscard]] VkPresentModeKHR GetPresentMode() const { return m_presentMode; }
     [[nodiscard]] const VkExtent2D& GetExtent() const { return m_extent; }
     [[nodiscard]] const std::vector<VkImage>& GetImages() const { return m_images; }
     [[nodiscard]] const std::vector<VkImageView>& GetImageViews() const { return m_imageViews; }
@@ -38,6 +57,10 @@ private:
     VkDevice m_device;
     VkSwapchainKHR m_swapchain;
 
+    PFN_vkWaitForPresentKHR m_waitForPresent = nullptr;
+    PFN_vkSetHdrMetadataEXT m_setHdrMetadata = nullptr;
+    uint64_t m_presentId = 0;
+
     std::vector<VkImage> m_images;
     std::vector<VkImageView> m_imageViews;
 };
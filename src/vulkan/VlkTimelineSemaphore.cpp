@@ -0,0 +1,52 @@
+#include "VlkError.hpp"
+#include "VlkTimelineSemaphore.hpp"
+
+VlkTimelineSemaphore::VlkTimelineSemaphore( VkDevice device, uint64_t initialValue )
+    : m_device( device )
+{
+    const VkSemaphoreTypeCreateInfo typeInfo = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_TYPE_CREATE_INFO,
+        .semaphoreType = VK_SEMAPHORE_TYPE_TIMELINE,
+        .initialValue = initialValue
+    };
+    const VkSemaphoreCreateInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_CREATE_INFO,
+        .pNext = &typeInfo
+    };
+    VkVerify( vkCreateSemaphore( device, &info, nullptr, &m_semaphore ) );
+}
+
+VlkTimelineSemaphore::~VlkTimelineSemaphore()
+{
+    vkDestroySemaphore( m_device, m_semaphore, nullptr );
+}
+
+VkResult VlkTimelineSemaphore::Wait( uint64_t value, uint64_t timeout )
+{
+    const VkSemaphoreWaitInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .semaphoreCount = 1,
+        .pSemaphores = &m_semaphore,
+        .pValues = &value
+    };
+    return vkWaitSemaphores( m_device, &info, timeout );
+}
+
+uint64_t VlkTimelineSemaphore::Value() const
+{
+    uint64_t value;
+    VkVerify( vkGetSemaphoreCounterValue( m_device, m_semaphore, &value ) );
+    return value;
+}
+
+VkResult VlkTimelineSemaphore::WaitAny( VkDevice device, std::span<const VkSemaphore> semaphores, std::span<const uint64_t> values, uint64_t timeout )
+{
+    const VkSemaphoreWaitInfo info = {
+        .sType = VK_STRUCTURE_TYPE_SEMAPHORE_WAIT_INFO,
+        .flags = VK_SEMAPHORE_WAIT_ANY_BIT,
+        .semaphoreCount = (uint32_t)semaphores.size(),
+        .pSemaphores = semaphores.data(),
+        .pValues = values.data()
+    };
+    return vkWaitSemaphores( device, &info, timeout );
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <span>
+#include <stdint.h>
+#include <vulkan/vulkan.h>
+
+#include "VlkBase.hpp"
+#include "util/NoCopy.hpp"
+
+class VlkTimelineSemaphore : public VlkBase
+{
+public:
+    explicit VlkTimelineSemaphore( VkDevice device, uint64_t initialValue = 0 );
+    ~VlkTimelineSemaphore();
+
+    NoCopy( VlkTimelineSemaphore );
+
+    VkResult Wait( uint64_t value, uint64_t timeout = UINT64_MAX );
+    [[nodiscard]] uint64_t Value() const;
+
+    // Returns when any of the semaphores reaches its value. All semaphores must belong to the same device.
+    static VkResult WaitAny( VkDevice device, std::span<const VkSemaphore> semaphores, std::span<const uint64_t> values, uint64_t timeout );
+
+    [[nodiscard]] VkDevice Device() const { return m_device; }
+
+    operator VkSemaphore() const { return m_semaphore; }
+
+private:
+    VkSemaphore m_semaphore;
+    VkDevice m_device;
+};
@@ -1,20 +1,26 @@
 #include <algorithm>
 #include <cmath>
 #include <string.h>
+#include <type_traits>
+#include <utility>
 #include <vulkan/vulkan.h>
 #include <tracy/Tracy.hpp>
 #include <tracy/TracyVulkan.hpp>
 
 #include "Texture.hpp"
 #include "util/Bitmap.hpp"
+#include "util/BitmapHalve.hpp"
 #include "util/BitmapHdr.hpp"
 #include "util/BitmapHdrHalf.hpp"
 #include "util/Panic.hpp"
-#include "vulkan/VlkBuffer.hpp"
+#include "util/PixelPool.hpp"
 #include "vulkan/VlkCommandBuffer.hpp"
 #include "vulkan/VlkDevice.hpp"
 #include "vulkan/VlkFence.hpp"
+#include "vulkan/VlkFencePool.hpp"
 #include "vulkan/VlkGarbage.hpp"
+#include "vulkan/VlkStagingRing.hpp"
+#include "vulkan/VlkTimelineSemaphore.hpp"
 #include "vulkan/ext/Tracy.hpp"
 
 struct MipData
@@ -25,6 +31,26 @@ struct MipData
     uint64_t size;
 };
 
+struct Texture::StreamState
+{
+    std::vector<MipData> mipChain;
+    uint32_t bpp;
+    bool blitMips;
+    bool hostImageCopy;
+    bool started;
+};
+
+struct Texture::ResidencyState
+{
+    std::vector<MipData> mipChain;
+    VlkStagingRing::Allocation staging;
+    std::shared_ptr<VlkStagingRing> stagingRing;
+    std::shared_ptr<VlkFence> fence;    // Of the last level submitted, which signals after the earlier ones too
+};
+
+// Progressive uploads start with the levels up to this size, which take no time to land
+constexpr uint32_t CoarseSize = 256;
+
 static std::vector<MipData> CalcMipLevels( uint32_t width, uint32_t height, uint32_t bpp, uint64_t& total )
 {
     const auto mipLevels = (uint32_t)std::floor( std::log2( std::max( width, height ) ) ) + 1;
@@ -89,42 +115,174 @@ static inline VkImageViewCreateInfo GetImageViewCreateInfo( VkImage image, VkFor
     };
 }
 
-static inline VkBufferCreateInfo GetStagingBufferInfo( uint64_t size, VkBufferUsageFlags usage )
+static bool CanBlitMips( const VlkDevice& device, VkFormat format )
 {
-    return {
-        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
-        .size = size,
-        .usage = usage,
-        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
-    };
+    constexpr VkFormatFeatureFlags required = VK_FORMAT_FEATURE_BLIT_SRC_BIT | VK_FORMAT_FEATURE_BLIT_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties( device, format, &props );
+    return ( props.optimalTilingFeatures & required ) == required;
+}
+
+static uint32_t GetFormatBpp( VkFormat format )
+{
+    switch( format )
+    {
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+        return 4;
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+        return 8;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+        return 16;
+    default:
+        Panic( "Unsupported texture format %d.", format );
+    }
+}
+
+// Same pixel values as Bitmap::FillBlack() and BitmapHdrHalf::FillBlack(): black, with full opacity
+static void FillBlackPixels( void* dst, size_t count, VkFormat format )
+{
+    switch( format )
+    {
+    case VK_FORMAT_R8G8B8A8_SRGB:
+    case VK_FORMAT_R8G8B8A8_UNORM:
+        std::fill_n( (uint32_t*)dst, count, 0xff000000 );
+        break;
+    case VK_FORMAT_A2B10G10R10_UNORM_PACK32:
+        std::fill_n( (uint32_t*)dst, count, 0xc0000000 );     // PQ zero is black
+        break;
+    case VK_FORMAT_R16G16B16A16_SFLOAT:
+        std::fill_n( (uint64_t*)dst, count, 0x3c00000000000000 );
+        break;
+    case VK_FORMAT_R32G32B32A32_SFLOAT:
+    {
+        auto ptr = (float*)dst;
+        for( size_t i=0; i<count; i++ )
+        {
+            *ptr++ = 0;
+            *ptr++ = 0;
+            *ptr++ = 0;
+            *ptr++ = 1;
+        }
+        break;
+    }
+    default:
+        Panic( "Unsupported texture format %d.", format );
+    }
+}
+
+// Narrows the span [from, to) of one mip level to the part of the next level it affects, and widens it to all
+// the texels that part is filtered from. Halving levels map exactly. Odd sizes are scaled by a fraction, for
+// these the whole axis is blitted again.
+static void NextMipSpan( uint32_t srcSize, uint32_t dstSize, int32_t& from, int32_t& to, int32_t& dstFrom, int32_t& dstTo )
+{
+    if( srcSize == dstSize * 2 )
+    {
+        dstFrom = from / 2;
+        dstTo = ( to + 1 ) / 2;
+        from = dstFrom * 2;
+        to = dstTo * 2;
+    }
+    else
+    {
+        dstFrom = 0;
+        dstTo = int32_t( dstSize );
+        from = 0;
+        to = int32_t( srcSize );
+    }
+}
+
+static VkFormat GetCompressedFormat( BitmapCompressed::Format format )
+{
+    switch( format )
+    {
+    case BitmapCompressed::Format::Bc1: return VK_FORMAT_BC1_RGB_SRGB_BLOCK;
+    case BitmapCompressed::Format::Bc3: return VK_FORMAT_BC3_SRGB_BLOCK;
+    case BitmapCompressed::Format::Bc7: return VK_FORMAT_BC7_SRGB_BLOCK;
+    case BitmapCompressed::Format::Etc2Rgb: return VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK;
+    case BitmapCompressed::Format::Etc2Rgba: return VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK;
+    default: return VK_FORMAT_UNDEFINED;
+    }
 }
 
 template<typename T>
-static void FillStagingBuffer( const std::vector<MipData>& mipChain, std::unique_ptr<T>&& tmp, const T* bmpptr, const std::shared_ptr<VlkBuffer>& stagingBuffer, TaskDispatch* td )
+using PixelType = std::remove_cvref_t<decltype( *std::declval<const T&>().Data() )>;
+
+// Mip levels halve the previous one, which the box filter does exactly unless an odd dimension gets rounded down.
+template<typename T>
+static void Downscale( const MipData& src, const uint8_t* srcPtr, const MipData& dst, uint8_t* dstPtr, TaskDispatch* td )
+{
+    if( IsHalving( src.width, src.height, dst.width, dst.height ) )
+    {
+        T::Halve( (const PixelType<T>*)srcPtr, src.width, src.height, (PixelType<T>*)dstPtr, td );
+    }
+    else
+    {
+        T::Resample( (const PixelType<T>*)srcPtr, src.width, src.height, (PixelType<T>*)dstPtr, dst.width, dst.height, td );
+    }
+}
+
+template<typename T>
+static void FillStagingBuffer( const std::vector<MipData>& mipChain, std::unique_ptr<T>&& tmp, const T* bmpptr, const VlkStagingRing::Allocation& staging, TaskDispatch* td )
 {
     const auto mipLevels = (uint32_t)mipChain.size();
-    auto bufptr = (uint8_t*)stagingBuffer->Ptr();
+    auto bufptr = (uint8_t*)staging.ptr;
+
+    // Each mip level is built from the previous one right inside the staging buffer. This requires reading the
+    // buffer back, which is only viable if the memory is cached.
+    if( mipLevels > 1 && staging.IsHostCached() )
+    {
+        memcpy( bufptr, bmpptr->Data(), mipChain[0].size );
+        for( uint32_t level = 1; level < mipLevels; level++ )
+        {
+            ZoneScopedN( "Mip downscale" );
+            ZoneTextF( "Level %u, %u x %u, %u bytes", level - 1, mipChain[level].width, mipChain[level].height, mipChain[level].size );
+
+            const auto& src = mipChain[level-1];
+            const auto& dst = mipChain[level];
+            Downscale<T>( src, bufptr + src.offset, dst, bufptr + dst.offset, td );
+        }
+        staging.Flush();
+        return;
+    }
+
+    // Otherwise levels past the first one are built into a scratch buffer and copied to the staging buffer.
+    const auto scratchSize = mipChain.back().offset + mipChain.back().size - mipChain[0].size;
+    auto scratch = mipLevels > 1 ? (uint8_t*)PixelAlloc( scratchSize, MemoryStats::Pool::Scratch ) : nullptr;
+    auto ptr = (const uint8_t*)bmpptr->Data();
+
     for( uint32_t level = 0; level < mipLevels; level++ )
     {
         const MipData& mipdata = mipChain[level];
-        memcpy( bufptr, bmpptr->Data(), mipdata.size );
-        bufptr += mipdata.size;
+        memcpy( bufptr + mipdata.offset, ptr, mipdata.size );
         if( level < mipLevels-1 )
         {
             ZoneScopedN( "Mip downscale" );
             ZoneTextF( "Level %u, %u x %u, %u bytes", level, mipChain[level+1].width, mipChain[level+1].height, mipChain[level+1].size );
 
-            tmp = bmpptr->ResizeNew( mipChain[level+1].width, mipChain[level+1].height, td );
-            bmpptr = tmp.get();
+            const auto& next = mipChain[level+1];
+            auto dst = scratch + next.offset - mipChain[0].size;
+            Downscale<T>( mipdata, ptr, next, dst, td );
+            ptr = dst;
         }
     }
-    stagingBuffer->Flush();
+    staging.Flush();
+
+    PixelFree( scratch, scratchSize, MemoryStats::Pool::Scratch );
 }
 
 template<typename T>
 static void HostCopy( VlkDevice& device, VlkImage& image, const std::vector<MipData>& mipChain, std::unique_ptr<T>&& tmp, const T* bmpptr, TaskDispatch* td )
 {
     const auto mipLevels = (uint32_t)mipChain.size();
+
+    // Levels past the first one are built into a single scratch buffer, each one from the previous level.
+    const auto scratchSize = mipChain.back().offset + mipChain.back().size - mipChain[0].size;
+    auto scratch = mipLevels > 1 ? (uint8_t*)PixelAlloc( scratchSize, MemoryStats::Pool::Scratch ) : nullptr;
+    auto ptr = (const uint8_t*)bmpptr->Data();
+
     for( uint32_t level = 0; level < mipLevels; level++ )
     {
         const MipData& mipdata = mipChain[level];
@@ -140,7 +298,7 @@ static void HostCopy( VlkDevice& device, VlkImage& image, const std::vector<MipD
 
         VkMemoryToImageCopy region = {
             .sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY,
-            .pHostPointer = bmpptr->Data(),
+            .pHostPointer = ptr,
             .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 },
             .imageExtent = { mipdata.width, mipdata.height, 1 },
         };
@@ -162,15 +320,21 @@ static void HostCopy( VlkDevice& device, VlkImage& image, const std::vector<MipD
             ZoneScopedN( "Mip downscale" );
             ZoneTextF( "Level %u, %u x %u, %u bytes", level, mipChain[level+1].width, mipChain[level+1].height, mipChain[level+1].size );
 
-            tmp = bmpptr->ResizeNew( mipChain[level+1].width, mipChain[level+1].height, td );
-            bmpptr = tmp.get();
+            const auto& next = mipChain[level+1];
+            auto dst = scratch + next.offset - mipChain[0].size;
+            Downscale<T>( mipdata, ptr, next, dst, td );
+            ptr = dst;
         }
     }
+
+    PixelFree( scratch, scratchSize, MemoryStats::Pool::Scratch );
 }
 
-static void ReadbackBuffer( VlkDevice& device, uint32_t width, uint32_t height, VkBuffer buffer, VkImage image )
+static void ReadbackBuffer( VlkDevice& device, const VkRect2D& rect, void* dst, VkDeviceSize size, VkImage image )
 {
-    auto cmd = std::make_unique<VlkCommandBuffer>( *device.GetCommandPool( QueueType::Graphic ) );
+    auto staging = device.GetStagingRing()->Acquire( size );
+
+    auto cmd = std::make_unique<VlkCommandBuffer>( device.GetThreadCommandPool( QueueType::Graphic ) );
     cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
 
     // readback barrier
@@ -197,10 +361,12 @@ static void ReadbackBuffer( VlkDevice& device, uint32_t width, uint32_t height,
     }
 
     const VkBufferImageCopy region = {
+        .bufferOffset = staging.offset,
         .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
-        .imageExtent = { width, height, 1 }
+        .imageOffset = { rect.offset.x, rect.offset.y, 0 },
+        .imageExtent = { rect.extent.width, rect.extent.height, 1 }
     };
-    vkCmdCopyImageToBuffer( *cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region );
+    vkCmdCopyImageToBuffer( *cmd, image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, staging, 1, &region );
 
     // read barrier
     {
@@ -226,13 +392,17 @@ static void ReadbackBuffer( VlkDevice& device, uint32_t width, uint32_t height,
     }
     cmd->End();
 
-    auto fence = std::make_shared<VlkFence>( device );
+    auto fence = device.GetFencePool()->Acquire();
     device.Submit( *cmd, *fence );
     fence->Wait();
+
+    staging.Invalidate();
+    memcpy( dst, staging.ptr, size );
+    device.GetStagingRing()->Release( staging, std::move( fence ) );
 }
 
 template<typename T>
-static void ReadbackHost( VlkDevice& device, std::shared_ptr<T>& bitmap, VkImage image )
+static void ReadbackHost( VlkDevice& device, std::shared_ptr<T>& bitmap, const VkRect2D& rect, VkImage image )
 {
     VkHostImageLayoutTransitionInfo transition = {
         .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO,
@@ -247,7 +417,8 @@ static void ReadbackHost( VlkDevice& device, std::shared_ptr<T>& bitmap, VkImage
         .sType = VK_STRUCTURE_TYPE_IMAGE_TO_MEMORY_COPY,
         .pHostPointer = bitmap->Data(),
         .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
-        .imageExtent = { bitmap->Width(), bitmap->Height(), 1 }
+        .imageOffset = { rect.offset.x, rect.offset.y, 0 },
+        .imageExtent = { rect.extent.width, rect.extent.height, 1 }
     };
     VkCopyImageToMemoryInfo copy = {
         .sType = VK_STRUCTURE_TYPE_COPY_IMAGE_TO_MEMORY_INFO,
@@ -263,35 +434,45 @@ static void ReadbackHost( VlkDevice& device, std::shared_ptr<T>& bitmap, VkImage
     vkTransitionImageLayout( device, 1, &transition );
 }
 
-Texture::Texture( VlkDevice& device, const Bitmap& bitmap, VkFormat format, bool mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td )
+Texture::Texture( VlkDevice& device, const Bitmap& bitmap, VkFormat format, Mips mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td )
     : m_format( format )
     , m_width( bitmap.Width() )
     , m_height( bitmap.Height() )
 {
     ZoneScoped;
 
+    const auto blitMips = mips == Mips::Gpu && CanBlitMips( device, format );
     uint64_t bufsize;
-    const auto mipChain = GetMipChain( mips, bitmap.Width(), bitmap.Height(), 4, bufsize );
+    const auto mipChain = GetMipChain( mips != Mips::None, bitmap.Width(), bitmap.Height(), 4, bufsize );
     const auto mipLevels = (uint32_t)mipChain.size();
-    const auto hostImageCopy = device.UseHostImageCopy();
+    const auto hostImageCopy = device.UseHostImageCopy() && !blitMips;
+    m_mipLevels = mipLevels;
+    m_hostImageCopy = hostImageCopy;
 
     m_image = std::make_shared<VlkImage>( device, GetImageCreateInfo( format, bitmap.Width(), bitmap.Height(), mipLevels, hostImageCopy ) );
     m_imageView = std::make_unique<VlkImageView>( device, GetImageViewCreateInfo( *m_image, format, mipLevels ) );
 
-    if( hostImageCopy )
+    if( blitMips )
+    {
+        auto staging = device.GetStagingRing()->Acquire( mipChain[0].size );
+        memcpy( staging.ptr, bitmap.Data(), mipChain[0].size );
+        staging.Flush();
+        UploadBlitMips( device, mipChain, std::move( staging ), fencesOut );
+    }
+    else if( hostImageCopy )
     {
         HostCopy( device, *m_image, mipChain, std::unique_ptr<Bitmap>(), &bitmap, td );
     }
     else
     {
-        auto stagingBuffer = std::make_shared<VlkBuffer>( device, GetStagingBufferInfo( bufsize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT ), VlkBuffer::WillWrite | VlkBuffer::PreferHost );
+        auto staging = device.GetStagingRing()->Acquire( bufsize );
 
-        FillStagingBuffer( mipChain, std::unique_ptr<Bitmap>(), &bitmap, stagingBuffer, td );
-        Upload( device, mipChain, std::move( stagingBuffer ), fencesOut );
+        FillStagingBuffer( mipChain, std::unique_ptr<Bitmap>(), &bitmap, staging, td );
+        Upload( device, mipChain, std::move( staging ), fencesOut );
     }
 }
 
-Texture::Texture( VlkDevice& device, const BitmapHdr& bitmap, VkFormat format, bool mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td )
+Texture::Texture( VlkDevice& device, const BitmapHdr& bitmap, VkFormat format, Mips mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td )
     : m_format( format )
     , m_width( bitmap.Width() )
     , m_height( bitmap.Height() )
@@ -299,15 +480,33 @@ Texture::Texture( VlkDevice& device, const BitmapHdr& bitmap, VkFormat format, b
     ZoneScoped;
 
     const bool half = format == VK_FORMAT_R16G16B16A16_SFLOAT;
+    const auto blitMips = mips == Mips::Gpu && CanBlitMips( device, format );
     uint64_t bufsize;
-    const auto mipChain = GetMipChain( mips, bitmap.Width(), bitmap.Height(), half ? 8 : 16, bufsize );
+    const auto mipChain = GetMipChain( mips != Mips::None, bitmap.Width(), bitmap.Height(), half ? 8 : 16, bufsize );
     const auto mipLevels = (uint32_t)mipChain.size();
-    const auto hostImageCopy = device.UseHostImageCopy();
+    const auto hostImageCopy = device.UseHostImageCopy() && !blitMips;
+    m_mipLevels = mipLevels;
+    m_hostImageCopy = hostImageCopy;
 
     m_image = std::make_shared<VlkImage>( device, GetImageCreateInfo( format, bitmap.Width(), bitmap.Height(), mipLevels, hostImageCopy ) );
     m_imageView = std::make_unique<VlkImageView>( device, GetImageViewCreateInfo( *m_image, format, mipLevels ) );
 
-    if( hostImageCopy )
+    if( blitMips )
+    {
+        auto staging = device.GetStagingRing()->Acquire( mipChain[0].size );
+        if( half )
+        {
+            BitmapHdrHalf tmp( bitmap );
+            memcpy( staging.ptr, tmp.Data(), mipChain[0].size );
+        }
+        else
+        {
+            memcpy( staging.ptr, bitmap.Data(), mipChain[0].size );
+        }
+        staging.Flush();
+        UploadBlitMips( device, mipChain, std::move( staging ), fencesOut );
+    }
+    else if( hostImageCopy )
     {
         if( half )
         {
@@ -322,124 +521,847 @@ Texture::Texture( VlkDevice& device, const BitmapHdr& bitmap, VkFormat format, b
     }
     else
     {
-        auto stagingBuffer = std::make_shared<VlkBuffer>( device, GetStagingBufferInfo( bufsize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT ), VlkBuffer::WillWrite | VlkBuffer::PreferHost );
+        auto staging = device.GetStagingRing()->Acquire( bufsize );
 
         if( half )
         {
             auto tmp = std::make_unique<BitmapHdrHalf>( bitmap );
             auto bmpptr = tmp.get();
-            FillStagingBuffer( mipChain, std::move( tmp ), bmpptr, stagingBuffer, td );
+            FillStagingBuffer( mipChain, std::move( tmp ), bmpptr, staging, td );
+        }
+        else
+        {
+            FillStagingBuffer( mipChain, std::unique_ptr<BitmapHdr>(), &bitmap, staging, td );
+        }
+
+        Upload( device, mipChain, std::move( staging ), fencesOut );
+    }
+}
+
+Texture::Texture( VlkDevice& device, const BitmapHdrHalf& bitmap, VkFormat format, Mips mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td )
+    : m_format( format )
+    , m_width( bitmap.Width() )
+    , m_height( bitmap.Height() )
+{
+    ZoneScoped;
+    const bool packed = format == VK_FORMAT_A2B10G10R10_UNORM_PACK32;
+    CheckPanic( packed || format == VK_FORMAT_R16G16B16A16_SFLOAT, "Half float bitmap requires a half float or packed PQ texture format" );
+
+    // Packed pixels are PQ encoded into the staging buffer. Mips are only blitted from there, as the Cpu filters
+    // work on linear values.
+    const auto blitMips = mips == Mips::Gpu && CanBlitMips( device, format );
+    uint64_t bufsize;
+    const auto mipChain = GetMipChain( packed ? blitMips : mips != Mips::None, bitmap.Width(), bitmap.Height(), packed ? 4 : 8, bufsize );
+    const auto mipLevels = (uint32_t)mipChain.size();
+    const auto hostImageCopy = device.UseHostImageCopy() && !blitMips && !packed;
+    m_mipLevels = mipLevels;
+    m_hostImageCopy = hostImageCopy;
+
+    m_image = std::make_shared<VlkImage>( device, GetImageCreateInfo( format, bitmap.Width(), bitmap.Height(), mipLevels, hostImageCopy ) );
+    m_imageView = std::make_unique<VlkImageView>( device, GetImageViewCreateInfo( *m_image, format, mipLevels ) );
+
+    if( packed )
+    {
+        auto staging = device.GetStagingRing()->Acquire( mipChain[0].size );
+        BitmapHdrHalf::EncodePq( bitmap.Data(), (uint32_t*)staging.ptr, size_t( bitmap.Width() ) * bitmap.Height(), td );
+        staging.Flush();
+        if( blitMips )
+        {
+            UploadBlitMips( device, mipChain, std::move( staging ), fencesOut );
         }
         else
         {
-            FillStagingBuffer( mipChain, std::unique_ptr<BitmapHdr>(), &bitmap, stagingBuffer, td );
+            Upload( device, mipChain, std::move( staging ), fencesOut );
+        }
+    }
+    else if( blitMips )
+    {
+        auto staging = device.GetStagingRing()->Acquire( mipChain[0].size );
+        memcpy( staging.ptr, bitmap.Data(), mipChain[0].size );
+        staging.Flush();
+        UploadBlitMips( device, mipChain, std::move( staging ), fencesOut );
+    }
+    else if( hostImageCopy )
+    {
+        HostCopy( device, *m_image, mipChain, std::unique_ptr<BitmapHdrHalf>(), &bitmap, td );
+    }
+    else
+    {
+        auto staging = device.GetStagingRing()->Acquire( bufsize );
+
+        FillStagingBuffer( mipChain, std::unique_ptr<BitmapHdrHalf>(), &bitmap, staging, td );
+        Upload( device, mipChain, std::move( staging ), fencesOut );
+    }
+}
+
+// Gpu mips fall back to no mips at all if the format can't be blitted, as there is no full image to build Cpu mips from.
+Texture::Texture( VlkDevice& device, uint32_t width, uint32_t height, VkFormat format, Mips mips )
+    : m_format( format )
+    , m_width( width )
+    , m_height( height )
+    , m_stream( std::make_unique<StreamState>() )
+{
+    ZoneScoped;
+    CheckPanic( mips != Mips::Cpu, "Streaming textures can't have Cpu mips." );
+
+    uint64_t bufsize;
+    m_stream->bpp = GetFormatBpp( format );
+    m_stream->blitMips = mips == Mips::Gpu && CanBlitMips( device, format );
+    m_stream->hostImageCopy = device.UseHostImageCopy() && !m_stream->blitMips;
+    m_stream->started = false;
+    m_stream->mipChain = GetMipChain( m_stream->blitMips, width, height, m_stream->bpp, bufsize );
+    const auto mipLevels = (uint32_t)m_stream->mipChain.size();
+    m_mipLevels = mipLevels;
+    m_hostImageCopy = m_stream->hostImageCopy;
+
+    m_image = std::make_shared<VlkImage>( device, GetImageCreateInfo( format, width, height, mipLevels, m_stream->hostImageCopy ) );
+    m_imageView = std::make_unique<VlkImageView>( device, GetImageViewCreateInfo( *m_image, format, mipLevels ) );
+}
+
+// Gpu mips fall back to no mips at all if the format can't be blitted, as Cpu mips would need the image on the CPU.
+Texture::Texture( VlkDevice& device, uint32_t width, uint32_t height, VkFormat format, Mips mips, const std::function<void( VkCommandBuffer, VkImageView )>& record, std::vector<std::shared_ptr<VlkFence>>& fencesOut )
+    : m_format( format )
+    , m_width( width )
+    , m_height( height )
+{
+    ZoneScoped;
+    CheckPanic( format == VK_FORMAT_R8G8B8A8_SRGB || format == VK_FORMAT_R8G8B8A8_UNORM, "Unsupported texture format for GPU writes." );
+    CheckPanic( mips != Mips::Cpu, "Textures written on the GPU can't have Cpu mips." );
+
+    uint64_t bufsize;
+    const auto mipChain = GetMipChain( mips == Mips::Gpu && CanBlitMips( device, format ), width, height, 4, bufsize );
+    m_mipLevels = (uint32_t)mipChain.size();
+
+    // sRGB formats can't be storage images. The image is written through a UNORM view, and the storage usage is
+    // left out of the sampled view.
+    auto imageInfo = GetImageCreateInfo( format, width, height, m_mipLevels, false );
+    imageInfo.flags = VK_IMAGE_CREATE_MUTABLE_FORMAT_BIT | VK_IMAGE_CREATE_EXTENDED_USAGE_BIT;
+    imageInfo.usage |= VK_IMAGE_USAGE_STORAGE_BIT;
+    m_image = std::make_shared<VlkImage>( device, imageInfo );
+
+    const VkImageViewUsageCreateInfo sampledUsage = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO,
+        .usage = VK_IMAGE_USAGE_SAMPLED_BIT
+    };
+    auto viewInfo = GetImageViewCreateInfo( *m_image, format, m_mipLevels );
+    viewInfo.pNext = &sampledUsage;
+    m_imageView = std::make_unique<VlkImageView>( device, viewInfo );
+
+    const VkImageViewUsageCreateInfo storageUsage = {
+        .sType = VK_STRUCTURE_TYPE_IMAGE_VIEW_USAGE_CREATE_INFO,
+        .usage = VK_IMAGE_USAGE_STORAGE_BIT
+    };
+    viewInfo = GetImageViewCreateInfo( *m_image, VK_FORMAT_R8G8B8A8_UNORM, 1 );
+    viewInfo.pNext = &storageUsage;
+    auto storageView = std::make_shared<VlkImageView>( device, viewInfo );
+
+    auto cmd = std::make_unique<VlkCommandBuffer>( device.GetThreadCommandPool( QueueType::Graphic ) );
+    cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+    {
+        ZoneVk( device, *cmd, "Texture write", true );
+        for( uint32_t level = 1; level < m_mipLevels; level++ ) WriteBarrier( *cmd, level );
+
+        VkImageMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .dstStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT,
+            .dstAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = *m_image,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+        };
+        const VkDependencyInfo deps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &barrier
+        };
+        vkCmdPipelineBarrier2( *cmd, &deps );
+
+        record( *cmd, *storageView );
+
+        // BlitMips() expects the first level as if it was uploaded
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_COMPUTE_SHADER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_SHADER_STORAGE_WRITE_BIT;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT | VK_ACCESS_2_TRANSFER_WRITE_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_GENERAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        vkCmdPipelineBarrier2( *cmd, &deps );
+    }
+
+    BlitMips( device, *cmd, mipChain );
+    cmd->End();
+
+    auto fence = device.GetFencePool()->Acquire();
+    m_readyQueue = QueueType::Graphic;
+    m_readyValue = device.Submit( *cmd, *fence );
+    device.GetGarbage()->Recycle( fence, {
+        std::move( cmd ),
+        std::move( storageView ),
+        m_image
+    } );
+    fencesOut.emplace_back( std::move( fence ) );
+}
+
+Texture::Texture( VlkDevice& device, const Texture& source, const VkRect2D& region, std::vector<std::shared_ptr<VlkFence>>& fencesOut )
+    : m_format( source.m_format )
+    , m_width( region.extent.width )
+    , m_height( region.extent.height )
+{
+    ZoneScoped;
+    CheckPanic( source.CanEdit( device ), "Source texture can't be copied on the GPU." );
+    CheckPanic( source.IsInside( region ), "Copy region out of bounds." );
+
+    m_image = std::make_shared<VlkImage>( device, GetImageCreateInfo( m_format, m_width, m_height, 1, false ) );
+    m_imageView = std::make_unique<VlkImageView>( device, GetImageViewCreateInfo( *m_image, m_format, 1 ) );
+
+    auto cmd = std::make_unique<VlkCommandBuffer>( device.GetThreadCommandPool( QueueType::Graphic ) );
+    cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+    {
+        ZoneVk( device, *cmd, "Texture copy", true );
+        WriteBarrier( *cmd, 0 );
+
+        VkImageMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = *source.m_image,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1 }
+        };
+        const VkDependencyInfo deps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &barrier
+        };
+        vkCmdPipelineBarrier2( *cmd, &deps );
+
+        const VkImageCopy copy = {
+            .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .srcOffset = { region.offset.x, region.offset.y, 0 },
+            .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .extent = { m_width, m_height, 1 }
+        };
+        vkCmdCopyImage( *cmd, *source.m_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, *m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &copy );
+
+        barrier.srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT;
+        barrier.srcAccessMask = VK_ACCESS_2_NONE;
+        barrier.dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT;
+        barrier.dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT;
+        barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+        barrier.newLayout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL;
+        vkCmdPipelineBarrier2( *cmd, &deps );
+
+        ReadBarrier( *cmd, 0, 1 );
+    }
+    cmd->End();
+
+    auto fence = device.GetFencePool()->Acquire();
+    m_readyQueue = QueueType::Graphic;
+    m_readyValue = device.Submit( *cmd, *fence );
+    device.GetGarbage()->Recycle( fence, {
+        std::move( cmd ),
+        m_image,
+        source.m_image
+    } );
+    fencesOut.emplace_back( std::move( fence ) );
+}
+
+Texture::~Texture()
+{
+    // The staging buffer of an unfinished progressive upload may still be read by the last level submitted
+    if( m_residency ) m_residency->stagingRing->Release( m_residency->staging, std::move( m_residency->fence ) );
+}
+
+void Texture::WriteRows( VlkDevice& device, const void* data, uint32_t y, uint32_t rows )
+{
+    ZoneScoped;
+    ZoneTextF( "Rows %u - %u", y, y + rows );
+    CheckPanic( m_stream, "Texture is not streaming." );
+    CheckPanic( y + rows <= m_height, "Rows out of bounds." );
+
+    const auto mipLevels = (uint32_t)m_stream->mipChain.size();
+    const auto first = !m_stream->started;
+    m_stream->started = true;
+
+    if( m_stream->hostImageCopy )
+    {
+        if( first )
+        {
+            const VkHostImageLayoutTransitionInfo transition = {
+                .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO,
+                .image = *m_image,
+                .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+                .newLayout = VK_IMAGE_LAYOUT_GENERAL,
+                .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 }
+            };
+            vkTransitionImageLayout( device, 1, &transition );
+        }
+
+        const VkMemoryToImageCopy region = {
+            .sType = VK_STRUCTURE_TYPE_MEMORY_TO_IMAGE_COPY,
+            .pHostPointer = data,
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .imageOffset = { 0, int32_t( y ), 0 },
+            .imageExtent = { m_width, rows, 1 },
+        };
+        const VkCopyMemoryToImageInfo copy = {
+            .sType = VK_STRUCTURE_TYPE_COPY_MEMORY_TO_IMAGE_INFO,
+            .dstImage = *m_image,
+            .dstImageLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .regionCount = 1,
+            .pRegions = &region
+        };
+        vkCopyMemoryToImage( device, &copy );
+        return;
+    }
+
+    const auto size = uint64_t( m_width ) * rows * m_stream->bpp;
+    auto staging = device.GetStagingRing()->Acquire( size );
+    memcpy( staging.ptr, data, size );
+    staging.Flush();
+
+    // Bands are submitted in order to a single queue, so the initial layout transition is seen by all of them.
+    // Blits need the graphics queue, which is then used for everything.
+    const auto queue = m_stream->blitMips ? QueueType::Graphic : QueueType::Transfer;
+    auto cmd = std::make_unique<VlkCommandBuffer>( device.GetThreadCommandPool( queue ) );
+    cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+    {
+        ZoneVk( device, *cmd, "Texture band upload", true );
+        if( first )
+        {
+            for( uint32_t level = 0; level < mipLevels; level++ ) WriteBarrier( *cmd, level );
         }
+        const VkBufferImageCopy region = {
+            .bufferOffset = staging.offset,
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .imageOffset = { 0, int32_t( y ), 0 },
+            .imageExtent = { m_width, rows, 1 }
+        };
+        vkCmdCopyBufferToImage( *cmd, staging, *m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region );
+    }
+    cmd->End();
+
+    // Nobody waits for individual bands, so they are tracked on the queue timeline instead of with fences.
+    const auto value = device.Submit( *cmd, VK_NULL_HANDLE );
+    auto& timeline = device.GetTimeline( queue );
+    device.GetStagingRing()->Release( staging, timeline, value );
+    device.GetGarbage()->Recycle( timeline, value, {
+        std::move( cmd ),
+        m_image
+    } );
+}
+
+void Texture::Finish( VlkDevice& device, std::vector<std::shared_ptr<VlkFence>>& fencesOut )
+{
+    ZoneScoped;
+    CheckPanic( m_stream, "Texture is not streaming." );
+    CheckPanic( m_stream->started, "No rows were written." );
+
+    const auto mipLevels = (uint32_t)m_stream->mipChain.size();
+
+    if( m_stream->hostImageCopy )
+    {
+        const VkHostImageLayoutTransitionInfo transition = {
+            .sType = VK_STRUCTURE_TYPE_HOST_IMAGE_LAYOUT_TRANSITION_INFO,
+            .image = *m_image,
+            .oldLayout = VK_IMAGE_LAYOUT_GENERAL,
+            .newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 }
+        };
+        vkTransitionImageLayout( device, 1, &transition );
+    }
+    else if( m_stream->blitMips )
+    {
+        auto cmd = std::make_unique<VlkCommandBuffer>( device.GetThreadCommandPool( QueueType::Graphic ) );
+        cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+        BlitMips( device, *cmd, m_stream->mipChain );
+        cmd->End();
+
+        auto fence = device.GetFencePool()->Acquire();
+        m_readyQueue = QueueType::Graphic;
+        m_readyValue = device.Submit( *cmd, *fence );
+        device.GetGarbage()->Recycle( fence, {
+            std::move( cmd ),
+            m_image
+        } );
+        fencesOut.emplace_back( std::move( fence ) );
+    }
+    else
+    {
+        auto cmdTx = std::make_unique<VlkCommandBuffer>( device.GetThreadCommandPool( QueueType::Transfer ) );
+        cmdTx->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+        SubmitTransfer( device, std::move( cmdTx ), 0, mipLevels, fencesOut );
+    }
+
+    m_stream.reset();
+}
+
+bool Texture::CanEdit( const VlkDevice& device ) const
+{
+    return !m_hostImageCopy && !m_stream && !IsCompressed() && ( m_mipLevels == 1 || CanBlitMips( device, m_format ) );
+}
+
+void Texture::FillBlack( VlkDevice& device, const VkRect2D& region, std::vector<std::shared_ptr<VlkFence>>& fencesOut )
+{
+    ZoneScoped;
+    CheckPanic( CanEdit( device ), "Texture can't be edited on the GPU." );
+    CheckPanic( IsInside( region ), "Fill region out of bounds." );
+
+    // All rows are copied from one band of black pixels, which keeps the staging allocation small for large regions
+    constexpr uint64_t BandSize = 1024 * 1024;
+    const auto bpp = GetFormatBpp( m_format );
+    const auto rowSize = uint64_t( region.extent.width ) * bpp;
+    const auto bandRows = (uint32_t)std::clamp<uint64_t>( BandSize / rowSize, 1, region.extent.height );
+
+    auto staging = device.GetStagingRing()->Acquire( rowSize * bandRows );
+    FillBlackPixels( staging.ptr, size_t( region.extent.width ) * bandRows, m_format );
+    staging.Flush();
+
+    std::vector<VkBufferImageCopy> bands;
+    for( uint32_t y = 0; y < region.extent.height; y += bandRows )
+    {
+        bands.emplace_back( VkBufferImageCopy {
+            .bufferOffset = staging.offset,
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .imageOffset = { region.offset.x, region.offset.y + int32_t( y ), 0 },
+            .imageExtent = { region.extent.width, std::min( bandRows, region.extent.height - y ), 1 }
+        } );
+    }
+
+    auto cmd = std::make_unique<VlkCommandBuffer>( device.GetThreadCommandPool( QueueType::Graphic ) );
+    cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+    {
+        ZoneVk( device, *cmd, "Texture fill", true );
+
+        // The contents are kept, unlike in WriteBarrier()
+        const VkImageMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = *m_image,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, m_mipLevels, 0, 1 }
+        };
+        const VkDependencyInfo deps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &barrier
+        };
+        vkCmdPipelineBarrier2( *cmd, &deps );
+
+        vkCmdCopyBufferToImage( *cmd, staging, *m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, (uint32_t)bands.size(), bands.data() );
+    }
+
+    uint64_t bufsize;
+    const auto mipChain = GetMipChain( m_mipLevels > 1, m_width, m_height, bpp, bufsize );
+    BlitMips( device, *cmd, mipChain, &region );
+    cmd->End();
+
+    auto fence = device.GetFencePool()->Acquire();
+    m_readyQueue = QueueType::Graphic;
+    m_readyValue = device.Submit( *cmd, *fence );
+    device.GetStagingRing()->Release( staging, fence );
+    device.GetGarbage()->Recycle( fence, {
+        std::move( cmd ),
+        m_image
+    } );
+    fencesOut.emplace_back( std::move( fence ) );
+}
+
+Texture::Texture( VlkDevice& device, const BitmapCompressed& bitmap, std::vector<std::shared_ptr<VlkFence>>& fencesOut, bool progressive )
+    : m_format( GetCompressedFormat( bitmap.GetFormat() ) )
+    , m_width( bitmap.Width() )
+    , m_height( bitmap.Height() )
+{
+    ZoneScoped;
+    CheckPanic( m_format != VK_FORMAT_UNDEFINED, "Invalid compressed format." );
+
+    std::vector<MipData> mipChain;
+    mipChain.reserve( bitmap.Levels().size() );
+    for( auto& level : bitmap.Levels() ) mipChain.emplace_back( level.width, level.height, level.offset, level.size );
+    const auto mipLevels = (uint32_t)mipChain.size();
+    m_mipLevels = mipLevels;
+
+    m_image = std::make_shared<VlkImage>( device, GetImageCreateInfo( m_format, m_width, m_height, mipLevels, false ) );
+    m_imageView = std::make_unique<VlkImageView>( device, GetImageViewCreateInfo( *m_image, m_format, mipLevels ) );
+
+    auto staging = device.GetStagingRing()->Acquire( bitmap.Size() );
+    memcpy( staging.ptr, bitmap.Data(), bitmap.Size() );
+    staging.Flush();
+    Upload( device, mipChain, std::move( staging ), fencesOut, progressive );
+}
+
+bool Texture::CanUpload( VkPhysicalDevice physDev, BitmapCompressed::Format compressed )
+{
+    const auto format = GetCompressedFormat( compressed );
+    if( format == VK_FORMAT_UNDEFINED ) return false;
+
+    constexpr VkFormatFeatureFlags required = VK_FORMAT_FEATURE_SAMPLED_IMAGE_BIT | VK_FORMAT_FEATURE_TRANSFER_DST_BIT | VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT;
+
+    VkFormatProperties props;
+    vkGetPhysicalDeviceFormatProperties( physDev, format, &props );
+    return ( props.optimalTilingFeatures & required ) == required;
+}
+
+bool Texture::Stream( VlkDevice& device )
+{
+    if( !m_residency ) return false;
+    if( !IsDrawable( device ) ) return true;
+
+    ZoneScoped;
+    ZoneTextF( "Level %u", m_residentLevel - 1 );
+
+    // Draws from here on are ordered after the upload, which is kept to a single level so that they aren't held up long
+    std::vector<std::shared_ptr<VlkFence>> fences;
+    m_residentLevel--;
+    m_residency->fence = UploadLevels( device, m_residency->mipChain, m_residency->staging, m_residentLevel, 1, fences );
+    if( m_residentLevel == 0 )
+    {
+        m_residency->stagingRing->Release( m_residency->staging, std::move( m_residency->fence ) );
+        m_residency.reset();
+    }
+    return true;
+}
 
-        Upload( device, mipChain, std::move( stagingBuffer ), fencesOut );
+bool Texture::IsReady( const VlkDevice& device ) const
+{
+    return !m_residency && IsDrawable( device );
+}
+
+bool Texture::IsDrawable( const VlkDevice& device ) const
+{
+    return m_readyValue == 0 || device.GetTimeline( m_readyQueue )->Value() >= m_readyValue;
+}
+
+bool Texture::IsCompressed() const
+{
+    switch( m_format )
+    {
+    case VK_FORMAT_BC1_RGB_SRGB_BLOCK:
+    case VK_FORMAT_BC3_SRGB_BLOCK:
+    case VK_FORMAT_BC7_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8_SRGB_BLOCK:
+    case VK_FORMAT_ETC2_R8G8B8A8_SRGB_BLOCK:
+        return true;
+    default:
+        return false;
     }
 }
 
 std::shared_ptr<Bitmap> Texture::ReadbackSdr( VlkDevice& device ) const
+{
+    return ReadbackSdr( device, { {}, { m_width, m_height } } );
+}
+
+std::shared_ptr<Bitmap> Texture::ReadbackSdr( VlkDevice& device, const VkRect2D& region ) const
 {
     ZoneScoped;
     CheckPanic( m_format == VK_FORMAT_R8G8B8A8_SRGB, "Texture format must be VK_FORMAT_R8G8B8A8_SRGB." );
+    CheckPanic( IsInside( region ), "Readback region out of bounds." );
 
-    const auto bufSize = m_width * m_height * 4;
-    const auto hostImageCopy = device.UseHostImageCopy();
-
-    auto ret = std::make_shared<Bitmap>( m_width, m_height );
-    if( hostImageCopy )
+    const auto bufSize = size_t( region.extent.width ) * region.extent.height * 4;
+    auto ret = std::make_shared<Bitmap>( region.extent.width, region.extent.height );
+    if( m_hostImageCopy )
     {
-        ReadbackHost( device, ret, *m_image );
+        ReadbackHost( device, ret, region, *m_image );
     }
     else
     {
-        auto staging = std::make_shared<VlkBuffer>( device, GetStagingBufferInfo( bufSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT ), VlkBuffer::WillRead | VlkBuffer::PreferHost );
-        ReadbackBuffer( device, m_width, m_height, *staging, *m_image );
-        memcpy( ret->Data(), staging->Ptr(), bufSize );
+        ReadbackBuffer( device, region, ret->Data(), bufSize, *m_image );
     }
     return ret;
 }
 
 std::shared_ptr<BitmapHdrHalf> Texture::ReadbackHdr( VlkDevice& device ) const
 {
-    ZoneScoped;
-    CheckPanic( m_format == VK_FORMAT_R16G16B16A16_SFLOAT, "Texture format must be VK_FORMAT_R16G16B16A16_SFLOAT." );
+    return ReadbackHdr( device, { {}, { m_width, m_height } } );
+}
 
-    const auto bufSize = m_width * m_height * 8;
-    const auto hostImageCopy = device.UseHostImageCopy();
+std::shared_ptr<BitmapHdrHalf> Texture::ReadbackHdr( VlkDevice& device, const VkRect2D& region ) const
+{
+    ZoneScoped;
+    CheckPanic( m_format == VK_FORMAT_R16G16B16A16_SFLOAT || m_format == VK_FORMAT_A2B10G10R10_UNORM_PACK32, "Texture format must be VK_FORMAT_R16G16B16A16_SFLOAT or VK_FORMAT_A2B10G10R10_UNORM_PACK32." );
+    CheckPanic( IsInside( region ), "Readback region out of bounds." );
 
-    auto ret = std::make_shared<BitmapHdrHalf>( m_width, m_height, Colorspace::BT2020 );
-    if( hostImageCopy )
+    const auto bufSize = size_t( region.extent.width ) * region.extent.height * 8;
+    auto ret = std::make_shared<BitmapHdrHalf>( region.extent.width, region.extent.height, Colorspace::BT2020 );
+    if( m_format == VK_FORMAT_A2B10G10R10_UNORM_PACK32 )
     {
-        ReadbackHost( device, ret, *m_image );
+        // Packed textures are never host copied
+        const auto count = size_t( region.extent.width ) * region.extent.height;
+        auto tmp = PixelAlloc<uint32_t>( count, MemoryStats::Pool::Scratch );
+        ReadbackBuffer( device, region, tmp, count * 4, *m_image );
+        BitmapHdrHalf::DecodePq( tmp, ret->Data(), count );
+        PixelFree( tmp, count, MemoryStats::Pool::Scratch );
+    }
+    else if( m_hostImageCopy )
+    {
+        ReadbackHost( device, ret, region, *m_image );
     }
     else
     {
-        auto staging = std::make_shared<VlkBuffer>( device, GetStagingBufferInfo( bufSize, VK_BUFFER_USAGE_TRANSFER_DST_BIT ), VlkBuffer::WillRead | VlkBuffer::PreferHost );
-        ReadbackBuffer( device, m_width, m_height, *staging, *m_image );
-        memcpy( ret->Data(), staging->Ptr(), bufSize );
+        ReadbackBuffer( device, region, ret->Data(), bufSize, *m_image );
     }
     return ret;
 }
 
-void Texture::Upload( VlkDevice& device, const std::vector<MipData>& mipChain, std::shared_ptr<VlkBuffer>&& stagingBuffer, std::vector<std::shared_ptr<VlkFence>>& fencesOut )
+bool Texture::IsInside( const VkRect2D& region ) const
+{
+    return region.offset.x >= 0 && region.offset.y >= 0 &&
+        region.extent.width > 0 && region.extent.height > 0 &&
+        uint32_t( region.offset.x ) + region.extent.width <= m_width &&
+        uint32_t( region.offset.y ) + region.extent.height <= m_height;
+}
+
+void Texture::Upload( VlkDevice& device, const std::vector<MipData>& mipChain, VlkStagingRing::Allocation&& staging, std::vector<std::shared_ptr<VlkFence>>& fencesOut, bool progressive )
 {
     const auto mipLevels = (uint32_t)mipChain.size();
 
-    auto cmdTx = std::make_unique<VlkCommandBuffer>( *device.GetCommandPool( QueueType::Transfer ) );
+    uint32_t base = 0;
+    if( progressive ) while( base < mipLevels - 1 && std::max( mipChain[base].width, mipChain[base].height ) > CoarseSize ) base++;
+
+    auto fence = UploadLevels( device, mipChain, staging, base, mipLevels - base, fencesOut );
+    if( base == 0 )
+    {
+        device.GetStagingRing()->Release( staging, std::move( fence ) );
+        return;
+    }
+
+    m_residentLevel = base;
+    m_residency = std::make_unique<ResidencyState>( mipChain, std::move( staging ), device.GetStagingRing(), std::move( fence ) );
+}
+
+std::shared_ptr<VlkFence> Texture::UploadLevels( VlkDevice& device, const std::vector<MipData>& mipChain, const VlkStagingRing::Allocation& staging, uint32_t base, uint32_t count, std::vector<std::shared_ptr<VlkFence>>& fencesOut )
+{
+    auto cmdTx = std::make_unique<VlkCommandBuffer>( device.GetThreadCommandPool( QueueType::Transfer ) );
     cmdTx->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
 
-    for( uint32_t level = 0; level < mipLevels; level++ )
+    for( uint32_t level = base; level < base + count; level++ )
     {
         ZoneVk( device, *cmdTx, "Texture upload", true );
         WriteBarrier( *cmdTx, level );
         const MipData& mipdata = mipChain[level];
         const VkBufferImageCopy region = {
-            .bufferOffset = mipdata.offset,
+            .bufferOffset = staging.offset + mipdata.offset,
             .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 },
             .imageExtent = { mipdata.width, mipdata.height, 1 }
         };
-        vkCmdCopyBufferToImage( *cmdTx, *stagingBuffer, *m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region );
+        vkCmdCopyBufferToImage( *cmdTx, staging, *m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region );
     }
 
+    // With the coarse levels of a progressive upload, the finer ones are put in the read layout without contents,
+    // so that all levels match the descriptors the texture is drawn with. Each is written anew from undefined.
+    if( base > 0 && base + count == mipChain.size() )
+    {
+        const VkImageMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .oldLayout = VK_IMAGE_LAYOUT_UNDEFINED,
+            .newLayout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = *m_image,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, base, 0, 1 }
+        };
+        const VkDependencyInfo deps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &barrier
+        };
+        vkCmdPipelineBarrier2( *cmdTx, &deps );
+    }
+
+    return SubmitTransfer( device, std::move( cmdTx ), base, count, fencesOut );
+}
+
+std::shared_ptr<VlkFence> Texture::SubmitTransfer( VlkDevice& device, std::unique_ptr<VlkCommandBuffer>&& cmdTx, uint32_t baseLevel, uint32_t levelCount, std::vector<std::shared_ptr<VlkFence>>& fencesOut )
+{
     const auto shareQueue = device.GetQueueInfo( QueueType::Graphic ).shareTransfer;
     const auto txQueue = device.GetQueueInfo( QueueType::Transfer ).idx;
     const auto gfxQueue = device.GetQueueInfo( QueueType::Graphic ).idx;
     if( shareQueue )
     {
-        ReadBarrier( *cmdTx, mipLevels );
+        ReadBarrier( *cmdTx, baseLevel, levelCount );
     }
     else
     {
-        ReadBarrierTx( *cmdTx, mipLevels, txQueue, gfxQueue );
+        ReadBarrierTx( *cmdTx, baseLevel, levelCount, txQueue, gfxQueue );
     }
     cmdTx->End();
 
-    auto fenceTrn = std::make_shared<VlkFence>( device );
-    device.Submit( *cmdTx, *fenceTrn );
+    auto fenceTrn = device.GetFencePool()->Acquire();
+    const VlkDevice::TimelinePoint txDone = { QueueType::Transfer, device.Submit( *cmdTx, *fenceTrn ) };
+    m_readyQueue = QueueType::Transfer;
+    m_readyValue = txDone.value;
     device.GetGarbage()->Recycle( fenceTrn, {
         std::move( cmdTx ),
-        std::move( stagingBuffer ),
         m_image
     } );
-    fencesOut.emplace_back( std::move( fenceTrn ) );
+    fencesOut.emplace_back( fenceTrn );
 
+    // The ownership acquire waits for the transfer on the GPU. Graphics work submitted afterwards is ordered
+    // after it, so the texture can be used right away, without waiting for the fences on the CPU.
     if( !shareQueue )
     {
-        auto cmdGfx = std::make_unique<VlkCommandBuffer>( *device.GetCommandPool( QueueType::Graphic ) );
+        auto cmdGfx = std::make_unique<VlkCommandBuffer>( device.GetThreadCommandPool( QueueType::Graphic ) );
         cmdGfx->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
-        ReadBarrierGfx( *cmdGfx, mipLevels, txQueue, gfxQueue );
+        ReadBarrierGfx( *cmdGfx, baseLevel, levelCount, txQueue, gfxQueue );
         cmdGfx->End();
 
-        auto fenceGfx = std::make_shared<VlkFence>( device );
-        device.Submit( *cmdGfx, *fenceGfx );
+        auto fenceGfx = device.GetFencePool()->Acquire();
+        m_readyQueue = QueueType::Graphic;
+        m_readyValue = device.Submit( *cmdGfx, *fenceGfx, { &txDone, 1 } );
         device.GetGarbage()->Recycle( fenceGfx, {
             std::move( cmdGfx ),
             m_image
         } );
         fencesOut.emplace_back( std::move( fenceGfx ) );
     }
+
+    return fenceTrn;
+}
+
+void Texture::UploadBlitMips( VlkDevice& device, const std::vector<MipData>& mipChain, VlkStagingRing::Allocation&& staging, std::vector<std::shared_ptr<VlkFence>>& fencesOut )
+{
+    ZoneScoped;
+    const auto mipLevels = (uint32_t)mipChain.size();
+
+    // Blits need the graphics queue, so there is no queue ownership transfer here.
+    auto cmd = std::make_unique<VlkCommandBuffer>( device.GetThreadCommandPool( QueueType::Graphic ) );
+    cmd->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT );
+
+    {
+        ZoneVk( device, *cmd, "Texture upload", true );
+        for( uint32_t level = 0; level < mipLevels; level++ ) WriteBarrier( *cmd, level );
+        const VkBufferImageCopy region = {
+            .bufferOffset = staging.offset,
+            .imageSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1 },
+            .imageExtent = { mipChain[0].width, mipChain[0].height, 1 }
+        };
+        vkCmdCopyBufferToImage( *cmd, staging, *m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region );
+    }
+
+    BlitMips( device, *cmd, mipChain );
+    cmd->End();
+
+    auto fence = device.GetFencePool()->Acquire();
+    m_readyQueue = QueueType::Graphic;
+    m_readyValue = device.Submit( *cmd, *fence );
+    device.GetStagingRing()->Release( staging, fence );
+    device.GetGarbage()->Recycle( fence, {
+        std::move( cmd ),
+        m_image
+    } );
+    fencesOut.emplace_back( std::move( fence ) );
+}
+
+// Blits the whole chain, or only the parts of the levels that depend on the region of the first level
+void Texture::BlitMips( VlkDevice& device, VkCommandBuffer cmdbuf, const std::vector<MipData>& mipChain, const VkRect2D* region )
+{
+    const auto mipLevels = (uint32_t)mipChain.size();
+
+    int32_t x0 = 0, y0 = 0;
+    int32_t x1 = int32_t( mipChain[0].width ), y1 = int32_t( mipChain[0].height );
+    if( region )
+    {
+        x0 = region->offset.x;
+        y0 = region->offset.y;
+        x1 = x0 + int32_t( region->extent.width );
+        y1 = y0 + int32_t( region->extent.height );
+    }
+
+    for( uint32_t level = 1; level < mipLevels; level++ )
+    {
+        ZoneVk( device, cmdbuf, "Mip blit", true );
+
+        const VkImageMemoryBarrier2 barrier = {
+            .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+            .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+            .dstStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+            .dstAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+            .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+            .newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+            .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+            .image = *m_image,
+            .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 1, 0, 1 }
+        };
+        const VkDependencyInfo deps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = 1,
+            .pImageMemoryBarriers = &barrier
+        };
+        vkCmdPipelineBarrier2( cmdbuf, &deps );
+
+        // sRGB formats are linearized by the blit, so filtering is gamma correct.
+        const auto& src = mipChain[level-1];
+        const auto& dst = mipChain[level];
+        int32_t dx0, dy0, dx1, dy1;
+        NextMipSpan( src.width, dst.width, x0, x1, dx0, dx1 );
+        NextMipSpan( src.height, dst.height, y0, y1, dy0, dy1 );
+        const VkImageBlit blit = {
+            .srcSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level - 1, 0, 1 },
+            .srcOffsets = { { x0, y0, 0 }, { x1, y1, 1 } },
+            .dstSubresource = { VK_IMAGE_ASPECT_COLOR_BIT, level, 0, 1 },
+            .dstOffsets = { { dx0, dy0, 0 }, { dx1, dy1, 1 } }
+        };
+        vkCmdBlitImage( cmdbuf, *m_image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, *m_image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &blit, VK_FILTER_LINEAR );
+        x0 = dx0;
+        y0 = dy0;
+        x1 = dx1;
+        y1 = dy1;
+    }
+
+    // All levels but the last one are now in the transfer source layout.
+    {
+        VkImageMemoryBarrier2 barriers[2] = {
+            {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                .srcAccessMask = VK_ACCESS_2_TRANSFER_READ_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+                .dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT,
+                .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+                .newLayout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = *m_image,
+                .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels - 1, 0, 1 }
+            },
+            {
+                .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
+                .srcStageMask = VK_PIPELINE_STAGE_2_TRANSFER_BIT,
+                .srcAccessMask = VK_ACCESS_2_TRANSFER_WRITE_BIT,
+                .dstStageMask = VK_PIPELINE_STAGE_2_FRAGMENT_SHADER_BIT,
+                .dstAccessMask = VK_ACCESS_2_SHADER_READ_BIT,
+                .oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                .newLayout = VK_IMAGE_LAYOUT_READ_ONLY_OPTIMAL,
+                .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
+                .image = *m_image,
+                .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, mipLevels - 1, 1, 0, 1 }
+            }
+        };
+        const VkDependencyInfo deps = {
+            .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
+            .imageMemoryBarrierCount = mipLevels > 1 ? 2u : 1u,
+            .pImageMemoryBarriers = mipLevels > 1 ? barriers : barriers + 1
+        };
+        vkCmdPipelineBarrier2( cmdbuf, &deps );
+    }
 }
 
 void Texture::WriteBarrier( VkCommandBuffer cmdbuf, uint32_t mip )
@@ -463,7 +1385,7 @@ void Texture::WriteBarrier( VkCommandBuffer cmdbuf, uint32_t mip )
     vkCmdPipelineBarrier2( cmdbuf, &deps );
 }
 
-void Texture::ReadBarrier( VkCommandBuffer cmdbuf, uint32_t mipLevels )
+void Texture::ReadBarrier( VkCommandBuffer cmdbuf, uint32_t baseLevel, uint32_t levelCount )
 {
     const VkImageMemoryBarrier2 barrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
@@ -476,7 +1398,7 @@ void Texture::ReadBarrier( VkCommandBuffer cmdbuf, uint32_t mipLevels )
         .srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED,
         .image = *m_image,
-        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 }
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, baseLevel, levelCount, 0, 1 }
     };
     const VkDependencyInfo deps = {
         .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
@@ -486,7 +1408,7 @@ void Texture::ReadBarrier( VkCommandBuffer cmdbuf, uint32_t mipLevels )
     vkCmdPipelineBarrier2( cmdbuf, &deps );
 }
 
-void Texture::ReadBarrierTx( VkCommandBuffer cmdbuf, uint32_t mipLevels, uint32_t trnQueue, uint32_t gfxQueue )
+void Texture::ReadBarrierTx( VkCommandBuffer cmdbuf, uint32_t baseLevel, uint32_t levelCount, uint32_t trnQueue, uint32_t gfxQueue )
 {
     const VkImageMemoryBarrier2 barrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
@@ -497,7 +1419,7 @@ void Texture::ReadBarrierTx( VkCommandBuffer cmdbuf, uint32_t mipLevels, uint32_
         .srcQueueFamilyIndex = trnQueue,
         .dstQueueFamilyIndex = gfxQueue,
         .image = *m_image,
-        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 }
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, baseLevel, levelCount, 0, 1 }
     };
     const VkDependencyInfo deps = {
         .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
@@ -507,7 +1429,7 @@ void Texture::ReadBarrierTx( VkCommandBuffer cmdbuf, uint32_t mipLevels, uint32_
     vkCmdPipelineBarrier2( cmdbuf, &deps );
 }
 
-void Texture::ReadBarrierGfx( VkCommandBuffer cmdbuf, uint32_t mipLevels, uint32_t trnQueue, uint32_t gfxQueue )
+void Texture::ReadBarrierGfx( VkCommandBuffer cmdbuf, uint32_t baseLevel, uint32_t levelCount, uint32_t trnQueue, uint32_t gfxQueue )
 {
     const VkImageMemoryBarrier2 barrier = {
         .sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER_2,
@@ -518,7 +1440,7 @@ void Texture::ReadBarrierGfx( VkCommandBuffer cmdbuf, uint32_t mipLevels, uint32
         .srcQueueFamilyIndex = trnQueue,
         .dstQueueFamilyIndex = gfxQueue,
         .image = *m_image,
-        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, 0, mipLevels, 0, 1 }
+        .subresourceRange = { VK_IMAGE_ASPECT_COLOR_BIT, baseLevel, levelCount, 0, 1 }
     };
     const VkDependencyInfo deps = {
         .sType = VK_STRUCTURE_TYPE_DEPENDENCY_INFO,
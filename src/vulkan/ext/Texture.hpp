@@ -1,49 +1,128 @@
 #pragma once
 
+#include <functional>
 #include <memory>
 #include <vector>
 #include <vulkan/vulkan.h>
 
+#include "util/BitmapCompressed.hpp"
 #include "util/NoCopy.hpp"
 #include "vulkan/VlkBase.hpp"
 #include "vulkan/VlkImage.hpp"
 #include "vulkan/VlkImageView.hpp"
+#include "vulkan/VlkQueueType.hpp"
+#include "vulkan/VlkStagingRing.hpp"
 
 class Bitmap;
 class BitmapHdr;
 class BitmapHdrHalf;
 struct MipData;
 class TaskDispatch;
-class VlkBuffer;
+class VlkCommandBuffer;
 class VlkDevice;
 class VlkFence;
 
 class Texture : public VlkBase
 {
 public:
-    Texture( VlkDevice& device, const Bitmap& bitmap, VkFormat format, bool mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td = nullptr );
-    Texture( VlkDevice& device, const BitmapHdr& bitmap, VkFormat format, bool mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td = nullptr );
+    enum class Mips
+    {
+        None,
+        Cpu,    // High quality filtering, done before upload
+        Gpu     // Only the first level is uploaded, the rest is blitted on the GPU. Falls back to Cpu if the format can't be blitted.
+    };
+
+    Texture( VlkDevice& device, const Bitmap& bitmap, VkFormat format, Mips mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td = nullptr );
+    Texture( VlkDevice& device, const BitmapHdr& bitmap, VkFormat format, Mips mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td = nullptr );
+    // Uploaded as is, without a float intermediate, if the format is VK_FORMAT_R16G16B16A16_SFLOAT. With
+    // VK_FORMAT_A2B10G10R10_UNORM_PACK32 the pixels are PQ encoded at half the size, see BitmapHdrHalf::EncodePq(),
+    // and mips are only made if they can be blitted.
+    Texture( VlkDevice& device, const BitmapHdrHalf& bitmap, VkFormat format, Mips mips, std::vector<std::shared_ptr<VlkFence>>& fencesOut, TaskDispatch* td = nullptr );
+
+    // Uploads the blocks as they are, with the mip levels present in the bitmap. Check CanUpload() first. If
+    // progressive, only the smallest levels are uploaded at first, and the finer ones follow through Stream().
+    Texture( VlkDevice& device, const BitmapCompressed& bitmap, std::vector<std::shared_ptr<VlkFence>>& fencesOut, bool progressive = false );
+    [[nodiscard]] static bool CanUpload( VkPhysicalDevice physDev, BitmapCompressed::Format format );
+
+    // Streaming upload. The image is created empty, then filled with bands of rows as they are decoded, so that
+    // decoding and uploading overlap. Row data must already be in the texture format. Cpu mips are not available,
+    // as the full image is never seen at once. The texture can be used only after Finish() is called.
+    Texture( VlkDevice& device, uint32_t width, uint32_t height, VkFormat format, Mips mips );
+
+    // The first level is written on the GPU, by the commands record() adds to a graphics queue command buffer. These
+    // would be compute shader writes through the storage view record() is given, with the level in the general
+    // layout. The format must be RGBA8, the storage view is always UNORM, so sRGB textures are written encoded.
+    // Resources used by the commands have to be kept alive until the fence is signaled.
+    Texture( VlkDevice& device, uint32_t width, uint32_t height, VkFormat format, Mips mips, const std::function<void( VkCommandBuffer, VkImageView )>& record, std::vector<std::shared_ptr<VlkFence>>& fencesOut );
+
+    // Copy of a region of the first level, made on the GPU, without mips. Check source.CanEdit() first.
+    Texture( VlkDevice& device, const Texture& source, const VkRect2D& region, std::vector<std::shared_ptr<VlkFence>>& fencesOut );
+    ~Texture();
     NoCopy( Texture );
 
+    void WriteRows( VlkDevice& device, const void* data, uint32_t y, uint32_t rows );
+    void Finish( VlkDevice& device, std::vector<std::shared_ptr<VlkFence>>& fencesOut );
+
+    // In place edits on the GPU. Only the parts of the mip levels that the region covers are built again.
+    // Textures uploaded with host image copies, or with mips in formats that can't be blitted, can't be edited.
+    [[nodiscard]] bool CanEdit( const VlkDevice& device ) const;
+    void FillBlack( VlkDevice& device, const VkRect2D& region, std::vector<std::shared_ptr<VlkFence>>& fencesOut );
+
+    // Only the region is copied out of the texture, which is much cheaper than a full readback for small selections
     std::shared_ptr<Bitmap> ReadbackSdr( VlkDevice& device ) const;
+    std::shared_ptr<Bitmap> ReadbackSdr( VlkDevice& device, const VkRect2D& region ) const;
     std::shared_ptr<BitmapHdrHalf> ReadbackHdr( VlkDevice& device ) const;
+    std::shared_ptr<BitmapHdrHalf> ReadbackHdr( VlkDevice& device, const VkRect2D& region ) const;     // Packed PQ is decoded
+
+    // Progressive residency. Uploads the next finer level once the previous one has landed, and returns true until
+    // all levels are resident. Until then the texture must be sampled with minLod clamped to ResidentLevel().
+    bool Stream( VlkDevice& device );
+    [[nodiscard]] uint32_t ResidentLevel() const { return m_residentLevel; }
+
+    // True once the upload has finished on the GPU. Frames which draw the texture earlier are held up until then.
+    // Progressive uploads are only ready with all levels resident, but are drawable once the resident ones landed.
+    [[nodiscard]] bool IsReady( const VlkDevice& device ) const;
+    [[nodiscard]] bool IsDrawable( const VlkDevice& device ) const;
 
     [[nodiscard]] VkFormat Format() const { return m_format; }
+    [[nodiscard]] bool IsCompressed() const;    // Block compressed textures can't be read back
+    [[nodiscard]] VkDeviceSize MemorySize() const { return m_image->Size(); }
 
     operator VkImage() const { return *m_image; }
     operator VkImageView() const { return *m_imageView; }
 
 private:
-    void Upload( VlkDevice& device, const std::vector<MipData>& mipChain, std::shared_ptr<VlkBuffer>&& stagingBuffer, std::vector<std::shared_ptr<VlkFence>>& fencesOut );
+    void Upload( VlkDevice& device, const std::vector<MipData>& mipChain, VlkStagingRing::Allocation&& staging, std::vector<std::shared_ptr<VlkFence>>& fencesOut, bool progressive = false );
+    std::shared_ptr<VlkFence> UploadLevels( VlkDevice& device, const std::vector<MipData>& mipChain, const VlkStagingRing::Allocation& staging, uint32_t base, uint32_t count, std::vector<std::shared_ptr<VlkFence>>& fencesOut );
+    void UploadBlitMips( VlkDevice& device, const std::vector<MipData>& mipChain, VlkStagingRing::Allocation&& staging, std::vector<std::shared_ptr<VlkFence>>& fencesOut );
+
+    std::shared_ptr<VlkFence> SubmitTransfer( VlkDevice& device, std::unique_ptr<VlkCommandBuffer>&& cmdTx, uint32_t baseLevel, uint32_t levelCount, std::vector<std::shared_ptr<VlkFence>>& fencesOut );
+    void BlitMips( VlkDevice& device, VkCommandBuffer cmdbuf, const std::vector<MipData>& mipChain, const VkRect2D* region = nullptr );
+
+    [[nodiscard]] bool IsInside( const VkRect2D& region ) const;
 
     void WriteBarrier( VkCommandBuffer cmdbuf, uint32_t mip );
-    void ReadBarrier( VkCommandBuffer cmdbuf, uint32_t mipLevels );
-    void ReadBarrierTx( VkCommandBuffer cmdbuf, uint32_t mipLevels, uint32_t trnQueue, uint32_t gfxQueue );
-    void ReadBarrierGfx( VkCommandBuffer cmdbuf, uint32_t mipLevels, uint32_t trnQueue, uint32_t gfxQueue );
+    void ReadBarrier( VkCommandBuffer cmdbuf, uint32_t baseLevel, uint32_t levelCount );
+    void ReadBarrierTx( VkCommandBuffer cmdbuf, uint32_t baseLevel, uint32_t levelCount, uint32_t trnQueue, uint32_t gfxQueue );
+    void ReadBarrierGfx( VkCommandBuffer cmdbuf, uint32_t baseLevel, uint32_t levelCount, uint32_t trnQueue, uint32_t gfxQueue );
+
+    struct StreamState;
+    struct ResidencyState;
 
     std::shared_ptr<VlkImage> m_image;
     std::unique_ptr<VlkImageView> m_imageView;
 
     VkFormat m_format;
     uint32_t m_width, m_height;
+    uint32_t m_mipLevels = 1;
+    bool m_hostImageCopy = false;
+
+    // Last submission of the upload. Zero if nothing was submitted, as with host image copies.
+    QueueType m_readyQueue = QueueType::Graphic;
+    uint64_t m_readyValue = 0;
+
+    std::unique_ptr<StreamState> m_stream;
+
+    uint32_t m_residentLevel = 0;
+    std::unique_ptr<ResidencyState> m_residency;
 };
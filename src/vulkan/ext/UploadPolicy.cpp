@@ -0,0 +1,216 @@
+#include <chrono>
+#include <memory>
+#include <stdio.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <tracy/Tracy.hpp>
+#include <vector>
+
+#include "Texture.hpp"
+#include "UploadPolicy.hpp"
+#include "util/Bitmap.hpp"
+#include "util/BitmapHdr.hpp"
+#include "util/BitmapHdrHalf.hpp"
+#include "util/BitmapYuv.hpp"
+#include "util/Clock.hpp"
+#include "util/Config.hpp"
+#include "util/Filesystem.hpp"
+#include "util/Logs.hpp"
+#include "util/Tonemapper.hpp"
+#include "vulkan/VlkBuffer.hpp"
+#include "vulkan/VlkDevice.hpp"
+#include "vulkan/VlkFence.hpp"
+#include "vulkan/VlkPhysicalDevice.hpp"
+#include "vulkan/VlkStagingRing.hpp"
+
+namespace
+{
+// Bumped whenever the measurements change, so that older results are calibrated again
+constexpr int Version = 1;
+
+constexpr uint32_t Size = 1024;
+constexpr int Repeats = 3;
+constexpr VkFormat SdrFormat = VK_FORMAT_R8G8B8A8_SRGB;
+
+using Clock = std::chrono::steady_clock;
+
+double Ms( Clock::time_point t0 )
+{
+    return std::chrono::duration<double, std::milli>( Clock::now() - t0 ).count();
+}
+
+// The pipeline cache UUID changes with the device and the driver build. Machines sharing a home directory may
+// have the same GPU, but not the same CPU.
+std::string CacheName( const VlkPhysicalDevice& physDev )
+{
+    std::string name = "upload-";
+    char hex[3];
+    for( auto v : physDev.Properties().pipelineCacheUUID )
+    {
+        snprintf( hex, sizeof( hex ), "%02x", v );
+        name += hex;
+    }
+    name += "-" + std::to_string( std::thread::hardware_concurrency() ) + ".ini";
+    return name;
+}
+
+template<typename T>
+void Upload( VlkDevice& device, const T& bitmap, VkFormat format, Texture::Mips mips, TaskDispatch& td )
+{
+    std::vector<std::shared_ptr<VlkFence>> fences;
+    Texture texture( device, bitmap, format, mips, fences, &td );
+    for( auto& fence : fences ) fence->Wait();
+}
+
+template<typename F>
+double Measure( F&& f )
+{
+    return MeasureMedian( Repeats, [&] {
+        const auto t0 = Clock::now();
+        f();
+        return Ms( t0 );
+    } );
+}
+
+// The planes are copied to a device buffer, as the view does before running the conversion shader. The shader
+// itself is left out, it takes a fraction of the copy on any GPU.
+void UploadYuv( VlkDevice& device, const BitmapYuv& yuv )
+{
+    const auto size = ( yuv.Size() + 3 ) & ~size_t( 3 );
+    auto staging = device.GetStagingRing()->Acquire( size );
+    memcpy( staging.ptr, yuv.Data(), yuv.Size() );
+    staging.Flush();
+
+    const VkBufferCreateInfo bufferInfo = {
+        .sType = VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO,
+        .size = size,
+        .usage = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+        .sharingMode = VK_SHARING_MODE_EXCLUSIVE
+    };
+    auto planes = std::make_shared<VlkBuffer>( device, bufferInfo, VlkBuffer::PreferDevice );
+
+    std::vector<std::shared_ptr<VlkFence>> fences;
+    Texture texture( device, yuv.Width(), yuv.Height(), SdrFormat, Texture::Mips::Gpu, [&]( VkCommandBuffer cmdbuf, VkImageView ) {
+        const VkBufferCopy copy = {
+            .srcOffset = staging.offset,
+            .size = size
+        };
+        vkCmdCopyBuffer( cmdbuf, staging, *planes, 1, &copy );
+    }, fences );
+    device.GetStagingRing()->Release( staging, fences.back() );
+    for( auto& fence : fences ) fence->Wait();
+}
+}
+
+bool UploadPolicy::Load( const VlkPhysicalDevice& physDev, UploadPolicy& policy )
+{
+    Config cfg( CacheName( physDev ) );
+    if( !cfg || cfg.Get( "Upload", "Version", 0 ) != Version ) return false;
+
+    policy.gpuMips = cfg.Get( "Upload", "GpuMips", 1 ) != 0;
+    policy.hostImageCopy = cfg.Get( "Upload", "HostImageCopy", 1 ) != 0;
+    policy.gpuTonemap = cfg.Get( "Upload", "GpuTonemap", 1 ) != 0;
+    policy.gpuYuv = cfg.Get( "Upload", "GpuYuv", 1 ) != 0;
+    return true;
+}
+
+UploadPolicy UploadPolicy::Calibrate( VlkDevice& device, TaskDispatch& td )
+{
+    ZoneScoped;
+    const auto start = Clock::now();
+
+    Bitmap sdr( Size, Size );
+    BitmapHdr hdr( Size, Size, Colorspace::BT709 );
+    BitmapYuv yuv( Size, Size, BitmapYuv::Subsampling::S420 );
+    {
+        auto s = sdr.Data();
+        auto h = hdr.Data();
+        for( uint32_t y=0; y<Size; y++ )
+        {
+            for( uint32_t x=0; x<Size; x++ )
+            {
+                *s++ = x & 0xFF;
+                *s++ = y & 0xFF;
+                *s++ = ( x ^ y ) & 0xFF;
+                *s++ = 0xFF;
+                *h++ = float( x ) / Size * 4;
+                *h++ = float( y ) / Size * 4;
+                *h++ = float( ( x ^ y ) & 0xFF ) / 255;
+                *h++ = 1;
+            }
+        }
+        auto p = yuv.Y();
+        for( size_t i=0; i<yuv.Size(); i++ ) *p++ = i * 7;
+    }
+    const BitmapHdrHalf half( hdr );
+
+    UploadPolicy policy;
+
+    // Measured first, as the CPU mips are uploaded the chosen way
+    const auto hostImageCopy = device.UseHostImageCopy();
+    if( hostImageCopy )
+    {
+        const auto host = Measure( [&] { Upload( device, sdr, SdrFormat, Texture::Mips::None, td ); } );
+        device.SetHostImageCopy( false );
+        const auto staging = Measure( [&] { Upload( device, sdr, SdrFormat, Texture::Mips::None, td ); } );
+        policy.hostImageCopy = host <= staging;
+        device.SetHostImageCopy( policy.hostImageCopy );
+        mclog( LogLevel::Info, "Upload calibration: host image copy %.2f ms, staging %.2f ms", host, staging );
+    }
+
+    const auto gpuMips = Measure( [&] { Upload( device, sdr, SdrFormat, Texture::Mips::Gpu, td ); } );
+    const auto cpuMips = Measure( [&] { Upload( device, sdr, SdrFormat, Texture::Mips::Cpu, td ); } );
+    policy.gpuMips = gpuMips <= cpuMips;
+    mclog( LogLevel::Info, "Upload calibration: GPU mips %.2f ms, CPU mips %.2f ms", gpuMips, cpuMips );
+    const auto mips = policy.gpuMips ? Texture::Mips::Gpu : Texture::Mips::Cpu;
+
+    // Either way the image is decoded once. Shader tone mapping then only costs the larger upload, as drawing
+    // samples the texture all the same.
+    const auto gpuTonemap = Measure( [&] { Upload( device, half, VK_FORMAT_R16G16B16A16_SFLOAT, Texture::Mips::Gpu, td ); } );
+    const auto cpuTonemap = Measure( [&] {
+        auto bitmap = hdr.Tonemap( ToneMap::Operator::AgX, &td );
+        Upload( device, *bitmap, SdrFormat, mips, td );
+    } );
+    policy.gpuTonemap = gpuTonemap <= cpuTonemap;
+    mclog( LogLevel::Info, "Upload calibration: GPU tone mapping %.2f ms, CPU tone mapping %.2f ms", gpuTonemap, cpuTonemap );
+
+    const auto gpuYuv = Measure( [&] { UploadYuv( device, yuv ); } );
+    const auto cpuYuv = Measure( [&] {
+        auto bitmap = yuv.ToBitmap( &td );
+        Upload( device, *bitmap, SdrFormat, mips, td );
+    } );
+    policy.gpuYuv = gpuYuv <= cpuYuv;
+    mclog( LogLevel::Info, "Upload calibration: GPU YCbCr %.2f ms, CPU YCbCr %.2f ms", gpuYuv, cpuYuv );
+
+    device.SetHostImageCopy( hostImageCopy );
+    mclog( LogLevel::Info, "Upload calibration took %.1f ms", Ms( start ) );
+
+    policy.Save( *device.GetPhysicalDevice() );
+    return policy;
+}
+
+void UploadPolicy::Apply( VlkDevice& device ) const
+{
+    device.SetHostImageCopy( hostImageCopy );
+}
+
+void UploadPolicy::Save( const VlkPhysicalDevice& physDev ) const
+{
+    const auto configPath = Config::GetPath();
+    if( !CreateDirectories( configPath ) ) return;
+
+    FILE* f = fopen( ( configPath + CacheName( physDev ) ).c_str(), "w" );
+    if( !f )
+    {
+        mclog( LogLevel::Warning, "Failed to save the upload calibration" );
+        return;
+    }
+    fprintf( f, "[Upload]\n" );
+    fprintf( f, "Version = %d\n", Version );
+    fprintf( f, "GpuMips = %d\n", gpuMips );
+    fprintf( f, "HostImageCopy = %d\n", hostImageCopy );
+    fprintf( f, "GpuTonemap = %d\n", gpuTonemap );
+    fprintf( f, "GpuYuv = %d\n", gpuYuv );
+    fclose( f );
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+class TaskDispatch;
+class VlkDevice;
+class VlkPhysicalDevice;
+
+// Which of the equivalent ways of getting an image into a texture is the faster one on this machine. That depends
+// on the balance of the CPU and the GPU, so it is measured by a short calibration, and cached in the config
+// directory for each device, driver build and CPU count.
+struct UploadPolicy
+{
+    bool gpuMips = true;            // Mips are blitted on the GPU, rather than filtered on the CPU
+    bool hostImageCopy = true;      // Host image copies, where the device has them, rather than staging buffers
+    bool gpuTonemap = true;         // HDR is uploaded in half float and tone mapped by a shader, not on load
+    bool gpuYuv = true;             // YCbCr planes are uploaded and converted to RGB by a shader
+
+    // False if the machine was not calibrated yet, the policy is left as it was then
+    [[nodiscard]] static bool Load( const VlkPhysicalDevice& physDev, UploadPolicy& policy );
+
+    // Takes a few hundred milliseconds. The device and the TaskDispatch should be otherwise idle, so that nothing
+    // else takes from the measured time. The result is cached.
+    [[nodiscard]] static UploadPolicy Calibrate( VlkDevice& device, TaskDispatch& td );
+
+    // The choice of host image copies is made on the device, for the textures made from then on
+    void Apply( VlkDevice& device ) const;
+
+    void Save( const VlkPhysicalDevice& physDev ) const;
+};
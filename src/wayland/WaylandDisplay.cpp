@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <string.h>
 #include <tracy/Tracy.hpp>
 
@@ -28,9 +29,9 @@ WaylandDisplay::WaylandDisplay()
     CheckPanic( m_xdgWmBase, "Failed to create Wayland xdg_wm_base" );
     CheckPanic( m_seat, "Failed to create Wayland seat" );
     CheckPanic( m_viewporter, "Failed to create Wayland viewporter" );
-    CheckPanic( m_fractionalScaleManager, "Failed to create Wayland fractional scale manager" );
     CheckPanic( m_dataDeviceManager, "Failed to create Wayland data device manager" );
 
+    if( !m_fractionalScaleManager ) mclog( LogLevel::Warning, "Fractional scaling not supported, buffers will be rendered at integer scale." );
     if( !m_cursorShapeManager ) mclog( LogLevel::Warning, "Unable to set mouse cursors. Switch to a different compositor." );
 }
 
@@ -38,6 +39,7 @@ WaylandDisplay::~WaylandDisplay()
 {
     m_outputs.clear();
     m_seat.reset();
+    if( m_presentation ) wp_presentation_destroy( m_presentation );
     if( m_pointerWarp ) wp_pointer_warp_v1_destroy( m_pointerWarp );
     if( m_colorManager ) wp_color_manager_v1_destroy( m_colorManager );
     if( m_activation ) xdg_activation_v1_destroy( m_activation );
@@ -58,9 +60,51 @@ void WaylandDisplay::Roundtrip()
     wl_display_roundtrip( m_dpy );
 }
 
+// The display is read only after wl_display_prepare_read() succeeded and epoll reported it readable, so the read
+// never blocks and no lock is held while waiting. If the display didn't become readable, the read is cancelled
+// once the other sources were handled.
 void WaylandDisplay::Run()
 {
-    while( m_keepRunning && wl_display_dispatch( m_dpy ) != -1 ) {}
+    const auto fd = wl_display_get_fd( m_dpy );
+    bool reading = false;
+
+    const auto prepare = m_loop.AddPrepare( [this, fd, &reading] {
+        while( wl_display_prepare_read( m_dpy ) != 0 )
+        {
+            if( wl_display_dispatch_pending( m_dpy ) < 0 ) { m_loop.Stop(); return 0; }
+        }
+        reading = true;
+
+        // Requests which did not fit in the socket buffer are sent when it becomes writable
+        const auto flushed = wl_display_flush( m_dpy ) >= 0 || errno != EAGAIN;
+        m_loop.ModifyFd( fd, flushed ? EPOLLIN : EPOLLIN | EPOLLOUT );
+        return -1;
+    }, [this, &reading] {
+        if( reading )
+        {
+            wl_display_cancel_read( m_dpy );
+            reading = false;
+        }
+    } );
+
+    m_loop.AddFd( fd, EPOLLIN, [this, &reading]( uint32_t events ) {
+        if( events & ( EPOLLERR | EPOLLHUP ) )
+        {
+            mclog( LogLevel::Error, "Wayland display connection lost" );
+            m_loop.Stop();
+            return;
+        }
+        if( events & EPOLLIN )
+        {
+            reading = false;
+            if( wl_display_read_events( m_dpy ) < 0 || wl_display_dispatch_pending( m_dpy ) < 0 ) m_loop.Stop();
+        }
+    } );
+
+    m_loop.Run();
+
+    m_loop.RemoveFd( fd );
+    m_loop.RemovePrepare( prepare );
 }
 
 void WaylandDisplay::RegistryGlobalShim( wl_registry* reg, uint32_t name, const char* interface, uint32_t version )
@@ -75,7 +119,7 @@ void WaylandDisplay::RegistryGlobal( wl_registry* reg, uint32_t name, const char
 {
     if( strcmp( interface, wl_compositor_interface.name ) == 0 )
     {
-        m_compositor = RegistryBind( wl_compositor, 5, 5 );
+        m_compositor = RegistryBind( wl_compositor, 5, 6 );
     }
     else if( strcmp( interface, wl_shm_interface.name ) == 0 )
     {
@@ -149,6 +193,15 @@ void WaylandDisplay::RegistryGlobal( wl_registry* reg, uint32_t name, const char
         m_pointerWarp = RegistryBind( wp_pointer_warp_v1 );
         if( m_seat ) m_seat->SetPointerWarp( m_pointerWarp );
     }
+    else if( strcmp( interface, wp_presentation_interface.name ) == 0 )
+    {
+        static constexpr wp_presentation_listener listener = {
+            .clock_id = Method( PresentationClockId )
+        };
+
+        m_presentation = RegistryBind( wp_presentation, 1, 2 );
+        wp_presentation_add_listener( m_presentation, &listener, this );
+    }
 }
 
 void WaylandDisplay::RegistryGlobalRemove( wl_registry* reg, uint32_t name )
@@ -166,3 +219,8 @@ void WaylandDisplay::IconManagerSize( xdg_toplevel_icon_manager_v1* manager, int
 {
     m_iconSizes.emplace_back( size );
 }
+
+void WaylandDisplay::PresentationClockId( wp_presentation* presentation, uint32_t clockId )
+{
+    m_presentationClock = clockid_t( clockId );
+}
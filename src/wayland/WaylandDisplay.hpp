@@ -1,15 +1,18 @@
 #pragma once
 
 #include <memory>
+#include <time.h>
 #include <vector>
 #include <wayland-client.h>
 
+#include "util/EventLoop.hpp"
 #include "util/NoCopy.hpp"
 
 #include "wayland-color-management-client-protocol.h"
 #include "wayland-cursor-shape-client-protocol.h"
 #include "wayland-fractional-scale-client-protocol.h"
 #include "wayland-pointer-warp-client-protocol.h"
+#include "wayland-presentation-time-client-protocol.h"
 #include "wayland-viewporter-client-protocol.h"
 #include "wayland-xdg-activation-client-protocol.h"
 #include "wayland-xdg-decoration-client-protocol.h"
@@ -29,8 +32,11 @@ public:
 
     void Roundtrip();
 
+    // Dispatches the display, and anything else added to the event loop, until stopped. Stop() is thread safe.
     void Run();
-    void Stop() { m_keepRunning = false; }
+    void Stop() { m_loop.Stop(); }
+
+    [[nodiscard]] EventLoop& Loop() { return m_loop; }
 
     [[nodiscard]] wl_display* Display() { return m_dpy; }
     [[nodiscard]] wl_compositor* Compositor() { return m_compositor; }
@@ -42,6 +48,8 @@ public:
     [[nodiscard]] xdg_toplevel_icon_manager_v1* IconManager() { return m_iconManager; }
     [[nodiscard]] xdg_activation_v1* Activation() { return m_activation; }
     [[nodiscard]] wp_pointer_warp_v1* PointerWarp() { return m_pointerWarp; }
+    [[nodiscard]] wp_presentation* Presentation() { return m_presentation; }
+    [[nodiscard]] clockid_t PresentationClock() const { return m_presentationClock; }     // Of the presentation timestamps
 
     [[nodiscard]] const auto& IconSizes() const { return m_iconSizes; }
     [[nodiscard]] const auto& Outputs() const { return m_outputs; }
@@ -58,6 +66,7 @@ private:
 
     void XdgWmPing( xdg_wm_base* shell, uint32_t serial );
     void IconManagerSize( xdg_toplevel_icon_manager_v1* manager, int32_t size );
+    void PresentationClockId( wp_presentation* presentation, uint32_t clockId );
 
     wl_display* m_dpy = nullptr;
     wl_compositor* m_compositor = nullptr;
@@ -73,8 +82,10 @@ private:
     xdg_activation_v1* m_activation = nullptr;
     wp_color_manager_v1* m_colorManager = nullptr;
     wp_pointer_warp_v1* m_pointerWarp = nullptr;
+    wp_presentation* m_presentation = nullptr;
+    clockid_t m_presentationClock = CLOCK_MONOTONIC;
 
-    bool m_keepRunning = true;
+    EventLoop m_loop;
 
     std::vector<int32_t> m_iconSizes;
     std::vector<std::shared_ptr<WaylandOutput>> m_outputs;
@@ -76,6 +76,7 @@ void WaylandPointer::Enter( wl_pointer* pointer, uint32_t serial, wl_surface* wi
 
 void WaylandPointer::Leave( wl_pointer* pointer, uint32_t serial, wl_surface* window )
 {
+    FlushMotion();
     CheckPanic( m_activeWindow == window, "Unknown window left!" );
     m_activeWindow = nullptr;
     m_seat.PointerLeft( window );
@@ -83,11 +84,14 @@ void WaylandPointer::Leave( wl_pointer* pointer, uint32_t serial, wl_surface* wi
 
 void WaylandPointer::Motion( wl_pointer* pointer, uint32_t time, wl_fixed_t sx, wl_fixed_t sy )
 {
-    m_seat.PointerMotion( m_activeWindow, sx, sy );
+    m_motion = true;
+    m_motionX = sx;
+    m_motionY = sy;
 }
 
 void WaylandPointer::Button( wl_pointer* pointer, uint32_t serial, uint32_t time, uint32_t button, uint32_t state )
 {
+    FlushMotion();
     m_seat.SetInputSerial( serial );
     m_seat.PointerButton( m_activeWindow, button, state == WL_POINTER_BUTTON_STATE_PRESSED );
 }
@@ -107,6 +111,7 @@ void WaylandPointer::Axis( wl_pointer* pointer, uint32_t time, uint32_t axis, wl
 
 void WaylandPointer::Frame( wl_pointer* pointer )
 {
+    FlushMotion();
     if( m_scroll.delta.x != 0 || m_scroll.delta.y != 0 )
     {
         m_seat.PointerScroll( m_activeWindow, m_scroll );
@@ -114,6 +119,13 @@ void WaylandPointer::Frame( wl_pointer* pointer )
     }
 }
 
+void WaylandPointer::FlushMotion()
+{
+    if( !m_motion ) return;
+    m_motion = false;
+    if( m_activeWindow ) m_seat.PointerMotion( m_activeWindow, m_motionX, m_motionY );
+}
+
 void WaylandPointer::AxisSource( wl_pointer* pointer, uint32_t source )
 {
     switch( source )
@@ -39,6 +39,8 @@ private:
     void AxisValue120( wl_pointer* pointer, uint32_t axis, int32_t value120 );
     void AxisRelativeDirection( wl_pointer* pointer, uint32_t axis, uint32_t direction );
 
+    void FlushMotion();
+
     wl_pointer* m_pointer;
     WaylandSeat& m_seat;
 
@@ -49,5 +51,10 @@ private:
     wp_cursor_shape_device_v1* m_cursorShapeDevice = nullptr;
     wp_pointer_warp_v1* m_pointerWarp = nullptr;
 
+    // Motion is delivered when the pointer frame ends, or before a button event of the same frame
+    bool m_motion = false;
+    wl_fixed_t m_motionX;
+    wl_fixed_t m_motionY;
+
     WaylandScroll m_scroll;
 };
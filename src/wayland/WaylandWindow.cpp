@@ -1,8 +1,11 @@
+#include <algorithm>
 #include <math.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <string>
 #include <sys/mman.h>
+#include <thread>
 #include <tracy/Tracy.hpp>
 #include <unistd.h>
 #include <vulkan/vulkan.h>
@@ -14,6 +17,8 @@
 #include "WaylandWindow.hpp"
 #include "image/vector/SvgImage.hpp"
 #include "util/Bitmap.hpp"
+#include "util/Clock.hpp"
+#include "util/DataBuffer.hpp"
 #include "util/Invoke.hpp"
 #include "util/Panic.hpp"
 #include "vulkan/VlkCommandBuffer.hpp"
@@ -56,9 +61,14 @@ WaylandWindow::WaylandWindow( WaylandDisplay& display, VlkInstance& vkInstance )
         .preferred_scale = Method( FractionalScalePreferredScale )
     };
 
-    m_fractionalScale = wp_fractional_scale_manager_v1_get_fractional_scale( display.FractionalScaleManager(), m_surface );
-    CheckPanic( m_fractionalScale, "Failed to create Wayland fractional scale" );
-    wp_fractional_scale_v1_add_listener( m_fractionalScale, &fractionalListener, this );
+    // Without fractional scale the integer buffer scale is used. The viewport maps the buffer to the logical size
+    // in both cases, so the swapchain always has the exact size in real pixels.
+    if( display.FractionalScaleManager() )
+    {
+        m_fractionalScale = wp_fractional_scale_manager_v1_get_fractional_scale( display.FractionalScaleManager(), m_surface );
+        CheckPanic( m_fractionalScale, "Failed to create Wayland fractional scale" );
+        wp_fractional_scale_v1_add_listener( m_fractionalScale, &fractionalListener, this );
+    }
 
     m_viewport = wp_viewporter_get_viewport( display.Viewporter(), m_surface );
     CheckPanic( m_viewport, "Failed to create Wayland viewport" );
@@ -103,8 +113,11 @@ void WaylandWindow::Destroy()
 {
     CheckPanic( m_surface, "Window already destroyed" );
 
+    for( auto& v : m_feedback ) wp_presentation_feedback_destroy( v.feedback );
+    m_feedback.clear();
+
     wp_viewport_destroy( m_viewport );
-    wp_fractional_scale_v1_destroy( m_fractionalScale );
+    if( m_fractionalScale ) wp_fractional_scale_v1_destroy( m_fractionalScale );
     if( m_xdgToplevelDecoration ) zxdg_toplevel_decoration_v1_destroy( m_xdgToplevelDecoration );
     xdg_toplevel_destroy( m_xdgToplevel );
     xdg_surface_destroy( m_xdgSurface );
@@ -125,7 +138,59 @@ void WaylandWindow::SetTitle( const char* title )
     xdg_toplevel_set_title( m_xdgToplevel, title );
 }
 
+static void RasterizeIcon( const SvgImage& icon, int32_t sz, uint32_t* dst )
+{
+    const auto bmp = icon.Rasterize( sz, sz );
+    auto src = (uint32_t*)bmp->Data();
+
+    int left = sz * sz;
+    while( left-- )
+    {
+        uint32_t px = *src++;
+        *dst++ = ( px & 0xFF00FF00 ) | ( px & 0x00FF0000 ) >> 16 | ( px & 0x000000FF ) << 16;
+    }
+}
+
 void WaylandWindow::SetIcon( const SvgImage& icon )
+{
+    UploadIcon( [&icon]( int32_t sz, uint32_t* dst ) {
+        RasterizeIcon( icon, sz, dst );
+    } );
+}
+
+void WaylandWindow::SetIcon( const DataBuffer& rasters, std::shared_ptr<DataBuffer> svg )
+{
+    ZoneScoped;
+
+    // Each raster is a uint32_t size, followed by size * size ARGB8888 pixels
+    unordered_flat_map<uint32_t, const char*> sizes;
+    auto ptr = rasters.data();
+    const auto end = ptr + rasters.size();
+    while( end - ptr >= 4 )
+    {
+        uint32_t sz;
+        memcpy( &sz, ptr, 4 );
+        ptr += 4;
+        if( size_t( end - ptr ) < size_t( sz ) * sz * 4 ) break;
+        sizes.emplace( sz, ptr );
+        ptr += size_t( sz ) * sz * 4;
+    }
+
+    std::unique_ptr<SvgImage> icon;
+    UploadIcon( [&]( int32_t sz, uint32_t* dst ) {
+        auto it = sizes.find( sz );
+        if( it != sizes.end() )
+        {
+            memcpy( dst, it->second, sz * sz * 4 );
+            return;
+        }
+
+        if( !icon ) icon = std::make_unique<SvgImage>( svg );
+        RasterizeIcon( *icon, sz, dst );
+    } );
+}
+
+void WaylandWindow::UploadIcon( const std::function<void( int32_t, uint32_t* )>& fill )
 {
     const auto mgr = m_display.IconManager();
     if( !mgr ) return;
@@ -164,18 +229,9 @@ void WaylandWindow::SetIcon( const SvgImage& icon )
         auto buf = wl_shm_pool_create_buffer( pool, offset, sz, sz, sz * 4, WL_SHM_FORMAT_ARGB8888 );
         bufs.push_back( buf );
 
-        const auto bmp = icon.Rasterize( sz, sz );
-        auto src = (uint32_t*)bmp->Data();
-        auto dst = (uint32_t*)(membuf + offset);
+        fill( sz, (uint32_t*)(membuf + offset) );
         offset += sz * sz * 4;
 
-        int left = sz * sz;
-        while( left-- )
-        {
-            uint32_t px = *src++;
-            *dst++ = ( px & 0xFF00FF00 ) | ( px & 0x00FF0000 ) >> 16 | ( px & 0x000000FF ) << 16;
-        }
-
         xdg_toplevel_icon_v1_add_buffer( wlicon, buf, sz );
     }
 
@@ -186,6 +242,32 @@ void WaylandWindow::SetIcon( const SvgImage& icon )
     wl_shm_pool_destroy( pool );
 }
 
+static bool IsEmpty( const VkRect2D& rect )
+{
+    return rect.extent.width == 0 || rect.extent.height == 0;
+}
+
+static VkRect2D Union( const VkRect2D& a, const VkRect2D& b )
+{
+    if( IsEmpty( a ) ) return b;
+    if( IsEmpty( b ) ) return a;
+
+    const auto x0 = std::min( a.offset.x, b.offset.x );
+    const auto y0 = std::min( a.offset.y, b.offset.y );
+    const auto x1 = std::max( a.offset.x + int32_t( a.extent.width ), b.offset.x + int32_t( b.extent.width ) );
+    const auto y1 = std::max( a.offset.y + int32_t( a.extent.height ), b.offset.y + int32_t( b.extent.height ) );
+    return { { x0, y0 }, { uint32_t( x1 - x0 ), uint32_t( y1 - y0 ) } };
+}
+
+static VkRect2D Clip( const VkRect2D& rect, const VkExtent2D& extent )
+{
+    const auto x0 = std::clamp( rect.offset.x, 0, int32_t( extent.width ) );
+    const auto y0 = std::clamp( rect.offset.y, 0, int32_t( extent.height ) );
+    const auto x1 = std::clamp( rect.offset.x + int32_t( rect.extent.width ), x0, int32_t( extent.width ) );
+    const auto y1 = std::clamp( rect.offset.y + int32_t( rect.extent.height ), y0, int32_t( extent.height ) );
+    return { { x0, y0 }, { uint32_t( x1 - x0 ), uint32_t( y1 - y0 ) } };
+}
+
 static uint32_t ceil( uint32_t a, uint32_t b )
 {
     return ( a + b - 1 ) / b;
@@ -220,7 +302,7 @@ void WaylandWindow::ResizeNoScale( uint32_t width, uint32_t height, bool reposit
         m_floatingExtent = m_staged = m_extent = VkExtent2D( width, height );
         CreateSwapchain( m_extent );
 
-        wp_viewport_set_destination( m_viewport, m_extent.width, m_extent.height );
+        SetDestination( m_extent );
     }
 }
 
@@ -291,6 +373,22 @@ void WaylandWindow::EnableHdr( bool enable )
     }
 }
 
+void WaylandWindow::SetContentLight( float maxCll, float maxFall )
+{
+    std::lock_guard lock( m_stateLock );
+    if( m_maxCll == maxCll && m_maxFall == maxFall ) return;
+    m_maxCll = maxCll;
+    m_maxFall = maxFall;
+    if( m_swapchain && maxCll > 0 ) m_swapchain->SetContentLight( maxCll, maxFall );
+}
+
+void WaylandWindow::SetPresentMode( VkPresentModeKHR mode, uint32_t imageCount, uint32_t framesInFlight )
+{
+    m_presentMode = mode;
+    m_imageCount = imageCount;
+    m_framesInFlight = framesInFlight;
+}
+
 void WaylandWindow::Update()
 {
     m_stateLock.lock();
@@ -298,8 +396,20 @@ void WaylandWindow::Update()
     const bool resized = m_staged.width != m_extent.width || m_staged.height != m_extent.height;
     const bool dpiChange = m_scale != m_prevScale;
     const bool hdrChange = m_hdr != m_prevHdr;
-    if( resized || dpiChange || hdrChange )
+
+    // Compositors send a new size for every pointer motion of an interactive resize. Swapchains of large windows
+    // are slow to create, so until enough time has passed since the last one, the viewport stretches the last
+    // frame to the new size instead.
+    const bool deferResize = resized && !dpiChange && !hdrChange && m_resizing && m_swapchain && float( GetTimeMicro() - m_swapchainTime ) < ResizeInterval();
+    if( deferResize )
+    {
+        m_resizeDeferred = true;
+        SetDestination( m_staged );
+        m_stateLock.unlock();
+    }
+    else if( resized || dpiChange || hdrChange )
     {
+        m_resizeDeferred = false;
         m_extent = m_staged;
         m_prevScale = m_scale;
         m_prevHdr = m_hdr;
@@ -307,7 +417,7 @@ void WaylandWindow::Update()
 
         CreateSwapchain( m_extent );
 
-        wp_viewport_set_destination( m_viewport, m_extent.width, m_extent.height );
+        SetDestination( m_extent );
 
         const auto extent = m_extent;
         const auto scale = m_scale;
@@ -341,8 +451,11 @@ void WaylandWindow::Update()
     if( cursor != seat.GetCursor( m_surface ) ) seat.SetCursor( m_surface, cursor );
 }
 
-VlkCommandBuffer& WaylandWindow::BeginFrame()
+VlkCommandBuffer& WaylandWindow::BeginFrame( const VkRect2D* damage )
 {
+    if( m_presentId != 0 ) PaceFrame();
+    m_frameStart = GetTimeMicro();
+
     m_frameIdx = ( m_frameIdx + 1 ) % m_frameData.size();
     auto& frame = m_frameData[m_frameIdx];
 
@@ -362,11 +475,20 @@ VlkCommandBuffer& WaylandWindow::BeginFrame()
         }
     }
 
+    // The acquired image may be a few presents old, so everything that changed since then has to be drawn
+    const VkRect2D full = { {}, m_swapchain->GetExtent() };
+    auto& image = m_imageDamage[m_imageIdx];
+    m_frameDamage = damage ? Clip( *damage, full.extent ) : full;
+    m_renderArea = image.valid ? Union( image.rect, m_frameDamage ) : full;
+    const auto partial = m_renderArea.extent.width != full.extent.width || m_renderArea.extent.height != full.extent.height;
+    for( auto& other : m_imageDamage ) other.rect = Union( other.rect, m_frameDamage );
+    image = { true, {} };
+
     frame.renderFence->Reset();
     frame.commandBuffer->lock();
     frame.commandBuffer->Reset();
     frame.commandBuffer->Begin( VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT, false );
-    m_swapchain->RenderBarrier( *frame.commandBuffer, m_imageIdx );
+    m_swapchain->RenderBarrier( *frame.commandBuffer, m_imageIdx, partial );
 
     return *frame.commandBuffer;
 }
@@ -419,8 +541,33 @@ void WaylandWindow::EndFrame()
     VkSemaphore renderFinished = *frame.renderFinished;
     VkSwapchainKHR swapchain = *m_swapchain;
 
+    // Passed on to the compositor as buffer damage, so that it only recomposites the changed area
+    const auto& extent = m_swapchain->GetExtent();
+    const auto partial = m_frameDamage.extent.width != extent.width || m_frameDamage.extent.height != extent.height;
+    const VkRectLayerKHR damageRect = {
+        .offset = m_frameDamage.offset,
+        .extent = m_frameDamage.extent
+    };
+    const VkPresentRegionKHR presentRegion = {
+        .rectangleCount = 1,
+        .pRectangles = &damageRect
+    };
+    const VkPresentRegionsKHR presentRegions = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_REGIONS_KHR,
+        .swapchainCount = 1,
+        .pRegions = &presentRegion
+    };
+    const void* regions = partial && m_vkDevice->UseIncrementalPresent() ? &presentRegions : nullptr;
+    const auto presentId = m_swapchain->NextPresentId();
+    const VkPresentIdKHR presentIdInfo = {
+        .sType = VK_STRUCTURE_TYPE_PRESENT_ID_KHR,
+        .pNext = regions,
+        .swapchainCount = 1,
+        .pPresentIds = &presentId
+    };
     const VkSwapchainPresentFenceInfoEXT presentFenceInfo = {
         .sType = VK_STRUCTURE_TYPE_SWAPCHAIN_PRESENT_FENCE_INFO_EXT,
+        .pNext = presentId != 0 ? &presentIdInfo : regions,
         .swapchainCount = 1,
         .pFences = &presentFence
     };
@@ -433,10 +580,60 @@ void WaylandWindow::EndFrame()
         .pSwapchains = &swapchain,
         .pImageIndices = &m_imageIdx
     };
+    RequestPresentFeedback();
+
     m_vkDevice->lock( QueueType::Present );
     const auto res = vkQueuePresentKHR( m_vkDevice->GetQueue( QueueType::Present ), &presentInfo );
     m_vkDevice->unlock( QueueType::Present );
     CheckPanic( res == VK_SUCCESS || res == VK_SUBOPTIMAL_KHR || res == VK_ERROR_OUT_OF_DATE_KHR, "Failed to present swapchain image (%s)", string_VkResult( res ) );
+
+    if( presentId != 0 && res != VK_ERROR_OUT_OF_DATE_KHR )
+    {
+        m_presentId = presentId;
+        const auto renderTime = float( GetTimeMicro() - m_frameStart );
+        m_renderTime = m_renderTime == 0 ? renderTime : m_renderTime + ( renderTime - m_renderTime ) * 0.1f;
+    }
+}
+
+// Waits for the previous frame to reach the screen, which happens at vblank, and then sleeps until the next frame
+// has to be started to make it in time for the following vblank. This keeps the input to display latency at close
+// to a single refresh, instead of the depth of the present queue.
+void WaylandWindow::PaceFrame()
+{
+    ZoneScoped;
+
+    const auto presentId = std::exchange( m_presentId, 0 );
+    if( !m_swapchain->WaitForPresent( presentId, 100'000'000 ) )
+    {
+        m_lastVblank = 0;
+        return;
+    }
+
+    const auto vblank = GetTimeMicro();
+    const auto latency = float( vblank - m_frameStart );
+    TracyPlot( "Present wait latency (ms)", latency / 1000.f );
+
+    if( m_lastVblank != 0 )
+    {
+        // Skipped refreshes are larger multiples of the interval, and don't tell much
+        const auto delta = float( vblank - m_lastVblank );
+        if( m_refreshInterval == 0 || delta < m_refreshInterval * 0.75f ) m_refreshInterval = delta;
+        else if( delta < m_refreshInterval * 1.5f ) m_refreshInterval += ( delta - m_refreshInterval ) * 0.05f;
+    }
+    m_lastVblank = vblank;
+    if( m_refreshInterval == 0 ) return;
+
+    // A frame which missed its vblank needs more headroom. Otherwise the margin slowly goes back down.
+    if( latency > m_refreshInterval * 1.5f ) m_pacingMargin = std::min( m_pacingMargin * 2, m_refreshInterval * 0.5f );
+    else m_pacingMargin = std::max( MinPacingMargin, m_pacingMargin * 0.98f );
+    TracyPlot( "Frame pacing margin (ms)", m_pacingMargin / 1000.f );
+
+    const auto wait = m_refreshInterval - m_renderTime - m_pacingMargin;
+    if( wait > 0 )
+    {
+        ZoneScopedN( "Pacing sleep" );
+        std::this_thread::sleep_for( std::chrono::microseconds( uint64_t( wait ) ) );
+    }
 }
 
 VkImage WaylandWindow::GetImage()
@@ -476,14 +673,20 @@ void WaylandWindow::SetDevice( std::shared_ptr<VlkDevice> device )
 {
     CheckPanic( !m_vkDevice, "Vulkan device already set" );
     m_vkDevice = std::move( device );
+    QuerySurfaceFormats( *m_vkDevice->GetPhysicalDevice() );
+}
 
+void WaylandWindow::QuerySurfaceFormats( VkPhysicalDevice physDev )
+{
     uint32_t formatCount;
-    vkGetPhysicalDeviceSurfaceFormatsKHR( *m_vkDevice->GetPhysicalDevice(), *m_vkSurface, &formatCount, nullptr );
+    vkGetPhysicalDeviceSurfaceFormatsKHR( physDev, *m_vkSurface, &formatCount, nullptr );
     std::vector<VkSurfaceFormatKHR> m_formats( formatCount );
-    vkGetPhysicalDeviceSurfaceFormatsKHR( *m_vkDevice->GetPhysicalDevice(), *m_vkSurface, &formatCount, m_formats.data() );
+    vkGetPhysicalDeviceSurfaceFormatsKHR( physDev, *m_vkSurface, &formatCount, m_formats.data() );
 
     const auto hdrFormat = FindSwapchainFormat( m_formats, HdrSwapchainFormats );
     m_hdrCapable = hdrFormat.format != VK_FORMAT_UNDEFINED;
+    m_sdrFormat = FindSwapchainFormat( m_formats, SdrSwapchainFormats ).format;
+    m_hdrFormat = hdrFormat.format;
 }
 
 void WaylandWindow::InvokeRender()
@@ -496,8 +699,21 @@ void WaylandWindow::InvokeRender()
     wl_callback_add_listener( cb, &listener, this );
 
     CheckPanic( !m_idle.load( std::memory_order_acquire ), "Window is rendering, but is idle?" );
+    FlushInput();
     const auto idle = !InvokeRet( OnRender, false );
-    if( idle ) m_idle.store( true, std::memory_order_release );
+    if( idle && m_resizeDeferred )
+    {
+        // Nothing new was drawn, but the frame callbacks have to keep coming until the swapchain catches up with
+        // the window size. The commit also applies the stretched destination.
+        wl_surface_commit( m_surface );
+    }
+    else if( idle )
+    {
+        // The first frame after idling is not paced, as there is no vblank to predict it from
+        m_presentId = 0;
+        m_lastVblank = 0;
+        m_idle.store( true, std::memory_order_release );
+    }
 }
 
 void WaylandWindow::InvokeClipboard( const unordered_flat_set<std::string>& mimeTypes )
@@ -517,6 +733,7 @@ void WaylandWindow::InvokeDrop( int fd, const char* mime )
 
 void WaylandWindow::InvokeKeyEvent( uint32_t key, int mods, bool pressed )
 {
+    FlushInput();
     Invoke( OnKeyEvent, key, mods, pressed );
 }
 
@@ -527,27 +744,65 @@ void WaylandWindow::InvokeCharacter( const char* character )
 
 void WaylandWindow::InvokeMouseEnter( float x, float y )
 {
+    FlushInput();
     Invoke( OnMouseEnter, x * m_scale / 120, y * m_scale / 120 );
 }
 
 void WaylandWindow::InvokeMouseLeave()
 {
+    FlushInput();
     Invoke( OnMouseLeave );
 }
 
+// Only the last position matters, as handlers work with the difference to the previous one. An idle window gets
+// it right away, so that it can start rendering.
 void WaylandWindow::InvokeMouseMove( float x, float y )
 {
-    Invoke( OnMouseMove, x * m_scale / 120, y * m_scale / 120 );
+    m_motionPending = true;
+    m_motionX = x * m_scale / 120;
+    m_motionY = y * m_scale / 120;
+    if( m_idle.load( std::memory_order_acquire ) ) FlushInput();
 }
 
 void WaylandWindow::InvokeMouseButton( uint32_t button, bool pressed )
 {
+    FlushInput();
     Invoke( OnMouseButton, button, pressed );
 }
 
+// Wheel steps are handled one by one, as they are not additive, e.g. for zoom
 void WaylandWindow::InvokeScroll( const WaylandScroll& scroll )
 {
-    Invoke( OnScroll, scroll );
+    if( m_scrollPending && ( scroll.source != m_pendingScroll.source || scroll.inverted.x != m_pendingScroll.inverted.x || scroll.inverted.y != m_pendingScroll.inverted.y ) ) FlushInput();
+    if( scroll.source == WaylandScroll::Source::Wheel || m_idle.load( std::memory_order_acquire ) )
+    {
+        FlushInput();
+        Invoke( OnScroll, scroll );
+    }
+    else if( m_scrollPending )
+    {
+        m_pendingScroll.delta.x += scroll.delta.x;
+        m_pendingScroll.delta.y += scroll.delta.y;
+    }
+    else
+    {
+        m_scrollPending = true;
+        m_pendingScroll = scroll;
+    }
+}
+
+void WaylandWindow::FlushInput()
+{
+    if( m_motionPending )
+    {
+        m_motionPending = false;
+        Invoke( OnMouseMove, m_motionX, m_motionY );
+    }
+    if( m_scrollPending )
+    {
+        m_scrollPending = false;
+        Invoke( OnScroll, m_pendingScroll );
+    }
 }
 
 void WaylandWindow::ResumeIfIdle()
@@ -559,7 +814,9 @@ void WaylandWindow::ResumeIfIdle()
         if( !idle ) return;
     }
 
+    // May be called from any thread, the loop flushes the commit
     wl_surface_commit( m_surface );
+    m_display.Loop().Wakeup();
 }
 
 void WaylandWindow::SetClipboard( const char* const* mime, size_t count, const WaylandDataSource::Listener* listener, void* listenerPtr )
@@ -597,6 +854,18 @@ void WaylandWindow::Recycle( std::vector<std::shared_ptr<VlkBase>>&& garbage )
     m_vkDevice->GetGarbage()->Recycle( m_currentRenderFence.load( std::memory_order_acquire ), std::move( garbage ) );
 }
 
+// The swapchain is always opaque. Declaring it lets the compositor skip whatever is below the window, and scan
+// out the buffer directly when the window covers the output.
+void WaylandWindow::SetDestination( const VkExtent2D& extent )
+{
+    wp_viewport_set_destination( m_viewport, extent.width, extent.height );
+
+    auto region = wl_compositor_create_region( m_display.Compositor() );
+    wl_region_add( region, 0, 0, extent.width, extent.height );
+    wl_surface_set_opaque_region( m_surface, region );
+    wl_region_destroy( region );
+}
+
 void WaylandWindow::CreateSwapchain( const VkExtent2D& extent )
 {
     const auto scaled = VkExtent2D {
@@ -604,17 +873,22 @@ void WaylandWindow::CreateSwapchain( const VkExtent2D& extent )
         .height = uint32_t( round( extent.height * m_scale / 120.f ) )
     };
 
+    const auto start = GetTimeMicro();
     auto oldSwapchain = m_swapchain;
     if( m_swapchain ) CleanupSwapchain();
-    m_swapchain = std::make_shared<VlkSwapchain>( *m_vkDevice, *m_vkSurface, scaled, m_hdr, oldSwapchain ? *oldSwapchain : VkSwapchainKHR { VK_NULL_HANDLE } );
+    m_swapchain = std::make_shared<VlkSwapchain>( *m_vkDevice, *m_vkSurface, scaled, m_hdr, m_presentMode, m_imageCount, oldSwapchain ? *oldSwapchain : VkSwapchainKHR { VK_NULL_HANDLE } );
     oldSwapchain.reset();
+    if( m_maxCll > 0 ) m_swapchain->SetContentLight( m_maxCll, m_maxFall );
 
     const auto imageViews = m_swapchain->GetImageViews();
     const auto numImages = imageViews.size();
+    const auto numFrames = std::clamp<size_t>( m_framesInFlight == 0 ? DefaultFramesInFlight : m_framesInFlight, 1, numImages );
+
+    m_imageDamage.assign( numImages, ImageDamage { false, {} } );
 
     CheckPanic( m_frameData.empty(), "Frame data is not empty!" );
-    m_frameData.reserve( numImages );
-    for( size_t i=0; i<numImages; i++ )
+    m_frameData.reserve( numFrames );
+    for( size_t i=0; i<numFrames; i++ )
     {
         m_frameData.emplace_back( FrameData {
             .commandBuffer = std::make_shared<VlkCommandBuffer>( *m_vkDevice->GetCommandPool( QueueType::Graphic ), true ),
@@ -624,6 +898,19 @@ void WaylandWindow::CreateSwapchain( const VkExtent2D& extent )
             .presentFence = std::make_shared<VlkFence>( *m_vkDevice, VK_FENCE_CREATE_SIGNALED_BIT )
         } );
     }
+    if( m_frameIdx >= numFrames ) m_frameIdx = 0;
+
+    m_presentId = 0;
+    m_lastVblank = 0;
+
+    m_swapchainTime = GetTimeMicro();
+    m_swapchainCreateTime = float( m_swapchainTime - start );
+}
+
+// One re-creation per refresh, or less often if it takes a good part of the frame
+float WaylandWindow::ResizeInterval() const
+{
+    return std::max( m_refreshInterval == 0 ? 16667.f : m_refreshInterval, m_swapchainCreateTime * 4 );
 }
 
 void WaylandWindow::CleanupSwapchain( bool withSurface )
@@ -685,6 +972,9 @@ void WaylandWindow::SurfaceLeave( wl_surface* surface, wl_output* output )
 
 void WaylandWindow::SurfacePreferredBufferScale( wl_surface* surface, int32_t scale )
 {
+    if( m_fractionalScale || scale <= 0 ) return;
+    m_scale = scale * 120;
+    ResumeIfIdle();
 }
 
 void WaylandWindow::SurfacePreferredBufferTransform( wl_surface* surface, int32_t transform )
@@ -709,17 +999,20 @@ void WaylandWindow::XdgToplevelConfigure( struct xdg_toplevel* toplevel, int32_t
 {
     bool maximized = false;
     bool fullscreen = false;
+    bool resizing = false;
     for( size_t i=0; i < states->size / sizeof(uint32_t); i++ )
     {
         uint32_t state;
         memcpy( &state, (char*)states->data + i * sizeof( uint32_t ), sizeof( uint32_t ) );
         if( state == XDG_TOPLEVEL_STATE_MAXIMIZED ) maximized = true;
         if( state == XDG_TOPLEVEL_STATE_FULLSCREEN ) fullscreen = true;
+        if( state == XDG_TOPLEVEL_STATE_RESIZING ) resizing = true;
     }
 
     const auto wasMaximized = m_maximized;
     m_maximized = maximized;
     m_fullscreen = fullscreen;
+    m_resizing = resizing;
 
     if( width == 0 || height == 0 )
     {
@@ -764,3 +1057,67 @@ void WaylandWindow::FrameDone( struct wl_callback* cb, uint32_t time )
     wl_callback_destroy( cb );
     InvokeRender();
 }
+
+// The feedback applies to the next commit of the surface, which is done by the present
+void WaylandWindow::RequestPresentFeedback()
+{
+    auto presentation = m_display.Presentation();
+    if( !presentation ) return;
+
+    static constexpr wp_presentation_feedback_listener listener = {
+        .sync_output = Method( PresentationSyncOutput ),
+        .presented = Method( PresentationPresented ),
+        .discarded = Method( PresentationDiscarded )
+    };
+
+    auto feedback = wp_presentation_feedback( presentation, m_surface );
+    wp_presentation_feedback_add_listener( feedback, &listener, this );
+
+    timespec ts;
+    clock_gettime( m_display.PresentationClock(), &ts );
+    m_feedback.emplace_back( PendingFeedback { feedback, uint64_t( ts.tv_sec ) * 1000000000 + ts.tv_nsec } );
+}
+
+void WaylandWindow::PresentationSyncOutput( wp_presentation_feedback* feedback, wl_output* output )
+{
+}
+
+void WaylandWindow::PresentationPresented( wp_presentation_feedback* feedback, uint32_t secHi, uint32_t secLo, uint32_t nsec, uint32_t refresh, uint32_t seqHi, uint32_t seqLo, uint32_t flags )
+{
+    const auto submitted = TakeFeedback( feedback );
+    const auto presented = ( ( uint64_t( secHi ) << 32 ) | secLo ) * 1000000000 + nsec;
+    const auto sequence = ( uint64_t( seqHi ) << 32 ) | seqLo;
+
+    m_presentStats.presented++;
+    m_presentStats.latency = presented > submitted ? ( presented - submitted ) / 1000000.f : 0;
+    m_presentStats.refresh = refresh / 1000000.f;
+    m_presentStats.vsync = ( flags & WP_PRESENTATION_FEEDBACK_KIND_VSYNC ) != 0;
+    m_presentStats.zeroCopy = ( flags & WP_PRESENTATION_FEEDBACK_KIND_ZERO_COPY ) != 0;
+
+    TracyPlot( "Presentation latency (ms)", m_presentStats.latency );
+    TracyPlot( "Refresh interval (ms)", m_presentStats.refresh );
+    TracyPlot( "Zero copy", int64_t( m_presentStats.zeroCopy ) );
+
+    // The sequence counts refreshes, if the compositor knows it. More than one between frames is a missed refresh
+    // while rendering continuously, or just idle time.
+    if( sequence != 0 && m_lastSequence != 0 && sequence > m_lastSequence ) TracyPlot( "Refreshes per frame", int64_t( sequence - m_lastSequence ) );
+    m_lastSequence = sequence;
+}
+
+void WaylandWindow::PresentationDiscarded( wp_presentation_feedback* feedback )
+{
+    TakeFeedback( feedback );
+    m_presentStats.discarded++;
+}
+
+// Returns the submit time. The feedback object is gone after the event.
+uint64_t WaylandWindow::TakeFeedback( wp_presentation_feedback* feedback )
+{
+    wp_presentation_feedback_destroy( feedback );
+
+    auto it = std::ranges::find_if( m_feedback, [feedback]( const auto& v ) { return v.feedback == feedback; } );
+    CheckPanic( it != m_feedback.end(), "Unknown presentation feedback" );
+    const auto submitted = it->submitted;
+    m_feedback.erase( it );
+    return submitted;
+}
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <atomic>
+#include <functional>
 #include <memory>
 #include <string>
 #include <vector>
@@ -18,7 +19,9 @@
 #include "wayland-xdg-shell-client-protocol.h"
 #include "wayland-fractional-scale-client-protocol.h"
 #include "wayland-viewporter-client-protocol.h"
+#include "wayland-presentation-time-client-protocol.h"
 
+class DataBuffer;
 class SvgImage;
 class VlkCommandBuffer;
 class VlkDevice;
@@ -42,7 +45,33 @@ class WaylandWindow : public GarbageChute
         std::shared_ptr<VlkFence> presentFence;
     };
 
+    // Area of a swapchain image which is out of date, as other images were presented since it was last drawn
+    struct ImageDamage
+    {
+        bool valid;     // Contents were drawn in full at some point
+        VkRect2D rect;
+    };
+
+    struct PendingFeedback
+    {
+        wp_presentation_feedback* feedback;
+        uint64_t submitted;     // Nanoseconds, presentation clock
+    };
+
 public:
+    static constexpr uint32_t DefaultFramesInFlight = 2;
+
+    // From wp_presentation feedback of the presented frames. All zero if the compositor doesn't support it.
+    struct PresentStats
+    {
+        uint64_t presented;     // Frames which reached the screen
+        uint64_t discarded;     // Frames which were replaced before they were shown
+        float latency;          // Milliseconds from present to display, of the last frame
+        float refresh;          // Milliseconds, zero if the refresh rate is variable or unknown
+        bool vsync;
+        bool zeroCopy;          // Scanned out directly, without composition
+    };
+
     struct Listener
     {
         void (*OnClose)( void* ptr );
@@ -71,6 +100,8 @@ public:
     void SetAppId( const char* appId );
     void SetTitle( const char* title );
     void SetIcon( const SvgImage& icon );
+    // Rasters made by the rasterize helper. Sizes the compositor asks for which are not among them are rendered from the SVG.
+    void SetIcon( const DataBuffer& rasters, std::shared_ptr<DataBuffer> svg );
     void Resize( uint32_t width, uint32_t height, bool reposition = false );             // Window size in real pixels
     void ResizeNoScale( uint32_t width, uint32_t height, bool reposition = false );      // Window size in logical pixels (1.0 scale)
     void LockSize();
@@ -80,9 +111,19 @@ public:
     void Close();
     void Activate( const char* token );
     void EnableHdr( bool enable );
+    // Light levels of the shown content in nits, passed to the compositor with HDR swapchains. Zero if unknown.
+    void SetContentLight( float maxCll, float maxFall );
+
+    // Used when the swapchain is created next. Zero counts pick the defaults. Each frame in flight has its own
+    // command buffer, semaphores and fences, so that recording of a frame overlaps GPU execution of the previous
+    // ones. There can't be more frames in flight than swapchain images. Fewer frames in flight lower the latency,
+    // at the cost of less overlap between the CPU and the GPU.
+    void SetPresentMode( VkPresentModeKHR mode, uint32_t imageCount = 0, uint32_t framesInFlight = 0 );
 
+    // Damage is the part of the window which changed since the last frame, in real pixels, null if everything did.
+    // Only GetRenderArea() has to be drawn, the rest of the image is kept.
     void Update();
-    VlkCommandBuffer& BeginFrame();
+    VlkCommandBuffer& BeginFrame( const VkRect2D* damage = nullptr );
     void EndFrame();
 
     VkImage GetImage();
@@ -91,6 +132,8 @@ public:
 
     void SetListener( const Listener* listener, void* listenerPtr );
     void SetDevice( std::shared_ptr<VlkDevice> device );
+    // Makes HdrCapable() valid before the device is set. SetDevice() does this too.
+    void QuerySurfaceFormats( VkPhysicalDevice physDev );
     void SetCursor( WaylandCursor cursor );
     void WarpPointer( float x, float y );
 
@@ -98,6 +141,7 @@ public:
     void ResumeIfIdle();
 
     [[nodiscard]] const VkExtent2D& GetSize() const { return m_swapchain->GetExtent(); }    // Swapchain extent, i.e. render area in real pixels
+    [[nodiscard]] const VkRect2D& GetRenderArea() const { return m_renderArea; }            // Valid between BeginFrame() and EndFrame()
     [[nodiscard]] const VkExtent2D& GetSizeNoScale() const { return m_extent; }             // Logical window size, i.e. pixels at 1.0 DPI scaling
     [[nodiscard]] const VkExtent2D& GetSizeFloating() const { return m_floatingExtent; }    // Logical window size
     [[nodiscard]] const char* GetTitle() const { return m_title.c_str(); }
@@ -105,8 +149,10 @@ public:
     [[nodiscard]] VkExtent2D GetBounds() const { return VkExtent2D { m_bounds.width * m_scale / 120, m_bounds.height * m_scale / 120 }; }
     [[nodiscard]] const VkExtent2D& GetBoundsNoScale() const { return m_bounds; }
     [[nodiscard]] bool HdrCapable() const { return m_hdrCapable; }
+    [[nodiscard]] VkFormat GetSwapchainFormat( bool hdr ) const { return hdr ? m_hdrFormat : m_sdrFormat; }     // VK_FORMAT_UNDEFINED if not available
     [[nodiscard]] bool IsMaximized() const { return m_maximized; }
     [[nodiscard]] bool IsFullscreen() const { return m_fullscreen; }
+    [[nodiscard]] const PresentStats& GetPresentStats() const { return m_presentStats; }
 
     [[nodiscard]] wl_surface* Surface() { return m_surface; }
     [[nodiscard]] xdg_toplevel* XdgToplevel() { return m_xdgToplevel; }
@@ -127,6 +173,7 @@ public:
 
 private:
     void Destroy();
+    void UploadIcon( const std::function<void( int32_t, uint32_t* )>& fill );
 
     void InvokeClipboard( const unordered_flat_set<std::string>& mimeTypes );
     void InvokeDrag( const unordered_flat_set<std::string>& mimeTypes );
@@ -138,6 +185,12 @@ private:
     void InvokeMouseMove( float x, float y );
     void InvokeMouseButton( uint32_t button, bool pressed );
     void InvokeScroll( const WaylandScroll& scroll );
+    void FlushInput();
+
+    void PaceFrame();
+
+    void SetDestination( const VkExtent2D& extent );
+    [[nodiscard]] float ResizeInterval() const;
 
     void CreateSwapchain( const VkExtent2D& extent );
     void CleanupSwapchain( bool withSurface = false );
@@ -161,6 +214,12 @@ private:
 
     void FrameDone( struct wl_callback* cb, uint32_t time );
 
+    void RequestPresentFeedback();
+    void PresentationSyncOutput( wp_presentation_feedback* feedback, wl_output* output );
+    void PresentationPresented( wp_presentation_feedback* feedback, uint32_t secHi, uint32_t secLo, uint32_t nsec, uint32_t refresh, uint32_t seqHi, uint32_t seqLo, uint32_t flags );
+    void PresentationDiscarded( wp_presentation_feedback* feedback );
+    [[nodiscard]] uint64_t TakeFeedback( wp_presentation_feedback* feedback );
+
     WaylandDisplay& m_display;
     wl_surface* m_surface;
     xdg_surface* m_xdgSurface;
@@ -177,14 +236,38 @@ private:
     const Listener* m_listener = nullptr;
     void* m_listenerPtr;
 
+    VkPresentModeKHR m_presentMode = VK_PRESENT_MODE_FIFO_KHR;
+    uint32_t m_imageCount = 0;
+    uint32_t m_framesInFlight = 0;
+
     std::vector<FrameData> m_frameData;
     uint32_t m_frameIdx = 0;
     uint32_t m_imageIdx;
+
+    static constexpr float MinPacingMargin = 1000;
+
+    // Frame pacing with present wait, times in microseconds. The present id is zero if there is nothing to wait for.
+    uint64_t m_presentId = 0;
+    uint64_t m_frameStart = 0;
+    uint64_t m_lastVblank = 0;
+    float m_refreshInterval = 0;
+    float m_renderTime = 0;
+    float m_pacingMargin = MinPacingMargin;
+
+    std::vector<PendingFeedback> m_feedback;
+    PresentStats m_presentStats = {};
+    uint64_t m_lastSequence = 0;
+
+    std::vector<ImageDamage> m_imageDamage;
+    VkRect2D m_frameDamage;
+    VkRect2D m_renderArea;
     std::atomic<std::shared_ptr<VlkFence>> m_currentRenderFence;
 
     std::mutex m_stateLock;
 
     bool m_hdrCapable;
+    VkFormat m_sdrFormat = VK_FORMAT_UNDEFINED;
+    VkFormat m_hdrFormat = VK_FORMAT_UNDEFINED;
 
     uint32_t m_scale = 120;
     uint32_t m_prevScale = 0;
@@ -195,6 +278,9 @@ private:
     int m_maxLuminance = 0;
     int m_prevMaxLuminance = 0;
 
+    float m_maxCll = 0;
+    float m_maxFall = 0;
+
     VkExtent2D m_extent;
     VkExtent2D m_staged;
     VkExtent2D m_floatingExtent;
@@ -202,6 +288,21 @@ private:
     bool m_maximized = false;
     bool m_fullscreen = false;
 
+    // Swapchain re-creation is throttled during interactive resize, with the viewport stretching the last frame
+    // to the new size meanwhile. Times in microseconds.
+    bool m_resizing = false;
+    bool m_resizeDeferred = false;
+    uint64_t m_swapchainTime = 0;
+    float m_swapchainCreateTime = 0;
+
+    // While frames are rendered, motion and smooth scrolling are coalesced and delivered once per frame.
+    // Input handlers and rendering both run on the display thread.
+    bool m_motionPending = false;
+    float m_motionX;
+    float m_motionY;
+    bool m_scrollPending = false;
+    WaylandScroll m_pendingScroll;
+
     std::atomic<bool> m_idle;
     std::atomic<WaylandCursor> m_cursor;
 
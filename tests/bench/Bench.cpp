@@ -0,0 +1,85 @@
+#include <algorithm>
+#include <catch2/catch_all.hpp>
+#include <mutex>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <thread>
+#include <unordered_map>
+
+#include <src/util/SimdDispatch.hpp>
+#include <src/util/TaskDispatch.hpp>
+
+#include "Bench.hpp"
+
+namespace
+{
+struct Items
+{
+    size_t count;
+    const char* unit;
+};
+
+std::mutex s_lock;
+std::unordered_map<std::string, Items> s_items;
+
+class ThroughputListener : public Catch::EventListenerBase
+{
+public:
+    using Catch::EventListenerBase::EventListenerBase;
+
+    void testRunStarting( const Catch::TestRunInfo& ) override
+    {
+        printf( "SIMD level: %s, dispatched %s, %zu workers\n", SimdLevel(), SimdLevelName( GetSimdLevel() ), BenchDispatch().NumWorkers() );
+    }
+
+    void benchmarkEnded( const Catch::BenchmarkStats<>& stats ) override
+    {
+        Items items;
+        {
+            std::lock_guard lock( s_lock );
+            auto it = s_items.find( stats.info.name );
+            if( it == s_items.end() ) return;
+            items = it->second;
+        }
+        const auto ns = stats.mean.point.count();
+        if( ns > 0 ) printf( "%s: %.1f %s\n", stats.info.name.c_str(), items.count * 1000. / ns, items.unit );
+    }
+
+    void testRunEnded( const Catch::TestRunStats& ) override
+    {
+        struct rusage usage;
+        getrusage( RUSAGE_SELF, &usage );
+        printf( "Peak RSS: %.1f MiB\n", usage.ru_maxrss / 1024. );
+    }
+};
+}
+
+CATCH_REGISTER_LISTENER( ThroughputListener )
+
+std::string Throughput( const std::string& name, size_t items, const char* unit )
+{
+    std::lock_guard lock( s_lock );
+    s_items[name] = { items, unit };
+    return name;
+}
+
+TaskDispatch& BenchDispatch()
+{
+    static TaskDispatch td( std::max( 1u, std::thread::hardware_concurrency() - 1 ), "Worker" );
+    return td;
+}
+
+const char* SimdLevel()
+{
+#if defined __AVX512F__
+    return "AVX-512";
+#elif defined __AVX2__
+    return "AVX2";
+#elif defined __SSE4_1__
+    return "SSE4.1";
+#elif defined __ARM_NEON
+    return "NEON";
+#else
+    return "scalar";
+#endif
+}
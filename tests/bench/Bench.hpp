@@ -0,0 +1,17 @@
+#pragma once
+
+#include <stddef.h>
+#include <string>
+
+class TaskDispatch;
+
+// Benchmark name which the listener reports with millions of items per second, next to the timings of Catch2.
+// Items are pixels, unless another unit is given.
+std::string Throughput( const std::string& name, size_t items, const char* unit = "MP/s" );
+
+// Worker pool shared by the benchmarks, sized to the machine, as the viewers do
+TaskDispatch& BenchDispatch();
+
+// Instruction set the compile time SIMD paths were built for. Build with MARCH_NATIVE off, or different
+// -march flags, to compare levels. Dispatched kernels pick theirs at run time, which MCORE_SIMD can lower.
+const char* SimdLevel();
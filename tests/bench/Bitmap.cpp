@@ -0,0 +1,46 @@
+#include <catch2/catch_all.hpp>
+
+#include <src/util/Bitmap.hpp>
+#include <src/util/BitmapHdr.hpp>
+#include <src/util/TaskDispatch.hpp>
+
+#include "Bench.hpp"
+#include "Corpus.hpp"
+
+TEST_CASE( "Bitmap", "[bench][bitmap]" )
+{
+    auto& td = BenchDispatch();
+    auto bmp = CorpusBitmap();
+    const size_t pixels = size_t( bmp->Width() ) * bmp->Height();
+
+    // Throughput is given in source pixels
+    BENCHMARK( Throughput( "ResizeNew half", pixels ) ) { return bmp->ResizeNew( bmp->Width() / 2, bmp->Height() / 2, &td ); };
+    BENCHMARK( Throughput( "ResizeNew 1920x1080", pixels ) ) { return bmp->ResizeNew( 1920, 1080, &td ); };
+    BENCHMARK( Throughput( "ResizeNew 1920x1080 single thread", pixels ) ) { return bmp->ResizeNew( 1920, 1080 ); };
+
+    // In place, the image alternates between both orientations
+    BENCHMARK( Throughput( "Rotate90", pixels ) ) { bmp->Rotate90( &td ); };
+    BENCHMARK( Throughput( "Rotate90 single thread", pixels ) ) { bmp->Rotate90(); };
+}
+
+TEST_CASE( "BitmapHdr", "[bench][bitmap]" )
+{
+    auto& td = BenchDispatch();
+    auto bmp = CorpusBitmapHdr();
+    const size_t pixels = size_t( bmp->Width() ) * bmp->Height();
+
+    BENCHMARK( Throughput( "HDR ResizeNew 1920x1080", pixels ) ) { return bmp->ResizeNew( 1920, 1080, &td ); };
+    BENCHMARK( Throughput( "HDR Rotate90", pixels ) ) { bmp->Rotate90( &td ); };
+
+    bool wide = false;
+    BENCHMARK( Throughput( "HDR SetColorspace", pixels ) )
+    {
+        wide = !wide;
+        bmp->SetColorspace( wide ? Colorspace::BT2020 : Colorspace::BT709, &td );
+    };
+    BENCHMARK( Throughput( "HDR SetColorspace single thread", pixels ) )
+    {
+        wide = !wide;
+        bmp->SetColorspace( wide ? Colorspace::BT2020 : Colorspace::BT709 );
+    };
+}
@@ -0,0 +1,359 @@
+#include <algorithm>
+#include <catch2/catch_all.hpp>
+#include <dirent.h>
+#include <jpeglib.h>
+#include <jxl/encode.h>
+#include <libheif/heif.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <tiffio.h>
+#include <webp/encode.h>
+
+#include <src/image/ImageLoader.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/BitmapHdr.hpp>
+#include <src/util/ExrWriter.hpp>
+
+#include "Bench.hpp"
+#include "Corpus.hpp"
+#include "../util/TestUtils.hpp"
+
+namespace
+{
+constexpr uint32_t Width = 2048;
+constexpr uint32_t Height = 1536;
+constexpr int Quality = 90;
+
+// Fixed seed, so that every run encodes the same files
+class Random
+{
+public:
+    uint32_t operator()()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+
+private:
+    uint32_t m_state = 0x9E3779B9;
+};
+
+// Smooth gradients with some noise on top, so that neither the predictors nor the transforms have it too easy
+float Sample( uint32_t x, uint32_t y, int channel, Random& rnd )
+{
+    const auto fx = float( x ) / Width;
+    const auto fy = float( y ) / Height;
+    float v;
+    switch( channel )
+    {
+    case 0: v = fx; break;
+    case 1: v = fy; break;
+    default: v = 0.5f + 0.5f * sinf( ( fx + fy ) * 12.f ); break;
+    }
+    return v + ( int( rnd() & 0xF ) - 8 ) / 255.f;
+}
+
+bool WriteFile( const std::string& path, const void* data, size_t size )
+{
+    FILE* f = fopen( path.c_str(), "wb" );
+    if( !f ) return false;
+    const auto ok = fwrite( data, 1, size, f ) == size;
+    fclose( f );
+    return ok;
+}
+
+bool SaveJpeg( const Bitmap& bmp, const std::string& path )
+{
+    FILE* f = fopen( path.c_str(), "wb" );
+    if( !f ) return false;
+
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error( &jerr );
+    jpeg_create_compress( &cinfo );
+    jpeg_stdio_dest( &cinfo, f );
+    cinfo.image_width = bmp.Width();
+    cinfo.image_height = bmp.Height();
+    cinfo.input_components = 4;
+    cinfo.in_color_space = JCS_EXT_RGBA;
+    jpeg_set_defaults( &cinfo );
+    jpeg_set_quality( &cinfo, Quality, TRUE );
+    jpeg_start_compress( &cinfo, TRUE );
+    while( cinfo.next_scanline < cinfo.image_height )
+    {
+        JSAMPROW row = (JSAMPROW)bmp.Data() + size_t( cinfo.next_scanline ) * bmp.Width() * 4;
+        jpeg_write_scanlines( &cinfo, &row, 1 );
+    }
+    jpeg_finish_compress( &cinfo );
+    jpeg_destroy_compress( &cinfo );
+    fclose( f );
+    return true;
+}
+
+bool SaveWebp( const Bitmap& bmp, const std::string& path )
+{
+    uint8_t* out;
+    const auto size = WebPEncodeRGBA( bmp.Data(), bmp.Width(), bmp.Height(), bmp.Width() * 4, Quality, &out );
+    if( size == 0 ) return false;
+    const auto ok = WriteFile( path, out, size );
+    WebPFree( out );
+    return ok;
+}
+
+bool SaveTiff( const Bitmap& bmp, const std::string& path )
+{
+    auto tiff = TIFFOpen( path.c_str(), "w" );
+    if( !tiff ) return false;
+
+    const uint16_t extra = EXTRASAMPLE_UNASSALPHA;
+    TIFFSetField( tiff, TIFFTAG_IMAGEWIDTH, bmp.Width() );
+    TIFFSetField( tiff, TIFFTAG_IMAGELENGTH, bmp.Height() );
+    TIFFSetField( tiff, TIFFTAG_SAMPLESPERPIXEL, 4 );
+    TIFFSetField( tiff, TIFFTAG_BITSPERSAMPLE, 8 );
+    TIFFSetField( tiff, TIFFTAG_EXTRASAMPLES, 1, &extra );
+    TIFFSetField( tiff, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_RGB );
+    TIFFSetField( tiff, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG );
+    TIFFSetField( tiff, TIFFTAG_COMPRESSION, COMPRESSION_ADOBE_DEFLATE );
+    TIFFSetField( tiff, TIFFTAG_ROWSPERSTRIP, 64 );
+
+    bool ok = true;
+    for( uint32_t y=0; y<bmp.Height() && ok; y++ )
+    {
+        ok = TIFFWriteScanline( tiff, (void*)( bmp.Data() + size_t( y ) * bmp.Width() * 4 ), y ) == 1;
+    }
+    TIFFClose( tiff );
+    return ok;
+}
+
+bool SaveJxl( const Bitmap& bmp, const std::string& path )
+{
+    auto enc = JxlEncoderCreate( nullptr );
+
+    JxlBasicInfo info;
+    JxlEncoderInitBasicInfo( &info );
+    info.xsize = bmp.Width();
+    info.ysize = bmp.Height();
+    info.bits_per_sample = 8;
+    info.num_extra_channels = 1;
+    info.alpha_bits = 8;
+    info.uses_original_profile = JXL_FALSE;
+
+    JxlColorEncoding color;
+    JxlColorEncodingSetToSRGB( &color, JXL_FALSE );
+
+    const JxlPixelFormat format = { 4, JXL_TYPE_UINT8, JXL_NATIVE_ENDIAN, 0 };
+    bool ok = JxlEncoderSetBasicInfo( enc, &info ) == JXL_ENC_SUCCESS && JxlEncoderSetColorEncoding( enc, &color ) == JXL_ENC_SUCCESS;
+    if( ok )
+    {
+        auto settings = JxlEncoderFrameSettingsCreate( enc, nullptr );
+        JxlEncoderFrameSettingsSetOption( settings, JXL_ENC_FRAME_SETTING_EFFORT, 3 );
+        JxlEncoderSetFrameDistance( settings, 1.f );
+        ok = JxlEncoderAddImageFrame( settings, &format, bmp.Data(), size_t( bmp.Width() ) * bmp.Height() * 4 ) == JXL_ENC_SUCCESS;
+        JxlEncoderCloseInput( enc );
+    }
+
+    std::vector<uint8_t> out( 1024 * 1024 );
+    size_t used = 0;
+    while( ok )
+    {
+        auto next = out.data() + used;
+        auto avail = out.size() - used;
+        const auto res = JxlEncoderProcessOutput( enc, &next, &avail );
+        used = next - out.data();
+        if( res == JXL_ENC_SUCCESS ) break;
+        if( res != JXL_ENC_NEED_MORE_OUTPUT ) ok = false;
+        else out.resize( out.size() * 2 );
+    }
+    JxlEncoderDestroy( enc );
+    return ok && WriteFile( path, out.data(), used );
+}
+
+// Not every libheif build comes with an HEVC encoder
+bool SaveHeif( const Bitmap& bmp, const std::string& path )
+{
+    auto ctx = heif_context_alloc();
+    heif_encoder* enc;
+    if( heif_context_get_encoder_for_format( ctx, heif_compression_HEVC, &enc ).code != heif_error_Ok )
+    {
+        heif_context_free( ctx );
+        return false;
+    }
+    heif_encoder_set_lossy_quality( enc, Quality );
+
+    heif_image* img;
+    heif_image_create( bmp.Width(), bmp.Height(), heif_colorspace_RGB, heif_chroma_interleaved_RGBA, &img );
+    heif_image_add_plane( img, heif_channel_interleaved, bmp.Width(), bmp.Height(), 8 );
+    int stride;
+    auto dst = heif_image_get_plane( img, heif_channel_interleaved, &stride );
+    for( uint32_t y=0; y<bmp.Height(); y++ )
+    {
+        memcpy( dst + size_t( y ) * stride, bmp.Data() + size_t( y ) * bmp.Width() * 4, bmp.Width() * 4 );
+    }
+
+    bool ok = heif_context_encode_image( ctx, img, enc, nullptr, nullptr ).code == heif_error_Ok;
+    if( ok ) ok = heif_context_write_to_file( ctx, path.c_str() ).code == heif_error_Ok;
+
+    heif_image_release( img );
+    heif_encoder_release( enc );
+    heif_context_free( ctx );
+    return ok;
+}
+
+bool SaveExr( const BitmapHdr& bmp, const std::string& path )
+{
+    ExrWriter writer( path.c_str(), bmp.Width(), bmp.Height(), ExrWriter::Compression::Zip, &BenchDispatch() );
+    writer.Write( bmp.Data(), bmp.Height() );
+    return writer.IsValid();
+}
+
+// Any bit pattern is a valid BC1, BC7 or ETC2 block
+std::vector<uint32_t> RandomBlocks( size_t words )
+{
+    Random rnd;
+    std::vector<uint32_t> ret( words );
+    for( auto& v : ret ) v = rnd();
+    return ret;
+}
+
+bool SaveDds( const std::string& path, bool bc7 )
+{
+    uint32_t hdr[37] = {};
+    hdr[0] = 0x20534444;        // DDS
+    hdr[1] = 124;
+    hdr[2] = 0x1007 | 0x80000;  // DDSD_CAPS, HEIGHT, WIDTH, PIXELFORMAT, LINEARSIZE
+    hdr[3] = Height;
+    hdr[4] = Width;
+    hdr[19] = 32;
+    hdr[20] = 0x4;              // DDPF_FOURCC
+    hdr[27] = 0x1000;           // DDSCAPS_TEXTURE
+    if( bc7 )
+    {
+        hdr[5] = Width * Height;
+        hdr[21] = 0x30315844;   // DX10
+        hdr[32] = 98;           // DXGI_FORMAT_BC7_UNORM
+        hdr[33] = 3;            // D3D10_RESOURCE_DIMENSION_TEXTURE2D
+        hdr[35] = 1;
+    }
+    else
+    {
+        hdr[5] = Width * Height / 2;
+        hdr[21] = 0x31545844;   // DXT1
+    }
+
+    const auto blocks = RandomBlocks( hdr[5] / 4 );
+    std::vector<char> file( bc7 ? 148 : 128 );
+    memcpy( file.data(), hdr, file.size() );
+    file.insert( file.end(), (const char*)blocks.data(), (const char*)( blocks.data() + blocks.size() ) );
+    return WriteFile( path, file.data(), file.size() );
+}
+
+bool SavePvr( const std::string& path )
+{
+    uint32_t hdr[13] = {};
+    hdr[0] = 0x03525650;        // PVR3
+    hdr[2] = 22;                // ETC2 RGB
+    hdr[6] = Height;
+    hdr[7] = Width;
+    hdr[8] = hdr[9] = hdr[10] = hdr[11] = 1;
+
+    const auto blocks = RandomBlocks( Width * Height / 8 );
+    std::vector<char> file( sizeof( hdr ) );
+    memcpy( file.data(), hdr, sizeof( hdr ) );
+    file.insert( file.end(), (const char*)blocks.data(), (const char*)( blocks.data() + blocks.size() ) );
+    return WriteFile( path, file.data(), file.size() );
+}
+
+void AddExternal( std::vector<CorpusFile>& corpus, const char* dirName )
+{
+    DIR* dir = opendir( dirName );
+    if( !dir ) return;
+
+    std::vector<std::string> files;
+    struct dirent* entry;
+    while( ( entry = readdir( dir ) ) )
+    {
+        auto path = std::string( dirName ) + "/" + entry->d_name;
+        if( IsLoadableImage( path.c_str() ) ) files.emplace_back( std::move( path ) );
+    }
+    closedir( dir );
+    std::ranges::sort( files );
+
+    for( auto& path : files )
+    {
+        auto loader = GetImageLoader( path.c_str(), ToneMap::Operator::PbrNeutral );
+        if( !loader ) continue;
+        const auto info = loader->Probe();
+        if( info.width == 0 ) continue;
+        corpus.emplace_back( CorpusFile { path.substr( path.find_last_of( '/' ) + 1 ), path, size_t( info.width ) * info.height } );
+    }
+}
+}
+
+std::unique_ptr<Bitmap> CorpusBitmap()
+{
+    Random rnd;
+    auto bmp = std::make_unique<Bitmap>( Width, Height );
+    auto ptr = bmp->Data();
+    for( uint32_t y=0; y<Height; y++ )
+    {
+        for( uint32_t x=0; x<Width; x++ )
+        {
+            for( int c=0; c<3; c++ ) *ptr++ = uint8_t( std::clamp( Sample( x, y, c, rnd ), 0.f, 1.f ) * 255.f + 0.5f );
+            *ptr++ = 255;
+        }
+    }
+    return bmp;
+}
+
+std::unique_ptr<BitmapHdr> CorpusBitmapHdr()
+{
+    Random rnd;
+    auto bmp = std::make_unique<BitmapHdr>( Width, Height, Colorspace::BT709 );
+    auto ptr = bmp->Data();
+    for( uint32_t y=0; y<Height; y++ )
+    {
+        for( uint32_t x=0; x<Width; x++ )
+        {
+            // Highlights up to 8 times the SDR white
+            for( int c=0; c<3; c++ ) *ptr++ = std::max( 0.f, Sample( x, y, c, rnd ) ) * ( 1.f + 7.f * float( x ) / Width );
+            *ptr++ = 1.f;
+        }
+    }
+    return bmp;
+}
+
+const std::vector<CorpusFile>& Corpus()
+{
+    static TempDir dir = TempDir::create();
+    static const std::vector<CorpusFile> corpus = [] {
+        std::vector<CorpusFile> ret;
+        const auto bmp = CorpusBitmap();
+        const auto hdr = CorpusBitmapHdr();
+        const size_t pixels = size_t( Width ) * Height;
+
+        auto add = [&]( const char* name, const char* file, bool ok ) {
+            const auto path = dir.filePath( file );
+            if( ok ) ret.emplace_back( CorpusFile { name, path, pixels } );
+            else WARN( "No " << name << " file in corpus" );
+        };
+
+        add( "PNG", "image.png", bmp->SavePng( dir.filePath( "image.png" ).c_str(), &BenchDispatch() ) );
+        add( "JPEG", "image.jpg", SaveJpeg( *bmp, dir.filePath( "image.jpg" ) ) );
+        add( "JXL", "image.jxl", SaveJxl( *bmp, dir.filePath( "image.jxl" ) ) );
+        add( "HEIF", "image.heic", SaveHeif( *bmp, dir.filePath( "image.heic" ) ) );
+        add( "WebP", "image.webp", SaveWebp( *bmp, dir.filePath( "image.webp" ) ) );
+        add( "TIFF", "image.tiff", SaveTiff( *bmp, dir.filePath( "image.tiff" ) ) );
+        add( "EXR", "image.exr", SaveExr( *hdr, dir.filePath( "image.exr" ) ) );
+        add( "DDS BC1", "bc1.dds", SaveDds( dir.filePath( "bc1.dds" ), false ) );
+        add( "DDS BC7", "bc7.dds", SaveDds( dir.filePath( "bc7.dds" ), true ) );
+        add( "PVR ETC2", "etc2.pvr", SavePvr( dir.filePath( "etc2.pvr" ) ) );
+
+        if( auto external = getenv( "MCORE_BENCH_CORPUS" ) ) AddExternal( ret, external );
+        return ret;
+    }();
+    return corpus;
+}
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <memory>
+#include <stddef.h>
+#include <string>
+#include <vector>
+
+class Bitmap;
+class BitmapHdr;
+
+struct CorpusFile
+{
+    std::string name;
+    std::string path;
+    size_t pixels;
+};
+
+// The same generated image, a mix of gradients and noise, encoded in each format there is an encoder for, with
+// fixed settings. Block compressed formats are filled with random blocks. Formats without an encoder at hand,
+// such as camera raw files, are read from the directory in MCORE_BENCH_CORPUS, if it is set. Built on first use.
+const std::vector<CorpusFile>& Corpus();
+
+// Source images of the corpus
+[[nodiscard]] std::unique_ptr<Bitmap> CorpusBitmap();
+[[nodiscard]] std::unique_ptr<BitmapHdr> CorpusBitmapHdr();
@@ -0,0 +1,35 @@
+#include <catch2/catch_all.hpp>
+
+#include <src/image/ImageLoader.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/BitmapHdr.hpp>
+
+#include "Bench.hpp"
+#include "Corpus.hpp"
+
+// Includes opening the file and parsing the headers, as the viewers pay for that too. The files are in the page
+// cache after the first run.
+TEST_CASE( "Decode", "[bench][decode]" )
+{
+    auto& td = BenchDispatch();
+    for( auto& file : Corpus() )
+    {
+        auto probe = GetImageLoader( file.path.c_str(), ToneMap::Operator::PbrNeutral, &td );
+        REQUIRE( probe );
+
+        BENCHMARK( Throughput( file.name + " decode", file.pixels ) )
+        {
+            auto loader = GetImageLoader( file.path.c_str(), ToneMap::Operator::PbrNeutral, &td );
+            return loader->Load();
+        };
+
+        if( probe->IsHdr() )
+        {
+            BENCHMARK( Throughput( file.name + " decode HDR", file.pixels ) )
+            {
+                auto loader = GetImageLoader( file.path.c_str(), ToneMap::Operator::PbrNeutral, &td );
+                return loader->LoadHdr();
+            };
+        }
+    }
+}
@@ -0,0 +1,92 @@
+#include <algorithm>
+#include <catch2/catch_all.hpp>
+#include <stdint.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <src/util/TaskDispatch.hpp>
+
+#include "Bench.hpp"
+
+namespace
+{
+// Powers of two up to the machine size, and the machine size itself
+std::vector<size_t> WorkerCounts()
+{
+    const size_t max = std::max( 1u, std::thread::hardware_concurrency() - 1 );
+    std::vector<size_t> ret;
+    for( size_t i=1; i<max; i*=2 ) ret.emplace_back( i );
+    ret.emplace_back( max );
+    return ret;
+}
+
+std::string Name( const char* what, size_t workers )
+{
+    return std::string( what ) + ", " + std::to_string( workers ) + " workers";
+}
+}
+
+TEST_CASE( "TaskDispatch scaling", "[bench][taskdispatch]" )
+{
+    constexpr size_t Jobs = 16 * 1024;
+    constexpr size_t ChunkPixels = 16 * 1024;
+    constexpr size_t Pixels = 256 * ChunkPixels;
+    constexpr size_t Fanout = 64;
+
+    std::vector<uint32_t> buf( Pixels, 0x80402010 );
+
+    for( auto workers : WorkerCounts() )
+    {
+        TaskDispatch td( workers, "Bench" );
+
+        // Queueing and dispatch overhead only
+        BENCHMARK( Throughput( Name( "Empty jobs", workers ), Jobs, "M jobs/s" ) )
+        {
+            TaskGroup group;
+            for( size_t i=0; i<Jobs; i++ ) td.Queue( group, [] {} );
+            group.Wait();
+        };
+
+        // Chunks of the size the image operations use, with a light per pixel cost
+        BENCHMARK( Throughput( Name( "16K pixel chunks", workers ), Pixels ) )
+        {
+            td.ParallelFor( 0, Pixels, ChunkPixels, [&]( size_t begin, size_t end ) {
+                for( size_t i=begin; i<end; i++ )
+                {
+                    const auto v = buf[i];
+                    buf[i] = ( v & 0xFF00FF00 ) | ( ( v >> 16 ) & 0xFF ) | ( ( v & 0xFF ) << 16 );
+                }
+            } );
+        };
+
+        // Fork and join from within jobs, as loaders do when they split their work on a worker
+        BENCHMARK( Throughput( Name( "Nested groups", workers ), Fanout * Fanout, "M jobs/s" ) )
+        {
+            TaskGroup outer;
+            for( size_t i=0; i<Fanout; i++ )
+            {
+                td.Queue( outer, [&td] {
+                    TaskGroup inner;
+                    for( size_t j=0; j<Fanout; j++ ) td.Queue( inner, [] {} );
+                    inner.Wait();
+                } );
+            }
+            outer.Wait();
+        };
+
+        // Everything queued from several threads at once, waited for with Sync()
+        BENCHMARK( Throughput( Name( "Contended producers", workers ), Jobs, "M jobs/s" ) )
+        {
+            std::vector<std::thread> producers;
+            for( size_t t=0; t<4; t++ )
+            {
+                producers.emplace_back( [&td] {
+                    for( size_t i=0; i<Jobs/4; i++ ) td.Queue( [] {} );
+                } );
+            }
+            for( auto& t : producers ) t.join();
+            td.Sync();
+        };
+    }
+}
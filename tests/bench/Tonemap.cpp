@@ -0,0 +1,37 @@
+#include <catch2/catch_all.hpp>
+#include <string>
+#include <vector>
+
+#include <src/util/BitmapHdr.hpp>
+#include <src/util/Tonemapper.hpp>
+
+#include "Bench.hpp"
+#include "Corpus.hpp"
+
+TEST_CASE( "Tone mapping", "[bench][tonemap]" )
+{
+    auto bmp = CorpusBitmapHdr();
+    const size_t pixels = size_t( bmp->Width() ) * bmp->Height();
+    std::vector<uint32_t> dst( pixels );
+
+    const std::pair<ToneMap::Operator, const char*> operators[] = {
+        { ToneMap::Operator::AgX, "AgX" },
+        { ToneMap::Operator::AgXGolden, "AgX Golden" },
+        { ToneMap::Operator::AgXPunchy, "AgX Punchy" },
+        { ToneMap::Operator::PbrNeutral, "PBR Neutral" }
+    };
+
+    const auto lutMode = ToneMap::LutMode();
+    for( auto lut : { false, true } )
+    {
+        ToneMap::SetLutMode( lut );
+        for( auto& [op, name] : operators )
+        {
+            BENCHMARK( Throughput( std::string( "ToneMap " ) + name + ( lut ? " LUT" : "" ), pixels ) )
+            {
+                ToneMap::Process( op, dst.data(), bmp->Data(), pixels );
+            };
+        }
+    }
+    ToneMap::SetLutMode( lutMode );
+}
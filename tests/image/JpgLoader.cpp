@@ -0,0 +1,195 @@
+#include <catch2/catch_all.hpp>
+
+#include <algorithm>
+#include <jpeglib.h>
+#include <memory>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+#include <src/image/JpgLoader.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/BitmapDct.hpp>
+#include <src/util/DataBuffer.hpp>
+#include <src/util/TaskDispatch.hpp>
+
+namespace
+{
+struct JpgFile : public DataBuffer
+{
+    explicit JpgFile( std::vector<uint8_t>&& file ) : DataBuffer( (const char*)file.data(), file.size() ), m_file( std::move( file ) ) {}
+
+    std::vector<uint8_t> m_file;
+};
+
+// A pattern with detail in every channel, so that chroma upsampling across the strip bounds shows. Input is RGB,
+// or CMYK, which the Adobe segment written by libjpeg marks as YCCK, when ycck is set.
+std::shared_ptr<DataBuffer> Encode( uint32_t width, uint32_t height, bool cmyk, bool ycck, int hSamp, int vSamp )
+{
+    const int comps = cmyk ? 4 : 3;
+    std::vector<uint8_t> pixels( size_t( width ) * height * comps );
+    auto ptr = pixels.data();
+    for( uint32_t y=0; y<height; y++ )
+    {
+        for( uint32_t x=0; x<width; x++ )
+        {
+            for( int c=0; c<comps; c++ ) *ptr++ = ( x * ( c + 3 ) + y * ( 7 - c ) + ( ( ( x ^ y ) * 13 ) >> c ) ) & 0xFF;
+        }
+    }
+
+    jpeg_compress_struct cinfo;
+    jpeg_error_mgr jerr;
+    cinfo.err = jpeg_std_error( &jerr );
+    jpeg_create_compress( &cinfo );
+
+    unsigned char* buf = nullptr;
+    unsigned long size = 0;
+    jpeg_mem_dest( &cinfo, &buf, &size );
+
+    cinfo.image_width = width;
+    cinfo.image_height = height;
+    cinfo.input_components = comps;
+    cinfo.in_color_space = cmyk ? JCS_CMYK : JCS_RGB;
+    jpeg_set_defaults( &cinfo );
+    if( cmyk ) jpeg_set_colorspace( &cinfo, ycck ? JCS_YCCK : JCS_CMYK );
+    jpeg_set_quality( &cinfo, 90, TRUE );
+    cinfo.comp_info[0].h_samp_factor = hSamp;
+    cinfo.comp_info[0].v_samp_factor = vSamp;
+    cinfo.restart_in_rows = 1;
+
+    jpeg_start_compress( &cinfo, TRUE );
+    while( cinfo.next_scanline < cinfo.image_height )
+    {
+        auto row = pixels.data() + size_t( cinfo.next_scanline ) * width * comps;
+        jpeg_write_scanlines( &cinfo, &row, 1 );
+    }
+    jpeg_finish_compress( &cinfo );
+    jpeg_destroy_compress( &cinfo );
+
+    std::vector<uint8_t> file( buf, buf + size );
+    free( buf );
+    return std::make_shared<JpgFile>( std::move( file ) );
+}
+
+// Without a TaskDispatch the image is decoded serially
+void CheckParallelMatchesSerial( const std::shared_ptr<DataBuffer>& file, TaskDispatch& td )
+{
+    auto serial = JpgLoader( file, nullptr ).Load();
+    auto parallel = JpgLoader( file, &td ).Load();
+    REQUIRE( serial );
+    REQUIRE( parallel );
+    REQUIRE( parallel->Width() == serial->Width() );
+    REQUIRE( parallel->Height() == serial->Height() );
+    CHECK( memcmp( parallel->Data(), serial->Data(), size_t( serial->Width() ) * serial->Height() * 4 ) == 0 );
+}
+
+// Keeps a copy of the rows it is given, and how often each was given
+struct CopySink : public RowSink
+{
+    bool Start( uint32_t width, uint32_t height ) override
+    {
+        starts++;
+        this->width = width;
+        pixels.resize( size_t( width ) * height );
+        given.resize( height );
+        return true;
+    }
+
+    void Rows( const uint32_t* data, uint32_t y, uint32_t count ) override
+    {
+        REQUIRE( y + count <= given.size() );
+        memcpy( pixels.data() + size_t( y ) * width, data, size_t( width ) * count * 4 );
+        for( uint32_t i=0; i<count; i++ ) given[y + i]++;
+    }
+
+    int starts = 0;
+    uint32_t width = 0;
+    std::vector<uint32_t> pixels;
+    std::vector<int> given;
+};
+
+void CheckStreaming( const std::shared_ptr<DataBuffer>& file, TaskDispatch* td )
+{
+    auto expected = JpgLoader( file, nullptr ).Load();
+    REQUIRE( expected );
+
+    JpgLoader loader( file, td );
+    REQUIRE( loader.HasStreaming() );
+    CopySink sink;
+    auto bmp = loader.LoadStreaming( sink );
+    REQUIRE( bmp );
+    REQUIRE( sink.starts == 1 );
+    REQUIRE( sink.width == expected->Width() );
+    REQUIRE( sink.given.size() == expected->Height() );
+    CHECK( std::ranges::all_of( sink.given, []( int n ) { return n == 1; } ) );
+
+    const auto size = size_t( expected->Width() ) * expected->Height() * 4;
+    CHECK( memcmp( bmp->Data(), expected->Data(), size ) == 0 );
+    CHECK( memcmp( sink.pixels.data(), expected->Data(), size ) == 0 );
+}
+}
+
+TEST_CASE( "Parallel JPEG decode matches serial decode", "[jpgloader]" )
+{
+    TaskDispatch td( 4, "Jpg" );
+
+    SECTION( "4:2:0 YCbCr" )
+    {
+        CheckParallelMatchesSerial( Encode( 317, 251, false, false, 2, 2 ), td );
+    }
+    SECTION( "4:2:2 YCbCr" )
+    {
+        CheckParallelMatchesSerial( Encode( 203, 149, false, false, 2, 1 ), td );
+    }
+    SECTION( "4:4:4 YCbCr" )
+    {
+        CheckParallelMatchesSerial( Encode( 100, 90, false, false, 1, 1 ), td );
+    }
+    SECTION( "YCCK" )
+    {
+        CheckParallelMatchesSerial( Encode( 211, 177, true, true, 2, 2 ), td );
+    }
+    SECTION( "CMYK" )
+    {
+        CheckParallelMatchesSerial( Encode( 120, 100, true, false, 1, 1 ), td );
+    }
+}
+
+TEST_CASE( "Parallel JPEG coefficients match serial read", "[jpgloader]" )
+{
+    TaskDispatch td( 4, "Jpg" );
+    const auto file = Encode( 317, 251, false, false, 2, 2 );
+
+    JpgLoader serialLoader( file, nullptr );
+    JpgLoader parallelLoader( file, &td );
+    REQUIRE( serialLoader.HasDct() );
+    REQUIRE( parallelLoader.HasDct() );
+
+    auto serial = serialLoader.LoadDct();
+    auto parallel = parallelLoader.LoadDct();
+    REQUIRE( serial );
+    REQUIRE( parallel );
+    REQUIRE( parallel->Size() == serial->Size() );
+    CHECK( memcmp( parallel->Data(), serial->Data(), serial->Size() ) == 0 );
+}
+
+TEST_CASE( "JPEG streaming gives every row once", "[jpgloader]" )
+{
+    TaskDispatch td( 4, "Jpg" );
+    const auto file = Encode( 317, 251, false, false, 2, 2 );
+
+    SECTION( "Serial" )
+    {
+        CheckStreaming( file, nullptr );
+    }
+    SECTION( "Parallel" )
+    {
+        CheckStreaming( file, &td );
+    }
+    SECTION( "Color managed images are not streamed" )
+    {
+        JpgLoader loader( Encode( 120, 100, true, false, 1, 1 ), &td );
+        CHECK( !loader.HasStreaming() );
+    }
+}
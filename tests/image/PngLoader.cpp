@@ -0,0 +1,180 @@
+#include <catch2/catch_all.hpp>
+
+#include <algorithm>
+#include <memory>
+#include <png.h>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+
+#include <src/image/PngLoader.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/DataBuffer.hpp>
+#include <src/util/SimdDispatch.hpp>
+
+namespace
+{
+constexpr uint32_t Width = 37;     // Rows which do not fill whole vectors
+constexpr uint32_t Height = 71;    // Streamed in three bands
+
+struct PngFile : public DataBuffer
+{
+    explicit PngFile( std::vector<uint8_t>&& file ) : DataBuffer( (const char*)file.data(), file.size() ), m_file( std::move( file ) ) {}
+
+    std::vector<uint8_t> m_file;
+};
+
+struct ScopedSimdLevel
+{
+    ScopedSimdLevel() : level( GetSimdLevel() ) {}
+    ~ScopedSimdLevel() { SetSimdLevel( level ); }
+    SimdLevel level;
+};
+
+// Levels the CPU supports, scalar first
+std::vector<SimdLevel> SupportedLevels()
+{
+    ScopedSimdLevel restore;
+    std::vector<SimdLevel> ret;
+    for( auto level : { SimdLevel::Scalar, SimdLevel::Sse41, SimdLevel::Avx2, SimdLevel::Avx512, SimdLevel::Neon } )
+    {
+        SetSimdLevel( level );
+        if( GetSimdLevel() == level ) ret.emplace_back( level );
+    }
+    return ret;
+}
+
+// Noise, so that the predictors of Avg and Paeth, including their ties, take every path. Samples are big endian,
+// as they are stored in the file.
+std::vector<uint8_t> MakePixels( int channels, int bitDepth )
+{
+    std::vector<uint8_t> ret( size_t( Width ) * Height * channels * bitDepth / 8 );
+    uint32_t state = 42;
+    for( size_t i=0; i<ret.size(); i++ )
+    {
+        state = state * 1103515245 + 12345;
+        ret[i] = ( i % 5 == 0 ) ? ret[i / 2] : ( state >> 16 ) & 0xFF;
+    }
+    return ret;
+}
+
+// Every row is written with the given filter. The stream is split over several IDAT chunks. Interlaced files are
+// decoded by libpng.
+std::shared_ptr<DataBuffer> Encode( const std::vector<uint8_t>& pixels, int channels, int bitDepth, int filter, bool interlace = false )
+{
+    std::vector<uint8_t> file;
+    auto png = png_create_write_struct( PNG_LIBPNG_VER_STRING, nullptr, nullptr, nullptr );
+    auto info = png_create_info_struct( png );
+    png_set_write_fn( png, &file, []( png_structp png, png_bytep data, png_size_t length ) {
+        auto file = (std::vector<uint8_t>*)png_get_io_ptr( png );
+        file->insert( file->end(), data, data + length );
+    }, nullptr );
+    png_set_IHDR( png, info, Width, Height, bitDepth, channels == 4 ? PNG_COLOR_TYPE_RGB_ALPHA : PNG_COLOR_TYPE_RGB, interlace ? PNG_INTERLACE_ADAM7 : PNG_INTERLACE_NONE, PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT );
+    png_set_filter( png, PNG_FILTER_TYPE_BASE, filter );
+    png_set_compression_buffer_size( png, 1024 );
+    png_write_info( png, info );
+
+    const auto stride = size_t( Width ) * channels * bitDepth / 8;
+    const auto passes = png_set_interlace_handling( png );
+    for( int pass=0; pass<passes; pass++ )
+    {
+        for( uint32_t y=0; y<Height; y++ ) png_write_row( png, pixels.data() + y * stride );
+    }
+    png_write_end( png, info );
+    png_destroy_write_struct( &png, &info );
+    return std::make_shared<PngFile>( std::move( file ) );
+}
+
+// What Load() should return: RGBA, with the high byte of 16-bit samples
+std::vector<uint8_t> Expected( const std::vector<uint8_t>& pixels, int channels, int bitDepth )
+{
+    const auto bytes = bitDepth / 8;
+    std::vector<uint8_t> ret;
+    ret.reserve( size_t( Width ) * Height * 4 );
+    for( size_t i=0; i<pixels.size(); i+=channels*bytes )
+    {
+        for( int c=0; c<channels; c++ ) ret.push_back( pixels[i + c*bytes] );
+        if( channels == 3 ) ret.push_back( 0xFF );
+    }
+    return ret;
+}
+
+// Keeps a copy of the rows it is given, and how often each was given
+struct CopySink : public RowSink
+{
+    bool Start( uint32_t width, uint32_t height ) override
+    {
+        starts++;
+        this->width = width;
+        pixels.resize( size_t( width ) * height );
+        given.resize( height );
+        return true;
+    }
+
+    void Rows( const uint32_t* data, uint32_t y, uint32_t count ) override
+    {
+        REQUIRE( y + count <= given.size() );
+        memcpy( pixels.data() + size_t( y ) * width, data, size_t( width ) * count * 4 );
+        for( uint32_t i=0; i<count; i++ ) given[y + i]++;
+    }
+
+    int starts = 0;
+    uint32_t width = 0;
+    std::vector<uint32_t> pixels;
+    std::vector<int> given;
+};
+}
+
+TEST_CASE( "PNG filters decode to the original pixels", "[pngloader]" )
+{
+    ScopedSimdLevel restore;
+    const auto levels = SupportedLevels();
+
+    for( int bitDepth : { 8, 16 } )
+    {
+        for( int channels : { 3, 4 } )
+        {
+            const auto pixels = MakePixels( channels, bitDepth );
+            const auto expected = Expected( pixels, channels, bitDepth );
+            for( int filter : { PNG_FILTER_NONE, PNG_FILTER_SUB, PNG_FILTER_UP, PNG_FILTER_AVG, PNG_FILTER_PAETH, PNG_ALL_FILTERS } )
+            {
+                const auto file = Encode( pixels, channels, bitDepth, filter );
+                for( auto level : levels )
+                {
+                    SetSimdLevel( level );
+                    INFO( "bit depth " << bitDepth << ", channels " << channels << ", filter " << filter << ", " << SimdLevelName( level ) );
+
+                    auto bmp = PngLoader( file ).Load();
+                    REQUIRE( bmp );
+                    REQUIRE( bmp->Width() == Width );
+                    REQUIRE( bmp->Height() == Height );
+                    CHECK( memcmp( bmp->Data(), expected.data(), expected.size() ) == 0 );
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE( "PNG streaming gives every row once", "[pngloader]" )
+{
+    for( int bitDepth : { 8, 16 } )
+    {
+        for( bool interlace : { false, true } )
+        {
+            INFO( "bit depth " << bitDepth << ", interlace " << interlace );
+            const auto pixels = MakePixels( 4, bitDepth );
+            const auto expected = Expected( pixels, 4, bitDepth );
+            const auto file = Encode( pixels, 4, bitDepth, PNG_ALL_FILTERS, interlace );
+
+            PngLoader loader( file );
+            REQUIRE( loader.HasStreaming() );
+            CopySink sink;
+            auto bmp = loader.LoadStreaming( sink );
+            REQUIRE( bmp );
+            CHECK( sink.starts == 1 );
+            CHECK( std::ranges::all_of( sink.given, []( int n ) { return n == 1; } ) );
+            CHECK( memcmp( bmp->Data(), expected.data(), expected.size() ) == 0 );
+            CHECK( memcmp( sink.pixels.data(), expected.data(), expected.size() ) == 0 );
+        }
+    }
+}
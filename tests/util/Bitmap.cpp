@@ -0,0 +1,259 @@
+#include <fcntl.h>
+#include <png.h>
+#include <stdlib.h>
+#include <string.h>
+#include <catch2/catch_all.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/TaskDispatch.hpp>
+
+#include "TestUtils.hpp"
+
+namespace
+{
+void Fill( Bitmap& bmp, uint8_t r, uint8_t g, uint8_t b, uint8_t a )
+{
+    auto ptr = bmp.Data();
+    for( size_t i=0; i<size_t( bmp.Width() ) * bmp.Height(); i++ )
+    {
+        *ptr++ = r;
+        *ptr++ = g;
+        *ptr++ = b;
+        *ptr++ = a;
+    }
+}
+
+bool IsFlat( const Bitmap& bmp, uint8_t r, uint8_t g, uint8_t b, uint8_t a )
+{
+    const uint8_t ref[4] = { r, g, b, a };
+    auto ptr = bmp.Data();
+    for( size_t i=0; i<size_t( bmp.Width() ) * bmp.Height() * 4; i++ )
+    {
+        if( abs( ptr[i] - ref[i % 4] ) > 1 ) return false;
+    }
+    return true;
+}
+
+std::vector<uint8_t> DecodePng( const char* path, uint32_t& width, uint32_t& height )
+{
+    png_image image = {};
+    image.version = PNG_IMAGE_VERSION;
+    REQUIRE( png_image_begin_read_from_file( &image, path ) );
+    image.format = PNG_FORMAT_RGBA;
+    std::vector<uint8_t> data( PNG_IMAGE_SIZE( image ) );
+    REQUIRE( png_image_finish_read( &image, nullptr, data.data(), 0, nullptr ) );
+    width = image.width;
+    height = image.height;
+    return data;
+}
+}
+
+TEST_CASE( "Bitmap premultiplied resize keeps flat colours", "[bitmap]" )
+{
+    TaskDispatch td( 4, "Test" );
+
+    for( uint8_t alpha : { 255, 128, 3 } )
+    {
+        for( auto dispatch : { (TaskDispatch*)nullptr, &td } )
+        {
+            Bitmap bmp( 67, 48 );
+            Fill( bmp, 200, 100, 30, alpha );
+
+            auto half = bmp.ResizeNew( 33, 24, dispatch );
+            REQUIRE( half->Width() == 33 );
+            REQUIRE( half->Height() == 24 );
+            REQUIRE( IsFlat( *half, 200, 100, 30, alpha ) );
+
+            bmp.Resize( 134, 96, dispatch );
+            REQUIRE( IsFlat( bmp, 200, 100, 30, alpha ) );
+        }
+    }
+}
+
+TEST_CASE( "Bitmap resize averages in linear light", "[bitmap]" )
+{
+    Bitmap bmp( 2, 2 );
+    const uint32_t checker[4] = { 0xFF000000, 0xFFFFFFFF, 0xFFFFFFFF, 0xFF000000 };
+    memcpy( bmp.Data(), checker, sizeof( checker ) );
+
+    // Half of the light of white is 188 in sRGB, not 128
+    auto px = bmp.ResizeNew( 1, 1 );
+    for( int i=0; i<3; i++ ) REQUIRE( abs( px->Data()[i] - 188 ) <= 1 );
+    REQUIRE( px->Data()[3] == 255 );
+}
+
+TEST_CASE( "Bitmap premultiplied resize does not bleed transparent colour", "[bitmap]" )
+{
+    TaskDispatch td( 4, "Test" );
+
+    // Opaque red on the left, transparent green on the right
+    Bitmap bmp( 16, 8 );
+    auto ptr = (uint32_t*)bmp.Data();
+    for( uint32_t y=0; y<8; y++ )
+    {
+        for( uint32_t x=0; x<16; x++ )
+        {
+            *ptr++ = x < 8 ? 0xFF0000FF : 0x0000FF00;
+        }
+    }
+
+    for( auto dispatch : { (TaskDispatch*)nullptr, &td } )
+    {
+        auto small = bmp.ResizeNew( 4, 4, dispatch );
+        bool clean = true;
+        bool edge = false;
+        auto px = small->Data();
+        for( uint32_t i=0; i<16; i++ )
+        {
+            if( px[3] != 0 && ( px[0] < 254 || px[1] > 1 || px[2] > 1 ) ) clean = false;
+            if( px[3] == 0 && ( px[0] != 0 || px[1] != 0 || px[2] != 0 ) ) clean = false;
+            if( px[3] == 255 ) edge = true;
+            px += 4;
+        }
+        REQUIRE( clean );
+        REQUIRE( edge );
+    }
+}
+
+TEST_CASE( "Bitmap halving filters premultiplied linear light", "[bitmap]" )
+{
+    TaskDispatch td( 4, "Test" );
+
+    const uint32_t sizes[][2] = { { 2, 2 }, { 6, 1 }, { 34, 6 }, { 130, 20 } };
+    for( auto [w, h] : sizes )
+    {
+        for( auto dispatch : { (TaskDispatch*)nullptr, &td } )
+        {
+            // Opaque checker on the left, transparent green on the right
+            Bitmap bmp( w, h );
+            auto ptr = (uint32_t*)bmp.Data();
+            for( uint32_t y=0; y<h; y++ )
+            {
+                for( uint32_t x=0; x<w; x++ )
+                {
+                    if( x < w / 2 ) *ptr++ = ( x + y ) % 2 == 0 ? 0xFF000000 : 0xFFFFFFFF;
+                    else *ptr++ = 0x0000FF00;
+                }
+            }
+
+            Bitmap half( w / 2, std::max( 1u, h / 2 ) );
+            Bitmap::Halve( bmp.Data(), w, h, half.Data(), dispatch );
+
+            bool match = true;
+            auto px = half.Data();
+            for( uint32_t y=0; y<half.Height(); y++ )
+            {
+                for( uint32_t x=0; x<half.Width(); x++ )
+                {
+                    // A block straddling the middle has one opaque column, which is black in a single row image
+                    const auto left = 2 * x + 1 < w / 2;
+                    const auto edge = 2 * x + 1 == w / 2;
+                    const int alpha = left ? 255 : edge ? 128 : 0;
+                    const int grey = left ? 188 : edge && h > 1 ? 188 : 0;
+                    if( abs( px[3] - alpha ) > 1 ) match = false;
+                    for( int i=0; i<3; i++ ) if( abs( px[i] - grey ) > 1 ) match = false;
+                    px += 4;
+                }
+            }
+            REQUIRE( match );
+        }
+    }
+}
+
+TEST_CASE( "Bitmap PNG strips decode to the original pixels", "[bitmap]" )
+{
+    TaskDispatch td( 4, "Test" );
+
+    // Several strips of rows, with content that exercises every filter
+    Bitmap bmp( 700, 900 );
+    auto ptr = bmp.Data();
+    for( uint32_t y=0; y<bmp.Height(); y++ )
+    {
+        for( uint32_t x=0; x<bmp.Width(); x++ )
+        {
+            *ptr++ = x;
+            *ptr++ = y;
+            *ptr++ = ( x * 7 + y * 13 ) ^ ( x * y );
+            *ptr++ = x < 350 ? 255 : y;
+        }
+    }
+
+    for( auto dispatch : { (TaskDispatch*)nullptr, &td } )
+    {
+        for( auto compression : { Bitmap::PngCompression::Default, Bitmap::PngCompression::Fast } )
+        {
+            auto file = TempFile::createEmpty();
+            const auto fd = open( file.path(), O_WRONLY | O_TRUNC );
+            REQUIRE( fd >= 0 );
+            REQUIRE( bmp.SavePng( fd, { { "Software", "Test" } }, dispatch, compression ) );
+            close( fd );
+
+            uint32_t width, height;
+            const auto data = DecodePng( file.path(), width, height );
+            REQUIRE( width == bmp.Width() );
+            REQUIRE( height == bmp.Height() );
+            REQUIRE( memcmp( data.data(), bmp.Data(), data.size() ) == 0 );
+        }
+    }
+}
+
+TEST_CASE( "Bitmap PNG of a single pixel", "[bitmap]" )
+{
+    Bitmap bmp( 1, 1 );
+    Fill( bmp, 10, 20, 30, 40 );
+
+    auto file = TempFile::createEmpty();
+    REQUIRE( bmp.SavePng( file.path() ) );
+
+    uint32_t width, height;
+    const auto data = DecodePng( file.path(), width, height );
+    REQUIRE( width == 1 );
+    REQUIRE( height == 1 );
+    REQUIRE( memcmp( data.data(), bmp.Data(), 4 ) == 0 );
+}
+
+TEST_CASE( "Bitmap views share pixels with the bitmap", "[bitmap]" )
+{
+    Bitmap bmp( 16, 8 );
+    auto ptr = bmp.Data();
+    for( uint32_t y=0; y<bmp.Height(); y++ )
+    {
+        for( uint32_t x=0; x<bmp.Width(); x++ )
+        {
+            *ptr++ = x;
+            *ptr++ = y;
+            *ptr++ = x + y;
+            *ptr++ = 255;
+        }
+    }
+
+    const auto view = bmp.View( 3, 2, 5, 4 );
+    CHECK( view.width == 5 );
+    CHECK( view.height == 4 );
+    CHECK( view.stride == 16 );
+    CHECK( !view.IsPacked() );
+    CHECK( view.Row( 0 ) == bmp.Data() + ( 2 * 16 + 3 ) * 4 );
+    CHECK( view.Sub( 1, 1, 2, 2 ).Row( 0 ) == view.Row( 1 ) + 4 );
+    CHECK( bmp.View().IsPacked() );
+
+    const Bitmap copy( view );
+    REQUIRE( copy.Width() == 5 );
+    REQUIRE( copy.Height() == 4 );
+    for( uint32_t y=0; y<4; y++ ) CHECK( memcmp( copy.Data() + y * 5 * 4, view.Row( y ), 5 * 4 ) == 0 );
+
+    auto file = TempFile::createEmpty();
+    const auto fd = open( file.path(), O_WRONLY | O_TRUNC );
+    REQUIRE( fd >= 0 );
+    REQUIRE( Bitmap::SavePng( view, fd, {} ) );
+    close( fd );
+
+    uint32_t width, height;
+    const auto data = DecodePng( file.path(), width, height );
+    REQUIRE( width == 5 );
+    REQUIRE( height == 4 );
+    CHECK( memcmp( data.data(), copy.Data(), data.size() ) == 0 );
+
+    bmp.Crop( 3, 2, 5, 4 );
+    REQUIRE( bmp.Width() == 5 );
+    REQUIRE( bmp.Height() == 4 );
+    CHECK( memcmp( bmp.Data(), copy.Data(), 5 * 4 * 4 ) == 0 );
+}
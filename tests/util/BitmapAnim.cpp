@@ -0,0 +1,111 @@
+#include <catch2/catch_all.hpp>
+#include <memory>
+#include <stdint.h>
+#include <string.h>
+#include <vector>
+#include <src/util/BitmapAnim.hpp>
+
+namespace
+{
+// Each frame moves a small square over a gradient background.
+std::shared_ptr<Bitmap> MakeFrame( uint32_t idx, uint32_t width = 64, uint32_t height = 48, int orientation = 0 )
+{
+    auto bmp = std::make_shared<Bitmap>( width, height, orientation );
+    auto px = (uint32_t*)bmp->Data();
+    for( uint32_t y=0; y<height; y++ )
+    {
+        for( uint32_t x=0; x<width; x++ )
+        {
+            const bool square = x >= idx % width && x < idx % width + 4 && y >= 10 && y < 14;
+            px[y * width + x] = square ? 0xFF0000FF : ( 0xFF000000 | ( y << 8 ) | x );
+        }
+    }
+    return bmp;
+}
+
+bool SamePixels( const Bitmap& a, const Bitmap& b )
+{
+    return a.Width() == b.Width() && a.Height() == b.Height() && memcmp( a.Data(), b.Data(), a.Width() * a.Height() * 4 ) == 0;
+}
+}
+
+TEST_CASE( "BitmapAnim delta frames", "[bitmapanim]" )
+{
+    constexpr uint32_t Frames = 70;
+
+    BitmapAnim anim( Frames );
+    for( uint32_t i=0; i<Frames; i++ ) anim.AddFrame( MakeFrame( i ), i * 10 );
+    REQUIRE( anim.FrameCount() == Frames );
+
+    SECTION( "Frames are rebuilt in playback order" )
+    {
+        for( uint32_t i=0; i<Frames; i++ )
+        {
+            auto frame = anim.GetFrame( i );
+            REQUIRE( frame.delay_us == i * 10 );
+            REQUIRE( SamePixels( *frame.bmp, *MakeFrame( i ) ) );
+        }
+    }
+
+    SECTION( "Frames are rebuilt out of order" )
+    {
+        for( uint32_t i : { 69u, 3u, 40u, 39u, 0u, 33u, 31u } )
+        {
+            REQUIRE( SamePixels( *anim.GetFrame( i ).bmp, *MakeFrame( i ) ) );
+        }
+    }
+
+    SECTION( "Frames released before the next request are rebuilt in place" )
+    {
+        const uint8_t* data = anim.GetFrame( 0 ).bmp->Data();
+        for( uint32_t i=1; i<Frames; i++ )
+        {
+            auto frame = anim.GetFrame( i );
+            REQUIRE( frame.bmp->Data() == data );
+            REQUIRE( SamePixels( *frame.bmp, *MakeFrame( i ) ) );
+        }
+    }
+
+    SECTION( "Frames still held are not changed by later requests" )
+    {
+        auto first = anim.GetFrame( 5 );
+        auto second = anim.GetFrame( 6 );
+        auto third = anim.GetFrame( 40 );
+        REQUIRE( SamePixels( *first.bmp, *MakeFrame( 5 ) ) );
+        REQUIRE( SamePixels( *second.bmp, *MakeFrame( 6 ) ) );
+        REQUIRE( SamePixels( *third.bmp, *MakeFrame( 40 ) ) );
+    }
+
+    SECTION( "Changed rectangles take less space than full frames" )
+    {
+        REQUIRE( anim.DataSize() < size_t( Frames ) * 64 * 48 * 4 / 4 );
+    }
+
+    SECTION( "Frames of different sizes are extended" )
+    {
+        BitmapAnim mixed( 2 );
+        mixed.AddFrame( MakeFrame( 0, 16, 16 ), 0 );
+        mixed.AddFrame( MakeFrame( 0, 32, 8 ), 0 );
+        mixed.NormalizeSize();
+        for( size_t i=0; i<2; i++ )
+        {
+            auto frame = mixed.GetFrame( i );
+            REQUIRE( frame.bmp->Width() == 32 );
+            REQUIRE( frame.bmp->Height() == 16 );
+        }
+    }
+
+    SECTION( "Orientation is kept" )
+    {
+        BitmapAnim rotated( 3 );
+        rotated.AddFrame( MakeFrame( 0, 64, 48, 6 ), 0 );
+        rotated.AddFrame( MakeFrame( 1, 64, 48, 6 ), 0 );
+        rotated.AddFrame( MakeFrame( 2, 64, 48, 3 ), 0 );
+        for( uint32_t i=0; i<3; i++ )
+        {
+            auto frame = rotated.GetFrame( i );
+            REQUIRE( frame.bmp->Orientation() == ( i < 2 ? 6 : 3 ) );
+            REQUIRE( SamePixels( *frame.bmp, *MakeFrame( i ) ) );
+        }
+    }
+}
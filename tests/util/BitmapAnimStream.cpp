@@ -0,0 +1,85 @@
+#include <atomic>
+#include <catch2/catch_all.hpp>
+#include <memory>
+#include <src/util/BitmapAnimStream.hpp>
+#include <src/util/TaskDispatch.hpp>
+
+namespace
+{
+// Frames carry their index as the delay, and no bitmap.
+class CountingSource : public BitmapAnimStream::Source
+{
+public:
+    CountingSource( uint32_t frames, std::atomic<uint32_t>& decoded ) : m_frames( frames ), m_next( 0 ), m_decoded( decoded ) {}
+
+    bool Next( BitmapAnim::Frame& frame ) override
+    {
+        if( m_next == m_frames ) return false;
+        frame = { nullptr, m_next++ };
+        m_decoded++;
+        return true;
+    }
+
+    void Rewind() override { m_next = 0; }
+
+private:
+    uint32_t m_frames;
+    uint32_t m_next;
+    std::atomic<uint32_t>& m_decoded;
+};
+}
+
+TEST_CASE( "BitmapAnimStream playback", "[bitmapanimstream]" )
+{
+    std::atomic<uint32_t> decoded = 0;
+
+    SECTION( "Frames are returned in order and wrap around" )
+    {
+        BitmapAnimStream stream( std::make_unique<CountingSource>( 3, decoded ), 16, 8, 3 );
+        REQUIRE( stream.Width() == 16 );
+        REQUIRE( stream.Height() == 8 );
+        REQUIRE( stream.FrameCount() == 3 );
+        for( uint32_t i=0; i<7; i++ ) REQUIRE( stream.Next().delay_us == i % 3 );
+    }
+
+    SECTION( "Decoding on workers keeps the same order" )
+    {
+        TaskDispatch td( 2, "anim" );
+        BitmapAnimStream stream( std::make_unique<CountingSource>( 5, decoded ), 1, 1, 5, &td, 2 );
+        for( uint32_t i=0; i<12; i++ ) REQUIRE( stream.Next().delay_us == i % 5 );
+    }
+
+    SECTION( "TryNext only returns decoded frames" )
+    {
+        TaskDispatch td( 2, "anim" );
+        BitmapAnimStream stream( std::make_unique<CountingSource>( 4, decoded ), 1, 1, 4, &td, 2 );
+        uint32_t next = 0;
+        while( next < 10 )
+        {
+            BitmapAnim::Frame frame;
+            if( !stream.TryNext( frame ) )
+            {
+                td.Sync();
+                continue;
+            }
+            REQUIRE( frame.delay_us == next++ % 4 );
+        }
+
+        BitmapAnimStream direct( std::make_unique<CountingSource>( 2, decoded ), 1, 1, 2 );
+        BitmapAnim::Frame frame;
+        REQUIRE( direct.TryNext( frame ) );
+        REQUIRE( frame.delay_us == 0 );
+    }
+
+    SECTION( "Only the window is decoded ahead" )
+    {
+        TaskDispatch td( 2, "anim" );
+        {
+            BitmapAnimStream stream( std::make_unique<CountingSource>( 100, decoded ), 1, 1, 100, &td, 3 );
+            REQUIRE( stream.Next().delay_us == 0 );
+            td.Sync();
+            REQUIRE( decoded <= 4 );
+        }
+        REQUIRE( decoded <= 4 );
+    }
+}
@@ -0,0 +1,108 @@
+#include <catch2/catch_all.hpp>
+
+#include <string.h>
+
+#include "util/Bitmap.hpp"
+#include "util/BitmapCompressed.hpp"
+
+TEST_CASE( "Compressed level layout", "[bitmapcompressed]" )
+{
+    BitmapCompressed bmp( BitmapCompressed::Format::Bc1, 16, 8, 5 );
+
+    const auto& levels = bmp.Levels();
+    REQUIRE( levels.size() == 5 );
+
+    CHECK( levels[0].width == 16 );
+    CHECK( levels[0].height == 8 );
+    CHECK( levels[0].offset == 0 );
+    CHECK( levels[0].size == 8 * 4 * 2 );
+
+    CHECK( levels[1].offset == levels[0].size );
+    CHECK( levels[1].size == 8 * 2 );
+
+    // Levels smaller than a block still take a full block.
+    CHECK( levels[3].width == 2 );
+    CHECK( levels[3].height == 1 );
+    CHECK( levels[3].size == 8 );
+    CHECK( levels[4].width == 1 );
+    CHECK( levels[4].size == 8 );
+
+    CHECK( bmp.Size() == levels[4].offset + levels[4].size );
+}
+
+TEST_CASE( "Compressed level count is clamped to the full chain", "[bitmapcompressed]" )
+{
+    BitmapCompressed bmp( BitmapCompressed::Format::Bc7, 4, 4, 10 );
+
+    REQUIRE( bmp.Levels().size() == 3 );
+    CHECK( bmp.Size() == 3 * 16 );
+    CHECK( bmp.Data() != nullptr );
+}
+
+TEST_CASE( "Solid color encodes to equal endpoints", "[bitmapcompressed]" )
+{
+    Bitmap bmp( 6, 5 );
+    auto ptr = bmp.Data();
+    for( int i=0; i<6*5; i++ )
+    {
+        ptr[i*4+0] = 255;
+        ptr[i*4+1] = 0;
+        ptr[i*4+2] = 0;
+        ptr[i*4+3] = 128;
+    }
+
+    auto bc1 = BitmapCompressed::Encode( bmp, BitmapCompressed::Format::Bc1, false );
+    REQUIRE( bc1->Levels().size() == 1 );
+    REQUIRE( bc1->Size() == 4 * 8 );
+    for( int i=0; i<4; i++ )
+    {
+        const auto block = bc1->Data() + i * 8;
+        const uint8_t expected[8] = { 0x00, 0xF8, 0x00, 0xF8, 0, 0, 0, 0 };
+        CHECK( memcmp( block, expected, 8 ) == 0 );
+    }
+
+    auto bc3 = BitmapCompressed::Encode( bmp, BitmapCompressed::Format::Bc3, false );
+    REQUIRE( bc3->Size() == 4 * 16 );
+    const uint8_t expected[16] = { 128, 128, 0, 0, 0, 0, 0, 0, 0x00, 0xF8, 0x00, 0xF8, 0, 0, 0, 0 };
+    CHECK( memcmp( bc3->Data(), expected, 16 ) == 0 );
+}
+
+TEST_CASE( "Two color block picks the endpoints", "[bitmapcompressed]" )
+{
+    Bitmap bmp( 4, 4 );
+    auto ptr = bmp.Data();
+    for( int i=0; i<16; i++ )
+    {
+        const uint8_t v = i < 8 ? 255 : 0;
+        ptr[i*4+0] = v;
+        ptr[i*4+1] = v;
+        ptr[i*4+2] = v;
+        ptr[i*4+3] = v;
+    }
+
+    auto bc3 = BitmapCompressed::Encode( bmp, BitmapCompressed::Format::Bc3, false );
+    const auto block = bc3->Data();
+
+    // Alpha endpoints are exact, white maps to index 0 and black to index 1
+    CHECK( block[0] == 255 );
+    CHECK( block[1] == 0 );
+    uint64_t alpha = 0;
+    for( int i=0; i<6; i++ ) alpha |= uint64_t( block[2+i] ) << ( i * 8 );
+    CHECK( alpha == 0x249249000000ull );
+
+    uint32_t color;
+    memcpy( &color, block + 12, 4 );
+    CHECK( color == 0x55550000 );
+}
+
+TEST_CASE( "Encoded mip chain", "[bitmapcompressed]" )
+{
+    Bitmap bmp( 13, 7 );
+    memset( bmp.Data(), 0x80, 13 * 7 * 4 );
+
+    auto bc1 = BitmapCompressed::Encode( bmp, BitmapCompressed::Format::Bc1, true );
+    const auto& levels = bc1->Levels();
+    REQUIRE( levels.size() == 4 );
+    CHECK( levels[3].width == 1 );
+    CHECK( levels[3].height == 1 );
+}
@@ -0,0 +1,85 @@
+#include <catch2/catch_all.hpp>
+
+#include <math.h>
+#include <string.h>
+
+#include "util/BitmapDct.hpp"
+#include "util/BitmapYuv.hpp"
+
+namespace
+{
+void Clear( BitmapDct& dct )
+{
+    memset( (void*)dct.Data(), 0, dct.Size() );
+    for( int c=0; c<3; c++ )
+    {
+        for( int i=0; i<64; i++ ) dct.Quant( c )[i] = 1;
+    }
+}
+}
+
+TEST_CASE( "Dct block layout", "[bitmapdct]" )
+{
+    BitmapDct dct( 17, 9, BitmapYuv::Subsampling::S420 );
+    CHECK( dct.GetComponent( 0 ).widthInBlocks == 3 );
+    CHECK( dct.GetComponent( 0 ).heightInBlocks == 2 );
+    CHECK( dct.GetComponent( 1 ).widthInBlocks == 2 );
+    CHECK( dct.GetComponent( 1 ).heightInBlocks == 1 );
+    CHECK( dct.GetComponent( 0 ).offset == BitmapDct::QuantSize );
+    CHECK( dct.GetComponent( 1 ).offset == BitmapDct::QuantSize + 6 * 64 );
+    CHECK( dct.GetComponent( 2 ).offset == BitmapDct::QuantSize + 8 * 64 );
+    CHECK( dct.Size() == ( BitmapDct::QuantSize + 10 * 64 ) * 2 );
+    CHECK( dct.Block( 0, 1, 1 ) == dct.Block( 0, 0, 0 ) + 4 * 64 );
+
+    BitmapDct dct422( 16, 9, BitmapYuv::Subsampling::S422 );
+    CHECK( dct422.GetComponent( 1 ).widthInBlocks == 1 );
+    CHECK( dct422.GetComponent( 1 ).heightInBlocks == 2 );
+}
+
+TEST_CASE( "DC only blocks are flat", "[bitmapdct]" )
+{
+    BitmapDct dct( 12, 10, BitmapYuv::Subsampling::S420 );
+    Clear( dct );
+    dct.Quant( 0 )[0] = 4;
+    dct.Block( 0, 0, 0 )[0] = 20;
+    dct.Block( 0, 1, 0 )[0] = -40;
+    dct.Block( 1, 0, 0 )[0] = 8;
+
+    auto yuv = dct.ToYuv();
+    REQUIRE( yuv->Width() == 12 );
+    REQUIRE( yuv->Height() == 10 );
+    CHECK( yuv->Y()[0] == 138 );
+    CHECK( yuv->Y()[7 * 12 + 7] == 138 );
+    CHECK( yuv->Y()[8] == 108 );
+    CHECK( yuv->Y()[11] == 108 );
+    CHECK( yuv->Y()[9 * 12] == 128 );
+    CHECK( yuv->Cb()[0] == 129 );
+    CHECK( yuv->Cr()[0] == 128 );
+}
+
+TEST_CASE( "First AC coefficient is a half cosine", "[bitmapdct]" )
+{
+    BitmapDct dct( 8, 8, BitmapYuv::Subsampling::S422 );
+    Clear( dct );
+    dct.Block( 0, 0, 0 )[1] = 100;
+
+    auto yuv = dct.ToYuv();
+    for( int x=0; x<8; x++ )
+    {
+        const auto expected = 128 + 25 * M_SQRT1_2 * cos( ( 2 * x + 1 ) * M_PI / 16 );
+        CHECK( fabs( yuv->Y()[x] - expected ) < 0.51 );
+        CHECK( yuv->Y()[7 * 8 + x] == yuv->Y()[x] );
+    }
+}
+
+TEST_CASE( "Dct output saturates", "[bitmapdct]" )
+{
+    BitmapDct dct( 8, 8, BitmapYuv::Subsampling::S422 );
+    Clear( dct );
+    dct.Block( 0, 0, 0 )[0] = 2000;
+    dct.Block( 1, 0, 0 )[0] = -2000;
+
+    auto yuv = dct.ToYuv();
+    CHECK( yuv->Y()[0] == 255 );
+    CHECK( yuv->Cb()[0] == 0 );
+}
@@ -0,0 +1,102 @@
+#include <string.h>
+#include <catch2/catch_all.hpp>
+#include <src/util/BitmapHdr.hpp>
+#include <src/util/TaskDispatch.hpp>
+
+using Catch::Matchers::WithinAbs;
+
+namespace
+{
+void Fill( BitmapHdr& bmp )
+{
+    auto ptr = bmp.Data();
+    const auto sz = size_t( bmp.Width() ) * bmp.Height();
+    for( size_t i=0; i<sz; i++ )
+    {
+        *ptr++ = float( i % 7 ) / 6;
+        *ptr++ = float( i % 5 ) / 4;
+        *ptr++ = float( i % 3 ) / 2;
+        *ptr++ = float( i % 11 ) / 10;
+    }
+}
+}
+
+TEST_CASE( "BitmapHdr converts BT.709 primaries to BT.2020", "[bitmaphdr]" )
+{
+    BitmapHdr bmp( 3, 1, Colorspace::BT709 );
+    auto ptr = bmp.Data();
+    const float src[12] = {
+        1, 0, 0, 0.5f,
+        0, 1, 0, 0.25f,
+        1, 1, 1, 1
+    };
+    memcpy( ptr, src, sizeof( src ) );
+
+    bmp.SetColorspace( Colorspace::BT2020 );
+    REQUIRE( bmp.GetColorspace() == Colorspace::BT2020 );
+
+    REQUIRE_THAT( ptr[0], WithinAbs( 0.6274, 1e-3 ) );
+    REQUIRE_THAT( ptr[1], WithinAbs( 0.0691, 1e-3 ) );
+    REQUIRE_THAT( ptr[2], WithinAbs( 0.0164, 1e-3 ) );
+    REQUIRE( ptr[3] == 0.5f );
+
+    REQUIRE_THAT( ptr[4], WithinAbs( 0.3293, 1e-3 ) );
+    REQUIRE_THAT( ptr[5], WithinAbs( 0.9195, 1e-3 ) );
+    REQUIRE_THAT( ptr[6], WithinAbs( 0.0880, 1e-3 ) );
+    REQUIRE( ptr[7] == 0.25f );
+
+    // Both colorspaces share the white point
+    for( int i=8; i<12; i++ ) REQUIRE_THAT( ptr[i], WithinAbs( 1, 1e-5 ) );
+}
+
+TEST_CASE( "BitmapHdr colorspace round trip", "[bitmaphdr]" )
+{
+    TaskDispatch td( 2, "Worker" );
+
+    for( auto size : { 1u, 5u, 127u } )
+    {
+        BitmapHdr ref( size, 3, Colorspace::BT709 );
+        BitmapHdr bmp( size, 3, Colorspace::BT709 );
+        Fill( ref );
+        Fill( bmp );
+
+        bmp.SetColorspace( Colorspace::BT2020, &td );
+        bmp.SetColorspace( Colorspace::BT709 );
+
+        const auto sz = size_t( size ) * 3 * 4;
+        for( size_t i=0; i<sz; i++ ) REQUIRE_THAT( bmp.Data()[i], WithinAbs( ref.Data()[i], 1e-5 ) );
+    }
+}
+
+TEST_CASE( "BitmapHdr halving averages 2x2 blocks", "[bitmaphdr]" )
+{
+    TaskDispatch td( 2, "Worker" );
+
+    const uint32_t sizes[][2] = { { 2, 2 }, { 6, 1 }, { 34, 6 }, { 130, 20 } };
+    for( auto [w, h] : sizes )
+    {
+        for( auto dispatch : { (TaskDispatch*)nullptr, &td } )
+        {
+            BitmapHdr bmp( w, h, Colorspace::BT709 );
+            Fill( bmp );
+            BitmapHdr half( w / 2, std::max( 1u, h / 2 ), Colorspace::BT709 );
+            BitmapHdr::Halve( bmp.Data(), w, h, half.Data(), dispatch );
+
+            const auto src = bmp.Data();
+            auto dst = half.Data();
+            for( uint32_t y=0; y<half.Height(); y++ )
+            {
+                const auto row0 = src + size_t( y * 2 ) * w * 4;
+                const auto row1 = h == 1 ? row0 : row0 + w * 4;
+                for( uint32_t x=0; x<half.Width(); x++ )
+                {
+                    for( int i=0; i<4; i++ )
+                    {
+                        const auto ref = ( row0[x*8+i] + row0[x*8+i+4] + row1[x*8+i] + row1[x*8+i+4] ) * 0.25f;
+                        REQUIRE_THAT( *dst++, WithinAbs( ref, 1e-6 ) );
+                    }
+                }
+            }
+        }
+    }
+}
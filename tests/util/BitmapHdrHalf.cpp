@@ -0,0 +1,129 @@
+#include <catch2/catch_all.hpp>
+#include <vector>
+#include <src/util/BitmapHdr.hpp>
+#include <src/util/BitmapHdrHalf.hpp>
+#include <src/util/TaskDispatch.hpp>
+#include <contrib/half.hpp>
+
+using Catch::Matchers::WithinAbs;
+
+namespace
+{
+void Fill( BitmapHdr& bmp )
+{
+    auto ptr = bmp.Data();
+    const auto sz = size_t( bmp.Width() ) * bmp.Height();
+    for( size_t i=0; i<sz; i++ )
+    {
+        *ptr++ = float( i % 7 ) / 6;
+        *ptr++ = float( i % 5 ) / 4;
+        *ptr++ = float( i % 3 ) / 2;
+        *ptr++ = float( i % 11 ) / 10;
+    }
+}
+}
+
+TEST_CASE( "BitmapHdrHalf colorspace matches float conversion", "[bitmaphdrhalf]" )
+{
+    TaskDispatch td( 2, "Worker" );
+
+    for( auto size : { 1u, 5u, 127u } )
+    {
+        BitmapHdr ref( size, 3, Colorspace::BT709 );
+        Fill( ref );
+        BitmapHdrHalf bmp( ref );
+
+        ref.SetColorspace( Colorspace::BT2020 );
+        bmp.SetColorspace( Colorspace::BT2020, &td );
+        REQUIRE( bmp.GetColorspace() == Colorspace::BT2020 );
+
+        const auto sz = size_t( size ) * 3 * 4;
+        for( size_t i=0; i<sz; i++ ) REQUIRE_THAT( float( bmp.Data()[i] ), WithinAbs( ref.Data()[i], 1e-3 ) );
+    }
+}
+
+TEST_CASE( "BitmapHdrHalf orientation matches float bitmap", "[bitmaphdrhalf]" )
+{
+    TaskDispatch td( 2, "Worker" );
+
+    for( int orientation=2; orientation<=8; orientation++ )
+    {
+        BitmapHdr ref( 37, 5, Colorspace::BT709, orientation );
+        Fill( ref );
+        BitmapHdrHalf bmp( ref );
+        REQUIRE( bmp.Orientation() == orientation );
+
+        ref.NormalizeOrientation( &td );
+        bmp.NormalizeOrientation( &td );
+        REQUIRE( bmp.Width() == ref.Width() );
+        REQUIRE( bmp.Height() == ref.Height() );
+        REQUIRE( bmp.Orientation() == 1 );
+
+        // Pixels are only moved, so they must be the rounded float values exactly
+        const auto sz = size_t( ref.Width() ) * ref.Height() * 4;
+        for( size_t i=0; i<sz; i++ ) REQUIRE( bmp.Data()[i] == half_float::half( ref.Data()[i] ) );
+    }
+}
+
+TEST_CASE( "BitmapHdrHalf halving matches float halving", "[bitmaphdrhalf]" )
+{
+    TaskDispatch td( 2, "Worker" );
+
+    const uint32_t sizes[][2] = { { 2, 2 }, { 6, 1 }, { 34, 6 }, { 130, 20 } };
+    for( auto [w, h] : sizes )
+    {
+        BitmapHdr src( w, h, Colorspace::BT709 );
+        Fill( src );
+        BitmapHdrHalf bmp( src );
+        BitmapHdr ref( bmp );
+
+        const auto hh = std::max( 1u, h / 2 );
+        BitmapHdr refHalf( w / 2, hh, Colorspace::BT709 );
+        BitmapHdr::Halve( ref.Data(), w, h, refHalf.Data() );
+        BitmapHdrHalf half( w / 2, hh, Colorspace::BT709 );
+        BitmapHdrHalf::Halve( bmp.Data(), w, h, half.Data(), &td );
+
+        const auto sz = size_t( w / 2 ) * hh * 4;
+        for( size_t i=0; i<sz; i++ ) REQUIRE( half.Data()[i] == half_float::half( refHalf.Data()[i] ) );
+    }
+}
+
+TEST_CASE( "BitmapHdrHalf PQ packing", "[bitmaphdrhalf]" )
+{
+    TaskDispatch td( 2, "Worker" );
+
+    // Black, 100 nits, 10000 nits and past it, with the four alpha levels
+    const half_float::half src[] = {
+        half_float::half( 0.f ), half_float::half( -1.f ), half_float::half( 0.f ), half_float::half( 1.f ),
+        half_float::half( 1.f ), half_float::half( 1.f ), half_float::half( 1.f ), half_float::half( 0.7f ),
+        half_float::half( 100.f ), half_float::half( 500.f ), half_float::half( 100.f ), half_float::half( 0.3f ),
+        half_float::half( 0.5f ), half_float::half( 2.f ), half_float::half( 4.f ), half_float::half( 0.f ),
+    };
+    uint32_t packed[4];
+    BitmapHdrHalf::EncodePq( src, packed, 4, &td );
+    CHECK( packed[0] == 0xC0000000 );
+    CHECK( packed[1] == ( 0x80000000 | 520 | ( 520 << 10 ) | ( 520 << 20 ) ) );
+    CHECK( packed[2] == ( 0x40000000 | 1023 | ( 1023 << 10 ) | ( 1023 << 20 ) ) );
+    CHECK( ( packed[3] >> 30 ) == 0 );
+
+    half_float::half decoded[16];
+    BitmapHdrHalf::DecodePq( packed, decoded, 4, &td );
+    CHECK( float( decoded[3] ) == 1.f );
+    CHECK( float( decoded[8] ) == 100.f );
+    for( int i : { 4, 5, 6, 12, 13, 14 } ) CHECK_THAT( float( decoded[i] ), WithinAbs( float( src[i] ), float( src[i] ) * 0.01f ) );
+
+    // Every code survives a round trip to half precision, up to one step at the darkest end
+    uint32_t codes[1024];
+    for( uint32_t i=0; i<1024; i++ ) codes[i] = i | ( i << 10 ) | ( i << 20 ) | 0xC0000000;
+    std::vector<half_float::half> half( 1024 * 4 );
+    BitmapHdrHalf::DecodePq( codes, half.data(), 1024, &td );
+    uint32_t again[1024];
+    BitmapHdrHalf::EncodePq( half.data(), again, 1024, &td );
+    for( uint32_t i=0; i<1024; i++ ) REQUIRE( std::abs( int( again[i] & 0x3FF ) - int( i ) ) <= 1 );
+
+    BitmapHdrHalf bmp( 3, 2, Colorspace::BT2020 );
+    bmp.FillBlack( 0, 0, 3, 2 );
+    CHECK( bmp.IsOpaque() );
+    bmp.Data()[4*4+3] = half_float::half( 0.5f );
+    CHECK( !bmp.IsOpaque() );
+}
@@ -0,0 +1,78 @@
+#include <catch2/catch_all.hpp>
+
+#include <string.h>
+
+#include "contrib/half.hpp"
+#include "util/Bitmap.hpp"
+#include "util/BitmapHdrHalf.hpp"
+#include "util/BitmapLz4.hpp"
+#include "util/TaskDispatch.hpp"
+
+TEST_CASE( "Lz4 bitmap round trip", "[bitmaplz4]" )
+{
+    TaskDispatch td( 4, "Worker" );
+
+    // Sizes around the chunk boundaries, with noise next to smooth gradients
+    const uint32_t sizes[][2] = { { 1, 1 }, { 7, 3 }, { 256, 256 }, { 257, 256 }, { 1023, 517 } };
+    for( auto [w, h] : sizes )
+    {
+        Bitmap bmp( w, h, 6 );
+        auto ptr = bmp.Data();
+        uint32_t seed = 1;
+        for( uint32_t y=0; y<h; y++ )
+        {
+            for( uint32_t x=0; x<w; x++ )
+            {
+                seed = seed * 1664525 + 1013904223;
+                *ptr++ = uint8_t( x );
+                *ptr++ = uint8_t( y );
+                *ptr++ = uint8_t( seed >> 24 );
+                *ptr++ = 0xFF;
+            }
+        }
+
+        for( auto dispatch : { &td, (TaskDispatch*)nullptr } )
+        {
+            BitmapLz4 lz4( bmp, dispatch );
+            CHECK( !lz4.IsHdr() );
+            CHECK( lz4.Width() == w );
+            CHECK( lz4.Height() == h );
+
+            auto out = lz4.ToBitmap( dispatch );
+            REQUIRE( out->Width() == w );
+            REQUIRE( out->Height() == h );
+            CHECK( out->Orientation() == 6 );
+            CHECK( memcmp( out->Data(), bmp.Data(), size_t( w ) * h * 4 ) == 0 );
+        }
+    }
+}
+
+TEST_CASE( "Lz4 HDR bitmap round trip", "[bitmaplz4]" )
+{
+    TaskDispatch td( 4, "Worker" );
+
+    BitmapHdrHalf bmp( 300, 200, Colorspace::BT2020 );
+    auto ptr = bmp.Data();
+    for( uint32_t i=0; i<300*200; i++ )
+    {
+        *ptr++ = half_float::half( float( i % 300 ) / 30 );
+        *ptr++ = half_float::half( float( i / 300 ) / 200 );
+        *ptr++ = half_float::half( -float( i % 17 ) );
+        *ptr++ = half_float::half( 1.f );
+    }
+
+    BitmapLz4 lz4( bmp, &td );
+    CHECK( lz4.IsHdr() );
+
+    auto out = lz4.ToBitmapHdrHalf( &td );
+    CHECK( out->GetColorspace() == Colorspace::BT2020 );
+    CHECK( memcmp( out->Data(), bmp.Data(), size_t( 300 ) * 200 * 8 ) == 0 );
+}
+
+TEST_CASE( "Lz4 bitmap is small for flat images", "[bitmaplz4]" )
+{
+    Bitmap bmp( 512, 512 );
+    bmp.FillBlack( 0, 0, 512, 512 );
+    BitmapLz4 lz4( bmp );
+    CHECK( lz4.Size() < 512 * 512 * 4 / 100 );
+}
@@ -0,0 +1,166 @@
+#include <catch2/catch_all.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/BitmapHdr.hpp>
+#include <src/util/TaskDispatch.hpp>
+
+namespace
+{
+uint32_t Pattern( uint32_t x, uint32_t y )
+{
+    return x | ( y << 16 );
+}
+
+Bitmap MakeBitmap( uint32_t width, uint32_t height )
+{
+    Bitmap bmp( width, height );
+    auto ptr = (uint32_t*)bmp.Data();
+    for( uint32_t y=0; y<height; y++ )
+    {
+        for( uint32_t x=0; x<width; x++ )
+        {
+            *ptr++ = Pattern( x, y );
+        }
+    }
+    return bmp;
+}
+
+// Checks that dst( x, y ) holds the source pixel at src( sx, sy ), as mapped by the rotation.
+template<typename F>
+bool CheckRotated( const Bitmap& bmp, F&& source )
+{
+    auto ptr = (const uint32_t*)bmp.Data();
+    for( uint32_t y=0; y<bmp.Height(); y++ )
+    {
+        for( uint32_t x=0; x<bmp.Width(); x++ )
+        {
+            const auto [sx, sy] = source( x, y );
+            if( *ptr++ != Pattern( sx, sy ) ) return false;
+        }
+    }
+    return true;
+}
+}
+
+TEST_CASE( "Bitmap rotation", "[bitmaprotate]" )
+{
+    TaskDispatch td( 4, "Test" );
+
+    // Sizes cover single pixels, partial tiles and blocks, and multiple blocks.
+    const uint32_t sizes[][2] = { { 1, 1 }, { 3, 5 }, { 8, 8 }, { 13, 70 }, { 130, 67 }, { 200, 9 } };
+
+    for( auto [w, h] : sizes )
+    {
+        for( auto dispatch : { (TaskDispatch*)nullptr, &td } )
+        {
+            auto cw = MakeBitmap( w, h );
+            cw.Rotate90( dispatch );
+            REQUIRE( cw.Width() == h );
+            REQUIRE( cw.Height() == w );
+            REQUIRE( CheckRotated( cw, [h]( uint32_t x, uint32_t y ) { return std::pair( y, h - x - 1 ); } ) );
+
+            auto ccw = MakeBitmap( w, h );
+            ccw.Rotate270( dispatch );
+            REQUIRE( ccw.Width() == h );
+            REQUIRE( ccw.Height() == w );
+            REQUIRE( CheckRotated( ccw, [w]( uint32_t x, uint32_t y ) { return std::pair( w - y - 1, x ); } ) );
+        }
+    }
+}
+
+TEST_CASE( "Bitmap flips and half turn", "[bitmaprotate]" )
+{
+    TaskDispatch td( 4, "Test" );
+
+    // Odd and even sizes, with rows shorter and longer than a vector
+    const uint32_t sizes[][2] = { { 1, 1 }, { 3, 5 }, { 8, 8 }, { 13, 70 }, { 130, 67 } };
+
+    for( auto [w, h] : sizes )
+    {
+        for( auto dispatch : { (TaskDispatch*)nullptr, &td } )
+        {
+            auto v = MakeBitmap( w, h );
+            v.FlipVertical( dispatch );
+            REQUIRE( CheckRotated( v, [h]( uint32_t x, uint32_t y ) { return std::pair( x, h - y - 1 ); } ) );
+
+            auto hz = MakeBitmap( w, h );
+            hz.FlipHorizontal( dispatch );
+            REQUIRE( CheckRotated( hz, [w]( uint32_t x, uint32_t y ) { return std::pair( w - x - 1, y ); } ) );
+
+            auto half = MakeBitmap( w, h );
+            half.Rotate180( dispatch );
+            REQUIRE( CheckRotated( half, [w, h]( uint32_t x, uint32_t y ) { return std::pair( w - x - 1, h - y - 1 ); } ) );
+        }
+    }
+}
+
+TEST_CASE( "Bitmap fill and crop", "[bitmaprotate]" )
+{
+    TaskDispatch td( 4, "Test" );
+
+    for( auto dispatch : { (TaskDispatch*)nullptr, &td } )
+    {
+        auto bmp = MakeBitmap( 100, 60 );
+        bmp.FillBlack( 10, 20, 30, 25, dispatch );
+        REQUIRE( CheckRotated( bmp, []( uint32_t x, uint32_t y ) {
+            return x >= 10 && x < 40 && y >= 20 && y < 45 ? std::pair( 0u, 0xff00u ) : std::pair( x, y );
+        } ) );
+
+        auto crop = MakeBitmap( 100, 60 );
+        crop.Crop( 7, 11, 50, 40, dispatch );
+        REQUIRE( crop.Width() == 50 );
+        REQUIRE( crop.Height() == 40 );
+        REQUIRE( CheckRotated( crop, []( uint32_t x, uint32_t y ) { return std::pair( x + 7, y + 11 ); } ) );
+    }
+}
+
+TEST_CASE( "BitmapHdr rotation", "[bitmaprotate]" )
+{
+    TaskDispatch td( 4, "Test" );
+
+    const uint32_t w = 75;
+    const uint32_t h = 40;
+    BitmapHdr bmp( w, h, Colorspace::BT709 );
+    auto ptr = bmp.Data();
+    for( uint32_t y=0; y<h; y++ )
+    {
+        for( uint32_t x=0; x<w; x++ )
+        {
+            *ptr++ = x;
+            *ptr++ = y;
+            *ptr++ = 0;
+            *ptr++ = 1;
+        }
+    }
+
+    bmp.Rotate90( &td );
+    REQUIRE( bmp.Width() == h );
+    REQUIRE( bmp.Height() == w );
+
+    bool match = true;
+    ptr = bmp.Data();
+    for( uint32_t y=0; y<w; y++ )
+    {
+        for( uint32_t x=0; x<h; x++ )
+        {
+            if( ptr[0] != y || ptr[1] != h - x - 1 || ptr[3] != 1 ) match = false;
+            ptr += 4;
+        }
+    }
+    REQUIRE( match );
+
+    bmp.Rotate270( &td );
+    REQUIRE( bmp.Width() == w );
+    REQUIRE( bmp.Height() == h );
+
+    match = true;
+    ptr = bmp.Data();
+    for( uint32_t y=0; y<h; y++ )
+    {
+        for( uint32_t x=0; x<w; x++ )
+        {
+            if( ptr[0] != x || ptr[1] != y ) match = false;
+            ptr += 4;
+        }
+    }
+    REQUIRE( match );
+}
@@ -0,0 +1,92 @@
+#include <catch2/catch_all.hpp>
+
+#include <string.h>
+
+#include "util/Bitmap.hpp"
+#include "util/BitmapYuv.hpp"
+
+TEST_CASE( "Yuv plane layout", "[bitmapyuv]" )
+{
+    BitmapYuv bmp420( 5, 3, BitmapYuv::Subsampling::S420 );
+    CHECK( bmp420.ChromaWidth() == 3 );
+    CHECK( bmp420.ChromaHeight() == 2 );
+    CHECK( bmp420.CbOffset() == 15 );
+    CHECK( bmp420.CrOffset() == 21 );
+    CHECK( bmp420.Size() == 27 );
+    CHECK( bmp420.Cr() == bmp420.Y() + 21 );
+
+    BitmapYuv bmp422( 4, 3, BitmapYuv::Subsampling::S422 );
+    CHECK( bmp422.ChromaWidth() == 2 );
+    CHECK( bmp422.ChromaHeight() == 3 );
+    CHECK( bmp422.Size() == 24 );
+}
+
+TEST_CASE( "Neutral chroma gives gray", "[bitmapyuv]" )
+{
+    BitmapYuv yuv( 4, 4, BitmapYuv::Subsampling::S420 );
+    for( int i=0; i<16; i++ ) yuv.Y()[i] = uint8_t( i * 16 );
+    memset( yuv.Cb(), 128, 4 );
+    memset( yuv.Cr(), 128, 4 );
+
+    auto bmp = yuv.ToBitmap();
+    REQUIRE( bmp->Width() == 4 );
+    REQUIRE( bmp->Height() == 4 );
+    for( int i=0; i<16; i++ )
+    {
+        const auto px = bmp->Data() + i * 4;
+        CHECK( px[0] == i * 16 );
+        CHECK( px[1] == i * 16 );
+        CHECK( px[2] == i * 16 );
+        CHECK( px[3] == 255 );
+    }
+}
+
+TEST_CASE( "Yuv primaries convert to RGB", "[bitmapyuv]" )
+{
+    BitmapYuv yuv( 2, 1, BitmapYuv::Subsampling::S422 );
+    yuv.Y()[0] = 76;
+    yuv.Y()[1] = 76;
+    yuv.Cb()[0] = 85;
+    yuv.Cr()[0] = 255;
+
+    auto bmp = yuv.ToBitmap();
+    const auto px = bmp->Data();
+    CHECK( px[0] == 254 );
+    CHECK( px[1] == 0 );
+    CHECK( px[2] == 0 );
+    CHECK( memcmp( px, px + 4, 4 ) == 0 );
+}
+
+TEST_CASE( "Chroma is upsampled with a triangle filter", "[bitmapyuv]" )
+{
+    BitmapYuv yuv( 4, 1, BitmapYuv::Subsampling::S422 );
+    memset( yuv.Y(), 100, 4 );
+    memset( yuv.Cb(), 128, 2 );
+    yuv.Cr()[0] = 128;
+    yuv.Cr()[1] = 228;
+
+    auto bmp = yuv.ToBitmap();
+    const auto px = bmp->Data();
+    CHECK( px[0] == 100 );
+    CHECK( px[4] == 135 );
+    CHECK( px[8] == 205 );
+    CHECK( px[12] == 240 );
+}
+
+TEST_CASE( "Vertical chroma taps in 4:2:0", "[bitmapyuv]" )
+{
+    BitmapYuv yuv( 2, 4, BitmapYuv::Subsampling::S420 );
+    memset( yuv.Y(), 100, 8 );
+    yuv.Cb()[0] = 128;
+    yuv.Cb()[1] = 128;
+    yuv.Cr()[0] = 128;
+    yuv.Cr()[1] = 228;
+
+    auto bmp = yuv.ToBitmap();
+    const auto px = bmp->Data();
+    CHECK( px[0] == 100 );
+    CHECK( px[8] == 135 );
+    CHECK( px[16] == 205 );
+    CHECK( px[24] == 240 );
+    CHECK( px[28] == 240 );
+}
@@ -155,4 +155,18 @@ TEST_CASE( "Callstack edge cases", "[callstack][edge]" )
         GetCallstack( data );
         REQUIRE_NOTHROW( PrintCallstack( data, data.count ) );
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE( "Deferred callstacks are printed on flush", "[callstack][deferred]" )
+{
+    WarmCallstacks();
+    GetCallstack( data );
+
+    OutputCapture capture;
+    PrintCallstackDeferred( data );
+    FlushCallstacks();
+    std::string deferred = stripAnsi( capture.getOutput() );
+
+    REQUIRE( deferred.find( "Callstack:" ) != std::string::npos );
+    REQUIRE( deferred == capturePrintCallstack( data, 0 ) );
+}
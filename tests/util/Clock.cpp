@@ -98,3 +98,22 @@ TEST_CASE( "GetTimeMicro functionality", "[clock][time]" )
         REQUIRE( elapsed2 <= 5000 );
     }
 }
+
+TEST_CASE( "MeasureMedian picks the median run", "[clock][median]" )
+{
+    SECTION( "Warm up run is not counted" )
+    {
+        int calls = 0;
+        const double values[] = { 100, 3, 1, 2 };
+        const auto median = MeasureMedian( 3, [&] { return values[calls++]; } );
+        REQUIRE( calls == 4 );
+        REQUIRE( median == 2 );
+    }
+
+    SECTION( "Outliers do not move the result" )
+    {
+        int calls = 0;
+        const double values[] = { 0, 5, 5, 1000, 5, 0 };
+        REQUIRE( MeasureMedian( 5, [&] { return values[calls++]; } ) == 5 );
+    }
+}
@@ -0,0 +1,108 @@
+#include <catch2/catch_all.hpp>
+#include <lcms2.h>
+#include <src/util/CmsCache.hpp>
+#include <string>
+
+namespace
+{
+cmsHTRANSFORM CreateSrgbTransform( cmsUInt32Number format )
+{
+    auto in = cmsCreate_sRGBProfile();
+    auto out = cmsCreate_sRGBProfile();
+    auto transform = cmsCreateTransform( in, format, out, format, INTENT_PERCEPTUAL, 0 );
+    cmsCloseProfile( out );
+    cmsCloseProfile( in );
+    return transform;
+}
+
+CmsCache::Key MakeKey( const char* in, cmsUInt32Number format = TYPE_RGBA_8 )
+{
+    return {
+        .in = CmsCache::Id( in ),
+        .out = CmsCache::Id( "sRGB" ),
+        .inFormat = format,
+        .outFormat = format,
+        .intent = INTENT_PERCEPTUAL,
+        .flags = 0
+    };
+}
+}
+
+TEST_CASE( "CmsCache profile ids", "[cmscache]" )
+{
+    const uint8_t icc[] = { 1, 2, 3, 4 };
+    const float params[] = { 0.3127f, 0.329f };
+
+    REQUIRE( CmsCache::Id( icc, sizeof( icc ) ) == CmsCache::Id( icc, sizeof( icc ) ) );
+    REQUIRE( CmsCache::Id( icc, sizeof( icc ) ) != CmsCache::Id( icc, sizeof( icc ) - 1 ) );
+    REQUIRE( CmsCache::Id( "sRGB" ) == CmsCache::Id( "sRGB" ) );
+    REQUIRE( CmsCache::Id( "sRGB" ) != CmsCache::Id( "CMYK" ) );
+    REQUIRE( CmsCache::Id( "RGB", params, sizeof( params ) ) != CmsCache::Id( "RGB" ) );
+    REQUIRE( CmsCache::Id( "RGB", params, sizeof( params ) ) != CmsCache::Id( "RGB", params, sizeof( float ) ) );
+}
+
+TEST_CASE( "CmsCache lookup", "[cmscache]" )
+{
+    CmsCache::Clear();
+    int created = 0;
+    auto create = [&created] { created++; return CreateSrgbTransform( TYPE_RGBA_8 ); };
+
+    SECTION( "Hits reuse the transform" )
+    {
+        auto t1 = CmsCache::Get( MakeKey( "a" ), create );
+        auto t2 = CmsCache::Get( MakeKey( "a" ), create );
+        REQUIRE( t1 );
+        REQUIRE( t1 == t2 );
+        REQUIRE( created == 1 );
+        REQUIRE( CmsCache::Size() == 1 );
+    }
+
+    SECTION( "Formats are part of the key" )
+    {
+        auto t1 = CmsCache::Get( MakeKey( "a" ), create );
+        auto t2 = CmsCache::Get( MakeKey( "a", TYPE_RGBA_FLT ), [] { return CreateSrgbTransform( TYPE_RGBA_FLT ); } );
+        REQUIRE( t1 != t2 );
+        REQUIRE( CmsCache::Size() == 2 );
+    }
+
+    SECTION( "Failures are not cached" )
+    {
+        auto t = CmsCache::Get( MakeKey( "a" ), [] { return (cmsHTRANSFORM)nullptr; } );
+        REQUIRE( !t );
+        REQUIRE( CmsCache::Size() == 0 );
+    }
+
+    SECTION( "Profiles are only opened on a miss" )
+    {
+        int opened = 0;
+        auto open = [&opened] { opened++; return cmsCreate_sRGBProfile(); };
+        auto t1 = CmsCache::Get( MakeKey( "a" ), open, open );
+        auto t2 = CmsCache::Get( MakeKey( "a" ), open, open );
+        REQUIRE( t1 );
+        REQUIRE( t1 == t2 );
+        REQUIRE( opened == 2 );
+    }
+
+    SECTION( "Least recently used transforms are evicted" )
+    {
+        auto first = CmsCache::Get( MakeKey( "0" ), create );
+        for( int i=1; i<40; i++ )
+        {
+            REQUIRE( CmsCache::Get( MakeKey( std::to_string( i ).c_str() ), create ) );
+            REQUIRE( CmsCache::Get( MakeKey( "0" ), create ) == first );
+        }
+        REQUIRE( CmsCache::Size() == 32 );
+        REQUIRE( created == 40 );
+
+        REQUIRE( CmsCache::Get( MakeKey( "1" ), create ) );
+        REQUIRE( created == 41 );
+
+        // Evicted transforms stay valid while in use
+        CmsCache::Clear();
+        REQUIRE( CmsCache::Size() == 0 );
+        uint8_t px[4] = { 10, 20, 30, 255 };
+        cmsDoTransform( first.get(), px, px, 1 );
+    }
+
+    CmsCache::Clear();
+}
@@ -0,0 +1,99 @@
+#include "TestUtils.hpp"
+#include <catch2/catch_all.hpp>
+#include <fcntl.h>
+#include <src/util/ConfigRegistry.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void writeConfigFile( const TempDir& dir, const char* name, const char* content )
+{
+    const auto path = std::string( dir.path() ) + "/ModernCore/" + name;
+    int fd = open( path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+    REQUIRE( fd >= 0 );
+    REQUIRE( write( fd, content, strlen( content ) ) == (ssize_t)strlen( content ) );
+    close( fd );
+}
+
+TEST_CASE( "ConfigRegistry", "[config][ini]" )
+{
+    const char* originalXdgConfig = getenv( "XDG_CONFIG_HOME" );
+    TempDir configDir = TempDir::create();
+    configDir.createSubdir( "ModernCore" );
+    setenv( "XDG_CONFIG_HOME", configDir.path(), 1 );
+
+    writeConfigFile( configDir, "registry.ini", "[Limits]\nMemory=64\nCallbacks=8" );
+    ConfigRegistry registry;
+
+    SECTION( "Files are read once" )
+    {
+        auto a = registry.Get( "registry.ini" );
+        auto b = registry.Get( "registry.ini" );
+        REQUIRE( a == b );
+        REQUIRE( a->Get( "Limits", "Memory", 0u ) == 64 );
+    }
+
+    SECTION( "Missing files give defaults" )
+    {
+        auto config = registry.Get( "missing.ini" );
+        REQUIRE( !(bool)*config );
+        REQUIRE( config->Get( "Limits", "Memory", 5u ) == 5 );
+    }
+
+    SECTION( "Changed keys notify their subscribers" )
+    {
+        REQUIRE( registry.Descriptor() >= 0 );
+
+        auto old = registry.Get( "registry.ini" );
+        uint32_t memory = 0;
+        int callbacks = 0;
+        const auto memoryId = registry.Subscribe( "registry.ini", "Limits", "Memory", [&]( const Config& config ) { memory = config.Get( "Limits", "Memory", 0u ); } );
+        const auto callbacksId = registry.Subscribe( "registry.ini", "Limits", "Callbacks", [&]( const Config& ) { callbacks++; } );
+
+        writeConfigFile( configDir, "registry.ini", "[Limits]\nMemory=128\nCallbacks=8" );
+        registry.Dispatch();
+        REQUIRE( memory == 128 );
+        REQUIRE( callbacks == 0 );
+        REQUIRE( registry.Get( "registry.ini" )->Get( "Limits", "Memory", 0u ) == 128 );
+        REQUIRE( old->Get( "Limits", "Memory", 0u ) == 64 );
+
+        registry.Unsubscribe( memoryId );
+        writeConfigFile( configDir, "registry.ini", "[Limits]\nMemory=256" );
+        registry.Dispatch();
+        REQUIRE( memory == 128 );
+        REQUIRE( callbacks == 1 );
+        registry.Unsubscribe( callbacksId );
+    }
+
+    SECTION( "Removed files fall back to defaults" )
+    {
+        int called = 0;
+        const auto id = registry.Subscribe( "registry.ini", "Limits", "Memory", [&]( const Config& config ) {
+            called++;
+            REQUIRE( config.Get( "Limits", "Memory", 7u ) == 7 );
+        } );
+        unlink( ( std::string( configDir.path() ) + "/ModernCore/registry.ini" ).c_str() );
+        registry.Dispatch();
+        REQUIRE( called == 1 );
+        registry.Unsubscribe( id );
+    }
+
+    SECTION( "Other files in the directory are ignored" )
+    {
+        int called = 0;
+        const auto id = registry.Subscribe( "registry.ini", "Limits", "Memory", [&]( const Config& ) { called++; } );
+        writeConfigFile( configDir, "other.ini", "[Limits]\nMemory=1" );
+        registry.Dispatch();
+        REQUIRE( called == 0 );
+        registry.Unsubscribe( id );
+    }
+
+    if( originalXdgConfig )
+    {
+        setenv( "XDG_CONFIG_HOME", originalXdgConfig, 1 );
+    }
+    else
+    {
+        unsetenv( "XDG_CONFIG_HOME" );
+    }
+}
@@ -0,0 +1,47 @@
+#include <catch2/catch_all.hpp>
+#include <sched.h>
+#include <src/util/CpuTopology.hpp>
+
+TEST_CASE( "ParseCpuList", "[cputopology][parse]" )
+{
+    SECTION( "Single values and ranges" )
+    {
+        REQUIRE( ParseCpuList( "3" ) == std::vector<uint32_t> { 3 } );
+        REQUIRE( ParseCpuList( "0-3" ) == std::vector<uint32_t> { 0, 1, 2, 3 } );
+        REQUIRE( ParseCpuList( "0-1,4,6-7" ) == std::vector<uint32_t> { 0, 1, 4, 6, 7 } );
+    }
+
+    SECTION( "Whitespace, order and duplicates" )
+    {
+        REQUIRE( ParseCpuList( " 5, 1-2 ,2 " ) == std::vector<uint32_t> { 1, 2, 5 } );
+    }
+
+    SECTION( "Invalid input" )
+    {
+        REQUIRE( ParseCpuList( nullptr ).empty() );
+        REQUIRE( ParseCpuList( "" ).empty() );
+        REQUIRE( ParseCpuList( "a" ).empty() );
+        REQUIRE( ParseCpuList( "1-" ).empty() );
+        REQUIRE( ParseCpuList( "3-1" ).empty() );
+        REQUIRE( ParseCpuList( "1,,2" ).empty() );
+        REQUIRE( ParseCpuList( "1;2" ).empty() );
+    }
+}
+
+TEST_CASE( "GetCpuClasses", "[cputopology][classes]" )
+{
+    cpu_set_t set;
+    REQUIRE( sched_getaffinity( 0, sizeof( set ), &set ) == 0 );
+
+    const auto classes = GetCpuClasses();
+    REQUIRE( !classes.empty() );
+
+    size_t total = 0;
+    for( auto& cls : classes )
+    {
+        REQUIRE( !cls.empty() );
+        for( auto cpu : cls ) REQUIRE( CPU_ISSET( cpu, &set ) );
+        total += cls.size();
+    }
+    REQUIRE( total == size_t( CPU_COUNT( &set ) ) );
+}
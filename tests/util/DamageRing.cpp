@@ -0,0 +1,69 @@
+#include <catch2/catch_all.hpp>
+#include <src/util/DamageRing.hpp>
+
+TEST_CASE( "DamageRing buffer age", "[damagering]" )
+{
+    const Region::Rect bounds = { 0, 0, 100, 100 };
+    const Region a( { 0, 0, 10, 10 } );
+    const Region b( { 50, 50, 60, 60 } );
+
+    SECTION( "First frame repaints everything" )
+    {
+        DamageRing ring( bounds );
+        REQUIRE( ring.Frame( a, 1 ).Area() == 10000 );
+    }
+
+    SECTION( "Buffer of the previous frame only needs the new damage" )
+    {
+        DamageRing ring( bounds );
+        (void)ring.Frame( a, 0 );
+        REQUIRE( ring.Frame( b, 1 ).Bounds() == b.Bounds() );
+    }
+
+    SECTION( "Older buffer accumulates the frames it missed" )
+    {
+        DamageRing ring( bounds );
+        (void)ring.Frame( Region( bounds ), 0 );
+        (void)ring.Frame( a, 1 );
+        const auto repaint = ring.Frame( b, 2 );
+        REQUIRE( repaint.Area() == 200 );
+        REQUIRE( repaint.Contains( a.Bounds() ) );
+        REQUIRE( repaint.Contains( b.Bounds() ) );
+    }
+
+    SECTION( "Unknown or too old buffers repaint everything" )
+    {
+        DamageRing ring( bounds, 2 );
+        for( int i=0; i<4; i++ ) (void)ring.Frame( a, 1 );
+        REQUIRE( ring.Frame( b, 0 ).Area() == 10000 );
+        REQUIRE( ring.Frame( b, 3 ).Area() == 10000 );
+        REQUIRE( ring.Frame( b, 2 ).Area() == 100 );
+    }
+
+    SECTION( "Damage outside the output is dropped" )
+    {
+        DamageRing ring( bounds );
+        (void)ring.Frame( a, 0 );
+        REQUIRE( ring.Frame( Region( { 90, 90, 200, 200 } ), 1 ).Area() == 100 );
+    }
+
+    SECTION( "Buffers of different ages from one frame" )
+    {
+        DamageRing ring( bounds );
+        ring.Add( Region( bounds ) );
+        ring.Add( a );
+        ring.Add( b );
+        REQUIRE( ring.Since( 1 ).Bounds() == b.Bounds() );
+        REQUIRE( ring.Since( 2 ).Area() == 200 );
+        REQUIRE( ring.Since( 3 ).Area() == 10000 );
+        REQUIRE( ring.Since( 0 ).Area() == 10000 );
+    }
+
+    SECTION( "Reset invalidates the history" )
+    {
+        DamageRing ring( bounds );
+        (void)ring.Frame( a, 0 );
+        ring.Reset( { 0, 0, 50, 50 } );
+        REQUIRE( ring.Frame( b, 1 ).Area() == 2500 );
+    }
+}
@@ -0,0 +1,149 @@
+#include <atomic>
+#include <catch2/catch_all.hpp>
+#include <chrono>
+#include <src/util/EventLoop.hpp>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+
+TEST_CASE( "EventLoop descriptors", "[eventloop]" )
+{
+    EventLoop loop;
+    int fds[2];
+    REQUIRE( pipe( fds ) == 0 );
+
+    std::vector<char> received;
+    loop.AddFd( fds[0], EPOLLIN, [&]( uint32_t events ) {
+        REQUIRE( ( events & EPOLLIN ) != 0 );
+        char buf[16];
+        const auto sz = read( fds[0], buf, sizeof( buf ) );
+        received.insert( received.end(), buf, buf + sz );
+    } );
+
+    SECTION( "Nothing ready times out" )
+    {
+        REQUIRE( loop.Dispatch( 0 ) );
+        REQUIRE( received.empty() );
+    }
+
+    SECTION( "Readable descriptor is dispatched" )
+    {
+        REQUIRE( write( fds[1], "abc", 3 ) == 3 );
+        REQUIRE( loop.Dispatch( 1000 ) );
+        REQUIRE( received == std::vector<char> { 'a', 'b', 'c' } );
+    }
+
+    SECTION( "Removed descriptor is not dispatched" )
+    {
+        loop.RemoveFd( fds[0] );
+        REQUIRE( write( fds[1], "abc", 3 ) == 3 );
+        REQUIRE( loop.Dispatch( 0 ) );
+        REQUIRE( received.empty() );
+    }
+
+    SECTION( "Callback may remove its own descriptor" )
+    {
+        loop.RemoveFd( fds[0] );
+        int calls = 0;
+        loop.AddFd( fds[0], EPOLLIN, [&]( uint32_t ) { calls++; loop.RemoveFd( fds[0] ); } );
+        REQUIRE( write( fds[1], "x", 1 ) == 1 );
+        REQUIRE( loop.Dispatch( 1000 ) );
+        REQUIRE( loop.Dispatch( 0 ) );
+        REQUIRE( calls == 1 );
+    }
+
+    loop.RemoveFd( fds[0] );
+    close( fds[0] );
+    close( fds[1] );
+}
+
+TEST_CASE( "EventLoop timers", "[eventloop]" )
+{
+    EventLoop loop;
+
+    SECTION( "One shot timer fires once" )
+    {
+        int calls = 0;
+        const auto timer = loop.AddTimer( 1000, 0, [&] { calls++; } );
+        REQUIRE( loop.Dispatch( 1000 ) );
+        REQUIRE( calls == 1 );
+        REQUIRE( loop.Dispatch( 20 ) );
+        REQUIRE( calls == 1 );
+        loop.RemoveTimer( timer );
+    }
+
+    SECTION( "Periodic timer fires repeatedly" )
+    {
+        int calls = 0;
+        const auto timer = loop.AddTimer( 1000, 1000, [&] { calls++; } );
+        while( calls < 3 ) REQUIRE( loop.Dispatch( 1000 ) );
+        loop.RemoveTimer( timer );
+    }
+
+    SECTION( "Disarmed timer does not fire" )
+    {
+        int calls = 0;
+        const auto timer = loop.AddTimer( 5000, 0, [&] { calls++; } );
+        loop.SetTimer( timer, 0 );
+        REQUIRE( loop.Dispatch( 20 ) );
+        REQUIRE( calls == 0 );
+        loop.RemoveTimer( timer );
+    }
+}
+
+TEST_CASE( "EventLoop prepare hooks", "[eventloop]" )
+{
+    EventLoop loop;
+
+    int prepared = 0;
+    int finished = 0;
+    const auto id = loop.AddPrepare( [&] { prepared++; return 0; }, [&] { finished++; } );
+
+    SECTION( "Hooks run around each dispatch" )
+    {
+        // The prepare timeout is used instead of blocking forever
+        REQUIRE( loop.Dispatch() );
+        REQUIRE( loop.Dispatch() );
+        REQUIRE( prepared == 2 );
+        REQUIRE( finished == 2 );
+    }
+
+    SECTION( "Removed hooks do not run" )
+    {
+        loop.RemovePrepare( id );
+        REQUIRE( loop.Dispatch( 0 ) );
+        REQUIRE( prepared == 0 );
+        REQUIRE( finished == 0 );
+    }
+}
+
+TEST_CASE( "EventLoop cross thread use", "[eventloop]" )
+{
+    EventLoop loop;
+
+    SECTION( "Posted callbacks run on the loop thread" )
+    {
+        const auto loopThread = std::this_thread::get_id();
+        std::atomic<bool> done = false;
+        std::thread poster( [&] {
+            loop.Post( [&] {
+                REQUIRE( std::this_thread::get_id() == loopThread );
+                done = true;
+            } );
+        } );
+        while( !done ) REQUIRE( loop.Dispatch( 1000 ) );
+        poster.join();
+    }
+
+    SECTION( "Stop ends Run from another thread" )
+    {
+        std::thread stopper( [&] {
+            std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+            loop.Stop();
+        } );
+        loop.Run();
+        stopper.join();
+        REQUIRE( loop.IsStopped() );
+        REQUIRE_FALSE( loop.Dispatch( 0 ) );
+    }
+}
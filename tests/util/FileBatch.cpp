@@ -0,0 +1,108 @@
+#include "TestUtils.hpp"
+#include <catch2/catch_all.hpp>
+#include <src/util/FileBatch.hpp>
+#include <src/util/PathList.hpp>
+#include <src/util/TaskDispatch.hpp>
+#include <string.h>
+#include <string>
+#include <sys/stat.h>
+#include <vector>
+
+namespace
+{
+// More files than are kept in flight, with a directory, a missing file and an empty file mixed in
+std::vector<std::string> CreateFiles( TempDir& dir )
+{
+    std::vector<std::string> paths;
+    for( int i=0; i<300; i++ )
+    {
+        const auto name = std::to_string( i );
+        const auto content = "file " + name + " contents";
+        paths.emplace_back( dir.createFile( name.c_str(), content.c_str(), content.size() ) );
+    }
+    dir.createSubdir( "dir" );
+    paths.emplace( paths.begin() + 10, dir.filePath( "dir" ) );
+    paths.emplace( paths.begin() + 20, dir.filePath( "missing" ) );
+    paths.emplace( paths.begin() + 30, dir.createFile( "empty" ) );
+    return paths;
+}
+
+void CheckHeaders( const std::vector<std::string>& paths, const std::vector<FileBatch::Header>& headers, size_t length )
+{
+    REQUIRE( headers.size() == paths.size() );
+    for( size_t i=0; i<paths.size(); i++ )
+    {
+        struct stat st;
+        const auto regular = stat( paths[i].c_str(), &st ) == 0 && S_ISREG( st.st_mode );
+        REQUIRE( headers[i].regular == regular );
+        if( !regular ) continue;
+
+        CHECK( headers[i].size == uint64_t( st.st_size ) );
+        CHECK( headers[i].mtime.tv_sec == st.st_mtim.tv_sec );
+        CHECK( headers[i].mtime.tv_nsec == st.st_mtim.tv_nsec );
+
+        const auto expected = std::min<size_t>( length, st.st_size );
+        REQUIRE( headers[i].length == expected );
+        CHECK( memcmp( headers[i].data, "file ", std::min<size_t>( expected, 5 ) ) == 0 );
+    }
+}
+}
+
+TEST_CASE( "FileBatch headers", "[filebatch]" )
+{
+    auto dir = TempDir::create();
+    const auto paths = CreateFiles( dir );
+
+    SECTION( "Header and stat" )
+    {
+        CheckHeaders( paths, FileBatch::ReadHeaders( paths, 12 ), 12 );
+    }
+
+    SECTION( "Stat only" )
+    {
+        CheckHeaders( paths, FileBatch::ReadHeaders( paths, 0 ), 0 );
+    }
+
+    SECTION( "Length is clamped" )
+    {
+        CheckHeaders( paths, FileBatch::ReadHeaders( paths, 1000 ), FileBatch::MaxHeader );
+    }
+
+    SECTION( "With workers" )
+    {
+        TaskDispatch td( 4, "Batch" );
+        CheckHeaders( paths, FileBatch::ReadHeaders( paths, 12, &td ), 12 );
+    }
+
+    SECTION( "Path list" )
+    {
+        const PathList list( paths );
+        REQUIRE( list.Prefix() == dir.path() + std::string( "/" ) );
+        CheckHeaders( paths, FileBatch::ReadHeaders( list, 12 ), 12 );
+
+        PathList missing( dir.filePath( "missing" ) );
+        missing.Add( "0" );
+        const auto headers = FileBatch::ReadHeaders( missing, 12 );
+        REQUIRE( headers.size() == 1 );
+        CHECK( !headers[0].regular );
+    }
+
+    SECTION( "Empty list" )
+    {
+        CHECK( FileBatch::ReadHeaders( std::vector<std::string> {}, 12 ).empty() );
+        CHECK( FileBatch::ReadHeaders( PathList(), 12 ).empty() );
+    }
+}
+
+TEST_CASE( "FileBatch prefetch", "[filebatch]" )
+{
+    auto dir = TempDir::create();
+    const auto paths = CreateFiles( dir );
+
+    FileBatch::Prefetch( paths );
+    FileBatch::Prefetch( std::vector<std::string> {} );
+
+    TaskDispatch td( 4, "Batch" );
+    FileBatch::Prefetch( paths, &td );
+    FileBatch::Prefetch( PathList( paths ), &td );
+}
@@ -0,0 +1,82 @@
+#include <catch2/catch_all.hpp>
+#include <src/util/FrameScheduler.hpp>
+
+TEST_CASE( "FrameScheduler fixed refresh", "[framescheduler]" )
+{
+    FrameScheduler scheduler( 16000, 4000 );
+
+    SECTION( "Nothing is scheduled without damage" )
+    {
+        REQUIRE( scheduler.IsIdle() );
+        REQUIRE( scheduler.NextFrame( 1000 ) == 0 );
+    }
+
+    SECTION( "First frame starts immediately" )
+    {
+        scheduler.Damage();
+        REQUIRE( scheduler.NextFrame( 1000 ) == 1000 );
+    }
+
+    SECTION( "Frame starts one deadline before the next vblank" )
+    {
+        scheduler.Presented( 100000 );
+        scheduler.Damage();
+        REQUIRE( scheduler.NextFrame( 101000 ) == 112000 );
+    }
+
+    SECTION( "Missed deadline aims at a later vblank" )
+    {
+        scheduler.Presented( 100000 );
+        scheduler.Damage();
+        REQUIRE( scheduler.NextFrame( 113000 ) == 128000 );
+        REQUIRE( scheduler.NextFrame( 150000 ) == 160000 );
+    }
+
+    SECTION( "No frame while one is in flight" )
+    {
+        scheduler.Damage();
+        scheduler.Begin();
+        scheduler.Damage();
+        REQUIRE_FALSE( scheduler.IsIdle() );
+        REQUIRE( scheduler.NextFrame( 1000 ) == 0 );
+        scheduler.Presented( 16000 );
+        REQUIRE( scheduler.NextFrame( 17000 ) == 28000 );
+    }
+
+    SECTION( "Cancelled frame is scheduled again after damage" )
+    {
+        scheduler.Damage();
+        scheduler.Begin();
+        scheduler.Cancel();
+        REQUIRE( scheduler.IsIdle() );
+        scheduler.Damage();
+        REQUIRE( scheduler.NextFrame( 1000 ) == 1000 );
+    }
+
+    SECTION( "Presented frame without new damage goes idle" )
+    {
+        scheduler.Damage();
+        scheduler.Begin();
+        scheduler.Presented( 16000 );
+        REQUIRE( scheduler.IsIdle() );
+        REQUIRE( scheduler.NextFrame( 17000 ) == 0 );
+    }
+}
+
+TEST_CASE( "FrameScheduler variable refresh", "[framescheduler]" )
+{
+    FrameScheduler scheduler( 7000, 4000 );
+    scheduler.SetVrr( true );
+    scheduler.Presented( 100000 );
+    scheduler.Damage();
+
+    SECTION( "Limited by the maximum refresh rate" )
+    {
+        REQUIRE( scheduler.NextFrame( 101000 ) == 103000 );
+    }
+
+    SECTION( "Late frame starts immediately" )
+    {
+        REQUIRE( scheduler.NextFrame( 150000 ) == 150000 );
+    }
+}
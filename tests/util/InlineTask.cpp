@@ -0,0 +1,62 @@
+#include <catch2/catch_all.hpp>
+#include <memory>
+#include <src/util/InlineTask.hpp>
+
+TEST_CASE( "InlineTask basic usage", "[inlinetask]" )
+{
+    SECTION( "Default constructed task is empty" )
+    {
+        InlineTask task;
+        REQUIRE_FALSE( task );
+    }
+
+    SECTION( "Calling invokes the callable" )
+    {
+        int counter = 0;
+        InlineTask task( [&counter] { counter++; } );
+        REQUIRE( task );
+        task();
+        task();
+        REQUIRE( counter == 2 );
+    }
+
+    SECTION( "Move transfers ownership" )
+    {
+        int counter = 0;
+        InlineTask a( [&counter] { counter++; } );
+        InlineTask b( std::move( a ) );
+        REQUIRE_FALSE( a );
+        REQUIRE( b );
+        b();
+
+        InlineTask c;
+        c = std::move( b );
+        REQUIRE_FALSE( b );
+        c();
+        REQUIRE( counter == 2 );
+    }
+
+    SECTION( "Captures are destroyed exactly once" )
+    {
+        auto ptr = std::make_shared<int>( 0 );
+        {
+            InlineTask a( [ptr] { (*ptr)++; } );
+            REQUIRE( ptr.use_count() == 2 );
+            InlineTask b( std::move( a ) );
+            REQUIRE( ptr.use_count() == 2 );
+            b();
+            b.Reset();
+            REQUIRE( ptr.use_count() == 1 );
+        }
+        REQUIRE( ptr.use_count() == 1 );
+        REQUIRE( *ptr == 1 );
+    }
+
+    SECTION( "Capacity is enforced at compile time" )
+    {
+        struct Small { void* p[4]; void operator()() {} };
+        struct Large { char data[InlineTask::Capacity + 1]; void operator()() {} };
+        STATIC_REQUIRE( InlineTask::Fits<Small> );
+        STATIC_REQUIRE_FALSE( InlineTask::Fits<Large> );
+    }
+}
@@ -2,7 +2,9 @@
 #include <catch2/catch_all.hpp>
 #include <src/util/Logs.hpp>
 #include <sys/stat.h>
+#include <thread>
 #include <unistd.h>
+#include <vector>
 
 static std::string captureLogOutput( LogLevel level, const char* msg )
 {
@@ -368,4 +370,97 @@ TEST_CASE( "Log levels can be changed multiple times", "[logs][state]" )
     REQUIRE( GetLogLevel() == LogLevel::Info );
 
     SetLogLevel( originalLevel );
-}
\ No newline at end of file
+}
+
+TEST_CASE( "Asynchronous logging", "[logs][async]" )
+{
+    LogLevel originalLevel = GetLogLevel();
+    SetLogLevel( LogLevel::Debug );
+
+    SECTION( "Queued messages are written on flush" )
+    {
+        OutputCapture capture;
+        SetLogAsync( true );
+        mclog( LogLevel::Info, "queued message" );
+        LogFlush();
+        SetLogAsync( false );
+        REQUIRE( stripAnsi( capture.getOutput() ).find( "queued message" ) != std::string::npos );
+    }
+
+    SECTION( "Messages of all threads are written once logging is synchronous again" )
+    {
+        OutputCapture capture;
+        SetLogAsync( true );
+        std::vector<std::thread> threads;
+        for( int i=0; i<4; i++ )
+        {
+            threads.emplace_back( [i] {
+                for( int j=0; j<50; j++ ) mclog( LogLevel::Debug, "thread %d message %d", i, j );
+            } );
+        }
+        for( auto& t : threads ) t.join();
+        SetLogAsync( false );
+
+        const auto output = stripAnsi( capture.getOutput() );
+        for( int i=0; i<4; i++ )
+        {
+            REQUIRE( output.find( "thread " + std::to_string( i ) + " message 49" ) != std::string::npos );
+        }
+    }
+
+    SECTION( "Errors are written right away" )
+    {
+        OutputCapture capture;
+        SetLogAsync( true );
+        mclog( LogLevel::Info, "before error" );
+        mclog( LogLevel::Error, "error message" );
+        const auto output = stripAnsi( capture.getOutput() );
+        SetLogAsync( false );
+
+        const auto before = output.find( "before error" );
+        const auto error = output.find( "error message" );
+        REQUIRE( before != std::string::npos );
+        REQUIRE( error != std::string::npos );
+        REQUIRE( before < error );
+    }
+
+    SECTION( "Long messages bypass the queue" )
+    {
+        OutputCapture capture;
+        SetLogAsync( true );
+        std::string longMsg( 32 * 1024, 'X' );
+        mclog( LogLevel::Info, "%s", longMsg.c_str() );
+        const auto output = stripAnsi( capture.getOutput() );
+        SetLogAsync( false );
+        REQUIRE( output.find( longMsg ) != std::string::npos );
+    }
+
+    SECTION( "Deferred messages are formatted by the writer" )
+    {
+        OutputCapture capture;
+        SetLogAsync( true );
+        const char* missing = nullptr;
+        char name[16] = "buffer";
+        mclog( LogLevel::Info, "values %d %zu %.2f %c %s", -7, size_t( 42 ), 1.5, 'q', "literal" );
+        mclog( LogLevel::Info, "strings %s %s", name, missing );
+        name[0] = 'X';
+        LogFlush();
+        SetLogAsync( false );
+
+        const auto output = stripAnsi( capture.getOutput() );
+        REQUIRE( output.find( "values -7 42 1.50 q literal" ) != std::string::npos );
+        REQUIRE( output.find( "strings buffer (null)" ) != std::string::npos );
+    }
+
+    SECTION( "Messages below the set level are not evaluated" )
+    {
+        REQUIRE( LogDetail::IsCompiled( LogLevel::Callstack ) );
+        REQUIRE( LogDetail::IsCompiled( LogLevel::Error ) );
+        int calls = 0;
+        SetLogLevel( LogLevel::Warning );
+        mclog( LogLevel::Info, "%d", ++calls );
+        REQUIRE( calls == 0 );
+    }
+
+    SetLogLevel( originalLevel );
+}
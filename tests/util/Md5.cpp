@@ -0,0 +1,34 @@
+#include <catch2/catch_all.hpp>
+#include <src/util/Md5.hpp>
+#include <string.h>
+#include <string>
+
+TEST_CASE( "Md5 matches the RFC 1321 test suite", "[md5]" )
+{
+    const std::pair<const char*, const char*> vectors[] = {
+        { "", "d41d8cd98f00b204e9800998ecf8427e" },
+        { "a", "0cc175b9c0f1b6a831c399e269772661" },
+        { "abc", "900150983cd24fb0d6963f7d28e17f72" },
+        { "message digest", "f96b697d7cb7938d525a2f31aaf161d0" },
+        { "abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b" },
+        { "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789", "d174ab98d277d9f5a5611c2c9f419d9f" },
+        { "12345678901234567890123456789012345678901234567890123456789012345678901234567890", "57edf4a22be3c955ac49da2e2107b67a" }
+    };
+
+    for( auto& [input, digest] : vectors )
+    {
+        REQUIRE( Md5Hex( input, strlen( input ) ) == digest );
+    }
+}
+
+TEST_CASE( "Md5 pads at the block boundary", "[md5]" )
+{
+    // 55 bytes fit the length in the last block, 56 bytes need another one
+    REQUIRE( Md5Hex( std::string( 55, 'a' ).data(), 55 ) == "ef1772b6dff9a122358552954ad0df65" );
+    REQUIRE( Md5Hex( std::string( 56, 'a' ).data(), 56 ) == "3b0c8ac703f828b04c6c197006d17218" );
+    REQUIRE( Md5Hex( std::string( 64, 'a' ).data(), 64 ) == "014842d480b571495a4a0363793f7367" );
+
+    const auto digest = Md5( "abc", 3 );
+    REQUIRE( digest[0] == 0x90 );
+    REQUIRE( digest[15] == 0x72 );
+}
@@ -5,6 +5,7 @@
 #include <src/util/MemoryBuffer.hpp>
 #include <string.h>
 #include <string>
+#include <thread>
 #include <unistd.h>
 #include <vector>
 
@@ -131,6 +132,55 @@ TEST_CASE( "MemoryBuffer functionality", "[memorybuffer][buffer]" )
         REQUIRE( memcmp( memBuffer.data(), largeContent.data(), largeContent.size() ) == 0 );
     }
 
+    SECTION( "Constructor with file descriptor not at start - reads remaining content" )
+    {
+        const char* testContent = "Skipped header, then the content";
+        int fd = createTempFileWithContent( testContent, strlen( testContent ) );
+        REQUIRE( fd >= 0 );
+        lseek( fd, 16, SEEK_SET );
+
+        MemoryBuffer memBuffer( fd );
+
+        REQUIRE( memBuffer.AsString() == "then the content" );
+    }
+
+    SECTION( "Constructor with pipe - reads everything the writer sends" )
+    {
+        std::vector<char> largeContent = BinaryPattern::random( 1'000'000 );
+        int fds[2];
+        REQUIRE( pipe( fds ) == 0 );
+
+        std::thread writer( [&] {
+            size_t pos = 0;
+            while( pos < largeContent.size() )
+            {
+                auto len = write( fds[1], largeContent.data() + pos, std::min<size_t>( largeContent.size() - pos, 100'000 ) );
+                if( len <= 0 ) break;
+                pos += len;
+            }
+            close( fds[1] );
+        } );
+
+        MemoryBuffer memBuffer( fds[0] );
+        writer.join();
+
+        REQUIRE( memBuffer.size() == largeContent.size() );
+        REQUIRE( memcmp( memBuffer.data(), largeContent.data(), largeContent.size() ) == 0 );
+    }
+
+    SECTION( "Constructor with empty pipe" )
+    {
+        int fds[2];
+        REQUIRE( pipe( fds ) == 0 );
+        close( fds[1] );
+
+        MemoryBuffer memBuffer( fds[0] );
+
+        REQUIRE( memBuffer.data() == nullptr );
+        REQUIRE( memBuffer.size() == 0 );
+        REQUIRE( memBuffer.AsString().empty() );
+    }
+
     SECTION( "AsString with binary data containing null bytes" )
     {
         std::vector<char> binaryData = { 'H', 'i', '\0', 'T', 'h', 'e', 'r', 'e' };
@@ -0,0 +1,74 @@
+#include <catch2/catch_all.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/MemoryStats.hpp>
+#include <src/util/PixelPool.hpp>
+#include <string>
+
+using MemoryStats::Pool;
+
+TEST_CASE( "MemoryStats accounting", "[memorystats]" )
+{
+    SECTION( "Pools count allocations until they are freed" )
+    {
+        const auto before = MemoryStats::Current();
+        int a, b;
+        MemoryStats::Alloc( Pool::Staging, &a, 1000 );
+        MemoryStats::Alloc( Pool::Textures, &b, 500 );
+
+        auto now = MemoryStats::Current();
+        CHECK( now.bytes[(size_t)Pool::Staging] == before.bytes[(size_t)Pool::Staging] + 1000 );
+        CHECK( now.bytes[(size_t)Pool::Textures] == before.bytes[(size_t)Pool::Textures] + 500 );
+        CHECK( now.total == before.total + 1500 );
+        CHECK( now.total == now.Total() );
+
+        MemoryStats::Free( Pool::Staging, &a, 1000 );
+        MemoryStats::Free( Pool::Textures, &b, 500 );
+        CHECK( MemoryStats::Current().total == before.total );
+    }
+
+    SECTION( "Watermarks keep the highest usage" )
+    {
+        const auto base = MemoryStats::Current().total;
+        int a, b;
+
+        MemoryStats::Watermark mark;
+        MemoryStats::Alloc( Pool::Buffers, &a, 4000 );
+        MemoryStats::Free( Pool::Buffers, &a, 4000 );
+        MemoryStats::Alloc( Pool::Staging, &b, 3000 );
+
+        const auto peak = mark.Peak();
+        CHECK( peak.bytes[(size_t)Pool::Buffers] >= 4000 );
+        CHECK( peak.bytes[(size_t)Pool::Staging] >= 3000 );
+        CHECK( peak.total == base + 4000 );
+
+        MemoryStats::Free( Pool::Staging, &b, 3000 );
+        CHECK( mark.Peak().total == base + 4000 );
+    }
+
+    SECTION( "Bitmaps go to their pool, pooled buffers to the cache" )
+    {
+        PixelPoolTrim();
+        const auto before = MemoryStats::Current();
+        {
+            Bitmap bmp( 1024, 1024 );
+            const auto now = MemoryStats::Current();
+            CHECK( now.bytes[(size_t)Pool::Bitmap] == before.bytes[(size_t)Pool::Bitmap] + 4 * 1024 * 1024 );
+        }
+        auto now = MemoryStats::Current();
+        CHECK( now.bytes[(size_t)Pool::Bitmap] == before.bytes[(size_t)Pool::Bitmap] );
+        CHECK( now.bytes[(size_t)Pool::PixelCache] == before.bytes[(size_t)Pool::PixelCache] + 4 * 1024 * 1024 );
+
+        PixelPoolTrim();
+        CHECK( MemoryStats::Current().bytes[(size_t)Pool::PixelCache] == 0 );
+    }
+
+    SECTION( "Format lists the used pools" )
+    {
+        MemoryStats::Usage usage;
+        usage.bytes[(size_t)Pool::Bitmap] = 3 * 1024 * 1024;
+        usage.bytes[(size_t)Pool::Textures] = 1024 * 1024 / 2;
+        usage.total = usage.Total();
+        CHECK( usage.Format() == "3.5 MiB (Bitmap 3.0, Textures 0.5)" );
+        CHECK( MemoryStats::Usage().Format() == "0.0 MiB" );
+    }
+}
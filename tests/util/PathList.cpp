@@ -0,0 +1,82 @@
+#include <catch2/catch_all.hpp>
+
+#include <string.h>
+
+#include "util/PathList.hpp"
+
+TEST_CASE( "Natural order", "[pathlist]" )
+{
+    CHECK( NaturalLess( "img2.png", "img10.png" ) );
+    CHECK( !NaturalLess( "img10.png", "img2.png" ) );
+    CHECK( NaturalLess( "a", "b" ) );
+    CHECK( NaturalLess( "a", "ab" ) );
+    CHECK( !NaturalLess( "abc", "abc" ) );
+    CHECK( NaturalLess( "img002", "img10" ) );
+    CHECK( NaturalLess( "img2", "img02" ) );
+    CHECK( !NaturalLess( "img02", "img2" ) );
+    CHECK( NaturalLess( "x1y2", "x1y10" ) );
+    CHECK( NaturalLess( "99999999999999999999999", "100000000000000000000000" ) );
+}
+
+TEST_CASE( "Path list", "[pathlist]" )
+{
+    SECTION( "Names in a directory" )
+    {
+        PathList list( "/images" );
+        CHECK( list.Prefix() == "/images/" );
+        list.Add( "img10.png" );
+        list.Add( "img2.png" );
+        list.Add( "img1.png" );
+        list.Sort();
+
+        REQUIRE( list.Size() == 3 );
+        CHECK( list.NameView( 0 ) == "img1.png" );
+        CHECK( list.NameView( 1 ) == "img2.png" );
+        CHECK( list.NameView( 2 ) == "img10.png" );
+        CHECK( strcmp( list.Name( 2 ), "img10.png" ) == 0 );
+        CHECK( list.Path( 1 ) == "/images/img2.png" );
+
+        CHECK( list.Is( 2, "/images/img10.png" ) );
+        CHECK( !list.Is( 2, "/images/img10.pn" ) );
+        CHECK( !list.Is( 2, "/other/img10.png" ) );
+
+        CHECK( list.Find( "/images/img2.png" ) == 1 );
+        CHECK( list.Find( "/images/img3.png" ) == PathList::npos );
+        CHECK( list.Find( "/other/img2.png" ) == PathList::npos );
+
+        CHECK( list.LowerBound( "/images/img2.png" ) == 1 );
+        CHECK( list.LowerBound( "/images/img3.png" ) == 2 );
+        CHECK( list.LowerBound( "/images/img99.png" ) == 3 );
+        CHECK( list.LowerBound( "/other/img2.png" ) == 3 );
+
+        list.Clear();
+        CHECK( list.Empty() );
+        CHECK( list.Prefix().empty() );
+    }
+
+    SECTION( "Common directory of paths" )
+    {
+        PathList list( std::vector<std::string> { "/a/b/c.png", "/a/bb/d.png", "/a/e.png" } );
+        CHECK( list.Prefix() == "/a/" );
+        REQUIRE( list.Size() == 3 );
+        CHECK( list.NameView( 0 ) == "b/c.png" );
+        CHECK( list.Path( 1 ) == "/a/bb/d.png" );
+        CHECK( list.Path( 2 ) == "/a/e.png" );
+
+        PathList relative( std::vector<std::string> { "a.png", "dir/b.png" } );
+        CHECK( relative.Prefix().empty() );
+        CHECK( relative.Path( 1 ) == "dir/b.png" );
+
+        PathList single( std::vector<std::string> { "/x/y.png" } );
+        CHECK( single.Prefix() == "/x/" );
+        CHECK( single.NameView( 0 ) == "y.png" );
+    }
+
+    SECTION( "No prefix" )
+    {
+        PathList list( "" );
+        list.Add( "/abs/path.png" );
+        CHECK( list.Path( 0 ) == "/abs/path.png" );
+        CHECK( list.Find( "/abs/path.png" ) == 0 );
+    }
+}
@@ -0,0 +1,56 @@
+#include <catch2/catch_all.hpp>
+#include <stdint.h>
+#include <string.h>
+#include <src/util/PixelPool.hpp>
+
+TEST_CASE( "PixelPool allocation", "[pixelpool]" )
+{
+    SECTION( "Buffers are 64 byte aligned" )
+    {
+        for( size_t size : { size_t( 0 ), size_t( 1 ), size_t( 100 ), size_t( 4096 ), size_t( 300 * 1024 ), size_t( 5 * 1024 * 1024 + 7 ) } )
+        {
+            auto ptr = PixelAlloc( size );
+            REQUIRE( ptr != nullptr );
+            REQUIRE( ( uintptr_t( ptr ) & 63 ) == 0 );
+            memset( ptr, 0xAB, size );
+            PixelFree( ptr, size );
+        }
+    }
+
+    SECTION( "Freed large buffers are reused for similar sizes" )
+    {
+        PixelPoolTrim();
+        auto ptr = PixelAlloc( 4 * 1024 * 1024 );
+        PixelFree( ptr, 4 * 1024 * 1024 );
+        auto ptr2 = PixelAlloc( 4 * 1024 * 1024 - 1000 );
+        REQUIRE( ptr2 == ptr );
+        PixelFree( ptr2, 4 * 1024 * 1024 - 1000 );
+        PixelPoolTrim();
+    }
+
+    SECTION( "Typed allocation" )
+    {
+        auto ptr = PixelAlloc<float>( 1024 * 1024 );
+        REQUIRE( ( uintptr_t( ptr ) & 63 ) == 0 );
+        ptr[1024 * 1024 - 1] = 1.f;
+        PixelFree( ptr, 1024 * 1024 );
+    }
+
+    SECTION( "Nothing is kept with a zero limit" )
+    {
+        PixelPoolTrim();
+        PixelPoolSetLimit( 0 );
+        auto ptr = PixelAlloc( 1024 * 1024 );
+        PixelFree( ptr, 1024 * 1024 );
+        auto ptr2 = PixelAlloc( 1024 * 1024 );
+        PixelFree( ptr2, 1024 * 1024 );
+        PixelPoolSetLimit( 256 * 1024 * 1024 );
+        SUCCEED();
+    }
+
+    SECTION( "Null free is a no-op" )
+    {
+        PixelFree( nullptr, 1024 );
+        SUCCEED();
+    }
+}
@@ -0,0 +1,82 @@
+#include <catch2/catch_all.hpp>
+#include <src/util/Region.hpp>
+
+TEST_CASE( "Region union", "[region]" )
+{
+    Region region;
+    REQUIRE( region.IsEmpty() );
+
+    SECTION( "Empty rectangles are ignored" )
+    {
+        region.Add( { 10, 10, 10, 20 } );
+        REQUIRE( region.IsEmpty() );
+    }
+
+    SECTION( "Overlapping rectangles stay disjoint" )
+    {
+        region.Add( { 0, 0, 10, 10 } );
+        region.Add( { 5, 5, 15, 15 } );
+        REQUIRE( region.Area() == 175 );
+        REQUIRE( region.Bounds() == Region::Rect { 0, 0, 15, 15 } );
+        REQUIRE( region.IsExact() );
+    }
+
+    SECTION( "Covered rectangle adds nothing" )
+    {
+        region.Add( { 0, 0, 10, 10 } );
+        region.Add( { 2, 2, 8, 8 } );
+        REQUIRE( region.Rects().size() == 1 );
+        REQUIRE( region.Area() == 100 );
+    }
+
+    SECTION( "Too many rectangles collapse to the bounding box" )
+    {
+        for( int i=0; i<int( Region::MaxRects ) + 1; i++ ) region.Add( { i * 10, 0, i * 10 + 5, 5 } );
+        REQUIRE( region.Rects().size() == 1 );
+        REQUIRE( region.Bounds() == Region::Rect { 0, 0, int32_t( Region::MaxRects ) * 10 + 5, 5 } );
+        REQUIRE_FALSE( region.IsExact() );
+    }
+}
+
+TEST_CASE( "Region subtraction and clipping", "[region]" )
+{
+    SECTION( "Hole in the middle" )
+    {
+        Region region( { 0, 0, 30, 30 } );
+        region.Subtract( Region::Rect { 10, 10, 20, 20 } );
+        REQUIRE( region.Area() == 800 );
+        REQUIRE_FALSE( region.Intersects( { 10, 10, 20, 20 } ) );
+        REQUIRE( region.Intersects( { 5, 5, 11, 11 } ) );
+    }
+
+    SECTION( "Covering rectangle empties the region" )
+    {
+        Region region( { 0, 0, 10, 10 } );
+        region.Subtract( Region::Rect { -5, -5, 20, 20 } );
+        REQUIRE( region.IsEmpty() );
+    }
+
+    SECTION( "Intersect clips to the rectangle" )
+    {
+        Region region( { -10, -10, 10, 10 } );
+        region.Add( { 50, 50, 60, 60 } );
+        region.Intersect( { 0, 0, 20, 20 } );
+        REQUIRE( region.Rects().size() == 1 );
+        REQUIRE( region.Bounds() == Region::Rect { 0, 0, 10, 10 } );
+    }
+
+    SECTION( "Contains checks full coverage" )
+    {
+        Region region( { 0, 0, 10, 20 } );
+        region.Add( { 10, 0, 20, 20 } );
+        REQUIRE( region.Contains( { 5, 5, 15, 15 } ) );
+        REQUIRE_FALSE( region.Contains( { 15, 15, 25, 25 } ) );
+    }
+
+    SECTION( "Translate moves all rectangles" )
+    {
+        Region region( { 0, 0, 10, 10 } );
+        region.Translate( 5, -5 );
+        REQUIRE( region.Bounds() == Region::Rect { 5, -5, 15, 5 } );
+    }
+}
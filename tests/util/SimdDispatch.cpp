@@ -0,0 +1,135 @@
+#include <array>
+#include <catch2/catch_all.hpp>
+#include <src/util/Bitmap.hpp>
+#include <src/util/BitmapHdr.hpp>
+#include <src/util/BitmapHdrHalf.hpp>
+#include <src/util/SimdDispatch.hpp>
+#include <src/util/Tonemapper.hpp>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+struct ScopedSimdLevel
+{
+    ScopedSimdLevel() : level( GetSimdLevel() ) {}
+    ~ScopedSimdLevel() { SetSimdLevel( level ); }
+    SimdLevel level;
+};
+
+// Levels the CPU supports, scalar first
+std::vector<SimdLevel> SupportedLevels()
+{
+    ScopedSimdLevel restore;
+    std::vector<SimdLevel> ret;
+    for( auto level : { SimdLevel::Scalar, SimdLevel::Sse41, SimdLevel::Avx2, SimdLevel::Avx512, SimdLevel::Neon } )
+    {
+        SetSimdLevel( level );
+        if( GetSimdLevel() == level ) ret.emplace_back( level );
+    }
+    return ret;
+}
+
+void Fill( BitmapHdr& bmp )
+{
+    auto ptr = bmp.Data();
+    const auto sz = size_t( bmp.Width() ) * bmp.Height();
+    for( size_t i=0; i<sz; i++ )
+    {
+        *ptr++ = float( i % 7 ) / 3;
+        *ptr++ = float( i % 5 ) / 4;
+        *ptr++ = float( i % 13 ) / 2;
+        *ptr++ = float( i % 11 ) / 10;
+    }
+}
+}
+
+TEST_CASE( "SimdLevel is limited to what the CPU supports", "[simddispatch]" )
+{
+    ScopedSimdLevel restore;
+    const auto cpu = GetCpuSimdLevel();
+
+    SetSimdLevel( SimdLevel::Scalar );
+    REQUIRE( GetSimdLevel() == SimdLevel::Scalar );
+
+    SetSimdLevel( SimdLevel::Avx512 );
+    if( cpu == SimdLevel::Neon ) REQUIRE( GetSimdLevel() == SimdLevel::Neon );
+    else REQUIRE( GetSimdLevel() <= cpu );
+
+    SetSimdLevel( cpu );
+    REQUIRE( GetSimdLevel() == cpu );
+    REQUIRE( strcmp( SimdLevelName( cpu ), "unknown" ) != 0 );
+}
+
+TEST_CASE( "Kernel variants match the scalar code", "[simddispatch]" )
+{
+    ScopedSimdLevel restore;
+    const auto levels = SupportedLevels();
+    REQUIRE( levels.front() == SimdLevel::Scalar );
+
+    // Odd sizes leave a tail for each vector width
+    constexpr uint32_t Width = 37;
+    constexpr uint32_t Height = 3;
+    constexpr size_t Pixels = Width * Height;
+
+    BitmapHdr src( Width, Height, Colorspace::BT709 );
+    Fill( src );
+
+    constexpr std::array tonemappers = { ToneMap::AgX, ToneMap::AgXGolden, ToneMap::AgXPunchy, ToneMap::PbrNeutral };
+
+    std::vector<uint32_t> refAlpha;
+    std::vector<std::vector<uint32_t>> refTonemap;
+    std::vector<uint16_t> refHalf;
+    std::vector<float> refFloat;
+
+    for( auto level : levels )
+    {
+        CAPTURE( SimdLevelName( level ) );
+        SetSimdLevel( level );
+
+        Bitmap bmp( Width, Height );
+        for( size_t i=0; i<Pixels * 4; i++ ) bmp.Data()[i] = uint8_t( i * 37 );
+        bmp.SetAlpha( 0x80 );
+        std::vector<uint32_t> alpha( (const uint32_t*)bmp.Data(), (const uint32_t*)bmp.Data() + Pixels );
+
+        BitmapHdrHalf half( src );
+        std::vector<uint16_t> halfData( (const uint16_t*)half.Data(), (const uint16_t*)half.Data() + Pixels * 4 );
+        BitmapHdr back( half );
+        std::vector<float> floatData( back.Data(), back.Data() + Pixels * 4 );
+
+        std::vector<std::vector<uint32_t>> tonemap;
+        for( auto fn : tonemappers )
+        {
+            std::vector<float> tmp( src.Data(), src.Data() + Pixels * 4 );
+            fn( tonemap.emplace_back( Pixels ).data(), tmp.data(), Pixels );
+        }
+
+        if( level == SimdLevel::Scalar )
+        {
+            refAlpha = std::move( alpha );
+            refHalf = std::move( halfData );
+            refFloat = std::move( floatData );
+            refTonemap = std::move( tonemap );
+            continue;
+        }
+
+        REQUIRE( alpha == refAlpha );
+        REQUIRE( halfData == refHalf );
+        REQUIRE( floatData == refFloat );
+
+        // The vector code approximates pow()
+        for( size_t t=0; t<tonemappers.size(); t++ )
+        {
+            CAPTURE( t );
+            for( size_t i=0; i<Pixels; i++ )
+            {
+                for( int c=0; c<32; c+=8 )
+                {
+                    const auto v0 = int( ( refTonemap[t][i] >> c ) & 0xFF );
+                    const auto v1 = int( ( tonemap[t][i] >> c ) & 0xFF );
+                    REQUIRE( std::abs( v0 - v1 ) <= 1 );
+                }
+            }
+        }
+    }
+}
@@ -0,0 +1,59 @@
+#include <catch2/catch_all.hpp>
+#include <memory>
+#include <stdint.h>
+#include <thread>
+
+#include "util/SpscQueue.hpp"
+
+TEST_CASE( "SPSC queue", "[spscqueue]" )
+{
+    SECTION( "Values come out in order until the ring is empty" )
+    {
+        SpscQueue<int, 4> queue;
+        int v;
+        REQUIRE( queue.Empty() );
+        REQUIRE( !queue.Pop( v ) );
+
+        for( int i=0; i<4; i++ ) REQUIRE( queue.Push( i ) );
+        REQUIRE( !queue.Push( 4 ) );
+
+        REQUIRE( queue.Pop( v ) );
+        CHECK( v == 0 );
+        REQUIRE( queue.Push( 4 ) );
+
+        for( int i=1; i<5; i++ )
+        {
+            REQUIRE( queue.Pop( v ) );
+            CHECK( v == i );
+        }
+        REQUIRE( !queue.Pop( v ) );
+        REQUIRE( queue.Empty() );
+    }
+
+    SECTION( "Nothing is lost or reordered between threads" )
+    {
+        constexpr uint32_t Count = 1000000;
+        auto queue = std::make_unique<SpscQueue<uint32_t, 64>>();
+
+        std::thread producer( [&queue] {
+            for( uint32_t i=0; i<Count; i++ )
+            {
+                while( !queue->Push( i ) ) std::this_thread::yield();
+            }
+        } );
+
+        uint32_t expected = 0;
+        bool ordered = true;
+        while( expected < Count )
+        {
+            uint32_t v;
+            if( !queue->Pop( v ) ) continue;
+            ordered &= v == expected;
+            expected++;
+        }
+        producer.join();
+
+        CHECK( ordered );
+        CHECK( queue->Empty() );
+    }
+}
@@ -0,0 +1,95 @@
+#include <atomic>
+#include <catch2/catch_all.hpp>
+#include <stdexcept>
+#include <thread>
+#include <vector>
+
+#include "util/Task.hpp"
+#include "util/TaskDispatch.hpp"
+
+namespace
+{
+Task<int> Value( int v )
+{
+    co_return v;
+}
+
+Task<int> Sum( int a, int b )
+{
+    co_return co_await Value( a ) + co_await Value( b );
+}
+
+Task<std::thread::id> WorkerId( TaskDispatch& td )
+{
+    co_await td.Schedule();
+    co_return std::this_thread::get_id();
+}
+
+Task<int> Square( TaskDispatch& td, int v )
+{
+    co_await td.Schedule();
+    co_return v * v;
+}
+
+Task<> Count( TaskDispatch& td, std::atomic<int>& counter )
+{
+    co_await td.Schedule();
+    counter.fetch_add( 1, std::memory_order_relaxed );
+}
+
+Task<int> Fail( TaskDispatch& td, int v )
+{
+    co_await td.Schedule();
+    if( v == 3 ) throw std::runtime_error( "fail" );
+    co_return v;
+}
+}
+
+TEST_CASE( "Tasks are lazy and chain on the calling thread", "[task]" )
+{
+    bool started = false;
+    auto task = [&started]() -> Task<int> {
+        started = true;
+        co_return 7;
+    };
+    auto t = task();
+    CHECK( !started );
+    CHECK( SyncWait( std::move( t ) ) == 7 );
+    CHECK( started );
+
+    CHECK( SyncWait( Sum( 2, 3 ) ) == 5 );
+}
+
+TEST_CASE( "Schedule resumes on a worker", "[task]" )
+{
+    TaskDispatch td( 2, "Task" );
+    CHECK( SyncWait( WorkerId( td ) ) != std::this_thread::get_id() );
+}
+
+TEST_CASE( "WhenAll keeps the order of results", "[task]" )
+{
+    TaskDispatch td( 4, "Task" );
+
+    std::vector<Task<int>> tasks;
+    for( int i=0; i<100; i++ ) tasks.emplace_back( Square( td, i ) );
+    const auto results = SyncWait( WhenAll( std::move( tasks ) ) );
+    REQUIRE( results.size() == 100 );
+    for( int i=0; i<100; i++ ) CHECK( results[i] == i * i );
+
+    std::atomic<int> counter = 0;
+    std::vector<Task<>> counts;
+    for( int i=0; i<50; i++ ) counts.emplace_back( Count( td, counter ) );
+    SyncWait( WhenAll( std::move( counts ) ) );
+    CHECK( counter.load() == 50 );
+
+    CHECK( SyncWait( WhenAll( std::vector<Task<int>>() ) ).empty() );
+}
+
+TEST_CASE( "WhenAll rethrows after all tasks are done", "[task]" )
+{
+    TaskDispatch td( 4, "Task" );
+
+    std::vector<Task<int>> tasks;
+    for( int i=0; i<8; i++ ) tasks.emplace_back( Fail( td, i ) );
+    CHECK_THROWS_AS( SyncWait( WhenAll( std::move( tasks ) ) ), std::runtime_error );
+}
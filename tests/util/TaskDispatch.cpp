@@ -1,8 +1,16 @@
+#include "TestUtils.hpp"
+#include <algorithm>
+#include <array>
 #include <atomic>
 #include <catch2/catch_all.hpp>
 #include <chrono>
+#include <mutex>
+#include <sched.h>
 #include <src/util/TaskDispatch.hpp>
+#include <stdlib.h>
+#include <string.h>
 #include <thread>
+#include <vector>
 
 TEST_CASE( "TaskDispatch construction and destruction", "[taskdispatch][ctor]" )
 {
@@ -228,6 +236,34 @@ TEST_CASE( "TaskDispatch parallelism", "[taskdispatch][parallel]" )
         }
         REQUIRE( uniqueWorkers >= 2 );
     }
+
+    SECTION( "Jobs spawned by a worker are stolen by idle workers" )
+    {
+        TaskDispatch dispatch( 4, "steal" );
+        dispatch.WaitInit();
+
+        std::atomic<int> concurrentCount{ 0 };
+        std::atomic<int> maxConcurrent{ 0 };
+
+        dispatch.Queue( [&] {
+            for( int i = 0; i < 4; i++ )
+            {
+                dispatch.Queue( [&] {
+                    int c = ++concurrentCount;
+                    int expected = maxConcurrent.load();
+                    while( c > expected && !maxConcurrent.compare_exchange_weak( expected, c ) )
+                    {
+                        expected = maxConcurrent.load();
+                    }
+                    std::this_thread::sleep_for( std::chrono::milliseconds( 5 ) );
+                    concurrentCount--;
+                } );
+            }
+        } );
+
+        dispatch.Sync();
+        REQUIRE( maxConcurrent.load() >= 2 );
+    }
 }
 
 TEST_CASE( "TaskDispatch thread safety", "[taskdispatch][threadsafe]" )
@@ -289,4 +325,557 @@ TEST_CASE( "TaskDispatch edge cases", "[taskdispatch][edge]" )
         dispatch.Sync();
         REQUIRE( counter.load() == 1000 );
     }
-}
\ No newline at end of file
+}
+
+TEST_CASE( "TaskDispatch ParallelFor", "[taskdispatch][parallelfor]" )
+{
+    SECTION( "Fixed grain covers the whole range once" )
+    {
+        TaskDispatch dispatch( 4, "pffixed" );
+        dispatch.WaitInit();
+
+        std::vector<std::atomic<int>> hits( 1000 );
+        for( auto& h : hits ) h = 0;
+        std::atomic<bool> oversized{ false };
+
+        dispatch.ParallelFor( 0, hits.size(), 64, [&hits, &oversized]( size_t begin, size_t end ) {
+            if( end - begin > 64 ) oversized = true;
+            for( size_t i = begin; i < end; i++ ) hits[i]++;
+        } );
+
+        REQUIRE_FALSE( oversized.load() );
+        REQUIRE( std::all_of( hits.begin(), hits.end(), []( const auto& h ) { return h.load() == 1; } ) );
+    }
+
+    SECTION( "Adaptive grain covers the whole range once" )
+    {
+        TaskDispatch dispatch( 4, "pfadaptive" );
+        dispatch.WaitInit();
+
+        std::vector<std::atomic<int>> hits( 100000 );
+        for( auto& h : hits ) h = 0;
+
+        dispatch.ParallelFor( 0, hits.size(), TaskDispatch::AdaptiveGrain, [&hits]( size_t begin, size_t end ) {
+            for( size_t i = begin; i < end; i++ ) hits[i]++;
+        } );
+
+        REQUIRE( std::all_of( hits.begin(), hits.end(), []( const auto& h ) { return h.load() == 1; } ) );
+    }
+
+    SECTION( "Expensive items are split across workers" )
+    {
+        TaskDispatch dispatch( 4, "pfsplit" );
+        dispatch.WaitInit();
+
+        std::atomic<int> chunks{ 0 };
+        dispatch.ParallelFor( 0, 64, TaskDispatch::AdaptiveGrain, [&chunks]( size_t begin, size_t end ) {
+            chunks++;
+            std::this_thread::sleep_for( std::chrono::milliseconds( end - begin ) );
+        } );
+
+        REQUIRE( chunks.load() >= 5 );
+    }
+
+    SECTION( "Zero workers and empty ranges" )
+    {
+        TaskDispatch dispatch( 0, "pfzero" );
+        dispatch.WaitInit();
+
+        int calls = 0;
+        dispatch.ParallelFor( 5, 5, TaskDispatch::AdaptiveGrain, [&calls]( size_t, size_t ) { calls++; } );
+        REQUIRE( calls == 0 );
+
+        size_t sum = 0;
+        dispatch.ParallelFor( 0, 100, 10, [&sum]( size_t begin, size_t end ) { sum += end - begin; } );
+        REQUIRE( sum == 100 );
+    }
+}
+
+TEST_CASE( "TaskDispatch task groups", "[taskdispatch][group]" )
+{
+    SECTION( "Wait covers all jobs of the group" )
+    {
+        TaskDispatch dispatch( 2, "group" );
+        dispatch.WaitInit();
+
+        std::atomic<int> counter{ 0 };
+        TaskGroup group;
+        for( int i = 0; i < 50; i++ )
+        {
+            dispatch.Queue( group, [&counter] { counter++; } );
+        }
+        group.Wait();
+
+        REQUIRE( group.IsDone() );
+        REQUIRE( counter.load() == 50 );
+    }
+
+    SECTION( "Wait does not block on unrelated jobs" )
+    {
+        TaskDispatch dispatch( 1, "unrelated" );
+        dispatch.WaitInit();
+
+        std::atomic<bool> release{ false };
+        std::atomic<bool> started{ false };
+        dispatch.Queue( [&] {
+            started = true;
+            while( !release.load() ) std::this_thread::yield();
+        } );
+        while( !started.load() ) std::this_thread::yield();
+
+        std::atomic<int> counter{ 0 };
+        TaskGroup group;
+        for( int i = 0; i < 10; i++ )
+        {
+            dispatch.Queue( group, [&counter] { counter++; } );
+        }
+        group.Wait();
+        REQUIRE( counter.load() == 10 );
+
+        release = true;
+        dispatch.Sync();
+    }
+
+    SECTION( "Waiting thread runs jobs itself" )
+    {
+        TaskDispatch dispatch( 0, "nohelp" );
+        dispatch.WaitInit();
+
+        std::atomic<int> counter{ 0 };
+        TaskGroup group;
+        dispatch.Queue( group, [&] {
+            counter++;
+            dispatch.Queue( group, [&counter] { counter++; } );
+        } );
+        group.Wait();
+        REQUIRE( counter.load() == 2 );
+    }
+
+    SECTION( "Empty group does not wait" )
+    {
+        TaskGroup group;
+        group.Wait();
+        REQUIRE( group.IsDone() );
+    }
+
+    SECTION( "Sync waits for group jobs" )
+    {
+        TaskDispatch dispatch( 2, "groupsync" );
+        dispatch.WaitInit();
+
+        std::atomic<int> counter{ 0 };
+        TaskGroup group;
+        for( int i = 0; i < 10; i++ )
+        {
+            dispatch.Queue( group, [&counter] { counter++; } );
+        }
+        dispatch.Sync();
+        REQUIRE( counter.load() == 10 );
+        REQUIRE( group.IsDone() );
+    }
+}
+
+TEST_CASE( "TaskDispatch priorities", "[taskdispatch][priority]" )
+{
+    SECTION( "ScopedPriority sets and restores the priority" )
+    {
+        REQUIRE( TaskDispatch::CurrentPriority() == TaskDispatch::Priority::Interactive );
+        {
+            TaskDispatch::ScopedPriority priority( TaskDispatch::Priority::Background );
+            REQUIRE( TaskDispatch::CurrentPriority() == TaskDispatch::Priority::Background );
+        }
+        REQUIRE( TaskDispatch::CurrentPriority() == TaskDispatch::Priority::Interactive );
+    }
+
+    SECTION( "Interactive jobs run before queued background jobs" )
+    {
+        TaskDispatch dispatch( 1, "priority" );
+        dispatch.WaitInit();
+
+        std::atomic<bool> release{ false };
+        dispatch.Queue( [&release] { while( !release.load() ) std::this_thread::yield(); } );
+
+        std::mutex lock;
+        std::vector<int> order;
+        {
+            TaskDispatch::ScopedPriority priority( TaskDispatch::Priority::Background );
+            for( int i = 0; i < 5; i++ )
+            {
+                dispatch.Queue( [&lock, &order] { std::lock_guard guard( lock ); order.push_back( 1 ); } );
+            }
+        }
+        dispatch.Queue( [&lock, &order] { std::lock_guard guard( lock ); order.push_back( 0 ); } );
+
+        release.store( true );
+        dispatch.Sync();
+        REQUIRE( order.size() == 6 );
+        REQUIRE( order[0] == 0 );
+    }
+
+    SECTION( "Nested jobs inherit the priority" )
+    {
+        TaskDispatch dispatch( 2, "inherit" );
+        dispatch.WaitInit();
+
+        std::atomic<bool> inherited{ false };
+        {
+            TaskDispatch::ScopedPriority priority( TaskDispatch::Priority::Background );
+            dispatch.Queue( [&] {
+                dispatch.Queue( [&inherited] { inherited.store( TaskDispatch::CurrentPriority() == TaskDispatch::Priority::Background ); } );
+            } );
+        }
+        dispatch.Sync();
+        REQUIRE( inherited.load() );
+        REQUIRE( TaskDispatch::CurrentPriority() == TaskDispatch::Priority::Interactive );
+    }
+}
+
+TEST_CASE( "TaskDispatch cancellation", "[taskdispatch][cancel]" )
+{
+    SECTION( "ScopedCancel sets and restores the flag" )
+    {
+        std::atomic<bool> flag{ true };
+        REQUIRE_FALSE( TaskDispatch::IsCancelled() );
+        {
+            TaskDispatch::ScopedCancel cancel( &flag );
+            REQUIRE( TaskDispatch::IsCancelled() );
+            flag.store( false );
+            REQUIRE_FALSE( TaskDispatch::IsCancelled() );
+        }
+        flag.store( true );
+        REQUIRE_FALSE( TaskDispatch::IsCancelled() );
+    }
+
+    SECTION( "Queued jobs inherit the flag" )
+    {
+        TaskDispatch dispatch( 2, "cancel" );
+        dispatch.WaitInit();
+
+        std::atomic<bool> flag{ true };
+        std::atomic<bool> seen{ false };
+        {
+            TaskDispatch::ScopedCancel cancel( &flag );
+            dispatch.Queue( [&] {
+                dispatch.Queue( [&seen] { seen.store( TaskDispatch::IsCancelled() ); } );
+            } );
+        }
+        dispatch.Sync();
+        REQUIRE( seen.load() );
+    }
+
+    SECTION( "ParallelFor skips chunks once cancelled" )
+    {
+        TaskDispatch dispatch( 4, "cancelfor" );
+        dispatch.WaitInit();
+
+        std::atomic<bool> flag{ false };
+        std::atomic<size_t> done{ 0 };
+        TaskDispatch::ScopedCancel cancel( &flag );
+        dispatch.ParallelFor( 0, 1000, 1, [&]( size_t begin, size_t end ) {
+            flag.store( true );
+            done += end - begin;
+        } );
+        REQUIRE( done.load() < 1000 );
+
+        done.store( 0 );
+        dispatch.ParallelFor( 0, 1000, 1, [&]( size_t begin, size_t end ) { done += end - begin; } );
+        REQUIRE( done.load() == 0 );
+    }
+}
+
+TEST_CASE( "TaskDispatch bulk queue", "[taskdispatch][bulk]" )
+{
+    SECTION( "All bulk tasks execute" )
+    {
+        TaskDispatch dispatch( 3, "bulk" );
+        dispatch.WaitInit();
+
+        std::atomic<int> counter{ 0 };
+        std::vector<InlineTask> tasks;
+        for( int i = 0; i < 100; i++ )
+        {
+            tasks.emplace_back( [&counter] { counter++; } );
+        }
+        dispatch.QueueBulk( tasks );
+        dispatch.Sync();
+        REQUIRE( counter.load() == 100 );
+    }
+
+    SECTION( "Bulk tasks are tracked by the group" )
+    {
+        TaskDispatch dispatch( 2, "bulkgroup" );
+        dispatch.WaitInit();
+
+        std::atomic<int> counter{ 0 };
+        InlineTask tasks[7];
+        for( auto& task : tasks ) task = InlineTask( [&counter] { counter++; } );
+
+        TaskGroup group;
+        dispatch.QueueBulk( group, tasks );
+        dispatch.QueueBulk( group, {} );
+        group.Wait();
+        REQUIRE( counter.load() == 7 );
+    }
+
+    SECTION( "Oversized captures still work" )
+    {
+        TaskDispatch dispatch( 1, "large" );
+        dispatch.WaitInit();
+
+        std::array<int, 64> data;
+        data.fill( 1 );
+        std::atomic<int> sum{ 0 };
+        dispatch.Queue( [data, &sum] { for( auto v : data ) sum += v; } );
+        dispatch.Sync();
+        REQUIRE( sum.load() == 64 );
+    }
+}
+
+TEST_CASE( "TaskDispatch worker placement", "[taskdispatch][placement]" )
+{
+    SECTION( "Workers are restricted to the affinity mask" )
+    {
+        cpu_set_t set;
+        REQUIRE( sched_getaffinity( 0, sizeof( set ), &set ) == 0 );
+        uint32_t cpu = 0;
+        while( !CPU_ISSET( cpu, &set ) ) cpu++;
+
+        TaskDispatch dispatch( 2, "pinned", WorkerPlacement { .cpus = { cpu } } );
+        dispatch.WaitInit();
+
+        std::atomic<int> wrong{ 0 };
+        for( int i = 0; i < 8; i++ )
+        {
+            dispatch.Queue( [&wrong, cpu] {
+                cpu_set_t cur;
+                if( sched_getaffinity( 0, sizeof( cur ), &cur ) != 0 || CPU_COUNT( &cur ) != 1 || !CPU_ISSET( cpu, &cur ) ) wrong++;
+            } );
+        }
+        dispatch.Sync();
+        REQUIRE( wrong.load() == 0 );
+    }
+
+    SECTION( "Performance first placement runs all jobs" )
+    {
+        TaskDispatch dispatch( 4, "perf", WorkerPlacement { .policy = WorkerPlacement::Policy::PerformanceFirst } );
+        dispatch.WaitInit();
+
+        std::atomic<int> counter{ 0 };
+        for( int i = 0; i < 100; i++ ) dispatch.Queue( [&counter] { counter++; } );
+        dispatch.Sync();
+        REQUIRE( counter.load() == 100 );
+    }
+
+    SECTION( "Placement is loaded from config" )
+    {
+        TempDir configDir = TempDir::create();
+        configDir.createSubdir( "ModernCore" );
+        setenv( "XDG_CONFIG_HOME", configDir.path(), 1 );
+
+        const char* ini = "[TaskDispatch]\nPlacement=performance\nAffinity=0-2,5\n";
+        configDir.createFile( "ModernCore/placement.ini", ini, strlen( ini ) );
+
+        const auto placement = TaskDispatch::LoadPlacement( "placement.ini" );
+        REQUIRE( placement.policy == WorkerPlacement::Policy::PerformanceFirst );
+        REQUIRE( placement.cpus == std::vector<uint32_t> { 0, 1, 2, 5 } );
+
+        const auto missing = TaskDispatch::LoadPlacement( "missing.ini" );
+        REQUIRE( missing.policy == WorkerPlacement::Policy::Any );
+        REQUIRE( missing.cpus.empty() );
+
+        unsetenv( "XDG_CONFIG_HOME" );
+    }
+}
+
+TEST_CASE( "TaskDispatch elastic workers", "[taskdispatch][elastic]" )
+{
+    SECTION( "No workers are started without work" )
+    {
+        TaskDispatch dispatch( 4, "lazy" );
+        REQUIRE( dispatch.NumRunningWorkers() == 0 );
+        dispatch.Sync();
+        REQUIRE( dispatch.NumRunningWorkers() == 0 );
+    }
+
+    SECTION( "Workers are started when the queue backs up" )
+    {
+        TaskDispatch dispatch( 4, "grow" );
+
+        std::atomic<bool> release{ false };
+        for( int i = 0; i < 4; i++ )
+        {
+            dispatch.Queue( [&release] { while( !release.load() ) std::this_thread::yield(); } );
+        }
+        const auto running = dispatch.NumRunningWorkers();
+        release.store( true );
+        dispatch.Sync();
+        REQUIRE( running >= 2 );
+        REQUIRE( dispatch.NumRunningWorkers() <= 4 );
+    }
+
+    SECTION( "A job queued behind a busy worker gets a worker of its own" )
+    {
+        TaskDispatch dispatch( 2, "busy" );
+
+        // The second job is queued once the first one keeps the only worker busy. Each job waits for the other to
+        // start, which only happens if they run at the same time. Sync() would run the second job itself, so it
+        // comes after the check.
+        std::atomic<int> started{ 0 };
+        std::atomic<int> together{ 0 };
+        const auto job = [&started, &together] {
+            started++;
+            const auto start = std::chrono::steady_clock::now();
+            while( started.load() < 2 && std::chrono::steady_clock::now() - start < std::chrono::seconds( 2 ) )
+            {
+                std::this_thread::yield();
+            }
+            if( started.load() == 2 ) together++;
+        };
+        dispatch.Queue( job );
+        while( started.load() == 0 ) std::this_thread::yield();
+        dispatch.Queue( job );
+
+        const auto start = std::chrono::steady_clock::now();
+        while( together.load() < 2 && std::chrono::steady_clock::now() - start < std::chrono::seconds( 5 ) )
+        {
+            std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+        }
+        const auto result = together.load();
+        dispatch.Sync();
+        REQUIRE( result == 2 );
+    }
+
+    SECTION( "Idle workers shut down and are restarted on demand" )
+    {
+        TaskDispatch dispatch( 2, "shrink" );
+        dispatch.Queue( [] {} );
+        dispatch.Sync();
+        REQUIRE( dispatch.NumRunningWorkers() >= 1 );
+
+        const auto start = std::chrono::steady_clock::now();
+        while( dispatch.NumRunningWorkers() != 0 && std::chrono::steady_clock::now() - start < std::chrono::seconds( 10 ) )
+        {
+            std::this_thread::sleep_for( std::chrono::milliseconds( 50 ) );
+        }
+        REQUIRE( dispatch.NumRunningWorkers() == 0 );
+
+        std::atomic<int> counter{ 0 };
+        for( int i = 0; i < 10; i++ ) dispatch.Queue( [&counter] { counter++; } );
+        dispatch.Sync();
+        REQUIRE( counter.load() == 10 );
+    }
+}
+
+TEST_CASE( "TaskDispatch stress", "[taskdispatch][stress]" )
+{
+    SECTION( "Many producers wait on their own groups" )
+    {
+        TaskDispatch dispatch( 4, "producers" );
+
+        std::atomic<size_t> total{ 0 };
+        std::atomic<bool> mismatch{ false };
+        std::vector<std::thread> threads;
+        for( int t = 0; t < 8; t++ )
+        {
+            threads.emplace_back( [&] {
+                for( int i = 0; i < 200; i++ )
+                {
+                    std::atomic<int> local{ 0 };
+                    TaskGroup group;
+                    for( int j = 0; j < 8; j++ ) dispatch.Queue( group, [&local, &total] { local++; total++; } );
+                    group.Wait();
+                    if( local.load() != 8 ) mismatch.store( true );
+                }
+            } );
+        }
+        for( auto& t : threads ) t.join();
+        dispatch.Sync();
+
+        REQUIRE_FALSE( mismatch.load() );
+        REQUIRE( total.load() == 8 * 200 * 8 );
+    }
+
+    SECTION( "Producers of both priorities race with the workers" )
+    {
+        TaskDispatch dispatch( 4, "priorities" );
+
+        std::atomic<size_t> counter{ 0 };
+        std::vector<std::thread> threads;
+        for( int t = 0; t < 6; t++ )
+        {
+            threads.emplace_back( [&, t] {
+                TaskDispatch::ScopedPriority priority( t % 2 ? TaskDispatch::Priority::Background : TaskDispatch::Priority::Interactive );
+                for( int i = 0; i < 500; i++ )
+                {
+                    dispatch.Queue( [&] {
+                        if( counter++ % 16 == 0 ) dispatch.Queue( [&counter] { counter++; } );
+                    } );
+                }
+            } );
+        }
+        for( auto& t : threads ) t.join();
+        dispatch.Sync();
+
+        // Every 16th job queues one more, and nested jobs may do the same
+        REQUIRE( counter.load() >= 6 * 500 + 6 * 500 / 16 );
+    }
+
+    SECTION( "Nested groups fork and join from within jobs" )
+    {
+        TaskDispatch dispatch( 4, "nested" );
+
+        std::atomic<size_t> counter{ 0 };
+        TaskGroup outer;
+        for( int i = 0; i < 32; i++ )
+        {
+            dispatch.Queue( outer, [&] {
+                TaskGroup inner;
+                for( int j = 0; j < 32; j++ ) dispatch.Queue( inner, [&counter] { counter++; } );
+                inner.Wait();
+            } );
+        }
+        outer.Wait();
+
+        REQUIRE( counter.load() == 32 * 32 );
+    }
+
+    SECTION( "Cancelling under load leaves no job behind" )
+    {
+        TaskDispatch dispatch( 4, "cancelload" );
+
+        std::atomic<bool> flag{ false };
+        std::atomic<size_t> done{ 0 };
+        std::atomic<size_t> skipped{ 0 };
+        std::vector<std::thread> threads;
+        for( int t = 0; t < 4; t++ )
+        {
+            threads.emplace_back( [&] {
+                TaskDispatch::ScopedCancel cancel( &flag );
+                TaskGroup group;
+                for( int i = 0; i < 64; i++ )
+                {
+                    dispatch.Queue( group, [&] {
+                        if( TaskDispatch::IsCancelled() )
+                        {
+                            skipped++;
+                            return;
+                        }
+                        dispatch.ParallelFor( 0, 4096, 64, [&]( size_t begin, size_t end ) {
+                            done += end - begin;
+                            std::this_thread::yield();
+                        } );
+                    } );
+                }
+                group.Wait();
+            } );
+        }
+
+        while( done.load() == 0 ) std::this_thread::yield();
+        flag.store( true );
+        for( auto& t : threads ) t.join();
+        dispatch.Sync();
+
+        REQUIRE( skipped.load() > 0 );
+        REQUIRE( done.load() < 4 * 64 * 4096 );
+    }
+}
@@ -0,0 +1,106 @@
+#include <catch2/catch_all.hpp>
+
+#include <string.h>
+
+#include "TestUtils.hpp"
+#include "util/Bitmap.hpp"
+#include "util/TaskDispatch.hpp"
+#include "util/TilePyramid.hpp"
+
+namespace
+{
+// Noise in the low bytes, which does not compress, next to flat channels, which do
+Bitmap MakeBitmap( uint32_t w, uint32_t h )
+{
+    Bitmap bmp( w, h );
+    auto ptr = bmp.Data();
+    uint32_t seed = 7;
+    for( uint32_t y=0; y<h; y++ )
+    {
+        for( uint32_t x=0; x<w; x++ )
+        {
+            seed = seed * 1664525 + 1013904223;
+            *ptr++ = uint8_t( x < w / 2 ? seed >> 24 : x );
+            *ptr++ = uint8_t( y );
+            *ptr++ = 0x40;
+            *ptr++ = 0xFF;
+        }
+    }
+    return bmp;
+}
+}
+
+TEST_CASE( "Tile pyramid cache", "[tilepyramid]" )
+{
+    TaskDispatch td( 4, "Worker" );
+    auto file = TempFile::createEmpty();
+    const TilePyramid::Source source = { .path = "/images/huge.tif", .mtime = { 1700000000, 123 }, .size = 4096 };
+
+    const auto bmp = MakeBitmap( 300, 200 );
+    REQUIRE( TilePyramid::Write( file.path(), source, bmp, 64, 100, &td ) );
+
+    SECTION( "Levels halve down to the overview size" )
+    {
+        auto pyramid = TilePyramid::Open( file.path(), source, 64 );
+        REQUIRE( pyramid );
+        REQUIRE( pyramid->Levels() == 3 );
+        CHECK( pyramid->Width( 0 ) == 300 );
+        CHECK( pyramid->Height( 0 ) == 200 );
+        CHECK( pyramid->Width( 2 ) == 75 );
+        CHECK( pyramid->Height( 2 ) == 50 );
+        CHECK( pyramid->TilesX( 0 ) == 5 );
+        CHECK( pyramid->TilesY( 0 ) == 4 );
+        CHECK( pyramid->Mtime().tv_nsec == 123 );
+    }
+
+    SECTION( "Tiles and levels have the pixels of the bitmap" )
+    {
+        auto pyramid = TilePyramid::Open( file.path(), source, 64 );
+        REQUIRE( pyramid );
+
+        // The last tile in each direction is cut at the image edge
+        auto tile = pyramid->Tile( 0, 4, 3 );
+        REQUIRE( tile );
+        CHECK( tile->Width() == 300 - 256 );
+        CHECK( tile->Height() == 200 - 192 );
+        for( uint32_t y=0; y<tile->Height(); y++ )
+        {
+            CHECK( memcmp( tile->Data() + y * tile->Width() * 4, bmp.Data() + ( ( 192 + y ) * 300 + 256 ) * 4, tile->Width() * 4 ) == 0 );
+        }
+
+        for( auto dispatch : { &td, (TaskDispatch*)nullptr } )
+        {
+            auto level = pyramid->Level( 0, dispatch );
+            REQUIRE( level );
+            CHECK( memcmp( level->Data(), bmp.Data(), 300 * 200 * 4 ) == 0 );
+        }
+
+        auto half = bmp.ResizeNew( 150, 100, &td );
+        auto level = pyramid->Level( 1 );
+        REQUIRE( level );
+        CHECK( memcmp( level->Data(), half->Data(), 150 * 100 * 4 ) == 0 );
+    }
+
+    SECTION( "Stale pyramids are not used" )
+    {
+        auto modified = source;
+        modified.mtime.tv_sec++;
+        CHECK( !TilePyramid::Open( file.path(), modified, 64 ) );
+
+        auto resized = source;
+        resized.size++;
+        CHECK( !TilePyramid::Open( file.path(), resized, 64 ) );
+
+        auto other = source;
+        other.path = "/images/other.tif";
+        CHECK( !TilePyramid::Open( file.path(), other, 64 ) );
+
+        CHECK( !TilePyramid::Open( file.path(), source, 128 ) );
+    }
+
+    SECTION( "Truncated files are rejected" )
+    {
+        REQUIRE( truncate( file.path(), file.size() - 1 ) == 0 );
+        CHECK( !TilePyramid::Open( file.path(), source, 64 ) );
+    }
+}
@@ -0,0 +1,122 @@
+#include "TestUtils.hpp"
+#include <catch2/catch_all.hpp>
+#include <src/util/Tonemapper.hpp>
+#include <src/util/TonemapperLut.hpp>
+#include <stdlib.h>
+#include <string.h>
+#include <vector>
+
+namespace
+{
+const char IdentityCube[] =
+    "# Identity\n"
+    "TITLE \"Identity\"\n"
+    "LUT_3D_SIZE 2\n"
+    "\n"
+    "0 0 0\n"
+    "1 0 0\n"
+    "0 1 0\n"
+    "1 1 0\n"
+    "0 0 1\n"
+    "1 0 1\n"
+    "0 1 1\n"
+    "1 1 1\n";
+
+int Channel( uint32_t v, int c )
+{
+    return ( v >> ( c * 8 ) ) & 0xFF;
+}
+}
+
+TEST_CASE( "Lut parses .cube files", "[tonemap][lut]" )
+{
+    SECTION( "Identity LUT passes colors through" )
+    {
+        auto lut = Lut::ParseCube( IdentityCube, strlen( IdentityCube ) );
+        REQUIRE( lut );
+        REQUIRE( lut->Size() == 2 );
+
+        float src[8] = { 0.25f, 0.5f, 0.75f, 1, 2, -1, 0, 0.5f };
+        uint32_t dst[2];
+        lut->Apply( dst, src, 2 );
+
+        REQUIRE( std::abs( Channel( dst[0], 0 ) - 64 ) <= 1 );
+        REQUIRE( std::abs( Channel( dst[0], 1 ) - 128 ) <= 1 );
+        REQUIRE( std::abs( Channel( dst[0], 2 ) - 191 ) <= 1 );
+        REQUIRE( Channel( dst[0], 3 ) == 255 );
+        REQUIRE( Channel( dst[1], 0 ) == 255 );
+        REQUIRE( Channel( dst[1], 1 ) == 0 );
+        REQUIRE( Channel( dst[1], 2 ) == 0 );
+        REQUIRE( std::abs( Channel( dst[1], 3 ) - 128 ) <= 1 );
+    }
+
+    SECTION( "Domain is applied" )
+    {
+        const char cube[] =
+            "LUT_3D_SIZE 2\n"
+            "DOMAIN_MIN 0 0 0\n"
+            "DOMAIN_MAX 2 2 2\n"
+            "0 0 0\n1 0 0\n0 1 0\n1 1 0\n0 0 1\n1 0 1\n0 1 1\n1 1 1\n";
+        auto lut = Lut::ParseCube( cube, strlen( cube ) );
+        REQUIRE( lut );
+
+        float src[4] = { 1, 1, 1, 1 };
+        uint32_t dst;
+        lut->Apply( &dst, src, 1 );
+        REQUIRE( std::abs( Channel( dst, 0 ) - 128 ) <= 1 );
+    }
+
+    SECTION( "Invalid files are rejected" )
+    {
+        const char truncated[] = "LUT_3D_SIZE 2\n0 0 0\n1 0 0\n";
+        REQUIRE_FALSE( Lut::ParseCube( truncated, strlen( truncated ) ) );
+
+        const char noSize[] = "0 0 0\n";
+        REQUIRE_FALSE( Lut::ParseCube( noSize, strlen( noSize ) ) );
+
+        const char oneD[] = "LUT_1D_SIZE 2\n0 0 0\n1 1 1\n";
+        REQUIRE_FALSE( Lut::ParseCube( oneD, strlen( oneD ) ) );
+
+        const char badRow[] = "LUT_3D_SIZE 2\n0 0\n";
+        REQUIRE_FALSE( Lut::ParseCube( badRow, strlen( badRow ) ) );
+    }
+
+    SECTION( "Loading from file" )
+    {
+        auto file = TempFile::create( IdentityCube, strlen( IdentityCube ) );
+        auto lut = Lut::LoadCube( file.path() );
+        REQUIRE( lut );
+        REQUIRE( lut->Size() == 2 );
+
+        REQUIRE_FALSE( Lut::LoadCube( "/nonexistent/look.cube" ) );
+    }
+}
+
+TEST_CASE( "Baked LUT matches the operator", "[tonemap][lut]" )
+{
+    constexpr size_t Count = 4096;
+    std::vector<float> src( Count * 4 );
+    srand( 1 );
+    for( size_t i=0; i<Count * 4; i++ )
+    {
+        const auto r = rand() / float( RAND_MAX );
+        src[i] = i % 4 == 3 ? r : std::exp2( r * 20 - 14 );
+    }
+
+    std::vector<uint32_t> lutOut( Count );
+    std::vector<uint32_t> ref( Count );
+
+    for( auto op : { ToneMap::AgX, ToneMap::PbrNeutral } )
+    {
+        Lut lut( op );
+        lut.Apply( lutOut.data(), src.data(), Count );
+        op( ref.data(), src.data(), Count );
+
+        int maxDiff = 0;
+        for( size_t i=0; i<Count; i++ )
+        {
+            for( int c=0; c<4; c++ ) maxDiff = std::max( maxDiff, std::abs( Channel( lutOut[i], c ) - Channel( ref[i], c ) ) );
+        }
+        REQUIRE( maxDiff <= 10 );
+    }
+}
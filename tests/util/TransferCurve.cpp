@@ -0,0 +1,36 @@
+#include <algorithm>
+#include <catch2/catch_all.hpp>
+
+#include "util/TransferCurve.hpp"
+
+TEST_CASE( "Transfer curves", "[transfercurve]" )
+{
+    using Catch::Matchers::WithinAbs;
+
+    SECTION( "sRGB decode" )
+    {
+        const auto curve = SrgbDecodeCurve( 256 );
+        REQUIRE( curve.size() == 256 );
+        CHECK( curve.front() == 0 );
+        CHECK_THAT( curve.back(), WithinAbs( 1, 1e-6 ) );
+        CHECK_THAT( curve[5], WithinAbs( 5 / 255. / 12.92, 1e-6 ) );
+        CHECK_THAT( curve[128], WithinAbs( 0.2158605, 1e-6 ) );
+        CHECK( std::ranges::is_sorted( curve ) );
+    }
+
+    SECTION( "PQ encode" )
+    {
+        // 100 nits is about half of the code range, 10000 nits is all of it
+        const auto curve = PqEncodeCurve( 1024, 100 );
+        CHECK_THAT( curve.front(), WithinAbs( 0, 1e-6 ) );
+        CHECK_THAT( curve.back(), WithinAbs( 0.5080784, 1e-5 ) );
+        CHECK( std::ranges::is_sorted( curve ) );
+
+        const auto full = PqEncodeCurve( 2, 10000 );
+        CHECK_THAT( full[1], WithinAbs( 1, 1e-6 ) );
+
+        // Brighter SDR white only raises the codes
+        const auto bright = PqEncodeCurve( 1024, 203 );
+        for( size_t i=1; i<bright.size(); i++ ) CHECK( bright[i] > curve[i] );
+    }
+}
@@ -144,6 +144,30 @@ TEST_CASE( "UrlDecode functionality", "[url][decode]" )
     }
 }
 
+TEST_CASE( "UrlEncodePath functionality", "[url][encode]" )
+{
+    SECTION( "Path characters are kept" )
+    {
+        REQUIRE( UrlEncodePath( "/home/user/Pictures/img_01-b.png" ) == "/home/user/Pictures/img_01-b.png" );
+        REQUIRE( UrlEncodePath( "/a!$&'()*+,-.:=@_~" ) == "/a!$&'()*+,-.:=@_~" );
+    }
+
+    SECTION( "Reserved and non-ASCII characters are escaped" )
+    {
+        REQUIRE( UrlEncodePath( "/tmp/a b#c%d?e" ) == "/tmp/a%20b%23c%25d%3Fe" );
+        REQUIRE( UrlEncodePath( "/tmp/[x];{y}" ) == "/tmp/%5Bx%5D%3B%7By%7D" );
+        REQUIRE( UrlEncodePath( "/tmp/\xc3\xa9t\xc3\xa9.jpg" ) == "/tmp/%C3%A9t%C3%A9.jpg" );
+    }
+
+    SECTION( "Round trip through UrlDecode" )
+    {
+        const std::string path = "/photos/2024 summer/#1 100%.jpg";
+        auto url = UrlEncodePath( path );
+        UrlDecode( url );
+        REQUIRE( url == path );
+    }
+}
+
 TEST_CASE( "UrlDecode benchmarks", "[!benchmark][url]" )
 {
     SECTION( "Decode heavily encoded string" )
@@ -0,0 +1,90 @@
+#include <atomic>
+#include <catch2/catch_all.hpp>
+#include <memory>
+#include <src/util/Bitmap.hpp>
+#include <src/util/TaskDispatch.hpp>
+#include <src/util/VectorImage.hpp>
+
+namespace
+{
+// Each pixel stores its own coordinates in the scaled image, so tile placement can be checked.
+class GradientImage : public VectorImage
+{
+public:
+    GradientImage( int width, int height ) : m_width( width ), m_height( height ), m_regions( 0 ), m_full( 0 ) {}
+
+    bool IsValid() const override { return true; }
+    int Width() const override { return m_width; }
+    int Height() const override { return m_height; }
+
+    std::unique_ptr<Bitmap> Rasterize( int width, int height ) const override
+    {
+        m_full++;
+        return RasterizeRegion( 0, 0, width, height, 1 );
+    }
+
+    std::unique_ptr<Bitmap> RasterizeRegion( int x, int y, int width, int height, float ) const override
+    {
+        m_regions++;
+        auto bmp = std::make_unique<Bitmap>( width, height );
+        auto ptr = (uint32_t*)bmp->Data();
+        for( int j=0; j<height; j++ )
+        {
+            for( int i=0; i<width; i++ )
+            {
+                *ptr++ = uint32_t( x + i ) | ( uint32_t( y + j ) << 16 );
+            }
+        }
+        return bmp;
+    }
+
+    int m_width;
+    int m_height;
+    mutable std::atomic<int> m_regions;
+    mutable std::atomic<int> m_full;
+};
+}
+
+TEST_CASE( "VectorImage tiled rasterization", "[vectorimage]" )
+{
+    TaskDispatch td( 4, "Test" );
+
+    SECTION( "Tiles are assembled in place" )
+    {
+        GradientImage img( 1000, 700 );
+        auto bmp = img.RasterizeTiled( 1000, 700, &td );
+        REQUIRE( bmp );
+        REQUIRE( bmp->Width() == 1000 );
+        REQUIRE( bmp->Height() == 700 );
+        REQUIRE( img.m_regions == 4 );
+        REQUIRE( img.m_full == 0 );
+
+        auto ptr = (const uint32_t*)bmp->Data();
+        bool match = true;
+        for( uint32_t y=0; y<700; y++ )
+        {
+            for( uint32_t x=0; x<1000; x++ )
+            {
+                if( *ptr++ != ( x | ( y << 16 ) ) ) match = false;
+            }
+        }
+        REQUIRE( match );
+    }
+
+    SECTION( "Small images are rendered in one call" )
+    {
+        GradientImage img( 100, 100 );
+        auto bmp = img.RasterizeTiled( 200, 200, &td );
+        REQUIRE( bmp );
+        REQUIRE( img.m_full == 1 );
+    }
+
+    SECTION( "No dispatcher renders in one call" )
+    {
+        GradientImage img( 1000, 1000 );
+        auto bmp = img.RasterizeTiled( 1000, 1000, nullptr );
+        REQUIRE( bmp );
+        REQUIRE( img.m_full == 1 );
+        REQUIRE( img.m_regions == 1 );
+    }
+}